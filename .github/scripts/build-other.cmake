@@ -110,7 +110,7 @@ if(ZSTD)
 					-DZSTD_BUILD_CONTRIB=off
 					-DZSTD_BUILD_DECOMPRESSION=on
 					-DZSTD_BUILD_DEPRECATED=off
-					-DZSTD_BUILD_DICTBUILDER=off
+					-DZSTD_BUILD_DICTBUILDER=on
 					-DZSTD_BUILD_PROGRAMS=off
 					-DZSTD_BUILD_SHARED=off
 					-DZSTD_BUILD_STATIC=on
@@ -37,7 +37,7 @@ else()
     endif()
 endif()
 
-if(CLIENT OR TOOLS)
+if(CLIENT OR TOOLS OR SERVER_THUMBNAILS)
     if(NOT EMSCRIPTEN)
         if(PKGCONFIG_FOUND)
             pkg_check_modules(LIBSWSCALE IMPORTED_TARGET GLOBAL
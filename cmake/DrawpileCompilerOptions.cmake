@@ -17,6 +17,11 @@ if(EMSCRIPTEN)
     # This flag is required when compiling all objects or linking will fail
     # when --shared-memory is used, which it is implicitly
     add_compile_options(-pthread)
+	# There's no runtime detection for SIMD in WebAssembly, since a module that
+	# uses it just fails to load in browsers that don't support it.
+	if(USE_WASM_SIMD)
+		add_compile_options(-msimd128)
+	endif()
 	# Extensions are required on Emscripten for EM_ASM to work.
 	set(CMAKE_C_EXTENSIONS ON)
 	set(CMAKE_CXX_EXTENSIONS ON)
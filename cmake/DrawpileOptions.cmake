@@ -39,6 +39,11 @@ if(NOT ANDROID AND NOT EMSCRIPTEN)
 	cmake_dependent_option(SERVERGUI "Enable server GUI" ON "SERVER" OFF)
 	add_feature_info("Server GUI (SERVERGUI)" SERVERGUI "")
 
+	cmake_dependent_option(
+		SERVER_THUMBNAILS "Render session thumbnails on the dedicated server"
+		OFF "SERVER" OFF)
+	add_feature_info("Server-side thumbnails (SERVER_THUMBNAILS)" SERVER_THUMBNAILS "")
+
 	cmake_dependent_option(
 		TOOLS "Command-line tools" OFF "CARGO_COMMAND" OFF)
 	add_feature_info("Command-line tools, requires Rust (TOOLS)" TOOLS "")
@@ -85,6 +90,11 @@ if(NOT MSVC AND NOT EMSCRIPTEN)
 	add_feature_info("Non-portable optimizations (ENABLE_ARCH_NATIVE)" ENABLE_ARCH_NATIVE "")
 endif()
 
+if(EMSCRIPTEN)
+	option(USE_WASM_SIMD "Use WebAssembly SIMD instructions, requires a browser that supports them" OFF)
+	add_feature_info("WebAssembly SIMD (USE_WASM_SIMD)" USE_WASM_SIMD "")
+endif()
+
 option(DIST_BUILD "Build for stand-alone distribution")
 add_feature_info("Distribution build (DIST_BUILD)" DIST_BUILD "")
 
@@ -3,4 +3,6 @@ package net.drawpile.android;
 
 public class DrawpileNative {
     public static native void processEvents();
+
+    public static native void trimMemory(int level);
 }
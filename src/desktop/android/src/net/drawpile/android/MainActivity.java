@@ -27,6 +27,33 @@ public class MainActivity extends QtActivity {
         super.onCreate(savedInstanceState);
     }
 
+    @Override
+    public void onTrimMemory(int level) {
+        super.onTrimMemory(level);
+        // Moderate pressure or the UI merely being hidden isn't worth throwing
+        // away caches for, anything else means we're in danger of getting killed.
+        if (level == TRIM_MEMORY_RUNNING_LOW || level == TRIM_MEMORY_RUNNING_CRITICAL
+                || level >= TRIM_MEMORY_BACKGROUND) {
+            trimNativeMemory(level);
+        }
+    }
+
+    @Override
+    public void onLowMemory() {
+        super.onLowMemory();
+        trimNativeMemory(TRIM_MEMORY_COMPLETE);
+    }
+
+    private void trimNativeMemory(int level) {
+        Log.i(TAG, "Trim memory at level " + level);
+        try {
+            DrawpileNative.trimMemory(level);
+        } catch (UnsatisfiedLinkError e) {
+            // Native library isn't loaded yet, so there's nothing to trim.
+            Log.w(TAG, "Unable to trim native memory", e);
+        }
+    }
+
     public boolean createConnectionNotificationChannel() {
         if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.O && connectionNotificationChannel == null) {
             Log.i(TAG, "createConnectionNotificationChannel");
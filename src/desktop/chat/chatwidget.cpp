@@ -24,6 +24,7 @@
 #include <QTabBar>
 #include <QTextBlock>
 #include <QTextBrowser>
+#include <QTextFrame>
 #include <QVBoxLayout>
 #ifdef HAVE_CHAT_LINE_EDIT_MOBILE
 #	include "desktop/chat/chatlineeditmobile.h"
@@ -36,10 +37,18 @@
 namespace widgets {
 
 struct Chat {
+	// Every message and separator is a table in its own frame. Long sessions
+	// would pile up tens of thousands of them, making each append and relayout
+	// slower, so the oldest ones get dropped beyond this limit. Checking the
+	// count isn't free either, so this is only done every so often.
+	static constexpr int MAX_SCROLLBACK_FRAMES = 5000;
+	static constexpr int SCROLLBACK_TRIM_INTERVAL = 100;
+
 	QTextDocument *doc;
 	int lastAppendedId = 0;
 	qint64 lastMessageTs = 0;
 	int scrollPosition = 0;
+	int appendsSinceTrim = 0;
 
 	Chat()
 		: doc(nullptr)
@@ -81,6 +90,7 @@ struct Chat {
 	void appendAction(const QString &usernameSpan, const QString &message);
 	void appendRoll(const QString &message);
 	void appendNotification(const QString &message);
+	void trimScrollback();
 };
 
 struct ChatWidget::Private {
@@ -138,6 +148,16 @@ struct ChatWidget::Private {
 		}
 	}
 
+	// Trimming shifts the content up, which would make the view jump if the
+	// user is scrolled up reading something. So that's put off until they're
+	// back at the bottom.
+	void trimChat(int chatId, bool wasAtEnd)
+	{
+		if(wasAtEnd || chatId != currentChat) {
+			chats[chatId].trimScrollback();
+		}
+	}
+
 	void scrollToEnd()
 	{
 		view->verticalScrollBar()->setValue(
@@ -628,6 +648,25 @@ void Chat::appendNotification(const QString &message)
 						  .arg(htmlutils::newlineToBr(message), timestamp()));
 }
 
+void Chat::trimScrollback()
+{
+	if(++appendsSinceTrim < SCROLLBACK_TRIM_INTERVAL) {
+		return;
+	}
+	appendsSinceTrim = 0;
+
+	const QList<QTextFrame *> frames = doc->rootFrame()->childFrames();
+	int excess = frames.size() - MAX_SCROLLBACK_FRAMES;
+	if(excess > 0) {
+		// Cut right before the first frame to keep, so that no table gets
+		// split in half.
+		QTextCursor cursor(doc);
+		cursor.setPosition(
+			frames[excess]->firstPosition() - 1, QTextCursor::KeepAnchor);
+		cursor.removeSelectedText();
+	}
+}
+
 void ChatWidget::userJoined(int id, const QString &name)
 {
 	Q_UNUSED(name);
@@ -666,11 +705,13 @@ void ChatWidget::userJoined(int id, const QString &name)
 	bool wasAtEnd = d->isAtEnd();
 
 	d->publicChat().appendNotification(msg);
+	d->trimChat(0, wasAtEnd);
 	if(wasAtEnd)
 		d->scrollChatToEnd(0);
 
 	if(d->chats.contains(id)) {
 		d->chats[id].appendNotification(msg);
+		d->trimChat(id, wasAtEnd);
 		if(wasAtEnd)
 			d->scrollChatToEnd(id);
 	}
@@ -685,11 +726,13 @@ void ChatWidget::userParted(int id)
 	bool wasAtEnd = d->isAtEnd();
 
 	d->publicChat().appendNotification(msg);
+	d->trimChat(0, wasAtEnd);
 	if(wasAtEnd)
 		d->scrollChatToEnd(0);
 
 	if(d->chats.contains(id)) {
 		d->chats[id].appendNotification(msg);
+		d->trimChat(id, wasAtEnd);
 		if(wasAtEnd)
 			d->scrollChatToEnd(id);
 	}
@@ -779,6 +822,7 @@ void ChatWidget::receiveMessage(
 		notifySanitize(event, message);
 	}
 
+	d->trimChat(chatId, wasAtEnd || isValidAlert);
 	if(wasAtEnd || isValidAlert) {
 		d->scrollChatToEnd(chatId);
 	}
@@ -826,6 +870,7 @@ void ChatWidget::receiveSystemMessage(const QString &message, int type)
 		alert ? notification::Event::PrivateChat : notification::Event::Chat;
 	notifySanitize(event, message);
 
+	d->trimChat(0, wasAtEnd || alert);
 	if(wasAtEnd || alert) {
 		d->scrollChatToEnd(0);
 	}
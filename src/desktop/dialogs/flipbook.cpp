@@ -10,6 +10,7 @@ extern "C" {
 #include "desktop/utils/widgetutils.h"
 #include "libclient/canvas/paintengine.h"
 #include "libclient/drawdance/viewmode.h"
+#include "libshared/util/qtcompat.h"
 #include "ui_flipbook.h"
 #include <QAction>
 #include <QEvent>
@@ -18,11 +19,18 @@ extern "C" {
 #include <QPixmap>
 #include <QRect>
 #include <QScreen>
+#include <QSet>
 #include <QSignalBlocker>
 #include <QTimer>
+#include <limits>
 
 namespace dialogs {
 
+// Rendered frames are kept within this many bytes. If the animation doesn't
+// fit, the frames furthest ahead of the playhead get dropped and are fetched
+// again when playback gets closer to them.
+static constexpr qint64 FRAME_CACHE_BUDGET = qint64(1024) * 1024 * 1024;
+
 struct Flipbook::Private {
 	State &state;
 	Ui_Flipbook ui;
@@ -34,6 +42,12 @@ struct Flipbook::Private {
 	drawdance::ViewModeBuffer vmb;
 	utils::AnimationRenderer *animationRenderer;
 	QHash<int, QPixmap> frames;
+	QSet<int> pendingFrames;
+	drawdance::CanvasState renderedCanvasState;
+	QRect renderedCrop;
+	QSize renderedMaxSize;
+	qint64 frameBytes = 0;
+	bool framesDropped = false;
 	QTimer timer;
 	QRect crop;
 	unsigned int batchId = 0;
@@ -306,12 +320,43 @@ int Flipbook::getTimerInterval() const
 
 void Flipbook::renderFrames()
 {
-	d->frames.clear();
+	QSize maxSize = compat::widgetScreen(*this)->availableSize() * 0.9;
+	int frameCount = d->canvasState.isNull() ? 0 : d->canvasState.frameCount();
+
+	// Frames rendered at the same size whose content didn't change since can
+	// be kept, so a refresh only has to render what was actually touched.
+	bool keep = !d->renderedCanvasState.isNull() &&
+				!d->canvasState.isNull() && d->renderedCrop == d->crop &&
+				d->renderedMaxSize == maxSize;
+	QSet<int> keptFrames;
+	QHash<int, QPixmap>::iterator it = d->frames.begin();
+	while(it != d->frames.end()) {
+		int i = it.key();
+		if(keep && i < frameCount &&
+		   d->canvasState.sameFrameContent(d->renderedCanvasState, i)) {
+			keptFrames.insert(i);
+			++it;
+		} else {
+			d->frameBytes -= getPixmapBytes(it.value());
+			it = d->frames.erase(it);
+		}
+	}
+
+	d->renderedCanvasState = d->canvasState;
+	d->renderedCrop = d->crop;
+	d->renderedMaxSize = maxSize;
+	d->framesDropped = false;
+	d->pendingFrames.clear();
+	for(int i = 0; i < frameCount; ++i) {
+		if(!keptFrames.contains(i)) {
+			d->pendingFrames.insert(i);
+		}
+	}
+
 	d->batchId = d->animationRenderer->render(
-		d->canvasState, d->crop,
-		compat::widgetScreen(*this)->availableSize() * 0.9,
-		d->ui.loopStart->value() - 1, d->ui.loopEnd->value(),
-		d->ui.layerIndex->value() - 1);
+		d->canvasState, d->crop, maxSize, d->ui.loopStart->value() - 1,
+		d->ui.loopEnd->value(), d->ui.layerIndex->value() - 1, keptFrames);
+	loadFrame();
 }
 
 void Flipbook::insertRenderedFrames(
@@ -322,8 +367,8 @@ void Flipbook::insertRenderedFrames(
 		int current = d->ui.layerIndex->value() - 1;
 		bool containsCurrent = false;
 		for(int i : frameIndexes) {
-			d->frames[i] = frame;
-			if(i == current) {
+			d->pendingFrames.remove(i);
+			if(insertFrame(i, frame) && i == current) {
 				containsCurrent = true;
 			}
 		}
@@ -333,6 +378,108 @@ void Flipbook::insertRenderedFrames(
 	}
 }
 
+qint64 Flipbook::getPixmapBytes(const QPixmap &pixmap)
+{
+	return qint64(pixmap.width()) * qint64(pixmap.height()) *
+		   qint64(qMax(1, pixmap.depth() / 8));
+}
+
+int Flipbook::getPlaybackDistance(int frameIndex) const
+{
+	// How many steps of playback it takes to get to the given frame. Frames
+	// outside of the loop never come up, so they're the furthest away.
+	int start = d->ui.loopStart->value() - 1;
+	int end = d->ui.loopEnd->value() - 1;
+	if(frameIndex < start || frameIndex > end) {
+		return std::numeric_limits<int>::max();
+	} else {
+		int current = d->ui.layerIndex->value() - 1;
+		int length = end - start + 1;
+		return ((frameIndex - current) % length + length) % length;
+	}
+}
+
+bool Flipbook::insertFrame(int frameIndex, const QPixmap &frame)
+{
+	qint64 bytes = getPixmapBytes(frame);
+	QHash<int, QPixmap>::iterator found = d->frames.find(frameIndex);
+	if(found != d->frames.end()) {
+		d->frameBytes -= getPixmapBytes(found.value());
+		d->frames.erase(found);
+	}
+
+	int distance = getPlaybackDistance(frameIndex);
+	while(d->frameBytes + bytes > FRAME_CACHE_BUDGET && !d->frames.isEmpty()) {
+		QHash<int, QPixmap>::iterator furthest = d->frames.end();
+		int furthestDistance = -1;
+		for(QHash<int, QPixmap>::iterator it = d->frames.begin(),
+										  end = d->frames.end();
+			it != end; ++it) {
+			int itDistance = getPlaybackDistance(it.key());
+			if(itDistance > furthestDistance) {
+				furthest = it;
+				furthestDistance = itDistance;
+			}
+		}
+		d->framesDropped = true;
+		if(furthestDistance <= distance) {
+			return false; // The new frame is the one needed last, drop it.
+		}
+		d->frameBytes -= getPixmapBytes(furthest.value());
+		d->frames.erase(furthest);
+	}
+
+	d->frames.insert(frameIndex, frame);
+	d->frameBytes += bytes;
+	return true;
+}
+
+void Flipbook::prefetchFrames()
+{
+	// If everything fit into the cache, there's nothing left to fetch.
+	if(!d->framesDropped || d->canvasState.isNull()) {
+		return;
+	}
+
+	// Otherwise the cache holds about this many frames. Once something within
+	// half of that ahead of the playhead is missing, request the next window,
+	// so that rendering stays ahead of playback without rendering frames that
+	// would just get dropped again.
+	int start = d->ui.loopStart->value() - 1;
+	int end = d->ui.loopEnd->value() - 1;
+	int length = end - start + 1;
+	if(length <= 0) {
+		return;
+	}
+	int current = d->ui.layerIndex->value() - 1;
+	int window = qMin(length, qMax(2, compat::cast_6<int>(d->frames.size())));
+	bool needed = false;
+	for(int step = 0; step < window / 2 && !needed; ++step) {
+		int i = start + (current - start + step) % length;
+		needed = !d->frames.contains(i) && !d->pendingFrames.contains(i);
+	}
+	if(!needed) {
+		return;
+	}
+
+	int frameCount = d->canvasState.frameCount();
+	QSet<int> skipFrames;
+	for(int i = 0; i < frameCount; ++i) {
+		skipFrames.insert(i);
+	}
+	d->pendingFrames.clear();
+	for(int step = 0; step < window; ++step) {
+		int i = start + (current - start + step) % length;
+		if(!d->frames.contains(i)) {
+			skipFrames.remove(i);
+			d->pendingFrames.insert(i);
+		}
+	}
+	d->batchId = d->animationRenderer->render(
+		d->canvasState, d->renderedCrop, d->renderedMaxSize, start, end + 1,
+		current, skipFrames);
+}
+
 void Flipbook::nextFrame()
 {
 	if(d->stalled) {
@@ -357,6 +504,7 @@ void Flipbook::loadFrame()
 		d->stalled = true;
 		d->ui.view->setLoading(true);
 	}
+	prefetchFrames();
 }
 
 QRect Flipbook::getExportRect() const
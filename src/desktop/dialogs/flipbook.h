@@ -63,6 +63,10 @@ private:
 	void updateSpeedSuffix();
 	int getTimerInterval() const;
 	void renderFrames();
+	static qint64 getPixmapBytes(const QPixmap &pixmap);
+	int getPlaybackDistance(int frameIndex) const;
+	bool insertFrame(int frameIndex, const QPixmap &frame);
+	void prefetchFrames();
 	QRect getExportRect() const;
 	int getExportStart() const;
 	int getExportEnd() const;
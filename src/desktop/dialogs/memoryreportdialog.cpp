@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpengine/memory_report.h>
+}
+#include "desktop/dialogs/memoryreportdialog.h"
+#include "desktop/utils/widgetutils.h"
+#include "libclient/canvas/canvasmodel.h"
+#include "libclient/canvas/paintengine.h"
+#include "libclient/document.h"
+#include <QDateTime>
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QLabel>
+#include <QLocale>
+#include <QPushButton>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+namespace dialogs {
+
+MemoryReportDialog::MemoryReportDialog(Document *doc, QWidget *parent)
+	: QDialog(parent)
+	, m_doc(doc)
+{
+	setWindowTitle(tr("Memory Report"));
+	QVBoxLayout *layout = new QVBoxLayout(this);
+
+	m_totalLabel = new QLabel;
+	m_totalLabel->setWordWrap(true);
+	layout->addWidget(m_totalLabel);
+
+	m_tree = new QTreeWidget;
+	m_tree->setHeaderLabels(
+		{tr("Source"), tr("Tiles"), tr("Unique"), tr("Shared")});
+	m_tree->setUniformRowHeights(true);
+	m_tree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	for(int i = 1; i < 4; ++i) {
+		m_tree->header()->setSectionResizeMode(
+			i, QHeaderView::ResizeToContents);
+	}
+	m_tree->header()->setStretchLastSection(false);
+	utils::bindKineticScrolling(m_tree);
+	layout->addWidget(m_tree, 1);
+
+	QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close);
+	m_refreshButton =
+		buttons->addButton(tr("Refresh"), QDialogButtonBox::ActionRole);
+	connect(
+		m_refreshButton, &QPushButton::clicked, this,
+		&MemoryReportDialog::refresh);
+	connect(
+		buttons, &QDialogButtonBox::rejected, this,
+		&MemoryReportDialog::reject);
+	layout->addWidget(buttons);
+
+	resize(600, 500);
+	refresh();
+}
+
+void MemoryReportDialog::refresh()
+{
+	canvas::CanvasModel *canvas = m_doc->canvas();
+	if(!canvas) {
+		m_tree->clear();
+		m_totalLabel->setText(tr("No canvas open."));
+		return;
+	}
+
+	// The canvas gets replaced when switching sessions, so connect to whatever
+	// the current one is and ignore reports from any previous ones.
+	canvas::PaintEngine *paintEngine = canvas->paintEngine();
+	connect(
+		paintEngine, &canvas::PaintEngine::memoryReportReady, this,
+		&MemoryReportDialog::setReport, Qt::UniqueConnection);
+	m_refreshButton->setEnabled(false);
+	m_totalLabel->setText(tr("Gathering memory usage…"));
+	paintEngine->requestMemoryReport();
+}
+
+void MemoryReportDialog::setReport(
+	const QSharedPointer<DP_MemoryReport> &report)
+{
+	canvas::CanvasModel *canvas = m_doc->canvas();
+	if(!canvas || canvas->paintEngine() != sender()) {
+		return;
+	}
+
+	m_refreshButton->setEnabled(true);
+	m_tree->clear();
+
+	DP_MemoryReport *mr = report.data();
+	DP_MemoryReportUsage total = DP_memory_report_total(mr);
+	m_totalLabel->setText(
+		tr("%1 distinct tiles, %2 in total. %3 is referenced by a single "
+		   "source, %4 is shared between multiple.")
+			.arg(QLocale().toString(qulonglong(total.tiles)))
+			.arg(formatDataSize(total.unique_bytes + total.shared_bytes))
+			.arg(formatDataSize(total.unique_bytes))
+			.arg(formatDataSize(total.shared_bytes)));
+
+	int sourceCount = DP_memory_report_source_count(mr);
+	for(int i = 0; i < sourceCount; ++i) {
+		const DP_MemoryReportSource *source =
+			DP_memory_report_source_at(mr, i);
+		QTreeWidgetItem *sourceItem = new QTreeWidgetItem(m_tree);
+		sourceItem->setText(0, getSourceName(source));
+		setUsageColumns(sourceItem, source->usage);
+
+		for(int j = 0; j < source->part_count; ++j) {
+			const DP_MemoryReportPart *part =
+				DP_memory_report_part_at(mr, i, j);
+			QTreeWidgetItem *partItem = new QTreeWidgetItem(sourceItem);
+			QString title = QString::fromUtf8(part->title ? part->title : "");
+			switch(part->type) {
+			case DP_MEMORY_REPORT_PART_LAYER:
+				partItem->setText(
+					0, tr("Layer %1: %2").arg(part->layer_id).arg(title));
+				break;
+			case DP_MEMORY_REPORT_PART_BACKGROUND:
+				partItem->setText(0, tr("Background"));
+				break;
+			case DP_MEMORY_REPORT_PART_SELECTION:
+				partItem->setText(0, tr("Selection %1").arg(part->layer_id));
+				break;
+			case DP_MEMORY_REPORT_PART_CACHE:
+				partItem->setText(0, title);
+				break;
+			}
+			setUsageColumns(partItem, part->usage);
+		}
+	}
+}
+
+QString
+MemoryReportDialog::getSourceName(const DP_MemoryReportSource *source) const
+{
+	switch(source->type) {
+	case DP_MEMORY_REPORT_SOURCE_CURRENT:
+		return tr("Current state");
+	case DP_MEMORY_REPORT_SOURCE_VIEW:
+		return tr("View");
+	case DP_MEMORY_REPORT_SOURCE_HISTORY:
+		return tr("History entry %1").arg(source->index);
+	case DP_MEMORY_REPORT_SOURCE_SNAPSHOT:
+		return tr("Snapshot from %1")
+			.arg(QLocale().toString(
+				QDateTime::fromMSecsSinceEpoch(source->index).time()));
+	case DP_MEMORY_REPORT_SOURCE_CACHE:
+		return tr("Render cache: %1").arg(QString::fromUtf8(source->name));
+	}
+	return QString();
+}
+
+void MemoryReportDialog::setUsageColumns(
+	QTreeWidgetItem *item, const DP_MemoryReportUsage &usage)
+{
+	item->setText(1, QLocale().toString(qulonglong(usage.tiles)));
+	item->setText(2, formatDataSize(usage.unique_bytes));
+	item->setText(3, formatDataSize(usage.shared_bytes));
+	for(int i = 1; i < 4; ++i) {
+		item->setTextAlignment(i, Qt::AlignRight | Qt::AlignVCenter);
+	}
+}
+
+QString MemoryReportDialog::formatDataSize(size_t bytes)
+{
+	return QLocale::c().formattedDataSize(qint64(bytes));
+}
+
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DESKTOP_DIALOGS_MEMORYREPORTDIALOG_H
+#define DESKTOP_DIALOGS_MEMORYREPORTDIALOG_H
+#include <QDialog>
+#include <QSharedPointer>
+
+struct DP_MemoryReport;
+struct DP_MemoryReportSource;
+struct DP_MemoryReportUsage;
+class Document;
+class QLabel;
+class QPushButton;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+namespace dialogs {
+
+// Shows how much tile memory the canvas, its undo history, the reset snapshots
+// and render caches use, split into what's unique to each of them and what's
+// shared with the others.
+class MemoryReportDialog final : public QDialog {
+	Q_OBJECT
+public:
+	MemoryReportDialog(Document *doc, QWidget *parent = nullptr);
+
+	void refresh();
+
+private:
+	void setReport(const QSharedPointer<DP_MemoryReport> &report);
+
+	QString getSourceName(const DP_MemoryReportSource *source) const;
+	static void setUsageColumns(
+		QTreeWidgetItem *item, const DP_MemoryReportUsage &usage);
+	static QString formatDataSize(size_t bytes);
+
+	Document *m_doc;
+	QLabel *m_totalLabel;
+	QTreeWidget *m_tree;
+	QPushButton *m_refreshButton;
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 extern "C" {
 #include <dpcommon/memory_pool.h>
 #include <dpengine/tile.h>
+#include <dpmsg/message.h>
 }
 
 #include "desktop/dialogs/netstats.h"
@@ -39,10 +40,36 @@ void NetStats::updateMemoryUsage()
 	size_t tileElementsUsed = tileElementsTotal - mps.el_free;
 	size_t tileBytesTotal = tileElementsTotal * mps.el_size;
 	size_t tileBytesUsed = tileElementsUsed * mps.el_size;
-	m_ui->tilesLabel->setText(
-		QStringLiteral("%1 / %2").arg(tileElementsUsed).arg(tileElementsTotal));
-	m_ui->tileMemoryLabel->setText(QStringLiteral("%1 / %2").arg(
-		formatDataSize(tileBytesUsed), formatDataSize(tileBytesTotal)));
+	DP_TileResidencyStatistics trs = DP_tile_residency_statistics();
+	if(trs.cold == 0) {
+		m_ui->tilesLabel->setText(QStringLiteral("%1 / %2")
+									  .arg(tileElementsUsed)
+									  .arg(tileElementsTotal));
+		m_ui->tileMemoryLabel->setText(QStringLiteral("%1 / %2").arg(
+			formatDataSize(tileBytesUsed), formatDataSize(tileBytesTotal)));
+	} else {
+		m_ui->tilesLabel->setText(QStringLiteral("%1 / %2 + %3")
+									  .arg(tileElementsUsed)
+									  .arg(tileElementsTotal)
+									  .arg(trs.cold));
+		m_ui->tileMemoryLabel->setText(QStringLiteral("%1 / %2 + %3").arg(
+			formatDataSize(tileBytesUsed), formatDataSize(tileBytesTotal),
+			formatDataSize(trs.cold_bytes)));
+	}
+
+	DP_MessageAllocationStatistics mas = DP_message_allocation_statistics();
+	if(mas.large == 0) {
+		m_ui->messagesLabel->setText(QStringLiteral("%1 / %2")
+										 .arg(mas.pooled)
+										 .arg(mas.pool_capacity));
+	} else {
+		m_ui->messagesLabel->setText(QStringLiteral("%1 / %2 + %3")
+										 .arg(mas.pooled)
+										 .arg(mas.pool_capacity)
+										 .arg(mas.large));
+	}
+	m_ui->messageMemoryLabel->setText(QStringLiteral("%1 / %2").arg(
+		formatDataSize(mas.pooled_bytes), formatDataSize(mas.pool_bytes)));
 
 	drawdance::DrawContextPoolStatistics dpcs =
 		drawdance::DrawContextPool::statistics();
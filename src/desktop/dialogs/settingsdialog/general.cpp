@@ -161,6 +161,11 @@ void General::initPerformance(
 		nullptr,
 		utils::formNote(tr(
 			"Enabling these options may impact performance on some systems.")));
+
+	auto *showPerformanceOverlay = new QCheckBox(
+		tr("Show frame timing and paint engine statistics on the canvas"));
+	settings.bindShowPerformanceOverlay(showPerformanceOverlay);
+	form->addRow(nullptr, showPerformanceOverlay);
 }
 
 void General::initSnapshots(
@@ -184,6 +189,18 @@ void General::initSnapshots(
 	snapshotIntervalLayout->setControlTypes(QSizePolicy::CheckBox);
 	form->addRow(nullptr, snapshotIntervalLayout);
 
+	auto *snapshotMaxMemory = new QSpinBox;
+	snapshotMaxMemory->setRange(0, 65536);
+	snapshotMaxMemory->setSingleStep(128);
+	//: Shown instead of 0 in "Use up to %1 MiB of memory for them".
+	snapshotMaxMemory->setSpecialValueText(tr("unlimited"));
+	settings.bindEngineSnapshotMaxMemory(snapshotMaxMemory);
+	settings.bindEngineSnapshotCount(snapshotMaxMemory, &QSpinBox::setEnabled);
+	auto *snapshotMaxMemoryLayout = utils::encapsulate(
+		tr("Use up to %1 MiB of memory for them"), snapshotMaxMemory);
+	snapshotMaxMemoryLayout->setControlTypes(QSizePolicy::CheckBox);
+	form->addRow(nullptr, snapshotMaxMemoryLayout);
+
 	form->addRow(
 		nullptr,
 		utils::formNote(
@@ -308,6 +308,9 @@ void LayerList::setCanvas(canvas::CanvasModel *canvas)
 	connect(
 		canvas->layerlist(), &canvas::LayerListModel::modelReset, this,
 		&LayerList::afterLayerReset);
+	connect(
+		canvas->layerlist(), &canvas::LayerListModel::layersUpdated, this,
+		&LayerList::afterLayerUpdate);
 	connect(
 		canvas->layerlist(), &canvas::LayerListModel::layerCheckStateToggled,
 		this, &LayerList::updateActionLabels);
@@ -1739,21 +1742,25 @@ dialogs::LayerProperties *LayerList::makeLayerPropertiesDialog(
 		connect(
 			dlg, &dialogs::LayerProperties::sketchModeChanged, this,
 			&LayerList::setLayerSketch);
+		auto updateDialog = [this, dlg]() {
+			QModelIndex newIndex =
+				m_canvas->layerlist()->layerIndex(dlg->layerId());
+			if(newIndex.isValid()) {
+				dlg->updateLayerItem(
+					newIndex.data().value<canvas::LayerListItem>(),
+					layerCreatorName(dlg->layerId()),
+					newIndex.data(canvas::LayerListModel::IsDefaultRole)
+						.toBool());
+			} else {
+				dlg->deleteLater();
+			}
+		};
 		connect(
 			m_canvas->layerlist(), &canvas::LayerListModel::modelReset, dlg,
-			[this, dlg]() {
-				QModelIndex newIndex =
-					m_canvas->layerlist()->layerIndex(dlg->layerId());
-				if(newIndex.isValid()) {
-					dlg->updateLayerItem(
-						newIndex.data().value<canvas::LayerListItem>(),
-						layerCreatorName(dlg->layerId()),
-						newIndex.data(canvas::LayerListModel::IsDefaultRole)
-							.toBool());
-				} else {
-					dlg->deleteLater();
-				}
-			});
+			updateDialog);
+		connect(
+			m_canvas->layerlist(), &canvas::LayerListModel::layersUpdated, dlg,
+			updateDialog);
 	} else {
 		isOwnLayer = true;
 		connect(
@@ -1919,6 +1926,13 @@ void LayerList::afterLayerReset()
 	}
 }
 
+void LayerList::afterLayerUpdate()
+{
+	// The view keeps track of expanded groups and the selection by itself if
+	// the model didn't reset, but the current layer's controls may be stale.
+	updateCurrent(currentSelection());
+}
+
 bool LayerList::isGroupSelected() const
 {
 	QModelIndex idx = currentSelection();
@@ -121,6 +121,7 @@ signals:
 private:
 	void beforeLayerReset();
 	void afterLayerReset();
+	void afterLayerUpdate();
 
 	void onFeatureAccessChange(DP_Feature feature, bool canuse);
 
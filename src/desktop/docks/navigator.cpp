@@ -214,7 +214,14 @@ void NavigatorView::hideEvent(QHideEvent *event)
 	QWidget::hideEvent(event);
 	m_refreshTimer->stop();
 	if(m_model) {
-		m_model->paintEngine()->setRenderOutsideView(false);
+		canvas::PaintEngine *pe = m_model->paintEngine();
+		pe->setRenderOutsideView(false);
+		if(m_useTileCache) {
+			// No point in keeping the shrunk canvas up to date while hidden.
+			pe->withTileCache([](canvas::TileCache &tileCache) {
+				tileCache.setNavigatorSize(QSize());
+			});
+		}
 	}
 }
 
@@ -327,6 +334,7 @@ void NavigatorView::refreshFromTileCache(canvas::PaintEngine *pe)
 		QSize canvasSize = tileCache.size();
 		if(!canvasSize.isEmpty()) {
 			bool sizeChanged = refreshCacheSize(canvasSize);
+			tileCache.setNavigatorSize(m_cache.size());
 			bool tilesChanged =
 				tileCache.paintDirtyNavigatorTilesReset(m_refreshAll, m_cache);
 			changed = sizeChanged || tilesChanged;
@@ -13,6 +13,8 @@
 #include "dpcommon/platform_qt.h"
 #include "libclient/brushes/brushpresetmodel.h"
 #include "libclient/drawdance/global.h"
+#include "libclient/drawdance/perf.h"
+#include "libclient/utils/annotationrastercache.h"
 #include "libclient/utils/colorscheme.h"
 #include "libclient/utils/logging.h"
 #include "libclient/utils/statedatabase.h"
@@ -24,12 +26,14 @@
 #include <QIcon>
 #include <QLibraryInfo>
 #include <QMetaEnum>
+#include <QPixmapCache>
 #include <QRegularExpression>
 #include <QScreen>
 #include <QStyle>
 #include <QStyleFactory>
 #include <QSurfaceFormat>
 #include <QTabletEvent>
+#include <QTimer>
 #include <QTranslator>
 #include <QUrl>
 #include <QWidget>
@@ -38,7 +42,6 @@
 #if defined(Q_OS_MACOS)
 #	include "desktop/utils/macui.h"
 #	include "desktop/widgets/macmenu.h"
-#	include <QTimer>
 #elif defined(Q_OS_WIN)
 #	include "desktop/bundled/kis_tablet/kis_tablet_support_win.h"
 #	include "desktop/bundled/kis_tablet/kis_tablet_support_win8.h"
@@ -55,6 +58,8 @@
 #	include <QProcess>
 #endif
 
+#define DP_PERF_CONTEXT "startup"
+
 DrawpileApp::DrawpileApp(int &argc, char **argv)
 	: QApplication(argc, argv)
 	, m_settings(new desktop::settings::Settings(this))
@@ -106,6 +111,7 @@ DrawpileApp::~DrawpileApp()
 
 void DrawpileApp::initState()
 {
+	DP_PERF_SCOPE("state");
 	Q_ASSERT(!m_state);
 	Q_ASSERT(!m_recents);
 	m_state = new utils::StateDatabase{this};
@@ -357,6 +363,7 @@ void DrawpileApp::updateThemeIcons()
 
 void DrawpileApp::initTheme()
 {
+	DP_PERF_SCOPE("theme");
 	static QStringList defaultThemePaths{QIcon::themeSearchPaths()};
 
 	QStringList themePaths;
@@ -378,6 +385,7 @@ void DrawpileApp::initTheme()
 
 void DrawpileApp::initCanvasImplementation(const QString &arg)
 {
+	DP_PERF_SCOPE("canvas_implementation");
 	using libclient::settings::CanvasImplementation;
 	int canvasImplementation;
 	if(QStringLiteral("system").compare(arg, Qt::CaseInsensitive) == 0) {
@@ -403,6 +411,7 @@ void DrawpileApp::initCanvasImplementation(const QString &arg)
 
 void DrawpileApp::initInterface()
 {
+	DP_PERF_SCOPE("interface");
 	QFont font = QApplication::font();
 	int fontSize = m_settings->fontSize();
 	if(fontSize <= 0) {
@@ -443,6 +452,7 @@ int DrawpileApp::getCanvasImplementationFor(int canvasImplementation)
 
 void DrawpileApp::initBrushPresets()
 {
+	DP_PERF_SCOPE("brush_presets");
 	Q_ASSERT(!m_brushPresets);
 	m_brushPresets = new brushes::BrushPresetTagModel(this);
 }
@@ -614,6 +624,13 @@ void DrawpileApp::openPath(const QString &path, bool restoreWindowPosition)
 	acquireWindow(restoreWindowPosition, false)->openPath(path);
 }
 
+void DrawpileApp::profileReplay(
+	const QString &path, const utils::ReplayProfiler::Options &options,
+	bool restoreWindowPosition)
+{
+	acquireWindow(restoreWindowPosition, false)->profileReplay(path, options);
+}
+
 void DrawpileApp::joinUrl(
 	const QUrl &url, const QString &autoRecordPath, bool restoreWindowPosition,
 	bool singleSession)
@@ -698,6 +715,18 @@ void DrawpileApp::deleteAllMainWindowsExcept(MainWindow *win)
 	}
 }
 
+void DrawpileApp::trimMemory()
+{
+	QPixmapCache::clear();
+	utils::AnnotationRasterCache::global().clear();
+	for(QWidget *widget : topLevelWidgets()) {
+		MainWindow *mw = qobject_cast<MainWindow *>(widget);
+		if(mw) {
+			mw->trimMemory();
+		}
+	}
+}
+
 static QStringList gatherPotentialLanguages(const QLocale &locale)
 {
 	QStringList langs;
@@ -718,6 +747,7 @@ static QStringList gatherPotentialLanguages(const QLocale &locale)
 
 static void initTranslations(DrawpileApp &app, const QLocale &locale)
 {
+	DP_PERF_SCOPE("translations");
 	QTranslator *translator = new QTranslator{&app};
 	for(const QString &lang : gatherPotentialLanguages(locale)) {
 		QString filename = QStringLiteral("all_%1").arg(lang);
@@ -756,6 +786,8 @@ struct StartupOptions {
 	QString autoRecordPath;
 	QString joinUrl;
 	QString openPath;
+	QString profileReplayPath;
+	utils::ReplayProfiler::Options profileReplayOptions;
 	bool blank = false;
 	int blankWidth = 0;
 	int blankHeight = 0;
@@ -765,6 +797,7 @@ struct StartupOptions {
 // Initialize the application and return a list of files to be opened (if any)
 static StartupOptions initApp(DrawpileApp &app)
 {
+	DP_PERF_SCOPE("init_app");
 	// Parse command line arguments
 	QCommandLineParser parser;
 	parser.addHelpOption();
@@ -872,6 +905,40 @@ static StartupOptions initApp(DrawpileApp &app)
 		QStringLiteral("Disable native dialogs, like the file picker."));
 	parser.addOption(noNativeDialogs);
 
+	QCommandLineOption profileReplay(
+		QStringLiteral("profile-replay"),
+		QStringLiteral(
+			"Play back the given recording through the canvas, gather "
+			"performance statistics and then exit. Use the profile options "
+			"below to control it."),
+		QStringLiteral("path"));
+	parser.addOption(profileReplay);
+
+	QCommandLineOption profileSpeed(
+		QStringLiteral("profile-speed"),
+		QStringLiteral(
+			"Speed for --profile-replay as a multiplier of the recorded "
+			"timing, 0 plays back as fast as possible. Default is 1."),
+		QStringLiteral("speed"), QStringLiteral("1"));
+	parser.addOption(profileSpeed);
+
+	QCommandLineOption profileTrace(
+		QStringLiteral("profile-trace"),
+		QStringLiteral(
+			"Record a performance trace during --profile-replay. Paths ending "
+			"in .json or .json.gz are written in Chrome's trace event format, "
+			"anything else as a gzipped Drawpile profile."),
+		QStringLiteral("path"));
+	parser.addOption(profileTrace);
+
+	QCommandLineOption profileStats(
+		QStringLiteral("profile-stats"),
+		QStringLiteral(
+			"Write frame time and playback statistics from --profile-replay "
+			"to the given file as JSON instead of logging them."),
+		QStringLiteral("path"));
+	parser.addOption(profileStats);
+
 	// URL
 	parser.addPositionalArgument("url", "Filename or URL.");
 
@@ -996,6 +1063,22 @@ static StartupOptions initApp(DrawpileApp &app)
 	startupOptions.autoRecordPath = parser.value(autoRecord);
 	startupOptions.openPath = parser.value(open);
 	startupOptions.joinUrl = parser.value(join);
+	startupOptions.profileReplayPath = parser.value(profileReplay);
+	if(!startupOptions.profileReplayPath.isEmpty()) {
+		bool ok;
+		double speed = parser.value(profileSpeed).toDouble(&ok);
+		if(!ok) {
+			qCritical(
+				"Invalid --profile-speed '%s'",
+				qUtf8Printable(parser.value(profileSpeed)));
+			std::exit(EXIT_FAILURE);
+		}
+		startupOptions.profileReplayOptions.speed = speed;
+		startupOptions.profileReplayOptions.tracePath =
+			parser.value(profileTrace);
+		startupOptions.profileReplayOptions.statsPath =
+			parser.value(profileStats);
+	}
 	startupOptions.blank = parser.isSet(blank);
 	if(startupOptions.blank) {
 		QRegularExpression blankRe(
@@ -1144,7 +1227,13 @@ static QUrl buildJoinUrl(const QString &address)
 static void startApplication(DrawpileApp *app)
 {
 	StartupOptions startupOptions = initApp(*app);
-	if(!startupOptions.joinUrl.isEmpty()) {
+	DP_PERF_SCOPE("open_window");
+	if(!startupOptions.profileReplayPath.isEmpty()) {
+		app->profileReplay(
+			startupOptions.profileReplayPath,
+			startupOptions.profileReplayOptions,
+			startupOptions.restoreWindowPosition);
+	} else if(!startupOptions.joinUrl.isEmpty()) {
 		app->joinUrl(
 			buildJoinUrl(startupOptions.joinUrl), startupOptions.autoRecordPath,
 			startupOptions.restoreWindowPosition, startupOptions.singleSession);
@@ -1192,6 +1281,22 @@ Java_net_drawpile_android_DrawpileNative_processEvents(
 		qWarning("DrawpileNative::not suspended");
 	}
 }
+
+extern "C" JNIEXPORT void JNICALL
+Java_net_drawpile_android_DrawpileNative_trimMemory(
+	JNIEnv *env, jobject obj, jint level)
+{
+	Q_UNUSED(env);
+	Q_UNUSED(obj);
+	qInfo("Android asks to trim memory at level %d", int(level));
+	// This gets called on the Android UI thread, not on the Qt one.
+	DrawpileApp *app =
+		qobject_cast<DrawpileApp *>(QCoreApplication::instance());
+	if(app) {
+		QMetaObject::invokeMethod(
+			app, &DrawpileApp::trimMemory, Qt::QueuedConnection);
+	}
+}
 #endif
 
 
@@ -1274,6 +1379,14 @@ extern "C" void drawpileMain(int argc, char **argv)
 #endif
 	QSurfaceFormat::setDefaultFormat(format);
 
+	// Setting DRAWPILE_STARTUP_TRACE to a file path records how long each
+	// phase of startup takes, up until the event loop gets going.
+	QByteArray startupTracePath = qgetenv("DRAWPILE_STARTUP_TRACE");
+	if(!startupTracePath.isEmpty() &&
+	   !drawdance::Perf::open(QString::fromLocal8Bit(startupTracePath))) {
+		qWarning("Error opening startup trace: %s", DP_error());
+	}
+
 #ifdef __EMSCRIPTEN__
 	DrawpileApp *app = new DrawpileApp(argc, argv);
 #else
@@ -1283,6 +1396,11 @@ extern "C" void drawpileMain(int argc, char **argv)
 	DP_QT_LOCALE_RESET();
 
 	startApplication(app);
+	if(drawdance::Perf::isOpen()) {
+		QTimer::singleShot(0, app, [] {
+			drawdance::Perf::close();
+		});
+	}
 
 #ifndef __EMSCRIPTEN__
 	return app->exec();
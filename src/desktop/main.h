@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef DRAWPILEAPP_H
 #define DRAWPILEAPP_H
+#include "desktop/utils/replayprofiler.h"
 #include <QApplication>
 #include <QPair>
 #include <QPalette>
@@ -47,6 +48,9 @@ public:
 	void initBrushPresets();
 
 	void openPath(const QString &path, bool restoreWindowPosition);
+	void profileReplay(
+		const QString &path, const utils::ReplayProfiler::Options &options,
+		bool restoreWindowPosition);
 	void joinUrl(
 		const QUrl &url, const QString &autoRecordPath,
 		bool restoreWindowPosition, bool singleSession);
@@ -58,6 +62,9 @@ public:
 
 	void deleteAllMainWindowsExcept(MainWindow *win);
 
+	// Drops caches when the operating system tells us that memory is low.
+	void trimMemory();
+
 	const desktop::settings::Settings &settings() const { return *m_settings; }
 	desktop::settings::Settings &settings() { return *m_settings; }
 
@@ -11,6 +11,7 @@
 #include "desktop/dialogs/invitedialog.h"
 #include "desktop/dialogs/layoutsdialog.h"
 #include "desktop/dialogs/logindialog.h"
+#include "desktop/dialogs/memoryreportdialog.h"
 #include "desktop/dialogs/playbackdialog.h"
 #include "desktop/dialogs/resetdialog.h"
 #include "desktop/dialogs/resizedialog.h"
@@ -148,6 +149,8 @@ using std::placeholders::_2;
 using std::placeholders::_3;
 static constexpr int DEBOUNCE_MS = 250;
 
+#define DP_PERF_CONTEXT "main_window"
+
 // clang-format off
 
 MainWindow::MainWindow(bool restoreWindowPosition, bool singleSession)
@@ -201,6 +204,7 @@ MainWindow::MainWindow(bool restoreWindowPosition, bool singleSession)
 	  , m_exitAction(RUNNING)
 #endif
 {
+	DP_PERF_SCOPE("construct");
 	// Avoid flickering of intermediate states.
 	setUpdatesEnabled(false);
 
@@ -2682,7 +2686,8 @@ void MainWindow::exportAnimation(
 		path,
 #endif
 		format, size.width(), size.height(), loops, start, end, framerate,
-		effectiveCrop, scaleSmooth, canvasState, this);
+		effectiveCrop, scaleSmooth,
+		dpApp().settings().animationExportHardware(), canvasState, this);
 	saver->setAutoDelete(true);
 
 	connect(
@@ -2779,6 +2784,58 @@ void MainWindow::showSystemInfo()
 	dlg->raise();
 }
 
+void MainWindow::profileReplay(
+	const QString &path, const utils::ReplayProfiler::Options &options)
+{
+	bool isTemplate;
+	DP_LoadResult result = m_doc->loadRecording(path, false, &isTemplate);
+	if(result != DP_LOAD_RESULT_SUCCESS || isTemplate) {
+		qCritical(
+			"Can't profile replay of '%s': %s", qUtf8Printable(path),
+			result == DP_LOAD_RESULT_SUCCESS ? "session template" : DP_error());
+		// The event loop may not be running yet, so exit once it does.
+		QTimer::singleShot(0, qApp, [] {
+			QCoreApplication::exit(EXIT_FAILURE);
+		});
+		return;
+	}
+
+	utils::ReplayProfiler *profiler = new utils::ReplayProfiler(
+		m_doc->canvas()->paintEngine(), m_canvasView->viewWidget()->viewport(),
+		options, this);
+	connect(
+		profiler, &utils::ReplayProfiler::finished, this, [](bool success) {
+			QCoreApplication::exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+		});
+	// Give the window a chance to show and lay itself out first.
+	QTimer::singleShot(0, profiler, &utils::ReplayProfiler::start);
+}
+
+void MainWindow::trimMemory()
+{
+	canvas::CanvasModel *canvas = m_doc->canvas();
+	if(canvas) {
+		canvas->paintEngine()->trimMemory();
+	}
+}
+
+void MainWindow::showMemoryReport()
+{
+	dialogs::MemoryReportDialog *dlg =
+		findChild<dialogs::MemoryReportDialog *>(
+			"memoryreportdialog", Qt::FindDirectChildrenOnly);
+	if(dlg) {
+		dlg->refresh();
+	} else {
+		dlg = new dialogs::MemoryReportDialog(m_doc, this);
+		dlg->setObjectName("memoryreportdialog");
+		dlg->setAttribute(Qt::WA_DeleteOnClose);
+	}
+	utils::showWindow(dlg, shouldShowDialogMaximized());
+	dlg->activateWindow();
+	dlg->raise();
+}
+
 void MainWindow::toggleRecording()
 {
 	if(m_playbackDialog) {
@@ -3138,6 +3195,7 @@ void MainWindow::hostSession(const HostParams &params)
 			m_doc->client(), &net::Client::serverDisconnected, server,
 			&server::BuiltinServer::stop);
 		paintEngine->setServer(server);
+		m_doc->client()->setBuiltinServer(server);
 
 		if(server->port() != cmake_config::proto::port()) {
 			address.setPort(server->port());
@@ -6842,6 +6900,7 @@ void MainWindow::setupActions()
 #endif
 	QAction *openDebugDump = makeAction("opendebugdump", tr("Open Debug Dump...")).noDefaultShortcut();
 	QAction *showNetStats = makeAction("shownetstats", tr("Statistics…")).noDefaultShortcut();
+	QAction *memoryReport = makeAction("memoryreport", tr("Memory Report…")).noDefaultShortcut();
 	devtoolsmenu->addAction(systeminfo);
 	devtoolsmenu->addAction(tableteventlog);
 	devtoolsmenu->addAction(profile);
@@ -6850,6 +6909,7 @@ void MainWindow::setupActions()
 #endif
 	devtoolsmenu->addAction(openDebugDump);
 	devtoolsmenu->addAction(showNetStats);
+	devtoolsmenu->addAction(memoryReport);
 	connect(devtoolsmenu, &QMenu::aboutToShow, this, &MainWindow::updateDevToolsActions);
 	connect(systeminfo, &QAction::triggered, this, &MainWindow::showSystemInfo);
 	connect(tableteventlog, &QAction::triggered, this, &MainWindow::toggleTabletEventLog);
@@ -6859,6 +6919,7 @@ void MainWindow::setupActions()
 #endif
 	connect(openDebugDump, &QAction::triggered, this, &MainWindow::openDebugDump);
 	connect(showNetStats, &QAction::triggered, m_netstatus, &widgets::NetStatus::showNetStats);
+	connect(memoryReport, &QAction::triggered, this, &MainWindow::showMemoryReport);
 
 	// clang-format on
 	if(DrawpileApp::isEnvTrue("DRAWPILE_DEV_MODE")) {
@@ -6,6 +6,7 @@ extern "C" {
 }
 #include "desktop/dialogs/flipbook.h"
 #include "desktop/utils/hostparams.h"
+#include "desktop/utils/replayprofiler.h"
 #include "libclient/canvas/acl.h"
 #include "libclient/drawdance/canvasstate.h"
 #include "libclient/tools/tool.h"
@@ -102,6 +103,9 @@ public:
 	void openRecent(const QString &path, QTemporaryFile *tempFile = nullptr);
 	void openPath(const QString &path, QTemporaryFile *tempFile = nullptr);
 	void autoJoin(const QUrl &url, const QString &autoRecordPath);
+	// Plays back the given recording for profiling, then exits the application.
+	void profileReplay(
+		const QString &path, const utils::ReplayProfiler::Options &options);
 
 	void hostSession(const HostParams &params);
 
@@ -127,6 +131,9 @@ public:
 	void showPopupMessage(const QString &message);
 	void showPermissionDeniedMessage(int feature);
 
+	//! Release canvas memory that can be recreated, when the system runs low
+	void trimMemory();
+
 	bool notificationsMuted() const { return m_notificationsMuted; }
 	bool isInitialCatchup() const { return m_initialCatchup; }
 
@@ -204,6 +211,7 @@ public slots:
 
 private slots:
 	void showSystemInfo();
+	void showMemoryReport();
 	void toggleRecording();
 	void toggleProfile();
 	void toggleTabletEventLog();
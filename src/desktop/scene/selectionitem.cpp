@@ -37,7 +37,7 @@ void SelectionItem::setModel(const QSharedPointer<canvas::SelectionMask> &mask)
 		m_mask = mask;
 	} else {
 		m_mask.clear();
-		generateOutline(mask->image());
+		generateOutline(mask);
 	}
 }
 
@@ -62,7 +62,7 @@ void SelectionItem::setShowMask(bool showMask)
 	if(m_showMask != showMask) {
 		m_showMask = showMask;
 		if(!showMask && m_mask) {
-			generateOutline(m_mask->image());
+			generateOutline(m_mask);
 			m_mask.clear();
 		}
 		refresh();
@@ -129,10 +129,11 @@ void SelectionItem::paint(
 	}
 }
 
-void SelectionItem::generateOutline(const QImage &mask)
+void SelectionItem::generateOutline(
+	const QSharedPointer<canvas::SelectionMask> &mask)
 {
-	SelectionOutlineGenerator *gen =
-		new SelectionOutlineGenerator(m_executionId, mask, false, 0, 0);
+	SelectionOutlineGenerator *gen = new SelectionOutlineGenerator(
+		m_executionId, mask->content(), mask->bounds(), m_outlineCache);
 	connect(
 		this, &SelectionItem::outlineRegenerating, gen,
 		&SelectionOutlineGenerator::cancel, Qt::DirectConnection);
@@ -148,6 +149,7 @@ void SelectionItem::setOutline(
 {
 	if(m_executionId == executionId) {
 		m_path = path.value;
+		m_outlineCache = path.cache;
 		refresh();
 	}
 }
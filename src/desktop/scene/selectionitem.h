@@ -6,6 +6,7 @@
 #include <QImage>
 #include <QPainterPath>
 
+struct SelectionOutlineCache;
 struct SelectionOutlinePath;
 
 namespace drawdance {
@@ -46,7 +47,7 @@ protected:
 		QWidget *widget) override;
 
 private:
-	void generateOutline(const QImage &mask);
+	void generateOutline(const QSharedPointer<canvas::SelectionMask> &mask);
 	void setOutline(unsigned int executionId, const SelectionOutlinePath &path);
 	void updateBoundingRectFromBounds();
 
@@ -54,6 +55,8 @@ private:
 	QRect m_bounds;
 	QSharedPointer<canvas::SelectionMask> m_mask;
 	QPainterPath m_path;
+	// Edges of the last outline, the next one only retraces what changed.
+	QSharedPointer<const SelectionOutlineCache> m_outlineCache;
 	qreal m_zoom;
 	qreal m_marchingAnts = 0.0;
 	qreal m_transparentDelay = 0.0;
@@ -110,6 +110,7 @@ SETTING_GETSET_V(
 	any::getExactVersion, &any::set)
 #endif
 SETTING(animationExportFormat     , AnimationExportFormat     , "animationexport/format"                , int(-1))
+SETTING(animationExportHardware   , AnimationExportHardware   , "animationexport/hardware"              , true)
 SETTING(automaticAlphaPreserve    , AutomaticAlphaPreserve    , "settings/automaticalphapreserve"       , int(1))
 SETTING_GETSET_V(
 	V1, brushCursor               , BrushCursor               , "settings/brushcursor"                  , int(view::Cursor::TriangleRight),
@@ -300,6 +301,7 @@ SETTING(shareBrushSlotColor       , ShareBrushSlotColor       , "settings/shareb
 SETTING(shortcuts                 , Shortcuts                 , "settings/shortcuts"                    , QVariantMap())
 SETTING(showInviteDialogOnHost    , ShowInviteDialogOnHost    , "invites/showdialogonhost"              , true)
 SETTING(showNsfmWarningOnJoin     , ShowNsfmWarningOnJoin     , "pc/shownsfmwarningonjoin"              , true)
+SETTING(showPerformanceOverlay    , ShowPerformanceOverlay    , "settings/render/performanceoverlay"    , false)
 SETTING(showTransformNotices      , ShowTransformNotices      , "settings/showtransformnotices"         , true)
 SETTING(showTrayIcon              , ShowTrayIcon              , "ui/trayicon"                           , true)
 SETTING(soundVolume               , SoundVolume               , "notifications/volume"                  , 60)
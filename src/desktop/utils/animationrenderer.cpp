@@ -9,6 +9,7 @@ extern "C" {
 #include <QImage>
 #include <QPixmap>
 #include <QRect>
+#include <algorithm>
 
 namespace utils {
 
@@ -58,12 +59,12 @@ AnimationRenderer::~AnimationRenderer()
 unsigned int AnimationRenderer::render(
 	const drawdance::CanvasState &canvasState, const QRect &crop,
 	const QSize &maxSize, int rangeStart, int rangeEndExclusive,
-	int currentRangeIndex)
+	int currentRangeIndex, const QSet<int> &skipFrameIndexes)
 {
 	unsigned int batchId = ++m_batchId;
 	QVector<int> indexes = buildFrameOrder(
 		canvasState.frameCount(), rangeStart, rangeEndExclusive,
-		currentRangeIndex);
+		currentRangeIndex, skipFrameIndexes);
 	QVector<int> frameIndexBuffer;
 	while(!indexes.isEmpty()) {
 		gatherFrame(canvasState, indexes, frameIndexBuffer);
@@ -100,7 +101,7 @@ void AnimationRenderer::detachDelete()
 
 QVector<int> AnimationRenderer::buildFrameOrder(
 	int frameCount, int rangeStart, int rangeEndExclusive,
-	int currentRangeIndex)
+	int currentRangeIndex, const QSet<int> &skipFrameIndexes)
 {
 	// We build the frames in priority order. Stuff that's in the user's
 	// selected frame range is more important than what's outside of it, frames
@@ -130,6 +131,15 @@ QVector<int> AnimationRenderer::buildFrameOrder(
 		Q_ASSERT(!indexes.contains(i));
 		indexes.append(i);
 	}
+	if(!skipFrameIndexes.isEmpty()) {
+		indexes.erase(
+			std::remove_if(
+				indexes.begin(), indexes.end(),
+				[&skipFrameIndexes](int i) {
+					return skipFrameIndexes.contains(i);
+				}),
+			indexes.end());
+	}
 	return indexes;
 }
 
@@ -6,6 +6,7 @@ extern "C" {
 }
 #include <QAtomicInteger>
 #include <QObject>
+#include <QSet>
 #include <QVector>
 
 class QRect;
@@ -29,10 +30,12 @@ public:
 	AnimationRenderer &operator=(const AnimationRenderer &) = delete;
 	AnimationRenderer &operator=(AnimationRenderer &&) = delete;
 
+	// Frames in skipFrameIndexes aren't rendered, because the caller still
+	// has them from a previous batch.
 	unsigned int render(
 		const drawdance::CanvasState &canvasState, const QRect &crop,
 		const QSize &maxSize, int rangeStart, int rangeEndExclusive,
-		int currentRangeIndex);
+		int currentRangeIndex, const QSet<int> &skipFrameIndexes);
 
 	// Asynchronous destruction without waiting for running jobs. Orphans this,
 	// cancels current batch and enqueues a job that calls deleteLater.
@@ -50,7 +53,7 @@ private:
 
 	static QVector<int> buildFrameOrder(
 		int frameCount, int rangeStart, int rangeEndExclusive,
-		int currentRangeIndex);
+		int currentRangeIndex, const QSet<int> &skipFrameIndexes);
 
 	static void gatherFrame(
 		const drawdance::CanvasState &canvasState, QVector<int> &indexes,
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DESKTOP_UTILS_EVENTTIMESTAMP_H
+#define DESKTOP_UTILS_EVENTTIMESTAMP_H
+#include <QDateTime>
+#include <QInputEvent>
+
+// Maps input event timestamps onto the wall clock that strokes are timed by.
+// Using the time the event is handled instead breaks down when the GUI thread
+// stalls, since all the events that piled up in the meantime get the same
+// time, which throws off speed-dependent brush dynamics and stabilization.
+//
+// Event timestamps have an arbitrary, platform-dependent origin, so the offset
+// to the wall clock is estimated as the smallest difference seen, which is the
+// one with the least delivery lag. This keeps the resulting times monotonic
+// and never ahead of the current time. Each kind of input device should get
+// its own instance, since their timestamps may not share the same origin.
+class EventTimestamp {
+public:
+	long long msecsSinceEpoch(const QInputEvent *event)
+	{
+		long long now = QDateTime::currentMSecsSinceEpoch();
+		long long timestamp = static_cast<long long>(event->timestamp());
+		if(timestamp <= 0) {
+			return now;
+		}
+
+		// If the events lag behind by way too much, the clock probably jumped
+		// or the timestamps started coming from a different source.
+		long long offset = now - timestamp;
+		if(!m_valid || offset < m_offset || offset - m_offset > MAX_LAG_MSEC) {
+			m_offset = offset;
+			m_valid = true;
+		}
+		return timestamp + m_offset;
+	}
+
+private:
+	static constexpr long long MAX_LAG_MSEC = 1000;
+	long long m_offset = 0;
+	bool m_valid = false;
+};
+
+#endif
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/common.h>
+}
+#include "desktop/utils/replayprofiler.h"
+#include "libclient/canvas/paintengine.h"
+#include "libclient/drawdance/perf.h"
+#include <QEvent>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QWidget>
+#include <algorithm>
+#include <cmath>
+
+namespace utils {
+
+// Same pacing as the playback dialog, so that recorded timing behaves the same
+// way as when the user plays back the recording.
+static constexpr double PLAY_FPS = 30.0;
+static constexpr double PLAY_MSECS = 1000.0 / PLAY_FPS;
+static constexpr double PLAY_MSECS_MAX = 100.0;
+// When playing as fast as possible, this many messages are handed over at once.
+static constexpr long long FAST_STEP_MESSAGES = 100;
+
+ReplayProfiler::ReplayProfiler(
+	canvas::PaintEngine *paintEngine, QWidget *viewport,
+	const Options &options, QObject *parent)
+	: QObject(parent)
+	, m_paintEngine(paintEngine)
+	, m_viewport(viewport)
+	, m_options(options)
+	, m_playTimer(new QTimer(this))
+{
+	m_playTimer->setTimerType(Qt::PreciseTimer);
+	m_playTimer->setSingleShot(true);
+	connect(m_playTimer, &QTimer::timeout, this, [this]() {
+		playNext(qMin(PLAY_MSECS_MAX, double(m_stepTime.elapsed())));
+	});
+	connect(
+		m_paintEngine, &canvas::PaintEngine::playbackAt, this,
+		&ReplayProfiler::onPlaybackAt, Qt::QueuedConnection);
+}
+
+void ReplayProfiler::start()
+{
+	if(!m_options.tracePath.isEmpty() &&
+	   !drawdance::Perf::open(m_options.tracePath)) {
+		qCritical(
+			"Error opening performance trace '%s': %s",
+			qUtf8Printable(m_options.tracePath), DP_error());
+		finish(false);
+		return;
+	}
+
+	DP_PlayerResult result = m_paintEngine->beginPlayback();
+	if(isErrorResult(result)) {
+		qCritical("Error starting playback: %s", DP_error());
+		finish(false);
+		return;
+	}
+
+	m_running = true;
+	m_viewport->installEventFilter(this);
+	m_totalTime.start();
+	m_frameTime.invalidate();
+	playNext(PLAY_MSECS);
+}
+
+bool ReplayProfiler::eventFilter(QObject *watched, QEvent *event)
+{
+	if(watched == m_viewport && event->type() == QEvent::Paint) {
+		if(m_frameTime.isValid()) {
+			m_frameIntervals.values.append(m_frameTime.nsecsElapsed() / 1.0e6);
+		}
+		m_frameTime.start();
+	}
+	return QObject::eventFilter(watched, event);
+}
+
+void ReplayProfiler::onPlaybackAt(long long pos)
+{
+	if(!m_running) {
+		return;
+	}
+
+	m_stepLatencies.values.append(m_stepTime.nsecsElapsed() / 1.0e6);
+	if(pos < 0) {
+		finish(true);
+	} else if(m_options.speed <= 0.0) {
+		playNext(0.0);
+	} else {
+		double elapsed = m_stepTime.elapsed();
+		if(elapsed < PLAY_MSECS) {
+			m_playTimer->start(qRound(PLAY_MSECS - elapsed));
+		} else {
+			playNext(qMin(PLAY_MSECS_MAX, elapsed));
+		}
+	}
+}
+
+void ReplayProfiler::playNext(double msecs)
+{
+	m_stepTime.start();
+	DP_PlayerResult result =
+		m_options.speed <= 0.0
+			? m_paintEngine->stepPlayback(FAST_STEP_MESSAGES)
+			: m_paintEngine->playPlayback(qRound(msecs * m_options.speed));
+	if(isErrorResult(result)) {
+		qCritical("Error during playback: %s", DP_error());
+		finish(false);
+	}
+}
+
+void ReplayProfiler::finish(bool success)
+{
+	m_running = false;
+	m_playTimer->stop();
+	m_viewport->removeEventFilter(this);
+
+	if(drawdance::Perf::isOpen() && !drawdance::Perf::close()) {
+		qCritical("Error closing performance trace: %s", DP_error());
+		success = false;
+	}
+
+	if(success && !writeStats()) {
+		success = false;
+	}
+
+	emit finished(success);
+}
+
+bool ReplayProfiler::writeStats()
+{
+	double totalMsecs = m_totalTime.nsecsElapsed() / 1.0e6;
+	double frameCount = m_frameIntervals.values.size() + 1;
+	double fps = totalMsecs > 0.0 ? frameCount / totalMsecs * 1000.0 : 0.0;
+
+	if(m_options.statsPath.isEmpty()) {
+		qInfo("Total: %.3f ms, %.2f frames per second", totalMsecs, fps);
+		qInfo(
+			"Frame intervals (ms): %s",
+			qUtf8Printable(m_frameIntervals.toString()));
+		qInfo(
+			"Playback step latencies (ms): %s",
+			qUtf8Printable(m_stepLatencies.toString()));
+		return true;
+	}
+
+	QJsonObject stats = {
+		{QStringLiteral("speed"), m_options.speed},
+		{QStringLiteral("total_ms"), totalMsecs},
+		{QStringLiteral("fps"), fps},
+		{QStringLiteral("frame_intervals_ms"), m_frameIntervals.toJson()},
+		{QStringLiteral("step_latencies_ms"), m_stepLatencies.toJson()},
+	};
+	QFile file(m_options.statsPath);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+	   file.write(QJsonDocument(stats).toJson()) < 0) {
+		qCritical(
+			"Error writing statistics to '%s': %s",
+			qUtf8Printable(m_options.statsPath),
+			qUtf8Printable(file.errorString()));
+		return false;
+	}
+	return true;
+}
+
+bool ReplayProfiler::isErrorResult(DP_PlayerResult result)
+{
+	return result != DP_PLAYER_SUCCESS && result != DP_PLAYER_RECORDING_END;
+}
+
+// Percentiles use the nearest rank, which is good enough for these purposes.
+static double percentile(const QVector<double> &sorted, double p)
+{
+	int count = sorted.size();
+	int rank = int(std::ceil(p / 100.0 * count));
+	return sorted[qBound(0, rank - 1, count - 1)];
+}
+
+QJsonObject ReplayProfiler::Series::toJson() const
+{
+	QJsonObject json = {{QStringLiteral("count"), values.size()}};
+	if(!values.isEmpty()) {
+		QVector<double> sorted = values;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for(double value : sorted) {
+			sum += value;
+		}
+		json[QStringLiteral("min")] = sorted.first();
+		json[QStringLiteral("mean")] = sum / sorted.size();
+		json[QStringLiteral("median")] = percentile(sorted, 50.0);
+		json[QStringLiteral("p95")] = percentile(sorted, 95.0);
+		json[QStringLiteral("p99")] = percentile(sorted, 99.0);
+		json[QStringLiteral("max")] = sorted.last();
+	}
+	return json;
+}
+
+QString ReplayProfiler::Series::toString() const
+{
+	QJsonObject json = toJson();
+	if(values.isEmpty()) {
+		return QStringLiteral("none");
+	}
+	return QStringLiteral(
+			   "count %1, min %2, mean %3, median %4, p95 %5, p99 %6, max %7")
+		.arg(values.size())
+		.arg(json[QStringLiteral("min")].toDouble(), 0, 'f', 3)
+		.arg(json[QStringLiteral("mean")].toDouble(), 0, 'f', 3)
+		.arg(json[QStringLiteral("median")].toDouble(), 0, 'f', 3)
+		.arg(json[QStringLiteral("p95")].toDouble(), 0, 'f', 3)
+		.arg(json[QStringLiteral("p99")].toDouble(), 0, 'f', 3)
+		.arg(json[QStringLiteral("max")].toDouble(), 0, 'f', 3);
+}
+
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DESKTOP_UTILS_REPLAYPROFILER_H
+#define DESKTOP_UTILS_REPLAYPROFILER_H
+extern "C" {
+#include <dpengine/player.h>
+}
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+class QJsonObject;
+class QTimer;
+class QWidget;
+
+namespace canvas {
+class PaintEngine;
+}
+
+namespace utils {
+
+// Plays back a recording loaded into the given paint engine through the
+// regular interactive stack and gathers timing statistics along the way, so
+// that a recording of a slow session can be turned into a repeatable
+// profiling scenario. Frame times are measured as the intervals between paint
+// events on the canvas viewport, playback step latency as the time between
+// handing messages to the paint engine and it reporting them as handled.
+class ReplayProfiler final : public QObject {
+	Q_OBJECT
+public:
+	struct Options {
+		// Multiplier of the recorded timing, zero or less means as fast as
+		// possible, stepping forward as soon as the previous step is done.
+		double speed = 1.0;
+		// Performance trace, see drawdance::Perf::open for the formats.
+		QString tracePath;
+		// Statistics in JSON format, empty means they're printed instead.
+		QString statsPath;
+	};
+
+	ReplayProfiler(
+		canvas::PaintEngine *paintEngine, QWidget *viewport,
+		const Options &options, QObject *parent = nullptr);
+
+	// Starts playback, the finished signal is emitted when it reaches the end.
+	void start();
+
+signals:
+	void finished(bool success);
+
+protected:
+	bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+	struct Series {
+		QVector<double> values;
+		QJsonObject toJson() const;
+		QString toString() const;
+	};
+
+	void onPlaybackAt(long long pos);
+	void playNext(double msecs);
+	void finish(bool success);
+	bool writeStats();
+	static bool isErrorResult(DP_PlayerResult result);
+
+	canvas::PaintEngine *m_paintEngine;
+	QWidget *m_viewport;
+	Options m_options;
+	QTimer *m_playTimer;
+	QElapsedTimer m_totalTime;
+	QElapsedTimer m_stepTime;
+	QElapsedTimer m_frameTime;
+	Series m_frameIntervals;
+	Series m_stepLatencies;
+	bool m_running = false;
+};
+
+}
+
+#endif
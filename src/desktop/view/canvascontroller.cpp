@@ -19,6 +19,7 @@
 #include <QScopedValueRollback>
 #include <QSignalBlocker>
 #include <QTabletEvent>
+#include <QTimer>
 #include <QTouchEvent>
 #include <QWheelEvent>
 #include <cmath>
@@ -153,6 +154,7 @@ CanvasController::CanvasController(CanvasScene *scene, QWidget *parent)
 	, m_alphaLockCursorStyle(int(Cursor::SameAsBrush))
 	, m_brushBlendMode(DP_BLEND_MODE_NORMAL)
 	, m_touch(new TouchHandler(this))
+	, m_performanceOverlayTimer(new QTimer(this))
 	, m_toolState(int(tools::ToolState::Normal))
 	, m_hudActionToActivate(int(drawingboard::ToggleItem::Action::None))
 #ifdef Q_OS_LINUX
@@ -170,6 +172,11 @@ CanvasController::CanvasController(CanvasScene *scene, QWidget *parent)
 		&CanvasController::setEraserTipActive);
 #endif
 
+	m_performanceOverlayTimer->setInterval(PERFORMANCE_OVERLAY_INTERVAL_MSEC);
+	connect(
+		m_performanceOverlayTimer, &QTimer::timeout, this,
+		&CanvasController::updatePerformanceOverlay);
+
 	desktop::settings::Settings &settings = app.settings();
 	settings.bindCanvasViewBackgroundColor(
 		this, &CanvasController::setClearColor);
@@ -185,6 +192,8 @@ CanvasController::CanvasController(CanvasScene *scene, QWidget *parent)
 	settings.bindCanvasShortcuts(this, &CanvasController::setCanvasShortcuts);
 	settings.bindShowTransformNotices(
 		this, &CanvasController::setShowTransformNotices);
+	settings.bindShowPerformanceOverlay(
+		this, &CanvasController::setShowPerformanceOverlay);
 	settings.bindBrushCursor(this, &CanvasController::setBrushCursorStyle);
 	settings.bindEraseCursor(this, &CanvasController::setEraseCursorStyle);
 	settings.bindAlphaLockCursor(
@@ -229,6 +238,7 @@ void CanvasController::setCanvasModel(canvas::CanvasModel *canvasModel)
 {
 	m_canvasModel = canvasModel;
 	updateCanvasSize(0, 0, 0, 0);
+	resetPerformanceCounters();
 	if(canvasModel) {
 		canvas::PaintEngine *pe = canvasModel->paintEngine();
 		connect(
@@ -611,8 +621,8 @@ void CanvasController::handleMouseMove(QMouseEvent *event)
 		} else {
 			event->accept();
 			penMoveEvent(
-				QDateTime::currentMSecsSinceEpoch(), posf, 1.0, 0.0, 0.0, 0.0,
-				getMouseModifiers(event));
+				m_mouseTimestamp.msecsSinceEpoch(event), posf, 1.0, 0.0, 0.0,
+				0.0, getMouseModifiers(event));
 		}
 	}
 }
@@ -634,7 +644,7 @@ void CanvasController::handleMousePress(QMouseEvent *event)
 	   (button != Qt::LeftButton || m_tabletEventTimer.hasExpired())) {
 		event->accept();
 		penPressEvent(
-			QDateTime::currentMSecsSinceEpoch(), posf, 1.0, 0.0, 0.0, 0.0,
+			m_mouseTimestamp.msecsSinceEpoch(event), posf, 1.0, 0.0, 0.0, 0.0,
 			button, getMouseModifiers(event), int(tools::DeviceType::Mouse),
 			false);
 	}
@@ -655,7 +665,7 @@ void CanvasController::handleMouseRelease(QMouseEvent *event)
 	   !touching) {
 		event->accept();
 		penReleaseEvent(
-			QDateTime::currentMSecsSinceEpoch(), posf, event->button(),
+			m_mouseTimestamp.msecsSinceEpoch(event), posf, event->button(),
 			getMouseModifiers(event));
 	}
 }
@@ -694,7 +704,7 @@ void CanvasController::handleTabletMove(QTabletEvent *event)
 		   buttons != Qt::LeftButton) {
 			startTabletEventTimer();
 			penMoveEvent(
-				QDateTime::currentMSecsSinceEpoch(), posf,
+				m_tabletTimestamp.msecsSinceEpoch(event), posf,
 				qBound(0.0, pressure, 1.0), xTilt, yTilt, rotation, modifiers);
 		}
 	}
@@ -745,7 +755,7 @@ void CanvasController::handleTabletPress(QTabletEvent *event)
 #endif
 
 		penPressEvent(
-			QDateTime::currentMSecsSinceEpoch(), posf,
+			m_tabletTimestamp.msecsSinceEpoch(event), posf,
 			qBound(0.0, pressure, 1.0), xTilt, yTilt, rotation, button,
 			modifiers, int(tools::DeviceType::Tablet), eraserOverride);
 	}
@@ -772,7 +782,7 @@ void CanvasController::handleTabletRelease(QTabletEvent *event)
 		}
 
 		penReleaseEvent(
-			QDateTime::currentMSecsSinceEpoch(), posf, event->button(),
+			m_tabletTimestamp.msecsSinceEpoch(event), posf, event->button(),
 			modifiers);
 	}
 }
@@ -1417,6 +1427,93 @@ void CanvasController::setShowTransformNotices(bool showTransformNotices)
 	m_showTransformNotices = showTransformNotices;
 }
 
+void CanvasController::recordFramePainted(qint64 frameNsecs, qint64 uploadNsecs)
+{
+	if(m_performanceOverlayTimer->isActive()) {
+		++m_framesPainted;
+		m_frameNsecsTotal += frameNsecs;
+		m_frameNsecsMax = qMax(m_frameNsecsMax, frameNsecs);
+		m_uploadNsecsTotal += uploadNsecs;
+	}
+}
+
+void CanvasController::setShowPerformanceOverlay(bool showPerformanceOverlay)
+{
+	if(showPerformanceOverlay) {
+		if(!m_performanceOverlayTimer->isActive()) {
+			resetPerformanceCounters();
+			m_performanceOverlayTimer->start();
+		}
+	} else {
+		m_performanceOverlayTimer->stop();
+		m_scene->setPerformanceNotice(QString());
+	}
+}
+
+void CanvasController::resetPerformanceCounters()
+{
+	m_performanceOverlayElapsed.start();
+	m_framesPainted = 0;
+	m_frameNsecsTotal = 0;
+	m_frameNsecsMax = 0;
+	m_uploadNsecsTotal = 0;
+	if(m_canvasModel) {
+		canvas::PaintEngine *pe = m_canvasModel->paintEngine();
+		DP_PaintEngineQueueStatistics qs = pe->queueStatistics();
+		m_lastRenderedTiles = pe->renderStatistics().jobs;
+		m_lastHandledMessages = qs.handled;
+		m_lastMessageQueueNsecs = qs.queue_ns;
+	} else {
+		m_lastRenderedTiles = 0;
+		m_lastHandledMessages = 0;
+		m_lastMessageQueueNsecs = 0;
+	}
+}
+
+void CanvasController::updatePerformanceOverlay()
+{
+	// Everything here is computed from counters that are being kept anyway,
+	// so leaving this on doesn't slow down painting or the paint engine.
+	qint64 elapsedMsec = qMax(qint64(1), m_performanceOverlayElapsed.elapsed());
+	double seconds = double(elapsedMsec) / 1000.0;
+	double frameAverageMsec =
+		m_framesPainted == 0
+			? 0.0
+			: double(m_frameNsecsTotal) / double(m_framesPainted) / 1.0e6;
+	QStringList lines;
+	lines.append(tr("Frames: %1/s, %2 ms average, %3 ms slowest")
+					 .arg(double(m_framesPainted) / seconds, 0, 'f', 1)
+					 .arg(frameAverageMsec, 0, 'f', 2)
+					 .arg(double(m_frameNsecsMax) / 1.0e6, 0, 'f', 2));
+	if(m_uploadNsecsTotal != 0) {
+		lines.append(tr("Tile uploads: %1 ms per second")
+						 .arg(double(m_uploadNsecsTotal) / 1.0e6 / seconds, 0,
+							  'f', 2));
+	}
+
+	if(m_canvasModel) {
+		canvas::PaintEngine *pe = m_canvasModel->paintEngine();
+		DP_PaintEngineQueueStatistics qs = pe->queueStatistics();
+		size_t renderedTiles = pe->renderStatistics().jobs;
+		unsigned long long handled = qs.handled - m_lastHandledMessages;
+		double waitAverageMsec =
+			handled == 0 ? 0.0
+						 : double(qs.queue_ns - m_lastMessageQueueNsecs) /
+							   double(handled) / 1.0e6;
+		lines.append(tr("Paint engine: %1 queued, %2 handled/s, %3 ms wait")
+						 .arg(qs.queued)
+						 .arg(qRound64(double(handled) / seconds))
+						 .arg(waitAverageMsec, 0, 'f', 2));
+		lines.append(tr("Renderer: %1 tiles/s")
+						 .arg(qRound64(
+							 double(renderedTiles - m_lastRenderedTiles) /
+							 seconds)));
+	}
+
+	resetPerformanceCounters();
+	m_scene->setPerformanceNotice(lines.join(QStringLiteral("\n")));
+}
+
 void CanvasController::setTabletEventTimerDelay(int tabletEventTimerDelay)
 {
 	m_tabletEventTimerDelay = tabletEventTimerDelay;
@@ -2510,7 +2607,7 @@ void CanvasController::emitViewRectChanged()
 		emit viewChanged(view);
 		if(m_canvasModel) {
 			m_canvasModel->paintEngine()->setCanvasViewTileArea(
-				m_canvasViewTileArea);
+				m_canvasViewTileArea, zoom());
 		}
 	}
 }
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef DESKTOP_VIEW_CANVASCONTROLLER_H
 #define DESKTOP_VIEW_CANVASCONTROLLER_H
+#include "desktop/utils/eventtimestamp.h"
 #include "desktop/utils/tabletfilter.h"
 #include "desktop/view/lock.h"
 #include "libclient/canvas/canvasshortcuts.h"
@@ -10,6 +11,7 @@
 #include <QColor>
 #include <QCursor>
 #include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QPointF>
 #include <QPolygonF>
@@ -25,6 +27,7 @@ class QGestureEvent;
 class QKeyEvent;
 class QMouseEvent;
 class QTabletEvent;
+class QTimer;
 class QTouchEvent;
 class QWheelEvent;
 class TouchHandler;
@@ -156,6 +159,10 @@ public:
 	QPointF outlinePos() const;
 	bool isSquareOutline() const { return m_squareOutline; }
 
+	// Called by the canvas widget after each repaint. The upload time is how
+	// long of that was spent getting tiles onto the GPU, if applicable.
+	void recordFramePainted(qint64 frameNsecs, qint64 uploadNsecs = 0);
+
 	void setLockReasons(QFlags<view::Lock::Reason> reasons);
 	void setLockDescription(const QString &lockDescription);
 	void setToolState(int toolState);
@@ -203,6 +210,7 @@ private:
 	static constexpr qreal ROTATION_STEP = 5.0;
 	static constexpr qreal DISCRETE_ROTATION_STEP = 15.0;
 	static constexpr int ZOOM_TO_MINIMUM_DIMENSION = 15;
+	static constexpr int PERFORMANCE_OVERLAY_INTERVAL_MSEC = 1000;
 
 	enum class PenMode { Normal, Colorpick, Layerpick };
 	enum class PenState { Up, MouseDown, TabletDown };
@@ -220,6 +228,9 @@ private:
 	void setOutlineWidth(qreal outlineWidth);
 	void setCanvasShortcuts(QVariantMap canvasShortcuts);
 	void setShowTransformNotices(bool showTransformNotices);
+	void setShowPerformanceOverlay(bool showPerformanceOverlay);
+	void resetPerformanceCounters();
+	void updatePerformanceOverlay();
 	void setTabletEventTimerDelay(int tabletEventTimerDelay);
 	void startTabletEventTimer();
 	void resetTabletDriver();
@@ -462,6 +473,15 @@ private:
 	bool m_canvasSizeChanging = false;
 	bool m_blockNotices = false;
 	bool m_showTransformNotices = false;
+	QTimer *m_performanceOverlayTimer;
+	QElapsedTimer m_performanceOverlayElapsed;
+	int m_framesPainted = 0;
+	qint64 m_frameNsecsTotal = 0;
+	qint64 m_frameNsecsMax = 0;
+	qint64 m_uploadNsecsTotal = 0;
+	size_t m_lastRenderedTiles = 0;
+	unsigned long long m_lastHandledMessages = 0;
+	unsigned long long m_lastMessageQueueNsecs = 0;
 	int m_toolState;
 	int m_hudActionToActivate;
 	bool m_locked = false;
@@ -473,6 +493,8 @@ private:
 	bool m_waylandWorkarounds;
 #endif
 	TabletFilter m_tabletFilter;
+	EventTimestamp m_mouseTimestamp;
+	EventTimestamp m_tabletTimestamp;
 };
 
 }
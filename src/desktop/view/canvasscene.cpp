@@ -101,6 +101,7 @@ void CanvasScene::setCanvasModel(canvas::CanvasModel *canvasModel)
 		}
 	}
 	m_userMarkers.clear();
+	m_pendingCursorMoves.clear();
 	m_activeLaserTrails.clear();
 
 	setSelection(canvasModel->selection()->mask());
@@ -591,6 +592,29 @@ void CanvasScene::setToolNotice(const QString &text)
 			setToolNoticePosition();
 		}
 	}
+	if(m_performanceNotice) {
+		setPerformanceNoticePosition();
+	}
+}
+
+void CanvasScene::setPerformanceNotice(const QString &text)
+{
+	if(text.isEmpty()) {
+		if(m_performanceNotice) {
+			delete m_performanceNotice;
+			m_performanceNotice = nullptr;
+		}
+	} else {
+		if(m_performanceNotice) {
+			if(m_performanceNotice->setText(text)) {
+				setPerformanceNoticePosition();
+			}
+		} else {
+			m_performanceNotice = new NoticeItem(text);
+			addSceneItem(m_performanceNotice);
+			setPerformanceNoticePosition();
+		}
+	}
 }
 
 bool CanvasScene::hasCatchup() const
@@ -676,6 +700,9 @@ void CanvasScene::onSceneRectChanged()
 	if(m_toolNotice) {
 		setToolNoticePosition();
 	}
+	if(m_performanceNotice) {
+		setPerformanceNoticePosition();
+	}
 	if(m_popupNotice) {
 		setPopupNoticePosition();
 	}
@@ -690,6 +717,7 @@ void CanvasScene::onSceneRectChanged()
 
 void CanvasScene::onUserJoined(int id)
 {
+	m_pendingCursorMoves.remove(id);
 	UserMarkerItem *um = m_userMarkers.value(id);
 	if(um) {
 		m_userMarkers.remove(id);
@@ -710,14 +738,48 @@ void CanvasScene::onCursorMoved(
 		}
 	}
 
+	// Markers only move once per animation step anyway, so rather than
+	// updating them for every single cursor motion, which gets excessive with
+	// lots of users in a session, only remember where they ended up.
+	bool penUp = flags & DP_USER_CURSOR_FLAG_PEN_UP;
+	bool penDown = flags & DP_USER_CURSOR_FLAG_PEN_DOWN;
+	PendingCursorMove &move = m_pendingCursorMoves[userId];
+	if(valid) {
+		move.jump = move.jump || move.penUp || (penUp && penDown) ||
+					!(flags & DP_USER_CURSOR_FLAG_INTERPOLATE);
+		move.valid = true;
+		move.penUp = false;
+		move.layerId = layerId;
+		move.x = x;
+		move.y = y;
+	}
+
+	if(penUp && !penDown) {
+		move.penUp = true;
+	}
+}
+
+void CanvasScene::applyPendingCursorMoves()
+{
+	if(!m_pendingCursorMoves.isEmpty()) {
+		for(QHash<int, PendingCursorMove>::const_iterator
+				it = m_pendingCursorMoves.constBegin(),
+				end = m_pendingCursorMoves.constEnd();
+			it != end; ++it) {
+			applyCursorMove(it.key(), it.value());
+		}
+		m_pendingCursorMoves.clear();
+	}
+}
+
+void CanvasScene::applyCursorMove(int userId, const PendingCursorMove &move)
+{
 	bool shouldShow =
 		m_canvasModel && m_canvasVisible && m_showUserMarkers &&
 		(m_showOwnUserMarker || userId != m_canvasModel->localUserId());
 	if(shouldShow) {
 		UserMarkerItem *item = m_userMarkers[userId];
-		bool penUp = flags & DP_USER_CURSOR_FLAG_PEN_UP;
-		bool penDown = flags & DP_USER_CURSOR_FLAG_PEN_DOWN;
-		if(!item && valid) {
+		if(!item && move.valid) {
 			const auto user = m_canvasModel->userlist()->getUserById(userId);
 			item = new UserMarkerItem(
 				userId, m_userMarkerPersistence, m_canvasGroup);
@@ -732,27 +794,26 @@ void CanvasScene::onCursorMoved(
 			item->setEvadeCursor(m_evadeUserCursors);
 			item->setCursorPosValid(m_cursorOnCanvas && !m_showOwnUserMarker);
 			item->setCursorPos(m_cursorPos);
-			item->setTargetPos(x, y, true);
+			item->setTargetPos(move.x, move.y, true);
 			m_userMarkers[userId] = item;
 		}
 
 		if(item) {
-			if(valid) {
+			if(move.valid) {
 				if(m_showUserLayers) {
 					item->setSubtext(
 						m_canvasModel->layerlist()
-							->layerIndex(layerId)
+							->layerIndex(move.layerId)
 							.data(canvas::LayerListModel::TitleRole)
 							.toString());
 				}
-				item->setTargetPos(
-					x, y,
-					item->clearPenUp() || (penUp && penDown) ||
-						!(flags & DP_USER_CURSOR_FLAG_INTERPOLATE));
+				// Clear the pen up state first, it must be reset regardless.
+				bool penWasUp = item->clearPenUp();
+				item->setTargetPos(move.x, move.y, penWasUp || move.jump);
 				item->fadein();
 			}
 
-			if(penUp && !penDown) {
+			if(move.penUp) {
 				item->setPenUp(true);
 			}
 		}
@@ -907,6 +968,20 @@ void CanvasScene::setToolNoticePosition()
 		QPointF(NOTICE_OFFSET, -toolNoticeBounds.height() - NOTICE_OFFSET));
 }
 
+void CanvasScene::setPerformanceNoticePosition()
+{
+	// Stacked on top of the tool notice, since both live in the bottom left.
+	qreal toolNoticeOffset =
+		m_toolNotice ? m_toolNotice->boundingRect().height() + NOTICE_OFFSET
+					 : 0.0;
+	QRectF performanceNoticeBounds = m_performanceNotice->boundingRect();
+	m_performanceNotice->updatePosition(
+		sceneRect().bottomLeft() +
+		QPointF(
+			NOTICE_OFFSET, -performanceNoticeBounds.height() - NOTICE_OFFSET -
+							   toolNoticeOffset));
+}
+
 void CanvasScene::setPopupNoticePosition()
 {
 	QRectF popupNoticeBounds = m_popupNotice->boundingRect();
@@ -948,6 +1023,7 @@ void CanvasScene::setTogglePositions()
 void CanvasScene::advanceAnimations()
 {
 	qreal dt = qreal(m_animationElapsedTimer.elapsed()) / 1000.0;
+	applyPendingCursorMoves();
 
 	for(QGraphicsItem *item : m_canvasGroup->childItems()) {
 		if(LaserTrailItem *lt = qgraphicsitem_cast<LaserTrailItem *>(item)) {
@@ -123,6 +123,7 @@ public:
 	void showPopupNotice(const QString &text);
 
 	void setToolNotice(const QString &text);
+	void setPerformanceNotice(const QString &text);
 
 	bool hasCatchup() const;
 	void setCatchupProgress(int percent);
@@ -141,6 +142,16 @@ private:
 	static constexpr qreal NOTICE_PERSIST = 1.0;
 	static constexpr qreal POPUP_PERSIST = 3.0;
 
+	// Cursor motion of a single user accumulated between animation steps.
+	struct PendingCursorMove {
+		bool valid = false;
+		bool jump = false;
+		bool penUp = false;
+		int layerId = 0;
+		int x = 0;
+		int y = 0;
+	};
+
 	void addSceneItem(BaseItem *item);
 
 	void onSceneRectChanged();
@@ -148,6 +159,8 @@ private:
 	void onUserJoined(int id);
 	void
 	onCursorMoved(unsigned int flags, int userId, int layerId, int x, int y);
+	void applyPendingCursorMoves();
+	void applyCursorMove(int userId, const PendingCursorMove &move);
 	void onLaserTrail(int userId, int persistence, const QColor &color);
 
 	void setSelection(const QSharedPointer<canvas::SelectionMask> &mask);
@@ -159,6 +172,7 @@ private:
 	void setTransformNoticePosition();
 	void setLockNoticePosition();
 	void setToolNoticePosition();
+	void setPerformanceNoticePosition();
 	void setPopupNoticePosition();
 	void setCatchupPosition();
 	void setStreamResetNoticePosition();
@@ -188,6 +202,7 @@ private:
 	qreal m_zoom = 1.0;
 	QPointF m_cursorPos;
 	QHash<int, UserMarkerItem *> m_userMarkers;
+	QHash<int, PendingCursorMove> m_pendingCursorMoves;
 	QHash<int, LaserTrailItem *> m_activeLaserTrails;
 
 	AnchorLineItem *m_anchorLine = nullptr;
@@ -208,6 +223,7 @@ private:
 	NoticeItem *m_transformNotice = nullptr;
 	NoticeItem *m_lockNotice = nullptr;
 	NoticeItem *m_toolNotice = nullptr;
+	NoticeItem *m_performanceNotice = nullptr;
 	NoticeItem *m_popupNotice = nullptr;
 
 	CatchupItem *m_catchup = nullptr;
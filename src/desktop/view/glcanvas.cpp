@@ -6,6 +6,7 @@
 #include "desktop/view/canvasscene.h"
 #include "libclient/canvas/tilecache.h"
 #include "libclient/drawdance/perf.h"
+#include <QElapsedTimer>
 #include <QMetaEnum>
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLFunctions>
@@ -24,6 +25,10 @@ struct GlCanvas::Private {
 	static constexpr int BUFFER_COUNT = 2;
 	static constexpr int CANVAS_UV_BUFFER_INDEX = 0;
 	static constexpr int OUTLINE_VERTEX_BUFFER_INDEX = 1;
+	// Pixel unpack buffers for tile uploads, cycled through so that we don't
+	// stall on a buffer the driver is still reading from the previous frame.
+	static constexpr int UPLOAD_BUFFER_COUNT = 3;
+	static constexpr size_t UPLOAD_PIXEL_SIZE = 4;
 	static constexpr int VERTEX_COUNT = 8;
 	static constexpr GLint FALLBACK_TEXTURE_SIZE = 1024;
 
@@ -35,6 +40,19 @@ struct GlCanvas::Private {
 		int lastOutlineSize = -1;
 	};
 
+	struct UploadTile {
+		QRect rect;
+		const void *pixels;
+	};
+
+	// A horizontal run of adjacent dirty tiles, uploaded in a single call.
+	struct UploadSpan {
+		QRect rect;
+		int firstTile;
+		int tileCount;
+		size_t offset;
+	};
+
 	struct CanvasShader {
 		GLuint program = 0;
 		GLuint vao = 0;
@@ -71,6 +89,18 @@ struct GlCanvas::Private {
 			buffers[i] = 0;
 		}
 
+		if(havePixelBuffers) {
+			qCDebug(lcDpGlCanvas, "Delete upload buffers");
+			f->glDeleteBuffers(UPLOAD_BUFFER_COUNT, uploadBuffers);
+			for(int i = 0; i < UPLOAD_BUFFER_COUNT; ++i) {
+				uploadBuffers[i] = 0;
+				uploadBufferSizes[i] = 0;
+			}
+			uploadBufferIndex = 0;
+		}
+		uploadTiles.clear();
+		uploadSpans.clear();
+
 		if(!canvasTextures.isEmpty()) {
 			qCDebug(lcDpGlCanvas, "Delete canvas textures");
 			f->glDeleteTextures(
@@ -728,9 +758,130 @@ void main()
 		f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	}
 
+	// Returns whether any tiles were uploaded at all.
+	bool uploadDirtyTiles(
+		QOpenGLFunctions *f, QOpenGLExtraFunctions *e,
+		canvas::TileCache &tileCache, const QRect &rect,
+		const QRect &visibleTileRect)
+	{
+		if(!havePixelBuffers) {
+			bool uploaded = false;
+			tileCache.eachDirtyTileReset(
+				visibleTileRect,
+				[&](const QRect &pixelRect, const void *pixels) {
+					uploadTile(f, rect, pixelRect, pixels);
+					uploaded = true;
+				});
+			return uploaded;
+		}
+
+		// Gather the dirty tiles into horizontal spans. The tile cache hands
+		// them to us row by row, so adjacent tiles end up next to each other.
+		uploadTiles.clear();
+		uploadSpans.clear();
+		size_t totalSize = 0;
+		tileCache.eachDirtyTileReset(
+			visibleTileRect, [&](const QRect &pixelRect, const void *pixels) {
+				int tileIndex = uploadTiles.size();
+				uploadTiles.append({pixelRect, pixels});
+				size_t tileSize = size_t(pixelRect.width()) *
+								  size_t(pixelRect.height()) *
+								  UPLOAD_PIXEL_SIZE;
+				if(!uploadSpans.isEmpty()) {
+					UploadSpan &span = uploadSpans.last();
+					if(span.rect.y() == pixelRect.y() &&
+					   span.rect.height() == pixelRect.height() &&
+					   span.rect.right() + 1 == pixelRect.x()) {
+						span.rect.setRight(pixelRect.right());
+						++span.tileCount;
+						totalSize += tileSize;
+						return;
+					}
+				}
+				uploadSpans.append({pixelRect, tileIndex, 1, totalSize});
+				totalSize += tileSize;
+			});
+
+		if(totalSize == 0) {
+			return false;
+		}
+
+		GLuint buffer = uploadBuffers[uploadBufferIndex];
+		GLsizeiptr &bufferSize = uploadBufferSizes[uploadBufferIndex];
+		uploadBufferIndex = (uploadBufferIndex + 1) % UPLOAD_BUFFER_COUNT;
+		f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		if(bufferSize < GLsizeiptr(totalSize)) {
+			bufferSize = GLsizeiptr(totalSize);
+			f->glBufferData(
+				GL_PIXEL_UNPACK_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+		}
+
+		unsigned char *mapped =
+			static_cast<unsigned char *>(e->glMapBufferRange(
+				GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(totalSize),
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		bool mappedOk = mapped != nullptr;
+		if(mappedOk) {
+			for(const UploadSpan &span : uploadSpans) {
+				copySpan(mapped + span.offset, span);
+			}
+			// The buffer contents may be lost due to e.g. a mode switch, in
+			// which case unmapping fails and we have to upload them directly.
+			mappedOk = e->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+		}
+
+		if(mappedOk) {
+			for(const UploadSpan &span : uploadSpans) {
+				uploadTile(
+					f, rect, span.rect,
+					reinterpret_cast<const void *>(span.offset));
+			}
+			f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		} else {
+			qCWarning(
+				lcDpGlCanvas,
+				"Failed to map upload buffer, uploading tiles directly");
+			f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			for(const UploadTile &tile : uploadTiles) {
+				uploadTile(f, rect, tile.rect, tile.pixels);
+			}
+		}
+		return true;
+	}
+
+	void copySpan(unsigned char *dst, const UploadSpan &span) const
+	{
+		size_t spanRowSize = size_t(span.rect.width()) * UPLOAD_PIXEL_SIZE;
+		int height = span.rect.height();
+		size_t x = 0;
+		for(int i = 0; i < span.tileCount; ++i) {
+			const UploadTile &tile = uploadTiles[span.firstTile + i];
+			size_t tileRowSize = size_t(tile.rect.width()) * UPLOAD_PIXEL_SIZE;
+			const unsigned char *src =
+				static_cast<const unsigned char *>(tile.pixels);
+			for(int y = 0; y < height; ++y) {
+				memcpy(
+					dst + size_t(y) * spanRowSize + x,
+					src + size_t(y) * tileRowSize, tileRowSize);
+			}
+			x += tileRowSize;
+		}
+	}
+
+	static void uploadTile(
+		QOpenGLFunctions *f, const QRect &rect, const QRect &pixelRect,
+		const void *pixels)
+	{
+		f->glTexSubImage2D(
+			GL_TEXTURE_2D, 0, pixelRect.x() - rect.x(),
+			pixelRect.y() - rect.y(), pixelRect.width(), pixelRect.height(),
+			GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+
 	void drawCanvasDirtyTexture(
-		QOpenGLFunctions *f, canvas::TileCache &tileCache, GLuint texture,
-		const QRect &rect, GLint &inOutFilter)
+		QOpenGLFunctions *f, QOpenGLExtraFunctions *e,
+		canvas::TileCache &tileCache, GLuint texture, const QRect &rect,
+		GLint &inOutFilter)
 	{
 		QRect tileRect = QRect(
 			QPoint(rect.left() / DP_TILE_SIZE, rect.top() / DP_TILE_SIZE),
@@ -744,21 +895,20 @@ void main()
 			if(texture != 0) {
 				f->glBindTexture(GL_TEXTURE_2D, texture);
 			}
-			tileCache.eachDirtyTileReset(
-				visibleTileRect,
-				[&](const QRect &pixelRect, const void *pixels) {
-					f->glTexSubImage2D(
-						GL_TEXTURE_2D, 0, pixelRect.x() - rect.x(),
-						pixelRect.y() - rect.y(), pixelRect.width(),
-						pixelRect.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-				});
-			f->glGenerateMipmap(GL_TEXTURE_2D);
+			// Regenerating mipmaps covers the whole texture, which is a waste
+			// if a small change elsewhere on the canvas didn't touch this one.
+			bool uploaded =
+				uploadDirtyTiles(f, e, tileCache, rect, visibleTileRect);
+			if(uploaded || texture == 0) {
+				f->glGenerateMipmap(GL_TEXTURE_2D);
+			}
 			drawCanvasShader(f, rect, inOutFilter);
 		}
 	}
 
 	void renderCanvasDirtyTexturesResize(
-		QOpenGLFunctions *f, canvas::TileCache &tileCache)
+		QOpenGLFunctions *f, QOpenGLExtraFunctions *e,
+		canvas::TileCache &tileCache)
 	{
 		int neededX = totalTextureSize.width() / maxTextureSize;
 		if(neededX * maxTextureSize < totalTextureSize.width()) {
@@ -819,7 +969,7 @@ void main()
 					GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
 				drawCanvasDirtyTexture(
-					f, tileCache, 0, canvasRects[i], canvasFilters[i]);
+					f, e, tileCache, 0, canvasRects[i], canvasFilters[i]);
 
 				x += textureWidth;
 				++i;
@@ -841,12 +991,12 @@ void main()
 		bool textureSizeChanged = totalTextureSize != size;
 		if(textureSizeChanged) {
 			totalTextureSize = size;
-			renderCanvasDirtyTexturesResize(f, tileCache);
+			renderCanvasDirtyTexturesResize(f, e, tileCache);
 		} else {
 			int textureCount = canvasTextures.size();
 			for(int i = 0; i < textureCount; ++i) {
 				drawCanvasDirtyTexture(
-					f, tileCache, canvasTextures[i], canvasRects[i],
+					f, e, tileCache, canvasTextures[i], canvasRects[i],
 					canvasFilters[i]);
 			}
 		}
@@ -888,7 +1038,8 @@ void main()
 		}
 	}
 
-	void renderCanvas(QOpenGLFunctions *f, QOpenGLExtraFunctions *e)
+	// Returns how long updating dirty textures took, zero if they were clean.
+	qint64 renderCanvas(QOpenGLFunctions *f, QOpenGLExtraFunctions *e)
 	{
 		// Rendering the canvas has three paths, to avoid state changes as much
 		// as possible. When nothing changed since last time, we just render the
@@ -898,9 +1049,13 @@ void main()
 		// textures entirely, rendering out each one along the way.
 		if(dirty.texture) {
 			dirty.texture = false;
+			QElapsedTimer uploadTimer;
+			uploadTimer.start();
 			renderCanvasDirty(f, e);
+			return uploadTimer.nsecsElapsed();
 		} else {
 			renderCanvasClean(f, e);
+			return 0;
 		}
 	}
 
@@ -965,11 +1120,17 @@ void main()
 	Dirty dirty;
 	bool initialized = false;
 	bool haveGles2 = false;
+	bool havePixelBuffers = false;
 	bool haveFragmentHighp;
 	GLint maxTextureSize;
 	CanvasShader canvasShader;
 	OutlineShader outlineShader;
 	GLuint buffers[BUFFER_COUNT] = {0, 0};
+	GLuint uploadBuffers[UPLOAD_BUFFER_COUNT] = {0, 0, 0};
+	GLsizeiptr uploadBufferSizes[UPLOAD_BUFFER_COUNT] = {0, 0, 0};
+	int uploadBufferIndex = 0;
+	QVector<UploadTile> uploadTiles;
+	QVector<UploadSpan> uploadSpans;
 	GLuint checkerTexture;
 	QVector<GLuint> canvasTextures;
 	QVector<QRect> canvasRects;
@@ -1110,6 +1271,9 @@ void GlCanvas::initializeGL()
 	d->haveGles2 = context->isOpenGLES();
 	QOpenGLExtraFunctions *e =
 		d->haveGles2 ? nullptr : context->extraFunctions();
+	// Pixel buffer objects and glMapBufferRange need OpenGL 3.0, which we
+	// already require for vertex array objects outside of OpenGL ES 2.0.
+	d->havePixelBuffers = !d->haveGles2;
 
 	d->haveFragmentHighp = !d->haveGles2 ||
 						   context->format().majorVersion() > 2 ||
@@ -1192,6 +1356,10 @@ void GlCanvas::initializeGL()
 
 	qCDebug(lcDpGlCanvas, "Generate buffers");
 	f->glGenBuffers(Private::BUFFER_COUNT, d->buffers);
+	if(d->havePixelBuffers) {
+		qCDebug(lcDpGlCanvas, "Generate upload buffers");
+		f->glGenBuffers(Private::UPLOAD_BUFFER_COUNT, d->uploadBuffers);
+	}
 
 	static constexpr GLfloat UVS[Private::VERTEX_COUNT] = {
 		0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 0.0f};
@@ -1226,6 +1394,8 @@ void GlCanvas::paintGL()
 	qCDebug(lcDpGlCanvas, "paintGL");
 	if(!d->viewSize.isEmpty()) {
 		DP_PERF_SCOPE("paint_gl");
+		QElapsedTimer frameTimer;
+		frameTimer.start();
 		QPainter painter(this);
 		painter.beginNativePainting();
 
@@ -1240,8 +1410,9 @@ void GlCanvas::paintGL()
 		f->glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
 		bool haveCanvas = controller->isCanvasVisible();
+		qint64 uploadNsecs = 0;
 		if(haveCanvas) {
-			d->renderCanvas(f, e);
+			uploadNsecs = d->renderCanvas(f, e);
 			if(d->controller->isOutlineVisible()) {
 				d->renderOutline(f, e, devicePixelRatioF());
 			}
@@ -1256,6 +1427,7 @@ void GlCanvas::paintGL()
 		painter.endNativePainting();
 
 		d->renderScene(painter);
+		controller->recordFramePainted(frameTimer.nsecsElapsed(), uploadNsecs);
 	}
 }
 
@@ -1297,8 +1469,20 @@ void GlCanvas::onControllerTransformChanged()
 
 void GlCanvas::onControllerTileCacheDirtyCheckNeeded()
 {
-	d->dirty.texture = true;
-	update();
+	// Unlike the software canvas, we always repaint the whole view, so avoid
+	// doing that when the changed tiles aren't even visible. They'll get
+	// uploaded once they are, since moving the view dirties the textures.
+	bool visibleTilesDirty = d->dirty.texture;
+	if(!visibleTilesDirty) {
+		QRect tileArea = d->controller->canvasViewTileArea();
+		d->controller->withTileCache([&](canvas::TileCache &tileCache) {
+			visibleTilesDirty = tileCache.checkDirtyTilesReset(tileArea);
+		});
+	}
+	if(visibleTilesDirty) {
+		d->dirty.texture = true;
+		update();
+	}
 }
 
 }
@@ -1,4 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/worker.h>
+}
 #include "desktop/view/softwarecanvas.h"
 #include "desktop/main.h"
 #include "desktop/settings.h"
@@ -7,6 +10,7 @@
 #include "libclient/canvas/canvasmodel.h"
 #include "libclient/canvas/paintengine.h"
 #include "libclient/canvas/tilecache.h"
+#include <QElapsedTimer>
 #include <QPaintEngine>
 #include <QPaintEvent>
 #include <QPainter>
@@ -16,7 +20,201 @@ Q_LOGGING_CATEGORY(
 
 namespace view {
 
+namespace {
+
+// A band of rows of a downscaled image, averaged from blocks of 2^level
+// pixels on each side. Blocks at the right and bottom edges may be cut off.
+struct DownscaleJob {
+	const uchar *src;
+	int srcWidth;
+	int srcHeight;
+	int srcStride;
+	uchar *dst;
+	int dstStride;
+	int level;
+	int y;
+	int rows;
+};
+
+void downscaleRows(const DownscaleJob &job)
+{
+	int level = job.level;
+	int n = 1 << level;
+	int dstWidth = (job.srcWidth + n - 1) >> level;
+	int yEnd = job.y + job.rows;
+	for(int dy = job.y; dy < yEnd; ++dy) {
+		int sy0 = dy << level;
+		int sy1 = qMin(sy0 + n, job.srcHeight);
+		uchar *out = job.dst + dy * job.dstStride;
+		for(int dx = 0; dx < dstWidth; ++dx) {
+			int sx0 = dx << level;
+			int sx1 = qMin(sx0 + n, job.srcWidth);
+			uint sums[4] = {0, 0, 0, 0};
+			for(int sy = sy0; sy < sy1; ++sy) {
+				const uchar *in = job.src + sy * job.srcStride + sx0 * 4;
+				for(int sx = sx0; sx < sx1; ++sx) {
+					sums[0] += in[0];
+					sums[1] += in[1];
+					sums[2] += in[2];
+					sums[3] += in[3];
+					in += 4;
+				}
+			}
+			// Channels are premultiplied, so averaging them keeps them valid.
+			uint count = uint((sy1 - sy0) * (sx1 - sx0));
+			for(int i = 0; i < 4; ++i) {
+				out[i] = uchar((sums[i] + count / 2u) / count);
+			}
+			out += 4;
+		}
+	}
+}
+
+void handleDownscaleJob(void *element, int threadIndex)
+{
+	Q_UNUSED(threadIndex);
+	DownscaleJob *job = static_cast<DownscaleJob *>(element);
+	downscaleRows(*job);
+}
+
+}
+
 struct SoftwareCanvas::Private {
+	// When zoomed out, the canvas is painted from a copy downscaled by a power
+	// of two, since having QPainter scale down the full-size pixmaps on every
+	// repaint is very slow. The copy is only updated where tiles changed.
+	static constexpr int MIP_LEVEL_MAX = 5;
+	static constexpr int MIP_MIN_BAND_ROWS = 32;
+
+	~Private()
+	{
+		if(mipWorker) {
+			DP_worker_free_join(mipWorker);
+		}
+	}
+
+	int getMipLevel() const
+	{
+		qreal zoom = controller->zoom();
+		int level = 0;
+		while(level < MIP_LEVEL_MAX && zoom * qreal(2 << level) <= 1.0) {
+			++level;
+		}
+		return level;
+	}
+
+	void clearMips()
+	{
+		mipImages.clear();
+		mipValid = QRegion();
+	}
+
+	void updateMips(
+		const QVector<canvas::PixmapGrid::Cell> &cells,
+		const QRectF &exposedBase)
+	{
+		int level = getMipLevel();
+		if(level != mipLevel) {
+			mipLevel = level;
+			clearMips();
+		}
+
+		if(level == 0) {
+			return;
+		}
+
+		int cellCount = cells.size();
+		if(mipImages.size() != cellCount) {
+			clearMips();
+			mipImages.resize(cellCount);
+		}
+
+		int n = 1 << level;
+		for(int i = 0; i < cellCount; ++i) {
+			const canvas::PixmapGrid::Cell &cell = cells[i];
+			QSize mipSize(
+				(cell.rect.width() + n - 1) >> level,
+				(cell.rect.height() + n - 1) >> level);
+			QImage &mipImage = mipImages[i];
+			if(mipImage.size() != mipSize) {
+				mipImage = QImage(mipSize, QImage::Format_ARGB32_Premultiplied);
+				mipValid -= cell.rect;
+			}
+
+			QRect exposed =
+				exposedBase.intersected(QRectF(cell.rect)).toAlignedRect();
+			if(!exposed.isEmpty()) {
+				QRegion invalid = QRegion(alignMipRect(exposed, n, cell.rect))
+									  .subtracted(mipValid);
+				for(const QRect &r : invalid) {
+					QRect aligned = alignMipRect(r, n, cell.rect);
+					QRect local = aligned.translated(-cell.rect.topLeft());
+					downscale(
+						cell.pixmap.copy(local).toImage().convertToFormat(
+							QImage::Format_ARGB32_Premultiplied),
+						mipImage, local.topLeft() / n, level);
+					mipValid |= aligned;
+				}
+			}
+		}
+	}
+
+	// Expands the rect to a multiple of n pixels, relative to the cell, which
+	// itself always starts at a multiple of n.
+	static QRect alignMipRect(const QRect &rect, int n, const QRect &cellRect)
+	{
+		QRect local = rect.translated(-cellRect.topLeft());
+		int left = local.left() / n * n;
+		int top = local.top() / n * n;
+		int right = (local.right() / n + 1) * n;
+		int bottom = (local.bottom() / n + 1) * n;
+		return QRect(
+				   QPoint(left, top),
+				   QPoint(
+					   qMin(right, cellRect.width()) - 1,
+					   qMin(bottom, cellRect.height()) - 1))
+			.translated(cellRect.topLeft());
+	}
+
+	void downscale(
+		const QImage &src, QImage &dst, const QPoint &dstPos, int level)
+	{
+		DownscaleJob job;
+		job.src = src.constBits();
+		job.srcWidth = src.width();
+		job.srcHeight = src.height();
+		job.srcStride = int(src.bytesPerLine());
+		job.dstStride = int(dst.bytesPerLine());
+		job.dst = dst.bits() + dstPos.y() * job.dstStride + dstPos.x() * 4;
+		job.level = level;
+		job.y = 0;
+
+		// Large areas get split into bands of rows across multiple threads.
+		int n = 1 << level;
+		int dstHeight = (src.height() + n - 1) >> level;
+		if(!mipWorker) {
+			// This holds up painting the canvas, so it gets to go first.
+			mipWorker = DP_worker_new_with_priority(
+				64, sizeof(DownscaleJob), DP_worker_cpu_count(16),
+				DP_WORKER_PRIORITY_HIGH, handleDownscaleJob);
+		}
+		int threadCount = DP_worker_thread_count(mipWorker);
+		int bandRows = qMax(
+			MIP_MIN_BAND_ROWS, (dstHeight + threadCount - 1) / threadCount);
+
+		if(bandRows >= dstHeight) {
+			job.rows = dstHeight;
+			downscaleRows(job);
+		} else {
+			for(int y = 0; y < dstHeight; y += bandRows) {
+				job.y = y;
+				job.rows = qMin(bandRows, dstHeight - y);
+				DP_worker_push(mipWorker, &job);
+			}
+			DP_worker_wait(mipWorker);
+		}
+	}
+
 	void updateOutline(qreal dpr)
 	{
 		view::CanvasScene *scene = controller->scene();
@@ -40,6 +238,7 @@ struct SoftwareCanvas::Private {
 					QRect viewRect = tf.mapRect(pixelRect).marginsAdded(
 						QMargins(1, 1, 1, 1));
 					region |= viewRect;
+					mipValid -= pixelRect;
 				});
 		}
 		return region;
@@ -60,6 +259,7 @@ struct SoftwareCanvas::Private {
 				}
 			});
 			if(wasResized) {
+				clearMips();
 				controller->updateCanvasSize(
 					resize.width, resize.height, resize.offsetX,
 					resize.offsetY);
@@ -135,13 +335,29 @@ struct SoftwareCanvas::Private {
 											 .map(QRectF(rect))
 											 .boundingRect();
 
-					for(const Cell &cell : *cells) {
+					updateMips(*cells, exposedBase);
+					int cellCount = cells->size();
+					for(int i = 0; i < cellCount; ++i) {
+						const Cell &cell = cells->at(i);
 						QRect exposed =
 							exposedBase.intersected(QRectF(cell.rect))
 								.toAlignedRect();
-						painter->drawPixmap(
-							exposed, cell.pixmap,
-							exposed.translated(-cell.rect.topLeft()));
+						if(mipLevel == 0) {
+							painter->drawPixmap(
+								exposed, cell.pixmap,
+								exposed.translated(-cell.rect.topLeft()));
+						} else if(!exposed.isEmpty()) {
+							qreal n = qreal(1 << mipLevel);
+							QRect local = alignMipRect(
+											  exposed, 1 << mipLevel, cell.rect)
+											  .translated(-cell.rect.topLeft());
+							painter->drawImage(
+								QRectF(local.translated(cell.rect.topLeft())),
+								mipImages[i],
+								QRectF(
+									local.x() / n, local.y() / n,
+									local.width() / n, local.height() / n));
+						}
 					}
 
 					if(pixelGridVisible) {
@@ -190,6 +406,10 @@ struct SoftwareCanvas::Private {
 	QColor checkerColor2;
 	QBrush checkerBrush;
 	bool renderUpdateFull = false;
+	int mipLevel = 0;
+	QVector<QImage> mipImages;
+	QRegion mipValid;
+	DP_Worker *mipWorker = nullptr;
 };
 
 SoftwareCanvas::SoftwareCanvas(CanvasController *controller, QWidget *parent)
@@ -276,8 +496,11 @@ void SoftwareCanvas::handlePaint(QPaintEvent *event)
 
 void SoftwareCanvas::paintEvent(QPaintEvent *event)
 {
+	QElapsedTimer frameTimer;
+	frameTimer.start();
 	QPainter painter(this);
 	d->paint(&painter, event->rect(), event->region());
+	d->controller->recordFramePainted(frameTimer.nsecsElapsed());
 }
 
 void SoftwareCanvas::setCheckerColor1(const QColor &color)
@@ -702,6 +702,14 @@ void TimelineWidget::paintEvent(QPaintEvent *)
 	int xScroll = d->xScroll;
 	int yScroll = d->yScroll;
 
+	// Only the tracks and frames that intersect the viewport get painted, long
+	// animations would otherwise spend most of their time on clipped stuff.
+	int firstVisibleRow = qMax(0, yScroll / rowHeight);
+	int lastVisibleRow =
+		qMin(trackCount - 1, (yScroll + h - rowHeight) / rowHeight);
+	int firstVisibleFrame = qMax(0, xScroll / columnWidth);
+	int lastVisibleFrame = (xScroll + w - headerWidth) / columnWidth;
+
 	QPainter painter{this};
 	QPalette pal = palette();
 	if(!d->editable) {
@@ -743,15 +751,27 @@ void TimelineWidget::paintEvent(QPaintEvent *)
 	// Key frames.
 	const canvas::TimelineKeyFrame *currentVisibleKeyFrame =
 		d->currentVisibleKeyFrame();
-	for(int i = 0; i < trackCount; ++i) {
+	for(int i = firstVisibleRow; i <= lastVisibleRow; ++i) {
 		int y = rowHeight + i * rowHeight - yScroll;
 		const canvas::TimelineTrack &track = tracks[trackCount - i - 1];
 		painter.setOpacity(track.hidden ? 0.5 : 1.0);
 		const QVector<canvas::TimelineKeyFrame> &keyFrames = track.keyFrames;
 		int keyFrameCount = keyFrames.size();
-		for(int j = 0; j < keyFrameCount; ++j) {
+		// Start at the last key frame at or before the first visible frame,
+		// since its trailing frames may still reach into the viewport.
+		QVector<canvas::TimelineKeyFrame>::const_iterator firstIt =
+			std::upper_bound(
+				keyFrames.constBegin(), keyFrames.constEnd(), firstVisibleFrame,
+				[](int frameIndex, const canvas::TimelineKeyFrame &kf) {
+					return frameIndex < kf.frameIndex;
+				});
+		int firstKeyFrame = qMax(0, int(firstIt - keyFrames.constBegin()) - 1);
+		for(int j = firstKeyFrame; j < keyFrameCount; ++j) {
 			const canvas::TimelineKeyFrame &keyFrame = keyFrames[j];
 			int frame = keyFrame.frameIndex;
+			if(frame > lastVisibleFrame) {
+				break;
+			}
 
 			int x = headerWidth + frame * columnWidth - xScroll;
 			bool isSelected =
@@ -837,7 +857,8 @@ void TimelineWidget::paintEvent(QPaintEvent *)
 
 	// Frame numbers along the top.
 	painter.setClipRect(d->frameHeaderRect());
-	for(int i = 0; i < frameCount; ++i) {
+	int lastVisibleHeaderFrame = qMin(frameCount - 1, lastVisibleFrame);
+	for(int i = firstVisibleFrame; i <= lastVisibleHeaderFrame; ++i) {
 		int x = headerWidth + i * columnWidth - xScroll;
 		bool isSelected = d->currentFrame == i;
 		if(isSelected) {
@@ -855,7 +876,7 @@ void TimelineWidget::paintEvent(QPaintEvent *)
 
 	// Tracks along the side.
 	painter.setClipRect(d->trackSidebarRect());
-	for(int i = 0; i < trackCount; ++i) {
+	for(int i = firstVisibleRow; i <= lastVisibleRow; ++i) {
 		int y = rowHeight + i * rowHeight - yScroll;
 		const canvas::TimelineTrack &track = tracks[trackCount - i - 1];
 		bool isSelected = track.id == d->currentTrackId;
@@ -543,7 +543,7 @@ class DrawdanceArrayFieldType(DrawdanceFieldType):
 
     def serialize_local_match(self, f, subject, dst):
         a_count = f"{subject}->{f.name}_{self.array_size_name(f)}"
-        return f"DP_write_bigendian_uint16({a_count}, {dst})"
+        return f"write_uint16({a_count}, {dst})"
 
     def match_local_match(self, f, subject):
         a_count = f"{subject}->{f.name}_{self.array_size_name(f)}"
@@ -791,7 +791,7 @@ class DrawdanceStructFieldType(DrawdanceFieldType):
 
     def serialize_local_match(self, f, subject, dst):
         a_count = f"{subject}->{f.name}_{self.array_size_name(f)}"
-        return f"DP_write_bigendian_uint16({a_count}, {dst})"
+        return f"write_uint16({a_count}, {dst})"
 
     def match_local_match(self, f, subject):
         a_count = f"{subject}->{f.name}_{self.array_size_name(f)}"
@@ -825,7 +825,7 @@ DrawdancePlainFieldType.declare(
     key="blendmode",
     base_type="uint8_t",
     payload_length=1,
-    serialize_payload_fn="DP_write_bigendian_uint8",
+    serialize_payload_fn="write_uint8",
     write_payload_text_fn="DP_text_writer_write_blend_mode",
     deserialize_payload_fn="read_uint8",
     parse_field_fn="DP_text_reader_get_blend_mode",
@@ -835,7 +835,7 @@ DrawdancePlainFieldType.declare(
     key="rgb24",
     base_type="uint32_t",
     payload_length=3,
-    serialize_payload_fn="DP_write_bigendian_uint24",
+    serialize_payload_fn="write_uint24",
     write_payload_text_fn="DP_text_writer_write_rgb_color",
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_rgb24,
     deserialize_payload_fn="read_uint24",
@@ -847,7 +847,7 @@ DrawdancePlainFieldType.declare(
     key="argb32",
     base_type="uint32_t",
     payload_length=4,
-    serialize_payload_fn="DP_write_bigendian_uint32",
+    serialize_payload_fn="write_uint32",
     write_payload_text_fn="DP_text_writer_write_argb_color",
     deserialize_payload_fn="read_uint32",
     parse_field_fn="DP_text_reader_get_argb_color",
@@ -857,7 +857,7 @@ DrawdancePlainFieldType.declare(
     key="bool",
     base_type="bool",
     payload_length=1,
-    serialize_payload_fn="DP_write_bigendian_uint8",
+    serialize_payload_fn="write_uint8",
     write_payload_text_fn="DP_text_writer_write_bool",
     deserialize_payload_fn="read_bool",
     parse_field_fn="DP_text_reader_get_bool",
@@ -867,7 +867,7 @@ DrawdancePlainFieldType.declare(
     key="i8",
     base_type="int8_t",
     payload_length=1,
-    serialize_payload_fn="DP_write_bigendian_int8",
+    serialize_payload_fn="write_int8",
     write_payload_text_fn=DrawdanceFieldType.write_text_int,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_int,
     deserialize_payload_fn="read_int8",
@@ -903,7 +903,7 @@ DrawdancePlainFieldType.declare(
     key="i32",
     base_type="int32_t",
     payload_length=4,
-    serialize_payload_fn="DP_write_bigendian_int32",
+    serialize_payload_fn="write_int32",
     write_payload_text_fn=DrawdanceFieldType.write_text_int,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_int,
     deserialize_payload_fn="read_int32",
@@ -915,7 +915,7 @@ DrawdancePlainFieldType.declare(
     key="u8",
     base_type="uint8_t",
     payload_length=1,
-    serialize_payload_fn="DP_write_bigendian_uint8",
+    serialize_payload_fn="write_uint8",
     write_payload_text_fn=DrawdanceFieldType.write_text_uint,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_uint,
     deserialize_payload_fn="read_uint8",
@@ -927,7 +927,7 @@ DrawdancePlainFieldType.declare(
     key="u16",
     base_type="uint16_t",
     payload_length=2,
-    serialize_payload_fn="DP_write_bigendian_uint16",
+    serialize_payload_fn="write_uint16",
     write_payload_text_fn=DrawdanceFieldType.write_text_uint,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_uint,
     deserialize_payload_fn="read_uint16",
@@ -939,7 +939,7 @@ DrawdancePlainFieldType.declare(
     key="u24",
     base_type="uint32_t",
     payload_length=3,
-    serialize_payload_fn="DP_write_bigendian_uint24",
+    serialize_payload_fn="write_uint24",
     write_payload_text_fn=DrawdanceFieldType.write_text_uint,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_uint,
     deserialize_payload_fn="read_uint24",
@@ -952,7 +952,7 @@ DrawdancePlainFieldType.declare(
     key="u32",
     base_type="uint32_t",
     payload_length=4,
-    serialize_payload_fn="DP_write_bigendian_uint32",
+    serialize_payload_fn="write_uint32",
     write_payload_text_fn=DrawdanceFieldType.write_text_uint,
     write_subfield_payload_text_fn=DrawdanceFieldType.write_subfield_text_uint,
     deserialize_payload_fn="read_uint32",
@@ -63,6 +63,11 @@
 #    define DP_SIMD_ALIGNMENT 32
 #    define DP_ALIGNAS_SIMD   alignas(DP_SIMD_ALIGNMENT)
 #else
+#    if !defined(RUST_BINDGEN) && (defined(_M_ARM64) || defined(__aarch64__))
+#        define DP_CPU_ARM64
+#    elif !defined(RUST_BINDGEN) && defined(__wasm_simd128__)
+#        define DP_CPU_WASM_SIMD128
+#    endif
 #    define DP_SIMD_ALIGNMENT 32
 #    define DP_ALIGNAS_SIMD   // nothing
 #endif
@@ -240,6 +245,11 @@ DP_INLINE uint64_t DP_clamp_uint64(uint64_t x, uint64_t min, uint64_t max)
     return x < min ? min : x > max ? max : x;
 }
 
+DP_INLINE double DP_clamp_double(double x, double min, double max)
+{
+    return x < min ? min : x > max ? max : x;
+}
+
 DP_INLINE float DP_min_float(float x, float y)
 {
     return x < y ? x : y;
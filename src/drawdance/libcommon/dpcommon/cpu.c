@@ -62,6 +62,22 @@ static DP_CpuSupport get_env_cpu_support(void)
         DP_warn("Restricting CPU support to at most AVX2");
         return DP_CPU_SUPPORT_AVX2;
     }
+    else if (DP_str_equal_lowercase(value, "avx512bw")) {
+        DP_warn("Restricting CPU support to at most AVX-512BW");
+        return DP_CPU_SUPPORT_AVX512BW;
+    }
+#endif
+#ifdef DP_CPU_ARM64
+    else if (DP_str_equal_lowercase(value, "neon")) {
+        DP_warn("Restricting CPU support to at most NEON");
+        return DP_CPU_SUPPORT_NEON;
+    }
+#endif
+#ifdef DP_CPU_WASM_SIMD128
+    else if (DP_str_equal_lowercase(value, "simd128")) {
+        DP_warn("Restricting CPU support to at most WebAssembly SIMD");
+        return DP_CPU_SUPPORT_SIMD128;
+    }
 #endif
     else {
         DP_warn("Unknown DP_CPU_SUPPORT value '%s', ignoring it", value);
@@ -116,13 +132,35 @@ static bool supports_avx2(void)
 #    endif
 }
 
+static bool supports_avx512bw(void)
+{
+#    if defined(__AVX512F__) && defined(__AVX512BW__)
+    return true;
+#    elif defined(_MSC_VER)
+    // The operating system also has to save the upper halves of the registers,
+    // which the compiler builtins check for us, but __cpuid doesn't.
+    int CPUInfo[4];
+    __cpuidex(CPUInfo, 7, 0);
+    return (CPUInfo[1] & (1 << 16)) != 0 && (CPUInfo[1] & (1 << 30)) != 0
+        && (_xgetbv(0) & 0xe6) == 0xe6;
+#    elif defined(__clang__) || defined(__GNUC__)
+    return __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw");
+#    else
+    return false; // unknown compiler
+#    endif
+}
+
 #endif
 
 void DP_cpu_support_init(void)
 {
     DP_CpuSupport max_support = get_env_cpu_support();
 #ifdef DP_CPU_X64
-    if (max_support >= DP_CPU_SUPPORT_AVX2 && supports_avx2()) {
+    if (max_support >= DP_CPU_SUPPORT_AVX512BW && supports_avx512bw()) {
+        DP_cpu_support_value = DP_CPU_SUPPORT_AVX512BW;
+    }
+    else if (max_support >= DP_CPU_SUPPORT_AVX2 && supports_avx2()) {
         DP_cpu_support_value = DP_CPU_SUPPORT_AVX2;
     }
     else if (max_support >= DP_CPU_SUPPORT_AVX && supports_avx()) {
@@ -134,6 +172,23 @@ void DP_cpu_support_init(void)
     else {
         DP_cpu_support_value = DP_CPU_SUPPORT_DEFAULT;
     }
+#elif defined(DP_CPU_ARM64)
+    // Advanced SIMD is mandatory on AArch64, no need to check for it.
+    if (max_support >= DP_CPU_SUPPORT_NEON) {
+        DP_cpu_support_value = DP_CPU_SUPPORT_NEON;
+    }
+    else {
+        DP_cpu_support_value = DP_CPU_SUPPORT_DEFAULT;
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    // There's no way to check for SIMD support at runtime in WebAssembly, a
+    // browser without it will refuse to load the module in the first place.
+    if (max_support >= DP_CPU_SUPPORT_SIMD128) {
+        DP_cpu_support_value = DP_CPU_SUPPORT_SIMD128;
+    }
+    else {
+        DP_cpu_support_value = DP_CPU_SUPPORT_DEFAULT;
+    }
 #else
     (void)max_support;
     DP_cpu_support_value = DP_CPU_SUPPORT_DEFAULT;
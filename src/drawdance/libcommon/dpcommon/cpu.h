@@ -52,6 +52,14 @@
 #            define __AVX2__
 #            define UNDEF__AVX2__
 #        endif
+#        ifndef __AVX512F__
+#            define __AVX512F__
+#            define UNDEF__AVX512F__
+#        endif
+#        ifndef __AVX512BW__
+#            define __AVX512BW__
+#            define UNDEF__AVX512BW__
+#        endif
 
 #        include <intrin.h>
 
@@ -79,11 +87,23 @@
 #            undef __AVX2__
 #            undef UNDEF__AVX2__
 #        endif
+#        ifdef UNDEF__AVX512F__
+#            undef __AVX512F__
+#            undef UNDEF__AVX512F__
+#        endif
+#        ifdef UNDEF__AVX512BW__
+#            undef __AVX512BW__
+#            undef UNDEF__AVX512BW__
+#        endif
 #    elif defined(__clang__) || defined(__GNUC__)
 #        include <x86intrin.h>
 #    else
 #        include <intrin.h>
 #    endif
+#elif defined(DP_CPU_ARM64)
+#    include <arm_neon.h>
+#elif defined(DP_CPU_WASM_SIMD128)
+#    include <wasm_simd128.h>
 #endif
 
 #define DP_DO_PRAGMA_(x) _Pragma(#x)
@@ -109,24 +129,37 @@ typedef enum DP_CpuSupport {
     DP_CPU_SUPPORT_SSE42,
     DP_CPU_SUPPORT_AVX,
     DP_CPU_SUPPORT_AVX2,
+    DP_CPU_SUPPORT_AVX512BW,
+#endif
+#ifdef DP_CPU_ARM64
+    DP_CPU_SUPPORT_NEON, // baseline on AArch64, only off if restricted
+#endif
+#ifdef DP_CPU_WASM_SIMD128
+    DP_CPU_SUPPORT_SIMD128, // compiled in via -msimd128, only off if restricted
 #endif
     DP_CPU_SUPPORT_COUNT,
 } DP_CpuSupport;
 
 void DP_cpu_support_init(void);
 
-// If AVX2, AVX or SSE 4.2 are requested at compile-time, we switch to those at
-// compile-time instead of doing a dynamic check. If your processor supports
-// AVX2 but you ask for SSE 4.2 at compile-time then you only get the latter.
+// What DP_cpu_support_init detected. Tests change it to compare the code paths
+// for each level of support, unless that's fixed at compile-time below.
+extern DP_CpuSupport DP_cpu_support_value;
+
+// If AVX-512BW, AVX2, AVX or SSE 4.2 are requested at compile-time, we switch
+// to those at compile-time instead of doing a dynamic check. If your processor
+// supports AVX2 but you ask for SSE 4.2 at compile-time then you only get the
+// latter.
 #ifdef NDEBUG
-#    if defined(DP_CPU_X64) && defined(__AVX2__)
+#    if defined(DP_CPU_X64) && defined(__AVX512F__) && defined(__AVX512BW__)
+#        define DP_cpu_support DP_CPU_SUPPORT_AVX512BW
+#    elif defined(DP_CPU_X64) && defined(__AVX2__)
 #        define DP_cpu_support DP_CPU_SUPPORT_AVX2
 #    elif defined(DP_CPU_X64) && defined(__AVX__)
 #        define DP_cpu_support DP_CPU_SUPPORT_AVX
 #    elif defined(DP_CPU_X64) && defined(__SSE4_2__)
 #        define DP_cpu_support DP_CPU_SUPPORT_SSE42
 #    else
-extern DP_CpuSupport DP_cpu_support_value;
 #        define DP_cpu_support DP_cpu_support_value
 #    endif
 #else
@@ -26,8 +26,14 @@
 #include <stdio.h>
 #include <string.h>
 
-#ifdef DP_QT_IO
+#if defined(DP_QT_IO)
 #    include "input_qt.h"
+#elif !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#    define DP_INPUT_MMAP
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
 #endif
 
 
@@ -325,6 +331,57 @@ DP_Input *DP_file_input_new_from_path(const char *path)
 #endif
 }
 
+#ifdef DP_INPUT_MMAP
+static void unmap_file_input(void *buffer, size_t size,
+                             DP_UNUSED void *free_arg)
+{
+    if (munmap(buffer, size) != 0) {
+        DP_warn("Error unmapping %zu bytes: %s", size, strerror(errno));
+    }
+}
+
+static DP_Input *map_file_input(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    // Empty files and things like pipes can't be mapped.
+    void *buffer = MAP_FAILED;
+    size_t size = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && (uintmax_t)st.st_size <= SIZE_MAX) {
+        size = (size_t)st.st_size;
+        buffer = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping stays valid after the file descriptor is closed.
+    close(fd);
+    return buffer == MAP_FAILED
+             ? NULL
+             : DP_mem_input_new(buffer, size, unmap_file_input, NULL);
+}
+#endif
+
+DP_Input *DP_file_input_new_mapped_from_path(const char *path)
+{
+    DP_ASSERT(path);
+#if defined(DP_QT_IO)
+    return DP_qfile_input_new_mapped_from_path(path, DP_input_new,
+                                               DP_mem_input_new);
+#else
+#    ifdef DP_INPUT_MMAP
+    DP_Input *input = map_file_input(path);
+    if (input) {
+        return input;
+    }
+#    endif
+    return DP_file_input_new_from_path(path);
+#endif
+}
+
 
 typedef struct DP_MemInputState {
     void *buffer;
@@ -376,7 +433,7 @@ static bool mem_input_rewind_by(void *internal, size_t size)
 static bool mem_input_seek(void *internal, size_t offset)
 {
     DP_MemInputState *state = internal;
-    if (offset < state->size) {
+    if (offset <= state->size) {
         state->pos = offset;
         return true;
     }
@@ -442,6 +499,26 @@ DP_Input *DP_mem_input_new_keep_on_close(const void *buffer, size_t size)
     return DP_mem_input_new((void *)buffer, size, NULL, NULL);
 }
 
+const void *DP_input_borrow(DP_Input *input, size_t size, size_t *out_size)
+{
+    DP_ASSERT(input);
+    DP_ASSERT(out_size);
+    if (input->methods == &mem_input_methods) {
+        DP_MemInputState *state = (DP_MemInputState *)input->internal;
+        DP_ASSERT(state->pos <= state->size);
+        size_t left = state->size - state->pos;
+        size_t borrowed = size <= left ? size : left;
+        const unsigned char *data =
+            (const unsigned char *)state->buffer + state->pos;
+        state->pos += borrowed;
+        *out_size = borrowed;
+        return data;
+    }
+    else {
+        return NULL;
+    }
+}
+
 
 DP_BufferedInput DP_buffered_input_init(DP_Input *input)
 {
@@ -65,6 +65,13 @@ bool DP_input_seek_by(DP_Input *input, size_t size);
 
 QIODevice *DP_input_qiodevice(DP_Input *input);
 
+// Returns a pointer to the next size (or fewer, at the end) bytes of the input
+// and advances past them without copying anything. Only memory inputs support
+// this, for others it returns NULL and the caller has to read instead. Views
+// borrowed one after the other are contiguous and stay valid until the input
+// is freed.
+const void *DP_input_borrow(DP_Input *input, size_t size, size_t *out_size);
+
 
 #ifndef RUST_BINDGEN
 DP_Input *DP_file_input_new(FILE *fp, bool close);
@@ -74,6 +81,12 @@ DP_Input *DP_file_input_new_from_stdin(bool close);
 
 DP_Input *DP_file_input_new_from_path(const char *path);
 
+// Maps the file into memory if possible, making it a memory input that reads
+// are just copies from and that DP_input_borrow works on. Falls back to a
+// regular file input otherwise. The file shouldn't be truncated while this is
+// open, so don't use it on something that might be written to concurrently.
+DP_Input *DP_file_input_new_mapped_from_path(const char *path);
+
 
 typedef void (*DP_MemInputFreeFn)(void *buffer, size_t size, void *free_arg);
 
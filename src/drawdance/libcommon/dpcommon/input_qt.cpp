@@ -137,12 +137,11 @@ extern "C" DP_Input *DP_qfile_input_new(QFile *file, bool close,
     return new_fn(qfile_input_init, &state, sizeof(DP_QFileInputState));
 }
 
-extern "C" DP_Input *DP_qfile_input_new_from_path(const char *path,
-                                                  DP_InputQtNewFn new_fn)
+static QFile *open_qfile(const char *path)
 {
     QFile *file = new QFile{QString::fromUtf8(path)};
     if (file->open(QIODevice::ReadOnly)) {
-        return DP_qfile_input_new(file, true, new_fn);
+        return file;
     }
     else {
         DP_error_set("Can't open '%s': %s", path,
@@ -151,3 +150,41 @@ extern "C" DP_Input *DP_qfile_input_new_from_path(const char *path,
         return nullptr;
     }
 }
+
+extern "C" DP_Input *DP_qfile_input_new_from_path(const char *path,
+                                                  DP_InputQtNewFn new_fn)
+{
+    QFile *file = open_qfile(path);
+    return file ? DP_qfile_input_new(file, true, new_fn) : nullptr;
+}
+
+static void qfile_input_unmap(DP_UNUSED void *buffer, DP_UNUSED size_t size,
+                              void *free_arg)
+{
+    // Closing the file gets rid of the mapping.
+    QFile *file = static_cast<QFile *>(free_arg);
+    file->close();
+    delete file;
+}
+
+extern "C" DP_Input *
+DP_qfile_input_new_mapped_from_path(const char *path, DP_InputQtNewFn new_fn,
+                                    DP_InputQtMemNewFn mem_new_fn)
+{
+    QFile *file = open_qfile(path);
+    if (!file) {
+        return nullptr;
+    }
+
+    // Empty files and things like pipes can't be mapped.
+    qint64 size = file->size();
+    uchar *buffer = size > 0 && !file->isSequential() && size_t(size) == size
+                      ? file->map(0, size)
+                      : nullptr;
+    if (buffer) {
+        return mem_new_fn(buffer, size_t(size), qfile_input_unmap, file);
+    }
+    else {
+        return DP_qfile_input_new(file, true, new_fn);
+    }
+}
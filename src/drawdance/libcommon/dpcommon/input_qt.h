@@ -14,11 +14,18 @@ typedef struct QFile QFile;
 typedef DP_Input *(*DP_InputQtNewFn)(DP_InputInitFn init, void *arg,
                                      size_t internal_size);
 
+typedef DP_Input *(*DP_InputQtMemNewFn)(void *buffer, size_t size,
+                                        DP_MemInputFreeFn free, void *free_arg);
+
 
 DP_Input *DP_qfile_input_new(QFile *file, bool close, DP_InputQtNewFn new_fn);
 
 DP_Input *DP_qfile_input_new_from_path(const char *path,
                                        DP_InputQtNewFn new_fn);
 
+DP_Input *DP_qfile_input_new_mapped_from_path(const char *path,
+                                              DP_InputQtNewFn new_fn,
+                                              DP_InputQtMemNewFn mem_new_fn);
+
 
 #endif
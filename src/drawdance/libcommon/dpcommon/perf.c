@@ -25,7 +25,6 @@
 #include "conversions.h"
 #include "output.h"
 #include "threading.h"
-#include "vector.h"
 
 // On Windows, we use QueryPerformanceCounter. On Darwin and old Android libc,
 // we use gettimeofday. On normal systems, we use the standard timespec_get.
@@ -58,19 +57,77 @@
 #endif
 
 
-#define INITIAL_CAPACITY 64
+// Each thread that records something gets its own ring buffer, which only it
+// writes into and only the writer thread reads from, so recording an event
+// never takes a lock or touches the output. Buffers are allocated the first
+// time a thread records something and never freed, a thread that can't get
+// one or whose buffer is full drops its events. Spans must be ended on the
+// same thread that began them. Span handles also carry the generation of the
+// recording they were begun in, spans left open when a recording gets closed
+// are reused in the next one and their stale handles are ignored.
+#define MAX_THREADS        64
+#define MAX_OPEN_SPANS     64
+#define HANDLE_INDEXES     (MAX_THREADS * MAX_OPEN_SPANS)
+#define HANDLE_GENERATIONS (INT_MAX / HANDLE_INDEXES)
+#define BUFFER_CAPACITY  2048
+#define WAKE_INTERVAL    256
 #define DETAIL_LENGTH    256
+#define FILTER_LENGTH    256
 #define NS_IN_S          1000000000
+#define NS_IN_US         1000.0
 
-typedef struct DP_PerfEntry {
+typedef enum DP_PerfEventType {
+    DP_PERF_EVENT_SPAN,
+    DP_PERF_EVENT_COUNTER,
+} DP_PerfEventType;
+
+typedef struct DP_PerfEvent {
+    DP_PerfEventType type;
     unsigned long long start;
+    unsigned long long end;
+    double value;
     const char *realm;
     const char *categories;
     char detail[DETAIL_LENGTH];
-} DP_PerfEntry;
+} DP_PerfEvent;
+
+typedef struct DP_PerfSpan {
+    bool open;
+    int generation;
+    DP_PerfEvent event;
+} DP_PerfSpan;
+
+typedef struct DP_PerfBuffer {
+    DP_Atomic head; // Next index to write, only changed by the owning thread.
+    DP_Atomic tail; // Next index to read, only changed by the writer thread.
+    DP_Atomic dropped;
+    unsigned int pushed;
+    DP_PerfSpan spans[MAX_OPEN_SPANS];
+    DP_PerfEvent events[BUFFER_CAPACITY];
+} DP_PerfBuffer;
+
+typedef enum DP_PerfSlotState {
+    DP_PERF_SLOT_FREE,
+    DP_PERF_SLOT_CLAIMING,
+    DP_PERF_SLOT_OWNED,
+} DP_PerfSlotState;
+
+typedef struct DP_PerfSlot {
+    DP_Atomic state;
+    DP_ThreadId thread_id;
+    DP_PerfBuffer *buffer;
+} DP_PerfSlot;
 
 static DP_Mutex *perf_mutex;
-static DP_Vector perf_entries;
+static DP_PerfSlot perf_slots[MAX_THREADS];
+static DP_Atomic perf_slots_dropped;
+static DP_Semaphore *perf_writer_sem;
+static DP_Thread *perf_writer_thread;
+static DP_Atomic perf_writer_quit;
+static DP_Atomic perf_generation;
+static DP_PerfFormat perf_format;
+static char perf_filter[FILTER_LENGTH];
+static bool perf_first_event;
 
 DP_Output *DP_perf_output;
 
@@ -87,17 +144,240 @@ static bool init_mutex(void)
     return perf_mutex;
 }
 
+
+// Checked when recording. The filter only changes while the output is closed,
+// so this doesn't need the mutex.
+static bool filter_matches(const char *categories)
+{
+    const char *start = perf_filter;
+    if (start[0] == '\0') {
+        return true;
+    }
+
+    while (true) {
+        const char *end = strchr(start, ',');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        if (length != 0 && strncmp(categories, start, length) == 0) {
+            return true;
+        }
+        else if (!end) {
+            return false;
+        }
+        start = end + 1;
+    }
+}
+
+static unsigned long long thread_id_number(DP_ThreadId thread_id)
+{
+#ifdef __EMSCRIPTEN_PTHREADS__
+    return (unsigned long long)(uintptr_t)thread_id;
+#else
+    return (unsigned long long)thread_id;
+#endif
+}
+
+// Escapes quotes and backslashes, replaces control characters with spaces.
+// Truncates the result to fit the buffer.
+static const char *json_escape(const char *s, char *buffer, size_t size)
+{
+    size_t i = 0;
+    for (const char *c = s; *c != '\0' && i + 2 < size; ++c) {
+        if (*c == '"' || *c == '\\') {
+            buffer[i++] = '\\';
+            buffer[i++] = *c;
+        }
+        else if ((unsigned char)*c < 0x20) {
+            buffer[i++] = ' ';
+        }
+        else {
+            buffer[i++] = *c;
+        }
+    }
+    buffer[i] = '\0';
+    return buffer;
+}
+
+static const char *event_separator(void)
+{
+    if (perf_first_event) {
+        perf_first_event = false;
+        return "\n";
+    }
+    else {
+        return ",\n";
+    }
+}
+
+static bool write_span(DP_Output *output, DP_ThreadId thread_id,
+                       DP_PerfEvent *ev)
+{
+    unsigned long long diff = ev->end - ev->start;
+    const char *detail = ev->detail;
+    if (perf_format == DP_PERF_FORMAT_CHROME_TRACE) {
+        // Complete events, the viewer nests them by time on each thread.
+        char escaped[DETAIL_LENGTH * 2];
+        bool have_detail = detail[0] != '\0';
+        return DP_output_format(
+            output,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":0,\"tid\":%llu%s%s%s}",
+            event_separator(), ev->categories, ev->realm,
+            DP_ullong_to_double(ev->start) / NS_IN_US,
+            DP_ullong_to_double(diff) / NS_IN_US, thread_id_number(thread_id),
+            have_detail ? ",\"args\":{\"detail\":\"" : "",
+            have_detail ? json_escape(detail, escaped, sizeof(escaped)) : "",
+            have_detail ? "\"}" : "");
+    }
+    else {
+        double start_seconds = DP_ullong_to_double(ev->start) / NS_IN_S;
+        double end_seconds = DP_ullong_to_double(ev->end) / NS_IN_S;
+        return DP_output_format(
+            output, "%" DP_THREAD_ID_FMT " %f %f %llu %s:%s%s%s\n", thread_id,
+            start_seconds, end_seconds, diff, ev->realm, ev->categories,
+            detail[0] == '\0' ? "" : " ", detail);
+    }
+}
+
+static bool write_counter(DP_Output *output, DP_ThreadId thread_id,
+                          DP_PerfEvent *ev)
+{
+    if (perf_format == DP_PERF_FORMAT_CHROME_TRACE) {
+        return DP_output_format(
+            output,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,"
+            "\"pid\":0,\"tid\":%llu,\"args\":{\"value\":%f}}",
+            event_separator(), ev->categories, ev->realm,
+            DP_ullong_to_double(ev->start) / NS_IN_US,
+            thread_id_number(thread_id), ev->value);
+    }
+    else {
+        double seconds = DP_ullong_to_double(ev->start) / NS_IN_S;
+        return DP_output_format(
+            output, "%" DP_THREAD_ID_FMT " %f %f 0 %s:%s value=%f\n", thread_id,
+            seconds, seconds, ev->realm, ev->categories, ev->value);
+    }
+}
+
+static void write_event(DP_Output *output, DP_ThreadId thread_id,
+                        DP_PerfEvent *ev)
+{
+    bool ok = ev->type == DP_PERF_EVENT_COUNTER
+                ? write_counter(output, thread_id, ev)
+                : write_span(output, thread_id, ev);
+    if (!ok) {
+        DP_warn("Error formatting perf output: %s", DP_error());
+    }
+}
+
+// Only called by the writer thread or while it isn't running.
+static void flush_buffers(DP_Output *output)
+{
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        DP_PerfSlot *slot = &perf_slots[i];
+        if (DP_atomic_get(&slot->state) == DP_PERF_SLOT_OWNED) {
+            DP_PerfBuffer *buffer = slot->buffer;
+            int head = DP_atomic_get(&buffer->head);
+            int tail = DP_atomic_get(&buffer->tail);
+            while (tail != head) {
+                write_event(output, slot->thread_id, &buffer->events[tail]);
+                tail = (tail + 1) % BUFFER_CAPACITY;
+            }
+            DP_atomic_set(&buffer->tail, tail);
+        }
+    }
+}
+
+// Throws away whatever was left over from a previous recording.
+static void discard_buffers(void)
+{
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        DP_PerfSlot *slot = &perf_slots[i];
+        if (DP_atomic_get(&slot->state) == DP_PERF_SLOT_OWNED) {
+            DP_PerfBuffer *buffer = slot->buffer;
+            DP_atomic_set(&buffer->tail, DP_atomic_get(&buffer->head));
+            DP_atomic_set(&buffer->dropped, 0);
+        }
+    }
+    DP_atomic_set(&perf_slots_dropped, 0);
+}
+
+static int count_dropped(void)
+{
+    int dropped = DP_atomic_get(&perf_slots_dropped);
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        DP_PerfSlot *slot = &perf_slots[i];
+        if (DP_atomic_get(&slot->state) == DP_PERF_SLOT_OWNED) {
+            dropped += DP_atomic_get(&slot->buffer->dropped);
+        }
+    }
+    return dropped;
+}
+
+static void run_writer(void *data)
+{
+    DP_thread_role_set(DP_THREAD_ROLE_BACKGROUND);
+    DP_Output *output = data;
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(perf_writer_sem);
+        bool quit = DP_atomic_get(&perf_writer_quit);
+        flush_buffers(output);
+        if (quit) {
+            break;
+        }
+    }
+}
+
 static bool close_perf(DP_Output *output)
 {
-    bool ok = DP_output_free(output);
+    DP_atomic_set(&perf_writer_quit, true);
+    DP_SEMAPHORE_MUST_POST(perf_writer_sem);
+    DP_thread_free_join(perf_writer_thread);
+    perf_writer_thread = NULL;
+
+    int dropped = count_dropped();
+    if (dropped != 0) {
+        DP_warn("Dropped %d perf events", dropped);
+    }
+
+    bool ok = true;
+    if (perf_format == DP_PERF_FORMAT_CHROME_TRACE) {
+        ok = DP_OUTPUT_PRINT_LITERAL(output, "\n]}\n");
+    }
+    ok = DP_output_free(output) && ok;
     if (!ok) {
         DP_error_set("Error closing perf output: %s", DP_error());
     }
-    DP_vector_dispose(&perf_entries);
     return ok;
 }
 
+static bool print_header(DP_Output *output, DP_PerfFormat format)
+{
+    switch (format) {
+    case DP_PERF_FORMAT_TEXT:
+        return DP_OUTPUT_PRINT_LITERAL(
+            output,
+            "# Drawdance performance recording v" DP_PERF_VERSION "\n"
+            "# Timed using " DP_PERF_TIMER_SOURCE "\n"
+            "# <thread_id> <start_seconds>.<start_nanoseconds> "
+            "<end_seconds>.<end_nanoseconds> <diff_nanoseconds> <category> "
+            "<details...>\n");
+    case DP_PERF_FORMAT_CHROME_TRACE:
+        return DP_OUTPUT_PRINT_LITERAL(
+            output, "{\"displayTimeUnit\":\"ns\",\"otherData\":{"
+                    "\"version\":\"Drawdance performance recording "
+                    "v" DP_PERF_VERSION "\",\"timer\":\"" DP_PERF_TIMER_SOURCE
+                    "\"},\"traceEvents\":[");
+    }
+    DP_UNREACHABLE();
+}
+
 bool DP_perf_open(DP_Output *output)
+{
+    return DP_perf_open_with(output, DP_PERF_FORMAT_TEXT, NULL);
+}
+
+bool DP_perf_open_with(DP_Output *output, DP_PerfFormat format,
+                       const char *filter_or_null)
 {
     if (!output) {
         DP_error_set("Given output is null");
@@ -111,19 +391,50 @@ bool DP_perf_open(DP_Output *output)
 
     DP_MUTEX_MUST_LOCK(perf_mutex);
     DP_Output *prev_output = DP_perf_output;
-    if (prev_output && !close_perf(prev_output)) {
-        DP_warn("Reopen perf output: %s", DP_error());
+    if (prev_output) {
+        DP_perf_output = NULL;
+        if (!close_perf(prev_output)) {
+            DP_warn("Reopen perf output: %s", DP_error());
+        }
+    }
+
+    if (!perf_writer_sem) {
+        perf_writer_sem = DP_semaphore_new(0);
+        if (!perf_writer_sem) {
+            DP_MUTEX_MUST_UNLOCK(perf_mutex);
+            DP_output_free(output);
+            return false;
+        }
+    }
+
+    perf_format = format;
+    if (filter_or_null && strlen(filter_or_null) >= (size_t)FILTER_LENGTH) {
+        DP_warn("Perf filter too long, truncating it");
+    }
+    snprintf(perf_filter, FILTER_LENGTH, "%s",
+             filter_or_null ? filter_or_null : "");
+    perf_first_event = true;
+    DP_atomic_set(&perf_generation,
+                  (DP_atomic_get(&perf_generation) + 1) % HANDLE_GENERATIONS);
+    discard_buffers();
+
+    if (!print_header(output, format)) {
+        DP_MUTEX_MUST_UNLOCK(perf_mutex);
+        DP_output_free(output);
+        return false;
     }
+
+    DP_atomic_set(&perf_writer_quit, false);
+    perf_writer_thread = DP_thread_new(run_writer, output);
+    if (!perf_writer_thread) {
+        DP_MUTEX_MUST_UNLOCK(perf_mutex);
+        DP_output_free(output);
+        return false;
+    }
+
     DP_perf_output = output;
-    DP_VECTOR_INIT_TYPE(&perf_entries, DP_PerfEntry, INITIAL_CAPACITY);
     DP_MUTEX_MUST_UNLOCK(perf_mutex);
-
-    return DP_OUTPUT_PRINT_LITERAL(
-        output, "# Drawdance performance recording v" DP_PERF_VERSION "\n"
-                "# Timed using " DP_PERF_TIMER_SOURCE "\n"
-                "# <thread_id> <start_seconds>.<start_nanoseconds> "
-                "<end_seconds>.<end_nanoseconds> <diff_nanoseconds> <category> "
-                "<details...>\n");
+    return true;
 }
 
 bool DP_perf_close(void)
@@ -136,8 +447,8 @@ bool DP_perf_close(void)
     bool ok;
     DP_Output *output = DP_perf_output;
     if (output) {
-        ok = close_perf(output);
         DP_perf_output = NULL;
+        ok = close_perf(output);
     }
     else {
         ok = false;
@@ -154,29 +465,68 @@ bool DP_perf_is_open(void)
 }
 
 
-static bool is_available_perf_entry(void *entry, DP_UNUSED void *user)
+static DP_PerfBuffer *claim_slot(DP_PerfSlot *slot, DP_ThreadId thread_id)
 {
-    DP_PerfEntry *pe = entry;
-    return pe->realm == NULL;
+    DP_PerfBuffer *buffer = DP_malloc_zeroed(sizeof(*buffer));
+    slot->thread_id = thread_id;
+    slot->buffer = buffer;
+    DP_atomic_set(&slot->state, DP_PERF_SLOT_OWNED);
+    return buffer;
 }
 
-static DP_PerfEntry *perf_entry_at(int handle)
+// A thread's slot is the first one that was free when it first looked for one.
+// Slots never get freed again, so it will find it again the same way, always
+// before any free one. The starting point is picked by thread id so that
+// usually only a single slot needs to be looked at.
+static DP_PerfBuffer *get_buffer(int *out_index)
 {
-    return DP_vector_at(&perf_entries, sizeof(DP_PerfEntry),
-                        DP_int_to_size(handle));
+    DP_ThreadId thread_id = DP_thread_current_id();
+    int start = (int)(thread_id_number(thread_id) % MAX_THREADS);
+    for (int offset = 0; offset < MAX_THREADS; ++offset) {
+        int index = (start + offset) % MAX_THREADS;
+        DP_PerfSlot *slot = &perf_slots[index];
+        while (true) {
+            int state = DP_atomic_get(&slot->state);
+            if (state == DP_PERF_SLOT_OWNED) {
+                if (slot->thread_id == thread_id) {
+                    *out_index = index;
+                    return slot->buffer;
+                }
+                break;
+            }
+            else if (state == DP_PERF_SLOT_FREE) {
+                if (DP_atomic_compare_exchange(&slot->state,
+                                               DP_PERF_SLOT_FREE,
+                                               DP_PERF_SLOT_CLAIMING)) {
+                    *out_index = index;
+                    return claim_slot(slot, thread_id);
+                }
+            }
+            else {
+                break;
+            }
+        }
+    }
+    DP_atomic_inc(&perf_slots_dropped);
+    return NULL;
 }
 
-static DP_PerfEntry *search_or_push_perf_entry(int *out_handle)
+static void push_event(DP_PerfBuffer *buffer, const DP_PerfEvent *ev)
 {
-    int handle = DP_vector_search_index(&perf_entries, sizeof(DP_PerfEntry),
-                                        is_available_perf_entry, NULL);
-    if (handle == -1) {
-        *out_handle = DP_size_to_int(perf_entries.used);
-        return DP_vector_push(&perf_entries, sizeof(DP_PerfEntry));
+    int head = DP_atomic_get(&buffer->head);
+    int next = (head + 1) % BUFFER_CAPACITY;
+    if (next == DP_atomic_get(&buffer->tail)) {
+        DP_atomic_inc(&buffer->dropped);
     }
     else {
-        *out_handle = handle;
-        return perf_entry_at(handle);
+        buffer->events[head] = *ev;
+        DP_atomic_set(&buffer->head, next);
+        if (++buffer->pushed % WAKE_INTERVAL == 0) {
+            DP_Semaphore *sem = perf_writer_sem;
+            if (sem) {
+                DP_SEMAPHORE_MUST_POST(sem);
+            }
+        }
     }
 }
 
@@ -233,47 +583,89 @@ int DP_perf_begin_internal(const char *realm, const char *categories,
 {
     DP_ASSERT(realm);
     DP_ASSERT(categories);
-    DP_ASSERT(perf_mutex);
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    int handle;
-    DP_PerfEntry *pe = search_or_push_perf_entry(&handle);
-    pe->start = DP_perf_time();
-    pe->realm = realm;
-    pe->categories = categories;
-    if (fmt) {
-        vsnprintf(pe->detail, DETAIL_LENGTH, fmt, ap);
+    if (!filter_matches(categories)) {
+        return DP_PERF_INVALID_HANDLE;
+    }
+
+    int index;
+    DP_PerfBuffer *buffer = get_buffer(&index);
+    if (!buffer) {
+        return DP_PERF_INVALID_HANDLE;
+    }
+
+    int generation = DP_atomic_get(&perf_generation);
+    for (int i = 0; i < MAX_OPEN_SPANS; ++i) {
+        DP_PerfSpan *span = &buffer->spans[i];
+        if (!span->open || span->generation != generation) {
+            span->open = true;
+            span->generation = generation;
+            DP_PerfEvent *ev = &span->event;
+            ev->type = DP_PERF_EVENT_SPAN;
+            ev->realm = realm;
+            ev->categories = categories;
+            if (fmt) {
+                vsnprintf(ev->detail, DETAIL_LENGTH, fmt, ap);
+            }
+            else {
+                ev->detail[0] = '\0';
+            }
+            ev->start = DP_perf_time();
+            return generation * HANDLE_INDEXES + index * MAX_OPEN_SPANS + i;
+        }
+    }
+
+    DP_atomic_inc(&buffer->dropped);
+    return DP_PERF_INVALID_HANDLE;
+}
+
+int DP_perf_begin_detail(const char *realm, const char *categories,
+                         const char *detail_or_null)
+{
+    if (detail_or_null) {
+        return DP_perf_begin(realm, categories, "%s", detail_or_null);
     }
     else {
-        pe->detail[0] = '\0';
+        return DP_perf_begin(realm, categories, NULL);
     }
-    DP_MUTEX_MUST_UNLOCK(perf_mutex);
-    return handle;
 }
 
-void DP_perf_end_internal(DP_Output *output, int handle)
+void DP_perf_end_internal(DP_UNUSED DP_Output *output, int handle)
 {
-    DP_ASSERT(output);
-    DP_ASSERT(handle != DP_PERF_INVALID_HANDLE);
-    DP_ASSERT(perf_mutex);
+    DP_ASSERT(handle >= 0);
     unsigned long long end = DP_perf_time();
-
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    DP_PerfEntry *pe = perf_entry_at(handle);
-    unsigned long long start = pe->start;
-    char *detail = pe->detail;
-
-    unsigned long long diff = end - start;
-    double start_seconds = DP_ullong_to_double(start) / NS_IN_S;
-    double end_seconds = DP_uint64_to_double(end) / NS_IN_S;
-
-    bool ok = DP_output_format(
-        output, "%" DP_THREAD_ID_FMT " %f %f %llu %s:%s%s%s\n",
-        DP_thread_current_id(), start_seconds, end_seconds, diff, pe->realm,
-        pe->categories, detail[0] == '\0' ? "" : " ", detail);
-    if (!ok) {
-        DP_warn("Error formatting perf output: %s", DP_error());
+    int generation = handle / HANDLE_INDEXES;
+    int index = handle % HANDLE_INDEXES;
+    DP_PerfSlot *slot = &perf_slots[index / MAX_OPEN_SPANS];
+    DP_ASSERT(DP_atomic_get(&slot->state) == DP_PERF_SLOT_OWNED);
+    DP_ASSERT(slot->thread_id == DP_thread_current_id());
+    DP_PerfBuffer *buffer = slot->buffer;
+    DP_PerfSpan *span = &buffer->spans[index % MAX_OPEN_SPANS];
+    // The span may have been begun in a previous recording and reused since.
+    if (span->open && span->generation == generation) {
+        span->open = false;
+        if (generation == DP_atomic_get(&perf_generation)) {
+            span->event.end = end;
+            push_event(buffer, &span->event);
+        }
     }
+}
 
-    pe->realm = NULL;
-    DP_MUTEX_MUST_UNLOCK(perf_mutex);
+void DP_perf_counter_internal(DP_UNUSED DP_Output *output, const char *realm,
+                              const char *categories, double value)
+{
+    DP_ASSERT(realm);
+    DP_ASSERT(categories);
+    int index;
+    DP_PerfBuffer *buffer =
+        filter_matches(categories) ? get_buffer(&index) : NULL;
+    if (buffer) {
+        DP_PerfEvent ev;
+        ev.type = DP_PERF_EVENT_COUNTER;
+        ev.start = DP_perf_time();
+        ev.value = value;
+        ev.realm = realm;
+        ev.categories = categories;
+        ev.detail[0] = '\0';
+        push_event(buffer, &ev);
+    }
 }
@@ -48,11 +48,30 @@ typedef struct DP_Output DP_Output;
 #    define DP_PERF_END(TARGET) DP_perf_end(_perf_handle_##TARGET)
 #endif
 
+#define DP_PERF_COUNTER(CATEGORIES, VALUE)                         \
+    DP_perf_counter(DP_PERF_XSTR(DP_PERF_REALM),                   \
+                    DP_PERF_CONTEXT ":" CATEGORIES, (double)(VALUE))
+
+typedef enum DP_PerfFormat {
+    // The line-based format described in the header of the file.
+    DP_PERF_FORMAT_TEXT,
+    // Chrome's Trace Event JSON, as read by chrome://tracing and Perfetto.
+    DP_PERF_FORMAT_CHROME_TRACE,
+} DP_PerfFormat;
+
 
 extern DP_Output *DP_perf_output;
 
-// Takes ownership of the output, it is freed even on error.
+// Takes ownership of the output, it is freed even on error. Events are
+// collected in per-thread buffers and written to the output by a background
+// thread, a thread that records faster than that drops events.
 bool DP_perf_open(DP_Output *output);
+
+// The filter is a comma-separated list of category prefixes, like
+// "paint_engine:tick,renderer". Only spans and counters whose categories start
+// with one of them are recorded. Pass NULL or an empty string for everything.
+bool DP_perf_open_with(DP_Output *output, DP_PerfFormat format,
+                       const char *filter_or_null);
 bool DP_perf_close(void);
 bool DP_perf_is_open(void);
 
@@ -79,6 +98,12 @@ DP_INLINE int DP_perf_begin(const char *realm, const char *categories,
     }
 }
 
+// Non-variadic version of DP_perf_begin for other languages' bindings. The
+// realm and categories must stay alive until the recording is closed, since
+// they're written out in the background, the detail is copied.
+int DP_perf_begin_detail(const char *realm, const char *categories,
+                         const char *detail_or_null);
+
 void DP_perf_end_internal(DP_Output *output, int handle);
 
 DP_INLINE void DP_perf_end(int handle)
@@ -91,5 +116,20 @@ DP_INLINE void DP_perf_end(int handle)
     }
 }
 
+void DP_perf_counter_internal(DP_Output *output, const char *realm,
+                              const char *categories, double value);
+
+// Records the current value of something, like a queue length. Shows up as a
+// counter track in trace viewers. The realm and categories aren't copied,
+// same as with spans.
+DP_INLINE void DP_perf_counter(const char *realm, const char *categories,
+                               double value)
+{
+    DP_Output *output = DP_perf_output;
+    if (output) {
+        DP_perf_counter_internal(output, realm, categories, value);
+    }
+}
+
 
 #endif
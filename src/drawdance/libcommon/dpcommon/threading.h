@@ -59,6 +59,19 @@ typedef enum DP_SemaphoreResult {
     DP_SEMAPHORE_ERROR,
 } DP_SemaphoreResult;
 
+// What a thread is used for, so that the operating system can tell which ones
+// to favor when cores are contended. Interactive threads are ones the user is
+// waiting on every frame, like painting and rendering. Utility threads do work
+// the user asked for and is waiting on, but not frame by frame. Background
+// threads do work the user isn't watching, like recording and saving, which
+// should never cost frames.
+typedef enum DP_ThreadRole {
+    DP_THREAD_ROLE_DEFAULT,
+    DP_THREAD_ROLE_INTERACTIVE,
+    DP_THREAD_ROLE_UTILITY,
+    DP_THREAD_ROLE_BACKGROUND,
+} DP_ThreadRole;
+
 typedef struct DP_ErrorState {
     unsigned int *count;
     size_t buffer_size;
@@ -157,6 +170,13 @@ DP_Thread *DP_thread_new(DP_ThreadFn fn, void *data);
 
 void DP_thread_free_join(DP_Thread *thread);
 
+// Sets the role of the calling thread. This is only a hint, failures get logged
+// and otherwise ignored. Threads created afterwards may inherit it. On Linux,
+// an unprivileged process can't raise priorities again after lowering them, so
+// interactive is the same as the default there and a thread shouldn't switch
+// away from background again once it's been set.
+void DP_thread_role_set(DP_ThreadRole role);
+
 
 DP_ErrorState DP_thread_error_state_get(void);
 
@@ -19,6 +19,9 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE // For SCHED_IDLE and syscall.
+#endif
 #include "atomic.h"
 #include "common.h"
 #include "conversions.h"
@@ -28,6 +31,11 @@
 #include <semaphore.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef __linux__
+#    include <sched.h>
+#    include <sys/resource.h>
+#    include <sys/syscall.h>
+#endif
 
 
 struct DP_Mutex {
@@ -250,7 +258,7 @@ int DP_semaphore_wait_n(DP_Semaphore *sem, int n)
 DP_SemaphoreResult DP_semaphore_try_wait(DP_Semaphore *sem)
 {
     DP_ASSERT(sem);
-    if (sem_trywait(&sem->value)) {
+    if (sem_trywait(&sem->value) == 0) {
         return DP_SEMAPHORE_OK;
     }
     else {
@@ -372,6 +380,67 @@ static DP_ErrorState to_error_state(DP_PthreadErrorState *state)
     return (DP_ErrorState){&state->count, state->buffer_size, state->buffer};
 }
 
+#ifdef __linux__
+static bool set_thread_nice(int nice)
+{
+    // Nice values are per-thread on Linux, even though POSIX says otherwise.
+    id_t tid = (id_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, nice) == 0) {
+        return true;
+    }
+    else {
+        DP_debug("Error setting thread nice value to %d: %s", nice,
+                 strerror(errno));
+        return false;
+    }
+}
+
+static bool set_thread_policy(int policy)
+{
+    struct sched_param param = {0};
+    int error = pthread_setschedparam(pthread_self(), policy, &param);
+    if (error == 0) {
+        return true;
+    }
+    else {
+        DP_debug("Error setting thread scheduling policy to %d: %s", policy,
+                 strerror(error));
+        return false;
+    }
+}
+#endif
+
+void DP_thread_role_set(DP_ThreadRole role)
+{
+#ifdef __linux__
+    switch (role) {
+    case DP_THREAD_ROLE_DEFAULT:
+    case DP_THREAD_ROLE_INTERACTIVE:
+        // Negative nice values need privileges, so this is the best we can do.
+        set_thread_policy(SCHED_OTHER);
+        set_thread_nice(0);
+        return;
+    case DP_THREAD_ROLE_UTILITY:
+        set_thread_nice(5);
+        return;
+    case DP_THREAD_ROLE_BACKGROUND:
+        // SCHED_IDLE only gets to run when nothing else wants the core, the
+        // highest nice value is the closest thing if that's not available.
+#    ifdef SCHED_IDLE
+        if (set_thread_policy(SCHED_IDLE)) {
+            return;
+        }
+#    endif
+        set_thread_nice(19);
+        return;
+    }
+    DP_warn("Unknown thread role %d", (int)role);
+#else
+    (void)role;
+#endif
+}
+
+
 DP_ErrorState DP_thread_error_state_get(void)
 {
     return to_error_state(get_pthread_error_state());
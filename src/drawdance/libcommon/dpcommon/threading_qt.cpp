@@ -25,6 +25,10 @@ extern "C" {
 // Qt doesn't have a way to get a numeric thread id, only a handle.
 #if defined(__EMSCRIPTEN__) || defined(__APPLE__) || defined(__linux__)
 #    include <pthread.h>
+#    ifdef __APPLE__
+#        include <pthread/qos.h>
+#        include <string.h>
+#    endif
 #elif defined(_WIN32)
 #    include <windows.h>
 #else
@@ -223,6 +227,55 @@ extern "C" void DP_thread_free_join(DP_Thread *thread)
     }
 }
 
+extern "C" void DP_thread_role_set(DP_ThreadRole role)
+{
+#ifdef __APPLE__
+    // QoS classes also pick between performance and efficiency cores.
+    qos_class_t qos;
+    switch (role) {
+    case DP_THREAD_ROLE_DEFAULT:
+        qos = QOS_CLASS_DEFAULT;
+        break;
+    case DP_THREAD_ROLE_INTERACTIVE:
+        qos = QOS_CLASS_USER_INTERACTIVE;
+        break;
+    case DP_THREAD_ROLE_UTILITY:
+        qos = QOS_CLASS_UTILITY;
+        break;
+    case DP_THREAD_ROLE_BACKGROUND:
+        qos = QOS_CLASS_BACKGROUND;
+        break;
+    default:
+        DP_warn("Unknown thread role %d", static_cast<int>(role));
+        return;
+    }
+    int error = pthread_set_qos_class_self_np(qos, 0);
+    if (error != 0) {
+        DP_debug("Error setting thread QoS class: %s", strerror(error));
+    }
+#else
+    QThread::Priority priority;
+    switch (role) {
+    case DP_THREAD_ROLE_DEFAULT:
+        priority = QThread::NormalPriority;
+        break;
+    case DP_THREAD_ROLE_INTERACTIVE:
+        priority = QThread::HighPriority;
+        break;
+    case DP_THREAD_ROLE_UTILITY:
+        priority = QThread::LowPriority;
+        break;
+    case DP_THREAD_ROLE_BACKGROUND:
+        priority = QThread::LowestPriority;
+        break;
+    default:
+        DP_warn("Unknown thread role %d", static_cast<int>(role));
+        return;
+    }
+    QThread::currentThread()->setPriority(priority);
+#endif
+}
+
 
 class DP_QtErrorState final {
   public:
@@ -191,6 +191,31 @@ void DP_thread_free_join(DP_Thread *thread)
         CloseHandle((HANDLE *)thread);
     }
 }
+void DP_thread_role_set(DP_ThreadRole role)
+{
+    int priority;
+    switch (role) {
+    case DP_THREAD_ROLE_DEFAULT:
+        priority = THREAD_PRIORITY_NORMAL;
+        break;
+    case DP_THREAD_ROLE_INTERACTIVE:
+        priority = THREAD_PRIORITY_ABOVE_NORMAL;
+        break;
+    case DP_THREAD_ROLE_UTILITY:
+        priority = THREAD_PRIORITY_BELOW_NORMAL;
+        break;
+    case DP_THREAD_ROLE_BACKGROUND:
+        priority = THREAD_PRIORITY_LOWEST;
+        break;
+    default:
+        DP_warn("Unknown thread role %d", (int)role);
+        return;
+    }
+    if (!SetThreadPriority(GetCurrentThread(), priority)) {
+        DP_debug("Error setting thread priority to %d: %lu", priority,
+                 GetLastError());
+    }
+}
 
 #ifdef _MSC_VER
 #    define THREAD_LOCAL __declspec(thread)
@@ -20,26 +20,45 @@
  * SOFTWARE.
  */
 #include "worker.h"
+#include "atomic.h"
 #include "common.h"
 #include "conversions.h"
 #include "queue.h"
 #include "threading.h"
 
+#define POOL_THREAD_COUNT_MAX 128
+
 
 typedef struct DP_Worker {
+    DP_Worker *prev;
+    DP_Worker *next;
+    DP_WorkerPriority priority;
     size_t element_size;
     DP_WorkerJobFn job_fn;
-    DP_Semaphore *sem;
     DP_Queue queue;
-    DP_Mutex *queue_mutex;
+    DP_Semaphore *sem_done;
+    int waiting;
+    int running;
     int thread_count;
-    DP_Thread *threads[];
+    int free_slot_count;
+    unsigned char *slot_elements;
+    int free_slots[];
 } DP_Worker;
 
-struct DP_WorkerParams {
-    DP_Worker *worker;
-    int thread_index;
-};
+// Everything in here is protected by the mutex. Each priority has a circular
+// list of workers, the head is moved along whenever a job is taken from it so
+// that workers of the same priority take turns.
+typedef struct DP_WorkerPool {
+    DP_Mutex *mutex;
+    DP_Semaphore *sem;
+    int idle_count;
+    int wake_count;
+    DP_Worker *lanes[DP_WORKER_PRIORITY_COUNT];
+    int thread_count;
+    DP_Thread *threads[];
+} DP_WorkerPool;
+
+static DP_WorkerPool *worker_pool;
 
 
 int DP_worker_cpu_count(int max)
@@ -55,107 +74,272 @@ int DP_worker_cpu_count(int max)
 }
 
 
-static bool shift_worker_element(DP_Mutex *queue_mutex, DP_Queue *queue,
-                                 size_t element_size, void *out_element)
+static bool worker_runnable(DP_Worker *worker)
 {
-    DP_MUTEX_MUST_LOCK(queue_mutex);
-    void *element = DP_queue_peek(queue, element_size);
-    if (element) {
-        memcpy(out_element, element, element_size);
-        DP_queue_shift(queue);
-    }
-    DP_MUTEX_MUST_UNLOCK(queue_mutex);
-    return element;
+    return worker->queue.used != 0 && worker->free_slot_count != 0;
+}
+
+static bool worker_done(DP_Worker *worker)
+{
+    return worker->queue.used == 0 && worker->running == 0;
 }
 
-static void run_worker_thread(void *data)
+static DP_Worker *pool_pick_worker(DP_WorkerPool *pool)
 {
-    struct DP_WorkerParams *params = data;
-    DP_Worker *worker = params->worker;
-    int thread_index = params->thread_index;
-    DP_free(params);
+    for (int i = 0; i < DP_WORKER_PRIORITY_COUNT; ++i) {
+        DP_Worker *first = pool->lanes[i];
+        if (first) {
+            DP_Worker *worker = first;
+            do {
+                if (worker_runnable(worker)) {
+                    pool->lanes[i] = worker->next;
+                    return worker;
+                }
+                worker = worker->next;
+            } while (worker != first);
+        }
+    }
+    return NULL;
+}
 
+// Must be called with the pool mutex locked, which is released while the job
+// runs. The thread index is a free slot of the worker, so running jobs never
+// share one, even if they're on different pool threads or helping threads.
+static void pool_run_job(DP_WorkerPool *pool, DP_Worker *worker)
+{
+    DP_ASSERT(worker_runnable(worker));
     size_t element_size = worker->element_size;
-    DP_WorkerJobFn job_fn = worker->job_fn;
-    DP_Semaphore *sem = worker->sem;
-    DP_Mutex *queue_mutex = worker->queue_mutex;
-    DP_Queue *queue = &worker->queue;
-    void *element = DP_malloc(element_size);
+    int slot = worker->free_slots[--worker->free_slot_count];
+    void *element = worker->slot_elements + DP_int_to_size(slot) * element_size;
+    memcpy(element, DP_queue_peek(&worker->queue, element_size), element_size);
+    DP_queue_shift(&worker->queue);
+    ++worker->running;
+
+    DP_MUTEX_MUST_UNLOCK(pool->mutex);
+    worker->job_fn(element, slot);
+    DP_MUTEX_MUST_LOCK(pool->mutex);
+
+    worker->free_slots[worker->free_slot_count++] = slot;
+    --worker->running;
+    int waiting = worker->waiting;
+    if (waiting != 0 && worker_done(worker)) {
+        worker->waiting = 0;
+        DP_SEMAPHORE_MUST_POST_N(worker->sem_done, waiting);
+    }
+}
+
+static void run_pool_thread(void *data)
+{
+    DP_WorkerPool *pool = data;
+    DP_Mutex *mutex = pool->mutex;
+    DP_Semaphore *sem = pool->sem;
+    // Pool threads run jobs of every priority, so they shouldn't inherit the
+    // role of whichever thread happened to create the first worker. Job
+    // priorities are handled by picking from the higher lanes first instead.
+    DP_thread_role_set(DP_THREAD_ROLE_DEFAULT);
+    DP_MUTEX_MUST_LOCK(mutex);
     while (true) {
-        DP_SEMAPHORE_MUST_WAIT(sem);
-        if (shift_worker_element(queue_mutex, queue, element_size, element)) {
-            job_fn(element, thread_index);
+        DP_Worker *worker = pool_pick_worker(pool);
+        if (worker) {
+            pool_run_job(pool, worker);
+        }
+        else {
+            ++pool->idle_count;
+            DP_MUTEX_MUST_UNLOCK(mutex);
+            DP_SEMAPHORE_MUST_WAIT(sem);
+            DP_MUTEX_MUST_LOCK(mutex);
+            --pool->idle_count;
+            --pool->wake_count;
+        }
+    }
+}
+
+static void pool_free(DP_WorkerPool *pool)
+{
+    DP_ASSERT(pool->thread_count == 0);
+    DP_semaphore_free(pool->sem);
+    DP_mutex_free(pool->mutex);
+    DP_free(pool);
+}
+
+// The pool threads are never joined, they live until the process exits.
+static DP_WorkerPool *pool_new(void)
+{
+    int max_thread_count = DP_worker_cpu_count(POOL_THREAD_COUNT_MAX);
+    DP_WorkerPool *pool = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+        DP_WorkerPool, threads, DP_int_to_size(max_thread_count)));
+
+    pool->mutex = DP_mutex_new();
+    if (!pool->mutex) {
+        pool_free(pool);
+        return NULL;
+    }
+
+    pool->sem = DP_semaphore_new(0);
+    if (!pool->sem) {
+        pool_free(pool);
+        return NULL;
+    }
+
+    // Running with fewer threads than requested is fine, only if there's none
+    // at all we can't do anything.
+    for (int i = 0; i < max_thread_count; ++i) {
+        DP_Thread *thread = DP_thread_new(run_pool_thread, pool);
+        if (thread) {
+            pool->threads[pool->thread_count++] = thread;
+        }
+        else if (pool->thread_count == 0) {
+            pool_free(pool);
+            return NULL;
         }
         else {
+            DP_warn("Worker pool started with only %d of %d threads: %s",
+                    pool->thread_count, max_thread_count, DP_error());
             break;
         }
     }
-    DP_free(element);
+
+    return pool;
+}
+
+static DP_WorkerPool *pool_get(void)
+{
+    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(pool_lock);
+    DP_atomic_lock(&pool_lock);
+    if (!worker_pool) {
+        worker_pool = pool_new();
+    }
+    DP_WorkerPool *pool = worker_pool;
+    DP_atomic_unlock(&pool_lock);
+    return pool;
+}
+
+// Must be called with the pool mutex locked.
+static void pool_wake(DP_WorkerPool *pool)
+{
+    if (pool->wake_count < pool->idle_count) {
+        ++pool->wake_count;
+        DP_SEMAPHORE_MUST_POST(pool->sem);
+    }
 }
 
+
 DP_Worker *DP_worker_new(size_t initial_capacity, size_t element_size,
                          int thread_count, DP_WorkerJobFn job_fn)
+{
+    return DP_worker_new_with_priority(initial_capacity, element_size,
+                                       thread_count, DP_WORKER_PRIORITY_NORMAL,
+                                       job_fn);
+}
+
+DP_Worker *DP_worker_new_with_priority(size_t initial_capacity,
+                                       size_t element_size, int thread_count,
+                                       DP_WorkerPriority priority,
+                                       DP_WorkerJobFn job_fn)
 {
     DP_ASSERT(initial_capacity > 0);
     DP_ASSERT(element_size > 0);
     DP_ASSERT(thread_count > 0);
+    DP_ASSERT(priority >= 0 && priority < DP_WORKER_PRIORITY_COUNT);
     DP_ASSERT(job_fn);
 
-    DP_Worker *worker = DP_malloc_zeroed(
-        DP_FLEX_SIZEOF(DP_Worker, threads, DP_int_to_size(thread_count)));
-    worker->element_size = element_size;
-    worker->job_fn = job_fn;
+    DP_WorkerPool *pool = pool_get();
+    if (!pool) {
+        return NULL;
+    }
 
-    worker->sem = DP_semaphore_new(0);
-    if (!worker->sem) {
-        DP_worker_free_join(worker);
+    DP_Semaphore *sem_done = DP_semaphore_new(0);
+    if (!sem_done) {
         return NULL;
     }
 
+    size_t slot_count = DP_int_to_size(thread_count);
+    DP_Worker *worker =
+        DP_malloc(DP_FLEX_SIZEOF(DP_Worker, free_slots, slot_count));
+    worker->priority = priority;
+    worker->element_size = element_size;
+    worker->job_fn = job_fn;
     DP_queue_init(&worker->queue, initial_capacity, element_size);
+    worker->sem_done = sem_done;
+    worker->waiting = 0;
+    worker->running = 0;
+    worker->thread_count = thread_count;
+    worker->free_slot_count = thread_count;
+    worker->slot_elements = DP_malloc(slot_count * element_size);
+    // Handed out from the back, so the lowest thread indexes get used first.
+    for (int i = 0; i < thread_count; ++i) {
+        worker->free_slots[i] = thread_count - i - 1;
+    }
 
-    worker->queue_mutex = DP_mutex_new();
-    if (!worker->queue_mutex) {
-        DP_worker_free_join(worker);
-        return NULL;
+    DP_MUTEX_MUST_LOCK(pool->mutex);
+    DP_Worker *first = pool->lanes[priority];
+    if (first) {
+        worker->next = first;
+        worker->prev = first->prev;
+        first->prev->next = worker;
+        first->prev = worker;
     }
+    else {
+        worker->next = worker;
+        worker->prev = worker;
+        pool->lanes[priority] = worker;
+    }
+    DP_MUTEX_MUST_UNLOCK(pool->mutex);
 
-    for (int i = 0; i < thread_count; ++i) {
-        struct DP_WorkerParams *params = DP_malloc(sizeof(*params));
-        *params = (struct DP_WorkerParams){worker, i};
-        DP_Thread *thread = DP_thread_new(run_worker_thread, params);
-        if (thread) {
-            worker->threads[i] = thread;
-            worker->thread_count = i + 1;
+    return worker;
+}
+
+// Must be called with the pool mutex locked.
+static void wait_locked(DP_WorkerPool *pool, DP_Worker *worker)
+{
+    while (!worker_done(worker)) {
+        if (worker_runnable(worker)) {
+            pool_run_job(pool, worker);
         }
         else {
-            DP_free(params);
-            DP_worker_free_join(worker);
-            return NULL;
+            ++worker->waiting;
+            DP_MUTEX_MUST_UNLOCK(pool->mutex);
+            DP_SEMAPHORE_MUST_WAIT(worker->sem_done);
+            DP_MUTEX_MUST_LOCK(pool->mutex);
         }
     }
-
-    return worker;
 }
 
 void DP_worker_free_join(DP_Worker *worker)
 {
     if (worker) {
-        DP_Semaphore *sem = worker->sem;
-        int thread_count = worker->thread_count;
-        if (sem) {
-            DP_SEMAPHORE_MUST_POST_N(sem, thread_count);
+        DP_WorkerPool *pool = worker_pool;
+        DP_MUTEX_MUST_LOCK(pool->mutex);
+        wait_locked(pool, worker);
+        DP_WorkerPriority priority = worker->priority;
+        if (worker->next == worker) {
+            pool->lanes[priority] = NULL;
         }
-        for (int i = 0; i < thread_count; ++i) {
-            DP_thread_free_join(worker->threads[i]);
+        else {
+            worker->prev->next = worker->next;
+            worker->next->prev = worker->prev;
+            if (pool->lanes[priority] == worker) {
+                pool->lanes[priority] = worker->next;
+            }
         }
-        DP_mutex_free(worker->queue_mutex);
+        DP_MUTEX_MUST_UNLOCK(pool->mutex);
+
+        DP_free(worker->slot_elements);
+        DP_semaphore_free(worker->sem_done);
         DP_queue_dispose(&worker->queue);
-        DP_semaphore_free(sem);
         DP_free(worker);
     }
 }
 
+void DP_worker_wait(DP_Worker *worker)
+{
+    DP_ASSERT(worker);
+    DP_WorkerPool *pool = worker_pool;
+    DP_MUTEX_MUST_LOCK(pool->mutex);
+    wait_locked(pool, worker);
+    DP_MUTEX_MUST_UNLOCK(pool->mutex);
+}
+
 int DP_worker_thread_count(DP_Worker *worker)
 {
     DP_ASSERT(worker);
@@ -168,22 +352,21 @@ void DP_worker_push_with(DP_Worker *worker,
 {
     DP_ASSERT(worker);
     DP_ASSERT(insert_element);
-    DP_Mutex *queue_mutex = worker->queue_mutex;
-    size_t element_size = worker->element_size;
-    DP_MUTEX_MUST_LOCK(queue_mutex);
-    insert_element(user, DP_queue_push(&worker->queue, element_size));
-    DP_MUTEX_MUST_UNLOCK(queue_mutex);
-    DP_SEMAPHORE_MUST_POST(worker->sem);
+    DP_WorkerPool *pool = worker_pool;
+    DP_MUTEX_MUST_LOCK(pool->mutex);
+    insert_element(user, DP_queue_push(&worker->queue, worker->element_size));
+    pool_wake(pool);
+    DP_MUTEX_MUST_UNLOCK(pool->mutex);
 }
 
 void DP_worker_push(DP_Worker *worker, void *element)
 {
     DP_ASSERT(worker);
     DP_ASSERT(element);
-    DP_Mutex *queue_mutex = worker->queue_mutex;
+    DP_WorkerPool *pool = worker_pool;
     size_t element_size = worker->element_size;
-    DP_MUTEX_MUST_LOCK(queue_mutex);
+    DP_MUTEX_MUST_LOCK(pool->mutex);
     memcpy(DP_queue_push(&worker->queue, element_size), element, element_size);
-    DP_MUTEX_MUST_UNLOCK(queue_mutex);
-    DP_SEMAPHORE_MUST_POST(worker->sem);
+    pool_wake(pool);
+    DP_MUTEX_MUST_UNLOCK(pool->mutex);
 }
@@ -24,17 +24,45 @@
 #include "common.h"
 
 
+// Workers don't have threads of their own, they're task groups on a single
+// process-wide thread pool that gets started the first time a worker is
+// created. The thread count of a worker is the maximum number of its jobs that
+// run at the same time and the thread index passed to jobs is unique among
+// those, so it can still be used to index per-thread buffers. The pool picks
+// jobs from higher priorities first, taking turns between workers of the same
+// priority.
+//
+// Jobs must not block waiting on other jobs, since there may not be a free
+// pool thread to run those. DP_worker_wait and DP_worker_free_join are fine,
+// the calling thread helps out running the worker's jobs while it waits.
 typedef struct DP_Worker DP_Worker;
 
 typedef void (*DP_WorkerJobFn)(void *element, int thread_index);
 
+typedef enum DP_WorkerPriority {
+    DP_WORKER_PRIORITY_HIGH,
+    DP_WORKER_PRIORITY_NORMAL,
+    DP_WORKER_PRIORITY_LOW,
+    DP_WORKER_PRIORITY_COUNT,
+} DP_WorkerPriority;
+
 int DP_worker_cpu_count(int max);
 
 DP_Worker *DP_worker_new(size_t initial_capacity, size_t element_size,
                          int thread_count, DP_WorkerJobFn job_fn);
 
+DP_Worker *DP_worker_new_with_priority(size_t initial_capacity,
+                                       size_t element_size, int thread_count,
+                                       DP_WorkerPriority priority,
+                                       DP_WorkerJobFn job_fn);
+
+// Waits for all jobs pushed so far to finish and then frees the worker.
 void DP_worker_free_join(DP_Worker *worker);
 
+// Waits for all jobs pushed so far to finish, running some of them on the
+// calling thread in the meantime.
+void DP_worker_wait(DP_Worker *worker);
+
 int DP_worker_thread_count(DP_Worker *worker);
 
 void DP_worker_push_with(DP_Worker *worker,
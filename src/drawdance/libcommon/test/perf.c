@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/file.h>
+#include <dpcommon/output.h>
+#include <dpcommon/perf.h>
+#include <dptest.h>
+
+#define LEAKED_COUNT 100
+
+
+static int count_occurrences(const char *haystack, const char *needle)
+{
+    int count = 0;
+    for (const char *s = strstr(haystack, needle); s;
+         s = strstr(s + 1, needle)) {
+        ++count;
+    }
+    return count;
+}
+
+static void perf_spans_left_open(TEST_PARAMS)
+{
+    const char *path = "test/tmp/perf_spans_left_open";
+    int leaked[LEAKED_COUNT];
+
+    // More spans than fit into a thread's buffer, so that if unended spans
+    // from the first recording stuck around, the second one couldn't record.
+    for (int i = 0; i < LEAKED_COUNT; ++i) {
+        if (!OK(DP_perf_open(DP_file_output_new_from_path(path)),
+                "open perf output %d", i)) {
+            return;
+        }
+        leaked[i] = DP_perf_begin("test", "leaked", NULL);
+        OK(DP_perf_close(), "close perf output %d", i);
+    }
+
+    if (!OK(DP_perf_open(DP_file_output_new_from_path(path)),
+            "open final perf output")) {
+        return;
+    }
+
+    int handles[3];
+    for (int i = 0; i < (int)DP_ARRAY_LENGTH(handles); ++i) {
+        handles[i] = DP_perf_begin("test", "fresh", NULL);
+        OK(handles[i] != DP_PERF_INVALID_HANDLE, "begin fresh span %d", i);
+    }
+
+    // Ending stale handles from previous recordings does nothing.
+    for (int i = 0; i < LEAKED_COUNT; ++i) {
+        DP_perf_end(leaked[i]);
+    }
+
+    for (int i = (int)DP_ARRAY_LENGTH(handles) - 1; i >= 0; --i) {
+        DP_perf_end(handles[i]);
+    }
+    if (!OK(DP_perf_close(), "close final perf output")) {
+        return;
+    }
+
+    size_t length;
+    char *buffer = DP_file_slurp(path, &length);
+    if (NOT_NULL_OK(buffer, "slurp perf output")) {
+        char *text = DP_malloc(length + 1);
+        memcpy(text, buffer, length);
+        text[length] = '\0';
+        INT_EQ_OK(count_occurrences(text, "test:fresh"), 3,
+                  "fresh spans recorded");
+        INT_EQ_OK(count_occurrences(text, "test:leaked"), 0,
+                  "stale spans not recorded");
+        DP_free(text);
+        DP_free(buffer);
+    }
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(perf_spans_left_open);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
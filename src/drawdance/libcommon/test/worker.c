@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/atomic.h>
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/worker.h>
+#include <dptest.h>
+
+#define JOB_COUNT       10000
+#define NESTED_COUNT    64
+#define SLOT_COUNT_MAX  8
+#define INNER_JOB_COUNT 100
+
+
+typedef struct WorkerTestContext {
+    DP_Atomic count;
+    DP_Atomic bad_index;
+    DP_Atomic shared_slot;
+    int thread_count;
+    DP_Atomic slots[SLOT_COUNT_MAX];
+} WorkerTestContext;
+
+typedef struct WorkerTestJob {
+    WorkerTestContext *c;
+} WorkerTestJob;
+
+static void count_job(void *element, int thread_index)
+{
+    WorkerTestContext *c = ((WorkerTestJob *)element)->c;
+    if (thread_index < 0 || thread_index >= c->thread_count) {
+        DP_atomic_set(&c->bad_index, 1);
+    }
+    else if (DP_atomic_xch(&c->slots[thread_index], 1) != 0) {
+        DP_atomic_set(&c->shared_slot, 1);
+    }
+    else {
+        DP_atomic_set(&c->slots[thread_index], 0);
+    }
+    DP_atomic_inc(&c->count);
+}
+
+static void init_context(WorkerTestContext *c, int thread_count)
+{
+    DP_atomic_set(&c->count, 0);
+    DP_atomic_set(&c->bad_index, 0);
+    DP_atomic_set(&c->shared_slot, 0);
+    c->thread_count = thread_count;
+    for (int i = 0; i < SLOT_COUNT_MAX; ++i) {
+        DP_atomic_set(&c->slots[i], 0);
+    }
+}
+
+static void push_count_jobs(DP_Worker *worker, WorkerTestContext *c, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        WorkerTestJob job = {c};
+        DP_worker_push(worker, &job);
+    }
+}
+
+
+static void worker_join(TEST_PARAMS)
+{
+    int thread_count = DP_worker_cpu_count(SLOT_COUNT_MAX);
+    WorkerTestContext c;
+    init_context(&c, thread_count);
+
+    DP_Worker *worker =
+        DP_worker_new(64, sizeof(WorkerTestJob), thread_count, count_job);
+    FATAL(NOT_NULL_OK(worker, "worker created"));
+    INT_EQ_OK(DP_worker_thread_count(worker), thread_count,
+              "worker has requested thread count");
+
+    push_count_jobs(worker, &c, JOB_COUNT);
+    DP_worker_free_join(worker);
+    INT_EQ_OK(DP_atomic_get(&c.count), JOB_COUNT, "all jobs ran on join");
+    NOK(DP_atomic_get(&c.bad_index), "thread indexes in range");
+    NOK(DP_atomic_get(&c.shared_slot), "no thread index used concurrently");
+}
+
+static void worker_wait(TEST_PARAMS)
+{
+    WorkerTestContext c;
+    init_context(&c, 2);
+
+    DP_Worker *worker = DP_worker_new_with_priority(
+        64, sizeof(WorkerTestJob), 2, DP_WORKER_PRIORITY_HIGH, count_job);
+    FATAL(NOT_NULL_OK(worker, "worker created"));
+
+    DP_worker_wait(worker);
+    INT_EQ_OK(DP_atomic_get(&c.count), 0, "waiting on no jobs returns");
+
+    push_count_jobs(worker, &c, JOB_COUNT);
+    DP_worker_wait(worker);
+    INT_EQ_OK(DP_atomic_get(&c.count), JOB_COUNT, "all jobs ran on wait");
+
+    push_count_jobs(worker, &c, JOB_COUNT);
+    DP_worker_wait(worker);
+    INT_EQ_OK(DP_atomic_get(&c.count), JOB_COUNT * 2,
+              "worker can be reused after waiting");
+
+    DP_worker_free_join(worker);
+    NOK(DP_atomic_get(&c.bad_index), "thread indexes in range");
+    NOK(DP_atomic_get(&c.shared_slot), "no thread index used concurrently");
+}
+
+
+static void nested_job(void *element, int thread_index)
+{
+    (void)thread_index;
+    WorkerTestContext *c = ((WorkerTestJob *)element)->c;
+    WorkerTestContext inner;
+    init_context(&inner, 2);
+    DP_Worker *worker = DP_worker_new_with_priority(
+        16, sizeof(WorkerTestJob), 2, DP_WORKER_PRIORITY_LOW, count_job);
+    if (worker) {
+        push_count_jobs(worker, &inner, INNER_JOB_COUNT);
+        DP_worker_free_join(worker);
+        DP_atomic_add(&c->count, DP_atomic_get(&inner.count));
+    }
+}
+
+// Every pool thread ends up waiting on an inner worker here, so this only
+// finishes because joining threads run those jobs themselves.
+static void worker_nested_join(TEST_PARAMS)
+{
+    int thread_count = DP_worker_cpu_count(128);
+    WorkerTestContext c;
+    init_context(&c, thread_count);
+
+    DP_Worker *worker =
+        DP_worker_new(64, sizeof(WorkerTestJob), thread_count, nested_job);
+    FATAL(NOT_NULL_OK(worker, "worker created"));
+    push_count_jobs(worker, &c, NESTED_COUNT);
+    DP_worker_free_join(worker);
+    INT_EQ_OK(DP_atomic_get(&c.count), NESTED_COUNT * INNER_JOB_COUNT,
+              "all nested jobs ran");
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(worker_join);
+    REGISTER_TEST(worker_wait);
+    REGISTER_TEST(worker_nested_join);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
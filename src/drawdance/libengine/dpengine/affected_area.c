@@ -589,3 +589,139 @@ void DP_affected_indirect_areas_clear(DP_AffectedIndirectAreas *aia)
         aia->areas[i] = (DP_IndirectArea){-1, INVALID_BOUNDS};
     }
 }
+
+
+typedef struct DP_AffectedAreaIndexEntry {
+    DP_AffectedDomain domain;
+    int affected_id;
+    int count;
+    DP_Rect bounds;
+} DP_AffectedAreaIndexEntry;
+
+void DP_affected_area_index_init(DP_AffectedAreaIndex *aai)
+{
+    DP_ASSERT(aai);
+    for (int i = 0; i < (int)DP_ARRAY_LENGTH(aai->domain_counts); ++i) {
+        aai->domain_counts[i] = 0;
+    }
+    DP_VECTOR_INIT_TYPE(&aai->entries, DP_AffectedAreaIndexEntry, 8);
+}
+
+void DP_affected_area_index_dispose(DP_AffectedAreaIndex *aai)
+{
+    DP_ASSERT(aai);
+    DP_vector_dispose(&aai->entries);
+}
+
+void DP_affected_area_index_clear(DP_AffectedAreaIndex *aai)
+{
+    DP_ASSERT(aai);
+    for (int i = 0; i < (int)DP_ARRAY_LENGTH(aai->domain_counts); ++i) {
+        aai->domain_counts[i] = 0;
+    }
+    aai->entries.used = 0;
+}
+
+static DP_AffectedAreaIndexEntry *
+search_index_entry(DP_AffectedAreaIndex *aai, DP_AffectedDomain domain,
+                   int affected_id, size_t *out_index)
+{
+    DP_AffectedAreaIndexEntry *entries = aai->entries.elements;
+    size_t used = aai->entries.used;
+    for (size_t i = 0; i < used; ++i) {
+        DP_AffectedAreaIndexEntry *entry = &entries[i];
+        if (entry->domain == domain && entry->affected_id == affected_id) {
+            if (out_index) {
+                *out_index = i;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void DP_affected_area_index_add(DP_AffectedAreaIndex *aai,
+                                const DP_AffectedArea *aa)
+{
+    DP_ASSERT(aai);
+    DP_ASSERT(aa);
+    DP_AffectedDomain domain = aa->domain;
+    ++aai->domain_counts[domain];
+
+    DP_AffectedAreaIndexEntry *entry =
+        search_index_entry(aai, domain, aa->affected_id, NULL);
+    if (entry) {
+        ++entry->count;
+        if (domain == DP_AFFECTED_DOMAIN_PIXELS) {
+            entry->bounds = DP_rect_union(entry->bounds, aa->bounds);
+        }
+    }
+    else {
+        DP_VECTOR_PUSH_TYPE(&aai->entries, DP_AffectedAreaIndexEntry,
+                            ((DP_AffectedAreaIndexEntry){
+                                domain, aa->affected_id, 1, aa->bounds}));
+    }
+}
+
+void DP_affected_area_index_remove(DP_AffectedAreaIndex *aai,
+                                   const DP_AffectedArea *aa)
+{
+    DP_ASSERT(aai);
+    DP_ASSERT(aa);
+    DP_AffectedDomain domain = aa->domain;
+    DP_ASSERT(aai->domain_counts[domain] > 0);
+    --aai->domain_counts[domain];
+
+    size_t index;
+    DP_AffectedAreaIndexEntry *entry =
+        search_index_entry(aai, domain, aa->affected_id, &index);
+    DP_ASSERT(entry);
+    DP_ASSERT(entry->count > 0);
+    if (--entry->count == 0) {
+        DP_vector_remove(&aai->entries, sizeof(*entry), index);
+    }
+}
+
+static bool index_domain_conflicts(DP_AffectedAreaIndex *aai,
+                                   DP_AffectedDomain domain)
+{
+    int *domain_counts = aai->domain_counts;
+    switch (domain) {
+    case DP_AFFECTED_DOMAIN_EVERYTHING:
+        return aai->entries.used != 0;
+    case DP_AFFECTED_DOMAIN_LAYER_ATTRS:
+        return domain_counts[DP_AFFECTED_DOMAIN_TIMELINE] != 0;
+    case DP_AFFECTED_DOMAIN_TIMELINE:
+        return domain_counts[DP_AFFECTED_DOMAIN_LAYER_ATTRS] != 0;
+    default:
+        return false;
+    }
+}
+
+bool DP_affected_area_index_concurrent_with(DP_AffectedAreaIndex *aai,
+                                            const DP_AffectedArea *aa)
+{
+    DP_ASSERT(aai);
+    DP_ASSERT(aa);
+    // Mirrors DP_affected_area_concurrent_with, but against all areas at once.
+    DP_AffectedDomain domain = aa->domain;
+    if (aai->domain_counts[DP_AFFECTED_DOMAIN_EVERYTHING] != 0
+        || index_domain_conflicts(aai, domain)) {
+        return false;
+    }
+    else if (domain == DP_AFFECTED_DOMAIN_USER_ATTRS
+             || aai->domain_counts[domain] == 0) {
+        return true;
+    }
+    else if (aa->affected_id == ALL_IDS
+             || search_index_entry(aai, domain, ALL_IDS, NULL)) {
+        return false;
+    }
+    else {
+        DP_AffectedAreaIndexEntry *entry =
+            search_index_entry(aai, domain, aa->affected_id, NULL);
+        return !entry
+            || (domain == DP_AFFECTED_DOMAIN_PIXELS
+                && !DP_rect_intersects(entry->bounds, aa->bounds));
+    }
+}
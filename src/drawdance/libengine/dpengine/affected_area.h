@@ -23,6 +23,7 @@
 #define DP_AFFECTED_AREA
 #include <dpcommon/common.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/vector.h>
 
 typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_Message DP_Message;
@@ -103,6 +104,14 @@ typedef struct DP_AffectedIndirectAreas {
     DP_IndirectArea areas[DP_AFFECTED_INDIRECT_AREAS_COUNT];
 } DP_AffectedIndirectAreas;
 
+// Summary of a bunch of affected areas, with counts per domain and the union
+// of bounds per affected layer, annotation etc. Areas can be added and removed
+// in any order, bounds only shrink once everything on that id is removed.
+typedef struct DP_AffectedAreaIndex {
+    int domain_counts[DP_AFFECTED_DOMAIN_EVERYTHING + 1];
+    DP_Vector entries;
+} DP_AffectedAreaIndex;
+
 
 // If the message is an indirect stroke, the affected indirect areas for that
 // user are amended with that stroke's bounds. If it's a pen up message, the
@@ -122,4 +131,24 @@ bool DP_affected_area_in_bounds(const DP_AffectedArea *aa, int x, int y,
 void DP_affected_indirect_areas_clear(DP_AffectedIndirectAreas *aia);
 
 
+void DP_affected_area_index_init(DP_AffectedAreaIndex *aai);
+
+void DP_affected_area_index_dispose(DP_AffectedAreaIndex *aai);
+
+void DP_affected_area_index_clear(DP_AffectedAreaIndex *aai);
+
+void DP_affected_area_index_add(DP_AffectedAreaIndex *aai,
+                                const DP_AffectedArea *aa);
+
+// The area must have been added before.
+void DP_affected_area_index_remove(DP_AffectedAreaIndex *aai,
+                                   const DP_AffectedArea *aa);
+
+// Returns true if the area is concurrent with every area in the index, in the
+// sense of DP_affected_area_concurrent_with. Returns false if it may not be,
+// in which case the individual areas need to be checked to know for sure.
+bool DP_affected_area_index_concurrent_with(DP_AffectedAreaIndex *aai,
+                                            const DP_AffectedArea *aa);
+
+
 #endif
@@ -187,6 +187,9 @@ struct DP_BrushEngine {
         bool sync_samples;
         bool compatibility_mode;
         long long last_time_msec;
+        // Bounds of dabs pushed since the last sync, samples outside of them
+        // can't be affected by our own painting and don't need to wait.
+        DP_Rect unsynced_bounds;
     } stroke;
     struct {
         bool active;
@@ -260,6 +263,7 @@ struct DP_BrushEngine {
         int used;
         size_t capacity;
         void *buffer;
+        DP_Rect bounds;
     } dabs;
     struct {
         bool snap;
@@ -398,11 +402,40 @@ static DP_LayerContent *search_layer(DP_CanvasState *cs, int layer_id)
     return NULL;
 }
 
-static DP_LayerContent *update_sample_layer_content(DP_BrushEngine *be)
+static void expand_bounds(DP_Rect *bounds, DP_Rect rect)
 {
-    if (be->stroke.sync_samples) {
-        DP_ASSERT(be->sync); // Checked when setting sync_samples.
-        DP_CanvasState *cs = be->sync(be->user);
+    *bounds = DP_rect_valid(*bounds) ? DP_rect_union(*bounds, rect) : rect;
+}
+
+static DP_CanvasState *sync_canvas_state(DP_BrushEngine *be)
+{
+    DP_ASSERT(be->sync); // Checked when setting sync_samples.
+    be->stroke.unsynced_bounds = (DP_Rect){0, 0, -1, -1};
+    return be->sync(be->user);
+}
+
+// Synchronizing means a round-trip to the paint engine, which is expensive to
+// do for every single sample. It's only needed if the sampled area overlaps
+// with dabs we pushed since the last time, everything else is as current as
+// the canvas state we already have.
+static bool should_sync_sample(DP_BrushEngine *be, int x, int y, int diameter)
+{
+    if (be->cs) {
+        int radius = diameter / 2 + 1;
+        DP_Rect sample_bounds = {x - radius, y - radius, x + radius,
+                                 y + radius};
+        return DP_rect_intersects(be->stroke.unsynced_bounds, sample_bounds);
+    }
+    else {
+        return true;
+    }
+}
+
+static DP_LayerContent *update_sample_layer_content(DP_BrushEngine *be, int x,
+                                                    int y, int diameter)
+{
+    if (be->stroke.sync_samples && should_sync_sample(be, x, y, diameter)) {
+        DP_CanvasState *cs = sync_canvas_state(be);
         if (cs) {
             if (cs == be->cs) {
                 DP_canvas_state_decref(cs);
@@ -1660,6 +1693,8 @@ static void append_pixel_dab(DP_BrushEngine *be, const DP_PixelDabParams *dab)
         dy = 0;
     }
 
+    expand_bounds(&be->dabs.bounds,
+                  pixel_dab_bounds(dab->x, dab->y, dab->size));
     DP_BrushEnginePixelDab *dabs = get_dab_buffer(be, sizeof(*dabs));
     dabs[be->dabs.used++] =
         (DP_BrushEnginePixelDab){dx, dy, dab->size, dab->opacity};
@@ -1816,6 +1851,7 @@ static void add_dab_soft(DP_BrushEngine *be, DP_ClassicBrush *cb,
             dy = 0;
         }
 
+        expand_bounds(&be->dabs.bounds, bounds);
         DP_BrushEngineClassicDab *dabs = get_dab_buffer(be, sizeof(*dabs));
         dabs[be->dabs.used++] = (DP_BrushEngineClassicDab){
             dx, dy, dab.size,
@@ -1980,6 +2016,10 @@ static void append_mypaint_dab(DP_BrushEngine *be,
         dy = 0;
     }
 
+    expand_bounds(&be->dabs.bounds,
+                  subpixel_dab_bounds(DP_int32_to_float(dab->x) / 4.0f,
+                                      DP_int32_to_float(dab->y) / 4.0f,
+                                      DP_uint32_to_float(dab->size) / 256.0f));
     DP_BrushEngineMyPaintDab *dabs = get_dab_buffer(be, sizeof(*dabs));
     dabs[be->dabs.used++] = (DP_BrushEngineMyPaintDab){
         dx,           dy,         dab->size,        dab->hardness,
@@ -2163,13 +2203,14 @@ static int get_color_mypaint_pigment(MyPaintSurface2 *self, float x, float y,
                                      float *color_a, DP_UNUSED float paint)
 {
     DP_BrushEngine *be = get_mypaint_surface_brush_engine(self);
-    DP_LayerContent *lc = update_sample_layer_content(be);
+    int xi = DP_float_to_int(x + 0.5f);
+    int yi = DP_float_to_int(y + 0.5f);
+    int diameter = DP_min_int(DP_float_to_int(radius * 2.0f + 0.5f), 255);
+    DP_LayerContent *lc = update_sample_layer_content(be, xi, yi, diameter);
     bool in_bounds;
     if (lc) {
-        int diameter = DP_min_int(DP_float_to_int(radius * 2.0f + 0.5f), 255);
         DP_UPixelFloat color = DP_layer_content_sample_color_at(
-            lc, get_stamp_buffer(be), DP_float_to_int(x + 0.5f),
-            DP_float_to_int(y + 0.5f), diameter, false,
+            lc, get_stamp_buffer(be), xi, yi, diameter, false,
             is_pigment_mode(be->mypaint.blend_mode), &be->last_diameter,
             &in_bounds);
         *color_r = color.r;
@@ -2307,7 +2348,17 @@ DP_brush_engine_new(DP_MaskSync *ms_or_null,
          add_dab_mypaint_pigment,
          get_color_mypaint_pigment,
          NULL},
-        {0, 1.0f, 0.0f, false, false, false, false, false, false, 0},
+        {0,
+         1.0f,
+         0.0f,
+         false,
+         false,
+         false,
+         false,
+         false,
+         false,
+         0,
+         {0, 0, -1, -1}},
         {false, false, 0, 0, ms_or_null ? ++ms_or_null->last_sync_id : 0,
          DP_mask_sync_incref_nullable(ms_or_null), NULL, 0, NULL, NULL},
         {NULL,
@@ -2317,7 +2368,7 @@ DP_brush_engine_new(DP_MaskSync *ms_or_null,
          DP_BRUSH_ENGINE_FLOOD_TARGET_NONE,
          {0, 0, -1, 0, 0, 0, 0, NULL}},
         {0},
-        {0, 0, 0, 0, NULL},
+        {0, 0, 0, 0, NULL, {0, 0, -1, -1}},
         {false, false, false, false, 0, 0, 0, 0, {0}},
         push_message,
         poll_control_or_null,
@@ -2774,6 +2825,8 @@ void DP_brush_engine_dabs_flush(DP_BrushEngine *be)
     DP_ASSERT(be);
     int used = be->dabs.used;
     if (used != 0) {
+        expand_bounds(&be->stroke.unsynced_bounds, be->dabs.bounds);
+        be->dabs.bounds = (DP_Rect){0, 0, -1, -1};
         switch (be->active) {
         case DP_BRUSH_ENGINE_ACTIVE_PIXEL:
             flush_pixel_dabs(be, used);
@@ -2861,7 +2914,7 @@ void DP_brush_engine_stroke_begin(DP_BrushEngine *be,
     // canvas states when it's running with a worker thread.
     DP_CanvasState *sync_cs;
     if (!cs_or_null && be->stroke.sync_samples) {
-        sync_cs = be->sync(be->user);
+        sync_cs = sync_canvas_state(be);
         cs_or_null = sync_cs;
     }
     else {
@@ -2928,14 +2981,22 @@ static int get_classic_smudge_diameter(const DP_ClassicBrush *cb,
     return CLAMP(diameter, 2, 255);
 }
 
+static DP_LayerContent *update_classic_sample_layer_content(
+    DP_BrushEngine *be, DP_ClassicBrush *cb, float x, float y, float pressure,
+    float velocity, float distance, int *out_diameter)
+{
+    int diameter =
+        get_classic_smudge_diameter(cb, pressure, velocity, distance);
+    *out_diameter = diameter;
+    return update_sample_layer_content(be, DP_float_to_int(x),
+                                       DP_float_to_int(y), diameter);
+}
+
 static DP_UPixelFloat sample_classic_smudge(DP_BrushEngine *be,
                                             DP_ClassicBrush *cb,
                                             DP_LayerContent *lc, float x,
-                                            float y, float pressure,
-                                            float velocity, float distance)
+                                            float y, int diameter)
 {
-    int diameter =
-        get_classic_smudge_diameter(cb, pressure, velocity, distance);
     return DP_layer_content_sample_color_at(
         lc, get_stamp_buffer(be), DP_float_to_int(x), DP_float_to_int(y),
         diameter, !cb->smudge_alpha || be->stroke.compatibility_mode,
@@ -2950,10 +3011,12 @@ static void update_classic_smudge(DP_BrushEngine *be, DP_ClassicBrush *cb,
     float smudge = DP_classic_brush_smudge_at(cb, pressure, velocity, distance);
     int smudge_distance = ++be->classic.smudge_distance;
     if (smudge > 0.0f && smudge_distance > cb->resmudge) {
-        DP_LayerContent *lc = update_sample_layer_content(be);
+        int diameter;
+        DP_LayerContent *lc = update_classic_sample_layer_content(
+            be, cb, x, y, pressure, velocity, distance, &diameter);
         if (lc) {
-            DP_UPixelFloat sample = sample_classic_smudge(
-                be, cb, lc, x, y, pressure, velocity, distance);
+            DP_UPixelFloat sample =
+                sample_classic_smudge(be, cb, lc, x, y, diameter);
             DP_UPixelFloat *sp = &be->classic.smudge_color;
             if (cb->smudge_alpha && !be->stroke.compatibility_mode) {
                 if (sample.a > 0.0f) {
@@ -3185,14 +3248,16 @@ static void stroke_to_classic(
         be->classic.last_up = false;
         be->stroke.in_progress = true;
         DP_LayerContent *lc;
+        int diameter;
         bool smudge_alpha = cb->smudge_alpha && !be->stroke.compatibility_mode;
         bool colorpick =
             (cb->colorpick || (smudge_alpha && cb->smudge.max > 0.0f))
             && get_classic_blend_mode(be) != DP_BLEND_MODE_ERASE
-            && (lc = update_sample_layer_content(be));
+            && (lc = update_classic_sample_layer_content(
+                    be, cb, x, y, pressure, 0.0f, 0.0f, &diameter));
         if (colorpick) {
             be->classic.smudge_color =
-                sample_classic_smudge(be, cb, lc, x, y, pressure, 0.0f, 0.0f);
+                sample_classic_smudge(be, cb, lc, x, y, diameter);
             if (smudge_alpha) {
                 if (be->classic.smudge_color.a > 0.0f) {
                     if (cb->colorpick) {
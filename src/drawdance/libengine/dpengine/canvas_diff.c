@@ -20,30 +20,143 @@
  * SOFTWARE.
  */
 #include "canvas_diff.h"
+#include "canvas_diff.h"
 #include "layer_props_list.h"
 #include "tile.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <string.h>
+#ifdef _MSC_VER
+#    include <intrin.h>
+#endif
+
+#define WORD_BITS 64
+#define WORD_ALL  UINT64_MAX
+
 
+// Tile-relative, inclusive bounds of the changed area of a tile. Only
+// meaningful if the corresponding bit in tile_changes is set.
+typedef struct DP_CanvasDiffRect {
+    uint8_t x1, y1;
+    uint8_t x2, y2;
+} DP_CanvasDiffRect;
 
+#define FULL_TILE_RECT \
+    ((DP_CanvasDiffRect){0, 0, DP_TILE_SIZE - 1, DP_TILE_SIZE - 1})
+
+// Changes are tracked in a two-level bitmap: tile_changes has a bit for each
+// tile, word_changes has a bit for each word of tile_changes that has any bits
+// set. Going through the changes only looks at the words that actually have
+// something in them, so on a huge canvas where a single dab changed a couple
+// tiles, that's a handful of words instead of every single tile.
 struct DP_CanvasDiff {
     int count;
     int xtiles, ytiles;
     int tile_changes_reserved;
-    bool *tile_changes;
+    uint64_t *tile_changes;
+    uint64_t *word_changes;
+    DP_CanvasDiffRect *tile_rects;
     bool layer_props_changed;
 };
 
+static int word_count(int bit_count)
+{
+    return (bit_count + WORD_BITS - 1) / WORD_BITS;
+}
+
+static uint64_t word_bit(int i)
+{
+    return UINT64_C(1) << (i % WORD_BITS);
+}
+
+static int lowest_bit(uint64_t word)
+{
+    DP_ASSERT(word != 0);
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    int index = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+static bool tile_changed(DP_CanvasDiff *diff, int i)
+{
+    return diff->tile_changes[i / WORD_BITS] & word_bit(i);
+}
+
+static void tile_change(DP_CanvasDiff *diff, int i)
+{
+    int w = i / WORD_BITS;
+    diff->tile_changes[w] |= word_bit(i);
+    diff->word_changes[w / WORD_BITS] |= word_bit(w);
+}
+
+// Sets the first count bits and clears the rest of the last word.
+static void fill_bits(uint64_t *bits, int count)
+{
+    int words = word_count(count);
+    for (int w = 0; w < words; ++w) {
+        bits[w] = WORD_ALL;
+    }
+    int rest = count % WORD_BITS;
+    if (rest != 0) {
+        bits[words - 1] = WORD_ALL >> (WORD_BITS - rest);
+    }
+}
+
+static bool rect_full(DP_CanvasDiffRect rect)
+{
+    return rect.x1 == 0 && rect.y1 == 0 && rect.x2 == DP_TILE_SIZE - 1
+        && rect.y2 == DP_TILE_SIZE - 1;
+}
+
+static DP_CanvasDiffRect rect_from(DP_Rect rect)
+{
+    DP_ASSERT(DP_rect_valid(rect));
+    return (DP_CanvasDiffRect){
+        DP_int_to_uint8(DP_max_int(0, rect.x1)),
+        DP_int_to_uint8(DP_max_int(0, rect.y1)),
+        DP_int_to_uint8(DP_min_int(DP_TILE_SIZE - 1, rect.x2)),
+        DP_int_to_uint8(DP_min_int(DP_TILE_SIZE - 1, rect.y2)),
+    };
+}
+
+static DP_CanvasDiffRect rect_union(DP_CanvasDiffRect a, DP_CanvasDiffRect b)
+{
+    return (DP_CanvasDiffRect){
+        DP_min_uint8(a.x1, b.x1),
+        DP_min_uint8(a.y1, b.y1),
+        DP_max_uint8(a.x2, b.x2),
+        DP_max_uint8(a.y2, b.y2),
+    };
+}
+
+static DP_Rect rect_to(DP_CanvasDiffRect rect)
+{
+    return (DP_Rect){rect.x1, rect.y1, rect.x2, rect.y2};
+}
+
 DP_CanvasDiff *DP_canvas_diff_new(void)
 {
     DP_CanvasDiff *diff = DP_malloc(sizeof(*diff));
-    *diff = (DP_CanvasDiff){0, 0, 0, 0, NULL, false};
+    *diff = (DP_CanvasDiff){0, 0, 0, 0, NULL, NULL, NULL, false};
     return diff;
 }
 
 void DP_canvas_diff_free(DP_CanvasDiff *diff)
 {
     if (diff) {
+        DP_free(diff->tile_rects);
+        DP_free(diff->word_changes);
         DP_free(diff->tile_changes);
         DP_free(diff);
     }
@@ -62,6 +175,16 @@ int DP_canvas_diff_ytiles(DP_CanvasDiff *diff)
 }
 
 
+static uint64_t *reserve_bits(uint64_t *bits, int old_count, int new_count)
+{
+    int old_words = word_count(old_count);
+    int new_words = word_count(new_count);
+    bits = DP_realloc(bits, DP_int_to_size(new_words) * sizeof(*bits));
+    memset(bits + old_words, 0,
+           DP_int_to_size(new_words - old_words) * sizeof(*bits));
+    return bits;
+}
+
 void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
                           int current_width, int current_height,
                           bool layer_props_changed)
@@ -77,90 +200,218 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
     diff->count = count;
     diff->xtiles = xtiles;
     diff->ytiles = ytiles;
-    if (diff->tile_changes_reserved < count) {
+    int reserved = diff->tile_changes_reserved;
+    if (reserved < count) {
         diff->tile_changes_reserved = count;
-        size_t size = DP_int_to_size(count) * sizeof(*diff->tile_changes);
-        diff->tile_changes = DP_realloc(diff->tile_changes, size);
+        diff->tile_changes = reserve_bits(diff->tile_changes, reserved, count);
+        diff->word_changes = reserve_bits(
+            diff->word_changes, word_count(reserved), word_count(count));
+        diff->tile_rects =
+            DP_realloc(diff->tile_rects,
+                       DP_int_to_size(count) * sizeof(*diff->tile_rects));
     }
     if (old_width != current_width || old_height != current_height) {
-        bool *tile_changes = diff->tile_changes;
-        for (int i = 0; i < count; ++i) {
-            tile_changes[i] = true;
-        }
+        DP_canvas_diff_check_all(diff);
     }
     diff->layer_props_changed = layer_props_changed;
 }
 
+static void check_index(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                        void *data, int i)
+{
+    DP_CanvasDiffRect *tile_rect = &diff->tile_rects[i];
+    if ((!tile_changed(diff, i) || !rect_full(*tile_rect)) && fn(data, i)) {
+        tile_change(diff, i);
+        *tile_rect = FULL_TILE_RECT;
+    }
+}
+
+static void check_rect_index(DP_CanvasDiff *diff, DP_CanvasDiffCheckRectFn fn,
+                             void *data, int i)
+{
+    DP_CanvasDiffRect *tile_rect = &diff->tile_rects[i];
+    if (!tile_changed(diff, i)) {
+        DP_Rect rect = fn(data, i);
+        if (DP_rect_valid(rect)) {
+            tile_change(diff, i);
+            *tile_rect = rect_from(rect);
+        }
+    }
+    else if (!rect_full(*tile_rect)) {
+        DP_Rect rect = fn(data, i);
+        if (DP_rect_valid(rect)) {
+            *tile_rect = rect_union(*tile_rect, rect_from(rect));
+        }
+    }
+}
+
 void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
                           void *data)
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
     int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
     for (int i = 0; i < count; ++i) {
-        bool *tile_change = &tile_changes[i];
-        if (!*tile_change && fn(data, i)) {
-            *tile_change = true;
-        }
+        check_index(diff, fn, data, i);
     }
 }
 
-void DP_canvas_diff_check_all(DP_CanvasDiff *diff)
+void DP_canvas_diff_check_range(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                void *data, int start, int end)
 {
     DP_ASSERT(diff);
-    int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
+    DP_ASSERT(fn);
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(end <= diff->count);
+    for (int i = start; i < end; ++i) {
+        check_index(diff, fn, data, i);
+    }
+}
+
+void DP_canvas_diff_check_indexes(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                  void *data, const int *indexes, int count)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(fn);
+    DP_ASSERT(indexes || count == 0);
     for (int i = 0; i < count; ++i) {
-        tile_changes[i] = true;
+        DP_ASSERT(indexes[i] >= 0);
+        DP_ASSERT(indexes[i] < diff->count);
+        check_index(diff, fn, data, indexes[i]);
     }
 }
 
-void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
-                               void *data)
+void DP_canvas_diff_check_rect(DP_CanvasDiff *diff,
+                               DP_CanvasDiffCheckRectFn fn, void *data)
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
     int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
     for (int i = 0; i < count; ++i) {
-        if (tile_changes[i]) {
-            fn(data, i);
-        }
+        check_rect_index(diff, fn, data, i);
     }
 }
 
-void DP_canvas_diff_each_index_reset(DP_CanvasDiff *diff,
-                                     DP_CanvasDiffEachIndexFn fn, void *data)
+void DP_canvas_diff_check_rect_range(DP_CanvasDiff *diff,
+                                     DP_CanvasDiffCheckRectFn fn, void *data,
+                                     int start, int end)
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(end <= diff->count);
+    for (int i = start; i < end; ++i) {
+        check_rect_index(diff, fn, data, i);
+    }
+}
+
+void DP_canvas_diff_check_rect_indexes(DP_CanvasDiff *diff,
+                                       DP_CanvasDiffCheckRectFn fn, void *data,
+                                       const int *indexes, int count)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(fn);
+    DP_ASSERT(indexes || count == 0);
+    for (int i = 0; i < count; ++i) {
+        DP_ASSERT(indexes[i] >= 0);
+        DP_ASSERT(indexes[i] < diff->count);
+        check_rect_index(diff, fn, data, indexes[i]);
+    }
+}
+
+void DP_canvas_diff_check_all(DP_CanvasDiff *diff)
+{
+    DP_ASSERT(diff);
     int count = diff->count;
-    bool *tile_changes = diff->tile_changes;
+    fill_bits(diff->tile_changes, count);
+    fill_bits(diff->word_changes, word_count(count));
+    DP_CanvasDiffRect *tile_rects = diff->tile_rects;
     for (int i = 0; i < count; ++i) {
-        if (tile_changes[i]) {
-            fn(data, i);
-            tile_changes[i] = false;
+        tile_rects[i] = FULL_TILE_RECT;
+    }
+}
+
+typedef void (*DP_CanvasDiffVisitFn)(DP_CanvasDiff *diff, int tile_index,
+                                     void *user);
+
+// Calls the given function for each changed tile in index order, which is also
+// row-major order. If reset is given, the changes are cleared along the way.
+static void each_change(DP_CanvasDiff *diff, bool reset,
+                        DP_CanvasDiffVisitFn fn, void *user)
+{
+    uint64_t *tile_changes = diff->tile_changes;
+    uint64_t *word_changes = diff->word_changes;
+    int summary_count = word_count(word_count(diff->count));
+    for (int s = 0; s < summary_count; ++s) {
+        uint64_t summary = word_changes[s];
+        while (summary != 0) {
+            int w = s * WORD_BITS + lowest_bit(summary);
+            summary &= summary - 1;
+            uint64_t word = tile_changes[w];
+            while (word != 0) {
+                fn(diff, w * WORD_BITS + lowest_bit(word), user);
+                word &= word - 1;
+            }
+            if (reset) {
+                tile_changes[w] = 0;
+            }
+        }
+        if (reset) {
+            word_changes[s] = 0;
         }
     }
 }
 
+struct DP_CanvasDiffEachIndexParams {
+    DP_CanvasDiffEachIndexFn fn;
+    void *data;
+};
+
+static void visit_index(DP_UNUSED DP_CanvasDiff *diff, int tile_index,
+                        void *user)
+{
+    struct DP_CanvasDiffEachIndexParams *params = user;
+    params->fn(params->data, tile_index);
+}
+
+void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
+                               void *data)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(fn);
+    struct DP_CanvasDiffEachIndexParams params = {fn, data};
+    each_change(diff, false, visit_index, &params);
+}
+
+void DP_canvas_diff_each_index_reset(DP_CanvasDiff *diff,
+                                     DP_CanvasDiffEachIndexFn fn, void *data)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(fn);
+    struct DP_CanvasDiffEachIndexParams params = {fn, data};
+    each_change(diff, true, visit_index, &params);
+}
+
+struct DP_CanvasDiffEachPosParams {
+    DP_CanvasDiffEachPosFn fn;
+    void *data;
+};
+
+static void visit_pos(DP_CanvasDiff *diff, int tile_index, void *user)
+{
+    struct DP_CanvasDiffEachPosParams *params = user;
+    int xtiles = diff->xtiles;
+    params->fn(params->data, tile_index % xtiles, tile_index / xtiles,
+               rect_to(diff->tile_rects[tile_index]));
+}
+
 void DP_canvas_diff_each_pos(DP_CanvasDiff *diff, DP_CanvasDiffEachPosFn fn,
                              void *data)
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int xtiles = diff->xtiles;
-    int ytiles = diff->ytiles;
-    bool *tile_changes = diff->tile_changes;
-    for (int y = 0; y < ytiles; ++y) {
-        for (int x = 0; x < xtiles; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-            }
-        }
-    }
+    struct DP_CanvasDiffEachPosParams params = {fn, data};
+    each_change(diff, false, visit_pos, &params);
 }
 
 void DP_canvas_diff_each_pos_reset(DP_CanvasDiff *diff,
@@ -168,18 +419,8 @@ void DP_canvas_diff_each_pos_reset(DP_CanvasDiff *diff,
 {
     DP_ASSERT(diff);
     DP_ASSERT(fn);
-    int xtiles = diff->xtiles;
-    int ytiles = diff->ytiles;
-    bool *tile_changes = diff->tile_changes;
-    for (int y = 0; y < ytiles; ++y) {
-        for (int x = 0; x < xtiles; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-                tile_changes[i] = false;
-            }
-        }
-    }
+    struct DP_CanvasDiffEachPosParams params = {fn, data};
+    each_change(diff, true, visit_pos, &params);
 }
 
 void DP_canvas_diff_each_pos_check_all_reset(DP_CanvasDiff *diff,
@@ -190,14 +431,16 @@ void DP_canvas_diff_each_pos_check_all_reset(DP_CanvasDiff *diff,
     DP_ASSERT(fn);
     int xtiles = diff->xtiles;
     int ytiles = diff->ytiles;
-    bool *tile_changes = diff->tile_changes;
     for (int y = 0; y < ytiles; ++y) {
         for (int x = 0; x < xtiles; ++x) {
-            int i = y * xtiles + x;
-            fn(data, x, y);
-            tile_changes[i] = false;
+            fn(data, x, y, rect_to(FULL_TILE_RECT));
         }
     }
+    int words = word_count(diff->count);
+    memset(diff->tile_changes, 0,
+           DP_int_to_size(words) * sizeof(*diff->tile_changes));
+    memset(diff->word_changes, 0,
+           DP_int_to_size(word_count(words)) * sizeof(*diff->word_changes));
 }
 
 void DP_canvas_diff_bounds_clamp(DP_CanvasDiff *diff, int tile_left,
@@ -219,6 +462,14 @@ void DP_canvas_diff_bounds_clamp(DP_CanvasDiff *diff, int tile_left,
     *out_xtiles = xtiles;
 }
 
+// Mask of the bits of word w that fall within the inclusive index range.
+static uint64_t range_mask(int w, int first, int last)
+{
+    int lo = w == first / WORD_BITS ? first % WORD_BITS : 0;
+    int hi = w == last / WORD_BITS ? last % WORD_BITS : WORD_BITS - 1;
+    return (WORD_ALL << lo) & (WORD_ALL >> (WORD_BITS - 1 - hi));
+}
+
 void DP_canvas_diff_each_pos_tile_bounds_reset(DP_CanvasDiff *diff,
                                                int tile_left, int tile_top,
                                                int tile_right, int tile_bottom,
@@ -231,13 +482,27 @@ void DP_canvas_diff_each_pos_tile_bounds_reset(DP_CanvasDiff *diff,
     DP_canvas_diff_bounds_clamp(diff, tile_left, tile_top, tile_right,
                                 tile_bottom, &left, &top, &right, &bottom,
                                 &xtiles);
-    bool *tile_changes = diff->tile_changes;
+    if (left > right) {
+        return;
+    }
+    uint64_t *tile_changes = diff->tile_changes;
+    uint64_t *word_changes = diff->word_changes;
+    DP_CanvasDiffRect *tile_rects = diff->tile_rects;
     for (int y = top; y <= bottom; ++y) {
-        for (int x = left; x <= right; ++x) {
-            int i = y * xtiles + x;
-            if (tile_changes[i]) {
-                fn(data, x, y);
-                tile_changes[i] = false;
+        int first = y * xtiles + left;
+        int last = y * xtiles + right;
+        for (int w = first / WORD_BITS; w <= last / WORD_BITS; ++w) {
+            uint64_t word = tile_changes[w] & range_mask(w, first, last);
+            if (word != 0) {
+                tile_changes[w] &= ~word;
+                if (tile_changes[w] == 0) {
+                    word_changes[w / WORD_BITS] &= ~word_bit(w);
+                }
+                do {
+                    int i = w * WORD_BITS + lowest_bit(word);
+                    fn(data, i - y * xtiles, y, rect_to(tile_rects[i]));
+                    word &= word - 1;
+                } while (word != 0);
             }
         }
     }
@@ -22,12 +22,18 @@
 #ifndef DP_ENGINE_CANVAS_DIFF
 #define DP_ENGINE_CANVAS_DIFF
 #include <dpcommon/common.h>
+#include <dpcommon/geom.h>
 
 
 typedef struct DP_CanvasDiff DP_CanvasDiff;
 typedef bool (*DP_CanvasDiffCheckFn)(void *data, int tile_index);
+// Returns the tile-relative bounds of the changed area, an invalid rect if
+// nothing changed.
+typedef DP_Rect (*DP_CanvasDiffCheckRectFn)(void *data, int tile_index);
 typedef void (*DP_CanvasDiffEachIndexFn)(void *data, int tile_index);
-typedef void (*DP_CanvasDiffEachPosFn)(void *data, int tile_x, int tile_y);
+// The given rect is the tile-relative, inclusive bounds of the changed area.
+typedef void (*DP_CanvasDiffEachPosFn)(void *data, int tile_x, int tile_y,
+                                       DP_Rect rect);
 
 DP_CanvasDiff *DP_canvas_diff_new(void);
 
@@ -40,6 +46,28 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
 void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
                           void *data);
 
+// Like DP_canvas_diff_check, but only marks the changed part of each tile.
+void DP_canvas_diff_check_rect(DP_CanvasDiff *diff,
+                               DP_CanvasDiffCheckRectFn fn, void *data);
+
+// Like DP_canvas_diff_check and DP_canvas_diff_check_rect respectively, but
+// only look at the tile indexes from start (inclusive) to end (exclusive).
+void DP_canvas_diff_check_range(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                void *data, int start, int end);
+
+void DP_canvas_diff_check_rect_range(DP_CanvasDiff *diff,
+                                     DP_CanvasDiffCheckRectFn fn, void *data,
+                                     int start, int end);
+
+// Same again, but only look at the given tile indexes. Duplicates are fine,
+// they just get checked again.
+void DP_canvas_diff_check_indexes(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                  void *data, const int *indexes, int count);
+
+void DP_canvas_diff_check_rect_indexes(DP_CanvasDiff *diff,
+                                       DP_CanvasDiffCheckRectFn fn, void *data,
+                                       const int *indexes, int count);
+
 void DP_canvas_diff_check_all(DP_CanvasDiff *diff);
 
 void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
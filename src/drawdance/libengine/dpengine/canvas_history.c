@@ -21,8 +21,10 @@
  */
 #include "canvas_history.h"
 #include "canvas_state.h"
+#include "memory_report.h"
 #include "recorder.h"
 #include "snapshots.h"
+#include "tile.h"
 #include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/conversions.h>
@@ -43,6 +45,10 @@
 
 #define MAX_FALLBEHIND 10000
 
+// When over the state memory budget, save points are dropped to get under it,
+// except for the oldest one and this many of the most recent ones.
+#define STATE_MEMORY_KEEP_RECENT 3
+
 // We want to batch draw dabs commands when replaying messages, since they're so
 // common and really benefit from combined handling. We'll use a fixed buffer of
 // some reasonable size to store plenty of messages for that purpose.
@@ -71,6 +77,7 @@ struct DP_CanvasHistory {
         int start;
         int fallbehind;
         DP_Queue queue;
+        DP_AffectedAreaIndex index;
     } fork;
     struct {
         DP_CanvasHistorySavePointFn fn;
@@ -79,8 +86,16 @@ struct DP_CanvasHistory {
     struct {
         int used;
         DP_Message *buffer[REPLAY_BUFFER_CAPACITY];
+        unsigned long long time_limit_ns;
+        unsigned long long time_ns;
     } replay;
     DP_Atomic local_drawing_in_progress;
+    struct {
+        // Number of local drawing dab messages handled so far, the published
+        // value is the one that matches the current state, under the mutex.
+        unsigned long long handled;
+        unsigned long long published;
+    } local_dabs;
     struct {
         bool want;
         char *dir;
@@ -88,6 +103,12 @@ struct DP_CanvasHistory {
         size_t buffer_size;
         unsigned char *buffer;
     } dump;
+    struct {
+        size_t budget;
+        int capacity;
+        int *indexes;
+        size_t *bytes;
+    } state_memory;
 };
 
 struct DP_CanvasHistorySnapshot {
@@ -343,6 +364,7 @@ static void clear_fork_entries(DP_CanvasHistory *ch)
     DP_ASSERT(ch);
     HISTORY_DEBUG("Clear %zu fork entries", ch->fork.queue.used);
     DP_queue_clear(&ch->fork.queue, sizeof(DP_ForkEntry), dispose_fork_entry);
+    DP_affected_area_index_clear(&ch->fork.index);
 }
 
 static void push_fork_entry_noinc(DP_CanvasHistory *ch, DP_Message *msg)
@@ -352,6 +374,7 @@ static void push_fork_entry_noinc(DP_CanvasHistory *ch, DP_Message *msg)
     HISTORY_DEBUG("Push fork element %zu", ch->fork.queue.used);
     DP_ForkEntry *fe = DP_queue_push(&ch->fork.queue, sizeof(DP_ForkEntry));
     *fe = (DP_ForkEntry){msg, DP_affected_area_make(msg, &ch->aia)};
+    DP_affected_area_index_add(&ch->fork.index, &fe->aa);
 }
 
 static void push_fork_entry_inc(DP_CanvasHistory *ch, DP_Message *msg)
@@ -377,6 +400,8 @@ static DP_Message *peek_fork_entry_message(DP_CanvasHistory *ch)
 
 static void shift_fork_entry_nodec(DP_CanvasHistory *ch)
 {
+    DP_ForkEntry *fe = DP_queue_peek(&ch->fork.queue, sizeof(DP_ForkEntry));
+    DP_affected_area_index_remove(&ch->fork.index, &fe->aa);
     DP_queue_shift(&ch->fork.queue);
     HISTORY_DEBUG("Shift fork element %zu", ch->fork.queue.used);
 }
@@ -404,8 +429,12 @@ static bool fork_entries_concurrent_with(DP_CanvasHistory *ch,
 {
     DP_ASSERT(ch);
     DP_ASSERT(aa);
-    return DP_queue_all(&ch->fork.queue, sizeof(DP_ForkEntry),
-                        fork_entry_concurrent_with, &aa);
+    // The index can tell that most messages are concurrent with the whole fork
+    // without looking at every entry in it. If it can't, we go through them
+    // individually, which also gives us warnings about the conflicting ones.
+    return DP_affected_area_index_concurrent_with(&ch->fork.index, aa)
+        || DP_queue_all(&ch->fork.queue, sizeof(DP_ForkEntry),
+                        fork_entry_concurrent_with, aa);
 }
 
 
@@ -420,6 +449,7 @@ static void call_save_point_fn(DP_CanvasHistory *ch, DP_CanvasState *cs,
 
 static void set_initial_entry(DP_CanvasHistory *ch, DP_CanvasState *cs)
 {
+    ch->replay.time_ns = 0;
     HISTORY_DEBUG("Set initial history entry");
     ch->entries[0] = (DP_CanvasHistoryEntry){
         DP_UNDO_DONE, DP_msg_undo_point_new(0), DP_canvas_state_incref(cs)};
@@ -516,11 +546,13 @@ DP_CanvasHistory *DP_canvas_history_new_inc(
         DP_malloc(entries_size),
         {0},
         true,
-        {false, 0, 0, DP_QUEUE_NULL},
+        {false, 0, 0, DP_QUEUE_NULL, {{0}, DP_VECTOR_NULL}},
         {save_point_fn, save_point_user},
-        {0, {0}},
+        {0, {0}, DP_CANVAS_HISTORY_REPLAY_TIME_LIMIT_DEFAULT_NS, 0},
         DP_ATOMIC_INIT(0),
+        {0, 0},
         {want_dump, DP_strdup(dump_dir), NULL, 0, NULL},
+        {0, 0, NULL, NULL},
     };
     DP_user_cursors_init(&ch->ucs);
     DP_effective_user_cursors_init(&ch->eucs);
@@ -532,6 +564,7 @@ DP_CanvasHistory *DP_canvas_history_new_inc(
     }
 
     DP_queue_init(&ch->fork.queue, INITIAL_CAPACITY, sizeof(DP_ForkEntry));
+    DP_affected_area_index_init(&ch->fork.index);
     set_initial_entry(ch, cs);
     validate_history(ch, true);
     return ch;
@@ -570,6 +603,7 @@ void DP_canvas_history_free(DP_CanvasHistory *ch)
     if (ch) {
         clear_fork_entries(ch);
         DP_queue_dispose(&ch->fork.queue);
+        DP_affected_area_index_dispose(&ch->fork.index);
         truncate_history(ch, ch->used);
         DP_free(ch->entries);
         DP_canvas_state_decref(ch->current_state);
@@ -577,6 +611,8 @@ void DP_canvas_history_free(DP_CanvasHistory *ch)
         DP_free(ch->dump.buffer);
         DP_output_free(ch->dump.output);
         DP_free(ch->dump.dir);
+        DP_free(ch->state_memory.bytes);
+        DP_free(ch->state_memory.indexes);
         DP_free(ch);
     }
 }
@@ -619,11 +655,23 @@ DP_CanvasState *DP_canvas_history_get(DP_CanvasHistory *ch)
 DP_CanvasState *
 DP_canvas_history_compare_and_get(DP_CanvasHistory *ch, DP_CanvasState *prev,
                                   DP_UserCursorBuffer *out_user_cursors)
+{
+    return DP_canvas_history_compare_and_get_local_dabs(ch, prev,
+                                                        out_user_cursors, NULL);
+}
+
+DP_CanvasState *DP_canvas_history_compare_and_get_local_dabs(
+    DP_CanvasHistory *ch, DP_CanvasState *prev,
+    DP_UserCursorBuffer *out_user_cursors,
+    unsigned long long *out_local_dabs_handled)
 {
     DP_ASSERT(ch);
     DP_PERF_BEGIN(fn, "compare_and_get");
     DP_Mutex *mutex = ch->mutex;
     DP_MUTEX_MUST_LOCK(mutex);
+    if (out_local_dabs_handled) {
+        *out_local_dabs_handled = ch->local_dabs.published;
+    }
     DP_CanvasState *next = ch->current_state;
     DP_CanvasState *cs;
     if (next == prev) {
@@ -640,12 +688,19 @@ DP_canvas_history_compare_and_get(DP_CanvasHistory *ch, DP_CanvasState *prev,
     return cs;
 }
 
+unsigned long long DP_canvas_history_local_dabs_handled(DP_CanvasHistory *ch)
+{
+    DP_ASSERT(ch);
+    return ch->local_dabs.handled;
+}
+
 static void set_current_state_noinc(DP_CanvasHistory *ch, DP_CanvasState *next)
 {
     DP_CanvasState *current = ch->current_state;
     DP_Mutex *mutex = ch->mutex;
     DP_MUTEX_MUST_LOCK(mutex);
     ch->current_state = next;
+    ch->local_dabs.published = ch->local_dabs.handled;
     DP_MUTEX_MUST_UNLOCK(mutex);
     DP_canvas_state_decref(current);
 }
@@ -657,11 +712,24 @@ static void set_current_state_with_cursors_noinc(DP_CanvasHistory *ch,
     DP_Mutex *mutex = ch->mutex;
     DP_MUTEX_MUST_LOCK(mutex);
     ch->current_state = next;
+    ch->local_dabs.published = ch->local_dabs.handled;
     DP_effective_user_cursors_apply(&ch->eucs, &ch->ucs);
     DP_MUTEX_MUST_UNLOCK(mutex);
     DP_canvas_state_decref(current);
 }
 
+// When handling local dabs doesn't change the state, the count still needs to
+// be published, otherwise it looks like they're still waiting to be handled.
+static void publish_local_dabs(DP_CanvasHistory *ch)
+{
+    if (ch->local_dabs.published != ch->local_dabs.handled) {
+        DP_Mutex *mutex = ch->mutex;
+        DP_MUTEX_MUST_LOCK(mutex);
+        ch->local_dabs.published = ch->local_dabs.handled;
+        DP_MUTEX_MUST_UNLOCK(mutex);
+    }
+}
+
 
 static void reset_to_state_noinc(DP_CanvasHistory *ch, DP_CanvasState *cs,
                                  bool clear_fork)
@@ -819,6 +887,17 @@ static void finish_replay(DP_CanvasHistory *ch, DP_CanvasState *cs,
     set_current_state_noinc(ch, cs);
 }
 
+static void replace_replay_state(DP_CanvasHistory *ch,
+                                 DP_CanvasHistoryEntry *entry,
+                                 DP_CanvasState **inout_cs, DP_DrawContext *dc)
+{
+    if (ch->replay.used != 0) {
+        *inout_cs = flush_replay_buffer(ch, *inout_cs, dc);
+    }
+    DP_canvas_state_decref_nullable(entry->state);
+    entry->state = DP_canvas_state_incref(*inout_cs);
+}
+
 static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
                             int start_index, DP_CanvasState *start_cs,
                             bool with_fork)
@@ -826,6 +905,9 @@ static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
     DP_ASSERT(start_cs);
     DP_CanvasHistoryEntry *entries = ch->entries;
     DP_CanvasState *cs = DP_canvas_state_incref(start_cs);
+    unsigned long long time_limit_ns = ch->replay.time_limit_ns;
+    unsigned long long last_state_time =
+        time_limit_ns == 0 ? 0 : DP_perf_time();
 
     int used = ch->used;
     for (int i = start_index + 1; i < used; ++i) {
@@ -837,15 +919,25 @@ static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
             // Update undo points even when they're undone so
             // they can serve as a starting point for redos.
             if (type == DP_MSG_UNDO_POINT) {
-                if (ch->replay.used != 0) {
-                    cs = flush_replay_buffer(ch, cs, dc);
+                replace_replay_state(ch, entry, &cs, dc);
+                if (time_limit_ns != 0) {
+                    last_state_time = DP_perf_time();
                 }
-                DP_canvas_state_decref_nullable(entry->state);
-                entry->state = DP_canvas_state_incref(cs);
             }
             else if (undo == DP_UNDO_DONE) {
                 cs = replay_drawing_command_dec(ch, cs, dc, msg, type);
                 validate_history(ch, with_fork);
+                // Keep save points in the middle of strokes up to date and
+                // place new ones where replaying took too long since the last.
+                if (entry->state) {
+                    replace_replay_state(ch, entry, &cs, dc);
+                }
+                else if (time_limit_ns != 0
+                         && DP_perf_time() - last_state_time >= time_limit_ns) {
+                    HISTORY_DEBUG("Create replay save point at %d", i);
+                    replace_replay_state(ch, entry, &cs, dc);
+                    last_state_time = DP_perf_time();
+                }
             }
         }
     }
@@ -856,6 +948,9 @@ static void replay_from_inc(DP_CanvasHistory *ch, DP_DrawContext *dc,
     }
 
     finish_replay(ch, cs, dc);
+    if (time_limit_ns != 0) {
+        ch->replay.time_ns = DP_perf_time() - last_state_time;
+    }
 }
 
 static bool search_and_replay_from(DP_CanvasHistory *ch, DP_DrawContext *dc,
@@ -953,6 +1048,35 @@ void DP_canvas_history_undo_depth_limit_set(DP_CanvasHistory *ch,
     }
 }
 
+size_t DP_canvas_history_state_memory_budget(DP_CanvasHistory *ch)
+{
+    DP_ASSERT(ch);
+    return ch->state_memory.budget;
+}
+
+void DP_canvas_history_state_memory_budget_set(DP_CanvasHistory *ch,
+                                               size_t budget_bytes)
+{
+    DP_ASSERT(ch);
+    DP_debug("Set state memory budget to %zu bytes", budget_bytes);
+    ch->state_memory.budget = budget_bytes;
+}
+
+unsigned long long DP_canvas_history_replay_time_limit(DP_CanvasHistory *ch)
+{
+    DP_ASSERT(ch);
+    return ch->replay.time_limit_ns;
+}
+
+void DP_canvas_history_replay_time_limit_set(DP_CanvasHistory *ch,
+                                             unsigned long long time_limit_ns)
+{
+    DP_ASSERT(ch);
+    DP_debug("Set replay time limit to %llu ns", time_limit_ns);
+    ch->replay.time_limit_ns = time_limit_ns;
+    ch->replay.time_ns = 0;
+}
+
 static int find_save_point_index(DP_CanvasHistory *ch)
 {
     for (int i = ch->used - 1; i >= 0; --i) {
@@ -969,6 +1093,7 @@ static int find_save_point_index(DP_CanvasHistory *ch)
 static void make_save_point(DP_CanvasHistory *ch, int index,
                             bool snapshot_requested)
 {
+    ch->replay.time_ns = 0;
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < ch->used);
     // Save points based on local fork state are invalid.
@@ -1124,6 +1249,127 @@ static void truncate_unreachable(DP_CanvasHistory *ch, int i, int depth)
     }
 }
 
+static size_t get_state_memory_bytes(DP_CanvasState *cs,
+                                     DP_CanvasState *newer)
+{
+    return DP_canvas_state_unshared_tile_count(cs, newer) * DP_TILE_BYTES;
+}
+
+static int gather_save_points(DP_CanvasHistory *ch)
+{
+    DP_CanvasHistoryEntry *entries = ch->entries;
+    int used = ch->used;
+    int count = 0;
+    for (int i = 0; i < used; ++i) {
+        if (entries[i].state) {
+            if (count == ch->state_memory.capacity) {
+                int new_capacity = DP_max_int(32, count * 2);
+                size_t new_size = DP_int_to_size(new_capacity);
+                ch->state_memory.indexes =
+                    DP_realloc(ch->state_memory.indexes,
+                               sizeof(*ch->state_memory.indexes) * new_size);
+                ch->state_memory.bytes =
+                    DP_realloc(ch->state_memory.bytes,
+                               sizeof(*ch->state_memory.bytes) * new_size);
+                ch->state_memory.capacity = new_capacity;
+            }
+            ch->state_memory.indexes[count++] = i;
+        }
+    }
+    return count;
+}
+
+static int search_state_to_drop(DP_CanvasHistory *ch, int count)
+{
+    // Drop the save point with the closest neighbors, so that the remaining
+    // ones stay spread out and no replay gets too far to go.
+    DP_CanvasHistoryEntry *entries = ch->entries;
+    int *indexes = ch->state_memory.indexes;
+    int best = -1;
+    int best_gap = INT_MAX;
+    for (int i = 1; i < count - STATE_MEMORY_KEEP_RECENT; ++i) {
+        int gap = indexes[i + 1] - indexes[i - 1];
+        if (gap < best_gap && is_undo_point_entry(&entries[indexes[i]])) {
+            best = i;
+            best_gap = gap;
+        }
+    }
+    return best;
+}
+
+// Canvas states share all the tiles they have in common, so what a save point
+// costs is the tiles that were changed between it and the next newer one.
+// When those add up to more than the budget, save points get dropped, undos
+// replay from an older save point instead. Replays regenerate save points
+// along the way, so those get dropped again at the next undo point.
+static int drop_save_points_over(DP_CanvasHistory *ch, size_t budget)
+{
+    if (have_local_fork(ch)) {
+        return 0;
+    }
+
+    int count = gather_save_points(ch);
+    if (count <= STATE_MEMORY_KEEP_RECENT + 1) {
+        return 0;
+    }
+
+    DP_CanvasHistoryEntry *entries = ch->entries;
+    int *indexes = ch->state_memory.indexes;
+    size_t *bytes = ch->state_memory.bytes;
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        DP_CanvasState *newer = i == count - 1 ? ch->current_state
+                                               : entries[indexes[i + 1]].state;
+        bytes[i] = get_state_memory_bytes(entries[indexes[i]].state, newer);
+        total += bytes[i];
+    }
+
+    int dropped = 0;
+    while (total > budget) {
+        int i = search_state_to_drop(ch, count);
+        if (i < 0) {
+            break;
+        }
+
+        DP_CanvasHistoryEntry *entry = &entries[indexes[i]];
+        HISTORY_DEBUG("Drop save point at %d for state memory", indexes[i]);
+        DP_canvas_state_decref(entry->state);
+        entry->state = NULL;
+        ++dropped;
+
+        total -= bytes[i - 1] + bytes[i];
+        bytes[i - 1] = get_state_memory_bytes(entries[indexes[i - 1]].state,
+                                              entries[indexes[i + 1]].state);
+        total += bytes[i - 1];
+
+        size_t tail = DP_int_to_size(count - i - 1);
+        memmove(&indexes[i], &indexes[i + 1], sizeof(*indexes) * tail);
+        memmove(&bytes[i], &bytes[i + 1], sizeof(*bytes) * tail);
+        --count;
+    }
+
+    if (dropped != 0) {
+        DP_debug("Dropped %d save point(s), state memory now at %zu of %zu "
+                 "bytes",
+                 dropped, total, budget);
+    }
+    return dropped;
+}
+
+static void enforce_state_memory_budget(DP_CanvasHistory *ch)
+{
+    size_t budget = ch->state_memory.budget;
+    if (budget != 0) {
+        drop_save_points_over(ch, budget);
+    }
+}
+
+int DP_canvas_history_save_points_trim(DP_CanvasHistory *ch)
+{
+    DP_ASSERT(ch);
+    return drop_save_points_over(ch, 0);
+}
+
 static void handle_undo_point(DP_CanvasHistory *ch, int index)
 {
     // Don't make save points while a local fork is present, since the local
@@ -1134,6 +1380,7 @@ static void handle_undo_point(DP_CanvasHistory *ch, int index)
     int depth;
     int i = mark_undone_actions_gone(ch, index, &depth);
     truncate_unreachable(ch, i, depth);
+    enforce_state_memory_budget(ch);
 }
 
 
@@ -1217,10 +1464,9 @@ static void mark_entries_undone(DP_CanvasHistory *ch, unsigned int context_id,
             && DP_message_type(entry->msg) != DP_MSG_SYNC_SELECTION_TILE) {
             entry->undo = DP_UNDO_UNDONE;
         }
-        // Clear out any states that were left behind by local fork starts, they
-        // happen too frequently to update them all on every undo/redo. Instead
-        // only undo points get to keep their states and get updated.
-        if (!is_undo_point_entry(entry)) {
+        // Undone entries can't hold a save point anymore, except for undo
+        // points. Any other states get updated by the replay that follows.
+        if (!is_valid_save_point_entry(entry)) {
             DP_CanvasState *cs = entry->state;
             if (cs) {
                 DP_canvas_state_decref_nullable(cs);
@@ -1338,6 +1584,20 @@ static bool handle_undo(DP_CanvasHistory *ch, DP_DrawContext *dc,
 }
 
 
+// Replaying from the last save point would take about as long as handling the
+// messages since then did. When that goes over the limit, make one here.
+static void add_replay_time(DP_CanvasHistory *ch, unsigned long long start)
+{
+    unsigned long long time_limit_ns = ch->replay.time_limit_ns;
+    if (time_limit_ns != 0) {
+        ch->replay.time_ns += DP_perf_time() - start;
+        if (ch->replay.time_ns >= time_limit_ns && !have_local_fork(ch)) {
+            HISTORY_DEBUG("Create replay time save point at %d", ch->used - 1);
+            make_save_point(ch, find_save_point_index(ch), false);
+        }
+    }
+}
+
 static bool handle_drawing_command(DP_CanvasHistory *ch, DP_DrawContext *dc,
                                    DP_Message *msg)
 {
@@ -1365,8 +1625,13 @@ static bool handle_command(DP_CanvasHistory *ch, DP_DrawContext *dc,
         return true;
     case DP_MSG_UNDO:
         return handle_undo(ch, dc, msg);
-    default:
-        return handle_drawing_command(ch, dc, msg);
+    default: {
+        unsigned long long start =
+            ch->replay.time_limit_ns == 0 ? 0 : DP_perf_time();
+        bool ok = handle_drawing_command(ch, dc, msg);
+        add_replay_time(ch, start);
+        return ok;
+    }
     }
 }
 
@@ -1601,8 +1866,16 @@ bool DP_canvas_history_handle_local(DP_CanvasHistory *ch, DP_DrawContext *dc,
     }
     push_fork_entry_inc(ch, msg);
 
-    bool ok = type == DP_MSG_UNDO || type == DP_MSG_UNDO_POINT
-           || handle_drawing_command(ch, dc, msg);
+    bool ok;
+    if (is_draw_dabs_message_type(type)) {
+        ++ch->local_dabs.handled;
+        ok = handle_drawing_command(ch, dc, msg);
+        publish_local_dabs(ch);
+    }
+    else {
+        ok = type == DP_MSG_UNDO || type == DP_MSG_UNDO_POINT
+          || handle_drawing_command(ch, dc, msg);
+    }
     validate_history(ch, true);
 
     DP_PERF_END(fn);
@@ -1654,11 +1927,14 @@ void DP_canvas_history_handle_multidab_dec(DP_CanvasHistory *ch,
     validate_history(ch, true);
 
     if (offset != count) {
+        unsigned long long start =
+            ch->replay.time_limit_ns == 0 ? 0 : DP_perf_time();
         DP_CanvasState *cs = DP_canvas_state_handle_multidab(
             ch->current_state, dc, &ch->ucs, count - offset, msgs + offset);
         if (cs) {
             set_current_state_with_cursors_noinc(ch, cs);
         }
+        add_replay_time(ch, start);
     }
 
     DP_PERF_END(fn);
@@ -1683,11 +1959,15 @@ void DP_canvas_history_handle_local_multidab_dec(DP_CanvasHistory *ch,
         push_fork_entry_noinc(ch, msgs[i]);
     }
 
+    ch->local_dabs.handled += DP_int_to_ullong(count);
     DP_CanvasState *cs = DP_canvas_state_handle_multidab(ch->current_state, dc,
                                                          &ch->ucs, count, msgs);
     if (cs) {
         set_current_state_with_cursors_noinc(ch, cs);
     }
+    else {
+        publish_local_dabs(ch);
+    }
 
     validate_history(ch, true);
     DP_PERF_END(fn);
@@ -1777,6 +2057,7 @@ bool DP_canvas_history_reset_image_new(
 struct DP_CanvasHistoryRecorderParams {
     DP_CanvasHistory *ch;
     DP_RecorderType type;
+    int keyframe_interval;
     JSON_Value *header;
     DP_RecorderGetTimeMsFn get_time_fn;
     void *get_time_user;
@@ -1788,9 +2069,9 @@ static bool accept_recorder_state(void *user, DP_CanvasState *cs)
 {
     struct DP_CanvasHistoryRecorderParams *params = user;
     DP_ASSERT(!params->r);
-    params->r = DP_recorder_new_inc(params->type, params->header, cs,
-                                    params->get_time_fn, params->get_time_user,
-                                    params->output);
+    params->r = DP_recorder_new_keyframes_inc(
+        params->type, params->header, cs, params->keyframe_interval,
+        params->get_time_fn, params->get_time_user, params->output);
     return params->r != NULL;
 }
 
@@ -1802,14 +2083,16 @@ static bool accept_recorder_message(void *user, DP_Message *msg)
 }
 
 DP_Recorder *DP_canvas_history_recorder_new(
-    DP_CanvasHistory *ch, DP_RecorderType type, JSON_Value *header,
-    DP_RecorderGetTimeMsFn get_time_fn, void *get_time_user, DP_Output *output)
+    DP_CanvasHistory *ch, DP_RecorderType type, int keyframe_interval,
+    JSON_Value *header, DP_RecorderGetTimeMsFn get_time_fn, void *get_time_user,
+    DP_Output *output)
 {
     DP_ASSERT(ch);
     DP_ASSERT(header);
     DP_ASSERT(output);
     struct DP_CanvasHistoryRecorderParams params = {
-        ch, type, header, get_time_fn, get_time_user, output, NULL};
+        ch,     type, keyframe_interval, header, get_time_fn, get_time_user,
+        output, NULL};
     bool ok = DP_canvas_history_reset_image_new(
         ch, accept_recorder_state, accept_recorder_message, &params);
     if (ok && params.r) {
@@ -1940,6 +2223,24 @@ static DP_ForkEntry *snapshot_fork(DP_CanvasHistory *ch)
     return fes;
 }
 
+void DP_canvas_history_memory_report_add(DP_CanvasHistory *ch,
+                                        DP_MemoryReport *mr)
+{
+    DP_ASSERT(ch);
+    DP_ASSERT(mr);
+    DP_memory_report_canvas_state_add(mr, DP_MEMORY_REPORT_SOURCE_CURRENT, -1,
+                                      ch->current_state);
+    int offset = ch->offset;
+    int used = ch->used;
+    for (int i = 0; i < used; ++i) {
+        DP_CanvasState *cs = ch->entries[i].state;
+        if (cs) {
+            DP_memory_report_canvas_state_add(
+                mr, DP_MEMORY_REPORT_SOURCE_HISTORY, offset + i, cs);
+        }
+    }
+}
+
 DP_CanvasHistorySnapshot *DP_canvas_history_snapshot_new(DP_CanvasHistory *ch)
 {
     DP_CanvasHistorySnapshot *chs = DP_malloc(sizeof(*chs));
@@ -28,12 +28,14 @@
 #include <dpcommon/common.h>
 
 typedef struct DP_DrawContext DP_DrawContext;
+typedef struct DP_MemoryReport DP_MemoryReport;
 typedef struct DP_Message DP_Message;
 typedef struct json_value_t JSON_Value;
 
 
 #define DP_CANVAS_HISTORY_UNDO_DEPTH_MIN 3
 #define DP_CANVAS_HISTORY_UNDO_DEPTH_MAX 255
+#define DP_CANVAS_HISTORY_REPLAY_TIME_LIMIT_DEFAULT_NS 200000000ull
 
 #define DP_USER_CURSOR_COUNT 256
 
@@ -106,6 +108,17 @@ DP_CanvasState *
 DP_canvas_history_compare_and_get(DP_CanvasHistory *ch, DP_CanvasState *prev,
                                   DP_UserCursorBuffer *out_user_cursors);
 
+// Like above, but also gives the number of local drawing dab messages that have
+// been handled to arrive at the current state, even if it's unchanged.
+DP_CanvasState *DP_canvas_history_compare_and_get_local_dabs(
+    DP_CanvasHistory *ch, DP_CanvasState *prev,
+    DP_UserCursorBuffer *out_user_cursors,
+    unsigned long long *out_local_dabs_handled);
+
+// Number of local drawing dab messages handled so far. Only to be called from
+// the thread that handles messages, use the function above from elsewhere.
+unsigned long long DP_canvas_history_local_dabs_handled(DP_CanvasHistory *ch);
+
 void DP_canvas_history_reset(DP_CanvasHistory *ch);
 
 void DP_canvas_history_reset_to_state_noinc(DP_CanvasHistory *ch,
@@ -124,6 +137,29 @@ void DP_canvas_history_undo_depth_limit_set(DP_CanvasHistory *ch,
                                             DP_DrawContext *dc,
                                             int undo_depth_limit);
 
+// When set to a non-zero amount of bytes, save points get dropped when the
+// tiles they keep alive exceed that amount, at the cost of undos having to
+// replay from further back. The oldest and most recent save points are kept.
+size_t DP_canvas_history_state_memory_budget(DP_CanvasHistory *ch);
+
+void DP_canvas_history_state_memory_budget_set(DP_CanvasHistory *ch,
+                                               size_t budget_bytes);
+
+// Drops every save point that the state memory budget could drop, as if it
+// was exhausted, for when memory runs low. Returns how many were dropped.
+int DP_canvas_history_save_points_trim(DP_CanvasHistory *ch);
+
+// When handling messages since the last save point took longer than this many
+// nanoseconds, another save point is made, even in the middle of a stroke.
+// Replays place them the same way. This keeps undos from stalling for too long
+// on expensive operations like big fills or transforms. The state memory
+// budget only drops save points at undo points, so it leaves these alone.
+// Zero turns it off.
+unsigned long long DP_canvas_history_replay_time_limit(DP_CanvasHistory *ch);
+
+void DP_canvas_history_replay_time_limit_set(DP_CanvasHistory *ch,
+                                             unsigned long long time_limit_ns);
+
 bool DP_canvas_history_save_point_make(DP_CanvasHistory *ch);
 
 bool DP_canvas_history_reconnect_restore(DP_CanvasHistory *ch,
@@ -160,8 +196,9 @@ bool DP_canvas_history_reset_image_new(
 // May return NULL if something goes wrong. Takes ownership of the output and
 // header, so no matter the return value, the caller must not free it.
 DP_Recorder *DP_canvas_history_recorder_new(
-    DP_CanvasHistory *ch, DP_RecorderType type, JSON_Value *header,
-    DP_RecorderGetTimeMsFn get_time_fn, void *get_time_user, DP_Output *output);
+    DP_CanvasHistory *ch, DP_RecorderType type, int keyframe_interval,
+    JSON_Value *header, DP_RecorderGetTimeMsFn get_time_fn, void *get_time_user,
+    DP_Output *output);
 
 
 DP_CanvasHistoryReconnectState *
@@ -175,6 +212,12 @@ bool DP_canvas_history_reconnect_state_apply(
     DP_DrawContext *dc);
 
 
+// Adds the current state and every undo save point. Must be called from the
+// thread that owns the history, i.e. the paint thread.
+void DP_canvas_history_memory_report_add(DP_CanvasHistory *ch,
+                                        DP_MemoryReport *mr);
+
+
 DP_CanvasHistorySnapshot *DP_canvas_history_snapshot_new(DP_CanvasHistory *ch);
 
 DP_CanvasHistorySnapshot *
@@ -399,6 +399,101 @@ bool DP_canvas_state_same_frame(DP_CanvasState *cs, int frame_index_a,
 }
 
 
+static bool same_layer_list_entry(DP_LayerListEntry *a, DP_LayerListEntry *b)
+{
+    if (DP_layer_list_entry_is_group(a)) {
+        return DP_layer_list_entry_is_group(b)
+            && DP_layer_list_entry_group_noinc(a)
+                   == DP_layer_list_entry_group_noinc(b);
+    }
+    else {
+        return !DP_layer_list_entry_is_group(b)
+            && DP_layer_list_entry_content_noinc(a)
+                   == DP_layer_list_entry_content_noinc(b);
+    }
+}
+
+static bool same_frame_layer(DP_CanvasState *cs, DP_CanvasState *prev,
+                             int layer_id)
+{
+    DP_LayerRoutesEntry *lre =
+        layer_id == 0 ? NULL
+                      : DP_layer_routes_search(cs->layer_routes, layer_id);
+    DP_LayerRoutesEntry *prev_lre =
+        layer_id == 0 ? NULL
+                      : DP_layer_routes_search(prev->layer_routes, layer_id);
+    if (!lre || !prev_lre) {
+        return !lre && !prev_lre;
+    }
+
+    uint16_t parent_opacity, prev_parent_opacity;
+    DP_UPixel8 parent_tint, prev_parent_tint;
+    DP_layer_routes_entry_parent_opacity_tint(lre, cs, &parent_opacity,
+                                              &parent_tint);
+    DP_layer_routes_entry_parent_opacity_tint(
+        prev_lre, prev, &prev_parent_opacity, &prev_parent_tint);
+    return parent_opacity == prev_parent_opacity
+        && parent_tint.color == prev_parent_tint.color
+        && DP_layer_routes_entry_props(lre, cs)
+               == DP_layer_routes_entry_props(prev_lre, prev)
+        && same_layer_list_entry(DP_layer_routes_entry_layer(lre, cs),
+                                 DP_layer_routes_entry_layer(prev_lre, prev));
+}
+
+static bool same_frame_track(DP_CanvasState *cs, DP_CanvasState *prev,
+                             DP_Track *t, DP_Track *prev_t, int frame_index)
+{
+    bool hidden = DP_track_hidden(t);
+    if (hidden != DP_track_hidden(prev_t)) {
+        return false;
+    }
+    else if (hidden) {
+        return true;
+    }
+
+    int i = DP_track_key_frame_search_at_or_before(t, frame_index);
+    int prev_i = DP_track_key_frame_search_at_or_before(prev_t, frame_index);
+    if (i == -1 || prev_i == -1) {
+        return i == -1 && prev_i == -1;
+    }
+
+    DP_KeyFrame *kf = DP_track_key_frame_at_noinc(t, i);
+    return kf == DP_track_key_frame_at_noinc(prev_t, prev_i)
+        && same_frame_layer(cs, prev, DP_key_frame_layer_id(kf));
+}
+
+bool DP_canvas_state_same_frame_content(DP_CanvasState *cs,
+                                        DP_CanvasState *prev, int frame_index)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(prev);
+    DP_ASSERT(DP_atomic_get(&prev->refcount) > 0);
+    if (cs == prev) {
+        return true;
+    }
+    else if (cs->width != prev->width || cs->height != prev->height
+             || cs->background_tile != prev->background_tile) {
+        return false;
+    }
+
+    DP_Timeline *tl = cs->timeline;
+    DP_Timeline *prev_tl = prev->timeline;
+    int track_count = DP_timeline_count(tl);
+    if (track_count != DP_timeline_count(prev_tl)) {
+        return false;
+    }
+
+    for (int i = 0; i < track_count; ++i) {
+        if (!same_frame_track(cs, prev, DP_timeline_at_noinc(tl, i),
+                              DP_timeline_at_noinc(prev_tl, i), frame_index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 static DP_CanvasState *handle_canvas_resize(DP_CanvasState *cs,
                                             unsigned int context_id,
                                             DP_MsgCanvasResize *mcr)
@@ -665,12 +760,14 @@ handle_put_tile(DP_CanvasState *cs, DP_DrawContext *dc, DP_MsgPutTile *mpt,
         return NULL;
     }
 
-    size_t image_size;
-    const unsigned char *image = DP_msg_put_tile_image(mpt, &image_size);
-    DP_Tile *tile =
-        decompress_fn(dc, DP_msg_put_tile_user(mpt), image, image_size);
+    DP_Tile *tile = DP_draw_context_predecoded_tile_take(dc, mpt);
     if (!tile) {
-        return NULL;
+        size_t image_size;
+        const unsigned char *image = DP_msg_put_tile_image(mpt, &image_size);
+        tile = decompress_fn(dc, DP_msg_put_tile_user(mpt), image, image_size);
+        if (!tile) {
+            return NULL;
+        }
     }
 
     DP_CanvasState *next =
@@ -687,10 +784,13 @@ static DP_CanvasState *handle_canvas_background(
     DP_Tile *(*decompress_fn)(DP_DrawContext *, unsigned int,
                               const unsigned char *, size_t))
 {
-    size_t image_size;
-    const unsigned char *image =
-        DP_msg_canvas_background_image(mcb, &image_size);
-    DP_Tile *tile = decompress_fn(dc, context_id, image, image_size);
+    DP_Tile *tile = DP_draw_context_predecoded_tile_take(dc, mcb);
+    if (!tile) {
+        size_t image_size;
+        const unsigned char *image =
+            DP_msg_canvas_background_image(mcb, &image_size);
+        tile = decompress_fn(dc, context_id, image, image_size);
+    }
     if (tile) {
         DP_TransientCanvasState *tcs = DP_transient_canvas_state_new(cs);
         DP_transient_canvas_state_background_tile_set_noinc(
@@ -1624,6 +1724,55 @@ DP_CanvasState *DP_canvas_state_handle(DP_CanvasState *cs, DP_DrawContext *dc,
     return next_cs;
 }
 
+bool DP_canvas_state_message_has_tile(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    switch (DP_message_type(msg)) {
+    case DP_MSG_PUT_TILE:
+    case DP_MSG_PUT_TILE_ZSTD:
+    case DP_MSG_CANVAS_BACKGROUND:
+    case DP_MSG_CANVAS_BACKGROUND_ZSTD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+DP_Tile *DP_canvas_state_message_tile_decode(DP_DrawContext *dc,
+                                             DP_Message *msg)
+{
+    DP_ASSERT(dc);
+    DP_ASSERT(msg);
+    size_t image_size;
+    const unsigned char *image;
+    switch (DP_message_type(msg)) {
+    case DP_MSG_PUT_TILE: {
+        DP_MsgPutTile *mpt = DP_message_internal(msg);
+        image = DP_msg_put_tile_image(mpt, &image_size);
+        return DP_tile_new_from_deflate(dc, DP_msg_put_tile_user(mpt), image,
+                                        image_size);
+    }
+    case DP_MSG_PUT_TILE_ZSTD: {
+        DP_MsgPutTile *mpt = DP_message_internal(msg);
+        image = DP_msg_put_tile_image(mpt, &image_size);
+        return DP_tile_new_from_split_delta_zstd8le(
+            dc, DP_msg_put_tile_user(mpt), image, image_size);
+    }
+    case DP_MSG_CANVAS_BACKGROUND:
+        image = DP_msg_canvas_background_image(DP_message_internal(msg),
+                                               &image_size);
+        return DP_tile_new_from_deflate(dc, DP_message_context_id(msg), image,
+                                        image_size);
+    case DP_MSG_CANVAS_BACKGROUND_ZSTD:
+        image = DP_msg_canvas_background_image(DP_message_internal(msg),
+                                               &image_size);
+        return DP_tile_new_from_split_delta_zstd8le(
+            dc, DP_message_context_id(msg), image, image_size);
+    default:
+        return NULL;
+    }
+}
+
 DP_CanvasState *DP_canvas_state_handle_multidab(DP_CanvasState *cs,
                                                 DP_DrawContext *dc,
                                                 DP_UserCursors *ucs_or_null,
@@ -1682,8 +1831,9 @@ static DP_Tile *get_flat_background_tile_or_null(DP_CanvasState *cs,
 static void init_flattening_tile(DP_TransientTile *tt, DP_Tile *background_tile)
 {
     if (background_tile) {
-        memcpy(DP_transient_tile_pixels(tt), DP_tile_pixels(background_tile),
-               DP_TILE_BYTES);
+        memcpy(DP_transient_tile_pixels(tt),
+               DP_tile_pixels_acquire(background_tile), DP_TILE_BYTES);
+        DP_tile_pixels_release(background_tile);
     }
     else {
         memset(DP_transient_tile_pixels(tt), 0, DP_TILE_BYTES);
@@ -1721,12 +1871,76 @@ DP_canvas_state_to_flat_layer(DP_CanvasState *cs, unsigned int flags,
     return tlc;
 }
 
+// Layers and isolated groups scale linearly with their opacity, so the onion
+// skin's opacity can be applied when merging instead of when flattening. That
+// way the same cached tile works no matter which onion skin the frame is in.
+static DP_TransientTile *
+flatten_onion_skin_cached(DP_OnionSkinCache *osc, int tile_index,
+                          DP_TransientTile *tt, DP_LayerListEntry *lle,
+                          DP_LayerProps *lp, uint16_t parent_opacity,
+                          bool include_sublayers, DP_ViewModeContext *vmc,
+                          const DP_OnionSkin *os)
+{
+    bool defer_opacity =
+        !DP_layer_list_entry_is_group(lle) || DP_layer_props_isolated(lp);
+    uint16_t opacity = defer_opacity
+                         ? parent_opacity
+                         : DP_fix15_mul(parent_opacity, os->opacity);
+
+    DP_Tile *t;
+    if (!DP_onion_skin_cache_search(osc, vmc, lle, lp, tile_index, opacity,
+                                    include_sublayers, &t)) {
+        DP_TransientTile *skin_tt = DP_layer_list_entry_flatten_tile_to(
+            lle, lp, tile_index, DP_transient_tile_new_blank(0), opacity,
+            (DP_UPixel8){.color = 0}, include_sublayers, false, false, vmc);
+        if (DP_tile_blank((DP_Tile *)skin_tt)) {
+            DP_transient_tile_decref(skin_tt);
+            t = NULL;
+        }
+        else {
+            t = DP_transient_tile_persist(skin_tt);
+        }
+        DP_onion_skin_cache_insert(osc, vmc, lle, lp, tile_index, opacity,
+                                   include_sublayers, t);
+    }
+
+    if (!t) {
+        return tt;
+    }
+
+    if (!tt) {
+        tt = DP_transient_tile_new_blank(0);
+    }
+
+    uint16_t merge_opacity = defer_opacity ? os->opacity : DP_BIT15;
+    DP_UPixel8 tint = os->tint;
+    if (tint.a != 0) {
+        DP_TransientTile *skin_tt = DP_transient_tile_new(t, 0);
+        DP_transient_tile_tint(skin_tt, tint);
+        DP_transient_tile_merge(tt, (DP_Tile *)skin_tt, merge_opacity,
+                                DP_BLEND_MODE_NORMAL);
+        DP_transient_tile_decref(skin_tt);
+    }
+    else {
+        DP_transient_tile_merge(tt, t, merge_opacity, DP_BLEND_MODE_NORMAL);
+    }
+    DP_tile_decref(t);
+    return tt;
+}
+
 static DP_TransientTile *
 flatten_onion_skin(int tile_index, DP_TransientTile *tt, DP_LayerListEntry *lle,
                    DP_LayerProps *lp, uint16_t parent_opacity,
                    bool include_sublayers, DP_ViewModeContext *vmc,
                    const DP_OnionSkin *os)
 {
+    DP_OnionSkinCache *osc = DP_view_mode_context_onion_skin_cache(vmc);
+    if (osc) {
+        return flatten_onion_skin_cached(osc, tile_index, tt, lle, lp,
+                                         parent_opacity, include_sublayers,
+                                         vmc, os);
+    }
+
     DP_TransientTile *skin_tt = DP_layer_list_entry_flatten_tile_to(
         lle, lp, tile_index, DP_transient_tile_new_blank(0),
         DP_fix15_mul(parent_opacity, os->opacity), (DP_UPixel8){.color = 0},
@@ -1788,23 +2002,76 @@ flatten_selection(DP_CanvasState *cs, int tile_index, DP_TransientTile *tt,
         tt = DP_transient_tile_new_blank(0);
     }
 
-    DP_blend_selection(DP_transient_tile_pixels(tt), DP_tile_pixels(t),
-                       DP_TILE_LENGTH, color);
+    DP_Pixel15 pixel;
+    if (DP_tile_same_pixel(t, &pixel)) {
+        DP_blend_selection_uniform(DP_transient_tile_pixels(tt),
+                                   DP_TILE_LENGTH, pixel, color);
+    }
+    else {
+        DP_blend_selection(DP_transient_tile_pixels(tt),
+                           DP_tile_pixels_acquire(t), DP_TILE_LENGTH, color);
+        DP_tile_pixels_release(t);
+    }
     DP_tile_decref(t);
 
     return tt;
 }
 
-DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
-                                                  int tile_index,
-                                                  DP_TransientTile *tt_or_null,
-                                                  bool include_sublayers,
-                                                  DP_UPixel15 *selection_tint,
-                                                  const DP_ViewModeFilter *vmf)
+static bool layer_occludes_tile(DP_ViewModeContextRoot *vmcr,
+                                DP_CanvasState *cs, int i, int tile_index,
+                                bool include_sublayers)
+{
+    DP_LayerListEntry *lle;
+    DP_LayerProps *lp;
+    const DP_OnionSkin *os;
+    uint16_t parent_opacity;
+    DP_UPixel8 parent_tint;
+    int clip_count;
+    DP_ViewModeContext vmc =
+        DP_view_mode_context_root_at(vmcr, cs, i, &lle, &lp, &os,
+                                     &parent_opacity, &parent_tint, &clip_count);
+    if (DP_view_mode_context_excludes_everything(&vmc) || os || clip_count != 0
+        || parent_tint.a != 0 || DP_layer_props_clip(lp)
+        || DP_layer_list_entry_is_group(lle)
+        || DP_layer_props_censored_any(lp)) {
+        return false;
+    }
+    DP_ViewModeResult vmr = DP_view_mode_context_apply(&vmc, lp, parent_opacity);
+    return vmr.visible && vmr.opacity == DP_BIT15
+        && vmr.blend_mode == DP_BLEND_MODE_NORMAL && vmr.tint.a == 0
+        && DP_layer_content_tile_opaque(
+            DP_layer_list_entry_content_noinc(lle), tile_index,
+            include_sublayers);
+}
+
+// An opaque tile on a layer that's blended normally at full opacity covers
+// up everything below it, so flattening can start from the topmost such layer
+// instead of compositing all the ones that end up hidden anyway.
+static int search_occluding_layer(DP_ViewModeContextRoot *vmcr,
+                                  DP_CanvasState *cs, int tile_index,
+                                  bool include_sublayers, int start, int end)
+{
+    for (int i = end - 1; i > start; --i) {
+        if (layer_occludes_tile(vmcr, cs, i, tile_index, include_sublayers)) {
+            return i;
+        }
+    }
+    return start;
+}
+
+static DP_TransientTile *flatten_tile_range(DP_CanvasState *cs,
+                                            int tile_index,
+                                            DP_TransientTile *tt_or_null,
+                                            bool include_sublayers,
+                                            const DP_ViewModeFilter *vmf,
+                                            int start, int end_or_negative)
 {
     DP_ViewModeContextRoot vmcr = DP_view_mode_context_root_init(vmf, cs);
     DP_TransientTile *tt = tt_or_null;
-    for (int i = 0; i < vmcr.count; ++i) {
+    int end = end_or_negative < 0 ? vmcr.count : end_or_negative;
+    int first = search_occluding_layer(&vmcr, cs, tile_index, include_sublayers,
+                                       start, end);
+    for (int i = first; i < end; ++i) {
         DP_LayerListEntry *lle;
         DP_LayerProps *lp;
         const DP_OnionSkin *os;
@@ -1832,6 +2099,14 @@ DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
             }
         }
     }
+    return tt;
+}
+
+static DP_TransientTile *flatten_selections(DP_CanvasState *cs, int tile_index,
+                                            DP_TransientTile *tt,
+                                            bool include_sublayers,
+                                            DP_UPixel15 *selection_tint)
+{
     if (selection_tint) {
         tt = flatten_selection(cs, tile_index, tt, include_sublayers,
                                *selection_tint, cs->active_context_id,
@@ -1846,6 +2121,97 @@ DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
     return tt;
 }
 
+DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
+                                                  int tile_index,
+                                                  DP_TransientTile *tt_or_null,
+                                                  bool include_sublayers,
+                                                  DP_UPixel15 *selection_tint,
+                                                  const DP_ViewModeFilter *vmf)
+{
+    DP_TransientTile *tt = flatten_tile_range(cs, tile_index, tt_or_null,
+                                              include_sublayers, vmf, 0, -1);
+    return flatten_selections(cs, tile_index, tt, include_sublayers,
+                              selection_tint);
+}
+
+DP_TransientTile *
+DP_canvas_state_flatten_tile_range_to(DP_CanvasState *cs, int tile_index,
+                                      DP_TransientTile *tt_or_null,
+                                      bool include_sublayers, int start,
+                                      int end)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(start <= end);
+    DP_ASSERT(end <= DP_layer_list_count(cs->layers));
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_default();
+    return flatten_tile_range(cs, tile_index, tt_or_null, include_sublayers,
+                              &vmf, start, end);
+}
+
+DP_TransientTile *
+DP_canvas_state_flatten_selection_tile_to(DP_CanvasState *cs, int tile_index,
+                                          DP_TransientTile *tt_or_null,
+                                          bool include_sublayers,
+                                          DP_UPixel15 *selection_tint)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    return flatten_selections(cs, tile_index, tt_or_null, include_sublayers,
+                              selection_tint);
+}
+
+static bool is_mergeable_above(DP_LayerProps *lp)
+{
+    if (DP_layer_props_hidden(lp)) {
+        return true;
+    }
+    else {
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        return DP_layer_props_blend_mode(lp) == DP_BLEND_MODE_NORMAL
+            && (!child_lpl || DP_layer_props_isolated(lp));
+    }
+}
+
+int DP_canvas_state_flatten_split_index(DP_CanvasState *cs, int layer_id,
+                                        bool *out_above_mergeable)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(out_above_mergeable);
+    DP_LayerRoutesEntry *lre =
+        DP_layer_routes_search(DP_canvas_state_layer_routes_noinc(cs),
+                               layer_id);
+    if (!lre) {
+        return -1;
+    }
+
+    // Clipping groups can't be split apart, so the top-level entry containing
+    // the layer must neither clip onto something below nor get clipped onto.
+    int index = DP_layer_routes_entry_index_at(lre, 0);
+    DP_LayerPropsList *lpl = cs->layer_props;
+    int count = DP_layer_props_list_count(lpl);
+    bool clipped =
+        (index != 0
+         && DP_layer_props_clip(DP_layer_props_list_at_noinc(lpl, index)))
+        || (index + 1 < count
+            && DP_layer_props_clip(DP_layer_props_list_at_noinc(lpl, index + 1)));
+    if (clipped) {
+        return -1;
+    }
+
+    // Everything above can only be flattened separately and merged on top if
+    // it's all plain Normal blending, otherwise the result would be different.
+    bool above_mergeable = true;
+    for (int i = index + 1; above_mergeable && i < count; ++i) {
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        above_mergeable = is_mergeable_above(lp);
+    }
+    *out_above_mergeable = above_mergeable;
+    return index;
+}
+
 static void *flatten_canvas(
     DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
     const DP_ViewModeFilter *vmf_or_null, void *(*get_buffer)(void *, int, int),
@@ -2031,6 +2397,305 @@ DP_Pixel15 DP_canvas_state_to_flat_pixel(DP_CanvasState *cs, int x, int y)
     return pixel;
 }
 
+static DP_LayerContent *search_active_selection_content(DP_CanvasState *cs)
+{
+    DP_SelectionSet *ss = cs->selections;
+    if (ss && cs->active_selection_id > 0) {
+        DP_Selection *sel = DP_selection_set_search_noinc(
+            ss, cs->active_context_id, cs->active_selection_id);
+        if (sel) {
+            return DP_selection_content_noinc(sel);
+        }
+    }
+    return NULL;
+}
+
+// Samples are taken from the middle of each block, clamped to the canvas for
+// tiles at the right and bottom edges. They're packed at the start of the
+// destination tile's pixels and only spread out into blocks at the end.
+typedef struct DP_FlattenSamples {
+    int step;
+    int count_x, count_y;
+    int left, top;
+    int last_x, last_y;
+    DP_Pixel15 *pixels;
+} DP_FlattenSamples;
+
+static int sample_x(const DP_FlattenSamples *fs, int sx)
+{
+    return DP_min_int(sx * fs->step + fs->step / 2, fs->last_x);
+}
+
+static int sample_y(const DP_FlattenSamples *fs, int sy)
+{
+    return DP_min_int(sy * fs->step + fs->step / 2, fs->last_y);
+}
+
+static int sample_count(const DP_FlattenSamples *fs)
+{
+    return fs->count_x * fs->count_y;
+}
+
+static void gather_samples(const DP_FlattenSamples *fs, DP_Tile *t,
+                           DP_Pixel15 *dst)
+{
+    const DP_Pixel15 *tile_pixels = DP_tile_pixels_acquire(t);
+    int i = 0;
+    for (int sy = 0; sy < fs->count_y; ++sy) {
+        const DP_Pixel15 *row = tile_pixels + sample_y(fs, sy) * DP_TILE_SIZE;
+        for (int sx = 0; sx < fs->count_x; ++sx) {
+            dst[i++] = row[sample_x(fs, sx)];
+        }
+    }
+    DP_tile_pixels_release(t);
+}
+
+static void blend_samples(const DP_FlattenSamples *fs, DP_Tile *t,
+                          uint16_t opacity, int blend_mode, DP_UPixel8 tint)
+{
+    DP_Pixel15 src[DP_TILE_LENGTH / 4];
+    gather_samples(fs, t, src);
+    int count = sample_count(fs);
+    if (tint.a != 0) {
+        DP_tint_pixels(src, count, tint);
+    }
+    DP_blend_pixels(fs->pixels, src, count, opacity, blend_mode);
+}
+
+static void flatten_samples_layer(const DP_FlattenSamples *fs,
+                                  DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                  int tile_index, uint16_t parent_opacity,
+                                  DP_UPixel8 parent_tint,
+                                  const DP_ViewModeContext *vmc)
+{
+    DP_ViewModeResult vmr = DP_view_mode_context_apply(vmc, lp, parent_opacity);
+    if (vmr.visible) {
+        DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+        DP_Tile *t = DP_layer_content_tile_at_index_noinc(lc, tile_index);
+        if (t) {
+            if (DP_layer_props_censored_any(lp)) {
+                blend_samples(fs, DP_tile_censored_noinc(), vmr.opacity,
+                              vmr.blend_mode, (DP_UPixel8){.color = 0});
+            }
+            else {
+                blend_samples(fs, t, vmr.opacity, vmr.blend_mode,
+                              vmr.tint.a == 0 ? parent_tint : vmr.tint);
+            }
+        }
+    }
+}
+
+// Groups and clipping layers are rare enough not to bother with batching.
+static void flatten_samples_slow(const DP_FlattenSamples *fs, void *user,
+                                 DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                 int index, int clip_count,
+                                 uint16_t parent_opacity,
+                                 DP_UPixel8 parent_tint,
+                                 const DP_ViewModeContext *vmc)
+{
+    int i = 0;
+    for (int sy = 0; sy < fs->count_y; ++sy) {
+        int y = fs->top + sample_y(fs, sy);
+        for (int sx = 0; sx < fs->count_x; ++sx) {
+            int x = fs->left + sample_x(fs, sx);
+            DP_Pixel15 *pixel = &fs->pixels[i++];
+            if (clip_count == 0) {
+                DP_layer_list_entry_flatten_pixel(lle, lp, x, y, pixel,
+                                                  parent_opacity, parent_tint,
+                                                  false, vmc);
+            }
+            else {
+                DP_layer_list_flatten_clipping_pixel(
+                    user, get_clip_layer, index, clip_count, x, y, pixel,
+                    parent_opacity, vmc);
+            }
+        }
+    }
+}
+
+static void spread_samples(const DP_FlattenSamples *fs)
+{
+    // Going backwards, since every block starts at or after the index of the
+    // sample that it's spread from, so no sample gets overwritten too early.
+    int step = fs->step;
+    DP_Pixel15 *pixels = fs->pixels;
+    for (int i = sample_count(fs) - 1; i >= 0; --i) {
+        int x = i % fs->count_x * step;
+        int y = i / fs->count_x * step;
+        DP_Pixel15 pixel = pixels[i];
+        for (int by = 0; by < step; ++by) {
+            DP_Pixel15 *row = pixels + (y + by) * DP_TILE_SIZE + x;
+            for (int bx = 0; bx < step; ++bx) {
+                row[bx] = pixel;
+            }
+        }
+    }
+}
+
+void DP_canvas_state_flatten_tile_sampled_to(DP_CanvasState *cs,
+                                             int tile_index,
+                                             DP_TransientTile *tt, int step,
+                                             DP_UPixel15 *selection_tint)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(tt);
+    DP_ASSERT(step >= 2);
+    DP_ASSERT(step <= DP_TILE_SIZE);
+    DP_ASSERT(DP_TILE_SIZE % step == 0);
+    int xtiles = DP_tile_count_round(cs->width);
+    int left = tile_index % xtiles * DP_TILE_SIZE;
+    int top = tile_index / xtiles * DP_TILE_SIZE;
+    DP_FlattenSamples fs = {
+        step,
+        DP_TILE_SIZE / step,
+        DP_TILE_SIZE / step,
+        left,
+        top,
+        DP_min_int(DP_TILE_SIZE, cs->width - left) - 1,
+        DP_min_int(DP_TILE_SIZE, cs->height - top) - 1,
+        DP_transient_tile_pixels(tt),
+    };
+
+    DP_Tile *background_tile = cs->background_tile;
+    if (background_tile) {
+        gather_samples(&fs, background_tile, fs.pixels);
+    }
+    else {
+        memset(fs.pixels, 0, sizeof(*fs.pixels) * (size_t)sample_count(&fs));
+    }
+
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_default();
+    DP_ViewModeContextRoot vmcr = DP_view_mode_context_root_init(&vmf, cs);
+    for (int i = 0; i < vmcr.count; ++i) {
+        DP_LayerListEntry *lle;
+        DP_LayerProps *lp;
+        const DP_OnionSkin *os;
+        uint16_t parent_opacity;
+        DP_UPixel8 parent_tint;
+        int clip_count;
+        DP_ViewModeContext vmc = DP_view_mode_context_root_at(
+            &vmcr, cs, i, &lle, &lp, &os, &parent_opacity, &parent_tint,
+            &clip_count);
+        if (!DP_view_mode_context_excludes_everything(&vmc)) {
+            DP_ASSERT(!os);
+            if (clip_count == 0 && !DP_layer_list_entry_is_group(lle)) {
+                flatten_samples_layer(&fs, lle, lp, tile_index, parent_opacity,
+                                      parent_tint, &vmc);
+            }
+            else {
+                flatten_samples_slow(&fs, (void *[]){&vmcr, cs}, lle, lp, i,
+                                     clip_count, parent_opacity, parent_tint,
+                                     &vmc);
+                i += clip_count;
+            }
+        }
+    }
+
+    if (selection_tint) {
+        DP_LayerContent *sel_lc = search_active_selection_content(cs);
+        DP_Tile *t =
+            sel_lc ? DP_layer_content_tile_at_index_noinc(sel_lc, tile_index)
+                   : NULL;
+        DP_Pixel15 pixel;
+        if (!t) {
+            // Nothing selected in this tile.
+        }
+        else if (DP_tile_same_pixel(t, &pixel)) {
+            DP_blend_selection_uniform(fs.pixels, sample_count(&fs), pixel,
+                                       *selection_tint);
+        }
+        else {
+            DP_Pixel15 src[DP_TILE_LENGTH / 4];
+            gather_samples(&fs, t, src);
+            DP_blend_selection(fs.pixels, src, sample_count(&fs),
+                               *selection_tint);
+        }
+    }
+
+    spread_samples(&fs);
+}
+
+// Averages each factor by factor block of the tile into one pixel of the
+// image, leaving out the parts of blocks that hang off the edge of the canvas.
+static void reduce_tile_into(DP_Image *img, DP_TransientTile *tt, int tx,
+                             int ty, int factor, int width, int height)
+{
+    const DP_Pixel15 *pixels = DP_transient_tile_pixels(tt);
+    int blocks = DP_TILE_SIZE / factor;
+    int left = tx * DP_TILE_SIZE;
+    int top = ty * DP_TILE_SIZE;
+    for (int by = 0; by < blocks && top + by * factor < height; ++by) {
+        int block_height = DP_min_int(factor, height - top - by * factor);
+        for (int bx = 0; bx < blocks && left + bx * factor < width; ++bx) {
+            int block_width = DP_min_int(factor, width - left - bx * factor);
+            uint32_t b = 0, g = 0, r = 0, a = 0;
+            for (int y = 0; y < block_height; ++y) {
+                const DP_Pixel15 *row =
+                    pixels + (by * factor + y) * DP_TILE_SIZE + bx * factor;
+                for (int x = 0; x < block_width; ++x) {
+                    b += row[x].b;
+                    g += row[x].g;
+                    r += row[x].r;
+                    a += row[x].a;
+                }
+            }
+            uint32_t n = DP_int_to_uint32(block_width * block_height);
+            DP_Pixel15 pixel = {
+                .b = DP_uint32_to_uint16((b + n / 2u) / n),
+                .g = DP_uint32_to_uint16((g + n / 2u) / n),
+                .r = DP_uint32_to_uint16((r + n / 2u) / n),
+                .a = DP_uint32_to_uint16((a + n / 2u) / n),
+            };
+            DP_image_pixel_at_set(img, tx * blocks + bx, ty * blocks + by,
+                                  DP_pixel15_to_8(pixel));
+        }
+    }
+}
+
+DP_Image *DP_canvas_state_to_reduced_flat_image(DP_CanvasState *cs,
+                                                int reduction)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_ASSERT(reduction >= 1);
+    DP_ASSERT(reduction <= DP_CANVAS_STATE_REDUCTION_MAX);
+    int width = cs->width;
+    int height = cs->height;
+    if (width <= 0 || height <= 0) {
+        DP_error_set("Can't create a flat image with zero pixels");
+        return NULL;
+    }
+
+    int factor = 1 << reduction;
+    int reduced_width = (width + factor - 1) / factor;
+    int reduced_height = (height + factor - 1) / factor;
+    DP_Image *img = DP_image_new(reduced_width, reduced_height);
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_default();
+    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
+    int xtiles = DP_tile_count_round(width);
+    int ytiles = DP_tile_count_round(height);
+    for (int ty = 0; ty < ytiles; ++ty) {
+        for (int tx = 0; tx < xtiles; ++tx) {
+            int i = ty * xtiles + tx;
+            if (reduction == 1) {
+                init_flattening_tile(tt, cs->background_tile);
+                DP_canvas_state_flatten_tile_to(cs, i, tt, false, NULL, &vmf);
+            }
+            else {
+                // Two samples along each axis of every block, so each pixel of
+                // the result averages four of them instead of picking one.
+                DP_canvas_state_flatten_tile_sampled_to(cs, i, tt, factor / 2,
+                                                        NULL);
+            }
+            reduce_tile_into(img, tt, tx, ty, factor, width, height);
+        }
+    }
+    DP_transient_tile_decref(tt);
+    return img;
+}
+
+
 static void *to_flat_separated_urgba8_get_buffer(void *user,
                                                  DP_UNUSED int width,
                                                  DP_UNUSED int height)
@@ -2144,6 +2809,33 @@ void DP_canvas_state_diff(DP_CanvasState *cs, DP_CanvasState *prev_or_null,
     DP_PERF_END(fn);
 }
 
+size_t DP_canvas_state_unshared_tile_count(DP_CanvasState *cs,
+                                           DP_CanvasState *other_or_null)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    if (cs == other_or_null) {
+        return 0;
+    }
+    else if (other_or_null) {
+        DP_ASSERT(DP_atomic_get(&other_or_null->refcount) > 0);
+        size_t background_count =
+            cs->background_tile
+                    && cs->background_tile != other_or_null->background_tile
+                ? 1
+                : 0;
+        return background_count
+             + DP_layer_list_unshared_tile_count(cs->layers, cs->layer_props,
+                                                 other_or_null->layers,
+                                                 other_or_null->layer_props);
+    }
+    else {
+        return (cs->background_tile ? 1 : 0)
+             + DP_layer_list_unshared_tile_count(cs->layers, cs->layer_props,
+                                                 NULL, NULL);
+    }
+}
+
 static void render_tile(void *data, int tile_index)
 {
     DP_CanvasState *cs = ((void **)data)[0];
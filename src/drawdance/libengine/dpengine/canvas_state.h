@@ -138,6 +138,12 @@ int DP_canvas_state_framerate(DP_CanvasState *cs);
 bool DP_canvas_state_same_frame(DP_CanvasState *cs, int frame_index_a,
                                 int frame_index_b);
 
+// Whether rendering the given frame of both canvas states gives the same
+// result. Only compares the identities of what's visible in the frame, so it
+// may report a difference when there is none, but never the other way round.
+bool DP_canvas_state_same_frame_content(DP_CanvasState *cs,
+                                        DP_CanvasState *prev, int frame_index);
+
 DP_CanvasState *DP_canvas_state_handle(DP_CanvasState *cs, DP_DrawContext *dc,
                                        DP_UserCursors *ucs_or_null,
                                        DP_Message *msg);
@@ -147,6 +153,15 @@ DP_CanvasState *DP_canvas_state_handle_multidab(DP_CanvasState *cs,
                                                 DP_UserCursors *ucs_or_null,
                                                 int count, DP_Message **msgs);
 
+// Whether the message is a put tile or canvas background one, whose tile can
+// be decompressed up front with the function below. That can happen on any
+// thread, the result is passed along as the draw context's predecoded tile.
+// Returns NULL on failure, the handler will then report the error.
+bool DP_canvas_state_message_has_tile(DP_Message *msg);
+
+DP_Tile *DP_canvas_state_message_tile_decode(DP_DrawContext *dc,
+                                             DP_Message *msg);
+
 int DP_canvas_state_search_change_bounds(DP_CanvasState *cs,
                                          unsigned int context_id, int *out_x,
                                          int *out_y, int *out_width,
@@ -168,6 +183,32 @@ DP_Image *DP_canvas_state_into_flat_image(DP_CanvasState *cs,
 
 DP_Pixel15 DP_canvas_state_to_flat_pixel(DP_CanvasState *cs, int x, int y);
 
+// Renders a reduced-detail version of the flattened tile by only flattening one
+// pixel out of every step by step block and filling the whole block with it.
+// Always uses the normal view mode and doesn't include sublayers, so this is
+// only good as a stand-in for when the canvas is zoomed out far enough.
+void DP_canvas_state_flatten_tile_sampled_to(DP_CanvasState *cs,
+                                             int tile_index,
+                                             DP_TransientTile *tt, int step,
+                                             DP_UPixel15 *selection_tint);
+
+// Largest reduction that DP_canvas_state_to_reduced_flat_image supports, which
+// reduces each tile down to a single pixel.
+#define DP_CANVAS_STATE_REDUCTION_MAX 6
+
+// Flattens the canvas straight into an image that's 2^reduction times smaller
+// along each axis, rounded up, without ever making a full-size one. Meant for
+// thumbnails, where the result gets scaled down the rest of the way after. A
+// reduction of 1 flattens every pixel and averages them in 2x2 blocks, so that
+// is exact. Higher ones flatten only a 2x2 grid of samples from each block via
+// DP_canvas_state_flatten_tile_sampled_to and average those, which saves about
+// 4^(reduction - 1) times the compositing work, but details thinner than the
+// spacing between samples, like line art or hatching, can alias or drop out.
+// Always uses the normal view mode, includes the background and doesn't
+// include sublayers.
+DP_Image *DP_canvas_state_to_reduced_flat_image(DP_CanvasState *cs,
+                                                int reduction);
+
 bool DP_canvas_state_to_flat_separated_urgba8(
     DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
     const DP_ViewModeFilter *vmf_or_null, unsigned char *buffer);
@@ -179,6 +220,29 @@ DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
                                                   DP_UPixel15 *selection_tint,
                                                   const DP_ViewModeFilter *vmf);
 
+// Flattens only the top-level entries from start up to, but not including, end
+// in the normal view mode. Doesn't draw any selection.
+DP_TransientTile *
+DP_canvas_state_flatten_tile_range_to(DP_CanvasState *cs, int tile_index,
+                                      DP_TransientTile *tt_or_null,
+                                      bool include_sublayers, int start,
+                                      int end);
+
+// Draws just the active selection, the finishing step after flattening ranges.
+DP_TransientTile *
+DP_canvas_state_flatten_selection_tile_to(DP_CanvasState *cs, int tile_index,
+                                          DP_TransientTile *tt_or_null,
+                                          bool include_sublayers,
+                                          DP_UPixel15 *selection_tint);
+
+// Finds the top-level index at which the canvas can be split into a range below
+// and above the given layer, for flattening those parts separately. Returns -1
+// if the layer doesn't exist or it's part of a clipping group. Whether the part
+// above can be flattened on its own and then merged on top with Normal blending
+// is written to out_above_mergeable, otherwise only the part below can be.
+int DP_canvas_state_flatten_split_index(DP_CanvasState *cs, int layer_id,
+                                        bool *out_above_mergeable);
+
 DP_TransientTile *
 DP_canvas_state_flatten_tile(DP_CanvasState *cs, int tile_index,
                              unsigned int flags,
@@ -192,6 +256,11 @@ DP_canvas_state_flatten_tile_at(DP_CanvasState *cs, int x, int y,
 void DP_canvas_state_diff(DP_CanvasState *cs, DP_CanvasState *prev_or_null,
                           DP_CanvasDiff *diff, int only_layer_id);
 
+// Number of tiles in the layers and background of the canvas state that the
+// other one doesn't share. Used to estimate the memory cost of keeping it.
+size_t DP_canvas_state_unshared_tile_count(DP_CanvasState *cs,
+                                           DP_CanvasState *other_or_null);
+
 DP_TransientLayerContent *DP_canvas_state_render(DP_CanvasState *cs,
                                                  DP_TransientLayerContent *lc,
                                                  DP_CanvasDiff *diff);
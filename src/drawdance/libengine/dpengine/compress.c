@@ -23,6 +23,7 @@
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <zdict.h>
 #include <zlib.h>
 #include <zstd.h>
 
@@ -167,6 +168,15 @@ bool DP_decompress_zstd(ZSTD_DCtx **in_out_ctx_or_null, const unsigned char *in,
                         size_t in_size,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user)
+{
+    return DP_decompress_zstd_with_dictionary(in_out_ctx_or_null, NULL, in,
+                                              in_size, get_output_buffer, user);
+}
+
+bool DP_decompress_zstd_with_dictionary(
+    ZSTD_DCtx **in_out_ctx_or_null, const ZSTD_DDict *ddict_or_null,
+    const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user)
 {
     if (in_size < 4) {
         DP_error_set("Zstd decompress input too short to fit header");
@@ -179,6 +189,13 @@ bool DP_decompress_zstd(ZSTD_DCtx **in_out_ctx_or_null, const unsigned char *in,
         return false; // The function should have already set the error message.
     }
 
+    // Decompressing with a dictionary always needs a context, so make a
+    // temporary one if the caller didn't give us a place to keep it.
+    ZSTD_DCtx *tmp_ctx = NULL;
+    if (!in_out_ctx_or_null && ddict_or_null) {
+        in_out_ctx_or_null = &tmp_ctx;
+    }
+
     size_t result;
     if (in_out_ctx_or_null) {
         ZSTD_DCtx *ctx = *in_out_ctx_or_null;
@@ -192,11 +209,19 @@ bool DP_decompress_zstd(ZSTD_DCtx **in_out_ctx_or_null, const unsigned char *in,
                 return false;
             }
         }
-        result = ZSTD_decompressDCtx(ctx, out, out_size, in + 4, in_size - 4);
+        if (ddict_or_null) {
+            result = ZSTD_decompress_usingDDict(ctx, out, out_size, in + 4,
+                                                in_size - 4, ddict_or_null);
+        }
+        else {
+            result =
+                ZSTD_decompressDCtx(ctx, out, out_size, in + 4, in_size - 4);
+        }
     }
     else {
         result = ZSTD_decompress(out, out_size, in + 4, in_size - 4);
     }
+    DP_decompress_zstd_free(&tmp_ctx);
 
     if (ZSTD_isError(result)) {
         DP_error_set("Zstd decompress error %zu: %s", result,
@@ -225,6 +250,15 @@ size_t DP_compress_zstd(ZSTD_CCtx **in_out_ctx_or_null, const unsigned char *in,
                         size_t in_size,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user)
+{
+    return DP_compress_zstd_with_dictionary(in_out_ctx_or_null, NULL, in,
+                                            in_size, get_output_buffer, user);
+}
+
+size_t DP_compress_zstd_with_dictionary(
+    ZSTD_CCtx **in_out_ctx_or_null, const ZSTD_CDict *cdict_or_null,
+    const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user)
 {
     if (in_size > UINT32_MAX) {
         DP_error_set("Zstd compress input size %zu out of bounds", in_size);
@@ -246,6 +280,12 @@ size_t DP_compress_zstd(ZSTD_CCtx **in_out_ctx_or_null, const unsigned char *in,
 
     DP_write_littleendian_uint32(DP_size_to_uint32(in_size), out);
 
+    // Same deal as with decompression, dictionaries need a context.
+    ZSTD_CCtx *tmp_ctx = NULL;
+    if (!in_out_ctx_or_null && cdict_or_null) {
+        in_out_ctx_or_null = &tmp_ctx;
+    }
+
     size_t result;
     if (in_out_ctx_or_null) {
         ZSTD_CCtx *cctx = *in_out_ctx_or_null;
@@ -259,11 +299,18 @@ size_t DP_compress_zstd(ZSTD_CCtx **in_out_ctx_or_null, const unsigned char *in,
                 return 0;
             }
         }
-        result = ZSTD_compressCCtx(cctx, out + 4, bound, in, in_size, 0);
+        if (cdict_or_null) {
+            result = ZSTD_compress_usingCDict(cctx, out + 4, bound, in,
+                                              in_size, cdict_or_null);
+        }
+        else {
+            result = ZSTD_compressCCtx(cctx, out + 4, bound, in, in_size, 0);
+        }
     }
     else {
         result = ZSTD_compress(out + 4, bound, in, in_size, 0);
     }
+    DP_compress_zstd_free(&tmp_ctx);
 
     if (ZSTD_isError(result)) {
         DP_error_set("Zstd compress error %zu: %s", result,
@@ -286,3 +333,54 @@ void DP_compress_zstd_free(ZSTD_CCtx **in_out_ctx_or_null)
         *in_out_ctx_or_null = NULL;
     }
 }
+
+
+size_t DP_compress_zstd_train_dictionary(unsigned char *buffer,
+                                         size_t capacity,
+                                         const unsigned char *samples,
+                                         const size_t *sample_sizes,
+                                         unsigned int sample_count)
+{
+    size_t result = ZDICT_trainFromBuffer(buffer, capacity, samples,
+                                          sample_sizes, sample_count);
+    if (ZDICT_isError(result)) {
+        DP_error_set("Zstd dictionary training error %zu: %s", result,
+                     ZDICT_getErrorName(result));
+        return 0;
+    }
+    return result;
+}
+
+ZSTD_CDict *DP_compress_zstd_dictionary_new(const unsigned char *dict,
+                                            size_t dict_size)
+{
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict, dict_size, 0);
+    if (!cdict) {
+        DP_error_set("Zstd create compression dictionary failed");
+    }
+    return cdict;
+}
+
+void DP_compress_zstd_dictionary_free(ZSTD_CDict *cdict_or_null)
+{
+    if (cdict_or_null) {
+        ZSTD_freeCDict(cdict_or_null);
+    }
+}
+
+ZSTD_DDict *DP_decompress_zstd_dictionary_new(const unsigned char *dict,
+                                              size_t dict_size)
+{
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict, dict_size);
+    if (!ddict) {
+        DP_error_set("Zstd create decompression dictionary failed");
+    }
+    return ddict;
+}
+
+void DP_decompress_zstd_dictionary_free(ZSTD_DDict *ddict_or_null)
+{
+    if (ddict_or_null) {
+        ZSTD_freeDDict(ddict_or_null);
+    }
+}
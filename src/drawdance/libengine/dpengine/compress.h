@@ -25,6 +25,8 @@
 
 typedef struct ZSTD_CCtx_s ZSTD_CCtx;
 typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
 
 
 bool DP_decompress_deflate(const unsigned char *in, size_t in_size,
@@ -43,6 +45,13 @@ bool DP_decompress_zstd(ZSTD_DCtx **in_out_ctx_or_null, const unsigned char *in,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user);
 
+// Data compressed with a dictionary can only be decompressed with that same
+// dictionary, it's not compatible with the above functions.
+bool DP_decompress_zstd_with_dictionary(
+    ZSTD_DCtx **in_out_ctx_or_null, const ZSTD_DDict *ddict_or_null,
+    const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user);
+
 void DP_decompress_zstd_free(ZSTD_DCtx **in_out_ctx_or_null);
 
 
@@ -51,9 +60,35 @@ size_t DP_compress_zstd(ZSTD_CCtx **in_out_ctx_or_null, const unsigned char *in,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user);
 
+size_t DP_compress_zstd_with_dictionary(
+    ZSTD_CCtx **in_out_ctx_or_null, const ZSTD_CDict *cdict_or_null,
+    const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user);
+
 size_t DP_compress_zstd_bounds(size_t in_size);
 
 void DP_compress_zstd_free(ZSTD_CCtx **in_out_ctx_or_null);
 
 
+// Trains a dictionary of at most the given capacity from the samples, which
+// are given back-to-back in one buffer. Returns the size of the dictionary or
+// 0 on error, which includes there not being enough samples to go on.
+size_t DP_compress_zstd_train_dictionary(unsigned char *buffer,
+                                         size_t capacity,
+                                         const unsigned char *samples,
+                                         const size_t *sample_sizes,
+                                         unsigned int sample_count);
+
+// Digested dictionaries, they copy the given data, so it can be freed after.
+ZSTD_CDict *DP_compress_zstd_dictionary_new(const unsigned char *dict,
+                                            size_t dict_size);
+
+void DP_compress_zstd_dictionary_free(ZSTD_CDict *cdict_or_null);
+
+ZSTD_DDict *DP_decompress_zstd_dictionary_new(const unsigned char *dict,
+                                              size_t dict_size);
+
+void DP_decompress_zstd_dictionary_free(ZSTD_DDict *ddict_or_null);
+
+
 #endif
@@ -28,6 +28,7 @@
  */
 #include "draw_context.h"
 #include "compress.h"
+#include "paint.h"
 #include "pixels.h"
 #include "tile.h"
 #include <dpcommon/common.h>
@@ -36,6 +37,14 @@
 #    include <libswscale/swscale.h>
 #endif
 
+#define STAMP_CACHE_COUNT 4
+
+typedef struct DP_DrawContextStampCacheEntry {
+    uint64_t key;
+    unsigned long long last_used;
+    size_t capacity;
+    DP_BrushStamp stamp;
+} DP_DrawContextStampCacheEntry;
 
 struct DP_DrawContext {
     // Transformations, decompression and layer id generation are used by
@@ -60,6 +69,15 @@ struct DP_DrawContext {
     size_t pool_size;
     void *pool;
     ZSTD_DCtx *zstd_dctx;
+    DP_DrawDabsWorker *draw_dabs_worker;
+    struct {
+        const void *key;
+        DP_Tile *tile;
+    } predecoded;
+    struct {
+        unsigned long long uses;
+        DP_DrawContextStampCacheEntry entries[STAMP_CACHE_COUNT];
+    } stamp_cache;
 #ifdef DP_LIBSWSCALE
     struct SwsContext *sws_context;
 #endif
@@ -72,6 +90,14 @@ DP_DrawContext *DP_draw_context_new(void)
     dc->pool_size = 0;
     dc->pool = NULL;
     dc->zstd_dctx = NULL;
+    dc->draw_dabs_worker = NULL;
+    dc->predecoded.key = NULL;
+    dc->predecoded.tile = NULL;
+    dc->stamp_cache.uses = 0;
+    for (int i = 0; i < STAMP_CACHE_COUNT; ++i) {
+        dc->stamp_cache.entries[i] = (DP_DrawContextStampCacheEntry){
+            0, 0, 0, (DP_BrushStamp){0, 0, 0, NULL}};
+    }
 #ifdef DP_LIBSWSCALE
     dc->sws_context = NULL;
 #endif
@@ -84,6 +110,10 @@ void DP_draw_context_free(DP_DrawContext *dc)
 #ifdef DP_LIBSWSCALE
         sws_freeContext(dc->sws_context);
 #endif
+        DP_tile_decref_nullable(dc->predecoded.tile);
+        for (int i = 0; i < STAMP_CACHE_COUNT; ++i) {
+            DP_free_simd(dc->stamp_cache.entries[i].stamp.data);
+        }
         DP_decompress_zstd_free(&dc->zstd_dctx);
         DP_free_simd(dc->pool);
         DP_free(dc);
@@ -94,7 +124,106 @@ void DP_draw_context_free(DP_DrawContext *dc)
 DP_DrawContextStatistics DP_draw_context_statistics(DP_DrawContext *dc)
 {
     DP_ASSERT(dc);
-    return (DP_DrawContextStatistics){sizeof(*dc), dc->pool_size};
+    size_t pool_bytes = dc->pool_size;
+    for (int i = 0; i < STAMP_CACHE_COUNT; ++i) {
+        pool_bytes += dc->stamp_cache.entries[i].capacity * sizeof(uint16_t);
+    }
+    return (DP_DrawContextStatistics){sizeof(*dc), pool_bytes};
+}
+
+size_t DP_draw_context_pools_release(DP_DrawContext *dc)
+{
+    DP_ASSERT(dc);
+    size_t released = dc->pool_size;
+    DP_free_simd(dc->pool);
+    dc->pool = NULL;
+    dc->pool_size = 0;
+    for (int i = 0; i < STAMP_CACHE_COUNT; ++i) {
+        DP_DrawContextStampCacheEntry *entry = &dc->stamp_cache.entries[i];
+        released += entry->capacity * sizeof(uint16_t);
+        DP_free_simd(entry->stamp.data);
+        *entry = (DP_DrawContextStampCacheEntry){
+            0, 0, 0, (DP_BrushStamp){0, 0, 0, NULL}};
+    }
+    return released;
+}
+
+
+DP_DrawDabsWorker *
+DP_draw_context_draw_dabs_worker_nullable(DP_DrawContext *dc)
+{
+    DP_ASSERT(dc);
+    return dc->draw_dabs_worker;
+}
+
+void DP_draw_context_draw_dabs_worker_set(DP_DrawContext *dc,
+                                          DP_DrawDabsWorker *ddw_or_null)
+{
+    DP_ASSERT(dc);
+    dc->draw_dabs_worker = ddw_or_null;
+}
+
+
+void DP_draw_context_predecoded_tile_set_noinc(DP_DrawContext *dc,
+                                               const void *key,
+                                               DP_Tile *t_or_null)
+{
+    DP_ASSERT(dc);
+    DP_tile_decref_nullable(dc->predecoded.tile);
+    dc->predecoded.key = key;
+    dc->predecoded.tile = t_or_null;
+}
+
+DP_Tile *DP_draw_context_predecoded_tile_take(DP_DrawContext *dc,
+                                              const void *key)
+{
+    DP_ASSERT(dc);
+    DP_ASSERT(key);
+    DP_Tile *t = dc->predecoded.tile;
+    if (t && dc->predecoded.key == key) {
+        dc->predecoded.key = NULL;
+        dc->predecoded.tile = NULL;
+        return t;
+    }
+    else {
+        return NULL;
+    }
+}
+
+
+DP_BrushStamp *DP_draw_context_stamp_cache_search(DP_DrawContext *dc,
+                                                  uint64_t key,
+                                                  size_t capacity,
+                                                  bool *out_found)
+{
+    DP_ASSERT(dc);
+    DP_ASSERT(capacity > 0);
+    DP_ASSERT(out_found);
+    unsigned long long uses = ++dc->stamp_cache.uses;
+    DP_DrawContextStampCacheEntry *entries = dc->stamp_cache.entries;
+    DP_DrawContextStampCacheEntry *oldest = &entries[0];
+    for (int i = 0; i < STAMP_CACHE_COUNT; ++i) {
+        DP_DrawContextStampCacheEntry *entry = &entries[i];
+        if (entry->capacity != 0 && entry->key == key) {
+            entry->last_used = uses;
+            *out_found = true;
+            return &entry->stamp;
+        }
+        else if (entry->last_used < oldest->last_used) {
+            oldest = entry;
+        }
+    }
+
+    // Not found, evict the least recently used entry.
+    if (oldest->capacity < capacity) {
+        DP_free_simd(oldest->stamp.data);
+        oldest->stamp.data = DP_malloc_simd(capacity * sizeof(uint16_t));
+        oldest->capacity = capacity;
+    }
+    oldest->key = key;
+    oldest->last_used = uses;
+    *out_found = false;
+    return &oldest->stamp;
 }
 
 
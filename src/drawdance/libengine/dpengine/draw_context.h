@@ -30,9 +30,12 @@
 #define DPENGINE_DRAW_CONTEXT_H
 #include <dpcommon/common.h>
 
+typedef struct DP_BrushStamp DP_BrushStamp;
+typedef struct DP_DrawDabsWorker DP_DrawDabsWorker;
 typedef struct DP_LayerListEntry DP_LayerListEntry;
 typedef struct DP_LayerProps DP_LayerProps;
 typedef struct DP_SplitTile8 DP_SplitTile8;
+typedef struct DP_Tile DP_Tile;
 typedef struct ZSTD_DCtx_s ZSTD_DCtx;
 typedef union DP_Pixel8 DP_Pixel8;
 
@@ -58,6 +61,42 @@ void DP_draw_context_free(DP_DrawContext *dc);
 
 DP_DrawContextStatistics DP_draw_context_statistics(DP_DrawContext *dc);
 
+// Frees the memory pool and the cached brush stamps, they get allocated again
+// when they're next needed. Must not be called while any of them are in use.
+// Returns how many bytes were released.
+size_t DP_draw_context_pools_release(DP_DrawContext *dc);
+
+
+// Threads to apply draw dabs batches on independent layers in parallel. Not
+// owned by the draw context, the caller must detach it before freeing it.
+DP_DrawDabsWorker *
+DP_draw_context_draw_dabs_worker_nullable(DP_DrawContext *dc);
+
+void DP_draw_context_draw_dabs_worker_set(DP_DrawContext *dc,
+                                          DP_DrawDabsWorker *ddw_or_null);
+
+
+// A tile that was decompressed ahead of time on another thread, keyed by the
+// internal data of the message it belongs to. Handlers take it if it matches
+// and decompress the tile themselves otherwise. Setting it again drops any
+// previous tile that didn't get taken.
+void DP_draw_context_predecoded_tile_set_noinc(DP_DrawContext *dc,
+                                               const void *key,
+                                               DP_Tile *t_or_null);
+
+DP_Tile *DP_draw_context_predecoded_tile_take(DP_DrawContext *dc,
+                                              const void *key);
+
+
+// Brush stamp masks that are expensive to generate, kept around because
+// strokes tend to repeat the same dab over and over. The key is up to the
+// caller. On a miss, the returned stamp's data has room for the given number
+// of values and must be filled in before the next call, along with the rest of
+// the stamp. Its data stays valid until the next call.
+DP_BrushStamp *DP_draw_context_stamp_cache_search(DP_DrawContext *dc,
+                                                  uint64_t key,
+                                                  size_t capacity,
+                                                  bool *out_found);
 
 // All of the following operations share the same memory, their use can't be
 // intermixed within the same operation, they must be used in sequence.
@@ -37,10 +37,14 @@
 #include "selection.h"
 #include "tile.h"
 #include "tile_iterator.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
 #include <dpcommon/geom.h>
 #include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <math.h>
 #include <helpers.h> // M_PI
 
@@ -57,6 +61,12 @@
 #define SOURCE_BLANK_CANVAS_MAX_LAYERS      3
 #define SOURCE_BLANK_CANVAS_TOO_MANY_LAYERS (SOURCE_BLANK_CANVAS_MAX_LAYERS + 1)
 
+#define SOURCE_PARALLEL_MIN_TILES   16
+#define SOURCE_PARALLEL_MAX_THREADS 64
+
+// Merged tiles are 32KiB each, so this keeps the cache at no more than 32MiB.
+#define SOURCE_CACHE_MAX_TILES 1024
+
 typedef enum DP_FloodFillContextType {
     DP_FLOOD_FILL_SOURCE_BLANK,
     DP_FLOOD_FILL_SOURCE_BLANK_WITH_SELECTION,
@@ -77,6 +87,19 @@ typedef struct DP_FillContext {
     void *user;
 } DP_FillContext;
 
+struct DP_FloodFillCache {
+    DP_CanvasState *cs;
+    int layer_id;
+    bool include_sublayers;
+    DP_ViewMode view_mode;
+    int active_layer_id;
+    int active_frame_index;
+    int tile_total;
+    int reserved_tiles;
+    DP_Tile **tiles;
+    unsigned char *known;
+};
+
 typedef struct DP_FloodFillContext {
     DP_FillContext parent;
     DP_FloodFillContextType type;
@@ -100,9 +123,11 @@ typedef struct DP_FloodFillContext {
     unsigned char *flood_map;
     unsigned char *dilate_map;
     unsigned char *erode_map;
+    unsigned char *gap_scratch;
     unsigned char *tile_status;
     unsigned char *output;
     DP_Queue queue;
+    DP_FloodFillCache *cache;
 } DP_FloodFillContext;
 
 typedef struct DP_FillSeed {
@@ -187,7 +212,8 @@ static void source_set_eroded(DP_FloodFillContext *c, int tile_index)
     c->tile_status[tile_index] = SOURCE_STATUS_ERODED;
 }
 
-static DP_Tile *source_merge_tile(DP_FloodFillContext *c, int tile_index)
+static DP_Tile *source_merge_tile_uncached(DP_FloodFillContext *c,
+                                           int tile_index)
 {
     switch (c->type) {
     case DP_FLOOD_FILL_SOURCE_BLANK:
@@ -212,6 +238,27 @@ static DP_Tile *source_merge_tile(DP_FloodFillContext *c, int tile_index)
     DP_UNREACHABLE();
 }
 
+static DP_Tile *source_merge_tile(DP_FloodFillContext *c, int tile_index)
+{
+    // Each tile is only merged by a single job, so there's no contention on
+    // the cache entries here, even when preparing the source in parallel.
+    DP_FloodFillCache *ffc = c->cache;
+    if (ffc) {
+        if (ffc->known[tile_index]) {
+            return DP_tile_incref_nullable(ffc->tiles[tile_index]);
+        }
+        else {
+            DP_Tile *t = source_merge_tile_uncached(c, tile_index);
+            ffc->tiles[tile_index] = DP_tile_incref_nullable(t);
+            ffc->known[tile_index] = 1;
+            return t;
+        }
+    }
+    else {
+        return source_merge_tile_uncached(c, tile_index);
+    }
+}
+
 static DP_UPixelFloat source_to_color(DP_Pixel15 pixel)
 {
     return DP_upixel15_to_float_round8(DP_pixel15_unpremultiply(pixel));
@@ -505,11 +552,91 @@ static size_t source_map_size(DP_FloodFillContext *c)
          * DP_int_to_size(DP_rect_height(area));
 }
 
+static size_t source_gap_scratch_size(DP_FloodFillContext *c)
+{
+    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
+    DP_ASSERT(c->gap > 0);
+    DP_Rect area = c->parent.area;
+    int span = DP_TILE_SIZE + c->gap * 2;
+    size_t rows = DP_int_to_size(DP_min_int(span, DP_rect_height(area)));
+    size_t prefix_count = DP_int_to_size(DP_min_int(
+                              span, DP_max_int(DP_rect_width(area),
+                                               DP_rect_height(area))))
+                        + 1;
+    return rows * DP_TILE_SIZE + prefix_count * sizeof(int);
+}
+
+static void cache_clear_tiles(DP_FloodFillCache *ffc)
+{
+    for (int i = 0; i < ffc->tile_total; ++i) {
+        if (ffc->known[i]) {
+            DP_tile_decref_nullable(ffc->tiles[i]);
+            ffc->tiles[i] = NULL;
+            ffc->known[i] = 0;
+        }
+    }
+    ffc->reserved_tiles = 0;
+}
+
+static bool cache_matches(DP_FloodFillCache *ffc, DP_CanvasState *cs,
+                          int layer_id, bool include_sublayers,
+                          DP_ViewMode view_mode, int active_layer_id,
+                          int active_frame_index)
+{
+    return ffc->cs == cs && ffc->layer_id == layer_id
+        && ffc->include_sublayers == include_sublayers
+        && ffc->view_mode == view_mode
+        && ffc->active_layer_id == active_layer_id
+        && ffc->active_frame_index == active_frame_index;
+}
+
+static void source_cache_init(DP_FloodFillContext *c, DP_FloodFillCache *ffc,
+                              DP_CanvasState *cs, int layer_id,
+                              bool include_sublayers, DP_ViewMode view_mode,
+                              int active_layer_id, int active_frame_index,
+                              DP_TileCounts tc)
+{
+    // Layers without sublayers don't need merging, their tiles are used as-is.
+    if (!ffc || c->type == DP_FLOOD_FILL_SOURCE_BLANK_WITH_SELECTION
+        || c->type == DP_FLOOD_FILL_SOURCE_LAYER_CONTENT) {
+        return;
+    }
+
+    DP_Rect area = c->parent.area;
+    int area_tiles = (area.x2 / DP_TILE_SIZE - area.x1 / DP_TILE_SIZE + 1)
+                   * (area.y2 / DP_TILE_SIZE - area.y1 / DP_TILE_SIZE + 1);
+    if (area_tiles > SOURCE_CACHE_MAX_TILES) {
+        return;
+    }
+
+    if (!cache_matches(ffc, cs, layer_id, include_sublayers, view_mode,
+                       active_layer_id, active_frame_index)) {
+        DP_flood_fill_cache_clear(ffc);
+        int tile_total = tc.x * tc.y;
+        ffc->cs = DP_canvas_state_incref(cs);
+        ffc->layer_id = layer_id;
+        ffc->include_sublayers = include_sublayers;
+        ffc->view_mode = view_mode;
+        ffc->active_layer_id = active_layer_id;
+        ffc->active_frame_index = active_frame_index;
+        ffc->tile_total = tile_total;
+        ffc->tiles = DP_malloc_zeroed(sizeof(*ffc->tiles)
+                                      * DP_int_to_size(tile_total));
+        ffc->known = DP_malloc_zeroed(DP_int_to_size(tile_total));
+    }
+    else if (ffc->reserved_tiles + area_tiles > SOURCE_CACHE_MAX_TILES) {
+        cache_clear_tiles(ffc);
+    }
+
+    ffc->reserved_tiles += area_tiles;
+    c->cache = ffc;
+}
+
 static bool source_init(DP_FloodFillContext *c, DP_CanvasState *cs,
                         int layer_id, bool include_sublayers,
                         DP_ViewMode view_mode, int active_layer_id,
                         int active_frame_index, double tolerance, int gap,
-                        int x, int y)
+                        int x, int y, DP_FloodFillCache *cache_or_null)
 {
     DP_ASSERT(gap >= 0);
     int canvas_width = DP_canvas_state_width(cs);
@@ -579,8 +706,11 @@ static bool source_init(DP_FloodFillContext *c, DP_CanvasState *cs,
     c->flood_map = DP_malloc_zeroed(map_size);
     c->dilate_map = gap == 0 ? NULL : DP_malloc_zeroed(map_size);
     c->erode_map = gap == 0 ? NULL : DP_malloc_zeroed(map_size);
+    c->gap_scratch = gap == 0 ? NULL : DP_malloc(source_gap_scratch_size(c));
     c->tile_status =
         DP_malloc_zeroed(DP_int_to_size(tc.x) * DP_int_to_size(tc.y));
+    source_cache_init(c, cache_or_null, cs, layer_id, include_sublayers,
+                      view_mode, active_layer_id, active_frame_index, tc);
     source_init_at(c, x, y);
     return true;
 }
@@ -608,6 +738,7 @@ static void source_dispose(DP_FloodFillContext *c)
     case DP_FLOOD_FILL_SOURCE_LAYER_GROUP_WITH_SUBLAYERS:
     case DP_FLOOD_FILL_SOURCE_LAYER_CONTENT:
         DP_free(c->tile_status);
+        DP_free(c->gap_scratch);
         DP_free(c->erode_map);
         DP_free(c->dilate_map);
         DP_free(c->flood_map);
@@ -616,101 +747,137 @@ static void source_dispose(DP_FloodFillContext *c)
     DP_UNREACHABLE();
 }
 
-static unsigned char source_flood_map_at(DP_FloodFillContext *c, int x, int y)
+static void source_merge_tile_at(DP_FloodFillContext *c, int xt, int yt)
 {
     DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
-    int xt = x / DP_TILE_SIZE;
-    int yt = y / DP_TILE_SIZE;
     int tile_index = yt * c->xtiles + xt;
     if (!source_is_merged(c, tile_index)) {
         DP_Tile *t = source_merge_tile(c, tile_index);
         source_set_merged(c, tile_index);
         source_flood_nullable_dec(c, xt, yt, t);
     }
+}
+
+static unsigned char source_flood_map_at(DP_FloodFillContext *c, int x, int y)
+{
+    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
+    source_merge_tile_at(c, x / DP_TILE_SIZE, y / DP_TILE_SIZE);
     return buffer_get(c->flood_map, c->parent.area, x, y);
 }
 
-static void source_dilate_pixel(DP_FloodFillContext *c, int x0, int y0)
+// Sets each pixel of the given tile in dst to 1 if there's any zero within the
+// gap-sized square around it in src, clamped to the fill area. Rather than
+// looking at the whole square for every pixel, this first collapses each row
+// using prefix counts of zeroes and then does the same for each column, which
+// gives the same result while staying linear in the gap size.
+static void source_gap_tile(DP_FloodFillContext *c, const unsigned char *src,
+                            unsigned char *dst, int xt, int yt,
+                            unsigned char *scratch)
 {
     DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
     int gap = c->gap;
     DP_Rect area = c->parent.area;
-    int x1 = DP_max_int(area.x1, x0 - gap);
-    int y1 = DP_max_int(area.y1, y0 - gap);
-    int x2 = DP_min_int(area.x2, x0 + gap);
-    int y2 = DP_min_int(area.y2, y0 + gap);
-    for (int y = y1; y <= y2; ++y) {
-        for (int x = x1; x <= x2; ++x) {
-            if (source_flood_map_at(c, x, y) == 0) {
-                buffer_set(c->dilate_map, area, x0, y0, 1);
-                return;
-            }
+    int buffer_left, buffer_top, buffer_right, buffer_bottom;
+    source_tile_bounds(c, xt, yt, NULL, NULL, &buffer_left, &buffer_top,
+                       &buffer_right, &buffer_bottom);
+    int width = buffer_right - buffer_left + 1;
+    int row_top = DP_max_int(area.y1, buffer_top - gap);
+    int row_bottom = DP_min_int(area.y2, buffer_bottom + gap);
+    int col_left = DP_max_int(area.x1, buffer_left - gap);
+    int col_right = DP_min_int(area.x2, buffer_right + gap);
+    unsigned char *rows = scratch;
+    int *prefix = (int *)(void *)(scratch
+                                  + DP_int_to_size(row_bottom - row_top + 1)
+                                        * DP_TILE_SIZE);
+
+    for (int y = row_top; y <= row_bottom; ++y) {
+        const unsigned char *src_row = buffer_at((unsigned char *)src, area,
+                                                 col_left, y);
+        int zeroes = 0;
+        prefix[0] = 0;
+        for (int x = col_left; x <= col_right; ++x) {
+            zeroes += src_row[x - col_left] == 0;
+            prefix[x - col_left + 1] = zeroes;
+        }
+        unsigned char *row = rows + (y - row_top) * DP_TILE_SIZE;
+        for (int x = buffer_left; x <= buffer_right; ++x) {
+            int x1 = DP_max_int(col_left, x - gap) - col_left;
+            int x2 = DP_min_int(col_right, x + gap) - col_left;
+            row[x - buffer_left] = prefix[x2 + 1] != prefix[x1];
+        }
+    }
+
+    for (int i = 0; i < width; ++i) {
+        int hits = 0;
+        prefix[0] = 0;
+        for (int y = row_top; y <= row_bottom; ++y) {
+            hits += rows[(y - row_top) * DP_TILE_SIZE + i];
+            prefix[y - row_top + 1] = hits;
+        }
+        for (int y = buffer_top; y <= buffer_bottom; ++y) {
+            int y1 = DP_max_int(row_top, y - gap) - row_top;
+            int y2 = DP_min_int(row_bottom, y + gap) - row_top;
+            buffer_set(dst, area, buffer_left + i, y,
+                       prefix[y2 + 1] != prefix[y1] ? 1 : 0);
         }
     }
 }
 
-static void source_dilate_tile(DP_FloodFillContext *c, int xt, int yt)
+static void source_gap_neighbor_tiles(DP_FloodFillContext *c, int xt, int yt,
+                                      int *out_left, int *out_top,
+                                      int *out_right, int *out_bottom)
 {
-    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
     int buffer_left, buffer_top, buffer_right, buffer_bottom;
     source_tile_bounds(c, xt, yt, NULL, NULL, &buffer_left, &buffer_top,
                        &buffer_right, &buffer_bottom);
-    for (int y = buffer_top; y <= buffer_bottom; ++y) {
-        for (int x = buffer_left; x <= buffer_right; ++x) {
+    int gap = c->gap;
+    DP_Rect area = c->parent.area;
+    *out_left = DP_max_int(area.x1, buffer_left - gap) / DP_TILE_SIZE;
+    *out_top = DP_max_int(area.y1, buffer_top - gap) / DP_TILE_SIZE;
+    *out_right = DP_min_int(area.x2, buffer_right + gap) / DP_TILE_SIZE;
+    *out_bottom = DP_min_int(area.y2, buffer_bottom + gap) / DP_TILE_SIZE;
+}
+
+static void source_dilate_tile(DP_FloodFillContext *c, int xt, int yt)
+{
+    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
+    int left, top, right, bottom;
+    source_gap_neighbor_tiles(c, xt, yt, &left, &top, &right, &bottom);
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
             if (is_cancelled(&c->parent)) {
                 return;
             }
-            source_dilate_pixel(c, x, y);
+            source_merge_tile_at(c, x, y);
         }
     }
+    source_gap_tile(c, c->flood_map, c->dilate_map, xt, yt, c->gap_scratch);
 }
 
-static unsigned char source_dilate_map_at(DP_FloodFillContext *c, int x, int y)
+static void source_dilate_tile_at(DP_FloodFillContext *c, int xt, int yt)
 {
     DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
-    int xt = x / DP_TILE_SIZE;
-    int yt = y / DP_TILE_SIZE;
     int tile_index = yt * c->xtiles + xt;
     if (!source_is_dilated(c, tile_index)) {
         source_dilate_tile(c, xt, yt);
         source_set_dilated(c, tile_index);
     }
-    return buffer_get(c->dilate_map, c->parent.area, x, y);
-}
-
-static void source_erode_pixel(DP_FloodFillContext *c, int x0, int y0)
-{
-    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
-    int gap = c->gap;
-    DP_Rect area = c->parent.area;
-    int x1 = DP_max_int(area.x1, x0 - gap);
-    int y1 = DP_max_int(area.y1, y0 - gap);
-    int x2 = DP_min_int(area.x2, x0 + gap);
-    int y2 = DP_min_int(area.y2, y0 + gap);
-    for (int y = y1; y <= y2; ++y) {
-        for (int x = x1; x <= x2; ++x) {
-            if (source_dilate_map_at(c, x, y) == 0) {
-                buffer_set(c->erode_map, area, x0, y0, 1);
-                return;
-            }
-        }
-    }
 }
 
 static void source_erode_tile(DP_FloodFillContext *c, int xt, int yt)
 {
     DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
-    int buffer_left, buffer_top, buffer_right, buffer_bottom;
-    source_tile_bounds(c, xt, yt, NULL, NULL, &buffer_left, &buffer_top,
-                       &buffer_right, &buffer_bottom);
-    for (int y = buffer_top; y <= buffer_bottom; ++y) {
-        for (int x = buffer_left; x <= buffer_right; ++x) {
+    int left, top, right, bottom;
+    source_gap_neighbor_tiles(c, xt, yt, &left, &top, &right, &bottom);
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
             if (is_cancelled(&c->parent)) {
                 return;
             }
-            source_erode_pixel(c, x, y);
+            source_dilate_tile_at(c, x, y);
         }
     }
+    source_gap_tile(c, c->dilate_map, c->erode_map, xt, yt, c->gap_scratch);
 }
 
 static unsigned char source_erode_map_at(DP_FloodFillContext *c, int x, int y)
@@ -742,20 +909,150 @@ static void source_flood_all(DP_FloodFillContext *c)
     int tile_top = area.y1 / DP_TILE_SIZE;
     int tile_right = area.x2 / DP_TILE_SIZE;
     int tile_bottom = area.y2 / DP_TILE_SIZE;
-    int xtiles = c->xtiles;
     for (int yt = tile_top; yt <= tile_bottom; ++yt) {
         for (int xt = tile_left; xt <= tile_right; ++xt) {
             if (is_cancelled(&c->parent)) {
                 return;
             }
-            int tile_index = yt * xtiles + xt;
+            source_merge_tile_at(c, xt, yt);
+        }
+    }
+}
+
+
+struct DP_FloodFillPrepareContext {
+    DP_FloodFillContext *c;
+    DP_Semaphore *sem;
+    DP_Atomic cancelled;
+    unsigned char **scratch;
+};
+
+struct DP_FloodFillPrepareJob {
+    struct DP_FloodFillPrepareContext *pc;
+    int status;
+    int xt, yt;
+};
+
+static void source_prepare_job(void *element, int thread_index)
+{
+    struct DP_FloodFillPrepareJob *job = element;
+    struct DP_FloodFillPrepareContext *pc = job->pc;
+    if (!DP_atomic_get(&pc->cancelled)) {
+        DP_FloodFillContext *c = pc->c;
+        int xt = job->xt;
+        int yt = job->yt;
+        int tile_index = yt * c->xtiles + xt;
+        switch (job->status) {
+        case SOURCE_STATUS_MERGED:
             if (!source_is_merged(c, tile_index)) {
                 DP_Tile *t = source_merge_tile(c, tile_index);
-                source_set_merged(c, tile_index);
                 source_flood_nullable_dec(c, xt, yt, t);
+                source_set_merged(c, tile_index);
             }
+            break;
+        case SOURCE_STATUS_DILATED:
+            source_gap_tile(c, c->flood_map, c->dilate_map, xt, yt,
+                            pc->scratch[thread_index]);
+            source_set_dilated(c, tile_index);
+            break;
+        case SOURCE_STATUS_ERODED:
+            source_gap_tile(c, c->dilate_map, c->erode_map, xt, yt,
+                            pc->scratch[thread_index]);
+            source_set_eroded(c, tile_index);
+            break;
+        default:
+            DP_UNREACHABLE();
+        }
+    }
+    DP_SEMAPHORE_MUST_POST(pc->sem);
+}
+
+static bool source_prepare_pass(struct DP_FloodFillPrepareContext *pc,
+                                DP_Worker *worker, int status)
+{
+    DP_FloodFillContext *c = pc->c;
+    DP_Rect area = c->parent.area;
+    int tile_left = area.x1 / DP_TILE_SIZE;
+    int tile_top = area.y1 / DP_TILE_SIZE;
+    int tile_right = area.x2 / DP_TILE_SIZE;
+    int tile_bottom = area.y2 / DP_TILE_SIZE;
+    int job_count = 0;
+    for (int yt = tile_top; yt <= tile_bottom; ++yt) {
+        for (int xt = tile_left; xt <= tile_right; ++xt) {
+            struct DP_FloodFillPrepareJob job = {pc, status, xt, yt};
+            DP_worker_push(worker, &job);
+            ++job_count;
+        }
+    }
+
+    // The cancel callback may not be thread-safe, so only we call it and
+    // forward the result to the workers, which then skip their remaining jobs.
+    for (int i = 0; i < job_count; ++i) {
+        DP_SEMAPHORE_MUST_WAIT(pc->sem);
+        if (!DP_atomic_get(&pc->cancelled) && is_cancelled(&c->parent)) {
+            DP_atomic_set(&pc->cancelled, 1);
+        }
+    }
+    return !DP_atomic_get(&pc->cancelled);
+}
+
+// Merging tiles and closing gaps are independent per tile, so for fills that
+// need to look at a larger part of the canvas, we do those up front on a
+// worker instead of lazily on demand. The flood itself is then just a quick
+// span fill over the prepared maps.
+static void source_prepare_parallel(DP_FloodFillContext *c)
+{
+    DP_ASSERT(c->type != DP_FLOOD_FILL_SOURCE_BLANK);
+    DP_Rect area = c->parent.area;
+    int tile_count = (area.x2 / DP_TILE_SIZE - area.x1 / DP_TILE_SIZE + 1)
+                   * (area.y2 / DP_TILE_SIZE - area.y1 / DP_TILE_SIZE + 1);
+    if (tile_count < SOURCE_PARALLEL_MIN_TILES) {
+        return;
+    }
+
+    int thread_count = DP_worker_cpu_count(
+        DP_min_int(tile_count, SOURCE_PARALLEL_MAX_THREADS));
+    if (thread_count < 2) {
+        return;
+    }
+
+    DP_Worker *worker =
+        DP_worker_new(DP_int_to_size(tile_count),
+                      sizeof(struct DP_FloodFillPrepareJob), thread_count,
+                      source_prepare_job);
+    if (!worker) {
+        DP_warn("Flood fill failed to create worker: %s", DP_error());
+        return;
+    }
+
+    int gap = c->gap;
+    unsigned char **scratch;
+    if (gap == 0) {
+        scratch = NULL;
+    }
+    else {
+        size_t scratch_size = source_gap_scratch_size(c);
+        scratch = DP_malloc(sizeof(*scratch) * DP_int_to_size(thread_count));
+        for (int i = 0; i < thread_count; ++i) {
+            scratch[i] = DP_malloc(scratch_size);
         }
     }
+
+    struct DP_FloodFillPrepareContext pc = {c, DP_semaphore_new(0), 0,
+                                            scratch};
+    if (source_prepare_pass(&pc, worker, SOURCE_STATUS_MERGED) && gap != 0
+        && source_prepare_pass(&pc, worker, SOURCE_STATUS_DILATED)) {
+        source_prepare_pass(&pc, worker, SOURCE_STATUS_ERODED);
+    }
+
+    DP_worker_free_join(worker);
+    DP_semaphore_free(pc.sem);
+    if (scratch) {
+        for (int i = 0; i < thread_count; ++i) {
+            DP_free(scratch[i]);
+        }
+        DP_free(scratch);
+    }
 }
 
 
@@ -876,90 +1173,272 @@ static int get_kernel_diameter(int radius)
     return radius * 2 + 1;
 }
 
-static unsigned char *generate_expansion_kernel(DP_FloodFillKernel kernel_shape,
-                                                int expand)
+static int get_kernel_level(int width)
 {
-    if (kernel_shape == DP_FLOOD_FILL_KERNEL_SQUARE) {
-        return NULL;
+    int level = 0;
+    while ((2 << level) <= width) {
+        ++level;
+    }
+    return level;
+}
+
+static int *generate_kernel_half_widths(int radius)
+{
+    // How far each row of a round kernel extends left and right of its center.
+    int diameter = get_kernel_diameter(radius);
+    int *half_widths =
+        DP_malloc(sizeof(*half_widths) * DP_int_to_size(diameter));
+    int rr = DP_square_int(radius);
+    for (int y = 0; y < diameter; ++y) {
+        int remaining = rr - DP_square_int(y - radius);
+        int half_width = (int)sqrt((double)remaining);
+        while (DP_square_int(half_width + 1) <= remaining) {
+            ++half_width;
+        }
+        while (DP_square_int(half_width) > remaining) {
+            --half_width;
+        }
+        half_widths[y] = half_width;
+    }
+    return half_widths;
+}
+
+static void morph_pair_row(float *dst, const float *a, const float *b,
+                           int start, int count, bool dilate)
+{
+    if (dilate) {
+        for (int i = start; i < start + count; ++i) {
+            dst[i] = DP_max_float(a[i], b[i]);
+        }
     }
     else {
-        int diameter = get_kernel_diameter(expand);
-        size_t kernel_size = DP_square_size(DP_int_to_size(diameter));
-        unsigned char *kernel = DP_malloc(kernel_size);
-        int rr = DP_square_int(expand);
-        for (int y = 0; y < diameter; ++y) {
-            for (int x = 0; x < diameter; ++x) {
-                kernel[y * diameter + x] =
-                    DP_square_int(x - expand) + DP_square_int(y - expand) <= rr;
-            }
+        for (int i = start; i < start + count; ++i) {
+            dst[i] = DP_min_float(a[i], b[i]);
         }
-        return kernel;
-    }
-}
-
-static void apply_expansion_kernel(float *mask, int mask_width, float value,
-                                   const unsigned char *kernel, int width,
-                                   int height, int expand, int feather_radius,
-                                   int expand_min_x, int expand_min_y, int x0,
-                                   int y0)
-{
-    int start_x0 = x0 - expand;
-    int start_y0 = y0 - expand;
-    int start_x = DP_max_int(start_x0, 0);
-    int start_y = DP_max_int(start_y0, 0);
-    int end_x = DP_min_int(x0 + expand, width - 1);
-    int end_y = DP_min_int(y0 + expand, height - 1);
-    int diameter = kernel ? get_kernel_diameter(expand) : 0;
-    for (int y = start_y; y <= end_y; ++y) {
-        for (int x = start_x; x <= end_x; ++x) {
-            if (!kernel || kernel[(y - start_y0) * diameter + (x - start_x0)]) {
-                int mx = x - expand_min_x + feather_radius;
-                int my = y - expand_min_y + feather_radius;
-                int index = my * mask_width + mx;
-                if (value == 1.0f || mask[index] < value) {
-                    mask[index] = value;
-                }
-            }
+    }
+}
+
+static void morph_accumulate_row(float *dst, const float *a, const float *b,
+                                 int start, int count, bool dilate)
+{
+    if (dilate) {
+        for (int i = start; i < start + count; ++i) {
+            dst[i] = DP_max_float(dst[i], DP_max_float(a[i], b[i]));
+        }
+    }
+    else {
+        for (int i = start; i < start + count; ++i) {
+            dst[i] = DP_min_float(dst[i], DP_min_float(a[i], b[i]));
         }
     }
 }
 
-static float erode_mask_pixel(const float *in_mask, int mask_width,
-                              const unsigned char *kernel, int shrink,
-                              int diameter, int x0, int y0)
+#ifdef DP_CPU_X64
+static void morph_pair_row_sse(float *dst, const float *a, const float *b,
+                               int count, bool dilate)
 {
-    int start_x = x0 - shrink;
-    int start_y = y0 - shrink;
-    int end_x = x0 + shrink;
-    int end_y = y0 + shrink;
-    float value = 1.0f;
-    for (int y = start_y; y <= end_y; ++y) {
-        for (int x = start_x; x <= end_x; ++x) {
-            if (!kernel || kernel[(y - start_y) * diameter + (x - start_x)]) {
-                value = DP_min_float(value, in_mask[y * mask_width + x]);
-                if (value == 0.0f) {
-                    return 0.0f;
-                }
+    DP_ASSERT(count % 4 == 0);
+    if (dilate) {
+        for (int i = 0; i < count; i += 4) {
+            _mm_storeu_ps(&dst[i], _mm_max_ps(_mm_loadu_ps(&a[i]),
+                                              _mm_loadu_ps(&b[i])));
+        }
+    }
+    else {
+        for (int i = 0; i < count; i += 4) {
+            _mm_storeu_ps(&dst[i], _mm_min_ps(_mm_loadu_ps(&a[i]),
+                                              _mm_loadu_ps(&b[i])));
+        }
+    }
+}
+
+static void morph_accumulate_row_sse(float *dst, const float *a,
+                                     const float *b, int count, bool dilate)
+{
+    DP_ASSERT(count % 4 == 0);
+    if (dilate) {
+        for (int i = 0; i < count; i += 4) {
+            __m128 value =
+                _mm_max_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i]));
+            _mm_storeu_ps(&dst[i], _mm_max_ps(_mm_loadu_ps(&dst[i]), value));
+        }
+    }
+    else {
+        for (int i = 0; i < count; i += 4) {
+            __m128 value =
+                _mm_min_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i]));
+            _mm_storeu_ps(&dst[i], _mm_min_ps(_mm_loadu_ps(&dst[i]), value));
+        }
+    }
+}
+#endif
+
+// Sets dst to the minimum or maximum of a and b. The destination may be the
+// same as a, with b pointing further ahead into the same buffer.
+static void morph_pair(float *dst, const float *a, const float *b, int count,
+                       bool dilate)
+{
+    int done = 0;
+#ifdef DP_CPU_X64
+    int sse_count = count - count % 4;
+    if (sse_count != 0) {
+        morph_pair_row_sse(dst, a, b, sse_count, dilate);
+        done = sse_count;
+    }
+#endif
+    morph_pair_row(dst, a, b, done, count - done, dilate);
+}
+
+// Combines dst with the minimum or maximum of a and b.
+static void morph_accumulate(float *dst, const float *a, const float *b,
+                             int count, bool dilate)
+{
+    int done = 0;
+#ifdef DP_CPU_X64
+    int sse_count = count - count % 4;
+    if (sse_count != 0) {
+        morph_accumulate_row_sse(dst, a, b, sse_count, dilate);
+        done = sse_count;
+    }
+#endif
+    morph_accumulate_row(dst, a, b, done, count - done, dilate);
+}
+
+static void morph_build_levels(float *levels, const float *row, int width,
+                               int level_count, bool dilate)
+{
+    // Level k holds the minimum or maximum of the 2^k pixels starting at each
+    // position, so any window can be answered with two overlapping lookups.
+    memcpy(levels, row, DP_int_to_size(width) * sizeof(*levels));
+    for (int level = 1; level < level_count; ++level) {
+        int span = 1 << (level - 1);
+        const float *prev = levels + (level - 1) * width;
+        morph_pair(levels + level * width, prev, prev + span,
+                   width - span * 2 + 1, dilate);
+    }
+}
+
+typedef const float *(*DP_MorphGetRowFn)(void *user, int y);
+
+static void morph_filter_square(DP_FillContext *c, DP_MorphGetRowFn get_row,
+                                void *user, int src_width, int src_height,
+                                float *dst, int dst_stride, int radius,
+                                float *levels, int level_count, bool dilate)
+{
+    // Collapse every row horizontally first, then run the same window over
+    // the columns by doubling up the collapsed rows.
+    int diameter = get_kernel_diameter(radius);
+    int out_width = src_width - radius * 2;
+    int out_height = src_height - radius * 2;
+    int level = level_count - 1;
+    int span = 1 << level;
+    float *rows = DP_malloc(sizeof(*rows) * DP_int_to_size(out_width)
+                            * DP_int_to_size(src_height));
+
+    for (int y = 0; y < src_height; ++y) {
+        if (is_cancelled(c)) {
+            DP_free(rows);
+            return;
+        }
+        morph_build_levels(levels, get_row(user, y), src_width, level_count,
+                           dilate);
+        const float *l = levels + level * src_width;
+        morph_pair(rows + y * out_width, l, l + diameter - span, out_width,
+                   dilate);
+    }
+
+    for (int i = 1; i <= level; ++i) {
+        int prev_span = 1 << (i - 1);
+        for (int y = 0; y + prev_span * 2 <= src_height; ++y) {
+            float *row = rows + y * out_width;
+            morph_pair(row, row, row + prev_span * out_width, out_width,
+                       dilate);
+        }
+    }
+
+    for (int y = 0; y < out_height; ++y) {
+        morph_pair(dst + y * dst_stride, rows + y * out_width,
+                   rows + (y + diameter - span) * out_width, out_width,
+                   dilate);
+    }
+    DP_free(rows);
+}
+
+static void morph_filter_round(DP_FillContext *c, DP_MorphGetRowFn get_row,
+                               void *user, int src_width, int src_height,
+                               float *dst, int dst_stride, int radius,
+                               const int *half_widths, float *levels,
+                               int level_count, bool dilate)
+{
+    // Each source row contributes to every output row the kernel reaches,
+    // using the width of the kernel at that distance.
+    int diameter = get_kernel_diameter(radius);
+    int out_width = src_width - radius * 2;
+    int out_height = src_height - radius * 2;
+    for (int sy = 0; sy < src_height; ++sy) {
+        if (is_cancelled(c)) {
+            return;
+        }
+        morph_build_levels(levels, get_row(user, sy), src_width, level_count,
+                           dilate);
+        for (int ky = 0; ky < diameter; ++ky) {
+            int y = sy - ky;
+            if (y >= 0 && y < out_height) {
+                int half_width = half_widths[ky];
+                int width = get_kernel_diameter(half_width);
+                int level = get_kernel_level(width);
+                const float *l = levels + level * src_width + radius
+                               - half_width;
+                morph_accumulate(dst + y * dst_stride, l,
+                                 l + width - (1 << level), out_width, dilate);
             }
         }
     }
-    return value;
 }
 
-static void erode_mask(DP_FillContext *c, const float *in_mask, int in_width,
-                       int in_height, float *out_mask, int out_width,
-                       int feather_radius, int shrink,
-                       const unsigned char *kernel)
+// Grows (dilate) or shrinks the values of the source by the given kernel,
+// making each pixel the maximum or minimum of the kernel around it. Source
+// rows come with radius pixels of context on each side, the result is written
+// for the area inside of that. The kernel is broken up into one horizontal run
+// per row and each run is answered from a table of power-of-two windows, so
+// the cost grows with the radius instead of its square. A square kernel has
+// the same run on every row, so it only needs a couple of lookups per pixel.
+static void morph_filter(DP_FillContext *c, DP_MorphGetRowFn get_row,
+                         void *user, int src_width, int src_height,
+                         float *dst, int dst_stride,
+                         DP_FloodFillKernel kernel_shape, int radius,
+                         bool dilate)
 {
-    int diameter = kernel ? get_kernel_diameter(shrink) : 0;
-    for (int y = shrink; y < in_height - shrink && !is_cancelled(c); ++y) {
-        int out_y = y - shrink + feather_radius;
-        for (int x = shrink; x < in_width - shrink; ++x) {
-            int out_x = x - shrink + feather_radius;
-            out_mask[out_y * out_width + out_x] = erode_mask_pixel(
-                in_mask, in_width, kernel, shrink, diameter, x, y);
+    DP_ASSERT(radius > 0);
+    int diameter = get_kernel_diameter(radius);
+    int out_width = src_width - radius * 2;
+    int out_height = src_height - radius * 2;
+    DP_ASSERT(out_width > 0);
+    DP_ASSERT(out_height > 0);
+
+    float initial = dilate ? 0.0f : 1.0f;
+    for (int y = 0; y < out_height; ++y) {
+        float *dst_row = dst + y * dst_stride;
+        for (int x = 0; x < out_width; ++x) {
+            dst_row[x] = initial;
         }
     }
+
+    int level_count = get_kernel_level(diameter) + 1;
+    float *levels = DP_malloc(sizeof(*levels) * DP_int_to_size(src_width)
+                              * DP_int_to_size(level_count));
+    if (kernel_shape == DP_FLOOD_FILL_KERNEL_SQUARE) {
+        morph_filter_square(c, get_row, user, src_width, src_height, dst,
+                            dst_stride, radius, levels, level_count, dilate);
+    }
+    else {
+        int *half_widths = generate_kernel_half_widths(radius);
+        morph_filter_round(c, get_row, user, src_width, src_height, dst,
+                           dst_stride, radius, half_widths, levels,
+                           level_count, dilate);
+        DP_free(half_widths);
+    }
+    DP_free(levels);
 }
 
 static bool expand_left_edge(int expand_min_x, int feather_radius, float *mask,
@@ -1099,17 +1578,51 @@ static void blur_horizontally(float *dst, const float *src, int x0, int y0,
     dst[y0 * width + x0] = result;
 }
 
-static void blur_vertically(float *dst, const float *src, int x0, int y0,
-                            int width, int height, const float *kernel,
-                            int radius)
+static void blur_vertically_row(float *dst, const float *src, int start,
+                                int count, float k)
 {
+    for (int x = start; x < start + count; ++x) {
+        dst[x] += src[x] * k;
+    }
+}
+
+#ifdef DP_CPU_X64
+static void blur_vertically_row_sse(float *dst, const float *src, int count,
+                                    float k_float)
+{
+    DP_ASSERT(count % 4 == 0);
+    __m128 k = _mm_set1_ps(k_float);
+    for (int x = 0; x < count; x += 4) {
+        __m128 value = _mm_mul_ps(_mm_loadu_ps(&src[x]), k);
+        _mm_storeu_ps(&dst[x], _mm_add_ps(_mm_loadu_ps(&dst[x]), value));
+    }
+}
+#endif
+
+static void blur_vertically(float *dst, const float *src, int y0, int width,
+                            int height, const float *kernel, int radius)
+{
+    // Sums up whole rows at a time, which adds everything up in the same
+    // order as going pixel by pixel would, but lets us do it in bulk.
     int top = DP_max_int(y0 - radius, 0);
     int bottom = DP_min_int(y0 + radius, height - 1);
-    float result = 0.0f;
+    float *dst_row = dst + y0 * width;
+    for (int x = 0; x < width; ++x) {
+        dst_row[x] = 0.0f;
+    }
     for (int y = top; y <= bottom; ++y) {
-        result += src[y * width + x0] * kernel[y - y0 + radius];
+        const float *src_row = src + y * width;
+        float k = kernel[y - y0 + radius];
+        int done = 0;
+#ifdef DP_CPU_X64
+        int sse_count = width - width % 4;
+        if (sse_count != 0) {
+            blur_vertically_row_sse(dst_row, src_row, sse_count, k);
+            done = sse_count;
+        }
+#endif
+        blur_vertically_row(dst_row, src_row, done, width - done, k);
     }
-    dst[y0 * width + x0] = result;
 }
 
 static void feather_mask(DP_FillContext *c, float *mask, float *tmp, int width,
@@ -1133,13 +1646,49 @@ static void feather_mask(DP_FillContext *c, float *mask, float *tmp, int width,
             DP_free(kernel);
             return;
         }
-        for (int x = 0; x < width; ++x) {
-            blur_vertically(mask, tmp, x, y, width, height, kernel, radius);
-        }
+        blur_vertically(mask, tmp, y, width, height, kernel, radius);
     }
     DP_free(kernel);
 }
 
+typedef struct DP_FloodFillExpandRows {
+    DP_FillContext *c;
+    float (*get_output)(void *, int, int);
+    float *buffer;
+    int left, top, width;
+} DP_FloodFillExpandRows;
+
+static const float *get_expand_row(void *user, int y)
+{
+    DP_FloodFillExpandRows *rows = user;
+    DP_FillContext *c = rows->c;
+    float *buffer = rows->buffer;
+    memset(buffer, 0, sizeof(*buffer) * DP_int_to_size(rows->width));
+    int canvas_y = rows->top + y;
+    if (canvas_y >= c->min_y && canvas_y <= c->max_y) {
+        float (*get_output)(void *, int, int) = rows->get_output;
+        int left = rows->left;
+        for (int x = c->min_x; x <= c->max_x; ++x) {
+            float value = get_output ? get_output(c, x, canvas_y) : 1.0f;
+            if (value > 0.0f) {
+                buffer[x - left] = value;
+            }
+        }
+    }
+    return buffer;
+}
+
+typedef struct DP_FloodFillShrinkRows {
+    const float *tmp;
+    int width;
+} DP_FloodFillShrinkRows;
+
+static const float *get_shrink_row(void *user, int y)
+{
+    DP_FloodFillShrinkRows *rows = user;
+    return rows->tmp + y * rows->width;
+}
+
 static float *make_mask(DP_FillContext *c,
                         float (*get_output)(void *, int, int), int expand,
                         DP_FloodFillKernel kernel_shape, int feather_radius,
@@ -1179,23 +1728,20 @@ static float *make_mask(DP_FillContext *c,
         }
     }
     else if (expand > 0) {
-        unsigned char *kernel = generate_expansion_kernel(kernel_shape, expand);
-        for (int y = min_y; y <= max_y; ++y) {
-            if (is_cancelled(c)) {
-                DP_free(kernel);
-                return mask;
-            }
-            for (int x = min_x; x <= max_x; ++x) {
-                float value = get_output ? get_output(c, x, y) : 1.0f;
-                if (value > 0.0f) {
-                    apply_expansion_kernel(mask, img_width, value, kernel,
-                                           c->width, c->height, expand,
-                                           feather_radius, expand_min_x,
-                                           expand_min_y, x, y);
-                }
-            }
-        }
-        DP_free(kernel);
+        int src_width = expand_max_x - expand_min_x + expand * 2 + 1;
+        int src_height = expand_max_y - expand_min_y + expand * 2 + 1;
+        DP_FloodFillExpandRows rows = {
+            c,
+            get_output,
+            DP_malloc(sizeof(float) * DP_int_to_size(src_width)),
+            expand_min_x - expand,
+            expand_min_y - expand,
+            src_width,
+        };
+        morph_filter(c, get_expand_row, &rows, src_width, src_height,
+                     mask + feather_radius * img_width + feather_radius,
+                     img_width, kernel_shape, expand, true);
+        DP_free(rows.buffer);
     }
     else {
         int shrink = -expand;
@@ -1226,10 +1772,10 @@ static float *make_mask(DP_FillContext *c,
                          tmp_height);
         }
 
-        unsigned char *kernel = generate_expansion_kernel(kernel_shape, shrink);
-        erode_mask(c, tmp, tmp_width, tmp_height, mask, img_width,
-                   feather_radius, shrink, kernel);
-        DP_free(kernel);
+        DP_FloodFillShrinkRows rows = {tmp, tmp_width};
+        morph_filter(c, get_shrink_row, &rows, tmp_width, tmp_height,
+                     mask + feather_radius * img_width + feather_radius,
+                     img_width, kernel_shape, shrink, false);
         DP_free(tmp);
     }
 
@@ -1349,6 +1895,37 @@ static DP_FloodFillResult finish_fill(DP_FillContext *c, float *mask, int img_x,
     return DP_FLOOD_FILL_SUCCESS;
 }
 
+DP_FloodFillCache *DP_flood_fill_cache_new(void)
+{
+    DP_FloodFillCache *ffc = DP_malloc(sizeof(*ffc));
+    *ffc = (DP_FloodFillCache){
+        NULL, 0, false, DP_VIEW_MODE_NORMAL, 0, 0, 0, 0, NULL, NULL};
+    return ffc;
+}
+
+void DP_flood_fill_cache_free(DP_FloodFillCache *ffc)
+{
+    if (ffc) {
+        DP_flood_fill_cache_clear(ffc);
+        DP_free(ffc);
+    }
+}
+
+void DP_flood_fill_cache_clear(DP_FloodFillCache *ffc)
+{
+    DP_ASSERT(ffc);
+    if (ffc->cs) {
+        cache_clear_tiles(ffc);
+        DP_free(ffc->known);
+        DP_free(ffc->tiles);
+        DP_canvas_state_decref(ffc->cs);
+        ffc->cs = NULL;
+        ffc->tile_total = 0;
+        ffc->tiles = NULL;
+        ffc->known = NULL;
+    }
+}
+
 DP_FloodFillResult
 DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
               int x, int y, DP_UPixelFloat fill_color, double tolerance,
@@ -1356,8 +1933,9 @@ DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
               DP_FloodFillKernel kernel_shape, int feather_radius,
               bool from_edge, bool continuous, bool include_sublayers,
               DP_ViewMode view_mode, int active_layer_id,
-              int active_frame_index, DP_Image **out_img, int *out_x,
-              int *out_y, DP_FloodFillShouldCancelFn should_cancel, void *user)
+              int active_frame_index, DP_FloodFillCache *cache_or_null,
+              DP_Image **out_img, int *out_x, int *out_y,
+              DP_FloodFillShouldCancelFn should_cancel, void *user)
 {
     DP_ASSERT(cs);
 
@@ -1386,7 +1964,9 @@ DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
         NULL,
         NULL,
         NULL,
+        NULL,
         DP_QUEUE_NULL,
+        NULL,
     };
     if (is_cancelled(&c.parent)) {
         return DP_FLOOD_FILL_CANCELLED;
@@ -1432,7 +2012,8 @@ DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
 
     if (!source_init(&c, cs, layer_id, include_sublayers, view_mode,
                      active_layer_id, active_frame_index, tolerance,
-                     continuous ? DP_max_int(0, gap) : 0, x, y)) {
+                     continuous ? DP_max_int(0, gap) : 0, x, y,
+                     cache_or_null)) {
         return DP_FLOOD_FILL_INVALID_LAYER;
     }
 
@@ -1454,12 +2035,16 @@ DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
         get_output = get_flood_mask_value;
         if (continuous) {
             c.output = DP_malloc_zeroed(source_map_size(&c));
+            if (c.gap != 0) {
+                source_prepare_parallel(&c);
+            }
             DP_queue_init(&c.queue, 1024, sizeof(DP_FillSeed));
             flood_fill(&c, x, y);
             DP_queue_dispose(&c.queue);
             source_dispose(&c);
         }
         else {
+            source_prepare_parallel(&c);
             source_flood_all(&c);
             source_move_flood_map_to_output(&c);
             source_dispose(&c);
@@ -2037,7 +2622,10 @@ bool DP_flood_fill_dab(DP_TransientLayerContent **in_out_state, int origin_x,
     flood_fill_dab_fill(&c, flood_fill_dab_inside_dab, origin_x, origin_y,
                         FILLED_DAB);
 
-    if (flood_fill_dab_all_filled(&c, left, top, right, bottom)) {
+    // The padded area may extend past the edges of the canvas.
+    if (flood_fill_dab_all_filled(&c, DP_max_int(left, 0), DP_max_int(top, 0),
+                                  DP_min_int(right, canvas_width - 1),
+                                  DP_min_int(bottom, canvas_height - 1))) {
         *out_should_mask = false;
         return true;
     }
@@ -44,6 +44,7 @@ typedef enum DP_FloodFillResult {
     DP_FLOOD_FILL_CANCELLED,
 } DP_FloodFillResult;
 
+typedef struct DP_FloodFillCache DP_FloodFillCache;
 typedef struct DP_FloodFillDabState DP_FloodFillDabState;
 
 typedef bool (*DP_FloodFillShouldCancelFn)(void *user);
@@ -52,6 +53,17 @@ typedef void (*DP_FloodFillDabClearFn)(void *user);
 typedef bool (*DP_FloodFillDabPutFn)(void *user, int col, int row, DP_Tile *t);
 typedef bool (*DP_FloodInDabFn)(void *user, int x, int y);
 
+// Keeps merged source tiles between flood fills on the same canvas state with
+// the same source layer and view, so that filling again with just a different
+// tolerance or position doesn't have to merge them all over. Holds a reference
+// to the canvas state until the next fill with a different one or until it's
+// cleared. Must not be used by multiple fills at the same time.
+DP_FloodFillCache *DP_flood_fill_cache_new(void);
+
+void DP_flood_fill_cache_free(DP_FloodFillCache *ffc);
+
+void DP_flood_fill_cache_clear(DP_FloodFillCache *ffc);
+
 DP_FloodFillResult
 DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
               int x, int y, DP_UPixelFloat fill_color, double tolerance,
@@ -59,8 +71,9 @@ DP_flood_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
               DP_FloodFillKernel kernel_shape, int feather_radius,
               bool from_edge, bool continuous, bool include_sublayers,
               DP_ViewMode view_mode, int active_layer_id,
-              int active_frame_index, DP_Image **out_img, int *out_x,
-              int *out_y, DP_FloodFillShouldCancelFn should_cancel, void *user);
+              int active_frame_index, DP_FloodFillCache *cache_or_null,
+              DP_Image **out_img, int *out_x, int *out_y,
+              DP_FloodFillShouldCancelFn should_cancel, void *user);
 
 DP_FloodFillResult
 DP_selection_fill(DP_CanvasState *cs, unsigned int context_id, int selection_id,
@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "gradient.h"
+#include "image.h"
+#include "pixels.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/worker.h>
+#include <math.h>
+
+#define GRADIENT_PARALLEL_MIN_PIXELS  (256 * 256)
+#define GRADIENT_PARALLEL_BAND_HEIGHT 64
+#define GRADIENT_PARALLEL_MAX_THREADS 64
+
+// Keeps the focal point of radial gradients from touching the edge, where the
+// gradient would degenerate into a cone.
+#define GRADIENT_FOCUS_MAX 0.999
+
+struct DP_GradientRender {
+    DP_GradientShape shape;
+    DP_GradientSpread spread;
+    // Origin that pixel positions are relative to. For linear gradients,
+    // that's the start of the line and the direction is divided by its
+    // squared length. For radial gradients, it's the focal point and the
+    // direction points from the center to there.
+    float origin_x, origin_y;
+    float dir_x, dir_y;
+    float a, inv_a;
+    // Premultiplied and scaled to 0 to 255, in b, g, r, a order.
+    float color[4];
+    float delta[4];
+    bool dither;
+    int width;
+    const DP_Pixel8 *mask;
+    DP_Pixel8 *dst;
+};
+
+// 4x4 Bayer matrix, already offset and scaled to be added before truncation.
+static const float dither_matrix[4][4] = {
+    {0.5f / 16.0f, 8.5f / 16.0f, 2.5f / 16.0f, 10.5f / 16.0f},
+    {12.5f / 16.0f, 4.5f / 16.0f, 14.5f / 16.0f, 6.5f / 16.0f},
+    {3.5f / 16.0f, 11.5f / 16.0f, 1.5f / 16.0f, 9.5f / 16.0f},
+    {15.5f / 16.0f, 7.5f / 16.0f, 13.5f / 16.0f, 5.5f / 16.0f},
+};
+
+
+static float spread_t(DP_GradientSpread spread, float t)
+{
+    switch (spread) {
+    case DP_GRADIENT_SPREAD_REPEAT:
+        return t - floorf(t);
+    case DP_GRADIENT_SPREAD_REFLECT: {
+        float u = t - floorf(t * 0.5f) * 2.0f;
+        return 1.0f - fabsf(u - 1.0f);
+    }
+    default:
+        return DP_min_float(DP_max_float(t, 0.0f), 1.0f);
+    }
+}
+
+static uint32_t gradient_pixel(const struct DP_GradientRender *gr, float t,
+                               float m, float offset)
+{
+    float a = gr->color[3] + t * gr->delta[3];
+    float b = DP_min_float(gr->color[0] + t * gr->delta[0], a);
+    float g = DP_min_float(gr->color[1] + t * gr->delta[1], a);
+    float r = DP_min_float(gr->color[2] + t * gr->delta[2], a);
+    return DP_float_to_uint32(b * m + offset)
+         | (DP_float_to_uint32(g * m + offset) << (uint32_t)8)
+         | (DP_float_to_uint32(r * m + offset) << (uint32_t)16)
+         | (DP_float_to_uint32(a * m + offset) << (uint32_t)24);
+}
+
+static void render_row(const struct DP_GradientRender *gr, int y, int start_x)
+{
+    int width = gr->width;
+    const DP_Pixel8 *mask = gr->mask ? gr->mask + y * width : NULL;
+    DP_Pixel8 *dst = gr->dst + y * width;
+    const float *offsets = dither_matrix[y & 3];
+    float qy = DP_int_to_float(y) + 0.5f - gr->origin_y;
+    for (int x = start_x; x < width; ++x) {
+        float qx = DP_int_to_float(x) + 0.5f - gr->origin_x;
+        float t;
+        if (gr->shape == DP_GRADIENT_SHAPE_RADIAL) {
+            float b = qx * gr->dir_x + qy * gr->dir_y;
+            float qq = qx * qx + qy * qy;
+            t = (b + sqrtf(b * b + gr->a * qq)) * gr->inv_a;
+        }
+        else {
+            t = qx * gr->dir_x + qy * gr->dir_y;
+        }
+        float m = mask ? DP_uint8_to_float(mask[x].a) * (1.0f / 255.0f) : 1.0f;
+        float offset = gr->dither ? offsets[x & 3] : 0.5f;
+        dst[x].color = gradient_pixel(gr, spread_t(gr->spread, t), m, offset);
+    }
+}
+
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("avx2")
+static __m256 spread_t_avx2(DP_GradientSpread spread, __m256 t)
+{
+    switch (spread) {
+    case DP_GRADIENT_SPREAD_REPEAT:
+        return _mm256_sub_ps(t, _mm256_floor_ps(t));
+    case DP_GRADIENT_SPREAD_REFLECT: {
+        __m256 u = _mm256_sub_ps(
+            t, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(
+                                 t, _mm256_set1_ps(0.5f))),
+                             _mm256_set1_ps(2.0f)));
+        __m256 v = _mm256_sub_ps(u, _mm256_set1_ps(1.0f));
+        return _mm256_sub_ps(_mm256_set1_ps(1.0f),
+                             _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v));
+    }
+    default:
+        return _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()),
+                             _mm256_set1_ps(1.0f));
+    }
+}
+
+static __m256i gradient_channel_avx2(const struct DP_GradientRender *gr,
+                                     int i, __m256 t, __m256 m, __m256 offset,
+                                     __m256 a, int shift)
+{
+    __m256 c = _mm256_add_ps(_mm256_set1_ps(gr->color[i]),
+                             _mm256_mul_ps(t, _mm256_set1_ps(gr->delta[i])));
+    __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_min_ps(c, a), m), offset);
+    return _mm256_slli_epi32(_mm256_cvttps_epi32(value), shift);
+}
+
+// Does the same operations in the same order as render_row, so the results
+// are identical, just eight pixels at a time. Returns where it stopped.
+static int render_row_avx2(const struct DP_GradientRender *gr, int y)
+{
+    int width = gr->width;
+    int simd_width = width - width % 8;
+    const DP_Pixel8 *mask = gr->mask ? gr->mask + y * width : NULL;
+    DP_Pixel8 *dst = gr->dst + y * width;
+
+    const float *row_offsets = dither_matrix[y & 3];
+    __m256 offset =
+        gr->dither ? _mm256_setr_ps(row_offsets[0], row_offsets[1],
+                                    row_offsets[2], row_offsets[3],
+                                    row_offsets[0], row_offsets[1],
+                                    row_offsets[2], row_offsets[3])
+                   : _mm256_set1_ps(0.5f);
+    bool radial = gr->shape == DP_GRADIENT_SHAPE_RADIAL;
+    __m256 dir_x = _mm256_set1_ps(gr->dir_x);
+    __m256 dir_y = _mm256_set1_ps(gr->dir_y);
+    __m256 coefficient_a = _mm256_set1_ps(gr->a);
+    __m256 inv_a = _mm256_set1_ps(gr->inv_a);
+    __m256 qy = _mm256_set1_ps(DP_int_to_float(y) + 0.5f - gr->origin_y);
+    __m256 qy_dir_y = _mm256_mul_ps(qy, dir_y);
+    __m256 qy_qy = _mm256_mul_ps(qy, qy);
+    __m256 xp = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+    for (int x = 0; x < simd_width; x += 8) {
+        __m256 qx = _mm256_sub_ps(
+            _mm256_add_ps(xp, _mm256_set1_ps(0.5f)),
+            _mm256_set1_ps(gr->origin_x));
+        __m256 t;
+        if (radial) {
+            __m256 b = _mm256_add_ps(_mm256_mul_ps(qx, dir_x), qy_dir_y);
+            __m256 qq = _mm256_add_ps(_mm256_mul_ps(qx, qx), qy_qy);
+            __m256 root = _mm256_sqrt_ps(_mm256_add_ps(
+                _mm256_mul_ps(b, b), _mm256_mul_ps(coefficient_a, qq)));
+            t = _mm256_mul_ps(_mm256_add_ps(b, root), inv_a);
+        }
+        else {
+            t = _mm256_add_ps(_mm256_mul_ps(qx, dir_x), qy_dir_y);
+        }
+        t = spread_t_avx2(gr->spread, t);
+
+        __m256 m;
+        if (mask) {
+            __m256i mask_pixels = _mm256_loadu_si256((const void *)&mask[x]);
+            m = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_srli_epi32(mask_pixels, 24)),
+                _mm256_set1_ps(1.0f / 255.0f));
+        }
+        else {
+            m = _mm256_set1_ps(1.0f);
+        }
+
+        __m256 a =
+            _mm256_add_ps(_mm256_set1_ps(gr->color[3]),
+                          _mm256_mul_ps(t, _mm256_set1_ps(gr->delta[3])));
+        __m256i pixels = _mm256_or_si256(
+            _mm256_or_si256(gradient_channel_avx2(gr, 0, t, m, offset, a, 0),
+                            gradient_channel_avx2(gr, 1, t, m, offset, a, 8)),
+            _mm256_or_si256(gradient_channel_avx2(gr, 2, t, m, offset, a, 16),
+                            gradient_channel_avx2(gr, 3, t, m, offset, a, 24)));
+        _mm256_storeu_si256((void *)&dst[x], pixels);
+
+        xp = _mm256_add_ps(xp, _mm256_set1_ps(8.0f));
+    }
+
+    _mm256_zeroupper();
+    return simd_width;
+}
+DP_TARGET_END
+#endif
+
+static void render_rows(const struct DP_GradientRender *gr, int top,
+                        int bottom)
+{
+    for (int y = top; y < bottom; ++y) {
+        int x = 0;
+#ifdef DP_CPU_X64
+        if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+            x = render_row_avx2(gr, y);
+        }
+#endif
+        render_row(gr, y, x);
+    }
+}
+
+
+struct DP_GradientBandJob {
+    const struct DP_GradientRender *gr;
+    int top;
+    int height;
+};
+
+static void render_band_job(void *element, DP_UNUSED int thread_index)
+{
+    struct DP_GradientBandJob *job = element;
+    int top = job->top;
+    render_rows(job->gr, top,
+                DP_min_int(top + GRADIENT_PARALLEL_BAND_HEIGHT, job->height));
+}
+
+static bool render_bands(const struct DP_GradientRender *gr, int height)
+{
+    if ((long long)gr->width * (long long)height
+        < GRADIENT_PARALLEL_MIN_PIXELS) {
+        return false;
+    }
+
+    int band_count = (height + GRADIENT_PARALLEL_BAND_HEIGHT - 1)
+                   / GRADIENT_PARALLEL_BAND_HEIGHT;
+    int thread_count = DP_worker_cpu_count(
+        DP_min_int(band_count, GRADIENT_PARALLEL_MAX_THREADS));
+    if (thread_count < 2) {
+        return false;
+    }
+
+    DP_Worker *worker =
+        DP_worker_new(DP_int_to_size(band_count),
+                      sizeof(struct DP_GradientBandJob), thread_count,
+                      render_band_job);
+    if (!worker) {
+        DP_warn("Gradient failed to create worker: %s", DP_error());
+        return false;
+    }
+
+    for (int i = 0; i < band_count; ++i) {
+        struct DP_GradientBandJob job = {
+            gr, i * GRADIENT_PARALLEL_BAND_HEIGHT, height};
+        DP_worker_push(worker, &job);
+    }
+    DP_worker_free_join(worker);
+    return true;
+}
+
+
+static void set_color(float *out, DP_UPixelFloat color)
+{
+    DP_PixelFloat pixel = DP_pixel_float_premultiply(color);
+    out[0] = pixel.b * 255.0f;
+    out[1] = pixel.g * 255.0f;
+    out[2] = pixel.r * 255.0f;
+    out[3] = pixel.a * 255.0f;
+}
+
+static void set_degenerate(struct DP_GradientRender *gr)
+{
+    // Zero-length gradients just get filled with the first color.
+    gr->shape = DP_GRADIENT_SHAPE_LINEAR;
+    gr->dir_x = 0.0f;
+    gr->dir_y = 0.0f;
+}
+
+static void set_linear(struct DP_GradientRender *gr, const DP_Gradient *g)
+{
+    double dx = g->x2 - g->x1;
+    double dy = g->y2 - g->y1;
+    double length2 = dx * dx + dy * dy;
+    if (length2 > 0.0) {
+        gr->origin_x = DP_double_to_float(g->x1);
+        gr->origin_y = DP_double_to_float(g->y1);
+        gr->dir_x = DP_double_to_float(dx / length2);
+        gr->dir_y = DP_double_to_float(dy / length2);
+    }
+    else {
+        set_degenerate(gr);
+    }
+}
+
+// Solves for t such that the pixel lies on the circle with radius t * r
+// around the point t of the way from the focal point to the center.
+static void set_radial(struct DP_GradientRender *gr, const DP_Gradient *g)
+{
+    double dx = g->x2 - g->x1;
+    double dy = g->y2 - g->y1;
+    double radius2 = dx * dx + dy * dy;
+    if (radius2 > 0.0) {
+        double focus = DP_min_double(DP_max_double(g->focus, 0.0),
+                                     GRADIENT_FOCUS_MAX);
+        double focus_dx = dx * focus;
+        double focus_dy = dy * focus;
+        double a = radius2 - (focus_dx * focus_dx + focus_dy * focus_dy);
+        gr->origin_x = DP_double_to_float(g->x1 + focus_dx);
+        gr->origin_y = DP_double_to_float(g->y1 + focus_dy);
+        gr->dir_x = DP_double_to_float(focus_dx);
+        gr->dir_y = DP_double_to_float(focus_dy);
+        gr->a = DP_double_to_float(a);
+        gr->inv_a = DP_double_to_float(1.0 / a);
+    }
+    else {
+        set_degenerate(gr);
+    }
+}
+
+DP_Image *DP_gradient_render(const DP_Gradient *gradient, int width,
+                             int height, const DP_Pixel8 *mask_or_null)
+{
+    DP_ASSERT(gradient);
+    if (width <= 0 || height <= 0) {
+        DP_error_set("Invalid gradient size %dx%d", width, height);
+        return NULL;
+    }
+
+    DP_Image *img = DP_image_new(width, height);
+    struct DP_GradientRender gr = {gradient->shape,
+                                   gradient->spread,
+                                   0.0f,
+                                   0.0f,
+                                   0.0f,
+                                   0.0f,
+                                   1.0f,
+                                   1.0f,
+                                   {0.0f, 0.0f, 0.0f, 0.0f},
+                                   {0.0f, 0.0f, 0.0f, 0.0f},
+                                   gradient->dither,
+                                   width,
+                                   mask_or_null,
+                                   DP_image_pixels(img)};
+
+    switch (gradient->shape) {
+    case DP_GRADIENT_SHAPE_LINEAR:
+        set_linear(&gr, gradient);
+        break;
+    case DP_GRADIENT_SHAPE_RADIAL:
+        set_radial(&gr, gradient);
+        break;
+    default:
+        DP_image_free(img);
+        DP_error_set("Unknown gradient shape %d", (int)gradient->shape);
+        return NULL;
+    }
+
+    set_color(gr.color, gradient->color1);
+    float color2[4];
+    set_color(color2, gradient->color2);
+    for (int i = 0; i < 4; ++i) {
+        gr.delta[i] = color2[i] - gr.color[i];
+    }
+
+    if (!render_bands(&gr, height)) {
+        render_rows(&gr, 0, height);
+    }
+    return img;
+}
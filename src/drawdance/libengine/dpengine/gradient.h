@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_GRADIENT_H
+#define DPENGINE_GRADIENT_H
+#include "pixels.h"
+#include <dpcommon/common.h>
+
+typedef struct DP_Image DP_Image;
+
+
+typedef enum DP_GradientShape {
+    DP_GRADIENT_SHAPE_LINEAR,
+    DP_GRADIENT_SHAPE_RADIAL,
+} DP_GradientShape;
+
+typedef enum DP_GradientSpread {
+    DP_GRADIENT_SPREAD_PAD,
+    DP_GRADIENT_SPREAD_REPEAT,
+    DP_GRADIENT_SPREAD_REFLECT,
+} DP_GradientSpread;
+
+// Linear gradients go from (x1, y1) to (x2, y2). Radial gradients are centered
+// on (x1, y1) with (x2, y2) on their edge, the focus says where the focal point
+// lies on the line between them, 0 being the center and 1 being the edge. The
+// colors are interpolated premultiplied, like Qt's gradients do by default.
+typedef struct DP_Gradient {
+    DP_GradientShape shape;
+    DP_GradientSpread spread;
+    double x1, y1, x2, y2;
+    double focus;
+    DP_UPixelFloat color1;
+    DP_UPixelFloat color2;
+    bool dither;
+} DP_Gradient;
+
+
+// Renders the gradient into a new image of the given size, coordinates are
+// relative to its top-left corner. If a mask is given, it must be the same
+// size and the result is clipped to its alpha. Large images are rendered in
+// parallel, in horizontal bands. Dithering uses an ordered pattern, so it
+// doesn't depend on how the image gets split up.
+DP_Image *DP_gradient_render(const DP_Gradient *gradient, int width,
+                             int height, const DP_Pixel8 *mask_or_null);
+
+
+#endif
@@ -0,0 +1,573 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "history_blocks.h"
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/file.h>
+#include <dpcommon/input.h>
+#include <zstd.h>
+
+#define COMPRESSION_LEVEL       3
+#define MAGIC                   "DPBLOCKS"
+#define MAGIC_LENGTH            8
+#define FRAME_HEADER_MAX_LENGTH 18
+
+
+static size_t read_at(DP_Input *input, size_t offset, unsigned char *buffer,
+                      size_t size, bool *out_error)
+{
+    if (!DP_input_seek(input, offset)) {
+        *out_error = true;
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        bool error;
+        size_t read = DP_input_read(input, buffer + done, size - done, &error);
+        if (error) {
+            *out_error = true;
+            return done;
+        }
+        else if (read == 0) {
+            break;
+        }
+        done += read;
+    }
+    *out_error = false;
+    return done;
+}
+
+static bool read_exactly(DP_Input *input, size_t offset, unsigned char *buffer,
+                         size_t size, const char *what)
+{
+    bool error;
+    size_t read = read_at(input, offset, buffer, size, &error);
+    if (error) {
+        return false;
+    }
+    else if (read != size) {
+        DP_error_set("%s cut off at offset %zu", what, offset);
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+
+void DP_history_blocks_header_write(size_t recording_header_length,
+                                    unsigned char *out)
+{
+    DP_ASSERT(out);
+    memcpy(out, MAGIC, MAGIC_LENGTH);
+    DP_write_littleendian_uint64((uint64_t)recording_header_length,
+                                 out + MAGIC_LENGTH);
+}
+
+unsigned char *DP_history_block_compress(size_t recording_offset,
+                                         size_t message_count,
+                                         const void *data, size_t size,
+                                         size_t *out_length)
+{
+    DP_ASSERT(data || size == 0);
+    DP_ASSERT(out_length);
+    if (size > DP_HISTORY_BLOCKS_BLOCK_SIZE_MAX
+        || message_count > UINT32_MAX) {
+        DP_error_set("History block too large: %zu messages in %zu bytes",
+                     message_count, size);
+        return NULL;
+    }
+
+    size_t bound = ZSTD_compressBound(size);
+    unsigned char *entry =
+        DP_malloc(DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH + bound);
+    size_t compressed_size =
+        ZSTD_compress(entry + DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH, bound,
+                      data, size, COMPRESSION_LEVEL);
+    if (ZSTD_isError(compressed_size)) {
+        DP_error_set("Error compressing history block: %s",
+                     ZSTD_getErrorName(compressed_size));
+        DP_free(entry);
+        return NULL;
+    }
+
+    unsigned char *out = entry;
+    out += DP_write_littleendian_uint64((uint64_t)recording_offset, out);
+    out += DP_write_littleendian_uint32((uint32_t)message_count, out);
+    out += DP_write_littleendian_uint32((uint32_t)size, out);
+    DP_write_littleendian_uint32((uint32_t)compressed_size, out);
+    *out_length = DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH + compressed_size;
+    return entry;
+}
+
+
+static bool check_block(DP_Input *input, const DP_HistoryBlock *block,
+                        size_t recording_header_length, size_t index)
+{
+    if (block->size > DP_HISTORY_BLOCKS_BLOCK_SIZE_MAX
+        || block->compressed_size == 0
+        || block->compressed_size
+               > ZSTD_compressBound(DP_HISTORY_BLOCKS_BLOCK_SIZE_MAX)
+        || block->recording_offset < recording_header_length) {
+        DP_error_set("History block %zu has bogus offset or size", index);
+        return false;
+    }
+
+    // The size is used to allocate the decompression buffer, so it has to
+    // match what the frame says about itself.
+    bool error;
+    unsigned char header[FRAME_HEADER_MAX_LENGTH];
+    size_t read =
+        read_at(input, block->compressed_offset, header,
+                DP_min_size(block->compressed_size, sizeof(header)), &error);
+    if (error) {
+        return false;
+    }
+    else if (ZSTD_getFrameContentSize(header, read) != block->size) {
+        DP_error_set("History block %zu size doesn't match its frame", index);
+        return false;
+    }
+    return true;
+}
+
+bool DP_history_blocks_read(DP_Input *input,
+                            size_t *out_recording_header_length,
+                            DP_HistoryBlock **out_blocks, size_t *out_count,
+                            size_t *out_length)
+{
+    DP_ASSERT(input);
+    DP_ASSERT(out_recording_header_length);
+    DP_ASSERT(out_blocks);
+    DP_ASSERT(out_count);
+    DP_ASSERT(out_length);
+    bool error;
+    size_t length = DP_input_length(input, &error);
+    if (error) {
+        return false;
+    }
+
+    unsigned char header[DP_HISTORY_BLOCKS_HEADER_LENGTH];
+    if (!read_exactly(input, 0, header, sizeof(header),
+                      "History block file header")) {
+        return false;
+    }
+    else if (memcmp(header, MAGIC, MAGIC_LENGTH) != 0) {
+        DP_error_set("Not a history block file");
+        return false;
+    }
+
+    uint64_t recording_header_length =
+        DP_read_littleendian_uint64(header + MAGIC_LENGTH);
+    if (recording_header_length > SIZE_MAX) {
+        DP_error_set("Bogus recording header length %llu",
+                     (unsigned long long)recording_header_length);
+        return false;
+    }
+
+    DP_HistoryBlock *blocks = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t pos = DP_HISTORY_BLOCKS_HEADER_LENGTH;
+    while (length - pos >= DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH) {
+        unsigned char entry[DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH];
+        if (!read_exactly(input, pos, entry, sizeof(entry), "History block")) {
+            DP_free(blocks);
+            return false;
+        }
+
+        uint64_t recording_offset = DP_read_littleendian_uint64(entry);
+        DP_HistoryBlock block = {
+            recording_offset > SIZE_MAX ? SIZE_MAX : (size_t)recording_offset,
+            DP_read_littleendian_uint32(entry + 8),
+            DP_read_littleendian_uint32(entry + 12),
+            pos + DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH,
+            DP_read_littleendian_uint32(entry + 16)};
+        if (block.compressed_size > length - block.compressed_offset) {
+            DP_warn("History block %zu cut off", count);
+            break;
+        }
+        else if (!check_block(input, &block, (size_t)recording_header_length,
+                              count)) {
+            DP_free(blocks);
+            return false;
+        }
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            blocks = DP_realloc(blocks, sizeof(*blocks) * capacity);
+        }
+        blocks[count++] = block;
+        pos = block.compressed_offset + block.compressed_size;
+    }
+
+    *out_recording_header_length = (size_t)recording_header_length;
+    *out_blocks = blocks;
+    *out_count = count;
+    *out_length = pos;
+    return true;
+}
+
+bool DP_history_block_decompress(DP_Input *input, const DP_HistoryBlock *block,
+                                 void *buffer)
+{
+    DP_ASSERT(input);
+    DP_ASSERT(block);
+    DP_ASSERT(buffer || block->size == 0);
+    size_t compressed_size = block->compressed_size;
+    unsigned char *compressed = DP_malloc(compressed_size);
+    if (!read_exactly(input, block->compressed_offset, compressed,
+                      compressed_size, "History block")) {
+        DP_free(compressed);
+        return false;
+    }
+
+    size_t result =
+        ZSTD_decompress(buffer, block->size, compressed, compressed_size);
+    DP_free(compressed);
+    if (ZSTD_isError(result)) {
+        DP_error_set("Error decompressing history block: %s",
+                     ZSTD_getErrorName(result));
+        return false;
+    }
+    else if (result != block->size) {
+        DP_error_set("History block decompressed to %zu instead of %zu bytes",
+                     result, block->size);
+        return false;
+    }
+    return true;
+}
+
+// Whether the recording holds the same messages as the given block.
+static bool recording_contains(DP_Input *input, const DP_HistoryBlock *block,
+                               DP_Input *recording, unsigned char *buffer,
+                               unsigned char *recorded, bool *out_error)
+{
+    if (!DP_history_block_decompress(input, block, buffer)) {
+        *out_error = true;
+        return false;
+    }
+
+    size_t read = read_at(recording, block->recording_offset, recorded,
+                          block->size, out_error);
+    return !*out_error && read == block->size
+        && memcmp(buffer, recorded, block->size) == 0;
+}
+
+bool DP_history_blocks_count_current(DP_Input *input,
+                                     const DP_HistoryBlock *blocks,
+                                     size_t count, DP_Input *recording,
+                                     size_t recording_header_length,
+                                     size_t *out_count)
+{
+    DP_ASSERT(input);
+    DP_ASSERT(blocks || count == 0);
+    DP_ASSERT(recording);
+    DP_ASSERT(out_count);
+    *out_count = count;
+    if (count == 0) {
+        return true;
+    }
+
+    // Find the start of the last batch, then check if it's still there.
+    size_t start = count - 1;
+    size_t max_size = blocks[start].size;
+    while (start > 0
+           && blocks[start].recording_offset
+                  == blocks[start - 1].recording_offset
+                         + blocks[start - 1].size) {
+        --start;
+        max_size = DP_max_size(max_size, blocks[start].size);
+    }
+    if (blocks[start].recording_offset != recording_header_length) {
+        return true;
+    }
+
+    unsigned char *buffer = DP_malloc(max_size * 2);
+    bool stale = true;
+    bool error = false;
+    for (size_t i = start; stale && i < count; ++i) {
+        stale = recording_contains(input, &blocks[i], recording, buffer,
+                                   buffer + max_size, &error);
+    }
+    DP_free(buffer);
+
+    if (error) {
+        return false;
+    }
+    else {
+        if (stale) {
+            *out_count = start;
+        }
+        return true;
+    }
+}
+
+
+typedef struct DP_HistoryBlocksSegment {
+    size_t offset;
+    size_t size;
+    // Where the segment is in the recording, unless it's a moved block.
+    size_t recording_offset;
+    const DP_HistoryBlock *block;
+} DP_HistoryBlocksSegment;
+
+typedef struct DP_HistoryBlocksInputArgs {
+    DP_Input *recording;
+    DP_Input *blocks;
+} DP_HistoryBlocksInputArgs;
+
+typedef struct DP_HistoryBlocksInputState {
+    DP_Input *recording;
+    DP_Input *blocks;
+    DP_HistoryBlock *block_array;
+    DP_HistoryBlocksSegment *segments;
+    size_t segment_count;
+    size_t length;
+    size_t pos;
+    size_t current;
+    unsigned char *buffer;
+    size_t buffer_capacity;
+} DP_HistoryBlocksInputState;
+
+static void append_segment(DP_HistoryBlocksInputState *state, size_t size,
+                           size_t recording_offset,
+                           const DP_HistoryBlock *block)
+{
+    if (size != 0) {
+        state->segments[state->segment_count++] = (DP_HistoryBlocksSegment){
+            state->length, size, recording_offset, block};
+        state->length += size;
+    }
+}
+
+static size_t find_segment(DP_HistoryBlocksInputState *state, size_t pos)
+{
+    // First segment that ends after the position.
+    size_t lo = 0;
+    size_t hi = state->segment_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        DP_HistoryBlocksSegment *segment = &state->segments[mid];
+        if (segment->offset + segment->size <= pos) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool load_block(DP_HistoryBlocksInputState *state, size_t index)
+{
+    if (state->current == index) {
+        return true;
+    }
+
+    const DP_HistoryBlock *block = state->segments[index].block;
+    if (state->buffer_capacity < block->size) {
+        DP_free(state->buffer);
+        state->buffer = DP_malloc(block->size);
+        state->buffer_capacity = block->size;
+    }
+
+    // Invalidate first, in case decompression fails halfway.
+    state->current = SIZE_MAX;
+    if (DP_history_block_decompress(state->blocks, block, state->buffer)) {
+        state->current = index;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static size_t history_blocks_input_read(void *internal, void *buffer,
+                                        size_t size, bool *out_error)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    unsigned char *out = buffer;
+    size_t done = 0;
+    while (done < size && state->pos < state->length) {
+        size_t index = find_segment(state, state->pos);
+        DP_HistoryBlocksSegment *segment = &state->segments[index];
+        size_t segment_pos = state->pos - segment->offset;
+        size_t count = DP_min_size(size - done, segment->size - segment_pos);
+        if (segment->block) {
+            if (!load_block(state, index)) {
+                *out_error = true;
+                break;
+            }
+            memcpy(out + done, state->buffer + segment_pos, count);
+        }
+        else if (!read_exactly(state->recording,
+                               segment->recording_offset + segment_pos,
+                               out + done, count, "Recording")) {
+            *out_error = true;
+            break;
+        }
+        done += count;
+        state->pos += count;
+    }
+    return done;
+}
+
+static size_t history_blocks_input_length(void *internal,
+                                          DP_UNUSED bool *out_error)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    return state->length;
+}
+
+static bool history_blocks_input_rewind(void *internal)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    state->pos = 0;
+    return true;
+}
+
+static bool history_blocks_input_rewind_by(void *internal, size_t size)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    if (size <= state->pos) {
+        state->pos -= size;
+        return true;
+    }
+    else {
+        DP_error_set("Can't rewind history blocks input by %zu from %zu", size,
+                     state->pos);
+        return false;
+    }
+}
+
+static bool history_blocks_input_seek(void *internal, size_t offset)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    if (offset <= state->length) {
+        state->pos = offset;
+        return true;
+    }
+    else {
+        DP_error_set("History blocks input seek offset %zu beyond end %zu",
+                     offset, state->length);
+        return false;
+    }
+}
+
+static bool history_blocks_input_seek_by(void *internal, size_t size)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    if (size <= state->length - state->pos) {
+        state->pos += size;
+        return true;
+    }
+    else {
+        DP_error_set("Can't seek history blocks input by %zu from %zu", size,
+                     state->pos);
+        return false;
+    }
+}
+
+static void history_blocks_input_dispose(void *internal)
+{
+    DP_HistoryBlocksInputState *state = internal;
+    DP_free(state->buffer);
+    DP_free(state->segments);
+    DP_free(state->block_array);
+    DP_input_free(state->blocks);
+    DP_input_free(state->recording);
+}
+
+static const DP_InputMethods history_blocks_input_methods = {
+    history_blocks_input_read,      history_blocks_input_length,
+    history_blocks_input_rewind,    history_blocks_input_rewind_by,
+    history_blocks_input_seek,      history_blocks_input_seek_by,
+    NULL,                           history_blocks_input_dispose,
+};
+
+static const DP_InputMethods *history_blocks_input_init(void *internal,
+                                                        void *arg)
+{
+    DP_HistoryBlocksInputArgs *args = arg;
+    bool error;
+    size_t recording_length = DP_input_length(args->recording, &error);
+    if (error) {
+        return NULL;
+    }
+
+    size_t header_length, count, blocks_length;
+    DP_HistoryBlock *blocks;
+    if (!DP_history_blocks_read(args->blocks, &header_length, &blocks, &count,
+                                &blocks_length)) {
+        return NULL;
+    }
+
+    size_t current;
+    if (!DP_history_blocks_count_current(args->blocks, blocks, count,
+                                         args->recording, header_length,
+                                         &current)) {
+        DP_free(blocks);
+        return NULL;
+    }
+    else if (recording_length < header_length) {
+        DP_error_set("Recording shorter than its header length %zu",
+                     header_length);
+        DP_free(blocks);
+        return NULL;
+    }
+
+    DP_HistoryBlocksInputState *state = internal;
+    *state = (DP_HistoryBlocksInputState){
+        args->recording,
+        args->blocks,
+        blocks,
+        DP_malloc(sizeof(*state->segments) * (current + 2)),
+        0,
+        0,
+        0,
+        SIZE_MAX,
+        NULL,
+        0};
+
+    append_segment(state, header_length, 0, NULL);
+    for (size_t i = 0; i < current; ++i) {
+        append_segment(state, blocks[i].size, 0, &blocks[i]);
+    }
+    append_segment(state, recording_length - header_length, header_length,
+                   NULL);
+    return &history_blocks_input_methods;
+}
+
+DP_Input *DP_history_blocks_input_new(DP_Input *recording, DP_Input *blocks)
+{
+    DP_ASSERT(recording);
+    DP_ASSERT(blocks);
+    DP_HistoryBlocksInputArgs args = {recording, blocks};
+    DP_Input *hbi = DP_input_new(history_blocks_input_init, &args,
+                                 sizeof(DP_HistoryBlocksInputState));
+    if (!hbi) {
+        DP_input_free(blocks);
+        DP_input_free(recording);
+    }
+    return hbi;
+}
+
+DP_Input *DP_history_blocks_input_new_detect(DP_Input *recording,
+                                             const char *path)
+{
+    DP_ASSERT(recording);
+    DP_ASSERT(path);
+    char *blocks_path = DP_format("%s" DP_HISTORY_BLOCKS_SUFFIX, path);
+    if (!DP_file_exists(blocks_path)) {
+        DP_free(blocks_path);
+        return recording;
+    }
+
+    DP_Input *blocks = DP_file_input_new_from_path(blocks_path);
+    DP_free(blocks_path);
+    if (!blocks) {
+        DP_input_free(recording);
+        return NULL;
+    }
+    return DP_history_blocks_input_new(recording, blocks);
+}
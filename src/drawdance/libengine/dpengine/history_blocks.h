@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_HISTORY_BLOCKS_H
+#define DPENGINE_HISTORY_BLOCKS_H
+#include <dpcommon/common.h>
+
+typedef struct DP_Input DP_Input;
+
+
+// The server can move closed blocks of a session's history out of the session
+// recording into a block file next to it, named like the recording with this
+// suffix appended, compressing each block as a zstd frame. Once all closed
+// blocks are moved, the recording is cut back to its header, so its remaining
+// messages come after those in the block file. Numbers are little endian:
+//
+//   magic "DPBLOCKS", u64 length of the recording header
+//   for each block: u64 offset in the recording it was moved from,
+//                   u32 message count, u32 size, u32 compressed size,
+//                   the zstd frame
+//
+// Blocks are moved in order, each batch from right after the recording header
+// onwards. If the server stops before cutting back the recording, the last
+// batch is still in there too. Blocks whose messages are still found in the
+// recording are stale and get ignored.
+#define DP_HISTORY_BLOCKS_SUFFIX              ".blocks"
+#define DP_HISTORY_BLOCKS_HEADER_LENGTH       16
+#define DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH 20
+
+// Blocks are decompressed into memory in one go, larger ones are rejected.
+#define DP_HISTORY_BLOCKS_BLOCK_SIZE_MAX (16 * 1024 * 1024)
+
+typedef struct DP_HistoryBlock {
+    size_t recording_offset;
+    size_t message_count;
+    size_t size;
+    size_t compressed_offset;
+    size_t compressed_size;
+} DP_HistoryBlock;
+
+
+// Writes the header of a new block file, DP_HISTORY_BLOCKS_HEADER_LENGTH bytes.
+void DP_history_blocks_header_write(size_t recording_header_length,
+                                    unsigned char *out);
+
+// Compresses the given block of messages into an entry to append to a block
+// file, including its header. Returns the entry, to be freed with DP_free, and
+// puts its length into *out_length. Returns NULL on error.
+unsigned char *DP_history_block_compress(size_t recording_offset,
+                                         size_t message_count,
+                                         const void *data, size_t size,
+                                         size_t *out_length);
+
+// Reads the header and blocks of a block file. The blocks are allocated into
+// *out_blocks, to be freed with DP_free. A block cut off at the end of the
+// file is left out, *out_length is set to where the last complete one ends.
+// Returns false on read errors and on blocks with bogus sizes.
+bool DP_history_blocks_read(DP_Input *input,
+                            size_t *out_recording_header_length,
+                            DP_HistoryBlock **out_blocks, size_t *out_count,
+                            size_t *out_length);
+
+// Decompresses the given block into the buffer, which must fit its size.
+bool DP_history_block_decompress(DP_Input *input, const DP_HistoryBlock *block,
+                                 void *buffer);
+
+// Figures out how many of the given blocks are current, the rest are stale
+// because the recording still contains them, see above. Returns false on
+// read errors.
+bool DP_history_blocks_count_current(DP_Input *input,
+                                     const DP_HistoryBlock *blocks,
+                                     size_t count, DP_Input *recording,
+                                     size_t recording_header_length,
+                                     size_t *out_count);
+
+// Wraps the given recording, taking ownership of it and of the block file
+// input, so that its moved blocks are read back in place. Reads like a plain
+// recording, including seeking. Returns NULL and frees the inputs on error.
+DP_Input *DP_history_blocks_input_new(DP_Input *recording, DP_Input *blocks);
+
+// Checks if there's a block file next to the recording at the given path and
+// wraps the input using the above if so, otherwise returns it as-is. Returns
+// NULL and frees the input on error.
+DP_Input *DP_history_blocks_input_new_detect(DP_Input *recording,
+                                             const char *path);
+
+
+#endif
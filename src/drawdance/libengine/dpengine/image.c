@@ -460,13 +460,39 @@ static int guess_thumbnail_interpolation(double scale_x, double scale_y)
 #endif
 }
 
+// Flattening at a reduced resolution is only worth the drop in quality if the
+// canvas is way bigger than the thumbnail. It's kept at least twice the size
+// of the thumbnail, so that the final scaling still has something to smooth.
+static int guess_thumbnail_reduction(double scale_x, double scale_y)
+{
+    double scale_min = DP_min_double(scale_x, scale_y);
+    int reduction = 0;
+    while (reduction < DP_CANVAS_STATE_REDUCTION_MAX
+           && scale_min >= DP_int_to_double(4 << reduction)) {
+        ++reduction;
+    }
+    return reduction;
+}
+
 static DP_Image *thumbnail_from_canvas_scale(DP_CanvasState *cs,
                                              DP_DrawContext *dc,
                                              int thumb_width, int thumb_height,
-                                             int interpolation)
+                                             double scale_x, double scale_y)
 {
-    DP_Image *img = DP_canvas_state_to_flat_image(
-        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    int reduction = guess_thumbnail_reduction(scale_x, scale_y);
+    DP_Image *img;
+    if (reduction == 0) {
+        img = DP_canvas_state_to_flat_image(cs, DP_FLAT_IMAGE_RENDER_FLAGS,
+                                            NULL, NULL);
+    }
+    else {
+        img = DP_canvas_state_to_reduced_flat_image(cs, reduction);
+        double factor = DP_int_to_double(1 << reduction);
+        scale_x /= factor;
+        scale_y /= factor;
+    }
+
+    int interpolation = guess_thumbnail_interpolation(scale_x, scale_y);
     if (img) {
         DP_Image *thumb =
             DP_image_scale(img, dc, thumb_width, thumb_height, interpolation);
@@ -514,8 +540,7 @@ DP_Image *DP_image_thumbnail_from_canvas(DP_CanvasState *cs,
     }
     else {
         DP_Image *thumb = thumbnail_from_canvas_scale(
-            cs, dc_or_null, thumb_width, thumb_height,
-            guess_thumbnail_interpolation(scale_x, scale_y));
+            cs, dc_or_null, thumb_width, thumb_height, scale_x, scale_y);
         if (thumb) {
             return thumb;
         }
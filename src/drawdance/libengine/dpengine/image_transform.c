@@ -25,13 +25,20 @@
 #include "draw_context.h"
 #include "image.h"
 #include "pixels.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/common.h>
+#include <dpcommon/cpu.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/messages.h>
 #include <qgrayraster_inc.h>
 #include <helpers.h> // CLAMP
 
+#define TRANSFORM_PARALLEL_MIN_PIXELS  (256 * 256)
+#define TRANSFORM_PARALLEL_BAND_HEIGHT 64
+#define TRANSFORM_PARALLEL_MAX_THREADS 64
 
 struct DP_RenderSpansData {
     int src_width, src_height;
@@ -70,6 +77,37 @@ static void fetch_transformed_bilinear_pixel_bounds(int l1, int l2, int v1,
     }
 }
 
+#ifdef DP_CPU_X64
+static uint32_t interpolate_4_pixels_sse(uint32_t tl, uint32_t tr, uint32_t bl,
+                                         uint32_t br, uint32_t distx,
+                                         uint32_t disty)
+{
+    // Same calculation as interpolate_4_pixels, but with each channel in its
+    // own 16 bit lane instead of packing two channels into 32 bits. The
+    // weights add up to 256, so none of the sums can overflow.
+    short wx = (short)(uint16_t)distx;
+    short iwx = (short)(uint16_t)(256u - distx);
+    short wy = (short)(uint16_t)disty;
+    short iwy = (short)(uint16_t)(256u - disty);
+    __m128i zero = _mm_setzero_si128();
+    __m128i pixels = _mm_setr_epi32((int)tl, (int)tr, (int)bl, (int)br);
+
+    // Top and bottom pairs, weighted horizontally.
+    __m128i weights_x = _mm_setr_epi16(iwx, iwx, iwx, iwx, wx, wx, wx, wx);
+    __m128i top = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weights_x);
+    __m128i bot = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weights_x);
+    __m128i rows = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(top, bot),
+                                                 _mm_unpackhi_epi64(top, bot)),
+                                  8);
+
+    // Blend the top and bottom results together vertically.
+    __m128i weights_y = _mm_setr_epi16(iwy, iwy, iwy, iwy, wy, wy, wy, wy);
+    __m128i weighted = _mm_mullo_epi16(rows, weights_y);
+    __m128i result = _mm_srli_epi16(
+        _mm_add_epi16(weighted, _mm_srli_si128(weighted, 8)), 8);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(result, zero));
+}
+#else
 static uint32_t interpolate_pixel(uint32_t x, uint32_t a, uint32_t y,
                                   uint32_t b)
 {
@@ -92,6 +130,7 @@ static uint32_t interpolate_4_pixels(uint32_t tl, uint32_t tr, uint32_t bl,
     uint32_t xbot = interpolate_pixel(bl, idistx, br, distx);
     return interpolate_pixel(xtop, idisty, xbot, disty);
 }
+#endif
 
 static void get_bilinear_params(int width, int height, const DP_Pixel8 *pixels,
                                 double px, double py, int *out_x1, int *out_y1,
@@ -128,8 +167,13 @@ static uint32_t fetch_transformed_pixel_bilinear(int width, int height,
     uint32_t distx = DP_double_to_uint32((px - DP_int_to_double(x1)) * 256.0);
     uint32_t disty = DP_double_to_uint32((py - DP_int_to_double(y1)) * 256.0);
 
+#ifdef DP_CPU_X64
+    return interpolate_4_pixels_sse(tl.color, tr.color, bl.color, br.color,
+                                    distx, disty);
+#else
     return interpolate_4_pixels(tl.color, tr.color, bl.color, br.color, distx,
                                 disty);
+#endif
 }
 
 static float lerpf(float a, float b, float t)
@@ -367,51 +411,25 @@ static DP_FT_Vector transform_outline_point(DP_Transform tf, double x, double y)
                           DP_double_to_int(v.y * 64.0 + 0.5)};
 }
 
-bool DP_image_transform_draw(int src_width, int src_height,
-                             const DP_Pixel8 *src_pixels, DP_DrawContext *dc,
-                             DP_Image *dst_img, DP_Transform tf,
-                             int interpolation)
+static bool rasterize(DP_DrawContext *dc, struct DP_RenderSpansData *rsd,
+                      const DP_FT_Vector *outline_points, DP_FT_BBox clip_box)
 {
-    DP_Transform delta = DP_transform_make(1.0, 0.0, 0.0, 0.0, 1.0, 0.0,
-                                           1.0 / 65536.0, 1.0 / 65536.0, 1.0);
-    DP_MaybeTransform mtf = DP_transform_invert(DP_transform_mul(delta, tf));
-    if (!mtf.valid) {
-        DP_error_set("Failed to invert fill transform matrix");
-        return false;
-    }
-
     DP_FT_Raster gray_raster;
     if (DP_ft_grays_raster.raster_new(&gray_raster) != 0) {
         DP_error_set("Failed to initialize transform rasterer");
         return false;
     }
 
-    int dst_width = DP_image_width(dst_img);
-    int dst_height = DP_image_height(dst_img);
-    struct DP_RenderSpansData rsd = {src_width,
-                                     src_height,
-                                     src_pixels,
-                                     dst_width,
-                                     dst_height,
-                                     DP_image_pixels(dst_img),
-                                     DP_transform_transpose(mtf.tf),
-                                     interpolation,
-                                     DP_draw_context_transform_buffer(dc)};
+    rsd->buffer = DP_draw_context_transform_buffer(dc);
 
     DP_FT_Vector points[5];
-    double w = DP_int_to_double(src_width);
-    double h = DP_int_to_double(src_height);
-    points[0] = transform_outline_point(tf, 0.0, 0.0);
-    points[1] = transform_outline_point(tf, w, 0.0);
-    points[2] = transform_outline_point(tf, w, h);
-    points[3] = transform_outline_point(tf, 0.0, h);
-    points[4] = points[0];
-
+    for (int i = 0; i < 5; ++i) {
+        points[i] = outline_points[i];
+    }
     char tags[5] = {DP_FT_CURVE_TAG_ON, DP_FT_CURVE_TAG_ON, DP_FT_CURVE_TAG_ON,
                     DP_FT_CURVE_TAG_ON, DP_FT_CURVE_TAG_ON};
     int contours[1] = {4};
     DP_FT_Outline outline = {1, 5, points, tags, contours, 0};
-    DP_FT_BBox clip_box = {0, 0, dst_width, dst_height};
 
     size_t raster_pool_size;
     unsigned char *raster_pool =
@@ -426,7 +444,7 @@ bool DP_image_transform_draw(int src_width, int src_height,
     DP_FT_Raster_Params params = {0};
     params.source = &outline;
     params.flags = DP_FT_RASTER_FLAG_CLIP;
-    params.user = &rsd;
+    params.user = rsd;
     params.clip_box = clip_box;
 
     bool done = false;
@@ -467,3 +485,136 @@ bool DP_image_transform_draw(int src_width, int src_height,
 
     return done;
 }
+
+
+struct DP_ImageTransformBands {
+    const struct DP_RenderSpansData *rsd;
+    const DP_FT_Vector *points;
+    DP_DrawContext **dcs;
+    DP_Atomic failed;
+};
+
+struct DP_ImageTransformBandJob {
+    struct DP_ImageTransformBands *bands;
+    int top;
+};
+
+static void rasterize_band_job(void *element, int thread_index)
+{
+    struct DP_ImageTransformBandJob *job = element;
+    struct DP_ImageTransformBands *bands = job->bands;
+    if (!DP_atomic_get(&bands->failed)) {
+        struct DP_RenderSpansData rsd = *bands->rsd;
+        int top = job->top;
+        int bottom =
+            DP_min_int(top + TRANSFORM_PARALLEL_BAND_HEIGHT, rsd.dst_height);
+        DP_FT_BBox clip_box = {0, top, rsd.dst_width, bottom};
+        if (!rasterize(bands->dcs[thread_index], &rsd, bands->points,
+                       clip_box)) {
+            DP_warn("Transform band %d failed: %s", top, DP_error());
+            DP_atomic_set(&bands->failed, 1);
+        }
+    }
+}
+
+// Rasterizes the destination in horizontal bands on a worker. Each band gets
+// the outline clipped to its rows, which produces the same spans as a single
+// pass would for those rows, so the bands are independent of each other.
+// Returns -1 if it's not worth it or no worker could be created, in which case
+// the caller should render it in one go instead.
+static int rasterize_bands(struct DP_RenderSpansData *rsd,
+                           const DP_FT_Vector *points)
+{
+    int dst_width = rsd->dst_width;
+    int dst_height = rsd->dst_height;
+    if (dst_width * dst_height < TRANSFORM_PARALLEL_MIN_PIXELS) {
+        return -1;
+    }
+
+    int band_count = (dst_height + TRANSFORM_PARALLEL_BAND_HEIGHT - 1)
+                   / TRANSFORM_PARALLEL_BAND_HEIGHT;
+    int thread_count = DP_worker_cpu_count(
+        DP_min_int(band_count, TRANSFORM_PARALLEL_MAX_THREADS));
+    if (thread_count < 2) {
+        return -1;
+    }
+
+    DP_Worker *worker = DP_worker_new(DP_int_to_size(band_count),
+                                      sizeof(struct DP_ImageTransformBandJob),
+                                      thread_count, rasterize_band_job);
+    if (!worker) {
+        DP_warn("Image transform failed to create worker: %s", DP_error());
+        return -1;
+    }
+
+    DP_DrawContext **dcs =
+        DP_malloc(sizeof(*dcs) * DP_int_to_size(thread_count));
+    for (int i = 0; i < thread_count; ++i) {
+        dcs[i] = DP_draw_context_new();
+    }
+
+    struct DP_ImageTransformBands bands = {rsd, points, dcs, 0};
+    for (int i = 0; i < band_count; ++i) {
+        struct DP_ImageTransformBandJob job = {
+            &bands, i * TRANSFORM_PARALLEL_BAND_HEIGHT};
+        DP_worker_push(worker, &job);
+    }
+    DP_worker_free_join(worker);
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_draw_context_free(dcs[i]);
+    }
+    DP_free(dcs);
+
+    if (DP_atomic_get(&bands.failed)) {
+        DP_error_set("Failed to rasterize transformed image");
+        return 0;
+    }
+    else {
+        return 1;
+    }
+}
+
+bool DP_image_transform_draw(int src_width, int src_height,
+                             const DP_Pixel8 *src_pixels, DP_DrawContext *dc,
+                             DP_Image *dst_img, DP_Transform tf,
+                             int interpolation)
+{
+    DP_Transform delta = DP_transform_make(1.0, 0.0, 0.0, 0.0, 1.0, 0.0,
+                                           1.0 / 65536.0, 1.0 / 65536.0, 1.0);
+    DP_MaybeTransform mtf = DP_transform_invert(DP_transform_mul(delta, tf));
+    if (!mtf.valid) {
+        DP_error_set("Failed to invert fill transform matrix");
+        return false;
+    }
+
+    int dst_width = DP_image_width(dst_img);
+    int dst_height = DP_image_height(dst_img);
+    struct DP_RenderSpansData rsd = {src_width,
+                                     src_height,
+                                     src_pixels,
+                                     dst_width,
+                                     dst_height,
+                                     DP_image_pixels(dst_img),
+                                     DP_transform_transpose(mtf.tf),
+                                     interpolation,
+                                     NULL};
+
+    DP_FT_Vector points[5];
+    double w = DP_int_to_double(src_width);
+    double h = DP_int_to_double(src_height);
+    points[0] = transform_outline_point(tf, 0.0, 0.0);
+    points[1] = transform_outline_point(tf, w, 0.0);
+    points[2] = transform_outline_point(tf, w, h);
+    points[3] = transform_outline_point(tf, 0.0, h);
+    points[4] = points[0];
+
+    int banded = rasterize_bands(&rsd, points);
+    if (banded == -1) {
+        DP_FT_BBox clip_box = {0, 0, dst_width, dst_height};
+        return rasterize(dc, &rsd, points, clip_box);
+    }
+    else {
+        return banded != 0;
+    }
+}
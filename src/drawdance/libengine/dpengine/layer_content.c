@@ -34,29 +34,77 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 
 
+#define LAYER_BOUNDS_UNKNOWN 0
+#define LAYER_BOUNDS_WRITING 1
+#define LAYER_BOUNDS_EMPTY   2
+#define LAYER_BOUNDS_VALID   3
+
+#define RESIZE_PARALLEL_MIN_TILES   64
+#define RESIZE_PARALLEL_MAX_THREADS 64
+
+#define MERGE_PARALLEL_MIN_TILES   64
+#define MERGE_PARALLEL_MAX_THREADS 64
+
+#define JOURNAL_INITIAL_CAPACITY 16
+#define JOURNAL_MAX_DEPTH        64
+#define JOURNAL_MAX_INDEXES      4096
+
+typedef struct DP_LayerContentJournal DP_LayerContentJournal;
+
+// Tiles are stored in rows, with each row holding one row of tiles. Rows that
+// don't have any tiles in them are null, so huge, mostly empty layers don't
+// have to carry around pointers for every single tile. Persistent rows are
+// shared between layer contents, making a transient copy only has to copy the
+// pointers to the rows. They're only copied themselves when they're written
+// to, only those transient rows are visited when persisting. Resizing and
+// merging operate on entire rows, so no two threads ever write the same row.
+typedef union DP_LayerContentElement {
+    DP_Tile *tile;
+    DP_TransientTile *transient_tile;
+} DP_LayerContentElement;
+
+typedef struct DP_LayerContentRow {
+    DP_Atomic refcount;
+    bool transient;
+    DP_LayerContentElement elements[];
+} DP_LayerContentRow;
+
+// The bounds cache the result of DP_layer_content_bounds for the layer's own
+// pixels once it's persistent, the state is one of the LAYER_BOUNDS_ values.
+// The serial uniquely identifies a persistent layer content, the journal says
+// which of its tiles changed relative to which earlier serials, see below.
+// While transient, they're those of the layer content it was created from, or
+// zero and NULL if it wasn't created from one or got bulk-changed since.
 #ifdef DP_NO_STRICT_ALIASING
 
 struct DP_LayerContent {
     DP_Atomic refcount;
     const bool transient;
     const int width, height;
+    DP_Atomic bounds_state;
+    DP_Rect bounds;
+    const int serial;
+    DP_LayerContentJournal *const journal;
     DP_LayerContent *mask;
     struct {
         DP_LayerList *contents;
         DP_LayerPropsList *props;
     } sub;
-    union {
-        DP_Tile *const tile;
-    } elements[];
+    DP_LayerContentRow *const rows[];
 };
 
 struct DP_TransientLayerContent {
     DP_Atomic refcount;
     bool transient;
     int width, height;
+    DP_Atomic bounds_state;
+    DP_Rect bounds;
+    int serial;
+    DP_LayerContentJournal *journal;
     union {
         DP_LayerContent *mask;
         DP_TransientLayerContent *transient_mask;
@@ -71,10 +119,7 @@ struct DP_TransientLayerContent {
             DP_TransientLayerPropsList *transient_props;
         };
     } sub;
-    union {
-        DP_Tile *tile;
-        DP_TransientTile *transient_tile;
-    } elements[];
+    DP_LayerContentRow *rows[];
 };
 
 #else
@@ -83,6 +128,10 @@ struct DP_LayerContent {
     DP_Atomic refcount;
     bool transient;
     int width, height;
+    DP_Atomic bounds_state;
+    DP_Rect bounds;
+    int serial;
+    DP_LayerContentJournal *journal;
     union {
         DP_LayerContent *mask;
         DP_TransientLayerContent *transient_mask;
@@ -97,14 +146,279 @@ struct DP_LayerContent {
             DP_TransientLayerPropsList *transient_props;
         };
     } sub;
-    union {
-        DP_Tile *tile;
-        DP_TransientTile *transient_tile;
-    } elements[];
+    DP_LayerContentRow *rows[];
 };
 
 #endif
 
+// When a transient layer content created from a persistent one gets persisted,
+// the indexes of the tiles it changed are recorded in a journal entry along
+// with the serial of the layer content it was created from. Entries chain to
+// the one of that earlier layer content, so a diff against any layer content
+// in the chain only needs to look at the recorded tiles instead of comparing
+// every tile of a potentially huge canvas. Chains are cut off when they get
+// too long and entries are dropped when too much changed, which just means
+// the diff has to fall back to looking at everything.
+struct DP_LayerContentJournal {
+    DP_Atomic refcount;
+    DP_LayerContentJournal *parent;
+    int base_serial;
+    int depth;
+    int total;
+    int count;
+    int indexes[];
+};
+
+typedef struct DP_LayerContentJournalBuilder {
+    DP_LayerContentJournal *journal;
+    int capacity;
+} DP_LayerContentJournalBuilder;
+
+static DP_Atomic layer_content_serial;
+
+static int next_serial(void)
+{
+    while (true) {
+        int serial = DP_atomic_get(&layer_content_serial);
+        int next = serial == INT_MAX ? 1 : serial + 1;
+        if (DP_atomic_compare_exchange(&layer_content_serial, serial, next)) {
+            return next;
+        }
+    }
+}
+
+static DP_LayerContentJournal *
+journal_incref_nullable(DP_LayerContentJournal *journal_or_null)
+{
+    if (journal_or_null) {
+        DP_ASSERT(DP_atomic_get(&journal_or_null->refcount) > 0);
+        DP_atomic_inc(&journal_or_null->refcount);
+    }
+    return journal_or_null;
+}
+
+static void journal_decref_nullable(DP_LayerContentJournal *journal_or_null)
+{
+    DP_LayerContentJournal *journal = journal_or_null;
+    while (journal && DP_atomic_dec(&journal->refcount)) {
+        DP_LayerContentJournal *parent = journal->parent;
+        DP_free(journal);
+        journal = parent;
+    }
+}
+
+static DP_LayerContentJournalBuilder
+journal_begin(DP_TransientLayerContent *tlc)
+{
+    if (tlc->serial == 0) {
+        return (DP_LayerContentJournalBuilder){NULL, 0};
+    }
+    else {
+        DP_LayerContentJournal *journal = DP_malloc(DP_FLEX_SIZEOF(
+            DP_LayerContentJournal, indexes, JOURNAL_INITIAL_CAPACITY));
+        DP_atomic_set(&journal->refcount, 1);
+        journal->count = 0;
+        return (DP_LayerContentJournalBuilder){journal,
+                                               JOURNAL_INITIAL_CAPACITY};
+    }
+}
+
+static void journal_push(DP_LayerContentJournalBuilder *jb, int i)
+{
+    DP_LayerContentJournal *journal = jb->journal;
+    if (journal) {
+        int count = journal->count;
+        if (count == jb->capacity) {
+            if (count == JOURNAL_MAX_INDEXES) {
+                DP_free(journal);
+                jb->journal = NULL;
+                return;
+            }
+            jb->capacity = DP_min_int(count * 2, JOURNAL_MAX_INDEXES);
+            size_t size = DP_FLEX_SIZEOF(DP_LayerContentJournal, indexes,
+                                         DP_int_to_size(jb->capacity));
+            journal = DP_realloc(journal, size);
+            jb->journal = journal;
+        }
+        journal->indexes[count] = i;
+        journal->count = count + 1;
+    }
+}
+
+static void journal_end(DP_LayerContentJournalBuilder *jb,
+                        DP_TransientLayerContent *tlc)
+{
+    DP_LayerContentJournal *base_journal = tlc->journal;
+    DP_LayerContentJournal *journal = jb->journal;
+    if (journal) {
+        int count = journal->count;
+        journal->base_serial = tlc->serial;
+        if (base_journal && base_journal->depth < JOURNAL_MAX_DEPTH
+            && base_journal->total + count <= JOURNAL_MAX_INDEXES) {
+            journal->parent = base_journal;
+            journal->depth = base_journal->depth + 1;
+            journal->total = base_journal->total + count;
+        }
+        else {
+            journal_decref_nullable(base_journal);
+            journal->parent = NULL;
+            journal->depth = 1;
+            journal->total = count;
+        }
+    }
+    else {
+        journal_decref_nullable(base_journal);
+    }
+    tlc->journal = journal;
+    tlc->serial = next_serial();
+}
+
+// Bulk changes that don't go through transient tiles, so the journal would
+// miss them. The next diff after persisting will have to look at everything.
+static void journal_forget(DP_TransientLayerContent *tlc)
+{
+    journal_decref_nullable(tlc->journal);
+    tlc->journal = NULL;
+    tlc->serial = 0;
+}
+
+// Returns the oldest journal entry of lc that needs to be looked at to diff it
+// against prev_lc or NULL if prev_lc isn't in the chain.
+static DP_LayerContentJournal *journal_search(DP_LayerContent *lc,
+                                              DP_LayerContent *prev_lc)
+{
+    int prev_serial = prev_lc->serial;
+    if (prev_serial != 0 && !lc->transient && !prev_lc->transient) {
+        for (DP_LayerContentJournal *journal = lc->journal; journal;
+             journal = journal->parent) {
+            if (journal->base_serial == prev_serial) {
+                return journal;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static DP_LayerContentRow *row_new(int xtiles)
+{
+    DP_LayerContentRow *row = DP_malloc(
+        DP_FLEX_SIZEOF(DP_LayerContentRow, elements, DP_int_to_size(xtiles)));
+    DP_atomic_set(&row->refcount, 1);
+    row->transient = true;
+    return row;
+}
+
+static DP_LayerContentRow *row_new_blank(int xtiles)
+{
+    DP_LayerContentRow *row = row_new(xtiles);
+    for (int x = 0; x < xtiles; ++x) {
+        row->elements[x].tile = NULL;
+    }
+    return row;
+}
+
+// Returns a persistent row with the given tile in every spot, it starts out
+// with the given number of references to it.
+static DP_LayerContentRow *row_new_filled(DP_Tile *tile, int xtiles,
+                                          int refcount)
+{
+    DP_LayerContentRow *row = row_new(xtiles);
+    DP_atomic_set(&row->refcount, refcount);
+    row->transient = false;
+    DP_tile_incref_by(tile, xtiles);
+    for (int x = 0; x < xtiles; ++x) {
+        row->elements[x].tile = tile;
+    }
+    return row;
+}
+
+static DP_LayerContentRow *row_incref_nullable(DP_LayerContentRow *row_or_null)
+{
+    if (row_or_null) {
+        DP_ASSERT(DP_atomic_get(&row_or_null->refcount) > 0);
+        DP_ASSERT(!row_or_null->transient);
+        DP_atomic_inc(&row_or_null->refcount);
+    }
+    return row_or_null;
+}
+
+static void row_decref_nullable(DP_LayerContentRow *row_or_null, int xtiles)
+{
+    if (row_or_null) {
+        DP_ASSERT(DP_atomic_get(&row_or_null->refcount) > 0);
+        if (DP_atomic_dec(&row_or_null->refcount)) {
+            for (int x = 0; x < xtiles; ++x) {
+                DP_tile_decref_nullable(row_or_null->elements[x].tile);
+            }
+            DP_free(row_or_null);
+        }
+    }
+}
+
+static DP_Tile *row_tile_at(DP_LayerContentRow *row_or_null, int x)
+{
+    return row_or_null ? row_or_null->elements[x].tile : NULL;
+}
+
+static DP_Tile *tile_at(DP_LayerContent *lc, int x, int y)
+{
+    DP_ASSERT(x >= 0);
+    DP_ASSERT(y >= 0);
+    DP_ASSERT(x < DP_tile_count_round(lc->width));
+    DP_ASSERT(y < DP_tile_count_round(lc->height));
+    return row_tile_at(lc->rows[y], x);
+}
+
+static DP_Tile *tile_at_index(DP_LayerContent *lc, int i)
+{
+    DP_ASSERT(i >= 0);
+    DP_ASSERT(i < DP_tile_total_round(lc->width, lc->height));
+    int xtiles = DP_tile_count_round(lc->width);
+    return row_tile_at(lc->rows[i / xtiles], i % xtiles);
+}
+
+// Returns the given row ready for writing. Missing rows are created blank and
+// shared ones get copied. A persistent row with no other references can just
+// be taken over, since there's nobody else left to see it change.
+static DP_LayerContentRow *get_transient_row(DP_TransientLayerContent *tlc,
+                                             int y)
+{
+    DP_ASSERT(y >= 0);
+    DP_ASSERT(y < DP_tile_count_round(tlc->height));
+    DP_LayerContentRow *row = tlc->rows[y];
+    if (row && (row->transient || DP_atomic_get(&row->refcount) == 1)) {
+        row->transient = true;
+        return row;
+    }
+    else {
+        int xtiles = DP_tile_count_round(tlc->width);
+        DP_LayerContentRow *trow;
+        if (row) {
+            trow = row_new(xtiles);
+            for (int x = 0; x < xtiles; ++x) {
+                trow->elements[x].tile =
+                    DP_tile_incref_nullable(row->elements[x].tile);
+            }
+            row_decref_nullable(row, xtiles);
+        }
+        else {
+            trow = row_new_blank(xtiles);
+        }
+        tlc->rows[y] = trow;
+        return trow;
+    }
+}
+
+static DP_LayerContentElement *
+get_transient_element(DP_TransientLayerContent *tlc, int i)
+{
+    DP_ASSERT(i >= 0);
+    DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
+    int xtiles = DP_tile_count_round(tlc->width);
+    return &get_transient_row(tlc, i / xtiles)->elements[i % xtiles];
+}
+
 
 DP_LayerContent *DP_layer_content_incref(DP_LayerContent *lc)
 {
@@ -124,13 +438,14 @@ void DP_layer_content_decref(DP_LayerContent *lc)
     DP_ASSERT(lc);
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
     if (DP_atomic_dec(&lc->refcount)) {
-        int count = DP_tile_total_round(lc->width, lc->height);
-        for (int i = 0; i < count; ++i) {
-            DP_tile_decref_nullable(lc->elements[i].tile);
+        DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+        for (int y = 0; y < tile_counts.y; ++y) {
+            row_decref_nullable(lc->rows[y], tile_counts.x);
         }
         DP_layer_props_list_decref(lc->sub.props);
         DP_layer_list_decref(lc->sub.contents);
         DP_layer_content_decref_nullable(lc->mask);
+        journal_decref_nullable(lc->journal);
         DP_free(lc);
     }
 }
@@ -165,7 +480,7 @@ static bool mark_both(void *data, int tile_index)
     DP_LayerContent *b = ((DP_LayerContent **)data)[1];
     DP_ASSERT(tile_index < DP_tile_total_round(a->width, a->height));
     DP_ASSERT(tile_index < DP_tile_total_round(b->width, b->height));
-    return a->elements[tile_index].tile || b->elements[tile_index].tile;
+    return tile_at_index(a, tile_index) || tile_at_index(b, tile_index);
 }
 
 static void layer_content_diff_mark_both(DP_LayerContent *lc,
@@ -179,12 +494,20 @@ static void layer_content_diff_mark_both(DP_LayerContent *lc,
     DP_ASSERT(DP_atomic_get(&prev_lc->refcount) > 0);
     DP_ASSERT(lc->width == prev_lc->width);   // Different sizes could be
     DP_ASSERT(lc->height == prev_lc->height); // supported, but aren't yet.
-    DP_canvas_diff_check(diff, mark_both, (DP_LayerContent *[]){lc, prev_lc});
+    DP_LayerContent *data[] = {lc, prev_lc};
+    DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+    for (int y = 0; y < tile_counts.y; ++y) {
+        if (lc->rows[y] || prev_lc->rows[y]) {
+            int start = y * tile_counts.x;
+            DP_canvas_diff_check_range(diff, mark_both, data, start,
+                                       start + tile_counts.x);
+        }
+    }
     DP_layer_list_diff_mark(lc->sub.contents, diff);
     DP_layer_list_diff_mark(prev_lc->sub.contents, diff);
 }
 
-static bool diff_tile(void *data, int tile_index)
+static DP_Rect diff_tile(void *data, int tile_index)
 {
     DP_ASSERT(data);
     DP_ASSERT(tile_index >= 0);
@@ -192,7 +515,11 @@ static bool diff_tile(void *data, int tile_index)
     DP_LayerContent *b = ((DP_LayerContent **)data)[1];
     DP_ASSERT(tile_index < DP_tile_total_round(a->width, a->height));
     DP_ASSERT(tile_index < DP_tile_total_round(b->width, b->height));
-    return a->elements[tile_index].tile != b->elements[tile_index].tile;
+    // Differing tile pointers usually mean a stroke touched part of the tile,
+    // so narrow it down to spare the renderer from converting and uploading
+    // the whole thing again.
+    return DP_tile_pixels_diff_bounds(tile_at_index(a, tile_index),
+                                      tile_at_index(b, tile_index));
 }
 
 static bool diff_tile_both_censored(void *data, int tile_index)
@@ -205,7 +532,55 @@ static bool diff_tile_both_censored(void *data, int tile_index)
     DP_ASSERT(tile_index < DP_tile_total_round(b->width, b->height));
     // When layers are censored, all non-blank tiles get turned into the
     // same censor tile, so we just have to compare their null-ness.
-    return !a->elements[tile_index].tile != !b->elements[tile_index].tile;
+    return !tile_at_index(a, tile_index) != !tile_at_index(b, tile_index);
+}
+
+static void layer_content_diff_tiles(DP_LayerContent *lc,
+                                     DP_LayerContent *prev_lc, bool censored,
+                                     DP_CanvasDiff *diff)
+{
+    if (lc == prev_lc) {
+        return; // Same content, nothing to compare.
+    }
+
+    DP_LayerContent *data[] = {lc, prev_lc};
+    DP_LayerContentJournal *last = journal_search(lc, prev_lc);
+    if (last) {
+        for (DP_LayerContentJournal *journal = lc->journal;;
+             journal = journal->parent) {
+            if (censored) {
+                DP_canvas_diff_check_indexes(diff, diff_tile_both_censored,
+                                             data, journal->indexes,
+                                             journal->count);
+            }
+            else {
+                DP_canvas_diff_check_rect_indexes(diff, diff_tile, data,
+                                                  journal->indexes,
+                                                  journal->count);
+            }
+            if (journal == last) {
+                break;
+            }
+        }
+    }
+    else {
+        // Rows that are shared between the two can't contain any changes.
+        DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+        for (int y = 0; y < tile_counts.y; ++y) {
+            if (lc->rows[y] != prev_lc->rows[y]) {
+                int start = y * tile_counts.x;
+                int end = start + tile_counts.x;
+                if (censored) {
+                    DP_canvas_diff_check_range(diff, diff_tile_both_censored,
+                                               data, start, end);
+                }
+                else {
+                    DP_canvas_diff_check_rect_range(diff, diff_tile, data,
+                                                    start, end);
+                }
+            }
+        }
+    }
 }
 
 static void layer_content_diff(DP_LayerContent *lc, bool censored,
@@ -219,15 +594,8 @@ static void layer_content_diff(DP_LayerContent *lc, bool censored,
     DP_ASSERT(DP_atomic_get(&prev_lc->refcount) > 0);
     DP_ASSERT(lc->width == prev_lc->width);   // Different sizes could be
     DP_ASSERT(lc->height == prev_lc->height); // supported, but aren't yet.
-    if (!censored && !prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile,
-                             (DP_LayerContent *[]){lc, prev_lc});
-        DP_layer_list_diff(lc->sub.contents, lc->sub.props,
-                           prev_lc->sub.contents, prev_lc->sub.props, diff, 0);
-    }
-    else if (censored && prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile_both_censored,
-                             (DP_LayerContent *[]){lc, prev_lc});
+    if (censored == prev_censored) {
+        layer_content_diff_tiles(lc, prev_lc, censored, diff);
         DP_layer_list_diff(lc->sub.contents, lc->sub.props,
                            prev_lc->sub.contents, prev_lc->sub.props, diff, 0);
     }
@@ -291,7 +659,7 @@ static bool mark(void *data, int tile_index)
     DP_ASSERT(tile_index >= 0);
     DP_LayerContent *lc = data;
     DP_ASSERT(tile_index < DP_tile_total_round(lc->width, lc->height));
-    return lc->elements[tile_index].tile;
+    return tile_at_index(lc, tile_index);
 }
 
 static void layer_content_diff_mark(DP_LayerContent *lc, DP_CanvasDiff *diff)
@@ -299,7 +667,14 @@ static void layer_content_diff_mark(DP_LayerContent *lc, DP_CanvasDiff *diff)
     DP_ASSERT(lc);
     DP_ASSERT(diff);
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
-    DP_canvas_diff_check(diff, mark, lc);
+    DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+    for (int y = 0; y < tile_counts.y; ++y) {
+        if (lc->rows[y]) {
+            int start = y * tile_counts.x;
+            DP_canvas_diff_check_range(diff, mark, lc, start,
+                                       start + tile_counts.x);
+        }
+    }
 }
 
 void DP_layer_content_diff_mark(DP_LayerContent *lc, DP_CanvasDiff *diff)
@@ -331,7 +706,7 @@ DP_Tile *DP_layer_content_tile_at_index_noinc(DP_LayerContent *lc, int i)
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
     DP_ASSERT(i >= 0);
     DP_ASSERT(i < DP_tile_total_round(lc->width, lc->height));
-    return lc->elements[i].tile;
+    return tile_at_index(lc, i);
 }
 
 DP_Tile *DP_layer_content_tile_at_noinc(DP_LayerContent *lc, int x, int y)
@@ -342,7 +717,7 @@ DP_Tile *DP_layer_content_tile_at_noinc(DP_LayerContent *lc, int x, int y)
     DP_ASSERT(y >= 0);
     DP_ASSERT(x < DP_tile_count_round(lc->width));
     DP_ASSERT(y < DP_tile_count_round(lc->height));
-    return lc->elements[y * DP_tile_count_round(lc->width) + x].tile;
+    return tile_at(lc, x, y);
 }
 
 DP_Pixel15 DP_layer_content_pixel_at(DP_LayerContent *lc, int x, int y)
@@ -355,8 +730,7 @@ DP_Pixel15 DP_layer_content_pixel_at(DP_LayerContent *lc, int x, int y)
     DP_ASSERT(y < lc->height);
     int xt = x / DP_TILE_SIZE;
     int yt = y / DP_TILE_SIZE;
-    int wt = DP_tile_count_round(lc->width);
-    DP_Tile *t = lc->elements[yt * wt + xt].tile;
+    DP_Tile *t = tile_at(lc, xt, yt);
     if (t) {
         return DP_tile_pixel_at(t, x - xt * DP_TILE_SIZE,
                                 y - yt * DP_TILE_SIZE);
@@ -377,8 +751,7 @@ bool DP_layer_content_pick_at(DP_LayerContent *lc, int x, int y,
     DP_ASSERT(y < lc->height);
     int xt = x / DP_TILE_SIZE;
     int yt = y / DP_TILE_SIZE;
-    int wt = DP_tile_count_round(lc->width);
-    DP_Tile *t = lc->elements[yt * wt + xt].tile;
+    DP_Tile *t = tile_at(lc, xt, yt);
     if (t) {
         int xp = x - xt * DP_TILE_SIZE;
         int yp = y - yt * DP_TILE_SIZE;
@@ -404,7 +777,6 @@ static DP_UPixelFloat sample_dab_color(DP_LayerContent *lc, DP_BrushStamp stamp,
     int yb = stamp.top < 0 ? -stamp.top : 0; // y in relation to brush origin
     int x0 = DP_max_int(0, stamp.left);
     int xb0 = stamp.left < 0 ? -stamp.left : 0;
-    int xtiles = DP_tile_count_round(lc->width);
 
     float weight = 0.0;
     float red = 0.0;
@@ -421,6 +793,7 @@ static DP_UPixelFloat sample_dab_color(DP_LayerContent *lc, DP_BrushStamp stamp,
         int yt = y - yindex * DP_TILE_SIZE;
         int hb = yt + diameter - yb < DP_TILE_SIZE ? diameter - yb
                                                    : DP_TILE_SIZE - yt;
+        DP_LayerContentRow *row = lc->rows[yindex];
         int x = x0;
         int xb = xb0; // x in relation to brush origin
         while (x < right) {
@@ -429,16 +802,15 @@ static DP_UPixelFloat sample_dab_color(DP_LayerContent *lc, DP_BrushStamp stamp,
             const int wb = xt + diameter - xb < DP_TILE_SIZE
                              ? diameter - xb
                              : DP_TILE_SIZE - xt;
-            const int i = xtiles * yindex + xindex;
 
             if (pigment) {
                 DP_tile_sample_pigment(
-                    lc->elements[i].tile, weights + yb * diameter + xb, xt, yt,
-                    wb, hb, diameter - wb, opaque, sample_interval, sample_rate,
-                    &weight, &red, &green, &blue, &alpha);
+                    row_tile_at(row, xindex), weights + yb * diameter + xb, xt,
+                    yt, wb, hb, diameter - wb, opaque, sample_interval,
+                    sample_rate, &weight, &red, &green, &blue, &alpha);
             }
             else {
-                DP_tile_sample(lc->elements[i].tile,
+                DP_tile_sample(row_tile_at(row, xindex),
                                weights + yb * diameter + xb, xt, yt, wb, hb,
                                diameter - wb, opaque, &weight, &red, &green,
                                &blue, &alpha);
@@ -553,11 +925,16 @@ bool DP_layer_content_has_content(DP_LayerContent *lc)
 {
     DP_ASSERT(lc);
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
-    int count = DP_tile_total_round(lc->width, lc->height);
-    for (int i = 0; i < count; ++i) {
-        DP_Tile *tile = lc->elements[i].tile;
-        if (tile && !DP_tile_blank(tile)) {
-            return true;
+    DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+    for (int y = 0; y < tile_counts.y; ++y) {
+        DP_LayerContentRow *row = lc->rows[y];
+        if (row) {
+            for (int x = 0; x < tile_counts.x; ++x) {
+                DP_Tile *tile = row->elements[x].tile;
+                if (tile && !DP_tile_blank(tile)) {
+                    return true;
+                }
+            }
         }
     }
 
@@ -573,41 +950,84 @@ bool DP_layer_content_has_content(DP_LayerContent *lc)
     return false;
 }
 
-static bool layer_content_tile_bounds(DP_LayerContent *lc, int *out_left,
-                                      int *out_top, int *out_right,
-                                      int *out_bottom)
+// Bounds of the pixels with non-zero alpha in the layer itself, excluding
+// sublayers. Tiles cache their own bounds, so only tiles that haven't been
+// looked at before need their pixels scanned. Persistent layers can't change,
+// so they remember the result and later calls don't even have to do that.
+static bool layer_content_compute_own_bounds(DP_LayerContent *lc,
+                                             DP_Rect *out_bounds)
 {
-    DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
-    int left = tile_counts.x;
-    int top = tile_counts.y;
-    int right = 0;
-    int bottom = 0;
-
+    int width = lc->width;
+    int height = lc->height;
+    DP_TileCounts tile_counts = DP_tile_counts_round(width, height);
+    bool valid = false;
+    DP_Rect bounds = {0, 0, -1, -1};
     for (int y = 0; y < tile_counts.y; ++y) {
+        DP_LayerContentRow *row = lc->rows[y];
+        if (!row) {
+            continue;
+        }
+        int tile_y = y * DP_TILE_SIZE;
+        int tile_height = DP_min_int(DP_TILE_SIZE, height - tile_y);
         for (int x = 0; x < tile_counts.x; ++x) {
-            DP_Tile *t = DP_layer_content_tile_at_noinc(lc, x, y);
-            if (t && !DP_tile_blank(t)) {
-                if (x < left) {
-                    left = x;
-                }
-                if (x > right) {
-                    right = x;
-                }
-                if (y < top) {
-                    top = y;
-                }
-                if (y > bottom) {
-                    bottom = y;
+            DP_Tile *t = row->elements[x].tile;
+            if (t) {
+                int tile_x = x * DP_TILE_SIZE;
+                int tile_width = DP_min_int(DP_TILE_SIZE, width - tile_x);
+                DP_Rect tile_bounds =
+                    DP_tile_alpha_bounds(t, tile_width, tile_height);
+                if (DP_rect_valid(tile_bounds)) {
+                    tile_bounds =
+                        DP_rect_translate(tile_bounds, tile_x, tile_y);
+                    bounds = valid ? DP_rect_union(bounds, tile_bounds)
+                                   : tile_bounds;
+                    valid = true;
                 }
             }
         }
     }
+    *out_bounds = bounds;
+    return valid;
+}
 
-    if (top != tile_counts.y) {
-        *out_left = left;
-        *out_top = top;
-        *out_right = right;
-        *out_bottom = bottom;
+static bool layer_content_own_bounds(DP_LayerContent *lc, DP_Rect *out_bounds)
+{
+    if (lc->transient) {
+        return layer_content_compute_own_bounds(lc, out_bounds);
+    }
+
+    switch (DP_atomic_get(&lc->bounds_state)) {
+    case LAYER_BOUNDS_VALID:
+        *out_bounds = lc->bounds;
+        return true;
+    case LAYER_BOUNDS_EMPTY:
+        return false;
+    default: {
+        // Racing threads compute the same thing, only one gets to store it.
+        DP_Rect bounds;
+        bool valid = layer_content_compute_own_bounds(lc, &bounds);
+        if (DP_atomic_compare_exchange(&lc->bounds_state, LAYER_BOUNDS_UNKNOWN,
+                                       LAYER_BOUNDS_WRITING)) {
+            lc->bounds = bounds;
+            DP_atomic_set(&lc->bounds_state,
+                          valid ? LAYER_BOUNDS_VALID : LAYER_BOUNDS_EMPTY);
+        }
+        *out_bounds = bounds;
+        return valid;
+    }
+    }
+}
+
+static bool layer_content_tile_bounds(DP_LayerContent *lc, int *out_left,
+                                      int *out_top, int *out_right,
+                                      int *out_bottom)
+{
+    DP_Rect bounds;
+    if (layer_content_own_bounds(lc, &bounds)) {
+        *out_left = bounds.x1 / DP_TILE_SIZE;
+        *out_top = bounds.y1 / DP_TILE_SIZE;
+        *out_right = bounds.x2 / DP_TILE_SIZE;
+        *out_bottom = bounds.y2 / DP_TILE_SIZE;
         return true;
     }
     else {
@@ -644,139 +1064,15 @@ static bool get_sublayer_change_bounds(DP_LayerContent *lc, int i, int *out_x,
     }
 }
 
-static bool layer_content_crop_top(DP_LayerContent *lc, DP_Rect rect,
-                                   int *out_top)
-{
-    for (int y = rect.y1; y <= rect.y2; ++y) {
-        for (int x = rect.x1; x <= rect.x2; ++x) {
-            if (DP_layer_content_pixel_at(lc, x, y).a != 0) {
-                *out_top = y;
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-static bool layer_content_crop_bottom(DP_LayerContent *lc, DP_Rect rect,
-                                      int *out_bottom)
-{
-    for (int y = rect.y2; y >= rect.y1; --y) {
-        for (int x = rect.x1; x <= rect.x2; ++x) {
-            if (DP_layer_content_pixel_at(lc, x, y).a != 0) {
-                *out_bottom = y;
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-static bool layer_content_crop_left(DP_LayerContent *lc, DP_Rect rect,
-                                    int *out_left)
-{
-    for (int x = rect.x1; x <= rect.x2; ++x) {
-        for (int y = rect.y1; y <= rect.y2; ++y) {
-            if (DP_layer_content_pixel_at(lc, x, y).a != 0) {
-                *out_left = x;
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
-static bool layer_content_crop_right(DP_LayerContent *lc, DP_Rect rect,
-                                     int *out_right)
-{
-    for (int x = rect.x2; x >= rect.x1; --x) {
-        for (int y = rect.y1; y <= rect.y2; ++y) {
-            if (DP_layer_content_pixel_at(lc, x, y).a != 0) {
-                *out_right = x;
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
 static bool layer_content_crop(DP_LayerContent *lc, int *out_x, int *out_y,
                                int *out_width, int *out_height)
 {
-    int tile_left, tile_top, tile_right, tile_bottom;
-    if (!layer_content_tile_bounds(lc, &tile_left, &tile_top, &tile_right,
-                                   &tile_bottom)) {
-        return false;
-    }
-
-    DP_Rect rect =
-        DP_rect_make(tile_left * DP_TILE_SIZE, tile_top * DP_TILE_SIZE,
-                     (tile_right - tile_left + 1) * DP_TILE_SIZE,
-                     (tile_bottom - tile_top + 1) * DP_TILE_SIZE);
-
-    int max_x = lc->width - 1;
-    if (rect.x2 > max_x) {
-        rect.x2 = max_x;
-    }
-
-    int max_y = lc->height - 1;
-    if (rect.y2 > max_y) {
-        rect.y2 = max_y;
-    }
-
-    bool crop_ok = layer_content_crop_top(lc, rect, &rect.y1)
-                && layer_content_crop_bottom(lc, rect, &rect.y2)
-                && layer_content_crop_left(lc, rect, &rect.x1)
-                && layer_content_crop_right(lc, rect, &rect.x2);
-
-    if (crop_ok) {
-        *out_x = rect.x1;
-        *out_y = rect.y1;
-        *out_width = DP_rect_width(rect);
-        *out_height = DP_rect_height(rect);
-        return true;
-    }
-    else {
-        return false;
-    }
-}
-
-static bool layer_content_crop_prev(DP_LayerContent *lc, DP_Rect prev,
-                                    int *out_x, int *out_y, int *out_width,
-                                    int *out_height)
-{
-    int tile_left, tile_top, tile_right, tile_bottom;
-    if (!layer_content_tile_bounds(lc, &tile_left, &tile_top, &tile_right,
-                                   &tile_bottom)) {
-        return false;
-    }
-
-    DP_Rect rect =
-        DP_rect_make(tile_left * DP_TILE_SIZE, tile_top * DP_TILE_SIZE,
-                     (tile_right - tile_left + 1) * DP_TILE_SIZE,
-                     (tile_bottom - tile_top + 1) * DP_TILE_SIZE);
-
-    int max_x = lc->width - 1;
-    if (rect.x2 > max_x) {
-        rect.x2 = max_x;
-    }
-
-    int max_y = lc->height - 1;
-    if (rect.y2 > max_y) {
-        rect.y2 = max_y;
-    }
-
-    bool crop_ok =
-        (prev.y1 <= rect.y1 || layer_content_crop_top(lc, rect, &rect.y1))
-        && (prev.y2 >= rect.y2 || layer_content_crop_bottom(lc, rect, &rect.y2))
-        && (prev.x1 <= rect.x1 || layer_content_crop_left(lc, rect, &rect.x1))
-        && (prev.x2 >= rect.x2 || layer_content_crop_right(lc, rect, &rect.x2));
-
-    if (crop_ok) {
-        *out_x = rect.x1;
-        *out_y = rect.y1;
-        *out_width = DP_rect_width(rect);
-        *out_height = DP_rect_height(rect);
+    DP_Rect bounds;
+    if (layer_content_own_bounds(lc, &bounds)) {
+        *out_x = bounds.x1;
+        *out_y = bounds.y1;
+        *out_width = DP_rect_width(bounds);
+        *out_height = DP_rect_height(bounds);
         return true;
     }
     else {
@@ -784,41 +1080,24 @@ static bool layer_content_crop_prev(DP_LayerContent *lc, DP_Rect prev,
     }
 }
 
-static void layer_content_union_bounds(DP_LayerContent *lc, bool *in_out_valid,
-                                       DP_Rect *in_out_bounds)
-{
-    int x, y, width, height;
-    bool prev_valid = *in_out_valid;
-    bool valid = prev_valid ? layer_content_crop_prev(lc, *in_out_bounds, &x,
-                                                      &y, &width, &height)
-                            : layer_content_crop(lc, &x, &y, &width, &height);
-    if (valid) {
-        DP_Rect bounds = DP_rect_make(x, y, width, height);
-        if (prev_valid) {
-            *in_out_bounds = DP_rect_union(*in_out_bounds, bounds);
-        }
-        else {
-            *in_out_valid = true;
-            *in_out_bounds = bounds;
-        }
-    }
-}
-
 bool DP_layer_content_bounds(DP_LayerContent *lc, bool include_sublayers,
                              DP_Rect *out_bounds)
 {
     DP_ASSERT(lc);
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
 
-    bool valid = false;
     DP_Rect bounds;
-    layer_content_union_bounds(lc, &valid, &bounds);
+    bool valid = layer_content_own_bounds(lc, &bounds);
     if (include_sublayers) {
         DP_LayerList *sub_ll = lc->sub.contents;
         int sub_count = DP_layer_list_count(sub_ll);
         for (int i = 0; i < sub_count; ++i) {
-            layer_content_union_bounds(
-                DP_layer_list_content_at_noinc(sub_ll, i), &valid, &bounds);
+            DP_Rect sub_bounds;
+            if (layer_content_own_bounds(
+                    DP_layer_list_content_at_noinc(sub_ll, i), &sub_bounds)) {
+                bounds = valid ? DP_rect_union(bounds, sub_bounds) : sub_bounds;
+                valid = true;
+            }
         }
     }
 
@@ -904,8 +1183,8 @@ DP_Image *DP_layer_content_to_image(DP_LayerContent *lc)
     DP_debug("Layer to image %dx%d tiles", tile_counts.x, tile_counts.y);
     for (int y = 0; y < tile_counts.y; ++y) {
         for (int x = 0; x < tile_counts.x; ++x) {
-            DP_tile_copy_to_image(lc->elements[y * tile_counts.x + x].tile, img,
-                                  x * DP_TILE_SIZE, y * DP_TILE_SIZE);
+            DP_tile_copy_to_image(tile_at(lc, x, y), img, x * DP_TILE_SIZE,
+                                  y * DP_TILE_SIZE);
         }
     }
     return img;
@@ -1003,6 +1282,24 @@ DP_Pixel8 *DP_layer_content_to_pixels8_cropped(DP_LayerContent *lc,
     }
 }
 
+// Converts a whole row at a time, so that the conversion can use SIMD.
+static void tile_to_upixels8(DP_Tile *t, DP_TileIterator *ti,
+                             DP_UPixel8 *pixels, int width)
+{
+    DP_TileIntoDstIterator tidi = DP_tile_into_dst_iterator_make(ti);
+    DP_Rect tile_bounds = tidi.tile_bounds;
+    DP_Rect dst_bounds = tidi.dst_bounds;
+    int count = DP_rect_width(tile_bounds);
+    int rows = DP_rect_height(tile_bounds);
+    const DP_Pixel15 *src = DP_tile_pixels_acquire(t);
+    for (int i = 0; i < rows; ++i) {
+        DP_pixels15_to_8_unpremultiply(
+            pixels + (dst_bounds.y1 + i) * width + dst_bounds.x1,
+            src + (tile_bounds.y1 + i) * DP_TILE_SIZE + tile_bounds.x1, count);
+    }
+    DP_tile_pixels_release(t);
+}
+
 DP_UPixel8 *DP_layer_content_to_upixels8(DP_LayerContent *lc, int x, int y,
                                          int width, int height)
 {
@@ -1019,12 +1316,7 @@ DP_UPixel8 *DP_layer_content_to_upixels8(DP_LayerContent *lc, int x, int y,
     while (DP_tile_iterator_next(&ti)) {
         DP_Tile *t = DP_layer_content_tile_at_noinc(lc, ti.col, ti.row);
         if (t) {
-            DP_TileIntoDstIterator tidi = DP_tile_into_dst_iterator_make(&ti);
-            while (DP_tile_into_dst_iterator_next(&tidi)) {
-                pixels[tidi.dst_y * width + tidi.dst_x] =
-                    DP_upixel15_to_8(DP_pixel15_unpremultiply(
-                        DP_tile_pixel_at(t, tidi.tile_x, tidi.tile_y)));
-            }
+            tile_to_upixels8(t, &ti, pixels, width);
         }
     }
 
@@ -1047,12 +1339,7 @@ DP_UPixel8 *DP_layer_content_to_upixels8_censored(DP_LayerContent *lc, int x,
     DP_Tile *censor_tile = DP_tile_censored_noinc();
     while (DP_tile_iterator_next(&ti)) {
         if (DP_layer_content_tile_at_noinc(lc, ti.col, ti.row)) {
-            DP_TileIntoDstIterator tidi = DP_tile_into_dst_iterator_make(&ti);
-            while (DP_tile_into_dst_iterator_next(&tidi)) {
-                pixels[tidi.dst_y * width + tidi.dst_x] =
-                    DP_upixel15_to_8(DP_pixel15_unpremultiply(DP_tile_pixel_at(
-                        censor_tile, tidi.tile_x, tidi.tile_y)));
-            }
+            tile_to_upixels8(censor_tile, &ti, pixels, width);
         }
     }
 
@@ -1166,7 +1453,7 @@ DP_Image *DP_layer_content_select(DP_LayerContent *lc, const DP_Rect *rect,
 static bool get_mask_tile(DP_LayerContent *mask, int i, DP_Tile **out_mt)
 {
     if (mask) {
-        DP_Tile *mt = mask->elements[i].tile;
+        DP_Tile *mt = tile_at_index(mask, i);
         if (mt) {
             *out_mt = mt;
             return true;
@@ -1194,7 +1481,7 @@ static DP_Tile *flatten_tile(DP_LayerContent *lc, int tile_index,
     DP_ASSERT(tile_index < DP_tile_total_round(lc->width, lc->height));
     DP_Tile *mt;
     if (get_mask_tile(lc->mask, tile_index, &mt)) {
-        DP_Tile *t = lc->elements[tile_index].tile;
+        DP_Tile *t = tile_at_index(lc, tile_index);
         DP_LayerList *ll = lc->sub.contents;
         if (!include_sublayers || DP_layer_list_count(ll) == 0) {
             if (t) {
@@ -1265,7 +1552,7 @@ static DP_Tile *flatten_censored_tile(DP_LayerContent *lc, int tile_index,
     DP_ASSERT(tile_index < DP_tile_total_round(lc->width, lc->height));
     DP_Tile *mt;
     if (get_mask_tile(lc->mask, tile_index, &mt)) {
-        DP_Tile *t = lc->elements[tile_index].tile;
+        DP_Tile *t = tile_at_index(lc, tile_index);
         if (t) {
             return mask_censor_tile(mt);
         }
@@ -1275,7 +1562,7 @@ static DP_Tile *flatten_censored_tile(DP_LayerContent *lc, int tile_index,
             for (int i = 0; i < sublayer_count; ++i) {
                 DP_LayerContent *sub_lc = DP_layer_list_entry_content_noinc(
                     DP_layer_list_at_noinc(ll, i));
-                if (sub_lc->elements[tile_index].tile) {
+                if (tile_at_index(sub_lc, tile_index)) {
                     return mask_censor_tile(mt);
                 }
             }
@@ -1294,6 +1581,19 @@ DP_Tile *DP_layer_content_flatten_tile(DP_LayerContent *lc, int tile_index,
                                    include_sublayers);
 }
 
+bool DP_layer_content_tile_opaque(DP_LayerContent *lc, int tile_index,
+                                  bool include_sublayers)
+{
+    DP_ASSERT(lc);
+    DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
+    DP_ASSERT(tile_index >= 0);
+    DP_ASSERT(tile_index < DP_tile_total_round(lc->width, lc->height));
+    DP_Tile *mt;
+    return get_mask_tile(lc->mask, tile_index, &mt) && !tile_needs_masking(mt)
+        && (!include_sublayers || DP_layer_list_count(lc->sub.contents) == 0)
+        && DP_tile_opaque(tile_at_index(lc, tile_index));
+}
+
 DP_TransientTile *
 DP_layer_content_flatten_tile_to(DP_LayerContent *lc, int tile_index,
                                  DP_TransientTile *tt_or_null, uint16_t opacity,
@@ -1339,8 +1639,7 @@ static DP_Pixel15 flatten_censored_pixel(DP_LayerContent *lc, int x, int y)
     DP_ASSERT(y < lc->height);
     int xt = x / DP_TILE_SIZE;
     int yt = y / DP_TILE_SIZE;
-    int wt = DP_tile_count_round(lc->width);
-    if (lc->elements[yt * wt + xt].tile) {
+    if (tile_at(lc, xt, yt)) {
         DP_Tile *censor_tile = DP_tile_censored_noinc();
         return DP_tile_pixel_at(censor_tile, x % DP_TILE_SIZE,
                                 y % DP_TILE_SIZE);
@@ -1367,13 +1666,19 @@ void DP_layer_content_flatten_pixel(DP_LayerContent *lc, int x, int y,
 
 static DP_TransientLayerContent *alloc_layer_content(int width, int height)
 {
-    size_t count = DP_int_to_size(DP_tile_total_round(width, height));
-    DP_TransientLayerContent *tlc =
-        DP_malloc(DP_FLEX_SIZEOF(DP_TransientLayerContent, elements, count));
+    int ytiles = DP_tile_count_round(height);
+    DP_TransientLayerContent *tlc = DP_malloc(DP_FLEX_SIZEOF(
+        DP_TransientLayerContent, rows, DP_int_to_size(ytiles)));
+    for (int y = 0; y < ytiles; ++y) {
+        tlc->rows[y] = NULL;
+    }
     DP_atomic_set(&tlc->refcount, 1);
     tlc->transient = true;
     tlc->width = width;
     tlc->height = height;
+    DP_atomic_set(&tlc->bounds_state, LAYER_BOUNDS_UNKNOWN);
+    tlc->serial = 0;
+    tlc->journal = NULL;
     tlc->mask = NULL;
     return tlc;
 }
@@ -1386,14 +1691,14 @@ static DP_TransientTile *get_transient_tile(DP_TransientLayerContent *tlc,
     DP_ASSERT(tlc->transient);
     DP_ASSERT(i >= 0);
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
-    DP_Tile *t = tlc->elements[i].tile;
+    DP_Tile *t = tile_at_index((DP_LayerContent *)tlc, i);
     DP_ASSERT(t);
     if (DP_tile_transient(t)) {
         return (DP_TransientTile *)t;
     }
     else {
         DP_TransientTile *tt = DP_transient_tile_new(t, context_id);
-        tlc->elements[i].transient_tile = tt;
+        get_transient_element(tlc, i)->transient_tile = tt;
         DP_tile_decref(t);
         return tt;
     }
@@ -1408,17 +1713,21 @@ get_or_create_transient_tile(DP_TransientLayerContent *tlc,
     DP_ASSERT(tlc->transient);
     DP_ASSERT(i >= 0);
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
-    DP_Tile *tile = tlc->elements[i].tile;
+    DP_Tile *tile = tile_at_index((DP_LayerContent *)tlc, i);
     if (!tile) {
-        tlc->elements[i].transient_tile =
-            DP_transient_tile_new_blank(context_id);
+        DP_TransientTile *tt = DP_transient_tile_new_blank(context_id);
+        get_transient_element(tlc, i)->transient_tile = tt;
+        return tt;
     }
     else if (!DP_tile_transient(tile)) {
-        tlc->elements[i].transient_tile =
-            DP_transient_tile_new(tile, context_id);
+        DP_TransientTile *tt = DP_transient_tile_new(tile, context_id);
+        get_transient_element(tlc, i)->transient_tile = tt;
         DP_tile_decref(tile);
+        return tt;
+    }
+    else {
+        return (DP_TransientTile *)tile;
     }
-    return tlc->elements[i].transient_tile;
 }
 
 void DP_transient_layer_content_pixel_at_put(DP_TransientLayerContent *tlc,
@@ -1472,16 +1781,27 @@ resize_layer_content_aligned(DP_LayerContent *lc, int top, int left, int width,
     DP_TileCounts old_counts = DP_tile_counts_round(lc->width, lc->height);
     DP_TileCounts offsets = DP_tile_counts_round(-left, -top);
     for (int y = 0; y < new_counts.y; ++y) {
+        int old_y = offsets.y + y;
+        DP_LayerContentRow *old_row =
+            old_y < 0 || old_y >= old_counts.y ? NULL : lc->rows[old_y];
+        if (!old_row) {
+            continue;
+        }
+        // Rows that stay in place horizontally can just be shared.
+        if (offsets.x == 0 && new_counts.x == old_counts.x
+            && !old_row->transient) {
+            tlc->rows[y] = row_incref_nullable(old_row);
+            continue;
+        }
         for (int x = 0; x < new_counts.x; ++x) {
             int old_x = offsets.x + x;
-            int old_y = offsets.y + y;
-            bool out_of_bounds = old_x < 0 || old_x >= old_counts.x || old_y < 0
-                              || old_y >= old_counts.y;
-            DP_Tile *tile = out_of_bounds
-                              ? NULL
-                              : lc->elements[old_y * old_counts.x + old_x].tile;
-            tlc->elements[y * new_counts.x + x].tile =
-                DP_tile_incref_nullable(tile);
+            if (old_x >= 0 && old_x < old_counts.x) {
+                DP_Tile *tile = old_row->elements[old_x].tile;
+                if (tile) {
+                    get_transient_row(tlc, y)->elements[x].tile =
+                        DP_tile_incref(tile);
+                }
+            }
         }
     }
     tlc->sub.contents = DP_layer_list_new();
@@ -1489,51 +1809,182 @@ resize_layer_content_aligned(DP_LayerContent *lc, int top, int left, int width,
     return tlc;
 }
 
-static void calculate_resize_offsets(int offset, int *out_pos, int *out_crop)
-{
-    if (offset < 0) {
-        *out_pos = 0;
-        *out_crop = -offset;
+struct DP_ResizeCopy {
+    DP_LayerContent *lc;
+    DP_TransientLayerContent *tlc;
+    unsigned int context_id;
+    int top, left;
+    DP_Pixel8 **buffers;
+};
+
+struct DP_ResizeCopyJob {
+    struct DP_ResizeCopy *rc;
+    int y;
+};
+
+// Copies the rows of a single source tile that land in the given destination
+// tile. The source area has already been clipped to the old layer bounds.
+static void resize_copy_source_tile(DP_Tile *t, DP_Pixel15 *dst, int src_x,
+                                    int src_y, int dst_x, int dst_y, int width,
+                                    int height)
+{
+    const DP_Pixel15 *src = DP_tile_pixels_acquire(t);
+    size_t row_bytes = DP_int_to_size(width) * sizeof(*dst);
+    for (int i = 0; i < height; ++i) {
+        memcpy(dst + (dst_y + i) * DP_TILE_SIZE + dst_x,
+               src + (src_y + i) * DP_TILE_SIZE + src_x, row_bytes);
+    }
+    DP_tile_pixels_release(t);
+}
+
+// Assembles one destination tile from the up to four source tiles it overlaps.
+// The result is rounded to 8 bits per channel, since that's what going through
+// an intermediate image used to do and clients have to agree on the pixels.
+static DP_Tile *resize_copy_tile(struct DP_ResizeCopy *rc, DP_Pixel8 *buffer,
+                                 int x, int y)
+{
+    DP_LayerContent *lc = rc->lc;
+    DP_TransientLayerContent *tlc = rc->tlc;
+    int dst_x = x * DP_TILE_SIZE;
+    int dst_y = y * DP_TILE_SIZE;
+    int src_left = dst_x - rc->left;
+    int src_top = dst_y - rc->top;
+    int src_right =
+        DP_min_int(src_left + DP_min_int(DP_TILE_SIZE, tlc->width - dst_x),
+                   lc->width);
+    int src_bottom =
+        DP_min_int(src_top + DP_min_int(DP_TILE_SIZE, tlc->height - dst_y),
+                   lc->height);
+    int clip_left = DP_max_int(src_left, 0);
+    int clip_top = DP_max_int(src_top, 0);
+    if (clip_left >= src_right || clip_top >= src_bottom) {
+        return NULL;
+    }
+
+    DP_TransientTile *tt = NULL;
+    DP_Pixel15 *pixels = NULL;
+    for (int sy = clip_top; sy < src_bottom;) {
+        int sy_end = DP_min_int((sy / DP_TILE_SIZE + 1) * DP_TILE_SIZE,
+                                src_bottom);
+        for (int sx = clip_left; sx < src_right;) {
+            int sx_end = DP_min_int((sx / DP_TILE_SIZE + 1) * DP_TILE_SIZE,
+                                    src_right);
+            DP_Tile *t = tile_at(lc, sx / DP_TILE_SIZE, sy / DP_TILE_SIZE);
+            if (t) {
+                if (!tt) {
+                    tt = DP_transient_tile_new_blank(rc->context_id);
+                    pixels = DP_transient_tile_pixels(tt);
+                }
+                resize_copy_source_tile(t, pixels, sx % DP_TILE_SIZE,
+                                        sy % DP_TILE_SIZE, sx - src_left,
+                                        sy - src_top, sx_end - sx,
+                                        sy_end - sy);
+            }
+            sx = sx_end;
+        }
+        sy = sy_end;
+    }
+
+    if (tt) {
+        DP_pixels15_to_8_tile(buffer, pixels);
+        DP_pixels8_to_15(pixels, buffer, DP_TILE_LENGTH);
+        if (DP_transient_tile_blank(tt)) {
+            DP_transient_tile_decref(tt);
+            return NULL;
+        }
+        else {
+            return DP_transient_tile_persist(tt);
+        }
     }
     else {
-        *out_pos = offset;
-        *out_crop = 0;
+        return NULL;
     }
 }
 
+static void resize_copy_row(struct DP_ResizeCopy *rc, DP_Pixel8 *buffer, int y)
+{
+    DP_TransientLayerContent *tlc = rc->tlc;
+    int xtiles = DP_tile_count_round(tlc->width);
+    for (int x = 0; x < xtiles; ++x) {
+        DP_Tile *t = resize_copy_tile(rc, buffer, x, y);
+        if (t) {
+            get_transient_row(tlc, y)->elements[x].tile = t;
+        }
+    }
+}
+
+static void resize_copy_row_job(void *element, int thread_index)
+{
+    struct DP_ResizeCopyJob *job = element;
+    struct DP_ResizeCopy *rc = job->rc;
+    resize_copy_row(rc, rc->buffers[thread_index], job->y);
+}
+
+// Copies the tile rows on a temporary worker, they don't depend on each other.
+// Returns false if it's not worth it or no worker could be created, in which
+// case the caller should copy the rows itself.
+static bool resize_copy_rows_parallel(struct DP_ResizeCopy *rc, int ytiles,
+                                      int tile_count)
+{
+    if (tile_count < RESIZE_PARALLEL_MIN_TILES) {
+        return false;
+    }
+
+    int thread_count =
+        DP_worker_cpu_count(DP_min_int(ytiles, RESIZE_PARALLEL_MAX_THREADS));
+    if (thread_count < 2) {
+        return false;
+    }
+
+    DP_Worker *worker =
+        DP_worker_new(DP_int_to_size(ytiles), sizeof(struct DP_ResizeCopyJob),
+                      thread_count, resize_copy_row_job);
+    if (!worker) {
+        DP_warn("Layer resize failed to create worker: %s", DP_error());
+        return false;
+    }
+
+    DP_Pixel8 **buffers =
+        DP_malloc(sizeof(*buffers) * DP_int_to_size(thread_count));
+    for (int i = 0; i < thread_count; ++i) {
+        buffers[i] = DP_malloc_simd(sizeof(**buffers) * DP_TILE_LENGTH);
+    }
+    rc->buffers = buffers;
+
+    for (int y = 0; y < ytiles; ++y) {
+        struct DP_ResizeCopyJob job = {rc, y};
+        DP_worker_push(worker, &job);
+    }
+    DP_worker_free_join(worker);
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_free_simd(buffers[i]);
+    }
+    DP_free(buffers);
+    return true;
+}
+
 static DP_TransientLayerContent *
 resize_layer_content_copy(DP_LayerContent *lc, unsigned int context_id, int top,
                           int left, int width, int height)
 {
-    // TODO: This operation is super expensive and obliterates change
-    // information. It could be solved by storing an x and y pixel offset in the
-    // layer instead. Need more functionality to test that out though.
-    DP_Image *img = DP_layer_content_to_image(lc);
+    // Shifts the pixels over directly from the old tiles, rather than going
+    // through a whole intermediate image. Destination tiles that don't overlap
+    // any old tiles with content remain null.
+    DP_TransientLayerContent *tlc = alloc_layer_content(width, height);
+    tlc->sub.contents = DP_layer_list_new();
+    tlc->sub.props = DP_layer_props_list_new();
 
-    int x, y, crop_x, crop_y;
-    calculate_resize_offsets(left, &x, &crop_x);
-    calculate_resize_offsets(top, &y, &crop_y);
-    if (crop_x != 0 || crop_y != 0) {
-        int img_width = DP_image_width(img);
-        int img_height = DP_image_height(img);
-        if (crop_x < img_width && crop_y < img_height) {
-            DP_Image *tmp = DP_image_new_subimage(
-                img, crop_x, crop_y, img_width - crop_x, img_height - crop_y);
-            DP_image_free(img);
-            img = tmp;
-        }
-        else { // Nothing to do, resulting image is out of bounds.
-            DP_image_free(img);
-            return DP_transient_layer_content_new_init(width, height, NULL);
+    DP_TileCounts tile_counts = DP_tile_counts_round(width, height);
+    struct DP_ResizeCopy rc = {lc, tlc, context_id, top, left, NULL};
+    if (!resize_copy_rows_parallel(&rc, tile_counts.y,
+                                   tile_counts.x * tile_counts.y)) {
+        DP_Pixel8 *buffer = DP_malloc_simd(sizeof(*buffer) * DP_TILE_LENGTH);
+        for (int y = 0; y < tile_counts.y; ++y) {
+            resize_copy_row(&rc, buffer, y);
         }
+        DP_free_simd(buffer);
     }
-
-    DP_TransientLayerContent *tlc =
-        DP_transient_layer_content_new_init(width, height, NULL);
-    DP_transient_layer_content_put_image(tlc, context_id, DP_BLEND_MODE_REPLACE,
-                                         x, y, img);
-    DP_image_free(img);
-
     return tlc;
 }
 
@@ -1631,10 +2082,12 @@ DP_TransientLayerContent *DP_transient_layer_content_new(DP_LayerContent *lc)
     int width = lc->width;
     int height = lc->height;
     DP_TransientLayerContent *tlc = alloc_layer_content(width, height);
-    int count = DP_tile_total_round(width, height);
-    for (int i = 0; i < count; ++i) {
-        tlc->elements[i].tile = DP_tile_incref_nullable(lc->elements[i].tile);
+    int ytiles = DP_tile_count_round(height);
+    for (int y = 0; y < ytiles; ++y) {
+        tlc->rows[y] = row_incref_nullable(lc->rows[y]);
     }
+    tlc->serial = lc->serial;
+    tlc->journal = journal_incref_nullable(lc->journal);
     tlc->mask = DP_layer_content_incref_nullable(lc->mask);
     tlc->sub.contents = DP_layer_list_incref(lc->sub.contents);
     tlc->sub.props = DP_layer_props_list_incref(lc->sub.props);
@@ -1649,20 +2102,26 @@ DP_transient_layer_content_new_transient(DP_TransientLayerContent *tlc)
     int width = tlc->width;
     int height = tlc->height;
     DP_TransientLayerContent *new_tlc = alloc_layer_content(width, height);
-    int count = DP_tile_total_round(width, height);
-    for (int i = 0; i < count; ++i) {
-        DP_Tile *t = tlc->elements[i].tile;
-        if (t) {
-            if (DP_tile_transient(t)) {
-                new_tlc->elements[i].transient_tile =
-                    DP_transient_tile_new_transient((DP_TransientTile *)t, 0);
-            }
-            else {
-                new_tlc->elements[i].tile = DP_tile_incref(t);
+    DP_TileCounts tile_counts = DP_tile_counts_round(width, height);
+    for (int y = 0; y < tile_counts.y; ++y) {
+        DP_LayerContentRow *row = tlc->rows[y];
+        if (row && row->transient) {
+            DP_LayerContentRow *new_row = row_new(tile_counts.x);
+            for (int x = 0; x < tile_counts.x; ++x) {
+                DP_Tile *t = row->elements[x].tile;
+                if (t && DP_tile_transient(t)) {
+                    new_row->elements[x].transient_tile =
+                        DP_transient_tile_new_transient((DP_TransientTile *)t,
+                                                        0);
+                }
+                else {
+                    new_row->elements[x].tile = DP_tile_incref_nullable(t);
+                }
             }
+            new_tlc->rows[y] = new_row;
         }
         else {
-            new_tlc->elements[i].tile = NULL;
+            new_tlc->rows[y] = row_incref_nullable(row);
         }
     }
     new_tlc->mask = DP_layer_content_incref_nullable(tlc->mask);
@@ -1689,10 +2148,14 @@ DP_transient_layer_content_new_init_with_transient_sublayers_noinc(
     DP_ASSERT(sub_tll);
     DP_ASSERT(sub_tlpl);
     DP_TransientLayerContent *tlc = alloc_layer_content(width, height);
-    int tile_count = DP_tile_total_round(width, height);
-    DP_tile_incref_by_nullable(tile, tile_count);
-    for (int i = 0; i < tile_count; ++i) {
-        tlc->elements[i].tile = tile;
+    DP_TileCounts tile_counts = DP_tile_counts_round(width, height);
+    if (tile && tile_counts.x != 0 && tile_counts.y != 0) {
+        // All rows are the same, so they can share a single one.
+        DP_LayerContentRow *row =
+            row_new_filled(tile, tile_counts.x, tile_counts.y);
+        for (int y = 0; y < tile_counts.y; ++y) {
+            tlc->rows[y] = row;
+        }
     }
     tlc->sub.transient_contents = sub_tll;
     tlc->sub.transient_props = sub_tlpl;
@@ -1742,24 +2205,49 @@ int DP_transient_layer_content_refcount(DP_TransientLayerContent *tlc)
 static DP_LayerContent *persist_with(DP_TransientLayerContent *tlc, bool mask)
 {
     tlc->transient = false;
-    int count = DP_tile_total_round(tlc->width, tlc->height);
-    for (int i = 0; i < count; ++i) {
-        DP_Tile *tile = tlc->elements[i].tile;
-        if (tile && DP_tile_transient(tile)) {
-            DP_TransientTile *tt = tlc->elements[i].transient_tile;
-            if (DP_transient_tile_blank(tt)) {
-                DP_transient_tile_decref(tt);
-                tlc->elements[i].transient_tile = NULL;
-            }
-            else if (mask && DP_transient_tile_opaque(tt)) {
-                DP_transient_tile_decref(tt);
-                tlc->elements[i].tile = DP_tile_opaque_inc();
+    DP_LayerContentJournalBuilder jb = journal_begin(tlc);
+    DP_TileCounts tile_counts = DP_tile_counts_round(tlc->width, tlc->height);
+    for (int y = 0; y < tile_counts.y; ++y) {
+        // Persistent rows can't contain any transient tiles, skip them.
+        DP_LayerContentRow *row = tlc->rows[y];
+        if (!row || !row->transient) {
+            continue;
+        }
+
+        bool empty = true;
+        for (int x = 0; x < tile_counts.x; ++x) {
+            DP_LayerContentElement *element = &row->elements[x];
+            DP_Tile *tile = element->tile;
+            if (tile && DP_tile_transient(tile)) {
+                journal_push(&jb, y * tile_counts.x + x);
+                DP_TransientTile *tt = element->transient_tile;
+                if (DP_transient_tile_blank(tt)) {
+                    DP_transient_tile_decref(tt);
+                    element->transient_tile = NULL;
+                }
+                else if (mask && DP_transient_tile_opaque(tt)) {
+                    DP_transient_tile_decref(tt);
+                    element->tile = DP_tile_opaque_inc();
+                }
+                else {
+                    element->tile =
+                        DP_tile_intern(DP_transient_tile_persist(tt));
+                }
             }
-            else {
-                DP_transient_tile_persist(tt);
+            if (element->tile) {
+                empty = false;
             }
         }
+
+        if (empty) {
+            DP_free(row);
+            tlc->rows[y] = NULL;
+        }
+        else {
+            row->transient = false;
+        }
     }
+    journal_end(&jb, tlc);
     if (tlc->mask && DP_layer_content_transient(tlc->mask)) {
         persist_with(tlc->transient_mask, true);
     }
@@ -1832,8 +2320,9 @@ void DP_transient_layer_content_transient_tile_at_set_noinc(
     DP_ASSERT(DP_atomic_get(&tlc->refcount) > 0);
     DP_ASSERT(tlc->transient);
     int i = y * DP_tile_count_round(tlc->width) + x;
-    DP_tile_decref_nullable(tlc->elements[i].tile);
-    tlc->elements[i].transient_tile = tt;
+    DP_LayerContentElement *element = get_transient_element(tlc, i);
+    DP_tile_decref_nullable(element->tile);
+    element->transient_tile = tt;
 }
 
 DP_LayerContent *
@@ -1934,9 +2423,9 @@ static DP_TransientTile *create_transient_tile(DP_TransientLayerContent *tlc,
     DP_ASSERT(tlc->transient);
     DP_ASSERT(i >= 0);
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
-    DP_ASSERT(!tlc->elements[i].tile);
+    DP_ASSERT(!tile_at_index((DP_LayerContent *)tlc, i));
     DP_TransientTile *tt = DP_transient_tile_new_blank(context_id);
-    tlc->elements[i].transient_tile = tt;
+    get_transient_element(tlc, i)->transient_tile = tt;
     return tt;
 }
 
@@ -1967,6 +2456,126 @@ static DP_TransientTile *merge_tile(DP_TransientTile *DP_RESTRICT tt,
     }
 }
 
+// Merging a tile that's entirely transparent doesn't change anything. The
+// cached alpha bounds rule out almost all tiles with content for free, only
+// tiles that look empty get their pixels checked for sure.
+static bool merge_source_blank(DP_Tile *t)
+{
+    return !DP_rect_valid(DP_tile_alpha_bounds(t, DP_TILE_SIZE, DP_TILE_SIZE))
+        && DP_tile_blank(t);
+}
+
+struct DP_LayerContentMerge {
+    DP_TransientLayerContent *tlc;
+    unsigned int context_id;
+    DP_LayerContent *lc;
+    DP_TileCounts tile_counts;
+    uint16_t opacity;
+    int blend_mode;
+    bool blend_blank;
+    DP_Tile *censor_tile;
+    DP_TransientTile **tmp_tts;
+};
+
+struct DP_LayerContentMergeJob {
+    struct DP_LayerContentMerge *m;
+    int y;
+};
+
+static DP_TransientTile *merge_tile_at(struct DP_LayerContentMerge *m,
+                                       DP_TransientTile *tmp_tt, int i)
+{
+    DP_LayerContent *lc = m->lc;
+    DP_Tile *t = tile_at_index(lc, i);
+    DP_Tile *mt;
+    if (t && get_mask_tile(lc->mask, i, &mt)
+        && (m->censor_tile || !merge_source_blank(t))) {
+        DP_TransientLayerContent *tlc = m->tlc;
+        DP_Tile *src = m->censor_tile ? m->censor_tile : t;
+        if (tile_at_index((DP_LayerContent *)tlc, i)) {
+            DP_TransientTile *tt = get_transient_tile(tlc, m->context_id, i);
+            DP_ASSERT((void *)tt != (void *)t);
+            tmp_tt = merge_tile(tt, src, mt, tmp_tt, m->opacity, m->blend_mode);
+        }
+        else if (m->blend_blank) {
+            // For blend modes like normal and behind, do regular blending.
+            DP_TransientTile *tt = create_transient_tile(tlc, m->context_id, i);
+            tmp_tt = merge_tile(tt, src, mt, tmp_tt, m->opacity, m->blend_mode);
+        }
+        else {
+            // For most other blend modes merging with transparent pixels
+            // doesn't do anything. For example erasing nothing or multiply
+            // with nothing just leads to more nothing. Skip the empty tile.
+        }
+    }
+    return tmp_tt;
+}
+
+static void merge_tiles_job(void *element, int thread_index)
+{
+    struct DP_LayerContentMergeJob *job = element;
+    struct DP_LayerContentMerge *m = job->m;
+    int xtiles = m->tile_counts.x;
+    int start = job->y * xtiles;
+    DP_TransientTile *tmp_tt = m->tmp_tts[thread_index];
+    for (int i = start; i < start + xtiles; ++i) {
+        tmp_tt = merge_tile_at(m, tmp_tt, i);
+    }
+    m->tmp_tts[thread_index] = tmp_tt;
+}
+
+// Merges each non-empty row of the source on a temporary worker. Every row job
+// only touches its own row in the target, so they never share a row and can
+// copy it on write without stepping on each other. Returns false if it's not
+// worth it or no worker could be created, in which case the caller should
+// merge the tiles itself.
+static bool merge_tiles_parallel(struct DP_LayerContentMerge *m)
+{
+    DP_LayerContent *lc = m->lc;
+    int ytiles = m->tile_counts.y;
+    int job_count = 0;
+    for (int y = 0; y < ytiles; ++y) {
+        if (lc->rows[y]) {
+            ++job_count;
+        }
+    }
+
+    if (job_count * m->tile_counts.x < MERGE_PARALLEL_MIN_TILES) {
+        return false;
+    }
+
+    int thread_count =
+        DP_worker_cpu_count(DP_min_int(job_count, MERGE_PARALLEL_MAX_THREADS));
+    if (thread_count < 2) {
+        return false;
+    }
+
+    DP_Worker *worker = DP_worker_new(DP_int_to_size(job_count),
+                                      sizeof(struct DP_LayerContentMergeJob),
+                                      thread_count, merge_tiles_job);
+    if (!worker) {
+        DP_warn("Layer merge failed to create worker: %s", DP_error());
+        return false;
+    }
+
+    size_t tmp_tts_size = sizeof(*m->tmp_tts) * DP_int_to_size(thread_count);
+    m->tmp_tts = DP_malloc_zeroed(tmp_tts_size);
+
+    for (int y = 0; y < ytiles; ++y) {
+        if (lc->rows[y]) {
+            struct DP_LayerContentMergeJob job = {m, y};
+            DP_worker_push(worker, &job);
+        }
+    }
+    DP_worker_free_join(worker);
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_transient_tile_decref_nullable(m->tmp_tts[i]);
+    }
+    DP_free(m->tmp_tts);
+    return true;
+}
+
 void DP_transient_layer_content_merge(DP_TransientLayerContent *tlc,
                                       unsigned int context_id,
                                       DP_LayerContent *lc, uint16_t opacity,
@@ -1979,36 +2588,30 @@ void DP_transient_layer_content_merge(DP_TransientLayerContent *tlc,
     DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
     DP_ASSERT(tlc->width == lc->width);
     DP_ASSERT(tlc->height == lc->height);
-    int count = DP_tile_total_round(lc->width, lc->height);
-    bool blend_blank = can_blend_blank(blend_mode, opacity);
-    DP_Tile *censor_tile = censored ? DP_tile_censored_noinc() : NULL;
-    DP_LayerContent *mask = lc->mask;
-    DP_TransientTile *tmp_tt = NULL;
-    for (int i = 0; i < count; ++i) {
-        DP_Tile *t = lc->elements[i].tile;
-        DP_Tile *mt;
-        if (t && get_mask_tile(mask, i, &mt)) {
-            if (tlc->elements[i].tile) {
-                DP_TransientTile *tt = get_transient_tile(tlc, context_id, i);
-                DP_ASSERT((void *)tt != (void *)t);
-                tmp_tt = merge_tile(tt, censored ? censor_tile : t, mt, tmp_tt,
-                                    opacity, blend_mode);
-            }
-            else if (blend_blank) {
-                // For blend modes like normal and behind, do regular blending.
-                DP_TransientTile *tt =
-                    create_transient_tile(tlc, context_id, i);
-                tmp_tt = merge_tile(tt, censored ? censor_tile : t, mt, tmp_tt,
-                                    opacity, blend_mode);
-            }
-            else {
-                // For most other blend modes merging with transparent pixels
-                // doesn't do anything. For example erasing nothing or multiply
-                // with nothing just leads to more nothing. Skip the empty tile.
+    DP_TileCounts tile_counts = DP_tile_counts_round(lc->width, lc->height);
+    struct DP_LayerContentMerge m = {
+        tlc,
+        context_id,
+        lc,
+        tile_counts,
+        opacity,
+        blend_mode,
+        can_blend_blank(blend_mode, opacity),
+        censored ? DP_tile_censored_noinc() : NULL,
+        NULL,
+    };
+    if (!merge_tiles_parallel(&m)) {
+        DP_TransientTile *tmp_tt = NULL;
+        for (int y = 0; y < tile_counts.y; ++y) {
+            if (lc->rows[y]) {
+                int start = y * tile_counts.x;
+                for (int i = start; i < start + tile_counts.x; ++i) {
+                    tmp_tt = merge_tile_at(&m, tmp_tt, i);
+                }
             }
         }
+        DP_transient_tile_decref_nullable(tmp_tt);
     }
-    DP_transient_tile_decref_nullable(tmp_tt);
 }
 
 
@@ -2139,7 +2742,8 @@ void DP_transient_layer_content_put_pixels(DP_TransientLayerContent *tlc,
 
     while (DP_tile_iterator_next(&ti)) {
         int i = ti.row * wt + ti.col;
-        if (tlc->elements[i].tile || DP_blend_mode_blend_blank(blend_mode)) {
+        if (tile_at_index((DP_LayerContent *)tlc, i)
+            || DP_blend_mode_blend_blank(blend_mode)) {
             DP_TileIntoDstIterator tidi = DP_tile_into_dst_iterator_make(&ti);
             DP_TransientTile *tt = NULL;
             while (DP_tile_into_dst_iterator_next(&tidi)) {
@@ -2232,12 +2836,11 @@ static void fill_rect(DP_TransientLayerContent *tlc, unsigned int context_id,
             int i = ty * xtiles + tx;
 
             DP_TransientTile *tt;
-            if (tlc->elements[i].tile) {
+            if (tile_at_index((DP_LayerContent *)tlc, i)) {
                 tt = get_or_create_transient_tile(tlc, context_id, i);
             }
             else if (blend_blank) {
-                tt = DP_transient_tile_new_blank(context_id);
-                tlc->elements[i].transient_tile = tt;
+                tt = create_transient_tile(tlc, context_id, i);
             }
             else {
                 continue; // Nothing to do on a blank tile.
@@ -2256,12 +2859,17 @@ static void fill_entirely(DP_TransientLayerContent *tld,
         blend_mode == DP_BLEND_MODE_REPLACE
         || (blend_mode == DP_BLEND_MODE_NORMAL && pixel.a == DP_BIT15);
     if (is_replacement) {
+        DP_TileCounts tile_counts =
+            DP_tile_counts_round(tld->width, tld->height);
         DP_Tile *tile = DP_tile_new_from_upixel15(context_id, pixel);
-        int tile_count = DP_tile_total_round(tld->width, tld->height);
-        DP_tile_incref_by(tile, tile_count - 1);
-        for (int i = 0; i < tile_count; ++i) {
-            DP_tile_decref_nullable(tld->elements[i].tile);
-            tld->elements[i].tile = tile;
+        // Every row ends up the same, so they can all share a single one.
+        DP_LayerContentRow *row =
+            row_new_filled(tile, tile_counts.x, tile_counts.y);
+        DP_tile_decref(tile);
+        journal_forget(tld);
+        for (int y = 0; y < tile_counts.y; ++y) {
+            row_decref_nullable(tld->rows[y], tile_counts.x);
+            tld->rows[y] = row;
         }
     }
     else {
@@ -2294,8 +2902,10 @@ void DP_transient_layer_content_tile_set_noinc(DP_TransientLayerContent *tlc,
     DP_ASSERT(DP_atomic_get(&tlc->refcount) > 0);
     DP_ASSERT(tlc->transient);
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
-    DP_tile_decref_nullable(tlc->elements[i].tile);
-    tlc->elements[i].tile = t;
+    journal_forget(tlc);
+    DP_LayerContentElement *element = get_transient_element(tlc, i);
+    DP_tile_decref_nullable(element->tile);
+    element->tile = t;
 }
 
 void DP_transient_layer_content_transient_tile_set_noinc(
@@ -2305,8 +2915,9 @@ void DP_transient_layer_content_transient_tile_set_noinc(
     DP_ASSERT(DP_atomic_get(&tlc->refcount) > 0);
     DP_ASSERT(tlc->transient);
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
-    DP_tile_decref_nullable(tlc->elements[i].tile);
-    tlc->elements[i].transient_tile = tt;
+    DP_LayerContentElement *element = get_transient_element(tlc, i);
+    DP_tile_decref_nullable(element->tile);
+    element->transient_tile = tt;
 }
 
 void DP_transient_layer_content_put_tile_inc(DP_TransientLayerContent *tlc,
@@ -2329,9 +2940,11 @@ void DP_transient_layer_content_put_tile_inc(DP_TransientLayerContent *tlc,
     }
 
     DP_tile_incref_by(tile, end - start);
+    journal_forget(tlc);
     for (int i = start; i < end; ++i) {
-        DP_tile_decref_nullable(tlc->elements[i].tile);
-        tlc->elements[i].tile = tile;
+        DP_LayerContentElement *element = get_transient_element(tlc, i);
+        DP_tile_decref_nullable(element->tile);
+        element->tile = tile;
     }
 }
 
@@ -2384,7 +2997,7 @@ static void apply_brush_stamp_with(DP_TransientLayerContent *tlc,
             xb = xb + wb;
 
             DP_TransientTile *tt;
-            if (tlc->elements[i].tile) {
+            if (tile_at_index((DP_LayerContent *)tlc, i)) {
                 tt = get_transient_tile(tlc, context_id, i);
             }
             else if (blend_blank) {
@@ -2556,11 +3169,12 @@ DP_transient_layer_content_render_tile(DP_TransientLayerContent *tlc,
     DP_ASSERT(cs);
     DP_ASSERT(tile_index >= 0);
     DP_ASSERT(tile_index < DP_tile_total_round(tlc->width, tlc->height));
-    DP_tile_decref_nullable(tlc->elements[tile_index].tile);
+    DP_LayerContentElement *element = get_transient_element(tlc, tile_index);
+    DP_tile_decref_nullable(element->tile);
     DP_ViewModeFilter vmf =
         vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default();
     DP_TransientTile *tt = DP_canvas_state_flatten_tile(
         cs, tile_index, DP_FLAT_IMAGE_RENDER_FLAGS, &vmf);
-    tlc->elements[tile_index].transient_tile = tt;
+    element->transient_tile = tt;
     return tt;
 }
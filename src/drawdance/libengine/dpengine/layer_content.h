@@ -155,6 +155,11 @@ DP_LayerContent *DP_layer_content_merge_sublayers(DP_LayerContent *lc);
 DP_Tile *DP_layer_content_flatten_tile(DP_LayerContent *lc, int tile_index,
                                        bool censored, bool include_sublayers);
 
+// Whether the flattened tile at the given index is fully opaque. Tiles that
+// need sublayers or a partial mask applied first are considered not opaque.
+bool DP_layer_content_tile_opaque(DP_LayerContent *lc, int tile_index,
+                                  bool include_sublayers);
+
 DP_TransientTile *
 DP_layer_content_flatten_tile_to(DP_LayerContent *lc, int tile_index,
                                  DP_TransientTile *tt_or_null, uint16_t opacity,
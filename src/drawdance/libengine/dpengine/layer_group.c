@@ -32,6 +32,34 @@
 #include <dpcommon/geom.h>
 #include <dpmsg/blend_mode.h>
 
+// Groups with fewer children than this aren't worth caching, flattening them
+// is barely more work than merging the cached tile would be.
+#define TILE_CACHE_MIN_CHILDREN 2
+
+// Upper bound on flattened tiles held by all group caches together, which is
+// 64 MiB worth of pixels. Caches are dropped when their group gets replaced
+// in the current canvas state, but groups kept alive by undo history or
+// snapshots may still hang onto theirs for a while, so this keeps them from
+// piling up. When it's exhausted, groups are just flattened without caching.
+#define TILE_CACHE_MAX_TILES 2048
+
+static DP_Atomic tile_cache_total = DP_ATOMIC_INIT(0);
+
+
+typedef struct DP_LayerGroupTileCacheEntry {
+    bool cached;
+    DP_Tile *tile;
+} DP_LayerGroupTileCacheEntry;
+
+// Flattened tiles of an isolated group's children, as rendered for the given
+// child props list with sublayers included and everything visible. The group
+// itself is immutable once persisted, so those are the only other inputs.
+typedef struct DP_LayerGroupTileCache {
+    DP_LayerPropsList *lpl;
+    int count;
+    int tile_count;
+    DP_LayerGroupTileCacheEntry entries[];
+} DP_LayerGroupTileCache;
 
 #ifdef DP_NO_STRICT_ALIASING
 
@@ -40,6 +68,8 @@ struct DP_LayerGroup {
     const bool transient;
     const int width, height;
     DP_LayerList *const children;
+    DP_Atomic cache_lock;
+    DP_LayerGroupTileCache *cache;
 };
 
 struct DP_TransientLayerGroup {
@@ -50,6 +80,8 @@ struct DP_TransientLayerGroup {
         DP_LayerList *children;
         DP_TransientLayerList *transient_children;
     };
+    DP_Atomic cache_lock;
+    DP_LayerGroupTileCache *cache;
 };
 
 #else
@@ -62,11 +94,102 @@ struct DP_LayerGroup {
         DP_LayerList *children;
         DP_TransientLayerList *transient_children;
     };
+    DP_Atomic cache_lock;
+    DP_LayerGroupTileCache *cache;
 };
 
 #endif
 
 
+static void tile_cache_free(DP_LayerGroupTileCache *cache_or_null)
+{
+    if (cache_or_null) {
+        int count = cache_or_null->count;
+        for (int i = 0; i < count; ++i) {
+            DP_tile_decref_nullable(cache_or_null->entries[i].tile);
+        }
+        DP_atomic_add(&tile_cache_total, -cache_or_null->tile_count);
+        DP_layer_props_list_decref(cache_or_null->lpl);
+        DP_free(cache_or_null);
+    }
+}
+
+static bool tile_cache_lookup(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                              int tile_index, DP_Tile **out_tile)
+{
+    bool found = false;
+    DP_atomic_lock(&lg->cache_lock);
+    DP_LayerGroupTileCache *cache = lg->cache;
+    if (cache && cache->lpl == lpl) {
+        DP_LayerGroupTileCacheEntry *entry = &cache->entries[tile_index];
+        if (entry->cached) {
+            *out_tile = DP_tile_incref_nullable(entry->tile);
+            found = true;
+        }
+    }
+    DP_atomic_unlock(&lg->cache_lock);
+    return found;
+}
+
+static void tile_cache_store(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                             int tile_index, DP_Tile *t_or_null)
+{
+    if (t_or_null
+        && DP_atomic_get(&tile_cache_total) >= TILE_CACHE_MAX_TILES) {
+        return;
+    }
+
+    DP_LayerGroupTileCache *fresh = NULL;
+    while (true) {
+        DP_LayerGroupTileCache *garbage = NULL;
+        DP_atomic_lock(&lg->cache_lock);
+        DP_LayerGroupTileCache *cache = lg->cache;
+        if (!cache || cache->lpl != lpl) {
+            if (fresh) {
+                // The children's props changed, everything in here is stale.
+                garbage = cache;
+                lg->cache = cache = fresh;
+                fresh = NULL;
+            }
+            else {
+                // Don't allocate while holding the spinlock, try again after.
+                DP_atomic_unlock(&lg->cache_lock);
+                int count = DP_tile_total_round(lg->width, lg->height);
+                fresh = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+                    DP_LayerGroupTileCache, entries, DP_int_to_size(count)));
+                fresh->lpl = DP_layer_props_list_incref(lpl);
+                fresh->count = count;
+                continue;
+            }
+        }
+
+        DP_LayerGroupTileCacheEntry *entry = &cache->entries[tile_index];
+        if (!entry->cached) {
+            entry->cached = true;
+            if (t_or_null) {
+                entry->tile = DP_tile_incref(t_or_null);
+                ++cache->tile_count;
+                DP_atomic_inc(&tile_cache_total);
+            }
+        }
+        DP_atomic_unlock(&lg->cache_lock);
+        tile_cache_free(garbage);
+        tile_cache_free(fresh);
+        return;
+    }
+}
+
+static void tile_cache_drop(DP_LayerGroup *lg)
+{
+    DP_atomic_lock(&lg->cache_lock);
+    DP_LayerGroupTileCache *cache = lg->cache;
+    lg->cache = NULL;
+    DP_atomic_unlock(&lg->cache_lock);
+    tile_cache_free(cache);
+}
+
+
+
 DP_LayerGroup *DP_layer_group_incref(DP_LayerGroup *lg)
 {
     DP_ASSERT(lg);
@@ -85,6 +208,7 @@ void DP_layer_group_decref(DP_LayerGroup *lg)
     DP_ASSERT(lg);
     DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
     if (DP_atomic_dec(&lg->refcount)) {
+        tile_cache_free(lg->cache);
         DP_layer_list_decref(lg->children);
         DP_free(lg);
     }
@@ -287,6 +411,7 @@ DP_TransientLayerGroup *DP_layer_group_resize(DP_LayerGroup *lg,
 {
     DP_ASSERT(lg);
     DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
+    tile_cache_drop(lg);
     int width = lg->width + left + right;
     int height = lg->height + top + bottom;
     DP_LayerList *ll = lg->children;
@@ -405,6 +530,66 @@ DP_TransientTile *DP_layer_group_flatten_tile(DP_LayerGroup *lg,
         &vmc);
 }
 
+bool DP_layer_group_tile_cached(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                                int tile_index)
+{
+    DP_ASSERT(lg);
+    DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
+    DP_ASSERT(lpl);
+    DP_ASSERT(tile_index >= 0);
+    DP_ASSERT(tile_index < DP_tile_total_round(lg->width, lg->height));
+    DP_Tile *t;
+    if (tile_cache_lookup(lg, lpl, tile_index, &t)) {
+        DP_tile_decref_nullable(t);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static bool should_cache_tiles(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                               bool include_sublayers,
+                               const DP_ViewModeResult *vmr)
+{
+    return !lg->transient && !DP_layer_props_list_transient(lpl)
+        && include_sublayers && DP_view_mode_context_normal(&vmr->child_vmc)
+        && DP_layer_list_count(lg->children) >= TILE_CACHE_MIN_CHILDREN;
+}
+
+static DP_TransientTile *merge_group_tile(DP_TransientTile *tt_or_null,
+                                          DP_Tile *gt_or_null,
+                                          const DP_ViewModeResult *vmr,
+                                          DP_UPixel8 parent_tint,
+                                          bool censored, bool clip)
+{
+    if (!gt_or_null) {
+        return tt_or_null;
+    }
+
+    DP_Tile *t;
+    DP_TransientTile *tinted = NULL;
+    if (censored) {
+        t = DP_tile_censored_noinc();
+    }
+    else if (vmr->tint.a != 0 || parent_tint.a != 0) {
+        // The cached tile is shared, so tint a copy of it instead.
+        tinted = DP_transient_tile_new(gt_or_null, 0);
+        DP_transient_tile_tint(tinted,
+                               vmr->tint.a != 0 ? vmr->tint : parent_tint);
+        t = (DP_Tile *)tinted;
+    }
+    else {
+        t = gt_or_null;
+    }
+
+    DP_TransientTile *tt = DP_transient_tile_merge_nullable(
+        tt_or_null, t, vmr->opacity, DP_blend_mode_clip(vmr->blend_mode, clip));
+    DP_transient_tile_decref_nullable(tinted);
+    DP_tile_decref(gt_or_null);
+    return tt;
+}
+
 DP_TransientTile *DP_layer_group_flatten_tile_to(
     DP_LayerGroup *lg, DP_LayerProps *lp, int tile_index,
     DP_TransientTile *tt_or_null, uint16_t parent_opacity,
@@ -426,7 +611,20 @@ DP_TransientTile *DP_layer_group_flatten_tile_to(
 
     DP_LayerPropsList *lpl = DP_layer_props_children_noinc(lp);
     bool censored = pass_through_censored || DP_layer_props_censored_any(lp);
-    if (vmr.isolated) {
+    if (vmr.isolated && should_cache_tiles(lg, lpl, include_sublayers, &vmr)) {
+        DP_Tile *gt;
+        if (!tile_cache_lookup(lg, lpl, tile_index, &gt)) {
+            DP_TransientTile *gtt = DP_layer_list_flatten_tile_to(
+                lg->children, lpl, tile_index, NULL, DP_BIT15,
+                (DP_UPixel8){.color = 0}, include_sublayers, false, false,
+                &vmr.child_vmc);
+            gt = gtt ? DP_transient_tile_persist(gtt) : NULL;
+            tile_cache_store(lg, lpl, tile_index, gt);
+        }
+        return merge_group_tile(tt_or_null, gt, &vmr, parent_tint, censored,
+                                clip);
+    }
+    else if (vmr.isolated) {
         // Flatten the group into a temporary layer with full opacity, then
         // merge the result with the group's blend mode and opacity.
         DP_TransientTile *gtt = DP_layer_list_flatten_tile_to(
@@ -525,7 +723,8 @@ static DP_TransientLayerGroup *alloc_layer_group(int width, int height)
 {
     DP_TransientLayerGroup *tlg = DP_malloc(sizeof(*tlg));
     *tlg = (DP_TransientLayerGroup){
-        DP_ATOMIC_INIT(1), true, width, height, {NULL}};
+        DP_ATOMIC_INIT(1), true, width, height, {NULL}, DP_ATOMIC_INIT(0),
+        NULL};
     return tlg;
 }
 
@@ -534,6 +733,8 @@ DP_TransientLayerGroup *DP_transient_layer_group_new(DP_LayerGroup *lg)
     DP_ASSERT(lg);
     DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
     DP_ASSERT(!lg->transient);
+    // The copy replaces this group, so its cache won't see any more use.
+    tile_cache_drop(lg);
     DP_TransientLayerGroup *tlg = alloc_layer_group(lg->width, lg->height);
     tlg->children = DP_layer_list_incref(lg->children);
     return tlg;
@@ -546,6 +747,7 @@ DP_transient_layer_group_new_with_children_noinc(DP_LayerGroup *lg,
     DP_ASSERT(lg);
     DP_ASSERT(DP_atomic_get(&lg->refcount) > 0);
     DP_ASSERT(!lg->transient);
+    tile_cache_drop(lg);
     DP_TransientLayerGroup *tlg = alloc_layer_group(lg->width, lg->height);
     tlg->transient_children = tll;
     return tlg;
@@ -36,6 +36,7 @@ typedef struct DP_TransientLayerContent DP_TransientLayerContent;
 typedef struct DP_LayerList DP_LayerList;
 typedef struct DP_TransientLayerList DP_TransientLayerList;
 typedef struct DP_LayerProps DP_LayerProps;
+typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_TransientTile DP_TransientTile;
 #else
 typedef struct DP_LayerGroup DP_LayerGroup;
@@ -44,6 +45,7 @@ typedef struct DP_LayerContent DP_TransientLayerContent;
 typedef struct DP_LayerList DP_LayerList;
 typedef struct DP_LayerList DP_TransientLayerList;
 typedef struct DP_LayerProps DP_LayerProps;
+typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_Tile DP_TransientTile;
 #endif
 
@@ -108,6 +110,11 @@ DP_TransientTile *DP_layer_group_flatten_tile_to(
     DP_UPixel8 parent_tint, bool include_sublayers, bool pass_through_censored,
     bool clip, const DP_ViewModeContext *vmc);
 
+// Whether the flattened children of the given isolated group tile are cached
+// for the given child props list. Only really interesting for tests.
+bool DP_layer_group_tile_cached(DP_LayerGroup *lg, DP_LayerPropsList *lpl,
+                                int tile_index);
+
 void DP_layer_group_flatten_pixel(DP_LayerGroup *lg, DP_LayerProps *lp, int x,
                                   int y, DP_Pixel15 *pixel,
                                   uint16_t parent_opacity,
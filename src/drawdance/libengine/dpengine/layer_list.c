@@ -43,20 +43,34 @@ struct DP_LayerListEntry {
     };
 };
 
+// Entries are stored in fixed-size chunks, so that a transient copy of a list
+// only has to copy the chunk pointers and changing a single entry only has to
+// copy the chunk it's in. See layer_props_list.c for the details, it works the
+// same way.
+#define CHUNK_SHIFT 5
+#define CHUNK_SIZE  (1 << CHUNK_SHIFT)
+#define CHUNK_MASK  (CHUNK_SIZE - 1)
+
+typedef struct DP_LayerListChunk {
+    DP_Atomic refcount;
+    bool transient;
+    DP_LayerListEntry elements[CHUNK_SIZE];
+} DP_LayerListChunk;
+
 #ifdef DP_NO_STRICT_ALIASING
 
 struct DP_LayerList {
     DP_Atomic refcount;
     const bool transient;
     const int count;
-    DP_LayerListEntry elements[];
+    DP_LayerListChunk *const chunks[];
 };
 
 struct DP_TransientLayerList {
     DP_Atomic refcount;
     bool transient;
     int count;
-    DP_LayerListEntry elements[];
+    DP_LayerListChunk *chunks[];
 };
 
 #else
@@ -65,7 +79,7 @@ struct DP_LayerList {
     DP_Atomic refcount;
     bool transient;
     int count;
-    DP_LayerListEntry elements[];
+    DP_LayerListChunk *chunks[];
 };
 
 #endif
@@ -130,16 +144,17 @@ int DP_layer_list_entry_height(DP_LayerListEntry *lle)
                          : DP_layer_content_height(lle->content);
 }
 
-static DP_LayerListEntry *layer_list_entry_incref(DP_LayerListEntry *lle)
+static DP_LayerListEntry
+layer_list_entry_incref_nullable(DP_LayerListEntry *lle)
 {
     DP_ASSERT(lle);
     if (lle->is_group) {
         DP_layer_group_incref(lle->group);
     }
     else {
-        DP_layer_content_incref(lle->content);
+        DP_layer_content_incref_nullable(lle->content);
     }
-    return lle;
+    return *lle;
 }
 
 static void layer_list_entry_decref(DP_LayerListEntry *lle)
@@ -165,11 +180,50 @@ static void layer_list_entry_decref_nullable(DP_LayerListEntry *lle)
 }
 
 
+static DP_LayerListChunk *chunk_new_blank(void)
+{
+    DP_LayerListChunk *chunk = DP_malloc(sizeof(*chunk));
+    DP_atomic_set(&chunk->refcount, 1);
+    chunk->transient = true;
+    for (int i = 0; i < CHUNK_SIZE; ++i) {
+        chunk->elements[i] = (DP_LayerListEntry){false, {NULL}};
+    }
+    return chunk;
+}
+
+static DP_LayerListChunk *chunk_incref(DP_LayerListChunk *chunk)
+{
+    DP_ASSERT(chunk);
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    DP_ASSERT(!chunk->transient);
+    DP_atomic_inc(&chunk->refcount);
+    return chunk;
+}
+
+static void chunk_decref(DP_LayerListChunk *chunk)
+{
+    DP_ASSERT(chunk);
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    if (DP_atomic_dec(&chunk->refcount)) {
+        for (int i = 0; i < CHUNK_SIZE; ++i) {
+            layer_list_entry_decref_nullable(&chunk->elements[i]);
+        }
+        DP_free(chunk);
+    }
+}
+
+static int chunk_count_for(int count)
+{
+    return (count + CHUNK_MASK) >> CHUNK_SHIFT;
+}
+
 static size_t layer_list_size(int count)
 {
-    return DP_FLEX_SIZEOF(DP_LayerList, elements, DP_int_to_size(count));
+    return DP_FLEX_SIZEOF(DP_LayerList, chunks,
+                          DP_int_to_size(chunk_count_for(count)));
 }
 
+// Chunks are left uninitialized, the caller has to fill them in.
 static void *allocate_layer_list(bool transient, int count)
 {
     DP_TransientLayerList *tll = DP_malloc(layer_list_size(count));
@@ -179,6 +233,61 @@ static void *allocate_layer_list(bool transient, int count)
     return tll;
 }
 
+static void fill_blank_chunks(DP_TransientLayerList *tll, int start)
+{
+    int chunk_count = chunk_count_for(tll->count);
+    for (int i = start; i < chunk_count; ++i) {
+        tll->chunks[i] = chunk_new_blank();
+    }
+}
+
+static DP_LayerListEntry *element_at(DP_LayerListChunk *const *chunks,
+                                     int index)
+{
+    return &chunks[index >> CHUNK_SHIFT]->elements[index & CHUNK_MASK];
+}
+
+static DP_LayerListChunk *get_transient_chunk(DP_TransientLayerList *tll,
+                                              int chunk_index)
+{
+    DP_LayerListChunk *chunk = tll->chunks[chunk_index];
+    if (chunk->transient) {
+        return chunk;
+    }
+    else if (DP_atomic_get(&chunk->refcount) == 1) {
+        // Nothing else is looking at this chunk, so it can be changed in place.
+        chunk->transient = true;
+        return chunk;
+    }
+    else {
+        DP_LayerListChunk *tchunk = chunk_new_blank();
+        for (int i = 0; i < CHUNK_SIZE; ++i) {
+            tchunk->elements[i] =
+                layer_list_entry_incref_nullable(&chunk->elements[i]);
+        }
+        chunk_decref(chunk);
+        tll->chunks[chunk_index] = tchunk;
+        return tchunk;
+    }
+}
+
+static DP_LayerListEntry *transient_element_at(DP_TransientLayerList *tll,
+                                               int index)
+{
+    DP_LayerListChunk *chunk = get_transient_chunk(tll, index >> CHUNK_SHIFT);
+    return &chunk->elements[index & CHUNK_MASK];
+}
+
+// Makes every chunk from the given entry index onwards transient, so that
+// entries can be shifted around between them freely.
+static void make_transient_from(DP_TransientLayerList *tll, int index)
+{
+    int chunk_count = chunk_count_for(tll->count);
+    for (int i = index >> CHUNK_SHIFT; i < chunk_count; ++i) {
+        get_transient_chunk(tll, i);
+    }
+}
+
 
 DP_LayerList *DP_layer_list_new(void)
 {
@@ -203,9 +312,9 @@ void DP_layer_list_decref(DP_LayerList *ll)
     DP_ASSERT(ll);
     DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
     if (DP_atomic_dec(&ll->refcount)) {
-        int count = ll->count;
-        for (int i = 0; i < count; ++i) {
-            layer_list_entry_decref_nullable(&ll->elements[i]);
+        int chunk_count = chunk_count_for(ll->count);
+        for (int i = 0; i < chunk_count; ++i) {
+            chunk_decref(ll->chunks[i]);
         }
         DP_free(ll);
     }
@@ -246,21 +355,22 @@ static void mark_layer_list_entry(DP_CanvasDiff *diff, DP_LayerListEntry *lle,
 
 static void diff_layers(DP_LayerList *ll, DP_LayerPropsList *lpl,
                         DP_LayerList *prev_ll, DP_LayerPropsList *prev_lpl,
-                        DP_CanvasDiff *diff, int only_layer_id, int count)
+                        DP_CanvasDiff *diff, int only_layer_id, int start,
+                        int end)
 {
     int clip = 0;
     int prev_clip = 0;
     bool on_pass_through = false;
     bool prev_on_pass_through = false;
-    for (int i = 0; i < count; ++i) {
-        DP_LayerListEntry *lle = &ll->elements[i];
+    for (int i = start; i < end; ++i) {
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
         bool is_group = lle->is_group;
-        DP_LayerListEntry *prev_lle = &prev_ll->elements[i];
+        DP_LayerListEntry *prev_lle = element_at(prev_ll->chunks, i);
         bool prev_is_group = prev_lle->is_group;
 
         DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
         DP_LayerProps *prev_lp = DP_layer_props_list_at_noinc(prev_lpl, i);
-        if (i != 0) {
+        if (i != start) {
             if (!on_pass_through && DP_layer_props_clip(lp)) {
                 ++clip;
             }
@@ -307,7 +417,7 @@ static void mark_layers(DP_LayerList *ll, DP_CanvasDiff *diff, int start,
                         int end)
 {
     for (int i = start; i < end; ++i) {
-        DP_LayerListEntry *lle = &ll->elements[i];
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
         if (lle->is_group) {
             DP_layer_group_diff_mark(lle->group, diff);
         }
@@ -332,18 +442,39 @@ void DP_layer_list_diff(DP_LayerList *ll, DP_LayerPropsList *lpl,
         int new_count = ll->count;
         int old_count = prev_ll->count;
         if (new_count <= old_count) {
-            diff_layers(ll, lpl, prev_ll, prev_lpl, diff, only_layer_id,
+            diff_layers(ll, lpl, prev_ll, prev_lpl, diff, only_layer_id, 0,
                         new_count);
             mark_layers(prev_ll, diff, new_count, old_count);
         }
         else {
-            diff_layers(ll, lpl, prev_ll, prev_lpl, diff, only_layer_id,
+            diff_layers(ll, lpl, prev_ll, prev_lpl, diff, only_layer_id, 0,
                         old_count);
             mark_layers(ll, diff, old_count, new_count);
         }
     }
 }
 
+void DP_layer_list_diff_range(DP_LayerList *ll, DP_LayerPropsList *lpl,
+                              DP_LayerList *prev_ll,
+                              DP_LayerPropsList *prev_lpl, DP_CanvasDiff *diff,
+                              int start, int end)
+{
+    DP_ASSERT(ll);
+    DP_ASSERT(lpl);
+    DP_ASSERT(prev_ll);
+    DP_ASSERT(prev_lpl);
+    DP_ASSERT(diff);
+    DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
+    DP_ASSERT(DP_atomic_get(&prev_ll->refcount) > 0);
+    DP_ASSERT(start >= 0);
+    DP_ASSERT(start <= end);
+    DP_ASSERT(end <= ll->count);
+    DP_ASSERT(end <= prev_ll->count);
+    if (ll != prev_ll || lpl != prev_lpl) {
+        diff_layers(ll, lpl, prev_ll, prev_lpl, diff, 0, start, end);
+    }
+}
+
 void DP_layer_list_diff_mark(DP_LayerList *ll, DP_CanvasDiff *diff)
 {
     DP_ASSERT(ll);
@@ -353,6 +484,99 @@ void DP_layer_list_diff_mark(DP_LayerList *ll, DP_CanvasDiff *diff)
 }
 
 
+static size_t count_unshared_content_tiles(DP_LayerContent *lc,
+                                           DP_LayerContent *other_or_null)
+{
+    if (lc == other_or_null) {
+        return 0;
+    }
+
+    int width = DP_layer_content_width(lc);
+    int height = DP_layer_content_height(lc);
+    DP_LayerContent *other =
+        other_or_null && DP_layer_content_width(other_or_null) == width
+                && DP_layer_content_height(other_or_null) == height
+            ? other_or_null
+            : NULL;
+
+    size_t count = 0;
+    int tile_count = DP_tile_total_round(width, height);
+    for (int i = 0; i < tile_count; ++i) {
+        DP_Tile *t = DP_layer_content_tile_at_index_noinc(lc, i);
+        if (t
+            && (!other || t != DP_layer_content_tile_at_index_noinc(other, i))) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static int search_other_index(DP_LayerPropsList *other_lpl_or_null, int index,
+                              int layer_id)
+{
+    if (other_lpl_or_null) {
+        // Usually the layer is in the same spot, so try that first.
+        if (index < DP_layer_props_list_count(other_lpl_or_null)
+            && DP_layer_props_id(
+                   DP_layer_props_list_at_noinc(other_lpl_or_null, index))
+                   == layer_id) {
+            return index;
+        }
+        else {
+            return DP_layer_props_list_index_by_id(other_lpl_or_null,
+                                                   layer_id);
+        }
+    }
+    else {
+        return -1;
+    }
+}
+
+size_t DP_layer_list_unshared_tile_count(DP_LayerList *ll,
+                                         DP_LayerPropsList *lpl,
+                                         DP_LayerList *other_ll_or_null,
+                                         DP_LayerPropsList *other_lpl_or_null)
+{
+    DP_ASSERT(ll);
+    DP_ASSERT(lpl);
+    DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
+    DP_ASSERT(!other_ll_or_null || other_lpl_or_null);
+    if (ll == other_ll_or_null) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < ll->count; ++i) {
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        int other_index = search_other_index(other_lpl_or_null, i,
+                                             DP_layer_props_id(lp));
+        DP_LayerListEntry *other_lle =
+            other_index < 0
+                ? NULL
+                : element_at(other_ll_or_null->chunks, other_index);
+        bool other_matches = other_lle && other_lle->is_group == lle->is_group;
+        if (lle->is_group) {
+            DP_LayerProps *other_lp =
+                other_matches ? DP_layer_props_list_at_noinc(other_lpl_or_null,
+                                                             other_index)
+                              : NULL;
+            count += DP_layer_list_unshared_tile_count(
+                DP_layer_group_children_noinc(lle->group),
+                DP_layer_props_children_noinc(lp),
+                other_lp ? DP_layer_group_children_noinc(other_lle->group)
+                         : NULL,
+                other_lp ? DP_layer_props_children_noinc(other_lp) : NULL);
+        }
+        else {
+            count += count_unshared_content_tiles(
+                lle->content, other_matches ? other_lle->content : NULL);
+        }
+    }
+    return count;
+}
+
+
 int DP_layer_list_count(DP_LayerList *ll)
 {
     DP_ASSERT(ll);
@@ -366,7 +590,7 @@ DP_LayerListEntry *DP_layer_list_at_noinc(DP_LayerList *ll, int index)
     DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < ll->count);
-    return &ll->elements[index];
+    return element_at(ll->chunks, index);
 }
 
 DP_LayerContent *DP_layer_list_content_at_noinc(DP_LayerList *ll, int index)
@@ -387,18 +611,19 @@ DP_TransientLayerList *DP_layer_list_resize(DP_LayerList *ll,
     DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
     int count = ll->count;
     DP_TransientLayerList *tll = allocate_layer_list(true, count);
+    fill_blank_chunks(tll, 0);
     for (int i = 0; i < count; ++i) {
-        DP_LayerListEntry *lle = &ll->elements[i];
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
         if (lle->is_group) {
             DP_TransientLayerGroup *tlg = DP_layer_group_resize(
                 lle->group, context_id, top, right, bottom, left);
-            tll->elements[i] =
+            *element_at(tll->chunks, i) =
                 (DP_LayerListEntry){true, {.transient_group = tlg}};
         }
         else {
             DP_TransientLayerContent *tlc = DP_layer_content_resize(
                 lle->content, context_id, top, right, bottom, left);
-            tll->elements[i] =
+            *element_at(tll->chunks, i) =
                 (DP_LayerListEntry){false, {.transient_content = tlc}};
         }
     }
@@ -472,7 +697,7 @@ static void layer_list_entry_merge_clipping_to_flat_image(
     bool include_sublayers, bool reveal_censored, bool pass_through_censored,
     bool clip)
 {
-    DP_LayerListEntry *lle = &ll->elements[i];
+    DP_LayerListEntry *lle = element_at(ll->chunks, i);
     DP_TransientLayerContent *clip_tlc = DP_transient_layer_content_new_init(
         DP_layer_list_entry_width(lle), DP_layer_list_entry_height(lle), NULL);
 
@@ -485,7 +710,7 @@ static void layer_list_entry_merge_clipping_to_flat_image(
 
     for (int j = 0; j < clip_count; ++j) {
         int clip_index = i + j + 1;
-        DP_LayerListEntry *clip_lle = &ll->elements[clip_index];
+        DP_LayerListEntry *clip_lle = element_at(ll->chunks, clip_index);
         DP_LayerProps *clip_lp = DP_layer_props_list_at_noinc(lpl, clip_index);
         layer_list_entry_merge_to_flat_image(clip_lle, clip_lp, clip_tlc,
                                              DP_BIT15, include_sublayers,
@@ -521,7 +746,7 @@ void DP_layer_list_merge_to_flat_image(DP_LayerList *ll, DP_LayerPropsList *lpl,
         if (DP_layer_props_visible(lp)) {
             if (clip_count == 0) {
                 layer_list_entry_merge_to_flat_image(
-                    &ll->elements[i], lp, tlc, parent_opacity,
+                    element_at(ll->chunks, i), lp, tlc, parent_opacity,
                     include_sublayers, reveal_censored, pass_through_censored,
                     clip);
             }
@@ -656,7 +881,7 @@ DP_TransientTile *DP_layer_list_flatten_tile_to(
     int count = ll->count;
     DP_TransientTile *tt = tt_or_null;
     for (int i = 0; i < count; ++i) {
-        DP_LayerListEntry *lle = &ll->elements[i];
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
         DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
         int clip_count = count_clipping_layers(lp, lpl, i, count);
         if (clip_count == 0) {
@@ -775,7 +1000,7 @@ void DP_layer_list_flatten_pixel(DP_LayerList *ll, DP_LayerPropsList *lpl,
     DP_ASSERT(vmc);
     int count = ll->count;
     for (int i = 0; i < count; ++i) {
-        DP_LayerListEntry *lle = &ll->elements[i];
+        DP_LayerListEntry *lle = element_at(ll->chunks, i);
         DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
         int clip_count = count_clipping_layers(lp, lpl, i, count);
         if (clip_count == 0) {
@@ -796,9 +1021,7 @@ void DP_layer_list_flatten_pixel(DP_LayerList *ll, DP_LayerPropsList *lpl,
 DP_TransientLayerList *DP_transient_layer_list_new_init(int reserve)
 {
     DP_TransientLayerList *tll = allocate_layer_list(true, reserve);
-    for (int i = 0; i < reserve; ++i) {
-        tll->elements[i] = (DP_LayerListEntry){false, {NULL}};
-    }
+    fill_blank_chunks(tll, 0);
     return tll;
 }
 
@@ -809,14 +1032,14 @@ DP_TransientLayerList *DP_transient_layer_list_new(DP_LayerList *ll,
     DP_ASSERT(DP_atomic_get(&ll->refcount) > 0);
     DP_ASSERT(!ll->transient);
     DP_ASSERT(reserve >= 0);
-    int count = ll->count;
-    DP_TransientLayerList *tll = allocate_layer_list(true, count + reserve);
-    for (int i = 0; i < count; ++i) {
-        tll->elements[i] = *layer_list_entry_incref(&ll->elements[i]);
-    }
-    for (int i = 0; i < reserve; ++i) {
-        tll->elements[count + i] = (DP_LayerListEntry){false, {NULL}};
+    DP_TransientLayerList *tll = allocate_layer_list(true, ll->count + reserve);
+    // The reserved entries past the end of a partial last chunk are already
+    // null, so that one can be shared too.
+    int chunk_count = chunk_count_for(ll->count);
+    for (int i = 0; i < chunk_count; ++i) {
+        tll->chunks[i] = chunk_incref(ll->chunks[i]);
     }
+    fill_blank_chunks(tll, chunk_count);
     return tll;
 }
 
@@ -829,13 +1052,11 @@ DP_transient_layer_list_reserve(DP_TransientLayerList *tll, int reserve)
     DP_ASSERT(reserve >= 0);
     DP_debug("Reserve %d elements in layer content list", reserve);
     if (reserve > 0) {
-        int old_count = tll->count;
-        int new_count = old_count + reserve;
+        int old_chunk_count = chunk_count_for(tll->count);
+        int new_count = tll->count + reserve;
         tll = DP_realloc(tll, layer_list_size(new_count));
         tll->count = new_count;
-        for (int i = old_count; i < new_count; ++i) {
-            tll->elements[i] = (DP_LayerListEntry){false, {NULL}};
-        }
+        fill_blank_chunks(tll, old_chunk_count);
     }
     return tll;
 }
@@ -872,20 +1093,31 @@ DP_LayerList *DP_transient_layer_list_persist(DP_TransientLayerList *tll)
     DP_ASSERT(tll->transient);
     tll->transient = false;
     int count = tll->count;
-    for (int i = 0; i < count; ++i) {
-        DP_LayerListEntry *lle = &tll->elements[i];
-        if (lle->is_group) {
-            DP_ASSERT(lle->group);
-            if (DP_layer_group_transient(lle->group)) {
-                DP_transient_layer_group_persist(lle->transient_group);
-            }
+    int chunk_count = chunk_count_for(count);
+    for (int i = 0; i < chunk_count; ++i) {
+        // Persistent chunks can't contain anything transient, skip them.
+        DP_LayerListChunk *chunk = tll->chunks[i];
+        if (!chunk->transient) {
+            continue;
         }
-        else {
-            DP_ASSERT(lle->content);
-            if (DP_layer_content_transient(lle->content)) {
-                DP_transient_layer_content_persist(lle->transient_content);
+
+        int end = DP_min_int(count - (i << CHUNK_SHIFT), CHUNK_SIZE);
+        for (int j = 0; j < end; ++j) {
+            DP_LayerListEntry *lle = &chunk->elements[j];
+            if (lle->is_group) {
+                DP_ASSERT(lle->group);
+                if (DP_layer_group_transient(lle->group)) {
+                    DP_transient_layer_group_persist(lle->transient_group);
+                }
+            }
+            else {
+                DP_ASSERT(lle->content);
+                if (DP_layer_content_transient(lle->content)) {
+                    DP_transient_layer_content_persist(lle->transient_content);
+                }
             }
         }
+        chunk->transient = false;
     }
     return (DP_LayerList *)tll;
 }
@@ -916,7 +1148,7 @@ DP_transient_layer_list_transient_content_at_noinc(DP_TransientLayerList *tll,
     DP_ASSERT(tll->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    DP_LayerListEntry *lle = &tll->elements[index];
+    DP_LayerListEntry *lle = transient_element_at(tll, index);
     DP_ASSERT(!lle->is_group);
     DP_LayerContent *lc = lle->content;
     if (!DP_layer_content_transient(lc)) {
@@ -935,7 +1167,7 @@ DP_transient_layer_list_transient_group_at_noinc(DP_TransientLayerList *tll,
     DP_ASSERT(tll->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    DP_LayerListEntry *lle = &tll->elements[index];
+    DP_LayerListEntry *lle = transient_element_at(tll, index);
     DP_ASSERT(lle->is_group);
     DP_LayerGroup *lg = lle->group;
     if (!DP_layer_group_transient(lg)) {
@@ -956,7 +1188,7 @@ DP_transient_layer_list_transient_group_at_with_children_noinc(
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
     DP_ASSERT(transient_children);
-    DP_LayerListEntry *lle = &tll->elements[index];
+    DP_LayerListEntry *lle = transient_element_at(tll, index);
     DP_ASSERT(lle->is_group);
     DP_LayerGroup *lg = lle->group;
     DP_ASSERT(!DP_layer_group_transient(lg));
@@ -973,9 +1205,10 @@ static void set_element_at(DP_TransientLayerList *tll, int index,
     DP_ASSERT(tll->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    DP_ASSERT(!tll->elements[index].is_group);
-    DP_ASSERT(!tll->elements[index].content);
-    tll->elements[index] = lle;
+    DP_LayerListEntry *element = transient_element_at(tll, index);
+    DP_ASSERT(!element->is_group);
+    DP_ASSERT(!element->content);
+    *element = lle;
 }
 
 void DP_transient_layer_list_set_content_noinc(DP_TransientLayerList *tll,
@@ -1027,13 +1260,15 @@ static void insert_element_at(DP_TransientLayerList *tll, int index,
     DP_ASSERT(tll);
     DP_ASSERT(DP_atomic_get(&tll->refcount) > 0);
     DP_ASSERT(tll->transient);
-    DP_ASSERT(!tll->elements[tll->count - 1].is_group);
-    DP_ASSERT(!tll->elements[tll->count - 1].content);
+    DP_ASSERT(!element_at(tll->chunks, tll->count - 1)->is_group);
+    DP_ASSERT(!element_at(tll->chunks, tll->count - 1)->content);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    memmove(&tll->elements[index + 1], &tll->elements[index],
-            sizeof(*tll->elements) * DP_int_to_size(tll->count - index - 1));
-    tll->elements[index] = lle;
+    make_transient_from(tll, index);
+    for (int i = tll->count - 1; i > index; --i) {
+        *element_at(tll->chunks, i) = *element_at(tll->chunks, i - 1);
+    }
+    *element_at(tll->chunks, index) = lle;
 }
 
 void DP_transient_layer_list_insert_content_inc(DP_TransientLayerList *tll,
@@ -1095,10 +1330,18 @@ void DP_transient_layer_list_delete_at(DP_TransientLayerList *tll, int index)
     DP_ASSERT(tll->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    layer_list_entry_decref(&tll->elements[index]);
-    int new_count = --tll->count;
-    memmove(&tll->elements[index], &tll->elements[index + 1],
-            DP_int_to_size(new_count - index) * sizeof(tll->elements[0]));
+    make_transient_from(tll, index);
+    layer_list_entry_decref(element_at(tll->chunks, index));
+    int new_count = tll->count - 1;
+    for (int i = index; i < new_count; ++i) {
+        *element_at(tll->chunks, i) = *element_at(tll->chunks, i + 1);
+    }
+    *element_at(tll->chunks, new_count) = (DP_LayerListEntry){false, {NULL}};
+    if ((new_count & CHUNK_MASK) == 0) {
+        // The last chunk is empty now, get rid of it.
+        chunk_decref(tll->chunks[new_count >> CHUNK_SHIFT]);
+    }
+    tll->count = new_count;
 }
 
 void DP_transient_layer_list_merge_at(DP_TransientLayerList *tll,
@@ -1110,12 +1353,12 @@ void DP_transient_layer_list_merge_at(DP_TransientLayerList *tll,
     DP_ASSERT(lp);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tll->count);
-    DP_ASSERT(tll->elements[index].is_group);
-    DP_LayerGroup *lg = tll->elements[index].group;
+    DP_LayerListEntry *lle = transient_element_at(tll, index);
+    DP_ASSERT(lle->is_group);
+    DP_LayerGroup *lg = lle->group;
     DP_TransientLayerContent *tlc = DP_layer_group_merge(lg, lp, true);
     DP_layer_group_decref(lg);
-    tll->elements[index] =
-        (DP_LayerListEntry){.is_group = false, .transient_content = tlc};
+    *lle = (DP_LayerListEntry){.is_group = false, .transient_content = tlc};
 }
 
 void DP_transient_layer_list_clamp(DP_TransientLayerList *tll, int count)
@@ -1126,8 +1369,25 @@ void DP_transient_layer_list_clamp(DP_TransientLayerList *tll, int count)
     DP_ASSERT(count >= 0);
     DP_ASSERT(count <= tll->count);
     int old_count = tll->count;
-    for (int i = count; i < old_count; ++i) {
-        layer_list_entry_decref_nullable(&tll->elements[i]);
+    if (count == old_count) {
+        return;
+    }
+
+    int old_chunk_count = chunk_count_for(old_count);
+    int new_chunk_count = chunk_count_for(count);
+    for (int i = new_chunk_count; i < old_chunk_count; ++i) {
+        chunk_decref(tll->chunks[i]);
+    }
+    // Clear out the tail of a partial last chunk, entries past the end of the
+    // list must be null.
+    int tail = count & CHUNK_MASK;
+    if (tail != 0) {
+        DP_LayerListChunk *chunk =
+            get_transient_chunk(tll, new_chunk_count - 1);
+        for (int i = tail; i < CHUNK_SIZE; ++i) {
+            layer_list_entry_decref_nullable(&chunk->elements[i]);
+            chunk->elements[i] = (DP_LayerListEntry){false, {NULL}};
+        }
     }
     tll->count = count;
 }
@@ -85,8 +85,23 @@ void DP_layer_list_diff(DP_LayerList *ll, DP_LayerPropsList *lpl,
                         DP_LayerList *prev_ll, DP_LayerPropsList *prev_lpl,
                         DP_CanvasDiff *diff, int only_layer_id);
 
+// Like DP_layer_list_diff, but only for the entries from start up to, but not
+// including, end, which must exist in both lists. Clipping starts over at start.
+void DP_layer_list_diff_range(DP_LayerList *ll, DP_LayerPropsList *lpl,
+                              DP_LayerList *prev_ll,
+                              DP_LayerPropsList *prev_lpl, DP_CanvasDiff *diff,
+                              int start, int end);
+
 void DP_layer_list_diff_mark(DP_LayerList *ll, DP_CanvasDiff *diff);
 
+// Counts the tiles in the given list that aren't also at the same spot in a
+// layer with the same id in the other list, which is about how much memory
+// keeping the former around costs on top of the latter.
+size_t DP_layer_list_unshared_tile_count(DP_LayerList *ll,
+                                         DP_LayerPropsList *lpl,
+                                         DP_LayerList *other_ll_or_null,
+                                         DP_LayerPropsList *other_lpl_or_null);
+
 int DP_layer_list_count(DP_LayerList *ll);
 
 DP_LayerListEntry *DP_layer_list_at_noinc(DP_LayerList *ll, int index);
@@ -27,25 +27,41 @@
 #include <dpmsg/blend_mode.h>
 
 
+// Elements are stored in fixed-size chunks, so that a transient copy of a list
+// only has to copy the chunk pointers and changing a single element only has to
+// copy the chunk it's in. Persistent chunks are immutable and get shared
+// between lists and undo states, transient chunks belong to a single transient
+// list. Only transient chunks can contain transient elements. Elements past the
+// end of the list are always null.
+#define CHUNK_SHIFT 5
+#define CHUNK_SIZE  (1 << CHUNK_SHIFT)
+#define CHUNK_MASK  (CHUNK_SIZE - 1)
+
+typedef union DP_LayerPropsListElement {
+    DP_LayerProps *layer_props;
+    DP_TransientLayerProps *transient_layer_props;
+} DP_LayerPropsListElement;
+
+typedef struct DP_LayerPropsListChunk {
+    DP_Atomic refcount;
+    bool transient;
+    DP_LayerPropsListElement elements[CHUNK_SIZE];
+} DP_LayerPropsListChunk;
+
 #ifdef DP_NO_STRICT_ALIASING
 
 struct DP_LayerPropsList {
     DP_Atomic refcount;
     const bool transient;
     const int count;
-    struct {
-        DP_LayerProps *const layer_props;
-    } elements[];
+    DP_LayerPropsListChunk *const chunks[];
 };
 
 struct DP_TransientLayerPropsList {
     DP_Atomic refcount;
     bool transient;
     int count;
-    union DP_TransientLayerPropsElement {
-        DP_LayerProps *layer_props;
-        DP_TransientLayerProps *transient_layer_props;
-    } elements[];
+    DP_LayerPropsListChunk *chunks[];
 };
 
 #else
@@ -54,20 +70,56 @@ struct DP_LayerPropsList {
     DP_Atomic refcount;
     bool transient;
     int count;
-    union DP_TransientLayerPropsElement {
-        DP_LayerProps *layer_props;
-        DP_TransientLayerProps *transient_layer_props;
-    } elements[];
+    DP_LayerPropsListChunk *chunks[];
 };
 
 #endif
 
 
+static DP_LayerPropsListChunk *chunk_new_blank(void)
+{
+    DP_LayerPropsListChunk *chunk = DP_malloc(sizeof(*chunk));
+    DP_atomic_set(&chunk->refcount, 1);
+    chunk->transient = true;
+    for (int i = 0; i < CHUNK_SIZE; ++i) {
+        chunk->elements[i].layer_props = NULL;
+    }
+    return chunk;
+}
+
+static DP_LayerPropsListChunk *chunk_incref(DP_LayerPropsListChunk *chunk)
+{
+    DP_ASSERT(chunk);
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    DP_ASSERT(!chunk->transient);
+    DP_atomic_inc(&chunk->refcount);
+    return chunk;
+}
+
+static void chunk_decref(DP_LayerPropsListChunk *chunk)
+{
+    DP_ASSERT(chunk);
+    DP_ASSERT(DP_atomic_get(&chunk->refcount) > 0);
+    if (DP_atomic_dec(&chunk->refcount)) {
+        for (int i = 0; i < CHUNK_SIZE; ++i) {
+            DP_layer_props_decref_nullable(chunk->elements[i].layer_props);
+        }
+        DP_free(chunk);
+    }
+}
+
+static int chunk_count_for(int count)
+{
+    return (count + CHUNK_MASK) >> CHUNK_SHIFT;
+}
+
 static size_t layer_props_list_size(int count)
 {
-    return DP_FLEX_SIZEOF(DP_LayerPropsList, elements, DP_int_to_size(count));
+    return DP_FLEX_SIZEOF(DP_LayerPropsList, chunks,
+                          DP_int_to_size(chunk_count_for(count)));
 }
 
+// Chunks are left uninitialized, the caller has to fill them in.
 static void *allocate_layer_props_list(bool transient, int count)
 {
     DP_TransientLayerPropsList *tlpl = DP_malloc(layer_props_list_size(count));
@@ -77,6 +129,62 @@ static void *allocate_layer_props_list(bool transient, int count)
     return tlpl;
 }
 
+static void fill_blank_chunks(DP_TransientLayerPropsList *tlpl, int start)
+{
+    int chunk_count = chunk_count_for(tlpl->count);
+    for (int i = start; i < chunk_count; ++i) {
+        tlpl->chunks[i] = chunk_new_blank();
+    }
+}
+
+static DP_LayerPropsListElement *
+element_at(DP_LayerPropsListChunk *const *chunks, int index)
+{
+    return &chunks[index >> CHUNK_SHIFT]->elements[index & CHUNK_MASK];
+}
+
+static DP_LayerPropsListChunk *
+get_transient_chunk(DP_TransientLayerPropsList *tlpl, int chunk_index)
+{
+    DP_LayerPropsListChunk *chunk = tlpl->chunks[chunk_index];
+    if (chunk->transient) {
+        return chunk;
+    }
+    else if (DP_atomic_get(&chunk->refcount) == 1) {
+        // Nothing else is looking at this chunk, so it can be changed in place.
+        chunk->transient = true;
+        return chunk;
+    }
+    else {
+        DP_LayerPropsListChunk *tchunk = chunk_new_blank();
+        for (int i = 0; i < CHUNK_SIZE; ++i) {
+            tchunk->elements[i].layer_props =
+                DP_layer_props_incref_nullable(chunk->elements[i].layer_props);
+        }
+        chunk_decref(chunk);
+        tlpl->chunks[chunk_index] = tchunk;
+        return tchunk;
+    }
+}
+
+static DP_LayerPropsListElement *
+transient_element_at(DP_TransientLayerPropsList *tlpl, int index)
+{
+    DP_LayerPropsListChunk *chunk =
+        get_transient_chunk(tlpl, index >> CHUNK_SHIFT);
+    return &chunk->elements[index & CHUNK_MASK];
+}
+
+// Makes every chunk from the given element index onwards transient, so that
+// elements can be shifted around between them freely.
+static void make_transient_from(DP_TransientLayerPropsList *tlpl, int index)
+{
+    int chunk_count = chunk_count_for(tlpl->count);
+    for (int i = index >> CHUNK_SHIFT; i < chunk_count; ++i) {
+        get_transient_chunk(tlpl, i);
+    }
+}
+
 
 DP_LayerPropsList *DP_layer_props_list_new(void)
 {
@@ -102,9 +210,9 @@ void DP_layer_props_list_decref(DP_LayerPropsList *lpl)
     DP_ASSERT(lpl);
     DP_ASSERT(DP_atomic_get(&lpl->refcount) > 0);
     if (DP_atomic_dec(&lpl->refcount)) {
-        int count = lpl->count;
-        for (int i = 0; i < count; ++i) {
-            DP_layer_props_decref_nullable(lpl->elements[i].layer_props);
+        int chunk_count = chunk_count_for(lpl->count);
+        for (int i = 0; i < chunk_count; ++i) {
+            chunk_decref(lpl->chunks[i]);
         }
         DP_free(lpl);
     }
@@ -144,7 +252,7 @@ DP_LayerProps *DP_layer_props_list_at_noinc(DP_LayerPropsList *lpl, int index)
     DP_ASSERT(DP_atomic_get(&lpl->refcount) > 0);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < lpl->count);
-    return lpl->elements[index].layer_props;
+    return element_at(lpl->chunks, index)->layer_props;
 }
 
 int DP_layer_props_list_index_by_id(DP_LayerPropsList *lpl, int layer_id)
@@ -154,7 +262,7 @@ int DP_layer_props_list_index_by_id(DP_LayerPropsList *lpl, int layer_id)
     int count = lpl->count;
     for (int i = 0; i < count; ++i) {
         // Transient layer lists may have null layers allocated in reserve.
-        DP_LayerProps *lp = lpl->elements[i].layer_props;
+        DP_LayerProps *lp = element_at(lpl->chunks, i)->layer_props;
         if (lp && DP_layer_props_id(lp) == layer_id) {
             return i;
         }
@@ -168,7 +276,7 @@ bool DP_layer_props_list_can_decrease_opacity(DP_LayerPropsList *lpl)
     DP_ASSERT(DP_atomic_get(&lpl->refcount) > 0);
     int count = lpl->count;
     for (int i = 0; i < count; ++i) {
-        DP_LayerProps *lp = lpl->elements[i].layer_props;
+        DP_LayerProps *lp = element_at(lpl->chunks, i)->layer_props;
 
         // Recurse if this is a pass-through group.
         DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
@@ -193,9 +301,7 @@ bool DP_layer_props_list_can_decrease_opacity(DP_LayerPropsList *lpl)
 DP_TransientLayerPropsList *DP_transient_layer_props_list_new_init(int reserve)
 {
     DP_TransientLayerPropsList *tlpl = allocate_layer_props_list(true, reserve);
-    for (int i = 0; i < reserve; ++i) {
-        tlpl->elements[i].layer_props = NULL;
-    }
+    fill_blank_chunks(tlpl, 0);
     return tlpl;
 }
 
@@ -206,16 +312,15 @@ DP_transient_layer_props_list_new(DP_LayerPropsList *lpl, int reserve)
     DP_ASSERT(DP_atomic_get(&lpl->refcount) > 0);
     DP_ASSERT(!lpl->transient);
     DP_ASSERT(reserve >= 0);
-    int count = lpl->count;
     DP_TransientLayerPropsList *tlpl =
-        allocate_layer_props_list(true, count + reserve);
-    for (int i = 0; i < count; ++i) {
-        tlpl->elements[i].layer_props =
-            DP_layer_props_incref(lpl->elements[i].layer_props);
-    }
-    for (int i = 0; i < reserve; ++i) {
-        tlpl->elements[count + i].layer_props = NULL;
+        allocate_layer_props_list(true, lpl->count + reserve);
+    // The reserved elements past the end of a partial last chunk are already
+    // null, so that one can be shared too.
+    int chunk_count = chunk_count_for(lpl->count);
+    for (int i = 0; i < chunk_count; ++i) {
+        tlpl->chunks[i] = chunk_incref(lpl->chunks[i]);
     }
+    fill_blank_chunks(tlpl, chunk_count);
     return tlpl;
 }
 
@@ -229,13 +334,11 @@ DP_transient_layer_props_list_reserve(DP_TransientLayerPropsList *tlpl,
     DP_ASSERT(reserve >= 0);
     DP_debug("Reserve %d elements in layer props list", reserve);
     if (reserve > 0) {
-        int old_count = tlpl->count;
-        int new_count = old_count + reserve;
+        int old_chunk_count = chunk_count_for(tlpl->count);
+        int new_count = tlpl->count + reserve;
         tlpl = DP_realloc(tlpl, layer_props_list_size(new_count));
         tlpl->count = new_count;
-        for (int i = old_count; i < new_count; ++i) {
-            tlpl->elements[i].layer_props = NULL;
-        }
+        fill_blank_chunks(tlpl, old_chunk_count);
     }
     return tlpl;
 }
@@ -274,11 +377,21 @@ DP_transient_layer_props_list_persist(DP_TransientLayerPropsList *tlpl)
     DP_ASSERT(tlpl->transient);
     tlpl->transient = false;
     int count = tlpl->count;
-    for (int i = 0; i < count; ++i) {
-        DP_ASSERT(tlpl->elements[i].layer_props);
-        if (DP_layer_props_transient(tlpl->elements[i].layer_props)) {
-            DP_transient_layer_props_persist(
-                tlpl->elements[i].transient_layer_props);
+    int chunk_count = chunk_count_for(count);
+    for (int i = 0; i < chunk_count; ++i) {
+        // Persistent chunks can't contain anything transient, skip them.
+        DP_LayerPropsListChunk *chunk = tlpl->chunks[i];
+        if (chunk->transient) {
+            int end = DP_min_int(count - (i << CHUNK_SHIFT), CHUNK_SIZE);
+            for (int j = 0; j < end; ++j) {
+                DP_LayerPropsListElement *element = &chunk->elements[j];
+                DP_ASSERT(element->layer_props);
+                if (DP_layer_props_transient(element->layer_props)) {
+                    DP_transient_layer_props_persist(
+                        element->transient_layer_props);
+                }
+            }
+            chunk->transient = false;
         }
     }
     return (DP_LayerPropsList *)tlpl;
@@ -310,13 +423,13 @@ DP_TransientLayerProps *DP_transient_layer_props_list_transient_at_noinc(
     DP_ASSERT(tlpl->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    DP_LayerProps *lp = tlpl->elements[index].layer_props;
+    DP_LayerPropsListElement *element = transient_element_at(tlpl, index);
+    DP_LayerProps *lp = element->layer_props;
     if (!DP_layer_props_transient(lp)) {
-        tlpl->elements[index].transient_layer_props =
-            DP_transient_layer_props_new(lp);
+        element->transient_layer_props = DP_transient_layer_props_new(lp);
         DP_layer_props_decref(lp);
     }
-    return tlpl->elements[index].transient_layer_props;
+    return element->transient_layer_props;
 }
 
 DP_TransientLayerProps *
@@ -330,13 +443,14 @@ DP_transient_layer_props_list_transient_at_with_children_noinc(
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
     DP_ASSERT(transient_children);
-    DP_LayerProps *lp = tlpl->elements[index].layer_props;
+    DP_LayerPropsListElement *element = transient_element_at(tlpl, index);
+    DP_LayerProps *lp = element->layer_props;
     DP_ASSERT(!DP_layer_props_transient(lp));
-    tlpl->elements[index].transient_layer_props =
+    element->transient_layer_props =
         DP_transient_layer_props_new_with_children_noinc(lp,
                                                          transient_children);
     DP_layer_props_decref(lp);
-    return tlpl->elements[index].transient_layer_props;
+    return element->transient_layer_props;
 }
 
 int DP_transient_layer_props_list_index_by_id(DP_TransientLayerPropsList *tlpl,
@@ -357,8 +471,9 @@ void DP_transient_layer_props_list_set_noinc(DP_TransientLayerPropsList *tlpl,
     DP_ASSERT(lp);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    DP_ASSERT(!tlpl->elements[index].layer_props);
-    tlpl->elements[index].layer_props = lp;
+    DP_LayerPropsListElement *element = transient_element_at(tlpl, index);
+    DP_ASSERT(!element->layer_props);
+    element->layer_props = lp;
 }
 
 void DP_transient_layer_props_list_set_inc(DP_TransientLayerPropsList *tlpl,
@@ -369,17 +484,19 @@ void DP_transient_layer_props_list_set_inc(DP_TransientLayerPropsList *tlpl,
 }
 
 static void insert_at(DP_TransientLayerPropsList *tlpl, int index,
-                      union DP_TransientLayerPropsElement element)
+                      DP_LayerPropsListElement element)
 {
     DP_ASSERT(tlpl);
     DP_ASSERT(DP_atomic_get(&tlpl->refcount) > 0);
     DP_ASSERT(tlpl->transient);
-    DP_ASSERT(!tlpl->elements[tlpl->count - 1].layer_props);
+    DP_ASSERT(!element_at(tlpl->chunks, tlpl->count - 1)->layer_props);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    memmove(&tlpl->elements[index + 1], &tlpl->elements[index],
-            sizeof(*tlpl->elements) * DP_int_to_size(tlpl->count - index - 1));
-    tlpl->elements[index] = element;
+    make_transient_from(tlpl, index);
+    for (int i = tlpl->count - 1; i > index; --i) {
+        *element_at(tlpl->chunks, i) = *element_at(tlpl->chunks, i - 1);
+    }
+    *element_at(tlpl->chunks, index) = element;
 }
 
 void DP_transient_layer_props_list_insert_inc(DP_TransientLayerPropsList *tlpl,
@@ -387,7 +504,7 @@ void DP_transient_layer_props_list_insert_inc(DP_TransientLayerPropsList *tlpl,
 {
     DP_ASSERT(lp);
     insert_at(tlpl, index,
-              (union DP_TransientLayerPropsElement){
+              (DP_LayerPropsListElement){
                   .layer_props = DP_layer_props_incref(lp)});
 }
 
@@ -400,8 +517,9 @@ void DP_transient_layer_props_list_set_transient_noinc(
     DP_ASSERT(tlp);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    DP_ASSERT(!tlpl->elements[index].layer_props);
-    tlpl->elements[index].transient_layer_props = tlp;
+    DP_LayerPropsListElement *element = transient_element_at(tlpl, index);
+    DP_ASSERT(!element->layer_props);
+    element->transient_layer_props = tlp;
 }
 
 void DP_transient_layer_props_list_insert_transient_noinc(
@@ -410,7 +528,7 @@ void DP_transient_layer_props_list_insert_transient_noinc(
     DP_ASSERT(tlp);
     insert_at(
         tlpl, index,
-        (union DP_TransientLayerPropsElement){.transient_layer_props = tlp});
+        (DP_LayerPropsListElement){.transient_layer_props = tlp});
 }
 
 void DP_transient_layer_props_list_delete_at(DP_TransientLayerPropsList *tlpl,
@@ -421,10 +539,18 @@ void DP_transient_layer_props_list_delete_at(DP_TransientLayerPropsList *tlpl,
     DP_ASSERT(tlpl->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    DP_layer_props_decref(tlpl->elements[index].layer_props);
-    int new_count = --tlpl->count;
-    memmove(&tlpl->elements[index], &tlpl->elements[index + 1],
-            DP_int_to_size(new_count - index) * sizeof(tlpl->elements[0]));
+    make_transient_from(tlpl, index);
+    DP_layer_props_decref(element_at(tlpl->chunks, index)->layer_props);
+    int new_count = tlpl->count - 1;
+    for (int i = index; i < new_count; ++i) {
+        *element_at(tlpl->chunks, i) = *element_at(tlpl->chunks, i + 1);
+    }
+    element_at(tlpl->chunks, new_count)->layer_props = NULL;
+    if ((new_count & CHUNK_MASK) == 0) {
+        // The last chunk is empty now, get rid of it.
+        chunk_decref(tlpl->chunks[new_count >> CHUNK_SHIFT]);
+    }
+    tlpl->count = new_count;
 }
 
 void DP_transient_layer_props_list_merge_at(DP_TransientLayerPropsList *tlpl,
@@ -435,9 +561,10 @@ void DP_transient_layer_props_list_merge_at(DP_TransientLayerPropsList *tlpl,
     DP_ASSERT(tlpl->transient);
     DP_ASSERT(index >= 0);
     DP_ASSERT(index < tlpl->count);
-    DP_LayerProps *lp = tlpl->elements[index].layer_props;
+    DP_LayerPropsListElement *element = transient_element_at(tlpl, index);
+    DP_LayerProps *lp = element->layer_props;
     DP_TransientLayerProps *tlp = DP_transient_layer_props_new_merge(lp);
-    tlpl->elements[index].transient_layer_props = tlp;
+    element->transient_layer_props = tlp;
     DP_layer_props_decref(lp);
 }
 
@@ -450,8 +577,25 @@ void DP_transient_layer_props_list_clamp(DP_TransientLayerPropsList *tlpl,
     DP_ASSERT(count >= 0);
     DP_ASSERT(count <= tlpl->count);
     int old_count = tlpl->count;
-    for (int i = count; i < old_count; ++i) {
-        DP_layer_props_decref_nullable(tlpl->elements[i].layer_props);
+    if (count == old_count) {
+        return;
+    }
+
+    int old_chunk_count = chunk_count_for(old_count);
+    int new_chunk_count = chunk_count_for(count);
+    for (int i = new_chunk_count; i < old_chunk_count; ++i) {
+        chunk_decref(tlpl->chunks[i]);
+    }
+    // Clear out the tail of a partial last chunk, elements past the end of the
+    // list must be null.
+    int tail = count & CHUNK_MASK;
+    if (tail != 0) {
+        DP_LayerPropsListChunk *chunk =
+            get_transient_chunk(tlpl, new_chunk_count - 1);
+        for (int i = tail; i < CHUNK_SIZE; ++i) {
+            DP_layer_props_decref_nullable(chunk->elements[i].layer_props);
+            chunk->elements[i].layer_props = NULL;
+        }
     }
     tlpl->count = count;
 }
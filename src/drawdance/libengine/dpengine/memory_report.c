@@ -0,0 +1,447 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "memory_report.h"
+#include "canvas_state.h"
+#include "layer_content.h"
+#include "layer_group.h"
+#include "layer_list.h"
+#include "layer_props.h"
+#include "layer_props_list.h"
+#include "selection.h"
+#include "selection_set.h"
+#include "tile.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/perf.h>
+#include <dpcommon/vector.h>
+#include <string.h>
+
+#define DP_PERF_CONTEXT "memory_report"
+
+
+#define INITIAL_TABLE_CAPACITY 1024
+
+// Counts are capped at two, all that matters is whether it's more than one.
+typedef struct DP_MemoryReportTile {
+    DP_Tile *t;
+    int last_part;
+    int last_source;
+    int counted_part;
+    int counted_source;
+    unsigned char parts;
+    unsigned char sources;
+} DP_MemoryReportTile;
+
+typedef struct DP_MemoryReportSourceEntry {
+    DP_MemoryReportSource source;
+    DP_CanvasState *cs_or_null;
+    int first_part;
+    size_t first_cache_tile;
+    size_t cache_tile_count;
+} DP_MemoryReportSourceEntry;
+
+struct DP_MemoryReport {
+    bool computed;
+    DP_Vector sources;
+    DP_Vector parts;
+    DP_Vector cache_tiles;
+    DP_MemoryReportUsage total;
+    struct {
+        size_t capacity;
+        size_t used;
+        DP_MemoryReportTile *elements;
+    } table;
+};
+
+typedef struct DP_MemoryReportVisit {
+    DP_MemoryReport *mr;
+    int source_index;
+    int part_index;
+    bool counting;
+} DP_MemoryReportVisit;
+
+
+DP_MemoryReport *DP_memory_report_new(void)
+{
+    DP_MemoryReport *mr = DP_malloc(sizeof(*mr));
+    *mr = (DP_MemoryReport){false, DP_VECTOR_NULL, DP_VECTOR_NULL,
+                            DP_VECTOR_NULL, {0, 0, 0}, {0, 0, NULL}};
+    DP_VECTOR_INIT_TYPE(&mr->sources, DP_MemoryReportSourceEntry, 64);
+    DP_VECTOR_INIT_TYPE(&mr->parts, DP_MemoryReportPart, 256);
+    DP_VECTOR_INIT_TYPE(&mr->cache_tiles, DP_Tile *, 256);
+    return mr;
+}
+
+static void dispose_source(void *element)
+{
+    DP_MemoryReportSourceEntry *entry = element;
+    DP_canvas_state_decref_nullable(entry->cs_or_null);
+    DP_free(entry->source.name);
+}
+
+static void dispose_part(void *element)
+{
+    DP_free(((DP_MemoryReportPart *)element)->title);
+}
+
+static void dispose_cache_tile(void *element)
+{
+    DP_tile_decref(*(DP_Tile **)element);
+}
+
+void DP_memory_report_free(DP_MemoryReport *mr_or_null)
+{
+    if (mr_or_null) {
+        DP_free(mr_or_null->table.elements);
+        DP_vector_clear_dispose(&mr_or_null->cache_tiles, sizeof(DP_Tile *),
+                                dispose_cache_tile);
+        DP_vector_clear_dispose(&mr_or_null->parts,
+                                sizeof(DP_MemoryReportPart), dispose_part);
+        DP_vector_clear_dispose(&mr_or_null->sources,
+                                sizeof(DP_MemoryReportSourceEntry),
+                                dispose_source);
+        DP_free(mr_or_null);
+    }
+}
+
+
+static char *dup_title(const char *title, size_t length)
+{
+    char *buffer = DP_malloc(length + 1);
+    memcpy(buffer, title, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static void push_source(DP_MemoryReport *mr, DP_MemoryReportSourceType type,
+                        long long index, const char *name_or_null,
+                        DP_CanvasState *cs_or_null)
+{
+    DP_MemoryReportSourceEntry *entry =
+        DP_vector_push(&mr->sources, sizeof(*entry));
+    *entry = (DP_MemoryReportSourceEntry){
+        {type, index, name_or_null ? DP_strdup(name_or_null) : NULL, 0,
+         {0, 0, 0}},
+        cs_or_null,
+        0,
+        mr->cache_tiles.used,
+        0,
+    };
+}
+
+void DP_memory_report_canvas_state_add(DP_MemoryReport *mr,
+                                       DP_MemoryReportSourceType type,
+                                       long long index, DP_CanvasState *cs)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(!mr->computed);
+    DP_ASSERT(cs);
+    DP_ASSERT(type != DP_MEMORY_REPORT_SOURCE_CACHE);
+    push_source(mr, type, index, NULL, DP_canvas_state_incref(cs));
+}
+
+void DP_memory_report_cache_add(DP_MemoryReport *mr, const char *name)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(!mr->computed);
+    DP_ASSERT(name);
+    push_source(mr, DP_MEMORY_REPORT_SOURCE_CACHE, -1, name, NULL);
+}
+
+void DP_memory_report_cache_tile_add(DP_MemoryReport *mr, DP_Tile *t_or_null)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(!mr->computed);
+    DP_ASSERT(mr->sources.used != 0);
+    DP_ASSERT(DP_VECTOR_LAST_TYPE(&mr->sources, DP_MemoryReportSourceEntry)
+                  .source.type
+              == DP_MEMORY_REPORT_SOURCE_CACHE);
+    if (t_or_null) {
+        DP_VECTOR_PUSH_TYPE(&mr->cache_tiles, DP_Tile *,
+                            DP_tile_incref(t_or_null));
+        ++DP_VECTOR_LAST_TYPE(&mr->sources, DP_MemoryReportSourceEntry)
+              .cache_tile_count;
+    }
+}
+
+
+static size_t hash_tile(DP_Tile *t, size_t mask)
+{
+    // Tiles are allocated with some alignment, so drop the low bits first.
+    uint64_t x = (uint64_t)(uintptr_t)t >> 4;
+    return (size_t)((x * UINT64_C(0x9e3779b97f4a7c15)) >> 17) & mask;
+}
+
+static void table_grow(DP_MemoryReport *mr)
+{
+    size_t old_capacity = mr->table.capacity;
+    DP_MemoryReportTile *old_elements = mr->table.elements;
+    size_t new_capacity =
+        old_capacity == 0 ? INITIAL_TABLE_CAPACITY : old_capacity * 2;
+    size_t mask = new_capacity - 1;
+    DP_MemoryReportTile *new_elements =
+        DP_malloc_zeroed(sizeof(*new_elements) * new_capacity);
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        DP_MemoryReportTile *mrt = &old_elements[i];
+        if (mrt->t) {
+            size_t j = hash_tile(mrt->t, mask);
+            while (new_elements[j].t) {
+                j = (j + 1) & mask;
+            }
+            new_elements[j] = *mrt;
+        }
+    }
+
+    DP_free(old_elements);
+    mr->table.capacity = new_capacity;
+    mr->table.elements = new_elements;
+}
+
+static DP_MemoryReportTile *table_get(DP_MemoryReport *mr, DP_Tile *t)
+{
+    if (mr->table.used * 2 >= mr->table.capacity) {
+        table_grow(mr);
+    }
+
+    size_t mask = mr->table.capacity - 1;
+    DP_MemoryReportTile *elements = mr->table.elements;
+    size_t i = hash_tile(t, mask);
+    while (elements[i].t) {
+        if (elements[i].t == t) {
+            return &elements[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    ++mr->table.used;
+    elements[i] = (DP_MemoryReportTile){t, -1, -1, -1, -1, 0, 0};
+    return &elements[i];
+}
+
+
+static void add_usage(DP_MemoryReportUsage *usage, bool shared)
+{
+    ++usage->tiles;
+    if (shared) {
+        usage->shared_bytes += DP_TILE_BYTES;
+    }
+    else {
+        usage->unique_bytes += DP_TILE_BYTES;
+    }
+}
+
+// The first pass marks which parts and sources reference each tile, the
+// second one counts them according to that. Tiles referenced more than once
+// from the same part or source still only count as one.
+static void visit_tile(DP_MemoryReportVisit *v, DP_Tile *t_or_null)
+{
+    if (t_or_null) {
+        DP_MemoryReportTile *mrt = table_get(v->mr, t_or_null);
+        int part_index = v->part_index;
+        int source_index = v->source_index;
+        if (v->counting) {
+            if (mrt->counted_part != part_index) {
+                mrt->counted_part = part_index;
+                DP_MemoryReportPart *part =
+                    DP_vector_at(&v->mr->parts, sizeof(*part),
+                                 DP_int_to_size(part_index));
+                add_usage(&part->usage, mrt->parts > 1);
+            }
+            if (mrt->counted_source != source_index) {
+                mrt->counted_source = source_index;
+                DP_MemoryReportSourceEntry *entry =
+                    DP_vector_at(&v->mr->sources, sizeof(*entry),
+                                 DP_int_to_size(source_index));
+                add_usage(&entry->source.usage, mrt->sources > 1);
+            }
+        }
+        else {
+            if (mrt->last_part != part_index) {
+                mrt->last_part = part_index;
+                mrt->parts = (unsigned char)DP_min_int(mrt->parts + 1, 2);
+            }
+            if (mrt->last_source != source_index) {
+                mrt->last_source = source_index;
+                mrt->sources = (unsigned char)DP_min_int(mrt->sources + 1, 2);
+            }
+        }
+    }
+}
+
+// Parts are created during the first pass, the second pass goes through them
+// in the same order again.
+static void begin_part(DP_MemoryReportVisit *v, DP_MemoryReportPartType type,
+                       int layer_id, char *title_or_null)
+{
+    if (v->counting) {
+        DP_free(title_or_null);
+        ++v->part_index;
+    }
+    else {
+        DP_MemoryReportPart *part =
+            DP_vector_push(&v->mr->parts, sizeof(*part));
+        *part = (DP_MemoryReportPart){type, layer_id, title_or_null, {0, 0, 0}};
+        v->part_index = DP_size_to_int(v->mr->parts.used) - 1;
+    }
+}
+
+static void visit_layer_content(DP_MemoryReportVisit *v, DP_LayerContent *lc)
+{
+    int tile_total = DP_tile_total_round(DP_layer_content_width(lc),
+                                         DP_layer_content_height(lc));
+    for (int i = 0; i < tile_total; ++i) {
+        visit_tile(v, DP_layer_content_tile_at_index_noinc(lc, i));
+    }
+
+    // Sublayers hold the in-progress strokes, they're part of their layer.
+    DP_LayerList *sub_ll = DP_layer_content_sub_contents_noinc(lc);
+    int sub_count = DP_layer_list_count(sub_ll);
+    for (int i = 0; i < sub_count; ++i) {
+        visit_layer_content(v, DP_layer_list_content_at_noinc(sub_ll, i));
+    }
+}
+
+static void visit_layer_list(DP_MemoryReportVisit *v, DP_LayerList *ll,
+                             DP_LayerPropsList *lpl)
+{
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        if (DP_layer_list_entry_is_group(lle)) {
+            visit_layer_list(
+                v,
+                DP_layer_group_children_noinc(
+                    DP_layer_list_entry_group_noinc(lle)),
+                DP_layer_props_children_noinc(lp));
+        }
+        else {
+            char *title = NULL;
+            if (!v->counting) {
+                size_t title_length;
+                const char *title_data =
+                    DP_layer_props_title(lp, &title_length);
+                title = dup_title(title_data, title_length);
+            }
+            begin_part(v, DP_MEMORY_REPORT_PART_LAYER, DP_layer_props_id(lp),
+                       title);
+            visit_layer_content(v, DP_layer_list_entry_content_noinc(lle));
+        }
+    }
+}
+
+static void visit_canvas_state(DP_MemoryReportVisit *v, DP_CanvasState *cs)
+{
+    DP_Tile *background_tile = DP_canvas_state_background_tile_noinc(cs);
+    if (background_tile) {
+        begin_part(v, DP_MEMORY_REPORT_PART_BACKGROUND, 0, NULL);
+        visit_tile(v, background_tile);
+    }
+
+    visit_layer_list(v, DP_canvas_state_layers_noinc(cs),
+                     DP_canvas_state_layer_props_noinc(cs));
+
+    DP_SelectionSet *ss = DP_canvas_state_selections_noinc_nullable(cs);
+    if (ss) {
+        int count = DP_selection_set_count(ss);
+        for (int i = 0; i < count; ++i) {
+            DP_Selection *sel = DP_selection_set_at_noinc(ss, i);
+            begin_part(v, DP_MEMORY_REPORT_PART_SELECTION,
+                       DP_selection_id(sel), NULL);
+            visit_layer_content(v, DP_selection_content_noinc(sel));
+        }
+    }
+}
+
+static void visit_sources(DP_MemoryReport *mr, bool counting)
+{
+    DP_MemoryReportVisit v = {mr, 0, -1, counting};
+    int source_count = DP_size_to_int(mr->sources.used);
+    for (int i = 0; i < source_count; ++i) {
+        DP_MemoryReportSourceEntry *entry =
+            DP_vector_at(&mr->sources, sizeof(*entry), DP_int_to_size(i));
+        v.source_index = i;
+        if (!counting) {
+            entry->first_part = DP_size_to_int(mr->parts.used);
+        }
+
+        if (entry->cs_or_null) {
+            visit_canvas_state(&v, entry->cs_or_null);
+        }
+        else {
+            begin_part(&v, DP_MEMORY_REPORT_PART_CACHE, 0,
+                       counting ? NULL : DP_strdup(entry->source.name));
+            size_t end = entry->first_cache_tile + entry->cache_tile_count;
+            for (size_t j = entry->first_cache_tile; j < end; ++j) {
+                visit_tile(&v,
+                           DP_VECTOR_AT_TYPE(&mr->cache_tiles, DP_Tile *, j));
+            }
+        }
+
+        if (!counting) {
+            entry->source.part_count =
+                DP_size_to_int(mr->parts.used) - entry->first_part;
+        }
+    }
+}
+
+void DP_memory_report_compute(DP_MemoryReport *mr)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(!mr->computed);
+    DP_PERF_BEGIN(fn, "compute");
+    visit_sources(mr, false);
+    visit_sources(mr, true);
+
+    DP_MemoryReportTile *elements = mr->table.elements;
+    size_t capacity = mr->table.capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        if (elements[i].t) {
+            add_usage(&mr->total, elements[i].sources > 1);
+        }
+    }
+
+    mr->computed = true;
+    DP_PERF_END(fn);
+}
+
+DP_MemoryReportUsage DP_memory_report_total(DP_MemoryReport *mr)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(mr->computed);
+    return mr->total;
+}
+
+int DP_memory_report_source_count(DP_MemoryReport *mr)
+{
+    DP_ASSERT(mr);
+    return DP_size_to_int(mr->sources.used);
+}
+
+const DP_MemoryReportSource *DP_memory_report_source_at(DP_MemoryReport *mr,
+                                                        int index)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(mr->computed);
+    DP_ASSERT(index >= 0);
+    DP_ASSERT(index < DP_memory_report_source_count(mr));
+    DP_MemoryReportSourceEntry *entry =
+        DP_vector_at(&mr->sources, sizeof(*entry), DP_int_to_size(index));
+    return &entry->source;
+}
+
+const DP_MemoryReportPart *DP_memory_report_part_at(DP_MemoryReport *mr,
+                                                    int source_index,
+                                                    int part_index)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(mr->computed);
+    DP_ASSERT(source_index >= 0);
+    DP_ASSERT(source_index < DP_memory_report_source_count(mr));
+    DP_MemoryReportSourceEntry *entry = DP_vector_at(
+        &mr->sources, sizeof(*entry), DP_int_to_size(source_index));
+    DP_ASSERT(part_index >= 0);
+    DP_ASSERT(part_index < entry->source.part_count);
+    return DP_vector_at(&mr->parts, sizeof(DP_MemoryReportPart),
+                        DP_int_to_size(entry->first_part + part_index));
+}
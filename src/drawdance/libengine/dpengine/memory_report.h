@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_MEMORY_REPORT_H
+#define DPENGINE_MEMORY_REPORT_H
+#include <dpcommon/common.h>
+
+typedef struct DP_CanvasState DP_CanvasState;
+typedef struct DP_Tile DP_Tile;
+
+
+// Accounts for the tile memory kept alive by a set of canvas states and
+// caches. Canvas states share most of their tiles with each other, so just
+// adding up their sizes is meaningless. Instead, each tile is counted once and
+// memory is split into what's unique to a source, which would be freed if it
+// were dropped, and what's shared with other sources in the same report.
+//
+// Sources are gathered first, holding references to the canvas states and
+// tiles, so this can be done on whichever thread owns them. The counting
+// happens in DP_memory_report_compute, which can then run on any thread.
+typedef struct DP_MemoryReport DP_MemoryReport;
+
+typedef enum DP_MemoryReportSourceType {
+    DP_MEMORY_REPORT_SOURCE_CURRENT,  // The current state of the history.
+    DP_MEMORY_REPORT_SOURCE_VIEW,     // What's shown, including previews.
+    DP_MEMORY_REPORT_SOURCE_HISTORY,  // An undo save point.
+    DP_MEMORY_REPORT_SOURCE_SNAPSHOT, // A snapshot to reset the session to.
+    DP_MEMORY_REPORT_SOURCE_CACHE,    // Tiles cached for rendering.
+} DP_MemoryReportSourceType;
+
+typedef enum DP_MemoryReportPartType {
+    DP_MEMORY_REPORT_PART_LAYER,
+    DP_MEMORY_REPORT_PART_BACKGROUND,
+    DP_MEMORY_REPORT_PART_SELECTION,
+    DP_MEMORY_REPORT_PART_CACHE,
+} DP_MemoryReportPartType;
+
+typedef struct DP_MemoryReportUsage {
+    size_t tiles;        // Distinct tiles referenced.
+    size_t unique_bytes; // Tiles that nothing else in the report references.
+    size_t shared_bytes; // Tiles that are also referenced from elsewhere.
+} DP_MemoryReportUsage;
+
+typedef struct DP_MemoryReportPart {
+    DP_MemoryReportPartType type;
+    int layer_id; // For layers and selections, zero otherwise.
+    char *title;  // Layer title or cache name, may be NULL.
+    DP_MemoryReportUsage usage;
+} DP_MemoryReportPart;
+
+typedef struct DP_MemoryReportSource {
+    DP_MemoryReportSourceType type;
+    long long index; // History index or snapshot timestamp, -1 otherwise.
+    char *name;      // Cache name, NULL otherwise.
+    int part_count;
+    DP_MemoryReportUsage usage;
+} DP_MemoryReportSource;
+
+
+DP_MemoryReport *DP_memory_report_new(void);
+
+void DP_memory_report_free(DP_MemoryReport *mr_or_null);
+
+// Adds a source for the given canvas state, with a part for each layer, the
+// background and each selection. Takes a reference to the canvas state.
+void DP_memory_report_canvas_state_add(DP_MemoryReport *mr,
+                                       DP_MemoryReportSourceType type,
+                                       long long index, DP_CanvasState *cs);
+
+// Adds a cache source with a single part, subsequent calls to add tiles go to
+// that part. Takes a reference to each tile, null tiles are ignored.
+void DP_memory_report_cache_add(DP_MemoryReport *mr, const char *name);
+
+void DP_memory_report_cache_tile_add(DP_MemoryReport *mr, DP_Tile *t_or_null);
+
+// Counts up the tiles of all sources, after which the usage values below are
+// filled in. Sources can't be added anymore after this.
+void DP_memory_report_compute(DP_MemoryReport *mr);
+
+// Usage of the whole report: unique bytes are tiles referenced by a single
+// source, shared bytes are the ones referenced by more than one.
+DP_MemoryReportUsage DP_memory_report_total(DP_MemoryReport *mr);
+
+int DP_memory_report_source_count(DP_MemoryReport *mr);
+
+const DP_MemoryReportSource *DP_memory_report_source_at(DP_MemoryReport *mr,
+                                                        int index);
+
+// Unique and shared bytes of parts are relative to all other parts, so a layer
+// that's unchanged between two save points has all of its tiles shared.
+const DP_MemoryReportPart *DP_memory_report_part_at(DP_MemoryReport *mr,
+                                                    int source_index,
+                                                    int part_index);
+
+
+#endif
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "message_cost.h"
+#include "dab_cost.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <float.h>
+
+
+static double get_classic_dabs_cost(DP_MsgDrawDabsClassic *mddc, double scale,
+                                    double dabs_cost, double max_cost)
+{
+    int count;
+    const DP_ClassicDab *cds = DP_msg_draw_dabs_classic_dabs(mddc, &count);
+    double base_cost =
+        scale
+        * DP_dab_cost_classic(DP_msg_draw_dabs_classic_paint_mode(mddc)
+                                  != DP_PAINT_MODE_DIRECT,
+                              DP_msg_draw_dabs_classic_mode(mddc));
+    for (int i = 0; i < count && dabs_cost < max_cost; ++i) {
+        double size =
+            DP_uint32_to_double(DP_classic_dab_size(DP_classic_dab_at(cds, i)));
+        double cost = base_cost * size * size;
+        dabs_cost += cost;
+    }
+    return dabs_cost;
+}
+
+static double get_pixel_dabs_cost(DP_MsgDrawDabsPixel *mddp, double scale,
+                                  double dabs_cost, double max_cost)
+{
+    int count;
+    const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
+    double base_cost =
+        scale
+        * DP_dab_cost_pixel(DP_msg_draw_dabs_pixel_paint_mode(mddp)
+                                != DP_PAINT_MODE_DIRECT,
+                            DP_msg_draw_dabs_pixel_mode(mddp));
+    for (int i = 0; i < count && dabs_cost < max_cost; ++i) {
+        double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
+        double cost = base_cost * size * size;
+        dabs_cost += cost;
+    }
+    return dabs_cost;
+}
+
+static double get_pixel_square_dabs_cost(DP_MsgDrawDabsPixel *mddp,
+                                         double scale, double dabs_cost,
+                                         double max_cost)
+{
+    int count;
+    const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
+    double base_cost =
+        scale
+        * DP_dab_cost_pixel_square(DP_msg_draw_dabs_pixel_paint_mode(mddp)
+                                       != DP_PAINT_MODE_DIRECT,
+                                   DP_msg_draw_dabs_pixel_mode(mddp));
+    for (int i = 0; i < count && dabs_cost < max_cost; ++i) {
+        double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
+        double cost = base_cost * size * size;
+        dabs_cost += cost;
+    }
+    return dabs_cost;
+}
+
+static double get_mypaint_dabs_cost(DP_MsgDrawDabsMyPaint *mddmp, double scale,
+                                    double dabs_cost, double max_cost)
+{
+    int count;
+    const DP_MyPaintDab *mpds = DP_msg_draw_dabs_mypaint_dabs(mddmp, &count);
+    double base_cost =
+        scale
+        * DP_dab_cost_mypaint(false, DP_msg_draw_dabs_mypaint_lock_alpha(mddmp),
+                              DP_msg_draw_dabs_mypaint_colorize(mddmp),
+                              DP_msg_draw_dabs_mypaint_posterize(mddmp));
+    for (int i = 0; i < count && dabs_cost < max_cost; ++i) {
+        double size = DP_mypaint_dab_size(DP_mypaint_dab_at(mpds, i));
+        double cost = base_cost * size * size;
+        dabs_cost += cost;
+    }
+    return dabs_cost;
+}
+
+static double get_mypaint_blend_dabs_cost(DP_MsgDrawDabsMyPaintBlend *mddmpb,
+                                          double scale, double dabs_cost,
+                                          double max_cost)
+{
+    int count;
+    const DP_MyPaintBlendDab *mpbds =
+        DP_msg_draw_dabs_mypaint_blend_dabs(mddmpb, &count);
+    double base_cost =
+        scale
+        * DP_dab_cost_mypaint_blend(
+            DP_msg_draw_dabs_mypaint_blend_paint_mode(mddmpb)
+                != DP_PAINT_MODE_DIRECT,
+            DP_msg_draw_dabs_mypaint_blend_mode(mddmpb));
+    for (int i = 0; i < count && dabs_cost < max_cost; ++i) {
+        double size =
+            DP_mypaint_blend_dab_size(DP_mypaint_blend_dab_at(mpbds, i));
+        double cost = base_cost * size * size;
+        dabs_cost += cost;
+    }
+    return dabs_cost;
+}
+
+double DP_message_cost_dabs(DP_Message *msg, double scale, double initial_cost,
+                            double max_cost)
+{
+    DP_ASSERT(msg);
+    switch (DP_message_type(msg)) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+        return get_classic_dabs_cost(DP_message_internal(msg), scale,
+                                     initial_cost, max_cost);
+    case DP_MSG_DRAW_DABS_PIXEL:
+        return get_pixel_dabs_cost(DP_message_internal(msg), scale,
+                                   initial_cost, max_cost);
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+        return get_pixel_square_dabs_cost(DP_message_internal(msg), scale,
+                                          initial_cost, max_cost);
+    case DP_MSG_DRAW_DABS_MYPAINT:
+        return get_mypaint_dabs_cost(DP_message_internal(msg), scale,
+                                     initial_cost, max_cost);
+    case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+        return get_mypaint_blend_dabs_cost(DP_message_internal(msg), scale,
+                                           initial_cost, max_cost);
+    default:
+        return -1.0;
+    }
+}
+
+static double get_area_cost(int blend_mode, long long width, long long height)
+{
+    return width > 0 && height > 0
+             ? DP_dab_cost_pixel_square(false, blend_mode)
+                   * DP_llong_to_double(width) * DP_llong_to_double(height)
+             : 0.0;
+}
+
+double DP_message_cost(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    switch (DP_message_type(msg)) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+    case DP_MSG_DRAW_DABS_PIXEL:
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+    case DP_MSG_DRAW_DABS_MYPAINT:
+    case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+        return DP_message_cost_dabs(msg, 1.0, 0.0, DBL_MAX);
+    case DP_MSG_FILL_RECT: {
+        DP_MsgFillRect *mfr = DP_message_internal(msg);
+        return get_area_cost(DP_msg_fill_rect_mode(mfr),
+                             DP_msg_fill_rect_w(mfr), DP_msg_fill_rect_h(mfr));
+    }
+    case DP_MSG_PUT_IMAGE: {
+        DP_MsgPutImage *mpi = DP_message_internal(msg);
+        return get_area_cost(DP_msg_put_image_mode(mpi),
+                             DP_msg_put_image_w(mpi), DP_msg_put_image_h(mpi));
+    }
+    case DP_MSG_MOVE_RECT: {
+        DP_MsgMoveRect *mmr = DP_message_internal(msg);
+        return get_area_cost(DP_msg_move_rect_blend(mmr),
+                             DP_msg_move_rect_w(mmr), DP_msg_move_rect_h(mmr));
+    }
+    case DP_MSG_TRANSFORM_REGION: {
+        DP_MsgTransformRegion *mtr = DP_message_internal(msg);
+        return get_area_cost(DP_msg_transform_region_blend(mtr),
+                             DP_msg_transform_region_bw(mtr),
+                             DP_msg_transform_region_bh(mtr));
+    }
+    default:
+        return 0.0;
+    }
+}
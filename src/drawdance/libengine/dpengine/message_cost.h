@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_MESSAGE_COST_H
+#define DPENGINE_MESSAGE_COST_H
+#include <dpcommon/common.h>
+
+typedef struct DP_Message DP_Message;
+
+
+// Costs are estimates of how long it takes to apply a message to the canvas,
+// in nanoseconds on the machine that the dab cost benchmark ran on. They are
+// only good for comparing against each other and against budgets in the same
+// unit, the actual time depends on the machine.
+
+// Adds the cost of the dabs in the given draw dabs message to the given
+// initial cost, multiplied by the given scale. Stops counting dabs once the
+// total reaches the given maximum. Returns a negative value if the message
+// isn't a draw dabs message.
+double DP_message_cost_dabs(DP_Message *msg, double scale, double initial_cost,
+                            double max_cost);
+
+// Estimated cost of applying the given message. Dabs are estimated as above,
+// fills, images and moved regions by their area, using the cost of pixel dabs
+// with the same blend mode. Everything else is considered to cost nothing.
+double DP_message_cost(DP_Message *msg);
+
+
+#endif
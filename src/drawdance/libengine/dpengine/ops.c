@@ -43,6 +43,7 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/ids.h>
 
@@ -1284,6 +1285,256 @@ static void draw_dabs_check_indirect_color(DP_PaintDrawDabsParams *params,
     }
 }
 
+typedef struct DP_DrawDabsOp {
+    DP_PaintDrawDabsParams params;
+    DP_TransientLayerContent *target;
+    DP_LayerContent *mask_lc;
+    DP_LayerContent *flood_lc;
+    // Union-find parent while grouping, next op in the group afterwards.
+    int link;
+} DP_DrawDabsOp;
+
+typedef struct DP_DrawDabsLayerLast {
+    int layer_id;
+    int op_index;
+} DP_DrawDabsLayerLast;
+
+struct DP_DrawDabsWorker {
+    DP_Worker *worker;
+    int thread_count;
+    DP_DrawContext **dcs;
+    DP_UserCursors *ucs_or_null;
+    int op_count;
+    int op_capacity;
+    DP_DrawDabsOp *ops;
+    int *roots;
+    int *tails;
+    int layer_count;
+    int layer_capacity;
+    DP_DrawDabsLayerLast *layers;
+    int last_by_context[DP_USER_CURSOR_COUNT];
+};
+
+struct DP_DrawDabsJob {
+    DP_DrawDabsWorker *ddw;
+    int first;
+};
+
+static void draw_dabs_run_group(DP_DrawDabsWorker *ddw, DP_DrawContext *dc,
+                                int first)
+{
+    DP_DrawDabsOp *ops = ddw->ops;
+    DP_UserCursors *ucs_or_null = ddw->ucs_or_null;
+    for (int i = first; i != -1; i = ops[i].link) {
+        DP_DrawDabsOp *op = &ops[i];
+        DP_paint_draw_dabs(dc, ucs_or_null, &op->params, op->target,
+                           op->mask_lc, op->flood_lc);
+    }
+}
+
+static void draw_dabs_job(void *element, int thread_index)
+{
+    struct DP_DrawDabsJob *job = element;
+    DP_DrawDabsWorker *ddw = job->ddw;
+    draw_dabs_run_group(ddw, ddw->dcs[thread_index], job->first);
+}
+
+DP_DrawDabsWorker *DP_draw_dabs_worker_new(int thread_count)
+{
+    DP_ASSERT(thread_count > 0);
+    // Dabs are what the user is waiting to see on the canvas, so they go ahead
+    // of background work like building reset images.
+    DP_Worker *worker = DP_worker_new_with_priority(
+        64, sizeof(struct DP_DrawDabsJob), thread_count,
+        DP_WORKER_PRIORITY_HIGH, draw_dabs_job);
+    if (!worker) {
+        return NULL;
+    }
+
+    DP_DrawDabsWorker *ddw = DP_malloc(sizeof(*ddw));
+    ddw->worker = worker;
+    ddw->thread_count = thread_count;
+    size_t dcs_size = sizeof(*ddw->dcs) * DP_int_to_size(thread_count);
+    ddw->dcs = DP_malloc(dcs_size);
+    for (int i = 0; i < thread_count; ++i) {
+        ddw->dcs[i] = DP_draw_context_new();
+    }
+    ddw->ucs_or_null = NULL;
+    ddw->op_count = 0;
+    ddw->op_capacity = 0;
+    ddw->ops = NULL;
+    ddw->roots = NULL;
+    ddw->tails = NULL;
+    ddw->layer_count = 0;
+    ddw->layer_capacity = 0;
+    ddw->layers = NULL;
+    for (int i = 0; i < DP_USER_CURSOR_COUNT; ++i) {
+        ddw->last_by_context[i] = -1;
+    }
+    return ddw;
+}
+
+void DP_draw_dabs_worker_free(DP_DrawDabsWorker *ddw)
+{
+    if (ddw) {
+        DP_worker_free_join(ddw->worker);
+        for (int i = 0; i < ddw->thread_count; ++i) {
+            DP_draw_context_free(ddw->dcs[i]);
+        }
+        DP_free(ddw->dcs);
+        DP_free(ddw->layers);
+        DP_free(ddw->tails);
+        DP_free(ddw->roots);
+        DP_free(ddw->ops);
+        DP_free(ddw);
+    }
+}
+
+static int draw_dabs_find(DP_DrawDabsOp *ops, int i)
+{
+    while (ops[i].link != i) {
+        ops[i].link = ops[ops[i].link].link;
+        i = ops[i].link;
+    }
+    return i;
+}
+
+static void draw_dabs_union(DP_DrawDabsOp *ops, int a, int b)
+{
+    int root_a = draw_dabs_find(ops, a);
+    int root_b = draw_dabs_find(ops, b);
+    // Keep the earliest op as the root, that's where the group starts.
+    if (root_a < root_b) {
+        ops[root_b].link = root_a;
+    }
+    else if (root_b < root_a) {
+        ops[root_a].link = root_b;
+    }
+}
+
+static int *draw_dabs_layer_last(DP_DrawDabsWorker *ddw, int layer_id)
+{
+    int layer_count = ddw->layer_count;
+    DP_DrawDabsLayerLast *layers = ddw->layers;
+    // There's usually only a handful of layers involved, the most recently
+    // added one being the most likely match.
+    for (int i = layer_count - 1; i >= 0; --i) {
+        if (layers[i].layer_id == layer_id) {
+            return &layers[i].op_index;
+        }
+    }
+
+    if (layer_count == ddw->layer_capacity) {
+        int new_capacity = DP_max_int(8, layer_count * 2);
+        ddw->layers =
+            DP_realloc(layers, sizeof(*layers) * DP_int_to_size(new_capacity));
+        ddw->layer_capacity = new_capacity;
+    }
+    ddw->layers[layer_count] = (DP_DrawDabsLayerLast){layer_id, -1};
+    ddw->layer_count = layer_count + 1;
+    return &ddw->layers[layer_count].op_index;
+}
+
+static void draw_dabs_record(DP_DrawDabsWorker *ddw,
+                             DP_UserCursors *ucs_or_null,
+                             const DP_PaintDrawDabsParams *params,
+                             DP_TransientLayerContent *target,
+                             DP_LayerContent *mask_lc,
+                             DP_LayerContent *flood_lc)
+{
+    // Empty dabs don't draw anything, nor do they activate the cursor.
+    if (DP_paint_draw_dabs_empty(params)) {
+        return;
+    }
+
+    // Cursor activation appends to a list shared among all users, so it must
+    // happen here in message order. The threads only move their own cursors.
+    unsigned int context_id = params->context_id;
+    if (ucs_or_null) {
+        DP_user_cursors_activate(ucs_or_null, context_id);
+    }
+
+    int index = ddw->op_count;
+    if (index == ddw->op_capacity) {
+        int new_capacity = DP_max_int(64, index * 2);
+        size_t new_size = DP_int_to_size(new_capacity);
+        ddw->ops = DP_realloc(ddw->ops, sizeof(*ddw->ops) * new_size);
+        ddw->roots = DP_realloc(ddw->roots, sizeof(*ddw->roots) * new_size);
+        ddw->tails = DP_realloc(ddw->tails, sizeof(*ddw->tails) * new_size);
+        ddw->op_capacity = new_capacity;
+    }
+    ddw->ops[index] =
+        (DP_DrawDabsOp){*params, target, mask_lc, flood_lc, index};
+    ddw->op_count = index + 1;
+
+    // Dabs on the same layer must be applied in order. Sublayers carry the
+    // layer id of their parent, so they end up in its group as well. Dabs by
+    // the same user must stay in order too, since they move their cursor.
+    int *layer_last = draw_dabs_layer_last(ddw, params->layer_id);
+    if (*layer_last != -1) {
+        draw_dabs_union(ddw->ops, index, *layer_last);
+    }
+    *layer_last = index;
+
+    int *context_last = &ddw->last_by_context[context_id];
+    if (*context_last != -1) {
+        draw_dabs_union(ddw->ops, index, *context_last);
+    }
+    *context_last = index;
+}
+
+static void draw_dabs_apply(DP_DrawDabsWorker *ddw, DP_DrawContext *dc,
+                            DP_UserCursors *ucs_or_null)
+{
+    int op_count = ddw->op_count;
+    DP_DrawDabsOp *ops = ddw->ops;
+    int *roots = ddw->roots;
+    int *tails = ddw->tails;
+
+    // Resolve all roots first, since linking the groups below overwrites the
+    // union-find parents. Roots are always the first op of their group.
+    int group_count = 0;
+    for (int i = 0; i < op_count; ++i) {
+        int root = draw_dabs_find(ops, i);
+        roots[i] = root;
+        if (root == i) {
+            ++group_count;
+        }
+    }
+
+    for (int i = 0; i < op_count; ++i) {
+        int root = roots[i];
+        if (root != i) {
+            ops[tails[root]].link = i;
+        }
+        ops[i].link = -1;
+        tails[root] = i;
+    }
+
+    ddw->ucs_or_null = ucs_or_null;
+    if (group_count == 1) {
+        draw_dabs_run_group(ddw, dc, 0);
+    }
+    else {
+        // The calling thread takes on the first group itself.
+        for (int i = 1; i < op_count; ++i) {
+            if (roots[i] == i) {
+                DP_worker_push(ddw->worker,
+                               &(struct DP_DrawDabsJob){ddw, i});
+            }
+        }
+        draw_dabs_run_group(ddw, dc, 0);
+        DP_worker_wait(ddw->worker);
+    }
+    ddw->ucs_or_null = NULL;
+
+    for (int i = 0; i < op_count; ++i) {
+        ddw->last_by_context[ops[i].params.context_id] = -1;
+    }
+    ddw->op_count = 0;
+    ddw->layer_count = 0;
+}
+
 DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
                                  DP_UserCursors *ucs_or_null,
                                  bool (*next)(void *, DP_PaintDrawDabsParams *),
@@ -1293,6 +1544,7 @@ DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
     // bunches, so we support batching them for the sake of speed. This makes
     // this operation kinda complicated, but the speedup is worth it.
     DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
+    DP_DrawDabsWorker *ddw = DP_draw_context_draw_dabs_worker_nullable(dc);
     DP_TransientCanvasState *tcs = NULL;
     DP_TransientLayerContent *tlc = NULL;
     DP_TransientLayerContent *sub_tlc = NULL;
@@ -1440,7 +1692,18 @@ DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
             target = tlc;
         }
 
-        DP_paint_draw_dabs(dc, ucs_or_null, &params, target, mask_lc, flood_lc);
+        if (ddw) {
+            draw_dabs_record(ddw, ucs_or_null, &params, target, mask_lc,
+                             flood_lc);
+        }
+        else {
+            DP_paint_draw_dabs(dc, ucs_or_null, &params, target, mask_lc,
+                               flood_lc);
+        }
+    }
+
+    if (ddw && ddw->op_count != 0) {
+        draw_dabs_apply(ddw, dc, ucs_or_null);
     }
 
     switch (errors) {
@@ -2139,6 +2402,19 @@ DP_CanvasState *DP_ops_sync_selection_tile(DP_CanvasState *cs,
                                            int selection_id, int index,
                                            DP_Tile *tile_or_null)
 {
+    // Keep synced tiles as compact as locally made selections, where fully
+    // selected tiles share the opaque tile and unselected ones are left out.
+    if (tile_or_null) {
+        if (DP_tile_opaque(tile_or_null)) {
+            DP_tile_decref(tile_or_null);
+            tile_or_null = DP_tile_opaque_inc();
+        }
+        else if (DP_tile_blank(tile_or_null)) {
+            DP_tile_decref(tile_or_null);
+            tile_or_null = NULL;
+        }
+    }
+
     DP_LayerRoutesSelEntry lrse =
         DP_layer_routes_search_sel_only(cs, context_id, selection_id);
 
@@ -26,6 +26,7 @@
 
 typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_DrawContext DP_DrawContext;
+typedef struct DP_DrawDabsWorker DP_DrawDabsWorker;
 typedef struct DP_Image DP_Image;
 typedef struct DP_KeyFrameLayer DP_KeyFrameLayer;
 typedef struct DP_PaintDrawDabsParams DP_PaintDrawDabsParams;
@@ -113,6 +114,14 @@ DP_CanvasState *DP_ops_annotation_edit(DP_CanvasState *cs, int annotation_id,
 
 DP_CanvasState *DP_ops_annotation_delete(DP_CanvasState *cs, int annotation_id);
 
+// Dabs on different layers from different users don't depend on each other.
+// If the draw context has one of these workers attached, DP_ops_draw_dabs
+// splits its batch into such independent groups and applies them in parallel.
+// Each group keeps its order, so the result is identical to the serial one.
+DP_DrawDabsWorker *DP_draw_dabs_worker_new(int thread_count);
+
+void DP_draw_dabs_worker_free(DP_DrawDabsWorker *ddw);
+
 DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
                                  DP_UserCursors *ucs_or_null,
                                  bool (*next)(void *, DP_PaintDrawDabsParams *),
@@ -57,11 +57,23 @@
 #define CLASSIC_LUT_MAX_HARDNESS 100
 #define CLASSIC_LUT_COUNT \
     (CLASSIC_LUT_MAX_HARDNESS - CLASSIC_LUT_MIN_HARDNESS + 1)
+// Past the end of the lookup table there's zeroes, so that vectorized lookups
+// can clamp their indexes instead of branching. Gathers read 32 bits at a time,
+// so there's one more element of padding for them to read past the last one.
+#define CLASSIC_LUT_PADDING 2
+
+// Masks at least this large get put into the draw context's stamp cache, below
+// that they're cheap enough that it's not worth holding onto them.
+#define STAMP_CACHE_MIN_DIAMETER 64
+
+#define STAMP_CACHE_KEY_CLASSIC     0
+#define STAMP_CACHE_KEY_ROUND_PIXEL 1
 
 static uint16_t *generate_classic_lut(int index)
 {
     DP_debug("Generating classic dab lookup table for index %d", index);
-    uint16_t *cl = DP_malloc(sizeof(*cl) * CLASSIC_LUT_SIZE);
+    uint16_t *cl =
+        DP_malloc(sizeof(*cl) * (CLASSIC_LUT_SIZE + CLASSIC_LUT_PADDING));
     double h = 1.0 - (index / 100.0);
     double exponent = h < 0.0000004 ? 1000000.0 : 0.4 / h;
     double radius = CLASSIC_LUT_RADIUS;
@@ -69,6 +81,9 @@ static uint16_t *generate_classic_lut(int index)
         double d = 1.0 - pow(pow(sqrt(i) / radius, exponent), 2.0);
         cl[i] = DP_double_to_uint16(d * DP_BIT15);
     }
+    for (int i = 0; i < CLASSIC_LUT_PADDING; ++i) {
+        cl[CLASSIC_LUT_SIZE + i] = 0;
+    }
     return cl;
 }
 
@@ -113,15 +128,19 @@ static void get_stamp_buffer_pair(DP_DrawContext *dc, size_t diameter_squared,
     *out_mask2 = (void *)(buffer + mask_size + padding);
 }
 
+static size_t get_classic_stamp_capacity(float diameter)
+{
+    return DP_square_size(DP_float_to_size(floorf(diameter + 4.0f)));
+}
+
 static void get_classic_stamp_buffers(DP_DrawContext *dc, uint32_t max_size,
                                       uint16_t **out_mask,
                                       uint16_t **out_offset_mask)
 {
     float diameter =
         DP_uint32_to_float(clamp_subpixel_dab_size(max_size)) / 256.0f;
-    size_t diameter_squared =
-        DP_square_size(DP_float_to_size(floorf(diameter + 4.0f)));
-    get_stamp_buffer_pair(dc, diameter_squared, out_mask, out_offset_mask);
+    get_stamp_buffer_pair(dc, get_classic_stamp_capacity(diameter), out_mask,
+                          out_offset_mask);
 }
 
 static void prepare_stamp(DP_BrushStamp *stamp, int scaled_hardness,
@@ -138,6 +157,131 @@ static void prepare_stamp(DP_BrushStamp *stamp, int scaled_hardness,
     *out_lut_scale = DP_square_float((CLASSIC_LUT_RADIUS - 1.0f) / radius);
 }
 
+static void get_mask_row(uint16_t *d, const uint16_t *lut, int start_x,
+                         int count, float r, float offset, float yy,
+                         float fudge, float lut_scale)
+{
+    for (int x = start_x; x < start_x + count; ++x) {
+        float dist = (DP_square_float(DP_int_to_float(x) - r + offset) + yy)
+                   * fudge * lut_scale;
+        int i = DP_float_to_int(dist);
+        d[x] = i < CLASSIC_LUT_SIZE ? lut[i] : 0;
+    }
+}
+
+#ifdef DP_CPU_X64
+static void get_mask_row_sse(uint16_t *d, const uint16_t *lut, int start_x,
+                             int count, float r_float, float offset_float,
+                             float yy_float, float fudge_float,
+                             float lut_scale_float)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    // Refer to get_mask_row for the formulas, the operations are done in the
+    // same order to get the exact same results. There's no gather instruction
+    // in SSE, so the lookups themselves are still done one by one.
+    __m128 r = _mm_set1_ps(r_float);
+    __m128 offset = _mm_set1_ps(offset_float);
+    __m128 yy = _mm_set1_ps(yy_float);
+    __m128 fudge = _mm_set1_ps(fudge_float);
+    __m128 lut_scale = _mm_set1_ps(lut_scale_float);
+    __m128i max_index = _mm_set1_epi32(CLASSIC_LUT_SIZE);
+
+    __m128 xp = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f),
+                           _mm_set1_ps((float)start_x));
+
+    for (int x = start_x; x < start_x + count; x += 4) {
+        __m128 xx = _mm_add_ps(_mm_sub_ps(xp, r), offset);
+        __m128 dist = _mm_mul_ps(
+            _mm_mul_ps(_mm_add_ps(_mm_mul_ps(xx, xx), yy), fudge), lut_scale);
+        __m128i i = _mm_cvttps_epi32(dist);
+        // Clamp to the zero padding past the end of the table, spelled out
+        // with a compare since the minimum instruction is SSE4.1.
+        __m128i in_range = _mm_cmplt_epi32(i, max_index);
+        i = _mm_or_si128(_mm_and_si128(in_range, i),
+                         _mm_andnot_si128(in_range, max_index));
+
+        DP_ALIGNAS_SIMD int indexes[4];
+        _mm_store_si128((void *)indexes, i);
+        d[x] = lut[indexes[0]];
+        d[x + 1] = lut[indexes[1]];
+        d[x + 2] = lut[indexes[2]];
+        d[x + 3] = lut[indexes[3]];
+
+        xp = _mm_add_ps(xp, _mm_set1_ps(4.0f));
+    }
+}
+
+DP_TARGET_BEGIN("avx2")
+static void get_mask_row_avx2(uint16_t *d, const uint16_t *lut, int start_x,
+                              int count, float r_float, float offset_float,
+                              float yy_float, float fudge_float,
+                              float lut_scale_float)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    // Refer to get_mask_row for the formulas, same deal as the SSE version.
+    __m256 r = _mm256_set1_ps(r_float);
+    __m256 offset = _mm256_set1_ps(offset_float);
+    __m256 yy = _mm256_set1_ps(yy_float);
+    __m256 fudge = _mm256_set1_ps(fudge_float);
+    __m256 lut_scale = _mm256_set1_ps(lut_scale_float);
+    __m256i max_index = _mm256_set1_epi32(CLASSIC_LUT_SIZE);
+    __m256i low_mask = _mm256_set1_epi32(0xffff);
+
+    __m256 xp = _mm256_add_ps(
+        _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f),
+        _mm256_set1_ps((float)start_x));
+
+    for (int x = start_x; x < start_x + count; x += 8) {
+        __m256 xx = _mm256_add_ps(_mm256_sub_ps(xp, r), offset);
+        __m256 dist = _mm256_mul_ps(
+            _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(xx, xx), yy), fudge),
+            lut_scale);
+        __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(dist), max_index);
+
+        // Gather 32 bits per value and keep the lower 16 of them. This reads
+        // one element past the index, the table is padded to allow for that.
+        __m256i values = _mm256_and_si256(
+            _mm256_i32gather_epi32((const int *)lut, i, 2), low_mask);
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(values),
+                                          _mm256_extracti128_si256(values, 1));
+        _mm_storeu_si128((void *)&d[x], packed);
+
+        xp = _mm256_add_ps(xp, _mm256_set1_ps(8.0f));
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+#endif
+
+static void get_mask_rows(uint16_t *d, const uint16_t *lut, int diameter,
+                          float r, float offset, float fudge, float lut_scale)
+{
+    for (int y = 0; y < diameter; ++y) {
+        float yy = DP_square_float(DP_int_to_float(y) - r + offset);
+        uint16_t *row = d + y * diameter;
+        int x = 0;
+        int remaining = diameter;
+#ifdef DP_CPU_X64
+        if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+            int avx_width = remaining - remaining % 8;
+            get_mask_row_avx2(row, lut, x, avx_width, r, offset, yy, fudge,
+                              lut_scale);
+            remaining -= avx_width;
+            x += avx_width;
+        }
+
+        int sse_width = remaining - remaining % 4;
+        get_mask_row_sse(row, lut, x, sse_width, r, offset, yy, fudge,
+                         lut_scale);
+        remaining -= sse_width;
+        x += sse_width;
+#endif
+        get_mask_row(row, lut, x, remaining, r, offset, yy, fudge, lut_scale);
+    }
+}
+
 static void get_mask(DP_BrushStamp *stamp, float radius, int scaled_hardness)
 {
     float r = radius / 2.0f;
@@ -172,19 +316,7 @@ static void get_mask(DP_BrushStamp *stamp, float radius, int scaled_hardness)
         const uint16_t *lut;
         float lut_scale;
         prepare_stamp(stamp, scaled_hardness, r, diameter, &lut, &lut_scale);
-        uint16_t *d = stamp->data;
-
-        for (int y = 0; y < diameter; ++y) {
-            float yy = DP_square_float(DP_int_to_float(y) - r + offset);
-            for (int x = 0; x < diameter; ++x) {
-                float dist =
-                    (DP_square_float(DP_int_to_float(x) - r + offset) + yy)
-                    * fudge * lut_scale;
-                int i = DP_float_to_int(dist);
-                *d = i < CLASSIC_LUT_SIZE ? lut[i] : 0;
-                ++d;
-            }
-        }
+        get_mask_rows(stamp->data, lut, diameter, r, offset, fudge, lut_scale);
     }
 }
 
@@ -262,16 +394,35 @@ static void generate_offset_mask(uint16_t *dst, const uint16_t *src,
     }
 }
 
-static void get_classic_mask_stamp(DP_BrushStamp *stamp, float radius,
+static uint64_t get_stamp_cache_key(int kind, uint32_t size, int hardness)
+{
+    return ((uint64_t)kind << 48) | ((uint64_t)size << 8) | (uint64_t)hardness;
+}
+
+static void get_classic_mask_stamp(DP_DrawContext *dc, DP_BrushStamp *stamp,
+                                   uint16_t *mask, uint32_t size, float radius,
                                    int scaled_hardness)
 {
     // Don't bother with a high-resolution mask for large brushes.
     if (radius < 8.0f) {
+        stamp->data = mask;
         get_high_res_mask(stamp, radius, scaled_hardness);
     }
-    else {
+    else if (radius < STAMP_CACHE_MIN_DIAMETER) {
+        stamp->data = mask;
         get_mask(stamp, radius, scaled_hardness);
     }
+    else {
+        bool found;
+        DP_BrushStamp *cached = DP_draw_context_stamp_cache_search(
+            dc, get_stamp_cache_key(STAMP_CACHE_KEY_CLASSIC, size,
+                                    scaled_hardness),
+            get_classic_stamp_capacity(radius), &found);
+        if (!found) {
+            get_mask(cached, radius, scaled_hardness);
+        }
+        *stamp = *cached;
+    }
 }
 
 static bool needs_mask_lc(int top, int left, int diameter,
@@ -478,7 +629,7 @@ static void draw_dabs_classic(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
                     || scaled_hardness != last_scaled_hardness) {
                     last_size = size;
                     last_scaled_hardness = scaled_hardness;
-                    get_classic_mask_stamp(&mask_stamp, radius,
+                    get_classic_mask_stamp(dc, &mask_stamp, mask, size, radius,
                                            scaled_hardness);
                 }
 
@@ -508,7 +659,51 @@ uint16_t clamp_pixel_dab_size(uint16_t size)
     return size < DP_BRUSH_SIZE_MAX ? size : DP_BRUSH_SIZE_MAX;
 }
 
-static void get_round_pixel_mask_stamp(uint16_t *stamp_buffer, int diameter)
+static void get_round_pixel_mask_row(uint16_t *row, int start_x, int count,
+                                     float r, float rr, float yy)
+{
+    for (int x = start_x; x < start_x + count; ++x) {
+        float xx = DP_square_float(DP_int_to_float(x) - r + 0.5f);
+        row[x] = xx + yy <= rr ? DP_BIT15 : 0;
+    }
+}
+
+#ifdef DP_CPU_X64
+static void get_round_pixel_mask_row_sse(uint16_t *row, int start_x,
+                                         int count, float r_float,
+                                         float rr_float, float yy_float)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    // Refer to get_round_pixel_mask_row for the formula.
+    __m128 r = _mm_set1_ps(r_float);
+    __m128 rr = _mm_set1_ps(rr_float);
+    __m128 yy = _mm_set1_ps(yy_float);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128i value = _mm_set1_epi16((short)DP_BIT15);
+
+    __m128 xp = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f),
+                           _mm_set1_ps((float)start_x));
+
+    for (int x = start_x; x < start_x + count; x += 8) {
+        __m128 xx1 = _mm_add_ps(_mm_sub_ps(xp, r), half);
+        __m128 xp2 = _mm_add_ps(xp, _mm_set1_ps(4.0f));
+        __m128 xx2 = _mm_add_ps(_mm_sub_ps(xp2, r), half);
+        __m128 inside1 =
+            _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(xx1, xx1), yy), rr);
+        __m128 inside2 =
+            _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(xx2, xx2), yy), rr);
+        // The comparisons give all ones or all zeroes, so a signed saturating
+        // pack just narrows them down to 16 bits without changing their value.
+        __m128i inside = _mm_packs_epi32(_mm_castps_si128(inside1),
+                                         _mm_castps_si128(inside2));
+        _mm_storeu_si128((void *)&row[x], _mm_and_si128(inside, value));
+        xp = _mm_add_ps(xp, _mm_set1_ps(8.0f));
+    }
+}
+#endif
+
+static void generate_round_pixel_mask(uint16_t *stamp_buffer, int diameter)
 {
     DP_ASSERT(diameter <= DP_BRUSH_SIZE_MAX);
 
@@ -516,11 +711,39 @@ static void get_round_pixel_mask_stamp(uint16_t *stamp_buffer, int diameter)
     float rr = DP_square_float(r);
     for (int y = 0; y < diameter; ++y) {
         float yy = DP_square_float(DP_int_to_float(y) - r + 0.5f);
-        for (int x = 0; x < diameter; ++x) {
-            float xx = DP_square_float(DP_int_to_float(x) - r + 0.5f);
-            uint16_t value = xx + yy <= rr ? DP_BIT15 : 0;
-            stamp_buffer[y * diameter + x] = value;
+        uint16_t *row = stamp_buffer + y * diameter;
+        int x = 0;
+        int remaining = diameter;
+#ifdef DP_CPU_X64
+        int sse_width = remaining - remaining % 8;
+        get_round_pixel_mask_row_sse(row, x, sse_width, r, rr, yy);
+        remaining -= sse_width;
+        x += sse_width;
+#endif
+        get_round_pixel_mask_row(row, x, remaining, r, rr, yy);
+    }
+}
+
+static uint16_t *get_round_pixel_mask_stamp(DP_DrawContext *dc,
+                                            uint16_t *stamp_buffer,
+                                            int diameter)
+{
+    if (diameter < STAMP_CACHE_MIN_DIAMETER) {
+        generate_round_pixel_mask(stamp_buffer, diameter);
+        return stamp_buffer;
+    }
+    else {
+        bool found;
+        DP_BrushStamp *cached = DP_draw_context_stamp_cache_search(
+            dc,
+            get_stamp_cache_key(STAMP_CACHE_KEY_ROUND_PIXEL,
+                                DP_int_to_uint32(diameter), 0),
+            DP_square_size(DP_int_to_size(diameter)), &found);
+        if (!found) {
+            generate_round_pixel_mask(cached->data, diameter);
+            cached->diameter = diameter;
         }
+        return cached->data;
     }
 }
 
@@ -571,6 +794,7 @@ static void draw_dabs_pixel(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
         DP_UPixel15 pixel = DP_upixel15_from_color(params->color);
         int blend_mode = params->blend_mode;
         int last_diameter = -1;
+        uint16_t *mask = stamp_buffer;
         DP_BrushStamp stamp;
 
         for (int i = 0; i < dab_count; ++i) {
@@ -584,7 +808,9 @@ static void draw_dabs_pixel(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
             if (stamp.diameter != 0 && opacity != 0) {
                 // Round pixel dab masks need to be regenerated for new sizes.
                 if (!square && last_diameter != stamp.diameter) {
-                    get_round_pixel_mask_stamp(stamp_buffer, stamp.diameter);
+                    last_diameter = stamp.diameter;
+                    mask = get_round_pixel_mask_stamp(dc, stamp_buffer,
+                                                      stamp.diameter);
                 }
 
                 int offset = stamp.diameter / 2;
@@ -593,8 +819,7 @@ static void draw_dabs_pixel(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
                 if (needs_mask_lc(stamp.top, stamp.left, stamp.diameter,
                                   mask_lc_or_null)) {
                     apply_mask_lc_into(stamp.top, stamp.left, stamp.diameter,
-                                       stamp_buffer, masked_buffer,
-                                       mask_lc_or_null);
+                                       mask, masked_buffer, mask_lc_or_null);
                     if (needs_mask_lc(stamp.top, stamp.left, stamp.diameter,
                                       flood_lc_or_null)) {
                         apply_mask_lc(stamp.top, stamp.left, stamp.diameter,
@@ -605,12 +830,11 @@ static void draw_dabs_pixel(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
                 else if (needs_mask_lc(stamp.top, stamp.left, stamp.diameter,
                                        flood_lc_or_null)) {
                     apply_mask_lc_into(stamp.top, stamp.left, stamp.diameter,
-                                       stamp_buffer, masked_buffer,
-                                       flood_lc_or_null);
+                                       mask, masked_buffer, flood_lc_or_null);
                     stamp.data = masked_buffer;
                 }
                 else {
-                    stamp.data = stamp_buffer;
+                    stamp.data = mask;
                 }
 
                 DP_transient_layer_content_brush_stamp_apply(
@@ -741,6 +965,49 @@ static void calculate_rr_mask_row_avx(float *rr_mask_row, int start_x,
 DP_TARGET_END
 #endif
 
+#ifdef DP_CPU_ARM64
+static void calculate_rr_mask_row_neon(float *rr_mask_row, int start_x,
+                                       int yp_int, int count, float radius,
+                                       float aspect_ratio_float, float sn_float,
+                                       float cs_float,
+                                       float one_over_radius2_float)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    // Refer to calculate_rr_mask_row for the formulas
+
+    float32x4_t half_minus_radius = vdupq_n_f32(0.5f - radius);
+
+    float32x4_t aspect_ratio = vdupq_n_f32(aspect_ratio_float);
+    float32x4_t sn = vdupq_n_f32(sn_float);
+    float32x4_t cs = vdupq_n_f32(cs_float);
+    float32x4_t one_over_radius2 = vdupq_n_f32(one_over_radius2_float);
+
+    float32x4_t yy =
+        vaddq_f32(vdupq_n_f32(DP_int_to_float(yp_int)), half_minus_radius);
+
+    float lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t xp =
+        vaddq_f32(vld1q_f32(lanes), vdupq_n_f32(DP_int_to_float(start_x)));
+
+    for (int i = start_x; i < start_x + count; i += 4) {
+        float32x4_t xx = vaddq_f32(xp, half_minus_radius);
+        float32x4_t yyr = vmulq_f32(
+            vsubq_f32(vmulq_f32(yy, cs), vmulq_f32(xx, sn)), aspect_ratio);
+
+        float32x4_t xxr = vaddq_f32(vmulq_f32(yy, sn), vmulq_f32(xx, cs));
+
+        float32x4_t rr =
+            vmulq_f32(vaddq_f32(vmulq_f32(yyr, yyr), vmulq_f32(xxr, xxr)),
+                      one_over_radius2);
+
+        vst1q_f32(&rr_mask_row[i], rr);
+
+        xp = vaddq_f32(xp, vdupq_n_f32(4.0f));
+    }
+}
+#endif
+
 static void calculate_rr_mask(float *rr_mask, int idia, float radius,
                               float aspect_ratio, float sn, float cs,
                               float one_over_radius2)
@@ -773,6 +1040,26 @@ static void calculate_rr_mask(float *rr_mask, int idia, float radius,
         xp += sse_width;
 
 
+        calculate_rr_mask_row(&rr_mask[yp * idia], xp, yp, remaining, radius,
+                              aspect_ratio, sn, cs, one_over_radius2);
+    }
+#elif defined(DP_CPU_ARM64)
+    for (int yp = 0; yp < idia; ++yp) {
+        int xp = 0;
+        int remaining = idia;
+
+        if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 4;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            calculate_rr_mask_row_neon(&rr_mask[yp * idia], xp, yp, neon_width,
+                                       radius, aspect_ratio, sn, cs,
+                                       one_over_radius2);
+
+            remaining -= neon_width;
+            xp += neon_width;
+        }
+
         calculate_rr_mask_row(&rr_mask[yp * idia], xp, yp, remaining, radius,
                               aspect_ratio, sn, cs, one_over_radius2);
     }
@@ -859,6 +1146,237 @@ static float calculate_rr_antialiased(int xp, int yp, float radius,
     }
 }
 
+// The vectorized versions of calculate_rr_antialiased calculate both sides of
+// each branch and then pick the appropriate one for each pixel. The operations
+// are done in the same order, so the results are the same as the scalar code.
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("sse4.2")
+static __m128 calculate_r_sample_sse42(__m128 x, __m128 y, __m128 aspect_ratio,
+                                       __m128 sn, __m128 cs)
+{
+    __m128 yyr = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(y, cs), _mm_mul_ps(x, sn)),
+                            aspect_ratio);
+    __m128 xxr = _mm_add_ps(_mm_mul_ps(y, sn), _mm_mul_ps(x, cs));
+    return _mm_add_ps(_mm_mul_ps(yyr, yyr), _mm_mul_ps(xxr, xxr));
+}
+
+static void calculate_rr_antialiased_row_sse42(
+    float *rr_mask_row, int start_x, int yp, int count, float radius_float,
+    float aspect_ratio_float, float sn_float, float cs_float,
+    float one_over_radius2_float, float r_aa_start_float)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 radius = _mm_set1_ps(radius_float);
+    __m128 aspect_ratio = _mm_set1_ps(aspect_ratio_float);
+    __m128 sn = _mm_set1_ps(sn_float);
+    __m128 cs = _mm_set1_ps(cs_float);
+    __m128 one_over_radius2 = _mm_set1_ps(one_over_radius2_float);
+    __m128 r_aa_start = _mm_set1_ps(r_aa_start_float);
+    __m128 l2 = _mm_set1_ps(cs_float * cs_float + sn_float * sn_float);
+    __m128 sn_offset = _mm_set1_ps(sn_float * RADIUS_OF_CIRCLE_WITH_AREA_1);
+    __m128 cs_offset = _mm_set1_ps(cs_float * RADIUS_OF_CIRCLE_WITH_AREA_1);
+
+    __m128 pixel_bottom = _mm_set1_ps(radius_float - DP_int_to_float(yp));
+    __m128 pixel_center_y = _mm_sub_ps(pixel_bottom, half);
+    __m128 pixel_top = _mm_sub_ps(pixel_bottom, one);
+    __m128 y_inside = _mm_and_ps(_mm_cmplt_ps(pixel_top, zero),
+                                 _mm_cmpgt_ps(pixel_bottom, zero));
+
+    __m128 xp = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f),
+                           _mm_set1_ps(DP_int_to_float(start_x)));
+
+    for (int i = start_x; i < start_x + count; i += 4) {
+        __m128 pixel_right = _mm_sub_ps(radius, xp);
+        __m128 pixel_center_x = _mm_sub_ps(pixel_right, half);
+        __m128 pixel_left = _mm_sub_ps(pixel_right, one);
+        __m128 inside =
+            _mm_and_ps(y_inside, _mm_and_ps(_mm_cmplt_ps(pixel_left, zero),
+                                            _mm_cmpgt_ps(pixel_right, zero)));
+
+        __m128 ltp_dot = _mm_add_ps(_mm_mul_ps(pixel_center_x, cs),
+                                    _mm_mul_ps(pixel_center_y, sn));
+        __m128 t = _mm_div_ps(ltp_dot, l2);
+        __m128 nearest_x = _mm_andnot_ps(
+            inside,
+            _mm_min_ps(pixel_right, _mm_max_ps(pixel_left, _mm_mul_ps(cs, t))));
+        __m128 nearest_y = _mm_andnot_ps(
+            inside,
+            _mm_min_ps(pixel_top, _mm_max_ps(pixel_bottom, _mm_mul_ps(sn, t))));
+        __m128 rr_near = _mm_mul_ps(
+            calculate_r_sample_sse42(nearest_x, nearest_y, aspect_ratio, sn,
+                                     cs),
+            one_over_radius2);
+
+        __m128 center_sign =
+            _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(pixel_center_x, cs), sn),
+                       _mm_mul_ps(cs, _mm_add_ps(pixel_center_y, sn)));
+        __m128 negative = _mm_cmplt_ps(center_sign, zero);
+        __m128 farthest_x =
+            _mm_blendv_ps(_mm_add_ps(nearest_x, sn_offset),
+                          _mm_sub_ps(nearest_x, sn_offset), negative);
+        __m128 farthest_y =
+            _mm_blendv_ps(_mm_sub_ps(nearest_y, cs_offset),
+                          _mm_add_ps(nearest_y, cs_offset), negative);
+
+        __m128 r_far = calculate_r_sample_sse42(farthest_x, farthest_y,
+                                                aspect_ratio, sn, cs);
+        __m128 rr_far = _mm_mul_ps(r_far, one_over_radius2);
+
+        __m128 rr_average = _mm_mul_ps(_mm_add_ps(rr_far, rr_near), half);
+        __m128 visibility_near =
+            _mm_div_ps(_mm_sub_ps(one, rr_near),
+                       _mm_add_ps(one, _mm_sub_ps(rr_far, rr_near)));
+        __m128 rr_visibility = _mm_sub_ps(one, visibility_near);
+
+        __m128 rr = _mm_blendv_ps(
+            _mm_blendv_ps(rr_visibility, rr_average,
+                          _mm_cmplt_ps(r_far, r_aa_start)),
+            rr_near, _mm_cmpgt_ps(rr_near, one));
+
+        _mm_storeu_ps(&rr_mask_row[i], rr);
+
+        xp = _mm_add_ps(xp, _mm_set1_ps(4.0f));
+    }
+}
+DP_TARGET_END
+#endif
+
+#ifdef DP_CPU_ARM64
+static float32x4_t calculate_r_sample_neon(float32x4_t x, float32x4_t y,
+                                           float32x4_t aspect_ratio,
+                                           float32x4_t sn, float32x4_t cs)
+{
+    float32x4_t yyr =
+        vmulq_f32(vsubq_f32(vmulq_f32(y, cs), vmulq_f32(x, sn)), aspect_ratio);
+    float32x4_t xxr = vaddq_f32(vmulq_f32(y, sn), vmulq_f32(x, cs));
+    return vaddq_f32(vmulq_f32(yyr, yyr), vmulq_f32(xxr, xxr));
+}
+
+static void calculate_rr_antialiased_row_neon(
+    float *rr_mask_row, int start_x, int yp, int count, float radius_float,
+    float aspect_ratio_float, float sn_float, float cs_float,
+    float one_over_radius2_float, float r_aa_start_float)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t half = vdupq_n_f32(0.5f);
+    float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t radius = vdupq_n_f32(radius_float);
+    float32x4_t aspect_ratio = vdupq_n_f32(aspect_ratio_float);
+    float32x4_t sn = vdupq_n_f32(sn_float);
+    float32x4_t cs = vdupq_n_f32(cs_float);
+    float32x4_t one_over_radius2 = vdupq_n_f32(one_over_radius2_float);
+    float32x4_t r_aa_start = vdupq_n_f32(r_aa_start_float);
+    float32x4_t l2 = vdupq_n_f32(cs_float * cs_float + sn_float * sn_float);
+    float32x4_t sn_offset =
+        vdupq_n_f32(sn_float * RADIUS_OF_CIRCLE_WITH_AREA_1);
+    float32x4_t cs_offset =
+        vdupq_n_f32(cs_float * RADIUS_OF_CIRCLE_WITH_AREA_1);
+
+    float32x4_t pixel_bottom =
+        vdupq_n_f32(radius_float - DP_int_to_float(yp));
+    float32x4_t pixel_center_y = vsubq_f32(pixel_bottom, half);
+    float32x4_t pixel_top = vsubq_f32(pixel_bottom, one);
+    uint32x4_t y_inside =
+        vandq_u32(vcltq_f32(pixel_top, zero), vcgtq_f32(pixel_bottom, zero));
+
+    float lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t xp =
+        vaddq_f32(vld1q_f32(lanes), vdupq_n_f32(DP_int_to_float(start_x)));
+
+    for (int i = start_x; i < start_x + count; i += 4) {
+        float32x4_t pixel_right = vsubq_f32(radius, xp);
+        float32x4_t pixel_center_x = vsubq_f32(pixel_right, half);
+        float32x4_t pixel_left = vsubq_f32(pixel_right, one);
+        uint32x4_t inside =
+            vandq_u32(y_inside, vandq_u32(vcltq_f32(pixel_left, zero),
+                                          vcgtq_f32(pixel_right, zero)));
+
+        float32x4_t ltp_dot = vaddq_f32(vmulq_f32(pixel_center_x, cs),
+                                        vmulq_f32(pixel_center_y, sn));
+        float32x4_t t = vdivq_f32(ltp_dot, l2);
+        float32x4_t nearest_x = vbslq_f32(
+            inside, zero,
+            vminq_f32(pixel_right, vmaxq_f32(pixel_left, vmulq_f32(cs, t))));
+        float32x4_t nearest_y = vbslq_f32(
+            inside, zero,
+            vminq_f32(pixel_top, vmaxq_f32(pixel_bottom, vmulq_f32(sn, t))));
+        float32x4_t rr_near = vmulq_f32(
+            calculate_r_sample_neon(nearest_x, nearest_y, aspect_ratio, sn, cs),
+            one_over_radius2);
+
+        float32x4_t center_sign =
+            vsubq_f32(vmulq_f32(vsubq_f32(pixel_center_x, cs), sn),
+                      vmulq_f32(cs, vaddq_f32(pixel_center_y, sn)));
+        uint32x4_t center_sign_negative = vcltq_f32(center_sign, zero);
+        float32x4_t farthest_x =
+            vbslq_f32(center_sign_negative, vsubq_f32(nearest_x, sn_offset),
+                      vaddq_f32(nearest_x, sn_offset));
+        float32x4_t farthest_y =
+            vbslq_f32(center_sign_negative, vaddq_f32(nearest_y, cs_offset),
+                      vsubq_f32(nearest_y, cs_offset));
+
+        float32x4_t r_far = calculate_r_sample_neon(farthest_x, farthest_y,
+                                                    aspect_ratio, sn, cs);
+        float32x4_t rr_far = vmulq_f32(r_far, one_over_radius2);
+
+        float32x4_t rr_average = vmulq_f32(vaddq_f32(rr_far, rr_near), half);
+        float32x4_t visibility_near =
+            vdivq_f32(vsubq_f32(one, rr_near),
+                      vaddq_f32(one, vsubq_f32(rr_far, rr_near)));
+        float32x4_t rr_visibility = vsubq_f32(one, visibility_near);
+
+        float32x4_t rr = vbslq_f32(
+            vcgtq_f32(rr_near, one), rr_near,
+            vbslq_f32(vcltq_f32(r_far, r_aa_start), rr_average, rr_visibility));
+
+        vst1q_f32(&rr_mask_row[i], rr);
+
+        xp = vaddq_f32(xp, vdupq_n_f32(4.0f));
+    }
+}
+#endif
+
+static void calculate_rr_mask_antialiased(float *rr_mask, int idia,
+                                          float radius, float aspect_ratio,
+                                          float sn, float cs,
+                                          float one_over_radius2,
+                                          float r_aa_start)
+{
+    for (int yp = 0; yp < idia; ++yp) {
+        float *rr_mask_row = &rr_mask[yp * idia];
+        int xp = 0;
+#if defined(DP_CPU_X64) || defined(DP_CPU_ARM64)
+        int simd_width = idia - idia % 4;
+#endif
+#ifdef DP_CPU_X64
+        if (DP_cpu_support >= DP_CPU_SUPPORT_SSE42) {
+            calculate_rr_antialiased_row_sse42(rr_mask_row, xp, yp, simd_width,
+                                               radius, aspect_ratio, sn, cs,
+                                               one_over_radius2, r_aa_start);
+            xp += simd_width;
+        }
+#elif defined(DP_CPU_ARM64)
+        if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+            calculate_rr_antialiased_row_neon(rr_mask_row, xp, yp, simd_width,
+                                              radius, aspect_ratio, sn, cs,
+                                              one_over_radius2, r_aa_start);
+            xp += simd_width;
+        }
+#endif
+        for (; xp < idia; ++xp) {
+            rr_mask_row[xp] =
+                calculate_rr_antialiased(xp, yp, radius, aspect_ratio, sn, cs,
+                                         one_over_radius2, r_aa_start);
+        }
+    }
+}
+
 static void calculate_opa_mask(uint16_t *mask, float *rr_mask, int count,
                                float hardness, float segment1_offset,
                                float segment1_slope, float segment2_offset,
@@ -992,6 +1510,56 @@ static void calculate_opa_mask_avx2(uint16_t *mask, float *rr_mask, int count,
 DP_TARGET_END
 #endif
 
+#ifdef DP_CPU_ARM64
+static uint16x4_t calculate_opa_mask_load_and_calculate_neon(
+    float *rr_mask, float32x4_t hardness, float32x4_t segment1_offset,
+    float32x4_t segment1_slope, float32x4_t segment2_offset,
+    float32x4_t segment2_slope)
+{
+    float32x4_t rr = vld1q_f32(rr_mask);
+
+    float32x4_t if_le_hardness =
+        vaddq_f32(segment1_offset, vmulq_f32(rr, segment1_slope));
+    float32x4_t else_le_hardness =
+        vaddq_f32(segment2_offset, vmulq_f32(rr, segment2_slope));
+
+    float32x4_t opa =
+        vbslq_f32(vcgtq_f32(rr, vdupq_n_f32(1.0f)), vdupq_n_f32(0.0f),
+                  vbslq_f32(vcleq_f32(rr, hardness), if_le_hardness,
+                            else_le_hardness));
+
+    // Round to nearest like the x86 versions do.
+    return vqmovun_s32(
+        vcvtnq_s32_f32(vmulq_f32(opa, vdupq_n_f32((float)DP_BIT15))));
+}
+
+static void calculate_opa_mask_neon(uint16_t *mask, float *rr_mask, int count,
+                                    float hardness_f, float segment1_offset_f,
+                                    float segment1_slope_f,
+                                    float segment2_offset_f,
+                                    float segment2_slope_f)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    // Refer to calculate_opa_mask for conditions
+    float32x4_t hardness = vdupq_n_f32(hardness_f);
+    float32x4_t segment1_offset = vdupq_n_f32(segment1_offset_f);
+    float32x4_t segment1_slope = vdupq_n_f32(segment1_slope_f);
+    float32x4_t segment2_offset = vdupq_n_f32(segment2_offset_f);
+    float32x4_t segment2_slope = vdupq_n_f32(segment2_slope_f);
+
+    for (int i = 0; i < count; i += 8) {
+        uint16x4_t _16_1 = calculate_opa_mask_load_and_calculate_neon(
+            &rr_mask[i], hardness, segment1_offset, segment1_slope,
+            segment2_offset, segment2_slope);
+        uint16x4_t _16_2 = calculate_opa_mask_load_and_calculate_neon(
+            &rr_mask[i + 4], hardness, segment1_offset, segment1_slope,
+            segment2_offset, segment2_slope);
+        vst1q_u16(&mask[i], vcombine_u16(_16_1, _16_2));
+    }
+}
+#endif
+
 static void calculate_opa(uint16_t *mask, float *rr_mask, int count,
                           float hardness, float segment1_offset,
                           float segment1_slope, float segment2_offset,
@@ -1023,6 +1591,19 @@ static void calculate_opa(uint16_t *mask, float *rr_mask, int count,
         mask += sse_width;
         rr_mask += sse_width;
     }
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        int remaining_after_neon_width = count % 8;
+        int neon_width = count - remaining_after_neon_width;
+
+        calculate_opa_mask_neon(mask, rr_mask, neon_width, hardness,
+                                segment1_offset, segment1_slope,
+                                segment2_offset, segment2_slope);
+
+        count -= neon_width;
+        mask += neon_width;
+        rr_mask += neon_width;
+    }
 #endif
 
     calculate_opa_mask(mask, rr_mask, count, hardness, segment1_offset,
@@ -1069,13 +1650,8 @@ static float get_mypaint_brush_stamp(DP_BrushStamp *stamp, uint16_t *mask,
     if (radius < 3.0f) {
         float aa_start = DP_max_float(0.0f, radius - AA_BORDER);
         float r_aa_start = aa_start * (aa_start / aspect_ratio);
-        for (int yp = 0; yp < idia; ++yp) {
-            for (int xp = 0; xp < idia; ++xp) {
-                rr_mask[yp * idia + xp] =
-                    calculate_rr_antialiased(xp, yp, radius, aspect_ratio, sn,
-                                             cs, one_over_radius2, r_aa_start);
-            }
-        }
+        calculate_rr_mask_antialiased(rr_mask, idia, radius, aspect_ratio, sn,
+                                      cs, one_over_radius2, r_aa_start);
     }
     else {
         calculate_rr_mask(rr_mask, idia, radius, aspect_ratio, sn, cs,
@@ -1460,6 +2036,53 @@ void DP_paint_draw_dabs(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
 }
 
 
+bool DP_paint_draw_dabs_empty(const DP_PaintDrawDabsParams *params)
+{
+    DP_ASSERT(params);
+    int dab_count = params->dab_count;
+    switch (params->type) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_ClassicDab *dab =
+                DP_classic_dab_at(params->classic.dabs, i);
+            if (DP_classic_dab_size(dab) > 0) {
+                return false;
+            }
+        }
+        return true;
+    case DP_MSG_DRAW_DABS_PIXEL:
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_PixelDab *dab = DP_pixel_dab_at(params->pixel.dabs, i);
+            if (DP_pixel_dab_size(dab) > 0) {
+                return false;
+            }
+        }
+        return true;
+    case DP_MSG_DRAW_DABS_MYPAINT:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_MyPaintDab *dab =
+                DP_mypaint_dab_at(params->mypaint.dabs, i);
+            if (DP_mypaint_dab_size(dab) > 0) {
+                return false;
+            }
+        }
+        return true;
+    case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_MyPaintBlendDab *dab =
+                DP_mypaint_blend_dab_at(params->mypaint_blend.dabs, i);
+            if (DP_mypaint_blend_dab_size(dab) > 0) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+
 DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
                                                  int left, int top,
                                                  int last_diameter)
@@ -85,6 +85,10 @@ void DP_paint_draw_dabs(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
                         DP_LayerContent *mask_lc_or_null,
                         DP_LayerContent *flood_lc_or_null);
 
+// Whether all dabs have a size of zero, in which case drawing them neither
+// touches any pixels nor moves the user's cursor.
+bool DP_paint_draw_dabs_empty(const DP_PaintDrawDabsParams *params);
+
 DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
                                                  int left, int top,
                                                  int last_diameter);
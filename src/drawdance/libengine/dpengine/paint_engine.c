@@ -23,7 +23,6 @@
 #include "canvas_diff.h"
 #include "canvas_history.h"
 #include "canvas_state.h"
-#include "dab_cost.h"
 #include "draw_context.h"
 #include "image.h"
 #include "layer_content.h"
@@ -33,6 +32,9 @@
 #include "layer_props_list.h"
 #include "layer_routes.h"
 #include "local_state.h"
+#include "memory_report.h"
+#include "message_cost.h"
+#include "ops.h"
 #include "paint.h"
 #include "player.h"
 #include "preview.h"
@@ -60,6 +62,7 @@
 #include <dpmsg/message.h>
 #include <dpmsg/message_queue.h>
 #include <dpmsg/msg_internal.h>
+#include <float.h>
 
 #define DP_PERF_CONTEXT "paint_engine"
 
@@ -76,6 +79,41 @@
 #define PUSH_MESSAGE          1
 #define PUSH_CLEAR_LOCAL_FORK 2
 
+// With a tile memory budget set, tiles that haven't been used in this many
+// ticks are candidates for getting compressed. That's around ten seconds.
+#define TILE_RESIDENCY_MIN_IDLE_TICKS 600
+
+// When memory runs low, tiles idle for around a second get compressed, going
+// through this many batches of them right away instead of one per tick.
+#define TRIM_MEMORY_MIN_IDLE_TICKS    60
+#define TRIM_MEMORY_RESIDENCY_BATCHES 64
+
+// Lowest level of detail below full resolution that's rendered when zoomed out,
+// which samples one pixel out of every 8x8 block.
+#define RENDER_LOD_MIN 3
+
+// Threads applying dabs on independent layers, on top of the paint thread.
+// Multidab batches rarely involve more than a few users at once.
+#define DRAW_DABS_THREAD_COUNT_MAX 7
+
+// Threads decompressing the tiles of upcoming put tile messages, which is most
+// of the work when catching up to a session. Only used when there's at least
+// the minimum number of those queued up in a row.
+#define PREDECODE_THREAD_COUNT_MAX 8
+#define PREDECODE_MESSAGES_MIN     4
+#define PREDECODE_MESSAGES_MAX     256
+
+// Most remote messages looked through for a hard reset that makes everything
+// in front of it moot. The search only happens when new ones arrive, so this
+// just bounds how long a single one can take.
+#define FAST_FORWARD_WINDOW 65536
+
+// Local dabs that the paint thread hasn't gotten around to after this long get
+// rendered as a preview so that the user doesn't see their stroke lag behind.
+// Usually the paint thread is faster than that and no preview happens at all.
+#define STROKE_PREVIEW_DELAY_NS     8000000ULL
+#define STROKE_PREVIEW_MESSAGES_MAX 1024
+
 typedef struct DP_PaintEngineCursorChange {
     DP_MessageType type;
     unsigned int context_id;
@@ -91,6 +129,26 @@ typedef struct DP_PaintEngineCursorChange {
     };
 } DP_PaintEngineCursorChange;
 
+// When a batch of messages was queued and how many of them are still left.
+typedef struct DP_PaintEngineQueueStamp {
+    unsigned long long time;
+    int count;
+} DP_PaintEngineQueueStamp;
+
+typedef struct DP_PaintEngineQueue {
+    DP_Queue messages;
+    DP_Queue stamps;
+} DP_PaintEngineQueue;
+
+// A local drawing dabs message that hasn't been handled yet. The sequence
+// number counts up the same way as the canvas history's local dabs counter.
+typedef struct DP_PaintEngineStrokePreviewEntry {
+    DP_Message *msg;
+    unsigned long long seq;
+    unsigned long long time;
+    int layer_id;
+} DP_PaintEngineStrokePreviewEntry;
+
 struct DP_PaintEngine {
     DP_AclState *acls;
     DP_CanvasHistory *ch;
@@ -121,16 +179,67 @@ struct DP_PaintEngine {
         } tracks;
     } local_view;
     DP_DrawContext *paint_dc;
+    DP_DrawDabsWorker *draw_dabs_worker;
     DP_DrawContext *main_dc;
     DP_Preview *previews[DP_PREVIEW_COUNT];
     DP_AtomicPtr next_previews[DP_PREVIEW_COUNT];
     DP_Atomic preview_rerendered;
     DP_PreviewRenderer *preview_renderer;
-    DP_Queue local_queue;
-    DP_Queue remote_queue;
+    // Retained transform preview sources, reused as long as the caller passes
+    // the same non-zero key for the same preview id.
+    struct {
+        long long key;
+        DP_PreviewTransformSource *pvts;
+    } transform_sources[DP_PREVIEW_TRANSFORM_COUNT];
+    struct {
+        // Protected by the queue mutex, appended to when local messages are
+        // pushed and trimmed by the tick once they show up in the history.
+        DP_Queue pending;
+        unsigned long long pushed;
+        // Only touched by the tick, what was last sent off to be rendered.
+        unsigned long long requested_seq;
+        int requested_count;
+        DP_Message *buffer[STROKE_PREVIEW_MESSAGES_MAX];
+    } stroke_preview;
+    DP_PaintEngineQueue local_queue;
+    DP_PaintEngineQueue remote_queue;
     DP_Semaphore *queue_sem;
     DP_Mutex *queue_mutex;
+    struct {
+        // Only touched by the paint thread, which moves queued messages in here
+        // in one go. That way it doesn't hold the queue mutex while picking
+        // messages apart into batches and other threads don't get blocked.
+        DP_PaintEngineQueue local;
+        DP_PaintEngineQueue remote;
+        // Set when messages get queued, so that the paint thread only needs to
+        // take the mutex when there's actually something new to pick up.
+        DP_Atomic local_pending;
+        DP_Atomic remote_pending;
+        // Set when remote messages were taken, so that the paint thread only
+        // looks for superseded ones when there's something new to look at.
+        bool remote_arrived;
+        int max_queued;
+        unsigned long long handled;
+        unsigned long long skipped;
+        unsigned long long queue_ns;
+        unsigned long long max_queue_ns;
+        // Copy for other threads to read, protected by the spin lock.
+        DP_Atomic stats_lock;
+        DP_PaintEngineQueueStatistics stats;
+    } inbox;
+    struct {
+        // Created on demand, a thread count of zero means there's none.
+        int thread_count;
+        DP_Worker *worker;
+        DP_DrawContext **dcs;
+        DP_Semaphore *sem;
+        int used;
+        int next;
+        DP_Message *msgs[PREDECODE_MESSAGES_MAX];
+        DP_Tile *tiles[PREDECODE_MESSAGES_MAX];
+    } predecode;
     DP_Atomic running;
+    DP_Atomic fast_forward;
     DP_Atomic catchup;
     DP_Atomic default_layer_id;
     DP_Atomic undo_depth_limit;
@@ -139,6 +248,7 @@ struct DP_PaintEngine {
     bool reset_locked;
     DP_Thread *paint_thread;
     DP_Renderer *renderer;
+    int render_lod;
     struct {
         uint8_t acl_change_flags;
         DP_Vector cursor_changes;
@@ -157,13 +267,141 @@ struct DP_PaintEngine {
         DP_PaintEngineStreamResetStartFn start_fn;
         void *user;
     } stream_reset;
+    size_t tile_memory_budget;
+    struct {
+        // Only touched by the paint thread.
+        double scales[DP_PAINT_ENGINE_DAB_TYPE_COUNT];
+        double costs[DP_PAINT_ENGINE_DAB_TYPE_COUNT];
+        // Copy for other threads to read, protected by the spin lock.
+        DP_Atomic stats_lock;
+        DP_PaintEngineMultidabStatistics stats;
+    } multidab;
 };
 
 
+static void queue_init(DP_PaintEngineQueue *q)
+{
+    DP_message_queue_init(&q->messages, INITIAL_QUEUE_CAPACITY);
+    DP_queue_init(&q->stamps, INITIAL_QUEUE_CAPACITY,
+                  sizeof(DP_PaintEngineQueueStamp));
+}
+
+static void queue_dispose(DP_PaintEngineQueue *q)
+{
+    DP_queue_dispose(&q->stamps);
+    DP_message_queue_dispose(&q->messages);
+}
+
+static void queue_push_stamp(DP_PaintEngineQueue *q, unsigned long long time,
+                             int count)
+{
+    DP_PaintEngineQueueStamp *last =
+        DP_queue_peek_last(&q->stamps, sizeof(*last));
+    if (last && last->time == time) {
+        last->count += count;
+    }
+    else {
+        DP_PaintEngineQueueStamp *stamp =
+            DP_queue_push(&q->stamps, sizeof(*stamp));
+        *stamp = (DP_PaintEngineQueueStamp){time, count};
+    }
+}
+
+static void queue_push_noinc(DP_PaintEngineQueue *q, DP_Message *msg,
+                             unsigned long long time)
+{
+    DP_message_queue_push_noinc(&q->messages, msg);
+    queue_push_stamp(q, time, 1);
+}
+
+static void queue_push_inc(DP_PaintEngineQueue *q, DP_Message *msg,
+                           unsigned long long time)
+{
+    queue_push_noinc(q, DP_message_incref(msg), time);
+}
+
+static DP_Message *queue_peek(DP_PaintEngineQueue *q)
+{
+    return DP_message_queue_peek(&q->messages);
+}
+
+static DP_Message *queue_shift(DP_PaintEngineQueue *q,
+                               unsigned long long *out_time)
+{
+    DP_Message *msg = DP_message_queue_shift(&q->messages);
+    if (msg) {
+        DP_PaintEngineQueueStamp *stamp =
+            DP_queue_peek(&q->stamps, sizeof(*stamp));
+        DP_ASSERT(stamp);
+        DP_ASSERT(stamp->count > 0);
+        *out_time = stamp->time;
+        if (--stamp->count == 0) {
+            DP_queue_shift(&q->stamps);
+        }
+    }
+    return msg;
+}
+
+static void queue_append(DP_PaintEngineQueue *dst, DP_PaintEngineQueue *src)
+{
+    if (dst->messages.used == 0) {
+        DP_PaintEngineQueue tmp = *dst;
+        *dst = *src;
+        *src = tmp;
+    }
+    else {
+        DP_Message *msg;
+        while ((msg = DP_message_queue_shift(&src->messages)) != NULL) {
+            DP_message_queue_push_noinc(&dst->messages, msg);
+        }
+        DP_PaintEngineQueueStamp *stamp;
+        while ((stamp = DP_queue_peek(&src->stamps, sizeof(*stamp))) != NULL) {
+            queue_push_stamp(dst, stamp->time, stamp->count);
+            DP_queue_shift(&src->stamps);
+        }
+    }
+}
+
+// Must be called with the queue mutex held.
+static void push_queued_messages(DP_PaintEngine *pe, bool local, int count)
+{
+    DP_atomic_set(local ? &pe->inbox.local_pending : &pe->inbox.remote_pending,
+                  true);
+    DP_SEMAPHORE_MUST_POST_N(pe->queue_sem, count);
+}
+
+// Called on the paint thread with the queue mutex held.
+static void take_queued_messages(DP_PaintEngine *pe)
+{
+    DP_atomic_set(&pe->inbox.local_pending, false);
+    DP_atomic_set(&pe->inbox.remote_pending, false);
+    if (pe->remote_queue.messages.used != 0) {
+        pe->inbox.remote_arrived = true;
+    }
+    queue_append(&pe->inbox.local, &pe->local_queue);
+    queue_append(&pe->inbox.remote, &pe->remote_queue);
+}
+
+static void dispose_stroke_preview_entry(void *element)
+{
+    DP_PaintEngineStrokePreviewEntry *entry = element;
+    DP_message_decref(entry->msg);
+}
+
+// Called with the queue mutex held.
+static void clear_stroke_preview_entries(DP_PaintEngine *pe)
+{
+    DP_queue_clear(&pe->stroke_preview.pending,
+                   sizeof(DP_PaintEngineStrokePreviewEntry),
+                   dispose_stroke_preview_entry);
+}
+
 static void push_cleanup_message(void *user, DP_Message *msg)
 {
+    // Called on the paint thread during cleanup, so this goes straight into
+    // the inbox, remote messages that are already in there come before it.
     DP_PaintEngine *pe = user;
-    DP_message_queue_push_noinc(&pe->remote_queue, msg);
+    queue_push_noinc(&pe->inbox.remote, msg, DP_perf_time());
     DP_SEMAPHORE_MUST_POST(pe->queue_sem);
 }
 
@@ -299,11 +537,14 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
     }
     case DP_MSG_INTERNAL_TYPE_CLEANUP:
         DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        take_queued_messages(pe);
         DP_canvas_history_cleanup(pe->ch, dc, push_cleanup_message, pe);
-        while (pe->local_queue.used != 0) {
-            DP_message_queue_push_noinc(
-                &pe->remote_queue, DP_message_queue_shift(&pe->local_queue));
-        }
+        queue_append(&pe->inbox.remote, &pe->inbox.local);
+        // Unhandled local dabs just got turned into remote ones, so they're
+        // not going to be counted by the history, start counting afresh.
+        clear_stroke_preview_entries(pe);
+        pe->stroke_preview.pushed =
+            DP_canvas_history_local_dabs_handled(pe->ch);
         // We might have gotten disconnected while catching up after joining the
         // session or during a reset, so say we're 100% caught up after cleanup.
         push_cleanup_message(pe, DP_msg_internal_catchup_new(0, 100));
@@ -382,6 +623,20 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
         DP_canvas_history_reconnect_state_free(chrs);
         break;
     }
+    case DP_MSG_INTERNAL_TYPE_MEMORY_REPORT: {
+        DP_MemoryReport *mr = DP_msg_internal_memory_report_get(mi);
+        DP_canvas_history_memory_report_add(pe->ch, mr);
+        DP_msg_internal_memory_report_call(mi, mr);
+        break;
+    }
+    case DP_MSG_INTERNAL_TYPE_TRIM_MEMORY: {
+        int save_points = DP_canvas_history_save_points_trim(pe->ch);
+        size_t pool_bytes = DP_draw_context_pools_release(dc);
+        DP_info("Trimmed paint thread memory: dropped %d save point(s), "
+                "released %zu bytes of draw context pools",
+                save_points, pool_bytes);
+        break;
+    }
     default:
         DP_warn("Unhandled internal message type %d", (int)type);
         break;
@@ -397,142 +652,121 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
 // Maximum number of multidab messages in a single go.
 #define MAX_MULTIDAB_MESSAGES 8192
 
-// 0.2 milliseconds, according to benchmark numbers. Hopefully enough for slow
-// machines to not drop below 60 fps, fast machines don't care anyway.
+// 0.2 milliseconds. Hopefully enough for slow machines to not drop below 60
+// fps, fast machines don't care anyway. The dab cost tables are nanoseconds on
+// the machine the benchmark ran on, so they are scaled by how long batches of
+// each type of dab actually take on this one. See calibrate_multidab below.
 #define MAX_MULTIDAB_COST 200000.0
 
-static bool shift_first_message(DP_PaintEngine *pe, DP_Message **msgs)
-{
-    // Local queue takes priority, we want our own strokes to be responsive.
-    DP_Message *msg = DP_message_queue_shift(&pe->local_queue);
-    if (msg) {
-        msgs[0] = msg;
-        return true;
-    }
-    else {
-        msgs[0] = DP_message_queue_shift(&pe->remote_queue);
-        return false;
-    }
-}
-
-static double get_classic_dabs_cost(DP_MsgDrawDabsClassic *mddc,
-                                    double dabs_cost)
-{
-    int count;
-    const DP_ClassicDab *cds = DP_msg_draw_dabs_classic_dabs(mddc, &count);
-    double base_cost = DP_dab_cost_classic(
-        DP_msg_draw_dabs_classic_paint_mode(mddc) != DP_PAINT_MODE_DIRECT,
-        DP_msg_draw_dabs_classic_mode(mddc));
-    for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
-        double size =
-            DP_uint32_to_double(DP_classic_dab_size(DP_classic_dab_at(cds, i)));
-        double cost = base_cost * size * size;
-        dabs_cost += cost;
-    }
-    return dabs_cost;
-}
-
-static double get_pixel_dabs_cost(DP_MsgDrawDabsPixel *mddp, double dabs_cost)
-{
-    int count;
-    const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
-    double base_cost = DP_dab_cost_pixel(DP_msg_draw_dabs_pixel_paint_mode(mddp)
-                                             != DP_PAINT_MODE_DIRECT,
-                                         DP_msg_draw_dabs_pixel_mode(mddp));
-    for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
-        double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
-        double cost = base_cost * size * size;
-        dabs_cost += cost;
+// Batches estimated to take less than this aren't measured, since the timer
+// overhead and noise would throw the calibration off too much.
+#define MULTIDAB_CALIBRATION_MIN_COST 20000.0
+// Fraction of the measured error that a single batch corrects for.
+#define MULTIDAB_CALIBRATION_RATE 0.05
+// Single measurements are clamped to this factor off from the estimate, so
+// that the thread getting preempted doesn't throw everything off at once.
+#define MULTIDAB_CALIBRATION_MAX_RATIO 4.0
+#define MULTIDAB_SCALE_MIN             (1.0 / 32.0)
+#define MULTIDAB_SCALE_MAX             32.0
+
+static void fill_inbox(DP_PaintEngine *pe)
+{
+    // New local messages get picked up right away, since they take priority.
+    // Remote ones only once the inbox runs too low to fill up a batch.
+    bool want_local = DP_atomic_get(&pe->inbox.local_pending);
+    bool want_remote =
+        DP_atomic_get(&pe->inbox.remote_pending)
+        && pe->inbox.remote.messages.used < MAX_MULTIDAB_MESSAGES;
+    if (want_local || want_remote) {
+        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        take_queued_messages(pe);
+        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
     }
-    return dabs_cost;
 }
 
-static double get_pixel_square_dabs_cost(DP_MsgDrawDabsPixel *mddp,
-                                         double dabs_cost)
+static void add_queue_time(DP_PaintEngine *pe, unsigned long long now,
+                           unsigned long long queued_time)
 {
-    int count;
-    const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
-    double base_cost = DP_dab_cost_pixel_square(
-        DP_msg_draw_dabs_pixel_paint_mode(mddp) != DP_PAINT_MODE_DIRECT,
-        DP_msg_draw_dabs_pixel_mode(mddp));
-    for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
-        double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
-        double cost = base_cost * size * size;
-        dabs_cost += cost;
+    unsigned long long queue_ns = now > queued_time ? now - queued_time : 0;
+    ++pe->inbox.handled;
+    pe->inbox.queue_ns += queue_ns;
+    if (queue_ns > pe->inbox.max_queue_ns) {
+        pe->inbox.max_queue_ns = queue_ns;
     }
-    return dabs_cost;
 }
 
-static double get_mypaint_dabs_cost(DP_MsgDrawDabsMyPaint *mddmp,
-                                    double dabs_cost)
+static bool shift_first_message(DP_PaintEngine *pe, DP_Message **msgs,
+                                unsigned long long now)
 {
-    int count;
-    const DP_MyPaintDab *mpds = DP_msg_draw_dabs_mypaint_dabs(mddmp, &count);
-    double base_cost =
-        DP_dab_cost_mypaint(false, DP_msg_draw_dabs_mypaint_lock_alpha(mddmp),
-                            DP_msg_draw_dabs_mypaint_colorize(mddmp),
-                            DP_msg_draw_dabs_mypaint_posterize(mddmp));
-    for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
-        double size = DP_mypaint_dab_size(DP_mypaint_dab_at(mpds, i));
-        double cost = base_cost * size * size;
-        dabs_cost += cost;
+    // Local queue takes priority, we want our own strokes to be responsive.
+    unsigned long long queued_time;
+    DP_Message *msg = queue_shift(&pe->inbox.local, &queued_time);
+    bool local;
+    if (msg) {
+        local = true;
     }
-    return dabs_cost;
-}
-
-static double get_mypaint_blend_dabs_cost(DP_MsgDrawDabsMyPaintBlend *mddmpb,
-                                          double dabs_cost)
-{
-    int count;
-    const DP_MyPaintBlendDab *mpbds =
-        DP_msg_draw_dabs_mypaint_blend_dabs(mddmpb, &count);
-    double base_cost = DP_dab_cost_mypaint_blend(
-        DP_msg_draw_dabs_mypaint_blend_paint_mode(mddmpb)
-            != DP_PAINT_MODE_DIRECT,
-        DP_msg_draw_dabs_mypaint_blend_mode(mddmpb));
-    for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
-        double size =
-            DP_mypaint_blend_dab_size(DP_mypaint_blend_dab_at(mpbds, i));
-        double cost = base_cost * size * size;
-        dabs_cost += cost;
+    else {
+        msg = queue_shift(&pe->inbox.remote, &queued_time);
+        local = false;
     }
-    return dabs_cost;
+    DP_ASSERT(msg);
+    msgs[0] = msg;
+    add_queue_time(pe, now, queued_time);
+    return local;
 }
 
-static double get_dabs_cost(DP_Message *msg, DP_MessageType type,
-                            double dabs_cost)
+static double get_dabs_cost(DP_PaintEngine *pe, DP_Message *msg,
+                            DP_MessageType type, double dabs_cost,
+                            double max_cost, int *out_dab_type)
 {
+    int dab_type;
     switch (type) {
     case DP_MSG_DRAW_DABS_CLASSIC:
-        return get_classic_dabs_cost(DP_message_internal(msg), dabs_cost);
+        dab_type = DP_PAINT_ENGINE_DAB_CLASSIC;
+        break;
     case DP_MSG_DRAW_DABS_PIXEL:
-        return get_pixel_dabs_cost(DP_message_internal(msg), dabs_cost);
+        dab_type = DP_PAINT_ENGINE_DAB_PIXEL;
+        break;
     case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
-        return get_pixel_square_dabs_cost(DP_message_internal(msg), dabs_cost);
+        dab_type = DP_PAINT_ENGINE_DAB_PIXEL_SQUARE;
+        break;
     case DP_MSG_DRAW_DABS_MYPAINT:
-        return get_mypaint_dabs_cost(DP_message_internal(msg), dabs_cost);
+        dab_type = DP_PAINT_ENGINE_DAB_MYPAINT;
+        break;
     case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
-        return get_mypaint_blend_dabs_cost(DP_message_internal(msg), dabs_cost);
+        dab_type = DP_PAINT_ENGINE_DAB_MYPAINT_BLEND;
+        break;
     default:
+        *out_dab_type = -1;
         return MAX_MULTIDAB_COST + 1.0;
     }
+    *out_dab_type = dab_type;
+    return DP_message_cost_dabs(msg, pe->multidab.scales[dab_type], dabs_cost,
+                                max_cost);
 }
 
 static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
                                          DP_Message **msgs,
-                                         double initial_dabs_cost)
+                                         double initial_dabs_cost,
+                                         unsigned long long now)
 {
     int count = 1;
     double total_dabs_cost = initial_dabs_cost;
-    DP_Queue *queue = local ? &pe->local_queue : &pe->remote_queue;
+    DP_PaintEngineQueue *queue = local ? &pe->inbox.local : &pe->inbox.remote;
 
     DP_Message *msg;
     while (count < MAX_MULTIDAB_MESSAGES
-           && (msg = DP_message_queue_peek(queue)) != NULL) {
-        total_dabs_cost =
-            get_dabs_cost(msg, DP_message_type(msg), total_dabs_cost);
-        if (total_dabs_cost <= MAX_MULTIDAB_COST) {
-            DP_queue_shift(queue);
+           && (msg = queue_peek(queue)) != NULL) {
+        int dab_type;
+        double next_dabs_cost =
+            get_dabs_cost(pe, msg, DP_message_type(msg), total_dabs_cost,
+                          MAX_MULTIDAB_COST, &dab_type);
+        if (next_dabs_cost <= MAX_MULTIDAB_COST) {
+            pe->multidab.costs[dab_type] += next_dabs_cost - total_dabs_cost;
+            total_dabs_cost = next_dabs_cost;
+            unsigned long long queued_time;
+            queue_shift(queue, &queued_time);
+            add_queue_time(pe, now, queued_time);
             msgs[count++] = msg;
         }
         else {
@@ -550,17 +784,70 @@ static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
 }
 
 static int maybe_shift_more_messages(DP_PaintEngine *pe, bool local,
-                                     DP_MessageType type, DP_Message **msgs)
+                                     DP_MessageType type, DP_Message **msgs,
+                                     unsigned long long now)
 {
-    double dabs_cost = get_dabs_cost(msgs[0], type, 0);
+    for (int i = 0; i < DP_PAINT_ENGINE_DAB_TYPE_COUNT; ++i) {
+        pe->multidab.costs[i] = 0.0;
+    }
+
+    // The first message gets its full cost estimated even if it's over the
+    // budget on its own, so that the calibration doesn't get stuck on those.
+    int dab_type;
+    double dabs_cost =
+        get_dabs_cost(pe, msgs[0], type, 0.0, DBL_MAX, &dab_type);
+    if (dab_type != -1) {
+        pe->multidab.costs[dab_type] = dabs_cost;
+    }
+
     if (dabs_cost <= MAX_MULTIDAB_COST) {
-        return shift_more_draw_dabs_messages(pe, local, msgs, dabs_cost);
+        return shift_more_draw_dabs_messages(pe, local, msgs, dabs_cost, now);
     }
     else {
         return 1;
     }
 }
 
+// The dab cost tables were measured on a single machine, so they don't match
+// up with what the dabs cost on this one. Compare the estimate for a batch to
+// how long it really took and nudge the scales of each type of dab in it
+// toward what would have made the estimate right, weighted by its share.
+static void calibrate_multidab(DP_PaintEngine *pe, unsigned long long time_ns)
+{
+    double *costs = pe->multidab.costs;
+    double estimated_ns = 0.0;
+    for (int i = 0; i < DP_PAINT_ENGINE_DAB_TYPE_COUNT; ++i) {
+        estimated_ns += costs[i];
+    }
+
+    if (estimated_ns >= MULTIDAB_CALIBRATION_MIN_COST) {
+        double ratio = DP_clamp_double(DP_ullong_to_double(time_ns)
+                                           / estimated_ns,
+                                       1.0 / MULTIDAB_CALIBRATION_MAX_RATIO,
+                                       MULTIDAB_CALIBRATION_MAX_RATIO);
+        double *scales = pe->multidab.scales;
+        for (int i = 0; i < DP_PAINT_ENGINE_DAB_TYPE_COUNT; ++i) {
+            double cost = costs[i];
+            if (cost > 0.0) {
+                double weight = MULTIDAB_CALIBRATION_RATE * cost / estimated_ns;
+                scales[i] = DP_clamp_double(
+                    scales[i] * (1.0 + weight * (ratio - 1.0)),
+                    MULTIDAB_SCALE_MIN, MULTIDAB_SCALE_MAX);
+            }
+        }
+
+        DP_atomic_lock(&pe->multidab.stats_lock);
+        DP_PaintEngineMultidabStatistics *stats = &pe->multidab.stats;
+        for (int i = 0; i < DP_PAINT_ENGINE_DAB_TYPE_COUNT; ++i) {
+            stats->scales[i] = scales[i];
+        }
+        ++stats->batches;
+        stats->batch_ns += time_ns;
+        stats->estimated_ns += estimated_ns;
+        DP_atomic_unlock(&pe->multidab.stats_lock);
+    }
+}
+
 static void handle_single_message(DP_PaintEngine *pe, DP_DrawContext *dc,
                                   bool local, DP_MessageType type,
                                   DP_Message *msg)
@@ -619,28 +906,237 @@ static void handle_multidab(DP_PaintEngine *pe, DP_DrawContext *dc, bool local,
     }
 }
 
+static void update_queue_statistics(DP_PaintEngine *pe, int queued)
+{
+    if (queued > pe->inbox.max_queued) {
+        pe->inbox.max_queued = queued;
+    }
+    DP_atomic_lock(&pe->inbox.stats_lock);
+    pe->inbox.stats.max_queued = pe->inbox.max_queued;
+    pe->inbox.stats.handled = pe->inbox.handled;
+    pe->inbox.stats.skipped = pe->inbox.skipped;
+    pe->inbox.stats.queue_ns = pe->inbox.queue_ns;
+    pe->inbox.stats.max_queue_ns = pe->inbox.max_queue_ns;
+    DP_atomic_unlock(&pe->inbox.stats_lock);
+    DP_PERF_COUNTER("queue", queued);
+}
+
+struct DP_PaintEnginePredecodeJob {
+    DP_PaintEngine *pe;
+    int index;
+};
+
+static void predecode_job(void *element, int thread_index)
+{
+    struct DP_PaintEnginePredecodeJob *job = element;
+    DP_PaintEngine *pe = job->pe;
+    int index = job->index;
+    pe->predecode.tiles[index] = DP_canvas_state_message_tile_decode(
+        pe->predecode.dcs[thread_index], pe->predecode.msgs[index]);
+    DP_SEMAPHORE_MUST_POST(pe->predecode.sem);
+}
+
+static bool predecode_worker_ensure(DP_PaintEngine *pe)
+{
+    if (pe->predecode.worker) {
+        return true;
+    }
+
+    int thread_count = pe->predecode.thread_count;
+    if (thread_count == 0) {
+        return false;
+    }
+
+    DP_Semaphore *sem = DP_semaphore_new(0);
+    DP_Worker *worker =
+        sem ? DP_worker_new_with_priority(
+                  PREDECODE_MESSAGES_MAX,
+                  sizeof(struct DP_PaintEnginePredecodeJob), thread_count,
+                  DP_WORKER_PRIORITY_HIGH, predecode_job)
+            : NULL;
+    if (!worker) {
+        DP_warn("Error creating tile decoding worker: %s", DP_error());
+        DP_semaphore_free(sem);
+        pe->predecode.thread_count = 0;
+        return false;
+    }
+
+    size_t dcs_size = sizeof(*pe->predecode.dcs) * DP_int_to_size(thread_count);
+    pe->predecode.dcs = DP_malloc(dcs_size);
+    for (int i = 0; i < thread_count; ++i) {
+        pe->predecode.dcs[i] = DP_draw_context_new();
+    }
+    pe->predecode.sem = sem;
+    pe->predecode.worker = worker;
+    return true;
+}
+
+static void discard_predecoded_tiles(DP_PaintEngine *pe)
+{
+    int used = pe->predecode.used;
+    for (int i = pe->predecode.next; i < used; ++i) {
+        DP_tile_decref_nullable(pe->predecode.tiles[i]);
+        DP_message_decref(pe->predecode.msgs[i]);
+    }
+    pe->predecode.used = 0;
+    pe->predecode.next = 0;
+}
+
+static DP_Message *queued_message_at(DP_Queue *queue, int index)
+{
+    return *(DP_Message **)DP_queue_at(queue, sizeof(DP_Message *),
+                                       DP_int_to_size(index));
+}
+
+static void predecode_tiles(DP_PaintEngine *pe, bool local, DP_Message *first)
+{
+    discard_predecoded_tiles(pe);
+
+    // The first message was already taken off the queue, the rest are still
+    // in there. Only ones in an unbroken run get decoded, the run is usually
+    // very long anyway, since that's how canvas resets are made up.
+    DP_Queue *queue =
+        local ? &pe->inbox.local.messages : &pe->inbox.remote.messages;
+    int max_count = DP_min_int(PREDECODE_MESSAGES_MAX,
+                               DP_size_to_int(queue->used) + 1);
+    int count = 1;
+    while (count < max_count
+           && DP_canvas_state_message_has_tile(
+               queued_message_at(queue, count - 1))) {
+        ++count;
+    }
+
+    if (count >= PREDECODE_MESSAGES_MIN && predecode_worker_ensure(pe)) {
+        pe->predecode.msgs[0] = DP_message_incref(first);
+        for (int i = 1; i < count; ++i) {
+            pe->predecode.msgs[i] =
+                DP_message_incref(queued_message_at(queue, i - 1));
+        }
+
+        DP_Worker *worker = pe->predecode.worker;
+        for (int i = 0; i < count; ++i) {
+            DP_worker_push(worker,
+                           &(struct DP_PaintEnginePredecodeJob){pe, i});
+        }
+        DP_SEMAPHORE_MUST_WAIT_N(pe->predecode.sem, count);
+        pe->predecode.used = count;
+    }
+}
+
+// Puts the tile of a put tile or canvas background message into the draw
+// context, decoding a whole run of those in parallel if necessary. Returns
+// whether the message is one of those, in which case the draw context must be
+// cleared out again after handling the message.
+static bool set_predecoded_tile(DP_PaintEngine *pe, DP_DrawContext *dc,
+                                bool local, DP_Message *msg)
+{
+    if (!DP_canvas_state_message_has_tile(msg)) {
+        return false;
+    }
+
+    int next = pe->predecode.next;
+    if (next >= pe->predecode.used || pe->predecode.msgs[next] != msg) {
+        predecode_tiles(pe, local, msg);
+        next = 0;
+    }
+
+    if (next < pe->predecode.used) {
+        DP_ASSERT(pe->predecode.msgs[next] == msg);
+        DP_draw_context_predecoded_tile_set_noinc(dc, DP_message_internal(msg),
+                                                  pe->predecode.tiles[next]);
+        DP_message_decref(pe->predecode.msgs[next]);
+        pe->predecode.next = next + 1;
+    }
+    return true;
+}
+
+static bool is_hard_reset_message(DP_Message *msg)
+{
+    if (DP_message_type(msg) == DP_MSG_INTERNAL) {
+        DP_MsgInternalType type =
+            DP_msg_internal_type(DP_msg_internal_cast(msg));
+        return type == DP_MSG_INTERNAL_TYPE_RESET
+            || type == DP_MSG_INTERNAL_TYPE_RESET_TO_STATE;
+    }
+    else {
+        return false;
+    }
+}
+
+// A hard reset throws away the history along with the canvas state, so any
+// commands queued up in front of it would only cause work that gets discarded
+// right after. Those are dropped without handling them. Everything else, like
+// internal messages and meta commands that set state on the paint engine, has
+// to go through in order, so the search stops at the first one of those.
+static void skip_superseded_messages(DP_PaintEngine *pe,
+                                     unsigned long long now)
+{
+    DP_Queue *queue = &pe->inbox.remote.messages;
+    int max_count =
+        DP_min_int(FAST_FORWARD_WINDOW, DP_size_to_int(queue->used));
+    int skip = 0;
+    for (int i = 0; i < max_count; ++i) {
+        DP_Message *msg = queued_message_at(queue, i);
+        if (is_hard_reset_message(msg)) {
+            skip = i;
+        }
+        else if (!DP_message_type_command(DP_message_type(msg))) {
+            break;
+        }
+    }
+
+    if (skip > 0) {
+        DP_debug("Skipping %d messages superseded by a reset", skip);
+        for (int i = 0; i < skip; ++i) {
+            unsigned long long queued_time;
+            DP_message_decref(queue_shift(&pe->inbox.remote, &queued_time));
+            add_queue_time(pe, now, queued_time);
+        }
+        // The reset itself is still queued, so these were all posted already.
+        DP_ASSERT(DP_semaphore_value(pe->queue_sem) >= skip);
+        DP_SEMAPHORE_MUST_WAIT_N(pe->queue_sem, skip);
+        pe->inbox.skipped += DP_int_to_ullong(skip);
+    }
+}
+
 static void handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
                            DP_Message **msgs)
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-    bool local = shift_first_message(pe, msgs);
+    // The semaphore was already waited on for the first message.
+    int queued = DP_semaphore_value(pe->queue_sem) + 1;
+    fill_inbox(pe);
+    unsigned long long now = DP_perf_time();
+    if (pe->inbox.remote_arrived) {
+        pe->inbox.remote_arrived = false;
+        if (DP_atomic_get(&pe->fast_forward)) {
+            skip_superseded_messages(pe, now);
+        }
+    }
+    bool local = shift_first_message(pe, msgs, now);
     DP_Message *first = msgs[0];
     DP_MessageType type = DP_message_type(first);
-    int count = maybe_shift_more_messages(pe, local, type, msgs);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    int count = maybe_shift_more_messages(pe, local, type, msgs, now);
+    update_queue_statistics(pe, queued);
 
     DP_ASSERT(count > 0);
     DP_ASSERT(count <= MAX_MULTIDAB_MESSAGES);
+    unsigned long long start = DP_perf_time();
     if (count == 1) {
+        bool predecoded = set_predecoded_tile(pe, dc, local, first);
         handle_single_message(pe, dc, local, type, first);
+        if (predecoded) {
+            DP_draw_context_predecoded_tile_set_noinc(dc, NULL, NULL);
+        }
     }
     else {
         handle_multidab(pe, dc, local, count, msgs);
     }
+    calibrate_multidab(pe, DP_perf_time() - start);
 }
 
 static void run_paint_engine(void *user)
 {
+    DP_thread_role_set(DP_THREAD_ROLE_INTERACTIVE);
     DP_PaintEngine *pe = user;
     DP_DrawContext *dc = pe->paint_dc;
     DP_Semaphore *sem = pe->queue_sem;
@@ -698,8 +1194,8 @@ static void sync_preview(DP_PaintEngine *pe, int type, DP_Preview *pv)
     // it won't look like transforms undo themselves for a moment.
     DP_Message *msg = DP_msg_internal_preview_new(0, type, pv);
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-    DP_message_queue_push_noinc(&pe->local_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    queue_push_noinc(&pe->local_queue, msg, DP_perf_time());
+    push_queued_messages(pe, true, 1);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
 }
 
@@ -707,7 +1203,15 @@ static void preview_rendered(void *user, DP_Preview *pv)
 {
     DP_PaintEngine *pe = user;
     int type = DP_preview_type(pv);
-    sync_preview(pe, type, DP_preview_incref(pv));
+    if (type == DP_PREVIEW_STROKE) {
+        // The paint thread is the thing that's lagging behind here, so this
+        // preview doesn't go through it. The tick makes sure it lines up.
+        free_preview(DP_atomic_ptr_xch(&pe->next_previews[type],
+                                       DP_preview_incref(pv)));
+    }
+    else {
+        sync_preview(pe, type, DP_preview_incref(pv));
+    }
 }
 
 static void preview_rerendered(void *user)
@@ -719,7 +1223,28 @@ static void preview_rerendered(void *user)
 static void preview_clear(void *user, int type)
 {
     DP_PaintEngine *pe = user;
-    sync_preview(pe, type, &DP_preview_null);
+    if (type == DP_PREVIEW_STROKE) {
+        free_preview(
+            DP_atomic_ptr_xch(&pe->next_previews[type], &DP_preview_null));
+    }
+    else {
+        sync_preview(pe, type, &DP_preview_null);
+    }
+}
+
+static DP_DrawDabsWorker *new_draw_dabs_worker(void)
+{
+    int thread_count = DP_worker_cpu_count(DRAW_DABS_THREAD_COUNT_MAX + 1) - 1;
+    if (thread_count > 0) {
+        DP_DrawDabsWorker *ddw = DP_draw_dabs_worker_new(thread_count);
+        if (!ddw) {
+            DP_warn("Error creating draw dabs worker: %s", DP_error());
+        }
+        return ddw;
+    }
+    else {
+        return NULL;
+    }
 }
 
 DP_PaintEngine *DP_paint_engine_new_inc(
@@ -727,6 +1252,7 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     DP_DrawContext *preview_dc, DP_AclState *acls, DP_CanvasState *cs_or_null,
     bool renderer_checker, uint32_t checker_color1, uint32_t checker_color2,
     uint32_t selection_color, DP_RendererTileFn renderer_tile_fn,
+    DP_RendererTileSlotFn renderer_tile_slot_fn_or_null,
     DP_RendererUnlockFn renderer_unlock_fn,
     DP_RendererResizeFn renderer_resize_fn, void *renderer_user,
     DP_CanvasHistorySavePointFn save_point_fn, void *save_point_user,
@@ -765,19 +1291,52 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     pe->local_view.tracks.prev_tl = NULL;
     pe->local_view.tracks.tl = NULL;
     pe->paint_dc = paint_dc;
+    pe->draw_dabs_worker = new_draw_dabs_worker();
+    DP_draw_context_draw_dabs_worker_set(paint_dc, pe->draw_dabs_worker);
     pe->main_dc = main_dc;
     for (int i = 0; i < DP_PREVIEW_COUNT; ++i) {
         pe->previews[i] = NULL;
         DP_atomic_ptr_set(&pe->next_previews[i], NULL);
     }
     DP_atomic_set(&pe->preview_rerendered, false);
+    for (int i = 0; i < DP_PREVIEW_TRANSFORM_COUNT; ++i) {
+        pe->transform_sources[i].key = 0;
+        pe->transform_sources[i].pvts = NULL;
+    }
     pe->preview_renderer = DP_preview_renderer_new(
         preview_dc, preview_rendered, preview_rerendered, preview_clear, pe);
-    DP_message_queue_init(&pe->local_queue, INITIAL_QUEUE_CAPACITY);
-    DP_message_queue_init(&pe->remote_queue, INITIAL_QUEUE_CAPACITY);
+    DP_queue_init(&pe->stroke_preview.pending, INITIAL_QUEUE_CAPACITY,
+                  sizeof(DP_PaintEngineStrokePreviewEntry));
+    pe->stroke_preview.pushed = 0;
+    pe->stroke_preview.requested_seq = 0;
+    pe->stroke_preview.requested_count = 0;
+    queue_init(&pe->local_queue);
+    queue_init(&pe->remote_queue);
     pe->queue_sem = DP_semaphore_new(0);
     pe->queue_mutex = DP_mutex_new();
+    queue_init(&pe->inbox.local);
+    queue_init(&pe->inbox.remote);
+    int predecode_thread_count =
+        DP_worker_cpu_count(PREDECODE_THREAD_COUNT_MAX);
+    pe->predecode.thread_count =
+        predecode_thread_count > 1 ? predecode_thread_count : 0;
+    pe->predecode.worker = NULL;
+    pe->predecode.dcs = NULL;
+    pe->predecode.sem = NULL;
+    pe->predecode.used = 0;
+    pe->predecode.next = 0;
+    DP_atomic_set(&pe->inbox.local_pending, false);
+    DP_atomic_set(&pe->inbox.remote_pending, false);
+    pe->inbox.remote_arrived = false;
+    pe->inbox.max_queued = 0;
+    pe->inbox.handled = 0;
+    pe->inbox.skipped = 0;
+    pe->inbox.queue_ns = 0;
+    pe->inbox.max_queue_ns = 0;
+    DP_atomic_set(&pe->inbox.stats_lock, 0);
+    pe->inbox.stats = (DP_PaintEngineQueueStatistics){0, 0, 0, 0, 0, 0};
     DP_atomic_set(&pe->running, true);
+    DP_atomic_set(&pe->fast_forward, true);
     DP_atomic_set(&pe->catchup, -1);
     DP_atomic_set(&pe->default_layer_id, -1);
     DP_atomic_set(&pe->undo_depth_limit,
@@ -786,11 +1345,13 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     pe->catching_up = false;
     pe->reset_locked = false;
     pe->paint_thread = DP_thread_new(run_paint_engine, pe);
+    pe->render_lod = 0;
     pe->renderer = DP_renderer_new(
         DP_worker_cpu_count(128), renderer_checker,
         pe->local_view.checker_color1, pe->local_view.checker_color2,
-        pe->local_view.selection_color, renderer_tile_fn, renderer_unlock_fn,
-        renderer_resize_fn, renderer_user);
+        pe->local_view.selection_color, renderer_tile_fn,
+        renderer_tile_slot_fn_or_null, renderer_unlock_fn, renderer_resize_fn,
+        renderer_user);
     pe->meta.acl_change_flags = 0;
     DP_VECTOR_INIT_TYPE(&pe->meta.cursor_changes, DP_PaintEngineCursorChange,
                         8);
@@ -808,9 +1369,65 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     pe->playback.user = playback_user;
     pe->stream_reset.start_fn = stream_reset_start_fn;
     pe->stream_reset.user = stream_reset_user;
+    pe->tile_memory_budget = 0;
+    DP_atomic_set(&pe->multidab.stats_lock, 0);
+    pe->multidab.stats.budget_ns = MAX_MULTIDAB_COST;
+    for (int i = 0; i < DP_PAINT_ENGINE_DAB_TYPE_COUNT; ++i) {
+        pe->multidab.scales[i] = 1.0;
+        pe->multidab.costs[i] = 0.0;
+        pe->multidab.stats.scales[i] = 1.0;
+    }
+    pe->multidab.stats.batches = 0;
+    pe->multidab.stats.batch_ns = 0;
+    pe->multidab.stats.estimated_ns = 0.0;
     return pe;
 }
 
+static void dispose_local_queue(DP_PaintEngineQueue *q)
+{
+    // Local messages may be internal ones that carry data of their own.
+    DP_Message *msg;
+    unsigned long long queued_time;
+    while ((msg = queue_shift(q, &queued_time)) != NULL) {
+        if (DP_message_type(msg) == DP_MSG_INTERNAL) {
+            DP_MsgInternal *mi = DP_msg_internal_cast(msg);
+            switch (DP_msg_internal_type(mi)) {
+            case DP_MSG_INTERNAL_TYPE_RESET_TO_STATE:
+                DP_canvas_state_decref(DP_msg_internal_reset_to_state_data(mi));
+                break;
+            case DP_MSG_INTERNAL_TYPE_PREVIEW:
+                free_preview(DP_msg_internal_preview_data(mi));
+                break;
+            case DP_MSG_INTERNAL_TYPE_DUMP_COMMAND: {
+                int count;
+                DP_Message **msgs =
+                    DP_msg_internal_dump_command_messages(mi, &count);
+                decref_messages(count, msgs);
+                break;
+            }
+            case DP_MSG_INTERNAL_TYPE_PAINT_SYNC:
+                DP_msg_internal_paint_sync_call(mi);
+                break;
+            case DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_MAKE:
+                DP_msg_internal_reconnect_state_make_call(mi, NULL);
+                break;
+            case DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_APPLY:
+                DP_canvas_history_reconnect_state_free(
+                    DP_msg_internal_reconnect_state_apply_get(mi));
+                break;
+            case DP_MSG_INTERNAL_TYPE_MEMORY_REPORT:
+                DP_memory_report_free(DP_msg_internal_memory_report_get(mi));
+                DP_msg_internal_memory_report_call(mi, NULL);
+                break;
+            default:
+                break;
+            }
+        }
+        DP_message_decref(msg);
+    }
+    queue_dispose(q);
+}
+
 void DP_paint_engine_free_join(DP_PaintEngine *pe)
 {
     if (pe) {
@@ -818,54 +1435,38 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe)
         DP_atomic_set(&pe->running, false);
         DP_SEMAPHORE_MUST_POST(pe->queue_sem);
         DP_thread_free_join(pe->paint_thread);
+        DP_draw_context_draw_dabs_worker_set(pe->paint_dc, NULL);
+        DP_draw_dabs_worker_free(pe->draw_dabs_worker);
+        discard_predecoded_tiles(pe);
+        if (pe->predecode.worker) {
+            DP_worker_free_join(pe->predecode.worker);
+            for (int i = 0; i < pe->predecode.thread_count; ++i) {
+                DP_draw_context_free(pe->predecode.dcs[i]);
+            }
+            DP_free(pe->predecode.dcs);
+            DP_semaphore_free(pe->predecode.sem);
+        }
         DP_player_free(pe->playback.player);
         DP_semaphore_free(pe->record.start_sem);
         DP_vector_dispose(&pe->meta.cursor_changes);
         DP_renderer_free(pe->renderer);
         DP_mutex_free(pe->queue_mutex);
         DP_semaphore_free(pe->queue_sem);
-        DP_message_queue_dispose(&pe->remote_queue);
-        DP_Message *msg;
-        while ((msg = DP_message_queue_shift(&pe->local_queue)) != NULL) {
-            if (DP_message_type(msg) == DP_MSG_INTERNAL) {
-                DP_MsgInternal *mi = DP_msg_internal_cast(msg);
-                switch (DP_msg_internal_type(mi)) {
-                case DP_MSG_INTERNAL_TYPE_RESET_TO_STATE:
-                    DP_canvas_state_decref(
-                        DP_msg_internal_reset_to_state_data(mi));
-                    break;
-                case DP_MSG_INTERNAL_TYPE_PREVIEW:
-                    free_preview(DP_msg_internal_preview_data(mi));
-                    break;
-                case DP_MSG_INTERNAL_TYPE_DUMP_COMMAND: {
-                    int count;
-                    DP_Message **msgs =
-                        DP_msg_internal_dump_command_messages(mi, &count);
-                    decref_messages(count, msgs);
-                    break;
-                }
-                case DP_MSG_INTERNAL_TYPE_PAINT_SYNC:
-                    DP_msg_internal_paint_sync_call(mi);
-                    break;
-                case DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_MAKE:
-                    DP_msg_internal_reconnect_state_make_call(mi, NULL);
-                    break;
-                case DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_APPLY:
-                    DP_canvas_history_reconnect_state_free(
-                        DP_msg_internal_reconnect_state_apply_get(mi));
-                    break;
-                default:
-                    break;
-                }
-            }
-            DP_message_decref(msg);
-        }
-        DP_message_queue_dispose(&pe->local_queue);
+        queue_dispose(&pe->inbox.remote);
+        queue_dispose(&pe->remote_queue);
+        dispose_local_queue(&pe->inbox.local);
+        dispose_local_queue(&pe->local_queue);
         DP_preview_renderer_free(pe->preview_renderer);
+        clear_stroke_preview_entries(pe);
+        DP_queue_dispose(&pe->stroke_preview.pending);
         for (int i = 0; i < DP_PREVIEW_COUNT; ++i) {
             free_preview(DP_atomic_ptr_xch(&pe->next_previews[i], NULL));
             DP_preview_decref_nullable(pe->previews[i]);
         }
+        for (int i = 0; i < DP_PREVIEW_TRANSFORM_COUNT; ++i) {
+            DP_preview_transform_source_decref_nullable(
+                pe->transform_sources[i].pvts);
+        }
         DP_timeline_decref_nullable(pe->local_view.tracks.tl);
         DP_timeline_decref_nullable(pe->local_view.tracks.prev_tl);
         DP_layer_props_list_decref_nullable(pe->local_view.layers.lpl);
@@ -886,12 +1487,41 @@ int DP_paint_engine_render_thread_count(DP_PaintEngine *pe)
     return DP_renderer_thread_count(pe->renderer);
 }
 
+DP_RendererStatistics DP_paint_engine_render_statistics(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return DP_renderer_statistics(pe->renderer);
+}
+
+DP_PaintEngineMultidabStatistics
+DP_paint_engine_multidab_statistics(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    DP_atomic_lock(&pe->multidab.stats_lock);
+    DP_PaintEngineMultidabStatistics stats = pe->multidab.stats;
+    DP_atomic_unlock(&pe->multidab.stats_lock);
+    return stats;
+}
+
+DP_PaintEngineQueueStatistics
+DP_paint_engine_queue_statistics(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    DP_atomic_lock(&pe->inbox.stats_lock);
+    DP_PaintEngineQueueStatistics stats = pe->inbox.stats;
+    DP_atomic_unlock(&pe->inbox.stats_lock);
+    stats.queued = DP_max_int(0, DP_semaphore_value(pe->queue_sem));
+    return stats;
+}
+
 void DP_paint_engine_local_drawing_in_progress_set(
     DP_PaintEngine *pe, bool local_drawing_in_progress)
 {
     DP_ASSERT(pe);
     DP_canvas_history_local_drawing_in_progress_set(pe->ch,
                                                     local_drawing_in_progress);
+    DP_renderer_local_drawing_in_progress_set(pe->renderer,
+                                              local_drawing_in_progress);
 }
 
 bool DP_paint_engine_want_canvas_history_dump(DP_PaintEngine *pe)
@@ -1048,6 +1678,83 @@ void DP_paint_engine_selection_color_set(DP_PaintEngine *pe, uint32_t color)
     }
 }
 
+size_t DP_paint_engine_tile_memory_budget(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return pe->tile_memory_budget;
+}
+
+void DP_paint_engine_tile_memory_budget_set(DP_PaintEngine *pe,
+                                            size_t budget_bytes)
+{
+    DP_ASSERT(pe);
+    pe->tile_memory_budget = budget_bytes;
+}
+
+void DP_paint_engine_trim_memory(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    DP_TileEncodingCacheStatistics tecs = DP_tile_encoding_cache_statistics();
+    DP_tile_encoding_cache_clear();
+    DP_renderer_caches_clear(pe->renderer);
+    size_t pool_bytes = DP_draw_context_pools_release(pe->main_dc);
+
+    int compressed = 0;
+    for (int i = 0; i < TRIM_MEMORY_RESIDENCY_BATCHES; ++i) {
+        compressed += DP_tile_residency_trim(0, TRIM_MEMORY_MIN_IDLE_TICKS);
+    }
+
+    DP_info("Trimmed memory: dropped %zu cached tile encoding(s) of %zu "
+            "bytes, cleared render caches, released %zu bytes of draw "
+            "context pools, compressed %d idle tile(s)",
+            tecs.entries, tecs.bytes, pool_bytes, compressed);
+
+    // The history and the paint draw context belong to the paint thread.
+    DP_Message *msg = DP_msg_internal_trim_memory_new(0);
+    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+    queue_push_noinc(&pe->local_queue, msg, DP_perf_time());
+    push_queued_messages(pe, true, 1);
+    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+}
+
+size_t DP_paint_engine_history_memory_budget(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return DP_canvas_history_state_memory_budget(pe->ch);
+}
+
+void DP_paint_engine_history_memory_budget_set(DP_PaintEngine *pe,
+                                               size_t budget_bytes)
+{
+    DP_ASSERT(pe);
+    DP_canvas_history_state_memory_budget_set(pe->ch, budget_bytes);
+}
+
+unsigned long long DP_paint_engine_replay_time_limit(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return DP_canvas_history_replay_time_limit(pe->ch);
+}
+
+void DP_paint_engine_replay_time_limit_set(DP_PaintEngine *pe,
+                                           unsigned long long time_limit_ns)
+{
+    DP_ASSERT(pe);
+    DP_canvas_history_replay_time_limit_set(pe->ch, time_limit_ns);
+}
+
+bool DP_paint_engine_fast_forward(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return DP_atomic_get(&pe->fast_forward);
+}
+
+void DP_paint_engine_fast_forward_set(DP_PaintEngine *pe, bool fast_forward)
+{
+    DP_ASSERT(pe);
+    DP_atomic_set(&pe->fast_forward, fast_forward);
+}
+
 
 DP_Tile *DP_paint_engine_local_background_tile_noinc(DP_PaintEngine *pe)
 {
@@ -1062,7 +1769,8 @@ static bool record_initial_message(void *user, DP_Message *msg)
 }
 
 static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
-                            JSON_Value *header, char *path, bool initial)
+                            int keyframe_interval, JSON_Value *header,
+                            char *path, bool initial)
 {
     DP_Output *output = DP_file_output_new_from_path(path);
     if (!output) {
@@ -1078,27 +1786,29 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
         // with the paint engine, maybe we should verify that somehow) until the
         // paint thread gets to it.
         DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-        DP_message_queue_push_noinc(&pe->remote_queue,
-                                    DP_msg_internal_recorder_start_new(0));
-        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+        queue_push_noinc(&pe->remote_queue,
+                         DP_msg_internal_recorder_start_new(0), DP_perf_time());
+        push_queued_messages(pe, false, 1);
         DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
         // The paint thread will post to this semaphore when it reaches our
         // recorder start message.
         DP_SEMAPHORE_MUST_WAIT(pe->record.start_sem);
-        DP_ASSERT(pe->remote_queue.used == 0);
+        DP_ASSERT(pe->remote_queue.messages.used == 0);
+        DP_ASSERT(pe->inbox.remote.messages.used == 0);
 
         // Now all queued messages have been handled. We can't just take the
         // current canvas state from the canvas history though, since that would
         // lose undo history and might contain state from local messages. So
         // instead, we grab the oldest reachable state and then record the
         // entire history since then.
-        r = DP_canvas_history_recorder_new(pe->ch, type, header,
-                                           pe->record.get_time_ms_fn,
-                                           pe->record.get_time_ms_user, output);
+        r = DP_canvas_history_recorder_new(
+            pe->ch, type, keyframe_interval, header, pe->record.get_time_ms_fn,
+            pe->record.get_time_ms_user, output);
     }
     else {
-        r = DP_recorder_new_inc(type, header, NULL, pe->record.get_time_ms_fn,
-                                pe->record.get_time_ms_user, output);
+        r = DP_recorder_new_keyframes_inc(
+            type, header, NULL, keyframe_interval, pe->record.get_time_ms_fn,
+            pe->record.get_time_ms_user, output);
     }
 
     // After initializing the state, we can set up local state and permissions.
@@ -1139,9 +1849,11 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
 }
 
 bool DP_paint_engine_recorder_start(DP_PaintEngine *pe, DP_RecorderType type,
-                                    JSON_Value *header, const char *path)
+                                    int keyframe_interval, JSON_Value *header,
+                                    const char *path)
 {
-    return start_recording(pe, type, header, DP_strdup(path), true);
+    return start_recording(pe, type, keyframe_interval, header,
+                           DP_strdup(path), true);
 }
 
 bool DP_paint_engine_recorder_stop(DP_PaintEngine *pe)
@@ -1216,8 +1928,10 @@ static void restart_recording(DP_PaintEngine *pe)
     }
 
     DP_RecorderType type = DP_recorder_type(pe->record.recorder);
+    int keyframe_interval = DP_recorder_keyframe_interval(pe->record.recorder);
     DP_paint_engine_recorder_stop(pe);
-    if (path && !start_recording(pe, type, header, path, false)) {
+    if (path
+        && !start_recording(pe, type, keyframe_interval, header, path, false)) {
         DP_warn("Can't restart recording: %s", DP_error());
     }
 }
@@ -1333,11 +2047,48 @@ static int should_push_message_local(DP_UNUSED DP_PaintEngine *pe,
     }
 }
 
-static int push_more_messages(DP_PaintEngine *pe, DP_Queue *queue,
-                              bool override_acls, int count, DP_Message **msgs,
+static int get_draw_dabs_layer_id(DP_Message *msg)
+{
+    switch (DP_message_type(msg)) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+        return DP_protocol_to_layer_id(
+            DP_msg_draw_dabs_classic_layer(DP_message_internal(msg)));
+    case DP_MSG_DRAW_DABS_PIXEL:
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+        return DP_protocol_to_layer_id(
+            DP_msg_draw_dabs_pixel_layer(DP_message_internal(msg)));
+    case DP_MSG_DRAW_DABS_MYPAINT:
+        return DP_protocol_to_layer_id(
+            DP_msg_draw_dabs_mypaint_layer(DP_message_internal(msg)));
+    case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+        return DP_protocol_to_layer_id(
+            DP_msg_draw_dabs_mypaint_blend_layer(DP_message_internal(msg)));
+    default:
+        return 0;
+    }
+}
+
+// Called with the queue mutex held.
+static void push_stroke_preview_entry(DP_PaintEngine *pe, DP_Message *msg,
+                                      unsigned long long time)
+{
+    int layer_id = get_draw_dabs_layer_id(msg);
+    if (layer_id != 0) {
+        DP_PaintEngineStrokePreviewEntry *entry =
+            DP_queue_push(&pe->stroke_preview.pending, sizeof(*entry));
+        *entry = (DP_PaintEngineStrokePreviewEntry){
+            DP_message_incref(msg), ++pe->stroke_preview.pushed, time,
+            layer_id};
+    }
+}
+
+static int push_more_messages(DP_PaintEngine *pe, bool local,
+                              unsigned long long time, bool override_acls,
+                              int count, DP_Message **msgs,
                               int (*should_push)(DP_PaintEngine *, DP_Message *,
                                                  bool))
 {
+    DP_PaintEngineQueue *queue = local ? &pe->local_queue : &pe->remote_queue;
     int pushed = 1;
     for (int i = 1; i < count; ++i) {
         DP_Message *msg = msgs[i];
@@ -1345,46 +2096,55 @@ static int push_more_messages(DP_PaintEngine *pe, DP_Queue *queue,
         case NO_PUSH:
             break;
         case PUSH_MESSAGE:
-            DP_message_queue_push_inc(queue, msg);
+            queue_push_inc(queue, msg, time);
+            if (local) {
+                push_stroke_preview_entry(pe, msg, time);
+            }
             ++pushed;
             break;
         case PUSH_CLEAR_LOCAL_FORK:
-            DP_message_queue_push_noinc(
-                queue, DP_msg_internal_local_fork_clear_new(0));
+            queue_push_noinc(queue, DP_msg_internal_local_fork_clear_new(0),
+                             time);
             ++pushed;
             break;
         default:
             DP_UNREACHABLE();
         }
     }
-    DP_SEMAPHORE_MUST_POST_N(pe->queue_sem, pushed);
+    push_queued_messages(pe, local, pushed);
     return pushed;
 }
 
-static int push_messages(DP_PaintEngine *pe, DP_Queue *queue,
-                         bool override_acls, int count, DP_Message **msgs,
+static int push_messages(DP_PaintEngine *pe, bool local, bool override_acls,
+                         int count, DP_Message **msgs,
                          int (*should_push)(DP_PaintEngine *, DP_Message *,
                                             bool))
 {
+    unsigned long long time = DP_perf_time();
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     // First message is the one that triggered the call to this function,
     // push it unconditionally. Then keep checking the rest again.
-    DP_message_queue_push_inc(queue, msgs[0]);
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
+    queue_push_inc(local ? &pe->local_queue : &pe->remote_queue, msgs[0], time);
+    if (local) {
+        push_stroke_preview_entry(pe, msgs[0], time);
+    }
+    int pushed = push_more_messages(pe, local, time, override_acls, count, msgs,
+                                    should_push);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
     return pushed;
 }
 
 static int push_clear_local_fork_messages(
-    DP_PaintEngine *pe, DP_Queue *queue, bool override_acls, int count,
+    DP_PaintEngine *pe, bool local, bool override_acls, int count,
     DP_Message **msgs, int (*should_push)(DP_PaintEngine *, DP_Message *, bool))
 {
+    unsigned long long time = DP_perf_time();
     DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     // First message is to instruct the paint engine to clear the local fork.
-    DP_message_queue_push_noinc(queue, DP_msg_internal_local_fork_clear_new(0));
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
+    queue_push_noinc(local ? &pe->local_queue : &pe->remote_queue,
+                     DP_msg_internal_local_fork_clear_new(0), time);
+    int pushed = push_more_messages(pe, local, time, override_acls, count, msgs,
+                                    should_push);
     DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
     return pushed;
 }
@@ -1415,8 +2175,7 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
             DP_PERF_BEGIN(push, "handle:push");
             pushed = (push == PUSH_MESSAGE ? push_messages
                                            : push_clear_local_fork_messages)(
-                pe, local ? &pe->local_queue : &pe->remote_queue, override_acls,
-                count - i, msgs + i, should_push);
+                pe, local, override_acls, count - i, msgs + i, should_push);
             DP_PERF_END(push);
             break;
         }
@@ -1449,6 +2208,79 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
 }
 
 
+static void request_stroke_preview(DP_PaintEngine *pe,
+                                   DP_PaintEngineStrokePreviewEntry *first)
+{
+    // Only a run of dabs on the same layer can go into a single preview.
+    DP_Queue *pending = &pe->stroke_preview.pending;
+    DP_Message **buffer = pe->stroke_preview.buffer;
+    int layer_id = first->layer_id;
+    int max_count =
+        DP_min_int(STROKE_PREVIEW_MESSAGES_MAX, DP_size_to_int(pending->used));
+    int count = 0;
+    while (count < max_count) {
+        DP_PaintEngineStrokePreviewEntry *entry =
+            DP_queue_at(pending, sizeof(*entry), DP_int_to_size(count));
+        if (entry->layer_id == layer_id) {
+            buffer[count++] = entry->msg;
+        }
+        else {
+            break;
+        }
+    }
+
+    if (first->seq != pe->stroke_preview.requested_seq
+        || count != pe->stroke_preview.requested_count) {
+        pe->stroke_preview.requested_seq = first->seq;
+        pe->stroke_preview.requested_count = count;
+        DP_CanvasState *cs = pe->history_cs;
+        DP_Preview *pv = DP_preview_new_stroke_inc(
+            DP_canvas_state_offset_x(cs), DP_canvas_state_offset_y(cs),
+            layer_id, count, buffer);
+        DP_preview_renderer_push_noinc_inc(pe->preview_renderer, pv, cs);
+    }
+}
+
+// Drops local dabs that have made it into the history state and makes sure
+// that the stroke preview starts right where that state leaves off, since
+// dabs would get drawn twice otherwise. Returns if the preview got removed.
+static bool update_stroke_preview(DP_PaintEngine *pe,
+                                  unsigned long long local_dabs_handled)
+{
+    DP_Queue *pending = &pe->stroke_preview.pending;
+    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+
+    DP_PaintEngineStrokePreviewEntry *first;
+    while ((first = DP_queue_peek(pending, sizeof(*first))) != NULL
+           && first->seq <= local_dabs_handled) {
+        DP_message_decref(first->msg);
+        DP_queue_shift(pending);
+    }
+
+    bool removed;
+    DP_Preview *pv = pe->previews[DP_PREVIEW_STROKE];
+    if (pv
+        && (!first || DP_preview_dabs_first_message_noinc(pv) != first->msg)) {
+        DP_preview_decref(pv);
+        pe->previews[DP_PREVIEW_STROKE] = NULL;
+        removed = true;
+    }
+    else {
+        removed = false;
+    }
+
+    if (first) {
+        unsigned long long now = DP_perf_time();
+        if (now > first->time
+            && now - first->time >= STROKE_PREVIEW_DELAY_NS) {
+            request_stroke_preview(pe, first);
+        }
+    }
+
+    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    return removed;
+}
+
 static DP_CanvasState *apply_previews(DP_PaintEngine *pe, DP_CanvasState *cs)
 {
     DP_CanvasState *next_cs = cs;
@@ -1846,7 +2678,8 @@ emit_changes(DP_PaintEngine *pe, DP_CanvasState *prev, DP_CanvasState *cs,
                       pe->local_view.checker_color1,
                       pe->local_view.checker_color2,
                       pe->local_view.selection_color, tile_bounds,
-                      render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+                      render_outside_tile_bounds, pe->render_lod,
+                      DP_RENDERER_CONTINUOUS);
 
     if (!catching_up) {
         if (DP_canvas_diff_layer_props_changed_reset(diff) || catchup_done) {
@@ -1947,8 +2780,9 @@ void DP_paint_engine_tick(
     }
     else {
         DP_CanvasState *prev_history_cs = pe->history_cs;
-        next_history_cs = DP_canvas_history_compare_and_get(
-            pe->ch, prev_history_cs, &pe->meta.ucb);
+        unsigned long long local_dabs_handled;
+        next_history_cs = DP_canvas_history_compare_and_get_local_dabs(
+            pe->ch, prev_history_cs, &pe->meta.ucb, &local_dabs_handled);
         DP_CanvasState *active_id_cs;
         if (next_history_cs) {
             DP_canvas_state_decref(prev_history_cs);
@@ -1976,6 +2810,10 @@ void DP_paint_engine_tick(
             }
         }
 
+        if (update_stroke_preview(pe, local_dabs_handled)) {
+            preview_changed = true;
+        }
+
         local_view_changed =
             !pe->local_view.layers.prev_lpl || !pe->local_view.tracks.prev_tl;
     }
@@ -2039,6 +2877,12 @@ void DP_paint_engine_tick(
         undo_depth_limit_set(user, undo_depth_limit);
     }
 
+    size_t tile_memory_budget = pe->tile_memory_budget;
+    if (tile_memory_budget != 0) {
+        DP_tile_residency_trim(tile_memory_budget,
+                               TILE_RESIDENCY_MIN_IDLE_TICKS);
+    }
+
     DP_PERF_END(fn);
 }
 
@@ -2050,18 +2894,35 @@ void DP_paint_engine_render_continuous(DP_PaintEngine *pe, DP_Rect tile_bounds,
                       pe->local_view.checker_color1,
                       pe->local_view.checker_color2,
                       pe->local_view.selection_color, tile_bounds,
-                      render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+                      render_outside_tile_bounds, pe->render_lod,
+                      DP_RENDERER_CONTINUOUS);
+}
+
+// Sampling one pixel per block only looks right when several of them end up on
+// every pixel on screen, so stay a level below what the zoom would allow. The
+// levels below the minimum aren't enough faster than a full render to bother.
+static int zoom_to_render_lod(double zoom)
+{
+    int lod = 0;
+    double scale = zoom > 0.0 ? 1.0 / zoom : 1.0;
+    while (scale >= 4.0 && lod < DP_RENDERER_LOD_MAX) {
+        scale *= 0.5;
+        ++lod;
+    }
+    return lod < RENDER_LOD_MIN ? 0 : lod;
 }
 
 void DP_paint_engine_change_bounds(DP_PaintEngine *pe, DP_Rect tile_bounds,
-                                   bool render_outside_tile_bounds)
+                                   bool render_outside_tile_bounds,
+                                   double zoom)
 {
+    pe->render_lod = zoom_to_render_lod(zoom);
     DP_renderer_apply(
         pe->renderer, pe->view_cs, pe->local_state, pe->diff,
         pe->local_view.layers_can_decrease_opacity,
         pe->local_view.checker_color1, pe->local_view.checker_color2,
         pe->local_view.selection_color, tile_bounds, render_outside_tile_bounds,
-        DP_RENDERER_VIEW_BOUNDS_CHANGED);
+        pe->render_lod, DP_RENDERER_VIEW_BOUNDS_CHANGED);
 }
 
 void DP_paint_engine_render_everything(DP_PaintEngine *pe)
@@ -2071,7 +2932,7 @@ void DP_paint_engine_render_everything(DP_PaintEngine *pe)
                       pe->local_view.checker_color1,
                       pe->local_view.checker_color2,
                       pe->local_view.selection_color,
-                      DP_rect_make(0, 0, UINT16_MAX, UINT16_MAX), false,
+                      DP_rect_make(0, 0, UINT16_MAX, UINT16_MAX), false, 0,
                       DP_RENDERER_EVERYTHING);
 }
 
@@ -2095,20 +2956,55 @@ void DP_paint_engine_preview_cut(DP_PaintEngine *pe, int x, int y, int width,
     }
 }
 
+static DP_PreviewTransformSource *get_transform_source(
+    DP_PaintEngine *pe, int id, int width, int height, long long source_key,
+    DP_PreviewTransformGetPixelsFn get_pixels,
+    DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user)
+{
+    DP_PreviewTransformSource *pvts = pe->transform_sources[id].pvts;
+    if (pvts && source_key != 0 && pe->transform_sources[id].key == source_key
+        && DP_preview_transform_source_width(pvts) == width
+        && DP_preview_transform_source_height(pvts) == height) {
+        dispose_pixels(user);
+    }
+    else {
+        DP_preview_transform_source_decref_nullable(pvts);
+        pvts = DP_preview_transform_source_new(width, height, get_pixels,
+                                               dispose_pixels, user);
+        pe->transform_sources[id].key = source_key;
+        pe->transform_sources[id].pvts = pvts;
+    }
+    return pvts;
+}
+
+static void clear_transform_source(DP_PaintEngine *pe, int id)
+{
+    DP_preview_transform_source_decref_nullable(
+        pe->transform_sources[id].pvts);
+    pe->transform_sources[id].key = 0;
+    pe->transform_sources[id].pvts = NULL;
+}
+
 void DP_paint_engine_preview_transform(
     DP_PaintEngine *pe, int id, int layer_id, int blend_mode, uint16_t opacity,
     int x, int y, int width, int height, const DP_Quad *dst_quad,
-    int interpolation, DP_PreviewTransformGetPixelsFn get_pixels,
+    int interpolation, bool reduced, long long source_key,
+    DP_PreviewTransformGetPixelsFn get_pixels,
     DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user)
 {
+    DP_ASSERT(id >= 0);
+    DP_ASSERT(id < DP_PREVIEW_TRANSFORM_COUNT);
     DP_ASSERT(dispose_pixels);
     if (width > 0 && height > 0) {
         DP_CanvasState *cs = pe->view_cs;
         int offset_x = DP_canvas_state_offset_x(cs);
         int offset_y = DP_canvas_state_offset_y(cs);
-        DP_Preview *pv = DP_preview_new_transform(
-            id, offset_x, offset_y, layer_id, blend_mode, opacity, x, y, width,
-            height, dst_quad, interpolation, get_pixels, dispose_pixels, user);
+        DP_PreviewTransformSource *pvts =
+            get_transform_source(pe, id, width, height, source_key,
+                                 get_pixels, dispose_pixels, user);
+        DP_Preview *pv = DP_preview_new_transform_inc(
+            id, offset_x, offset_y, layer_id, blend_mode, opacity, x, y,
+            dst_quad, interpolation, reduced, pvts);
         DP_preview_renderer_push_noinc_inc(pe->preview_renderer, pv, cs);
     }
     else {
@@ -2160,15 +3056,32 @@ void DP_paint_engine_preview_clear(DP_PaintEngine *pe, int type)
     DP_ASSERT(type >= 0);
     DP_ASSERT(type < DP_PREVIEW_COUNT);
     DP_preview_renderer_cancel(pe->preview_renderer, type);
+    if (type >= DP_PREVIEW_TRANSFORM_FIRST
+        && type <= DP_PREVIEW_TRANSFORM_LAST) {
+        clear_transform_source(pe, type - DP_PREVIEW_TRANSFORM_FIRST);
+    }
 }
 
 void DP_paint_engine_preview_clear_all_transforms(DP_PaintEngine *pe)
 {
     DP_ASSERT(pe);
     DP_preview_renderer_cancel_all_transforms(pe->preview_renderer);
+    for (int i = 0; i < DP_PREVIEW_TRANSFORM_COUNT; ++i) {
+        clear_transform_source(pe, i);
+    }
 }
 
 
+void DP_paint_engine_memory_report_add_view(DP_PaintEngine *pe,
+                                            DP_MemoryReport *mr)
+{
+    DP_ASSERT(pe);
+    DP_ASSERT(mr);
+    DP_memory_report_canvas_state_add(mr, DP_MEMORY_REPORT_SOURCE_VIEW, -1,
+                                      pe->view_cs);
+    DP_renderer_memory_report_add(pe->renderer, mr);
+}
+
 DP_CanvasState *DP_paint_engine_view_canvas_state_inc(DP_PaintEngine *pe)
 {
     DP_ASSERT(pe);
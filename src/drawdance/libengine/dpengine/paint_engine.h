@@ -37,6 +37,7 @@ typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_DocumentMetadata DP_DocumentMetadata;
 typedef struct DP_Image DP_Image;
 typedef struct DP_LayerPropsList DP_LayerPropsList;
+typedef struct DP_MemoryReport DP_MemoryReport;
 typedef struct DP_Message DP_Message;
 typedef struct DP_Quad DP_Quad;
 typedef struct DP_SelectionSet DP_SelectionSet;
@@ -104,6 +105,7 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     DP_DrawContext *preview_dc, DP_AclState *acls, DP_CanvasState *cs_or_null,
     bool renderer_checker, uint32_t checker_color1, uint32_t checker_color2,
     uint32_t selection_color, DP_RendererTileFn renderer_tile_fn,
+    DP_RendererTileSlotFn renderer_tile_slot_fn_or_null,
     DP_RendererUnlockFn renderer_unlock_fn,
     DP_RendererResizeFn renderer_resize_fn, void *renderer_user,
     DP_CanvasHistorySavePointFn save_point_fn, void *save_point_user,
@@ -119,6 +121,43 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe);
 
 int DP_paint_engine_render_thread_count(DP_PaintEngine *pe);
 
+DP_RendererStatistics DP_paint_engine_render_statistics(DP_PaintEngine *pe);
+
+// Index into the multidab cost scales.
+typedef enum DP_PaintEngineDabType {
+    DP_PAINT_ENGINE_DAB_CLASSIC,
+    DP_PAINT_ENGINE_DAB_PIXEL,
+    DP_PAINT_ENGINE_DAB_PIXEL_SQUARE,
+    DP_PAINT_ENGINE_DAB_MYPAINT,
+    DP_PAINT_ENGINE_DAB_MYPAINT_BLEND,
+    DP_PAINT_ENGINE_DAB_TYPE_COUNT,
+} DP_PaintEngineDabType;
+
+typedef struct DP_PaintEngineMultidabStatistics {
+    double budget_ns; // Time a single batch of draw dabs is supposed to take.
+    // Measured time per unit of the offline dab cost tables. Dividing the
+    // budget by these gives the active budget in table units for each type.
+    double scales[DP_PAINT_ENGINE_DAB_TYPE_COUNT];
+    size_t batches; // Batches measured to calibrate the scales.
+    unsigned long long batch_ns; // Total time taken by those batches.
+    double estimated_ns;         // Total time they were estimated to take.
+} DP_PaintEngineMultidabStatistics;
+
+DP_PaintEngineMultidabStatistics
+DP_paint_engine_multidab_statistics(DP_PaintEngine *pe);
+
+typedef struct DP_PaintEngineQueueStatistics {
+    int queued;     // Messages currently waiting for the paint thread.
+    int max_queued; // Most messages that were waiting at once.
+    unsigned long long handled;      // Messages taken off the queues.
+    unsigned long long skipped;      // Of those, ones superseded by a reset.
+    unsigned long long queue_ns;     // Total time those spent waiting.
+    unsigned long long max_queue_ns; // Longest time a single one waited.
+} DP_PaintEngineQueueStatistics;
+
+DP_PaintEngineQueueStatistics
+DP_paint_engine_queue_statistics(DP_PaintEngine *pe);
+
 void DP_paint_engine_local_drawing_in_progress_set(
     DP_PaintEngine *pe, bool local_drawing_in_progress);
 
@@ -162,11 +201,44 @@ void DP_paint_engine_checker_color1_set(DP_PaintEngine *pe, uint32_t color1);
 void DP_paint_engine_checker_color2_set(DP_PaintEngine *pe, uint32_t color2);
 void DP_paint_engine_selection_color_set(DP_PaintEngine *pe, uint32_t color);
 
+// When set to a non-zero amount of bytes, tiles that haven't been used in a
+// while are compressed in the tick once their pixels exceed that budget.
+size_t DP_paint_engine_tile_memory_budget(DP_PaintEngine *pe);
+void DP_paint_engine_tile_memory_budget_set(DP_PaintEngine *pe,
+                                            size_t budget_bytes);
+
+// Releases memory that gets rebuilt when it's needed again, for when the
+// system is running low on it: cached tile encodings, render caches and draw
+// context pools. Idle tiles get compressed regardless of the budget above.
+// The paint thread then drops undo save points and releases its own pools.
+// Must be called from the thread that renders. What got freed is logged.
+void DP_paint_engine_trim_memory(DP_PaintEngine *pe);
+
+// Limits how much memory undo save points may keep alive, see
+// DP_canvas_history_state_memory_budget_set.
+size_t DP_paint_engine_history_memory_budget(DP_PaintEngine *pe);
+void DP_paint_engine_history_memory_budget_set(DP_PaintEngine *pe,
+                                               size_t budget_bytes);
+
+// See DP_canvas_history_replay_time_limit_set.
+unsigned long long DP_paint_engine_replay_time_limit(DP_PaintEngine *pe);
+void DP_paint_engine_replay_time_limit_set(DP_PaintEngine *pe,
+                                           unsigned long long time_limit_ns);
+
+// Whether commands queued up in front of a hard reset get dropped instead of
+// handled, since the reset throws away their results anyway. On by default.
+// The snapshot taken when the reset is handled then has the canvas as it was
+// before those commands, since their effect never got computed.
+bool DP_paint_engine_fast_forward(DP_PaintEngine *pe);
+void DP_paint_engine_fast_forward_set(DP_PaintEngine *pe, bool fast_forward);
+
 DP_Tile *DP_paint_engine_local_background_tile_noinc(DP_PaintEngine *pe);
 
-// Takes ownership of the header, path is copied.
+// Takes ownership of the header, path is copied. See
+// DP_recorder_new_keyframes_inc for what the keyframe interval does.
 bool DP_paint_engine_recorder_start(DP_PaintEngine *pe, DP_RecorderType type,
-                                    JSON_Value *header, const char *path);
+                                    int keyframe_interval, JSON_Value *header,
+                                    const char *path);
 
 bool DP_paint_engine_recorder_stop(DP_PaintEngine *pe);
 
@@ -200,8 +272,11 @@ void DP_paint_engine_tick(
 void DP_paint_engine_render_continuous(DP_PaintEngine *pe, DP_Rect tile_bounds,
                                        bool render_outside_tile_bounds);
 
+// The zoom picks the level of detail to render at, zoomed out far enough the
+// canvas gets rendered at reduced detail until zooming back in.
 void DP_paint_engine_change_bounds(DP_PaintEngine *pe, DP_Rect tile_bounds,
-                                   bool render_outside_tile_bounds);
+                                   bool render_outside_tile_bounds,
+                                   double zoom);
 
 void DP_paint_engine_render_everything(DP_PaintEngine *pe);
 
@@ -209,10 +284,15 @@ void DP_paint_engine_preview_cut(DP_PaintEngine *pe, int x, int y, int width,
                                  int height, const DP_Pixel8 *mask_or_null,
                                  int layer_id_count, const int *layer_ids);
 
+// Consecutive transform previews for the same id with the same non-zero source
+// key retain the source pixels from the first one instead of getting them again
+// and dispose of the new ones immediately. If reduced is true, large transforms
+// are previewed at a lower resolution, which is meant for while dragging.
 void DP_paint_engine_preview_transform(
     DP_PaintEngine *pe, int id, int layer_id, int blend_mode, uint16_t opacity,
     int x, int y, int width, int height, const DP_Quad *dst_quad,
-    int interpolation, DP_PreviewTransformGetPixelsFn get_pixels,
+    int interpolation, bool reduced, long long source_key,
+    DP_PreviewTransformGetPixelsFn get_pixels,
     DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user);
 
 void DP_paint_engine_preview_dabs_inc(DP_PaintEngine *pe, int layer_id,
@@ -226,6 +306,11 @@ void DP_paint_engine_preview_fill(DP_PaintEngine *pe, int layer_id,
 void DP_paint_engine_preview_clear(DP_PaintEngine *pe, int type);
 void DP_paint_engine_preview_clear_all_transforms(DP_PaintEngine *pe);
 
+// Adds the view canvas state and the renderer's caches. Must be called from
+// the main thread, the canvas history is added via an internal message.
+void DP_paint_engine_memory_report_add_view(DP_PaintEngine *pe,
+                                            DP_MemoryReport *mr);
+
 DP_CanvasState *DP_paint_engine_view_canvas_state_inc(DP_PaintEngine *pe);
 
 DP_CanvasState *DP_paint_engine_history_canvas_state_inc(DP_PaintEngine *pe);
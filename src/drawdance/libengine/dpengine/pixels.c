@@ -55,6 +55,7 @@
 #include <dpmsg/blend_mode.h>
 #include <fastapprox/fastpow.h>
 #include <math.h>
+#include <string.h>
 
 static_assert(sizeof(DP_Pixel8) == sizeof(uint32_t), "DP_Pixel8 is 32 bits");
 static_assert(sizeof(DP_UPixel8) == sizeof(uint32_t), "DP_UPixel8 is 32 bits");
@@ -729,16 +730,6 @@ void DP_pixels15_to_8(DP_Pixel8 *dst, const DP_Pixel15 *src, int count)
     }
 }
 
-void DP_pixels15_to_8_unpremultiply(DP_UPixel8 *dst, const DP_Pixel15 *src,
-                                    int count)
-{
-    DP_ASSERT(count <= 0 || dst);
-    DP_ASSERT(count <= 0 || src);
-    for (int i = 0; i < count; ++i) {
-        dst[i] = DP_upixel15_to_8(DP_pixel15_unpremultiply(src[i]));
-    }
-}
-
 
 #ifdef DP_CPU_X64
 DP_TARGET_BEGIN("sse4.2")
@@ -849,6 +840,113 @@ static void pixels15_to_8_avx2(DP_Pixel8 *dst, const DP_Pixel15 *src)
     _mm256_zeroupper();
 }
 DP_TARGET_END
+
+DP_TARGET_BEGIN("avx512f,avx512bw")
+static __m512i pixels15_to_8_channels_avx512(__m256i source)
+{
+    // Convert 15bit channels to 8bit channels. (p * 255 + 16384) >> 15
+    __m512i p = _mm512_cvtepu16_epi32(source);
+    return _mm512_srli_epi32(
+        _mm512_add_epi32(_mm512_mullo_epi32(p, _mm512_set1_epi32(255)),
+                         _mm512_set1_epi32(FUDGE15_TO_8)),
+        15);
+}
+
+static void pixels15_to_8_avx512(DP_Pixel8 *dst, const DP_Pixel15 *src)
+{
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        // Tiles are only aligned to 32 bytes, so these loads are unaligned.
+        __m512i source1 = _mm512_loadu_si512((const void *)&src[i]);
+        __m512i source2 = _mm512_loadu_si512((const void *)&src[i + 8]);
+
+        // Each of these holds 4 pixels with one channel per 32bit spot.
+        __m512i p1 =
+            pixels15_to_8_channels_avx512(_mm512_castsi512_si256(source1));
+        __m512i p2 = pixels15_to_8_channels_avx512(
+            _mm512_extracti64x4_epi64(source1, 1));
+        __m512i p3 =
+            pixels15_to_8_channels_avx512(_mm512_castsi512_si256(source2));
+        __m512i p4 = pixels15_to_8_channels_avx512(
+            _mm512_extracti64x4_epi64(source2, 1));
+
+        // Packing works within 128 bit lanes, so lane k ends up with pixel k
+        // of p1, p2, p3 and p4. The final permute puts them back in order.
+        __m512i packed = _mm512_packus_epi16(_mm512_packus_epi32(p1, p2),
+                                             _mm512_packus_epi32(p3, p4));
+        __m512i out = _mm512_permutexvar_epi32(
+            _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11,
+                              15),
+            packed);
+
+        _mm512_storeu_si512((void *)&dst[i], out);
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+#endif
+
+#ifdef DP_CPU_ARM64
+static void pixels15_to_8_neon(DP_Pixel8 *dst, const DP_Pixel15 *src)
+{
+    uint16x4_t _255 = vdup_n_u16(255);
+    uint32x4_t fudge = vdupq_n_u32(FUDGE15_TO_8);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        // The channels are in the same order in 15 and 8 bit pixels, so they
+        // don't need to be shuffled, just converted and narrowed.
+        uint16x8_t source1 = vld1q_u16((const uint16_t *)&src[i]);
+        uint16x8_t source2 = vld1q_u16((const uint16_t *)&src[i + 2]);
+
+        // Convert 15bit pixels to 8bit pixels. (p * 255 + 16384) >> 15
+        uint16x4_t p1 =
+            vshrn_n_u32(vmlal_u16(fudge, vget_low_u16(source1), _255), 15);
+        uint16x4_t p2 =
+            vshrn_n_u32(vmlal_u16(fudge, vget_high_u16(source1), _255), 15);
+        uint16x4_t p3 =
+            vshrn_n_u32(vmlal_u16(fudge, vget_low_u16(source2), _255), 15);
+        uint16x4_t p4 =
+            vshrn_n_u32(vmlal_u16(fudge, vget_high_u16(source2), _255), 15);
+
+        uint8x16_t out = vcombine_u8(vmovn_u16(vcombine_u16(p1, p2)),
+                                     vmovn_u16(vcombine_u16(p3, p4)));
+        vst1q_u8((uint8_t *)&dst[i], out);
+    }
+}
+#endif
+
+#ifdef DP_CPU_WASM_SIMD128
+static v128_t pixels15_to_8_channels_simd128(v128_t source, v128_t _255,
+                                             v128_t fudge, bool high)
+{
+    v128_t product = high ? wasm_u32x4_extmul_high_u16x8(source, _255)
+                          : wasm_u32x4_extmul_low_u16x8(source, _255);
+    return wasm_u32x4_shr(wasm_i32x4_add(product, fudge), 15);
+}
+
+static void pixels15_to_8_simd128(DP_Pixel8 *dst, const DP_Pixel15 *src)
+{
+    v128_t _255 = wasm_u16x8_splat(255);
+    v128_t fudge = wasm_u32x4_splat(FUDGE15_TO_8);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        // Same as the NEON version, the channels are already in the right
+        // order and only need to be converted and narrowed.
+        v128_t source1 = wasm_v128_load(&src[i]);
+        v128_t source2 = wasm_v128_load(&src[i + 2]);
+
+        // Convert 15bit pixels to 8bit pixels. (p * 255 + 16384) >> 15
+        v128_t p1 = pixels15_to_8_channels_simd128(source1, _255, fudge, false);
+        v128_t p2 = pixels15_to_8_channels_simd128(source1, _255, fudge, true);
+        v128_t p3 = pixels15_to_8_channels_simd128(source2, _255, fudge, false);
+        v128_t p4 = pixels15_to_8_channels_simd128(source2, _255, fudge, true);
+
+        // Every result fits into a byte, so only the lowest one of each 32 bit
+        // lane needs to be picked out.
+        v128_t p12 = wasm_i16x8_shuffle(p1, p2, 0, 2, 4, 6, 8, 10, 12, 14);
+        v128_t p34 = wasm_i16x8_shuffle(p3, p4, 0, 2, 4, 6, 8, 10, 12, 14);
+        v128_t out = wasm_i8x16_shuffle(p12, p34, 0, 2, 4, 6, 8, 10, 12, 14, 16,
+                                        18, 20, 22, 24, 26, 28, 30);
+        wasm_v128_store(&dst[i], out);
+    }
+}
 #endif
 
 void DP_pixels15_to_8_tile(DP_Pixel8 *dst, const DP_Pixel15 *src)
@@ -857,13 +955,26 @@ void DP_pixels15_to_8_tile(DP_Pixel8 *dst, const DP_Pixel15 *src)
     const DP_Pixel15 *aligned_src = DP_ASSUME_SIMD_ALIGNED(src);
 #ifdef DP_CPU_X64
     DP_CpuSupport cpu_support = DP_cpu_support;
-    if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+    if (cpu_support >= DP_CPU_SUPPORT_AVX512BW) {
+        pixels15_to_8_avx512(aligned_dst, aligned_src);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
         pixels15_to_8_avx2(aligned_dst, aligned_src);
     }
     else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
         pixels15_to_8_sse42(aligned_dst, aligned_src);
     }
     else
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        pixels15_to_8_neon(aligned_dst, aligned_src);
+    }
+    else
+#elif defined(DP_CPU_WASM_SIMD128)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+        pixels15_to_8_simd128(aligned_dst, aligned_src);
+    }
+    else
 #endif
     {
         DP_pixels15_to_8(aligned_dst, aligned_src, DP_TILE_LENGTH);
@@ -907,7 +1018,8 @@ void DP_split_tile8_to_pixels15_checked(DP_Pixel15 *dst,
     }
 }
 
-void DP_pixels15_to_split_tile8_delta(DP_SplitTile8 *dst, const DP_Pixel15 *src)
+static void pixels15_to_split_tile8_delta(DP_SplitTile8 *dst,
+                                          const DP_Pixel15 *src)
 {
     uint8_t last_b = 0;
     uint8_t last_g = 0;
@@ -930,7 +1042,8 @@ void DP_pixels15_to_split_tile8_delta(DP_SplitTile8 *dst, const DP_Pixel15 *src)
     }
 }
 
-void DP_split_tile8_delta_to_pixels15(DP_Pixel15 *dst, const DP_SplitTile8 *src)
+static void split_tile8_delta_to_pixels15(DP_Pixel15 *dst,
+                                          const DP_SplitTile8 *src)
 {
     uint8_t b = 0;
     uint8_t g = 0;
@@ -950,8 +1063,8 @@ void DP_split_tile8_delta_to_pixels15(DP_Pixel15 *dst, const DP_SplitTile8 *src)
     }
 }
 
-void DP_split_tile8_delta_to_pixels15_checked(DP_Pixel15 *dst,
-                                              const DP_SplitTile8 *src)
+static void split_tile8_delta_to_pixels15_checked(DP_Pixel15 *dst,
+                                                  const DP_SplitTile8 *src)
 {
     uint8_t b = 0;
     uint8_t g = 0;
@@ -971,6 +1084,663 @@ void DP_split_tile8_delta_to_pixels15_checked(DP_Pixel15 *dst,
     }
 }
 
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("sse4.2")
+// Convert 15 bit channels to 8 bit ones, (c * 255 + 16384) >> 15, without
+// leaving 16 bit lanes: c * 510 is split into its high and low halves and the
+// top bit of the low half rounds the high half. Only the low byte is kept,
+// same as the cast in DP_channel15_to_8.
+static __m128i channels15_to_8_sse42(__m128i c)
+{
+    __m128i _510 = _mm_set1_epi16(510);
+    __m128i high = _mm_mulhi_epu16(c, _510);
+    __m128i round = _mm_srli_epi16(_mm_mullo_epi16(c, _510), 15);
+    return _mm_and_si128(_mm_add_epi16(high, round), _mm_set1_epi16(0xff));
+}
+
+// Convert 8 bit channels to 15 bit ones, (c << 15) / 255. Since that's the
+// same as (c << 7) + (c << 7) / 255, the division fits into 16 bits.
+static __m128i channels8_to_15_sse42(__m128i c)
+{
+    __m128i c7 = _mm_slli_epi16(c, 7);
+    __m128i q = _mm_srli_epi16(
+        _mm_add_epi16(_mm_add_epi16(c7, _mm_srli_epi16(c7, 8)),
+                      _mm_set1_epi16(1)),
+        8);
+    return _mm_add_epi16(c7, q);
+}
+
+// Convert 4 pairs of 15 bit pixels to 8 bit and split them into 4 registers
+// of 16 consecutive blues, greens, reds and alphas.
+static void split_pixels15_to_8_sse42(const __m128i source[8], __m128i *out_b,
+                                      __m128i *out_g, __m128i *out_r,
+                                      __m128i *out_a)
+{
+    __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7,
+                                  11, 15);
+    __m128i p[4];
+    for (int i = 0; i < 4; ++i) {
+        // |B1-4|G1-4|R1-4|A1-4| for every 4 pixels
+        p[i] = _mm_shuffle_epi8(
+            _mm_packus_epi16(channels15_to_8_sse42(source[i * 2]),
+                             channels15_to_8_sse42(source[i * 2 + 1])),
+            group);
+    }
+
+    // clang-format off
+    __m128i t0 = _mm_unpacklo_epi32(p[0], p[1]); // |B1-4|B5-8|G1-4|G5-8|
+    __m128i t1 = _mm_unpackhi_epi32(p[0], p[1]); // |R1-4|R5-8|A1-4|A5-8|
+    __m128i t2 = _mm_unpacklo_epi32(p[2], p[3]); // |B9-12|B13-16|G9-12|G13-16|
+    __m128i t3 = _mm_unpackhi_epi32(p[2], p[3]); // |R9-12|R13-16|A9-12|A13-16|
+
+    *out_b = _mm_unpacklo_epi64(t0, t2);
+    *out_g = _mm_unpackhi_epi64(t0, t2);
+    *out_r = _mm_unpacklo_epi64(t1, t3);
+    *out_a = _mm_unpackhi_epi64(t1, t3);
+    // clang-format on
+}
+
+// Subtract the previous byte from every byte.
+static __m128i delta_sse42(__m128i current, __m128i last)
+{
+    return _mm_sub_epi8(current, _mm_alignr_epi8(current, last, 15));
+}
+
+static void pixels15_to_split_tile8_delta_sse42(DP_SplitTile8 *dst,
+                                                const DP_Pixel15 *src)
+{
+    __m128i last_b = _mm_setzero_si128();
+    __m128i last_g = _mm_setzero_si128();
+    __m128i last_r = _mm_setzero_si128();
+    __m128i last_a = _mm_setzero_si128();
+    // 16 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        __m128i source[8];
+        for (int j = 0; j < 8; ++j) {
+            source[j] = _mm_load_si128((const void *)&src[i + j * 2]);
+        }
+
+        __m128i b, g, r, a;
+        split_pixels15_to_8_sse42(source, &b, &g, &r, &a);
+
+        _mm_storeu_si128((void *)&dst->b[i], delta_sse42(b, last_b));
+        _mm_storeu_si128((void *)&dst->g[i], delta_sse42(g, last_g));
+        _mm_storeu_si128((void *)&dst->r[i], delta_sse42(r, last_r));
+        _mm_storeu_si128((void *)&dst->a[i], delta_sse42(a, last_a));
+
+        last_b = b;
+        last_g = g;
+        last_r = r;
+        last_a = a;
+    }
+}
+
+// Prefix sum of the bytes, carrying over the last byte of the previous sum.
+static __m128i undelta_sse42(__m128i delta, __m128i last)
+{
+    __m128i sum = _mm_add_epi8(delta, _mm_slli_si128(delta, 1));
+    sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 2));
+    sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 4));
+    sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 8));
+    return _mm_add_epi8(sum, _mm_shuffle_epi8(last, _mm_set1_epi8(15)));
+}
+
+// Convert 4 8 bit pixels to 15 bit and store them.
+static void store_pixels8_to_15_sse42(__m128i pixels, DP_Pixel15 dest[4])
+{
+    __m128i lo = channels8_to_15_sse42(_mm_cvtepu8_epi16(pixels));
+    __m128i hi = channels8_to_15_sse42(
+        _mm_unpackhi_epi8(pixels, _mm_setzero_si128()));
+    _mm_store_si128((void *)dest, lo);
+    _mm_store_si128((void *)(dest + 2), hi);
+}
+
+static void split_tile8_delta_to_pixels15_sse42(DP_Pixel15 *dst,
+                                                const DP_SplitTile8 *src,
+                                                bool checked)
+{
+    __m128i b = _mm_setzero_si128();
+    __m128i g = _mm_setzero_si128();
+    __m128i r = _mm_setzero_si128();
+    __m128i a = _mm_setzero_si128();
+    // 16 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        b = undelta_sse42(_mm_loadu_si128((const void *)&src->b[i]), b);
+        g = undelta_sse42(_mm_loadu_si128((const void *)&src->g[i]), g);
+        r = undelta_sse42(_mm_loadu_si128((const void *)&src->r[i]), r);
+        a = undelta_sse42(_mm_loadu_si128((const void *)&src->a[i]), a);
+
+        // Clamp color channels to alpha, but keep the unclamped values around
+        // for the sum of the next pixels.
+        __m128i cb = checked ? _mm_min_epu8(b, a) : b;
+        __m128i cg = checked ? _mm_min_epu8(g, a) : g;
+        __m128i cr = checked ? _mm_min_epu8(r, a) : r;
+
+        // clang-format off
+        __m128i bg_lo = _mm_unpacklo_epi8(cb, cg); // |B1|G1|B2|G2|...|B8|G8|
+        __m128i bg_hi = _mm_unpackhi_epi8(cb, cg); // |B9|G9|B10|G10|...|B16|G16|
+        __m128i ra_lo = _mm_unpacklo_epi8(cr, a);  // |R1|A1|R2|A2|...|R8|A8|
+        __m128i ra_hi = _mm_unpackhi_epi8(cr, a);  // |R9|A9|R10|A10|...|R16|A16|
+        // clang-format on
+
+        store_pixels8_to_15_sse42(_mm_unpacklo_epi16(bg_lo, ra_lo), &dst[i]);
+        store_pixels8_to_15_sse42(_mm_unpackhi_epi16(bg_lo, ra_lo),
+                                  &dst[i + 4]);
+        store_pixels8_to_15_sse42(_mm_unpacklo_epi16(bg_hi, ra_hi),
+                                  &dst[i + 8]);
+        store_pixels8_to_15_sse42(_mm_unpackhi_epi16(bg_hi, ra_hi),
+                                  &dst[i + 12]);
+    }
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx2")
+static __m256i channels15_to_8_avx2(__m256i c)
+{
+    __m256i _510 = _mm256_set1_epi16(510);
+    __m256i high = _mm256_mulhi_epu16(c, _510);
+    __m256i round = _mm256_srli_epi16(_mm256_mullo_epi16(c, _510), 15);
+    return _mm256_and_si256(_mm256_add_epi16(high, round),
+                            _mm256_set1_epi16(0xff));
+}
+
+static __m256i channels8_to_15_avx2(__m256i c)
+{
+    __m256i c7 = _mm256_slli_epi16(c, 7);
+    __m256i q = _mm256_srli_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(c7, _mm256_srli_epi16(c7, 8)),
+                         _mm256_set1_epi16(1)),
+        8);
+    return _mm256_add_epi16(c7, q);
+}
+
+// Same as the SSE version, but each 128 bit lane works on its own 16 pixels.
+// The lower lane gets pixels 1 through 16, the upper one 17 through 32, so
+// the resulting registers hold 32 consecutive channel values.
+static void split_pixels15_to_8_avx2(const __m256i source[8], __m256i *out_b,
+                                     __m256i *out_g, __m256i *out_r,
+                                     __m256i *out_a)
+{
+    __m256i group =
+        _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                         0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    __m256i p[4];
+    for (int i = 0; i < 4; ++i) {
+        p[i] = _mm256_shuffle_epi8(
+            _mm256_packus_epi16(channels15_to_8_avx2(source[i * 2]),
+                                channels15_to_8_avx2(source[i * 2 + 1])),
+            group);
+    }
+
+    __m256i t0 = _mm256_unpacklo_epi32(p[0], p[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(p[0], p[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(p[2], p[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(p[2], p[3]);
+
+    *out_b = _mm256_unpacklo_epi64(t0, t2);
+    *out_g = _mm256_unpackhi_epi64(t0, t2);
+    *out_r = _mm256_unpacklo_epi64(t1, t3);
+    *out_a = _mm256_unpackhi_epi64(t1, t3);
+}
+
+static __m256i delta_avx2(__m256i current, __m256i last)
+{
+    // alignr works within lanes, so the bytes before each lane are lined up
+    // first: the upper lane of the last register and the lower lane of this.
+    __m256i previous = _mm256_permute2x128_si256(last, current, 0x21);
+    return _mm256_sub_epi8(current, _mm256_alignr_epi8(current, previous, 15));
+}
+
+static void pixels15_to_split_tile8_delta_avx2(DP_SplitTile8 *dst,
+                                               const DP_Pixel15 *src)
+{
+    __m256i last_b = _mm256_setzero_si256();
+    __m256i last_g = _mm256_setzero_si256();
+    __m256i last_r = _mm256_setzero_si256();
+    __m256i last_a = _mm256_setzero_si256();
+    // 32 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 32) {
+        __m256i source[8];
+        for (int j = 0; j < 8; ++j) {
+            source[j] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_load_si128((const void *)&src[i + j * 2])),
+                _mm_load_si128((const void *)&src[i + j * 2 + 16]), 1);
+        }
+
+        __m256i b, g, r, a;
+        split_pixels15_to_8_avx2(source, &b, &g, &r, &a);
+
+        _mm256_storeu_si256((void *)&dst->b[i], delta_avx2(b, last_b));
+        _mm256_storeu_si256((void *)&dst->g[i], delta_avx2(g, last_g));
+        _mm256_storeu_si256((void *)&dst->r[i], delta_avx2(r, last_r));
+        _mm256_storeu_si256((void *)&dst->a[i], delta_avx2(a, last_a));
+
+        last_b = b;
+        last_g = g;
+        last_r = r;
+        last_a = a;
+    }
+    _mm256_zeroupper();
+}
+
+static __m256i undelta_avx2(__m256i delta, __m256i last)
+{
+    __m256i sum = _mm256_add_epi8(delta, _mm256_slli_si256(delta, 1));
+    sum = _mm256_add_epi8(sum, _mm256_slli_si256(sum, 2));
+    sum = _mm256_add_epi8(sum, _mm256_slli_si256(sum, 4));
+    sum = _mm256_add_epi8(sum, _mm256_slli_si256(sum, 8));
+    // The shifts above work within lanes, so the lower lane's total still
+    // needs to be added to the upper one.
+    __m256i totals = _mm256_shuffle_epi8(sum, _mm256_set1_epi8(15));
+    sum = _mm256_add_epi8(sum, _mm256_permute2x128_si256(totals, totals, 0x08));
+    __m256i carry = _mm256_shuffle_epi8(last, _mm256_set1_epi8(15));
+    return _mm256_add_epi8(sum, _mm256_permute2x128_si256(carry, carry, 0x11));
+}
+
+static void store_pixels8_to_15_avx2(__m128i pixels, DP_Pixel15 dest[4])
+{
+    __m256i out = channels8_to_15_avx2(_mm256_cvtepu8_epi16(pixels));
+    _mm256_store_si256((void *)dest, out);
+}
+
+static void split_tile8_delta_to_pixels15_avx2(DP_Pixel15 *dst,
+                                               const DP_SplitTile8 *src,
+                                               bool checked)
+{
+    __m256i b = _mm256_setzero_si256();
+    __m256i g = _mm256_setzero_si256();
+    __m256i r = _mm256_setzero_si256();
+    __m256i a = _mm256_setzero_si256();
+    // 32 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 32) {
+        b = undelta_avx2(_mm256_loadu_si256((const void *)&src->b[i]), b);
+        g = undelta_avx2(_mm256_loadu_si256((const void *)&src->g[i]), g);
+        r = undelta_avx2(_mm256_loadu_si256((const void *)&src->r[i]), r);
+        a = undelta_avx2(_mm256_loadu_si256((const void *)&src->a[i]), a);
+
+        __m256i cb = checked ? _mm256_min_epu8(b, a) : b;
+        __m256i cg = checked ? _mm256_min_epu8(g, a) : g;
+        __m256i cr = checked ? _mm256_min_epu8(r, a) : r;
+
+        // Interleaving works within lanes, so the lower lane of each of these
+        // has 4 pixels of the first 16 and the upper lane of the second 16.
+        __m256i bg_lo = _mm256_unpacklo_epi8(cb, cg);
+        __m256i bg_hi = _mm256_unpackhi_epi8(cb, cg);
+        __m256i ra_lo = _mm256_unpacklo_epi8(cr, a);
+        __m256i ra_hi = _mm256_unpackhi_epi8(cr, a);
+        __m256i q[4] = {
+            _mm256_unpacklo_epi16(bg_lo, ra_lo),
+            _mm256_unpackhi_epi16(bg_lo, ra_lo),
+            _mm256_unpacklo_epi16(bg_hi, ra_hi),
+            _mm256_unpackhi_epi16(bg_hi, ra_hi),
+        };
+
+        for (int j = 0; j < 4; ++j) {
+            store_pixels8_to_15_avx2(_mm256_castsi256_si128(q[j]),
+                                     &dst[i + j * 4]);
+            store_pixels8_to_15_avx2(_mm256_extracti128_si256(q[j], 1),
+                                     &dst[i + j * 4 + 16]);
+        }
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx512f,avx512bw")
+static __m512i channels15_to_8_avx512(__m512i c)
+{
+    __m512i _510 = _mm512_set1_epi16(510);
+    __m512i high = _mm512_mulhi_epu16(c, _510);
+    __m512i round = _mm512_srli_epi16(_mm512_mullo_epi16(c, _510), 15);
+    return _mm512_and_si512(_mm512_add_epi16(high, round),
+                            _mm512_set1_epi16(0xff));
+}
+
+static __m512i channels8_to_15_avx512(__m512i c)
+{
+    __m512i c7 = _mm512_slli_epi16(c, 7);
+    __m512i q = _mm512_srli_epi16(
+        _mm512_add_epi16(_mm512_add_epi16(c7, _mm512_srli_epi16(c7, 8)),
+                         _mm512_set1_epi16(1)),
+        8);
+    return _mm512_add_epi16(c7, q);
+}
+
+// Same as the AVX2 version, but with four lanes of 16 pixels each.
+static void split_pixels15_to_8_avx512(const __m512i source[8], __m512i *out_b,
+                                       __m512i *out_g, __m512i *out_r,
+                                       __m512i *out_a)
+{
+    __m512i group = _mm512_broadcast_i32x4(_mm_setr_epi8(
+        0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    __m512i p[4];
+    for (int i = 0; i < 4; ++i) {
+        p[i] = _mm512_shuffle_epi8(
+            _mm512_packus_epi16(channels15_to_8_avx512(source[i * 2]),
+                                channels15_to_8_avx512(source[i * 2 + 1])),
+            group);
+    }
+
+    __m512i t0 = _mm512_unpacklo_epi32(p[0], p[1]);
+    __m512i t1 = _mm512_unpackhi_epi32(p[0], p[1]);
+    __m512i t2 = _mm512_unpacklo_epi32(p[2], p[3]);
+    __m512i t3 = _mm512_unpackhi_epi32(p[2], p[3]);
+
+    *out_b = _mm512_unpacklo_epi64(t0, t2);
+    *out_g = _mm512_unpackhi_epi64(t0, t2);
+    *out_r = _mm512_unpacklo_epi64(t1, t3);
+    *out_a = _mm512_unpackhi_epi64(t1, t3);
+}
+
+static __m512i delta_avx512(__m512i current, __m512i last)
+{
+    // Line up the lane before each lane, like in the AVX2 version.
+    __m512i previous = _mm512_permutex2var_epi64(
+        last, _mm512_setr_epi64(6, 7, 8, 9, 10, 11, 12, 13), current);
+    return _mm512_sub_epi8(current, _mm512_alignr_epi8(current, previous, 15));
+}
+
+static void pixels15_to_split_tile8_delta_avx512(DP_SplitTile8 *dst,
+                                                 const DP_Pixel15 *src)
+{
+    __m512i last_b = _mm512_setzero_si512();
+    __m512i last_g = _mm512_setzero_si512();
+    __m512i last_r = _mm512_setzero_si512();
+    __m512i last_a = _mm512_setzero_si512();
+    // 64 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 64) {
+        __m512i source[8];
+        for (int j = 0; j < 8; ++j) {
+            const DP_Pixel15 *s = &src[i + j * 2];
+            __m512i x = _mm512_castsi128_si512(_mm_load_si128((const void *)s));
+            x = _mm512_inserti32x4(x, _mm_load_si128((const void *)(s + 16)),
+                                   1);
+            x = _mm512_inserti32x4(x, _mm_load_si128((const void *)(s + 32)),
+                                   2);
+            source[j] = _mm512_inserti32x4(
+                x, _mm_load_si128((const void *)(s + 48)), 3);
+        }
+
+        __m512i b, g, r, a;
+        split_pixels15_to_8_avx512(source, &b, &g, &r, &a);
+
+        _mm512_storeu_si512((void *)&dst->b[i], delta_avx512(b, last_b));
+        _mm512_storeu_si512((void *)&dst->g[i], delta_avx512(g, last_g));
+        _mm512_storeu_si512((void *)&dst->r[i], delta_avx512(r, last_r));
+        _mm512_storeu_si512((void *)&dst->a[i], delta_avx512(a, last_a));
+
+        last_b = b;
+        last_g = g;
+        last_r = r;
+        last_a = a;
+    }
+    _mm256_zeroupper();
+}
+
+static __m512i undelta_avx512(__m512i delta, __m512i last)
+{
+    __m512i sum = _mm512_add_epi8(delta, _mm512_bslli_epi128(delta, 1));
+    sum = _mm512_add_epi8(sum, _mm512_bslli_epi128(sum, 2));
+    sum = _mm512_add_epi8(sum, _mm512_bslli_epi128(sum, 4));
+    sum = _mm512_add_epi8(sum, _mm512_bslli_epi128(sum, 8));
+    // Add the totals of all preceding lanes to each lane by shifting them up
+    // by one lane and then by two lanes.
+    __m512i totals = _mm512_shuffle_epi8(sum, _mm512_set1_epi8(15));
+    __m512i shift1 = _mm512_maskz_permutexvar_epi64(
+        0xfc, _mm512_setr_epi64(0, 1, 0, 1, 2, 3, 4, 5), totals);
+    __m512i shift2 = _mm512_maskz_permutexvar_epi64(
+        0xf0, _mm512_setr_epi64(0, 1, 2, 3, 0, 1, 2, 3),
+        _mm512_add_epi8(totals, shift1));
+    sum = _mm512_add_epi8(sum, _mm512_add_epi8(shift1, shift2));
+    __m512i carry = _mm512_shuffle_epi8(last, _mm512_set1_epi8(15));
+    return _mm512_add_epi8(sum, _mm512_shuffle_i64x2(carry, carry, 0xff));
+}
+
+// Convert 2x4 8 bit pixels to 15 bit, storing the lower lane in the first
+// destination, the upper one into the second one.
+static void store_pixels8_to_15_avx512(__m256i pixels, DP_Pixel15 dest1[4],
+                                       DP_Pixel15 dest2[4])
+{
+    __m512i out = channels8_to_15_avx512(_mm512_cvtepu8_epi16(pixels));
+    _mm256_store_si256((void *)dest1, _mm512_castsi512_si256(out));
+    _mm256_store_si256((void *)dest2, _mm512_extracti64x4_epi64(out, 1));
+}
+
+static void split_tile8_delta_to_pixels15_avx512(DP_Pixel15 *dst,
+                                                 const DP_SplitTile8 *src,
+                                                 bool checked)
+{
+    __m512i b = _mm512_setzero_si512();
+    __m512i g = _mm512_setzero_si512();
+    __m512i r = _mm512_setzero_si512();
+    __m512i a = _mm512_setzero_si512();
+    // 64 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 64) {
+        b = undelta_avx512(_mm512_loadu_si512((const void *)&src->b[i]), b);
+        g = undelta_avx512(_mm512_loadu_si512((const void *)&src->g[i]), g);
+        r = undelta_avx512(_mm512_loadu_si512((const void *)&src->r[i]), r);
+        a = undelta_avx512(_mm512_loadu_si512((const void *)&src->a[i]), a);
+
+        __m512i cb = checked ? _mm512_min_epu8(b, a) : b;
+        __m512i cg = checked ? _mm512_min_epu8(g, a) : g;
+        __m512i cr = checked ? _mm512_min_epu8(r, a) : r;
+
+        // Each lane of these has 4 pixels of its own 16, like in AVX2.
+        __m512i bg_lo = _mm512_unpacklo_epi8(cb, cg);
+        __m512i bg_hi = _mm512_unpackhi_epi8(cb, cg);
+        __m512i ra_lo = _mm512_unpacklo_epi8(cr, a);
+        __m512i ra_hi = _mm512_unpackhi_epi8(cr, a);
+        __m512i q[4] = {
+            _mm512_unpacklo_epi16(bg_lo, ra_lo),
+            _mm512_unpackhi_epi16(bg_lo, ra_lo),
+            _mm512_unpacklo_epi16(bg_hi, ra_hi),
+            _mm512_unpackhi_epi16(bg_hi, ra_hi),
+        };
+
+        for (int j = 0; j < 4; ++j) {
+            DP_Pixel15 *d = &dst[i + j * 4];
+            store_pixels8_to_15_avx512(_mm512_castsi512_si256(q[j]), d,
+                                       d + 16);
+            store_pixels8_to_15_avx512(_mm512_extracti64x4_epi64(q[j], 1),
+                                       d + 32, d + 48);
+        }
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+#endif
+
+#ifdef DP_CPU_ARM64
+// Convert 8 15 bit channels to 8 bit, (c * 255 + 16384) >> 15, which is
+// exactly a rounding narrowing shift. Only the low byte is kept, same as the
+// cast in DP_channel15_to_8.
+static uint8x8_t channels15_to_8_neon(uint16x8_t c)
+{
+    uint16x4_t low = vrshrn_n_u32(vmull_n_u16(vget_low_u16(c), 255), 15);
+    uint16x4_t high = vrshrn_n_u32(vmull_high_n_u16(c, 255), 15);
+    return vmovn_u16(vcombine_u16(low, high));
+}
+
+// Convert 8 bit channels to 15 bit ones, (c << 15) / 255. Since that's the
+// same as (c << 7) + (c << 7) / 255, the division fits into 16 bits.
+static uint16x8_t channels8_to_15_neon(uint16x8_t c)
+{
+    uint16x8_t c7 = vshlq_n_u16(c, 7);
+    uint16x8_t q = vshrq_n_u16(
+        vaddq_u16(vsraq_n_u16(c7, c7, 8), vdupq_n_u16(1)), 8);
+    return vaddq_u16(c7, q);
+}
+
+static uint8x16_t split_channels15_to_8_neon(uint16x8_t c1, uint16x8_t c2)
+{
+    return vcombine_u8(channels15_to_8_neon(c1), channels15_to_8_neon(c2));
+}
+
+// Subtract the previous byte from every byte.
+static uint8x16_t delta_neon(uint8x16_t current, uint8x16_t last)
+{
+    return vsubq_u8(current, vextq_u8(last, current, 15));
+}
+
+static void pixels15_to_split_tile8_delta_neon(DP_SplitTile8 *dst,
+                                               const DP_Pixel15 *src)
+{
+    uint8x16_t last_b = vdupq_n_u8(0);
+    uint8x16_t last_g = vdupq_n_u8(0);
+    uint8x16_t last_r = vdupq_n_u8(0);
+    uint8x16_t last_a = vdupq_n_u8(0);
+    // 16 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        uint16x8x4_t source1 = vld4q_u16((const uint16_t *)&src[i]);
+        uint16x8x4_t source2 = vld4q_u16((const uint16_t *)&src[i + 8]);
+
+        uint8x16_t b =
+            split_channels15_to_8_neon(source1.val[0], source2.val[0]);
+        uint8x16_t g =
+            split_channels15_to_8_neon(source1.val[1], source2.val[1]);
+        uint8x16_t r =
+            split_channels15_to_8_neon(source1.val[2], source2.val[2]);
+        uint8x16_t a =
+            split_channels15_to_8_neon(source1.val[3], source2.val[3]);
+
+        vst1q_u8(&dst->b[i], delta_neon(b, last_b));
+        vst1q_u8(&dst->g[i], delta_neon(g, last_g));
+        vst1q_u8(&dst->r[i], delta_neon(r, last_r));
+        vst1q_u8(&dst->a[i], delta_neon(a, last_a));
+
+        last_b = b;
+        last_g = g;
+        last_r = r;
+        last_a = a;
+    }
+}
+
+// Prefix sum of the bytes, carrying over the last byte of the previous sum.
+static uint8x16_t undelta_neon(uint8x16_t delta, uint8x16_t last)
+{
+    uint8x16_t zero = vdupq_n_u8(0);
+    uint8x16_t sum = vaddq_u8(delta, vextq_u8(zero, delta, 15));
+    sum = vaddq_u8(sum, vextq_u8(zero, sum, 14));
+    sum = vaddq_u8(sum, vextq_u8(zero, sum, 12));
+    sum = vaddq_u8(sum, vextq_u8(zero, sum, 8));
+    return vaddq_u8(sum, vdupq_laneq_u8(last, 15));
+}
+
+static void split_tile8_delta_to_pixels15_neon(DP_Pixel15 *dst,
+                                               const DP_SplitTile8 *src,
+                                               bool checked)
+{
+    uint8x16_t b = vdupq_n_u8(0);
+    uint8x16_t g = vdupq_n_u8(0);
+    uint8x16_t r = vdupq_n_u8(0);
+    uint8x16_t a = vdupq_n_u8(0);
+    // 16 pixels are converted at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        b = undelta_neon(vld1q_u8(&src->b[i]), b);
+        g = undelta_neon(vld1q_u8(&src->g[i]), g);
+        r = undelta_neon(vld1q_u8(&src->r[i]), r);
+        a = undelta_neon(vld1q_u8(&src->a[i]), a);
+
+        // Clamp color channels to alpha, but keep the unclamped values around
+        // for the sum of the next pixels.
+        uint8x16_t cb = checked ? vminq_u8(b, a) : b;
+        uint8x16_t cg = checked ? vminq_u8(g, a) : g;
+        uint8x16_t cr = checked ? vminq_u8(r, a) : r;
+
+        uint16x8x4_t out1 = {{
+            channels8_to_15_neon(vmovl_u8(vget_low_u8(cb))),
+            channels8_to_15_neon(vmovl_u8(vget_low_u8(cg))),
+            channels8_to_15_neon(vmovl_u8(vget_low_u8(cr))),
+            channels8_to_15_neon(vmovl_u8(vget_low_u8(a))),
+        }};
+        vst4q_u16((uint16_t *)&dst[i], out1);
+
+        uint16x8x4_t out2 = {{
+            channels8_to_15_neon(vmovl_high_u8(cb)),
+            channels8_to_15_neon(vmovl_high_u8(cg)),
+            channels8_to_15_neon(vmovl_high_u8(cr)),
+            channels8_to_15_neon(vmovl_high_u8(a)),
+        }};
+        vst4q_u16((uint16_t *)&dst[i + 8], out2);
+    }
+}
+#endif
+
+void DP_pixels15_to_split_tile8_delta(DP_SplitTile8 *dst, const DP_Pixel15 *src)
+{
+    const DP_Pixel15 *aligned_src = DP_ASSUME_SIMD_ALIGNED(src);
+#ifdef DP_CPU_X64
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX512BW) {
+        pixels15_to_split_tile8_delta_avx512(dst, aligned_src);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        pixels15_to_split_tile8_delta_avx2(dst, aligned_src);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        pixels15_to_split_tile8_delta_sse42(dst, aligned_src);
+    }
+    else
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        pixels15_to_split_tile8_delta_neon(dst, aligned_src);
+    }
+    else
+#endif
+    {
+        pixels15_to_split_tile8_delta(dst, aligned_src);
+    }
+}
+
+static bool split_tile8_delta_to_pixels15_simd(DP_Pixel15 *dst,
+                                               const DP_SplitTile8 *src,
+                                               bool checked)
+{
+#ifdef DP_CPU_X64
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX512BW) {
+        split_tile8_delta_to_pixels15_avx512(dst, src, checked);
+        return true;
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        split_tile8_delta_to_pixels15_avx2(dst, src, checked);
+        return true;
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        split_tile8_delta_to_pixels15_sse42(dst, src, checked);
+        return true;
+    }
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        split_tile8_delta_to_pixels15_neon(dst, src, checked);
+        return true;
+    }
+#else
+    (void)dst;
+    (void)src;
+    (void)checked;
+#endif
+    return false;
+}
+
+void DP_split_tile8_delta_to_pixels15(DP_Pixel15 *dst, const DP_SplitTile8 *src)
+{
+    DP_Pixel15 *aligned_dst = DP_ASSUME_SIMD_ALIGNED(dst);
+    if (!split_tile8_delta_to_pixels15_simd(aligned_dst, src, false)) {
+        split_tile8_delta_to_pixels15(aligned_dst, src);
+    }
+}
+
+void DP_split_tile8_delta_to_pixels15_checked(DP_Pixel15 *dst,
+                                              const DP_SplitTile8 *src)
+{
+    DP_Pixel15 *aligned_dst = DP_ASSUME_SIMD_ALIGNED(dst);
+    if (!split_tile8_delta_to_pixels15_simd(aligned_dst, src, true)) {
+        split_tile8_delta_to_pixels15_checked(aligned_dst, src);
+    }
+}
+
 void DP_split8_delta_to_pixels8(DP_Pixel8 *DP_RESTRICT dst,
                                 const uint8_t *DP_RESTRICT src, int count)
 {
@@ -1384,6 +2154,26 @@ static void blend_tile_normal_sse42(DP_Pixel15 *DP_RESTRICT dst,
     // clang-format on
 }
 
+// Normal blending of a single source pixel, already multiplied by the opacity,
+// onto pixel_count pixels, which must be a multiple of 2. The channels don't
+// need to be split apart, since they're all multiplied by the same value. The
+// 32 bit product is put back together from its low and high halves.
+static void blend_pixels_uniform_normal_sse42(DP_Pixel15 *dst, int pixel_count,
+                                              DP_Pixel15 src_o, uint16_t as1)
+{
+    DP_Pixel15 src_pixels[2] = {src_o, src_o};
+    __m128i s = _mm_loadu_si128((const void *)src_pixels);
+    __m128i a = _mm_set1_epi16((short)as1);
+    for (int i = 0; i < pixel_count; i += 2) {
+        __m128i *d128 = (void *)&dst[i];
+        __m128i d = _mm_loadu_si128(d128);
+        __m128i lo = _mm_mullo_epi16(d, a);
+        __m128i hi = _mm_mulhi_epu16(d, a);
+        __m128i m = _mm_or_si128(_mm_slli_epi16(hi, 1), _mm_srli_epi16(lo, 15));
+        _mm_storeu_si128(d128, _mm_add_epi16(m, s));
+    }
+}
+
 static void blend_tile_recolor_sse42(DP_Pixel15 *DP_RESTRICT dst,
                                      const DP_Pixel15 *DP_RESTRICT src,
                                      uint16_t opacity)
@@ -2126,67 +2916,371 @@ static void blend_tile_oklab_recolor_sse42(DP_Pixel15 *DP_RESTRICT dst,
         store_aligned_sse42(mix_b, mix_g, mix_r, dst_a, &dst[i]);
     }
 }
-DP_TARGET_END
 
-DP_TARGET_BEGIN("avx2")
-static void shuffle_load_avx2(__m256i source1, __m256i source2,
-                              __m256i *out_blue, __m256i *out_green,
-                              __m256i *out_red, __m256i *out_alpha)
+// Truncating division of unsigned 32 bit values, same as what C does. The
+// quotient is estimated via floats, which may make it off by one, so the
+// remainder is checked to correct it. Only valid for quotients below 2^21.
+static __m128i div_estimate_sse42(__m128i n, __m128i d)
 {
-    // clang-format off
-
-    // source1 |B1|G1|R1|A1|B2|G2|R2|A2|B3|G3|R3|A3|B4|G4|R4|A4|
-    // source2 |B5|G5|R5|A5|B6|G6|R6|A6|B7|G7|R7|A7|B8|G8|R8|A8|
-
-    __m256i lo = _mm256_unpacklo_epi32(source1, source2);     // |B1|G1|B5|G5|R1|A1|R5|A5|B3|G3|B7|G7|R3|A3|R7|A7|
-    __m256i hi = _mm256_unpackhi_epi32(source1, source2);     // |B2|G2|B6|G6|R2|A2|R6|A6|B4|G4|B8|G8|R4|A4|R8|A8|
-
-    __m256i blue_green = _mm256_unpacklo_epi64(lo, hi);       // |B1|G1|B5|G5|B2|G2|B6|G6|B3|G3|B7|G7|B4|G4|B8|G8|
-    __m256i red_alpha = _mm256_unpackhi_epi64(lo, hi);        // |R1|A1|R5|A5|R2|A2|R6|A6|R3|A3|R7|A7|R4|A4|R8|A8|
-
-    // Blend with 0 to zero upper bits of 32 spot. Shifting conveniently also zeros out upper bits.
-    *out_blue = _mm256_blend_epi16(blue_green, _mm256_set1_epi32(0), 170); // |B1|0|B5|0|B2|0|B6|0|B3|0|B7|0|B4|0|B8|0|
-    *out_green = _mm256_srli_epi32(blue_green, 16);                        // |G1|0|G5|0|G2|0|G6|0|G3|0|G7|0|G4|0|G8|0|
-    *out_red = _mm256_blend_epi16(red_alpha, _mm256_set1_epi32(0), 170);   // |R1|0|R5|0|R2|0|R6|0|R3|0|R7|0|R4|0|R8|0|
-    *out_alpha = _mm256_srli_epi32(red_alpha, 16);                         // |A1|0|A5|0|A2|0|A6|0|A3|0|A7|0|A4|0|A8|0|
-    // clang-format on
+    __m128i q = _mm_cvttps_epi32(
+        _mm_div_ps(_mm_cvtepi32_ps(n), _mm_cvtepi32_ps(d)));
+    __m128i r = _mm_sub_epi32(n, _mm_mullo_epi32(q, d));
+    q = _mm_add_epi32(q, _mm_cmpgt_epi32(_mm_setzero_si128(), r));
+    __m128i d1 = _mm_sub_epi32(d, _mm_set1_epi32(1));
+    return _mm_sub_epi32(q, _mm_cmpgt_epi32(r, d1));
 }
-// Load 8 16bit pixels and split them into 8x32 bit registers.
-static void load_aligned_avx2(const DP_Pixel15 src[8], __m256i *out_blue,
-                              __m256i *out_green, __m256i *out_red,
-                              __m256i *out_alpha)
-{
-    DP_ASSERT(((intptr_t)src) % 32 == 0);
 
-    const __m256i *src256 = (const void *)src;
-    __m256i source1 = _mm256_load_si256(src256);
-    __m256i source2 = _mm256_load_si256(src256 + 1);
+// Signed division truncating toward zero, as C does it. The divisor must be
+// positive, lanes where it isn't will contain garbage.
+static __m128i idiv_sse42(__m128i n, __m128i d)
+{
+    return _mm_sign_epi32(div_estimate_sse42(_mm_abs_epi32(n), d), n);
+}
 
-    shuffle_load_avx2(source1, source2, out_blue, out_green, out_red,
-                      out_alpha);
+// Same as DP_pixel15_unpremultiply, but for four pixels at a time.
+static void unpremultiply_sse42(__m128i *b, __m128i *g, __m128i *r, __m128i a)
+{
+    __m128i zero = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+    *b = _mm_andnot_si128(zero, div_estimate_sse42(_mm_slli_epi32(*b, 15), a));
+    *g = _mm_andnot_si128(zero, div_estimate_sse42(_mm_slli_epi32(*g, 15), a));
+    *r = _mm_andnot_si128(zero, div_estimate_sse42(_mm_slli_epi32(*r, 15), a));
 }
-// Load 8 16bit pixels and split them into 8x32 bit registers.
-static void load_unaligned_avx2(const DP_Pixel15 src[8], __m256i *out_blue,
-                                __m256i *out_green, __m256i *out_red,
-                                __m256i *out_alpha)
+
+static __m128i comp_screen_sse42(__m128i a, __m128i b)
 {
-    const __m256i *src256 = (const void *)src;
-    __m256i source1 = _mm256_loadu_si256(src256);
-    __m256i source2 = _mm256_loadu_si256(src256 + 1);
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    return _mm_sub_epi32(
+        one, mul_sse42(_mm_sub_epi32(one, a), _mm_sub_epi32(one, b)));
+}
 
-    shuffle_load_avx2(source1, source2, out_blue, out_green, out_red,
-                      out_alpha);
+static __m128i comp_hard_light_sse42(__m128i a, __m128i b)
+{
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    __m128i b2 = _mm_add_epi32(b, b);
+    __m128i lower = _mm_cmpeq_epi32(_mm_min_epu32(b2, one), b2);
+    return _mm_blendv_epi8(comp_screen_sse42(a, _mm_sub_epi32(b2, one)),
+                           mul_sse42(a, b2), lower);
 }
 
-static void shuffle_store_avx2(__m256i blue, __m256i green, __m256i red,
-                               __m256i alpha, __m256i *out1, __m256i *out2)
+static __m128i comp_pin_light_sse42(__m128i a, __m128i b)
 {
-    // clang-format off
-    __m256i blue_green = _mm256_blend_epi16(blue, _mm256_slli_si256(green, 2), 170); // |B1|G1|B5|G5|B2|G2|B6|G6|B3|G3|B7|G7|B4|G4|B8|G8|
-    __m256i red_alpha = _mm256_blend_epi16(red, _mm256_slli_si256(alpha, 2), 170);   // |R1|A1|R5|A5|R2|A2|R6|A6|R3|A3|R7|A7|R4|A4|R8|A8|
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    __m128i b2 = _mm_add_epi32(b, b);
+    __m128i lower = _mm_cmpeq_epi32(_mm_min_epu32(b2, one), b2);
+    return _mm_blendv_epi8(_mm_max_epu32(a, _mm_sub_epi32(b2, one)),
+                           _mm_min_epu32(a, b2), lower);
+}
 
-    __m256i lo = _mm256_unpacklo_epi32(blue_green, red_alpha);                       // |B1|G1|R1|A1|B5|G5|R5|A5|B3|G3|R3|A3|B7|G7|R7|A7|
-    __m256i hi = _mm256_unpackhi_epi32(blue_green, red_alpha);                       // |B2|G2|R2|A2|B6|G6|R6|A6|B4|G4|R4|A4|B8|G8|R8|A8|
+static __m128i comp_separable_sse42(int blend_mode, __m128i a, __m128i b)
+{
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    switch (blend_mode) {
+    case DP_BLEND_MODE_MULTIPLY:
+    case DP_BLEND_MODE_MULTIPLY_ALPHA:
+        return mul_sse42(a, b);
+    case DP_BLEND_MODE_SCREEN:
+    case DP_BLEND_MODE_SCREEN_ALPHA:
+        return comp_screen_sse42(a, b);
+    case DP_BLEND_MODE_OVERLAY:
+    case DP_BLEND_MODE_OVERLAY_ALPHA:
+        return comp_hard_light_sse42(b, a);
+    case DP_BLEND_MODE_HARD_LIGHT:
+    case DP_BLEND_MODE_HARD_LIGHT_ALPHA:
+        return comp_hard_light_sse42(a, b);
+    case DP_BLEND_MODE_PIN_LIGHT:
+    case DP_BLEND_MODE_PIN_LIGHT_ALPHA:
+        return comp_pin_light_sse42(a, b);
+    case DP_BLEND_MODE_DARKEN:
+    case DP_BLEND_MODE_DARKEN_ALPHA:
+        return _mm_min_epu32(a, b);
+    case DP_BLEND_MODE_LIGHTEN:
+    case DP_BLEND_MODE_LIGHTEN_ALPHA:
+        return _mm_max_epu32(a, b);
+    case DP_BLEND_MODE_ADD:
+    case DP_BLEND_MODE_ADD_ALPHA:
+        return _mm_min_epu32(_mm_add_epi32(a, b), one);
+    case DP_BLEND_MODE_SUBTRACT:
+    case DP_BLEND_MODE_SUBTRACT_ALPHA:
+        return _mm_sub_epi32(_mm_max_epu32(a, b), b);
+    case DP_BLEND_MODE_DIFFERENCE:
+    case DP_BLEND_MODE_DIFFERENCE_ALPHA:
+        return _mm_sub_epi32(_mm_max_epu32(a, b), _mm_min_epu32(a, b));
+    case DP_BLEND_MODE_LINEAR_BURN:
+    case DP_BLEND_MODE_LINEAR_BURN_ALPHA:
+        return _mm_sub_epi32(_mm_max_epu32(_mm_add_epi32(a, b), one), one);
+    case DP_BLEND_MODE_LINEAR_LIGHT:
+    case DP_BLEND_MODE_LINEAR_LIGHT_ALPHA: {
+        __m128i c = _mm_add_epi32(a, _mm_add_epi32(b, b));
+        return _mm_min_epu32(_mm_sub_epi32(_mm_max_epu32(c, one), one), one);
+    }
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static __m128i lum_sum_sse42(__m128i b, __m128i g, __m128i r)
+{
+    __m128i sum_b = _mm_mullo_epi32(b, _mm_set1_epi32((int)LUM_B));
+    __m128i sum_g = _mm_mullo_epi32(g, _mm_set1_epi32((int)LUM_G));
+    __m128i sum_r = _mm_mullo_epi32(r, _mm_set1_epi32((int)LUM_R));
+    return _mm_add_epi32(_mm_add_epi32(sum_b, sum_g), sum_r);
+}
+
+static __m128i lum_sse42(__m128i b, __m128i g, __m128i r)
+{
+    return _mm_srli_epi32(lum_sum_sse42(b, g, r), 15);
+}
+
+// Signed division by DP_BIT15 rounding toward zero, like LUM_T on IFix15.
+static __m128i ilum_sse42(__m128i b, __m128i g, __m128i r)
+{
+    __m128i sum = lum_sum_sse42(b, g, r);
+    __m128i bias = _mm_srli_epi32(_mm_srai_epi32(sum, 31), 17);
+    return _mm_srai_epi32(_mm_add_epi32(sum, bias), 15);
+}
+
+static __m128i clip_channel_sse42(__m128i c, __m128i l, __m128i f, __m128i d)
+{
+    return _mm_add_epi32(
+        l, idiv_sse42(_mm_mullo_epi32(_mm_sub_epi32(c, l), f), d));
+}
+
+// Same as set_lum and clip_color, but for four pixels at a time.
+static void set_lum_sse42(__m128i *b, __m128i *g, __m128i *r, __m128i l)
+{
+    __m128i d = _mm_sub_epi32(l, lum_sse42(*b, *g, *r));
+    __m128i ib = _mm_add_epi32(*b, d);
+    __m128i ig = _mm_add_epi32(*g, d);
+    __m128i ir = _mm_add_epi32(*r, d);
+
+    __m128i il = ilum_sse42(ib, ig, ir);
+    __m128i n = _mm_min_epi32(ib, _mm_min_epi32(ig, ir));
+    __m128i x = _mm_max_epi32(ib, _mm_max_epi32(ig, ir));
+
+    __m128i below = _mm_cmpgt_epi32(_mm_setzero_si128(), n);
+    __m128i ln = _mm_sub_epi32(il, n);
+    ib = _mm_blendv_epi8(ib, clip_channel_sse42(ib, il, il, ln), below);
+    ig = _mm_blendv_epi8(ig, clip_channel_sse42(ig, il, il, ln), below);
+    ir = _mm_blendv_epi8(ir, clip_channel_sse42(ir, il, il, ln), below);
+
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    __m128i above = _mm_cmpgt_epi32(x, one);
+    __m128i l1 = _mm_sub_epi32(one, il);
+    __m128i xl = _mm_sub_epi32(x, il);
+    *b = _mm_blendv_epi8(ib, clip_channel_sse42(ib, il, l1, xl), above);
+    *g = _mm_blendv_epi8(ig, clip_channel_sse42(ig, il, l1, xl), above);
+    *r = _mm_blendv_epi8(ir, clip_channel_sse42(ir, il, l1, xl), above);
+}
+
+static void comp_nonseparable_sse42(int blend_mode, __m128i *ab, __m128i *ag,
+                                    __m128i *ar, __m128i bb, __m128i bg,
+                                    __m128i br)
+{
+    switch (blend_mode) {
+    case DP_BLEND_MODE_LUMINOSITY:
+    case DP_BLEND_MODE_LUMINOSITY_ALPHA:
+        set_lum_sse42(ab, ag, ar, lum_sse42(bb, bg, br));
+        break;
+    case DP_BLEND_MODE_COLOR:
+    case DP_BLEND_MODE_COLOR_ALPHA: {
+        __m128i l = lum_sse42(*ab, *ag, *ar);
+        *ab = bb;
+        *ag = bg;
+        *ar = br;
+        set_lum_sse42(ab, ag, ar, l);
+        break;
+    }
+    case DP_BLEND_MODE_DARKER_COLOR:
+    case DP_BLEND_MODE_DARKER_COLOR_ALPHA: {
+        __m128i pick = _mm_cmpgt_epi32(lum_sse42(*ab, *ag, *ar),
+                                       lum_sse42(bb, bg, br));
+        *ab = _mm_blendv_epi8(*ab, bb, pick);
+        *ag = _mm_blendv_epi8(*ag, bg, pick);
+        *ar = _mm_blendv_epi8(*ar, br, pick);
+        break;
+    }
+    case DP_BLEND_MODE_LIGHTER_COLOR:
+    case DP_BLEND_MODE_LIGHTER_COLOR_ALPHA: {
+        __m128i pick = _mm_cmpgt_epi32(lum_sse42(bb, bg, br),
+                                       lum_sse42(*ab, *ag, *ar));
+        *ab = _mm_blendv_epi8(*ab, bb, pick);
+        *ag = _mm_blendv_epi8(*ag, bg, pick);
+        *ar = _mm_blendv_epi8(*ar, br, pick);
+        break;
+    }
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static void comp_sse42(int blend_mode, bool separable, __m128i cb_b,
+                       __m128i cb_g, __m128i cb_r, __m128i cs_b, __m128i cs_g,
+                       __m128i cs_r, __m128i *out_b, __m128i *out_g,
+                       __m128i *out_r)
+{
+    if (separable) {
+        *out_b = comp_separable_sse42(blend_mode, cb_b, cs_b);
+        *out_g = comp_separable_sse42(blend_mode, cb_g, cs_g);
+        *out_r = comp_separable_sse42(blend_mode, cb_r, cs_r);
+    }
+    else {
+        *out_b = cb_b;
+        *out_g = cb_g;
+        *out_r = cb_r;
+        comp_nonseparable_sse42(blend_mode, out_b, out_g, out_r, cs_b, cs_g,
+                                cs_r);
+    }
+}
+
+// Alpha-preserving composite blend modes, see blend_pixels_composite_separable
+// and blend_pixels_composite_nonseparable.
+static void blend_tile_composite_sse42(DP_Pixel15 *DP_RESTRICT dst,
+                                       const DP_Pixel15 *DP_RESTRICT src,
+                                       uint16_t opacity, int blend_mode,
+                                       bool separable)
+{
+    __m128i o = _mm_set1_epi32(opacity);
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        __m128i src_b, src_g, src_r, src_a;
+        load_aligned_sse42(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m128i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_sse42(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m128i cb_b = dst_b, cb_g = dst_g, cb_r = dst_r;
+        unpremultiply_sse42(&cb_b, &cb_g, &cb_r, dst_a);
+        unpremultiply_sse42(&src_b, &src_g, &src_r, src_a);
+
+        __m128i cr_b, cr_g, cr_r;
+        comp_sse42(blend_mode, separable, cb_b, cb_g, cb_r, src_b, src_g,
+                   src_r, &cr_b, &cr_g, &cr_r);
+
+        __m128i so = mul_sse42(src_a, o);
+        __m128i so1 = _mm_sub_epi32(one, so);
+        cr_b = mul_sse42(sumprods_sse42(so1, cb_b, so, cr_b), dst_a);
+        cr_g = mul_sse42(sumprods_sse42(so1, cb_g, so, cr_g), dst_a);
+        cr_r = mul_sse42(sumprods_sse42(so1, cb_r, so, cr_r), dst_a);
+
+        // Fully transparent destination pixels are left alone.
+        __m128i keep = _mm_cmpeq_epi32(dst_a, _mm_setzero_si128());
+        cr_b = _mm_blendv_epi8(cr_b, dst_b, keep);
+        cr_g = _mm_blendv_epi8(cr_g, dst_g, keep);
+        cr_r = _mm_blendv_epi8(cr_r, dst_r, keep);
+
+        store_aligned_sse42(cr_b, cr_g, cr_r, dst_a, &dst[i]);
+    }
+}
+
+// Alpha-affecting composite blend modes, see composite_separable_alpha and
+// composite_nonseparable_alpha.
+static void blend_tile_composite_alpha_sse42(DP_Pixel15 *DP_RESTRICT dst,
+                                             const DP_Pixel15 *DP_RESTRICT src,
+                                             uint16_t opacity, int blend_mode,
+                                             bool separable)
+{
+    __m128i o = _mm_set1_epi32(opacity);
+    __m128i one = _mm_set1_epi32(DP_BIT15);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        __m128i src_b, src_g, src_r, src_a;
+        load_aligned_sse42(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m128i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_sse42(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m128i cb_b = dst_b, cb_g = dst_g, cb_r = dst_r;
+        unpremultiply_sse42(&cb_b, &cb_g, &cb_r, dst_a);
+        __m128i cs_b = src_b, cs_g = src_g, cs_r = src_r;
+        unpremultiply_sse42(&cs_b, &cs_g, &cs_r, src_a);
+
+        __m128i cr_b, cr_g, cr_r;
+        comp_sse42(blend_mode, separable, cb_b, cb_g, cb_r, cs_b, cs_g, cs_r,
+                   &cr_b, &cr_g, &cr_r);
+
+        __m128i ab1 = _mm_sub_epi32(one, dst_a);
+        cr_b = sumprods_sse42(ab1, cs_b, dst_a, cr_b);
+        cr_g = sumprods_sse42(ab1, cs_g, dst_a, cr_g);
+        cr_r = sumprods_sse42(ab1, cs_r, dst_a, cr_r);
+
+        __m128i so = mul_sse42(src_a, o);
+        __m128i so1 = _mm_sub_epi32(one, so);
+        cr_b = _mm_min_epu32(sumprods_sse42(so, cr_b, so1, dst_b), one);
+        cr_g = _mm_min_epu32(sumprods_sse42(so, cr_g, so1, dst_g), one);
+        cr_r = _mm_min_epu32(sumprods_sse42(so, cr_r, so1, dst_r), one);
+        __m128i cr_a =
+            _mm_min_epu32(_mm_add_epi32(so, mul_sse42(dst_a, so1)), one);
+
+        // Fully transparent source pixels don't change anything.
+        __m128i keep = _mm_cmpeq_epi32(src_a, _mm_setzero_si128());
+        cr_b = _mm_blendv_epi8(cr_b, dst_b, keep);
+        cr_g = _mm_blendv_epi8(cr_g, dst_g, keep);
+        cr_r = _mm_blendv_epi8(cr_r, dst_r, keep);
+        cr_a = _mm_blendv_epi8(cr_a, dst_a, keep);
+
+        store_aligned_sse42(cr_b, cr_g, cr_r, cr_a, &dst[i]);
+    }
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx2")
+static void shuffle_load_avx2(__m256i source1, __m256i source2,
+                              __m256i *out_blue, __m256i *out_green,
+                              __m256i *out_red, __m256i *out_alpha)
+{
+    // clang-format off
+
+    // source1 |B1|G1|R1|A1|B2|G2|R2|A2|B3|G3|R3|A3|B4|G4|R4|A4|
+    // source2 |B5|G5|R5|A5|B6|G6|R6|A6|B7|G7|R7|A7|B8|G8|R8|A8|
+
+    __m256i lo = _mm256_unpacklo_epi32(source1, source2);     // |B1|G1|B5|G5|R1|A1|R5|A5|B3|G3|B7|G7|R3|A3|R7|A7|
+    __m256i hi = _mm256_unpackhi_epi32(source1, source2);     // |B2|G2|B6|G6|R2|A2|R6|A6|B4|G4|B8|G8|R4|A4|R8|A8|
+
+    __m256i blue_green = _mm256_unpacklo_epi64(lo, hi);       // |B1|G1|B5|G5|B2|G2|B6|G6|B3|G3|B7|G7|B4|G4|B8|G8|
+    __m256i red_alpha = _mm256_unpackhi_epi64(lo, hi);        // |R1|A1|R5|A5|R2|A2|R6|A6|R3|A3|R7|A7|R4|A4|R8|A8|
+
+    // Blend with 0 to zero upper bits of 32 spot. Shifting conveniently also zeros out upper bits.
+    *out_blue = _mm256_blend_epi16(blue_green, _mm256_set1_epi32(0), 170); // |B1|0|B5|0|B2|0|B6|0|B3|0|B7|0|B4|0|B8|0|
+    *out_green = _mm256_srli_epi32(blue_green, 16);                        // |G1|0|G5|0|G2|0|G6|0|G3|0|G7|0|G4|0|G8|0|
+    *out_red = _mm256_blend_epi16(red_alpha, _mm256_set1_epi32(0), 170);   // |R1|0|R5|0|R2|0|R6|0|R3|0|R7|0|R4|0|R8|0|
+    *out_alpha = _mm256_srli_epi32(red_alpha, 16);                         // |A1|0|A5|0|A2|0|A6|0|A3|0|A7|0|A4|0|A8|0|
+    // clang-format on
+}
+// Load 8 16bit pixels and split them into 8x32 bit registers.
+static void load_aligned_avx2(const DP_Pixel15 src[8], __m256i *out_blue,
+                              __m256i *out_green, __m256i *out_red,
+                              __m256i *out_alpha)
+{
+    DP_ASSERT(((intptr_t)src) % 32 == 0);
+
+    const __m256i *src256 = (const void *)src;
+    __m256i source1 = _mm256_load_si256(src256);
+    __m256i source2 = _mm256_load_si256(src256 + 1);
+
+    shuffle_load_avx2(source1, source2, out_blue, out_green, out_red,
+                      out_alpha);
+}
+// Load 8 16bit pixels and split them into 8x32 bit registers.
+static void load_unaligned_avx2(const DP_Pixel15 src[8], __m256i *out_blue,
+                                __m256i *out_green, __m256i *out_red,
+                                __m256i *out_alpha)
+{
+    const __m256i *src256 = (const void *)src;
+    __m256i source1 = _mm256_loadu_si256(src256);
+    __m256i source2 = _mm256_loadu_si256(src256 + 1);
+
+    shuffle_load_avx2(source1, source2, out_blue, out_green, out_red,
+                      out_alpha);
+}
+
+static void shuffle_store_avx2(__m256i blue, __m256i green, __m256i red,
+                               __m256i alpha, __m256i *out1, __m256i *out2)
+{
+    // clang-format off
+    __m256i blue_green = _mm256_blend_epi16(blue, _mm256_slli_si256(green, 2), 170); // |B1|G1|B5|G5|B2|G2|B6|G6|B3|G3|B7|G7|B4|G4|B8|G8|
+    __m256i red_alpha = _mm256_blend_epi16(red, _mm256_slli_si256(alpha, 2), 170);   // |R1|A1|R5|A5|R2|A2|R6|A6|R3|A3|R7|A7|R4|A4|R8|A8|
+
+    __m256i lo = _mm256_unpacklo_epi32(blue_green, red_alpha);                       // |B1|G1|R1|A1|B5|G5|R5|A5|B3|G3|R3|A3|B7|G7|R7|A7|
+    __m256i hi = _mm256_unpackhi_epi32(blue_green, red_alpha);                       // |B2|G2|R2|A2|B6|G6|R6|A6|B4|G4|R4|A4|B8|G8|R8|A8|
 
     *out1 = _mm256_unpacklo_epi64(lo, hi);                                           // |B1|G1|R1|A1|B2|G2|R2|A2|B3|G3|R3|A3|B4|G4|R4|A4|
     *out2 = _mm256_unpackhi_epi64(lo, hi);                                           // |B5|G5|R5|A5|B6|G6|R6|A6|B7|G7|R7|A7|B8|G8|R8|A8|
@@ -2261,6 +3355,26 @@ static void blend_tile_normal_avx2(DP_Pixel15 *DP_RESTRICT dst,
     // clang-format on
 }
 
+// Like blend_pixels_uniform_normal_sse42, but pixel_count must be a multiple
+// of 4 and it does 4 pixels at a time.
+static void blend_pixels_uniform_normal_avx2(DP_Pixel15 *dst, int pixel_count,
+                                             DP_Pixel15 src_o, uint16_t as1)
+{
+    DP_Pixel15 src_pixels[4] = {src_o, src_o, src_o, src_o};
+    __m256i s = _mm256_loadu_si256((const void *)src_pixels);
+    __m256i a = _mm256_set1_epi16((short)as1);
+    for (int i = 0; i < pixel_count; i += 4) {
+        __m256i *d256 = (void *)&dst[i];
+        __m256i d = _mm256_loadu_si256(d256);
+        __m256i lo = _mm256_mullo_epi16(d, a);
+        __m256i hi = _mm256_mulhi_epu16(d, a);
+        __m256i m = _mm256_or_si256(_mm256_slli_epi16(hi, 1),
+                                    _mm256_srli_epi16(lo, 15));
+        _mm256_storeu_si256(d256, _mm256_add_epi16(m, s));
+    }
+    _mm256_zeroupper();
+}
+
 static void blend_tile_recolor_avx2(DP_Pixel15 *DP_RESTRICT dst,
                                     const DP_Pixel15 *DP_RESTRICT src,
                                     uint16_t opacity)
@@ -2443,61 +3557,494 @@ static void blend_mask_pixels_recolor_avx2(DP_Pixel15 *dst, DP_UPixel15 src,
     _mm256_zeroupper();
     // clang-format on
 }
-DP_TARGET_END
 
-// All CPUs that support AVX2 also support FMA, so we could combine this with
-// the regular AVX2 section. We'll keep it separate just in case though.
-DP_TARGET_BEGIN("avx2,fma")
+static __m256i div_estimate_avx2(__m256i n, __m256i d)
+{
+    __m256i q = _mm256_cvttps_epi32(
+        _mm256_div_ps(_mm256_cvtepi32_ps(n), _mm256_cvtepi32_ps(d)));
+    __m256i r = _mm256_sub_epi32(n, _mm256_mullo_epi32(q, d));
+    q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(_mm256_setzero_si256(), r));
+    __m256i d1 = _mm256_sub_epi32(d, _mm256_set1_epi32(1));
+    return _mm256_sub_epi32(q, _mm256_cmpgt_epi32(r, d1));
+}
 
-__m256 fastcbrt_avx2(__m256 x)
+static __m256i idiv_avx2(__m256i n, __m256i d)
 {
-    const __m256 two = _mm256_set1_ps(2.0f);
-    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
-    const __m256i magic_number = _mm256_set1_epi32(0x2a51067f);
+    return _mm256_sign_epi32(div_estimate_avx2(_mm256_abs_epi32(n), d), n);
+}
 
-    __m256 signs = _mm256_and_ps(x, sign_mask);
-    __m256 abs_x = _mm256_andnot_ps(sign_mask, x);
+// Same as DP_pixel15_unpremultiply, but for eight pixels at a time.
+static void unpremultiply_avx2(__m256i *b, __m256i *g, __m256i *r, __m256i a)
+{
+    __m256i zero = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+    *b = _mm256_andnot_si256(
+        zero, div_estimate_avx2(_mm256_slli_epi32(*b, 15), a));
+    *g = _mm256_andnot_si256(
+        zero, div_estimate_avx2(_mm256_slli_epi32(*g, 15), a));
+    *r = _mm256_andnot_si256(
+        zero, div_estimate_avx2(_mm256_slli_epi32(*r, 15), a));
+}
 
-    __m256i i = _mm256_castps_si256(abs_x);
-    i = _mm256_add_epi32(
-        _mm256_cvtps_epi32(
-            _mm256_mul_ps(_mm256_cvtepi32_ps(i), _mm256_set1_ps(1.0f / 3.0f))),
-        magic_number);
-    __m256 y = _mm256_castsi256_ps(i);
+static __m256i comp_screen_avx2(__m256i a, __m256i b)
+{
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    return _mm256_sub_epi32(
+        one, mul_avx2(_mm256_sub_epi32(one, a), _mm256_sub_epi32(one, b)));
+}
 
-    __m256 y3 = _mm256_mul_ps(y, _mm256_mul_ps(y, y));
-    __m256 halley_num = _mm256_fmadd_ps(abs_x, two, y3);
-    __m256 halley_den = _mm256_fmadd_ps(y3, two, abs_x);
-    __m256 result = _mm256_mul_ps(y, _mm256_div_ps(halley_num, halley_den));
+static __m256i comp_hard_light_avx2(__m256i a, __m256i b)
+{
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    __m256i b2 = _mm256_add_epi32(b, b);
+    __m256i lower = _mm256_cmpeq_epi32(_mm256_min_epu32(b2, one), b2);
+    return _mm256_blendv_epi8(comp_screen_avx2(a, _mm256_sub_epi32(b2, one)),
+                              mul_avx2(a, b2), lower);
+}
 
-    result = _mm256_or_ps(result, signs);
-    __m256 is_zero_mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ);
-    return _mm256_andnot_ps(is_zero_mask, result);
+static __m256i comp_pin_light_avx2(__m256i a, __m256i b)
+{
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    __m256i b2 = _mm256_add_epi32(b, b);
+    __m256i lower = _mm256_cmpeq_epi32(_mm256_min_epu32(b2, one), b2);
+    return _mm256_blendv_epi8(_mm256_max_epu32(a, _mm256_sub_epi32(b2, one)),
+                              _mm256_min_epu32(a, b2), lower);
 }
 
-static __m256 vfastpow_avx2(__m256 base, __m256 exponent)
+static __m256i comp_separable_avx2(int blend_mode, __m256i a, __m256i b)
 {
-    // vfastpow uses GCC extensions.
-#    if defined(__GNUC__) && defined(__SSE2__)
-    // TODO: this is a little silly but there was no fastpow for 8 wide
-    __m128 base_lo = _mm256_extractf128_ps(base, 0);
-    __m128 base_hi = _mm256_extractf128_ps(base, 1);
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    switch (blend_mode) {
+    case DP_BLEND_MODE_MULTIPLY:
+    case DP_BLEND_MODE_MULTIPLY_ALPHA:
+        return mul_avx2(a, b);
+    case DP_BLEND_MODE_SCREEN:
+    case DP_BLEND_MODE_SCREEN_ALPHA:
+        return comp_screen_avx2(a, b);
+    case DP_BLEND_MODE_OVERLAY:
+    case DP_BLEND_MODE_OVERLAY_ALPHA:
+        return comp_hard_light_avx2(b, a);
+    case DP_BLEND_MODE_HARD_LIGHT:
+    case DP_BLEND_MODE_HARD_LIGHT_ALPHA:
+        return comp_hard_light_avx2(a, b);
+    case DP_BLEND_MODE_PIN_LIGHT:
+    case DP_BLEND_MODE_PIN_LIGHT_ALPHA:
+        return comp_pin_light_avx2(a, b);
+    case DP_BLEND_MODE_DARKEN:
+    case DP_BLEND_MODE_DARKEN_ALPHA:
+        return _mm256_min_epu32(a, b);
+    case DP_BLEND_MODE_LIGHTEN:
+    case DP_BLEND_MODE_LIGHTEN_ALPHA:
+        return _mm256_max_epu32(a, b);
+    case DP_BLEND_MODE_ADD:
+    case DP_BLEND_MODE_ADD_ALPHA:
+        return _mm256_min_epu32(_mm256_add_epi32(a, b), one);
+    case DP_BLEND_MODE_SUBTRACT:
+    case DP_BLEND_MODE_SUBTRACT_ALPHA:
+        return _mm256_sub_epi32(_mm256_max_epu32(a, b), b);
+    case DP_BLEND_MODE_DIFFERENCE:
+    case DP_BLEND_MODE_DIFFERENCE_ALPHA:
+        return _mm256_sub_epi32(_mm256_max_epu32(a, b), _mm256_min_epu32(a, b));
+    case DP_BLEND_MODE_LINEAR_BURN:
+    case DP_BLEND_MODE_LINEAR_BURN_ALPHA:
+        return _mm256_sub_epi32(
+            _mm256_max_epu32(_mm256_add_epi32(a, b), one), one);
+    case DP_BLEND_MODE_LINEAR_LIGHT:
+    case DP_BLEND_MODE_LINEAR_LIGHT_ALPHA: {
+        __m256i c = _mm256_add_epi32(a, _mm256_add_epi32(b, b));
+        return _mm256_min_epu32(
+            _mm256_sub_epi32(_mm256_max_epu32(c, one), one), one);
+    }
+    default:
+        DP_UNREACHABLE();
+    }
+}
 
-    __m128 exponent_lo = _mm256_extractf128_ps(exponent, 0);
-    __m128 exponent_hi = _mm256_extractf128_ps(exponent, 1);
+static __m256i lum_sum_avx2(__m256i b, __m256i g, __m256i r)
+{
+    __m256i sum_b = _mm256_mullo_epi32(b, _mm256_set1_epi32((int)LUM_B));
+    __m256i sum_g = _mm256_mullo_epi32(g, _mm256_set1_epi32((int)LUM_G));
+    __m256i sum_r = _mm256_mullo_epi32(r, _mm256_set1_epi32((int)LUM_R));
+    return _mm256_add_epi32(_mm256_add_epi32(sum_b, sum_g), sum_r);
+}
 
-    __m128 res_lo = vfastpow(base_lo, exponent_lo);
-    __m128 res_hi = vfastpow(base_hi, exponent_hi);
+static __m256i lum_avx2(__m256i b, __m256i g, __m256i r)
+{
+    return _mm256_srli_epi32(lum_sum_avx2(b, g, r), 15);
+}
 
-    return _mm256_set_m128(res_hi, res_lo);
-#    else
-    DP_ALIGNAS_SIMD float x[8];
-    DP_ALIGNAS_SIMD float p[8];
-    _mm256_store_ps(x, base);
-    _mm256_store_ps(p, exponent);
-    x[0] = fastpow(x[0], p[0]);
-    x[1] = fastpow(x[1], p[1]);
-    x[2] = fastpow(x[2], p[2]);
+// Signed division by DP_BIT15 rounding toward zero, like LUM_T on IFix15.
+static __m256i ilum_avx2(__m256i b, __m256i g, __m256i r)
+{
+    __m256i sum = lum_sum_avx2(b, g, r);
+    __m256i bias = _mm256_srli_epi32(_mm256_srai_epi32(sum, 31), 17);
+    return _mm256_srai_epi32(_mm256_add_epi32(sum, bias), 15);
+}
+
+static __m256i clip_channel_avx2(__m256i c, __m256i l, __m256i f, __m256i d)
+{
+    return _mm256_add_epi32(
+        l, idiv_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(c, l), f), d));
+}
+
+// Same as set_lum and clip_color, but for eight pixels at a time.
+static void set_lum_avx2(__m256i *b, __m256i *g, __m256i *r, __m256i l)
+{
+    __m256i d = _mm256_sub_epi32(l, lum_avx2(*b, *g, *r));
+    __m256i ib = _mm256_add_epi32(*b, d);
+    __m256i ig = _mm256_add_epi32(*g, d);
+    __m256i ir = _mm256_add_epi32(*r, d);
+
+    __m256i il = ilum_avx2(ib, ig, ir);
+    __m256i n = _mm256_min_epi32(ib, _mm256_min_epi32(ig, ir));
+    __m256i x = _mm256_max_epi32(ib, _mm256_max_epi32(ig, ir));
+
+    __m256i below = _mm256_cmpgt_epi32(_mm256_setzero_si256(), n);
+    __m256i ln = _mm256_sub_epi32(il, n);
+    ib = _mm256_blendv_epi8(ib, clip_channel_avx2(ib, il, il, ln), below);
+    ig = _mm256_blendv_epi8(ig, clip_channel_avx2(ig, il, il, ln), below);
+    ir = _mm256_blendv_epi8(ir, clip_channel_avx2(ir, il, il, ln), below);
+
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    __m256i above = _mm256_cmpgt_epi32(x, one);
+    __m256i l1 = _mm256_sub_epi32(one, il);
+    __m256i xl = _mm256_sub_epi32(x, il);
+    *b = _mm256_blendv_epi8(ib, clip_channel_avx2(ib, il, l1, xl), above);
+    *g = _mm256_blendv_epi8(ig, clip_channel_avx2(ig, il, l1, xl), above);
+    *r = _mm256_blendv_epi8(ir, clip_channel_avx2(ir, il, l1, xl), above);
+}
+
+static void comp_nonseparable_avx2(int blend_mode, __m256i *ab, __m256i *ag,
+                                   __m256i *ar, __m256i bb, __m256i bg,
+                                   __m256i br)
+{
+    switch (blend_mode) {
+    case DP_BLEND_MODE_LUMINOSITY:
+    case DP_BLEND_MODE_LUMINOSITY_ALPHA:
+        set_lum_avx2(ab, ag, ar, lum_avx2(bb, bg, br));
+        break;
+    case DP_BLEND_MODE_COLOR:
+    case DP_BLEND_MODE_COLOR_ALPHA: {
+        __m256i l = lum_avx2(*ab, *ag, *ar);
+        *ab = bb;
+        *ag = bg;
+        *ar = br;
+        set_lum_avx2(ab, ag, ar, l);
+        break;
+    }
+    case DP_BLEND_MODE_DARKER_COLOR:
+    case DP_BLEND_MODE_DARKER_COLOR_ALPHA: {
+        __m256i pick = _mm256_cmpgt_epi32(lum_avx2(*ab, *ag, *ar),
+                                          lum_avx2(bb, bg, br));
+        *ab = _mm256_blendv_epi8(*ab, bb, pick);
+        *ag = _mm256_blendv_epi8(*ag, bg, pick);
+        *ar = _mm256_blendv_epi8(*ar, br, pick);
+        break;
+    }
+    case DP_BLEND_MODE_LIGHTER_COLOR:
+    case DP_BLEND_MODE_LIGHTER_COLOR_ALPHA: {
+        __m256i pick = _mm256_cmpgt_epi32(lum_avx2(bb, bg, br),
+                                          lum_avx2(*ab, *ag, *ar));
+        *ab = _mm256_blendv_epi8(*ab, bb, pick);
+        *ag = _mm256_blendv_epi8(*ag, bg, pick);
+        *ar = _mm256_blendv_epi8(*ar, br, pick);
+        break;
+    }
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static void comp_avx2(int blend_mode, bool separable, __m256i cb_b,
+                      __m256i cb_g, __m256i cb_r, __m256i cs_b, __m256i cs_g,
+                      __m256i cs_r, __m256i *out_b, __m256i *out_g,
+                      __m256i *out_r)
+{
+    if (separable) {
+        *out_b = comp_separable_avx2(blend_mode, cb_b, cs_b);
+        *out_g = comp_separable_avx2(blend_mode, cb_g, cs_g);
+        *out_r = comp_separable_avx2(blend_mode, cb_r, cs_r);
+    }
+    else {
+        *out_b = cb_b;
+        *out_g = cb_g;
+        *out_r = cb_r;
+        comp_nonseparable_avx2(blend_mode, out_b, out_g, out_r, cs_b, cs_g,
+                               cs_r);
+    }
+}
+
+// Alpha-preserving composite blend modes, see blend_pixels_composite_separable
+// and blend_pixels_composite_nonseparable.
+static void blend_tile_composite_avx2(DP_Pixel15 *DP_RESTRICT dst,
+                                      const DP_Pixel15 *DP_RESTRICT src,
+                                      uint16_t opacity, int blend_mode,
+                                      bool separable)
+{
+    __m256i o = _mm256_set1_epi32(opacity);
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i src_b, src_g, src_r, src_a;
+        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m256i cb_b = dst_b, cb_g = dst_g, cb_r = dst_r;
+        unpremultiply_avx2(&cb_b, &cb_g, &cb_r, dst_a);
+        unpremultiply_avx2(&src_b, &src_g, &src_r, src_a);
+
+        __m256i cr_b, cr_g, cr_r;
+        comp_avx2(blend_mode, separable, cb_b, cb_g, cb_r, src_b, src_g,
+                  src_r, &cr_b, &cr_g, &cr_r);
+
+        __m256i so = mul_avx2(src_a, o);
+        __m256i so1 = _mm256_sub_epi32(one, so);
+        cr_b = mul_avx2(sumprods_avx2(so1, cb_b, so, cr_b), dst_a);
+        cr_g = mul_avx2(sumprods_avx2(so1, cb_g, so, cr_g), dst_a);
+        cr_r = mul_avx2(sumprods_avx2(so1, cb_r, so, cr_r), dst_a);
+
+        // Fully transparent destination pixels are left alone.
+        __m256i keep = _mm256_cmpeq_epi32(dst_a, _mm256_setzero_si256());
+        cr_b = _mm256_blendv_epi8(cr_b, dst_b, keep);
+        cr_g = _mm256_blendv_epi8(cr_g, dst_g, keep);
+        cr_r = _mm256_blendv_epi8(cr_r, dst_r, keep);
+
+        store_aligned_avx2(cr_b, cr_g, cr_r, dst_a, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+
+// Alpha-affecting composite blend modes, see composite_separable_alpha and
+// composite_nonseparable_alpha.
+static void blend_tile_composite_alpha_avx2(DP_Pixel15 *DP_RESTRICT dst,
+                                            const DP_Pixel15 *DP_RESTRICT src,
+                                            uint16_t opacity, int blend_mode,
+                                            bool separable)
+{
+    __m256i o = _mm256_set1_epi32(opacity);
+    __m256i one = _mm256_set1_epi32(DP_BIT15);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i src_b, src_g, src_r, src_a;
+        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m256i cb_b = dst_b, cb_g = dst_g, cb_r = dst_r;
+        unpremultiply_avx2(&cb_b, &cb_g, &cb_r, dst_a);
+        __m256i cs_b = src_b, cs_g = src_g, cs_r = src_r;
+        unpremultiply_avx2(&cs_b, &cs_g, &cs_r, src_a);
+
+        __m256i cr_b, cr_g, cr_r;
+        comp_avx2(blend_mode, separable, cb_b, cb_g, cb_r, cs_b, cs_g, cs_r,
+                  &cr_b, &cr_g, &cr_r);
+
+        __m256i ab1 = _mm256_sub_epi32(one, dst_a);
+        cr_b = sumprods_avx2(ab1, cs_b, dst_a, cr_b);
+        cr_g = sumprods_avx2(ab1, cs_g, dst_a, cr_g);
+        cr_r = sumprods_avx2(ab1, cs_r, dst_a, cr_r);
+
+        __m256i so = mul_avx2(src_a, o);
+        __m256i so1 = _mm256_sub_epi32(one, so);
+        cr_b = _mm256_min_epu32(sumprods_avx2(so, cr_b, so1, dst_b), one);
+        cr_g = _mm256_min_epu32(sumprods_avx2(so, cr_g, so1, dst_g), one);
+        cr_r = _mm256_min_epu32(sumprods_avx2(so, cr_r, so1, dst_r), one);
+        __m256i cr_a =
+            _mm256_min_epu32(_mm256_add_epi32(so, mul_avx2(dst_a, so1)), one);
+
+        // Fully transparent source pixels don't change anything.
+        __m256i keep = _mm256_cmpeq_epi32(src_a, _mm256_setzero_si256());
+        cr_b = _mm256_blendv_epi8(cr_b, dst_b, keep);
+        cr_g = _mm256_blendv_epi8(cr_g, dst_g, keep);
+        cr_r = _mm256_blendv_epi8(cr_r, dst_r, keep);
+        cr_a = _mm256_blendv_epi8(cr_a, dst_a, keep);
+
+        store_aligned_avx2(cr_b, cr_g, cr_r, cr_a, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx512f,avx512bw")
+// Load 16 16bit pixels and split them into 16x32 bit registers. Unlike the
+// AVX2 version, this keeps the pixels in order, since a two-source permute can
+// pick the 32 bit blue-green and red-alpha pairs from across the whole thing.
+static void load_avx512(const DP_Pixel15 src[16], __m512i *out_blue,
+                        __m512i *out_green, __m512i *out_red,
+                        __m512i *out_alpha)
+{
+    // clang-format off
+    __m512i source1 = _mm512_loadu_si512((const void *)src);       // |B1|G1|R1|A1|...|B8|G8|R8|A8|
+    __m512i source2 = _mm512_loadu_si512((const void *)(src + 8)); // |B9|G9|R9|A9|...|B16|G16|R16|A16|
+
+    __m512i blue_green = _mm512_permutex2var_epi32(                // |B1|G1|B2|G2|...|B16|G16|
+        source1, _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30), source2);
+    __m512i red_alpha = _mm512_permutex2var_epi32(                 // |R1|A1|R2|A2|...|R16|A16|
+        source1, _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31), source2);
+
+    __m512i low = _mm512_set1_epi32(0xffff);
+    *out_blue = _mm512_and_si512(blue_green, low);
+    *out_green = _mm512_srli_epi32(blue_green, 16);
+    *out_red = _mm512_and_si512(red_alpha, low);
+    *out_alpha = _mm512_srli_epi32(red_alpha, 16);
+    // clang-format on
+}
+
+// Store 16x32 bit registers into 16 16bit pixels.
+static void store_avx512(__m512i blue, __m512i green, __m512i red,
+                         __m512i alpha, DP_Pixel15 dest[16])
+{
+    // clang-format off
+    __m512i blue_green = _mm512_or_si512(blue, _mm512_slli_epi32(green, 16)); // |B1|G1|B2|G2|...|B16|G16|
+    __m512i red_alpha = _mm512_or_si512(red, _mm512_slli_epi32(alpha, 16));   // |R1|A1|R2|A2|...|R16|A16|
+
+    __m512i out1 = _mm512_permutex2var_epi32(                                  // |B1|G1|R1|A1|...|B8|G8|R8|A8|
+        blue_green, _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23), red_alpha);
+    __m512i out2 = _mm512_permutex2var_epi32(                                  // |B9|G9|R9|A9|...|B16|G16|R16|A16|
+        blue_green, _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31), red_alpha);
+
+    _mm512_storeu_si512((void *)dest, out1);
+    _mm512_storeu_si512((void *)(dest + 8), out2);
+    // clang-format on
+}
+
+static __m512i mul_avx512(__m512i a, __m512i b)
+{
+    return _mm512_srli_epi32(_mm512_mullo_epi32(a, b), 15);
+}
+
+static __m512i sumprods_avx512(__m512i a1, __m512i a2, __m512i b1, __m512i b2)
+{
+    return _mm512_srli_epi32(_mm512_add_epi32(_mm512_mullo_epi32(a1, a2),
+                                              _mm512_mullo_epi32(b1, b2)),
+                             15);
+}
+
+static void blend_tile_normal_avx512(DP_Pixel15 *DP_RESTRICT dst,
+                                     const DP_Pixel15 *DP_RESTRICT src,
+                                     uint16_t opacity)
+{
+    // clang-format off
+    __m512i o = _mm512_set1_epi32(opacity); // o = opacity
+
+    // 16 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 16) {
+        // load
+        __m512i srcB, srcG, srcR, srcA;
+        load_avx512(&src[i], &srcB, &srcG, &srcR, &srcA);
+
+        __m512i dstB, dstG, dstR, dstA;
+        load_avx512(&dst[i], &dstB, &dstG, &dstR, &dstA);
+
+        // Normal blend
+        __m512i srcAO = mul_avx512(srcA, o);
+        __m512i as1 = _mm512_sub_epi32(_mm512_set1_epi32(1 << 15), srcAO); // as1 = 1 - srcA * o
+
+        dstB = _mm512_add_epi32(mul_avx512(dstB, as1), mul_avx512(srcB, o)); // dstB = (dstB * as1) + (srcB * o)
+        dstG = _mm512_add_epi32(mul_avx512(dstG, as1), mul_avx512(srcG, o)); // dstG = (dstG * as1) + (srcG * o)
+        dstR = _mm512_add_epi32(mul_avx512(dstR, as1), mul_avx512(srcR, o)); // dstR = (dstR * as1) + (srcR * o)
+        dstA = _mm512_add_epi32(mul_avx512(dstA, as1), srcAO);               // dstA = (dstA * as1) + (srcA * o)
+
+        // store
+        store_avx512(dstB, dstG, dstR, dstA, &dst[i]);
+    }
+    _mm256_zeroupper();
+    // clang-format on
+}
+
+static void blend_mask_pixels_normal_and_eraser_avx512(DP_Pixel15 *dst,
+                                                       DP_UPixel15 src,
+                                                       const uint16_t *mask_int,
+                                                       Fix15 opacity_int,
+                                                       int count)
+{
+    DP_ASSERT(count % 16 == 0);
+
+    __m512i srcB = _mm512_set1_epi32(src.b);
+    __m512i srcG = _mm512_set1_epi32(src.g);
+    __m512i srcR = _mm512_set1_epi32(src.r);
+    __m512i srcA = _mm512_set1_epi32(src.a);
+
+    __m512i opacity = _mm512_set1_epi32((int)opacity_int);
+    __m512i bit15 = _mm512_set1_epi32(DP_BIT15);
+
+    for (int x = 0; x < count; x += 16, dst += 16, mask_int += 16) {
+        // load mask, no permute needed since the pixels are loaded in order
+        __m512i mask =
+            _mm512_cvtepu16_epi32(_mm256_loadu_si256((const void *)mask_int));
+
+        // Load dst
+        __m512i dstB, dstG, dstR, dstA;
+        load_avx512(dst, &dstB, &dstG, &dstR, &dstA);
+
+        __m512i o = mul_avx512(mask, opacity);
+        __m512i opa_a = mul_avx512(o, srcA);
+        __m512i opa_b = _mm512_sub_epi32(bit15, o);
+
+        dstB = sumprods_avx512(opa_a, srcB, opa_b, dstB);
+        dstG = sumprods_avx512(opa_a, srcG, opa_b, dstG);
+        dstR = sumprods_avx512(opa_a, srcR, opa_b, dstR);
+        dstA = _mm512_add_epi32(opa_a, mul_avx512(opa_b, dstA));
+
+        store_avx512(dstB, dstG, dstR, dstA, dst);
+    }
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+
+// All CPUs that support AVX2 also support FMA, so we could combine this with
+// the regular AVX2 section. We'll keep it separate just in case though.
+DP_TARGET_BEGIN("avx2,fma")
+
+__m256 fastcbrt_avx2(__m256 x)
+{
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256i magic_number = _mm256_set1_epi32(0x2a51067f);
+
+    __m256 signs = _mm256_and_ps(x, sign_mask);
+    __m256 abs_x = _mm256_andnot_ps(sign_mask, x);
+
+    __m256i i = _mm256_castps_si256(abs_x);
+    i = _mm256_add_epi32(
+        _mm256_cvtps_epi32(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(i), _mm256_set1_ps(1.0f / 3.0f))),
+        magic_number);
+    __m256 y = _mm256_castsi256_ps(i);
+
+    __m256 y3 = _mm256_mul_ps(y, _mm256_mul_ps(y, y));
+    __m256 halley_num = _mm256_fmadd_ps(abs_x, two, y3);
+    __m256 halley_den = _mm256_fmadd_ps(y3, two, abs_x);
+    __m256 result = _mm256_mul_ps(y, _mm256_div_ps(halley_num, halley_den));
+
+    result = _mm256_or_ps(result, signs);
+    __m256 is_zero_mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    return _mm256_andnot_ps(is_zero_mask, result);
+}
+
+static __m256 vfastpow_avx2(__m256 base, __m256 exponent)
+{
+    // vfastpow uses GCC extensions.
+#    if defined(__GNUC__) && defined(__SSE2__)
+    // TODO: this is a little silly but there was no fastpow for 8 wide
+    __m128 base_lo = _mm256_extractf128_ps(base, 0);
+    __m128 base_hi = _mm256_extractf128_ps(base, 1);
+
+    __m128 exponent_lo = _mm256_extractf128_ps(exponent, 0);
+    __m128 exponent_hi = _mm256_extractf128_ps(exponent, 1);
+
+    __m128 res_lo = vfastpow(base_lo, exponent_lo);
+    __m128 res_hi = vfastpow(base_hi, exponent_hi);
+
+    return _mm256_set_m128(res_hi, res_lo);
+#    else
+    DP_ALIGNAS_SIMD float x[8];
+    DP_ALIGNAS_SIMD float p[8];
+    _mm256_store_ps(x, base);
+    _mm256_store_ps(p, exponent);
+    x[0] = fastpow(x[0], p[0]);
+    x[1] = fastpow(x[1], p[1]);
+    x[2] = fastpow(x[2], p[2]);
     x[3] = fastpow(x[3], p[3]);
     x[4] = fastpow(x[4], p[4]);
     x[5] = fastpow(x[5], p[5]);
@@ -2848,182 +4395,1294 @@ static void blend_mask_pixels_oklab_normal_avx2(DP_Pixel15 *dst,
         mix_oklab_avx2(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
                        src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
 
-        __m256i mix_r, mix_g, mix_b, mix_a;
-        mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_bf, mix_af), bit15));
-        mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_gf, mix_af), bit15));
-        mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_rf, mix_af), bit15));
-        mix_a = _mm256_cvtps_epi32(_mm256_mul_ps(mix_af, bit15));
+        __m256i mix_r, mix_g, mix_b, mix_a;
+        mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_bf, mix_af), bit15));
+        mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_gf, mix_af), bit15));
+        mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_rf, mix_af), bit15));
+        mix_a = _mm256_cvtps_epi32(_mm256_mul_ps(mix_af, bit15));
+
+        store_unaligned_avx2(mix_b, mix_g, mix_r, mix_a, dst);
+    }
+    _mm256_zeroupper();
+}
+
+static void blend_mask_pixels_oklab_recolor_avx2(DP_Pixel15 *dst,
+                                                 DP_UPixel15 src,
+                                                 const uint16_t *mask_int,
+                                                 Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
+    const __m256 bit15 = _mm256_set1_ps(BIT15_FLOAT);
+
+    // Do in parent function ?
+    __m256i src_b = _mm256_set1_epi32(src.b);
+    __m256i src_g = _mm256_set1_epi32(src.g);
+    __m256i src_r = _mm256_set1_epi32(src.r);
+    __m256i src_a = _mm256_set1_epi32(DP_BIT15);
+
+    __m256 src_okl, src_oka, src_okb, src_af;
+    pixels_to_oklaba_avx2(src_b, src_g, src_r, src_a, &src_okl, &src_oka,
+                          &src_okb, &src_af);
+
+    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        // load mask
+        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
+        // Permute mask to fit pixel load order (15263748)
+        mask = _mm256_permutevar8x32_epi32(
+            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+
+        __m256i oi = mul_avx2(mask, opacity);
+        __m256 o = _mm256_div_ps(_mm256_cvtepi32_ps(oi), bit15);
+
+        // Load dst
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        __m256 dst_okl, dst_oka, dst_okb, dst_af;
+        load_unaligned_avx2(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+        pixels_to_oklaba_avx2(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        __m256 mix_bf, mix_gf, mix_rf, mix_af;
+        mix_oklab_avx2(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+
+        __m256i mix_b, mix_g, mix_r, mix_a;
+        mix_a = dst_a;
+        mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_rf, dst_af), bit15));
+        mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_gf, dst_af), bit15));
+        mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_bf, dst_af), bit15));
+
+        store_unaligned_avx2(mix_b, mix_g, mix_r, mix_a, dst);
+    }
+    _mm256_zeroupper();
+}
+
+static void
+blend_mask_pixels_oklab_normal_and_eraser_avx2(DP_Pixel15 *dst, DP_UPixel15 src,
+                                               const uint16_t *mask_int,
+                                               Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
+    const __m256 bit15f = _mm256_set1_ps(BIT15_FLOAT);
+
+    __m256i src_b = _mm256_set1_epi32(src.b);
+    __m256i src_g = _mm256_set1_epi32(src.g);
+    __m256i src_r = _mm256_set1_epi32(src.r);
+    __m256i src_a = _mm256_set1_epi32(DP_BIT15);
+
+    __m256 src_okl, src_oka, src_okb, src_af;
+    pixels_to_oklaba_avx2(src_b, src_g, src_r, src_a, &src_okl, &src_oka,
+                          &src_okb, &src_af);
+
+    __m256i erase_alpha = _mm256_set1_epi32(src.a);
+    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+
+    const __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
+        // Permute mask to fit pixel load order (15263748)
+        mask = _mm256_permutevar8x32_epi32(
+            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        load_unaligned_avx2(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m256i opa_a = mul_avx2(mask, opacity);
+        __m256i opa_b = _mm256_sub_epi32(bit15, opa_a);
+        __m256i opa_a2 = mul_avx2(opa_a, erase_alpha);
+        __m256i opa_out = _mm256_add_epi32(opa_a2, mul_avx2(opa_b, dst_a));
+
+        __m256 o = _mm256_div_ps(_mm256_cvtepi32_ps(opa_a2), bit15f);
+        __m256 opa_out_f = _mm256_div_ps(_mm256_cvtepi32_ps(opa_out), bit15f);
+
+        __m256 dst_okl, dst_oka, dst_okb, dst_af;
+        pixels_to_oklaba_avx2(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        __m256 mix_rf, mix_gf, mix_bf, mix_af;
+        mix_oklab_avx2(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+
+
+        __m256i mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_rf, opa_out_f),
+            bit15f));
+        __m256i mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_gf, opa_out_f),
+            bit15f));
+        __m256i mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
+            channel_linear_premultiply_to_srgb_avx2(mix_bf, opa_out_f),
+            bit15f));
+
+        store_unaligned_avx2(mix_b, mix_g, mix_r, opa_out, dst);
+    }
+}
+
+static void blend_tile_oklab_normal_avx2(DP_Pixel15 *DP_RESTRICT dst,
+                                         const DP_Pixel15 *DP_RESTRICT src,
+                                         uint16_t opacity)
+{
+    __m256 o = _mm256_set1_ps((float)opacity / BIT15_FLOAT);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i src_b, src_g, src_r, src_a;
+        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m256i mix_b, mix_g, mix_r, mix_a;
+        blend_oklab_pixel_avx2(dst_b, dst_g, dst_r, dst_a, src_b, src_g, src_r,
+                               src_a, o, &mix_b, &mix_g, &mix_r, &mix_a);
+
+        store_aligned_avx2(mix_b, mix_g, mix_r, mix_a, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+
+static void blend_tile_oklab_recolor_avx2(DP_Pixel15 *DP_RESTRICT dst,
+                                          const DP_Pixel15 *DP_RESTRICT src,
+                                          uint16_t opacity)
+{
+    __m256 o = _mm256_set1_ps((float)opacity / BIT15_FLOAT);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i src_b, src_g, src_r, src_a;
+        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        __m256i dst_b, dst_g, dst_r, dst_a;
+        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        __m256i mix_b, mix_g, mix_r;
+        blend_oklab_pixel_avx2(dst_b, dst_g, dst_r, dst_a, src_b, src_g, src_r,
+                               src_a, o, &mix_b, &mix_g, &mix_r, NULL);
+
+        store_aligned_avx2(mix_b, mix_g, mix_r, dst_a, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+
+DP_TARGET_END
+#endif
+
+#ifdef DP_CPU_ARM64
+// Load 8 16bit pixels and deinterleave them into one register per channel.
+static void load_neon(const DP_Pixel15 src[8], uint16x8_t *out_blue,
+                      uint16x8_t *out_green, uint16x8_t *out_red,
+                      uint16x8_t *out_alpha)
+{
+    uint16x8x4_t source = vld4q_u16((const uint16_t *)src);
+    *out_blue = source.val[0];
+    *out_green = source.val[1];
+    *out_red = source.val[2];
+    *out_alpha = source.val[3];
+}
+
+// Interleave one register per channel and store them into 8 16bit pixels.
+static void store_neon(uint16x8_t blue, uint16x8_t green, uint16x8_t red,
+                       uint16x8_t alpha, DP_Pixel15 dest[8])
+{
+    uint16x8x4_t out = {{blue, green, red, alpha}};
+    vst4q_u16((uint16_t *)dest, out);
+}
+
+// Load 4 16bit pixels and split them into 4x32 bit registers.
+static void load4_neon(const DP_Pixel15 src[4], uint32x4_t *out_blue,
+                       uint32x4_t *out_green, uint32x4_t *out_red,
+                       uint32x4_t *out_alpha)
+{
+    uint16x4x4_t source = vld4_u16((const uint16_t *)src);
+    *out_blue = vmovl_u16(source.val[0]);
+    *out_green = vmovl_u16(source.val[1]);
+    *out_red = vmovl_u16(source.val[2]);
+    *out_alpha = vmovl_u16(source.val[3]);
+}
+
+// Store 4x32 bit registers into 4 16bit pixels.
+static void store4_neon(uint32x4_t blue, uint32x4_t green, uint32x4_t red,
+                        uint32x4_t alpha, DP_Pixel15 dest[4])
+{
+    uint16x4x4_t out = {
+        {vmovn_u32(blue), vmovn_u32(green), vmovn_u32(red), vmovn_u32(alpha)}};
+    vst4_u16((uint16_t *)dest, out);
+}
+
+// The multiplications are widened to 32 bits and then narrowed back down, the
+// results are the same as the 32 bit lanes of the SSE and AVX versions.
+static uint16x8_t mul_neon(uint16x8_t a, uint16x8_t b)
+{
+    uint32x4_t low = vmull_u16(vget_low_u16(a), vget_low_u16(b));
+    uint32x4_t high = vmull_high_u16(a, b);
+    return vcombine_u16(vshrn_n_u32(low, 15), vshrn_n_u32(high, 15));
+}
+
+static uint16x8_t sumprods_neon(uint16x8_t a1, uint16x8_t a2, uint16x8_t b1,
+                                uint16x8_t b2)
+{
+    uint32x4_t low = vmlal_u16(vmull_u16(vget_low_u16(a1), vget_low_u16(a2)),
+                               vget_low_u16(b1), vget_low_u16(b2));
+    uint32x4_t high = vmlal_high_u16(vmull_high_u16(a1, a2), b1, b2);
+    return vcombine_u16(vshrn_n_u32(low, 15), vshrn_n_u32(high, 15));
+}
+
+static uint32x4_t mul4_neon(uint32x4_t a, uint32x4_t b)
+{
+    return vshrq_n_u32(vmulq_u32(a, b), 15);
+}
+
+static void blend_tile_normal_neon(DP_Pixel15 *DP_RESTRICT dst,
+                                   const DP_Pixel15 *DP_RESTRICT src,
+                                   uint16_t opacity)
+{
+    uint16x8_t o = vdupq_n_u16(opacity);
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+
+    // 8 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        uint16x8_t src_b, src_g, src_r, src_a;
+        load_neon(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t src_ao = mul_neon(src_a, o);
+        uint16x8_t as1 = vsubq_u16(bit15, src_ao);
+
+        dst_b = vaddq_u16(mul_neon(dst_b, as1), mul_neon(src_b, o));
+        dst_g = vaddq_u16(mul_neon(dst_g, as1), mul_neon(src_g, o));
+        dst_r = vaddq_u16(mul_neon(dst_r, as1), mul_neon(src_r, o));
+        dst_a = vaddq_u16(mul_neon(dst_a, as1), src_ao);
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, &dst[i]);
+    }
+}
+
+// Normal blending of a single source pixel, already multiplied by the opacity,
+// onto pixel_count pixels, which must be a multiple of 2. The channels don't
+// need to be split apart, since they're all multiplied by the same value.
+static void blend_pixels_uniform_normal_neon(DP_Pixel15 *dst, int pixel_count,
+                                             DP_Pixel15 src_o, uint16_t as1)
+{
+    DP_Pixel15 src_pixels[2] = {src_o, src_o};
+    uint16x8_t s = vld1q_u16((const uint16_t *)src_pixels);
+    uint16x8_t a = vdupq_n_u16(as1);
+    for (int i = 0; i < pixel_count; i += 2) {
+        uint16_t *d16 = (uint16_t *)&dst[i];
+        vst1q_u16(d16, vaddq_u16(mul_neon(vld1q_u16(d16), a), s));
+    }
+}
+
+static void blend_tile_recolor_neon(DP_Pixel15 *DP_RESTRICT dst,
+                                    const DP_Pixel15 *DP_RESTRICT src,
+                                    uint16_t opacity)
+{
+    uint16x8_t o = vdupq_n_u16(opacity);
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        uint16x8_t src_b, src_g, src_r, src_a;
+        load_neon(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t abo = mul_neon(dst_a, o);
+        uint16x8_t as1 = vsubq_u16(bit15, mul_neon(src_a, o));
+
+        dst_b = vaddq_u16(mul_neon(dst_b, as1), mul_neon(src_b, abo));
+        dst_g = vaddq_u16(mul_neon(dst_g, as1), mul_neon(src_g, abo));
+        dst_r = vaddq_u16(mul_neon(dst_r, as1), mul_neon(src_r, abo));
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, &dst[i]);
+    }
+}
+
+static void blend_tile_behind_neon(DP_Pixel15 *DP_RESTRICT dst,
+                                   const DP_Pixel15 *DP_RESTRICT src,
+                                   uint16_t opacity)
+{
+    uint16x8_t o = vdupq_n_u16(opacity);
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        uint16x8_t src_b, src_g, src_r, src_a;
+        load_neon(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t a1 = mul_neon(vsubq_u16(bit15, dst_a), o);
+
+        dst_b = vaddq_u16(dst_b, mul_neon(src_b, a1));
+        dst_g = vaddq_u16(dst_g, mul_neon(src_g, a1));
+        dst_r = vaddq_u16(dst_r, mul_neon(src_r, a1));
+        dst_a = vaddq_u16(dst_a, mul_neon(src_a, a1));
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, &dst[i]);
+    }
+}
+
+static void blend_mask_pixels_normal_neon(DP_Pixel15 *dst, DP_UPixel15 src,
+                                          const uint16_t *mask_int,
+                                          Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    uint16x8_t src_b = vdupq_n_u16(src.b);
+    uint16x8_t src_g = vdupq_n_u16(src.g);
+    uint16x8_t src_r = vdupq_n_u16(src.r);
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+
+    uint16x8_t opacity = vdupq_n_u16(from_fix(opacity_int));
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        uint16x8_t mask = vld1q_u16(mask_int);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t o = mul_neon(mask, opacity);
+
+        uint16x8_t src_ao = mul_neon(bit15, o);
+        uint16x8_t as1 = vsubq_u16(bit15, src_ao);
+
+        dst_b = vaddq_u16(mul_neon(dst_b, as1), mul_neon(src_b, o));
+        dst_g = vaddq_u16(mul_neon(dst_g, as1), mul_neon(src_g, o));
+        dst_r = vaddq_u16(mul_neon(dst_r, as1), mul_neon(src_r, o));
+        dst_a = vaddq_u16(mul_neon(dst_a, as1), src_ao);
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, dst);
+    }
+}
+
+static void blend_mask_pixels_normal_and_eraser_neon(DP_Pixel15 *dst,
+                                                     DP_UPixel15 src,
+                                                     const uint16_t *mask_int,
+                                                     Fix15 opacity_int,
+                                                     int count)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    uint16x8_t src_b = vdupq_n_u16(src.b);
+    uint16x8_t src_g = vdupq_n_u16(src.g);
+    uint16x8_t src_r = vdupq_n_u16(src.r);
+    uint16x8_t src_a = vdupq_n_u16(src.a);
+
+    uint16x8_t opacity = vdupq_n_u16(from_fix(opacity_int));
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        uint16x8_t mask = vld1q_u16(mask_int);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t o = mul_neon(mask, opacity);
+        uint16x8_t opa_a = mul_neon(o, src_a);
+        uint16x8_t opa_b = vsubq_u16(bit15, o);
+
+        dst_b = sumprods_neon(opa_a, src_b, opa_b, dst_b);
+        dst_g = sumprods_neon(opa_a, src_g, opa_b, dst_g);
+        dst_r = sumprods_neon(opa_a, src_r, opa_b, dst_r);
+        dst_a = vaddq_u16(opa_a, mul_neon(opa_b, dst_a));
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, dst);
+    }
+}
+
+static void blend_mask_pixels_recolor_neon(DP_Pixel15 *dst, DP_UPixel15 src,
+                                           const uint16_t *mask_int,
+                                           Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    uint16x8_t src_b = vdupq_n_u16(src.b);
+    uint16x8_t src_g = vdupq_n_u16(src.g);
+    uint16x8_t src_r = vdupq_n_u16(src.r);
+    uint16x8_t bit15 = vdupq_n_u16(BIT15_U16);
+
+    uint16x8_t opacity = vdupq_n_u16(from_fix(opacity_int));
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        uint16x8_t mask = vld1q_u16(mask_int);
+
+        uint16x8_t dst_b, dst_g, dst_r, dst_a;
+        load_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint16x8_t o = mul_neon(mask, opacity);
+
+        uint16x8_t src_ao = mul_neon(bit15, o);
+        uint16x8_t as = mul_neon(dst_a, src_ao);
+        uint16x8_t as1 = vsubq_u16(bit15, src_ao);
+
+        dst_b = vaddq_u16(mul_neon(dst_b, as1), mul_neon(src_b, as));
+        dst_g = vaddq_u16(mul_neon(dst_g, as1), mul_neon(src_g, as));
+        dst_r = vaddq_u16(mul_neon(dst_r, as1), mul_neon(src_r, as));
+
+        store_neon(dst_b, dst_g, dst_r, dst_a, dst);
+    }
+}
+
+static float32x4_t fastcbrt_neon(float32x4_t x)
+{
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    const uint32x4_t sign_mask = vdupq_n_u32(0x80000000u);
+    const int32x4_t magic_number = vdupq_n_s32(0x2a51067f);
+
+    uint32x4_t xi = vreinterpretq_u32_f32(x);
+    uint32x4_t signs = vandq_u32(xi, sign_mask);
+    float32x4_t abs_x = vreinterpretq_f32_u32(vbicq_u32(xi, sign_mask));
+
+    int32x4_t i = vreinterpretq_s32_f32(abs_x);
+    i = vaddq_s32(vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(i),
+                                           vdupq_n_f32(1.0f / 3.0f))),
+                  magic_number);
+    float32x4_t y = vreinterpretq_f32_s32(i);
+
+    float32x4_t y3 = vmulq_f32(y, vmulq_f32(y, y));
+    float32x4_t halley_num = vaddq_f32(vmulq_f32(abs_x, two), y3);
+    float32x4_t halley_den = vaddq_f32(vmulq_f32(y3, two), abs_x);
+    float32x4_t result = vmulq_f32(y, vdivq_f32(halley_num, halley_den));
+
+    uint32x4_t result_bits = vorrq_u32(vreinterpretq_u32_f32(result), signs);
+    uint32x4_t is_zero_mask = vceqq_f32(x, vdupq_n_f32(0.0f));
+    return vreinterpretq_f32_u32(vbicq_u32(result_bits, is_zero_mask));
+}
+
+static float32x4_t dot3_neon(float32x4_t x, float cx, float32x4_t y, float cy,
+                             float32x4_t z, float cz)
+{
+    float32x4_t term_x = vmulq_f32(x, vdupq_n_f32(cx));
+    float32x4_t term_y = vmulq_f32(y, vdupq_n_f32(cy));
+    float32x4_t term_z = vmulq_f32(z, vdupq_n_f32(cz));
+    return vaddq_f32(vaddq_f32(term_x, term_y), term_z);
+}
+
+// See linear_srgb_to_oklab for the scalar version and the coefficients.
+static void linear_srgb_to_oklab_neon(float32x4_t source_b,
+                                      float32x4_t source_g,
+                                      float32x4_t source_r, float32x4_t *out_l,
+                                      float32x4_t *out_a, float32x4_t *out_b)
+{
+    float32x4_t l = dot3_neon(source_r, 0.4122214708f, source_g, 0.5363325363f,
+                              source_b, 0.0514459929f);
+    float32x4_t m = dot3_neon(source_r, 0.2119034982f, source_g, 0.6806995451f,
+                              source_b, 0.1073969566f);
+    float32x4_t s = dot3_neon(source_r, 0.0883024619f, source_g, 0.2817188376f,
+                              source_b, 0.6299787005f);
+
+    const float32x4_t jbias = vdupq_n_f32(0.0037930732552754493f);
+    const float32x4_t kbias = vdupq_n_f32(-0.15595420054924858f);
+    float32x4_t l_ = vaddq_f32(fastcbrt_neon(vaddq_f32(l, jbias)), kbias);
+    float32x4_t m_ = vaddq_f32(fastcbrt_neon(vaddq_f32(m, jbias)), kbias);
+    float32x4_t s_ = vaddq_f32(fastcbrt_neon(vaddq_f32(s, jbias)), kbias);
+
+    *out_l = dot3_neon(l_, 0.2104542553f, m_, 0.7936177850f, s_,
+                       -0.0040720468f);
+    *out_a = dot3_neon(l_, 1.9779984951f, m_, -2.4285922050f, s_,
+                       0.4505937099f);
+    *out_b = dot3_neon(l_, 0.0259040371f, m_, 0.7827717662f, s_,
+                       -0.8086757660f);
+}
+
+// See oklab_to_linear_srgb for the scalar version and the coefficients.
+static void oklab_to_linear_srgb_neon(float32x4_t source_l,
+                                      float32x4_t source_a,
+                                      float32x4_t source_b, float32x4_t *out_b,
+                                      float32x4_t *out_g, float32x4_t *out_r)
+{
+    float32x4_t l_ = dot3_neon(source_l, 1.0f, source_a, 0.3963377774f,
+                               source_b, 0.2158037573f);
+    float32x4_t m_ = dot3_neon(source_l, 1.0f, source_a, -0.1055613458f,
+                               source_b, -0.0638541728f);
+    float32x4_t s_ = dot3_neon(source_l, 1.0f, source_a, -0.0894841775f,
+                               source_b, -1.2914855480f);
+
+    const float32x4_t jbias = vdupq_n_f32(-0.0037930732552754493f);
+    const float32x4_t kbias = vdupq_n_f32(0.15595420054924858f);
+
+    l_ = vaddq_f32(l_, kbias);
+    m_ = vaddq_f32(m_, kbias);
+    s_ = vaddq_f32(s_, kbias);
+
+    float32x4_t l = vaddq_f32(vmulq_f32(l_, vmulq_f32(l_, l_)), jbias);
+    float32x4_t m = vaddq_f32(vmulq_f32(m_, vmulq_f32(m_, m_)), jbias);
+    float32x4_t s = vaddq_f32(vmulq_f32(s_, vmulq_f32(s_, s_)), jbias);
+
+    *out_r = dot3_neon(l, +4.0767416621f, m, -3.3077115913f, s, +0.2309699292f);
+    *out_g = dot3_neon(l, -1.2684380046f, m, +2.6097574011f, s, -0.3413193965f);
+    *out_b = dot3_neon(l, -0.0041960863f, m, -0.7034186147f, s, +1.7076147010f);
+}
+
+// Vectorized versions of fastlog2 and fastpow2 from fastapprox.
+static float32x4_t vfastlog2_neon(float32x4_t x)
+{
+    uint32x4_t xi = vreinterpretq_u32_f32(x);
+    float32x4_t mx = vreinterpretq_f32_u32(vorrq_u32(
+        vandq_u32(xi, vdupq_n_u32(0x007fffffu)), vdupq_n_u32(0x3f000000u)));
+    float32x4_t y = vmulq_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(xi)),
+                              vdupq_n_f32(1.1920928955078125e-7f));
+    return vsubq_f32(
+        vsubq_f32(vsubq_f32(y, vdupq_n_f32(124.22551499f)),
+                  vmulq_f32(vdupq_n_f32(1.498030302f), mx)),
+        vdivq_f32(vdupq_n_f32(1.72587999f),
+                  vaddq_f32(vdupq_n_f32(0.3520887068f), mx)));
+}
+
+static float32x4_t vfastpow2_neon(float32x4_t p)
+{
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t min = vdupq_n_f32(-126.0f);
+    float32x4_t offset =
+        vbslq_f32(vcltq_f32(p, zero), vdupq_n_f32(1.0f), zero);
+    float32x4_t clipp = vbslq_f32(vcltq_f32(p, min), min, p);
+    float32x4_t w = vcvtq_f32_s32(vcvtq_s32_f32(clipp));
+    float32x4_t z = vaddq_f32(vsubq_f32(clipp, w), offset);
+    float32x4_t v = vsubq_f32(
+        vaddq_f32(vaddq_f32(clipp, vdupq_n_f32(121.2740575f)),
+                  vdivq_f32(vdupq_n_f32(27.7280233f),
+                            vsubq_f32(vdupq_n_f32(4.84252568f), z))),
+        vmulq_f32(vdupq_n_f32(1.49012907f), z));
+    return vreinterpretq_f32_s32(
+        vcvtq_s32_f32(vmulq_f32(vdupq_n_f32((float)(1 << 23)), v)));
+}
+
+static float32x4_t vfastpow_neon(float32x4_t base, float32x4_t exponent)
+{
+    return vfastpow2_neon(vmulq_f32(exponent, vfastlog2_neon(base)));
+}
+
+static float32x4_t channel_unpremultiply_to_linear_neon(float32x4_t ch,
+                                                        float32x4_t alpha)
+{
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t threshold = vdupq_n_f32(0.04045f);
+    const float32x4_t h = vdupq_n_f32(1.0f / 12.92f);
+
+    const float32x4_t pow_add = vdupq_n_f32(0.055f);
+    const float32x4_t pow_mul = vdupq_n_f32(1.0f / 1.055f);
+    const float32x4_t gamma = vdupq_n_f32(2.4f);
+    // return x < 0.04045f ? x / 12.92f : fastpow((x + 0.055f) / 1.055f, 2.4f);
+
+    float32x4_t unprem = vdivq_f32(ch, alpha);
+    unprem = vbslq_f32(vceqq_f32(alpha, zero), zero, unprem);
+
+    float32x4_t powed =
+        vfastpow_neon(vmulq_f32(vaddq_f32(unprem, pow_add), pow_mul), gamma);
+    float32x4_t small = vmulq_f32(unprem, h);
+
+    return vbslq_f32(vcltq_f32(unprem, threshold), small, powed);
+}
+
+static float32x4_t channel_linear_premultiply_to_srgb_neon(float32x4_t ch,
+                                                           float32x4_t alpha)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t threshold = vdupq_n_f32(0.0031308f);
+    const float32x4_t h = vdupq_n_f32(12.92f);
+
+    const float32x4_t pow_sub = vdupq_n_f32(0.055f);
+    const float32x4_t pow_mul = vdupq_n_f32(1.055f);
+    const float32x4_t inv_gamma = vdupq_n_f32(1.0f / 2.4f);
+    // return x < 0.0031308f ? x * 12.92f : fastpow(x, 1.0f / 2.4f) * 1.055f -
+    // 0.055f;
+
+    ch = vminq_f32(ch, one);
+    float32x4_t powed =
+        vsubq_f32(vmulq_f32(pow_mul, vfastpow_neon(ch, inv_gamma)), pow_sub);
+    float32x4_t small = vmulq_f32(ch, h);
+
+    float32x4_t srgb = vbslq_f32(vcleq_f32(ch, threshold), small, powed);
+    return vminq_f32(vmulq_f32(srgb, alpha), one);
+}
+
+static void pixels_to_oklaba_neon(uint32x4_t src_b, uint32x4_t src_g,
+                                  uint32x4_t src_r, uint32x4_t src_a,
+                                  float32x4_t *out_okl, float32x4_t *out_oka,
+                                  float32x4_t *out_okb, float32x4_t *out_a)
+{
+    const float32x4_t bit15 = vdupq_n_f32(1.0f / BIT15_FLOAT);
+
+    float32x4_t src_bf = vmulq_f32(vcvtq_f32_u32(src_b), bit15);
+    float32x4_t src_gf = vmulq_f32(vcvtq_f32_u32(src_g), bit15);
+    float32x4_t src_rf = vmulq_f32(vcvtq_f32_u32(src_r), bit15);
+    float32x4_t src_af = vmulq_f32(vcvtq_f32_u32(src_a), bit15);
+
+    float32x4_t src_bl = channel_unpremultiply_to_linear_neon(src_bf, src_af);
+    float32x4_t src_gl = channel_unpremultiply_to_linear_neon(src_gf, src_af);
+    float32x4_t src_rl = channel_unpremultiply_to_linear_neon(src_rf, src_af);
+
+    linear_srgb_to_oklab_neon(src_bl, src_gl, src_rl, out_okl, out_oka,
+                              out_okb);
+    *out_a = src_af;
+}
+
+static void mix_oklab_neon(float32x4_t dst_okl, float32x4_t dst_oka,
+                           float32x4_t dst_okb, float32x4_t dst_a,
+                           float32x4_t src_okl, float32x4_t src_oka,
+                           float32x4_t src_okb, float32x4_t src_a,
+                           float32x4_t op, float32x4_t *out_b,
+                           float32x4_t *out_g, float32x4_t *out_r,
+                           float32x4_t *out_a_or_null)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t alpha = vmulq_f32(op, src_a);
+    float32x4_t mix_a =
+        vaddq_f32(alpha, vmulq_f32(dst_a, vsubq_f32(one, alpha)));
+    float32x4_t blend = vdivq_f32(alpha, mix_a);
+    blend = vbslq_f32(vceqq_f32(mix_a, zero), zero, blend);
+
+    // lerp rewritten in the form: b + (a - b) * t
+    float32x4_t mix_okl =
+        vaddq_f32(dst_okl, vmulq_f32(vsubq_f32(src_okl, dst_okl), blend));
+    float32x4_t mix_oka =
+        vaddq_f32(dst_oka, vmulq_f32(vsubq_f32(src_oka, dst_oka), blend));
+    float32x4_t mix_okb =
+        vaddq_f32(dst_okb, vmulq_f32(vsubq_f32(src_okb, dst_okb), blend));
+
+    float32x4_t mix_bl, mix_gl, mix_rl;
+    oklab_to_linear_srgb_neon(mix_okl, mix_oka, mix_okb, &mix_bl, &mix_gl,
+                              &mix_rl);
+
+    *out_b = vmaxq_f32(vminq_f32(mix_bl, one), zero);
+    *out_g = vmaxq_f32(vminq_f32(mix_gl, one), zero);
+    *out_r = vmaxq_f32(vminq_f32(mix_rl, one), zero);
+    if (out_a_or_null) {
+        *out_a_or_null = vmaxq_f32(vminq_f32(mix_a, one), zero);
+    }
+}
+
+static uint32x4_t linear_premultiply_to_channel_neon(float32x4_t ch,
+                                                     float32x4_t alpha)
+{
+    return vcvtnq_u32_f32(
+        vmulq_f32(channel_linear_premultiply_to_srgb_neon(ch, alpha),
+                  vdupq_n_f32(BIT15_FLOAT)));
+}
+
+static void blend_mask_pixels_oklab_normal_neon(DP_Pixel15 *dst,
+                                                DP_UPixel15 src,
+                                                const uint16_t *mask_int,
+                                                Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 4 == 0);
+    const float32x4_t bit15 = vdupq_n_f32(BIT15_FLOAT);
+
+    float32x4_t src_okl, src_oka, src_okb, src_af;
+    pixels_to_oklaba_neon(vdupq_n_u32(src.b), vdupq_n_u32(src.g),
+                          vdupq_n_u32(src.r), vdupq_n_u32(DP_BIT15), &src_okl,
+                          &src_oka, &src_okb, &src_af);
+
+    uint32x4_t opacity = vdupq_n_u32((uint32_t)opacity_int);
+
+    for (int x = 0; x < count; x += 4, dst += 4, mask_int += 4) {
+        uint32x4_t mask = vmovl_u16(vld1_u16(mask_int));
+
+        uint32x4_t oi = mul4_neon(mask, opacity);
+        float32x4_t o = vdivq_f32(vcvtq_f32_u32(oi), bit15);
+
+        uint32x4_t dst_b, dst_g, dst_r, dst_a;
+        float32x4_t dst_okl, dst_oka, dst_okb, dst_af;
+        load4_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+        pixels_to_oklaba_neon(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        float32x4_t mix_bf, mix_gf, mix_rf, mix_af;
+        mix_oklab_neon(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+
+        store4_neon(linear_premultiply_to_channel_neon(mix_bf, mix_af),
+                    linear_premultiply_to_channel_neon(mix_gf, mix_af),
+                    linear_premultiply_to_channel_neon(mix_rf, mix_af),
+                    vcvtnq_u32_f32(vmulq_f32(mix_af, bit15)), dst);
+    }
+}
+
+static void blend_mask_pixels_oklab_recolor_neon(DP_Pixel15 *dst,
+                                                 DP_UPixel15 src,
+                                                 const uint16_t *mask_int,
+                                                 Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 4 == 0);
+    const float32x4_t bit15 = vdupq_n_f32(BIT15_FLOAT);
+
+    float32x4_t src_okl, src_oka, src_okb, src_af;
+    pixels_to_oklaba_neon(vdupq_n_u32(src.b), vdupq_n_u32(src.g),
+                          vdupq_n_u32(src.r), vdupq_n_u32(DP_BIT15), &src_okl,
+                          &src_oka, &src_okb, &src_af);
+
+    uint32x4_t opacity = vdupq_n_u32((uint32_t)opacity_int);
+
+    for (int x = 0; x < count; x += 4, dst += 4, mask_int += 4) {
+        uint32x4_t mask = vmovl_u16(vld1_u16(mask_int));
+
+        uint32x4_t oi = mul4_neon(mask, opacity);
+        float32x4_t o = vdivq_f32(vcvtq_f32_u32(oi), bit15);
+
+        uint32x4_t dst_b, dst_g, dst_r, dst_a;
+        float32x4_t dst_okl, dst_oka, dst_okb, dst_af;
+        load4_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+        pixels_to_oklaba_neon(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        float32x4_t mix_bf, mix_gf, mix_rf, mix_af;
+        mix_oklab_neon(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+
+        store4_neon(linear_premultiply_to_channel_neon(mix_bf, dst_af),
+                    linear_premultiply_to_channel_neon(mix_gf, dst_af),
+                    linear_premultiply_to_channel_neon(mix_rf, dst_af), dst_a,
+                    dst);
+    }
+}
+
+static void blend_mask_pixels_oklab_normal_and_eraser_neon(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 4 == 0);
+    const float32x4_t bit15f = vdupq_n_f32(BIT15_FLOAT);
+
+    float32x4_t src_okl, src_oka, src_okb, src_af;
+    pixels_to_oklaba_neon(vdupq_n_u32(src.b), vdupq_n_u32(src.g),
+                          vdupq_n_u32(src.r), vdupq_n_u32(DP_BIT15), &src_okl,
+                          &src_oka, &src_okb, &src_af);
+
+    uint32x4_t erase_alpha = vdupq_n_u32(src.a);
+    uint32x4_t opacity = vdupq_n_u32((uint32_t)opacity_int);
+    uint32x4_t bit15 = vdupq_n_u32(DP_BIT15);
+
+    for (int x = 0; x < count; x += 4, dst += 4, mask_int += 4) {
+        uint32x4_t mask = vmovl_u16(vld1_u16(mask_int));
+
+        uint32x4_t dst_b, dst_g, dst_r, dst_a;
+        load4_neon(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+
+        uint32x4_t opa_a = mul4_neon(mask, opacity);
+        uint32x4_t opa_b = vsubq_u32(bit15, opa_a);
+        uint32x4_t opa_a2 = mul4_neon(opa_a, erase_alpha);
+        uint32x4_t opa_out = vaddq_u32(opa_a2, mul4_neon(opa_b, dst_a));
+
+        float32x4_t o = vdivq_f32(vcvtq_f32_u32(opa_a2), bit15f);
+        float32x4_t opa_out_f = vdivq_f32(vcvtq_f32_u32(opa_out), bit15f);
+
+        float32x4_t dst_okl, dst_oka, dst_okb, dst_af;
+        pixels_to_oklaba_neon(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        float32x4_t mix_bf, mix_gf, mix_rf, mix_af;
+        mix_oklab_neon(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+
+        store4_neon(linear_premultiply_to_channel_neon(mix_bf, opa_out_f),
+                    linear_premultiply_to_channel_neon(mix_gf, opa_out_f),
+                    linear_premultiply_to_channel_neon(mix_rf, opa_out_f),
+                    opa_out, dst);
+    }
+}
+
+static void blend_tile_oklab_neon(DP_Pixel15 *DP_RESTRICT dst,
+                                  const DP_Pixel15 *DP_RESTRICT src,
+                                  uint16_t opacity, bool recolor)
+{
+    const float32x4_t bit15 = vdupq_n_f32(BIT15_FLOAT);
+    const float32x4_t o = vdupq_n_f32((float)opacity / BIT15_FLOAT);
+
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        uint32x4_t src_b, src_g, src_r, src_a;
+        load4_neon(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        uint32x4_t dst_b, dst_g, dst_r, dst_a;
+        load4_neon(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        float32x4_t src_okl, src_oka, src_okb, src_af;
+        float32x4_t dst_okl, dst_oka, dst_okb, dst_af;
+        pixels_to_oklaba_neon(src_b, src_g, src_r, src_a, &src_okl, &src_oka,
+                              &src_okb, &src_af);
+        pixels_to_oklaba_neon(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
+                              &dst_okb, &dst_af);
+
+        float32x4_t mix_b, mix_g, mix_r;
+        if (recolor) {
+            mix_oklab_neon(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                           src_okb, src_af, o, &mix_b, &mix_g, &mix_r, NULL);
+            store4_neon(linear_premultiply_to_channel_neon(mix_b, dst_af),
+                        linear_premultiply_to_channel_neon(mix_g, dst_af),
+                        linear_premultiply_to_channel_neon(mix_r, dst_af),
+                        dst_a, &dst[i]);
+        }
+        else {
+            float32x4_t mix_a;
+            mix_oklab_neon(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
+                           src_okb, src_af, o, &mix_b, &mix_g, &mix_r, &mix_a);
+            store4_neon(linear_premultiply_to_channel_neon(mix_b, mix_a),
+                        linear_premultiply_to_channel_neon(mix_g, mix_a),
+                        linear_premultiply_to_channel_neon(mix_r, mix_a),
+                        vcvtnq_u32_f32(vmulq_f32(mix_a, bit15)), &dst[i]);
+        }
+    }
+}
+#endif
+
+#ifdef DP_CPU_WASM_SIMD128
+// Load 8 16bit pixels and deinterleave them into one register per channel.
+static void load_simd128(const DP_Pixel15 src[8], v128_t *out_blue,
+                         v128_t *out_green, v128_t *out_red, v128_t *out_alpha)
+{
+    // clang-format off
+    v128_t source1 = wasm_v128_load(&src[0]); // |B1|G1|R1|A1|B2|G2|R2|A2|
+    v128_t source2 = wasm_v128_load(&src[2]); // |B3|G3|R3|A3|B4|G4|R4|A4|
+    v128_t source3 = wasm_v128_load(&src[4]); // |B5|G5|R5|A5|B6|G6|R6|A6|
+    v128_t source4 = wasm_v128_load(&src[6]); // |B7|G7|R7|A7|B8|G8|R8|A8|
+
+    v128_t bg1 = wasm_i16x8_shuffle(source1, source2, 0, 4, 8, 12, 1, 5, 9, 13);  // |B1|B2|B3|B4|G1|G2|G3|G4|
+    v128_t ra1 = wasm_i16x8_shuffle(source1, source2, 2, 6, 10, 14, 3, 7, 11, 15); // |R1|R2|R3|R4|A1|A2|A3|A4|
+    v128_t bg2 = wasm_i16x8_shuffle(source3, source4, 0, 4, 8, 12, 1, 5, 9, 13);  // |B5|B6|B7|B8|G5|G6|G7|G8|
+    v128_t ra2 = wasm_i16x8_shuffle(source3, source4, 2, 6, 10, 14, 3, 7, 11, 15); // |R5|R6|R7|R8|A5|A6|A7|A8|
+
+    *out_blue = wasm_i16x8_shuffle(bg1, bg2, 0, 1, 2, 3, 8, 9, 10, 11);
+    *out_green = wasm_i16x8_shuffle(bg1, bg2, 4, 5, 6, 7, 12, 13, 14, 15);
+    *out_red = wasm_i16x8_shuffle(ra1, ra2, 0, 1, 2, 3, 8, 9, 10, 11);
+    *out_alpha = wasm_i16x8_shuffle(ra1, ra2, 4, 5, 6, 7, 12, 13, 14, 15);
+    // clang-format on
+}
+
+// Interleave one register per channel and store them into 8 16bit pixels.
+static void store_simd128(v128_t blue, v128_t green, v128_t red, v128_t alpha,
+                          DP_Pixel15 dest[8])
+{
+    // clang-format off
+    v128_t bg1 = wasm_i16x8_shuffle(blue, green, 0, 1, 2, 3, 8, 9, 10, 11);  // |B1|B2|B3|B4|G1|G2|G3|G4|
+    v128_t bg2 = wasm_i16x8_shuffle(blue, green, 4, 5, 6, 7, 12, 13, 14, 15); // |B5|B6|B7|B8|G5|G6|G7|G8|
+    v128_t ra1 = wasm_i16x8_shuffle(red, alpha, 0, 1, 2, 3, 8, 9, 10, 11);   // |R1|R2|R3|R4|A1|A2|A3|A4|
+    v128_t ra2 = wasm_i16x8_shuffle(red, alpha, 4, 5, 6, 7, 12, 13, 14, 15);  // |R5|R6|R7|R8|A5|A6|A7|A8|
+
+    wasm_v128_store(&dest[0], wasm_i16x8_shuffle(bg1, ra1, 0, 4, 8, 12, 1, 5, 9, 13));
+    wasm_v128_store(&dest[2], wasm_i16x8_shuffle(bg1, ra1, 2, 6, 10, 14, 3, 7, 11, 15));
+    wasm_v128_store(&dest[4], wasm_i16x8_shuffle(bg2, ra2, 0, 4, 8, 12, 1, 5, 9, 13));
+    wasm_v128_store(&dest[6], wasm_i16x8_shuffle(bg2, ra2, 2, 6, 10, 14, 3, 7, 11, 15));
+    // clang-format on
+}
+
+// Narrow the 32 bit lanes of two registers to 16 bits by truncating them.
+static v128_t narrow_simd128(v128_t low, v128_t high)
+{
+    return wasm_i16x8_shuffle(low, high, 0, 2, 4, 6, 8, 10, 12, 14);
+}
+
+// The multiplications are widened to 32 bits and then narrowed back down, the
+// results are the same as the 32 bit lanes of the SSE and AVX versions.
+static v128_t mul_simd128(v128_t a, v128_t b)
+{
+    v128_t low = wasm_u32x4_shr(wasm_u32x4_extmul_low_u16x8(a, b), 15);
+    v128_t high = wasm_u32x4_shr(wasm_u32x4_extmul_high_u16x8(a, b), 15);
+    return narrow_simd128(low, high);
+}
+
+static v128_t sumprods_simd128(v128_t a1, v128_t a2, v128_t b1, v128_t b2)
+{
+    v128_t low = wasm_i32x4_add(wasm_u32x4_extmul_low_u16x8(a1, a2),
+                                wasm_u32x4_extmul_low_u16x8(b1, b2));
+    v128_t high = wasm_i32x4_add(wasm_u32x4_extmul_high_u16x8(a1, a2),
+                                 wasm_u32x4_extmul_high_u16x8(b1, b2));
+    return narrow_simd128(wasm_u32x4_shr(low, 15), wasm_u32x4_shr(high, 15));
+}
+
+static void blend_tile_normal_simd128(DP_Pixel15 *DP_RESTRICT dst,
+                                      const DP_Pixel15 *DP_RESTRICT src,
+                                      uint16_t opacity)
+{
+    v128_t o = wasm_u16x8_splat(opacity);
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
+
+    // 8 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        v128_t src_b, src_g, src_r, src_a;
+        load_simd128(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        v128_t src_ao = mul_simd128(src_a, o);
+        v128_t as1 = wasm_i16x8_sub(bit15, src_ao);
+
+        dst_b = wasm_i16x8_add(mul_simd128(dst_b, as1), mul_simd128(src_b, o));
+        dst_g = wasm_i16x8_add(mul_simd128(dst_g, as1), mul_simd128(src_g, o));
+        dst_r = wasm_i16x8_add(mul_simd128(dst_r, as1), mul_simd128(src_r, o));
+        dst_a = wasm_i16x8_add(mul_simd128(dst_a, as1), src_ao);
+
+        store_simd128(dst_b, dst_g, dst_r, dst_a, &dst[i]);
+    }
+}
+
+// Normal blending of a single source pixel, already multiplied by the opacity,
+// onto pixel_count pixels, which must be a multiple of 2. The channels don't
+// need to be split apart, since they're all multiplied by the same value.
+static void blend_pixels_uniform_normal_simd128(DP_Pixel15 *dst,
+                                                int pixel_count,
+                                                DP_Pixel15 src_o, uint16_t as1)
+{
+    DP_Pixel15 src_pixels[2] = {src_o, src_o};
+    v128_t s = wasm_v128_load(src_pixels);
+    v128_t a = wasm_u16x8_splat(as1);
+    for (int i = 0; i < pixel_count; i += 2) {
+        DP_Pixel15 *d = &dst[i];
+        v128_t m = mul_simd128(wasm_v128_load(d), a);
+        wasm_v128_store(d, wasm_i16x8_add(m, s));
+    }
+}
+
+static void blend_tile_recolor_simd128(DP_Pixel15 *DP_RESTRICT dst,
+                                       const DP_Pixel15 *DP_RESTRICT src,
+                                       uint16_t opacity)
+{
+    v128_t o = wasm_u16x8_splat(opacity);
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        v128_t src_b, src_g, src_r, src_a;
+        load_simd128(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        v128_t abo = mul_simd128(dst_a, o);
+        v128_t as1 = wasm_i16x8_sub(bit15, mul_simd128(src_a, o));
+
+        dst_b =
+            wasm_i16x8_add(mul_simd128(dst_b, as1), mul_simd128(src_b, abo));
+        dst_g =
+            wasm_i16x8_add(mul_simd128(dst_g, as1), mul_simd128(src_g, abo));
+        dst_r =
+            wasm_i16x8_add(mul_simd128(dst_r, as1), mul_simd128(src_r, abo));
+
+        store_simd128(dst_b, dst_g, dst_r, dst_a, &dst[i]);
+    }
+}
+
+static void blend_tile_behind_simd128(DP_Pixel15 *DP_RESTRICT dst,
+                                      const DP_Pixel15 *DP_RESTRICT src,
+                                      uint16_t opacity)
+{
+    v128_t o = wasm_u16x8_splat(opacity);
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        v128_t src_b, src_g, src_r, src_a;
+        load_simd128(&src[i], &src_b, &src_g, &src_r, &src_a);
+
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
+
+        v128_t a1 = mul_simd128(wasm_i16x8_sub(bit15, dst_a), o);
 
-        store_unaligned_avx2(mix_b, mix_g, mix_r, mix_a, dst);
+        dst_b = wasm_i16x8_add(dst_b, mul_simd128(src_b, a1));
+        dst_g = wasm_i16x8_add(dst_g, mul_simd128(src_g, a1));
+        dst_r = wasm_i16x8_add(dst_r, mul_simd128(src_r, a1));
+        dst_a = wasm_i16x8_add(dst_a, mul_simd128(src_a, a1));
+
+        store_simd128(dst_b, dst_g, dst_r, dst_a, &dst[i]);
     }
-    _mm256_zeroupper();
 }
 
-static void blend_mask_pixels_oklab_recolor_avx2(DP_Pixel15 *dst,
-                                                 DP_UPixel15 src,
-                                                 const uint16_t *mask_int,
-                                                 Fix15 opacity_int, int count)
+static void blend_mask_pixels_normal_simd128(DP_Pixel15 *dst, DP_UPixel15 src,
+                                             const uint16_t *mask_int,
+                                             Fix15 opacity_int, int count)
 {
     DP_ASSERT(count % 8 == 0);
-    const __m256 bit15 = _mm256_set1_ps(BIT15_FLOAT);
 
-    // Do in parent function ?
-    __m256i src_b = _mm256_set1_epi32(src.b);
-    __m256i src_g = _mm256_set1_epi32(src.g);
-    __m256i src_r = _mm256_set1_epi32(src.r);
-    __m256i src_a = _mm256_set1_epi32(DP_BIT15);
-
-    __m256 src_okl, src_oka, src_okb, src_af;
-    pixels_to_oklaba_avx2(src_b, src_g, src_r, src_a, &src_okl, &src_oka,
-                          &src_okb, &src_af);
+    v128_t src_b = wasm_u16x8_splat(src.b);
+    v128_t src_g = wasm_u16x8_splat(src.g);
+    v128_t src_r = wasm_u16x8_splat(src.r);
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
 
-    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+    v128_t opacity = wasm_u16x8_splat(from_fix(opacity_int));
 
     for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
-        // load mask
-        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
-        // Permute mask to fit pixel load order (15263748)
-        mask = _mm256_permutevar8x32_epi32(
-            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        v128_t mask = wasm_v128_load(mask_int);
 
-        __m256i oi = mul_avx2(mask, opacity);
-        __m256 o = _mm256_div_ps(_mm256_cvtepi32_ps(oi), bit15);
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(dst, &dst_b, &dst_g, &dst_r, &dst_a);
 
-        // Load dst
-        __m256i dst_b, dst_g, dst_r, dst_a;
-        __m256 dst_okl, dst_oka, dst_okb, dst_af;
-        load_unaligned_avx2(dst, &dst_b, &dst_g, &dst_r, &dst_a);
-        pixels_to_oklaba_avx2(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
-                              &dst_okb, &dst_af);
+        v128_t o = mul_simd128(mask, opacity);
 
-        __m256 mix_bf, mix_gf, mix_rf, mix_af;
-        mix_oklab_avx2(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
-                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+        v128_t src_ao = mul_simd128(bit15, o);
+        v128_t as1 = wasm_i16x8_sub(bit15, src_ao);
 
-        __m256i mix_b, mix_g, mix_r, mix_a;
-        mix_a = dst_a;
-        mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_rf, dst_af), bit15));
-        mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_gf, dst_af), bit15));
-        mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_bf, dst_af), bit15));
+        dst_b = wasm_i16x8_add(mul_simd128(dst_b, as1), mul_simd128(src_b, o));
+        dst_g = wasm_i16x8_add(mul_simd128(dst_g, as1), mul_simd128(src_g, o));
+        dst_r = wasm_i16x8_add(mul_simd128(dst_r, as1), mul_simd128(src_r, o));
+        dst_a = wasm_i16x8_add(mul_simd128(dst_a, as1), src_ao);
 
-        store_unaligned_avx2(mix_b, mix_g, mix_r, mix_a, dst);
+        store_simd128(dst_b, dst_g, dst_r, dst_a, dst);
     }
-    _mm256_zeroupper();
 }
 
-static void
-blend_mask_pixels_oklab_normal_and_eraser_avx2(DP_Pixel15 *dst, DP_UPixel15 src,
-                                               const uint16_t *mask_int,
-                                               Fix15 opacity_int, int count)
+static void blend_mask_pixels_normal_and_eraser_simd128(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count)
 {
     DP_ASSERT(count % 8 == 0);
-    const __m256 bit15f = _mm256_set1_ps(BIT15_FLOAT);
 
-    __m256i src_b = _mm256_set1_epi32(src.b);
-    __m256i src_g = _mm256_set1_epi32(src.g);
-    __m256i src_r = _mm256_set1_epi32(src.r);
-    __m256i src_a = _mm256_set1_epi32(DP_BIT15);
+    v128_t src_b = wasm_u16x8_splat(src.b);
+    v128_t src_g = wasm_u16x8_splat(src.g);
+    v128_t src_r = wasm_u16x8_splat(src.r);
+    v128_t src_a = wasm_u16x8_splat(src.a);
 
-    __m256 src_okl, src_oka, src_okb, src_af;
-    pixels_to_oklaba_avx2(src_b, src_g, src_r, src_a, &src_okl, &src_oka,
-                          &src_okb, &src_af);
+    v128_t opacity = wasm_u16x8_splat(from_fix(opacity_int));
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
 
-    __m256i erase_alpha = _mm256_set1_epi32(src.a);
-    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        v128_t mask = wasm_v128_load(mask_int);
 
-    const __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(dst, &dst_b, &dst_g, &dst_r, &dst_a);
 
-    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
-        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
-        // Permute mask to fit pixel load order (15263748)
-        mask = _mm256_permutevar8x32_epi32(
-            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        v128_t o = mul_simd128(mask, opacity);
+        v128_t opa_a = mul_simd128(o, src_a);
+        v128_t opa_b = wasm_i16x8_sub(bit15, o);
 
-        __m256i dst_b, dst_g, dst_r, dst_a;
-        load_unaligned_avx2(dst, &dst_b, &dst_g, &dst_r, &dst_a);
+        dst_b = sumprods_simd128(opa_a, src_b, opa_b, dst_b);
+        dst_g = sumprods_simd128(opa_a, src_g, opa_b, dst_g);
+        dst_r = sumprods_simd128(opa_a, src_r, opa_b, dst_r);
+        dst_a = wasm_i16x8_add(opa_a, mul_simd128(opa_b, dst_a));
 
-        __m256i opa_a = mul_avx2(mask, opacity);
-        __m256i opa_b = _mm256_sub_epi32(bit15, opa_a);
-        __m256i opa_a2 = mul_avx2(opa_a, erase_alpha);
-        __m256i opa_out = _mm256_add_epi32(opa_a2, mul_avx2(opa_b, dst_a));
+        store_simd128(dst_b, dst_g, dst_r, dst_a, dst);
+    }
+}
 
-        __m256 o = _mm256_div_ps(_mm256_cvtepi32_ps(opa_a2), bit15f);
-        __m256 opa_out_f = _mm256_div_ps(_mm256_cvtepi32_ps(opa_out), bit15f);
+static void blend_mask_pixels_recolor_simd128(DP_Pixel15 *dst, DP_UPixel15 src,
+                                              const uint16_t *mask_int,
+                                              Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
 
-        __m256 dst_okl, dst_oka, dst_okb, dst_af;
-        pixels_to_oklaba_avx2(dst_b, dst_g, dst_r, dst_a, &dst_okl, &dst_oka,
-                              &dst_okb, &dst_af);
+    v128_t src_b = wasm_u16x8_splat(src.b);
+    v128_t src_g = wasm_u16x8_splat(src.g);
+    v128_t src_r = wasm_u16x8_splat(src.r);
+    v128_t bit15 = wasm_u16x8_splat(BIT15_U16);
 
-        __m256 mix_rf, mix_gf, mix_bf, mix_af;
-        mix_oklab_avx2(dst_okl, dst_oka, dst_okb, dst_af, src_okl, src_oka,
-                       src_okb, src_af, o, &mix_bf, &mix_gf, &mix_rf, &mix_af);
+    v128_t opacity = wasm_u16x8_splat(from_fix(opacity_int));
 
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        v128_t mask = wasm_v128_load(mask_int);
 
-        __m256i mix_r = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_rf, opa_out_f),
-            bit15f));
-        __m256i mix_g = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_gf, opa_out_f),
-            bit15f));
-        __m256i mix_b = _mm256_cvtps_epi32(_mm256_mul_ps(
-            channel_linear_premultiply_to_srgb_avx2(mix_bf, opa_out_f),
-            bit15f));
+        v128_t dst_b, dst_g, dst_r, dst_a;
+        load_simd128(dst, &dst_b, &dst_g, &dst_r, &dst_a);
 
-        store_unaligned_avx2(mix_b, mix_g, mix_r, opa_out, dst);
+        v128_t o = mul_simd128(mask, opacity);
+
+        v128_t src_ao = mul_simd128(bit15, o);
+        v128_t as = mul_simd128(dst_a, src_ao);
+        v128_t as1 = wasm_i16x8_sub(bit15, src_ao);
+
+        dst_b = wasm_i16x8_add(mul_simd128(dst_b, as1), mul_simd128(src_b, as));
+        dst_g = wasm_i16x8_add(mul_simd128(dst_g, as1), mul_simd128(src_g, as));
+        dst_r = wasm_i16x8_add(mul_simd128(dst_r, as1), mul_simd128(src_r, as));
+
+        store_simd128(dst_b, dst_g, dst_r, dst_a, dst);
     }
 }
+#endif
 
-static void blend_tile_oklab_normal_avx2(DP_Pixel15 *DP_RESTRICT dst,
-                                         const DP_Pixel15 *DP_RESTRICT src,
-                                         uint16_t opacity)
-{
-    __m256 o = _mm256_set1_ps((float)opacity / BIT15_FLOAT);
-    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
-        __m256i src_b, src_g, src_r, src_a;
-        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
-
-        __m256i dst_b, dst_g, dst_r, dst_a;
-        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
 
-        __m256i mix_b, mix_g, mix_r, mix_a;
-        blend_oklab_pixel_avx2(dst_b, dst_g, dst_r, dst_a, src_b, src_g, src_r,
-                               src_a, o, &mix_b, &mix_g, &mix_r, &mix_a);
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("sse4.2")
+// Same as DP_pixel15_unpremultiply followed by DP_channel15_to_8, given the
+// reciprocal of the alpha. Multiplying with that estimates the quotient, which
+// is then corrected via the remainder like in div_estimate_sse42, so there's
+// only a single division per pixel instead of one per channel.
+static __m128i unpremultiply_channel_to_8_sse42(__m128i c, __m128i a,
+                                                __m128 rcp)
+{
+    __m128i n = _mm_slli_epi32(c, 15);
+    __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(c), rcp));
+    __m128i r = _mm_sub_epi32(n, _mm_mullo_epi32(q, a));
+    q = _mm_add_epi32(q, _mm_cmpgt_epi32(_mm_setzero_si128(), r));
+    __m128i a1 = _mm_sub_epi32(a, _mm_set1_epi32(1));
+    q = _mm_sub_epi32(q, _mm_cmpgt_epi32(r, a1));
+    q = _mm_min_epi32(q, _mm_set1_epi32(DP_BIT15));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi32(q, _mm_set1_epi32(255)),
+                                        _mm_set1_epi32(FUDGE15_TO_8)),
+                          15);
+}
+
+static void pixels15_to_8_unpremultiply_sse42(DP_UPixel8 *dst,
+                                              const DP_Pixel15 *src, int count)
+{
+    for (int i = 0; i < count; i += 4) {
+        __m128i b, g, r, a;
+        load_unaligned_sse42(&src[i], &b, &g, &r, &a);
+
+        // Transparent pixels end up as all zeroes, the garbage that division
+        // by zero produces for them gets masked out at the end.
+        __m128i zero = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+        __m128 rcp = _mm_div_ps(_mm_set1_ps(BIT15_FLOAT), _mm_cvtepi32_ps(a));
+        __m128i b8 = unpremultiply_channel_to_8_sse42(b, a, rcp);
+        __m128i g8 = unpremultiply_channel_to_8_sse42(g, a, rcp);
+        __m128i r8 = unpremultiply_channel_to_8_sse42(r, a, rcp);
+        __m128i a8 = _mm_srli_epi32(
+            _mm_add_epi32(_mm_mullo_epi32(a, _mm_set1_epi32(255)),
+                          _mm_set1_epi32(FUDGE15_TO_8)),
+            15);
+
+        __m128i out = _mm_or_si128(
+            _mm_or_si128(b8, _mm_slli_epi32(g8, 8)),
+            _mm_or_si128(_mm_slli_epi32(r8, 16), _mm_slli_epi32(a8, 24)));
+        _mm_storeu_si128((void *)&dst[i], _mm_andnot_si128(zero, out));
+    }
+}
+
+// Same as DP_pixel8_premultiply, but for 4 pixels at a time. Channels are
+// widened to 16 bits, which is enough for the multiplication and rounding.
+static __m128i premultiply_channels_sse42(__m128i p)
+{
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0xff), 0xff);
+    __m128i t = _mm_mullo_epi16(p, a);
+    t = _mm_add_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)),
+                      _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(t, 8);
+}
+
+static void pixels8_premultiply_sse42(DP_Pixel8 *pixels, int count)
+{
+    __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    for (int i = 0; i < count; i += 4) {
+        __m128i source = _mm_loadu_si128((void *)&pixels[i]);
+        __m128i lo = premultiply_channels_sse42(_mm_cvtepu8_epi16(source));
+        __m128i hi = premultiply_channels_sse42(
+            _mm_cvtepu8_epi16(_mm_srli_si128(source, 8)));
+        // The alpha got multiplied with itself, put the original back.
+        __m128i out = _mm_blendv_epi8(_mm_packus_epi16(lo, hi), source,
+                                      alpha_mask);
+        _mm_storeu_si128((void *)&pixels[i], out);
+    }
+}
+DP_TARGET_END
 
-        store_aligned_avx2(mix_b, mix_g, mix_r, mix_a, &dst[i]);
+DP_TARGET_BEGIN("avx2")
+static __m256i unpremultiply_channel_to_8_avx2(__m256i c, __m256i a,
+                                               __m256 rcp)
+{
+    __m256i n = _mm256_slli_epi32(c, 15);
+    __m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(c), rcp));
+    __m256i r = _mm256_sub_epi32(n, _mm256_mullo_epi32(q, a));
+    q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(_mm256_setzero_si256(), r));
+    __m256i a1 = _mm256_sub_epi32(a, _mm256_set1_epi32(1));
+    q = _mm256_sub_epi32(q, _mm256_cmpgt_epi32(r, a1));
+    q = _mm256_min_epi32(q, _mm256_set1_epi32(DP_BIT15));
+    return _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(q, _mm256_set1_epi32(255)),
+                         _mm256_set1_epi32(FUDGE15_TO_8)),
+        15);
+}
+
+static void pixels15_to_8_unpremultiply_avx2(DP_UPixel8 *dst,
+                                             const DP_Pixel15 *src, int count)
+{
+    for (int i = 0; i < count; i += 8) {
+        __m256i b, g, r, a;
+        load_unaligned_avx2(&src[i], &b, &g, &r, &a);
+
+        __m256i zero = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+        __m256 rcp =
+            _mm256_div_ps(_mm256_set1_ps(BIT15_FLOAT), _mm256_cvtepi32_ps(a));
+        __m256i b8 = unpremultiply_channel_to_8_avx2(b, a, rcp);
+        __m256i g8 = unpremultiply_channel_to_8_avx2(g, a, rcp);
+        __m256i r8 = unpremultiply_channel_to_8_avx2(r, a, rcp);
+        __m256i a8 = _mm256_srli_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(a, _mm256_set1_epi32(255)),
+                             _mm256_set1_epi32(FUDGE15_TO_8)),
+            15);
+
+        __m256i out = _mm256_or_si256(
+            _mm256_or_si256(b8, _mm256_slli_epi32(g8, 8)),
+            _mm256_or_si256(_mm256_slli_epi32(r8, 16),
+                            _mm256_slli_epi32(a8, 24)));
+        // Loading leaves the pixels in the order 1, 5, 2, 6, 3, 7, 4, 8.
+        out = _mm256_permutevar8x32_epi32(
+            _mm256_andnot_si256(zero, out),
+            _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+        _mm256_storeu_si256((void *)&dst[i], out);
     }
     _mm256_zeroupper();
 }
 
-static void blend_tile_oklab_recolor_avx2(DP_Pixel15 *DP_RESTRICT dst,
-                                          const DP_Pixel15 *DP_RESTRICT src,
-                                          uint16_t opacity)
+static __m256i premultiply_channels_avx2(__m256i p)
 {
-    __m256 o = _mm256_set1_ps((float)opacity / BIT15_FLOAT);
-    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
-        __m256i src_b, src_g, src_r, src_a;
-        load_aligned_avx2(&src[i], &src_b, &src_g, &src_r, &src_a);
-
-        __m256i dst_b, dst_g, dst_r, dst_a;
-        load_aligned_avx2(&dst[i], &dst_b, &dst_g, &dst_r, &dst_a);
-
-        __m256i mix_b, mix_g, mix_r;
-        blend_oklab_pixel_avx2(dst_b, dst_g, dst_r, dst_a, src_b, src_g, src_r,
-                               src_a, o, &mix_b, &mix_g, &mix_r, NULL);
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, 0xff), 0xff);
+    __m256i t = _mm256_mullo_epi16(p, a);
+    t = _mm256_add_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)),
+                         _mm256_set1_epi16(0x80));
+    return _mm256_srli_epi16(t, 8);
+}
 
-        store_aligned_avx2(mix_b, mix_g, mix_r, dst_a, &dst[i]);
+static void pixels8_premultiply_avx2(DP_Pixel8 *pixels, int count)
+{
+    __m256i alpha_mask = _mm256_set1_epi32((int)0xff000000);
+    for (int i = 0; i < count; i += 8) {
+        __m256i source = _mm256_loadu_si256((void *)&pixels[i]);
+        __m256i lo = premultiply_channels_avx2(
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(source)));
+        __m256i hi = premultiply_channels_avx2(
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(source, 1)));
+        // Packing works within 128 bit lanes, which leaves pixels 2 and 3 in
+        // the upper lane and 4 and 5 in the lower one, this swaps them back.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi),
+                                                  _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i out = _mm256_blendv_epi8(packed, source, alpha_mask);
+        _mm256_storeu_si256((void *)&pixels[i], out);
     }
     _mm256_zeroupper();
 }
-
 DP_TARGET_END
 #endif
 
+void DP_pixels15_to_8_unpremultiply(DP_UPixel8 *dst, const DP_Pixel15 *src,
+                                    int count)
+{
+    DP_ASSERT(count <= 0 || dst);
+    DP_ASSERT(count <= 0 || src);
+    int i = 0;
+#ifdef DP_CPU_X64
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        i = count - count % 8;
+        pixels15_to_8_unpremultiply_avx2(dst, src, i);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        i = count - count % 4;
+        pixels15_to_8_unpremultiply_sse42(dst, src, i);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = DP_upixel15_to_8(DP_pixel15_unpremultiply(src[i]));
+    }
+}
+
+void DP_pixels8_premultiply(DP_Pixel8 *pixels, int count)
+{
+    DP_ASSERT(count <= 0 || pixels);
+    int i = 0;
+#ifdef DP_CPU_X64
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        i = count - count % 8;
+        pixels8_premultiply_avx2(pixels, i);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        i = count - count % 4;
+        pixels8_premultiply_sse42(pixels, i);
+    }
+#endif
+    for (; i < count; ++i) {
+        pixels[i] = DP_pixel8_premultiply((DP_UPixel8){pixels[i].color});
+    }
+}
+
 static BGRA15 blend_normal(BGR15 cb, BGR15 cs, Fix15 ab, Fix15 as, Fix15 o)
 {
     Fix15 as1 = BIT15_FIX - fix15_mul(as, o);
@@ -4263,6 +6922,53 @@ static void blend_mask_normal(DP_Pixel15 *dst, DP_UPixel15 src,
         dst += remaining;
         mask += remaining;
 
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 8;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_normal_neon(dst, src, mask, opacity, neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_normal(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+            int remaining_after_simd128_width = remaining % 8;
+            int simd128_width = remaining - remaining_after_simd128_width;
+
+            blend_mask_pixels_normal_simd128(dst, src, mask, opacity,
+                                             simd128_width);
+
+            remaining -= simd128_width;
+            dst += simd128_width;
+            mask += simd128_width;
+        }
+
+        blend_mask_pixels_normal(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
         dst += base_skip;
         mask += mask_skip;
     }
@@ -4286,28 +6992,88 @@ static void blend_mask_normal_and_eraser(DP_Pixel15 *dst, DP_UPixel15 src,
     for (int y = 0; y < h; ++y) {
         int remaining = w;
 
-        if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
-            int remaining_after_avx_width = remaining % 8;
-            int avx_width = remaining - remaining_after_avx_width;
-
-            blend_mask_pixels_normal_and_eraser_avx2(dst, src, mask, opacity,
-                                                     avx_width);
-
-            remaining -= avx_width;
-            dst += avx_width;
-            mask += avx_width;
-        }
-
-        if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
-            int remaining_after_sse_width = remaining % 4;
-            int sse_width = remaining - remaining_after_sse_width;
+        if (cpu_support >= DP_CPU_SUPPORT_AVX512BW) {
+            int remaining_after_avx512_width = remaining % 16;
+            int avx512_width = remaining - remaining_after_avx512_width;
+
+            blend_mask_pixels_normal_and_eraser_avx512(dst, src, mask, opacity,
+                                                       avx512_width);
+
+            remaining -= avx512_width;
+            dst += avx512_width;
+            mask += avx512_width;
+        }
+
+        if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+            int remaining_after_avx_width = remaining % 8;
+            int avx_width = remaining - remaining_after_avx_width;
+
+            blend_mask_pixels_normal_and_eraser_avx2(dst, src, mask, opacity,
+                                                     avx_width);
+
+            remaining -= avx_width;
+            dst += avx_width;
+            mask += avx_width;
+        }
+
+        if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+            int remaining_after_sse_width = remaining % 4;
+            int sse_width = remaining - remaining_after_sse_width;
+
+            blend_mask_pixels_normal_and_eraser_sse42(dst, src, mask, opacity,
+                                                      sse_width);
+
+            remaining -= sse_width;
+            dst += sse_width;
+            mask += sse_width;
+        }
+
+        blend_mask_pixels_normal_and_eraser(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 8;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_normal_and_eraser_neon(dst, src, mask, opacity,
+                                                     neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_normal_and_eraser(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+            int remaining_after_simd128_width = remaining % 8;
+            int simd128_width = remaining - remaining_after_simd128_width;
 
-            blend_mask_pixels_normal_and_eraser_sse42(dst, src, mask, opacity,
-                                                      sse_width);
+            blend_mask_pixels_normal_and_eraser_simd128(
+                dst, src, mask, opacity, simd128_width);
 
-            remaining -= sse_width;
-            dst += sse_width;
-            mask += sse_width;
+            remaining -= simd128_width;
+            dst += simd128_width;
+            mask += simd128_width;
         }
 
         blend_mask_pixels_normal_and_eraser(dst, src, mask, opacity, remaining);
@@ -4733,6 +7499,53 @@ static void blend_mask_recolor(DP_Pixel15 *dst, DP_UPixel15 src,
         dst += remaining;
         mask += remaining;
 
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 8;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_recolor_neon(dst, src, mask, opacity, neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_recolor(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+            int remaining_after_simd128_width = remaining % 8;
+            int simd128_width = remaining - remaining_after_simd128_width;
+
+            blend_mask_pixels_recolor_simd128(dst, src, mask, opacity,
+                                              simd128_width);
+
+            remaining -= simd128_width;
+            dst += simd128_width;
+            mask += simd128_width;
+        }
+
+        blend_mask_pixels_recolor(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
         dst += base_skip;
         mask += mask_skip;
     }
@@ -4783,6 +7596,30 @@ static void blend_mask_oklab_normal(DP_Pixel15 *dst, DP_UPixel15 src,
         dst += remaining;
         mask += remaining;
 
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 4;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_oklab_normal_neon(dst, src, mask, opacity,
+                                                neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_oklab_normal(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
         dst += base_skip;
         mask += mask_skip;
     }
@@ -4833,6 +7670,30 @@ static void blend_mask_oklab_recolor(DP_Pixel15 *dst, DP_UPixel15 src,
         dst += remaining;
         mask += remaining;
 
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 4;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_oklab_recolor_neon(dst, src, mask, opacity,
+                                                 neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_oklab_recolor(dst, src, mask, opacity, remaining);
+        dst += remaining;
+        mask += remaining;
+
         dst += base_skip;
         mask += mask_skip;
     }
@@ -4885,6 +7746,31 @@ static void blend_mask_oklab_normal_and_eraser(DP_Pixel15 *dst, DP_UPixel15 src,
         dst += remaining;
         mask += remaining;
 
+        dst += base_skip;
+        mask += mask_skip;
+    }
+#elif defined(DP_CPU_ARM64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    for (int y = 0; y < h; ++y) {
+        int remaining = w;
+
+        if (cpu_support >= DP_CPU_SUPPORT_NEON) {
+            int remaining_after_neon_width = remaining % 4;
+            int neon_width = remaining - remaining_after_neon_width;
+
+            blend_mask_pixels_oklab_normal_and_eraser_neon(dst, src, mask,
+                                                           opacity, neon_width);
+
+            remaining -= neon_width;
+            dst += neon_width;
+            mask += neon_width;
+        }
+
+        blend_mask_pixels_oklab_normal_and_eraser(dst, src, mask, opacity,
+                                                  remaining);
+        dst += remaining;
+        mask += remaining;
+
         dst += base_skip;
         mask += mask_skip;
     }
@@ -6175,6 +9061,74 @@ void DP_blend_selection(DP_Pixel15 *DP_RESTRICT dst,
     }
 }
 
+void DP_blend_selection_uniform(DP_Pixel15 *dst, int pixel_count,
+                                DP_Pixel15 src, DP_UPixel15 color)
+{
+    Fix15 opacity = to_fix(color.a);
+    Fix15 as = to_fix(src.a);
+    if (opacity != 0 && as != 0) {
+        BGR15 cs = to_ubgr(color);
+        Fix15 aso = fix15_mul(as, opacity);
+        Fix15 aso1 = BIT15_FIX - aso;
+        DP_Pixel15 on_blank = DP_pixel15_premultiply((DP_UPixel15){
+            .b = color.b,
+            .g = color.g,
+            .r = color.r,
+            .a = from_fix(aso),
+        });
+        for (int i = 0; i < pixel_count; ++i) {
+            DP_Pixel15 dp = dst[i];
+            Fix15 ab = to_fix(dp.a);
+            if (ab == 0) {
+                dst[i] = on_blank;
+            }
+            else {
+                BGR15 cb = to_bgr(dp);
+                dst[i] = (DP_Pixel15){
+                    .b = from_fix(fix15_sumprods(cs.b, aso, cb.b, aso1)),
+                    .g = from_fix(fix15_sumprods(cs.g, aso, cb.g, aso1)),
+                    .r = from_fix(fix15_sumprods(cs.r, aso, cb.r, aso1)),
+                    .a = from_fix(aso + fix15_mul(ab, aso1)),
+                };
+            }
+        }
+    }
+}
+
+#ifdef DP_CPU_X64
+static bool blend_tile_composite(DP_Pixel15 *DP_RESTRICT dst,
+                                 const DP_Pixel15 *DP_RESTRICT src,
+                                 uint16_t opacity, int blend_mode, bool alpha,
+                                 bool separable)
+{
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        if (alpha) {
+            blend_tile_composite_alpha_avx2(dst, src, opacity, blend_mode,
+                                            separable);
+        }
+        else {
+            blend_tile_composite_avx2(dst, src, opacity, blend_mode, separable);
+        }
+        return true;
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        if (alpha) {
+            blend_tile_composite_alpha_sse42(dst, src, opacity, blend_mode,
+                                             separable);
+        }
+        else {
+            blend_tile_composite_sse42(dst, src, opacity, blend_mode,
+                                       separable);
+        }
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+#endif
+
 void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
                    const DP_Pixel15 *DP_RESTRICT src, uint16_t opacity,
                    int blend_mode)
@@ -6186,7 +9140,11 @@ void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
     // Alpha-affecting blend modes.
     case DP_BLEND_MODE_NORMAL: {
         DP_CpuSupport cpu_support = DP_cpu_support;
-        if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        if (cpu_support >= DP_CPU_SUPPORT_AVX512BW) {
+            blend_tile_normal_avx512(aligned_dst, aligned_src, opacity);
+            return;
+        }
+        else if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
             blend_tile_normal_avx2(aligned_dst, aligned_src, opacity);
             return;
         }
@@ -6204,6 +9162,7 @@ void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
         }
         else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
             blend_tile_recolor_sse42(aligned_dst, aligned_src, opacity);
+            return;
         }
         break;
     }
@@ -6243,14 +9202,200 @@ void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
         }
         break;
     }
+    // Alpha-preserving separable blend modes
+    case DP_BLEND_MODE_MULTIPLY:
+    case DP_BLEND_MODE_SCREEN:
+    case DP_BLEND_MODE_OVERLAY:
+    case DP_BLEND_MODE_HARD_LIGHT:
+    case DP_BLEND_MODE_PIN_LIGHT:
+    case DP_BLEND_MODE_DARKEN:
+    case DP_BLEND_MODE_LIGHTEN:
+    case DP_BLEND_MODE_ADD:
+    case DP_BLEND_MODE_SUBTRACT:
+    case DP_BLEND_MODE_DIFFERENCE:
+    case DP_BLEND_MODE_LINEAR_BURN:
+    case DP_BLEND_MODE_LINEAR_LIGHT:
+        if (blend_tile_composite(aligned_dst, aligned_src, opacity, blend_mode,
+                                 false, true)) {
+            return;
+        }
+        break;
+    // Alpha-preserving non-separable blend modes
+    case DP_BLEND_MODE_LUMINOSITY:
+    case DP_BLEND_MODE_COLOR:
+    case DP_BLEND_MODE_DARKER_COLOR:
+    case DP_BLEND_MODE_LIGHTER_COLOR:
+        if (blend_tile_composite(aligned_dst, aligned_src, opacity, blend_mode,
+                                 false, false)) {
+            return;
+        }
+        break;
+    // Alpha-affecting separable blend modes
+    case DP_BLEND_MODE_MULTIPLY_ALPHA:
+    case DP_BLEND_MODE_SCREEN_ALPHA:
+    case DP_BLEND_MODE_OVERLAY_ALPHA:
+    case DP_BLEND_MODE_HARD_LIGHT_ALPHA:
+    case DP_BLEND_MODE_PIN_LIGHT_ALPHA:
+    case DP_BLEND_MODE_DARKEN_ALPHA:
+    case DP_BLEND_MODE_LIGHTEN_ALPHA:
+    case DP_BLEND_MODE_ADD_ALPHA:
+    case DP_BLEND_MODE_SUBTRACT_ALPHA:
+    case DP_BLEND_MODE_DIFFERENCE_ALPHA:
+    case DP_BLEND_MODE_LINEAR_BURN_ALPHA:
+    case DP_BLEND_MODE_LINEAR_LIGHT_ALPHA:
+        if (blend_tile_composite(aligned_dst, aligned_src, opacity, blend_mode,
+                                 true, true)) {
+            return;
+        }
+        break;
+    // Alpha-affecting non-separable blend modes
+    case DP_BLEND_MODE_LUMINOSITY_ALPHA:
+    case DP_BLEND_MODE_COLOR_ALPHA:
+    case DP_BLEND_MODE_DARKER_COLOR_ALPHA:
+    case DP_BLEND_MODE_LIGHTER_COLOR_ALPHA:
+        if (blend_tile_composite(aligned_dst, aligned_src, opacity, blend_mode,
+                                 true, false)) {
+            return;
+        }
+        break;
     default:
         break;
     }
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        switch (blend_mode) {
+        case DP_BLEND_MODE_NORMAL:
+            blend_tile_normal_neon(aligned_dst, aligned_src, opacity);
+            return;
+        case DP_BLEND_MODE_RECOLOR:
+            blend_tile_recolor_neon(aligned_dst, aligned_src, opacity);
+            return;
+        case DP_BLEND_MODE_BEHIND:
+            blend_tile_behind_neon(aligned_dst, aligned_src, opacity);
+            return;
+        case DP_BLEND_MODE_OKLAB_NORMAL:
+            blend_tile_oklab_neon(aligned_dst, aligned_src, opacity, false);
+            return;
+        case DP_BLEND_MODE_OKLAB_RECOLOR:
+            blend_tile_oklab_neon(aligned_dst, aligned_src, opacity, true);
+            return;
+        default:
+            break;
+        }
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+        switch (blend_mode) {
+        case DP_BLEND_MODE_NORMAL:
+            blend_tile_normal_simd128(aligned_dst, aligned_src, opacity);
+            return;
+        case DP_BLEND_MODE_RECOLOR:
+            blend_tile_recolor_simd128(aligned_dst, aligned_src, opacity);
+            return;
+        case DP_BLEND_MODE_BEHIND:
+            blend_tile_behind_simd128(aligned_dst, aligned_src, opacity);
+            return;
+        default:
+            break;
+        }
+    }
 #endif
     DP_blend_pixels(aligned_dst, aligned_src, DP_TILE_LENGTH, opacity,
                     blend_mode);
 }
 
+static void blend_pixels_uniform_normal(DP_Pixel15 *DP_RESTRICT dst,
+                                        int pixel_count, DP_Pixel15 src,
+                                        uint16_t opacity)
+{
+    // The vectorized kernels that DP_blend_tile uses shift each product
+    // separately instead of shifting their sum, which rounds slightly
+    // differently than blend_normal. We have to match whichever one it picks.
+    int vectorized;
+    Fix15 o = to_fix(opacity);
+    BGRA15 s = to_bgra(src);
+    DP_Pixel15 src_o = {
+        .b = from_fix(fix15_mul(s.b, o)),
+        .g = from_fix(fix15_mul(s.g, o)),
+        .r = from_fix(fix15_mul(s.r, o)),
+        .a = from_fix(fix15_mul(s.a, o)),
+    };
+    uint16_t as1 = (uint16_t)(DP_BIT15 - src_o.a);
+#if defined(DP_CPU_X64)
+    DP_CpuSupport cpu_support = DP_cpu_support;
+    if (cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        vectorized = pixel_count - pixel_count % 4;
+        blend_pixels_uniform_normal_avx2(dst, vectorized, src_o, as1);
+    }
+    else if (cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        vectorized = pixel_count - pixel_count % 2;
+        blend_pixels_uniform_normal_sse42(dst, vectorized, src_o, as1);
+    }
+    else {
+        vectorized = -1;
+    }
+#elif defined(DP_CPU_ARM64)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_NEON) {
+        vectorized = pixel_count - pixel_count % 2;
+        blend_pixels_uniform_normal_neon(dst, vectorized, src_o, as1);
+    }
+    else {
+        vectorized = -1;
+    }
+#elif defined(DP_CPU_WASM_SIMD128)
+    if (DP_cpu_support >= DP_CPU_SUPPORT_SIMD128) {
+        vectorized = pixel_count - pixel_count % 2;
+        blend_pixels_uniform_normal_simd128(dst, vectorized, src_o, as1);
+    }
+    else {
+        vectorized = -1;
+    }
+#else
+    vectorized = -1;
+#endif
+
+    if (vectorized < 0) {
+        for (int i = 0; i < pixel_count; ++i) {
+            BGRA15 b = to_bgra(dst[i]);
+            dst[i] = from_bgra(blend_normal(b.bgr, s.bgr, b.a, s.a, o));
+        }
+    }
+    else {
+        // Leftover pixels that don't fill a whole vector, rounded the same.
+        for (int i = vectorized; i < pixel_count; ++i) {
+            DP_Pixel15 dp = dst[i];
+            dst[i] = (DP_Pixel15){
+                .b = from_fix(fix15_mul(to_fix(dp.b), as1) + src_o.b),
+                .g = from_fix(fix15_mul(to_fix(dp.g), as1) + src_o.g),
+                .r = from_fix(fix15_mul(to_fix(dp.r), as1) + src_o.r),
+                .a = from_fix(fix15_mul(to_fix(dp.a), as1) + src_o.a),
+            };
+        }
+    }
+}
+
+bool DP_blend_pixels_uniform(DP_Pixel15 *DP_RESTRICT dst, int pixel_count,
+                             DP_Pixel15 src, uint16_t opacity, int blend_mode)
+{
+    switch (blend_mode) {
+    case DP_BLEND_MODE_NORMAL:
+        if (opacity == 0 || DP_pixel15_equal(src, DP_pixel15_zero())) {
+            // Nothing to do, the destination stays the same.
+        }
+        else if (opacity == DP_BIT15 && src.a == DP_BIT15) {
+            for (int i = 0; i < pixel_count; ++i) {
+                dst[i] = src;
+            }
+        }
+        else {
+            blend_pixels_uniform_normal(dst, pixel_count, src, opacity);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
 void DP_mask_tile(DP_Pixel15 *DP_RESTRICT dst,
                   const DP_Pixel15 *DP_RESTRICT src,
                   const DP_Pixel15 *DP_RESTRICT mask)
@@ -6307,6 +9452,67 @@ void DP_mask_tile_in_place(DP_Pixel15 *DP_RESTRICT dst,
     }
 }
 
+void DP_mask_tile_uniform(DP_Pixel15 *DP_RESTRICT dst,
+                          const DP_Pixel15 *DP_RESTRICT src, uint16_t mask_a)
+{
+    DP_Pixel15 *aligned_dst = DP_ASSUME_SIMD_ALIGNED(dst);
+    const DP_Pixel15 *aligned_src = DP_ASSUME_SIMD_ALIGNED(src);
+    if (mask_a == 0) {
+        memset(aligned_dst, 0, sizeof(*aligned_dst) * DP_TILE_LENGTH);
+    }
+    else if (mask_a == DP_BIT15) {
+        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+            DP_Pixel15 sp = aligned_src[i];
+            aligned_dst[i] = sp.a == 0 ? (DP_Pixel15){0, 0, 0, 0} : sp;
+        }
+    }
+    else {
+        Fix15 m = to_fix(mask_a);
+        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+            DP_Pixel15 sp = aligned_src[i];
+            if (sp.a == 0) {
+                aligned_dst[i] = (DP_Pixel15){0, 0, 0, 0};
+            }
+            else {
+                BGRA15 bgra = to_bgra(sp);
+                aligned_dst[i] = (DP_Pixel15){
+                    .b = from_fix(fix15_mul(bgra.b, m)),
+                    .g = from_fix(fix15_mul(bgra.g, m)),
+                    .r = from_fix(fix15_mul(bgra.r, m)),
+                    .a = from_fix(fix15_mul(bgra.a, m)),
+                };
+            }
+        }
+    }
+}
+
+void DP_mask_tile_in_place_uniform(DP_Pixel15 *dst, uint16_t mask_a)
+{
+    DP_Pixel15 *aligned_dst = DP_ASSUME_SIMD_ALIGNED(dst);
+    if (mask_a == 0) {
+        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+            if (aligned_dst[i].a != 0) {
+                aligned_dst[i] = (DP_Pixel15){0, 0, 0, 0};
+            }
+        }
+    }
+    else if (mask_a != DP_BIT15) {
+        Fix15 m = to_fix(mask_a);
+        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+            DP_Pixel15 sp = aligned_dst[i];
+            if (sp.a != 0) {
+                BGRA15 bgra = to_bgra(sp);
+                aligned_dst[i] = (DP_Pixel15){
+                    .b = from_fix(fix15_mul(bgra.b, m)),
+                    .g = from_fix(fix15_mul(bgra.g, m)),
+                    .r = from_fix(fix15_mul(bgra.r, m)),
+                    .a = from_fix(fix15_mul(bgra.a, m)),
+                };
+            }
+        }
+    }
+}
+
 
 // Posterization adapted from libmypaint, see license above.
 
@@ -135,6 +135,9 @@ void DP_pixels15_to_8(DP_Pixel8 *dst, const DP_Pixel15 *src, int count);
 void DP_pixels15_to_8_unpremultiply(DP_UPixel8 *dst, const DP_Pixel15 *src,
                                     int count);
 
+// Premultiplies the pixels in place, they are unpremultiplied going in.
+void DP_pixels8_premultiply(DP_Pixel8 *pixels, int count);
+
 // Uses SIMD to convert pixels, but requires high alignments, max_align_t is not
 // enough! The pixels of tiles are automatically properly aligned, but e.g. the
 // pixels of images or compression buffers are not, so you can't use this there.
@@ -236,12 +239,23 @@ void DP_blend_selection(DP_Pixel15 *DP_RESTRICT dst,
                         const DP_Pixel15 *DP_RESTRICT src, int pixel_count,
                         DP_UPixel15 color);
 
+// Same result as DP_blend_selection with src filled with the given pixel, which
+// is what fully selected tiles and the insides of soft regions look like.
+void DP_blend_selection_uniform(DP_Pixel15 *dst, int pixel_count,
+                                DP_Pixel15 src, DP_UPixel15 color);
+
 // Needs big SIMD alignment of dst and src, max_align_t is not enough! Only the
 // pixels of tiles are properly aligned, really.
 void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
                    const DP_Pixel15 *DP_RESTRICT src, uint16_t opacity,
                    int blend_mode);
 
+// Blends the same source pixel onto every destination pixel, with the same
+// result DP_blend_tile would give when src is filled with that pixel. Returns
+// false without touching dst if the blend mode doesn't have a fast path for it.
+bool DP_blend_pixels_uniform(DP_Pixel15 *DP_RESTRICT dst, int pixel_count,
+                             DP_Pixel15 src, uint16_t opacity, int blend_mode);
+
 void DP_mask_tile(DP_Pixel15 *DP_RESTRICT dst,
                   const DP_Pixel15 *DP_RESTRICT src,
                   const DP_Pixel15 *DP_RESTRICT mask);
@@ -249,6 +263,12 @@ void DP_mask_tile(DP_Pixel15 *DP_RESTRICT dst,
 void DP_mask_tile_in_place(DP_Pixel15 *DP_RESTRICT dst,
                            const DP_Pixel15 *DP_RESTRICT mask);
 
+// Same results as the above with every mask pixel having the given alpha.
+void DP_mask_tile_uniform(DP_Pixel15 *DP_RESTRICT dst,
+                          const DP_Pixel15 *DP_RESTRICT src, uint16_t mask_a);
+
+void DP_mask_tile_in_place_uniform(DP_Pixel15 *dst, uint16_t mask_a);
+
 
 void DP_posterize_mask(DP_Pixel15 *dst, int posterize_num, const uint16_t *mask,
                        uint16_t opacity, int w, int h, int mask_skip,
@@ -21,19 +21,25 @@
  */
 #include "player.h"
 #include "canvas_history.h"
+#include "canvas_state.h"
 #include "dump_reader.h"
+#include "history_blocks.h"
 #include "image.h"
 #include "local_state.h"
+#include "seekable_zstd.h"
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
 #include <dpmsg/acl.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
 #include <dpmsg/protover.h>
 #include <dpmsg/text_reader.h>
 #include <ctype.h>
@@ -41,6 +47,34 @@
 
 #define INDEX_EXTENSION "dpidx"
 
+// Replays aren't interactive, so there's no frame time to stay under and the
+// batches of draw dabs only need to be bounded to limit the buffer's size.
+#define REPLAY_MAX_MULTIDAB_MESSAGES 8192
+
+typedef struct DP_PlayerReadAheadEntry {
+    DP_PlayerResult result;
+    DP_Message *msg;
+    size_t offset;
+    double progress;
+    char *error;
+} DP_PlayerReadAheadEntry;
+
+// Reads and decodes messages on a separate thread, up to a bounded number of
+// them ahead of where playback is at. While it's running, it owns the reader,
+// the offset and progress here are the ones after the last message taken.
+typedef struct DP_PlayerReadAhead {
+    DP_Player *player;
+    bool decode_opaque;
+    bool stop;
+    DP_Mutex *mutex;
+    DP_Semaphore *sem_free;
+    DP_Semaphore *sem_filled;
+    DP_Queue queue;
+    size_t offset;
+    double progress;
+    DP_Thread *thread;
+} DP_PlayerReadAhead;
+
 typedef union DP_PlayerReader {
     DP_BinaryReader *binary;
     DP_TextReader *text;
@@ -63,6 +97,8 @@ struct DP_Player {
     unsigned char pass;
     bool input_error;
     bool end;
+    int read_ahead_capacity;
+    DP_PlayerReadAhead *read_ahead;
     DP_PlayerIndex index;
 };
 
@@ -72,7 +108,7 @@ static void player_index_dispose(DP_PlayerIndex *pi)
     DP_ASSERT(pi);
     DP_free(pi->entries);
     DP_buffered_input_dispose(&pi->input);
-    *pi = (DP_PlayerIndex){DP_BUFFERED_INPUT_NULL, 0, NULL, 0};
+    *pi = (DP_PlayerIndex){DP_BUFFERED_INPUT_NULL, 0, NULL, 0, false};
 }
 
 
@@ -170,7 +206,9 @@ static DP_Player *make_player(DP_PlayerType type, char *recording_path,
                     DP_PLAYER_PASS_CLIENT_PLAYBACK,
                     false,
                     false,
-                    {DP_BUFFERED_INPUT_NULL, 0, NULL, 0}};
+                    0,
+                    NULL,
+                    {DP_BUFFERED_INPUT_NULL, 0, NULL, 0, false}};
     return player;
 }
 
@@ -257,13 +295,28 @@ static DP_Player *new_debug_dump_player(DP_Input *input)
                           DP_PLAYER_PASS_CLIENT_PLAYBACK,
                           false,
                           false,
-                          {DP_BUFFERED_INPUT_NULL, 0, NULL, 0}};
+                          0,
+                          NULL,
+                          {DP_BUFFERED_INPUT_NULL, 0, NULL, 0, false}};
     return player;
 }
 
 DP_Player *DP_player_new(DP_PlayerType type, const char *path_or_null,
                          DP_Input *input, DP_LoadResult *out_result)
 {
+    // Recordings may be compressed, debug dumps never are. Server recordings
+    // may also have their older blocks moved into a block file next to them.
+    if (type != DP_PLAYER_TYPE_DEBUG_DUMP) {
+        if (path_or_null) {
+            input = DP_history_blocks_input_new_detect(input, path_or_null);
+        }
+        input = input ? DP_seekable_zstd_input_new_detect(input) : NULL;
+        if (!input) {
+            assign_load_result(out_result, DP_LOAD_RESULT_READ_ERROR);
+            return NULL;
+        }
+    }
+
     if (type == DP_PLAYER_TYPE_GUESS) {
         DP_LoadResult guess_result = guess_type(input, &type);
         if (guess_result != DP_LOAD_RESULT_SUCCESS) {
@@ -314,9 +367,257 @@ DP_Player *DP_player_new(DP_PlayerType type, const char *path_or_null,
     return player;
 }
 
+static size_t reader_tell(DP_Player *player)
+{
+    switch (player->type) {
+    case DP_PLAYER_TYPE_BINARY:
+        return DP_binary_reader_tell(player->reader.binary);
+    case DP_PLAYER_TYPE_TEXT:
+        return DP_text_reader_tell(player->reader.text);
+    case DP_PLAYER_TYPE_DEBUG_DUMP:
+        return DP_dump_reader_tell(player->reader.dump);
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static double reader_progress(DP_Player *player)
+{
+    switch (player->type) {
+    case DP_PLAYER_TYPE_BINARY:
+        return DP_binary_reader_progress(player->reader.binary);
+    case DP_PLAYER_TYPE_TEXT:
+        return DP_text_reader_progress(player->reader.text);
+    case DP_PLAYER_TYPE_DEBUG_DUMP:
+        return 0.0;
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static bool reader_seek(DP_Player *player, size_t offset)
+{
+    switch (player->type) {
+    case DP_PLAYER_TYPE_BINARY:
+        return DP_binary_reader_seek(player->reader.binary, offset);
+    case DP_PLAYER_TYPE_TEXT:
+        return DP_text_reader_seek(player->reader.text, offset);
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+static DP_PlayerResult read_binary(DP_Player *player, bool decode_opaque,
+                                   DP_Message **out_msg)
+{
+    DP_BinaryReaderResult (*read_fn)(DP_BinaryReader *reader,
+                                     bool decode_opaque, DP_Message **out_msg);
+#ifdef DP_PROTOCOL_COMPAT_VERSION
+    read_fn = player->compatibility_mode ? DP_binary_reader_read_message_compat
+                                         : DP_binary_reader_read_message;
+#else
+    read_fn = DP_binary_reader_read_message;
+#endif
+    switch (read_fn(player->reader.binary, decode_opaque, out_msg)) {
+    case DP_BINARY_READER_SUCCESS:
+        return DP_PLAYER_SUCCESS;
+    case DP_BINARY_READER_INPUT_END:
+        return DP_PLAYER_RECORDING_END;
+    case DP_BINARY_READER_ERROR_PARSE:
+        return DP_PLAYER_ERROR_PARSE;
+    default:
+        return DP_PLAYER_ERROR_INPUT;
+    }
+}
+
+static DP_PlayerResult read_text(DP_Player *player, DP_Message **out_msg)
+{
+    DP_TextReaderResult result =
+        DP_text_reader_read_message(player->reader.text, out_msg);
+    switch (result) {
+    case DP_TEXT_READER_SUCCESS:
+        return DP_PLAYER_SUCCESS;
+    case DP_TEXT_READER_INPUT_END:
+        return DP_PLAYER_RECORDING_END;
+    case DP_TEXT_READER_ERROR_PARSE:
+        return DP_PLAYER_ERROR_PARSE;
+    default:
+        return DP_PLAYER_ERROR_INPUT;
+    }
+}
+
+// Doesn't touch any player state other than the reader, since this gets
+// called from the read-ahead thread.
+static DP_PlayerResult read_message(DP_Player *player, bool decode_opaque,
+                                    DP_Message **out_msg)
+{
+    switch (player->type) {
+    case DP_PLAYER_TYPE_BINARY:
+        return read_binary(player, decode_opaque, out_msg);
+    case DP_PLAYER_TYPE_TEXT:
+        return read_text(player, out_msg);
+    case DP_PLAYER_TYPE_DEBUG_DUMP:
+        DP_error_set("Can't step debug dump like a recording");
+        return DP_PLAYER_ERROR_OPERATION;
+    default:
+        DP_UNREACHABLE();
+    }
+}
+
+
+static void run_read_ahead(void *data)
+{
+    DP_thread_role_set(DP_THREAD_ROLE_UTILITY);
+    DP_PlayerReadAhead *ra = data;
+    DP_Player *player = ra->player;
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(ra->sem_free);
+        DP_MUTEX_MUST_LOCK(ra->mutex);
+        bool stop = ra->stop;
+        DP_MUTEX_MUST_UNLOCK(ra->mutex);
+        if (stop) {
+            break;
+        }
+
+        DP_Message *msg;
+        DP_PlayerResult result = read_message(player, ra->decode_opaque, &msg);
+        bool error = result == DP_PLAYER_ERROR_PARSE
+                  || result == DP_PLAYER_ERROR_INPUT;
+        DP_PlayerReadAheadEntry entry = {
+            result, result == DP_PLAYER_SUCCESS ? msg : NULL,
+            reader_tell(player), reader_progress(player),
+            error ? DP_strdup(DP_error()) : NULL};
+
+        DP_MUTEX_MUST_LOCK(ra->mutex);
+        *(DP_PlayerReadAheadEntry *)DP_queue_push(&ra->queue,
+                                                  sizeof(entry)) = entry;
+        DP_MUTEX_MUST_UNLOCK(ra->mutex);
+        DP_SEMAPHORE_MUST_POST(ra->sem_filled);
+
+        // Parse errors only affect the one message, anything else is final.
+        if (result != DP_PLAYER_SUCCESS && result != DP_PLAYER_ERROR_PARSE) {
+            break;
+        }
+    }
+}
+
+static void dispose_read_ahead_entry(void *element)
+{
+    DP_PlayerReadAheadEntry *entry = element;
+    DP_message_decref_nullable(entry->msg);
+    DP_free(entry->error);
+}
+
+static void free_read_ahead(DP_PlayerReadAhead *ra)
+{
+    if (ra->thread) {
+        DP_MUTEX_MUST_LOCK(ra->mutex);
+        ra->stop = true;
+        DP_MUTEX_MUST_UNLOCK(ra->mutex);
+        DP_SEMAPHORE_MUST_POST(ra->sem_free);
+        DP_thread_free_join(ra->thread);
+    }
+    DP_queue_clear(&ra->queue, sizeof(DP_PlayerReadAheadEntry),
+                   dispose_read_ahead_entry);
+    DP_queue_dispose(&ra->queue);
+    DP_semaphore_free(ra->sem_filled);
+    DP_semaphore_free(ra->sem_free);
+    DP_mutex_free(ra->mutex);
+    DP_free(ra);
+}
+
+static DP_PlayerReadAhead *start_read_ahead(DP_Player *player,
+                                            bool decode_opaque)
+{
+    int capacity = player->read_ahead_capacity;
+    DP_PlayerReadAhead *ra = DP_malloc(sizeof(*ra));
+    *ra = (DP_PlayerReadAhead){player,
+                               decode_opaque,
+                               false,
+                               DP_mutex_new(),
+                               DP_semaphore_new(DP_int_to_uint(capacity)),
+                               DP_semaphore_new(0),
+                               DP_QUEUE_NULL,
+                               reader_tell(player),
+                               reader_progress(player),
+                               NULL};
+    DP_queue_init(&ra->queue, DP_int_to_size(capacity),
+                  sizeof(DP_PlayerReadAheadEntry));
+    if (ra->mutex && ra->sem_free && ra->sem_filled) {
+        ra->thread = DP_thread_new(run_read_ahead, ra);
+    }
+
+    if (ra->thread) {
+        return ra;
+    }
+    else {
+        DP_warn("Error starting player read-ahead: %s", DP_error());
+        free_read_ahead(ra);
+        return NULL;
+    }
+}
+
+// The reader may be past the messages that were taken so far, so seek back to
+// where playback actually is unless the caller is going to seek anyway.
+static bool stop_read_ahead(DP_Player *player, bool seek_back)
+{
+    DP_PlayerReadAhead *ra = player->read_ahead;
+    if (ra) {
+        size_t offset = ra->offset;
+        free_read_ahead(ra);
+        player->read_ahead = NULL;
+        if (seek_back && !reader_seek(player, offset)) {
+            player->input_error = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static DP_PlayerResult read_message_ahead(DP_Player *player,
+                                          bool decode_opaque,
+                                          DP_Message **out_msg)
+{
+    DP_PlayerReadAhead *ra = player->read_ahead;
+    if (ra && ra->decode_opaque != decode_opaque) {
+        // Messages read so far were decoded the other way, read them again.
+        if (!stop_read_ahead(player, true)) {
+            return DP_PLAYER_ERROR_INPUT;
+        }
+        ra = NULL;
+    }
+
+    if (!ra) {
+        ra = start_read_ahead(player, decode_opaque);
+        if (!ra) {
+            player->read_ahead_capacity = 0;
+            return read_message(player, decode_opaque, out_msg);
+        }
+        player->read_ahead = ra;
+    }
+
+    DP_SEMAPHORE_MUST_WAIT(ra->sem_filled);
+    DP_MUTEX_MUST_LOCK(ra->mutex);
+    DP_PlayerReadAheadEntry entry =
+        *(DP_PlayerReadAheadEntry *)DP_queue_peek(&ra->queue, sizeof(entry));
+    DP_queue_shift(&ra->queue);
+    DP_MUTEX_MUST_UNLOCK(ra->mutex);
+    DP_SEMAPHORE_MUST_POST(ra->sem_free);
+
+    ra->offset = entry.offset;
+    ra->progress = entry.progress;
+    if (entry.error) {
+        DP_error_set("%s", entry.error);
+        DP_free(entry.error);
+    }
+    *out_msg = entry.msg;
+    return entry.result;
+}
+
 void DP_player_free(DP_Player *player)
 {
     if (player) {
+        stop_read_ahead(player, false);
         player_index_dispose(&player->index);
         DP_acl_state_free(player->acls);
         switch (player->type) {
@@ -425,6 +726,16 @@ void DP_player_pass_set(DP_Player *player, DP_PlayerPass pass)
     player->pass = (unsigned char)pass;
 }
 
+void DP_player_read_ahead_set(DP_Player *player, int max_messages)
+{
+    DP_ASSERT(player);
+    DP_ASSERT(max_messages >= 0);
+    if (max_messages != player->read_ahead_capacity) {
+        stop_read_ahead(player, true);
+        player->read_ahead_capacity = max_messages;
+    }
+}
+
 const char *DP_player_recording_path(DP_Player *player)
 {
     DP_ASSERT(player);
@@ -459,31 +770,15 @@ void DP_player_index_set(DP_Player *player, DP_PlayerIndex index)
 size_t DP_player_tell(DP_Player *player)
 {
     DP_ASSERT(player);
-    switch (player->type) {
-    case DP_PLAYER_TYPE_BINARY:
-        return DP_binary_reader_tell(player->reader.binary);
-    case DP_PLAYER_TYPE_TEXT:
-        return DP_text_reader_tell(player->reader.text);
-    case DP_PLAYER_TYPE_DEBUG_DUMP:
-        return DP_dump_reader_tell(player->reader.dump);
-    default:
-        DP_UNREACHABLE();
-    }
+    DP_PlayerReadAhead *ra = player->read_ahead;
+    return ra ? ra->offset : reader_tell(player);
 }
 
 double DP_player_progress(DP_Player *player)
 {
     DP_ASSERT(player);
-    switch (player->type) {
-    case DP_PLAYER_TYPE_BINARY:
-        return DP_binary_reader_progress(player->reader.binary);
-    case DP_PLAYER_TYPE_TEXT:
-        return DP_text_reader_progress(player->reader.text);
-    case DP_PLAYER_TYPE_DEBUG_DUMP:
-        return 0.0;
-    default:
-        DP_UNREACHABLE();
-    }
+    DP_PlayerReadAhead *ra = player->read_ahead;
+    return ra ? ra->progress : reader_progress(player);
 }
 
 long long DP_player_position(DP_Player *player)
@@ -493,68 +788,27 @@ long long DP_player_position(DP_Player *player)
 }
 
 
-static DP_PlayerResult step_binary(DP_Player *player, bool decode_opaque,
-                                   DP_Message **out_msg)
-{
-    DP_BinaryReaderResult (*read_fn)(DP_BinaryReader *reader,
-                                     bool decode_opaque, DP_Message **out_msg);
-#ifdef DP_PROTOCOL_COMPAT_VERSION
-    read_fn = player->compatibility_mode ? DP_binary_reader_read_message_compat
-                                         : DP_binary_reader_read_message;
-#else
-    read_fn = DP_binary_reader_read_message;
-#endif
-    switch (read_fn(player->reader.binary, decode_opaque, out_msg)) {
-    case DP_BINARY_READER_SUCCESS:
-        return DP_PLAYER_SUCCESS;
-    case DP_BINARY_READER_INPUT_END:
-        player->end = true;
-        return DP_PLAYER_RECORDING_END;
-    case DP_BINARY_READER_ERROR_PARSE:
-        return DP_PLAYER_ERROR_PARSE;
-    default:
-        player->input_error = true;
-        return DP_PLAYER_ERROR_INPUT;
-    }
-}
-
-static DP_PlayerResult step_text(DP_Player *player, DP_Message **out_msg)
-{
-    DP_TextReaderResult result =
-        DP_text_reader_read_message(player->reader.text, out_msg);
-    switch (result) {
-    case DP_TEXT_READER_SUCCESS:
-        return DP_PLAYER_SUCCESS;
-    case DP_TEXT_READER_INPUT_END:
-        player->end = true;
-        return DP_PLAYER_RECORDING_END;
-    case DP_TEXT_READER_ERROR_PARSE:
-        return DP_PLAYER_ERROR_PARSE;
-    default:
-        player->input_error = true;
-        return DP_PLAYER_ERROR_INPUT;
-    }
-}
-
 static DP_PlayerResult step_message(DP_Player *player, bool decode_opaque,
                                     DP_Message **out_msg)
 {
-    DP_PlayerResult result;
-    switch (player->type) {
-    case DP_PLAYER_TYPE_BINARY:
-        result = step_binary(player, decode_opaque, out_msg);
+    bool read_ahead = player->read_ahead_capacity > 0
+                   && player->type != DP_PLAYER_TYPE_DEBUG_DUMP;
+    DP_PlayerResult result =
+        read_ahead ? read_message_ahead(player, decode_opaque, out_msg)
+                   : read_message(player, decode_opaque, out_msg);
+    switch (result) {
+    case DP_PLAYER_SUCCESS:
+    case DP_PLAYER_ERROR_PARSE:
+        ++player->position;
         break;
-    case DP_PLAYER_TYPE_TEXT:
-        result = step_text(player, out_msg);
+    case DP_PLAYER_RECORDING_END:
+        player->end = true;
+        break;
+    case DP_PLAYER_ERROR_INPUT:
+        player->input_error = true;
         break;
-    case DP_PLAYER_TYPE_DEBUG_DUMP:
-        DP_error_set("Can't step debug dump like a recording");
-        return DP_PLAYER_ERROR_OPERATION;
     default:
-        DP_UNREACHABLE();
-    }
-    if (result == DP_PLAYER_SUCCESS || result == DP_PLAYER_ERROR_PARSE) {
-        ++player->position;
+        break;
     }
     return result;
 }
@@ -701,6 +955,7 @@ bool DP_player_seek(DP_Player *player, long long position, size_t offset)
 {
     DP_ASSERT(player);
     // No need to check for input errors, since seeking clears those.
+    stop_read_ahead(player, false);
 
     bool seek_ok;
     DP_debug("Seeking playback to %zu", offset);
@@ -776,3 +1031,133 @@ bool DP_player_seek_dump(DP_Player *player, long long position)
         return false;
     }
 }
+
+
+typedef struct DP_PlayerReplayContext {
+    DP_CanvasHistory *ch;
+    DP_DrawContext *dc;
+    int multidab_count;
+    DP_Message *multidab_msgs[REPLAY_MAX_MULTIDAB_MESSAGES];
+} DP_PlayerReplayContext;
+
+static bool is_draw_dabs_message(DP_MessageType type)
+{
+    switch (type) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+    case DP_MSG_DRAW_DABS_PIXEL:
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+    case DP_MSG_DRAW_DABS_MYPAINT:
+    case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void flush_replay_multidab(DP_PlayerReplayContext *c)
+{
+    int count = c->multidab_count;
+    if (count != 0) {
+        c->multidab_count = 0;
+        DP_canvas_history_handle_multidab_dec(c->ch, c->dc, count,
+                                              c->multidab_msgs);
+    }
+}
+
+static void handle_replay_message_dec(DP_PlayerReplayContext *c,
+                                      DP_Message *msg, DP_MessageType type)
+{
+    if (is_draw_dabs_message(type)) {
+        c->multidab_msgs[c->multidab_count++] = msg;
+        if (c->multidab_count == REPLAY_MAX_MULTIDAB_MESSAGES) {
+            flush_replay_multidab(c);
+        }
+    }
+    else {
+        flush_replay_multidab(c);
+        if (DP_message_type_command(type)
+            && !DP_canvas_history_handle(c->ch, c->dc, msg)) {
+            DP_warn("Error handling message in replay: %s", DP_error());
+        }
+        DP_message_decref(msg);
+    }
+}
+
+static bool output_replay(DP_PlayerReplayContext *c,
+                          DP_PlayerReplayOutputFn output_fn, void *user,
+                          bool last)
+{
+    flush_replay_multidab(c);
+    DP_CanvasState *cs = DP_canvas_history_get(c->ch);
+    bool ok = output_fn(user, cs, last);
+    DP_canvas_state_decref(cs);
+    return ok;
+}
+
+static DP_PlayerResult replay(DP_PlayerReplayContext *c, DP_Player *player,
+                              DP_PlayerReplayStep step, long long steps,
+                              DP_PlayerReplayOutputFn output_fn, void *user)
+{
+    long long done = 0;
+    while (true) {
+        DP_Message *msg;
+        DP_PlayerResult result = DP_player_step(player, true, &msg);
+        if (result == DP_PLAYER_SUCCESS) {
+            // Counted the same way as when stepping through playback.
+            DP_MessageType type = DP_message_type(msg);
+            if (step == DP_PLAYER_REPLAY_STEP_MESSAGES
+                || (step == DP_PLAYER_REPLAY_STEP_UNDO_POINTS
+                    && type == DP_MSG_UNDO_POINT)) {
+                ++done;
+            }
+            handle_replay_message_dec(c, msg, type);
+        }
+        else if (result == DP_PLAYER_ERROR_PARSE) {
+            if (step == DP_PLAYER_REPLAY_STEP_MESSAGES) {
+                ++done;
+            }
+            DP_warn("Can't replay message: %s", DP_error());
+        }
+        else if (result == DP_PLAYER_RECORDING_END) {
+            return output_replay(c, output_fn, user, true)
+                     ? DP_PLAYER_RECORDING_END
+                     : DP_PLAYER_ERROR_OPERATION;
+        }
+        else {
+            return result;
+        }
+
+        if (step != DP_PLAYER_REPLAY_STEP_NONE && done >= steps) {
+            done = 0;
+            if (!output_replay(c, output_fn, user, false)) {
+                return DP_PLAYER_ERROR_OPERATION;
+            }
+        }
+    }
+}
+
+DP_PlayerResult DP_player_replay(DP_Player *player, DP_DrawContext *dc,
+                                 DP_PlayerReplayStep step, long long steps,
+                                 DP_PlayerReplayOutputFn output_fn, void *user)
+{
+    DP_ASSERT(player);
+    DP_ASSERT(dc);
+    DP_ASSERT(step == DP_PLAYER_REPLAY_STEP_NONE || steps > 0);
+    DP_ASSERT(output_fn);
+    if (player->type == DP_PLAYER_TYPE_DEBUG_DUMP) {
+        DP_error_set("Can't replay a debug dump");
+        return DP_PLAYER_ERROR_OPERATION;
+    }
+
+    DP_PlayerReplayContext *c = DP_malloc(sizeof(*c));
+    c->ch = DP_canvas_history_new(NULL, NULL, false, NULL);
+    c->dc = dc;
+    c->multidab_count = 0;
+    DP_PlayerResult result = replay(c, player, step, steps, output_fn, user);
+    for (int i = 0; i < c->multidab_count; ++i) {
+        DP_message_decref(c->multidab_msgs[i]);
+    }
+    DP_canvas_history_free(c->ch);
+    DP_free(c);
+    return result;
+}
@@ -33,6 +33,10 @@ typedef struct DP_Message DP_Message;
 typedef struct json_object_t JSON_Object;
 
 
+// Enough to keep a reasonable amount of parsing off of the playback thread,
+// without holding on to too much memory when messages are large.
+#define DP_PLAYER_READ_AHEAD_DEFAULT 256
+
 typedef struct DP_Player DP_Player;
 
 typedef enum DP_PlayerType {
@@ -67,6 +71,20 @@ typedef enum DP_PlayerPass {
     DP_PLAYER_PASS_ALL,
 } DP_PlayerPass;
 
+typedef enum DP_PlayerReplayStep {
+    // Only output the final state at the end of the recording.
+    DP_PLAYER_REPLAY_STEP_NONE,
+    // Output every given number of messages.
+    DP_PLAYER_REPLAY_STEP_MESSAGES,
+    // Output every given number of undo points.
+    DP_PLAYER_REPLAY_STEP_UNDO_POINTS,
+} DP_PlayerReplayStep;
+
+// Receives the canvas state at an output point, without a reference. Should
+// return false to stop the replay, which then fails.
+typedef bool (*DP_PlayerReplayOutputFn)(void *user, DP_CanvasState *cs,
+                                        bool last);
+
 typedef struct DP_PlayerIndexEntry {
     long long message_index;
     size_t message_offset;
@@ -79,6 +97,9 @@ typedef struct DP_PlayerIndex {
     unsigned int message_count;
     DP_PlayerIndexEntry *entries;
     size_t entry_count;
+    // Keyframes embedded in the recording itself rather than a separate index
+    // file, the input then reads from the recording.
+    bool embedded;
 } DP_PlayerIndex;
 
 
@@ -101,6 +122,11 @@ void DP_player_acl_override_set(DP_Player *player, bool override);
 
 void DP_player_pass_set(DP_Player *player, DP_PlayerPass pass);
 
+// Reads and decodes up to the given number of messages ahead on a separate
+// thread, so that stepping doesn't have to wait on parsing. Zero turns it off,
+// which is the default. Debug dumps are never read ahead.
+void DP_player_read_ahead_set(DP_Player *player, int max_messages);
+
 const char *DP_player_recording_path(DP_Player *player);
 
 const char *DP_player_index_path(DP_Player *player);
@@ -133,4 +159,15 @@ bool DP_player_rewind(DP_Player *player);
 bool DP_player_seek_dump(DP_Player *player, long long position);
 
 
+// Replays the rest of the recording headlessly, for when only the resulting
+// images are wanted. No paint engine gets involved, so there's no rendering,
+// previews or playback timing, and runs of draw dabs are handled in large
+// batches. The output function is called at every step, plus once more at the
+// end with last set to true. Returns DP_PLAYER_RECORDING_END on success.
+DP_PlayerResult DP_player_replay(DP_Player *player, DP_DrawContext *dc,
+                                 DP_PlayerReplayStep step, long long steps,
+                                 DP_PlayerReplayOutputFn output_fn,
+                                 void *user);
+
+
 #endif
@@ -380,18 +380,157 @@ DP_Preview *DP_preview_new_cut(int initial_offset_x, int initial_offset_y,
 }
 
 
+// Reduced transform previews keep the destination area under this many pixels
+// by halving the resolution up to the maximum level, i.e. an eighth.
+#define TRANSFORM_REDUCED_MAX_AREA  (1024 * 1024)
+#define TRANSFORM_REDUCED_MAX_LEVEL 3
+
+struct DP_PreviewTransformSource {
+    DP_Atomic refcount;
+    DP_Mutex *mutex;
+    int width, height;
+    struct {
+        DP_PreviewTransformGetPixelsFn get;
+        DP_PreviewTransformDisposePixelsFn dispose;
+        void *user;
+    } fn;
+    const DP_Pixel8 *pixels;
+    // Power-of-two downsampled copies, index 0 is half the size and so on.
+    DP_Pixel8 *levels[TRANSFORM_REDUCED_MAX_LEVEL];
+};
+
+DP_PreviewTransformSource *DP_preview_transform_source_new(
+    int width, int height, DP_PreviewTransformGetPixelsFn get_pixels,
+    DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user)
+{
+    DP_ASSERT(width > 0);
+    DP_ASSERT(height > 0);
+    DP_ASSERT(get_pixels);
+    DP_ASSERT(dispose_pixels);
+    DP_PreviewTransformSource *pvts = DP_malloc(sizeof(*pvts));
+    DP_atomic_set(&pvts->refcount, 1);
+    pvts->mutex = DP_mutex_new();
+    pvts->width = width;
+    pvts->height = height;
+    pvts->fn.get = get_pixels;
+    pvts->fn.dispose = dispose_pixels;
+    pvts->fn.user = user;
+    pvts->pixels = NULL;
+    for (int i = 0; i < TRANSFORM_REDUCED_MAX_LEVEL; ++i) {
+        pvts->levels[i] = NULL;
+    }
+    return pvts;
+}
+
+DP_PreviewTransformSource *
+DP_preview_transform_source_incref(DP_PreviewTransformSource *pvts)
+{
+    DP_ASSERT(pvts);
+    DP_ASSERT(DP_atomic_get(&pvts->refcount) > 0);
+    DP_atomic_inc(&pvts->refcount);
+    return pvts;
+}
+
+void DP_preview_transform_source_decref(DP_PreviewTransformSource *pvts)
+{
+    DP_ASSERT(pvts);
+    DP_ASSERT(DP_atomic_get(&pvts->refcount) > 0);
+    if (DP_atomic_dec(&pvts->refcount)) {
+        for (int i = 0; i < TRANSFORM_REDUCED_MAX_LEVEL; ++i) {
+            DP_free(pvts->levels[i]);
+        }
+        pvts->fn.dispose(pvts->fn.user);
+        DP_mutex_free(pvts->mutex);
+        DP_free(pvts);
+    }
+}
+
+void DP_preview_transform_source_decref_nullable(
+    DP_PreviewTransformSource *pvts_or_null)
+{
+    if (pvts_or_null) {
+        DP_preview_transform_source_decref(pvts_or_null);
+    }
+}
+
+int DP_preview_transform_source_width(DP_PreviewTransformSource *pvts)
+{
+    DP_ASSERT(pvts);
+    return pvts->width;
+}
+
+int DP_preview_transform_source_height(DP_PreviewTransformSource *pvts)
+{
+    DP_ASSERT(pvts);
+    return pvts->height;
+}
+
+static DP_Pixel8 *transform_source_downsample(const DP_Pixel8 *src,
+                                              int src_width, int dst_width,
+                                              int dst_height)
+{
+    DP_Pixel8 *dst = DP_malloc(sizeof(*dst) * (size_t)dst_width
+                               * (size_t)dst_height);
+    for (int y = 0; y < dst_height; ++y) {
+        const DP_Pixel8 *row1 = src + (size_t)y * (size_t)2 * (size_t)src_width;
+        const DP_Pixel8 *row2 = row1 + src_width;
+        DP_Pixel8 *out = dst + (size_t)y * (size_t)dst_width;
+        for (int x = 0; x < dst_width; ++x) {
+            DP_Pixel8 a = row1[x * 2], b = row1[x * 2 + 1];
+            DP_Pixel8 c = row2[x * 2], d = row2[x * 2 + 1];
+            // Averaging premultiplied pixels keeps them premultiplied.
+            out[x] = (DP_Pixel8){
+                .b = DP_int_to_uint8((a.b + b.b + c.b + d.b + 2) / 4),
+                .g = DP_int_to_uint8((a.g + b.g + c.g + d.g + 2) / 4),
+                .r = DP_int_to_uint8((a.r + b.r + c.r + d.r + 2) / 4),
+                .a = DP_int_to_uint8((a.a + b.a + c.a + d.a + 2) / 4),
+            };
+        }
+    }
+    return dst;
+}
+
+// Returns the source pixels at the given level, where each level halves the
+// size, rounding down. Lower levels are fetched or generated as needed.
+static const DP_Pixel8 *transform_source_pixels(DP_PreviewTransformSource *pvts,
+                                                int level)
+{
+    DP_ASSERT(level >= 0);
+    DP_ASSERT(level <= TRANSFORM_REDUCED_MAX_LEVEL);
+    DP_MUTEX_MUST_LOCK(pvts->mutex);
+    const DP_Pixel8 *pixels = pvts->pixels;
+    if (!pixels) {
+        pixels = pvts->fn.get(pvts->fn.user);
+        pvts->pixels = pixels;
+    }
+    int width = pvts->width;
+    int height = pvts->height;
+    for (int i = 0; i < level; ++i) {
+        int level_width = width / 2;
+        int level_height = height / 2;
+        if (!pvts->levels[i]) {
+            pvts->levels[i] = transform_source_downsample(
+                pixels, width, level_width, level_height);
+        }
+        pixels = pvts->levels[i];
+        width = level_width;
+        height = level_height;
+    }
+    DP_MUTEX_MUST_UNLOCK(pvts->mutex);
+    return pixels;
+}
+
+
 typedef struct DP_PreviewTransform {
     DP_Preview parent;
     int layer_id;
-    int x, y, width, height;
+    int x, y;
     DP_Quad dst_quad;
     int interpolation;
+    bool reduced;
+    bool failed;
     DP_Image *img;
-    struct {
-        DP_PreviewTransformGetPixelsFn get;
-        DP_PreviewTransformDisposePixelsFn dispose;
-        void *user;
-    } pixels;
+    DP_PreviewTransformSource *pvts;
 } DP_PreviewTransform;
 
 static const int *preview_transform_get_layer_ids(DP_Preview *pv,
@@ -402,6 +541,94 @@ static const int *preview_transform_get_layer_ids(DP_Preview *pv,
     return &pvtf->layer_id;
 }
 
+static int preview_transform_reduced_level(DP_PreviewTransform *pvtf,
+                                           long long *out_area)
+{
+    DP_Rect bounds = DP_quad_bounds(pvtf->dst_quad);
+    long long area = (long long)DP_rect_width(bounds)
+                   * (long long)DP_rect_height(bounds);
+    int level = 0;
+    while (level < TRANSFORM_REDUCED_MAX_LEVEL
+           && (area >> (level * 2)) > TRANSFORM_REDUCED_MAX_AREA) {
+        ++level;
+    }
+    *out_area = area >> (level * 2);
+    return level;
+}
+
+static int preview_transform_source_level(DP_PreviewTransformSource *pvts,
+                                          int level, long long area)
+{
+    // Don't shrink the source below the density of the reduced destination,
+    // that would only blur the preview further without making it any faster.
+    int width = pvts->width;
+    int height = pvts->height;
+    while (level > 0) {
+        int level_width = width >> level;
+        int level_height = height >> level;
+        if (level_width > 0 && level_height > 0
+            && (long long)level_width * (long long)level_height >= area) {
+            break;
+        }
+        --level;
+    }
+    return level;
+}
+
+static DP_Image *preview_transform_enlarge(DP_Image *reduced, int level,
+                                           int width, int height)
+{
+    DP_Image *img = DP_image_new(width, height);
+    DP_Pixel8 *dst = DP_image_pixels(img);
+    const DP_Pixel8 *src = DP_image_pixels(reduced);
+    int reduced_width = DP_image_width(reduced);
+    int reduced_height = DP_image_height(reduced);
+    for (int y = 0; y < height; ++y) {
+        DP_Pixel8 *row = dst + (size_t)y * (size_t)width;
+        if (y % (1 << level) == 0) {
+            const DP_Pixel8 *src_row =
+                src
+                + (size_t)DP_min_int(y >> level, reduced_height - 1)
+                      * (size_t)reduced_width;
+            for (int x = 0; x < width; ++x) {
+                row[x] = src_row[DP_min_int(x >> level, reduced_width - 1)];
+            }
+        }
+        else {
+            memcpy(row, row - width, sizeof(*row) * (size_t)width);
+        }
+    }
+    return img;
+}
+
+static DP_Image *preview_transform_reduced(DP_PreviewTransform *pvtf,
+                                           DP_DrawContext *dc, int level,
+                                           int src_level)
+{
+    DP_PreviewTransformSource *pvts = pvtf->pvts;
+    const DP_Pixel8 *pixels = transform_source_pixels(pvts, src_level);
+    DP_Quad q = pvtf->dst_quad;
+    DP_Rect bounds = DP_quad_bounds(q);
+    int bx = DP_rect_x(bounds);
+    int by = DP_rect_y(bounds);
+    DP_Quad reduced_quad = DP_quad_make(
+        (q.x1 - bx) >> level, (q.y1 - by) >> level, (q.x2 - bx) >> level,
+        (q.y2 - by) >> level, (q.x3 - bx) >> level, (q.y3 - by) >> level,
+        (q.x4 - bx) >> level, (q.y4 - by) >> level);
+    DP_Image *reduced = DP_image_transform_pixels(
+        pvts->width >> src_level, pvts->height >> src_level, pixels, dc,
+        &reduced_quad, pvtf->interpolation, false, NULL, NULL);
+    if (reduced) {
+        DP_Image *img = preview_transform_enlarge(
+            reduced, level, DP_rect_width(bounds), DP_rect_height(bounds));
+        DP_image_free(reduced);
+        return img;
+    }
+    else {
+        return NULL;
+    }
+}
+
 static bool preview_transform_prepare_image(DP_PreviewTransform *pvtf,
                                             DP_DrawContext *dc)
 {
@@ -409,19 +636,24 @@ static bool preview_transform_prepare_image(DP_PreviewTransform *pvtf,
         return true; // Image alread transformed successfully.
     }
 
-    DP_PreviewTransformGetPixelsFn get_pixels = pvtf->pixels.get;
-    if (!get_pixels) {
+    if (pvtf->failed) {
         return false; // Transform already attempted, but failed.
     }
 
-    void *user = pvtf->pixels.user;
-    const DP_Pixel8 *pixels = get_pixels(user);
-    pvtf->pixels.get = NULL;
-    DP_Image *img = DP_image_transform_pixels(
-        pvtf->width, pvtf->height, pixels, dc, &pvtf->dst_quad,
-        pvtf->interpolation, false, NULL, NULL);
-    pvtf->pixels.dispose(user);
-    pvtf->pixels.dispose = NULL;
+    DP_PreviewTransformSource *pvts = pvtf->pvts;
+    long long area = 0;
+    int level =
+        pvtf->reduced ? preview_transform_reduced_level(pvtf, &area) : 0;
+    DP_Image *img;
+    if (level == 0) {
+        img = DP_image_transform_pixels(
+            pvts->width, pvts->height, transform_source_pixels(pvts, 0), dc,
+            &pvtf->dst_quad, pvtf->interpolation, false, NULL, NULL);
+    }
+    else {
+        img = preview_transform_reduced(
+            pvtf, dc, level, preview_transform_source_level(pvts, level, area));
+    }
 
     if (img) {
         pvtf->img = img;
@@ -429,6 +661,7 @@ static bool preview_transform_prepare_image(DP_PreviewTransform *pvtf,
     }
     else {
         DP_warn("Error transforming preview: %s", DP_error());
+        pvtf->failed = true;
         return false;
     }
 }
@@ -451,27 +684,21 @@ static void preview_transform_render(DP_Preview *pv,
 static void preview_transform_dispose(DP_Preview *pv)
 {
     DP_PreviewTransform *pvtf = (DP_PreviewTransform *)pv;
-    DP_PreviewTransformDisposePixelsFn dispose = pvtf->pixels.dispose;
-    if (dispose) {
-        dispose(pvtf->pixels.user);
-    }
+    DP_preview_transform_source_decref(pvtf->pvts);
     DP_image_free(pvtf->img);
 }
 
-DP_Preview *DP_preview_new_transform(
-    int id, int initial_offset_x, int initial_offset_y, int layer_id,
-    int blend_mode, uint16_t opacity, int x, int y, int width, int height,
-    const DP_Quad *dst_quad, int interpolation,
-    DP_PreviewTransformGetPixelsFn get_pixels,
-    DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user)
+DP_Preview *DP_preview_new_transform_inc(int id, int initial_offset_x,
+                                         int initial_offset_y, int layer_id,
+                                         int blend_mode, uint16_t opacity,
+                                         int x, int y, const DP_Quad *dst_quad,
+                                         int interpolation, bool reduced,
+                                         DP_PreviewTransformSource *pvts)
 {
     DP_ASSERT(id >= 0);
     DP_ASSERT(id < DP_PREVIEW_TRANSFORM_COUNT);
-    DP_ASSERT(width > 0);
-    DP_ASSERT(height > 0);
     DP_ASSERT(dst_quad);
-    DP_ASSERT(get_pixels);
-    DP_ASSERT(dispose_pixels);
+    DP_ASSERT(pvts);
     DP_PreviewTransform *pvtf = DP_malloc(sizeof(*pvtf));
     init_preview(&pvtf->parent, DP_PREVIEW_TRANSFORM_FIRST + id, blend_mode,
                  opacity, initial_offset_x, initial_offset_y,
@@ -480,14 +707,12 @@ DP_Preview *DP_preview_new_transform(
     pvtf->layer_id = layer_id;
     pvtf->x = x;
     pvtf->y = y;
-    pvtf->width = width;
-    pvtf->height = height;
     pvtf->dst_quad = *dst_quad;
     pvtf->interpolation = interpolation;
-    pvtf->pixels.get = get_pixels;
-    pvtf->pixels.dispose = dispose_pixels;
-    pvtf->pixels.user = user;
+    pvtf->reduced = reduced;
+    pvtf->failed = false;
     pvtf->img = NULL;
+    pvtf->pvts = DP_preview_transform_source_incref(pvts);
     return &pvtf->parent;
 }
 
@@ -687,15 +912,15 @@ static void preview_dabs_dispose(DP_Preview *pv)
     }
 }
 
-DP_Preview *DP_preview_new_dabs_inc(int initial_offset_x, int initial_offset_y,
-                                    int layer_id, int count,
-                                    DP_Message **messages)
+static DP_Preview *new_dabs_inc(int type, int initial_offset_x,
+                                int initial_offset_y, int layer_id, int count,
+                                DP_Message **messages)
 {
     DP_ASSERT(count > 0);
     DP_ASSERT(messages);
     DP_PreviewDabs *pvd = DP_malloc(
         DP_FLEX_SIZEOF(DP_PreviewDabs, messages, DP_int_to_size(count)));
-    init_preview(&pvd->parent, DP_PREVIEW_DABS,
+    init_preview(&pvd->parent, type,
                  preview_dabs_blend_mode(messages[0]), DP_BIT15,
                  initial_offset_x, initial_offset_y, preview_dabs_get_layer_ids,
                  preview_dabs_render, preview_dabs_dispose);
@@ -707,6 +932,31 @@ DP_Preview *DP_preview_new_dabs_inc(int initial_offset_x, int initial_offset_y,
     return &pvd->parent;
 }
 
+DP_Preview *DP_preview_new_dabs_inc(int initial_offset_x, int initial_offset_y,
+                                    int layer_id, int count,
+                                    DP_Message **messages)
+{
+    return new_dabs_inc(DP_PREVIEW_DABS, initial_offset_x, initial_offset_y,
+                        layer_id, count, messages);
+}
+
+DP_Preview *DP_preview_new_stroke_inc(int initial_offset_x,
+                                      int initial_offset_y, int layer_id,
+                                      int count, DP_Message **messages)
+{
+    return new_dabs_inc(DP_PREVIEW_STROKE, initial_offset_x, initial_offset_y,
+                        layer_id, count, messages);
+}
+
+DP_Message *DP_preview_dabs_first_message_noinc(DP_Preview *pv)
+{
+    DP_ASSERT(pv);
+    DP_ASSERT(DP_atomic_get(&pv->refcount) > 0);
+    DP_ASSERT(pv->type == DP_PREVIEW_DABS || pv->type == DP_PREVIEW_STROKE);
+    DP_PreviewDabs *pvd = (DP_PreviewDabs *)pv;
+    return pvd->messages[0];
+}
+
 
 typedef struct DP_PreviewFill {
     DP_Preview parent;
@@ -799,6 +1049,7 @@ static bool handle_render_job(DP_Preview *pv, DP_CanvasState *cs,
 
 static void run_worker_thread(void *user)
 {
+    DP_thread_role_set(DP_THREAD_ROLE_INTERACTIVE);
     DP_PreviewRenderer *pvr = user;
     DP_Mutex *queue_mutex = pvr->queue_mutex;
     DP_Semaphore *queue_sem = pvr->queue_sem;
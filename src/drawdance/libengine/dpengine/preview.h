@@ -18,6 +18,9 @@ typedef enum DP_PreviewType {
     DP_PREVIEW_CUT,
     DP_PREVIEW_DABS,
     DP_PREVIEW_FILL,
+    // Local drawing dabs that are still waiting for the paint engine to get
+    // around to them, see DP_paint_engine_tick.
+    DP_PREVIEW_STROKE,
     // The amount of layers that can be previewed with an accurate transform
     // preview is limited because at some point it's just too slow. If the user
     // selects that many layers, we force the "fast" preview mode instead, which
@@ -29,6 +32,7 @@ typedef enum DP_PreviewType {
 } DP_PreviewType;
 
 typedef struct DP_Preview DP_Preview;
+typedef struct DP_PreviewTransformSource DP_PreviewTransformSource;
 
 typedef const DP_Pixel8 *(*DP_PreviewTransformGetPixelsFn)(void *user);
 typedef void (*DP_PreviewTransformDisposePixelsFn)(void *user);
@@ -65,17 +69,47 @@ DP_Preview *DP_preview_new_cut(int initial_offset_x, int initial_offset_y,
                                const DP_Pixel8 *mask_or_null,
                                int layer_id_count, const int *layer_ids);
 
-DP_Preview *DP_preview_new_transform(
-    int id, int initial_offset_x, int initial_offset_y, int layer_id,
-    int blend_mode, uint16_t opacity, int x, int y, int width, int height,
-    const DP_Quad *dst_quad, int interpolation,
-    DP_PreviewTransformGetPixelsFn get_pixels,
+// Source pixels of a transform preview. These are fetched lazily on the first
+// render and then retained, along with any downsampled copies of them, so that
+// dragging a transform around doesn't have to get them again for every update.
+DP_PreviewTransformSource *DP_preview_transform_source_new(
+    int width, int height, DP_PreviewTransformGetPixelsFn get_pixels,
     DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user);
 
+DP_PreviewTransformSource *
+DP_preview_transform_source_incref(DP_PreviewTransformSource *pvts);
+
+void DP_preview_transform_source_decref(DP_PreviewTransformSource *pvts);
+
+void DP_preview_transform_source_decref_nullable(
+    DP_PreviewTransformSource *pvts_or_null);
+
+int DP_preview_transform_source_width(DP_PreviewTransformSource *pvts);
+
+int DP_preview_transform_source_height(DP_PreviewTransformSource *pvts);
+
+// If reduced is true, large transforms are rendered from a downsampled copy of
+// the source at a fraction of the destination resolution and then scaled back
+// up. That's meant for while the user is dragging the transform around.
+DP_Preview *DP_preview_new_transform_inc(int id, int initial_offset_x,
+                                         int initial_offset_y, int layer_id,
+                                         int blend_mode, uint16_t opacity,
+                                         int x, int y, const DP_Quad *dst_quad,
+                                         int interpolation, bool reduced,
+                                         DP_PreviewTransformSource *pvts);
+
 DP_Preview *DP_preview_new_dabs_inc(int initial_offset_x, int initial_offset_y,
                                     int layer_id, int count,
                                     DP_Message **messages);
 
+// Like a dabs preview, but with its own type so that it doesn't clobber that.
+DP_Preview *DP_preview_new_stroke_inc(int initial_offset_x,
+                                      int initial_offset_y, int layer_id,
+                                      int count, DP_Message **messages);
+
+// First message of a dabs or stroke preview, without incrementing its refcount.
+DP_Message *DP_preview_dabs_first_message_noinc(DP_Preview *pv);
+
 DP_Preview *DP_preview_new_fill(int initial_offset_x, int initial_offset_y,
                                 int layer_id, int blend_mode, uint16_t opacity,
                                 int x, int y, int width, int height,
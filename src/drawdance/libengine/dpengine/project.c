@@ -18,15 +18,18 @@
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/geom.h>
 #include <dpcommon/input.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
 #include <dpcommon/worker.h>
 #include <dpdb/sql.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/ids.h>
 #include <dpmsg/message.h>
+#include <uthash_inc.h>
 
 #define DP_PERF_CONTEXT "project"
 
@@ -46,6 +49,13 @@
 #define DP_PROJECT_SNAPSHOT_TRACK_FLAG_HIDDEN          (1u << 0u)
 #define DP_PROJECT_SNAPSHOT_TRACK_FLAG_ONION_SKIN      (1u << 1u)
 
+// Training a dictionary takes a good fraction of a second with the maximum
+// amount of samples, so this is kept fairly low. A canvas with fewer tiles than
+// the minimum doesn't compress to much anyway.
+#define DP_PROJECT_DICTIONARY_CAPACITY    (32 * 1024)
+#define DP_PROJECT_DICTIONARY_MIN_SAMPLES 32
+#define DP_PROJECT_DICTIONARY_MAX_SAMPLES 256
+
 
 typedef enum DP_ProjectPersistentStatement {
     DP_PROJECT_STATEMENT_MESSAGE_RECORD,
@@ -63,6 +73,8 @@ typedef enum DP_ProjectSnapshotPersistentStatement {
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_METADATA,
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_LAYER,
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE,
+    DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_REF,
+    DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_CHUNK,
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_ANNOTATION,
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TRACK,
     DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_KEY_FRAME,
@@ -80,18 +92,76 @@ typedef enum DP_ProjectSnapshotMetadata {
     DP_PROJECT_SNAPSHOT_METADATA_FRAME_COUNT = 7,
 } DP_ProjectSnapshotMetadata;
 
+// Maps a tile to the snapshot_tile_chunks row its pixels were written to. Holds
+// a reference to the tile, so the pointer can't be reused for another one.
+typedef struct DP_ProjectTileChunk {
+    DP_Tile *t;
+    long long chunk_id;
+    UT_hash_handle hh;
+} DP_ProjectTileChunk;
+
 typedef struct DP_ProjectSnapshot {
     long long id;
     DP_ProjectSnapshotState state;
     sqlite3_stmt *stmts[DP_PROJECT_SNAPSHOT_STATEMENT_COUNT];
     DP_Mutex *mutex;
+    DP_ProjectTileChunk *chunks;
 } DP_ProjectSnapshot;
 
+// Tile chunks of the last finished snapshot. The next snapshot references those
+// instead of compressing and writing the same tiles again.
+typedef struct DP_ProjectKnownChunks {
+    long long snapshot_id;
+    DP_ProjectTileChunk *chunks;
+} DP_ProjectKnownChunks;
+
+// Zstd dictionary that tile chunks get compressed with. Individual tiles are
+// small enough that zstd doesn't have much to go on, so one trained on the
+// canvas helps. It's picked up from the file or trained on the first snapshot
+// with enough tiles, then kept for as long as the project is open.
+typedef struct DP_ProjectDictionary {
+    bool loaded;
+    long long id;
+    ZSTD_CDict *cdict;
+} DP_ProjectDictionary;
+
+typedef enum DP_ProjectWriterEntryType {
+    DP_PROJECT_WRITER_ENTRY_MESSAGE,
+    DP_PROJECT_WRITER_ENTRY_SYNC,
+    DP_PROJECT_WRITER_ENTRY_QUIT,
+} DP_ProjectWriterEntryType;
+
+typedef struct DP_ProjectWriterEntry {
+    DP_ProjectWriterEntryType type;
+    long long session_id;
+    long long sequence_id;
+    unsigned int flags;
+    DP_Message *msg;
+} DP_ProjectWriterEntry;
+
+// Background thread for recording messages. Only the thread owning the project
+// pushes to it and it only touches the database while there's entries queued,
+// so syncing with it before any other database access is enough to keep the
+// two from getting in each other's way.
+typedef struct DP_ProjectWriter {
+    DP_Thread *thread;
+    DP_Mutex *queue_mutex;
+    DP_Queue queue;
+    DP_Semaphore *sem_queued;
+    DP_Semaphore *sem_space;
+    DP_Semaphore *sem_synced;
+    int max_batch_size;
+    int write_errors; // Protected by queue_mutex.
+} DP_ProjectWriter;
+
 struct DP_Project {
     sqlite3 *db;
+    DP_ProjectWriter *writer;
     long long session_id;
     long long sequence_id;
     DP_ProjectSnapshot snapshot;
+    DP_ProjectKnownChunks known;
+    DP_ProjectDictionary dictionary;
     sqlite3_stmt *stmts[DP_PROJECT_STATEMENT_COUNT];
     unsigned char serialize_buffer[DP_MESSAGE_MAX_PAYLOAD_LENGTH];
 };
@@ -411,7 +481,7 @@ static int check_header(sqlite3 *db, bool snapshot_only, int *out_result)
         DP_error_set("File has incorrect application id %d", application_id);
         return DP_PROJECT_OPEN_ERROR_HEADER_MISMATCH;
     }
-    else if (user_version != expected_user_version) {
+    else if (user_version < 1 || user_version > expected_user_version) {
         DP_error_set("File has unknown user version %d", user_version);
         return DP_PROJECT_OPEN_ERROR_HEADER_MISMATCH;
     }
@@ -546,6 +616,22 @@ static bool apply_migrations(sqlite3 *db, int *out_result)
         "    flags integer not null,\n"
         "    primary key (snapshot_id, track_index, frame_index, layer_id))\n"
         "strict, without rowid;\n",
+        // Migration 2: tile pixels shared between snapshots. Tiles that
+        // reference a chunk have empty pixels of their own.
+        "create table snapshot_tile_chunks (\n"
+        "    chunk_id integer primary key not null,\n"
+        "    pixels blob not null)\n"
+        "strict;\n"
+        "alter table snapshot_tiles add column chunk_id integer;\n"
+        "create index snapshot_tiles_chunk_id on snapshot_tiles (chunk_id)\n"
+        "    where chunk_id is not null;\n",
+        // Migration 3: zstd dictionaries for tile chunks. Chunks without a
+        // dictionary id were compressed without one.
+        "create table snapshot_dictionaries (\n"
+        "    dictionary_id integer primary key not null,\n"
+        "    content blob not null)\n"
+        "strict;\n"
+        "alter table snapshot_tile_chunks add column dictionary_id integer;\n",
     };
 
     bool result = true;
@@ -659,7 +745,17 @@ static DP_ProjectOpenResult project_open(const char *path, unsigned int flags,
 
     set_db_configs(db);
 
-    if (!read_only) {
+    if (read_only) {
+        // Lets SQLite read pages straight out of a memory mapping instead of
+        // copying them into its cache. Not a big deal if it doesn't work.
+        int mmap_result = sqlite3_exec(db, "pragma mmap_size = 1073741824",
+                                       NULL, NULL, NULL);
+        if (mmap_result != SQLITE_OK) {
+            DP_warn("Error %d setting mmap size: %s", mmap_result,
+                    db_error(db));
+        }
+    }
+    else {
         if (sqlite3_db_readonly(db, "main") > 0) {
             DP_error_set("Error opening '%s': database is read-only", path);
             try_close_db(db);
@@ -733,7 +829,7 @@ static DP_ProjectOpenResult project_open(const char *path, unsigned int flags,
         }
     }
 
-    sqlite3_stmt *stmts[DP_PROJECT_STATEMENT_COUNT];
+    sqlite3_stmt *stmts[DP_PROJECT_STATEMENT_COUNT] = {0};
     if (!snapshot_only) {
         for (int i = 0; i < DP_PROJECT_STATEMENT_COUNT; ++i) {
             sqlite3_stmt *stmt =
@@ -755,22 +851,22 @@ static DP_ProjectOpenResult project_open(const char *path, unsigned int flags,
 
     DP_Project *prj = DP_malloc(sizeof(*prj));
     prj->db = db;
+    prj->writer = NULL;
     prj->session_id = 0LL;
     prj->sequence_id = 0LL;
     prj->snapshot.id = 0LL;
     prj->snapshot.state = DP_PROJECT_SNAPSHOT_STATE_CLOSED;
     prj->snapshot.mutex = NULL;
+    prj->snapshot.chunks = NULL;
+    prj->known.snapshot_id = 0LL;
+    prj->known.chunks = NULL;
+    prj->dictionary.loaded = false;
+    prj->dictionary.id = 0LL;
+    prj->dictionary.cdict = NULL;
     for (int i = 0; i < DP_PROJECT_SNAPSHOT_STATEMENT_COUNT; ++i) {
         prj->snapshot.stmts[i] = NULL;
     }
-    if (snapshot_only) {
-        for (int i = 0; i < DP_PROJECT_STATEMENT_COUNT; ++i) {
-            prj->stmts[i] = NULL;
-        }
-    }
-    else {
-        memcpy(prj->stmts, stmts, sizeof(stmts));
-    }
+    memcpy(prj->stmts, stmts, sizeof(stmts));
     return (DP_ProjectOpenResult){prj, 0, SQLITE_OK};
 }
 
@@ -786,6 +882,16 @@ bool DP_project_open_was_busy(const DP_ProjectOpenResult *open)
         && (open->sql_result & 0xff) == SQLITE_BUSY;
 }
 
+static void tile_chunks_clear(DP_ProjectTileChunk **chunks)
+{
+    DP_ProjectTileChunk *ptc, *tmp;
+    HASH_ITER(hh, *chunks, ptc, tmp) {
+        HASH_DEL(*chunks, ptc);
+        DP_tile_decref(ptc->t);
+        DP_free(ptc);
+    }
+}
+
 static void project_close_session(DP_Project *prj)
 {
     if (DP_project_session_close(prj, DP_PROJECT_SESSION_FLAG_PROJECT_CLOSED)
@@ -796,6 +902,10 @@ static void project_close_session(DP_Project *prj)
 
 static bool project_close(DP_Project *prj, bool warn_only)
 {
+    if (prj->writer && !DP_project_message_record_async_stop(prj)) {
+        DP_warn("Close project: %s", DP_error());
+    }
+
     if (prj->session_id != 0LL) {
         if (warn_only) {
             const char *error = DP_error();
@@ -811,6 +921,9 @@ static bool project_close(DP_Project *prj, bool warn_only)
     }
 
     DP_mutex_free(prj->snapshot.mutex);
+    tile_chunks_clear(&prj->snapshot.chunks);
+    tile_chunks_clear(&prj->known.chunks);
+    DP_compress_zstd_dictionary_free(prj->dictionary.cdict);
     for (int i = 0; i < DP_PROJECT_STATEMENT_COUNT; ++i) {
         sqlite3_finalize(prj->stmts[i]);
     }
@@ -862,9 +975,32 @@ static bool handle_verify(void *user, const char *text)
     }
 }
 
+static void writer_push(DP_ProjectWriter *w, DP_ProjectWriterEntry entry)
+{
+    DP_SEMAPHORE_MUST_WAIT(w->sem_space);
+    DP_MUTEX_MUST_LOCK(w->queue_mutex);
+    *(DP_ProjectWriterEntry *)DP_queue_push(&w->queue, sizeof(entry)) = entry;
+    DP_MUTEX_MUST_UNLOCK(w->queue_mutex);
+    DP_SEMAPHORE_MUST_POST(w->sem_queued);
+}
+
+// Waits for all recorded messages to be committed. Must be called before
+// touching the database outside of the writer thread.
+static void project_sync(DP_Project *prj)
+{
+    DP_ProjectWriter *w = prj->writer;
+    if (w) {
+        writer_push(w, (DP_ProjectWriterEntry){DP_PROJECT_WRITER_ENTRY_SYNC,
+                                               0LL, 0LL, 0u, NULL});
+        DP_SEMAPHORE_MUST_WAIT(w->sem_synced);
+    }
+}
+
+
 DP_ProjectVerifyStatus DP_project_verify(DP_Project *prj, unsigned int flags)
 {
     DP_ASSERT(prj);
+    project_sync(prj);
     const char *sql = (flags & DP_PROJECT_VERIFY_FULL)
                         ? "pragma integrity_check(1)"
                         : "pragma quick_check(1)";
@@ -927,6 +1063,19 @@ static bool ps_bind_blob(DP_Project *prj, sqlite3_stmt *stmt, int param,
     }
 }
 
+static bool ps_bind_null(DP_Project *prj, sqlite3_stmt *stmt, int param)
+{
+    int bind_result = sqlite3_bind_null(stmt, param);
+    if (is_ok(bind_result)) {
+        return true;
+    }
+    else {
+        DP_error_set("Error %d binding null parameter %d to %s: %s",
+                     bind_result, param, sqlite3_sql(stmt), prj_db_error(prj));
+        return false;
+    }
+}
+
 static bool ps_bind_text_with(DP_Project *prj, sqlite3_stmt *stmt, int param,
                               const char *value, int length)
 {
@@ -1059,6 +1208,7 @@ int DP_project_session_open(DP_Project *prj, int source_type,
 
     DP_debug("Opening session source %d %s, protocol %s", source_type,
              source_param, protocol);
+    project_sync(prj);
     prj->sequence_id = 0LL;
     sqlite3_stmt *stmt = ps_prepare_ephemeral(
         prj, "insert into sessions (source_type, source_param, protocol, "
@@ -1092,6 +1242,8 @@ int DP_project_session_close(DP_Project *prj, unsigned int flags_to_set)
         return DP_PROJECT_SESSION_CLOSE_NOT_OPEN;
     }
 
+    project_sync(prj);
+
     prj->session_id = 0LL;
     sqlite3_stmt *stmt = ps_prepare_ephemeral(
         prj, "update sessions set flags = flags | ?, "
@@ -1124,6 +1276,40 @@ unsigned char *get_serialize_buffer(void *user, DP_UNUSED size_t length)
     return prj->serialize_buffer;
 }
 
+static int message_write(DP_Project *prj, long long session_id,
+                         long long sequence_id, unsigned int flags,
+                         DP_Message *msg)
+{
+    size_t length = DP_message_serialize_body(msg, get_serialize_buffer, prj);
+    if (length == 0) {
+        return DP_PROJECT_MESSAGE_RECORD_ERROR_SERIALIZE;
+    }
+
+    sqlite3_stmt *stmt = prj->stmts[DP_PROJECT_STATEMENT_MESSAGE_RECORD];
+    bool write_ok = ps_bind_int64(prj, stmt, 1, session_id)
+                 && ps_bind_int64(prj, stmt, 2, sequence_id)
+                 && ps_bind_int64(prj, stmt, 3, DP_uint_to_llong(flags))
+                 && ps_bind_int(prj, stmt, 4, (int)DP_message_type(msg))
+                 && ps_bind_int64(prj, stmt, 5, DP_message_context_id(msg))
+                 && ps_bind_blob(prj, stmt, 6, prj->serialize_buffer, length)
+                 && ps_exec_write(prj, stmt, NULL);
+    ps_clear_bindings(prj, stmt);
+    if (!write_ok) {
+        return DP_PROJECT_MESSAGE_RECORD_ERROR_WRITE;
+    }
+
+    return 0;
+}
+
+static int writer_take_errors(DP_ProjectWriter *w)
+{
+    DP_MUTEX_MUST_LOCK(w->queue_mutex);
+    int write_errors = w->write_errors;
+    w->write_errors = 0;
+    DP_MUTEX_MUST_UNLOCK(w->queue_mutex);
+    return write_errors;
+}
+
 int DP_project_message_record(DP_Project *prj, DP_Message *msg,
                               unsigned int flags)
 {
@@ -1143,27 +1329,192 @@ int DP_project_message_record(DP_Project *prj, DP_Message *msg,
         return DP_PROJECT_MESSAGE_RECORD_ERROR_NO_SESSION;
     }
 
-    size_t length = DP_message_serialize_body(msg, get_serialize_buffer, prj);
-    if (length == 0) {
-        return DP_PROJECT_MESSAGE_RECORD_ERROR_SERIALIZE;
+    long long sequence_id = ++prj->sequence_id;
+    DP_ProjectWriter *w = prj->writer;
+    if (!w) {
+        return message_write(prj, session_id, sequence_id, flags, msg);
     }
 
-    sqlite3_stmt *stmt = prj->stmts[DP_PROJECT_STATEMENT_MESSAGE_RECORD];
-    bool write_ok = ps_bind_int64(prj, stmt, 1, session_id)
-                 && ps_bind_int64(prj, stmt, 2, ++prj->sequence_id)
-                 && ps_bind_int64(prj, stmt, 3, DP_uint_to_llong(flags))
-                 && ps_bind_int(prj, stmt, 4, (int)DP_message_type(msg))
-                 && ps_bind_int64(prj, stmt, 5, DP_message_context_id(msg))
-                 && ps_bind_blob(prj, stmt, 6, prj->serialize_buffer, length)
-                 && ps_exec_write(prj, stmt, NULL);
-    ps_clear_bindings(prj, stmt);
-    if (!write_ok) {
+    writer_push(w, (DP_ProjectWriterEntry){DP_PROJECT_WRITER_ENTRY_MESSAGE,
+                                           session_id, sequence_id, flags,
+                                           DP_message_incref(msg)});
+    int write_errors = writer_take_errors(w);
+    if (write_errors != 0) {
+        DP_error_set("Failed to record %d message(s) in the background",
+                     write_errors);
         return DP_PROJECT_MESSAGE_RECORD_ERROR_WRITE;
     }
 
     return 0;
 }
 
+static void writer_shift(DP_ProjectWriter *w, DP_ProjectWriterEntry *out_entry)
+{
+    DP_MUTEX_MUST_LOCK(w->queue_mutex);
+    DP_ProjectWriterEntry *entry = DP_queue_peek(&w->queue, sizeof(*entry));
+    DP_ASSERT(entry);
+    *out_entry = *entry;
+    DP_queue_shift(&w->queue);
+    DP_MUTEX_MUST_UNLOCK(w->queue_mutex);
+    DP_SEMAPHORE_MUST_POST(w->sem_space);
+}
+
+static void writer_add_errors(DP_ProjectWriter *w, int count)
+{
+    DP_MUTEX_MUST_LOCK(w->queue_mutex);
+    w->write_errors += count;
+    DP_MUTEX_MUST_UNLOCK(w->queue_mutex);
+}
+
+// Writes the given message and then as many more as are already queued up, up
+// to the batch size, in a single transaction. Returns true if it ran into a
+// non-message entry, which is then left in the entry parameter.
+static bool writer_write_batch(DP_Project *prj, DP_ProjectWriter *w,
+                               DP_ProjectWriterEntry *entry)
+{
+    bool in_tx = exec_write_stmt(prj->db, "begin",
+                                 "opening message record transaction", NULL);
+    if (!in_tx) {
+        DP_warn("Record messages: %s", DP_error());
+    }
+
+    int errors = 0;
+    int count = 0;
+    bool have_entry = true;
+    do {
+        int result = message_write(prj, entry->session_id, entry->sequence_id,
+                                   entry->flags, entry->msg);
+        DP_message_decref(entry->msg);
+        if (result != 0) {
+            DP_warn("Record message: %s", DP_error());
+            ++errors;
+        }
+
+        if (++count < w->max_batch_size
+            && DP_SEMAPHORE_MUST_TRY_WAIT(w->sem_queued)) {
+            writer_shift(w, entry);
+        }
+        else {
+            have_entry = false;
+        }
+    } while (have_entry && entry->type == DP_PROJECT_WRITER_ENTRY_MESSAGE);
+
+    if (in_tx
+        && !exec_write_stmt(prj->db, "commit",
+                            "committing message record transaction", NULL)) {
+        DP_warn("Record messages: %s", DP_error());
+        try_rollback(prj->db);
+        errors = count;
+    }
+
+    if (errors != 0) {
+        writer_add_errors(w, errors);
+    }
+    return have_entry;
+}
+
+static void run_writer_thread(void *data)
+{
+    DP_thread_role_set(DP_THREAD_ROLE_BACKGROUND);
+    DP_Project *prj = data;
+    DP_ProjectWriter *w = prj->writer;
+    DP_ProjectWriterEntry entry;
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(w->sem_queued);
+        writer_shift(w, &entry);
+        if (entry.type == DP_PROJECT_WRITER_ENTRY_MESSAGE
+            && !writer_write_batch(prj, w, &entry)) {
+            continue;
+        }
+
+        switch (entry.type) {
+        case DP_PROJECT_WRITER_ENTRY_SYNC:
+            DP_SEMAPHORE_MUST_POST(w->sem_synced);
+            break;
+        case DP_PROJECT_WRITER_ENTRY_QUIT:
+            return;
+        case DP_PROJECT_WRITER_ENTRY_MESSAGE:
+            DP_UNREACHABLE();
+        }
+    }
+}
+
+static void writer_free(DP_ProjectWriter *w)
+{
+    DP_semaphore_free(w->sem_synced);
+    DP_semaphore_free(w->sem_space);
+    DP_semaphore_free(w->sem_queued);
+    DP_queue_dispose(&w->queue);
+    DP_mutex_free(w->queue_mutex);
+    DP_free(w);
+}
+
+bool DP_project_message_record_async_start(DP_Project *prj, int max_queued,
+                                           int max_batch_size)
+{
+    DP_ASSERT(prj);
+    DP_ASSERT(max_queued > 0);
+    DP_ASSERT(max_batch_size > 0);
+
+    if (prj->writer) {
+        DP_error_set("Asynchronous message recording already started");
+        return false;
+    }
+
+    if (!prj->stmts[DP_PROJECT_STATEMENT_MESSAGE_RECORD]) {
+        DP_error_set("Project can't record messages");
+        return false;
+    }
+
+    DP_ProjectWriter *w = DP_malloc(sizeof(*w));
+    w->thread = NULL;
+    w->queue_mutex = DP_mutex_new();
+    DP_queue_init(&w->queue, DP_int_to_size(max_queued),
+                  sizeof(DP_ProjectWriterEntry));
+    w->sem_queued = DP_semaphore_new(0);
+    w->sem_space = DP_semaphore_new(DP_int_to_uint(max_queued));
+    w->sem_synced = DP_semaphore_new(0);
+    w->max_batch_size = max_batch_size;
+    w->write_errors = 0;
+    if (!w->queue_mutex || !w->sem_queued || !w->sem_space || !w->sem_synced) {
+        writer_free(w);
+        return false;
+    }
+
+    prj->writer = w;
+    w->thread = DP_thread_new(run_writer_thread, prj);
+    if (!w->thread) {
+        prj->writer = NULL;
+        writer_free(w);
+        return false;
+    }
+
+    return true;
+}
+
+bool DP_project_message_record_async_stop(DP_Project *prj)
+{
+    DP_ASSERT(prj);
+    DP_ProjectWriter *w = prj->writer;
+    if (!w) {
+        return true;
+    }
+
+    writer_push(w, (DP_ProjectWriterEntry){DP_PROJECT_WRITER_ENTRY_QUIT, 0LL,
+                                           0LL, 0u, NULL});
+    DP_thread_free_join(w->thread);
+    int write_errors = w->write_errors;
+    prj->writer = NULL;
+    writer_free(w);
+
+    if (write_errors != 0) {
+        DP_error_set("Failed to record %d message(s) in the background",
+                     write_errors);
+        return false;
+    }
+    return true;
+}
+
 
 static const char *snapshot_sql(DP_ProjectSnapshotPersistentStatement psps)
 {
@@ -1180,6 +1531,13 @@ static const char *snapshot_sql(DP_ProjectSnapshotPersistentStatement psps)
         return "insert into snapshot_tiles (snapshot_id, layer_index, "
                "tile_index, context_id, repeat, pixels) values (?, ?, ?, ?, ?, "
                "?)";
+    case DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_REF:
+        return "insert into snapshot_tiles (snapshot_id, layer_index, "
+               "tile_index, context_id, repeat, pixels, chunk_id) values (?, "
+               "?, ?, ?, ?, x'', ?)";
+    case DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_CHUNK:
+        return "insert into snapshot_tile_chunks (pixels, dictionary_id) "
+               "values (?, ?)";
     case DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_ANNOTATION:
         return "insert into snapshot_annotations (snapshot_id, "
                "annotation_index, annotation_id, content, x, y, width, height, "
@@ -1253,10 +1611,15 @@ static long long project_snapshot_open(DP_Project *prj, unsigned int flags)
 
     DP_ASSERT(snapshot_id > 0);
     for (int i = 0; i < DP_PROJECT_SNAPSHOT_STATEMENT_COUNT; ++i) {
-        prj->snapshot.stmts[i] = ps_prepare_persistent(
-            prj, snapshot_sql((DP_ProjectSnapshotPersistentStatement)i));
+        DP_ProjectSnapshotPersistentStatement psps =
+            (DP_ProjectSnapshotPersistentStatement)i;
+        // Chunks don't belong to any one snapshot, so they have no id to bind.
+        bool bind_id = psps != DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_CHUNK;
+        prj->snapshot.stmts[i] = ps_prepare_persistent(prj, snapshot_sql(psps));
         if (!prj->snapshot.stmts[i]
-            || !ps_bind_int64(prj, prj->snapshot.stmts[i], 1, snapshot_id)) {
+            || (bind_id
+                && !ps_bind_int64(prj, prj->snapshot.stmts[i], 1,
+                                  snapshot_id))) {
             for (int j = 0; j < i; ++j) {
                 sqlite3_finalize(prj->snapshot.stmts[j]);
                 prj->snapshot.stmts[j] = NULL;
@@ -1278,6 +1641,7 @@ long long DP_project_snapshot_open(DP_Project *prj, unsigned int flags)
 {
     DP_ASSERT(prj);
     DP_ASSERT(!(flags & DP_PROJECT_SNAPSHOT_FLAG_COMPLETE));
+    project_sync(prj);
 
     if (prj->session_id == 0LL) {
         DP_error_set("No session open");
@@ -1297,12 +1661,14 @@ static void snapshot_close(DP_Project *prj)
     }
     DP_mutex_free(prj->snapshot.mutex);
     prj->snapshot.mutex = NULL;
+    tile_chunks_clear(&prj->snapshot.chunks);
 }
 
 int DP_project_snapshot_finish(DP_Project *prj, long long snapshot_id)
 {
     DP_ASSERT(prj);
     DP_ASSERT(snapshot_id > 0LL);
+    project_sync(prj);
 
     if (prj->snapshot.id == 0LL) {
         DP_error_set("Snapshot %lld is not open (none is)", snapshot_id);
@@ -1315,11 +1681,18 @@ int DP_project_snapshot_finish(DP_Project *prj, long long snapshot_id)
         return DP_PROJECT_SNAPSHOT_FINISH_ERROR_NOT_OPEN;
     }
 
+    // Only a successfully written snapshot may be referenced by the next one.
+    DP_ProjectTileChunk *chunks = NULL;
+    if (prj->snapshot.state == DP_PROJECT_SNAPSHOT_STATE_OK) {
+        chunks = prj->snapshot.chunks;
+        prj->snapshot.chunks = NULL;
+    }
     snapshot_close(prj);
 
     sqlite3_stmt *stmt = ps_prepare_ephemeral(
         prj, "update snapshots set flags = flags | ? where snapshot_id = ?");
     if (!stmt) {
+        tile_chunks_clear(&chunks);
         return DP_PROJECT_SNAPSHOT_FINISH_ERROR_PREPARE;
     }
 
@@ -1329,15 +1702,22 @@ int DP_project_snapshot_finish(DP_Project *prj, long long snapshot_id)
         && ps_exec_write(prj, stmt, NULL);
     sqlite3_finalize(stmt);
     if (!write_ok) {
+        tile_chunks_clear(&chunks);
         return DP_PROJECT_SNAPSHOT_FINISH_ERROR_WRITE;
     }
 
     if (sqlite3_changes64(prj->db) == 0LL) {
         DP_error_set("Closing snapshot %lld resulted in no changes",
                      snapshot_id);
+        tile_chunks_clear(&chunks);
         return DP_PROJECT_SNAPSHOT_FINISH_ERROR_NO_CHANGE;
     }
 
+    if (chunks) {
+        tile_chunks_clear(&prj->known.chunks);
+        prj->known.snapshot_id = snapshot_id;
+        prj->known.chunks = chunks;
+    }
     return 0;
 }
 
@@ -1345,6 +1725,12 @@ static int project_snapshot_discard_relations(DP_Project *prj,
                                               long long snapshot_id)
 {
     const char *sqls[] = {
+        // Tile chunks may be shared with other snapshots, only delete the ones
+        // that no other snapshot references. Must happen before the tiles go.
+        "delete from snapshot_tile_chunks where chunk_id in (select chunk_id "
+        "from snapshot_tiles where snapshot_id = ?1) and not exists (select 1 "
+        "from snapshot_tiles where snapshot_tiles.chunk_id = "
+        "snapshot_tile_chunks.chunk_id and snapshot_tiles.snapshot_id <> ?1)",
         "delete from snapshot_key_frames where snapshot_id = ?",
         "delete from snapshot_tracks where snapshot_id = ?",
         "delete from snapshot_annotations where snapshot_id = ?",
@@ -1372,6 +1758,27 @@ static int project_snapshot_discard_relations(DP_Project *prj,
         }
     }
 
+    // Dictionaries go once no chunk uses them anymore, except for the latest
+    // one, since that's what new chunks get compressed with.
+    sqlite3_stmt *dictionary_stmt = ps_prepare_ephemeral(
+        prj, "delete from snapshot_dictionaries where dictionary_id <> (select "
+             "max(dictionary_id) from snapshot_dictionaries) and not exists "
+             "(select 1 from snapshot_tile_chunks where "
+             "snapshot_tile_chunks.dictionary_id = "
+             "snapshot_dictionaries.dictionary_id)");
+    if (dictionary_stmt) {
+        bool write_ok = ps_exec_write(prj, dictionary_stmt, NULL);
+        sqlite3_finalize(dictionary_stmt);
+        if (!write_ok) {
+            DP_warn("Discard snapshot %lld: %s", snapshot_id, DP_error());
+            ++write_errors;
+        }
+    }
+    else {
+        DP_warn("Discard snapshot %lld: %s", snapshot_id, DP_error());
+        ++prepare_errors;
+    }
+
     if (prepare_errors == 0) {
         if (write_errors == 0) {
             return 0;
@@ -1400,11 +1807,17 @@ int DP_project_snapshot_discard(DP_Project *prj, long long snapshot_id)
 {
     DP_ASSERT(prj);
     DP_ASSERT(snapshot_id > 0LL);
+    project_sync(prj);
 
     if (prj->snapshot.id == snapshot_id) {
         snapshot_close(prj);
     }
 
+    if (prj->known.snapshot_id == snapshot_id) {
+        prj->known.snapshot_id = 0LL;
+        tile_chunks_clear(&prj->known.chunks);
+    }
+
     sqlite3_stmt *stmt = ps_prepare_ephemeral(
         prj, "delete from snapshots where snapshot_id = ?");
     if (!stmt) {
@@ -1436,6 +1849,7 @@ int DP_project_snapshot_discard_all_except(DP_Project *prj,
 {
     DP_ASSERT(prj);
     DP_ASSERT(snapshot_id > 0LL);
+    project_sync(prj);
 
     sqlite3_stmt *stmt =
         ps_prepare_ephemeral(prj, "select snapshot_id from snapshots "
@@ -1586,10 +2000,70 @@ static bool snapshot_handle_layer(DP_Project *prj,
         && ps_exec_write(prj, stmt, NULL);
 }
 
+static bool snapshot_write_tile_chunk(DP_Project *prj,
+                                      const DP_ResetEntryTile *ret,
+                                      long long *out_chunk_id)
+{
+    if (ret->data) {
+        sqlite3_stmt *stmt =
+            prj->snapshot
+                .stmts[DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_CHUNK];
+        long long dictionary_id = prj->dictionary.id;
+        return ps_bind_blob(prj, stmt, 1, ret->data, ret->size)
+            && (dictionary_id == 0LL
+                    ? ps_bind_null(prj, stmt, 2)
+                    : ps_bind_int64(prj, stmt, 2, dictionary_id))
+            && ps_exec_write(prj, stmt, out_chunk_id);
+    }
+    else {
+        DP_ProjectTileChunk *known;
+        HASH_FIND_PTR(prj->known.chunks, &ret->t, known);
+        if (known) {
+            *out_chunk_id = known->chunk_id;
+            return true;
+        }
+        else {
+            DP_error_set("Tile %d of layer %d has no known chunk",
+                         ret->tile_index, ret->layer_index);
+            return false;
+        }
+    }
+}
+
+static bool snapshot_handle_tile_ref(DP_Project *prj,
+                                     const DP_ResetEntryTile *ret)
+{
+    DP_ProjectTileChunk *ptc;
+    HASH_FIND_PTR(prj->snapshot.chunks, &ret->t, ptc);
+    if (!ptc) {
+        long long chunk_id;
+        if (!snapshot_write_tile_chunk(prj, ret, &chunk_id)) {
+            return false;
+        }
+        ptc = DP_malloc(sizeof(*ptc));
+        ptc->t = DP_tile_incref(ret->t);
+        ptc->chunk_id = chunk_id;
+        HASH_ADD_PTR(prj->snapshot.chunks, t, ptc);
+    }
+
+    sqlite3_stmt *stmt =
+        prj->snapshot.stmts[DP_PROJECT_SNAPSHOT_STATEMENT_INSERT_TILE_REF];
+    return ps_bind_int(prj, stmt, 2, ret->layer_index)
+        && ps_bind_int(prj, stmt, 3, ret->tile_index)
+        && ps_bind_int64(prj, stmt, 4, ret->context_id)
+        && ps_bind_int(prj, stmt, 5, ret->tile_run - 1)
+        && ps_bind_int64(prj, stmt, 6, ptc->chunk_id)
+        && ps_exec_write(prj, stmt, NULL);
+}
+
 static bool snapshot_handle_tile(DP_Project *prj, const DP_ResetEntryTile *ret)
 {
     DP_ASSERT(ret->sublayer_id == 0);
     DP_ASSERT(ret->tile_run > 0);
+    if (ret->t) {
+        return snapshot_handle_tile_ref(prj, ret);
+    }
+
     DP_ASSERT(ret->size != 0);
     DP_ASSERT(ret->data);
     sqlite3_stmt *stmt =
@@ -1751,6 +2225,178 @@ static void snapshot_handle_entry_callback(void *user,
     }
 }
 
+static bool snapshot_tile_known(void *user, DP_Tile *t)
+{
+    // Called from worker threads, but the known chunks only change when
+    // snapshots are finished or discarded, never during one.
+    DP_Project *prj = user;
+    DP_ProjectTileChunk *known;
+    HASH_FIND_PTR(prj->known.chunks, &t, known);
+    return known != NULL;
+}
+
+static bool dictionary_load_latest(DP_Project *prj)
+{
+    sqlite3_stmt *stmt = ps_prepare_ephemeral(
+        prj, "select dictionary_id, content from snapshot_dictionaries "
+             "order by dictionary_id desc limit 1");
+    if (!stmt) {
+        return false;
+    }
+
+    bool error = false;
+    if (ps_exec_step(prj, stmt, &error)) {
+        const unsigned char *content = sqlite3_column_blob(stmt, 1);
+        size_t size = DP_int_to_size(sqlite3_column_bytes(stmt, 1));
+        ZSTD_CDict *cdict =
+            content ? DP_compress_zstd_dictionary_new(content, size) : NULL;
+        if (cdict) {
+            prj->dictionary.id = sqlite3_column_int64(stmt, 0);
+            prj->dictionary.cdict = cdict;
+        }
+        else {
+            if (!content) {
+                DP_error_set("Dictionary has no content");
+            }
+            error = true;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return !error;
+}
+
+typedef struct DP_ProjectDictionarySamples {
+    int seen;
+    int stride;
+    int count;
+    DP_SplitTile8 *buffer;
+} DP_ProjectDictionarySamples;
+
+static void dictionary_walk_tiles(DP_LayerList *ll, int tile_count,
+                                  void (*fn)(void *, DP_Tile *), void *user)
+{
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        if (DP_layer_list_entry_is_group(lle)) {
+            DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+            dictionary_walk_tiles(DP_layer_group_children_noinc(lg),
+                                  tile_count, fn, user);
+        }
+        else {
+            DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+            for (int j = 0; j < tile_count; ++j) {
+                DP_Tile *t = DP_layer_content_tile_at_index_noinc(lc, j);
+                if (t) {
+                    fn(user, t);
+                }
+            }
+        }
+    }
+}
+
+static void dictionary_count_tile(void *user, DP_UNUSED DP_Tile *t)
+{
+    ++*(int *)user;
+}
+
+static void dictionary_sample_tile(void *user, DP_Tile *t)
+{
+    DP_ProjectDictionarySamples *samples = user;
+    DP_Pixel15 pixel;
+    if (samples->count < DP_PROJECT_DICTIONARY_MAX_SAMPLES
+        && samples->seen++ % samples->stride == 0
+        && !DP_tile_same_pixel(t, &pixel)) {
+        DP_tile_split_delta8le(t, &samples->buffer[samples->count++]);
+    }
+}
+
+static bool dictionary_insert(DP_Project *prj, const unsigned char *content,
+                              size_t size)
+{
+    ZSTD_CDict *cdict = DP_compress_zstd_dictionary_new(content, size);
+    if (!cdict) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = ps_prepare_ephemeral(
+        prj, "insert into snapshot_dictionaries (content) values (?)");
+    if (!stmt) {
+        DP_compress_zstd_dictionary_free(cdict);
+        return false;
+    }
+
+    long long dictionary_id;
+    bool write_ok = ps_bind_blob(prj, stmt, 1, content, size)
+                 && ps_exec_write(prj, stmt, &dictionary_id);
+    sqlite3_finalize(stmt);
+    if (!write_ok) {
+        DP_compress_zstd_dictionary_free(cdict);
+        return false;
+    }
+
+    prj->dictionary.id = dictionary_id;
+    prj->dictionary.cdict = cdict;
+    return true;
+}
+
+// Samples tiles spread across the whole canvas. Not having enough of them just
+// means there's no dictionary yet, that's not an error.
+static bool dictionary_train(DP_Project *prj, DP_CanvasState *cs)
+{
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    int tile_count = DP_tile_total_round(DP_canvas_state_width(cs),
+                                         DP_canvas_state_height(cs));
+    int total = 0;
+    dictionary_walk_tiles(ll, tile_count, dictionary_count_tile, &total);
+    if (total < DP_PROJECT_DICTIONARY_MIN_SAMPLES) {
+        return true;
+    }
+
+    DP_ProjectDictionarySamples samples = {
+        0, DP_max_int(1, total / DP_PROJECT_DICTIONARY_MAX_SAMPLES), 0,
+        DP_malloc(sizeof(*samples.buffer)
+                  * (size_t)DP_PROJECT_DICTIONARY_MAX_SAMPLES)};
+    dictionary_walk_tiles(ll, tile_count, dictionary_sample_tile, &samples);
+
+    bool ok = true;
+    if (samples.count >= DP_PROJECT_DICTIONARY_MIN_SAMPLES) {
+        size_t *sample_sizes =
+            DP_malloc(sizeof(*sample_sizes) * DP_int_to_size(samples.count));
+        for (int i = 0; i < samples.count; ++i) {
+            sample_sizes[i] = sizeof(*samples.buffer);
+        }
+
+        unsigned char *content = DP_malloc(DP_PROJECT_DICTIONARY_CAPACITY);
+        DP_PERF_BEGIN(train, "save:dictionary");
+        size_t size = DP_compress_zstd_train_dictionary(
+            content, DP_PROJECT_DICTIONARY_CAPACITY,
+            (const unsigned char *)samples.buffer, sample_sizes,
+            DP_int_to_uint(samples.count));
+        DP_PERF_END(train);
+        ok = size != 0 && dictionary_insert(prj, content, size);
+        DP_free(content);
+        DP_free(sample_sizes);
+    }
+
+    DP_free(samples.buffer);
+    return ok;
+}
+
+static void dictionary_prepare(DP_Project *prj, DP_CanvasState *cs)
+{
+    if (!prj->dictionary.loaded) {
+        prj->dictionary.loaded = true;
+        if (!dictionary_load_latest(prj)) {
+            DP_warn("Load snapshot dictionary: %s", DP_error());
+        }
+    }
+
+    if (!prj->dictionary.cdict && !dictionary_train(prj, cs)) {
+        DP_warn("Train snapshot dictionary: %s", DP_error());
+    }
+}
+
 static int
 snapshot_canvas(DP_Project *prj, long long snapshot_id, DP_CanvasState *cs,
                 bool (*thumb_write_fn)(void *, DP_Image *, DP_Output *),
@@ -1765,16 +2411,38 @@ snapshot_canvas(DP_Project *prj, long long snapshot_id, DP_CanvasState *cs,
     }
 
     prj->snapshot.state = DP_PROJECT_SNAPSHOT_STATE_OK;
+    dictionary_prepare(prj, cs);
     DP_ResetImageOptions options = {true,
                                     true,
                                     false,
                                     DP_RESET_IMAGE_COMPRESSION_ZSTD8LE,
                                     256,
                                     256,
-                                    {thumb_write_fn, thumb_write_user}};
+                                    {thumb_write_fn, thumb_write_user},
+                                    {snapshot_tile_known, prj},
+                                    prj->dictionary.cdict};
+
+    // Inserting everything in a single transaction is a lot faster than
+    // letting each row commit on its own. There's no journal to roll back
+    // with, so a failed snapshot keeps whatever got written, same as without
+    // a transaction, and is left for the caller to discard.
+    bool in_tx = exec_write_stmt(prj->db, "begin",
+                                 "opening snapshot transaction", NULL);
+    if (!in_tx) {
+        DP_warn("Snapshot canvas: %s", DP_error());
+    }
+
     DP_reset_image_build_with(cs, &options, snapshot_handle_entry_callback,
                               prj);
 
+    if (in_tx
+        && !exec_write_stmt(prj->db, "commit",
+                            "committing snapshot transaction", NULL)) {
+        DP_warn("Snapshot canvas: %s", DP_error());
+        try_rollback(prj->db);
+        prj->snapshot.state = DP_PROJECT_SNAPSHOT_STATE_ERROR;
+    }
+
     if (prj->snapshot.state != DP_PROJECT_SNAPSHOT_STATE_OK) {
         return DP_PROJECT_SNAPSHOT_CANVAS_ERROR_WRITE;
     }
@@ -1790,6 +2458,7 @@ int DP_project_snapshot_canvas(DP_Project *prj, long long snapshot_id,
 {
     DP_ASSERT(prj);
     DP_ASSERT(snapshot_id > 0LL);
+    project_sync(prj);
     DP_PERF_BEGIN(fn, "save");
     int result =
         snapshot_canvas(prj, snapshot_id, cs, thumb_write_fn, thumb_write_user);
@@ -1805,13 +2474,34 @@ typedef struct DP_ProjectCanvasFromSnapshotLayer {
         DP_TransientLayerGroup *tlg;
     };
     int used;
+    bool visible; // Not hidden itself and not inside of a hidden group.
 } DP_ProjectCanvasFromSnapshotLayer;
 
+typedef enum DP_ProjectCanvasFromSnapshotPass {
+    DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_PREVIEW,
+    DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_REST,
+} DP_ProjectCanvasFromSnapshotPass;
+
+// For progressive loading: the preview pass only decodes priority tiles, the
+// rest pass takes those from the preview canvas and decodes everything else.
+typedef struct DP_ProjectCanvasFromSnapshotPriority {
+    DP_ProjectCanvasFromSnapshotPass pass;
+    const DP_Rect *area; // In pixels, null means the whole canvas.
+    int preview_layer_count;
+    DP_LayerContent **preview_lcs; // Borrowed from the preview canvas state.
+} DP_ProjectCanvasFromSnapshotPriority;
+
 typedef struct DP_ProjectCanvasFromSnapshotContext
     DP_ProjectCanvasFromSnapshotContext;
 
+typedef struct DP_ProjectCanvasFromSnapshotDictionary {
+    long long id;
+    ZSTD_DDict *ddict;
+} DP_ProjectCanvasFromSnapshotDictionary;
+
 typedef struct DP_ProjectCanvasFromSnapshotTileJobHeader {
     DP_ProjectCanvasFromSnapshotContext *c;
+    const ZSTD_DDict *ddict;
     int layer_index;
     int tile_index;
     unsigned int context_id;
@@ -1835,9 +2525,12 @@ struct DP_ProjectCanvasFromSnapshotContext {
     DP_TransientCanvasState *tcs;
     DP_SplitTile8 **split_buffers;
     ZSTD_DCtx **zstd_contexts;
+    DP_ProjectCanvasFromSnapshotDictionary *dictionaries;
     DP_ProjectCanvasFromSnapshotLayer *layers;
+    DP_ProjectCanvasFromSnapshotPriority *priority;
     long long snapshot_id;
     unsigned int snapshot_flags;
+    int dictionary_count;
     int layer_count;
     int root_layer_count;
     int annotation_count;
@@ -1848,9 +2541,9 @@ static void cfs_tile_job(void *element, int thread_index)
 {
     DP_ProjectCanvasFromSnapshotTileJob *job = element;
     DP_ProjectCanvasFromSnapshotContext *c = job->header.c;
-    DP_Tile *t = DP_tile_new_from_split_delta_zstd8le_with(
-        &c->zstd_contexts[thread_index], c->split_buffers[thread_index], 0,
-        job->data, job->header.size);
+    DP_Tile *t = DP_tile_new_from_split_delta_zstd8le_with_dictionary(
+        &c->zstd_contexts[thread_index], job->header.ddict,
+        c->split_buffers[thread_index], 0, job->data, job->header.size);
 
     int layer_index = job->header.layer_index;
     if (layer_index >= 0) {
@@ -1969,7 +2662,7 @@ static bool cfs_read_metadata(DP_ProjectCanvasFromSnapshotContext *c)
             size_t size = DP_int_to_size(sqlite3_column_bytes(stmt, 1));
             if (data && size >= 4) {
                 DP_ProjectCanvasFromSnapshotTileJobParams params = {
-                    {c, -1, -1, 0, 0, size}, data};
+                    {c, NULL, -1, -1, 0, 0, size}, data};
                 DP_worker_push_with(c->worker, cfs_insert_tile_job, &params);
             }
             break;
@@ -2192,6 +2885,8 @@ static bool cfs_read_layer(DP_ProjectCanvasFromSnapshotContext *c,
 
     DP_ProjectCanvasFromSnapshotLayer *parent_layer =
         cfs_read_parent_layer(c, stmt, layer_index);
+    layer->visible = !(flags & DP_PROJECT_SNAPSHOT_LAYER_FLAG_HIDDEN)
+                  && (!parent_layer || parent_layer->visible);
     DP_TransientLayerPropsList *parent_tlpl;
     DP_TransientLayerList *parent_tll;
     int index_to_set;
@@ -2320,13 +3015,176 @@ static bool cfs_read_layers(DP_ProjectCanvasFromSnapshotContext *c)
     return !error;
 }
 
+static bool cfs_has_tile_chunks(DP_Project *prj)
+{
+    // Read-only opens don't apply migrations, so the project may predate them.
+    int count;
+    if (exec_int_stmt(prj->db,
+                      "select count(*) from "
+                      "pragma_table_info('snapshot_tiles') "
+                      "where name = 'chunk_id'",
+                      0, &count, NULL)) {
+        return count != 0;
+    }
+    else {
+        DP_warn("Error checking for tile chunks: %s", DP_error());
+        return false;
+    }
+}
+
+static bool cfs_has_dictionaries(DP_Project *prj)
+{
+    int count;
+    if (exec_int_stmt(prj->db,
+                      "select count(*) from "
+                      "pragma_table_info('snapshot_tile_chunks') "
+                      "where name = 'dictionary_id'",
+                      0, &count, NULL)) {
+        return count != 0;
+    }
+    else {
+        DP_warn("Error checking for dictionaries: %s", DP_error());
+        return false;
+    }
+}
+
+// Only loads the dictionaries that this snapshot's tiles actually use, which
+// is usually just one.
+static bool cfs_read_dictionaries(DP_ProjectCanvasFromSnapshotContext *c)
+{
+    DP_Project *prj = c->prj;
+    sqlite3_stmt *stmt = ps_prepare_ephemeral(
+        prj, "select dictionary_id, content from snapshot_dictionaries "
+             "where dictionary_id in (select c.dictionary_id from "
+             "snapshot_tiles t join snapshot_tile_chunks c on c.chunk_id = "
+             "t.chunk_id where t.snapshot_id = ?)");
+    if (!stmt) {
+        return false;
+    }
+
+    if (!ps_bind_int64(prj, stmt, 1, c->snapshot_id)) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+
+    bool error;
+    while (ps_exec_step(prj, stmt, &error)) {
+        long long dictionary_id = sqlite3_column_int64(stmt, 0);
+        const unsigned char *content = sqlite3_column_blob(stmt, 1);
+        size_t size = DP_int_to_size(sqlite3_column_bytes(stmt, 1));
+        ZSTD_DDict *ddict =
+            content ? DP_decompress_zstd_dictionary_new(content, size) : NULL;
+        if (ddict) {
+            int index = c->dictionary_count++;
+            c->dictionaries =
+                DP_realloc(c->dictionaries, sizeof(*c->dictionaries)
+                                                * DP_int_to_size(index + 1));
+            c->dictionaries[index] =
+                (DP_ProjectCanvasFromSnapshotDictionary){dictionary_id, ddict};
+        }
+        else {
+            DP_warn("Error loading dictionary %lld: %s", dictionary_id,
+                    content ? DP_error() : "no content");
+        }
+    }
+    sqlite3_finalize(stmt);
+    return !error;
+}
+
+static bool cfs_find_dictionary(DP_ProjectCanvasFromSnapshotContext *c,
+                                long long dictionary_id,
+                                const ZSTD_DDict **out_ddict)
+{
+    for (int i = 0; i < c->dictionary_count; ++i) {
+        if (c->dictionaries[i].id == dictionary_id) {
+            *out_ddict = c->dictionaries[i].ddict;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool cfs_tile_run_intersects(const DP_Rect *tile_area, int xtiles,
+                                    int tile_index, int repeat)
+{
+    for (int i = tile_index; i <= tile_index + repeat; ++i) {
+        int x = i % xtiles;
+        int y = i / xtiles;
+        if (y > tile_area->y2) {
+            return false;
+        }
+        else if (y >= tile_area->y1 && x >= tile_area->x1
+                 && x <= tile_area->x2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static DP_Rect cfs_priority_tile_area(DP_ProjectCanvasFromSnapshotContext *c)
+{
+    int width = DP_transient_canvas_state_width(c->tcs);
+    int height = DP_transient_canvas_state_height(c->tcs);
+    DP_Rect canvas_area = DP_rect_make(0, 0, width, height);
+    const DP_Rect *area = c->priority->area;
+    DP_Rect clamped =
+        area ? DP_rect_intersection(*area, canvas_area) : canvas_area;
+    if (DP_rect_valid(clamped)) {
+        return (DP_Rect){clamped.x1 / DP_TILE_SIZE, clamped.y1 / DP_TILE_SIZE,
+                         clamped.x2 / DP_TILE_SIZE, clamped.y2 / DP_TILE_SIZE};
+    }
+    else {
+        return clamped; // Doesn't intersect the canvas, nothing has priority.
+    }
+}
+
+// Takes the tiles already decoded by the preview pass, returns false if there
+// are none to take, in which case they need to be decoded normally.
+static bool cfs_take_preview_tiles(DP_ProjectCanvasFromSnapshotPriority *p,
+                                   DP_TransientLayerContent *tlc,
+                                   int layer_index, int tile_index, int repeat)
+{
+    DP_LayerContent *lc =
+        layer_index < p->preview_layer_count ? p->preview_lcs[layer_index]
+                                             : NULL;
+    if (lc) {
+        for (int i = tile_index; i <= tile_index + repeat; ++i) {
+            DP_transient_layer_content_tile_set_noinc(
+                tlc,
+                DP_tile_incref_nullable(
+                    DP_layer_content_tile_at_index_noinc(lc, i)),
+                i);
+        }
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
 static bool cfs_read_tiles(DP_ProjectCanvasFromSnapshotContext *c,
                            size_t max_pixel_size)
 {
     DP_Project *prj = c->prj;
-    sqlite3_stmt *stmt = ps_prepare_ephemeral(
-        prj, "select layer_index, tile_index, context_id, repeat, pixels "
-             "from snapshot_tiles where snapshot_id = ?");
+    const char *sql;
+    if (cfs_has_dictionaries(prj)) {
+        sql = "select t.layer_index, t.tile_index, t.context_id, t.repeat, "
+              "coalesce(c.pixels, t.pixels), c.dictionary_id from "
+              "snapshot_tiles t left join snapshot_tile_chunks c on "
+              "c.chunk_id = t.chunk_id where t.snapshot_id = ?";
+    }
+    else if (cfs_has_tile_chunks(prj)) {
+        sql = "select t.layer_index, t.tile_index, t.context_id, t.repeat, "
+              "coalesce(c.pixels, t.pixels), null from snapshot_tiles t left "
+              "join snapshot_tile_chunks c on c.chunk_id = t.chunk_id "
+              "where t.snapshot_id = ?";
+    }
+    else {
+        sql = "select layer_index, tile_index, context_id, repeat, pixels, "
+              "null from snapshot_tiles where snapshot_id = ?";
+    }
+
+    sqlite3_stmt *stmt = ps_prepare_ephemeral(prj, sql);
     if (!stmt) {
         return false;
     }
@@ -2341,6 +3199,11 @@ static bool cfs_read_tiles(DP_ProjectCanvasFromSnapshotContext *c,
         DP_tile_total_round(DP_transient_canvas_state_width(c->tcs),
                             DP_transient_canvas_state_height(c->tcs));
 
+    DP_ProjectCanvasFromSnapshotPriority *priority = c->priority;
+    int xtiles = DP_tile_count_round(DP_transient_canvas_state_width(c->tcs));
+    DP_Rect tile_area =
+        priority ? cfs_priority_tile_area(c) : (DP_Rect){0, 0, -1, -1};
+
     bool error;
     while (ps_exec_step(prj, stmt, &error)) {
         int layer_index = sqlite3_column_int(stmt, 0);
@@ -2386,6 +3249,27 @@ static bool cfs_read_tiles(DP_ProjectCanvasFromSnapshotContext *c,
             repeat = max_repeat;
         }
 
+        // Check this before touching the pixels, so that SQLite doesn't need
+        // to load them for tiles that get skipped.
+        if (priority) {
+            bool is_priority =
+                layer->visible
+                && cfs_tile_run_intersects(&tile_area, xtiles, tile_index,
+                                           repeat);
+            if (priority->pass
+                == DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_PREVIEW) {
+                if (!is_priority) {
+                    continue;
+                }
+            }
+            else if (is_priority
+                     && cfs_take_preview_tiles(priority, layer->tlc,
+                                               layer_index, tile_index,
+                                               repeat)) {
+                continue;
+            }
+        }
+
         const unsigned char *pixels = sqlite3_column_blob(stmt, 4);
         if (!pixels) {
             DP_warn("Tile index %d of layer %d has null pixel data", tile_index,
@@ -2405,6 +3289,16 @@ static bool cfs_read_tiles(DP_ProjectCanvasFromSnapshotContext *c,
             continue;
         }
 
+        const ZSTD_DDict *ddict = NULL;
+        if (sqlite3_column_type(stmt, 5) != SQLITE_NULL) {
+            long long dictionary_id = sqlite3_column_int64(stmt, 5);
+            if (!cfs_find_dictionary(c, dictionary_id, &ddict)) {
+                DP_warn("Tile index %d of layer %d has unknown dictionary %lld",
+                        tile_index, layer_index, dictionary_id);
+                continue;
+            }
+        }
+
         DP_TransientLayerContent *tlc = layer->tlc;
         if (size == 4
             && memcmp(pixels, (unsigned char[]){0, 0, 0, 0}, 4) == 0) {
@@ -2415,8 +3309,8 @@ static bool cfs_read_tiles(DP_ProjectCanvasFromSnapshotContext *c,
         }
         else {
             DP_ProjectCanvasFromSnapshotTileJobParams params = {
-                {c, layer_index, tile_index, DP_int_to_uint(context_id), repeat,
-                 size},
+                {c, ddict, layer_index, tile_index, DP_int_to_uint(context_id),
+                 repeat, size},
                 pixels};
             DP_worker_push_with(c->worker, cfs_insert_tile_job, &params);
         }
@@ -2829,6 +3723,10 @@ cfs_context_dispose(DP_ProjectCanvasFromSnapshotContext *c,
         DP_free(c->zstd_contexts);
         DP_free(c->split_buffers);
     }
+    for (int i = 0; i < c->dictionary_count; ++i) {
+        DP_decompress_zstd_dictionary_free(c->dictionaries[i].ddict);
+    }
+    DP_free(c->dictionaries);
     DP_free(c->layers);
     DP_CanvasState *cs;
     if (keep_canvas_state) {
@@ -2858,17 +3756,16 @@ static size_t get_tile_job_size_alignment(size_t max_pixel_size)
     }
 }
 
-DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
-                                                DP_DrawContext *dc,
-                                                long long snapshot_id)
+static DP_CanvasState *
+canvas_from_snapshot(DP_Project *prj, DP_DrawContext *dc, long long snapshot_id,
+                     DP_ProjectCanvasFromSnapshotPriority *priority)
 {
-    DP_ASSERT(prj);
-    DP_ASSERT(snapshot_id);
     DP_PERF_BEGIN(fn, "load");
 
     DP_PERF_BEGIN(setup, "load:setup");
     DP_ProjectCanvasFromSnapshotContext c = {
-        prj, NULL, NULL, NULL, NULL, NULL, snapshot_id, 0, 0, 0, 0, 0};
+        prj, NULL, NULL, NULL, NULL, NULL, NULL, priority, snapshot_id, 0, 0, 0,
+        0, 0, 0};
     if (!cfs_read_header(&c)) {
         return NULL;
     }
@@ -2912,7 +3809,8 @@ DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
         DP_PERF_BEGIN(layers, "load:layers");
         c.layers = DP_malloc(sizeof(*c.layers) * DP_int_to_size(c.layer_count));
         for (int i = 0; i < c.layer_count; ++i) {
-            c.layers[i] = (DP_ProjectCanvasFromSnapshotLayer){NULL, {NULL}, -1};
+            c.layers[i] =
+                (DP_ProjectCanvasFromSnapshotLayer){NULL, {NULL}, -1, false};
         }
         DP_transient_canvas_state_transient_layers(c.tcs, c.root_layer_count);
         DP_transient_canvas_state_transient_layer_props(c.tcs,
@@ -2924,6 +3822,9 @@ DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
         DP_PERF_END(layers);
 
         DP_PERF_BEGIN(tiles, "load:tiles");
+        if (cfs_has_dictionaries(prj) && !cfs_read_dictionaries(&c)) {
+            DP_warn("Error reading dictionaries: %s", DP_error());
+        }
         if (!cfs_read_tiles(&c, max_pixel_size)) {
             DP_warn("Error reading tiles: %s", DP_error());
         }
@@ -2954,15 +3855,70 @@ DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
     DP_transient_canvas_state_timeline_cleanup(c.tcs);
     DP_PERF_END(cleanup);
 
+    // Persisting happens in place, so these pointers stay valid for as long as
+    // the resulting canvas state is alive.
+    if (priority
+        && priority->pass == DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_PREVIEW) {
+        int layer_count = c.layers ? c.layer_count : 0;
+        priority->preview_layer_count = layer_count;
+        priority->preview_lcs =
+            DP_malloc(sizeof(*priority->preview_lcs)
+                      * DP_int_to_size(DP_max_int(layer_count, 1)));
+        for (int i = 0; i < layer_count; ++i) {
+            DP_ProjectCanvasFromSnapshotLayer *layer = &c.layers[i];
+            priority->preview_lcs[i] = layer->tlp && layer->used < 0
+                                         ? (DP_LayerContent *)layer->tlc
+                                         : NULL;
+        }
+    }
+
     DP_CanvasState *cs = cfs_context_dispose(&c, true);
     DP_PERF_END(fn);
     return cs;
 }
 
+DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
+                                                DP_DrawContext *dc,
+                                                long long snapshot_id)
+{
+    DP_ASSERT(prj);
+    DP_ASSERT(snapshot_id);
+    project_sync(prj);
+    return canvas_from_snapshot(prj, dc, snapshot_id, NULL);
+}
+
+DP_CanvasState *DP_project_canvas_from_snapshot_progressive(
+    DP_Project *prj, DP_DrawContext *dc, long long snapshot_id,
+    const DP_Rect *area_or_null, void (*preview_fn)(void *, DP_CanvasState *),
+    void *user)
+{
+    DP_ASSERT(prj);
+    DP_ASSERT(snapshot_id);
+    DP_ASSERT(preview_fn);
+    project_sync(prj);
+
+    DP_ProjectCanvasFromSnapshotPriority priority = {
+        DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_PREVIEW, area_or_null, 0, NULL};
+    DP_CanvasState *preview_cs =
+        canvas_from_snapshot(prj, dc, snapshot_id, &priority);
+    if (!preview_cs) {
+        return NULL;
+    }
+
+    preview_fn(user, preview_cs);
+
+    priority.pass = DP_PROJECT_CANVAS_FROM_SNAPSHOT_PASS_REST;
+    DP_CanvasState *cs = canvas_from_snapshot(prj, dc, snapshot_id, &priority);
+    DP_free(priority.preview_lcs);
+    DP_canvas_state_decref(preview_cs);
+    return cs;
+}
+
 DP_CanvasState *DP_project_canvas_from_latest_snapshot(DP_Project *prj,
                                                        DP_DrawContext *dc)
 {
     DP_ASSERT(prj);
+    project_sync(prj);
     sqlite3_stmt *stmt = ps_prepare_ephemeral(
         prj,
         "select snapshot_id from snapshots order by taken_at desc limit 1");
@@ -2991,6 +3947,28 @@ DP_CanvasState *DP_project_canvas_from_latest_snapshot(DP_Project *prj,
 }
 
 
+static int canvas_save_snapshot(DP_Project *prj, DP_CanvasState *cs,
+                                bool (*thumb_write_fn)(void *, DP_Image *,
+                                                       DP_Output *),
+                                void *thumb_write_user,
+                                long long *out_snapshot_id)
+{
+    long long snapshot_id =
+        project_snapshot_open(prj, DP_PROJECT_SNAPSHOT_FLAG_CANVAS);
+    if (snapshot_id <= 0LL) {
+        return DP_PROJECT_CANVAS_SAVE_ERROR_OPEN_SNAPSHOT;
+    }
+
+    *out_snapshot_id = snapshot_id;
+    int snapshot_result = DP_project_snapshot_canvas(
+        prj, snapshot_id, cs, thumb_write_fn, thumb_write_user);
+    if (snapshot_result != 0) {
+        return snapshot_result;
+    }
+
+    return DP_project_snapshot_finish(prj, snapshot_id);
+}
+
 int DP_project_canvas_save(DP_CanvasState *cs, const char *path,
                            bool (*thumb_write_fn)(void *, DP_Image *,
                                                   DP_Output *),
@@ -3006,33 +3984,232 @@ int DP_project_canvas_save(DP_CanvasState *cs, const char *path,
         return open_result.error;
     }
 
-    long long snapshot_id =
-        project_snapshot_open(prj, DP_PROJECT_SNAPSHOT_FLAG_CANVAS);
-    if (snapshot_id <= 0LL) {
+    long long snapshot_id = 0LL;
+    int save_result = canvas_save_snapshot(prj, cs, thumb_write_fn,
+                                           thumb_write_user, &snapshot_id);
+    if (save_result != 0) {
         project_close(prj, true);
-        return DP_PROJECT_CANVAS_SAVE_ERROR_OPEN_SNAPSHOT;
+        return save_result;
     }
 
-    int snapshot_result = DP_project_snapshot_canvas(
-        prj, snapshot_id, cs, thumb_write_fn, thumb_write_user);
-    if (snapshot_result != 0) {
+    if (!project_close(prj, false)) {
+        return DP_PROJECT_CANVAS_SAVE_ERROR_CLOSE_PROJECT;
+    }
+
+    return 0;
+}
+
+
+struct DP_ProjectSaveState {
+    long long snapshot_id;
+    double taken_at;
+    int incremental_saves;
+    DP_ProjectTileChunk *chunks;
+};
+
+DP_ProjectSaveState *DP_project_save_state_new(void)
+{
+    DP_ProjectSaveState *pss = DP_malloc(sizeof(*pss));
+    *pss = (DP_ProjectSaveState){0LL, 0.0, 0, NULL};
+    return pss;
+}
+
+static void save_state_clear(DP_ProjectSaveState *pss)
+{
+    pss->snapshot_id = 0LL;
+    pss->taken_at = 0.0;
+    pss->incremental_saves = 0;
+    tile_chunks_clear(&pss->chunks);
+}
+
+void DP_project_save_state_free(DP_ProjectSaveState *pss)
+{
+    if (pss) {
+        save_state_clear(pss);
+        DP_free(pss);
+    }
+}
+
+static bool read_latest_snapshot(DP_Project *prj, long long *out_snapshot_id,
+                                 double *out_taken_at)
+{
+    sqlite3_stmt *stmt = ps_prepare_ephemeral(
+        prj, "select snapshot_id, taken_at from snapshots "
+             "order by taken_at desc limit 1");
+    if (!stmt) {
+        return false;
+    }
+
+    bool error;
+    bool found = ps_exec_step(prj, stmt, &error);
+    if (found) {
+        *out_snapshot_id = sqlite3_column_int64(stmt, 0);
+        *out_taken_at = sqlite3_column_double(stmt, 1);
+    }
+    else if (!error) {
+        DP_error_set("No snapshot found");
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Takes the chunks of the snapshot just written so that the next save can
+// reference them, the project is about to be closed anyway.
+static bool save_state_take_known(DP_ProjectSaveState *pss, DP_Project *prj,
+                                  long long snapshot_id)
+{
+    long long latest_snapshot_id;
+    double taken_at;
+    if (!read_latest_snapshot(prj, &latest_snapshot_id, &taken_at)) {
+        return false;
+    }
+
+    if (latest_snapshot_id != snapshot_id) {
+        DP_error_set("Latest snapshot %lld is not the saved one %lld",
+                     latest_snapshot_id, snapshot_id);
+        return false;
+    }
+
+    pss->snapshot_id = snapshot_id;
+    pss->taken_at = taken_at;
+    // A canvas without any tiles doesn't have any known chunks.
+    if (prj->known.snapshot_id == snapshot_id) {
+        pss->chunks = prj->known.chunks;
+        prj->known.snapshot_id = 0LL;
+        prj->known.chunks = NULL;
+    }
+    return true;
+}
+
+// The file may have been replaced or written to by someone else since, in
+// which case the chunk ids we know about are meaningless.
+static bool save_state_matches(DP_ProjectSaveState *pss, DP_Project *prj)
+{
+    long long snapshot_id;
+    double taken_at;
+    return read_latest_snapshot(prj, &snapshot_id, &taken_at)
+        && snapshot_id == pss->snapshot_id && taken_at == pss->taken_at;
+}
+
+static int canvas_save_full(DP_CanvasState *cs, const char *path,
+                            DP_ProjectSaveState *pss,
+                            bool (*thumb_write_fn)(void *, DP_Image *,
+                                                   DP_Output *),
+                            void *thumb_write_user)
+{
+    DP_ProjectOpenResult open_result =
+        project_open(path, DP_PROJECT_OPEN_TRUNCATE, true);
+    DP_Project *prj = open_result.project;
+    if (!prj) {
+        return open_result.error;
+    }
+
+    long long snapshot_id = 0LL;
+    int save_result = canvas_save_snapshot(prj, cs, thumb_write_fn,
+                                           thumb_write_user, &snapshot_id);
+    if (save_result != 0) {
         project_close(prj, true);
-        return snapshot_result;
+        return save_result;
+    }
+
+    if (!save_state_take_known(pss, prj, snapshot_id)) {
+        DP_warn("Full save: %s", DP_error());
+    }
+
+    if (!project_close(prj, false)) {
+        save_state_clear(pss);
+        return DP_PROJECT_CANVAS_SAVE_ERROR_CLOSE_PROJECT;
+    }
+
+    return 0;
+}
+
+// Returns 1 if the file doesn't match the save state, so the caller should
+// fall back to a full save.
+static int canvas_save_incremental(DP_CanvasState *cs, const char *path,
+                                   DP_ProjectSaveState *pss,
+                                   bool (*thumb_write_fn)(void *, DP_Image *,
+                                                          DP_Output *),
+                                   void *thumb_write_user)
+{
+    DP_ProjectOpenResult open_result =
+        project_open(path, DP_PROJECT_OPEN_EXISTING, true);
+    DP_Project *prj = open_result.project;
+    if (!prj) {
+        DP_warn("Incremental save: %s", DP_error());
+        return 1;
     }
 
-    int finish_result = DP_project_snapshot_finish(prj, snapshot_id);
-    if (finish_result != 0) {
+    if (!save_state_matches(pss, prj)) {
+        project_close(prj, true);
+        return 1;
+    }
+
+    prj->known.snapshot_id = pss->snapshot_id;
+    prj->known.chunks = pss->chunks;
+    long long previous_snapshot_id = pss->snapshot_id;
+    pss->snapshot_id = 0LL;
+    pss->chunks = NULL;
+
+    long long snapshot_id = 0LL;
+    int save_result = canvas_save_snapshot(prj, cs, thumb_write_fn,
+                                           thumb_write_user, &snapshot_id);
+    if (save_result != 0) {
+        // Don't leave a broken snapshot around, loading picks the latest one.
+        if (snapshot_id > 0LL
+            && DP_project_snapshot_discard(prj, snapshot_id) < 0) {
+            DP_warn("Incremental save discard: %s", DP_error());
+        }
         project_close(prj, true);
-        return finish_result;
+        save_state_clear(pss);
+        return save_result;
+    }
+
+    // Deletes the previous snapshot's rows and any chunks only it used.
+    if (DP_project_snapshot_discard(prj, previous_snapshot_id) < 0) {
+        DP_warn("Incremental save discard: %s", DP_error());
+    }
+
+    if (!save_state_take_known(pss, prj, snapshot_id)) {
+        DP_warn("Incremental save: %s", DP_error());
+        save_state_clear(pss);
     }
 
     if (!project_close(prj, false)) {
+        save_state_clear(pss);
         return DP_PROJECT_CANVAS_SAVE_ERROR_CLOSE_PROJECT;
     }
 
+    ++pss->incremental_saves;
     return 0;
 }
 
+int DP_project_canvas_save_incremental(DP_CanvasState *cs, const char *path,
+                                       DP_ProjectSaveState *pss,
+                                       bool (*thumb_write_fn)(void *,
+                                                              DP_Image *,
+                                                              DP_Output *),
+                                       void *thumb_write_user)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(path);
+    DP_ASSERT(pss);
+
+    // Every so often, rewrite the whole file to get rid of the space left
+    // behind by discarded snapshots.
+    if (pss->snapshot_id > 0LL
+        && pss->incremental_saves < DP_PROJECT_SAVE_COMPACT_INTERVAL) {
+        int result = canvas_save_incremental(cs, path, pss, thumb_write_fn,
+                                             thumb_write_user);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    save_state_clear(pss);
+    return canvas_save_full(cs, path, pss, thumb_write_fn, thumb_write_user);
+}
+
 int DP_project_canvas_load(DP_DrawContext *dc, const char *path,
                            DP_CanvasState **out_cs)
 {
@@ -3129,6 +4306,7 @@ bool DP_project_dump(DP_Project *prj, DP_Output *output)
 {
     DP_ASSERT(prj);
     DP_ASSERT(output);
+    project_sync(prj);
     return DP_OUTPUT_PRINT_LITERAL(output, "begin project dump\n")
         && dump_query(prj, output, "pragma application_id")
         && dump_query(prj, output, "pragma user_version")
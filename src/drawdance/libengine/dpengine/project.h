@@ -8,13 +8,14 @@ typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
 typedef struct DP_Message DP_Message;
 typedef struct DP_Output DP_Output;
+typedef struct DP_Rect DP_Rect;
 
 
 #define DP_PROJECT_APPLICATION_ID 520585024
 #define DP_PROJECT_USER_VERSION   1
 
 #define DP_PROJECT_CANVAS_APPLICATION_ID 520585025
-#define DP_PROJECT_CANVAS_USER_VERSION   1
+#define DP_PROJECT_CANVAS_USER_VERSION   2
 
 #define DP_PROJECT_ERROR_IN(VALUE, CATEGORY) \
     (VALUE <= CATEGORY##_UNKNOWN && VALUE > CATEGORY##_UNKNOWN - 100)
@@ -114,8 +115,12 @@ typedef struct DP_Output DP_Output;
 #define DP_PROJECT_SNAPSHOT_FLAG_PERSISTENT (1u << 1u)
 #define DP_PROJECT_SNAPSHOT_FLAG_CANVAS     (1u << 2u)
 
+// Number of incremental saves after which the next one rewrites the file.
+#define DP_PROJECT_SAVE_COMPACT_INTERVAL 16
+
 
 typedef struct DP_Project DP_Project;
+typedef struct DP_ProjectSaveState DP_ProjectSaveState;
 
 typedef enum DP_ProjectCheckType {
     DP_PROJECT_CHECK_NONE,    // Not a project file.
@@ -181,6 +186,29 @@ int DP_project_session_close(DP_Project *prj, unsigned int flags_to_set);
 int DP_project_message_record(DP_Project *prj, DP_Message *msg,
                               unsigned int flags);
 
+// Makes DP_project_message_record hand messages off to a background thread
+// instead of writing them immediately. That thread writes whatever messages
+// have queued up, but at most max_batch_size of them, in a single transaction.
+// If max_queued messages are waiting, recording further ones blocks until
+// there's space again. Every other function that touches the project waits for
+// the queue to be written out first. Write errors on the background thread are
+// warned about and then reported by the next DP_project_message_record call
+// and by DP_project_message_record_async_stop.
+//
+// Regarding durability: project files don't sync to disk, so a power loss or
+// operating system crash can lose recent data either way. If the application
+// crashes, the messages still in the queue are lost, but everything already
+// committed survives, since each transaction is atomic. Returns false on
+// failure, in which case messages keep getting recorded immediately.
+bool DP_project_message_record_async_start(DP_Project *prj, int max_queued,
+                                           int max_batch_size);
+
+// Writes out all queued messages and stops the background thread. Returns
+// false if there were any unreported write errors. Calling this when there's
+// no background thread does nothing and returns true. Closing the project
+// calls this automatically.
+bool DP_project_message_record_async_stop(DP_Project *prj);
+
 
 // Opens a snapshot to record messages to. Returns a positive snapshot id on
 // success and a negative DP_PROJECT_SNAPSHOT_OPEN_ERROR_* value on failure.
@@ -220,6 +248,19 @@ DP_CanvasState *DP_project_canvas_from_snapshot(DP_Project *prj,
 DP_CanvasState *DP_project_canvas_from_latest_snapshot(DP_Project *prj,
                                                        DP_DrawContext *dc);
 
+// Loads a snapshot in two passes, so that something can be shown early. The
+// first pass loads the structure, but only decodes the tiles of visible layers
+// that intersect the given area in canvas pixels, or the whole canvas if it's
+// null. That incomplete canvas state is passed to preview_fn, which must incref
+// it if it wants to keep it around. The second pass then decodes the remaining
+// tiles, taking the ones it already has from the preview, and the complete
+// canvas state is returned. Returns null on failure, when that happens during
+// the first pass, preview_fn is never called.
+DP_CanvasState *DP_project_canvas_from_snapshot_progressive(
+    DP_Project *prj, DP_DrawContext *dc, long long snapshot_id,
+    const DP_Rect *area_or_null, void (*preview_fn)(void *, DP_CanvasState *),
+    void *user);
+
 
 // Returns 0 on success and a negative DP_PROJECT_OPEN_ERROR_*,
 // DP_PROJECT_SNAPSHOT_CANVAS_ERROR_*, DP_PROJECT_SNAPSHOT_FINISH_ERROR_* or
@@ -230,6 +271,24 @@ int DP_project_canvas_save(DP_CanvasState *cs, const char *path,
                                                   DP_Output *),
                            void *thumb_write_user);
 
+// State kept between incremental saves of the same canvas to the same path.
+// Holds on to the tiles of the last save, so free it when no longer needed.
+DP_ProjectSaveState *DP_project_save_state_new(void);
+
+void DP_project_save_state_free(DP_ProjectSaveState *pss);
+
+// Like DP_project_canvas_save, but if the file still contains the snapshot
+// last saved with the given state, only tiles that changed since then are
+// compressed and written, the rest reference the existing data. Otherwise,
+// and every DP_PROJECT_SAVE_COMPACT_INTERVAL saves, the file is rewritten in
+// full. On failure, the state is reset and the next save is a full one.
+int DP_project_canvas_save_incremental(DP_CanvasState *cs, const char *path,
+                                       DP_ProjectSaveState *pss,
+                                       bool (*thumb_write_fn)(void *,
+                                                              DP_Image *,
+                                                              DP_Output *),
+                                       void *thumb_write_user);
+
 // Returns 0 on success and a negative DP_PROJECT_OPEN_ERROR_* or
 // DP_PROJECT_CANVAS_LOAD_ERROR_* value on failure. The out_cs parameter is
 // required, it will be set on success and left untouched on failure.
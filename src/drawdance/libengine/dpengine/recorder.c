@@ -20,10 +20,14 @@
  * License, version 3. See 3rdparty/licenses/drawpile/COPYING for details.
  */
 #include "recorder.h"
+#include "canvas_history.h"
 #include "canvas_state.h"
+#include "draw_context.h"
 #include "snapshots.h"
 #include <dpcommon/atomic.h>
+#include <dpcommon/binary.h>
 #include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
 #include <dpcommon/output.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
@@ -31,12 +35,16 @@
 #include <dpmsg/binary_writer.h>
 #include <dpmsg/message.h>
 #include <dpmsg/message_queue.h>
+#include <dpmsg/reset_stream.h>
 #include <dpmsg/text_writer.h>
 #include <parson.h>
 
 #define MIN_INTERVAL 500
 #define MAX_INTERVAL UINT16_MAX
 
+// Leaves room for the kind byte at the start of the data message body.
+#define KEYFRAME_CHUNK_MAX_LENGTH (DP_MSG_DATA_BODY_MAX_SIZE - 1)
+
 struct DP_Recorder {
     DP_RecorderType type;
     struct {
@@ -55,6 +63,14 @@ struct DP_Recorder {
     DP_Semaphore *sem;
     DP_Thread *thread;
     char *error;
+    struct {
+        int interval;
+        DP_AclState *acls;
+        DP_CanvasHistory *ch;
+        DP_DrawContext *dc;
+        long long message_count;
+        size_t last_offset;
+    } keyframes;
 };
 
 struct DP_RecorderThreadArgs {
@@ -62,6 +78,16 @@ struct DP_RecorderThreadArgs {
     DP_CanvasState *cs_or_null;
 };
 
+struct DP_RecorderKeyframeChunk {
+    unsigned char kind;
+    const unsigned char *data;
+};
+
+struct DP_RecorderKeyframeContext {
+    DP_ResetStreamProducer *rsp;
+    bool ok;
+};
+
 
 static bool set_header_pair(JSON_Object *obj, const char *key,
                             const char *value)
@@ -141,6 +167,177 @@ static bool write_header(DP_Recorder *r)
     return ok;
 }
 
+static bool handle_error(DP_Recorder *r)
+{
+    DP_atomic_set(&r->running, 0);
+    r->error = DP_strdup(DP_error());
+    return false;
+}
+
+static void set_keyframe_body(size_t size, unsigned char *out, void *user)
+{
+    const struct DP_RecorderKeyframeChunk *chunk = user;
+    out[0] = chunk->kind;
+    memcpy(out + 1, chunk->data, size - 1);
+}
+
+static bool write_keyframe_chunk(DP_Recorder *r, unsigned char kind,
+                                 const unsigned char *data, size_t size)
+{
+    struct DP_RecorderKeyframeChunk chunk = {kind, data};
+    DP_Message *msg =
+        DP_msg_data_new(0, DP_RECORDER_KEYFRAME_DATA_TYPE, 0,
+                        set_keyframe_body, size + 1, &chunk);
+    bool ok = DP_binary_writer_write_message(r->binary_writer, msg) != 0;
+    DP_message_decref(msg);
+    return ok;
+}
+
+static bool write_keyframe_snapshot(DP_Recorder *r, DP_Message *msg)
+{
+    size_t size;
+    const unsigned char *data =
+        DP_msg_reset_stream_data(DP_message_internal(msg), &size);
+    for (size_t offset = 0; offset < size;
+         offset += KEYFRAME_CHUNK_MAX_LENGTH) {
+        size_t remaining = size - offset;
+        size_t length = remaining < KEYFRAME_CHUNK_MAX_LENGTH
+                          ? remaining
+                          : KEYFRAME_CHUNK_MAX_LENGTH;
+        if (!write_keyframe_chunk(r, DP_RECORDER_KEYFRAME_KIND_SNAPSHOT,
+                                  data + offset, length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool push_keyframe_message_dec(void *user, DP_Message *msg)
+{
+    struct DP_RecorderKeyframeContext *c = user;
+    if (c->ok) {
+        c->ok = DP_reset_stream_producer_push(c->rsp, msg);
+    }
+    DP_message_decref(msg);
+    return c->ok;
+}
+
+static void push_keyframe_reset_image_message(void *user, DP_Message *msg)
+{
+    push_keyframe_message_dec(user, msg);
+}
+
+static bool push_keyframe_state(void *user, DP_CanvasState *cs)
+{
+    struct DP_RecorderKeyframeContext *c = user;
+    DP_reset_image_build(cs, 0, false, push_keyframe_reset_image_message, c);
+    return c->ok;
+}
+
+static bool push_keyframe_history(DP_Recorder *r, DP_ResetStreamProducer *rsp)
+{
+    // Same contents as a snapshot in a separately built index: the oldest
+    // reachable canvas state, the history since then and the permissions.
+    struct DP_RecorderKeyframeContext c = {rsp, true};
+    return push_keyframe_message_dec(
+               &c, DP_acl_state_msg_feature_access_all_new(0))
+        && push_keyframe_message_dec(
+               &c, DP_acl_state_msg_feature_limits_none_new(0))
+        && DP_canvas_history_reset_image_new(r->keyframes.ch,
+                                             push_keyframe_state,
+                                             push_keyframe_message_dec, &c)
+        && DP_acl_state_reset_image_build(
+               r->keyframes.acls, 0, DP_ACL_STATE_RESET_IMAGE_RECORDING_FLAGS,
+               NULL, NULL, push_keyframe_message_dec, &c);
+}
+
+static bool write_keyframe(DP_Recorder *r, long long message_index)
+{
+    bool error;
+    size_t snapshot_offset = DP_binary_writer_tell(r->binary_writer, &error);
+    if (error) {
+        return false;
+    }
+
+    DP_ResetStreamProducer *rsp = DP_reset_stream_producer_new(false);
+    if (!rsp) {
+        return false;
+    }
+
+    if (!push_keyframe_history(r, rsp)) {
+        DP_reset_stream_producer_free_discard(rsp);
+        return false;
+    }
+
+    int count;
+    DP_Message **msgs = DP_reset_stream_producer_free_finish(rsp, &count);
+    if (!msgs) {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < count; ++i) {
+        ok = ok && write_keyframe_snapshot(r, msgs[i]);
+        DP_message_decref(msgs[i]);
+    }
+    DP_free(msgs);
+    if (!ok) {
+        return false;
+    }
+
+    size_t keyframe_offset = DP_binary_writer_tell(r->binary_writer, &error);
+    if (error) {
+        return false;
+    }
+
+    unsigned char data[DP_RECORDER_KEYFRAME_BODY_LENGTH - 1];
+    size_t written =
+        DP_write_littleendian_uint32(DP_llong_to_uint32(message_index), data);
+    written += DP_write_littleendian_uint64(DP_size_to_uint64(snapshot_offset),
+                                            data + written);
+    written += DP_write_littleendian_uint64(
+        DP_size_to_uint64(r->keyframes.last_offset), data + written);
+    if (write_keyframe_chunk(r, DP_RECORDER_KEYFRAME_KIND_KEYFRAME, data,
+                             written)) {
+        r->keyframes.last_offset = keyframe_offset;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static bool write_keyframe_trailer(DP_Recorder *r)
+{
+    unsigned char data[DP_RECORDER_KEYFRAME_TRAILER_BODY_LENGTH - 1];
+    size_t written = DP_write_littleendian_uint32(
+        DP_llong_to_uint32(r->keyframes.message_count), data);
+    written += DP_write_littleendian_uint64(
+        DP_size_to_uint64(r->keyframes.last_offset), data + written);
+    memcpy(data + written, DP_RECORDER_KEYFRAME_TRAILER_MAGIC,
+           sizeof(DP_RECORDER_KEYFRAME_TRAILER_MAGIC) - 1);
+    written += sizeof(DP_RECORDER_KEYFRAME_TRAILER_MAGIC) - 1;
+    return write_keyframe_chunk(r, DP_RECORDER_KEYFRAME_KIND_TRAILER, data,
+                                written);
+}
+
+static bool handle_keyframe_message(DP_Recorder *r, DP_Message *msg)
+{
+    // Keep track of the canvas the same way building an index does.
+    bool filtered = DP_acl_state_handle(r->keyframes.acls, msg, false)
+                  & DP_ACL_STATE_FILTERED_BIT;
+    if (!filtered && DP_message_type_command(DP_message_type(msg))) {
+        if (!DP_canvas_history_handle(r->keyframes.ch, r->keyframes.dc, msg)) {
+            DP_warn("Error handling message for keyframe: %s", DP_error());
+        }
+        long long message_index = r->keyframes.message_count++;
+        if (r->keyframes.message_count % r->keyframes.interval == 0) {
+            return write_keyframe(r, message_index);
+        }
+    }
+    return true;
+}
+
 static bool write_message_dec(DP_Recorder *r, DP_Message *msg)
 {
     bool ok;
@@ -155,15 +352,17 @@ static bool write_message_dec(DP_Recorder *r, DP_Message *msg)
         DP_UNREACHABLE();
     }
 
+    if (ok && r->keyframes.ch) {
+        ok = handle_keyframe_message(r, msg);
+    }
+
     DP_message_decref(msg);
 
     if (ok) {
         return true;
     }
     else {
-        DP_atomic_set(&r->running, 0);
-        r->error = DP_strdup(DP_error());
-        return false;
+        return handle_error(r);
     }
 }
 
@@ -199,6 +398,7 @@ static bool shift_message(DP_Recorder *r, DP_Message **out_msg)
 
 static void run_recorder(void *user)
 {
+    DP_thread_role_set(DP_THREAD_ROLE_BACKGROUND);
     struct DP_RecorderThreadArgs *args = user;
     DP_Recorder *r = args->r;
     DP_CanvasState *cs_or_null = args->cs_or_null;
@@ -223,6 +423,12 @@ static void run_recorder(void *user)
                 break;
             }
         }
+        // The trailer must come last, so only write it if the recording was
+        // stopped regularly and not due to an error.
+        if (r->keyframes.ch && DP_atomic_get(&r->running)
+            && !write_keyframe_trailer(r)) {
+            handle_error(r);
+        }
     }
     else {
         DP_canvas_state_decref_nullable(cs_or_null);
@@ -234,6 +440,18 @@ DP_Recorder *DP_recorder_new_inc(DP_RecorderType type, JSON_Value *header,
                                  DP_CanvasState *cs_or_null,
                                  DP_RecorderGetTimeMsFn get_time_fn,
                                  void *get_time_user, DP_Output *output)
+{
+    return DP_recorder_new_keyframes_inc(type, header, cs_or_null, 0,
+                                         get_time_fn, get_time_user, output);
+}
+
+DP_Recorder *DP_recorder_new_keyframes_inc(DP_RecorderType type,
+                                           JSON_Value *header,
+                                           DP_CanvasState *cs_or_null,
+                                           int keyframe_interval,
+                                           DP_RecorderGetTimeMsFn get_time_fn,
+                                           void *get_time_user,
+                                           DP_Output *output)
 {
     DP_ASSERT(header);
     DP_ASSERT(output);
@@ -248,7 +466,8 @@ DP_Recorder *DP_recorder_new_inc(DP_RecorderType type, JSON_Value *header,
                        NULL,
                        NULL,
                        NULL,
-                       NULL};
+                       NULL,
+                       {0, NULL, NULL, NULL, 0, 0}};
 
     switch (type) {
     case DP_RECORDER_TYPE_BINARY:
@@ -266,6 +485,13 @@ DP_Recorder *DP_recorder_new_inc(DP_RecorderType type, JSON_Value *header,
 
     DP_message_queue_init(&r->queue, 64);
 
+    if (type == DP_RECORDER_TYPE_BINARY && keyframe_interval > 0) {
+        r->keyframes.interval = keyframe_interval;
+        r->keyframes.acls = DP_acl_state_new_playback();
+        r->keyframes.ch = DP_canvas_history_new(NULL, NULL, false, NULL);
+        r->keyframes.dc = DP_draw_context_new();
+    }
+
     r->mutex = DP_mutex_new();
     if (!r->mutex) {
         DP_recorder_free_join(r, NULL);
@@ -298,6 +524,9 @@ void DP_recorder_free_join(DP_Recorder *r, char **out_error)
             DP_SEMAPHORE_MUST_POST(r->sem);
             DP_thread_free_join(r->thread);
         }
+        DP_draw_context_free(r->keyframes.dc);
+        DP_canvas_history_free(r->keyframes.ch);
+        DP_acl_state_free(r->keyframes.acls);
         DP_semaphore_free(r->sem);
         DP_mutex_free(r->mutex);
         DP_message_queue_dispose(&r->queue);
@@ -334,6 +563,12 @@ DP_RecorderType DP_recorder_type(DP_Recorder *r)
     return r->type;
 }
 
+int DP_recorder_keyframe_interval(DP_Recorder *r)
+{
+    DP_ASSERT(r);
+    return r->keyframes.interval;
+}
+
 JSON_Value *DP_recorder_header(DP_Recorder *r)
 {
     DP_ASSERT(r);
@@ -38,6 +38,25 @@ typedef enum DP_RecorderType {
 
 typedef long long (*DP_RecorderGetTimeMsFn)(void *user);
 
+// Binary recordings can carry keyframes, which let the player seek without
+// building a separate index first. These are stored in data messages of the
+// following type, which regular playback skips. A keyframe consists of a
+// number of snapshot chunks, a compressed reset stream of the canvas and its
+// history, followed by the keyframe itself. That holds the index of the command
+// message it was taken after, the offset of its first snapshot chunk and the
+// offset of the previous keyframe, or 0 if there is none. When the recording is
+// finished, a trailer with the total command message count, the offset of the
+// last keyframe and a magic value gets written. All numbers are little-endian.
+#define DP_RECORDER_KEYFRAME_DATA_TYPE           200
+#define DP_RECORDER_KEYFRAME_KIND_SNAPSHOT       0
+#define DP_RECORDER_KEYFRAME_KIND_KEYFRAME       1
+#define DP_RECORDER_KEYFRAME_KIND_TRAILER        2
+#define DP_RECORDER_KEYFRAME_BODY_LENGTH         21
+#define DP_RECORDER_KEYFRAME_LENGTH              27
+#define DP_RECORDER_KEYFRAME_TRAILER_MAGIC       "DPKF"
+#define DP_RECORDER_KEYFRAME_TRAILER_BODY_LENGTH 17
+#define DP_RECORDER_KEYFRAME_TRAILER_LENGTH      23
+
 
 JSON_Value *DP_recorder_header_new(const char *first, ...);
 JSON_Value *DP_recorder_header_clone(JSON_Value *header);
@@ -49,6 +68,19 @@ DP_Recorder *DP_recorder_new_inc(DP_RecorderType type, JSON_Value *header,
                                  DP_RecorderGetTimeMsFn get_time_fn,
                                  void *get_time_user, DP_Output *output);
 
+// Like the above, but writes a keyframe every keyframe_interval command
+// messages. To do so, the recorder thread replays the recording as it goes,
+// which costs about as much as building an index for it afterwards would, but
+// doesn't make anyone wait. Only applies to binary recordings, for text ones
+// or when the interval is zero or less, this is the same as the above.
+DP_Recorder *DP_recorder_new_keyframes_inc(DP_RecorderType type,
+                                           JSON_Value *header,
+                                           DP_CanvasState *cs_or_null,
+                                           int keyframe_interval,
+                                           DP_RecorderGetTimeMsFn get_time_fn,
+                                           void *get_time_user,
+                                           DP_Output *output);
+
 // If there was an error, the error message will be placed in the provided
 // pointer, to be freed by the caller. If there was no error, it will be set to
 // NULL. Providing that out pointer is optional.
@@ -56,6 +88,9 @@ void DP_recorder_free_join(DP_Recorder *r, char **out_error);
 
 DP_RecorderType DP_recorder_type(DP_Recorder *r);
 
+// Zero if this recorder doesn't write keyframes.
+int DP_recorder_keyframe_interval(DP_Recorder *r);
+
 JSON_Value *DP_recorder_header(DP_Recorder *r);
 
 bool DP_recorder_message_push_inc(DP_Recorder *r, DP_Message *msg);
@@ -2,23 +2,35 @@
 #include "canvas_diff.h"
 #include "canvas_state.h"
 #include "layer_content.h"
+#include "layer_list.h"
 #include "local_state.h"
+#include "memory_report.h"
 #include "pixels.h"
 #include "tile.h"
 #include "view_mode.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/perf.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
+#include <dpcommon/vector.h>
 #include <dpmsg/blend_mode.h>
 
 #define TILE_QUEUE_INITIAL_CAPACITY 1024
 
+// Maximum number of tiles a render thread takes from the shared queues at once.
+// The rest of them sit in the thread's own queue for it or others to pick up.
+#define TILE_CLAIM_MAX 8
+
 #define TILE_QUEUED_NONE 0
 #define TILE_QUEUED_HIGH 1
 #define TILE_QUEUED_LOW  2
 
+#define INVALID_TILE_RECT ((DP_Rect){0, 0, -1, -1})
+#define FULL_TILE_RECT    ((DP_Rect){0, 0, DP_TILE_SIZE - 1, DP_TILE_SIZE - 1})
+
 #define CHANGE_NONE        0u
 #define CHANGE_RESIZE      (1u << 0u)
 #define CHANGE_CHECKER     (1u << 1u)
@@ -26,10 +38,43 @@
 #define CHANGE_LOCAL_STATE (1u << 3u)
 #define CHANGE_UNLOCK      (1u << 4u)
 
+typedef struct DP_RendererTileJob {
+    int tile_x, tile_y;
+    int tile_index;
+    DP_Rect rect;
+} DP_RendererTileJob;
+
+// Claimed jobs are dropped if a blocking change came in before they got to
+// run, same as the tombstoned ones still sitting in the shared queues.
+typedef struct DP_RendererClaimedJob {
+    DP_RendererTileJob tile;
+    int blocking_epoch;
+    bool high;
+} DP_RendererClaimedJob;
+
+// The renderer state that tile jobs render from. Each thread keeps its own
+// copy of it around and only refreshes it when the generation changed.
+typedef struct DP_RendererSnapshot {
+    DP_CanvasState *cs;
+    bool needs_checkers;
+    bool above_mergeable;
+    int split_index;
+    unsigned int split_epoch;
+    int lod;
+} DP_RendererSnapshot;
+
 typedef struct DP_RenderContext {
     DP_ALIGNAS_SIMD DP_Pixel8 pixels[DP_TILE_LENGTH];
     DP_TransientTile *tt;
     DP_ViewModeBuffer vmb;
+    // Made from the snapshot's canvas state and the renderer's local state
+    // whenever the snapshot is refreshed, tile jobs just use it as-is.
+    DP_ViewModeFilter vmf;
+    DP_Atomic lock;
+    DP_Queue jobs;
+    DP_RendererStatistics stats;
+    int generation;
+    DP_RendererSnapshot snapshot;
 } DP_RenderContext;
 
 typedef struct DP_RendererLocalState {
@@ -51,12 +96,10 @@ typedef struct DP_RendererTileCoords {
     int tile_x, tile_y;
 } DP_RendererTileCoords;
 
-typedef struct DP_RendererTileJob {
-    int tile_x, tile_y;
-    int tile_index;
-    DP_CanvasState *cs;
-    bool needs_checkers;
-} DP_RendererTileJob;
+typedef struct DP_RendererTileDistance {
+    int distance;
+    DP_RendererTileCoords coords;
+} DP_RendererTileDistance;
 
 typedef struct DP_RendererResize {
     int width, height;
@@ -81,6 +124,28 @@ typedef struct DP_RendererBlocking {
     DP_RendererLocalState local_state;
 } DP_RendererBlocking;
 
+typedef struct DP_RendererLayerCacheEntry {
+    bool cached;
+    DP_Tile *tile;
+} DP_RendererLayerCacheEntry;
+
+// While the user is drawing, the composites of everything below and above the
+// active layer get cached, so the only thing that needs to be flattened again
+// is the layer being drawn on. Entries are only stored by jobs whose epoch
+// matches, which gets bumped every time something gets invalidated.
+typedef struct DP_RendererLayerCache {
+    DP_Atomic enabled;
+    DP_Atomic lock;
+    DP_CanvasState *cs;
+    int split_index;
+    bool above_mergeable;
+    unsigned int epoch;
+    size_t capacity;
+    DP_RendererLayerCacheEntry *below;
+    DP_RendererLayerCacheEntry *above;
+    DP_CanvasDiff *diff;
+} DP_RendererLayerCache;
+
 typedef struct DP_RenderJob {
     DP_RenderJobType type;
     union {
@@ -92,6 +157,7 @@ typedef struct DP_RenderJob {
 struct DP_Renderer {
     struct {
         DP_RendererTileFn tile;
+        DP_RendererTileSlotFn tile_slot;
         DP_RendererUnlockFn unlock;
         DP_RendererResizeFn resize;
         void *user;
@@ -103,7 +169,18 @@ struct DP_Renderer {
         DP_Queue queue_low;
         size_t map_capacity;
         char *map;
+        size_t rects_capacity;
+        DP_Rect *rects;
+        DP_Atomic *lods;
+        DP_Vector distances;
     } tile;
+    struct {
+        DP_Atomic lock;
+        DP_Atomic generation;
+    } state;
+    DP_Atomic blocking_epoch;
+    DP_Atomic high_pending;
+    DP_Atomic quit;
     DP_Pixel8 checker_color1;
     DP_Pixel8 checker_color2;
     DP_UPixel15 selection_color;
@@ -111,7 +188,10 @@ struct DP_Renderer {
     DP_CanvasState *cs;
     bool checkers_visible;
     int xtiles;
+    int lod;
     DP_RendererLocalState local_state;
+    DP_RendererLayerCache layer_cache;
+    DP_OnionSkinCache *onion_skin_cache;
     DP_Mutex *queue_mutex;
     DP_Semaphore *queue_sem;
     DP_Semaphore *wait_ready_sem;
@@ -121,11 +201,48 @@ struct DP_Renderer {
 };
 
 
-static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
-                            DP_RendererTileJob *job)
+static DP_RendererLayerCacheEntry *
+layer_cache_entry_at(DP_RendererLayerCache *lc, bool above, int tile_index)
+{
+    return &(above ? lc->above : lc->below)[tile_index];
+}
+
+static bool layer_cache_get(DP_RendererLayerCache *lc, bool above,
+                            int tile_index, unsigned int epoch,
+                            DP_Tile **out_tile_or_null)
+{
+    DP_atomic_lock(&lc->lock);
+    bool found = false;
+    if (lc->epoch == epoch) {
+        DP_RendererLayerCacheEntry *entry =
+            layer_cache_entry_at(lc, above, tile_index);
+        if (entry->cached) {
+            *out_tile_or_null = DP_tile_incref_nullable(entry->tile);
+            found = true;
+        }
+    }
+    DP_atomic_unlock(&lc->lock);
+    return found;
+}
+
+static void layer_cache_put(DP_RendererLayerCache *lc, bool above,
+                            int tile_index, unsigned int epoch,
+                            DP_Tile *t_or_null)
+{
+    DP_atomic_lock(&lc->lock);
+    if (lc->epoch == epoch) {
+        DP_RendererLayerCacheEntry *entry =
+            layer_cache_entry_at(lc, above, tile_index);
+        if (!entry->cached) {
+            entry->cached = true;
+            entry->tile = DP_tile_incref_nullable(t_or_null);
+        }
+    }
+    DP_atomic_unlock(&lc->lock);
+}
+
+static void init_tile(DP_TransientTile *tt, DP_CanvasState *cs)
 {
-    DP_TransientTile *tt = rc->tt;
-    DP_CanvasState *cs = job->cs;
     DP_Tile *background_tile = DP_canvas_state_background_tile_noinc(cs);
     if (background_tile) {
         DP_transient_tile_copy(tt, background_tile);
@@ -133,25 +250,178 @@ static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
     else {
         DP_transient_tile_clear(tt);
     }
+}
+
+static void flatten_tile_below(DP_RendererLayerCache *lc, DP_TransientTile *tt,
+                               const DP_RendererSnapshot *snapshot,
+                               int tile_index)
+{
+    DP_Tile *below;
+    if (layer_cache_get(lc, false, tile_index, snapshot->split_epoch,
+                        &below)) {
+        DP_transient_tile_copy(tt, below);
+        DP_tile_decref(below);
+    }
+    else {
+        DP_CanvasState *cs = snapshot->cs;
+        init_tile(tt, cs);
+        DP_canvas_state_flatten_tile_range_to(cs, tile_index, tt, true, 0,
+                                              snapshot->split_index);
+        below = DP_transient_tile_persist(
+            DP_transient_tile_new((DP_Tile *)tt, 0));
+        layer_cache_put(lc, false, tile_index, snapshot->split_epoch, below);
+        DP_tile_decref(below);
+    }
+}
+
+static void flatten_tile_above(DP_RendererLayerCache *lc, DP_TransientTile *tt,
+                               const DP_RendererSnapshot *snapshot,
+                               int tile_index, int count)
+{
+    DP_CanvasState *cs = snapshot->cs;
+    int start = snapshot->split_index + 1;
+    if (snapshot->above_mergeable) {
+        DP_Tile *above_or_null;
+        if (!layer_cache_get(lc, true, tile_index, snapshot->split_epoch,
+                             &above_or_null)) {
+            DP_TransientTile *above_tt = DP_canvas_state_flatten_tile_range_to(
+                cs, tile_index, NULL, true, start, count);
+            above_or_null =
+                above_tt ? DP_transient_tile_persist(above_tt) : NULL;
+            layer_cache_put(lc, true, tile_index, snapshot->split_epoch,
+                            above_or_null);
+        }
+        if (above_or_null) {
+            DP_transient_tile_merge(tt, above_or_null, DP_BIT15,
+                                    DP_BLEND_MODE_NORMAL);
+            DP_tile_decref(above_or_null);
+        }
+    }
+    else {
+        DP_canvas_state_flatten_tile_range_to(cs, tile_index, tt, true, start,
+                                              count);
+    }
+}
+
+static void flatten_tile_split(DP_Renderer *renderer, DP_TransientTile *tt,
+                               const DP_RendererSnapshot *snapshot,
+                               int tile_index)
+{
+    DP_RendererLayerCache *lc = &renderer->layer_cache;
+    DP_CanvasState *cs = snapshot->cs;
+    int split_index = snapshot->split_index;
+    int count = DP_layer_list_count(DP_canvas_state_layers_noinc(cs));
+    flatten_tile_below(lc, tt, snapshot, tile_index);
+    DP_canvas_state_flatten_tile_range_to(cs, tile_index, tt, true,
+                                          split_index, split_index + 1);
+    flatten_tile_above(lc, tt, snapshot, tile_index, count);
+    DP_canvas_state_flatten_selection_tile_to(cs, tile_index, tt, true,
+                                              &renderer->selection_color);
+}
+
+static void release_snapshot(DP_RenderContext *rc)
+{
+    DP_canvas_state_decref_nullable(rc->snapshot.cs);
+    rc->snapshot.cs = NULL;
+    rc->generation = -1;
+}
 
-    DP_ViewModeFilter vmf = DP_view_mode_filter_make_from_active(
-        &rc->vmb, renderer->local_state.view_mode, cs,
-        renderer->local_state.active, renderer->local_state.oss);
+static void refresh_snapshot(DP_Renderer *renderer, DP_RenderContext *rc)
+{
+    if (DP_atomic_get(&renderer->state.generation) != rc->generation) {
+        DP_atomic_lock(&renderer->state.lock);
+        DP_canvas_state_decref_nullable(rc->snapshot.cs);
+        DP_RendererLayerCache *lc = &renderer->layer_cache;
+        bool split = lc->cs;
+        DP_atomic_lock(&lc->lock);
+        unsigned int split_epoch = lc->epoch;
+        DP_atomic_unlock(&lc->lock);
+        rc->snapshot = (DP_RendererSnapshot){
+            DP_canvas_state_incref(renderer->cs),
+            renderer->checker && renderer->checkers_visible,
+            split && lc->above_mergeable,
+            split ? lc->split_index : -1,
+            split_epoch,
+            // Reduced detail only makes sense for the plain flattened canvas.
+            split || renderer->local_state.view_mode != DP_VIEW_MODE_NORMAL
+                ? 0
+                : renderer->lod,
+        };
+        rc->generation = DP_atomic_get(&renderer->state.generation);
+        DP_atomic_unlock(&renderer->state.lock);
+        // The local state only changes in blocking jobs, while this thread is
+        // held up, so it's fine to look at it outside of the lock.
+        rc->vmf = DP_view_mode_filter_make_from_active(
+            &rc->vmb, renderer->local_state.view_mode, rc->snapshot.cs,
+            renderer->local_state.active, renderer->local_state.oss);
+    }
+}
 
-    DP_canvas_state_flatten_tile_to(cs, job->tile_index, tt, true,
-                                    &renderer->selection_color, &vmf);
+static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
+                            DP_RendererTileJob *job)
+{
+    refresh_snapshot(renderer, rc);
+    const DP_RendererSnapshot *snapshot = &rc->snapshot;
+    DP_TransientTile *tt = rc->tt;
+    DP_CanvasState *cs = snapshot->cs;
+    int tile_index = job->tile_index;
+    int lod = snapshot->lod;
+    DP_atomic_set(&renderer->tile.lods[tile_index], lod);
+    if (snapshot->split_index >= 0) {
+        flatten_tile_split(renderer, tt, snapshot, tile_index);
+    }
+    else if (lod > 0) {
+        DP_canvas_state_flatten_tile_sampled_to(cs, tile_index, tt, 1 << lod,
+                                                &renderer->selection_color);
+    }
+    else {
+        init_tile(tt, cs);
+        DP_canvas_state_flatten_tile_to(cs, tile_index, tt, true,
+                                        &renderer->selection_color, &rc->vmf);
+    }
 
-    if (job->needs_checkers) {
+    if (snapshot->needs_checkers) {
         DP_transient_tile_merge(tt, (DP_Tile *)renderer->checker, DP_BIT15,
                                 DP_BLEND_MODE_BEHIND);
     }
 
-    DP_Pixel8 *pixel_buffer = rc->pixels;
-    DP_pixels15_to_8_tile(pixel_buffer, DP_transient_tile_pixels(tt));
-    renderer->fn.tile(renderer->fn.user, job->tile_x, job->tile_y,
-                      pixel_buffer);
+    // Only the changed part of the tile gets converted, the rest of the pixel
+    // buffer is left with whatever was in there before. The tile callback is
+    // told which part that is so that it doesn't look at anything else.
+    DP_Pixel15 *src = DP_transient_tile_pixels(tt);
+    // Sampled blocks may straddle the edges of the dirty area.
+    DP_Rect rect = lod == 0 ? job->rect : FULL_TILE_RECT;
+    int stride = DP_TILE_SIZE;
+    DP_Pixel8 *pixel_buffer = NULL;
+    DP_RendererTileSlotFn tile_slot = renderer->fn.tile_slot;
+    if (tile_slot) {
+        int slot_width, slot_height;
+        pixel_buffer = tile_slot(renderer->fn.user, job->tile_x, job->tile_y,
+                                 &slot_width, &slot_height);
+        if (pixel_buffer) {
+            // Tiles at the edge of the canvas may be smaller, don't write
+            // past the end of their rows.
+            rect.x2 = DP_min_int(rect.x2, slot_width - 1);
+            rect.y2 = DP_min_int(rect.y2, slot_height - 1);
+            stride = slot_width;
+        }
+    }
+    if (!pixel_buffer) {
+        pixel_buffer = rc->pixels;
+    }
 
-    DP_canvas_state_decref(cs);
+    int width = DP_rect_width(rect);
+    if (width == DP_TILE_SIZE && DP_rect_height(rect) == DP_TILE_SIZE) {
+        DP_pixels15_to_8_tile(pixel_buffer, src);
+    }
+    else if (width > 0) {
+        for (int y = rect.y1; y <= rect.y2; ++y) {
+            DP_pixels15_to_8(pixel_buffer + y * stride + rect.x1,
+                             src + y * DP_TILE_SIZE + rect.x1, width);
+        }
+    }
+    renderer->fn.tile(renderer->fn.user, job->tile_x, job->tile_y,
+                      pixel_buffer, rect);
 }
 
 
@@ -184,6 +454,13 @@ static void handle_blocking_job(DP_Renderer *renderer, DP_Mutex *queue_mutex,
     if (changes & CHANGE_LOCAL_STATE) {
         DP_onion_skins_free(renderer->local_state.oss);
         renderer->local_state = job->local_state;
+        // Cached onion skins are only good for as long as they're shown.
+        DP_OnionSkinCache *osc = renderer->onion_skin_cache;
+        if (osc && !renderer->local_state.oss) {
+            DP_onion_skin_cache_clear(osc);
+        }
+        // The view mode is part of the render threads' snapshots.
+        DP_atomic_inc(&renderer->state.generation);
     }
 
     if (changes & CHANGE_UNLOCK) {
@@ -242,32 +519,75 @@ static int enqueue_blocking_job(DP_Renderer *renderer,
     return thread_count;
 }
 
-static bool dequeue_job_tile(DP_Renderer *renderer, DP_Queue *queue,
-                             DP_RenderJob *out_job)
+// Takes the tile at the front of the queue, unless it's actually an unlock
+// marker, a tombstone or an entry left behind by a priority upgrade.
+static bool take_queued_tile(DP_Renderer *renderer, DP_Queue *queue,
+                             char priority, DP_RendererTileJob *out_tile)
 {
     DP_RendererTileCoords *coords = DP_queue_peek(queue, sizeof(*coords));
-    if (coords) {
+    if (coords && coords->tile_x >= 0) {
         int tile_x = coords->tile_x;
         int tile_y = coords->tile_y;
-        if (tile_x >= 0) {
-            int tile_index = tile_y * renderer->xtiles + tile_x;
+        int tile_index = tile_y * renderer->xtiles + tile_x;
+        if (renderer->tile.map[tile_index] == priority) {
             renderer->tile.map[tile_index] = TILE_QUEUED_NONE;
+            DP_Rect *rect = &renderer->tile.rects[tile_index];
+            *out_tile = (DP_RendererTileJob){tile_x, tile_y, tile_index, *rect};
+            *rect = INVALID_TILE_RECT;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void claim_more_tiles(DP_Renderer *renderer, DP_RenderContext *rc,
+                             DP_Queue *queue, char priority)
+{
+    // Leave enough tiles in the shared queue for the other threads to chew on.
+    size_t share = queue->used / DP_int_to_size(renderer->thread_count);
+    size_t count = DP_min_size(share, TILE_CLAIM_MAX - 1);
+    if (count != 0) {
+        int blocking_epoch = DP_atomic_get(&renderer->blocking_epoch);
+        DP_atomic_lock(&rc->lock);
+        DP_RendererTileJob tile;
+        for (size_t i = 0;
+             i < count && take_queued_tile(renderer, queue, priority, &tile);
+             ++i) {
+            DP_RendererClaimedJob *claimed =
+                DP_queue_push(&rc->jobs, sizeof(*claimed));
+            *claimed = (DP_RendererClaimedJob){
+                tile, blocking_epoch, priority == TILE_QUEUED_HIGH};
+            DP_queue_shift(queue);
+        }
+        ++rc->stats.claims;
+        DP_atomic_unlock(&rc->lock);
+    }
+}
+
+static bool dequeue_job_tile(DP_Renderer *renderer, DP_RenderContext *rc,
+                             DP_Queue *queue, char priority,
+                             DP_RenderJob *out_job)
+{
+    DP_RendererTileCoords *coords = DP_queue_peek(queue, sizeof(*coords));
+    if (coords) {
+        if (take_queued_tile(renderer, queue, priority, &out_job->tile)) {
             out_job->type = DP_RENDER_JOB_TILE;
-            out_job->tile = (DP_RendererTileJob){
-                tile_x, tile_y, tile_index,
-                DP_canvas_state_incref(renderer->cs),
-                renderer->checker && renderer->checkers_visible};
+            DP_queue_shift(queue);
+            claim_more_tiles(renderer, rc, queue, priority);
         }
         else {
-            if (tile_y == DP_RENDER_JOB_UNLOCK) {
+            if (coords->tile_x < 0 && coords->tile_y == DP_RENDER_JOB_UNLOCK) {
                 DP_RendererBlocking blocking;
                 blocking.changes = CHANGE_UNLOCK;
                 int pushed = enqueue_blocking_job(renderer, &blocking);
                 DP_SEMAPHORE_MUST_POST_N(renderer->queue_sem, pushed);
             }
             out_job->type = DP_RENDER_JOB_INVALID;
+            DP_queue_shift(queue);
+        }
+        if (priority == TILE_QUEUED_HIGH) {
+            DP_atomic_set(&renderer->high_pending, queue->used != 0);
         }
-        DP_queue_shift(queue);
         return true;
     }
     else {
@@ -275,17 +595,116 @@ static bool dequeue_job_tile(DP_Renderer *renderer, DP_Queue *queue,
     }
 }
 
-static DP_RenderJob dequeue_job(DP_Renderer *renderer)
+// A thread with claimed tiles of its own only looks for high-priority ones in
+// the shared queues. Blocking jobs have to wait until it has worked through
+// its own tiles, since an unlock must come after all of those are rendered.
+static bool dequeue_job(DP_Renderer *renderer, DP_RenderContext *rc,
+                        bool only_high, DP_RenderJob *out_job)
+{
+    return (!only_high && dequeue_job_resize(renderer, out_job))
+        || dequeue_job_tile(renderer, rc, &renderer->tile.queue_high,
+                            TILE_QUEUED_HIGH, out_job)
+        || (!only_high
+            && dequeue_job_tile(renderer, rc, &renderer->tile.queue_low,
+                                TILE_QUEUED_LOW, out_job));
+}
+
+static void take_claimed_job(DP_Renderer *renderer,
+                             DP_RendererClaimedJob *claimed,
+                             DP_RenderJob *out_job)
+{
+    if (claimed->blocking_epoch == DP_atomic_get(&renderer->blocking_epoch)) {
+        out_job->type = DP_RENDER_JOB_TILE;
+        out_job->tile = claimed->tile;
+    }
+    else {
+        out_job->type = DP_RENDER_JOB_INVALID;
+    }
+}
+
+static bool dequeue_own_job(DP_Renderer *renderer, DP_RenderContext *rc,
+                            bool include_low, DP_RenderJob *out_job)
+{
+    DP_atomic_lock(&rc->lock);
+    DP_RendererClaimedJob *claimed = DP_queue_peek(&rc->jobs, sizeof(*claimed));
+    bool found = claimed && (include_low || claimed->high);
+    if (found) {
+        take_claimed_job(renderer, claimed, out_job);
+        DP_queue_shift(&rc->jobs);
+    }
+    DP_atomic_unlock(&rc->lock);
+    return found;
+}
+
+static bool steal_job(DP_Renderer *renderer, int thread_index,
+                      DP_RenderJob *out_job)
+{
+    int thread_count = renderer->thread_count;
+    for (int i = 1; i < thread_count; ++i) {
+        DP_RenderContext *victim =
+            &renderer->contexts[(thread_index + i) % thread_count];
+        DP_atomic_lock(&victim->lock);
+        DP_RendererClaimedJob *claimed =
+            DP_queue_peek_last(&victim->jobs, sizeof(*claimed));
+        if (claimed) {
+            take_claimed_job(renderer, claimed, out_job);
+            DP_queue_pop(&victim->jobs);
+            DP_atomic_unlock(&victim->lock);
+            return true;
+        }
+        DP_atomic_unlock(&victim->lock);
+    }
+    return false;
+}
+
+static bool dequeue_shared_job(DP_Renderer *renderer, DP_RenderContext *rc,
+                               bool only_high, DP_RenderJob *out_job)
+{
+    DP_Mutex *queue_mutex = renderer->queue_mutex;
+    unsigned long long start = DP_perf_time();
+    DP_MUTEX_MUST_LOCK(queue_mutex);
+    unsigned long long wait_time = DP_perf_time() - start;
+    bool found = dequeue_job(renderer, rc, only_high, out_job);
+    DP_MUTEX_MUST_UNLOCK(queue_mutex);
+    DP_atomic_lock(&rc->lock);
+    rc->stats.queue_wait_ns += wait_time;
+    DP_atomic_unlock(&rc->lock);
+    return found;
+}
+
+// Every job waits on the queue semaphore once, no matter where it ends up being
+// taken from, so there's always one to be found somewhere. It may just have
+// been pushed after this thread looked at the shared queues, so keep looking.
+static DP_RenderJob next_job(DP_Renderer *renderer, int thread_index)
 {
+    DP_RenderContext *rc = &renderer->contexts[thread_index];
     DP_RenderJob job;
-    bool job_found =
-        dequeue_job_resize(renderer, &job)
-        || dequeue_job_tile(renderer, &renderer->tile.queue_high, &job)
-        || dequeue_job_tile(renderer, &renderer->tile.queue_low, &job);
-    if (!job_found) {
-        job.type = DP_RENDER_JOB_QUIT;
+    while (true) {
+        if (DP_atomic_get(&renderer->quit)) {
+            job.type = DP_RENDER_JOB_QUIT;
+            return job;
+        }
+
+        bool high_pending = DP_atomic_get(&renderer->high_pending);
+        if (dequeue_own_job(renderer, rc, !high_pending, &job)) {
+            return job;
+        }
+
+        DP_atomic_lock(&rc->lock);
+        bool have_own = rc->jobs.used != 0;
+        DP_atomic_unlock(&rc->lock);
+        if (dequeue_shared_job(renderer, rc, have_own, &job)
+            || dequeue_own_job(renderer, rc, true, &job)) {
+            return job;
+        }
+
+        if (steal_job(renderer, thread_index, &job)) {
+            DP_atomic_lock(&rc->lock);
+            ++rc->stats.steals;
+            DP_atomic_unlock(&rc->lock);
+            return job;
+        }
     }
-    return job;
 }
 
 static void handle_jobs(DP_Renderer *renderer, int thread_index)
@@ -294,13 +713,19 @@ static void handle_jobs(DP_Renderer *renderer, int thread_index)
     DP_Semaphore *queue_sem = renderer->queue_sem;
     DP_RenderContext *rc = &renderer->contexts[thread_index];
     while (true) {
-        DP_SEMAPHORE_MUST_WAIT(queue_sem);
-        DP_MUTEX_MUST_LOCK(queue_mutex);
-        DP_RenderJob job = dequeue_job(renderer);
-        DP_MUTEX_MUST_UNLOCK(queue_mutex);
+        if (!DP_SEMAPHORE_MUST_TRY_WAIT(queue_sem)) {
+            // Going idle, don't keep an outdated canvas state alive meanwhile.
+            release_snapshot(rc);
+            DP_SEMAPHORE_MUST_WAIT(queue_sem);
+        }
+
+        DP_RenderJob job = next_job(renderer, thread_index);
         switch (job.type) {
         case DP_RENDER_JOB_TILE:
             handle_tile_job(renderer, rc, &job.tile);
+            DP_atomic_lock(&rc->lock);
+            ++rc->stats.jobs;
+            DP_atomic_unlock(&rc->lock);
             break;
         case DP_RENDER_JOB_BLOCKING:
             handle_blocking_job(renderer, queue_mutex, &job.blocking);
@@ -325,6 +750,7 @@ struct DP_RenderWorkerParams {
 
 static void run_worker_thread(void *user)
 {
+    DP_thread_role_set(DP_THREAD_ROLE_INTERACTIVE);
     struct DP_RenderWorkerParams *params = user;
     DP_Renderer *renderer = params->renderer;
     int thread_index = params->thread_index;
@@ -337,6 +763,7 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checker,
                              DP_Pixel8 checker_color1, DP_Pixel8 checker_color2,
                              DP_UPixel15 selection_color,
                              DP_RendererTileFn tile_fn,
+                             DP_RendererTileSlotFn tile_slot_fn_or_null,
                              DP_RendererUnlockFn unlock_fn,
                              DP_RendererResizeFn resize_fn, void *user)
 {
@@ -349,6 +776,7 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checker,
     DP_Renderer *renderer =
         DP_malloc(DP_FLEX_SIZEOF(DP_Renderer, threads, size_thread_count));
     renderer->fn.tile = tile_fn;
+    renderer->fn.tile_slot = tile_slot_fn_or_null;
     renderer->fn.unlock = unlock_fn;
     renderer->fn.resize = resize_fn;
     renderer->fn.user = user;
@@ -365,6 +793,11 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checker,
                   sizeof(DP_RendererTileCoords));
     renderer->tile.map_capacity = 0;
     renderer->tile.map = NULL;
+    renderer->tile.rects_capacity = 0;
+    renderer->tile.rects = NULL;
+    renderer->tile.lods = NULL;
+    DP_VECTOR_INIT_TYPE(&renderer->tile.distances, DP_RendererTileDistance,
+                        TILE_QUEUE_INITIAL_CAPACITY);
     renderer->checker_color1 = checker_color1;
     renderer->checker_color2 = checker_color2;
     renderer->selection_color = selection_color;
@@ -376,13 +809,31 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checker,
     renderer->cs = DP_canvas_state_new();
     renderer->checkers_visible = false;
     renderer->xtiles = 0;
+    renderer->lod = 0;
     renderer->local_state =
         (DP_RendererLocalState){DP_VIEW_MODE_NORMAL, 0, NULL};
+    renderer->layer_cache = (DP_RendererLayerCache){
+        0, 0, NULL, -1, false, 0, 0, NULL, NULL, NULL};
+    // Without a cache, onion skins just get flattened every time.
+    renderer->onion_skin_cache = DP_onion_skin_cache_new();
+    DP_atomic_set(&renderer->state.lock, 0);
+    DP_atomic_set(&renderer->state.generation, 0);
+    DP_atomic_set(&renderer->blocking_epoch, 0);
+    DP_atomic_set(&renderer->high_pending, 0);
+    DP_atomic_set(&renderer->quit, 0);
     renderer->contexts = DP_malloc_simd(sizeof(*renderer->contexts)
                                         * DP_int_to_size(thread_count));
     for (int i = 0; i < thread_count; ++i) {
-        renderer->contexts[i].tt = DP_transient_tile_new_blank(0);
-        DP_view_mode_buffer_init(&renderer->contexts[i].vmb);
+        DP_RenderContext *rc = &renderer->contexts[i];
+        rc->tt = DP_transient_tile_new_blank(0);
+        DP_view_mode_buffer_init(&rc->vmb);
+        rc->vmb.onion_skin_cache = renderer->onion_skin_cache;
+        rc->vmf = DP_view_mode_filter_make_default();
+        DP_atomic_set(&rc->lock, 0);
+        DP_queue_init(&rc->jobs, TILE_CLAIM_MAX, sizeof(DP_RendererClaimedJob));
+        rc->stats = (DP_RendererStatistics){0, 0, 0, 0};
+        rc->generation = -1;
+        rc->snapshot.cs = NULL;
         renderer->threads[i] = NULL;
     }
 
@@ -409,6 +860,34 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checker,
     return renderer;
 }
 
+static void layer_cache_clear_entries(DP_RendererLayerCache *lc,
+                                      size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        DP_RendererLayerCacheEntry *below = &lc->below[i];
+        if (below->cached) {
+            DP_tile_decref_nullable(below->tile);
+            below->cached = false;
+        }
+        DP_RendererLayerCacheEntry *above = &lc->above[i];
+        if (above->cached) {
+            DP_tile_decref_nullable(above->tile);
+            above->cached = false;
+        }
+    }
+}
+
+static void layer_cache_dispose(DP_RendererLayerCache *lc)
+{
+    if (lc->cs) {
+        layer_cache_clear_entries(lc, lc->capacity);
+        DP_canvas_state_decref(lc->cs);
+    }
+    DP_canvas_diff_free(lc->diff);
+    DP_free(lc->above);
+    DP_free(lc->below);
+}
+
 static void dispose_blocking_job(void *element)
 {
     DP_RenderJob *job = element;
@@ -428,6 +907,7 @@ void DP_renderer_free(DP_Renderer *renderer)
                            dispose_blocking_job);
             renderer->tile.queue_high.used = 0;
             renderer->tile.queue_low.used = 0;
+            DP_atomic_set(&renderer->quit, 1);
             DP_SEMAPHORE_MUST_POST_N(renderer->queue_sem, thread_count);
             DP_MUTEX_MUST_UNLOCK(renderer->queue_mutex);
             for (int i = 0; i < thread_count; ++i) {
@@ -439,15 +919,23 @@ void DP_renderer_free(DP_Renderer *renderer)
         DP_semaphore_free(renderer->queue_sem);
         DP_mutex_free(renderer->queue_mutex);
         DP_onion_skins_free(renderer->local_state.oss);
+        layer_cache_dispose(&renderer->layer_cache);
+        DP_onion_skin_cache_free(renderer->onion_skin_cache);
         DP_canvas_state_decref(renderer->cs);
         DP_transient_tile_decref_nullable(renderer->checker);
+        DP_vector_dispose(&renderer->tile.distances);
+        DP_free(renderer->tile.lods);
+        DP_free(renderer->tile.rects);
         DP_free(renderer->tile.map);
         DP_queue_dispose(&renderer->tile.queue_low);
         DP_queue_dispose(&renderer->tile.queue_high);
         DP_queue_dispose(&renderer->blocking_queue);
         for (int i = 0; i < thread_count; ++i) {
-            DP_view_mode_buffer_dispose(&renderer->contexts[i].vmb);
-            DP_transient_tile_decref(renderer->contexts[i].tt);
+            DP_RenderContext *rc = &renderer->contexts[i];
+            release_snapshot(rc);
+            DP_queue_dispose(&rc->jobs);
+            DP_view_mode_buffer_dispose(&rc->vmb);
+            DP_transient_tile_decref(rc->tt);
         }
         DP_free_simd(renderer->contexts);
         DP_free(renderer);
@@ -460,6 +948,50 @@ int DP_renderer_thread_count(DP_Renderer *renderer)
     return renderer->thread_count;
 }
 
+DP_RendererStatistics DP_renderer_statistics(DP_Renderer *renderer)
+{
+    DP_ASSERT(renderer);
+    DP_RendererStatistics total = {0, 0, 0, 0};
+    for (int i = 0; i < renderer->thread_count; ++i) {
+        DP_RenderContext *rc = &renderer->contexts[i];
+        DP_atomic_lock(&rc->lock);
+        total.jobs += rc->stats.jobs;
+        total.claims += rc->stats.claims;
+        total.steals += rc->stats.steals;
+        total.queue_wait_ns += rc->stats.queue_wait_ns;
+        DP_atomic_unlock(&rc->lock);
+    }
+    return total;
+}
+
+static void layer_cache_memory_report_add(DP_RendererLayerCache *lc,
+                                          DP_MemoryReport *mr, bool above)
+{
+    DP_memory_report_cache_add(mr, above ? "layers above" : "layers below");
+    DP_atomic_lock(&lc->lock);
+    size_t capacity = lc->capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        DP_RendererLayerCacheEntry *entry =
+            layer_cache_entry_at(lc, above, DP_size_to_int(i));
+        if (entry->cached) {
+            DP_memory_report_cache_tile_add(mr, entry->tile);
+        }
+    }
+    DP_atomic_unlock(&lc->lock);
+}
+
+void DP_renderer_memory_report_add(DP_Renderer *renderer, DP_MemoryReport *mr)
+{
+    DP_ASSERT(renderer);
+    DP_ASSERT(mr);
+    layer_cache_memory_report_add(&renderer->layer_cache, mr, false);
+    layer_cache_memory_report_add(&renderer->layer_cache, mr, true);
+    DP_OnionSkinCache *osc = renderer->onion_skin_cache;
+    if (osc) {
+        DP_onion_skin_cache_memory_report_add(osc, mr);
+    }
+}
+
 bool DP_renderer_checkers(DP_Renderer *renderer)
 {
     DP_ASSERT(renderer);
@@ -472,6 +1004,14 @@ bool DP_renderer_checkers_visible(DP_Renderer *renderer)
     return renderer->checkers_visible;
 }
 
+void DP_renderer_local_drawing_in_progress_set(DP_Renderer *renderer,
+                                               bool local_drawing_in_progress)
+{
+    DP_ASSERT(renderer);
+    DP_atomic_set(&renderer->layer_cache.enabled,
+                  local_drawing_in_progress ? 1 : 0);
+}
+
 
 static bool local_state_params_differ(DP_RendererLocalState *rls,
                                       DP_LocalState *ls)
@@ -527,7 +1067,9 @@ static int push_blocking(DP_Renderer *renderer, DP_RendererBlocking *blocking)
     int pushed = enqueue_blocking_job(renderer, blocking);
 
     // All current tile jobs are invalidated by the blocking change, so we turn
-    // those into tombstones to avoid any pointless processing thereof.
+    // those into tombstones to avoid any pointless processing thereof. Tiles
+    // already claimed by a render thread are dropped by bumping the epoch.
+    DP_atomic_inc(&renderer->blocking_epoch);
     DP_queue_each(&renderer->tile.queue_high, sizeof(DP_RendererTileCoords),
                   invalidate_tile_coords, NULL);
     DP_queue_each(&renderer->tile.queue_low, sizeof(DP_RendererTileCoords),
@@ -546,6 +1088,24 @@ static int push_blocking(DP_Renderer *renderer, DP_RendererBlocking *blocking)
         }
 
         renderer->xtiles = DP_tile_count_round(width);
+
+        // Pending tile rects don't get reset on other blocking changes, since
+        // the tombstoned tiles will get merged into when they're pushed again.
+        size_t tile_count = DP_int_to_size(renderer->xtiles)
+                          * DP_int_to_size(DP_tile_count_round(height));
+        if (renderer->tile.rects_capacity < tile_count) {
+            DP_free(renderer->tile.rects);
+            DP_free(renderer->tile.lods);
+            renderer->tile.rects =
+                DP_malloc(sizeof(*renderer->tile.rects) * tile_count);
+            renderer->tile.lods =
+                DP_malloc(sizeof(*renderer->tile.lods) * tile_count);
+            renderer->tile.rects_capacity = tile_count;
+        }
+        for (size_t i = 0; i < tile_count; ++i) {
+            renderer->tile.rects[i] = INVALID_TILE_RECT;
+            DP_atomic_set(&renderer->tile.lods[i], 0);
+        }
     }
     memset(renderer->tile.map, TILE_QUEUED_NONE, required_capacity);
 
@@ -561,51 +1121,28 @@ static void enqueue_tile(DP_Queue *queue, char *map, int tile_x, int tile_y,
     map[tile_index] = priority;
 }
 
-static bool should_remove_tile(void *element, void *user)
-{
-    DP_RendererTileCoords *a = element;
-    DP_RendererTileCoords *b = user;
-    return a->tile_x == b->tile_x && a->tile_y == b->tile_y;
-}
-
-static void remove_tile(DP_Queue *queue, int tile_x, int tile_y)
-{
-    DP_RendererTileCoords coords = {tile_x, tile_y};
-    size_t index = DP_queue_search_index(queue, sizeof(DP_RendererTileCoords),
-                                         should_remove_tile, &coords);
-    DP_ASSERT(index < queue->used);
-    // We don't actually care too much about the order in our queue, so instead
-    // of going through the effort of removing an element in the middle, we just
-    // replace it with the last element. If it's at the beginning or end, we can
-    // just shift or pop it respectively though, which is even easier.
-    if (index == 0) {
-        DP_queue_shift(queue);
-    }
-    else if (index == queue->used - 1) {
-        DP_queue_pop(queue);
-    }
-    else {
-        DP_RendererTileCoords *last =
-            DP_queue_peek_last(queue, sizeof(DP_RendererTileCoords));
-        DP_RendererTileCoords *target =
-            DP_queue_at(queue, sizeof(DP_RendererTileCoords), index);
-        *target = *last;
-        DP_queue_pop(queue);
-    }
-}
-
+// Rather than searching the low priority queue for the tile to remove it, we
+// leave it in there. The tile map no longer matches its priority, so a render
+// thread will skip it when it gets to it. That still takes a trip through the
+// queue semaphore, so the caller has to count this as a pushed job.
 static void upgrade_tile_priority(DP_Renderer *renderer, int tile_x, int tile_y,
                                   int tile_index)
 {
     enqueue_tile(&renderer->tile.queue_high, renderer->tile.map, tile_x, tile_y,
                  tile_index, TILE_QUEUED_HIGH);
-    remove_tile(&renderer->tile.queue_low, tile_x, tile_y);
+}
+
+static void add_tile_rect(DP_Renderer *renderer, int tile_index, DP_Rect rect)
+{
+    DP_Rect *pending = &renderer->tile.rects[tile_index];
+    *pending = DP_rect_valid(*pending) ? DP_rect_union(*pending, rect) : rect;
 }
 
 static void push_tile_high_priority(DP_Renderer *renderer, int tile_x,
-                                    int tile_y, int *out_pushed)
+                                    int tile_y, DP_Rect rect, int *out_pushed)
 {
     int tile_index = tile_y * renderer->xtiles + tile_x;
+    add_tile_rect(renderer, tile_index, rect);
     char status = renderer->tile.map[tile_index];
     if (status == TILE_QUEUED_NONE) {
         enqueue_tile(&renderer->tile.queue_high, renderer->tile.map, tile_x,
@@ -614,6 +1151,7 @@ static void push_tile_high_priority(DP_Renderer *renderer, int tile_x,
     }
     else if (status == TILE_QUEUED_LOW) {
         upgrade_tile_priority(renderer, tile_x, tile_y, tile_index);
+        ++*out_pushed;
     }
 }
 
@@ -623,15 +1161,17 @@ struct DP_RendererPushTileParams {
     int pushed;
 };
 
-static void push_tile(void *user, int tile_x, int tile_y)
+static void push_tile(void *user, int tile_x, int tile_y, DP_Rect rect)
 {
     struct DP_RendererPushTileParams *params = user;
     DP_Renderer *renderer = params->renderer;
     if (DP_rect_contains(params->view_tile_bounds, tile_x, tile_y)) {
-        push_tile_high_priority(renderer, tile_x, tile_y, &params->pushed);
+        push_tile_high_priority(renderer, tile_x, tile_y, rect,
+                                &params->pushed);
     }
     else {
         int tile_index = tile_y * renderer->xtiles + tile_x;
+        add_tile_rect(renderer, tile_index, rect);
         char status = renderer->tile.map[tile_index];
         if (status == TILE_QUEUED_NONE) {
             enqueue_tile(&renderer->tile.queue_low, renderer->tile.map, tile_x,
@@ -646,15 +1186,37 @@ struct DP_RendererPushTileInViewParams {
     int pushed;
 };
 
-static void push_tile_in_view(void *user, int tile_x, int tile_y)
+static void push_tile_in_view(void *user, int tile_x, int tile_y,
+                              DP_Rect rect)
 {
     struct DP_RendererPushTileInViewParams *params = user;
     DP_Renderer *renderer = params->renderer;
-    push_tile_high_priority(renderer, tile_x, tile_y, &params->pushed);
+    push_tile_high_priority(renderer, tile_x, tile_y, rect, &params->pushed);
+}
+
+// Tiles rendered at a coarser level of detail than the current one get
+// rendered again in full. Outside of the view this only happens when the level
+// actually decreased, the rest get picked up once they scroll into view.
+static void refine_tiles(DP_Renderer *renderer,
+                         struct DP_RendererPushTileParams *params,
+                         DP_Rect tile_bounds)
+{
+    int lod = renderer->lod;
+    DP_Atomic *lods = renderer->tile.lods;
+    int xtiles = renderer->xtiles;
+    for (int tile_y = tile_bounds.y1; tile_y <= tile_bounds.y2; ++tile_y) {
+        for (int tile_x = tile_bounds.x1; tile_x <= tile_bounds.x2; ++tile_x) {
+            int tile_index = tile_y * xtiles + tile_x;
+            if (DP_atomic_get(&lods[tile_index]) > lod) {
+                DP_atomic_set(&lods[tile_index], lod);
+                push_tile(params, tile_x, tile_y, FULL_TILE_RECT);
+            }
+        }
+    }
 }
 
 static bool reprioritize_tiles(DP_Renderer *renderer, DP_CanvasDiff *diff,
-                               DP_Rect tile_bounds)
+                               DP_Rect tile_bounds, int *out_pushed)
 {
     int left, top, right, bottom, xtiles;
     DP_canvas_diff_bounds_clamp(diff, tile_bounds.x1, tile_bounds.y1,
@@ -668,6 +1230,7 @@ static bool reprioritize_tiles(DP_Renderer *renderer, DP_CanvasDiff *diff,
             switch (tile_map[tile_index]) {
             case TILE_QUEUED_LOW:
                 upgrade_tile_priority(renderer, tile_x, tile_y, tile_index);
+                ++*out_pushed;
                 DP_FALLTHROUGH();
             case TILE_QUEUED_HIGH:
                 was_queued = true;
@@ -680,16 +1243,224 @@ static bool reprioritize_tiles(DP_Renderer *renderer, DP_CanvasDiff *diff,
     return was_queued;
 }
 
+static int compare_tile_distances(const void *a, const void *b)
+{
+    int da = ((const DP_RendererTileDistance *)a)->distance;
+    int db = ((const DP_RendererTileDistance *)b)->distance;
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+// Sorts the high-priority tiles pushed from the given index onwards by their
+// distance to the center of the view, so that the area the user is looking at
+// fills in first instead of going from the top-left to the bottom-right.
+static void sort_tiles_by_distance(DP_Renderer *renderer, size_t start,
+                                   DP_Rect view_tile_bounds)
+{
+    DP_Queue *queue = &renderer->tile.queue_high;
+    size_t end = queue->used;
+    if (end - start > 1) {
+        // Doubled coordinates, so that the center of an even-sized view still
+        // lands on an integer.
+        int center_x = view_tile_bounds.x1 + view_tile_bounds.x2;
+        int center_y = view_tile_bounds.y1 + view_tile_bounds.y2;
+        DP_Vector *distances = &renderer->tile.distances;
+        distances->used = 0;
+        for (size_t i = start; i < end; ++i) {
+            DP_RendererTileCoords coords = *(DP_RendererTileCoords *)DP_queue_at(
+                queue, sizeof(coords), i);
+            int dx = coords.tile_x * 2 - center_x;
+            int dy = coords.tile_y * 2 - center_y;
+            DP_VECTOR_PUSH_TYPE(distances, DP_RendererTileDistance,
+                                ((DP_RendererTileDistance){dx * dx + dy * dy,
+                                                           coords}));
+        }
+
+        DP_vector_sort(distances, sizeof(DP_RendererTileDistance),
+                       compare_tile_distances);
+
+        for (size_t i = start; i < end; ++i) {
+            *(DP_RendererTileCoords *)DP_queue_at(
+                queue, sizeof(DP_RendererTileCoords), i) =
+                DP_VECTOR_AT_TYPE(distances, DP_RendererTileDistance, i - start)
+                    .coords;
+        }
+    }
+}
+
+static void layer_cache_off(DP_RendererLayerCache *lc)
+{
+    if (lc->cs) {
+        DP_atomic_lock(&lc->lock);
+        layer_cache_clear_entries(lc, lc->capacity);
+        ++lc->epoch;
+        DP_atomic_unlock(&lc->lock);
+        DP_canvas_state_decref(lc->cs);
+        lc->cs = NULL;
+    }
+}
+
+static void ignore_tile(DP_UNUSED void *user, DP_UNUSED int tile_index)
+{
+    // Nothing to do, just clearing out the diff.
+}
+
+static void layer_cache_reset(DP_RendererLayerCache *lc, DP_CanvasState *cs,
+                              int split_index, bool above_mergeable)
+{
+    layer_cache_off(lc);
+
+    int width = DP_canvas_state_width(cs);
+    int height = DP_canvas_state_height(cs);
+    if (!lc->diff) {
+        lc->diff = DP_canvas_diff_new();
+    }
+    DP_canvas_diff_begin(lc->diff, 0, 0, width, height, false);
+    DP_canvas_diff_each_index_reset(lc->diff, ignore_tile, NULL);
+
+    size_t required_capacity = DP_int_to_size(DP_tile_count_round(width))
+                             * DP_int_to_size(DP_tile_count_round(height));
+    if (lc->capacity < required_capacity) {
+        size_t size = sizeof(*lc->below) * required_capacity;
+        lc->below = DP_realloc(lc->below, size);
+        lc->above = DP_realloc(lc->above, size);
+        for (size_t i = lc->capacity; i < required_capacity; ++i) {
+            lc->below[i] = (DP_RendererLayerCacheEntry){false, NULL};
+            lc->above[i] = (DP_RendererLayerCacheEntry){false, NULL};
+        }
+        lc->capacity = required_capacity;
+    }
+
+    lc->cs = DP_canvas_state_incref(cs);
+    lc->split_index = split_index;
+    lc->above_mergeable = above_mergeable;
+}
+
+struct DP_RendererInvalidateParams {
+    DP_RendererLayerCache *lc;
+    bool above;
+    bool invalidated;
+};
+
+static void invalidate_entry(void *user, int tile_index)
+{
+    struct DP_RendererInvalidateParams *params = user;
+    DP_RendererLayerCacheEntry *entry =
+        layer_cache_entry_at(params->lc, params->above, tile_index);
+    if (entry->cached) {
+        DP_tile_decref_nullable(entry->tile);
+        entry->cached = false;
+        params->invalidated = true;
+    }
+}
+
+static void layer_cache_invalidate(DP_RendererLayerCache *lc,
+                                   DP_CanvasDiff *diff, bool above)
+{
+    struct DP_RendererInvalidateParams params = {lc, above, false};
+    DP_atomic_lock(&lc->lock);
+    DP_canvas_diff_each_index_reset(diff, invalidate_entry, &params);
+    // Bump the epoch so that jobs still working on a previous canvas state
+    // don't store their now outdated results in the cache.
+    if (params.invalidated) {
+        ++lc->epoch;
+    }
+    DP_atomic_unlock(&lc->lock);
+}
+
+static void layer_cache_diff(DP_RendererLayerCache *lc, DP_CanvasState *cs)
+{
+    DP_CanvasState *prev_cs = lc->cs;
+    int width = DP_canvas_state_width(cs);
+    int height = DP_canvas_state_height(cs);
+    DP_CanvasDiff *diff = lc->diff;
+    DP_canvas_diff_begin(diff, width, height, width, height, false);
+
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    DP_LayerPropsList *lpl = DP_canvas_state_layer_props_noinc(cs);
+    DP_LayerList *prev_ll = DP_canvas_state_layers_noinc(prev_cs);
+    DP_LayerPropsList *prev_lpl = DP_canvas_state_layer_props_noinc(prev_cs);
+    int split_index = lc->split_index;
+
+    if (DP_canvas_state_background_tile_noinc(cs)
+        == DP_canvas_state_background_tile_noinc(prev_cs)) {
+        DP_layer_list_diff_range(ll, lpl, prev_ll, prev_lpl, diff, 0,
+                                 split_index);
+    }
+    else {
+        DP_canvas_diff_check_all(diff);
+    }
+    layer_cache_invalidate(lc, diff, false);
+
+    DP_layer_list_diff_range(ll, lpl, prev_ll, prev_lpl, diff, split_index + 1,
+                             DP_layer_list_count(ll));
+    layer_cache_invalidate(lc, diff, true);
+
+    lc->cs = DP_canvas_state_incref(cs);
+    DP_canvas_state_decref(prev_cs);
+}
+
+static void update_layer_cache(DP_Renderer *renderer, DP_CanvasState *cs,
+                               DP_LocalState *ls)
+{
+    DP_RendererLayerCache *lc = &renderer->layer_cache;
+    int layer_id = DP_atomic_get(&lc->enabled)
+                        && DP_local_state_view_mode(ls) == DP_VIEW_MODE_NORMAL
+                     ? DP_local_state_active_layer_id(ls)
+                     : 0;
+    bool above_mergeable = false;
+    int split_index =
+        layer_id == 0
+            ? -1
+            : DP_canvas_state_flatten_split_index(cs, layer_id,
+                                                  &above_mergeable);
+    if (split_index < 0) {
+        layer_cache_off(lc);
+    }
+    else {
+        DP_CanvasState *prev_cs = lc->cs;
+        bool reset =
+            !prev_cs || lc->split_index != split_index
+            || lc->above_mergeable != above_mergeable
+            || DP_canvas_state_width(prev_cs) != DP_canvas_state_width(cs)
+            || DP_canvas_state_height(prev_cs) != DP_canvas_state_height(cs)
+            || DP_layer_list_count(DP_canvas_state_layers_noinc(prev_cs))
+                   != DP_layer_list_count(DP_canvas_state_layers_noinc(cs));
+        if (reset) {
+            layer_cache_reset(lc, cs, split_index, above_mergeable);
+        }
+        else if (prev_cs != cs) {
+            layer_cache_diff(lc, cs);
+        }
+    }
+}
+
+void DP_renderer_caches_clear(DP_Renderer *renderer)
+{
+    DP_ASSERT(renderer);
+    // The cache gets reset and filled again by the next apply if local
+    // drawing is still in progress, render threads notice by the generation.
+    DP_atomic_lock(&renderer->state.lock);
+    layer_cache_off(&renderer->layer_cache);
+    DP_atomic_inc(&renderer->state.generation);
+    DP_atomic_unlock(&renderer->state.lock);
+    DP_OnionSkinCache *osc = renderer->onion_skin_cache;
+    if (osc) {
+        DP_onion_skin_cache_clear(osc);
+    }
+}
+
 void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
                        DP_LocalState *ls, DP_CanvasDiff *diff,
                        bool layers_can_decrease_opacity,
                        DP_Pixel8 checker_color1, DP_Pixel8 checker_color2,
                        DP_UPixel15 selection_color, DP_Rect view_tile_bounds,
-                       bool render_outside_view, DP_RendererMode mode)
+                       bool render_outside_view, int lod, DP_RendererMode mode)
 {
     DP_ASSERT(renderer);
     DP_ASSERT(cs);
     DP_ASSERT(diff);
+    DP_ASSERT(lod >= 0);
+    DP_ASSERT(lod <= DP_RENDERER_LOD_MAX);
 
     DP_CanvasState *prev_cs = renderer->cs;
     int prev_width = DP_canvas_state_width(prev_cs);
@@ -700,6 +1471,9 @@ void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
     DP_Mutex *queue_mutex = renderer->queue_mutex;
     DP_MUTEX_MUST_LOCK(queue_mutex);
 
+    // Render threads pick up the state below when they get to their next tile,
+    // so that tiles they've already claimed don't get rendered outdated.
+    DP_atomic_lock(&renderer->state.lock);
     renderer->cs = DP_canvas_state_incref(cs);
     // It's very rare in practice for the checkerboard background to actually be
     // visible behind the canvas. Only if the canvas background is set to a
@@ -709,6 +1483,11 @@ void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
     bool has_checker = renderer->checker;
     renderer->checkers_visible =
         !DP_canvas_state_background_opaque(cs) || layers_can_decrease_opacity;
+    update_layer_cache(renderer, cs, ls);
+    int prev_lod = renderer->lod;
+    renderer->lod = mode == DP_RENDERER_EVERYTHING ? 0 : lod;
+    DP_atomic_inc(&renderer->state.generation);
+    DP_atomic_unlock(&renderer->state.lock);
 
     DP_RendererBlocking blocking;
     blocking.changes = CHANGE_NONE;
@@ -773,8 +1552,30 @@ void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
         pushed += params.pushed;
     }
 
+    if (mode != DP_RENDERER_EVERYTHING) {
+        int xtiles = renderer->xtiles;
+        int ytiles = DP_tile_count_round(height);
+        DP_Rect canvas_tile_bounds = DP_rect_make(0, 0, xtiles, ytiles);
+        struct DP_RendererPushTileParams params = {renderer, view_tile_bounds,
+                                                   0};
+        if (render_outside_view && renderer->lod < prev_lod) {
+            refine_tiles(renderer, &params, canvas_tile_bounds);
+        }
+        else {
+            refine_tiles(
+                renderer, &params,
+                DP_rect_intersection(canvas_tile_bounds, view_tile_bounds));
+        }
+        pushed += params.pushed;
+    }
+
+    bool was_queued = mode != DP_RENDERER_CONTINUOUS
+                   && reprioritize_tiles(renderer, diff, view_tile_bounds,
+                                         &pushed);
+    sort_tiles_by_distance(renderer, tile_queue_high_used_before,
+                           view_tile_bounds);
+
     if (mode != DP_RENDERER_CONTINUOUS) {
-        bool was_queued = reprioritize_tiles(renderer, diff, view_tile_bounds);
         // Block the main thread if there's new high-priority tiles to render.
         // This avoids tiles flickering in when the user moves the view
         // elsewhere at the expense of possibly chugging for a moment. But since
@@ -793,6 +1594,7 @@ void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
         }
     }
 
+    DP_atomic_set(&renderer->high_pending, tile_queue_high->used != 0);
     DP_SEMAPHORE_MUST_POST_N(renderer->queue_sem, pushed);
     DP_MUTEX_MUST_UNLOCK(queue_mutex);
 }
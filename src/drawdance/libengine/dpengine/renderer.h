@@ -8,10 +8,25 @@
 typedef struct DP_CanvasDiff DP_CanvasDiff;
 typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_LocalState DP_LocalState;
+typedef struct DP_MemoryReport DP_MemoryReport;
 
 
+// Levels of detail go from 0 for full resolution to sampling single pixels out
+// of 64x64 blocks, i.e. one per tile.
+#define DP_RENDERER_LOD_MAX 6
+
 typedef struct DP_Renderer DP_Renderer;
-typedef void (*DP_RendererTileFn)(void *user, int x, int y, DP_Pixel8 *pixels);
+// Only the pixels within the given tile-relative rect are valid, the rest of
+// the tile didn't change and must be left alone by the callback.
+typedef void (*DP_RendererTileFn)(void *user, int x, int y, DP_Pixel8 *pixels,
+                                  DP_Rect rect);
+// Optional, called right before the tile function for the same tile. If it
+// returns a buffer of width * height pixels, the renderer writes the tile into
+// it directly instead of into its own buffer and then passes it along to the
+// tile function, which can skip copying it. The tile function is called in
+// either case, so it can be used to release anything acquired in here.
+typedef DP_Pixel8 *(*DP_RendererTileSlotFn)(void *user, int x, int y,
+                                            int *out_width, int *out_height);
 typedef void (*DP_RendererUnlockFn)(void *user);
 typedef void (*DP_RendererResizeFn)(void *user, int width, int height,
                                     int prev_width, int prev_height,
@@ -33,6 +48,7 @@ DP_Renderer *DP_renderer_new(int thread_count, bool checkers,
                              DP_Pixel8 checker_color1, DP_Pixel8 checker_color2,
                              DP_UPixel15 selection_color,
                              DP_RendererTileFn tile_fn,
+                             DP_RendererTileSlotFn tile_slot_fn_or_null,
                              DP_RendererUnlockFn unlock_fn,
                              DP_RendererResizeFn resize_fn, void *user);
 
@@ -40,15 +56,42 @@ void DP_renderer_free(DP_Renderer *renderer);
 
 int DP_renderer_thread_count(DP_Renderer *renderer);
 
+typedef struct DP_RendererStatistics {
+    size_t jobs;   // Tiles rendered.
+    size_t claims; // Batches of tiles claimed from the shared queues at once.
+    size_t steals; // Tiles taken from another render thread's claimed batch.
+    unsigned long long queue_wait_ns; // Time spent waiting on the queue lock.
+} DP_RendererStatistics;
+
+// Totals over all render threads, for tuning the render thread count.
+DP_RendererStatistics DP_renderer_statistics(DP_Renderer *renderer);
+
+// Adds the layer and onion skin caches, each as their own source.
+void DP_renderer_memory_report_add(DP_Renderer *renderer, DP_MemoryReport *mr);
+
 bool DP_renderer_checkers(DP_Renderer *renderer);
 bool DP_renderer_checkers_visible(DP_Renderer *renderer);
 
-// Increments refcount on the given canvas state, resets the given diff.
+// While enabled, the composites below and above the active layer are cached
+// for each tile and only the active layer itself is flattened on top of them
+// again, until the next DP_renderer_apply after disabling it drops the cache.
+void DP_renderer_local_drawing_in_progress_set(DP_Renderer *renderer,
+                                               bool local_drawing_in_progress);
+
+// Drops the layer and onion skin caches, for when memory runs low. They fill
+// up again as tiles get rendered. Must be called from the same thread that
+// calls DP_renderer_apply.
+void DP_renderer_caches_clear(DP_Renderer *renderer);
+
+// Increments refcount on the given canvas state, resets the given diff. A lod
+// above zero renders changed tiles at reduced detail, with each 2^lod sized
+// block filled with a single sampled pixel. Coarser tiles get rendered
+// again when the lod decreases. DP_RENDERER_EVERYTHING always renders in full.
 void DP_renderer_apply(DP_Renderer *renderer, DP_CanvasState *cs,
                        DP_LocalState *ls, DP_CanvasDiff *diff,
                        bool layers_can_decrease_opacity,
                        DP_Pixel8 checker_color1, DP_Pixel8 checker_color2,
                        DP_UPixel15 selection_color, DP_Rect view_tile_bounds,
-                       bool render_outside_view, DP_RendererMode mode);
+                       bool render_outside_view, int lod, DP_RendererMode mode);
 
 #endif
@@ -0,0 +1,810 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "seekable_zstd.h"
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpcommon/perf.h>
+#include <zstd.h>
+
+// Laid out like zstd's seekable format, see contrib/seekable_format in its
+// repository: the seek table is a skippable frame holding the compressed and
+// decompressed size of each frame, followed by a footer with the frame count,
+// a descriptor byte and a magic number. All numbers are little-endian.
+#define COMPRESSION_LEVEL              3
+#define SKIPPABLE_MAGIC                0x184d2a5eu
+#define SKIPPABLE_MAGIC_MASK           0xfffffff0u
+#define SKIPPABLE_MAGIC_BASE           0x184d2a50u
+#define SKIPPABLE_HEADER_LENGTH        8
+#define SEEKABLE_MAGIC                 0x8f92eab1u
+#define SEEK_TABLE_ENTRY_LENGTH        8
+#define SEEK_TABLE_CHECKSUM_LENGTH     4
+#define SEEK_TABLE_FOOTER_LENGTH       9
+#define SEEK_TABLE_DESCRIPTOR_CHECKSUM 0x80u
+#define SEEK_TABLE_DESCRIPTOR_RESERVED 0x7cu
+#define FRAME_MAGIC_LENGTH             4
+#define FRAME_HEADER_MAX_LENGTH        18
+#define FRAME_CHECKSUM_LENGTH          4
+#define BLOCK_HEADER_LENGTH            3
+#define BLOCK_TYPE_RLE                 1u
+
+
+typedef struct DP_SeekableZstdEntry {
+    uint32_t compressed_size;
+    uint32_t decompressed_size;
+} DP_SeekableZstdEntry;
+
+typedef struct DP_SeekableZstdOutputState {
+    DP_Output *output;
+    ZSTD_CCtx *cctx;
+    unsigned char *buffer;
+    size_t frame_size;
+    size_t used;
+    unsigned char *compressed;
+    size_t compressed_capacity;
+    size_t offset;
+    unsigned long long sync_interval_ns;
+    unsigned long long frame_start;
+    DP_SeekableZstdEntry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+} DP_SeekableZstdOutputState;
+
+typedef struct DP_SeekableZstdOutputArgs {
+    DP_Output *output;
+    size_t frame_size;
+    long long sync_interval_ms;
+} DP_SeekableZstdOutputArgs;
+
+static bool end_frame(DP_SeekableZstdOutputState *state)
+{
+    size_t used = state->used;
+    if (used == 0) {
+        return true;
+    }
+
+    size_t bound = ZSTD_compressBound(used);
+    if (state->compressed_capacity < bound) {
+        DP_free(state->compressed);
+        state->compressed = DP_malloc(bound);
+        state->compressed_capacity = bound;
+    }
+
+    size_t compressed_size = ZSTD_compress2(state->cctx, state->compressed,
+                                            bound, state->buffer, used);
+    if (ZSTD_isError(compressed_size)) {
+        DP_error_set("Seekable zstd compression error: %s",
+                     ZSTD_getErrorName(compressed_size));
+        return false;
+    }
+
+    if (!DP_output_write(state->output, state->compressed, compressed_size)) {
+        return false;
+    }
+
+    if (state->entry_count == state->entry_capacity) {
+        size_t capacity = state->entry_capacity == 0
+                            ? 64
+                            : state->entry_capacity * 2;
+        state->entries =
+            DP_realloc(state->entries, sizeof(*state->entries) * capacity);
+        state->entry_capacity = capacity;
+    }
+    state->entries[state->entry_count++] = (DP_SeekableZstdEntry){
+        DP_size_to_uint32(compressed_size), DP_size_to_uint32(used)};
+
+    state->offset += used;
+    state->used = 0;
+    return true;
+}
+
+static bool write_seek_table(DP_SeekableZstdOutputState *state)
+{
+    size_t count = state->entry_count;
+    size_t table_length =
+        count * SEEK_TABLE_ENTRY_LENGTH + SEEK_TABLE_FOOTER_LENGTH;
+    size_t length = SKIPPABLE_HEADER_LENGTH + table_length;
+    unsigned char *data = DP_malloc(length);
+
+    size_t written = DP_write_littleendian_uint32(SKIPPABLE_MAGIC, data);
+    written += DP_write_littleendian_uint32(DP_size_to_uint32(table_length),
+                                            data + written);
+    for (size_t i = 0; i < count; ++i) {
+        written += DP_write_littleendian_uint32(
+            state->entries[i].compressed_size, data + written);
+        written += DP_write_littleendian_uint32(
+            state->entries[i].decompressed_size, data + written);
+    }
+    written +=
+        DP_write_littleendian_uint32(DP_size_to_uint32(count), data + written);
+    data[written++] = 0; // Descriptor, no checksums in the table.
+    written += DP_write_littleendian_uint32(SEEKABLE_MAGIC, data + written);
+    DP_ASSERT(written == length);
+
+    bool ok = DP_output_write(state->output, data, length);
+    DP_free(data);
+    return ok;
+}
+
+static size_t seekable_zstd_output_write(void *internal, const void *buffer,
+                                         size_t size)
+{
+    DP_SeekableZstdOutputState *state = internal;
+    const unsigned char *in = buffer;
+    size_t left = size;
+    while (left != 0) {
+        if (state->used == 0) {
+            state->frame_start = DP_perf_time();
+        }
+
+        size_t space = state->frame_size - state->used;
+        size_t count = left < space ? left : space;
+        memcpy(state->buffer + state->used, in, count);
+        state->used += count;
+        in += count;
+        left -= count;
+
+        if (state->used == state->frame_size && !end_frame(state)) {
+            return 0;
+        }
+    }
+
+    unsigned long long sync_interval_ns = state->sync_interval_ns;
+    if (state->used != 0 && sync_interval_ns != 0
+        && DP_perf_time() - state->frame_start >= sync_interval_ns) {
+        if (!end_frame(state) || !DP_output_flush(state->output)) {
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+static bool seekable_zstd_output_flush(void *internal)
+{
+    DP_SeekableZstdOutputState *state = internal;
+    return end_frame(state) && DP_output_flush(state->output);
+}
+
+static size_t seekable_zstd_output_tell(void *internal,
+                                        DP_UNUSED bool *out_error)
+{
+    DP_SeekableZstdOutputState *state = internal;
+    return state->offset + state->used;
+}
+
+static bool seekable_zstd_output_dispose(void *internal, bool discard)
+{
+    DP_SeekableZstdOutputState *state = internal;
+    bool ok;
+    if (discard) {
+        ok = DP_output_free_discard(state->output);
+    }
+    else {
+        ok = end_frame(state) && write_seek_table(state);
+        ok = DP_output_free(state->output) && ok;
+    }
+    DP_free(state->entries);
+    DP_free(state->compressed);
+    DP_free(state->buffer);
+    ZSTD_freeCCtx(state->cctx);
+    return ok;
+}
+
+static const DP_OutputMethods seekable_zstd_output_methods = {
+    seekable_zstd_output_write,
+    NULL,
+    seekable_zstd_output_flush,
+    seekable_zstd_output_tell,
+    NULL,
+    NULL,
+    seekable_zstd_output_dispose,
+};
+
+static bool set_cctx_parameter(ZSTD_CCtx *cctx, ZSTD_cParameter param,
+                               int value)
+{
+    size_t result = ZSTD_CCtx_setParameter(cctx, param, value);
+    if (ZSTD_isError(result)) {
+        DP_error_set("Error setting zstd compression parameter %d: %s",
+                     (int)param, ZSTD_getErrorName(result));
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static const DP_OutputMethods *seekable_zstd_output_init(void *internal,
+                                                         void *arg)
+{
+    DP_SeekableZstdOutputArgs *args = arg;
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (!cctx) {
+        DP_error_set("Error creating zstd compression context");
+        return NULL;
+    }
+
+    // Checksums make a frame cut off by the writer stopping abruptly show up
+    // as such, rather than as garbage at the end of the data.
+    if (!set_cctx_parameter(cctx, ZSTD_c_compressionLevel, COMPRESSION_LEVEL)
+        || !set_cctx_parameter(cctx, ZSTD_c_checksumFlag, 1)) {
+        ZSTD_freeCCtx(cctx);
+        return NULL;
+    }
+
+    long long sync_interval_ms = args->sync_interval_ms;
+    DP_SeekableZstdOutputState *state = internal;
+    *state = (DP_SeekableZstdOutputState){
+        args->output,
+        cctx,
+        DP_malloc(args->frame_size),
+        args->frame_size,
+        0,
+        NULL,
+        0,
+        0,
+        sync_interval_ms > 0 ? DP_llong_to_ullong(sync_interval_ms) * 1000000ull
+                             : 0,
+        0,
+        NULL,
+        0,
+        0};
+    return &seekable_zstd_output_methods;
+}
+
+DP_Output *DP_seekable_zstd_output_new(DP_Output *output, size_t frame_size,
+                                       long long sync_interval_ms)
+{
+    DP_ASSERT(output);
+    DP_ASSERT(frame_size > 0);
+    DP_ASSERT(frame_size <= DP_SEEKABLE_ZSTD_FRAME_SIZE_MAX);
+    DP_SeekableZstdOutputArgs args = {output, frame_size, sync_interval_ms};
+    DP_Output *zo = DP_output_new(seekable_zstd_output_init, &args,
+                                  sizeof(DP_SeekableZstdOutputState));
+    if (!zo) {
+        DP_output_free_discard(output);
+    }
+    return zo;
+}
+
+
+typedef struct DP_SeekableZstdFrame {
+    size_t compressed_offset;
+    size_t compressed_size;
+    size_t decompressed_offset;
+    size_t decompressed_size;
+} DP_SeekableZstdFrame;
+
+typedef struct DP_SeekableZstdInputState {
+    DP_Input *input;
+    ZSTD_DCtx *dctx;
+    DP_SeekableZstdFrame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    size_t length;
+    size_t pos;
+    size_t current;
+    unsigned char *compressed;
+    size_t compressed_capacity;
+    unsigned char *buffer;
+    size_t buffer_capacity;
+} DP_SeekableZstdInputState;
+
+static size_t read_at(DP_Input *input, size_t offset, unsigned char *buffer,
+                      size_t size, bool *out_error)
+{
+    if (!DP_input_seek(input, offset)) {
+        *out_error = true;
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        bool error;
+        size_t read = DP_input_read(input, buffer + done, size - done, &error);
+        if (error) {
+            *out_error = true;
+            return done;
+        }
+        else if (read == 0) {
+            break;
+        }
+        done += read;
+    }
+    *out_error = false;
+    return done;
+}
+
+static void append_frame(DP_SeekableZstdInputState *state,
+                         size_t compressed_offset, size_t compressed_size,
+                         size_t decompressed_size)
+{
+    if (state->frame_count == state->frame_capacity) {
+        size_t capacity = state->frame_capacity == 0
+                            ? 64
+                            : state->frame_capacity * 2;
+        state->frames =
+            DP_realloc(state->frames, sizeof(*state->frames) * capacity);
+        state->frame_capacity = capacity;
+    }
+    state->frames[state->frame_count++] = (DP_SeekableZstdFrame){
+        compressed_offset, compressed_size, state->length, decompressed_size};
+    state->length += decompressed_size;
+}
+
+static void reset_frames(DP_SeekableZstdInputState *state)
+{
+    state->frame_count = 0;
+    state->length = 0;
+}
+
+// The seek table's sizes are used to allocate the decompression buffer, so
+// they must match up with what the frame headers say.
+static bool check_frame_sizes(DP_SeekableZstdInputState *state)
+{
+    for (size_t i = 0; i < state->frame_count; ++i) {
+        DP_SeekableZstdFrame *frame = &state->frames[i];
+        bool error;
+        unsigned char header[FRAME_HEADER_MAX_LENGTH];
+        size_t read = read_at(state->input, frame->compressed_offset, header,
+                              DP_min_size(frame->compressed_size,
+                                          FRAME_HEADER_MAX_LENGTH),
+                              &error);
+        if (error) {
+            return false;
+        }
+
+        unsigned long long content_size =
+            ZSTD_getFrameContentSize(header, read);
+        if (content_size != frame->decompressed_size) {
+            DP_error_set("Zstd frame %zu size doesn't match seek table", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns false on read errors and bogus frame sizes. If there's no usable
+// seek table, that's not an error, *out_found is just set to false.
+static bool read_seek_table(DP_SeekableZstdInputState *state,
+                            size_t input_length, bool *out_found)
+{
+    *out_found = false;
+    if (input_length < SKIPPABLE_HEADER_LENGTH + SEEK_TABLE_FOOTER_LENGTH) {
+        return true;
+    }
+
+    bool error;
+    unsigned char footer[SEEK_TABLE_FOOTER_LENGTH];
+    size_t read =
+        read_at(state->input, input_length - SEEK_TABLE_FOOTER_LENGTH, footer,
+                SEEK_TABLE_FOOTER_LENGTH, &error);
+    if (error) {
+        return false;
+    }
+
+    unsigned int descriptor = footer[4];
+    if (read != SEEK_TABLE_FOOTER_LENGTH
+        || DP_read_littleendian_uint32(footer + 5) != SEEKABLE_MAGIC
+        || (descriptor & SEEK_TABLE_DESCRIPTOR_RESERVED) != 0) {
+        return true;
+    }
+
+    size_t entry_length =
+        SEEK_TABLE_ENTRY_LENGTH
+        + ((descriptor & SEEK_TABLE_DESCRIPTOR_CHECKSUM)
+               ? SEEK_TABLE_CHECKSUM_LENGTH
+               : 0);
+    size_t count = DP_read_littleendian_uint32(footer);
+    if (count > input_length / entry_length) {
+        return true;
+    }
+
+    size_t table_length = count * entry_length + SEEK_TABLE_FOOTER_LENGTH;
+    size_t frame_length = SKIPPABLE_HEADER_LENGTH + table_length;
+    if (frame_length > input_length) {
+        return true;
+    }
+
+    size_t table_offset = input_length - frame_length;
+    unsigned char *table = DP_malloc(frame_length);
+    read = read_at(state->input, table_offset, table, frame_length, &error);
+    if (error) {
+        DP_free(table);
+        return false;
+    }
+
+    bool valid = read == frame_length
+              && DP_read_littleendian_uint32(table) == SKIPPABLE_MAGIC
+              && DP_read_littleendian_uint32(table + 4) == table_length;
+    size_t compressed_offset = 0;
+    for (size_t i = 0; valid && i < count; ++i) {
+        const unsigned char *entry =
+            table + SKIPPABLE_HEADER_LENGTH + i * entry_length;
+        size_t compressed_size = DP_read_littleendian_uint32(entry);
+        size_t decompressed_size = DP_read_littleendian_uint32(entry + 4);
+        if (decompressed_size > DP_SEEKABLE_ZSTD_FRAME_SIZE_MAX) {
+            DP_error_set("Zstd frame %zu too large: %zu bytes", i,
+                         decompressed_size);
+            DP_free(table);
+            return false;
+        }
+        else if (compressed_size > table_offset - compressed_offset) {
+            valid = false;
+        }
+        else {
+            append_frame(state, compressed_offset, compressed_size,
+                         decompressed_size);
+            compressed_offset += compressed_size;
+        }
+    }
+    DP_free(table);
+
+    if (valid && compressed_offset == table_offset) {
+        *out_found = true;
+        return check_frame_sizes(state);
+    }
+    else {
+        reset_frames(state);
+        return true;
+    }
+}
+
+static size_t get_frame_header_length(const unsigned char *header)
+{
+    static const size_t dict_id_lengths[] = {0, 1, 2, 4};
+    static const size_t content_size_lengths[] = {0, 2, 4, 8};
+    unsigned int descriptor = header[FRAME_MAGIC_LENGTH];
+    unsigned int content_size_flag = descriptor >> 6u;
+    bool single_segment = descriptor & 0x20u;
+    // Descriptor byte, then a window descriptor unless it's a single segment.
+    size_t length = FRAME_MAGIC_LENGTH + (single_segment ? 1u : 2u);
+    length += dict_id_lengths[descriptor & 0x3u];
+    if (content_size_flag == 0 && single_segment) {
+        length += 1;
+    }
+    else {
+        length += content_size_lengths[content_size_flag];
+    }
+    return length;
+}
+
+// Finds the end of the frame at the given offset by walking its block headers,
+// returns 0 if it's cut off.
+static size_t find_frame_end(DP_SeekableZstdInputState *state,
+                             size_t input_length, size_t offset,
+                             size_t header_length, bool checksum,
+                             bool *out_error)
+{
+    size_t pos = offset + header_length;
+    while (true) {
+        unsigned char block_header[BLOCK_HEADER_LENGTH];
+        size_t read = read_at(state->input, pos, block_header,
+                              BLOCK_HEADER_LENGTH, out_error);
+        if (*out_error || read != BLOCK_HEADER_LENGTH) {
+            return 0;
+        }
+
+        uint32_t block = DP_read_littleendian_uint24(block_header);
+        uint32_t block_type = (block >> 1u) & 0x3u;
+        size_t block_length = block_type == BLOCK_TYPE_RLE ? 1 : block >> 3u;
+        pos += BLOCK_HEADER_LENGTH + block_length;
+        if (pos > input_length) {
+            return 0;
+        }
+        else if (block & 0x1u) {
+            break;
+        }
+    }
+
+    if (checksum) {
+        pos += FRAME_CHECKSUM_LENGTH;
+    }
+    return pos <= input_length ? pos : 0;
+}
+
+static bool scan_frames(DP_SeekableZstdInputState *state, size_t input_length)
+{
+    size_t offset = 0;
+    while (offset < input_length) {
+        bool error;
+        unsigned char header[FRAME_HEADER_MAX_LENGTH];
+        size_t left = input_length - offset;
+        size_t read = read_at(state->input, offset, header,
+                              left < sizeof(header) ? left : sizeof(header),
+                              &error);
+        if (error) {
+            return false;
+        }
+        else if (read < SKIPPABLE_HEADER_LENGTH) {
+            break;
+        }
+
+        uint32_t magic = DP_read_littleendian_uint32(header);
+        if ((magic & SKIPPABLE_MAGIC_MASK) == SKIPPABLE_MAGIC_BASE) {
+            offset += SKIPPABLE_HEADER_LENGTH
+                    + DP_read_littleendian_uint32(header + 4);
+            continue;
+        }
+        else if (magic != ZSTD_MAGICNUMBER) {
+            if (offset == 0) {
+                DP_error_set("Not a zstd file");
+                return false;
+            }
+            DP_warn("Garbage at offset %zu of zstd file", offset);
+            break;
+        }
+
+        size_t header_length = get_frame_header_length(header);
+        unsigned long long content_size =
+            ZSTD_getFrameContentSize(header, read);
+        if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+            DP_warn("Cut off zstd frame header at offset %zu", offset);
+            break;
+        }
+        else if (content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            DP_error_set("Unsupported zstd frame at offset %zu", offset);
+            return false;
+        }
+        else if (content_size > DP_SEEKABLE_ZSTD_FRAME_SIZE_MAX) {
+            DP_error_set("Zstd frame at offset %zu too large: %llu bytes",
+                         offset, content_size);
+            return false;
+        }
+
+        bool checksum = header[FRAME_MAGIC_LENGTH] & 0x4u;
+        size_t end = find_frame_end(state, input_length, offset, header_length,
+                                    checksum, &error);
+        if (error) {
+            return false;
+        }
+        else if (end == 0) {
+            DP_warn("Cut off zstd frame at offset %zu", offset);
+            break;
+        }
+
+        append_frame(state, offset, end - offset, (size_t)content_size);
+        offset = end;
+    }
+    return true;
+}
+
+static size_t find_frame(DP_SeekableZstdInputState *state, size_t pos)
+{
+    size_t current = state->current;
+    if (current < state->frame_count) {
+        DP_SeekableZstdFrame *frame = &state->frames[current];
+        if (pos >= frame->decompressed_offset
+            && pos - frame->decompressed_offset < frame->decompressed_size) {
+            return current;
+        }
+    }
+
+    // First frame that ends after the position.
+    size_t lo = 0;
+    size_t hi = state->frame_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        DP_SeekableZstdFrame *frame = &state->frames[mid];
+        if (frame->decompressed_offset + frame->decompressed_size <= pos) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool load_frame(DP_SeekableZstdInputState *state, size_t index)
+{
+    if (state->current == index) {
+        return true;
+    }
+
+    DP_SeekableZstdFrame *frame = &state->frames[index];
+    size_t compressed_size = frame->compressed_size;
+    if (state->compressed_capacity < compressed_size) {
+        DP_free(state->compressed);
+        state->compressed = DP_malloc(compressed_size);
+        state->compressed_capacity = compressed_size;
+    }
+
+    bool error;
+    size_t read = read_at(state->input, frame->compressed_offset,
+                          state->compressed, compressed_size, &error);
+    if (error) {
+        return false;
+    }
+    else if (read != compressed_size) {
+        DP_error_set("Zstd frame %zu cut off", index);
+        return false;
+    }
+
+    size_t decompressed_size = frame->decompressed_size;
+    if (state->buffer_capacity < decompressed_size) {
+        DP_free(state->buffer);
+        state->buffer = DP_malloc(decompressed_size);
+        state->buffer_capacity = decompressed_size;
+    }
+
+    // Invalidate first, in case decompression fails halfway.
+    state->current = SIZE_MAX;
+    size_t result =
+        ZSTD_decompressDCtx(state->dctx, state->buffer, decompressed_size,
+                            state->compressed, compressed_size);
+    if (ZSTD_isError(result)) {
+        DP_error_set("Error decompressing zstd frame %zu: %s", index,
+                     ZSTD_getErrorName(result));
+        return false;
+    }
+    else if (result != decompressed_size) {
+        DP_error_set("Zstd frame %zu decompressed to %zu instead of %zu bytes",
+                     index, result, decompressed_size);
+        return false;
+    }
+
+    state->current = index;
+    return true;
+}
+
+static size_t seekable_zstd_input_read(void *internal, void *buffer,
+                                       size_t size, bool *out_error)
+{
+    DP_SeekableZstdInputState *state = internal;
+    unsigned char *out = buffer;
+    size_t done = 0;
+    while (done < size && state->pos < state->length) {
+        size_t index = find_frame(state, state->pos);
+        if (!load_frame(state, index)) {
+            *out_error = true;
+            break;
+        }
+
+        DP_SeekableZstdFrame *frame = &state->frames[index];
+        size_t frame_pos = state->pos - frame->decompressed_offset;
+        size_t available = frame->decompressed_size - frame_pos;
+        size_t wanted = size - done;
+        size_t count = wanted < available ? wanted : available;
+        memcpy(out + done, state->buffer + frame_pos, count);
+        done += count;
+        state->pos += count;
+    }
+    return done;
+}
+
+static size_t seekable_zstd_input_length(void *internal,
+                                         DP_UNUSED bool *out_error)
+{
+    DP_SeekableZstdInputState *state = internal;
+    return state->length;
+}
+
+static bool seekable_zstd_input_rewind(void *internal)
+{
+    DP_SeekableZstdInputState *state = internal;
+    state->pos = 0;
+    return true;
+}
+
+static bool seekable_zstd_input_rewind_by(void *internal, size_t size)
+{
+    DP_SeekableZstdInputState *state = internal;
+    if (size <= state->pos) {
+        state->pos -= size;
+        return true;
+    }
+    else {
+        DP_error_set("Can't rewind zstd input by %zu from %zu", size,
+                     state->pos);
+        return false;
+    }
+}
+
+static bool seekable_zstd_input_seek(void *internal, size_t offset)
+{
+    DP_SeekableZstdInputState *state = internal;
+    if (offset <= state->length) {
+        state->pos = offset;
+        return true;
+    }
+    else {
+        DP_error_set("Zstd input seek offset %zu beyond end %zu", offset,
+                     state->length);
+        return false;
+    }
+}
+
+static bool seekable_zstd_input_seek_by(void *internal, size_t size)
+{
+    DP_SeekableZstdInputState *state = internal;
+    if (size <= state->length - state->pos) {
+        state->pos += size;
+        return true;
+    }
+    else {
+        DP_error_set("Can't seek zstd input by %zu from %zu", size,
+                     state->pos);
+        return false;
+    }
+}
+
+static void seekable_zstd_input_dispose(void *internal)
+{
+    DP_SeekableZstdInputState *state = internal;
+    DP_free(state->buffer);
+    DP_free(state->compressed);
+    DP_free(state->frames);
+    ZSTD_freeDCtx(state->dctx);
+    DP_input_free(state->input);
+}
+
+static const DP_InputMethods seekable_zstd_input_methods = {
+    seekable_zstd_input_read,      seekable_zstd_input_length,
+    seekable_zstd_input_rewind,    seekable_zstd_input_rewind_by,
+    seekable_zstd_input_seek,      seekable_zstd_input_seek_by,
+    NULL,                          seekable_zstd_input_dispose,
+};
+
+static const DP_InputMethods *seekable_zstd_input_init(void *internal,
+                                                       void *arg)
+{
+    DP_Input *input = arg;
+    bool error;
+    size_t input_length = DP_input_length(input, &error);
+    if (error) {
+        return NULL;
+    }
+
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (!dctx) {
+        DP_error_set("Error creating zstd decompression context");
+        return NULL;
+    }
+
+    DP_SeekableZstdInputState *state = internal;
+    *state = (DP_SeekableZstdInputState){
+        input, dctx, NULL, 0, 0, 0, 0, SIZE_MAX, NULL, 0, NULL, 0};
+
+    bool found;
+    if (!read_seek_table(state, input_length, &found)
+        || (!found && !scan_frames(state, input_length))) {
+        DP_free(state->frames);
+        ZSTD_freeDCtx(dctx);
+        return NULL;
+    }
+
+    return &seekable_zstd_input_methods;
+}
+
+DP_Input *DP_seekable_zstd_input_new(DP_Input *input)
+{
+    DP_ASSERT(input);
+    DP_Input *zi = DP_input_new(seekable_zstd_input_init, input,
+                                sizeof(DP_SeekableZstdInputState));
+    if (!zi) {
+        DP_input_free(input);
+    }
+    return zi;
+}
+
+DP_Input *DP_seekable_zstd_input_new_detect(DP_Input *input)
+{
+    DP_ASSERT(input);
+    unsigned char magic[FRAME_MAGIC_LENGTH];
+    bool error;
+    size_t read = DP_input_read(input, magic, sizeof(magic), &error);
+    if (error || !DP_input_rewind(input)) {
+        DP_input_free(input);
+        return NULL;
+    }
+    else if (read == sizeof(magic)
+             && DP_read_littleendian_uint32(magic) == ZSTD_MAGICNUMBER) {
+        return DP_seekable_zstd_input_new(input);
+    }
+    else {
+        return input;
+    }
+}
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_SEEKABLE_ZSTD_H
+#define DPENGINE_SEEKABLE_ZSTD_H
+#include <dpcommon/common.h>
+
+typedef struct DP_Input DP_Input;
+typedef struct DP_Output DP_Output;
+
+
+// Data is compressed in independent zstd frames, each holding up to this much
+// uncompressed data, so reading from somewhere in the middle only has to
+// decompress the single frame around it.
+#define DP_SEEKABLE_ZSTD_FRAME_SIZE_DEFAULT (1024 * 1024)
+
+// Frames claiming to be larger than this are rejected when reading, since the
+// whole frame gets decompressed into memory at once.
+#define DP_SEEKABLE_ZSTD_FRAME_SIZE_MAX (64 * 1024 * 1024)
+
+// A frame that has been open for this long is ended at the next write, so that
+// a slow trickle of data still gets to the disk every now and then.
+#define DP_SEEKABLE_ZSTD_SYNC_INTERVAL_MS_DEFAULT 10000
+
+
+// Wraps the given output, taking ownership of it, so that everything written
+// to it is compressed in the seekable zstd format: a sequence of independent
+// zstd frames followed by a seek table in a skippable frame, which regular
+// zstd tools can decompress too. Writes are collected into a buffer of the
+// given frame size and compressed in one go when it's full, when the frame has
+// been open longer than the sync interval or when the output is flushed. Each
+// frame is a sync point, if writing stops abruptly the data up to the last one
+// can still be recovered. The seek table gets written when the output is freed.
+// Telling returns the uncompressed position, seeking is not supported.
+DP_Output *DP_seekable_zstd_output_new(DP_Output *output, size_t frame_size,
+                                       long long sync_interval_ms);
+
+// Wraps the given input, taking ownership of it, and reads it as seekable
+// zstd, with lengths and offsets referring to the uncompressed data. If the
+// seek table is missing, the frames are scanned for instead, which handles
+// files whose writer stopped abruptly. Returns NULL and frees the input if
+// it's not a readable zstd file.
+DP_Input *DP_seekable_zstd_input_new(DP_Input *input);
+
+// Checks if the given input starts with a zstd frame and wraps it using the
+// above if so, otherwise returns it as-is, rewound. Returns NULL and frees
+// the input on error.
+DP_Input *DP_seekable_zstd_input_new_detect(DP_Input *input);
+
+
+#endif
@@ -13,6 +13,8 @@
 #include "layer_list.h"
 #include "layer_props.h"
 #include "layer_props_list.h"
+#include "layer_routes.h"
+#include "memory_report.h"
 #include "pixels.h"
 #include "selection.h"
 #include "selection_set.h"
@@ -38,10 +40,15 @@
 struct DP_Snapshot {
     long long timestamp_ms;
     DP_CanvasState *cs;
+    // Tile memory that this snapshot keeps alive compared to the next newer
+    // one, which is about what evicting it frees. Zero for the newest one.
+    size_t retained_bytes;
 };
 
 struct DP_SnapshotQueue {
     size_t max_count;
+    size_t max_bytes;
+    size_t retained_bytes;
     long long min_delay_ms;
     struct {
         DP_SnapshotQueueTimestampMsFn fn;
@@ -81,6 +88,8 @@ DP_snapshot_queue_new(size_t max_count, long long min_delay_ms,
     if (mutex) {
         DP_SnapshotQueue *sq = DP_malloc(sizeof(*sq));
         *sq = (DP_SnapshotQueue){max_count,
+                                 0,
+                                 0,
                                  min_delay_ms,
                                  {timestamp_fn, timestamp_user},
                                  mutex,
@@ -109,6 +118,32 @@ void DP_snapshot_queue_free(DP_SnapshotQueue *sq)
 }
 
 
+static void shift_snapshot(DP_SnapshotQueue *sq)
+{
+    DP_Snapshot *s = DP_queue_peek(&sq->queue, ELEMENT_SIZE);
+    DP_ASSERT(sq->retained_bytes >= s->retained_bytes);
+    sq->retained_bytes -= s->retained_bytes;
+    dispose_snapshot(s);
+    DP_queue_shift(&sq->queue);
+}
+
+static void clear_snapshots(DP_SnapshotQueue *sq)
+{
+    DP_queue_clear(&sq->queue, ELEMENT_SIZE, dispose_queued_snapshot);
+    sq->retained_bytes = 0;
+}
+
+// The newest snapshot is always kept, it retains nothing by itself.
+static void evict_over_budget(DP_SnapshotQueue *sq)
+{
+    size_t max_bytes = sq->max_bytes;
+    if (max_bytes != 0) {
+        while (sq->queue.used > 1 && sq->retained_bytes > max_bytes) {
+            shift_snapshot(sq);
+        }
+    }
+}
+
 void DP_snapshot_queue_max_count_set(DP_SnapshotQueue *sq, size_t max_count)
 {
     DP_ASSERT(sq);
@@ -116,17 +151,50 @@ void DP_snapshot_queue_max_count_set(DP_SnapshotQueue *sq, size_t max_count)
     DP_MUTEX_MUST_LOCK(mutex);
     sq->max_count = max_count;
     if (max_count == 0) {
-        DP_queue_clear(&sq->queue, ELEMENT_SIZE, dispose_queued_snapshot);
+        clear_snapshots(sq);
     }
     else {
         while (sq->queue.used >= max_count) {
-            dispose_snapshot(DP_queue_peek(&sq->queue, ELEMENT_SIZE));
-            DP_queue_shift(&sq->queue);
+            shift_snapshot(sq);
         }
     }
     DP_MUTEX_MUST_UNLOCK(mutex);
 }
 
+void DP_snapshot_queue_max_bytes_set(DP_SnapshotQueue *sq, size_t max_bytes)
+{
+    DP_ASSERT(sq);
+    DP_Mutex *mutex = sq->mutex;
+    DP_MUTEX_MUST_LOCK(mutex);
+    sq->max_bytes = max_bytes;
+    evict_over_budget(sq);
+    DP_MUTEX_MUST_UNLOCK(mutex);
+}
+
+size_t DP_snapshot_queue_retained_bytes(DP_SnapshotQueue *sq)
+{
+    DP_ASSERT(sq);
+    DP_Mutex *mutex = sq->mutex;
+    DP_MUTEX_MUST_LOCK(mutex);
+    size_t retained_bytes = sq->retained_bytes;
+    DP_MUTEX_MUST_UNLOCK(mutex);
+    return retained_bytes;
+}
+
+size_t DP_snapshot_queue_trim(DP_SnapshotQueue *sq)
+{
+    DP_ASSERT(sq);
+    DP_Mutex *mutex = sq->mutex;
+    DP_MUTEX_MUST_LOCK(mutex);
+    size_t evicted = 0;
+    while (sq->queue.used > 1) {
+        shift_snapshot(sq);
+        ++evicted;
+    }
+    DP_MUTEX_MUST_UNLOCK(mutex);
+    return evicted;
+}
+
 void DP_snapshot_queue_min_delay_ms_set(DP_SnapshotQueue *sq,
                                         long long min_delay_ms)
 {
@@ -158,17 +226,98 @@ static bool should_make_snapshot(DP_SnapshotQueue *sq, DP_CanvasState *cs,
     }
 }
 
+static size_t layer_content_retained_bytes(DP_LayerContent *lc,
+                                           DP_LayerContent *newer_lc_or_null)
+{
+    if (lc == newer_lc_or_null) {
+        return 0;
+    }
+
+    int width = DP_layer_content_width(lc);
+    int height = DP_layer_content_height(lc);
+    bool same_size = newer_lc_or_null
+                  && DP_layer_content_width(newer_lc_or_null) == width
+                  && DP_layer_content_height(newer_lc_or_null) == height;
+    int tile_total = DP_tile_total_round(width, height);
+    size_t bytes = 0;
+    for (int i = 0; i < tile_total; ++i) {
+        DP_Tile *t = DP_layer_content_tile_at_index_noinc(lc, i);
+        DP_Tile *newer_t =
+            same_size
+                ? DP_layer_content_tile_at_index_noinc(newer_lc_or_null, i)
+                : NULL;
+        if (t && t != newer_t) {
+            bytes += DP_TILE_BYTES;
+        }
+    }
+    return bytes;
+}
+
+static size_t layer_list_retained_bytes(DP_LayerList *ll,
+                                        DP_LayerPropsList *lpl,
+                                        DP_CanvasState *newer_cs,
+                                        DP_LayerRoutes *newer_lr)
+{
+    size_t bytes = 0;
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        if (DP_layer_list_entry_is_group(lle)) {
+            DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+            bytes += layer_list_retained_bytes(
+                DP_layer_group_children_noinc(lg),
+                DP_layer_props_children_noinc(lp), newer_cs, newer_lr);
+        }
+        else {
+            // Layers get moved around, so match them up by id instead of
+            // index. Anything not found in the newer state is all retained.
+            DP_LayerRoutesEntry *lre =
+                DP_layer_routes_search(newer_lr, DP_layer_props_id(lp));
+            DP_LayerContent *newer_lc =
+                lre && !DP_layer_routes_entry_is_group(lre)
+                    ? DP_layer_routes_entry_content(lre, newer_cs)
+                    : NULL;
+            bytes += layer_content_retained_bytes(
+                DP_layer_list_entry_content_noinc(lle), newer_lc);
+        }
+    }
+    return bytes;
+}
+
+// Figures out how much tile memory the given state keeps alive that the newer
+// one doesn't. Unchanged layers share their content, so only the layers that
+// actually changed in between need to be looked at tile by tile.
+static size_t canvas_state_retained_bytes(DP_CanvasState *cs,
+                                          DP_CanvasState *newer_cs)
+{
+    if (cs == newer_cs) {
+        return 0;
+    }
+    return layer_list_retained_bytes(
+        DP_canvas_state_layers_noinc(cs), DP_canvas_state_layer_props_noinc(cs),
+        newer_cs, DP_canvas_state_layer_routes_noinc(newer_cs));
+}
+
 static void make_snapshot(DP_SnapshotQueue *sq, long long timestamp_ms,
                           DP_CanvasState *cs)
 {
     size_t max_count = sq->max_count;
     if (max_count != 0) {
         while (sq->queue.used >= max_count) {
-            dispose_snapshot(DP_queue_peek(&sq->queue, ELEMENT_SIZE));
-            DP_queue_shift(&sq->queue);
+            shift_snapshot(sq);
+        }
+
+        DP_Snapshot *prev = DP_queue_peek_last(&sq->queue, ELEMENT_SIZE);
+        if (prev) {
+            DP_ASSERT(prev->retained_bytes == 0);
+            prev->retained_bytes = canvas_state_retained_bytes(prev->cs, cs);
+            sq->retained_bytes += prev->retained_bytes;
         }
+
         DP_Snapshot *s = DP_queue_push(&sq->queue, ELEMENT_SIZE);
-        *s = (DP_Snapshot){timestamp_ms, DP_canvas_state_incref(cs)};
+        *s = (DP_Snapshot){timestamp_ms, DP_canvas_state_incref(cs), 0};
+        evict_over_budget(sq);
     }
 }
 
@@ -210,6 +359,22 @@ void DP_snapshot_queue_get_with(DP_SnapshotQueue *sq, DP_SnapshotsGetFn get_fn,
     DP_MUTEX_MUST_UNLOCK(mutex);
 }
 
+void DP_snapshot_queue_memory_report_add(DP_SnapshotQueue *sq,
+                                         DP_MemoryReport *mr)
+{
+    DP_ASSERT(sq);
+    DP_ASSERT(mr);
+    DP_Mutex *mutex = sq->mutex;
+    DP_MUTEX_MUST_LOCK(mutex);
+    size_t count = sq->queue.used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_Snapshot *s = snapshot_at(sq, i);
+        DP_memory_report_canvas_state_add(mr, DP_MEMORY_REPORT_SOURCE_SNAPSHOT,
+                                          s->timestamp_ms, s->cs);
+    }
+    DP_MUTEX_MUST_UNLOCK(mutex);
+}
+
 
 struct DP_ResetImageOutputBuffer {
     size_t capacity;
@@ -304,24 +469,36 @@ static size_t reset_image_compress_tile_gzip8be(struct DP_ResetImageContext *c,
 }
 
 static size_t reset_image_compress_tile_zstd8le(struct DP_ResetImageContext *c,
-                                                int buffer_index, DP_Tile *t)
+                                                int buffer_index, DP_Tile *t,
+                                                const ZSTD_CDict *cdict)
 {
     struct DP_ResetImageBuffer *buffer = &c->buffers[buffer_index];
-    return t ? DP_tile_compress_split_delta_zstd8le(
-                   t, &buffer->zstd_context, &buffer->pixels->split,
-                   reset_image_get_output_buffer, &buffer->output)
-             : DP_tile_compress_pixel8le(DP_pixel15_zero(),
+    if (!t) {
+        return DP_tile_compress_pixel8le(DP_pixel15_zero(),
                                          reset_image_get_output_buffer,
                                          &buffer->output);
+    }
+    else if (cdict) {
+        // The encoding cache only holds plain encodings, so this bypasses it.
+        return DP_tile_compress_split_delta_zstd8le_with_dictionary(
+            t, &buffer->zstd_context, cdict, &buffer->pixels->split,
+            reset_image_get_output_buffer, &buffer->output);
+    }
+    else {
+        return DP_tile_compress_split_delta_zstd8le_cached(
+            t, &buffer->zstd_context, &buffer->pixels->split,
+            reset_image_get_output_buffer, &buffer->output);
+    }
 }
 
 static size_t reset_image_compress_tile(struct DP_ResetImageContext *c,
-                                        int buffer_index, DP_Tile *t)
+                                        int buffer_index, DP_Tile *t,
+                                        const ZSTD_CDict *cdict)
 {
     size_t size;
     switch (c->options.compression) {
     case DP_RESET_IMAGE_COMPRESSION_ZSTD8LE:
-        size = reset_image_compress_tile_zstd8le(c, buffer_index, t);
+        size = reset_image_compress_tile_zstd8le(c, buffer_index, t, cdict);
         break;
     default:
         size = reset_image_compress_tile_gzip8be(c, buffer_index, t);
@@ -421,7 +598,7 @@ static bool tile_is_effectively_blank(DP_Tile *t, DP_Pixel15 fill_pixel)
 static void background_to_reset_image(struct DP_ResetImageContext *c,
                                       int buffer_index, DP_Tile *t)
 {
-    size_t size = reset_image_compress_tile(c, buffer_index, t);
+    size_t size = reset_image_compress_tile(c, buffer_index, t, NULL);
     if (size != 0) {
         reset_image_handle(
             c, (DP_ResetEntry){
@@ -433,16 +610,29 @@ static void background_to_reset_image(struct DP_ResetImageContext *c,
 static void tile_to_reset_image(struct DP_ResetImageContext *c,
                                 int buffer_index, int layer_index, int layer_id,
                                 int sublayer_id, int tile_index, int tile_run,
-                                DP_Tile *t)
+                                DP_Tile *t, bool ephemeral)
 {
-    size_t size = reset_image_compress_tile(c, buffer_index, t);
+    DP_Tile *persistent_t = ephemeral ? NULL : t;
+    unsigned int context_id = t ? DP_tile_context_id(t) : 0u;
+    if (persistent_t && c->options.tile_known.fn
+        && c->options.tile_known.fn(c->options.tile_known.user, persistent_t)) {
+        reset_image_handle(
+            c, (DP_ResetEntry){DP_RESET_ENTRY_TILE,
+                               .tile = {layer_index, layer_id, sublayer_id,
+                                        tile_index, tile_run, context_id, 0,
+                                        NULL, persistent_t}});
+        return;
+    }
+
+    size_t size = reset_image_compress_tile(
+        c, buffer_index, t, persistent_t ? c->options.zstd_dictionary : NULL);
     if (size != 0) {
         reset_image_handle(
             c, (DP_ResetEntry){DP_RESET_ENTRY_TILE,
                                .tile = {layer_index, layer_id, sublayer_id,
-                                        tile_index, tile_run,
-                                        t ? DP_tile_context_id(t) : 0u, size,
-                                        c->buffers[buffer_index].output.data}});
+                                        tile_index, tile_run, context_id, size,
+                                        c->buffers[buffer_index].output.data,
+                                        persistent_t}});
     }
 }
 
@@ -494,7 +684,8 @@ static void reset_image_job(void *user, int thread_index)
         DP_Tile *t = job->tile.t;
         tile_to_reset_image(job->c, thread_index, job->tile.layer_index,
                             job->tile.layer_id, job->tile.sublayer_id,
-                            job->tile.tile_index, job->tile.tile_run, t);
+                            job->tile.tile_index, job->tile.tile_run, t,
+                            job->tile.holds_ref);
         if (job->tile.holds_ref) {
             DP_tile_decref(t);
         }
@@ -531,7 +722,7 @@ static void flush_tile(struct DP_ResetImageContext *c, int layer_index,
     }
     else {
         tile_to_reset_image(c, 0, layer_index, layer_id, sublayer_id,
-                            tile_index, tile_run, t);
+                            tile_index, tile_run, t, ephemeral);
     }
 }
 
@@ -846,8 +1037,11 @@ void DP_reset_image_build_with(
     DP_Worker *worker;
     if (options->use_worker) {
         int thread_count = DP_worker_cpu_count(128);
-        worker = DP_worker_new(1024, sizeof(struct DP_ResetImageJob),
-                               thread_count, reset_image_job);
+        // Reset images are built in the background while the user keeps
+        // drawing, so they shouldn't hold up the canvas.
+        worker = DP_worker_new_with_priority(
+            1024, sizeof(struct DP_ResetImageJob), thread_count,
+            DP_WORKER_PRIORITY_LOW, reset_image_job);
         if (worker) {
             buffers_count = thread_count;
         }
@@ -1165,8 +1359,15 @@ void DP_reset_image_build(DP_CanvasState *cs, unsigned int context_id,
     DP_ResetImageCompression compression =
         compatibility_mode ? DP_RESET_IMAGE_COMPRESSION_GZIP8BE
                            : DP_RESET_IMAGE_COMPRESSION_ZSTD8LE;
-    DP_ResetImageOptions options = {
-        true, false, !compatibility_mode, compression, 0, 0, {NULL, NULL}};
+    DP_ResetImageOptions options = {true,
+                                    false,
+                                    !compatibility_mode,
+                                    compression,
+                                    0,
+                                    0,
+                                    {NULL, NULL},
+                                    {NULL, NULL},
+                                    NULL};
     struct DP_ResetImageMessageContext c = {
         context_id, 0, compatibility_mode, DP_mutex_new(), push_message, user};
     if (!c.mutex) {
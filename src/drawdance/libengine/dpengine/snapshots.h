@@ -11,9 +11,12 @@ typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
 typedef struct DP_KeyFrame DP_KeyFrame;
 typedef struct DP_LayerProps DP_LayerProps;
+typedef struct DP_MemoryReport DP_MemoryReport;
 typedef struct DP_Message DP_Message;
 typedef struct DP_Output DP_Output;
+typedef struct DP_Tile DP_Tile;
 typedef struct DP_Track DP_Track;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
 
 
 typedef struct DP_Snapshot DP_Snapshot;
@@ -42,6 +45,19 @@ typedef struct DP_ResetImageOptions {
         bool (*fn)(void *, DP_Image *, DP_Output *);
         void *user;
     } thumb_write;
+    // Called on worker threads for each tile that's part of the canvas state
+    // (as opposed to merged sublayers), before compressing it. If it returns
+    // true, the tile's entry is emitted with no data instead, since the
+    // handler already has it from an earlier build.
+    struct {
+        bool (*fn)(void *, DP_Tile *);
+        void *user;
+    } tile_known;
+    // Dictionary to compress persistent layer tiles with when using zstd8le
+    // compression, NULL for none. Those are the tile entries that have both a
+    // tile and data, the handler must keep track of which dictionary they
+    // were compressed with, since they can't be decompressed without it.
+    const ZSTD_CDict *zstd_dictionary;
 } DP_ResetImageOptions;
 
 typedef enum DP_ResetEntryType {
@@ -86,6 +102,7 @@ typedef struct DP_ResetEntryTile {
     unsigned int context_id;
     size_t size;
     void *data;
+    DP_Tile *t; // Null for merged sublayers, which are thrown away after.
 } DP_ResetEntryTile;
 
 typedef struct DP_ResetEntrySelectionTile {
@@ -151,6 +168,17 @@ void DP_snapshot_queue_max_count_set(DP_SnapshotQueue *sq, size_t max_count);
 void DP_snapshot_queue_min_delay_ms_set(DP_SnapshotQueue *sq,
                                         long long min_delay_ms);
 
+// Limits the tile memory kept alive by older snapshots, counting only tiles
+// that aren't shared with the snapshot after them. The oldest ones get evicted
+// first. The newest snapshot is always kept. Zero means no limit.
+void DP_snapshot_queue_max_bytes_set(DP_SnapshotQueue *sq, size_t max_bytes);
+
+size_t DP_snapshot_queue_retained_bytes(DP_SnapshotQueue *sq);
+
+// Evicts every snapshot except the newest one, for when memory runs low.
+// Returns how many were evicted. New snapshots get made as usual afterwards.
+size_t DP_snapshot_queue_trim(DP_SnapshotQueue *sq);
+
 // Pass this to canvas_history_new to wire up the snapshot queue.
 void DP_snapshot_queue_on_save_point(void *user, DP_CanvasState *cs,
                                      bool snapshot_requested);
@@ -158,6 +186,10 @@ void DP_snapshot_queue_on_save_point(void *user, DP_CanvasState *cs,
 void DP_snapshot_queue_get_with(DP_SnapshotQueue *sq, DP_SnapshotsGetFn get_fn,
                                 void *user);
 
+// Adds each snapshot with its timestamp as the index.
+void DP_snapshot_queue_memory_report_add(DP_SnapshotQueue *sq,
+                                         DP_MemoryReport *mr);
+
 
 void DP_reset_image_build_with(
     DP_CanvasState *cs, const DP_ResetImageOptions *options,
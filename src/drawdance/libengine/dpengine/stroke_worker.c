@@ -14,6 +14,9 @@ struct DP_StrokeWorker {
     DP_Thread *thread;
     DP_Queue queue;
     DP_BrushEngine *be;
+    // Whether the brush engine syncs with the paint engine to get a canvas
+    // state to sample from. Otherwise the one passed in is handed along.
+    bool sync_samples;
 };
 
 typedef enum DP_StrokeWorkerJobType {
@@ -63,16 +66,20 @@ typedef struct DP_StrokeWorkerJob {
             bool flip;
             float zoom;
             float angle;
+            DP_CanvasState *cs;
         } stroke_begin;
         struct {
             DP_BrushPoint bp;
+            DP_CanvasState *cs;
         } stroke_to;
         struct {
             long long time_msec;
+            DP_CanvasState *cs;
         } poll;
         struct {
             long long time_msec;
             bool push_pen_up;
+            DP_CanvasState *cs;
         } stroke_end;
         struct {
             float x;
@@ -99,13 +106,43 @@ static bool shift_job(DP_Mutex *queue_mutex, DP_Queue *queue,
     return job;
 }
 
+// When the thread falls behind, there's further input queued up behind a dab
+// flush. Flushing anyway would send out lots of small draw dabs messages, so
+// the dabs are instead left to accumulate until the last flush in that run.
+// Only strokes and polls may be in between, since those just generate more
+// dabs, anything else needs the dabs up to that point to be sent out first.
+static bool should_defer_flush(DP_Mutex *queue_mutex, DP_Queue *queue)
+{
+    bool defer = false;
+    DP_MUTEX_MUST_LOCK(queue_mutex);
+    size_t used = queue->used;
+    for (size_t i = 0; i < used; ++i) {
+        DP_StrokeWorkerJob *job =
+            DP_queue_at(queue, sizeof(DP_StrokeWorkerJob), i);
+        DP_StrokeWorkerJobType type = job->type;
+        if (type == DP_STROKE_WORKER_JOB_DABS_FLUSH) {
+            defer = true;
+            break;
+        }
+        else if (type != DP_STROKE_WORKER_JOB_NONE
+                 && type != DP_STROKE_WORKER_JOB_STROKE_TO
+                 && type != DP_STROKE_WORKER_JOB_POLL) {
+            break;
+        }
+    }
+    DP_MUTEX_MUST_UNLOCK(queue_mutex);
+    return defer;
+}
+
 static void run_stroke_worker_thread(void *data)
 {
+    DP_thread_role_set(DP_THREAD_ROLE_INTERACTIVE);
     DP_StrokeWorker *sw = data;
     DP_Semaphore *sem = sw->sem;
     DP_Mutex *mutex = sw->mutex;
     DP_Queue *queue = &sw->queue;
     bool stroking = false;
+    bool sync_samples = false;
     while (true) {
         DP_SEMAPHORE_MUST_WAIT(sem);
         DP_StrokeWorkerJob job;
@@ -118,6 +155,7 @@ static void run_stroke_worker_thread(void *data)
                 continue;
             case DP_STROKE_WORKER_JOB_CLASSIC_BRUSH_SET:
                 DP_ASSERT(!stroking);
+                sync_samples = job.classic->besp.sync_samples;
                 DP_brush_engine_classic_brush_set(
                     sw->be, &job.classic->brush, &job.classic->besp,
                     job.classic->have_color_override
@@ -129,6 +167,7 @@ static void run_stroke_worker_thread(void *data)
                 continue;
             case DP_STROKE_WORKER_JOB_MYPAINT_BRUSH_SET:
                 DP_ASSERT(!stroking);
+                sync_samples = job.mypaint->besp.sync_samples;
                 DP_brush_engine_mypaint_brush_set(
                     sw->be, &job.mypaint->brush, &job.mypaint->settings,
                     &job.mypaint->besp,
@@ -140,7 +179,11 @@ static void run_stroke_worker_thread(void *data)
                 DP_free(job.mypaint);
                 continue;
             case DP_STROKE_WORKER_JOB_DABS_FLUSH:
-                DP_brush_engine_dabs_flush(sw->be);
+                // Samples are synced with what the paint engine has gotten so
+                // far, so holding back dabs would change what they pick up.
+                if (sync_samples || !should_defer_flush(mutex, queue)) {
+                    DP_brush_engine_dabs_flush(sw->be);
+                }
                 continue;
             case DP_STROKE_WORKER_JOB_MESSAGE_PUSH:
                 DP_brush_engine_message_push_noinc(sw->be, job.msg);
@@ -148,22 +191,28 @@ static void run_stroke_worker_thread(void *data)
             case DP_STROKE_WORKER_JOB_STROKE_BEGIN:
                 stroking = true;
                 DP_brush_engine_stroke_begin(
-                    sw->be, NULL, job.stroke_begin.context_id,
+                    sw->be, job.stroke_begin.cs, job.stroke_begin.context_id,
                     job.stroke_begin.compatibility_mode,
                     job.stroke_begin.push_undo_point, job.stroke_begin.mirror,
                     job.stroke_begin.flip, job.stroke_begin.zoom,
                     job.stroke_begin.angle);
+                DP_canvas_state_decref_nullable(job.stroke_begin.cs);
                 continue;
             case DP_STROKE_WORKER_JOB_STROKE_TO:
-                DP_brush_engine_stroke_to(sw->be, job.stroke_to.bp, NULL);
+                DP_brush_engine_stroke_to(sw->be, job.stroke_to.bp,
+                                          job.stroke_to.cs);
+                DP_canvas_state_decref_nullable(job.stroke_to.cs);
                 continue;
             case DP_STROKE_WORKER_JOB_POLL:
-                DP_brush_engine_poll(sw->be, job.poll.time_msec, NULL);
+                DP_brush_engine_poll(sw->be, job.poll.time_msec, job.poll.cs);
+                DP_canvas_state_decref_nullable(job.poll.cs);
                 continue;
             case DP_STROKE_WORKER_JOB_STROKE_END:
                 stroking = false;
                 DP_brush_engine_stroke_end(sw->be, job.stroke_end.time_msec,
-                                           NULL, job.stroke_end.push_pen_up);
+                                           job.stroke_end.cs,
+                                           job.stroke_end.push_pen_up);
+                DP_canvas_state_decref_nullable(job.stroke_end.cs);
                 continue;
             case DP_STROKE_WORKER_JOB_OFFSET_ADD:
                 DP_brush_engine_offset_add(sw->be, job.offset_add.x,
@@ -202,7 +251,7 @@ static void push_job(DP_StrokeWorker *sw, DP_StrokeWorkerJob job)
 DP_StrokeWorker *DP_stroke_worker_new(DP_BrushEngine *be)
 {
     DP_StrokeWorker *sw = DP_malloc(sizeof(*sw));
-    *sw = (DP_StrokeWorker){NULL, NULL, NULL, DP_QUEUE_NULL, be};
+    *sw = (DP_StrokeWorker){NULL, NULL, NULL, DP_QUEUE_NULL, be, false};
     DP_queue_init(&sw->queue, 64, sizeof(DP_StrokeWorkerJob));
     return sw;
 }
@@ -297,10 +346,12 @@ void DP_stroke_worker_size_limit_set(DP_StrokeWorker *sw, int size_limit)
     }
 }
 
-static void start_or_stop_thread(DP_StrokeWorker *sw, bool sync_samples,
+static void start_or_stop_thread(DP_StrokeWorker *sw, bool want_thread,
+                                 bool sync_samples,
                                  DP_LayerContent *flood_lc_or_null)
 {
-    if (sync_samples || flood_lc_or_null) {
+    sw->sync_samples = sync_samples;
+    if (want_thread || sync_samples || flood_lc_or_null) {
         if (!sw->thread) {
             bool started = DP_stroke_worker_thread_start(sw);
             if (!started) {
@@ -323,7 +374,7 @@ void DP_stroke_worker_classic_brush_set(DP_StrokeWorker *sw,
     DP_ASSERT(brush);
     DP_ASSERT(besp);
 
-    start_or_stop_thread(sw, besp->sync_samples, besp->flood_lc);
+    start_or_stop_thread(sw, false, besp->sync_samples, besp->flood_lc);
 
     if (sw->thread) {
         DP_StrokeWorkerJobClassic *classic = DP_malloc(sizeof(*classic));
@@ -357,7 +408,9 @@ void DP_stroke_worker_mypaint_brush_set(DP_StrokeWorker *sw,
     DP_ASSERT(settings);
     DP_ASSERT(besp);
 
-    start_or_stop_thread(sw, besp->sync_samples, besp->flood_lc);
+    // MyPaint brushes are expensive enough to hold up input handling when
+    // they're big or have a small spacing, so they always get a thread.
+    start_or_stop_thread(sw, true, besp->sync_samples, besp->flood_lc);
 
     if (sw->thread) {
         DP_StrokeWorkerJobMyPaint *mypaint = DP_malloc(sizeof(*mypaint));
@@ -392,6 +445,12 @@ void DP_stroke_worker_dabs_flush(DP_StrokeWorker *sw)
     }
 }
 
+bool DP_stroke_worker_dabs_deferrable(DP_StrokeWorker *sw)
+{
+    DP_ASSERT(sw);
+    return !sw->sync_samples;
+}
+
 void DP_stroke_worker_message_push_noinc(DP_StrokeWorker *sw, DP_Message *msg)
 {
     DP_ASSERT(sw);
@@ -405,6 +464,20 @@ void DP_stroke_worker_message_push_noinc(DP_StrokeWorker *sw, DP_Message *msg)
     }
 }
 
+// With synced samples, the brush engine gets its canvas state from the paint
+// engine, since the one passed in here is going to be outdated by the time the
+// thread gets to it. Otherwise it's passed along, same as without a thread.
+static DP_CanvasState *job_canvas_state(DP_StrokeWorker *sw,
+                                        DP_CanvasState *cs_or_null)
+{
+    if (sw->sync_samples) {
+        return NULL;
+    }
+    else {
+        return DP_canvas_state_incref_nullable(cs_or_null);
+    }
+}
+
 void DP_stroke_worker_stroke_begin(DP_StrokeWorker *sw,
                                    DP_CanvasState *cs_or_null,
                                    unsigned int context_id,
@@ -414,11 +487,12 @@ void DP_stroke_worker_stroke_begin(DP_StrokeWorker *sw,
 {
     DP_ASSERT(sw);
     if (sw->thread) {
+        DP_CanvasState *cs = job_canvas_state(sw, cs_or_null);
         push_job(sw, (DP_StrokeWorkerJob){
                          DP_STROKE_WORKER_JOB_STROKE_BEGIN,
                          {.stroke_begin = {context_id, compatibility_mode,
                                            push_undo_point, mirror, flip, zoom,
-                                           angle}}});
+                                           angle, cs}}});
     }
     else {
         DP_brush_engine_stroke_begin(sw->be, cs_or_null, context_id,
@@ -433,8 +507,9 @@ void DP_stroke_worker_stroke_to(DP_StrokeWorker *sw, const DP_BrushPoint *bp,
     DP_ASSERT(sw);
     DP_ASSERT(bp);
     if (sw->thread) {
+        DP_CanvasState *cs = job_canvas_state(sw, cs_or_null);
         push_job(sw, (DP_StrokeWorkerJob){DP_STROKE_WORKER_JOB_STROKE_TO,
-                                          {.stroke_to = {*bp}}});
+                                          {.stroke_to = {*bp, cs}}});
     }
     else {
         DP_brush_engine_stroke_to(sw->be, *bp, cs_or_null);
@@ -446,8 +521,9 @@ void DP_stroke_worker_poll(DP_StrokeWorker *sw, long long time_msec,
 {
     DP_ASSERT(sw);
     if (sw->thread) {
+        DP_CanvasState *cs = job_canvas_state(sw, cs_or_null);
         push_job(sw, (DP_StrokeWorkerJob){DP_STROKE_WORKER_JOB_POLL,
-                                          {.poll = {time_msec}}});
+                                          {.poll = {time_msec, cs}}});
     }
     else {
         DP_brush_engine_poll(sw->be, time_msec, cs_or_null);
@@ -459,9 +535,10 @@ void DP_stroke_worker_stroke_end(DP_StrokeWorker *sw, long long time_msec,
 {
     DP_ASSERT(sw);
     if (sw->thread) {
-        push_job(
-            sw, (DP_StrokeWorkerJob){DP_STROKE_WORKER_JOB_STROKE_END,
-                                     {.stroke_end = {time_msec, push_pen_up}}});
+        DP_CanvasState *cs = job_canvas_state(sw, cs_or_null);
+        push_job(sw, (DP_StrokeWorkerJob){
+                         DP_STROKE_WORKER_JOB_STROKE_END,
+                         {.stroke_end = {time_msec, push_pen_up, cs}}});
     }
     else {
         DP_brush_engine_stroke_end(sw->be, time_msec, cs_or_null, push_pen_up);
@@ -480,6 +557,18 @@ static void cancel_job(void *element, DP_UNUSED void *user)
     case DP_STROKE_WORKER_JOB_MYPAINT_BRUSH_SET:
         DP_free(job->mypaint);
         break;
+    case DP_STROKE_WORKER_JOB_STROKE_BEGIN:
+        DP_canvas_state_decref_nullable(job->stroke_begin.cs);
+        break;
+    case DP_STROKE_WORKER_JOB_STROKE_TO:
+        DP_canvas_state_decref_nullable(job->stroke_to.cs);
+        break;
+    case DP_STROKE_WORKER_JOB_POLL:
+        DP_canvas_state_decref_nullable(job->poll.cs);
+        break;
+    case DP_STROKE_WORKER_JOB_STROKE_END:
+        DP_canvas_state_decref_nullable(job->stroke_end.cs);
+        break;
     default:
         break;
     }
@@ -44,6 +44,11 @@ void DP_stroke_worker_mypaint_brush_set(DP_StrokeWorker *sw,
 
 void DP_stroke_worker_dabs_flush(DP_StrokeWorker *sw);
 
+// Whether dab flushes may be held back for a bit to batch several inputs' worth
+// of dabs into fewer messages. Not when samples are synced, since those work
+// off of what the paint engine has gotten so far.
+bool DP_stroke_worker_dabs_deferrable(DP_StrokeWorker *sw);
+
 void DP_stroke_worker_message_push_noinc(DP_StrokeWorker *sw, DP_Message *msg);
 
 void DP_stroke_worker_stroke_begin(DP_StrokeWorker *sw,
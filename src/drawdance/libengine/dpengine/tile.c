@@ -39,39 +39,110 @@
 #include <dpcommon/threading.h>
 #include <dpmsg/blend_mode.h>
 #include <fastapprox/fastpow.h>
-
-
+#include <stdlib.h>
+#include <uthash_inc.h>
+
+
+// Bookkeeping for moving the pixels of persistent tiles that haven't been used
+// in a while into compressed cold storage, see DP_tile_residency_trim below.
+// The pins, last use, cold storage and encoding are protected by the lock, the
+// links in the list of resident tiles by the lock of the tile's shard. While a
+// tile is pinned, its pixels stay where they are. The encoding caches the
+// result of DP_tile_compress_split_delta_zstd8le_cached, it's only ever set on
+// resident tiles and dropped when they're evicted.
+typedef struct DP_TileResidency {
+    DP_Atomic lock;
+    int pins;
+    unsigned int last_used;
+    bool listed;
+    bool cold_alpha;
+    DP_Pixel15 cold_pixel;
+    size_t cold_size;
+    unsigned char *cold_data;
+    size_t encoded_size;
+    unsigned char *encoded_data;
+    struct DP_Tile *prev;
+    struct DP_Tile *next;
+} DP_TileResidency;
+
+// If maybe_blank is false, the tile is known not to be blank. If uniform is
+// true, all pixels of the tile are known to be the same, so they don't need to
+// be looked at individually. Either one being set the other way means unknown.
+// The opacity caches the result of DP_tile_opaque for persistent tiles, it
+// starts out as TILE_OPACITY_UNKNOWN and is only filled in once asked for.
+// The bounds work the same way for DP_tile_alpha_bounds, see TILE_BOUNDS_.
+// The shard is the one the tile was allocated from, remote_next links it into
+// that shard's list of remote frees once it's dead. The intern fields are
+// protected by the intern lock, see DP_tile_intern below. The pixels are NULL
+// while the tile is cold.
 #ifdef DP_NO_STRICT_ALIASING
 
 struct DP_Tile {
-    DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
+    DP_Pixel15 *pixels;
     DP_Atomic refcount;
     const bool transient;
     const bool maybe_blank;
+    const bool uniform;
+    DP_Atomic opacity;
+    DP_Atomic bounds;
     const unsigned int context_id;
+    unsigned int shard;
+    struct DP_Tile *remote_next;
+    bool interned;
+    uint64_t intern_hash;
+    UT_hash_handle hh;
+    DP_TileResidency residency;
 };
 
 struct DP_TransientTile {
-    DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
+    DP_Pixel15 *pixels;
     DP_Atomic refcount;
     bool transient;
     bool maybe_blank;
+    bool uniform;
+    DP_Atomic opacity;
+    DP_Atomic bounds;
     unsigned int context_id;
+    unsigned int shard;
+    struct DP_Tile *remote_next;
+    bool interned;
+    uint64_t intern_hash;
+    UT_hash_handle hh;
+    DP_TileResidency residency;
 };
 
 #else
 
 struct DP_Tile {
-    DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
+    DP_Pixel15 *pixels;
     DP_Atomic refcount;
     bool transient;
     bool maybe_blank;
+    bool uniform;
+    DP_Atomic opacity;
+    DP_Atomic bounds;
     unsigned int context_id;
+    unsigned int shard;
+    struct DP_Tile *remote_next;
+    bool interned;
+    uint64_t intern_hash;
+    UT_hash_handle hh;
+    DP_TileResidency residency;
 };
 
 #endif
 
 
+#define TILE_OPACITY_UNKNOWN     0
+#define TILE_OPACITY_OPAQUE      1
+#define TILE_OPACITY_TRANSLUCENT 2
+
+// Cached alpha bounds are packed into a single atomic as 2 + x1, y1, x2 and y2
+// at 6 bits each, with the small values left for the special cases.
+#define TILE_BOUNDS_UNKNOWN 0
+#define TILE_BOUNDS_EMPTY   1
+#define TILE_BOUNDS_OFFSET  2
+
 // We want to initialize a static buffer with the same value 4096 times, so this
 // is a goofy way to achieve that at compile time without spelling it all out.
 #define DP_BIT15_4    DP_BIT15, DP_BIT15, DP_BIT15, DP_BIT15
@@ -87,46 +158,424 @@ const uint16_t *DP_tile_opaque_mask(void)
     return opaque_mask;
 }
 
-static DP_MemoryPool tile_memory_pool;
-static DP_Mutex *tile_memory_pool_lock = NULL;
+// Tiles are allocated from a handful of shards, picked by hashing the id of
+// the allocating thread, so that threads allocating at the same time usually
+// don't wait on each other. A tile freed from a thread that maps to another
+// shard is put on that shard's remote list instead, which gets returned to the
+// pools in a batch by whoever takes the shard lock next. The list of resident
+// tiles and the residency counters are protected by the shard lock as well.
+#define TILE_SHARD_COUNT         8
+#define TILE_REMOTE_FREE_BATCH   32
+#define TILE_SHARD_INDEX_SHIFT   61
+static_assert(TILE_SHARD_COUNT == 1 << (64 - TILE_SHARD_INDEX_SHIFT),
+              "Tile shard index shift matches shard count");
+
+typedef struct DP_TileShard {
+    DP_Mutex *lock;
+    DP_MemoryPool tile_pool;
+    DP_MemoryPool pixel_pool;
+    // Persistent tiles with resident pixels, most recently listed first.
+    DP_Tile *resident_first;
+    DP_Tile *resident_last;
+    size_t resident_count;
+    size_t cold_count;
+    size_t cold_bytes;
+    size_t evictions;
+    size_t inflations;
+    size_t encoded_count;
+    size_t encoded_bytes;
+    size_t encoded_limit;
+    size_t remote_frees;
+    size_t remote_batches;
+    // Protected by the remote lock, the count is there to check it cheaply.
+    DP_Atomic remote_lock;
+    DP_Atomic remote_count;
+    DP_Tile *remote_first;
+} DP_TileShard;
+
+static DP_TileShard tile_shards[TILE_SHARD_COUNT];
+static DP_Mutex *tile_intern_lock = NULL;
+static bool tile_intern_enabled;
+static DP_Tile *tile_intern_table;
+static size_t tile_intern_hits;
+static DP_Atomic tile_residency_epoch;
+static DP_Atomic tile_trim_shard;
+static DP_Atomic tile_encoding_hits;
+
+static bool get_env_tile_intern(void)
+{
+    const char *value = getenv("DP_TILE_INTERN");
+    return value && !DP_str_equal(value, "") && !DP_str_equal(value, "0");
+}
+
+static void init_tile_shards(void)
+{
+    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(tile_shards_spinlock);
+    if (!tile_intern_lock) {
+        DP_atomic_lock(&tile_shards_spinlock);
+        if (!tile_intern_lock) {
+            for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+                DP_TileShard *shard = &tile_shards[i];
+                shard->lock = DP_mutex_new();
+                shard->tile_pool =
+                    DP_memory_pool_new_type(DP_TransientTile, 128);
+                shard->pixel_pool = DP_memory_pool_new(DP_TILE_BYTES, 32);
+                shard->encoded_limit =
+                    DP_TILE_ENCODING_CACHE_DEFAULT_LIMIT / TILE_SHARD_COUNT;
+            }
+            tile_intern_enabled = get_env_tile_intern();
+            tile_intern_lock = DP_mutex_new();
+        }
+        DP_atomic_unlock(&tile_shards_spinlock);
+    }
+}
 
-static void *alloc_tile(bool transient, bool maybe_blank,
-                        unsigned int context_id)
+static unsigned int current_shard_index(void)
 {
-    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(tile_memory_pool_spinlock);
-    if (!tile_memory_pool_lock) {
-        DP_atomic_lock(&tile_memory_pool_spinlock);
-        if (!tile_memory_pool_lock) {
-            tile_memory_pool = DP_memory_pool_new_type(DP_TransientTile, 1024);
-            tile_memory_pool_lock = DP_mutex_new();
-        }
-        DP_atomic_unlock(&tile_memory_pool_spinlock);
+    DP_ThreadId id = DP_thread_current_id();
+    uint64_t x = 0;
+    memcpy(&x, &id, DP_min_size(sizeof(id), sizeof(x)));
+    return (unsigned int)((x * 0x9e3779b97f4a7c15u) >> TILE_SHARD_INDEX_SHIFT);
+}
+
+// Must be called with the shard lock held.
+static void resident_link(DP_TileShard *shard, DP_Tile *t)
+{
+    DP_ASSERT(!t->residency.listed);
+    t->residency.listed = true;
+    t->residency.prev = NULL;
+    t->residency.next = shard->resident_first;
+    if (shard->resident_first) {
+        shard->resident_first->residency.prev = t;
+    }
+    else {
+        shard->resident_last = t;
     }
+    shard->resident_first = t;
+    ++shard->resident_count;
+}
+
+// Must be called with the shard lock held.
+static void resident_unlink(DP_TileShard *shard, DP_Tile *t)
+{
+    DP_ASSERT(t->residency.listed);
+    DP_Tile *prev = t->residency.prev;
+    DP_Tile *next = t->residency.next;
+    if (prev) {
+        prev->residency.next = next;
+    }
+    else {
+        shard->resident_first = next;
+    }
+    if (next) {
+        next->residency.prev = prev;
+    }
+    else {
+        shard->resident_last = prev;
+    }
+    t->residency.listed = false;
+    t->residency.prev = NULL;
+    t->residency.next = NULL;
+    --shard->resident_count;
+}
+
+// Gives the memory of a dead tile back to its pools. Must be called with the
+// shard lock held, the cold data and encoding must already have been freed.
+static void free_tile(DP_TileShard *shard, DP_Tile *t)
+{
+    if (t->residency.listed) {
+        resident_unlink(shard, t);
+    }
+    if (t->residency.encoded_size != 0) {
+        --shard->encoded_count;
+        shard->encoded_bytes -= t->residency.encoded_size;
+    }
+    if (t->pixels) {
+        DP_memory_pool_free_el(&shard->pixel_pool, t->pixels);
+    }
+    else {
+        --shard->cold_count;
+        shard->cold_bytes -= t->residency.cold_size;
+    }
+    DP_memory_pool_free_el(&shard->tile_pool, t);
+}
+
+// Must be called with the shard lock held.
+static void return_remote_frees(DP_TileShard *shard)
+{
+    DP_atomic_lock(&shard->remote_lock);
+    DP_Tile *t = shard->remote_first;
+    int count = DP_atomic_xch(&shard->remote_count, 0);
+    shard->remote_first = NULL;
+    DP_atomic_unlock(&shard->remote_lock);
+
+    while (t) {
+        DP_Tile *next = t->remote_next;
+        free_tile(shard, t);
+        t = next;
+    }
+
+    if (count != 0) {
+        shard->remote_frees += DP_int_to_size(count);
+        ++shard->remote_batches;
+    }
+}
+
+static void lock_shard(DP_TileShard *shard)
+{
+    DP_MUTEX_MUST_LOCK(shard->lock);
+    if (DP_atomic_get(&shard->remote_count) != 0) {
+        return_remote_frees(shard);
+    }
+}
+
+static void unlock_shard(DP_TileShard *shard)
+{
+    DP_MUTEX_MUST_UNLOCK(shard->lock);
+}
+
+static void *alloc_tile(bool transient, bool maybe_blank, bool uniform,
+                        unsigned int context_id)
+{
+    init_tile_shards();
 
-    DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-    DP_TransientTile *tt = DP_memory_pool_alloc_el(&tile_memory_pool);
-    DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+    unsigned int shard_index = current_shard_index();
+    DP_TileShard *shard = &tile_shards[shard_index];
+    lock_shard(shard);
+    DP_TransientTile *tt = DP_memory_pool_alloc_el(&shard->tile_pool);
+    tt->pixels = DP_memory_pool_alloc_el(&shard->pixel_pool);
+    unlock_shard(shard);
 
     DP_atomic_set(&tt->refcount, 1);
     tt->transient = transient;
     tt->maybe_blank = maybe_blank;
+    tt->uniform = uniform;
+    DP_atomic_set(&tt->opacity, TILE_OPACITY_UNKNOWN);
+    DP_atomic_set(&tt->bounds, TILE_BOUNDS_UNKNOWN);
     tt->context_id = context_id;
+    tt->shard = shard_index;
+    tt->remote_next = NULL;
+    tt->interned = false;
+    DP_atomic_set(&tt->residency.lock, 0);
+    tt->residency.pins = 0;
+    tt->residency.last_used =
+        (unsigned int)DP_atomic_get(&tile_residency_epoch);
+    tt->residency.listed = false;
+    tt->residency.cold_alpha = false;
+    tt->residency.cold_size = 0;
+    tt->residency.cold_data = NULL;
+    tt->residency.encoded_size = 0;
+    tt->residency.encoded_data = NULL;
+    tt->residency.prev = NULL;
+    tt->residency.next = NULL;
 
     return tt;
 }
 
+// Persistent tiles become candidates for cold storage once their pixels are
+// done being written to. Transient tiles get this when they're persisted.
+static DP_Tile *make_resident(DP_TransientTile *tt)
+{
+    DP_Tile *t = (DP_Tile *)tt;
+    DP_TileShard *shard = &tile_shards[t->shard];
+    lock_shard(shard);
+    resident_link(shard, t);
+    unlock_shard(shard);
+    return t;
+}
+
+#define COLD_ALPHA_BYTES (sizeof(uint16_t) * DP_TILE_LENGTH)
+
+static unsigned char *get_cold_output_buffer(size_t out_size, void *user)
+{
+    if (out_size == DP_TILE_BYTES) {
+        return user;
+    }
+    else {
+        DP_error_set("Cold tile decompression needs size %zu, but got %zu",
+                     (size_t)DP_TILE_BYTES, out_size);
+        return NULL;
+    }
+}
+
+static unsigned char *get_cold_alpha_output_buffer(size_t out_size,
+                                                   void *user)
+{
+    if (out_size == COLD_ALPHA_BYTES) {
+        return user;
+    }
+    else {
+        DP_error_set("Cold alpha decompression needs size %zu, but got %zu",
+                     COLD_ALPHA_BYTES, out_size);
+        return NULL;
+    }
+}
+
+static void inflate_cold_alpha(const unsigned char *cold_data,
+                               size_t cold_size, DP_Pixel15 *pixels)
+{
+    uint16_t alpha[DP_TILE_LENGTH];
+    if (!DP_decompress_zstd(NULL, cold_data, cold_size,
+                            get_cold_alpha_output_buffer, alpha)) {
+        DP_panic("Cold alpha decompression failed: %s", DP_error());
+    }
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        pixels[i] = (DP_Pixel15){0, 0, 0, alpha[i]};
+    }
+}
+
+// Inflates the pixels of a cold tile. Must be called with its lock held.
+static void inflate_cold(DP_Tile *t)
+{
+    DP_TileShard *shard = &tile_shards[t->shard];
+    lock_shard(shard);
+    DP_Pixel15 *pixels = DP_memory_pool_alloc_el(&shard->pixel_pool);
+    unlock_shard(shard);
+
+    unsigned char *cold_data = t->residency.cold_data;
+    size_t cold_size = t->residency.cold_size;
+    if (cold_data) {
+        if (t->residency.cold_alpha) {
+            inflate_cold_alpha(cold_data, cold_size, pixels);
+        }
+        else if (!DP_decompress_zstd(NULL, cold_data, cold_size,
+                                     get_cold_output_buffer, pixels)) {
+            DP_panic("Cold tile decompression failed: %s", DP_error());
+        }
+        DP_free(cold_data);
+    }
+    else {
+        DP_Pixel15 pixel = t->residency.cold_pixel;
+        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+            pixels[i] = pixel;
+        }
+    }
+    t->residency.cold_data = NULL;
+    t->residency.cold_size = 0;
+
+    lock_shard(shard);
+    t->pixels = pixels;
+    resident_link(shard, t);
+    --shard->cold_count;
+    shard->cold_bytes -= cold_size;
+    ++shard->inflations;
+    unlock_shard(shard);
+}
+
+// Keeps the pixels of the tile resident until the matching tile_unpin, bringing
+// them back from cold storage if necessary. Transient tiles are never cold.
+static DP_Pixel15 *tile_pin(DP_Tile *t)
+{
+    if (t->transient) {
+        return t->pixels;
+    }
+    else {
+        DP_atomic_lock(&t->residency.lock);
+        if (!t->pixels) {
+            inflate_cold(t);
+        }
+        ++t->residency.pins;
+        t->residency.last_used =
+            (unsigned int)DP_atomic_get(&tile_residency_epoch);
+        DP_Pixel15 *pixels = t->pixels;
+        DP_atomic_unlock(&t->residency.lock);
+        return pixels;
+    }
+}
+
+static void tile_unpin(DP_Tile *t)
+{
+    if (!t->transient) {
+        DP_atomic_lock(&t->residency.lock);
+        DP_ASSERT(t->residency.pins > 0);
+        --t->residency.pins;
+        DP_atomic_unlock(&t->residency.lock);
+    }
+}
+
 
 DP_MemoryPoolStatistics DP_tile_memory_usage(void)
 {
-    if (tile_memory_pool_lock) {
-        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-        DP_MemoryPoolStatistics mps =
-            DP_memory_pool_statistics(&tile_memory_pool);
-        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
-        return mps;
+    DP_MemoryPoolStatistics total = {DP_TILE_BYTES, 0, 0, 0};
+    if (tile_intern_lock) {
+        for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+            DP_TileShard *shard = &tile_shards[i];
+            lock_shard(shard);
+            DP_MemoryPoolStatistics mps =
+                DP_memory_pool_statistics(&shard->pixel_pool);
+            unlock_shard(shard);
+            total.bucket_el_count = mps.bucket_el_count;
+            total.buckets_len += mps.buckets_len;
+            total.el_free += mps.el_free;
+        }
+    }
+    return total;
+}
+
+DP_TileResidencyStatistics DP_tile_residency_statistics(void)
+{
+    DP_TileResidencyStatistics total = {0, 0, 0, 0, 0};
+    if (tile_intern_lock) {
+        for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+            DP_TileShard *shard = &tile_shards[i];
+            lock_shard(shard);
+            total.resident += shard->resident_count;
+            total.cold += shard->cold_count;
+            total.cold_bytes += shard->cold_bytes;
+            total.evictions += shard->evictions;
+            total.inflations += shard->inflations;
+            unlock_shard(shard);
+        }
+    }
+    return total;
+}
+
+DP_TileEncodingCacheStatistics DP_tile_encoding_cache_statistics(void)
+{
+    DP_TileEncodingCacheStatistics total = {0, 0, 0, 0};
+    if (tile_intern_lock) {
+        for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+            DP_TileShard *shard = &tile_shards[i];
+            lock_shard(shard);
+            total.limit += shard->encoded_limit;
+            total.entries += shard->encoded_count;
+            total.bytes += shard->encoded_bytes;
+            unlock_shard(shard);
+        }
+        total.hits = (unsigned int)DP_atomic_get(&tile_encoding_hits);
+    }
+    return total;
+}
+
+DP_TileAllocationStatistics DP_tile_allocation_statistics(void)
+{
+    DP_TileAllocationStatistics total = {TILE_SHARD_COUNT, 0, 0};
+    if (tile_intern_lock) {
+        for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+            DP_TileShard *shard = &tile_shards[i];
+            lock_shard(shard);
+            total.remote_frees += shard->remote_frees;
+            total.remote_batches += shard->remote_batches;
+            unlock_shard(shard);
+        }
+    }
+    return total;
+}
+
+DP_TileInternStatistics DP_tile_intern_statistics(void)
+{
+    if (tile_intern_lock) {
+        DP_MUTEX_MUST_LOCK(tile_intern_lock);
+        DP_TileInternStatistics tis = {
+            tile_intern_enabled,
+            HASH_COUNT(tile_intern_table),
+            tile_intern_hits,
+        };
+        DP_MUTEX_MUST_UNLOCK(tile_intern_lock);
+        return tis;
     }
     else {
-        return (DP_MemoryPoolStatistics){sizeof(DP_TransientTile), 0, 0, 0};
+        return (DP_TileInternStatistics){false, 0, 0};
     }
 }
 
@@ -138,11 +587,11 @@ DP_Tile *DP_tile_new(unsigned int context_id)
 
 DP_Tile *DP_tile_new_from_pixel15(unsigned int context_id, DP_Pixel15 pixel)
 {
-    DP_TransientTile *tt = alloc_tile(false, pixel.a == 0, context_id);
+    DP_TransientTile *tt = alloc_tile(false, pixel.a == 0, true, context_id);
     for (int i = 0; i < DP_TILE_LENGTH; ++i) {
         tt->pixels[i] = pixel;
     }
-    return (DP_Tile *)tt;
+    return make_resident(tt);
 }
 
 DP_Tile *DP_tile_new_from_upixel15(unsigned int context_id, DP_UPixel15 pixel)
@@ -153,9 +602,9 @@ DP_Tile *DP_tile_new_from_upixel15(unsigned int context_id, DP_UPixel15 pixel)
 DP_Tile *DP_tile_new_from_pixels8(unsigned int context_id,
                                   const DP_Pixel8 *pixels)
 {
-    DP_TransientTile *tt = alloc_tile(false, true, context_id);
+    DP_TransientTile *tt = alloc_tile(false, true, false, context_id);
     DP_pixels8_to_15(tt->pixels, pixels, DP_TILE_LENGTH);
-    return (DP_Tile *)tt;
+    return make_resident(tt);
 }
 
 DP_Tile *DP_tile_new_from_bgra(unsigned int context_id, uint32_t bgra)
@@ -174,7 +623,7 @@ static unsigned char *get_inflate_output_buffer(size_t out_size, void *user)
 {
     if (out_size == DP_TILE_COMPRESSED_BYTES) {
         struct DP_TileInflateArgs *args = user;
-        args->tt = alloc_tile(false, true, args->context_id);
+        args->tt = alloc_tile(false, true, false, args->context_id);
         return (unsigned char *)args->buffer;
     }
     else {
@@ -201,7 +650,7 @@ DP_Tile *DP_tile_new_from_deflate(DP_DrawContext *dc, unsigned int context_id,
                                   &args)) {
             DP_pixels8_to_15_checked(args.tt->pixels, args.buffer,
                                      DP_TILE_LENGTH);
-            return (DP_Tile *)args.tt;
+            return make_resident(args.tt);
         }
         else {
             DP_tile_decref_nullable((DP_Tile *)args.tt);
@@ -213,10 +662,20 @@ DP_Tile *DP_tile_new_from_deflate(DP_DrawContext *dc, unsigned int context_id,
 DP_Tile *DP_tile_new_from_split_delta_zstd8le_with(
     ZSTD_DCtx **in_out_ctx_or_null, DP_SplitTile8 *split_tile8_buffer,
     unsigned int context_id, const unsigned char *image, size_t image_size)
+{
+    return DP_tile_new_from_split_delta_zstd8le_with_dictionary(
+        in_out_ctx_or_null, NULL, split_tile8_buffer, context_id, image,
+        image_size);
+}
+
+DP_Tile *DP_tile_new_from_split_delta_zstd8le_with_dictionary(
+    ZSTD_DCtx **in_out_ctx_or_null, const ZSTD_DDict *ddict_or_null,
+    DP_SplitTile8 *split_tile8_buffer, unsigned int context_id,
+    const unsigned char *image, size_t image_size)
 {
     if (image_size == 4) {
         uint32_t bgra = DP_read_littleendian_uint32(image);
-        return DP_tile_new_from_bgra(context_id, bgra);
+        return DP_tile_intern(DP_tile_new_from_bgra(context_id, bgra));
     }
     else {
         struct DP_TileInflateArgs args = {
@@ -224,11 +683,12 @@ DP_Tile *DP_tile_new_from_split_delta_zstd8le_with(
             context_id,
             NULL,
         };
-        if (DP_decompress_zstd(in_out_ctx_or_null, image, image_size,
-                               get_inflate_output_buffer, &args)) {
+        if (DP_decompress_zstd_with_dictionary(
+                in_out_ctx_or_null, ddict_or_null, image, image_size,
+                get_inflate_output_buffer, &args)) {
             DP_split_tile8_delta_to_pixels15_checked(args.tt->pixels,
                                                      args.buffer);
-            return (DP_Tile *)args.tt;
+            return DP_tile_intern(make_resident(args.tt));
         }
         else {
             DP_tile_decref_nullable((DP_Tile *)args.tt);
@@ -252,7 +712,7 @@ static unsigned char *get_inflate_mask_output_buffer(size_t out_size,
 {
     if (out_size == DP_TILE_LENGTH) {
         struct DP_TileInflateArgs *args = user;
-        args->tt = alloc_tile(false, true, args->context_id);
+        args->tt = alloc_tile(false, true, false, args->context_id);
         return (unsigned char *)args->buffer;
     }
     else {
@@ -287,7 +747,7 @@ DP_Tile *DP_tile_new_mask_from_delta_zstd8le(DP_DrawContext *dc,
                 a += buffer[i];
                 pixels[i] = (DP_Pixel15){0, 0, 0, DP_channel8_to_15(a)};
             }
-            return (DP_Tile *)args.tt;
+            return DP_tile_intern(make_resident(args.tt));
         }
         else {
             DP_tile_decref_nullable((DP_Tile *)args.tt);
@@ -300,7 +760,7 @@ DP_Tile *DP_tile_new_zebra(unsigned int context_id, DP_Pixel15 pixel1,
                            DP_Pixel15 pixel2)
 {
     DP_TransientTile *tt =
-        alloc_tile(true, pixel1.a == 0 && pixel2.a == 0, context_id);
+        alloc_tile(true, pixel1.a == 0 && pixel2.a == 0, false, context_id);
     for (int i = 0; i < DP_TILE_LENGTH; ++i) {
         tt->pixels[i] = ((i / DP_TILE_SIZE + i % DP_TILE_SIZE) / 32) % 2 == 0
                           ? pixel1
@@ -338,12 +798,12 @@ DP_Tile *DP_tile_opaque_noinc(void)
     if (!opaque_tile) {
         DP_atomic_lock(&opaque_tile_lock);
         if (!opaque_tile) {
-            DP_TransientTile *tt = alloc_tile(false, false, 0);
+            DP_TransientTile *tt = alloc_tile(false, false, true, 0);
             DP_Pixel15 *pixels = tt->pixels;
             for (int i = 0; i < DP_TILE_LENGTH; ++i) {
                 pixels[i] = (DP_Pixel15){0, 0, 0, DP_BIT15};
             }
-            opaque_tile = (DP_Tile *)tt;
+            opaque_tile = make_resident(tt);
         }
         DP_atomic_unlock(&opaque_tile_lock);
     }
@@ -393,9 +853,44 @@ void DP_tile_decref(DP_Tile *tile)
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
     if (DP_atomic_dec(&tile->refcount)) {
-        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-        DP_memory_pool_free_el(&tile_memory_pool, tile);
-        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+        if (tile->interned) {
+            DP_MUTEX_MUST_LOCK(tile_intern_lock);
+            HASH_DELETE(hh, tile_intern_table, tile);
+            DP_MUTEX_MUST_UNLOCK(tile_intern_lock);
+        }
+
+        DP_free(tile->residency.cold_data);
+        tile->residency.cold_data = NULL;
+
+        // DP_tile_encoding_cache_clear may be looking at the encoding of
+        // tiles that died just now, so this has to happen under the lock. The
+        // size stays so that the shard statistics get updated when freeing.
+        DP_atomic_lock(&tile->residency.lock);
+        unsigned char *encoded_data = tile->residency.encoded_data;
+        tile->residency.encoded_data = NULL;
+        DP_atomic_unlock(&tile->residency.lock);
+        DP_free(encoded_data);
+
+        DP_TileShard *shard = &tile_shards[tile->shard];
+        if (tile->shard == current_shard_index()) {
+            lock_shard(shard);
+            free_tile(shard, tile);
+            unlock_shard(shard);
+        }
+        else {
+            DP_atomic_lock(&shard->remote_lock);
+            tile->remote_next = shard->remote_first;
+            shard->remote_first = tile;
+            DP_atomic_inc(&shard->remote_count);
+            DP_atomic_unlock(&shard->remote_lock);
+            // Don't let the list grow without bounds if nothing else is
+            // allocating from that shard anymore.
+            if (DP_atomic_get(&shard->remote_count) >= TILE_REMOTE_FREE_BATCH
+                && DP_mutex_try_lock(shard->lock) == DP_MUTEX_OK) {
+                return_remote_frees(shard);
+                unlock_shard(shard);
+            }
+        }
     }
 }
 
@@ -406,6 +901,319 @@ void DP_tile_decref_nullable(DP_Tile *tile_or_null)
     }
 }
 
+static uint64_t hash_round(uint64_t h, uint64_t x)
+{
+    uint64_t y = h + x * 0xc2b2ae3d27d4eb4fu;
+    return ((y << 31u) | (y >> 33u)) * 0x9e3779b185ebca87u;
+}
+
+// Hashes the tile's context id and pixels, each of which is 64 bits, in four
+// interleaved lanes so that the multiplications don't wait on each other. It
+// only needs to be fast and spread well, the contents are compared afterwards.
+static uint64_t hash_tile(unsigned int context_id, const DP_Pixel15 *pixels)
+{
+    static_assert(sizeof(DP_Pixel15) == sizeof(uint64_t),
+                  "Pixel is 64 bits for hashing");
+    uint64_t lanes[4] = {
+        0x60ea27eeadc0b5d6u ^ context_id,
+        0xc2b2ae3d27d4eb4fu,
+        0x165667b19e3779f9u,
+        0x61c8864e7a143579u,
+    };
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        for (int j = 0; j < 4; ++j) {
+            uint64_t x;
+            memcpy(&x, &pixels[i + j], sizeof(x));
+            lanes[j] = hash_round(lanes[j], x);
+        }
+    }
+    uint64_t h = hash_round(hash_round(lanes[0], lanes[1]),
+                            hash_round(lanes[2], lanes[3]));
+    h ^= h >> 33u;
+    h *= 0xc2b2ae3d27d4eb4fu;
+    h ^= h >> 29u;
+    return h;
+}
+
+// Takes a reference unless the tile is about to be freed, which happens when
+// another thread dropped the last reference, but hasn't gotten the lock to take
+// it out of the intern table or the list of resident tiles yet. Must be called
+// with the respective intern or shard lock held.
+static bool tile_incref_if_alive(DP_Tile *t)
+{
+    int refcount = DP_atomic_get(&t->refcount);
+    while (refcount > 0) {
+        if (DP_atomic_compare_exchange(&t->refcount, refcount, refcount + 1)) {
+            return true;
+        }
+        refcount = DP_atomic_get(&t->refcount);
+    }
+    return false;
+}
+
+DP_Tile *DP_tile_intern(DP_Tile *t)
+{
+    DP_ASSERT(t);
+    DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
+    DP_ASSERT(!t->transient);
+    if (!tile_intern_enabled) {
+        return t;
+    }
+
+    DP_Pixel15 *pixels = tile_pin(t);
+    uint64_t hash = hash_tile(t->context_id, pixels);
+    DP_Tile *found;
+    DP_MUTEX_MUST_LOCK(tile_intern_lock);
+    if (t->interned) {
+        found = NULL;
+    }
+    else {
+        HASH_FIND(hh, tile_intern_table, &hash, sizeof(hash), found);
+        if (!found) {
+            t->interned = true;
+            t->intern_hash = hash;
+            HASH_ADD(hh, tile_intern_table, intern_hash, sizeof(t->intern_hash),
+                     t);
+        }
+        else if (found->context_id != t->context_id
+                 || !tile_incref_if_alive(found)) {
+            found = NULL;
+        }
+    }
+    DP_MUTEX_MUST_UNLOCK(tile_intern_lock);
+
+    // The found tile may be cold, so its pixels can only be compared with the
+    // lock released. A hash collision with different contents isn't shared.
+    if (found) {
+        bool equal = memcmp(tile_pin(found), pixels, DP_TILE_BYTES) == 0;
+        tile_unpin(found);
+        if (equal) {
+            tile_unpin(t);
+            DP_MUTEX_MUST_LOCK(tile_intern_lock);
+            ++tile_intern_hits;
+            DP_MUTEX_MUST_UNLOCK(tile_intern_lock);
+            DP_tile_decref(t);
+            return found;
+        }
+        DP_tile_decref(found);
+    }
+    tile_unpin(t);
+    return t;
+}
+
+static unsigned char *get_cold_compress_buffer(size_t out_size, void *user)
+{
+    unsigned char **buffer_ptr = user;
+    *buffer_ptr = DP_malloc(out_size);
+    return *buffer_ptr;
+}
+
+// Selection and layer mask tiles are black with varying alpha, so only their
+// alpha channel needs to be stored. That's a quarter of the size up front.
+static bool gather_cold_alpha(const DP_Pixel15 *pixels, uint16_t *alpha)
+{
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        DP_Pixel15 pixel = pixels[i];
+        if (pixel.b != 0 || pixel.g != 0 || pixel.r != 0) {
+            return false;
+        }
+        alpha[i] = pixel.a;
+    }
+    return true;
+}
+
+// Moves the pixels into cold storage unless the tile got pinned since it was
+// picked. They're compressed losslessly, since this is supposed to be
+// invisible, except for uniform tiles, which only need to remember one pixel.
+static bool evict_tile(DP_Tile *t, ZSTD_CCtx **in_out_ctx)
+{
+    DP_atomic_lock(&t->residency.lock);
+    DP_Pixel15 *pixels = t->pixels;
+    if (t->residency.pins != 0 || !pixels) {
+        DP_atomic_unlock(&t->residency.lock);
+        return false;
+    }
+
+    unsigned char *cold_data = NULL;
+    size_t cold_size;
+    if (t->uniform) {
+        t->residency.cold_pixel = pixels[0];
+        cold_size = 0;
+    }
+    else {
+        uint16_t alpha[DP_TILE_LENGTH];
+        bool cold_alpha = gather_cold_alpha(pixels, alpha);
+        t->residency.cold_alpha = cold_alpha;
+        unsigned char *buffer = NULL;
+        cold_size = DP_compress_zstd(
+            in_out_ctx,
+            cold_alpha ? (const unsigned char *)alpha
+                       : (const unsigned char *)pixels,
+            cold_alpha ? COLD_ALPHA_BYTES : DP_TILE_BYTES,
+            get_cold_compress_buffer, &buffer);
+        if (cold_size == 0) {
+            DP_warn("Cold tile compression failed: %s", DP_error());
+            DP_free(buffer);
+            DP_atomic_unlock(&t->residency.lock);
+            return false;
+        }
+        // The buffer is sized for the worst case, don't keep the slack.
+        cold_data = DP_realloc(buffer, cold_size);
+    }
+    t->residency.cold_data = cold_data;
+    t->residency.cold_size = cold_size;
+
+    // The tile hasn't been used in a while, so its encoding probably won't be
+    // needed soon either and isn't worth the memory.
+    unsigned char *encoded_data = t->residency.encoded_data;
+    size_t encoded_size = t->residency.encoded_size;
+    t->residency.encoded_data = NULL;
+    t->residency.encoded_size = 0;
+
+    DP_TileShard *shard = &tile_shards[t->shard];
+    lock_shard(shard);
+    t->pixels = NULL;
+    DP_memory_pool_free_el(&shard->pixel_pool, pixels);
+    resident_unlink(shard, t);
+    ++shard->cold_count;
+    shard->cold_bytes += cold_size;
+    ++shard->evictions;
+    if (encoded_size != 0) {
+        --shard->encoded_count;
+        shard->encoded_bytes -= encoded_size;
+    }
+    unlock_shard(shard);
+    DP_free(encoded_data);
+
+    DP_atomic_unlock(&t->residency.lock);
+    return true;
+}
+
+#define RESIDENCY_TRIM_BATCH      16
+#define RESIDENCY_TRIM_MAX_VISITS 1024
+
+// Collects idle tiles from the least recently listed end of the shard. Tiles
+// that were used too recently get moved to the front, so that the next walk
+// doesn't run into them again. Tile locks are taken in the opposite order when
+// inflating, so they may only be tried here, never waited on.
+static int collect_idle_tiles(DP_TileShard *shard, unsigned int epoch,
+                              unsigned int min_idle, int visits, int wanted,
+                              DP_Tile **candidates)
+{
+    int count = 0;
+    lock_shard(shard);
+    DP_Tile *t = shard->resident_last;
+    while (t && visits-- != 0 && count < wanted) {
+        DP_Tile *prev = t->residency.prev;
+        if (DP_atomic_compare_exchange(&t->residency.lock, 0, 1)) {
+            bool idle = t->residency.pins == 0
+                     && epoch - t->residency.last_used >= min_idle;
+            DP_atomic_unlock(&t->residency.lock);
+            if (!idle) {
+                resident_unlink(shard, t);
+                resident_link(shard, t);
+            }
+            else if (tile_incref_if_alive(t)) {
+                candidates[count++] = t;
+            }
+        }
+        t = prev;
+    }
+    unlock_shard(shard);
+    return count;
+}
+
+int DP_tile_residency_trim(size_t budget_bytes, unsigned int min_idle)
+{
+    if (!tile_intern_lock) {
+        return 0;
+    }
+
+    DP_atomic_inc(&tile_residency_epoch);
+    unsigned int epoch = (unsigned int)DP_atomic_get(&tile_residency_epoch);
+
+    DP_MemoryPoolStatistics mps = DP_tile_memory_usage();
+    size_t used = mps.buckets_len * mps.bucket_el_count - mps.el_free;
+    size_t budget = budget_bytes / DP_TILE_BYTES;
+    if (used <= budget) {
+        return 0;
+    }
+
+    // Start at a different shard each time so that they get trimmed evenly.
+    DP_Tile *candidates[RESIDENCY_TRIM_BATCH];
+    int wanted = DP_size_to_int(
+        DP_min_size(used - budget, (size_t)RESIDENCY_TRIM_BATCH));
+    int first = DP_atomic_get(&tile_trim_shard);
+    DP_atomic_set(&tile_trim_shard, (first + 1) % TILE_SHARD_COUNT);
+    int count = 0;
+    for (int i = 0; i < TILE_SHARD_COUNT && count < wanted; ++i) {
+        count += collect_idle_tiles(
+            &tile_shards[(first + i) % TILE_SHARD_COUNT], epoch, min_idle,
+            RESIDENCY_TRIM_MAX_VISITS / TILE_SHARD_COUNT, wanted - count,
+            candidates + count);
+    }
+
+    int evicted = 0;
+    if (count != 0) {
+        ZSTD_CCtx *ctx = NULL;
+        for (int i = 0; i < count; ++i) {
+            if (evict_tile(candidates[i], &ctx)) {
+                ++evicted;
+            }
+            DP_tile_decref(candidates[i]);
+        }
+        DP_compress_zstd_free(&ctx);
+    }
+    return evicted;
+}
+
+// Tile locks are taken in the opposite order everywhere else, so they can
+// only be tried here. Tiles that are busy just keep their encoding.
+static void clear_shard_encodings(DP_TileShard *shard)
+{
+    lock_shard(shard);
+    for (DP_Tile *t = shard->resident_first; t; t = t->residency.next) {
+        if (DP_atomic_compare_exchange(&t->residency.lock, 0, 1)) {
+            unsigned char *encoded_data = t->residency.encoded_data;
+            if (encoded_data) {
+                --shard->encoded_count;
+                shard->encoded_bytes -= t->residency.encoded_size;
+                t->residency.encoded_data = NULL;
+                t->residency.encoded_size = 0;
+            }
+            DP_atomic_unlock(&t->residency.lock);
+            DP_free(encoded_data);
+        }
+    }
+    unlock_shard(shard);
+}
+
+void DP_tile_encoding_cache_clear(void)
+{
+    if (tile_intern_lock) {
+        for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+            clear_shard_encodings(&tile_shards[i]);
+        }
+    }
+}
+
+void DP_tile_encoding_cache_limit_set(size_t limit_bytes)
+{
+    init_tile_shards();
+    size_t shard_limit = limit_bytes / TILE_SHARD_COUNT;
+    for (int i = 0; i < TILE_SHARD_COUNT; ++i) {
+        DP_TileShard *shard = &tile_shards[i];
+        lock_shard(shard);
+        bool lowered = shard_limit < shard->encoded_limit;
+        shard->encoded_limit = shard_limit;
+        unlock_shard(shard);
+        // Rather than picking which encodings to drop, just start over.
+        if (lowered) {
+            clear_shard_encodings(shard);
+        }
+    }
+}
+
 int DP_tile_refcount(DP_Tile *tile)
 {
     DP_ASSERT(tile);
@@ -428,11 +1236,18 @@ unsigned int DP_tile_context_id(DP_Tile *tile)
     return tile->context_id;
 }
 
-const DP_Pixel15 *DP_tile_pixels(DP_Tile *tile)
+const DP_Pixel15 *DP_tile_pixels_acquire(DP_Tile *tile)
 {
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
-    return tile->pixels;
+    return tile_pin(tile);
+}
+
+void DP_tile_pixels_release(DP_Tile *tile)
+{
+    DP_ASSERT(tile);
+    DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
+    tile_unpin(tile);
 }
 
 DP_Pixel15 DP_tile_pixel_at(DP_Tile *tile, int x, int y)
@@ -443,43 +1258,186 @@ DP_Pixel15 DP_tile_pixel_at(DP_Tile *tile, int x, int y)
     DP_ASSERT(y >= 0);
     DP_ASSERT(x < DP_TILE_SIZE);
     DP_ASSERT(y < DP_TILE_SIZE);
-    return tile->pixels[y * DP_TILE_SIZE + x];
+    DP_Pixel15 pixel = tile_pin(tile)[y * DP_TILE_SIZE + x];
+    tile_unpin(tile);
+    return pixel;
 }
 
 bool DP_tile_blank(DP_Tile *tile)
 {
     static const DP_Pixel15 blank_pixels[DP_TILE_LENGTH] = {0};
-    return memcmp(tile->pixels, blank_pixels, DP_TILE_BYTES) == 0;
+    DP_Pixel15 *pixels = tile_pin(tile);
+    bool blank = tile->uniform
+                   ? DP_pixel15_equal(pixels[0], DP_pixel15_zero())
+                   : memcmp(pixels, blank_pixels, DP_TILE_BYTES) == 0;
+    tile_unpin(tile);
+    return blank;
+}
+
+static bool tile_pixels_opaque(DP_Tile *tile)
+{
+    DP_Pixel15 *pixels = tile_pin(tile);
+    int count = tile->uniform ? 1 : DP_TILE_LENGTH;
+    bool opaque = true;
+    for (int i = 0; i < count; ++i) {
+        if (pixels[i].a < DP_BIT15) {
+            opaque = false;
+            break;
+        }
+    }
+    tile_unpin(tile);
+    return opaque;
 }
 
 bool DP_tile_opaque(DP_Tile *tile_or_null)
 {
     if (tile_or_null) {
-        DP_Pixel15 *pixels = tile_or_null->pixels;
-        for (int i = 0; i < DP_TILE_LENGTH; ++i) {
-            if (pixels[i].a < DP_BIT15) {
-                return false;
-            }
+        if (tile_or_null->transient) {
+            return tile_pixels_opaque(tile_or_null);
         }
-        return true;
+        // Persistent tiles don't change, so checking them once is enough.
+        // Racing threads just end up storing the same result.
+        int opacity = DP_atomic_get(&tile_or_null->opacity);
+        if (opacity == TILE_OPACITY_UNKNOWN) {
+            opacity = tile_pixels_opaque(tile_or_null)
+                        ? TILE_OPACITY_OPAQUE
+                        : TILE_OPACITY_TRANSLUCENT;
+            DP_atomic_set(&tile_or_null->opacity, opacity);
+        }
+        return opacity == TILE_OPACITY_OPAQUE;
     }
     else {
         return false;
     }
 }
 
+static bool tile_row_has_alpha(const DP_Pixel15 *pixels, int y, int width)
+{
+    const DP_Pixel15 *row = pixels + y * DP_TILE_SIZE;
+    for (int x = 0; x < width; ++x) {
+        if (row[x].a != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool tile_column_has_alpha(const DP_Pixel15 *pixels, int x, int top,
+                                  int bottom)
+{
+    for (int y = top; y <= bottom; ++y) {
+        if (pixels[y * DP_TILE_SIZE + x].a != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static DP_Rect tile_pixels_alpha_bounds(DP_Tile *tile, int width, int height)
+{
+    DP_Rect bounds = DP_rect_make(0, 0, 0, 0);
+    DP_Pixel15 *pixels = tile_pin(tile);
+    if (tile->uniform) {
+        if (pixels[0].a != 0) {
+            bounds = DP_rect_make(0, 0, width, height);
+        }
+    }
+    else {
+        int top = 0;
+        while (top < height && !tile_row_has_alpha(pixels, top, width)) {
+            ++top;
+        }
+        if (top < height) {
+            int bottom = height - 1;
+            while (!tile_row_has_alpha(pixels, bottom, width)) {
+                --bottom;
+            }
+            int left = 0;
+            while (!tile_column_has_alpha(pixels, left, top, bottom)) {
+                ++left;
+            }
+            int right = width - 1;
+            while (!tile_column_has_alpha(pixels, right, top, bottom)) {
+                --right;
+            }
+            bounds = (DP_Rect){left, top, right, bottom};
+        }
+    }
+    tile_unpin(tile);
+    return bounds;
+}
+
+static int tile_bounds_pack(DP_Rect bounds)
+{
+    if (DP_rect_valid(bounds)) {
+        return TILE_BOUNDS_OFFSET
+             + (bounds.x1 | (bounds.y1 << 6) | (bounds.x2 << 12)
+                | (bounds.y2 << 18));
+    }
+    else {
+        return TILE_BOUNDS_EMPTY;
+    }
+}
+
+static DP_Rect tile_bounds_unpack(int packed)
+{
+    if (packed == TILE_BOUNDS_EMPTY) {
+        return DP_rect_make(0, 0, 0, 0);
+    }
+    else {
+        int value = packed - TILE_BOUNDS_OFFSET;
+        return (DP_Rect){value & 63, (value >> 6) & 63, (value >> 12) & 63,
+                         (value >> 18) & 63};
+    }
+}
+
+DP_Rect DP_tile_alpha_bounds(DP_Tile *tile, int width, int height)
+{
+    DP_ASSERT(tile);
+    DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
+    DP_ASSERT(width > 0 && width <= DP_TILE_SIZE);
+    DP_ASSERT(height > 0 && height <= DP_TILE_SIZE);
+    if (tile->transient) {
+        return tile_pixels_alpha_bounds(tile, width, height);
+    }
+
+    // Persistent tiles don't change, so the bounds of the full tile only need
+    // to be figured out once. Racing threads just store the same result.
+    int packed = DP_atomic_get(&tile->bounds);
+    if (packed == TILE_BOUNDS_UNKNOWN) {
+        packed = tile_bounds_pack(
+            tile_pixels_alpha_bounds(tile, DP_TILE_SIZE, DP_TILE_SIZE));
+        DP_atomic_set(&tile->bounds, packed);
+    }
+
+    DP_Rect bounds = tile_bounds_unpack(packed);
+    if (!DP_rect_valid(bounds)
+        || (bounds.x2 < width && bounds.y2 < height)) {
+        return bounds;
+    }
+    else {
+        // Partial tile at the edge of the canvas with content sticking out
+        // past it, which only happens with the odd resize. Just look again.
+        return tile_pixels_alpha_bounds(tile, width, height);
+    }
+}
+
 bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel)
 {
     DP_Pixel15 pixel;
     if (tile_or_null) {
-        DP_Pixel15 *pixels = tile_or_null->pixels;
+        DP_Pixel15 *pixels = tile_pin(tile_or_null);
         pixel = pixels[0];
-        for (int i = 1; i < DP_TILE_LENGTH; ++i) {
-            DP_Pixel15 q = pixels[i];
-            if (!DP_pixel15_equal(pixel, q)) {
-                return false;
+        if (!tile_or_null->uniform) {
+            for (int i = 1; i < DP_TILE_LENGTH; ++i) {
+                DP_Pixel15 q = pixels[i];
+                if (!DP_pixel15_equal(pixel, q)) {
+                    tile_unpin(tile_or_null);
+                    return false;
+                }
             }
         }
+        tile_unpin(tile_or_null);
     }
     else {
         pixel = DP_pixel15_zero();
@@ -499,24 +1457,106 @@ bool DP_tile_pixels_equal(DP_Tile *t1, DP_Tile *t2)
     else if (t1 && t2) {
         DP_ASSERT(DP_atomic_get(&t1->refcount) > 0);
         DP_ASSERT(DP_atomic_get(&t2->refcount) > 0);
-        return memcmp(t1->pixels, t2->pixels, DP_TILE_BYTES) == 0;
+        bool equal = memcmp(tile_pin(t1), tile_pin(t2), DP_TILE_BYTES) == 0;
+        tile_unpin(t1);
+        tile_unpin(t2);
+        return equal;
     }
     else {
         return false;
     }
 }
 
+uint64_t DP_tile_pixels_hash(DP_Tile *tile)
+{
+    DP_ASSERT(tile);
+    DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
+    uint64_t hash = hash_tile(0, tile_pin(tile));
+    tile_unpin(tile);
+    return hash;
+}
+
+static bool pixel_rows_equal(const DP_Pixel15 *a, const DP_Pixel15 *b, int y)
+{
+    size_t offset = DP_int_to_size(y * DP_TILE_SIZE);
+    return memcmp(a + offset, b + offset, sizeof(*a) * DP_TILE_SIZE) == 0;
+}
+
+static DP_Rect pixels_diff_bounds(const DP_Pixel15 *a, const DP_Pixel15 *b)
+{
+    int top = 0;
+    while (top < DP_TILE_SIZE && pixel_rows_equal(a, b, top)) {
+        ++top;
+    }
+
+    if (top == DP_TILE_SIZE) {
+        return DP_rect_make(0, 0, 0, 0);
+    }
+
+    int bottom = DP_TILE_SIZE - 1;
+    while (bottom > top && pixel_rows_equal(a, b, bottom)) {
+        --bottom;
+    }
+
+    // Every row in between could differ anywhere, so we have to look at each
+    // one of them, but can bail out once the whole width is covered.
+    int left = DP_TILE_SIZE - 1;
+    int right = 0;
+    for (int y = top; y <= bottom && (left > 0 || right < DP_TILE_SIZE - 1);
+         ++y) {
+        const DP_Pixel15 *row_a = a + y * DP_TILE_SIZE;
+        const DP_Pixel15 *row_b = b + y * DP_TILE_SIZE;
+        for (int x = 0; x < left; ++x) {
+            if (!DP_pixel15_equal(row_a[x], row_b[x])) {
+                left = x;
+                break;
+            }
+        }
+        for (int x = DP_TILE_SIZE - 1; x > right; --x) {
+            if (!DP_pixel15_equal(row_a[x], row_b[x])) {
+                right = x;
+                break;
+            }
+        }
+    }
+
+    return (DP_Rect){DP_min_int(left, right), top, right, bottom};
+}
+
+DP_Rect DP_tile_pixels_diff_bounds(DP_Tile *t1_or_null, DP_Tile *t2_or_null)
+{
+    if (t1_or_null == t2_or_null) {
+        return DP_rect_make(0, 0, 0, 0);
+    }
+    else if (t1_or_null && t2_or_null) {
+        DP_ASSERT(DP_atomic_get(&t1_or_null->refcount) > 0);
+        DP_ASSERT(DP_atomic_get(&t2_or_null->refcount) > 0);
+        DP_Rect bounds =
+            pixels_diff_bounds(tile_pin(t1_or_null), tile_pin(t2_or_null));
+        tile_unpin(t1_or_null);
+        tile_unpin(t2_or_null);
+        return bounds;
+    }
+    else {
+        return DP_rect_make(0, 0, DP_TILE_SIZE, DP_TILE_SIZE);
+    }
+}
+
 bool DP_tile_pixels_equal_pixel(DP_Tile *tile, DP_Pixel15 pixel)
 {
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
-    DP_Pixel15 *pixels = tile->pixels;
-    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+    DP_Pixel15 *pixels = tile_pin(tile);
+    int count = tile->uniform ? 1 : DP_TILE_LENGTH;
+    bool equal = true;
+    for (int i = 0; i < count; ++i) {
         if (!DP_pixel15_equal(pixels[i], pixel)) {
-            return false;
+            equal = false;
+            break;
         }
     }
-    return true;
+    tile_unpin(tile);
+    return equal;
 }
 
 
@@ -566,7 +1606,8 @@ size_t DP_tile_compress_deflate(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
         return DP_tile_compress_pixel8be(pixel, get_output_buffer, user);
     }
     else {
-        DP_pixels15_to_8(pixel_buffer, tile->pixels, DP_TILE_LENGTH);
+        DP_pixels15_to_8(pixel_buffer, tile_pin(tile), DP_TILE_LENGTH);
+        tile_unpin(tile);
         static_assert(sizeof(DP_Pixel8[DP_TILE_LENGTH])
                           == DP_TILE_COMPRESSED_BYTES,
                       "Tile of DP_Pixel8 has expected size");
@@ -579,6 +1620,15 @@ size_t DP_tile_compress_deflate(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
 size_t DP_tile_compress_split_delta_zstd8le(
     DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, DP_SplitTile8 *split_buffer,
     unsigned char *(*get_output_buffer)(size_t, void *), void *user)
+{
+    return DP_tile_compress_split_delta_zstd8le_with_dictionary(
+        t, in_out_ctx_or_null, NULL, split_buffer, get_output_buffer, user);
+}
+
+size_t DP_tile_compress_split_delta_zstd8le_with_dictionary(
+    DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, const ZSTD_CDict *cdict_or_null,
+    DP_SplitTile8 *split_buffer,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user)
 {
     DP_ASSERT(t);
     DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
@@ -588,15 +1638,115 @@ size_t DP_tile_compress_split_delta_zstd8le(
         return DP_tile_compress_pixel8le(pixel, get_output_buffer, user);
     }
     else {
-        DP_pixels15_to_split_tile8_delta(split_buffer, t->pixels);
+        DP_tile_split_delta8le(t, split_buffer);
         static_assert(sizeof(DP_SplitTile8) == DP_TILE_COMPRESSED_BYTES,
                       "Tile of split 8 bit channels has expected size");
-        return DP_compress_zstd(
-            in_out_ctx_or_null, (const unsigned char *)split_buffer,
-            DP_TILE_COMPRESSED_BYTES, get_output_buffer, user);
+        return DP_compress_zstd_with_dictionary(
+            in_out_ctx_or_null, cdict_or_null,
+            (const unsigned char *)split_buffer, DP_TILE_COMPRESSED_BYTES,
+            get_output_buffer, user);
     }
 }
 
+void DP_tile_split_delta8le(DP_Tile *t, DP_SplitTile8 *split_buffer)
+{
+    DP_ASSERT(t);
+    DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
+    DP_ASSERT(split_buffer);
+    DP_pixels15_to_split_tile8_delta(split_buffer, tile_pin(t));
+    tile_unpin(t);
+}
+
+struct DP_TileEncodingCaptureArgs {
+    unsigned char *(*get_output_buffer)(size_t, void *);
+    void *user;
+    unsigned char *buffer;
+};
+
+static unsigned char *get_encoding_capture_buffer(size_t out_size, void *user)
+{
+    struct DP_TileEncodingCaptureArgs *args = user;
+    args->buffer = args->get_output_buffer(out_size, args->user);
+    return args->buffer;
+}
+
+// Copies the cached encoding into an output buffer, returns 0 if there's none.
+static size_t copy_tile_encoding(DP_Tile *t,
+                                 unsigned char *(*get_output_buffer)(size_t,
+                                                                     void *),
+                                 void *user)
+{
+    size_t size = 0;
+    DP_atomic_lock(&t->residency.lock);
+    unsigned char *encoded_data = t->residency.encoded_data;
+    if (encoded_data) {
+        size = t->residency.encoded_size;
+        unsigned char *buffer = get_output_buffer(size, user);
+        if (buffer) {
+            memcpy(buffer, encoded_data, size);
+        }
+        else {
+            size = 0;
+        }
+    }
+    DP_atomic_unlock(&t->residency.lock);
+    return size;
+}
+
+// Remembers the encoding on the tile, unless that would go over the limit or
+// it got evicted or encoded by someone else in the meantime.
+static void store_tile_encoding(DP_Tile *t, const unsigned char *buffer,
+                                size_t size)
+{
+    unsigned char *encoded_data = DP_malloc(size);
+    memcpy(encoded_data, buffer, size);
+
+    DP_TileShard *shard = &tile_shards[t->shard];
+    DP_atomic_lock(&t->residency.lock);
+    if (t->pixels && !t->residency.encoded_data) {
+        lock_shard(shard);
+        if (shard->encoded_bytes + size <= shard->encoded_limit) {
+            ++shard->encoded_count;
+            shard->encoded_bytes += size;
+            t->residency.encoded_data = encoded_data;
+            t->residency.encoded_size = size;
+            encoded_data = NULL;
+        }
+        unlock_shard(shard);
+    }
+    DP_atomic_unlock(&t->residency.lock);
+    DP_free(encoded_data);
+}
+
+size_t DP_tile_compress_split_delta_zstd8le_cached(
+    DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, DP_SplitTile8 *split_buffer,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user)
+{
+    DP_ASSERT(t);
+    DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
+    if (t->transient) {
+        return DP_tile_compress_split_delta_zstd8le(
+            t, in_out_ctx_or_null, split_buffer, get_output_buffer, user);
+    }
+
+    size_t size = copy_tile_encoding(t, get_output_buffer, user);
+    if (size != 0) {
+        DP_atomic_inc(&tile_encoding_hits);
+        return size;
+    }
+
+    struct DP_TileEncodingCaptureArgs args = {get_output_buffer, user, NULL};
+    size = DP_tile_compress_split_delta_zstd8le(t, in_out_ctx_or_null,
+                                                split_buffer,
+                                                get_encoding_capture_buffer,
+                                                &args);
+    // Single-pixel encodings are quicker to make than looking them up.
+    if (size > 4) {
+        store_tile_encoding(t, args.buffer, size);
+    }
+    return size;
+}
+
 size_t DP_tile_compress_mask_delta_zstd8le_opaque(
     unsigned char *(*get_output_buffer)(size_t, void *), void *user)
 {
@@ -609,13 +1759,14 @@ size_t DP_tile_compress_mask_delta_zstd8le_normal(
     DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, uint8_t *channel_buffer,
     unsigned char *(*get_output_buffer)(size_t, void *), void *user)
 {
-    const DP_Pixel15 *pixels = DP_tile_pixels(t);
+    const DP_Pixel15 *pixels = tile_pin(t);
     uint8_t last_a = 0;
     for (int i = 0; i < DP_TILE_LENGTH; ++i) {
         uint8_t a = DP_channel15_to_8(pixels[i].a);
         channel_buffer[i] = a - last_a;
         last_a = a;
     }
+    tile_unpin(t);
     return DP_compress_zstd(in_out_ctx_or_null, channel_buffer, DP_TILE_LENGTH,
                             get_output_buffer, user);
 }
@@ -649,11 +1800,12 @@ void DP_tile_copy_to_image(DP_Tile *tile_or_null, DP_Image *img, int x, int y)
 
     if (tile_or_null) {
         DP_ASSERT(DP_atomic_get(&tile_or_null->refcount) > 0);
-        DP_Pixel15 *src = tile_or_null->pixels;
+        DP_Pixel15 *src = tile_pin(tile_or_null);
         for (int i = 0; i < height; ++i) {
             DP_pixels15_to_8(dst + i * img_width, src + i * DP_TILE_SIZE,
                              width);
         }
+        tile_unpin(tile_or_null);
     }
     else {
         for (int i = 0; i < height; ++i) {
@@ -673,11 +1825,12 @@ void DP_tile_copy_to_pixels8(DP_Tile *tile_or_null, DP_Pixel8 *pixels, int x,
 
     if (tile_or_null) {
         DP_ASSERT(DP_atomic_get(&tile_or_null->refcount) > 0);
-        DP_Pixel15 *src = tile_or_null->pixels;
+        DP_Pixel15 *src = tile_pin(tile_or_null);
         for (int i = 0; i < height; ++i) {
             DP_pixels15_to_8(dst + i * pixels_width, src + i * DP_TILE_SIZE,
                              width);
         }
+        tile_unpin(tile_or_null);
     }
     else {
         for (int i = 0; i < height; ++i) {
@@ -697,11 +1850,12 @@ void DP_tile_copy_to_upixels8(DP_Tile *tile_or_null, DP_UPixel8 *pixels, int x,
 
     if (tile_or_null) {
         DP_ASSERT(DP_atomic_get(&tile_or_null->refcount) > 0);
-        DP_Pixel15 *src = tile_or_null->pixels;
+        DP_Pixel15 *src = tile_pin(tile_or_null);
         for (int i = 0; i < height; ++i) {
             DP_pixels15_to_8_unpremultiply(dst + i * pixels_width,
                                            src + i * DP_TILE_SIZE, width);
         }
+        tile_unpin(tile_or_null);
     }
     else {
         for (int i = 0; i < height; ++i) {
@@ -771,10 +1925,11 @@ void DP_tile_sample(DP_Tile *tile_or_null, const uint16_t *mask, int x, int y,
                     float *in_out_alpha)
 {
     if (tile_or_null) {
-        DP_Pixel15 *src = tile_or_null->pixels + y * DP_TILE_SIZE + x;
+        DP_Pixel15 *src = tile_pin(tile_or_null) + y * DP_TILE_SIZE + x;
         sample_tile(src, mask, width, height, skip, DP_TILE_SIZE - width,
                     opaque, in_out_weight, in_out_red, in_out_green,
                     in_out_blue, in_out_alpha);
+        tile_unpin(tile_or_null);
     }
     else if (!opaque) {
         sample_blank(mask, width, height, skip, in_out_weight);
@@ -874,10 +2029,13 @@ void DP_tile_sample_pigment(DP_Tile *tile_or_null, const uint16_t *mask, int x,
                             float *in_out_alpha)
 {
     DP_Pixel15 *src =
-        tile_or_null ? tile_or_null->pixels + y * DP_TILE_SIZE + x : NULL;
+        tile_or_null ? tile_pin(tile_or_null) + y * DP_TILE_SIZE + x : NULL;
     sample_tile_pigment(src, mask, width, height, skip, DP_TILE_SIZE - width,
                         opaque, sample_interval, sample_rate, in_out_weight,
                         in_out_red, in_out_green, in_out_blue, in_out_alpha);
+    if (tile_or_null) {
+        tile_unpin(tile_or_null);
+    }
 }
 
 
@@ -885,8 +2043,10 @@ DP_TransientTile *DP_transient_tile_new(DP_Tile *tile, unsigned int context_id)
 {
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
-    DP_TransientTile *tt = alloc_tile(true, tile->maybe_blank, context_id);
-    memcpy(tt->pixels, tile->pixels, DP_TILE_BYTES);
+    DP_TransientTile *tt =
+        alloc_tile(true, tile->maybe_blank, tile->uniform, context_id);
+    memcpy(tt->pixels, tile_pin(tile), DP_TILE_BYTES);
+    tile_unpin(tile);
     return tt;
 }
 
@@ -898,7 +2058,7 @@ DP_TransientTile *DP_transient_tile_new_masked(DP_Tile *DP_RESTRICT t,
     DP_ASSERT(mt);
     DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
     DP_ASSERT(DP_atomic_get(&mt->refcount) > 0);
-    DP_TransientTile *tt = alloc_tile(true, true, context_id);
+    DP_TransientTile *tt = alloc_tile(true, true, false, context_id);
     DP_transient_tile_mask(tt, t, mt);
     return tt;
 }
@@ -911,8 +2071,8 @@ DP_TransientTile *DP_transient_tile_new_transient(DP_TransientTile *tt,
 
 DP_TransientTile *DP_transient_tile_new_blank(unsigned int context_id)
 {
-    DP_TransientTile *tt = alloc_tile(true, true, context_id);
-    memset(tt->pixels, 0, sizeof(tt->pixels));
+    DP_TransientTile *tt = alloc_tile(true, true, true, context_id);
+    memset(tt->pixels, 0, DP_TILE_BYTES);
 
     return tt;
 }
@@ -928,7 +2088,7 @@ DP_TransientTile *DP_transient_tile_new_checker(unsigned int context_id,
                                                 DP_Pixel15 pixel1,
                                                 DP_Pixel15 pixel2)
 {
-    DP_TransientTile *tt = alloc_tile(true, false, context_id);
+    DP_TransientTile *tt = alloc_tile(true, false, false, context_id);
     DP_transient_tile_fill_checker(tt, pixel1, pixel2);
     return tt;
 }
@@ -976,7 +2136,7 @@ DP_Tile *DP_transient_tile_persist(DP_TransientTile *tt)
     DP_ASSERT(DP_atomic_get(&tt->refcount) > 0);
     DP_ASSERT(tt->transient);
     tt->transient = false;
-    return (DP_Tile *)tt;
+    return make_resident(tt);
 }
 
 
@@ -994,6 +2154,7 @@ DP_Pixel15 *DP_transient_tile_pixels(DP_TransientTile *tt)
     DP_ASSERT(DP_atomic_get(&tt->refcount) > 0);
     DP_ASSERT(tt->transient);
     tt->maybe_blank = true;
+    tt->uniform = false;
     return tt->pixels;
 }
 
@@ -1016,6 +2177,7 @@ void DP_transient_tile_pixel_at_set(DP_TransientTile *tt, int x, int y,
     DP_ASSERT(x < DP_TILE_SIZE);
     DP_ASSERT(y < DP_TILE_SIZE);
     tt->maybe_blank = pixel.a == 0;
+    tt->uniform = tt->uniform && DP_pixel15_equal(tt->pixels[0], pixel);
     tt->pixels[y * DP_TILE_SIZE + x] = pixel;
 }
 
@@ -1032,6 +2194,7 @@ void DP_transient_tile_pixel_at_put(DP_TransientTile *tt, int blend_mode, int x,
     if (DP_blend_mode_can_decrease_opacity(blend_mode)) {
         tt->maybe_blank = true;
     }
+    tt->uniform = false;
     DP_blend_pixels(&tt->pixels[y * DP_TILE_SIZE + x], &pixel, 1, DP_BIT15,
                     blend_mode);
 }
@@ -1043,6 +2206,7 @@ void DP_transient_tile_clear(DP_TransientTile *tt)
     DP_ASSERT(tt->transient);
     memset(tt->pixels, 0, DP_TILE_BYTES);
     tt->maybe_blank = true;
+    tt->uniform = true;
 }
 
 void DP_transient_tile_fill_checker(DP_TransientTile *tt, DP_Pixel15 pixel1,
@@ -1061,6 +2225,7 @@ void DP_transient_tile_fill_checker(DP_TransientTile *tt, DP_Pixel15 pixel1,
         }
     }
     tt->maybe_blank = pixel1.a == 0 && pixel2.a == 0;
+    tt->uniform = DP_pixel15_equal(pixel1, pixel2);
 }
 
 void DP_transient_tile_copy(DP_TransientTile *tt, DP_Tile *t)
@@ -1070,8 +2235,10 @@ void DP_transient_tile_copy(DP_TransientTile *tt, DP_Tile *t)
     DP_ASSERT(tt->transient);
     DP_ASSERT(t);
     DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
-    memcpy(tt->pixels, t->pixels, DP_TILE_BYTES);
+    memcpy(tt->pixels, tile_pin(t), DP_TILE_BYTES);
+    tile_unpin(t);
     tt->maybe_blank = t->maybe_blank;
+    tt->uniform = t->uniform;
 }
 
 bool DP_transient_tile_blank(DP_TransientTile *tt)
@@ -1102,7 +2269,8 @@ bool DP_transient_tile_opaque(DP_TransientTile *tt)
     DP_ASSERT(DP_atomic_get(&tt->refcount) > 0);
     DP_ASSERT(tt->transient);
     DP_Pixel15 *pixels = tt->pixels;
-    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+    int count = tt->uniform ? 1 : DP_TILE_LENGTH;
+    for (int i = 0; i < count; ++i) {
         if (pixels[i].a < DP_BIT15) {
             return false;
         }
@@ -1121,7 +2289,17 @@ void DP_transient_tile_mask(DP_TransientTile *DP_RESTRICT tt,
     DP_ASSERT(DP_atomic_get(&t->refcount) > 0);
     DP_ASSERT(DP_atomic_get(&mt->refcount) > 0);
     DP_ASSERT(tt->transient);
-    DP_mask_tile(tt->pixels, t->pixels, mt->pixels);
+    const DP_Pixel15 *mask_pixels = tile_pin(mt);
+    if (mt->uniform) {
+        tt->uniform = t->uniform;
+        DP_mask_tile_uniform(tt->pixels, tile_pin(t), mask_pixels[0].a);
+    }
+    else {
+        tt->uniform = false;
+        DP_mask_tile(tt->pixels, tile_pin(t), mask_pixels);
+    }
+    tile_unpin(t);
+    tile_unpin(mt);
 }
 
 void DP_transient_tile_mask_in_place(DP_TransientTile *DP_RESTRICT tt,
@@ -1132,7 +2310,19 @@ void DP_transient_tile_mask_in_place(DP_TransientTile *DP_RESTRICT tt,
     DP_ASSERT(DP_atomic_get(&tt->refcount) > 0);
     DP_ASSERT(DP_atomic_get(&mt->refcount) > 0);
     DP_ASSERT(tt->transient);
-    DP_mask_tile_in_place(tt->pixels, mt->pixels);
+    const DP_Pixel15 *mask_pixels = tile_pin(mt);
+    if (mt->uniform) {
+        uint16_t mask_a = mask_pixels[0].a;
+        // Masking every pixel the same way keeps a uniform tile uniform.
+        if (mask_a != DP_BIT15) {
+            DP_mask_tile_in_place_uniform(tt->pixels, mask_a);
+        }
+    }
+    else {
+        tt->uniform = false;
+        DP_mask_tile_in_place(tt->pixels, mask_pixels);
+    }
+    tile_unpin(mt);
 }
 
 void DP_transient_tile_merge(DP_TransientTile *DP_RESTRICT tt,
@@ -1144,7 +2334,32 @@ void DP_transient_tile_merge(DP_TransientTile *DP_RESTRICT tt,
     if (DP_blend_mode_can_decrease_opacity(blend_mode)) {
         tt->maybe_blank = true;
     }
-    DP_blend_tile(tt->pixels, t->pixels, opacity, blend_mode);
+
+    DP_Pixel15 *src_pixels = tile_pin(t);
+    if (t->uniform) {
+        // Blending a single color onto a tile that's also a single color gives
+        // another single color, so the result only needs to be computed once.
+        DP_Pixel15 src = src_pixels[0];
+        if (tt->uniform) {
+            DP_Pixel15 dst = tt->pixels[0];
+            if (DP_blend_pixels_uniform(&dst, 1, src, opacity, blend_mode)) {
+                for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+                    tt->pixels[i] = dst;
+                }
+                tile_unpin(t);
+                return;
+            }
+        }
+        else if (DP_blend_pixels_uniform(tt->pixels, DP_TILE_LENGTH, src,
+                                         opacity, blend_mode)) {
+            tile_unpin(t);
+            return;
+        }
+    }
+
+    tt->uniform = false;
+    DP_blend_tile(tt->pixels, src_pixels, opacity, blend_mode);
+    tile_unpin(t);
 }
 
 DP_TransientTile *
@@ -1176,6 +2391,7 @@ void DP_transient_tile_brush_apply(DP_TransientTile *tt, DP_UPixel15 src,
     if (DP_blend_mode_can_decrease_opacity(blend_mode)) {
         tt->maybe_blank = true;
     }
+    tt->uniform = false;
     DP_blend_mask(tt->pixels + y * DP_TILE_SIZE + x, src, blend_mode, mask,
                   opacity, w, h, skip, DP_TILE_SIZE - w);
 }
@@ -1196,6 +2412,7 @@ void DP_transient_tile_brush_apply_posterize(DP_TransientTile *tt,
     DP_ASSERT(y < DP_TILE_SIZE);
     DP_ASSERT(x + w <= DP_TILE_SIZE);
     DP_ASSERT(y + h <= DP_TILE_SIZE);
+    tt->uniform = false;
     DP_posterize_mask(tt->pixels + y * DP_TILE_SIZE + x, posterize_num, mask,
                       opacity, w, h, skip, DP_TILE_SIZE - w);
 }
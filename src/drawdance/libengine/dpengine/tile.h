@@ -23,12 +23,15 @@
 #define DPENGINE_TILE_H
 #include "pixels.h"
 #include <dpcommon/common.h>
+#include <dpcommon/geom.h>
 #include <dpcommon/memory_pool.h>
 
 typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
 typedef struct ZSTD_CCtx_s ZSTD_CCtx;
 typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
 
 #define DP_TILE_BYTES            (DP_TILE_LENGTH * sizeof(DP_Pixel15))
 #define DP_TILE_COMPRESSED_BYTES (DP_TILE_LENGTH * sizeof(DP_Pixel8))
@@ -83,8 +86,61 @@ DP_INLINE int DP_tile_total_round(int width, int height)
 const uint16_t *DP_tile_opaque_mask(void);
 
 
+// Statistics of the memory used for resident tile pixels.
 DP_MemoryPoolStatistics DP_tile_memory_usage(void);
 
+typedef struct DP_TileInternStatistics {
+    bool enabled;
+    size_t tiles; // Distinct tiles currently in the intern table.
+    size_t hits;  // How many tiles have been replaced by an existing one.
+} DP_TileInternStatistics;
+
+DP_TileInternStatistics DP_tile_intern_statistics(void);
+
+typedef struct DP_TileResidencyStatistics {
+    size_t resident;   // Persistent tiles whose pixels are in memory.
+    size_t cold;       // Persistent tiles whose pixels are compressed.
+    size_t cold_bytes; // How much memory the compressed pixels take up.
+    size_t evictions;  // How often pixels have been put into cold storage.
+    size_t inflations; // How often they had to be brought back out of it.
+} DP_TileResidencyStatistics;
+
+DP_TileResidencyStatistics DP_tile_residency_statistics(void);
+
+// Compressed encodings remembered on persistent tiles, so that sending or
+// saving the same tile again doesn't have to compress it again.
+typedef struct DP_TileEncodingCacheStatistics {
+    size_t limit;   // Maximum bytes of encodings to keep around.
+    size_t entries; // Tiles that currently have an encoding cached.
+    size_t bytes;   // How much memory the cached encodings take up.
+    size_t hits;    // How often an encoding was reused instead of compressing.
+} DP_TileEncodingCacheStatistics;
+
+#define DP_TILE_ENCODING_CACHE_DEFAULT_LIMIT ((size_t)128 * 1024 * 1024)
+
+DP_TileEncodingCacheStatistics DP_tile_encoding_cache_statistics(void);
+
+// Drops all cached encodings, e.g. when memory runs low. Encodings of evicted
+// tiles are dropped along with their pixels anyway, see below.
+void DP_tile_encoding_cache_clear(void);
+
+// Zero disables caching. Lowering the limit clears the cache.
+void DP_tile_encoding_cache_limit_set(size_t limit_bytes);
+
+typedef struct DP_TileAllocationStatistics {
+    size_t shards;         // How many separately locked pools there are.
+    size_t remote_frees;   // Tiles freed by a thread from a different shard.
+    size_t remote_batches; // How many batches they were given back in.
+} DP_TileAllocationStatistics;
+
+DP_TileAllocationStatistics DP_tile_allocation_statistics(void);
+
+// If resident tile pixels take up more than the given budget, compresses a
+// batch of persistent tiles that haven't been touched in the last min_idle
+// calls to this function. Their pixels are inflated again transparently when
+// they're accessed. Returns how many tiles were compressed.
+int DP_tile_residency_trim(size_t budget_bytes, unsigned int min_idle);
+
 
 DP_Tile *DP_tile_new(unsigned int context_id);
 
@@ -105,6 +161,12 @@ DP_Tile *DP_tile_new_from_split_delta_zstd8le_with(
     ZSTD_DCtx **in_out_ctx_or_null, DP_SplitTile8 *split_tile8_buffer,
     unsigned int context_id, const unsigned char *image, size_t image_size);
 
+// The dictionary must be the same one that the tile was compressed with.
+DP_Tile *DP_tile_new_from_split_delta_zstd8le_with_dictionary(
+    ZSTD_DCtx **in_out_ctx_or_null, const ZSTD_DDict *ddict_or_null,
+    DP_SplitTile8 *split_tile8_buffer, unsigned int context_id,
+    const unsigned char *image, size_t image_size);
+
 DP_Tile *DP_tile_new_from_split_delta_zstd8le(DP_DrawContext *dc,
                                               unsigned int context_id,
                                               const unsigned char *image,
@@ -129,6 +191,16 @@ DP_Tile *DP_tile_opaque_inc(void);
 // Is the given tile identical to the tile returned by DP_tile_opaque_(no)inc?
 bool DP_tile_opaque_ident(DP_Tile *tile);
 
+// Looks up a tile with the same context id and pixels in the global intern
+// table, taking over the given reference. If one is found, the given tile is
+// decref'd and a new reference to the existing tile is returned. Otherwise,
+// the tile is added to the table and returned as-is. Tiles that end up with
+// identical contents can then share memory, as happens with duplicated layers
+// or key frames and tiles sent repeatedly. Interning is only done if the
+// DP_TILE_INTERN environment variable is set to something other than 0, since
+// hashing every tile isn't free. Otherwise the tile is returned unchanged.
+DP_Tile *DP_tile_intern(DP_Tile *t);
+
 DP_Tile *DP_tile_incref(DP_Tile *tile);
 
 DP_Tile *DP_tile_incref_nullable(DP_Tile *tile_or_null);
@@ -148,7 +220,10 @@ bool DP_tile_transient(DP_Tile *tile);
 
 unsigned int DP_tile_context_id(DP_Tile *tile);
 
-const DP_Pixel15 *DP_tile_pixels(DP_Tile *tile);
+// The pixels of a persistent tile may be moved into cold storage when they're
+// not in use, so direct access to them must be bracketed by these calls.
+const DP_Pixel15 *DP_tile_pixels_acquire(DP_Tile *tile);
+void DP_tile_pixels_release(DP_Tile *tile);
 
 DP_Pixel15 DP_tile_pixel_at(DP_Tile *tile, int x, int y);
 
@@ -158,10 +233,24 @@ bool DP_tile_opaque(DP_Tile *tile_or_null);
 
 bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel);
 
+// Returns the tile-relative bounds of the pixels with non-zero alpha within
+// the top-left width by height area of the tile, or an invalid rect if there
+// are none. Cached for persistent tiles, so repeated calls are cheap.
+DP_Rect DP_tile_alpha_bounds(DP_Tile *tile, int width, int height);
+
 bool DP_tile_pixels_equal(DP_Tile *t1, DP_Tile *t2);
 
+// Hash of the tile's pixels alone, ignoring its context id. Tiles with equal
+// pixels have equal hashes, the converse has to be checked separately.
+uint64_t DP_tile_pixels_hash(DP_Tile *tile);
+
 bool DP_tile_pixels_equal_pixel(DP_Tile *tile, DP_Pixel15 pixel);
 
+// Returns the tile-relative bounds of the pixels that differ between the two
+// tiles, or an invalid rect if they're the same. A null tile is treated as
+// differing everywhere, since it's usually cheaper that way than comparing.
+DP_Rect DP_tile_pixels_diff_bounds(DP_Tile *t1_or_null, DP_Tile *t2_or_null);
+
 
 size_t DP_tile_compress_pixel8be(DP_Pixel15 pixel,
                                  unsigned char *(*get_output_buffer)(size_t,
@@ -182,6 +271,22 @@ size_t DP_tile_compress_split_delta_zstd8le(
     DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, DP_SplitTile8 *split_buffer,
     unsigned char *(*get_output_buffer)(size_t, void *), void *user);
 
+size_t DP_tile_compress_split_delta_zstd8le_with_dictionary(
+    DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, const ZSTD_CDict *cdict_or_null,
+    DP_SplitTile8 *split_buffer,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user);
+
+// Writes the uncompressed split delta data of the tile into the buffer, which
+// is what the above compress. Useful for training dictionaries.
+void DP_tile_split_delta8le(DP_Tile *t, DP_SplitTile8 *split_buffer);
+
+// Same output as DP_tile_compress_split_delta_zstd8le, but for persistent
+// tiles the result is cached on the tile and copied out of there the next time
+// around.
+size_t DP_tile_compress_split_delta_zstd8le_cached(
+    DP_Tile *t, ZSTD_CCtx **in_out_ctx_or_null, DP_SplitTile8 *split_buffer,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user);
+
 size_t DP_tile_compress_mask_delta_zstd8le_opaque(
     unsigned char *(*get_output_buffer)(size_t, void *), void *user);
 
@@ -29,12 +29,17 @@
 #include "layer_props_list.h"
 #include "layer_routes.h"
 #include "local_state.h"
+#include "memory_report.h"
+#include "tile.h"
 #include "timeline.h"
 #include "track.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
 #include <dpmsg/blend_mode.h>
+#include <uthash_inc.h>
+#include <string.h>
 
 
 #define TYPE_NORMAL       0
@@ -45,10 +50,17 @@
 #define TYPE_CALLBACK     5
 
 
+// The layer, its properties and its parent's opacity and tint get looked up
+// once when the filter is made, rather than every time a tile is flattened.
 typedef struct DP_ViewModeTrack {
     int layer_id;
     DP_Vector hidden_layer_ids;
     const DP_OnionSkin *onion_skin;
+    DP_KeyFrame *key_frame;
+    DP_LayerListEntry *lle;
+    DP_LayerProps *lp;
+    uint16_t parent_opacity;
+    DP_UPixel8 parent_tint;
 } DP_ViewModeTrack;
 
 struct DP_OnionSkins {
@@ -58,10 +70,38 @@ struct DP_OnionSkins {
     DP_OnionSkin skins[];
 };
 
+// Each entry holds references to the layer, properties and key frame in its
+// key, so that pointer identity can't be confused by a later allocation.
+// The table doubles as a least-recently-used list: hits get moved to the end,
+// evictions happen at the front.
+#define ONION_SKIN_CACHE_MAX_ENTRIES 2048
+
+typedef struct DP_OnionSkinCacheKey {
+    void *layer;
+    DP_LayerProps *lp;
+    DP_KeyFrame *kf;
+    int tile_index;
+    int internal_type;
+    uint16_t opacity;
+    bool include_sublayers;
+} DP_OnionSkinCacheKey;
+
+typedef struct DP_OnionSkinCacheEntry {
+    DP_OnionSkinCacheKey key;
+    bool is_group;
+    DP_Tile *tile;
+    UT_hash_handle hh;
+} DP_OnionSkinCacheEntry;
+
+struct DP_OnionSkinCache {
+    DP_Mutex *mutex;
+    DP_OnionSkinCacheEntry *entries;
+};
+
 
 void DP_view_mode_buffer_init(DP_ViewModeBuffer *vmb)
 {
-    *vmb = (DP_ViewModeBuffer){0, 0, NULL};
+    *vmb = (DP_ViewModeBuffer){0, 0, NULL, NULL};
 }
 
 void DP_view_mode_buffer_dispose(DP_ViewModeBuffer *vmb)
@@ -72,7 +112,7 @@ void DP_view_mode_buffer_dispose(DP_ViewModeBuffer *vmb)
             DP_vector_dispose(&vmb->tracks[i].hidden_layer_ids);
         }
         DP_free(vmb->tracks);
-        *vmb = (DP_ViewModeBuffer){0, 0, NULL};
+        *vmb = (DP_ViewModeBuffer){0, 0, NULL, NULL};
     }
 }
 
@@ -86,7 +126,8 @@ static DP_ViewModeTrack *view_mode_buffer_push(DP_ViewModeBuffer *vmb)
             vmb->tracks, sizeof(*vmb->tracks) * DP_int_to_size(new_capacity));
         vmb->capacity = new_capacity;
         for (int i = capacity; i < new_capacity; ++i) {
-            vmb->tracks[i] = (DP_ViewModeTrack){0, DP_VECTOR_NULL, NULL};
+            vmb->tracks[i] = (DP_ViewModeTrack){
+                0, DP_VECTOR_NULL, NULL, NULL, NULL, NULL, 0, {0}};
         }
     }
     vmb->count = index + 1;
@@ -193,6 +234,7 @@ static bool build_view_frame(DP_ViewModeTrack *vmt, const DP_OnionSkin *os,
 {
     vmt->layer_id = DP_layer_props_id(lp);
     vmt->onion_skin = os;
+    vmt->key_frame = kf;
 
     int count;
     const DP_KeyFrameLayer *kfls = DP_key_frame_layers(kf, &count);
@@ -223,7 +265,13 @@ static void build_key_frame(DP_ViewModeBuffer *vmb, DP_CanvasState *cs,
     if (lre) {
         DP_ViewModeTrack *vmt = view_mode_buffer_push(vmb);
         DP_LayerProps *lp = DP_layer_routes_entry_props(lre, cs);
-        if (!build_view_frame(vmt, os, lp, kf)) {
+        if (build_view_frame(vmt, os, lp, kf)) {
+            vmt->lle = DP_layer_routes_entry_layer(lre, cs);
+            vmt->lp = lp;
+            DP_layer_routes_entry_parent_opacity_tint(
+                lre, cs, &vmt->parent_opacity, &vmt->parent_tint);
+        }
+        else {
             view_mode_buffer_pop(vmb);
         }
     }
@@ -469,6 +517,12 @@ bool DP_view_mode_context_excludes_everything(const DP_ViewModeContext *vmc)
     return vmc->internal_type == TYPE_NOTHING;
 }
 
+bool DP_view_mode_context_normal(const DP_ViewModeContext *vmc)
+{
+    DP_ASSERT(vmc);
+    return vmc->internal_type == TYPE_NORMAL;
+}
+
 static int count_clipping_layers(DP_LayerProps *lp, DP_LayerPropsList *lpl,
                                  int i, int count)
 {
@@ -507,22 +561,14 @@ DP_ViewModeContext DP_view_mode_context_root_at(
         DP_ASSERT(index < vmf->vmb->count);
         DP_ViewModeBuffer *vmb = vmf->vmb;
         DP_ViewModeTrack *vmt = &vmb->tracks[index];
-        int layer_id = vmt->layer_id;
-        if (layer_id != 0) {
-            DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
-            DP_LayerRoutesEntry *lre = DP_layer_routes_search(lr, layer_id);
-            if (lre) {
-                *out_lle = DP_layer_routes_entry_layer(lre, cs);
-                *out_lp = DP_layer_routes_entry_props(lre, cs);
-                *out_os = vmt->onion_skin;
-                DP_layer_routes_entry_parent_opacity_tint(
-                    lre, cs, out_parent_opacity, out_parent_tint);
-                *out_clip_count = 0;
-                return make_frame_context(internal_type, index, vmb);
-            }
-            else {
-                DP_warn("Track %d layer id %d not found", index, layer_id);
-            }
+        if (vmt->layer_id != 0) {
+            *out_lle = vmt->lle;
+            *out_lp = vmt->lp;
+            *out_os = vmt->onion_skin;
+            *out_parent_opacity = vmt->parent_opacity;
+            *out_parent_tint = vmt->parent_tint;
+            *out_clip_count = 0;
+            return make_frame_context(internal_type, index, vmb);
         }
         *out_lle = NULL;
         *out_lp = NULL;
@@ -984,3 +1030,174 @@ void DP_onion_skins_skin_above_at_set(DP_OnionSkins *oss, int index,
     DP_ASSERT(opacity <= DP_BIT15);
     oss->skins[oss->count_below + index] = (DP_OnionSkin){opacity, tint};
 }
+
+
+DP_OnionSkinCache *DP_onion_skin_cache_new(void)
+{
+    DP_Mutex *mutex = DP_mutex_new();
+    if (mutex) {
+        DP_OnionSkinCache *osc = DP_malloc(sizeof(*osc));
+        *osc = (DP_OnionSkinCache){mutex, NULL};
+        return osc;
+    }
+    else {
+        return NULL;
+    }
+}
+
+static void onion_skin_cache_entry_free(DP_OnionSkinCacheEntry *e)
+{
+    if (e->is_group) {
+        DP_layer_group_decref(e->key.layer);
+    }
+    else {
+        DP_layer_content_decref(e->key.layer);
+    }
+    DP_layer_props_decref(e->key.lp);
+    DP_key_frame_decref(e->key.kf);
+    DP_tile_decref_nullable(e->tile);
+    DP_free(e);
+}
+
+static void onion_skin_cache_clear(DP_OnionSkinCache *osc)
+{
+    DP_OnionSkinCacheEntry *e, *tmp;
+    HASH_ITER(hh, osc->entries, e, tmp) {
+        HASH_DELETE(hh, osc->entries, e);
+        onion_skin_cache_entry_free(e);
+    }
+}
+
+void DP_onion_skin_cache_free(DP_OnionSkinCache *osc_or_null)
+{
+    if (osc_or_null) {
+        onion_skin_cache_clear(osc_or_null);
+        DP_mutex_free(osc_or_null->mutex);
+        DP_free(osc_or_null);
+    }
+}
+
+void DP_onion_skin_cache_clear(DP_OnionSkinCache *osc)
+{
+    DP_ASSERT(osc);
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    onion_skin_cache_clear(osc);
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+}
+
+void DP_onion_skin_cache_memory_report_add(DP_OnionSkinCache *osc,
+                                           DP_MemoryReport *mr)
+{
+    DP_ASSERT(osc);
+    DP_ASSERT(mr);
+    DP_memory_report_cache_add(mr, "onion skins");
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    for (DP_OnionSkinCacheEntry *e = osc->entries; e; e = e->hh.next) {
+        DP_memory_report_cache_tile_add(mr, e->tile);
+    }
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+}
+
+static DP_ViewModeTrack *get_onion_skin_track(const DP_ViewModeContext *vmc)
+{
+    if (is_frame_type(vmc->internal_type)) {
+        DP_ViewModeBuffer *vmb = vmc->frame.vmb;
+        DP_ViewModeTrack *vmt = &vmb->tracks[vmc->frame.track_index];
+        if (vmt->onion_skin && vmt->key_frame) {
+            return vmt;
+        }
+    }
+    return NULL;
+}
+
+DP_OnionSkinCache *
+DP_view_mode_context_onion_skin_cache(const DP_ViewModeContext *vmc)
+{
+    DP_ASSERT(vmc);
+    return get_onion_skin_track(vmc) ? vmc->frame.vmb->onion_skin_cache
+                                     : NULL;
+}
+
+static DP_OnionSkinCacheKey
+make_onion_skin_cache_key(const DP_ViewModeContext *vmc, DP_LayerListEntry *lle,
+                          DP_LayerProps *lp, int tile_index, uint16_t opacity,
+                          bool include_sublayers)
+{
+    DP_ViewModeTrack *vmt = get_onion_skin_track(vmc);
+    DP_ASSERT(vmt);
+    // The key gets hashed and compared as raw bytes, so clear the padding.
+    DP_OnionSkinCacheKey key;
+    memset(&key, 0, sizeof(key));
+    key.layer = DP_layer_list_entry_is_group(lle)
+                  ? (void *)DP_layer_list_entry_group_noinc(lle)
+                  : (void *)DP_layer_list_entry_content_noinc(lle);
+    key.lp = lp;
+    key.kf = vmt->key_frame;
+    key.tile_index = tile_index;
+    key.internal_type = vmc->internal_type;
+    key.opacity = opacity;
+    key.include_sublayers = include_sublayers;
+    return key;
+}
+
+bool DP_onion_skin_cache_search(DP_OnionSkinCache *osc,
+                                const DP_ViewModeContext *vmc,
+                                DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                int tile_index, uint16_t opacity,
+                                bool include_sublayers,
+                                DP_Tile **out_tile_or_null)
+{
+    DP_ASSERT(osc);
+    DP_ASSERT(out_tile_or_null);
+    DP_OnionSkinCacheKey key = make_onion_skin_cache_key(
+        vmc, lle, lp, tile_index, opacity, include_sublayers);
+    DP_OnionSkinCacheEntry *e;
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    HASH_FIND(hh, osc->entries, &key, sizeof(key), e);
+    if (e) {
+        HASH_DELETE(hh, osc->entries, e);
+        HASH_ADD(hh, osc->entries, key, sizeof(e->key), e);
+        *out_tile_or_null = DP_tile_incref_nullable(e->tile);
+    }
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+    return e != NULL;
+}
+
+void DP_onion_skin_cache_insert(DP_OnionSkinCache *osc,
+                                const DP_ViewModeContext *vmc,
+                                DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                int tile_index, uint16_t opacity,
+                                bool include_sublayers, DP_Tile *tile_or_null)
+{
+    DP_ASSERT(osc);
+    DP_OnionSkinCacheKey key = make_onion_skin_cache_key(
+        vmc, lle, lp, tile_index, opacity, include_sublayers);
+    DP_OnionSkinCacheEntry *e;
+    DP_OnionSkinCacheEntry *evicted = NULL;
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    HASH_FIND(hh, osc->entries, &key, sizeof(key), e);
+    if (!e) { // Another thread may have gotten here first.
+        if (HASH_COUNT(osc->entries) >= ONION_SKIN_CACHE_MAX_ENTRIES) {
+            evicted = osc->entries;
+            HASH_DELETE(hh, osc->entries, evicted);
+        }
+        e = DP_malloc(sizeof(*e));
+        e->key = key;
+        e->is_group = DP_layer_list_entry_is_group(lle);
+        if (e->is_group) {
+            DP_layer_group_incref(key.layer);
+        }
+        else {
+            DP_layer_content_incref(key.layer);
+        }
+        DP_layer_props_incref(lp);
+        DP_key_frame_incref(key.kf);
+        e->tile = DP_tile_incref_nullable(tile_or_null);
+        HASH_ADD(hh, osc->entries, key, sizeof(e->key), e);
+    }
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+    // Letting go of the evicted layer may free a lot, don't hold the lock.
+    if (evicted) {
+        onion_skin_cache_entry_free(evicted);
+    }
+}
@@ -30,6 +30,8 @@ typedef struct DP_LayerListEntry DP_LayerListEntry;
 typedef struct DP_LayerProps DP_LayerProps;
 typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_LocalState DP_LocalState;
+typedef struct DP_MemoryReport DP_MemoryReport;
+typedef struct DP_Tile DP_Tile;
 
 
 typedef enum DP_ViewMode {
@@ -40,11 +42,15 @@ typedef enum DP_ViewMode {
 } DP_ViewMode;
 
 typedef struct DP_ViewModeTrack DP_ViewModeTrack;
+typedef struct DP_OnionSkinCache DP_OnionSkinCache;
 
+// The onion skin cache is optional and not owned by the buffer. If it's set,
+// flattening onion skins in frame view mode looks there before compositing.
 typedef struct DP_ViewModeBuffer {
     int capacity;
     int count;
     DP_ViewModeTrack *tracks;
+    DP_OnionSkinCache *onion_skin_cache;
 } DP_ViewModeBuffer;
 
 typedef struct DP_ViewModeCallback {
@@ -109,6 +115,9 @@ void DP_view_mode_buffer_dispose(DP_ViewModeBuffer *vmb);
 
 DP_ViewModeFilter DP_view_mode_filter_make_default(void);
 
+// Frame filters look up their layers in the given canvas state up front, so
+// they may only be used with that same canvas state.
+
 DP_ViewModeFilter DP_view_mode_filter_make_frame_render(DP_ViewModeBuffer *vmb,
                                                         DP_CanvasState *cs,
                                                         int frame_index);
@@ -137,6 +146,9 @@ DP_ViewModeContext DP_view_mode_context_make_default(void);
 
 bool DP_view_mode_context_excludes_everything(const DP_ViewModeContext *vmc);
 
+// Whether the context renders everything as-is, without any filtering.
+bool DP_view_mode_context_normal(const DP_ViewModeContext *vmc);
+
 DP_ViewModeContext DP_view_mode_context_root_at(
     const DP_ViewModeContextRoot *vmcr, DP_CanvasState *cs, int index,
     DP_LayerListEntry **out_lle, DP_LayerProps **out_lp,
@@ -195,4 +207,42 @@ void DP_onion_skins_skin_above_at_set(DP_OnionSkins *oss, int index,
                                       uint16_t opacity, DP_UPixel8 tint);
 
 
+// Holds on to flattened onion skin tiles, keyed by the identity of the layer,
+// its properties and the key frame they're showing, so that stepping through
+// frames doesn't have to composite the same ones over and over. The tiles are
+// stored without the onion skin's tint, so they're reusable at any position.
+// Thread-safe, a single cache can be shared by multiple view mode buffers.
+// Returns NULL if the cache couldn't be created.
+DP_OnionSkinCache *DP_onion_skin_cache_new(void);
+
+void DP_onion_skin_cache_free(DP_OnionSkinCache *osc_or_null);
+
+void DP_onion_skin_cache_clear(DP_OnionSkinCache *osc);
+
+void DP_onion_skin_cache_memory_report_add(DP_OnionSkinCache *osc,
+                                           DP_MemoryReport *mr);
+
+// Returns the cache of the view mode buffer the given context belongs to, or
+// NULL if there's none or it's not an onion skin context.
+DP_OnionSkinCache *
+DP_view_mode_context_onion_skin_cache(const DP_ViewModeContext *vmc);
+
+// Looks up the tile for the given onion skin layer, flattened at the given
+// opacity. If found, returns true and puts a new reference to the tile into
+// out_tile_or_null, which is set to NULL if the tile was blank.
+bool DP_onion_skin_cache_search(DP_OnionSkinCache *osc,
+                                const DP_ViewModeContext *vmc,
+                                DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                int tile_index, uint16_t opacity,
+                                bool include_sublayers,
+                                DP_Tile **out_tile_or_null);
+
+// Stores a tile found missing by a search. Pass NULL for a blank tile.
+void DP_onion_skin_cache_insert(DP_OnionSkinCache *osc,
+                                const DP_ViewModeContext *vmc,
+                                DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                int tile_index, uint16_t opacity,
+                                bool include_sublayers, DP_Tile *tile_or_null);
+
+
 #endif
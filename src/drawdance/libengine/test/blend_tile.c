@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/cpu.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpmsg/blend_mode.h>
+#include <dptest.h>
+
+
+// Tile blending uses vector instructions for some blend modes, picked based on
+// DP_cpu_support. Each of those has to give the same result as the scalar code
+// that DP_CPU_SUPPORT_DEFAULT falls back to. This switches between every level
+// of support that the processor running the test has, so there's no need to
+// set the DP_CPU_SUPPORT environment variable to cover them all.
+
+static const uint16_t opacities[] = {
+    0, 1, DP_BIT15 / 3, DP_BIT15 / 2, DP_BIT15 - 1, DP_BIT15,
+};
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8u;
+}
+
+// Premultiplied pixels, including fully transparent and fully opaque ones and
+// channels at their extremes, since that's where rounding goes wrong.
+static void generate_tile(DP_Pixel15 *pixels, uint32_t seed)
+{
+    uint32_t state = seed;
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        uint32_t kind = next_random(&state) % 8u;
+        int a = kind == 0 ? 0
+              : kind == 1 ? DP_BIT15
+                          : (int)(next_random(&state) % (DP_BIT15 + 1));
+        int c[3];
+        for (int j = 0; j < 3; ++j) {
+            uint32_t extreme = next_random(&state) % 6u;
+            uint32_t range = (uint32_t)a + 1u;
+            c[j] = extreme == 0 ? 0
+                 : extreme == 1 ? a
+                                : (int)(next_random(&state) % range);
+        }
+        pixels[i] = (DP_Pixel15){
+            .b = DP_int_to_uint16(c[0]),
+            .g = DP_int_to_uint16(c[1]),
+            .r = DP_int_to_uint16(c[2]),
+            .a = DP_int_to_uint16(a),
+        };
+    }
+}
+
+static int channel_difference(uint16_t a, uint16_t b)
+{
+    return a < b ? b - a : a - b;
+}
+
+static int pixel_difference(DP_Pixel15 a, DP_Pixel15 b)
+{
+    return DP_max_int(
+        DP_max_int(channel_difference(a.b, b.b), channel_difference(a.g, b.g)),
+        DP_max_int(channel_difference(a.r, b.r), channel_difference(a.a, b.a)));
+}
+
+// How far the vectorized code is allowed to stray from the scalar code. Normal
+// and recolor shift each product separately instead of their sum, pigment sums
+// up its spectral conversion in a different order and the OKLab modes use a
+// fast cube root approximation. Everything else has to match exactly.
+static int tolerance_for(int blend_mode)
+{
+    switch (blend_mode) {
+    case DP_BLEND_MODE_NORMAL:
+    case DP_BLEND_MODE_RECOLOR:
+    case DP_BLEND_MODE_PIGMENT:
+    case DP_BLEND_MODE_PIGMENT_ALPHA:
+        return 1;
+    case DP_BLEND_MODE_OKLAB_NORMAL:
+    case DP_BLEND_MODE_OKLAB_RECOLOR:
+        return 64;
+    default:
+        return 0;
+    }
+}
+
+static void blend_with_support(DP_CpuSupport cpu_support, DP_Pixel15 *dst,
+                               const DP_Pixel15 *base, const DP_Pixel15 *src,
+                               uint16_t opacity, int blend_mode)
+{
+    memcpy(dst, base, sizeof(*dst) * DP_TILE_LENGTH);
+    DP_cpu_support_value = cpu_support;
+    DP_blend_tile(dst, src, opacity, blend_mode);
+}
+
+static void blend_tile_matches_scalar(TEST_PARAMS)
+{
+    DP_CpuSupport detected = DP_cpu_support_value;
+    if (DP_cpu_support != detected) {
+        // Support was picked at compile-time, so it can't be switched around.
+        DP_test_note(T, "CPU support %d is compiled in, not comparing tiers",
+                     (int)DP_cpu_support);
+        return;
+    }
+
+    size_t size = sizeof(DP_Pixel15) * DP_TILE_LENGTH;
+    DP_Pixel15 *base = DP_malloc_simd(size);
+    DP_Pixel15 *src = DP_malloc_simd(size);
+    DP_Pixel15 *expected = DP_malloc_simd(size);
+    DP_Pixel15 *actual = DP_malloc_simd(size);
+    generate_tile(base, 1);
+    generate_tile(src, 2);
+
+    for (int cpu_support = DP_CPU_SUPPORT_DEFAULT + 1;
+         cpu_support <= (int)detected; ++cpu_support) {
+        for (int blend_mode = 0; blend_mode < DP_BLEND_MODE_COUNT;
+             ++blend_mode) {
+            if (!DP_blend_mode_exists(blend_mode)) {
+                continue;
+            }
+
+            int tolerance = tolerance_for(blend_mode);
+            for (size_t i = 0; i < DP_ARRAY_LENGTH(opacities); ++i) {
+                uint16_t opacity = opacities[i];
+                blend_with_support(DP_CPU_SUPPORT_DEFAULT, expected, base, src,
+                                   opacity, blend_mode);
+                blend_with_support((DP_CpuSupport)cpu_support, actual, base,
+                                   src, opacity, blend_mode);
+
+                int mismatches = 0;
+                int max_difference = 0;
+                for (int j = 0; j < DP_TILE_LENGTH; ++j) {
+                    int difference = pixel_difference(expected[j], actual[j]);
+                    if (difference > tolerance) {
+                        ++mismatches;
+                    }
+                    max_difference = DP_max_int(max_difference, difference);
+                }
+                OK(mismatches == 0,
+                   "%s with opacity %d, CPU support %d: %d mismatch(es), "
+                   "max difference %d of %d allowed",
+                   DP_blend_mode_enum_name_unprefixed(blend_mode), (int)opacity,
+                   cpu_support, mismatches, max_difference, tolerance);
+            }
+        }
+    }
+
+    DP_cpu_support_value = detected;
+    DP_free_simd(actual);
+    DP_free_simd(expected);
+    DP_free_simd(src);
+    DP_free_simd(base);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(blend_tile_matches_scalar);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/input.h>
+#include <dpengine/history_blocks.h>
+#include <dptest.h>
+
+#define HEADER_LENGTH 12
+#define BLOCK_COUNT   4
+
+static const size_t block_sizes[BLOCK_COUNT] = {3000, 5000, 2000, 4000};
+
+typedef struct HistoryBlocksTestData {
+    // Header and all blocks in order, what reading should result in.
+    unsigned char *data;
+    size_t length;
+    size_t block_offsets[BLOCK_COUNT];
+} HistoryBlocksTestData;
+
+static HistoryBlocksTestData generate_data(void)
+{
+    HistoryBlocksTestData td;
+    td.length = HEADER_LENGTH;
+    for (int i = 0; i < BLOCK_COUNT; ++i) {
+        td.block_offsets[i] = td.length;
+        td.length += block_sizes[i];
+    }
+
+    // Compressible, but not so much that every block looks the same.
+    td.data = DP_malloc(td.length);
+    uint32_t x = 1;
+    for (size_t i = 0; i < td.length; ++i) {
+        x = x * 1103515245u + 12345u;
+        td.data[i] = (unsigned char)((x >> 16u) % 16u + (i / 1000u) % 64u);
+    }
+    return td;
+}
+
+// The recording as it is after it was last cut back, still containing the
+// blocks from the given one onwards.
+static unsigned char *make_recording(HistoryBlocksTestData *td, int kept,
+                                     size_t *out_length)
+{
+    size_t skip = td->block_offsets[kept] - HEADER_LENGTH;
+    size_t length = td->length - skip;
+    unsigned char *recording = DP_malloc(length);
+    memcpy(recording, td->data, HEADER_LENGTH);
+    memcpy(recording + HEADER_LENGTH, td->data + HEADER_LENGTH + skip,
+           length - HEADER_LENGTH);
+    *out_length = length;
+    return recording;
+}
+
+// Blocks moved in batches, each starting right after the recording header.
+static unsigned char *make_blocks(TEST_PARAMS, HistoryBlocksTestData *td,
+                                  int moved, const int *batch_starts,
+                                  size_t *out_length)
+{
+    size_t length = DP_HISTORY_BLOCKS_HEADER_LENGTH;
+    unsigned char *blocks = DP_malloc(length);
+    DP_history_blocks_header_write(HEADER_LENGTH, blocks);
+
+    size_t recording_offset = HEADER_LENGTH;
+    for (int i = 0; i < moved; ++i) {
+        for (const int *b = batch_starts; *b >= 0; ++b) {
+            if (*b == i) {
+                recording_offset = HEADER_LENGTH;
+            }
+        }
+
+        size_t entry_length;
+        unsigned char *entry = DP_history_block_compress(
+            recording_offset, 10, td->data + td->block_offsets[i],
+            block_sizes[i], &entry_length);
+        if (NOT_NULL_OK(entry, "compress block %d", i)) {
+            blocks = DP_realloc(blocks, length + entry_length);
+            memcpy(blocks + length, entry, entry_length);
+            length += entry_length;
+            DP_free(entry);
+        }
+        recording_offset += block_sizes[i];
+    }
+
+    *out_length = length;
+    return blocks;
+}
+
+static void check_read(TEST_PARAMS, DP_Input *input, HistoryBlocksTestData *td,
+                       const char *title)
+{
+    if (!NOT_NULL_OK(input, "%s: open input", title)) {
+        return;
+    }
+
+    UINT_EQ_OK(DP_input_length(input, NULL), td->length, "%s: length", title);
+
+    unsigned char *buffer = DP_malloc(td->length);
+    bool error;
+    size_t read = DP_input_read(input, buffer, td->length, &error);
+    OK(!error && read == td->length
+           && memcmp(buffer, td->data, td->length) == 0,
+       "%s: read data matches", title);
+
+    // Jump back and forth, across blocks and within them.
+    size_t offsets[] = {0, 7000, 2990, 10000, 12, 8000, 3011};
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(offsets); ++i) {
+        size_t offset = offsets[i];
+        OK(DP_input_seek(input, offset), "%s: seek to %zu", title, offset);
+        read = DP_input_read(input, buffer, 100, &error);
+        OK(!error && read == 100 && memcmp(buffer, td->data + offset, 100) == 0,
+           "%s: data at %zu matches", title, offset);
+    }
+
+    DP_free(buffer);
+    DP_input_free(input);
+}
+
+static void check_case(TEST_PARAMS, HistoryBlocksTestData *td, int moved,
+                       const int *batch_starts, int kept,
+                       size_t expected_current, const char *title)
+{
+    size_t recording_length, blocks_length;
+    unsigned char *recording = make_recording(td, kept, &recording_length);
+    unsigned char *blocks =
+        make_blocks(TEST_ARGS, td, moved, batch_starts, &blocks_length);
+
+    DP_Input *blocks_input =
+        DP_mem_input_new_keep_on_close(blocks, blocks_length);
+    DP_Input *recording_input =
+        DP_mem_input_new_keep_on_close(recording, recording_length);
+    size_t header_length, count, length, current;
+    DP_HistoryBlock *read_blocks;
+    if (OK(DP_history_blocks_read(blocks_input, &header_length, &read_blocks,
+                                  &count, &length),
+           "%s: read blocks", title)) {
+        UINT_EQ_OK(header_length, HEADER_LENGTH, "%s: header length", title);
+        UINT_EQ_OK(count, moved, "%s: block count", title);
+        UINT_EQ_OK(length, blocks_length, "%s: blocks length", title);
+        OK(DP_history_blocks_count_current(blocks_input, read_blocks, count,
+                                           recording_input, header_length,
+                                           &current),
+           "%s: count current blocks", title);
+        UINT_EQ_OK(current, expected_current, "%s: current blocks", title);
+        DP_free(read_blocks);
+    }
+    DP_input_free(recording_input);
+    DP_input_free(blocks_input);
+
+    check_read(TEST_ARGS,
+               DP_history_blocks_input_new(
+                   DP_mem_input_new_keep_on_close(recording, recording_length),
+                   DP_mem_input_new_keep_on_close(blocks, blocks_length)),
+               td, title);
+
+    DP_free(blocks);
+    DP_free(recording);
+}
+
+static void history_blocks_read_back(TEST_PARAMS)
+{
+    HistoryBlocksTestData td = generate_data();
+    int one_batch[] = {0, -1};
+    int two_batches[] = {0, 2, -1};
+    check_case(TEST_ARGS, &td, 0, one_batch, 0, 0, "nothing moved");
+    check_case(TEST_ARGS, &td, 2, one_batch, 2, 2, "one batch");
+    check_case(TEST_ARGS, &td, 3, two_batches, 3, 3, "two batches");
+    // Server stopped between moving the blocks and cutting the recording.
+    check_case(TEST_ARGS, &td, 2, one_batch, 0, 0, "not cut back");
+    check_case(TEST_ARGS, &td, 3, two_batches, 2, 2,
+               "second batch not cut back");
+    DP_free(td.data);
+}
+
+static void history_blocks_bogus(TEST_PARAMS)
+{
+    HistoryBlocksTestData td = generate_data();
+    int one_batch[] = {0, -1};
+    size_t blocks_length;
+    unsigned char *blocks =
+        make_blocks(TEST_ARGS, &td, 2, one_batch, &blocks_length);
+
+    // A block cut off at the end, as if the server had stopped while writing
+    // it, is left out.
+    size_t header_length, count, length;
+    DP_HistoryBlock *read_blocks;
+    DP_Input *input = DP_mem_input_new_keep_on_close(blocks, blocks_length - 5);
+    if (OK(DP_history_blocks_read(input, &header_length, &read_blocks, &count,
+                                  &length),
+           "read cut off blocks")) {
+        UINT_EQ_OK(count, 1, "cut off block left out");
+        OK(count == 1
+               && length
+                      == read_blocks[0].compressed_offset
+                             + read_blocks[0].compressed_size,
+           "length ends at last complete block");
+        DP_free(read_blocks);
+    }
+    DP_input_free(input);
+
+    // Sizes that don't match the frame or are too large are rejected.
+    unsigned char *first_size = blocks + DP_HISTORY_BLOCKS_HEADER_LENGTH + 12;
+    uint32_t bogus_sizes[] = {3001, UINT32_MAX};
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(bogus_sizes); ++i) {
+        DP_write_littleendian_uint32(bogus_sizes[i], first_size);
+        input = DP_mem_input_new_keep_on_close(blocks, blocks_length);
+        NOK(DP_history_blocks_read(input, &header_length, &read_blocks,
+                                   &count, &length),
+            "reject block size %u", (unsigned int)bogus_sizes[i]);
+        DP_input_free(input);
+    }
+
+    memcpy(blocks, "GARBAGE!", 8);
+    input = DP_mem_input_new_keep_on_close(blocks, blocks_length);
+    NOK(DP_history_blocks_read(input, &header_length, &read_blocks, &count,
+                               &length),
+        "reject wrong magic");
+    DP_input_free(input);
+
+    DP_free(blocks);
+    DP_free(td.data);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(history_blocks_read_back);
+    REGISTER_TEST(history_blocks_bogus);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
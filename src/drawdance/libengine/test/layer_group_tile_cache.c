@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_group.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpengine/view_mode.h>
+#include <dptest.h>
+
+
+#define WIDTH  (DP_TILE_SIZE * 2)
+#define HEIGHT DP_TILE_SIZE
+
+static DP_LayerGroup *make_group(void)
+{
+    DP_TransientLayerList *tll = DP_transient_layer_list_new_init(2);
+    uint32_t colors[] = {0xffff0000u, 0x800000ffu};
+    for (int i = 0; i < 2; ++i) {
+        DP_Tile *t = DP_tile_new_from_bgra(0, colors[i]);
+        DP_transient_layer_list_insert_transient_content_noinc(
+            tll, DP_transient_layer_content_new_init(WIDTH, HEIGHT, t), i);
+        DP_tile_decref(t);
+    }
+    return DP_transient_layer_group_persist(
+        DP_transient_layer_group_new_init_with_transient_children_noinc(
+            WIDTH, HEIGHT, tll));
+}
+
+static DP_LayerProps *make_props(uint16_t top_opacity)
+{
+    DP_TransientLayerPropsList *tlpl =
+        DP_transient_layer_props_list_new_init(2);
+    for (int i = 0; i < 2; ++i) {
+        DP_TransientLayerProps *tlp =
+            DP_transient_layer_props_new_init(i + 2, false);
+        if (i == 1) {
+            DP_transient_layer_props_opacity_set(tlp, top_opacity);
+        }
+        DP_transient_layer_props_list_insert_transient_noinc(tlpl, tlp, i);
+    }
+    return DP_transient_layer_props_persist(
+        DP_transient_layer_props_new_init_with_transient_children_noinc(1,
+                                                                        tlpl));
+}
+
+static DP_Pixel15 flatten_pixel(DP_LayerGroup *lg, DP_LayerProps *lp,
+                                int tile_index)
+{
+    DP_ViewModeContext vmc = DP_view_mode_context_make_default();
+    DP_TransientTile *tt = DP_layer_group_flatten_tile_to(
+        lg, lp, tile_index, NULL, DP_BIT15, (DP_UPixel8){.color = 0}, true,
+        false, false, &vmc);
+    DP_Pixel15 pixel = DP_transient_tile_pixel_at(tt, 0, 0);
+    DP_transient_tile_decref(tt);
+    return pixel;
+}
+
+static bool pixel_equal(DP_Pixel15 a, DP_Pixel15 b)
+{
+    return a.b == b.b && a.g == b.g && a.r == b.r && a.a == b.a;
+}
+
+
+static void tile_cache_hit_and_miss(TEST_PARAMS)
+{
+    DP_LayerGroup *lg = make_group();
+    DP_LayerProps *lp1 = make_props(DP_BIT15);
+    DP_LayerProps *lp2 = make_props(DP_BIT15 / 2);
+    DP_LayerPropsList *lpl1 = DP_layer_props_children_noinc(lp1);
+    DP_LayerPropsList *lpl2 = DP_layer_props_children_noinc(lp2);
+
+    NOK(DP_layer_group_tile_cached(lg, lpl1, 0), "nothing cached initially");
+
+    DP_Pixel15 first = flatten_pixel(lg, lp1, 0);
+    OK(DP_layer_group_tile_cached(lg, lpl1, 0), "flattened tile cached");
+    NOK(DP_layer_group_tile_cached(lg, lpl1, 1), "other tile not cached");
+    NOK(DP_layer_group_tile_cached(lg, lpl2, 0),
+        "flattened tile not cached for other props list");
+
+    OK(pixel_equal(flatten_pixel(lg, lp1, 0), first),
+       "cache hit gives same result");
+
+    DP_Pixel15 changed = flatten_pixel(lg, lp2, 0);
+    NOK(pixel_equal(changed, first), "changed props list isn't served stale");
+    OK(DP_layer_group_tile_cached(lg, lpl2, 0),
+       "tile cached for changed props list");
+    NOK(DP_layer_group_tile_cached(lg, lpl1, 0),
+        "tile for previous props list evicted");
+
+    OK(pixel_equal(flatten_pixel(lg, lp1, 0), first),
+       "flattening with previous props list again gives original result");
+
+    DP_transient_layer_group_decref(DP_transient_layer_group_new(lg));
+    NOK(DP_layer_group_tile_cached(lg, lpl1, 0),
+        "cache dropped when group is replaced");
+
+    DP_layer_props_decref(lp2);
+    DP_layer_props_decref(lp1);
+    DP_layer_group_decref(lg);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(tile_cache_hit_and_miss);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -97,11 +97,74 @@ static void pixels15_to_8_tile(TEST_PARAMS)
 }
 
 
+// Bulk conversions use vector instructions for most of the pixels and the
+// scalar functions for the remainder, both have to come out the same. The odd
+// counts and offsets make sure that the pointers aren't aligned and that there
+// is a remainder to deal with.
+#define BULK_PIXEL_COUNT 1003
+
+static void pixels15_to_8_unpremultiply(TEST_PARAMS)
+{
+    DP_Pixel15 *src = DP_malloc(sizeof(*src) * (BULK_PIXEL_COUNT + 1));
+    DP_UPixel8 *dst = DP_malloc(sizeof(*dst) * (BULK_PIXEL_COUNT + 1));
+    for (int a = 0; a <= DP_BIT15; a += 7) {
+        for (int i = 0; i < BULK_PIXEL_COUNT; ++i) {
+            int c = a == 0 ? 0 : (i * 7919 + a) % (a + 1);
+            src[i + 1] = (DP_Pixel15){
+                .b = DP_int_to_uint16(c),
+                .g = DP_int_to_uint16(a - c),
+                .r = DP_int_to_uint16(i == 0 ? a : c / 2),
+                .a = DP_int_to_uint16(a),
+            };
+        }
+
+        DP_pixels15_to_8_unpremultiply(dst + 1, src + 1, BULK_PIXEL_COUNT);
+        int mismatches = 0;
+        for (int i = 1; i <= BULK_PIXEL_COUNT; ++i) {
+            DP_UPixel8 expected =
+                DP_upixel15_to_8(DP_pixel15_unpremultiply(src[i]));
+            if (dst[i].color != expected.color) {
+                ++mismatches;
+            }
+        }
+        INT_EQ_OK(mismatches, 0, "pixels15_to_8_unpremultiply(alpha %d)", a);
+    }
+    DP_free(dst);
+    DP_free(src);
+}
+
+static void pixels8_premultiply(TEST_PARAMS)
+{
+    DP_Pixel8 *pixels = DP_malloc(sizeof(*pixels) * (BULK_PIXEL_COUNT + 1));
+    for (int a = 0; a <= 255; ++a) {
+        for (int i = 1; i <= BULK_PIXEL_COUNT; ++i) {
+            pixels[i].color = DP_int_to_uint32(a) << 24u
+                            | (DP_int_to_uint32(i) * 2654435761u & 0xffffffu);
+        }
+
+        DP_pixels8_premultiply(pixels + 1, BULK_PIXEL_COUNT);
+        int mismatches = 0;
+        for (int i = 1; i <= BULK_PIXEL_COUNT; ++i) {
+            DP_UPixel8 upixel = {DP_int_to_uint32(a) << 24u
+                                 | (DP_int_to_uint32(i) * 2654435761u
+                                    & 0xffffffu)};
+            if (pixels[i].color != DP_pixel8_premultiply(upixel).color) {
+                ++mismatches;
+            }
+        }
+        INT_EQ_OK(mismatches, 0, "pixels8_premultiply(alpha %d)", a);
+    }
+    DP_free(pixels);
+}
+
+
 static void register_tests(REGISTER_PARAMS)
 {
     REGISTER_TEST(channel8_to_15);
     REGISTER_TEST(channel15_to_8);
     REGISTER_TEST(pixels15_to_8_tile);
+    REGISTER_TEST(pixels15_to_8_unpremultiply);
+    REGISTER_TEST(pixels8_premultiply);
 }
 
 int main(int argc, char **argv)
@@ -5,7 +5,14 @@
 #include <dpdb/sql.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
 #include <dpengine/project.h>
+#include <dpengine/tile.h>
+#include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
 #include <dptest.h>
 
@@ -237,10 +244,146 @@ static void project_lock(TEST_PARAMS)
     OK(DP_project_close(open1.project), "Close project");
 }
 
+static void project_incremental_save(TEST_PARAMS)
+{
+    const char *path = "test/tmp/project_incremental_save.dppr";
+    remove_preexisting(TEST_ARGS, path);
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
+    DP_transient_canvas_state_width_set(tcs, 100);
+    DP_transient_canvas_state_height_set(tcs, 100);
+    DP_CanvasState *cs = DP_transient_canvas_state_persist(tcs);
+    DP_ProjectSaveState *pss = DP_project_save_state_new();
+
+    for (int i = 0; i < DP_PROJECT_SAVE_COMPACT_INTERVAL + 2; ++i) {
+        INT_EQ_OK(DP_project_canvas_save_incremental(cs, path, pss, NULL, NULL),
+                  0, "Incremental save %d", i);
+    }
+
+    DP_CanvasState *loaded_cs = NULL;
+    INT_EQ_OK(DP_project_canvas_load(dc, path, &loaded_cs), 0,
+              "Load incrementally saved canvas");
+    DP_canvas_state_decref_nullable(loaded_cs);
+
+    // Someone else writing the file makes the next save a full one.
+    INT_EQ_OK(DP_project_canvas_save(cs, path, NULL, NULL), 0,
+              "Overwrite incrementally saved canvas");
+    INT_EQ_OK(DP_project_canvas_save_incremental(cs, path, pss, NULL, NULL), 0,
+              "Incremental save after overwrite");
+
+    loaded_cs = NULL;
+    INT_EQ_OK(DP_project_canvas_load(dc, path, &loaded_cs), 0,
+              "Load canvas saved after overwrite");
+    DP_canvas_state_decref_nullable(loaded_cs);
+
+    DP_project_save_state_free(pss);
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+// Enough tiles with varied content to train a dictionary on.
+static DP_CanvasState *make_painted_canvas(DP_DrawContext *dc, int width,
+                                           int height)
+{
+    DP_Image *img = DP_image_new(width, height);
+    DP_Pixel8 *pixels = DP_image_pixels(img);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t noise = (uint8_t)((x * 7 + y * 13 + (x ^ y)) % 23);
+            pixels[y * width + x] = (DP_Pixel8){
+                .b = (uint8_t)(x + noise),
+                .g = (uint8_t)(y - noise),
+                .r = (uint8_t)((x + y) / 2),
+                .a = 255,
+            };
+        }
+    }
+
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
+    DP_transient_canvas_state_width_set(tcs, width);
+    DP_transient_canvas_state_height_set(tcs, height);
+
+    DP_TransientLayerContent *tlc =
+        DP_transient_layer_content_new_init(width, height, NULL);
+    DP_transient_layer_content_put_image(tlc, 1, DP_BLEND_MODE_REPLACE, 0, 0,
+                                         img);
+    DP_image_free(img);
+    DP_TransientLayerList *tll =
+        DP_transient_canvas_state_transient_layers(tcs, 1);
+    DP_transient_layer_list_insert_transient_content_noinc(tll, tlc, 0);
+
+    DP_TransientLayerProps *tlp = DP_transient_layer_props_new_init(1, false);
+    DP_TransientLayerPropsList *tlpl =
+        DP_transient_canvas_state_transient_layer_props(tcs, 1);
+    DP_transient_layer_props_list_insert_transient_noinc(tlpl, tlp, 0);
+
+    DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+static DP_LayerContent *first_layer_content(DP_CanvasState *cs)
+{
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    return DP_layer_list_entry_content_noinc(DP_layer_list_at_noinc(ll, 0));
+}
+
+static int count_different_tiles(DP_CanvasState *a, DP_CanvasState *b)
+{
+    DP_LayerContent *lca = first_layer_content(a);
+    DP_LayerContent *lcb = first_layer_content(b);
+    int tile_count = DP_tile_total_round(DP_canvas_state_width(a),
+                                         DP_canvas_state_height(a));
+    int different = 0;
+    for (int i = 0; i < tile_count; ++i) {
+        DP_Tile *ta = DP_layer_content_tile_at_index_noinc(lca, i);
+        DP_Tile *tb = DP_layer_content_tile_at_index_noinc(lcb, i);
+        if (!DP_tile_pixels_equal(ta, tb)) {
+            ++different;
+        }
+    }
+    return different;
+}
+
+static void project_dictionary(TEST_PARAMS)
+{
+    const char *path = "test/tmp/project_dictionary.dppr";
+    remove_preexisting(TEST_ARGS, path);
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = make_painted_canvas(dc, 640, 640);
+    DP_ProjectSaveState *pss = DP_project_save_state_new();
+
+    // The first save trains the dictionary, the incremental one after reuses
+    // it from the file.
+    for (int i = 0; i < 2; ++i) {
+        INT_EQ_OK(DP_project_canvas_save_incremental(cs, path, pss, NULL, NULL),
+                  0, "Save painted canvas %d", i);
+
+        DP_CanvasState *loaded_cs = NULL;
+        if (INT_EQ_OK(DP_project_canvas_load(dc, path, &loaded_cs), 0,
+                      "Load painted canvas %d", i)) {
+            DP_LayerList *ll = DP_canvas_state_layers_noinc(loaded_cs);
+            if (INT_EQ_OK(DP_layer_list_count(ll), 1,
+                          "Loaded canvas %d has one layer", i)) {
+                INT_EQ_OK(count_different_tiles(cs, loaded_cs), 0,
+                          "Loaded canvas %d has the same tiles", i);
+            }
+        }
+        DP_canvas_state_decref_nullable(loaded_cs);
+    }
+
+    DP_project_save_state_free(pss);
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
 static void register_tests(REGISTER_PARAMS)
 {
     REGISTER_TEST(project_basics);
     REGISTER_TEST(project_lock);
+    REGISTER_TEST(project_incremental_save);
+    REGISTER_TEST(project_dictionary);
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/file.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpengine/seekable_zstd.h>
+#include <dptest.h>
+
+#define DATA_LENGTH 100000
+#define FRAME_SIZE  4096
+
+static unsigned char *generate_data(void)
+{
+    // Compressible, but not so much that every frame looks the same.
+    unsigned char *data = DP_malloc(DATA_LENGTH);
+    uint32_t x = 1;
+    for (size_t i = 0; i < DATA_LENGTH; ++i) {
+        x = x * 1103515245u + 12345u;
+        data[i] = (unsigned char)((x >> 16u) % 16u + (i / 1000u) % 64u);
+    }
+    return data;
+}
+
+static bool write_data(TEST_PARAMS, const char *path,
+                       const unsigned char *data)
+{
+    DP_Output *output = DP_seekable_zstd_output_new(
+        DP_file_output_new_from_path(path), FRAME_SIZE, 0);
+    if (!NOT_NULL_OK(output, "create seekable output")) {
+        return false;
+    }
+
+    // Write in uneven chunks so that they straddle frame boundaries.
+    size_t offset = 0;
+    size_t chunk = 1;
+    bool ok = true;
+    while (ok && offset < DATA_LENGTH) {
+        size_t count = DP_min_size(chunk, DATA_LENGTH - offset);
+        ok = DP_output_write(output, data + offset, count);
+        offset += count;
+        chunk = chunk * 3 % 10007 + 1;
+        ok = ok && UINT_EQ_OK(DP_output_tell(output, NULL), offset, "tell");
+    }
+    OK(ok, "write data");
+    return OK(DP_output_free(output), "close seekable output") && ok;
+}
+
+static void check_read(TEST_PARAMS, DP_Input *input, const unsigned char *data,
+                       size_t expected_length, const char *title)
+{
+    if (!NOT_NULL_OK(input, "%s: open input", title)) {
+        return;
+    }
+
+    size_t length = DP_input_length(input, NULL);
+    UINT_EQ_OK(length, expected_length, "%s: length", title);
+
+    unsigned char *buffer = DP_malloc(DATA_LENGTH);
+    bool error;
+    size_t read = DP_input_read(input, buffer, DATA_LENGTH, &error);
+    OK(!error, "%s: read without error", title);
+    UINT_EQ_OK(read, expected_length, "%s: read everything", title);
+    OK(memcmp(buffer, data, DP_min_size(read, expected_length)) == 0,
+       "%s: read data matches", title);
+
+    // Jump back and forth, across frames and within them.
+    size_t offsets[] = {
+        0, 50000, FRAME_SIZE - 1, 12345, FRAME_SIZE, 3, 65000, 40001,
+    };
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(offsets); ++i) {
+        size_t offset = offsets[i];
+        if (offset + 100 > expected_length) {
+            continue;
+        }
+        OK(DP_input_seek(input, offset), "%s: seek to %zu", title, offset);
+        read = DP_input_read(input, buffer, 100, &error);
+        OK(!error && read == 100 && memcmp(buffer, data + offset, 100) == 0,
+           "%s: data at %zu matches", title, offset);
+    }
+
+    DP_free(buffer);
+    DP_input_free(input);
+}
+
+static void seekable_zstd_round_trip(TEST_PARAMS)
+{
+    const char *path = "test/tmp/seekable_zstd.zst";
+    unsigned char *data = generate_data();
+    if (write_data(TEST_ARGS, path, data)) {
+        size_t file_length;
+        unsigned char *file = DP_file_slurp(path, &file_length);
+        if (NOT_NULL_OK(file, "slurp compressed file")) {
+            check_read(TEST_ARGS,
+                       DP_seekable_zstd_input_new_detect(
+                           DP_file_input_new_from_path(path)),
+                       data, DATA_LENGTH, "with seek table");
+
+            // Chopping off the seek table and part of the last frame, as if
+            // the writer had stopped abruptly, leaves the complete frames.
+            size_t frame_count = (DATA_LENGTH + FRAME_SIZE - 1) / FRAME_SIZE;
+            size_t seek_table_length = 8 + frame_count * 8 + 9;
+            size_t truncated_length = file_length - seek_table_length - 10;
+            check_read(TEST_ARGS,
+                       DP_seekable_zstd_input_new(
+                           DP_mem_input_new_keep_on_close(file,
+                                                          truncated_length)),
+                       data, DATA_LENGTH / FRAME_SIZE * FRAME_SIZE,
+                       "truncated");
+
+            // Seek table sizes disagreeing with the frame header or being
+            // unreasonably large get the file rejected.
+            unsigned char *first_size =
+                file + file_length - seek_table_length + 8 + 4;
+            uint32_t bogus_sizes[] = {FRAME_SIZE + 1, UINT32_MAX};
+            for (size_t i = 0; i < DP_ARRAY_LENGTH(bogus_sizes); ++i) {
+                DP_write_littleendian_uint32(bogus_sizes[i], first_size);
+                DP_Input *input = DP_seekable_zstd_input_new(
+                    DP_mem_input_new_keep_on_close(file, file_length));
+                NULL_OK(input, "reject seek table frame size %u",
+                        (unsigned int)bogus_sizes[i]);
+                DP_input_free(input);
+            }
+            DP_free(file);
+        }
+    }
+
+    // Uncompressed data gets passed through as-is.
+    check_read(TEST_ARGS,
+               DP_seekable_zstd_input_new_detect(
+                   DP_mem_input_new_keep_on_close(data, DATA_LENGTH)),
+               data, DATA_LENGTH, "uncompressed");
+    DP_free(data);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(seekable_zstd_round_trip);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Measures what a client goes through when joining a session, using the
+// contents of a recording as the session history. The recording is read and
+// serialized up front, then deserialized the way it would be coming off the
+// network, handed to a paint engine in batches like the client does it and
+// finally rendered in full. Reports the time and peak memory after each stage.
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/paint_engine.h>
+#include <dpengine/player.h>
+#include <dpengine/renderer.h>
+#include <dpimpex/image_impex.h>
+#include <dpimpex/load.h>
+#include <dpmsg/acl.h>
+#include <dpmsg/message.h>
+#include <dpmsg/msg_internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#    include <windows.h>
+#else
+#    include <time.h>
+#endif
+
+
+#define DEFAULT_BATCH_SIZE 1024
+#define TICK_INTERVAL_MS   1
+
+typedef struct SerializedMessages {
+    unsigned char *buffer;
+    size_t used;
+    size_t capacity;
+    int count;
+} SerializedMessages;
+
+
+
+static void sleep_tick_interval(void)
+{
+#if defined(_WIN32)
+    Sleep(TICK_INTERVAL_MS);
+#else
+    struct timespec ts = {0, TICK_INTERVAL_MS * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void print_stage(const char *name, unsigned long long start,
+                        unsigned long long end)
+{
+    double ms = DP_ullong_to_double(end - start) / 1000000.0;
+    bench_result(BENCH_LOWER_IS_BETTER, "ms", ms, "%s", name);
+    long long peak = bench_peak_memory_kib();
+    if (peak < 0) {
+        printf("%-12s %12.3f ms\n", name, ms);
+    }
+    else {
+        printf("%-12s %12.3f ms %10lld KiB peak\n", name, ms, peak);
+    }
+    fflush(stdout);
+}
+
+
+static unsigned char *get_serialize_buffer(void *user, size_t length)
+{
+    SerializedMessages *sm = user;
+    size_t required = sm->used + length;
+    if (required > sm->capacity) {
+        size_t new_capacity = DP_max_size(required, sm->capacity * 2);
+        sm->buffer = DP_realloc(sm->buffer, new_capacity);
+        sm->capacity = new_capacity;
+    }
+    return sm->buffer + sm->used;
+}
+
+static bool read_recording(const char *path, SerializedMessages *sm)
+{
+    DP_LoadResult result;
+    DP_Player *player = DP_load_recording(path, &result);
+    if (!player) {
+        fprintf(stderr, "Error loading '%s' (%d): %s\n", path, (int)result,
+                DP_error());
+        return false;
+    }
+
+    bool ok = true;
+    while (true) {
+        DP_Message *msg;
+        DP_PlayerResult pr = DP_player_step(player, true, &msg);
+        if (pr == DP_PLAYER_SUCCESS) {
+            size_t length =
+                DP_message_serialize(msg, true, get_serialize_buffer, sm);
+            DP_message_decref(msg);
+            if (length == 0) {
+                fprintf(stderr, "Error serializing message: %s\n", DP_error());
+                ok = false;
+                break;
+            }
+            sm->used += length;
+            ++sm->count;
+        }
+        else if (pr == DP_PLAYER_RECORDING_END) {
+            break;
+        }
+        else if (pr == DP_PLAYER_ERROR_PARSE) {
+            fprintf(stderr, "Skipping message: %s\n", DP_error());
+        }
+        else {
+            fprintf(stderr, "Error reading '%s': %s\n", path, DP_error());
+            ok = false;
+            break;
+        }
+    }
+
+    DP_player_free(player);
+    return ok;
+}
+
+static DP_Message **deserialize_messages(SerializedMessages *sm,
+                                         int *out_count)
+{
+    DP_Message **msgs = DP_malloc(sizeof(*msgs) * DP_int_to_size(sm->count));
+    int count = 0;
+    size_t offset = 0;
+    while (offset < sm->used) {
+        const unsigned char *buf = sm->buffer + offset;
+        size_t remaining = sm->used - offset;
+        DP_Message *msg = DP_message_deserialize(buf, remaining, true);
+        if (!msg) {
+            fprintf(stderr, "Error deserializing message: %s\n", DP_error());
+            break;
+        }
+        msgs[count++] = msg;
+        offset += (size_t)DP_MESSAGE_HEADER_LENGTH
+                + (size_t)DP_read_bigendian_uint16(buf);
+    }
+    *out_count = count;
+    return msgs;
+}
+
+
+static void on_acls_changed(DP_UNUSED void *user,
+                            DP_UNUSED int acl_change_flags)
+{
+}
+
+static void on_laser_trail(DP_UNUSED void *user,
+                           DP_UNUSED unsigned int context_id,
+                           DP_UNUSED int persistence, DP_UNUSED uint32_t color)
+{
+}
+
+static void on_move_pointer(DP_UNUSED void *user,
+                            DP_UNUSED unsigned int context_id,
+                            DP_UNUSED int x, DP_UNUSED int y)
+{
+}
+
+static void on_catchup(void *user, int progress)
+{
+    int *out_progress = user;
+    *out_progress = progress;
+}
+
+static void on_reset_lock_changed(DP_UNUSED void *user,
+                                  DP_UNUSED bool locked)
+{
+}
+
+static void on_recorder_state_changed(DP_UNUSED void *user,
+                                      DP_UNUSED bool started)
+{
+}
+
+static void on_layer_props_changed(DP_UNUSED void *user,
+                                   DP_UNUSED DP_LayerPropsList *lpl)
+{
+}
+
+static void on_annotations_changed(DP_UNUSED void *user,
+                                   DP_UNUSED DP_AnnotationList *al)
+{
+}
+
+static void on_document_metadata_changed(DP_UNUSED void *user,
+                                         DP_UNUSED DP_DocumentMetadata *dm)
+{
+}
+
+static void on_timeline_changed(DP_UNUSED void *user,
+                                DP_UNUSED DP_Timeline *tl)
+{
+}
+
+static void on_selections_changed(DP_UNUSED void *user,
+                                  DP_UNUSED DP_SelectionSet *ss_or_null)
+{
+}
+
+static void on_cursor_moved(DP_UNUSED void *user, DP_UNUSED unsigned int flags,
+                            DP_UNUSED unsigned int context_id,
+                            DP_UNUSED int layer_id, DP_UNUSED int x,
+                            DP_UNUSED int y)
+{
+}
+
+static void on_default_layer_set(DP_UNUSED void *user,
+                                 DP_UNUSED int layer_id)
+{
+}
+
+static void on_undo_depth_limit_set(DP_UNUSED void *user,
+                                    DP_UNUSED int undo_depth_limit)
+{
+}
+
+static void on_censored_layer_revealed(DP_UNUSED void *user,
+                                       DP_UNUSED int layer_id)
+{
+}
+
+static void tick(DP_PaintEngine *pe, DP_Rect tile_bounds, int *out_progress)
+{
+    DP_paint_engine_tick(
+        pe, tile_bounds, false, on_catchup, on_reset_lock_changed,
+        on_recorder_state_changed, on_layer_props_changed,
+        on_annotations_changed, on_document_metadata_changed,
+        on_timeline_changed, on_selections_changed, on_cursor_moved,
+        on_default_layer_set, on_undo_depth_limit_set,
+        on_censored_layer_revealed, out_progress);
+}
+
+static void handle(DP_PaintEngine *pe, int count, DP_Message **msgs)
+{
+    DP_paint_engine_handle_inc(pe, false, true, count, msgs, on_acls_changed,
+                               on_laser_trail, on_move_pointer, NULL);
+}
+
+static void handle_single_noinc(DP_PaintEngine *pe, DP_Message *msg)
+{
+    handle(pe, 1, &msg);
+    DP_message_decref(msg);
+}
+
+
+static void bench(int count, DP_Message **msgs, int batch_size)
+{
+    DP_DrawContext *paint_dc = DP_draw_context_new();
+    DP_DrawContext *main_dc = DP_draw_context_new();
+    DP_DrawContext *preview_dc = DP_draw_context_new();
+    DP_AclState *acls = DP_acl_state_new();
+    BenchRenderState brs;
+    bench_render_state_init(&brs, false);
+
+    DP_PaintEngine *pe = DP_paint_engine_new_inc(
+        paint_dc, main_dc, preview_dc, acls, NULL, true, 0xff646464u,
+        0xff878787u, 0x0u, bench_on_renderer_tile, NULL,
+        bench_on_renderer_unlock, bench_on_renderer_resize, &brs, NULL, NULL,
+        NULL, NULL, false, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL);
+
+    // Paint thread: multidab batching, canvas history and everything else
+    // that happens to the messages before they show up in the canvas state.
+    // Catchup progress is handled in order with the rest of the messages, so
+    // ticking until it reaches 100 is the same thing a joining client sees.
+    // Ticks don't render any tiles, that's measured separately below.
+    int progress = -1;
+    DP_Rect nothing = {0, 0, -1, -1};
+    unsigned long long start = DP_perf_time();
+    handle_single_noinc(pe, DP_msg_internal_catchup_new(0, 0));
+    for (int i = 0; i < count; i += batch_size) {
+        handle(pe, DP_min_int(batch_size, count - i), msgs + i);
+    }
+    handle_single_noinc(pe, DP_msg_internal_catchup_new(0, 100));
+    int ticks = 0;
+    do {
+        sleep_tick_interval();
+        tick(pe, nothing, &progress);
+        ++ticks;
+    } while (progress < 100);
+    unsigned long long end = DP_perf_time();
+    print_stage("handle", start, end);
+
+    DP_Rect everything = {0, 0, UINT16_MAX, UINT16_MAX};
+    start = DP_perf_time();
+    tick(pe, everything, &progress);
+    DP_paint_engine_render_everything(pe);
+    DP_SEMAPHORE_MUST_WAIT(brs.unlock_sem);
+    end = DP_perf_time();
+    print_stage("render", start, end);
+
+    DP_PaintEngineQueueStatistics qs = DP_paint_engine_queue_statistics(pe);
+    DP_PaintEngineMultidabStatistics ms =
+        DP_paint_engine_multidab_statistics(pe);
+    DP_RendererStatistics rstats = DP_paint_engine_render_statistics(pe);
+    printf("\ncanvas %dx%d, %d render threads, %d ticks to catch up\n",
+           brs.width, brs.height, DP_paint_engine_render_thread_count(pe),
+           ticks);
+    printf("queue: %llu handled, %llu skipped, %d max queued, "
+           "%.3f ms max wait\n",
+           qs.handled, qs.skipped, qs.max_queued,
+           DP_ullong_to_double(qs.max_queue_ns) / 1000000.0);
+    printf("multidab: %zu batches, %.3f ms measured, %.3f ms estimated\n",
+           ms.batches, DP_ullong_to_double(ms.batch_ns) / 1000000.0,
+           ms.estimated_ns / 1000000.0);
+    printf("renderer: %d tiles delivered, %zu jobs, %zu claims, %zu steals, "
+           "%.3f ms queue wait\n",
+           DP_atomic_get(&brs.tiles), rstats.jobs, rstats.claims,
+           rstats.steals,
+           DP_ullong_to_double(rstats.queue_wait_ns) / 1000000.0);
+
+    DP_paint_engine_free_join(pe);
+    bench_render_state_dispose(&brs);
+    DP_acl_state_free(acls);
+    DP_draw_context_free(preview_dc);
+    DP_draw_context_free(main_dc);
+    DP_draw_context_free(paint_dc);
+}
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+    DP_image_impex_init();
+
+    int batch_size = argc == 3 ? atoi(argv[2]) : DEFAULT_BATCH_SIZE;
+    if ((argc != 2 && argc != 3) || batch_size <= 0) {
+        fprintf(stderr, "Usage: %s RECORDING [BATCH_SIZE]\n",
+                bench_name(argc, argv, "bench_catchup"));
+        return 2;
+    }
+
+    bench_results_init("bench_catchup", argc, argv);
+    SerializedMessages sm = {NULL, 0, 0, 0};
+    unsigned long long start = DP_perf_time();
+    if (!read_recording(argv[1], &sm)) {
+        DP_free(sm.buffer);
+        return 1;
+    }
+    unsigned long long end = DP_perf_time();
+    print_stage("read", start, end);
+    printf("%d messages, %zu bytes\n", sm.count, sm.used);
+
+    int count;
+    start = DP_perf_time();
+    DP_Message **msgs = deserialize_messages(&sm, &count);
+    end = DP_perf_time();
+    DP_free(sm.buffer);
+    print_stage("deserialize", start, end);
+
+    bench(count, msgs, batch_size);
+
+    for (int i = 0; i < count; ++i) {
+        DP_message_decref(msgs[i]);
+    }
+    DP_free(msgs);
+
+    long long peak = bench_peak_memory_kib();
+    if (peak >= 0) {
+        bench_result(BENCH_LOWER_IS_BETTER, "KiB", (double)peak, "peak_rss");
+    }
+    return bench_results_finish() ? 0 : 1;
+}
@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Runs the tile and image codecs over the contents of a real canvas file and
+// reports the compression ratio and throughput of each, to pick compression
+// levels with. All throughputs are relative to the uncompressed 8 bit pixel
+// data, so they're comparable between codecs. Tiles are taken from every
+// layer, skipping duplicates of the same tile. Zstd levels are run on the
+// split-delta representation that tiles get compressed from.
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpcommon/perf.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/compress.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_group.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpimpex/image_impex.h>
+#include <dpimpex/image_png.h>
+#include <dpimpex/load.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zstd.h>
+
+
+#define DEFAULT_MAX_TILES 4096
+#define RAW_TILE_BYTES    ((size_t)DP_TILE_LENGTH * (size_t)4)
+#define RAW_MASK_BYTES    ((size_t)DP_TILE_LENGTH)
+
+static const int zstd_levels[] = {-5, -1, 1, 2, 3, 4, 6, 9, 12, 15, 19};
+
+typedef struct TileCorpus {
+    DP_Tile **tiles;
+    int count;
+    int capacity;
+} TileCorpus;
+
+// Compressed payloads of all tiles, one after another.
+typedef struct Payloads {
+    unsigned char *data;
+    size_t used;
+    size_t capacity;
+    size_t *offsets;
+    size_t *sizes;
+} Payloads;
+
+typedef size_t (*CompressTileFn)(void *user, DP_Tile *t, Payloads *p);
+typedef DP_Tile *(*DecompressTileFn)(void *user, const unsigned char *data,
+                                     size_t size);
+
+typedef struct CodecContext {
+    DP_DrawContext *dc;
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+    DP_SplitTile8 *split;
+    uint8_t *channel;
+} CodecContext;
+
+
+static bool tile_in_corpus(TileCorpus *corpus, DP_Tile *t)
+{
+    for (int i = 0; i < corpus->count; ++i) {
+        if (corpus->tiles[i] == t) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void collect_tiles(TileCorpus *corpus, DP_LayerList *ll, int max_tiles)
+{
+    int layer_count = DP_layer_list_count(ll);
+    for (int i = 0; i < layer_count && corpus->count < max_tiles; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        if (DP_layer_list_entry_is_group(lle)) {
+            DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+            collect_tiles(corpus, DP_layer_group_children_noinc(lg),
+                          max_tiles);
+            continue;
+        }
+
+        DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+        int tile_count = DP_tile_total_round(DP_layer_content_width(lc),
+                                             DP_layer_content_height(lc));
+        for (int j = 0; j < tile_count && corpus->count < max_tiles; ++j) {
+            DP_Tile *t = DP_layer_content_tile_at_index_noinc(lc, j);
+            if (t && !DP_tile_blank(t) && !tile_in_corpus(corpus, t)) {
+                if (corpus->count == corpus->capacity) {
+                    corpus->capacity = DP_max_int(64, corpus->capacity * 2);
+                    corpus->tiles = DP_realloc(
+                        corpus->tiles, sizeof(*corpus->tiles)
+                                           * DP_int_to_size(corpus->capacity));
+                }
+                corpus->tiles[corpus->count++] = DP_tile_incref(t);
+            }
+        }
+    }
+}
+
+
+static unsigned char *get_payload_buffer(size_t size, void *user)
+{
+    Payloads *p = user;
+    size_t required = p->used + size;
+    if (required > p->capacity) {
+        p->capacity = DP_max_size(required, p->capacity * 2);
+        p->data = DP_realloc(p->data, p->capacity);
+    }
+    return p->data + p->used;
+}
+
+static void print_result(const char *name, int count, size_t raw_bytes,
+                         size_t compressed_bytes,
+                         unsigned long long compress_ns,
+                         unsigned long long decompress_ns)
+{
+    double raw_mb = (double)raw_bytes / (1024.0 * 1024.0);
+    double compress_s = DP_ullong_to_double(compress_ns) / 1000000000.0;
+    double decompress_s = DP_ullong_to_double(decompress_ns) / 1000000000.0;
+    double ratio = compressed_bytes == 0
+                     ? 0.0
+                     : (double)raw_bytes / (double)compressed_bytes;
+    double compress_mb_s = compress_s > 0.0 ? raw_mb / compress_s : 0.0;
+    double decompress_mb_s = decompress_s > 0.0 ? raw_mb / decompress_s : 0.0;
+    printf("%s,%d,%zu,%zu,%.3f,%.1f,%.1f\n", name, count, raw_bytes,
+           compressed_bytes, ratio, compress_mb_s, decompress_mb_s);
+    fflush(stdout);
+    bench_result(BENCH_HIGHER_IS_BETTER, "ratio", ratio, "%s_ratio", name);
+    bench_result(BENCH_HIGHER_IS_BETTER, "MiB/s", compress_mb_s,
+                 "%s_compress", name);
+    bench_result(BENCH_HIGHER_IS_BETTER, "MiB/s", decompress_mb_s,
+                 "%s_decompress", name);
+}
+
+// Compressing overwrites the previous iteration's payloads, decompressing
+// reads the payloads of the last one.
+static void bench_tiles(const char *name, TileCorpus *corpus, int iterations,
+                        size_t raw_tile_bytes, CompressTileFn compress,
+                        DecompressTileFn decompress, void *user, Payloads *p)
+{
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        p->used = 0;
+        for (int j = 0; j < corpus->count; ++j) {
+            size_t size = compress(user, corpus->tiles[j], p);
+            if (size == 0) {
+                fprintf(stderr, "%s: compression failed: %s\n", name,
+                        DP_error());
+                return;
+            }
+            p->offsets[j] = p->used;
+            p->sizes[j] = size;
+            p->used += size;
+        }
+    }
+    unsigned long long compress_ns = DP_perf_time() - start;
+
+    start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        for (int j = 0; j < corpus->count; ++j) {
+            const unsigned char *data = p->data + p->offsets[j];
+            DP_Tile *t = decompress(user, data, p->sizes[j]);
+            if (!t) {
+                fprintf(stderr, "%s: decompression failed: %s\n", name,
+                        DP_error());
+                return;
+            }
+            DP_tile_decref(t);
+        }
+    }
+    unsigned long long decompress_ns = DP_perf_time() - start;
+
+    size_t raw_bytes =
+        raw_tile_bytes * DP_int_to_size(corpus->count) * (size_t)iterations;
+    print_result(name, corpus->count, raw_bytes, p->used * (size_t)iterations,
+                 compress_ns, decompress_ns);
+}
+
+static size_t compress_deflate(void *user, DP_Tile *t, Payloads *p)
+{
+    CodecContext *c = user;
+    return DP_tile_compress_deflate(t, DP_draw_context_tile8_buffer(c->dc),
+                                    get_payload_buffer, p);
+}
+
+static DP_Tile *decompress_deflate(void *user, const unsigned char *data,
+                                   size_t size)
+{
+    CodecContext *c = user;
+    return DP_tile_new_from_deflate(c->dc, 0, data, size);
+}
+
+static size_t compress_split_delta_zstd8le(void *user, DP_Tile *t, Payloads *p)
+{
+    CodecContext *c = user;
+    return DP_tile_compress_split_delta_zstd8le(t, &c->cctx, c->split,
+                                                get_payload_buffer, p);
+}
+
+static DP_Tile *decompress_split_delta_zstd8le(void *user,
+                                               const unsigned char *data,
+                                               size_t size)
+{
+    CodecContext *c = user;
+    return DP_tile_new_from_split_delta_zstd8le_with(&c->dctx, c->split, 0,
+                                                     data, size);
+}
+
+static size_t compress_mask_delta_zstd8le(void *user, DP_Tile *t, Payloads *p)
+{
+    CodecContext *c = user;
+    return DP_tile_compress_mask_delta_zstd8le(t, &c->cctx, c->channel,
+                                               get_payload_buffer, p);
+}
+
+static DP_Tile *decompress_mask_delta_zstd8le(void *user,
+                                              const unsigned char *data,
+                                              size_t size)
+{
+    CodecContext *c = user;
+    return DP_tile_new_mask_from_delta_zstd8le(c->dc, 0, data, size);
+}
+
+
+static void bench_zstd_level(int level, DP_SplitTile8 *splits, int count,
+                             int iterations, CodecContext *c, Payloads *p)
+{
+    size_t bound = ZSTD_compressBound(sizeof(*splits));
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        p->used = 0;
+        for (int j = 0; j < count; ++j) {
+            unsigned char *out = get_payload_buffer(bound, p);
+            size_t size = ZSTD_compressCCtx(c->cctx, out, bound, &splits[j],
+                                            sizeof(*splits), level);
+            if (ZSTD_isError(size)) {
+                fprintf(stderr, "zstd %d: compression failed: %s\n", level,
+                        ZSTD_getErrorName(size));
+                return;
+            }
+            p->offsets[j] = p->used;
+            p->sizes[j] = size;
+            p->used += size;
+        }
+    }
+    unsigned long long compress_ns = DP_perf_time() - start;
+
+    start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        for (int j = 0; j < count; ++j) {
+            size_t size =
+                ZSTD_decompressDCtx(c->dctx, c->split, sizeof(*c->split),
+                                    p->data + p->offsets[j], p->sizes[j]);
+            if (ZSTD_isError(size)) {
+                fprintf(stderr, "zstd %d: decompression failed: %s\n", level,
+                        ZSTD_getErrorName(size));
+                return;
+            }
+        }
+    }
+    unsigned long long decompress_ns = DP_perf_time() - start;
+
+    char name[32];
+    snprintf(name, sizeof(name), "zstd_%d", level);
+    size_t raw_bytes =
+        RAW_TILE_BYTES * DP_int_to_size(count) * (size_t)iterations;
+    print_result(name, count, raw_bytes, p->used * (size_t)iterations,
+                 compress_ns, decompress_ns);
+}
+
+static void bench_zstd_levels(TileCorpus *corpus, int iterations,
+                              CodecContext *c, Payloads *p)
+{
+    DP_SplitTile8 *splits = DP_malloc_simd(
+        sizeof(*splits) * DP_int_to_size(DP_max_int(1, corpus->count)));
+    for (int i = 0; i < corpus->count; ++i) {
+        DP_Tile *t = corpus->tiles[i];
+        const DP_Pixel15 *pixels = DP_tile_pixels_acquire(t);
+        DP_pixels15_to_split_tile8_delta(&splits[i], pixels);
+        DP_tile_pixels_release(t);
+    }
+
+    if (!c->cctx) {
+        c->cctx = ZSTD_createCCtx();
+    }
+    if (!c->dctx) {
+        c->dctx = ZSTD_createDCtx();
+    }
+
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(zstd_levels); ++i) {
+        bench_zstd_level(zstd_levels[i], splits, corpus->count, iterations, c,
+                         p);
+    }
+
+    DP_free_simd(splits);
+}
+
+
+typedef bool (*WriteImageFn)(DP_Image *img, DP_Output *output, int arg);
+
+static bool write_png(DP_Image *img, DP_Output *output, int level)
+{
+    return DP_image_write_png_level(img, output, level);
+}
+
+static bool write_jpeg(DP_Image *img, DP_Output *output, int quality)
+{
+    return DP_image_write_jpeg_quality(img, output, quality);
+}
+
+static bool write_webp(DP_Image *img, DP_Output *output, DP_UNUSED int arg)
+{
+    return DP_image_write_webp(img, output);
+}
+
+static bool write_webp_lossy(DP_Image *img, DP_Output *output, int quality)
+{
+    return DP_image_write_webp_lossy(img, output, quality);
+}
+
+static bool write_qoi(DP_Image *img, DP_Output *output, DP_UNUSED int arg)
+{
+    return DP_image_write_qoi(img, output);
+}
+
+static void bench_image(const char *name, DP_Image *img, int iterations,
+                        WriteImageFn write, int arg, DP_ImageFileType type)
+{
+    void *buffer = NULL;
+    size_t size = 0;
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_free(buffer);
+        void **buffer_ptr;
+        size_t *size_ptr;
+        DP_Output *output =
+            DP_mem_output_new(1024, false, &buffer_ptr, &size_ptr);
+        bool ok = write(img, output, arg);
+        buffer = *buffer_ptr;
+        size = *size_ptr;
+        DP_output_free(output);
+        if (!ok) {
+            fprintf(stderr, "%s: encoding failed: %s\n", name, DP_error());
+            DP_free(buffer);
+            return;
+        }
+    }
+    unsigned long long compress_ns = DP_perf_time() - start;
+
+    start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_Input *input = DP_mem_input_new_keep_on_close(buffer, size);
+        DP_Image *decoded = DP_image_new_from_file(input, type, NULL);
+        DP_input_free(input);
+        if (!decoded) {
+            fprintf(stderr, "%s: decoding failed: %s\n", name, DP_error());
+            DP_free(buffer);
+            return;
+        }
+        DP_image_free(decoded);
+    }
+    unsigned long long decompress_ns = DP_perf_time() - start;
+    DP_free(buffer);
+
+    size_t raw_bytes = DP_int_to_size(DP_image_width(img))
+                     * DP_int_to_size(DP_image_height(img)) * (size_t)4
+                     * (size_t)iterations;
+    print_result(name, 1, raw_bytes, size * (size_t)iterations, compress_ns,
+                 decompress_ns);
+}
+
+static void bench_images(DP_CanvasState *cs, int iterations)
+{
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    if (!img) {
+        fprintf(stderr, "Flattening canvas failed: %s\n", DP_error());
+        return;
+    }
+
+    bench_image("png_default", img, iterations, write_png,
+                DP_IMAGE_PNG_LEVEL_DEFAULT, DP_IMAGE_FILE_TYPE_PNG);
+    bench_image("png_1", img, iterations, write_png, 1,
+                DP_IMAGE_FILE_TYPE_PNG);
+    bench_image("png_3", img, iterations, write_png, 3,
+                DP_IMAGE_FILE_TYPE_PNG);
+    bench_image("png_6", img, iterations, write_png, 6,
+                DP_IMAGE_FILE_TYPE_PNG);
+    bench_image("png_9", img, iterations, write_png, 9,
+                DP_IMAGE_FILE_TYPE_PNG);
+    bench_image("jpeg_80", img, iterations, write_jpeg, 80,
+                DP_IMAGE_FILE_TYPE_JPEG);
+    bench_image("jpeg_95", img, iterations, write_jpeg, 95,
+                DP_IMAGE_FILE_TYPE_JPEG);
+    bench_image("webp", img, iterations, write_webp, 0,
+                DP_IMAGE_FILE_TYPE_WEBP);
+    bench_image("webp_lossy_90", img, iterations, write_webp_lossy, 90,
+                DP_IMAGE_FILE_TYPE_WEBP);
+    bench_image("qoi", img, iterations, write_qoi, 0, DP_IMAGE_FILE_TYPE_QOI);
+
+    DP_image_free(img);
+}
+
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+    DP_image_impex_init();
+
+    int iterations = argc >= 3 ? atoi(argv[2]) : 0;
+    int max_tiles = argc >= 4 ? atoi(argv[3]) : DEFAULT_MAX_TILES;
+    if (argc < 3 || argc > 4 || iterations <= 0 || max_tiles <= 0) {
+        fprintf(stderr, "Usage: %s PATH ITERATIONS [MAX_TILES]\n",
+                bench_name(argc, argv, "bench_codecs"));
+        return 2;
+    }
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_LoadResult result;
+    DP_CanvasState *cs =
+        DP_load(dc, argv[1], "Layer 1", 0, NULL, NULL, &result, NULL);
+    if (!cs) {
+        fprintf(stderr, "Error loading '%s' (%d): %s\n", argv[1], (int)result,
+                DP_error());
+        DP_draw_context_free(dc);
+        return 1;
+    }
+
+    bench_results_init("bench_codecs", argc, argv);
+    TileCorpus corpus = {NULL, 0, 0};
+    collect_tiles(&corpus, DP_canvas_state_layers_noinc(cs), max_tiles);
+
+    size_t offsets_size = sizeof(size_t) * DP_int_to_size(corpus.count + 1);
+    Payloads p = {NULL, 0, 0, DP_malloc(offsets_size),
+                  DP_malloc(offsets_size)};
+    CodecContext c = {dc, NULL, NULL, DP_malloc_simd(sizeof(*c.split)),
+                      DP_malloc(RAW_MASK_BYTES)};
+
+    printf("codec,items,raw_bytes,compressed_bytes,ratio,compress_mb_s,"
+           "decompress_mb_s\n");
+    bench_tiles("tile_deflate", &corpus, iterations, RAW_TILE_BYTES,
+                compress_deflate, decompress_deflate, &c, &p);
+    bench_tiles("tile_split_delta_zstd8le", &corpus, iterations,
+                RAW_TILE_BYTES, compress_split_delta_zstd8le,
+                decompress_split_delta_zstd8le, &c, &p);
+    bench_tiles("mask_delta_zstd8le", &corpus, iterations, RAW_MASK_BYTES,
+                compress_mask_delta_zstd8le, decompress_mask_delta_zstd8le,
+                &c, &p);
+    bench_zstd_levels(&corpus, iterations, &c, &p);
+    bench_images(cs, iterations);
+
+    DP_free(c.channel);
+    DP_free_simd(c.split);
+    DP_decompress_zstd_free(&c.dctx);
+    DP_compress_zstd_free(&c.cctx);
+    DP_free(p.sizes);
+    DP_free(p.offsets);
+    DP_free(p.data);
+    for (int i = 0; i < corpus.count; ++i) {
+        DP_tile_decref(corpus.tiles[i]);
+    }
+    DP_free(corpus.tiles);
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+    return bench_results_finish() ? 0 : 1;
+}
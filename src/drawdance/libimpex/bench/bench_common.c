@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "bench_common.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/pixels.h>
+#include <dpmsg/blend_mode.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#    include <sys/resource.h>
+#    define HAVE_GETRUSAGE
+#endif
+
+
+const char *bench_name(int argc, char **argv, const char *fallback)
+{
+    return argc > 0 && argv[0] ? argv[0] : fallback;
+}
+
+bool bench_parse_dimensions(const char *width_arg, const char *height_arg,
+                            int *out_width, int *out_height)
+{
+    int width = atoi(width_arg);
+    int height = atoi(height_arg);
+    if (!DP_canvas_state_in_max_dimension_bound(width)
+        || !DP_canvas_state_in_max_dimension_bound(height)
+        || !DP_canvas_state_in_max_pixels_bound(width, height)) {
+        fputs("Dimensions out of bounds\n", stderr);
+        return false;
+    }
+    *out_width = width;
+    *out_height = height;
+    return true;
+}
+
+bool bench_parse_positive(const char *arg, const char *what, int *out_value)
+{
+    int value = atoi(arg);
+    if (value <= 0) {
+        fprintf(stderr, "%s out of bounds\n", what);
+        return false;
+    }
+    *out_value = value;
+    return true;
+}
+
+
+long long bench_peak_memory_kib(void)
+{
+#ifdef HAVE_GETRUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#    ifdef __APPLE__
+        return (long long)usage.ru_maxrss / 1024LL; // Bytes on macOS.
+#    else
+        return (long long)usage.ru_maxrss;
+#    endif
+    }
+#endif
+    return -1;
+}
+
+long long bench_cpu_time_us(void)
+{
+#ifdef HAVE_GETRUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return (long long)usage.ru_utime.tv_sec * 1000000LL
+             + (long long)usage.ru_utime.tv_usec
+             + (long long)usage.ru_stime.tv_sec * 1000000LL
+             + (long long)usage.ru_stime.tv_usec;
+    }
+#endif
+    return -1;
+}
+
+
+double bench_random(RngDouble *rng)
+{
+    return fabs(fmod(rng_double_next(rng), 1.0));
+}
+
+DP_TransientCanvasState *
+bench_canvas_new(int width, int height, int layer_count,
+                 DP_TransientLayerList **out_tll,
+                 DP_TransientLayerPropsList **out_tlpl)
+{
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
+    DP_transient_canvas_state_width_set(tcs, width);
+    DP_transient_canvas_state_height_set(tcs, height);
+    *out_tll = DP_transient_canvas_state_transient_layers(tcs, layer_count);
+    *out_tlpl =
+        DP_transient_canvas_state_transient_layer_props(tcs, layer_count);
+    return tcs;
+}
+
+DP_TransientLayerProps *bench_layer_props_new(int layer_id, int blend_mode,
+                                              uint16_t opacity)
+{
+    DP_TransientLayerProps *tlp =
+        DP_transient_layer_props_new_init(layer_id, false);
+    DP_transient_layer_props_blend_mode_set(tlp, blend_mode);
+    DP_transient_layer_props_opacity_set(tlp, opacity);
+    return tlp;
+}
+
+DP_Pixel15 bench_random_pixel(RngDouble *rng)
+{
+    double a = bench_random(rng);
+    double b = bench_random(rng) * a;
+    double g = bench_random(rng) * a;
+    double r = bench_random(rng) * a;
+    return (DP_Pixel15){
+        DP_channel_float_to_15(DP_double_to_float(b)),
+        DP_channel_float_to_15(DP_double_to_float(g)),
+        DP_channel_float_to_15(DP_double_to_float(r)),
+        DP_channel_float_to_15(DP_double_to_float(a)),
+    };
+}
+
+static DP_TransientLayerContent *generate_layer_content(RngDouble *rng,
+                                                        int width, int height)
+{
+    DP_TransientLayerContent *tlc =
+        DP_transient_layer_content_new_init(width, height, NULL);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            DP_transient_layer_content_pixel_at_set(tlc, 0, x, y,
+                                                    bench_random_pixel(rng));
+        }
+    }
+
+    return tlc;
+}
+
+DP_CanvasState *bench_generate_canvas(RngDouble *rng, int width, int height,
+                                      int blend_mode)
+{
+    DP_TransientLayerList *tll;
+    DP_TransientLayerPropsList *tlpl;
+    DP_TransientCanvasState *tcs =
+        bench_canvas_new(width, height, 2, &tll, &tlpl);
+    int blend_modes[] = {DP_BLEND_MODE_NORMAL, blend_mode};
+    for (int i = 0; i < 2; ++i) {
+        DP_transient_layer_list_set_transient_content_noinc(
+            tll, generate_layer_content(rng, width, height), i);
+    }
+    for (int i = 0; i < 2; ++i) {
+        uint16_t opacity =
+            DP_channel_float_to_15(DP_double_to_float(bench_random(rng)));
+        DP_transient_layer_props_list_set_transient_noinc(
+            tlpl, bench_layer_props_new(i + 1, blend_modes[i], opacity), i);
+    }
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+
+void bench_render_state_init(BenchRenderState *brs, bool wait_for_tiles)
+{
+    brs->unlock_sem = DP_semaphore_new(0);
+    brs->tile_sem_or_null = wait_for_tiles ? DP_semaphore_new(0) : NULL;
+    DP_atomic_set(&brs->tiles, 0);
+    brs->width = 0;
+    brs->height = 0;
+}
+
+void bench_render_state_dispose(BenchRenderState *brs)
+{
+    if (brs->tile_sem_or_null) {
+        DP_semaphore_free(brs->tile_sem_or_null);
+    }
+    DP_semaphore_free(brs->unlock_sem);
+}
+
+void bench_on_renderer_tile(void *user, DP_UNUSED int x, DP_UNUSED int y,
+                            DP_UNUSED DP_Pixel8 *pixels, DP_UNUSED DP_Rect rect)
+{
+    BenchRenderState *brs = user;
+    // Tiles get delivered from multiple render threads at once.
+    DP_atomic_inc(&brs->tiles);
+    if (brs->tile_sem_or_null) {
+        DP_SEMAPHORE_MUST_POST(brs->tile_sem_or_null);
+    }
+}
+
+void bench_on_renderer_unlock(void *user)
+{
+    BenchRenderState *brs = user;
+    DP_SEMAPHORE_MUST_POST(brs->unlock_sem);
+}
+
+void bench_on_renderer_resize(void *user, int width, int height,
+                              DP_UNUSED int prev_width,
+                              DP_UNUSED int prev_height,
+                              DP_UNUSED int offset_x, DP_UNUSED int offset_y)
+{
+    BenchRenderState *brs = user;
+    brs->width = width;
+    brs->height = height;
+}
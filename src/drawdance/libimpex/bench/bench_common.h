@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPIMPEX_BENCH_COMMON_H
+#define DPIMPEX_BENCH_COMMON_H
+#include <dpcommon/atomic.h>
+#include <dpcommon/common.h>
+#include <dpcommon/geom.h>
+#include <dpengine/pixels.h>
+#include <rng-double.h>
+
+typedef struct DP_CanvasState DP_CanvasState;
+typedef struct DP_Semaphore DP_Semaphore;
+
+#ifdef DP_NO_STRICT_ALIASING
+typedef struct DP_TransientCanvasState DP_TransientCanvasState;
+typedef struct DP_TransientLayerList DP_TransientLayerList;
+typedef struct DP_TransientLayerProps DP_TransientLayerProps;
+typedef struct DP_TransientLayerPropsList DP_TransientLayerPropsList;
+#else
+typedef struct DP_CanvasState DP_TransientCanvasState;
+typedef struct DP_LayerList DP_TransientLayerList;
+typedef struct DP_LayerProps DP_TransientLayerProps;
+typedef struct DP_LayerPropsList DP_TransientLayerPropsList;
+#endif
+
+
+// Helpers shared between the benchmarks, so that they measure and generate
+// things the same way.
+
+// Program name for usage messages.
+const char *bench_name(int argc, char **argv, const char *fallback);
+
+// Argument parsing, these print an error and return false if the value is out
+// of bounds. Dimensions must fit on a canvas.
+bool bench_parse_dimensions(const char *width_arg, const char *height_arg,
+                            int *out_width, int *out_height);
+
+bool bench_parse_positive(const char *arg, const char *what, int *out_value);
+
+
+// Peak resident set size of the process in KiB, or -1 if we don't know how to
+// get it on this platform.
+long long bench_peak_memory_kib(void);
+
+// User plus system CPU time used by the process in microseconds, or -1 if we
+// don't know how to get it on this platform.
+long long bench_cpu_time_us(void);
+
+// Random number in [0, 1).
+double bench_random(RngDouble *rng);
+
+// Random premultiplied pixel with a random opacity.
+DP_Pixel15 bench_random_pixel(RngDouble *rng);
+
+// A canvas of the given size with room for the given number of root layers,
+// which the caller has to fill in before persisting it.
+DP_TransientCanvasState *
+bench_canvas_new(int width, int height, int layer_count,
+                 DP_TransientLayerList **out_tll,
+                 DP_TransientLayerPropsList **out_tlpl);
+
+DP_TransientLayerProps *bench_layer_props_new(int layer_id, int blend_mode,
+                                              uint16_t opacity);
+
+// Generates a canvas with two layers of random pixels, both with a random
+// opacity. The bottom one uses normal blending, the top one the given mode.
+DP_CanvasState *bench_generate_canvas(RngDouble *rng, int width, int height,
+                                      int blend_mode);
+
+
+
+// Renderer callbacks that let the benchmark wait for the renderer. The unlock
+// semaphore is posted when the renderer is done with the canvas, the tile
+// semaphore for every tile delivered, unless tiles are only counted.
+typedef struct BenchRenderState {
+    DP_Semaphore *unlock_sem;
+    DP_Semaphore *tile_sem_or_null;
+    DP_Atomic tiles;
+    int width;
+    int height;
+} BenchRenderState;
+
+void bench_render_state_init(BenchRenderState *brs, bool wait_for_tiles);
+
+void bench_render_state_dispose(BenchRenderState *brs);
+
+void bench_on_renderer_tile(void *user, int x, int y, DP_Pixel8 *pixels,
+                            DP_Rect rect);
+
+void bench_on_renderer_unlock(void *user);
+
+void bench_on_renderer_resize(void *user, int width, int height,
+                              int prev_width, int prev_height, int offset_x,
+                              int offset_y);
+
+
+#endif
@@ -1,18 +1,15 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+#include "bench_common.h"
+#include "bench_results.h"
 #include <dpcommon/common.h>
-#include <dpcommon/conversions.h>
 #include <dpcommon/cpu.h>
 #include <dpcommon/output.h>
+#include <dpcommon/perf.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/image.h>
 #include <dpengine/layer_content.h>
-#include <dpengine/layer_list.h>
-#include <dpengine/layer_props.h>
-#include <dpengine/layer_props_list.h>
 #include <dpimpex/image_impex.h>
 #include <dpmsg/blend_mode.h>
-#include <math.h>
-#include <rng-double.h>
 #include <stdio.h>
 
 static bool parse_args(int argc, char **argv, int *out_width, int *out_height,
@@ -26,29 +23,30 @@ static bool parse_args(int argc, char **argv, int *out_width, int *out_height,
         return false;
     }
 
-    int width = atoi(argv[1]);
-    if (!DP_canvas_state_in_max_dimension_bound(width)) {
-        fputs("Width out of bounds\n", stderr);
+    int width, height, iterations;
+    if (!bench_parse_dimensions(argv[1], argv[2], &width, &height)
+        || !bench_parse_positive(argv[3], "Iterations", &iterations)) {
         return false;
     }
 
-    int height = atoi(argv[2]);
-    if (!DP_canvas_state_in_max_dimension_bound(height)) {
-        fputs("Height out of bounds\n", stderr);
-        return false;
-    }
+    long seed = atol(argv[4]);
 
-    if (!DP_canvas_state_in_max_pixels_bound(width, height)) {
-        fputs("Dimensions out of bounds\n", stderr);
-        return false;
+    // Passing "all" benchmarks every blend mode usable on layers in turn.
+    int mode;
+    if (DP_str_equal(argv[5], "all")) {
+        mode = -1;
+    }
+    else {
+        mode = (int)DP_blend_mode_by_ora_name(argv[5], DP_BLEND_MODE_COUNT);
+        if (mode == DP_BLEND_MODE_COUNT) {
+            fprintf(stderr, "Unknown blend mode '%s'\n", argv[5]);
+            return false;
+        }
     }
 
-    int iterations = atoi(argv[3]);
-    long seed = atol(argv[4]);
-
-    DP_BlendMode mode = DP_blend_mode_by_ora_name(argv[5], DP_BLEND_MODE_COUNT);
-    if (mode == DP_BLEND_MODE_COUNT) {
-        fprintf(stderr, "Unknown blend mode '%s'\n", argv[5]);
+    if (mode < 0 && argc > min_args) {
+        fputs("Can't write an image when benchmarking all blend modes\n",
+              stderr);
         return false;
     }
 
@@ -56,78 +54,40 @@ static bool parse_args(int argc, char **argv, int *out_width, int *out_height,
     *out_height = height;
     *out_iterations = iterations;
     *out_seed = seed;
-    *out_mode = (int)mode;
+    *out_mode = mode;
     *out_path = argc < 7 ? NULL : argv[6];
     return true;
 }
 
-static double get_random(RngDouble *rng)
+static unsigned long long bench(DP_CanvasState *cs, int iterations)
 {
-    return fabs(fmod(rng_double_next(rng), 1.0));
-}
-
-static DP_TransientLayerProps *
-generate_layer_props(int layer_id, int blend_mode, uint16_t opacity)
-{
-    DP_TransientLayerProps *tlp =
-        DP_transient_layer_props_new_init(layer_id, false);
-    DP_transient_layer_props_blend_mode_set(tlp, blend_mode);
-    DP_transient_layer_props_opacity_set(tlp, opacity);
-    return tlp;
-}
-
-static DP_TransientLayerContent *generate_layer_content(RngDouble *rng,
-                                                        int width, int height)
-{
-    DP_TransientLayerContent *tlc =
-        DP_transient_layer_content_new_init(width, height, NULL);
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            double a = get_random(rng);
-            DP_Pixel15 pixel = {
-                DP_channel_float_to_15(DP_double_to_float(get_random(rng) * a)),
-                DP_channel_float_to_15(DP_double_to_float(get_random(rng) * a)),
-                DP_channel_float_to_15(DP_double_to_float(get_random(rng) * a)),
-                DP_channel_float_to_15(DP_double_to_float(a)),
-            };
-            DP_transient_layer_content_pixel_at_set(tlc, 0, x, y, pixel);
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_TransientLayerContent *tlc =
+            DP_canvas_state_to_flat_layer(cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL);
+        if (tlc) {
+            DP_transient_layer_content_decref(tlc);
         }
     }
-
-    return tlc;
+    return DP_perf_time() - start;
 }
 
-static DP_CanvasState *generate_canvas(RngDouble *rng, int width, int height,
-                                       int mode)
+static void bench_all(int width, int height, int iterations, long seed)
 {
-    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
-    DP_transient_canvas_state_width_set(tcs, width);
-    DP_transient_canvas_state_height_set(tcs, height);
-
-    DP_TransientLayerList *tll =
-        DP_transient_canvas_state_transient_layers(tcs, 2);
-    DP_transient_layer_list_set_transient_content_noinc(
-        tll, generate_layer_content(rng, width, height), 0);
-    DP_transient_layer_list_set_transient_content_noinc(
-        tll, generate_layer_content(rng, width, height), 1);
-
-    DP_TransientLayerPropsList *tlpl =
-        DP_transient_canvas_state_transient_layer_props(tcs, 2);
-    DP_transient_layer_props_list_set_transient_noinc(
-        tlpl,
-        generate_layer_props(
-            1, DP_BLEND_MODE_NORMAL,
-            DP_channel_float_to_15(DP_double_to_float(get_random(rng)))),
-        0);
-    DP_transient_layer_props_list_set_transient_noinc(
-        tlpl,
-        generate_layer_props(
-            2, mode,
-            DP_channel_float_to_15(DP_double_to_float(get_random(rng)))),
-        1);
-
-    return DP_transient_canvas_state_persist(tcs);
+    for (int mode = 0; mode < DP_BLEND_MODE_COUNT; ++mode) {
+        if (DP_blend_mode_valid_for_layer(mode)) {
+            // Same seed for every mode, so they all blend the same pixels.
+            RngDouble *rng = rng_double_new(seed);
+            DP_CanvasState *cs =
+                bench_generate_canvas(rng, width, height, mode);
+            rng_double_free(rng);
+            unsigned long long ns = bench(cs, iterations);
+            printf("%s,%llu\n", DP_blend_mode_enum_name(mode), ns);
+            bench_result(BENCH_LOWER_IS_BETTER, "ns", (double)ns, "%s",
+                         DP_blend_mode_enum_name(mode));
+            DP_canvas_state_decref(cs);
+        }
+    }
 }
 
 int main(int argc, char **argv)
@@ -141,21 +101,29 @@ int main(int argc, char **argv)
     if (!parse_args(argc, argv, &width, &height, &iterations, &seed, &mode,
                     &path)) {
         fprintf(stderr,
-                "Usage: %s WIDTH HEIGHT ITERATIONS SEED MODE [PATH_TO_PNG]\n",
-                argc > 0 && argv[0] ? argv[0] : "bench_flatten");
+                "Usage: %s WIDTH HEIGHT ITERATIONS SEED MODE|all "
+                "[PATH_TO_PNG]\n",
+                bench_name(argc, argv, "bench_flatten"));
         return 2;
     }
 
+    bench_results_init("bench_flatten", argc, argv);
+    if (mode < 0) {
+        bench_all(width, height, iterations, seed);
+        return bench_results_finish() ? 0 : 1;
+    }
+
     RngDouble *rng = rng_double_new(seed);
-    DP_CanvasState *cs = generate_canvas(rng, width, height, mode);
+    DP_CanvasState *cs = bench_generate_canvas(rng, width, height, mode);
     rng_double_free(rng);
 
-    for (int i = 0; i < iterations; ++i) {
-        DP_TransientLayerContent *tlc =
-            DP_canvas_state_to_flat_layer(cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL);
-        if (tlc) {
-            DP_transient_layer_content_decref(tlc);
-        }
+    unsigned long long ns = bench(cs, iterations);
+    printf("%llu\n", ns);
+    bench_result(BENCH_LOWER_IS_BETTER, "ns", (double)ns, "%s",
+                 DP_blend_mode_enum_name(mode));
+    if (!bench_results_finish()) {
+        DP_canvas_state_decref(cs);
+        return 1;
     }
 
     if (path) {
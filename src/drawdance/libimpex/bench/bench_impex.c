@@ -0,0 +1,434 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Measures loading and saving documents in the supported formats. Each input
+// is loaded single- and multi-threaded, then saved in each requested format and
+// the result loaded back in again, if it's a format that can be loaded. Prints
+// a CSV row with the wall time, CPU time, peak memory use and file size of each
+// operation, averaged over the given number of iterations.
+//
+// Peak memory use is the high water mark of the whole process, so the values
+// only grow over the course of a run. To measure a single format in isolation,
+// run the benchmark with one input and one format at a time.
+//
+// An input of the form gen:WIDTHxHEIGHT:SEED isn't loaded from a file, but
+// generated the same way bench_flatten does it, so saving can be measured
+// without having to supply documents.
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/input.h>
+#include <dpcommon/perf.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpimpex/image_impex.h>
+#include <dpimpex/load.h>
+#include <dpimpex/save.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/messages.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef DP_LIBAV
+#    include <dpimpex/save_video.h>
+#endif
+
+
+typedef enum BenchSaveKind {
+    BENCH_SAVE_IMAGE,
+    BENCH_SAVE_FRAMES,
+    BENCH_SAVE_ZIP,
+    BENCH_SAVE_VIDEO,
+    BENCH_SAVE_GIF,
+} BenchSaveKind;
+
+typedef struct BenchFormat {
+    const char *name;
+    const char *extension;
+    BenchSaveKind kind;
+    DP_SaveImageType type;
+    int video_format;
+    bool reload;
+} BenchFormat;
+
+typedef struct BenchMeasurement {
+    unsigned long long wall_ns;
+    long long cpu_us;
+} BenchMeasurement;
+
+static const BenchFormat formats[] = {
+    {"ora", "ora", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_ORA, 0, true},
+    {"psd", "psd", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_PSD, 0, true},
+    {"dpcs", "dpcs", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_PROJECT_CANVAS, 0, true},
+    {"png", "png", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_PNG, 0, true},
+    {"jpeg", "jpg", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_JPEG, 0, true},
+    {"webp", "webp", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_WEBP, 0, true},
+    {"qoi", "qoi", BENCH_SAVE_IMAGE, DP_SAVE_IMAGE_QOI, 0, true},
+    {"frames", NULL, BENCH_SAVE_FRAMES, DP_SAVE_IMAGE_UNKNOWN, 0, false},
+    {"zip", "zip", BENCH_SAVE_ZIP, DP_SAVE_IMAGE_UNKNOWN, 0, false},
+#ifdef DP_LIBAV
+    {"mp4", "mp4", BENCH_SAVE_VIDEO, DP_SAVE_IMAGE_UNKNOWN,
+     DP_SAVE_VIDEO_FORMAT_MP4_VP9, false},
+    {"webm", "webm", BENCH_SAVE_VIDEO, DP_SAVE_IMAGE_UNKNOWN,
+     DP_SAVE_VIDEO_FORMAT_WEBM_VP8, false},
+    {"animwebp", "webp", BENCH_SAVE_VIDEO, DP_SAVE_IMAGE_UNKNOWN,
+     DP_SAVE_VIDEO_FORMAT_WEBP, false},
+    {"gif", "gif", BENCH_SAVE_GIF, DP_SAVE_IMAGE_UNKNOWN, 0, false},
+#endif
+};
+
+
+// Returns -1 if the file doesn't exist or can't be read.
+static long long file_size(const char *path)
+{
+    DP_Input *input = DP_file_input_new_from_path(path);
+    if (!input) {
+        return -1;
+    }
+    bool error;
+    size_t length = DP_input_length(input, &error);
+    DP_input_free(input);
+    return error ? -1 : (long long)length;
+}
+
+static long long frames_size(const char *output_dir, int frame_count)
+{
+    long long total = 0;
+    for (int i = 1; i <= frame_count; ++i) {
+        char *path = DP_format("%s/frame-%03d.png", output_dir, i);
+        long long size = file_size(path);
+        DP_free(path);
+        if (size > 0) {
+            total += size;
+        }
+    }
+    return total;
+}
+
+static BenchMeasurement measure_begin(void)
+{
+    return (BenchMeasurement){DP_perf_time(), bench_cpu_time_us()};
+}
+
+static void measure_end(BenchMeasurement *m, BenchMeasurement start)
+{
+    long long cpu_us = bench_cpu_time_us();
+    m->wall_ns += DP_perf_time() - start.wall_ns;
+    if (m->cpu_us >= 0 && cpu_us >= 0 && start.cpu_us >= 0) {
+        m->cpu_us += cpu_us - start.cpu_us;
+    }
+    else {
+        m->cpu_us = -1;
+    }
+}
+
+// Result names shouldn't depend on where the input files are, so only the file
+// name is used for them.
+static const char *file_name(const char *path)
+{
+    const char *name = path;
+    for (const char *c = path; *c; ++c) {
+        if (*c == '/' || *c == '\\') {
+            name = c + 1;
+        }
+    }
+    return name;
+}
+
+static void print_row(const char *input, const char *operation,
+                      const char *format, const char *threads, int iterations,
+                      BenchMeasurement m, long long bytes)
+{
+    double wall_ms = (double)m.wall_ns / 1000000.0 / (double)iterations;
+    printf("\"%s\",%s,%s,%s,%.3f,", input, operation, format, threads,
+           wall_ms);
+    if (m.cpu_us < 0) {
+        printf("-1,");
+    }
+    else {
+        printf("%.3f,", (double)m.cpu_us / 1000.0 / (double)iterations);
+    }
+    printf("%lld,%lld\n", bench_peak_memory_kib(), bytes);
+    fflush(stdout);
+    bench_result(BENCH_LOWER_IS_BETTER, "ms", wall_ms, "%s_%s_%s_%s",
+                 file_name(input), operation, format, threads);
+    // Loads just report the size of what they read, that's the save's result.
+    if (bytes >= 0 && DP_str_equal(operation, "save")) {
+        bench_result(BENCH_LOWER_IS_BETTER, "bytes", (double)bytes,
+                     "%s_%s_%s_%s_bytes", file_name(input), operation, format,
+                     threads);
+    }
+}
+
+
+static DP_CanvasState *load(DP_DrawContext *dc, const char *path,
+                            unsigned int flags)
+{
+    DP_LoadResult result;
+    DP_CanvasState *cs =
+        DP_load(dc, path, "Layer 1", flags, NULL, NULL, &result, NULL);
+    if (!cs) {
+        fprintf(stderr, "Error loading '%s' (%d): %s\n", path, (int)result,
+                DP_error());
+    }
+    return cs;
+}
+
+// Loads the file single- and multi-threaded, returns the last loaded canvas
+// state if the caller wants it.
+static bool bench_load(DP_DrawContext *dc, const char *input, const char *path,
+                       const char *format, int iterations,
+                       DP_CanvasState **out_cs_or_null)
+{
+    long long bytes = file_size(path);
+    DP_CanvasState *cs = NULL;
+    for (int single = 1; single >= 0; --single) {
+        unsigned int flags =
+            single ? DP_LOAD_FLAG_SINGLE_THREAD : DP_LOAD_FLAG_NONE;
+        BenchMeasurement m = {0, 0};
+        for (int i = 0; i < iterations; ++i) {
+            DP_canvas_state_decref_nullable(cs);
+            BenchMeasurement start = measure_begin();
+            cs = load(dc, path, flags);
+            measure_end(&m, start);
+            if (!cs) {
+                return false;
+            }
+        }
+        print_row(input, "load", format, single ? "single" : "multi",
+                  iterations, m, bytes);
+    }
+
+    if (out_cs_or_null) {
+        *out_cs_or_null = cs;
+    }
+    else {
+        DP_canvas_state_decref(cs);
+    }
+    return true;
+}
+
+static bool parse_generated_input(const char *input, int *out_width,
+                                  int *out_height, long *out_seed)
+{
+    char end;
+    int matched = sscanf(input, "gen:%dx%d:%ld%c", out_width, out_height,
+                         out_seed, &end);
+    return matched == 3;
+}
+
+// Generated inputs don't have anything to load, so they only get saved.
+static bool bench_input(DP_DrawContext *dc, const char *input, int iterations,
+                        DP_CanvasState **out_cs)
+{
+    int width, height;
+    long seed;
+    if (parse_generated_input(input, &width, &height, &seed)) {
+        if (!DP_canvas_state_in_max_dimension_bound(width)
+            || !DP_canvas_state_in_max_dimension_bound(height)
+            || !DP_canvas_state_in_max_pixels_bound(width, height)) {
+            fprintf(stderr, "Dimensions of '%s' out of bounds\n", input);
+            return false;
+        }
+        RngDouble *rng = rng_double_new(seed);
+        *out_cs =
+            bench_generate_canvas(rng, width, height, DP_BLEND_MODE_NORMAL);
+        rng_double_free(rng);
+        return true;
+    }
+    else {
+        return bench_load(dc, input, input, "input", iterations, out_cs);
+    }
+}
+
+static DP_SaveResult save(DP_CanvasState *cs, DP_DrawContext *dc,
+                          const BenchFormat *format, const char *path)
+{
+    int width = DP_canvas_state_width(cs);
+    int height = DP_canvas_state_height(cs);
+    switch (format->kind) {
+    case BENCH_SAVE_IMAGE:
+        return DP_save(cs, dc, format->type, path, NULL, NULL, NULL);
+    case BENCH_SAVE_FRAMES:
+        return DP_save_animation_frames(
+            cs, dc, path, NULL, width, height,
+            DP_MSG_TRANSFORM_REGION_MODE_BILINEAR, -1, -1, NULL, NULL);
+    case BENCH_SAVE_ZIP:
+        return DP_save_animation_zip(cs, dc, path, NULL, width, height,
+                                     DP_MSG_TRANSFORM_REGION_MODE_BILINEAR, -1,
+                                     -1, NULL, NULL);
+#ifdef DP_LIBAV
+    case BENCH_SAVE_VIDEO:
+        if (!DP_save_video_format_supported(format->video_format)) {
+            DP_error_set("Video format not supported");
+            return DP_SAVE_RESULT_UNKNOWN_FORMAT;
+        }
+        return DP_save_animation_video((DP_SaveVideoParams){
+            cs,
+            NULL,
+            DP_SAVE_VIDEO_DESTINATION_PATH,
+            (void *)path,
+            NULL,
+            0,
+            DP_SAVE_VIDEO_FLAGS_SCALE_SMOOTH,
+            format->video_format,
+            width,
+            height,
+            -1,
+            -1,
+            -1,
+            1,
+            NULL,
+            NULL,
+        });
+    case BENCH_SAVE_GIF:
+        return DP_save_animation_video_gif((DP_SaveGifParams){
+            cs,
+            NULL,
+            DP_SAVE_VIDEO_DESTINATION_PATH,
+            (void *)path,
+            DP_SAVE_VIDEO_FLAGS_SCALE_SMOOTH,
+            width,
+            height,
+            -1,
+            -1,
+            -1,
+            NULL,
+            NULL,
+        });
+#else
+    case BENCH_SAVE_VIDEO:
+    case BENCH_SAVE_GIF:
+        break;
+#endif
+    }
+    DP_error_set("Unsupported save kind %d", (int)format->kind);
+    return DP_SAVE_RESULT_UNKNOWN_FORMAT;
+}
+
+static bool bench_save(DP_CanvasState *cs, DP_DrawContext *dc,
+                       const char *input, const char *output_dir,
+                       const BenchFormat *format, int iterations)
+{
+    char *path = format->extension
+                   ? DP_format("%s/bench_impex.%s", output_dir,
+                               format->extension)
+                   : DP_strdup(output_dir);
+
+    BenchMeasurement m = {0, 0};
+    for (int i = 0; i < iterations; ++i) {
+        BenchMeasurement start = measure_begin();
+        DP_SaveResult result = save(cs, dc, format, path);
+        measure_end(&m, start);
+        if (result != DP_SAVE_RESULT_SUCCESS) {
+            fprintf(stderr, "Error saving %s to '%s' (%d): %s\n", format->name,
+                    path, (int)result, DP_error());
+            DP_free(path);
+            return false;
+        }
+    }
+
+    long long bytes =
+        format->kind == BENCH_SAVE_FRAMES
+            ? frames_size(path, DP_canvas_state_frame_count(cs))
+            : file_size(path);
+    // Saving always uses as many threads as the format implementation wants.
+    print_row(input, "save", format->name, "auto", iterations, m, bytes);
+
+    bool ok = !format->reload
+           || bench_load(dc, input, path, format->name, iterations, NULL);
+    DP_free(path);
+    return ok;
+}
+
+
+static const BenchFormat *search_format(const char *name)
+{
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(formats); ++i) {
+        if (DP_str_equal(formats[i].name, name)) {
+            return &formats[i];
+        }
+    }
+    return NULL;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s OUTPUT_DIR ITERATIONS INPUT... [-- FORMAT...]\n"
+            "INPUT is a path or gen:WIDTHxHEIGHT:SEED\n"
+            "Formats:",
+            name);
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(formats); ++i) {
+        fprintf(stderr, " %s", formats[i].name);
+    }
+    fputs("\n", stderr);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+    DP_image_impex_init();
+
+    const char *name = bench_name(argc, argv, "bench_impex");
+    if (argc < 4) {
+        return usage(name);
+    }
+
+    const char *output_dir = argv[1];
+    int iterations;
+    if (!bench_parse_positive(argv[2], "Iterations", &iterations)) {
+        return usage(name);
+    }
+
+    int inputs_end = 3;
+    while (inputs_end < argc && !DP_str_equal(argv[inputs_end], "--")) {
+        ++inputs_end;
+    }
+    if (inputs_end == 3) {
+        return usage(name);
+    }
+
+    const BenchFormat *selected[DP_ARRAY_LENGTH(formats)];
+    size_t selected_count = 0;
+    if (inputs_end < argc) {
+        for (int i = inputs_end + 1; i < argc; ++i) {
+            const BenchFormat *format = search_format(argv[i]);
+            if (!format || selected_count == DP_ARRAY_LENGTH(selected)) {
+                fprintf(stderr, "Unknown format '%s'\n", argv[i]);
+                return usage(name);
+            }
+            selected[selected_count++] = format;
+        }
+    }
+    else {
+        for (size_t i = 0; i < DP_ARRAY_LENGTH(formats); ++i) {
+            selected[selected_count++] = &formats[i];
+        }
+    }
+
+    bench_results_init("bench_impex", argc, argv);
+    DP_DrawContext *dc = DP_draw_context_new();
+    bool ok = true;
+    printf("input,operation,format,threads,wall_ms,cpu_ms,peak_rss_kib,"
+           "bytes\n");
+    for (int i = 3; i < inputs_end; ++i) {
+        const char *input = argv[i];
+        DP_CanvasState *cs;
+        if (!bench_input(dc, input, iterations, &cs)) {
+            ok = false;
+            continue;
+        }
+
+        for (size_t j = 0; j < selected_count; ++j) {
+            if (!bench_save(cs, dc, input, output_dir, selected[j],
+                            iterations)) {
+                ok = false;
+            }
+        }
+        DP_canvas_state_decref(cs);
+    }
+    DP_draw_context_free(dc);
+
+    return bench_results_finish() && ok ? 0 : 1;
+}
@@ -74,7 +74,7 @@ bench_classic() {
 }
 
 bench_mypaint() {
-    printf 'Indirect,Normal,Lock Alpha,Colorize,Posterize,N+LA,N+LA+C,N+LA+C+P\n'
+    printf 'Indirect,Normal,Lock Alpha,Colorize,Posterize,N+LA,N+LA+C,N+LA+C+P,Elliptical\n'
     for ((size = 0 ; size <= "$max_size" ; size++)); do
         echo "bench mypaint $size/$max_size" 1>&2
         ((smooth_size = size * 257))
@@ -93,6 +93,8 @@ bench_mypaint() {
         run_bench mypaint "$total_dabs" "$dabs_per_message" 255 "$smooth_size" 255 127 0 0 85 85 0 0
         printf ','
         run_bench mypaint "$total_dabs" "$dabs_per_message" 255 "$smooth_size" 255 127 0 0 64 64 64 127
+        printf ','
+        run_bench mypaint "$total_dabs" "$dabs_per_message" 255 "$smooth_size" 255 127 64 128 0 0 0 0
         printf '\n'
     done
 }
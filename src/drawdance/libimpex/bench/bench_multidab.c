@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+#include "bench_results.h"
 #include "limits.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
@@ -491,6 +492,8 @@ static void bench(int count, DP_Message **msgs, const char *save_path)
     DP_canvas_state_decref(cs);
     DP_draw_context_free(dc);
     printf("%llu\n", end - start);
+    bench_result(BENCH_LOWER_IS_BETTER, "ns", (double)(end - start),
+                 "multidab");
 }
 
 static void run(const struct Args *args)
@@ -550,7 +553,11 @@ int main(int argc, char **argv)
             dump_blend_modes();
         }
         else {
+            bench_results_init("bench_multidab", argc, argv);
             run(&args);
+            if (!bench_results_finish()) {
+                return 1;
+            }
         }
         return 0;
     }
@@ -0,0 +1,427 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Drives a renderer the way the canvas view does: the whole canvas changes,
+// tiles in view get rendered first, the rest after. Reports the time until the
+// tiles in view are done, the time until everything is done and the resulting
+// throughput, for each render thread count from 1 up to the given maximum.
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
+#include <dpengine/canvas_diff.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_group.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/local_state.h>
+#include <dpengine/renderer.h>
+#include <dpengine/tile.h>
+#include <dpengine/view_mode.h>
+#include <dpimpex/image_impex.h>
+#include <dpimpex/load.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Chance for a generated tile to be left blank, most layers don't cover the
+// entire canvas.
+#define BLANK_TILE_CHANCE 0.25
+
+typedef struct BenchArgs {
+    const char *path; // Load this file if given, otherwise generate a canvas.
+    int width;
+    int height;
+    int layers;
+    int group_size;
+    bool mixed_blend_modes;
+    long seed;
+    int view_width;
+    int view_height;
+    int iterations;
+    int max_threads;
+    DP_ViewMode view_mode;
+    bool onion_skins;
+} BenchArgs;
+
+
+static bool parse_view_mode(const char *s, DP_ViewMode *out_view_mode,
+                            bool *out_onion_skins)
+{
+    *out_onion_skins = false;
+    if (DP_str_equal(s, "normal")) {
+        *out_view_mode = DP_VIEW_MODE_NORMAL;
+    }
+    else if (DP_str_equal(s, "layer")) {
+        *out_view_mode = DP_VIEW_MODE_LAYER;
+    }
+    else if (DP_str_equal(s, "group")) {
+        *out_view_mode = DP_VIEW_MODE_GROUP;
+    }
+    else if (DP_str_equal(s, "frame")) {
+        *out_view_mode = DP_VIEW_MODE_FRAME;
+    }
+    else if (DP_str_equal(s, "onion")) {
+        *out_view_mode = DP_VIEW_MODE_FRAME;
+        *out_onion_skins = true;
+    }
+    else {
+        fprintf(stderr, "Unknown view mode '%s'\n", s);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_view_args(char **argv, BenchArgs *args)
+{
+    return bench_parse_positive(argv[0], "View width", &args->view_width)
+        && bench_parse_positive(argv[1], "View height", &args->view_height)
+        && bench_parse_positive(argv[2], "Iterations", &args->iterations)
+        && bench_parse_positive(argv[3], "Thread count", &args->max_threads)
+        && parse_view_mode(argv[4], &args->view_mode, &args->onion_skins);
+}
+
+static bool parse_args(int argc, char **argv, BenchArgs *args)
+{
+    if (argc == 8 && DP_str_equal(argv[1], "load")) {
+        args->path = argv[2];
+        return parse_view_args(argv + 3, args);
+    }
+    else if (argc == 13 && DP_str_equal(argv[1], "gen")) {
+        args->path = NULL;
+        if (!bench_parse_dimensions(argv[2], argv[3], &args->width,
+                                    &args->height)
+            || !bench_parse_positive(argv[4], "Layer count", &args->layers)) {
+            return false;
+        }
+
+        args->group_size = atoi(argv[5]);
+        if (args->group_size < 0) {
+            fputs("Group size out of bounds\n", stderr);
+            return false;
+        }
+
+        if (DP_str_equal(argv[6], "mixed")) {
+            args->mixed_blend_modes = true;
+        }
+        else if (DP_str_equal(argv[6], "normal")) {
+            args->mixed_blend_modes = false;
+        }
+        else {
+            fprintf(stderr, "Unknown blend modes '%s'\n", argv[6]);
+            return false;
+        }
+
+        args->seed = atol(argv[7]);
+        return parse_view_args(argv + 8, args);
+    }
+    else {
+        return false;
+    }
+}
+
+
+static int get_random_blend_mode(RngDouble *rng, bool mixed)
+{
+    if (mixed) {
+        while (true) {
+            int mode = (int)(bench_random(rng) * DP_BLEND_MODE_COUNT);
+            if (DP_blend_mode_valid_for_layer(mode)) {
+                return mode;
+            }
+        }
+    }
+    else {
+        return DP_BLEND_MODE_NORMAL;
+    }
+}
+
+static uint16_t get_random_opacity(RngDouble *rng)
+{
+    double opacity = 0.5 + bench_random(rng) * 0.5;
+    return DP_channel_float_to_15(DP_double_to_float(opacity));
+}
+
+static DP_TransientLayerContent *generate_layer_content(RngDouble *rng,
+                                                        int width, int height)
+{
+    DP_TransientLayerContent *tlc =
+        DP_transient_layer_content_new_init(width, height, NULL);
+    int tile_count =
+        DP_tile_count_round(width) * DP_tile_count_round(height);
+    for (int i = 0; i < tile_count; ++i) {
+        if (bench_random(rng) >= BLANK_TILE_CHANCE) {
+            uint32_t bgra = (uint32_t)(bench_random(rng) * (double)UINT32_MAX);
+            DP_transient_layer_content_tile_set_noinc(
+                tlc, DP_tile_new_from_bgra(0, bgra), i);
+        }
+    }
+    return tlc;
+}
+
+static void generate_layer(RngDouble *rng, const BenchArgs *args,
+                           DP_TransientLayerPropsList *tlpl,
+                           DP_TransientLayerList *tll, int index,
+                           int layer_id)
+{
+    int blend_mode = get_random_blend_mode(rng, args->mixed_blend_modes);
+    uint16_t opacity = get_random_opacity(rng);
+    DP_transient_layer_props_list_set_transient_noinc(
+        tlpl, bench_layer_props_new(layer_id, blend_mode, opacity), index);
+    DP_transient_layer_list_set_transient_content_noinc(
+        tll, generate_layer_content(rng, args->width, args->height), index);
+}
+
+// Layers are put into groups of the given size, or all at the top level if
+// it's zero. Group ids come after all the layer ids.
+static DP_CanvasState *generate_canvas(const BenchArgs *args)
+{
+    RngDouble *rng = rng_double_new(args->seed);
+    int group_size = args->group_size;
+    int root_count = group_size == 0
+                       ? args->layers
+                       : (args->layers + group_size - 1) / group_size;
+    DP_TransientLayerList *tll;
+    DP_TransientLayerPropsList *tlpl;
+    DP_TransientCanvasState *tcs =
+        bench_canvas_new(args->width, args->height, root_count, &tll, &tlpl);
+
+    int layer_id = 1;
+    for (int i = 0; i < root_count; ++i) {
+        if (group_size == 0) {
+            generate_layer(rng, args, tlpl, tll, i, layer_id++);
+        }
+        else {
+            int child_count =
+                DP_min_int(group_size, args->layers - layer_id + 1);
+            DP_TransientLayerList *child_tll =
+                DP_transient_layer_list_new_init(child_count);
+            DP_TransientLayerPropsList *child_tlpl =
+                DP_transient_layer_props_list_new_init(child_count);
+            for (int j = 0; j < child_count; ++j) {
+                generate_layer(rng, args, child_tlpl, child_tll, j,
+                               layer_id++);
+            }
+
+            DP_TransientLayerProps *tlp =
+                DP_transient_layer_props_new_init_with_transient_children_noinc(
+                    args->layers + i + 1, child_tlpl);
+            DP_transient_layer_props_blend_mode_set(
+                tlp, get_random_blend_mode(rng, args->mixed_blend_modes));
+            DP_transient_layer_props_opacity_set(tlp, get_random_opacity(rng));
+            DP_transient_layer_props_list_set_transient_noinc(tlpl, tlp, i);
+            DP_transient_layer_list_set_transient_group_noinc(
+                tll,
+                DP_transient_layer_group_new_init_with_transient_children_noinc(
+                    args->width, args->height, child_tll),
+                i);
+        }
+    }
+
+    rng_double_free(rng);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+static DP_CanvasState *load_canvas(DP_DrawContext *dc, const char *path)
+{
+    DP_LoadResult result;
+    DP_CanvasState *cs =
+        DP_load(dc, path, "Layer 1", 0, NULL, NULL, &result, NULL);
+    if (!cs) {
+        fprintf(stderr, "Error loading '%s' (%d): %s\n", path, (int)result,
+                DP_error());
+    }
+    return cs;
+}
+
+
+// The topmost layer that isn't a group, so that the layer view mode shows
+// that layer and the group view mode shows the group it's in, if any.
+static int find_active_layer_id(DP_CanvasState *cs)
+{
+    DP_LayerPropsList *lpl = DP_canvas_state_layer_props_noinc(cs);
+    while (true) {
+        int count = DP_layer_props_list_count(lpl);
+        if (count == 0) {
+            return 0;
+        }
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, count - 1);
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            lpl = child_lpl;
+        }
+        else {
+            return DP_layer_props_id(lp);
+        }
+    }
+}
+
+static void handle_local_noinc(DP_LocalState *ls, DP_DrawContext *dc,
+                               DP_Message *msg)
+{
+    DP_local_state_handle(ls, dc, msg, true);
+    DP_message_decref(msg);
+}
+
+static void on_view_invalidated(DP_UNUSED void *user,
+                                DP_UNUSED bool check_all,
+                                DP_UNUSED int layer_id)
+{
+    // Nothing to do, the whole canvas gets rendered on every iteration.
+}
+
+static DP_LocalState *make_local_state(DP_DrawContext *dc, DP_CanvasState *cs,
+                                       const BenchArgs *args)
+{
+    DP_LocalState *ls = DP_local_state_new(cs, on_view_invalidated, NULL);
+    handle_local_noinc(
+        ls, dc, DP_local_state_msg_active_layer_new(find_active_layer_id(cs)));
+    handle_local_noinc(ls, dc, DP_local_state_msg_active_frame_new(0));
+    if (args->onion_skins) {
+        DP_OnionSkins *oss = DP_onion_skins_new(false, 2, 2);
+        DP_UPixel8 tint_below = {.b = 0, .g = 0, .r = 255, .a = 64};
+        DP_UPixel8 tint_above = {.b = 255, .g = 0, .r = 0, .a = 64};
+        for (int i = 0; i < 2; ++i) {
+            uint16_t opacity = (uint16_t)(DP_BIT15 / (i + 2));
+            DP_onion_skins_skin_below_at_set(oss, i, opacity, tint_below);
+            DP_onion_skins_skin_above_at_set(oss, i, opacity, tint_above);
+        }
+        handle_local_noinc(ls, dc, DP_local_state_msg_onion_skins_new(oss));
+        DP_onion_skins_free(oss);
+    }
+    handle_local_noinc(ls, dc,
+                       DP_local_state_msg_view_mode_new(args->view_mode));
+    return ls;
+}
+
+
+static void apply(DP_Renderer *renderer, DP_CanvasState *cs, DP_LocalState *ls,
+                  DP_CanvasDiff *diff, DP_Rect view_tile_bounds,
+                  DP_RendererMode mode)
+{
+    DP_Pixel8 checker_color1 = {0xff646464u};
+    DP_Pixel8 checker_color2 = {0xff878787u};
+    DP_renderer_apply(renderer, cs, ls, diff, true, checker_color1,
+                      checker_color2, DP_upixel15_zero(), view_tile_bounds,
+                      true, 0, mode);
+}
+
+static void bench(DP_CanvasState *cs, DP_LocalState *ls, int thread_count,
+                  const BenchArgs *args)
+{
+    BenchRenderState brs;
+    bench_render_state_init(&brs, true);
+    DP_Pixel8 checker_color1 = {0xff646464u};
+    DP_Pixel8 checker_color2 = {0xff878787u};
+    DP_Renderer *renderer = DP_renderer_new(
+        thread_count, true, checker_color1, checker_color2, DP_upixel15_zero(),
+        bench_on_renderer_tile, NULL, bench_on_renderer_unlock,
+        bench_on_renderer_resize, &brs);
+    DP_CanvasDiff *diff = DP_canvas_diff_new();
+
+    int width = DP_canvas_state_width(cs);
+    int height = DP_canvas_state_height(cs);
+    int xtiles = DP_tile_count_round(width);
+    int ytiles = DP_tile_count_round(height);
+    int tile_count = xtiles * ytiles;
+
+    // The view is centered on the canvas, like after opening it.
+    int view_x = DP_max_int(0, (width - args->view_width) / 2);
+    int view_y = DP_max_int(0, (height - args->view_height) / 2);
+    DP_Rect view_tile_bounds = {
+        view_x / DP_TILE_SIZE,
+        view_y / DP_TILE_SIZE,
+        DP_min_int(xtiles, (view_x + args->view_width - 1) / DP_TILE_SIZE),
+        DP_min_int(ytiles, (view_y + args->view_height - 1) / DP_TILE_SIZE),
+    };
+
+    // Get the initial resize and local state out of the way.
+    DP_canvas_diff_begin(diff, 0, 0, width, height, true);
+    apply(renderer, cs, ls, diff, DP_rect_make(0, 0, xtiles, ytiles),
+          DP_RENDERER_EVERYTHING);
+    DP_SEMAPHORE_MUST_WAIT(brs.unlock_sem);
+    DP_SEMAPHORE_MUST_WAIT_N(brs.tile_sem_or_null, tile_count);
+
+    unsigned long long view_ns = 0;
+    unsigned long long total_ns = 0;
+    for (int i = 0; i < args->iterations; ++i) {
+        DP_canvas_diff_begin(diff, width, height, width, height, false);
+        DP_canvas_diff_check_all(diff);
+        unsigned long long start = DP_perf_time();
+        apply(renderer, cs, ls, diff, view_tile_bounds,
+              DP_RENDERER_VIEW_BOUNDS_CHANGED);
+        DP_SEMAPHORE_MUST_WAIT(brs.unlock_sem);
+        unsigned long long view_end = DP_perf_time();
+        DP_SEMAPHORE_MUST_WAIT_N(brs.tile_sem_or_null, tile_count);
+        unsigned long long total_end = DP_perf_time();
+        view_ns += view_end - start;
+        total_ns += total_end - start;
+    }
+
+    DP_RendererStatistics stats = DP_renderer_statistics(renderer);
+    double iterations = (double)args->iterations;
+    double view_ms = DP_ullong_to_double(view_ns) / 1000000.0 / iterations;
+    double total_ms = DP_ullong_to_double(total_ns) / 1000000.0 / iterations;
+    printf("%d,%d,%.3f,%.3f,%.0f,%zu,%zu,%.3f\n", thread_count, tile_count,
+           view_ms, total_ms, (double)tile_count / total_ms * 1000.0,
+           stats.claims, stats.steals,
+           DP_ullong_to_double(stats.queue_wait_ns) / 1000000.0);
+    fflush(stdout);
+    bench_result(BENCH_LOWER_IS_BETTER, "ms", view_ms, "view_%d_threads",
+                 thread_count);
+    bench_result(BENCH_LOWER_IS_BETTER, "ms", total_ms, "total_%d_threads",
+                 thread_count);
+
+    DP_canvas_diff_free(diff);
+    DP_renderer_free(renderer);
+    bench_render_state_dispose(&brs);
+}
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+    DP_image_impex_init();
+
+    BenchArgs args;
+    if (!parse_args(argc, argv, &args)) {
+        const char *name = bench_name(argc, argv, "bench_render");
+        fprintf(stderr,
+                "Usage: %s gen WIDTH HEIGHT LAYERS GROUP_SIZE normal|mixed "
+                "SEED VIEW_WIDTH VIEW_HEIGHT ITERATIONS MAX_THREADS VIEW_MODE\n"
+                "       %s load PATH "
+                "VIEW_WIDTH VIEW_HEIGHT ITERATIONS MAX_THREADS VIEW_MODE\n"
+                "VIEW_MODE is one of normal, layer, group, frame or onion\n",
+                name, name);
+        return 2;
+    }
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs =
+        args.path ? load_canvas(dc, args.path) : generate_canvas(&args);
+    if (!cs) {
+        DP_draw_context_free(dc);
+        return 1;
+    }
+
+    bench_results_init("bench_render", argc, argv);
+    DP_LocalState *ls = make_local_state(dc, cs, &args);
+    printf("threads,tiles,view_ms,total_ms,tiles_per_second,claims,steals,"
+           "queue_wait_ms\n");
+    // Powers of two up to the maximum, then the maximum itself.
+    for (int thread_count = 1; thread_count < args.max_threads;
+         thread_count *= 2) {
+        bench(cs, ls, thread_count, &args);
+    }
+    bench(cs, ls, args.max_threads, &args);
+
+    DP_local_state_free(ls);
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+    return bench_results_finish() ? 0 : 1;
+}
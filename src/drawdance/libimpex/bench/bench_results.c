@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <parson.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_RESULTS_VERSION 1
+
+
+static JSON_Value *results_value;
+
+void bench_results_init(const char *benchmark, int argc, char **argv)
+{
+    DP_ASSERT(!results_value);
+    results_value = json_value_init_object();
+    JSON_Object *root = json_value_get_object(results_value);
+    json_object_set_number(root, "version", BENCH_RESULTS_VERSION);
+    json_object_set_string(root, "benchmark", benchmark);
+
+    JSON_Value *args_value = json_value_init_array();
+    JSON_Array *args = json_value_get_array(args_value);
+    for (int i = 1; i < argc; ++i) {
+        json_array_append_string(args, argv[i]);
+    }
+    json_object_set_value(root, "args", args_value);
+    json_object_set_value(root, "results", json_value_init_array());
+}
+
+void bench_result(BenchBetter better, const char *unit, double value,
+                  const char *name_fmt, ...)
+{
+    DP_ASSERT(results_value);
+    va_list ap;
+    va_start(ap, name_fmt);
+    char *name = DP_vformat(name_fmt, ap);
+    va_end(ap);
+
+    JSON_Value *result_value = json_value_init_object();
+    JSON_Object *result = json_value_get_object(result_value);
+    json_object_set_string(result, "name", name);
+    json_object_set_string(result, "unit", unit);
+    json_object_set_string(result, "better",
+                           better == BENCH_HIGHER_IS_BETTER ? "higher"
+                                                            : "lower");
+    json_object_set_number(result, "value", value);
+    DP_free(name);
+
+    json_array_append_value(
+        json_object_get_array(json_value_get_object(results_value), "results"),
+        result_value);
+}
+
+bool bench_results_finish(void)
+{
+    DP_ASSERT(results_value);
+    bool ok = true;
+    const char *path = getenv("DP_BENCH_JSON");
+    if (path && *path) {
+        if (json_serialize_to_file_pretty(results_value, path)
+            != JSONSuccess) {
+            fprintf(stderr, "Error writing results to '%s'\n", path);
+            ok = false;
+        }
+    }
+    json_value_free(results_value);
+    results_value = NULL;
+    return ok;
+}
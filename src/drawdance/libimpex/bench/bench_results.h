@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPIMPEX_BENCH_RESULTS_H
+#define DPIMPEX_BENCH_RESULTS_H
+#include <dpcommon/common.h>
+
+
+// Common machine-readable output for the benchmarks. They keep printing their
+// usual human-readable or CSV output and additionally report each measurement
+// here. If the DP_BENCH_JSON environment variable is set, the results get
+// written to the file it names when the benchmark finishes, which is what
+// run_benchmarks.py uses to compare against a stored baseline.
+
+typedef enum BenchBetter {
+    BENCH_LOWER_IS_BETTER,
+    BENCH_HIGHER_IS_BETTER,
+} BenchBetter;
+
+void bench_results_init(const char *benchmark, int argc, char **argv);
+
+// The name identifies the measurement within the benchmark run and must be
+// stable between runs with the same arguments.
+void bench_result(BenchBetter better, const char *unit, double value,
+                  const char *name_fmt, ...) DP_FORMAT(4, 5);
+
+// Writes the results if requested and frees them. Returns false on error.
+bool bench_results_finish(void);
+
+
+#endif
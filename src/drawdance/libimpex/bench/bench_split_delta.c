@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/perf.h>
+#include <dpengine/pixels.h>
+#include <stdio.h>
+
+// Benchmarks the split-delta conversion that tiles go through before being
+// compressed and after being decompressed. Prints tiles per second for each
+// direction. Set DP_CPU_SUPPORT to compare the different vectorized versions.
+
+static void generate_pixels(RngDouble *rng, DP_Pixel15 *pixels)
+{
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        pixels[i] = bench_random_pixel(rng);
+    }
+}
+
+static void print_result(const char *name, int iterations,
+                         unsigned long long ns)
+{
+    double seconds = (double)ns / 1000000000.0;
+    double tiles_per_second =
+        seconds > 0.0 ? (double)iterations / seconds : 0.0;
+    printf("%s,%.0f\n", name, tiles_per_second);
+    bench_result(BENCH_HIGHER_IS_BETTER, "tiles/s", tiles_per_second, "%s",
+                 name);
+}
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s ITERATIONS SEED\n",
+                bench_name(argc, argv, "bench_split_delta"));
+        return 2;
+    }
+
+    int iterations = atoi(argv[1]);
+    long seed = atol(argv[2]);
+    bench_results_init("bench_split_delta", argc, argv);
+
+    DP_Pixel15 *pixels = DP_malloc_simd(sizeof(*pixels) * DP_TILE_LENGTH);
+    DP_SplitTile8 *split = DP_malloc_simd(sizeof(*split));
+
+    RngDouble *rng = rng_double_new(seed);
+    generate_pixels(rng, pixels);
+    rng_double_free(rng);
+
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_pixels15_to_split_tile8_delta(split, pixels);
+    }
+    print_result("pixels15_to_split_tile8_delta", iterations,
+                 DP_perf_time() - start);
+
+    start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_split_tile8_delta_to_pixels15(pixels, split);
+    }
+    print_result("split_tile8_delta_to_pixels15", iterations,
+                 DP_perf_time() - start);
+
+    start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_split_tile8_delta_to_pixels15_checked(pixels, split);
+    }
+    print_result("split_tile8_delta_to_pixels15_checked", iterations,
+                 DP_perf_time() - start);
+
+    DP_free_simd(split);
+    DP_free_simd(pixels);
+    return bench_results_finish() ? 0 : 1;
+}
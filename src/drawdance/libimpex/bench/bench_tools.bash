@@ -0,0 +1,88 @@
+#!/bin/bash
+if [[ $# -ne 3 ]]; then
+    echo "Usage: $0 BENCH_TOOLS_EXECUTABLE ITERATIONS OUTPUT_DIR" 1>&2
+    exit 2
+fi
+
+bench_tools="$1"
+iterations="$2"
+output_dir="$3"
+
+sizes=(1024 2048 4096)
+tolerances=(0 0.1 0.5)
+gaps=(0 4 16)
+radii=(0 4 16)
+dab_diameters=(8 32 128)
+interpolations=(nearest bilinear binary)
+angles=(0 15 45 90)
+
+run_bench() {
+    printf '%s' "$($bench_tools "$@")"
+}
+
+bench_flood() {
+    printf 'size,tolerance,gap,expand,feather,ns\n'
+    for size in "${sizes[@]}"; do
+        for tolerance in "${tolerances[@]}"; do
+            for gap in "${gaps[@]}"; do
+                for expand in "${radii[@]}"; do
+                    for feather in "${radii[@]}"; do
+                        echo "bench flood $size $tolerance $gap $expand $feather" 1>&2
+                        printf '%s,%s,%s,%s,%s,' "$size" "$tolerance" "$gap" "$expand" "$feather"
+                        run_bench flood "$size" "$iterations" "$tolerance" "$gap" "$expand" "$feather"
+                        printf '\n'
+                    done
+                done
+            done
+        done
+    done
+}
+
+bench_selection() {
+    printf 'size,expand,feather,ns\n'
+    for size in "${sizes[@]}"; do
+        for expand in "${radii[@]}"; do
+            for feather in "${radii[@]}"; do
+                echo "bench selection $size $expand $feather" 1>&2
+                printf '%s,%s,%s,' "$size" "$expand" "$feather"
+                run_bench selection "$size" "$iterations" "$expand" "$feather"
+                printf '\n'
+            done
+        done
+    done
+}
+
+bench_dab() {
+    printf 'size,diameter,tolerance,expand,ns\n'
+    for size in "${sizes[@]}"; do
+        for diameter in "${dab_diameters[@]}"; do
+            for tolerance in "${tolerances[@]}"; do
+                for expand in "${radii[@]}"; do
+                    echo "bench dab $size $diameter $tolerance $expand" 1>&2
+                    printf '%s,%s,%s,%s,' "$size" "$diameter" "$tolerance" "$expand"
+                    run_bench dab "$size" "$iterations" "$diameter" "$tolerance" "$expand"
+                    printf '\n'
+                done
+            done
+        done
+    done
+}
+
+bench_transform() {
+    printf 'size,interpolation,angle,ns\n'
+    for size in "${sizes[@]}"; do
+        for interpolation in "${interpolations[@]}"; do
+            for angle in "${angles[@]}"; do
+                echo "bench transform $size $interpolation $angle" 1>&2
+                printf '%s,%s,%s,' "$size" "$interpolation" "$angle"
+                run_bench transform "$size" "$iterations" "$interpolation" "$angle"
+                printf '\n'
+            done
+        done
+    done
+}
+
+bench_flood >"$output_dir/flood-$iterations.csv"
+bench_selection >"$output_dir/selection-$iterations.csv"
+bench_dab >"$output_dir/dab-$iterations.csv"
+bench_transform >"$output_dir/transform-$iterations.csv"
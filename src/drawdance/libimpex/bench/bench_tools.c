@@ -0,0 +1,376 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Benchmarks the interactive tools that work on whole regions of the canvas:
+// flood fill, selection fill, flood fill masking of brush dabs and image
+// transforms. Each run benchmarks a single configuration and prints the total
+// nanoseconds taken, bench_tools.bash runs parameter sweeps over these.
+//
+// The canvas is a square of the given size with a single layer of line art
+// on it: a grid of lines, each line with a small hole in the middle of every
+// cell edge, so that gap closing makes a difference to how far fills spread.
+#include "bench_common.h"
+#include "bench_results.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/geom.h>
+#include <dpcommon/perf.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/flood_fill.h>
+#include <dpengine/image.h>
+#include <dpengine/image_transform.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/pixels.h>
+#include <dpengine/selection.h>
+#include <dpengine/selection_set.h>
+#include <dpimpex/image_impex.h>
+#include <dpmsg/ids.h>
+#include <dpmsg/messages.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define CONTEXT_ID     1
+#define LAYER_ID       0x100
+#define GRID_CELLS     4
+#define LINE_WIDTH     3
+#define LINE_HOLE_SIZE 6
+
+typedef struct FloodFillDabState {
+    int x, y;
+    int radius;
+} FloodFillDabState;
+
+
+static int cell_size_for(int size)
+{
+    return DP_max_int(size / GRID_CELLS, LINE_HOLE_SIZE * 2);
+}
+
+static bool on_line(int cell_size, int x, int y)
+{
+    int cx = x % cell_size;
+    int cy = y % cell_size;
+    int hole_start = (cell_size - LINE_HOLE_SIZE) / 2;
+    int hole_end = hole_start + LINE_HOLE_SIZE;
+    return (cx < LINE_WIDTH && (cy < hole_start || cy >= hole_end))
+        || (cy < LINE_WIDTH && (cx < hole_start || cx >= hole_end));
+}
+
+static DP_CanvasState *generate_canvas(DP_DrawContext *dc, int size)
+{
+    DP_TransientLayerList *tll;
+    DP_TransientLayerPropsList *tlpl;
+    DP_TransientCanvasState *tcs = bench_canvas_new(size, size, 1, &tll, &tlpl);
+
+    DP_TransientLayerContent *tlc =
+        DP_transient_layer_content_new_init(size, size, NULL);
+    int cell_size = cell_size_for(size);
+    DP_Pixel15 black = {0, 0, 0, DP_BIT15};
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            if (on_line(cell_size, x, y)) {
+                DP_transient_layer_content_pixel_at_set(tlc, 0, x, y, black);
+            }
+        }
+    }
+
+    DP_transient_layer_list_set_transient_content_noinc(tll, tlc, 0);
+    DP_transient_layer_props_list_set_transient_noinc(
+        tlpl, DP_transient_layer_props_new_init(LAYER_ID, false), 0);
+
+    DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+// An ellipse covering most of the canvas, with a soft edge.
+static DP_CanvasState *add_selection(DP_CanvasState *cs)
+{
+    int size = DP_canvas_state_width(cs);
+    DP_TransientLayerContent *tlc =
+        DP_transient_layer_content_new_init(size, size, NULL);
+    double center = (double)size / 2.0;
+    double radius = center * 0.9;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            double dx = ((double)x - center) / radius;
+            double dy = ((double)y - center) / (radius * 0.75);
+            double d = sqrt(dx * dx + dy * dy);
+            if (d < 1.0) {
+                double a = DP_min_double(1.0, (1.0 - d) * 10.0);
+                uint16_t a15 = DP_channel_float_to_15(DP_double_to_float(a));
+                DP_Pixel15 pixel = {a15, a15, a15, a15};
+                DP_transient_layer_content_pixel_at_set(tlc, 0, x, y, pixel);
+            }
+        }
+    }
+
+    DP_Selection *sel =
+        DP_selection_new_init(CONTEXT_ID, DP_SELECTION_ID_MAIN,
+                              DP_transient_layer_content_persist_mask(tlc));
+    DP_TransientSelectionSet *tss = DP_transient_selection_set_new_init(1);
+    DP_transient_selection_set_insert_at_noinc(tss, 0, sel);
+    return DP_canvas_state_new_with_selections_noinc(
+        cs, DP_transient_selection_set_persist(tss));
+}
+
+
+static const DP_UPixelFloat fill_color = {0.2f, 0.4f, 0.8f, 1.0f};
+
+static bool bench_flood(DP_CanvasState *cs, int iterations, double tolerance,
+                        int gap, int expand, int feather,
+                        unsigned long long *out_ns)
+{
+    // Start in the middle of the top-left cell. Unless the gap is large enough
+    // to close the holes in the lines, the fill leaks out into the other cells.
+    int start_xy = cell_size_for(DP_canvas_state_width(cs)) / 2;
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_Image *img;
+        int img_x, img_y;
+        DP_FloodFillResult result = DP_flood_fill(
+            cs, CONTEXT_ID, 0, start_xy, start_xy, fill_color, tolerance,
+            LAYER_ID, -1, gap, expand, DP_FLOOD_FILL_KERNEL_ROUND, feather,
+            false, true, false, DP_VIEW_MODE_NORMAL, LAYER_ID, 0, NULL, &img,
+            &img_x, &img_y, NULL, NULL);
+        if (result != DP_FLOOD_FILL_SUCCESS) {
+            fprintf(stderr, "Flood fill failed with result %d: %s\n",
+                    (int)result, DP_error());
+            return false;
+        }
+        DP_image_free(img);
+    }
+    *out_ns = DP_perf_time() - start;
+    return true;
+}
+
+static bool bench_selection(DP_CanvasState *cs, int iterations, int expand,
+                            int feather, unsigned long long *out_ns)
+{
+    DP_CanvasState *sel_cs = add_selection(DP_canvas_state_incref(cs));
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_Image *img;
+        int img_x, img_y;
+        DP_FloodFillResult result = DP_selection_fill(
+            sel_cs, CONTEXT_ID, DP_SELECTION_ID_MAIN, fill_color, expand,
+            DP_FLOOD_FILL_KERNEL_ROUND, feather, false, &img, &img_x, &img_y,
+            NULL, NULL);
+        if (result != DP_FLOOD_FILL_SUCCESS) {
+            fprintf(stderr, "Selection fill failed with result %d: %s\n",
+                    (int)result, DP_error());
+            DP_canvas_state_decref(sel_cs);
+            return false;
+        }
+        DP_image_free(img);
+    }
+    *out_ns = DP_perf_time() - start;
+    DP_canvas_state_decref(sel_cs);
+    return true;
+}
+
+
+static bool in_dab(void *user, int x, int y)
+{
+    FloodFillDabState *s = user;
+    int dx = x - s->x;
+    int dy = y - s->y;
+    return dx * dx + dy * dy <= s->radius * s->radius;
+}
+
+static void on_dab_flush(DP_UNUSED void *user)
+{
+}
+
+static void on_dab_clear(DP_UNUSED void *user)
+{
+}
+
+static bool on_dab_put(DP_UNUSED void *user, DP_UNUSED int col,
+                       DP_UNUSED int row, DP_UNUSED DP_Tile *t)
+{
+    return true;
+}
+
+// A horizontal stroke across the middle of the canvas, one dab every quarter
+// of the diameter, like a brush with the default spacing.
+static bool bench_dab(DP_CanvasState *cs, int iterations, int diameter,
+                      double tolerance, int expand, unsigned long long *out_ns)
+{
+    int size = DP_canvas_state_width(cs);
+    DP_LayerContent *flood_lc = DP_layer_list_entry_content_noinc(
+        DP_layer_list_at_noinc(DP_canvas_state_layers_noinc(cs), 0));
+    int radius = DP_max_int(1, diameter / 2);
+    int spacing = DP_max_int(1, diameter / 4);
+    FloodFillDabState s = {0, size / 2 + LINE_WIDTH * 2, radius};
+
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations; ++i) {
+        DP_TransientLayerContent *state = NULL;
+        for (s.x = 0; s.x < size; s.x += spacing) {
+            DP_Rect dab_area = DP_rect_make(s.x - radius, s.y - radius,
+                                            radius * 2 + 1, radius * 2 + 1);
+            bool should_mask;
+            DP_flood_fill_dab(&state, s.x, s.y, tolerance, expand, &dab_area,
+                              flood_lc, in_dab, on_dab_flush, on_dab_clear,
+                              on_dab_put, &s, &should_mask);
+        }
+        DP_transient_layer_content_decref_nullable(state);
+    }
+    *out_ns = DP_perf_time() - start;
+    return true;
+}
+
+
+// Rotates the flattened canvas around its center, the destination image is
+// the bounds of the rotated canvas.
+static bool bench_transform(DP_CanvasState *cs, DP_DrawContext *dc,
+                            int iterations, int interpolation, double angle,
+                            unsigned long long *out_ns)
+{
+    DP_Image *src_img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    if (!src_img) {
+        fprintf(stderr, "Error flattening canvas: %s\n", DP_error());
+        return false;
+    }
+
+    int size = DP_image_width(src_img);
+    double center = (double)size / 2.0;
+    double radians = angle * M_PI / 180.0;
+    double c = cos(radians);
+    double s = sin(radians);
+    int xs[4], ys[4];
+    for (int i = 0; i < 4; ++i) {
+        double x = (i == 1 || i == 2 ? (double)size : 0.0) - center;
+        double y = (i >= 2 ? (double)size : 0.0) - center;
+        xs[i] = DP_double_to_int(round(x * c - y * s + center));
+        ys[i] = DP_double_to_int(round(x * s + y * c + center));
+    }
+    DP_Quad dst_quad =
+        DP_quad_make(xs[0], ys[0], xs[1], ys[1], xs[2], ys[2], xs[3], ys[3]);
+    DP_Rect dst_bounds = DP_quad_bounds(dst_quad);
+    DP_Quad src_quad = DP_quad_make(0, 0, size, 0, size, size, 0, size);
+    DP_MaybeTransform mtf = DP_transform_quad_to_quad(
+        src_quad,
+        DP_quad_translate(dst_quad, -dst_bounds.x1, -dst_bounds.y1));
+    if (!mtf.valid) {
+        fputs("Invalid transform\n", stderr);
+        DP_image_free(src_img);
+        return false;
+    }
+
+    DP_Image *dst_img =
+        DP_image_new(DP_rect_width(dst_bounds), DP_rect_height(dst_bounds));
+    bool ok = true;
+    unsigned long long start = DP_perf_time();
+    for (int i = 0; i < iterations && ok; ++i) {
+        ok = DP_image_transform_draw(size, size, DP_image_pixels(src_img), dc,
+                                     dst_img, mtf.tf, interpolation);
+    }
+    *out_ns = DP_perf_time() - start;
+    if (!ok) {
+        fprintf(stderr, "Error transforming image: %s\n", DP_error());
+    }
+
+    DP_image_free(dst_img);
+    DP_image_free(src_img);
+    return ok;
+}
+
+static bool parse_interpolation(const char *s, int *out_interpolation)
+{
+    if (DP_str_equal(s, "nearest")) {
+        *out_interpolation = DP_MSG_TRANSFORM_REGION_MODE_NEAREST;
+    }
+    else if (DP_str_equal(s, "bilinear")) {
+        *out_interpolation = DP_MSG_TRANSFORM_REGION_MODE_BILINEAR;
+    }
+    else if (DP_str_equal(s, "binary")) {
+        *out_interpolation = DP_MSG_TRANSFORM_REGION_MODE_BINARY;
+    }
+    else {
+        fprintf(stderr, "Unknown interpolation '%s'\n", s);
+        return false;
+    }
+    return true;
+}
+
+
+static int usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s flood SIZE ITERATIONS TOLERANCE GAP EXPAND FEATHER\n"
+            "       %s selection SIZE ITERATIONS EXPAND FEATHER\n"
+            "       %s dab SIZE ITERATIONS DIAMETER TOLERANCE EXPAND\n"
+            "       %s transform SIZE ITERATIONS "
+            "nearest|bilinear|binary ANGLE\n",
+            name, name, name, name);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    DP_cpu_support_init();
+    DP_image_impex_init();
+
+    const char *name = bench_name(argc, argv, "bench_tools");
+    if (argc < 4) {
+        return usage(name);
+    }
+
+    const char *tool = argv[1];
+    int size, iterations;
+    if (!bench_parse_dimensions(argv[2], argv[2], &size, &size)
+        || !bench_parse_positive(argv[3], "Iterations", &iterations)) {
+        return 2;
+    }
+
+    int interpolation = 0;
+    if (DP_str_equal(tool, "flood") ? argc != 8
+        : DP_str_equal(tool, "selection") ? argc != 6
+        : DP_str_equal(tool, "dab")       ? argc != 7
+        : DP_str_equal(tool, "transform")
+            ? argc != 6 || !parse_interpolation(argv[4], &interpolation)
+            : true) {
+        return usage(name);
+    }
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = generate_canvas(dc, size);
+    unsigned long long ns = 0;
+    bool ok;
+    if (DP_str_equal(tool, "flood")) {
+        ok = bench_flood(cs, iterations, atof(argv[4]), atoi(argv[5]),
+                         atoi(argv[6]), atoi(argv[7]), &ns);
+    }
+    else if (DP_str_equal(tool, "selection")) {
+        ok = bench_selection(cs, iterations, atoi(argv[4]), atoi(argv[5]),
+                             &ns);
+    }
+    else if (DP_str_equal(tool, "dab")) {
+        ok = bench_dab(cs, iterations, atoi(argv[4]), atof(argv[5]),
+                       atoi(argv[6]), &ns);
+    }
+    else {
+        ok = bench_transform(cs, dc, iterations, interpolation, atof(argv[5]),
+                             &ns);
+    }
+
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+
+    if (ok) {
+        printf("%llu\n", ns);
+        bench_results_init("bench_tools", argc, argv);
+        bench_result(BENCH_LOWER_IS_BETTER, "ns", (double)ns, "%s", tool);
+        return bench_results_finish() ? 0 : 1;
+    }
+    else {
+        return 1;
+    }
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-3.0-or-later
+# Runs the benchmark suite and optionally compares the results against a
+# baseline from an earlier run, failing if anything got slower than the given
+# threshold. Each benchmark writes its results via the DP_BENCH_JSON
+# environment variable, see bench_results.h. Typical use when rebasing:
+#
+#   run_benchmarks.py --bin-dir build/bin --output before.json
+#   (rebase, rebuild)
+#   run_benchmarks.py --bin-dir build/bin --baseline before.json
+#
+# Benchmarks that need input files are skipped unless those are given via
+# --input, e.g. --input canvas=big.ora --input recording=session.dprec.
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+RESULTS_VERSION = 1
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description="Run the benchmark suite.")
+    parser.add_argument(
+        "--bin-dir", required=True, help="directory with the bench_* executables"
+    )
+    parser.add_argument(
+        "--suite",
+        default=os.path.join(SCRIPT_DIR, "suite.json"),
+        help="suite definition, defaults to suite.json next to this script",
+    )
+    parser.add_argument("--output", help="write combined results to this file")
+    parser.add_argument("--baseline", help="compare against these results")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=10.0,
+        help="regression threshold in percent, default is %(default)s",
+    )
+    parser.add_argument(
+        "--repeat",
+        type=int,
+        default=3,
+        help="runs per benchmark, the median is used, default is %(default)s",
+    )
+    parser.add_argument(
+        "--input",
+        action="append",
+        default=[],
+        metavar="NAME=PATH",
+        help="input file for benchmarks that require one",
+    )
+    parser.add_argument(
+        "--only", action="append", default=[], metavar="ID", help="run only these"
+    )
+    return parser.parse_args()
+
+
+def parse_inputs(input_args):
+    inputs = {}
+    for arg in input_args:
+        name, sep, path = arg.partition("=")
+        if not sep or not name or not path:
+            sys.exit(f"Invalid input '{arg}', expected NAME=PATH")
+        inputs[name] = os.path.abspath(path)
+    return inputs
+
+
+def find_executable(bin_dir, name):
+    for candidate in (name, name + ".exe"):
+        path = os.path.join(bin_dir, candidate)
+        if os.path.isfile(path):
+            return path
+    sys.exit(f"Executable {name} not found in {bin_dir}")
+
+
+def run_once(command, env, json_path):
+    env = dict(env, DP_BENCH_JSON=json_path)
+    subprocess.run(command, env=env, check=True, stdout=subprocess.DEVNULL)
+    with open(json_path, "r", encoding="utf-8") as f:
+        return json.load(f)
+
+
+def run_benchmark(bench, bin_dir, inputs, repeat, work_dir):
+    bench_id = bench["id"]
+    variables = dict(inputs, output_dir=os.path.join(work_dir, bench_id))
+    os.makedirs(variables["output_dir"], exist_ok=True)
+    command = [arg.format(**variables) for arg in bench["command"]]
+    command[0] = find_executable(bin_dir, command[0])
+    json_path = os.path.join(work_dir, bench_id + ".json")
+
+    runs = []
+    for i in range(repeat):
+        print(f"{bench_id} {i + 1}/{repeat}", file=sys.stderr, flush=True)
+        runs.append(run_once(command, os.environ, json_path))
+
+    # Take the median of each measurement to weed out noisy runs.
+    results = {}
+    for run in runs:
+        for result in run["results"]:
+            entry = results.setdefault(
+                result["name"],
+                {"unit": result["unit"], "better": result["better"], "values": []},
+            )
+            entry["values"].append(result["value"])
+    return {
+        name: {
+            "unit": entry["unit"],
+            "better": entry["better"],
+            "value": statistics.median(entry["values"]),
+        }
+        for name, entry in results.items()
+    }
+
+
+def run_suite(args, suite, inputs):
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="dpbench") as work_dir:
+        for bench in suite["benchmarks"]:
+            bench_id = bench["id"]
+            if args.only and bench_id not in args.only:
+                continue
+            missing = [name for name in bench.get("requires", []) if name not in inputs]
+            if missing:
+                print(
+                    f"Skipping {bench_id}, needs --input {', '.join(missing)}",
+                    file=sys.stderr,
+                )
+                continue
+            results[bench_id] = run_benchmark(
+                bench, args.bin_dir, inputs, args.repeat, work_dir
+            )
+    return results
+
+
+def get_change_percent(baseline, current):
+    if baseline == 0.0:
+        return 0.0
+    return (current - baseline) / abs(baseline) * 100.0
+
+
+def compare(baseline, results, threshold):
+    regressions = 0
+    for bench_id, bench_results in results.items():
+        baseline_results = baseline.get(bench_id)
+        if baseline_results is None:
+            print(f"{bench_id}: not in baseline")
+            continue
+        for name, result in bench_results.items():
+            baseline_result = baseline_results.get(name)
+            if baseline_result is None:
+                print(f"{bench_id}/{name}: not in baseline")
+                continue
+            change = get_change_percent(baseline_result["value"], result["value"])
+            # Positive means worse, regardless of which direction is better.
+            worsening = -change if result["better"] == "higher" else change
+            regressed = worsening > threshold
+            if regressed:
+                regressions += 1
+            print(
+                "{} {}/{}: {:.3f} -> {:.3f} {} ({:+.1f}% {})".format(
+                    "REGRESSION" if regressed else "ok",
+                    bench_id,
+                    name,
+                    baseline_result["value"],
+                    result["value"],
+                    result["unit"],
+                    change,
+                    "better" if worsening <= 0.0 else "worse",
+                )
+            )
+    return regressions
+
+
+def main():
+    args = parse_args()
+    if args.repeat < 1:
+        sys.exit("--repeat must be at least 1")
+
+    with open(args.suite, "r", encoding="utf-8") as f:
+        suite = json.load(f)
+    results = run_suite(args, suite, parse_inputs(args.input))
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump(
+                {"version": RESULTS_VERSION, "results": results}, f, indent=4
+            )
+            f.write("\n")
+
+    if args.baseline:
+        with open(args.baseline, "r", encoding="utf-8") as f:
+            baseline = json.load(f)
+        if baseline.get("version") != RESULTS_VERSION:
+            sys.exit(f"Unsupported baseline version in {args.baseline}")
+        regressions = compare(baseline["results"], results, args.threshold)
+        if regressions != 0:
+            print(
+                f"{regressions} regression(s) above {args.threshold}%",
+                file=sys.stderr,
+            )
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -108,6 +108,15 @@ bool DP_image_write_png(DP_Image *img, DP_Output *output)
                               DP_image_pixels(img));
 }
 
+bool DP_image_write_png_level(DP_Image *img, DP_Output *output, int level)
+{
+    DP_ASSERT(img);
+    DP_ASSERT(output);
+    return DP_image_png_write_level(output, DP_image_width(img),
+                                    DP_image_height(img), DP_image_pixels(img),
+                                    level);
+}
+
 bool DP_image_write_jpeg_quality(DP_Image *img, DP_Output *output, int quality)
 {
     return DP_image_jpeg_write(output, DP_image_width(img),
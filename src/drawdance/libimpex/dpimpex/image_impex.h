@@ -21,6 +21,9 @@ DP_Image *DP_image_read_jpeg(DP_Input *input);
 DP_Image *DP_image_read_jpeg(DP_Input *input);
 
 bool DP_image_write_png(DP_Image *img, DP_Output *output) DP_MUST_CHECK;
+// See DP_IMAGE_PNG_LEVEL_* in image_png.h for the level.
+bool DP_image_write_png_level(DP_Image *img, DP_Output *output,
+                              int level) DP_MUST_CHECK;
 bool DP_image_write_jpeg_quality(DP_Image *img, DP_Output *output,
                                  int quality) DP_MUST_CHECK;
 bool DP_image_write_jpeg(DP_Image *img, DP_Output *output) DP_MUST_CHECK;
@@ -204,13 +204,35 @@ static void term_jpeg_destination_buffer(j_compress_ptr cinfo)
     }
 }
 
+typedef struct DP_JpegPixels {
+    int width;
+    DP_Pixel8 *pixels;
+} DP_JpegPixels;
+
+static const DP_Pixel8 *get_jpeg_pixels_row(void *user, int y)
+{
+    DP_JpegPixels *jp = user;
+    return jp->pixels + DP_int_to_size(y) * DP_int_to_size(jp->width);
+}
+
 bool DP_image_jpeg_write(DP_Output *output, int width, int height,
                          DP_Pixel8 *pixels, int quality)
+{
+    DP_ASSERT(pixels);
+    DP_JpegPixels jp = {width, pixels};
+    return DP_image_jpeg_write_rows(output, width, height, quality,
+                                    get_jpeg_pixels_row, &jp);
+}
+
+bool DP_image_jpeg_write_rows(DP_Output *output, int width, int height,
+                              int quality,
+                              const DP_Pixel8 *(*get_row)(void *, int),
+                              void *user)
 {
     DP_ASSERT(output);
     DP_ASSERT(width > 0);
     DP_ASSERT(height > 0);
-    DP_ASSERT(pixels);
+    DP_ASSERT(get_row);
 
     struct jpeg_compress_struct cinfo;
 
@@ -244,9 +266,16 @@ bool DP_image_jpeg_write(DP_Output *output, int width, int height,
     jpeg_start_compress(&cinfo, TRUE);
 
     while (cinfo.next_scanline < cinfo.image_height) {
-        JDIMENSION offset = cinfo.next_scanline * cinfo.image_width;
+        const DP_Pixel8 *pixels = get_row(user, (int)cinfo.next_scanline);
+        if (!pixels) {
+            jpeg_destroy_compress(&cinfo);
+            DP_free(scanline);
+            DP_free(dest.buffer);
+            return false;
+        }
+
         for (JDIMENSION i = 0; i < cinfo.image_width; ++i) {
-            DP_UPixel8 pixel = DP_pixel8_unpremultiply(pixels[offset + i]);
+            DP_UPixel8 pixel = DP_pixel8_unpremultiply(pixels[i]);
             scanline[i * 3 + 0] = pixel.r;
             scanline[i * 3 + 1] = pixel.g;
             scanline[i * 3 + 2] = pixel.b;
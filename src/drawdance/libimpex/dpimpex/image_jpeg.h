@@ -14,5 +14,11 @@ DP_Image *DP_image_jpeg_read(DP_Input *input);
 bool DP_image_jpeg_write(DP_Output *output, int width, int height,
                          DP_Pixel8 *pixels, int quality);
 
+// Like DP_image_png_write_rows, see there.
+bool DP_image_jpeg_write_rows(DP_Output *output, int width, int height,
+                              int quality,
+                              const DP_Pixel8 *(*get_row)(void *, int),
+                              void *user);
+
 
 #endif
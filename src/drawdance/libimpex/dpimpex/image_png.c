@@ -76,16 +76,19 @@ static void push_pixels(png_uint_32 channels, png_uint_32 width,
 {
     for (png_uint_32 y = 0; y < height; ++y) {
         png_bytep row = row_pointers[y];
+        DP_Pixel8 *dst = pixels + y * width;
         for (png_uint_32 x = 0; x < width; ++x) {
             png_uint_32 offset = x * channels;
-            DP_UPixel8 pixel = {
+            dst[x] = (DP_Pixel8){
                 .b = row[offset],
                 .g = row[offset + 1],
                 .r = row[offset + 2],
                 .a = channels == 3 ? 0xff : row[offset + 3],
             };
-            // PNG stores pixels unpremultiplied, fix them up.
-            pixels[y * width + x] = DP_pixel8_premultiply(pixel);
+        }
+        // PNG stores pixels unpremultiplied, fix them up.
+        if (channels != 3) {
+            DP_pixels8_premultiply(dst, DP_uint32_to_int(width));
         }
     }
 }
@@ -151,21 +154,56 @@ DP_Image *DP_image_png_read(DP_Input *input)
 }
 
 
-static bool write_png_with(DP_Output *output, int width, int height,
-                           DP_UPixel8 (*get_pixel)(void *, size_t), void *user)
+static png_structp create_png_write_struct(png_infop *out_info_ptr)
 {
     png_structp png_ptr =
         png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, error_png,
                                   warn_png, NULL, malloc_png, free_png);
     if (!png_ptr) {
         DP_error_set("Can't create PNG write struct");
-        return false;
+        return NULL;
     }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         DP_error_set("Can't create PNG write info struct");
         png_destroy_write_struct(&png_ptr, NULL);
+        return NULL;
+    }
+
+    *out_info_ptr = info_ptr;
+    return png_ptr;
+}
+
+static void set_png_write_params(png_structp png_ptr, png_infop info_ptr,
+                                 DP_Output *output, int width, int height,
+                                 int level)
+{
+    png_set_write_fn(png_ptr, output, write_png, flush_png);
+
+    png_set_IHDR(png_ptr, info_ptr, DP_int_to_uint32(width),
+                 DP_int_to_uint32(height), 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+
+    if (level >= 0) {
+        png_set_compression_level(png_ptr, DP_min_int(level, 9));
+        if (level <= DP_IMAGE_PNG_LEVEL_FIXED_FILTER_MAX) {
+            // The sub filter alone does well on both paint and the long
+            // transparent runs of mostly empty layers, and it skips libpng
+            // running every filter on every row to pick the best one.
+            png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+        }
+    }
+}
+
+static bool write_png_with(DP_Output *output, int width, int height,
+                           int level, DP_UPixel8 (*get_pixel)(void *, size_t),
+                           void *user)
+{
+    png_infop info_ptr;
+    png_structp png_ptr = create_png_write_struct(&info_ptr);
+    if (!png_ptr) {
         return false;
     }
 
@@ -195,13 +233,7 @@ static bool write_png_with(DP_Output *output, int width, int height,
         return false;
     }
 
-    png_set_write_fn(png_ptr, output, write_png, flush_png);
-
-    png_set_IHDR(png_ptr, info_ptr, DP_int_to_uint32(width),
-                 DP_int_to_uint32(height), 8, PNG_COLOR_TYPE_RGBA,
-                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
-
+    set_png_write_params(png_ptr, info_ptr, output, width, height, level);
     png_set_rows(png_ptr, info_ptr, row_pointers);
     png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
 
@@ -221,8 +253,15 @@ static DP_UPixel8 get_premultiplied_pixel(void *user, size_t pixel_index)
 bool DP_image_png_write(DP_Output *output, int width, int height,
                         DP_Pixel8 *pixels)
 {
-    return write_png_with(output, width, height, get_premultiplied_pixel,
-                          pixels);
+    return DP_image_png_write_level(output, width, height, pixels,
+                                    DP_IMAGE_PNG_LEVEL_DEFAULT);
+}
+
+bool DP_image_png_write_level(DP_Output *output, int width, int height,
+                              DP_Pixel8 *pixels, int level)
+{
+    return write_png_with(output, width, height, level,
+                          get_premultiplied_pixel, pixels);
 }
 
 static DP_UPixel8 get_unpremultiplied_pixel(void *user, size_t pixel_index)
@@ -234,6 +273,62 @@ static DP_UPixel8 get_unpremultiplied_pixel(void *user, size_t pixel_index)
 bool DP_image_png_write_unpremultiplied(DP_Output *output, int width,
                                         int height, DP_UPixel8 *pixels)
 {
-    return write_png_with(output, width, height, get_unpremultiplied_pixel,
-                          pixels);
+    return DP_image_png_write_unpremultiplied_level(
+        output, width, height, pixels, DP_IMAGE_PNG_LEVEL_DEFAULT);
+}
+
+bool DP_image_png_write_unpremultiplied_level(DP_Output *output, int width,
+                                              int height, DP_UPixel8 *pixels,
+                                              int level)
+{
+    return write_png_with(output, width, height, level,
+                          get_unpremultiplied_pixel, pixels);
+}
+
+bool DP_image_png_write_rows(DP_Output *output, int width, int height,
+                             int level,
+                             const DP_Pixel8 *(*get_row)(void *, int),
+                             void *user)
+{
+    png_infop info_ptr;
+    png_structp png_ptr = create_png_write_struct(&info_ptr);
+    if (!png_ptr) {
+        return false;
+    }
+
+    png_bytep bytes = png_malloc(png_ptr, DP_int_to_size(width) * 4u);
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_free(png_ptr, bytes);
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return false;
+    }
+
+    set_png_write_params(png_ptr, info_ptr, output, width, height, level);
+    png_write_info(png_ptr, info_ptr);
+
+    for (int y = 0; y < height; ++y) {
+        const DP_Pixel8 *pixels = get_row(user, y);
+        if (!pixels) {
+            png_free(png_ptr, bytes);
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return false;
+        }
+
+        for (int x = 0; x < width; ++x) {
+            DP_UPixel8 pixel = DP_pixel8_unpremultiply(pixels[x]);
+            size_t byte_index = DP_int_to_size(x) * 4u;
+            bytes[byte_index + 0u] = pixel.r;
+            bytes[byte_index + 1u] = pixel.g;
+            bytes[byte_index + 2u] = pixel.b;
+            bytes[byte_index + 3u] = pixel.a;
+        }
+        png_write_row(png_ptr, bytes);
+    }
+
+    png_write_end(png_ptr, info_ptr);
+    png_free(png_ptr, bytes);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+
+    return DP_output_flush(output);
 }
@@ -10,13 +10,37 @@ typedef union DP_Pixel8 DP_Pixel8;
 typedef union DP_UPixel8 DP_UPixel8;
 
 
+// Compression levels for writing PNGs, these go straight to zlib. The fast
+// level is meant for PNGs that are storage rather than the final product,
+// like ORA layers or frames, it trades a somewhat larger file for encoding a
+// lot quicker. Levels up to DP_IMAGE_PNG_LEVEL_FIXED_FILTER_MAX also use a
+// single row filter instead of trying all of them on every row.
+#define DP_IMAGE_PNG_LEVEL_DEFAULT          (-1)
+#define DP_IMAGE_PNG_LEVEL_FAST             1
+#define DP_IMAGE_PNG_LEVEL_FIXED_FILTER_MAX 3
+
 DP_Image *DP_image_png_read(DP_Input *input);
 
 bool DP_image_png_write(DP_Output *output, int width, int height,
                         DP_Pixel8 *pixels);
 
+bool DP_image_png_write_level(DP_Output *output, int width, int height,
+                              DP_Pixel8 *pixels, int level);
+
 bool DP_image_png_write_unpremultiplied(DP_Output *output, int width, int height,
                          DP_UPixel8 *pixels);
 
+bool DP_image_png_write_unpremultiplied_level(DP_Output *output, int width,
+                                              int height, DP_UPixel8 *pixels,
+                                              int level);
+
+// Writes a PNG one row at a time, so the whole image never has to be in memory
+// at once. The get_row function is called for each row from top to bottom and
+// returns that row's premultiplied pixels, or NULL with DP_error set to abort.
+bool DP_image_png_write_rows(DP_Output *output, int width, int height,
+                             int level,
+                             const DP_Pixel8 *(*get_row)(void *, int),
+                             void *user);
+
 
 #endif
@@ -5,6 +5,7 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
 #include <dpcommon/output.h>
+#include <dpcommon/worker.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/image.h>
 #include <dpengine/pixels.h>
@@ -32,15 +33,33 @@ static int hash_upixel8(DP_UPixel8 px)
     return px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11;
 }
 
+// Memory inputs get decoded straight out of their buffer, others are read into
+// the given storage one chunk at a time.
+static const unsigned char *qoi_read_chunk(DP_Input *input,
+                                           unsigned char *storage,
+                                           size_t *out_fill, bool *out_error)
+{
+    const unsigned char *borrowed = DP_input_borrow(input, SIZE_MAX, out_fill);
+    if (borrowed) {
+        *out_error = false;
+        return borrowed;
+    }
+    else {
+        *out_fill = DP_input_read(input, storage, BUFSIZ, out_error);
+        return storage;
+    }
+}
+
 DP_Image *DP_image_qoi_read(DP_Input *input)
 {
     DP_ASSERT(input);
 
     size_t fill = 0;
-    unsigned char buf[BUFSIZ];
+    unsigned char storage[BUFSIZ];
+    const unsigned char *buf = storage;
 
     bool error;
-    fill = DP_input_read(input, buf, DP_QOI_HEADER_SIZE, &error);
+    fill = DP_input_read(input, storage, DP_QOI_HEADER_SIZE, &error);
     if (error) {
         return NULL;
     }
@@ -82,7 +101,7 @@ DP_Image *DP_image_qoi_read(DP_Input *input)
             OUT = buf[pos++];                                      \
         }                                                          \
         else {                                                     \
-            fill = DP_input_read(input, buf, sizeof(buf), &error); \
+            buf = qoi_read_chunk(input, storage, &fill, &error);   \
             if (error) {                                           \
                 DP_image_free(img);                                \
                 return NULL;                                       \
@@ -140,9 +159,11 @@ DP_Image *DP_image_qoi_read(DP_Input *input)
             }
 
             index[hash_upixel8(px) & (64 - 1)] = px;
-            dst[i] = DP_pixel8_premultiply(px);
+            dst[i] = (DP_Pixel8){px.color};
         }
     }
+    // QOI stores pixels unpremultiplied, runs copied them over as they are.
+    DP_pixels8_premultiply(dst, pixel_count);
 
     unsigned char padding[] = DP_QOI_PADDING_INIT;
     for (int i = 0; i < (int)sizeof(padding); ++i) {
@@ -159,35 +180,27 @@ DP_Image *DP_image_qoi_read(DP_Input *input)
     return img;
 }
 
-bool DP_image_qoi_write(DP_Output *output, int width, int height,
-                        DP_Pixel8 *pixels)
+// Strips after the first may be encoded in parallel, so they can't know what
+// came before them. Their first pixel is always written out in full and only
+// index entries set within the strip itself are referred to. Any decoder will
+// have set those entries the same way by then, so it's still a regular QOI
+// stream that just happens to be a tiny bit larger.
+static bool qoi_write_strip(DP_Output *output, const DP_Pixel8 *pixels,
+                            int pixel_count, bool first)
 {
-    DP_ASSERT(output);
-    DP_ASSERT(width > 0);
-    DP_ASSERT(height > 0);
-    DP_ASSERT(pixels);
-
-    if (!DP_OUTPUT_WRITE_BIGENDIAN(output, DP_OUTPUT_UINT32(DP_QOI_MAGIC),
-                                   DP_OUTPUT_UINT32(width),
-                                   DP_OUTPUT_UINT32(height),
-                                   DP_OUTPUT_UINT8(4), // channels
-                                   DP_OUTPUT_UINT8(0), // color space (SRGB)
-                                   DP_OUTPUT_END)) {
-        return false;
-    }
-
     int run = 0;
     DP_UPixel8 px_prev = {.b = 0, .g = 0, .r = 0, .a = 255};
+    bool have_prev = first;
     DP_UPixel8 index[64];
     memset(index, 0, sizeof(index));
+    uint64_t index_valid = first ? UINT64_MAX : 0u;
 
-    int pixel_count = width * height;
     for (int i = 0; i < pixel_count; ++i) {
         DP_UPixel8 px = DP_pixel8_unpremultiply(pixels[i]);
         size_t len = 0;
         unsigned char buf[6];
 
-        if (px.color == px_prev.color) {
+        if (have_prev && px.color == px_prev.color) {
             ++run;
             if (run == 62 || i == pixel_count - 1) {
                 buf[len++] = DP_int_to_uchar(DP_QOI_OP_RUN | (run - 1));
@@ -201,13 +214,16 @@ bool DP_image_qoi_write(DP_Output *output, int width, int height,
             }
 
             int index_pos = hash_upixel8(px) & (64 - 1);
-            if (index[index_pos].color == px.color) {
+            uint64_t index_bit = (uint64_t)1u << index_pos;
+            if ((index_valid & index_bit)
+                && index[index_pos].color == px.color) {
                 buf[len++] = DP_int_to_uchar(DP_QOI_OP_INDEX | index_pos);
             }
             else {
                 index[index_pos] = px;
+                index_valid |= index_bit;
 
-                if (px.a == px_prev.a) {
+                if (have_prev && px.a == px_prev.a) {
                     signed char vr = (signed char)(px.r - px_prev.r);
                     signed char vg = (signed char)(px.g - px_prev.g);
                     signed char vb = (signed char)(px.b - px_prev.b);
@@ -249,11 +265,120 @@ bool DP_image_qoi_write(DP_Output *output, int width, int height,
         }
 
         px_prev = px;
+        have_prev = true;
+    }
+
+    return true;
+}
+
+// SPDX-SnippetEnd
+
+#define DP_QOI_STRIP_MIN_PIXELS (1 << 20)
+
+typedef struct DP_QoiStripJob {
+    const DP_Pixel8 *pixels;
+    int pixel_count;
+    bool first;
+    void *buffer;
+    size_t size;
+    char *error;
+} DP_QoiStripJob;
+
+static void qoi_write_strip_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_QoiStripJob *job = *(DP_QoiStripJob **)element;
+    void **buffer_ptr;
+    size_t *size_ptr;
+    DP_Output *output = DP_mem_output_new(
+        DP_int_to_size(job->pixel_count) / 2u + 64u, false, &buffer_ptr,
+        &size_ptr);
+    bool ok =
+        qoi_write_strip(output, job->pixels, job->pixel_count, job->first);
+    job->buffer = *buffer_ptr;
+    job->size = *size_ptr;
+    DP_output_free(output);
+    if (!ok) {
+        job->error = DP_strdup(DP_error());
+    }
+}
+
+static int qoi_strip_count(int pixel_count)
+{
+    // Not worth spinning up threads for smaller images.
+    int strip_count = pixel_count / DP_QOI_STRIP_MIN_PIXELS;
+    return strip_count < 2 ? 1 : DP_worker_cpu_count(strip_count);
+}
+
+static bool qoi_write_strips(DP_Output *output, const DP_Pixel8 *pixels,
+                             int pixel_count, int strip_count)
+{
+    DP_Worker *worker =
+        DP_worker_new(DP_int_to_size(strip_count), sizeof(DP_QoiStripJob *),
+                      strip_count, qoi_write_strip_job);
+    if (!worker) {
+        DP_warn("Error creating QOI worker: %s", DP_error());
+        return qoi_write_strip(output, pixels, pixel_count, true);
+    }
+
+    DP_QoiStripJob *jobs =
+        DP_malloc(sizeof(*jobs) * DP_int_to_size(strip_count));
+    int strip_size = pixel_count / strip_count;
+    for (int i = 0; i < strip_count; ++i) {
+        int offset = strip_size * i;
+        int count = i == strip_count - 1 ? pixel_count - offset : strip_size;
+        jobs[i] = (DP_QoiStripJob){pixels + offset, count, i == 0, NULL, 0,
+                                   NULL};
+        DP_QoiStripJob *job = &jobs[i];
+        DP_worker_push(worker, &job);
+    }
+    DP_worker_free_join(worker);
+
+    bool ok = true;
+    for (int i = 0; i < strip_count; ++i) {
+        DP_QoiStripJob *job = &jobs[i];
+        if (ok) {
+            if (job->error) {
+                DP_error_set("%s", job->error);
+                ok = false;
+            }
+            else {
+                ok = DP_output_write(output, job->buffer, job->size);
+            }
+        }
+        DP_free(job->buffer);
+        DP_free(job->error);
+    }
+    DP_free(jobs);
+    return ok;
+}
+
+bool DP_image_qoi_write(DP_Output *output, int width, int height,
+                        DP_Pixel8 *pixels)
+{
+    DP_ASSERT(output);
+    DP_ASSERT(width > 0);
+    DP_ASSERT(height > 0);
+    DP_ASSERT(pixels);
+
+    if (!DP_OUTPUT_WRITE_BIGENDIAN(output, DP_OUTPUT_UINT32(DP_QOI_MAGIC),
+                                   DP_OUTPUT_UINT32(width),
+                                   DP_OUTPUT_UINT32(height),
+                                   DP_OUTPUT_UINT8(4), // channels
+                                   DP_OUTPUT_UINT8(0), // color space (SRGB)
+                                   DP_OUTPUT_END)) {
+        return false;
+    }
+
+    int pixel_count = width * height;
+    int strip_count = qoi_strip_count(pixel_count);
+    bool ok = strip_count > 1
+                ? qoi_write_strips(output, pixels, pixel_count, strip_count)
+                : qoi_write_strip(output, pixels, pixel_count, true);
+    if (!ok) {
+        return false;
     }
 
     unsigned char padding[] = DP_QOI_PADDING_INIT;
     return DP_output_write(output, padding, sizeof(padding))
         && DP_output_flush(output);
 }
-
-// SPDX-SnippetEnd
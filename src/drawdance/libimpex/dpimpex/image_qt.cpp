@@ -192,19 +192,45 @@ static bool write_image(DP_Output *output, int width, int height, uchar *pixels,
     return ok ? DP_output_flush(output) : false;
 }
 
+// Qt's PNG writer takes a quality from 0 to 100 that it turns into a zlib
+// level as (100 - quality) * 9 / 91, so this is the inverse of that.
+static int png_level_to_quality(int level)
+{
+    return level < 0 ? -1 : 100 - (DP_min_int(level, 9) * 91 + 8) / 9;
+}
+
 extern "C" bool DP_image_png_write(DP_Output *output, int width, int height,
                                    DP_Pixel8 *pixels)
+{
+    return DP_image_png_write_level(output, width, height, pixels,
+                                    DP_IMAGE_PNG_LEVEL_DEFAULT);
+}
+
+extern "C" bool DP_image_png_write_level(DP_Output *output, int width,
+                                         int height, DP_Pixel8 *pixels,
+                                         int level)
 {
     return write_image(output, width, height, reinterpret_cast<uchar *>(pixels),
-                       "PNG", -1, QImage::Format_ARGB32_Premultiplied);
+                       "PNG", png_level_to_quality(level),
+                       QImage::Format_ARGB32_Premultiplied);
 }
 
 extern "C" bool DP_image_png_write_unpremultiplied(DP_Output *output, int width,
                                                    int height,
                                                    DP_UPixel8 *pixels)
+{
+    return DP_image_png_write_unpremultiplied_level(
+        output, width, height, pixels, DP_IMAGE_PNG_LEVEL_DEFAULT);
+}
+
+extern "C" bool DP_image_png_write_unpremultiplied_level(DP_Output *output,
+                                                         int width, int height,
+                                                         DP_UPixel8 *pixels,
+                                                         int level)
 {
     return write_image(output, width, height, reinterpret_cast<uchar *>(pixels),
-                       "PNG", -1, QImage::Format_ARGB32);
+                       "PNG", png_level_to_quality(level),
+                       QImage::Format_ARGB32);
 }
 
 bool DP_image_jpeg_write(DP_Output *output, int width, int height,
@@ -213,3 +239,46 @@ bool DP_image_jpeg_write(DP_Output *output, int width, int height,
     return write_image(output, width, height, reinterpret_cast<uchar *>(pixels),
                        "JPEG", quality, QImage::Format_ARGB32_Premultiplied);
 }
+
+// Qt's image writers need the whole image up front, so this just gathers the
+// rows and doesn't actually save any memory compared to the regular functions.
+static bool write_image_rows(DP_Output *output, int width, int height,
+                             const DP_Pixel8 *(*get_row)(void *, int),
+                             void *user, const char *format, int quality)
+{
+    QImage qi(width, height, QImage::Format_ARGB32_Premultiplied);
+    if (qi.isNull()) {
+        DP_error_set("Could not allocate %dx%d %s image", width, height,
+                     format);
+        return false;
+    }
+
+    size_t row_size = DP_int_to_size(width) * sizeof(DP_Pixel8);
+    for (int y = 0; y < height; ++y) {
+        const DP_Pixel8 *pixels = get_row(user, y);
+        if (!pixels) {
+            return false;
+        }
+        memcpy(qi.scanLine(y), pixels, row_size);
+    }
+
+    return write_image(output, width, height, qi.bits(), format, quality,
+                       QImage::Format_ARGB32_Premultiplied);
+}
+
+extern "C" bool
+DP_image_png_write_rows(DP_Output *output, int width, int height, int level,
+                        const DP_Pixel8 *(*get_row)(void *, int), void *user)
+{
+    return write_image_rows(output, width, height, get_row, user, "PNG",
+                            png_level_to_quality(level));
+}
+
+bool DP_image_jpeg_write_rows(DP_Output *output, int width, int height,
+                              int quality,
+                              const DP_Pixel8 *(*get_row)(void *, int),
+                              void *user)
+{
+    return write_image_rows(output, width, height, get_row, user, "JPEG",
+                            quality);
+}
@@ -9,6 +9,11 @@
 #include <webp/decode.h>
 #include <webp/encode.h>
 
+// Images at least this big get encoded with libwebp's threading enabled. It
+// only splits off some of the work to another thread, so it's not worth the
+// overhead for small things like thumbnails.
+#define DP_WEBP_THREADED_MIN_PIXELS (1024 * 1024)
+
 
 static const char *status_code_to_string(VP8StatusCode status)
 {
@@ -35,16 +40,21 @@ static const char *status_code_to_string(VP8StatusCode status)
 
 DP_Image *DP_image_webp_read(DP_Input *input)
 {
-    WebPDecBuffer wdb;
-    if (!WebPInitDecBuffer(&wdb)) {
-        DP_error_set("Error initializing decode buffer");
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
+        DP_error_set("Error initializing decoder config");
         return NULL;
     }
-    wdb.colorspace = MODE_bgrA;
+    // The size isn't known up front when decoding incrementally, but the
+    // threading overhead is negligible compared to decoding anything at all.
+    config.options.use_threads = 1;
+
+    WebPDecBuffer *wdb = &config.output;
+    wdb->colorspace = MODE_bgrA;
 
-    WebPIDecoder *idec = WebPINewDecoder(&wdb);
+    WebPIDecoder *idec = WebPIDecode(NULL, 0, &config);
     if (!idec) {
-        WebPFreeDecBuffer(&wdb);
+        WebPFreeDecBuffer(wdb);
         DP_error_set("Error creating decoder");
         return NULL;
     }
@@ -55,13 +65,13 @@ DP_Image *DP_image_webp_read(DP_Input *input)
         size_t read = DP_input_read(input, buf, sizeof(buf), &error);
         if (error) {
             WebPIDelete(idec);
-            WebPFreeDecBuffer(&wdb);
+            WebPFreeDecBuffer(wdb);
             return NULL;
         }
         else if (read == 0) {
             DP_error_set("Premature end of file");
             WebPIDelete(idec);
-            WebPFreeDecBuffer(&wdb);
+            WebPFreeDecBuffer(wdb);
             return NULL;
         }
         else {
@@ -73,7 +83,7 @@ DP_Image *DP_image_webp_read(DP_Input *input)
                 DP_error_set("Decode error %d (%s)", (int)status,
                              status_code_to_string(status));
                 WebPIDelete(idec);
-                WebPFreeDecBuffer(&wdb);
+                WebPFreeDecBuffer(wdb);
                 return NULL;
             }
         }
@@ -82,13 +92,13 @@ DP_Image *DP_image_webp_read(DP_Input *input)
     WebPIDelete(idec);
 
     DP_Image *img;
-    int w = wdb.width;
-    int h = wdb.height;
+    int w = wdb->width;
+    int h = wdb->height;
     if (w > 0 && h > 0) {
         img = DP_image_new(w, h);
         DP_Pixel8 *pixels = DP_image_pixels(img);
-        const uint8_t *rgba = wdb.u.RGBA.rgba;
-        size_t rgba_stride = DP_int_to_size(wdb.u.RGBA.stride);
+        const uint8_t *rgba = wdb->u.RGBA.rgba;
+        size_t rgba_stride = DP_int_to_size(wdb->u.RGBA.stride);
         size_t img_stride = DP_int_to_size(w) * (size_t)4;
         if (rgba_stride == img_stride) {
             memcpy(pixels, rgba, img_stride * DP_int_to_size(h));
@@ -105,7 +115,7 @@ DP_Image *DP_image_webp_read(DP_Input *input)
         DP_error_set("Image has a size of zero");
     }
 
-    WebPFreeDecBuffer(&wdb);
+    WebPFreeDecBuffer(wdb);
     return img;
 }
 
@@ -158,6 +168,9 @@ bool DP_image_webp_write(DP_Output *output, int width, int height,
     }
 
     config.lossless = lossless;
+    if (width * height >= DP_WEBP_THREADED_MIN_PIXELS) {
+        config.thread_level = 1;
+    }
     if (!WebPValidateConfig(&config)) {
         DP_error_set("Error validating encoding config");
         return false;
@@ -84,6 +84,8 @@ typedef enum DP_ReadOraExpect {
     DP_READ_ORA_EXPECT_ROOT_STACK_OR_ANNOTATIONS_OR_TIMELINE,
     DP_READ_ORA_EXPECT_STACK_OR_LAYER,
     DP_READ_ORA_EXPECT_LAYER_END,
+    DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE,
+    DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE_END,
     DP_READ_ORA_EXPECT_IMAGE_END,
     DP_READ_ORA_EXPECT_ANNOTATION,
     DP_READ_ORA_EXPECT_ANNOTATION_CONTENT,
@@ -156,6 +158,8 @@ typedef struct DP_ReadOraContext {
     size_t text_capacity;
     size_t text_len;
     char *text;
+    DP_TransientLayerContent *sparse_tlc;
+    DP_Vector sparse_pieces;
 } DP_ReadOraContext;
 
 static void dispose_child(void *element)
@@ -508,19 +512,33 @@ static bool ora_try_load_background_tile(DP_ReadOraContext *c,
     return true;
 }
 
-struct DP_OraLoadLayerContentParams {
-    DP_TransientLayerContent *tlc;
+typedef struct DP_OraLoadLayerPiece {
     DP_ZipReaderFile *zrf;
     int x, y;
+} DP_OraLoadLayerPiece;
+
+struct DP_OraLoadLayerContentParams {
+    DP_TransientLayerContent *tlc;
+    // Sparse layers consist of multiple pieces, which are all loaded by the
+    // same job so that there's no concurrent writes to the layer content.
+    int piece_count;
+    DP_OraLoadLayerPiece *pieces;
+    DP_OraLoadLayerPiece piece;
 };
 
-static void ora_load_layer_content_job(void *user, DP_UNUSED int thread_index)
+static void dispose_sparse_piece(void *element)
 {
-    struct DP_OraLoadLayerContentParams *params = user;
-    DP_Image *img = ora_load_png_free(params->zrf);
+    DP_OraLoadLayerPiece *piece = element;
+    DP_zip_reader_file_free(piece->zrf);
+}
+
+static void ora_load_layer_piece(DP_TransientLayerContent *tlc,
+                                 DP_OraLoadLayerPiece *piece)
+{
+    DP_Image *img = ora_load_png_free(piece->zrf);
     if (img) {
-        DP_transient_layer_content_put_image(
-            params->tlc, 1, DP_BLEND_MODE_REPLACE, params->x, params->y, img);
+        DP_transient_layer_content_put_image(tlc, 1, DP_BLEND_MODE_REPLACE,
+                                             piece->x, piece->y, img);
         DP_image_free(img);
     }
     else {
@@ -528,29 +546,61 @@ static void ora_load_layer_content_job(void *user, DP_UNUSED int thread_index)
     }
 }
 
-static void ora_load_layer_content_in_worker(DP_ReadOraContext *c,
-                                             DP_XmlElement *element,
-                                             DP_TransientLayerContent *tlc)
+static void ora_load_layer_content_job(void *user, DP_UNUSED int thread_index)
+{
+    struct DP_OraLoadLayerContentParams *params = user;
+    if (params->pieces) {
+        for (int i = 0; i < params->piece_count; ++i) {
+            ora_load_layer_piece(params->tlc, &params->pieces[i]);
+        }
+        DP_free(params->pieces);
+    }
+    else {
+        ora_load_layer_piece(params->tlc, &params->piece);
+    }
+}
+
+static void
+ora_push_layer_content_job(DP_ReadOraContext *c,
+                           struct DP_OraLoadLayerContentParams *params)
+{
+    if (c->worker) {
+        DP_worker_push(c->worker, params);
+    }
+    else {
+        ora_load_layer_content_job(params, 0);
+    }
+}
+
+static bool ora_read_layer_piece(DP_ReadOraContext *c, DP_XmlElement *element,
+                                 DP_OraLoadLayerPiece *out_piece)
 {
     const char *src = DP_xml_element_attribute(element, NULL, "src");
     if (!src) {
-        return;
+        return false;
     }
 
     DP_ZipReaderFile *zrf = DP_zip_reader_read_file(c->zr, src);
     if (!zrf) {
         DP_warn("ORA source '%s' not found in archive", src);
-        return;
+        return false;
     }
 
-    struct DP_OraLoadLayerContentParams params = {tlc, zrf, 0, 0};
-    ora_read_int_attribute(element, NULL, "x", INT32_MIN, INT32_MAX, &params.x);
-    ora_read_int_attribute(element, NULL, "y", INT32_MIN, INT32_MAX, &params.y);
-    if (c->worker) {
-        DP_worker_push(c->worker, &params);
-    }
-    else {
-        ora_load_layer_content_job(&params, 0);
+    *out_piece = (DP_OraLoadLayerPiece){zrf, 0, 0};
+    ora_read_int_attribute(element, NULL, "x", INT32_MIN, INT32_MAX,
+                           &out_piece->x);
+    ora_read_int_attribute(element, NULL, "y", INT32_MIN, INT32_MAX,
+                           &out_piece->y);
+    return true;
+}
+
+static void ora_load_layer_content_in_worker(DP_ReadOraContext *c,
+                                             DP_XmlElement *element,
+                                             DP_TransientLayerContent *tlc)
+{
+    struct DP_OraLoadLayerContentParams params = {tlc, 0, NULL, {NULL, 0, 0}};
+    if (ora_read_layer_piece(c, element, &params.piece)) {
+        ora_push_layer_content_job(c, &params);
     }
 }
 
@@ -596,6 +646,60 @@ static bool ora_handle_layer(DP_ReadOraContext *c, DP_XmlElement *element)
     return true;
 }
 
+// Sparse layers are a single layer saved as a stack of tile-aligned pieces,
+// so that mostly empty layers don't need a PNG covering the entire canvas.
+static bool ora_handle_sparse_layer(DP_ReadOraContext *c,
+                                    DP_XmlElement *element)
+{
+    int element_id =
+        ora_get_next_id(&c->next_layer_id, DP_LAYER_ELEMENT_ID_MAX);
+    if (element_id == -1) {
+        return false;
+    }
+
+    int layer_id = DP_layer_id_make(1u, element_id);
+    DP_TransientLayerContent *tlc = DP_transient_layer_content_new_init(
+        DP_transient_canvas_state_width(c->tcs),
+        DP_transient_canvas_state_height(c->tcs), NULL);
+    DP_TransientLayerProps *tlp =
+        ora_make_layer_props(element, layer_id, false);
+
+    push_layer_children(c, (DP_ReadOraChildren){.tlc = tlc, .tlp = tlp});
+    ora_handle_fixed_layer(c, element, layer_id);
+    c->sparse_tlc = tlc;
+    c->expect = DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE;
+    return true;
+}
+
+static void ora_handle_sparse_layer_piece(DP_ReadOraContext *c,
+                                          DP_XmlElement *element)
+{
+    DP_OraLoadLayerPiece piece;
+    if (ora_read_layer_piece(c, element, &piece)) {
+        DP_VECTOR_PUSH_TYPE(&c->sparse_pieces, DP_OraLoadLayerPiece, piece);
+    }
+    c->expect = DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE_END;
+}
+
+static void ora_handle_sparse_layer_end(DP_ReadOraContext *c)
+{
+    size_t count = c->sparse_pieces.used;
+    if (count != 0) {
+        size_t size = sizeof(DP_OraLoadLayerPiece) * count;
+        DP_OraLoadLayerPiece *pieces = DP_malloc(size);
+        memcpy(pieces, c->sparse_pieces.elements, size);
+        c->sparse_pieces.used = 0;
+        struct DP_OraLoadLayerContentParams params = {
+            c->sparse_tlc, DP_size_to_int(count), pieces, {NULL, 0, 0}};
+        // Layer content loading is slow, so we do it asynchronously in a
+        // worker. These workers are joined before the canvas state is
+        // persisted/freed.
+        ora_push_layer_content_job(c, &params);
+    }
+    c->sparse_tlc = NULL;
+    c->expect = DP_READ_ORA_EXPECT_STACK_OR_LAYER;
+}
+
 static bool ora_is_maybe_clipping_group(DP_XmlElement *element)
 {
     if (ora_read_bool_attribute(element, DRAWPILE_NAMESPACE,
@@ -1079,7 +1183,13 @@ static bool ora_xml_start_element(void *user, DP_XmlElement *element)
             return ora_handle_layer(c, element);
         }
         else if (DP_xml_element_name_equals(element, NULL, "stack")) {
-            return ora_handle_stack(c, element);
+            if (ora_read_bool_attribute(element, DRAWPILE_NAMESPACE,
+                                        "sparse-layer")) {
+                return ora_handle_sparse_layer(c, element);
+            }
+            else {
+                return ora_handle_stack(c, element);
+            }
         }
         else if (DP_xml_element_name_equals(element, DRAWPILE_NAMESPACE,
                                             "annotations")) {
@@ -1100,6 +1210,23 @@ static bool ora_xml_start_element(void *user, DP_XmlElement *element)
                  DP_xml_element_name(element));
         ++c->garbage_depth;
         break;
+    case DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE:
+        if (DP_xml_element_name_equals(element, NULL, "layer")) {
+            ora_handle_sparse_layer_piece(c, element);
+        }
+        else {
+            DP_debug("Expected sparse layer <layer>, got <%s:%s>",
+                     DP_xml_element_namespace(element),
+                     DP_xml_element_name(element));
+            ++c->garbage_depth;
+        }
+        break;
+    case DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE_END:
+        DP_debug("Expected sparse layer </layer>, got <%s:%s>",
+                 DP_xml_element_namespace(element),
+                 DP_xml_element_name(element));
+        ++c->garbage_depth;
+        break;
     case DP_READ_ORA_EXPECT_IMAGE_END:
         DP_debug("Expected </image>, got <%s:%s>",
                  DP_xml_element_namespace(element),
@@ -1218,6 +1345,12 @@ static bool ora_xml_end_element(void *user)
     case DP_READ_ORA_EXPECT_LAYER_END:
         c->expect = DP_READ_ORA_EXPECT_STACK_OR_LAYER;
         break;
+    case DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE:
+        ora_handle_sparse_layer_end(c);
+        break;
+    case DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE_END:
+        c->expect = DP_READ_ORA_EXPECT_SPARSE_LAYER_PIECE;
+        break;
     case DP_READ_ORA_EXPECT_IMAGE_END:
         c->expect = DP_READ_ORA_EXPECT_ROOT_STACK_OR_ANNOTATIONS_OR_TIMELINE;
         break;
@@ -1332,10 +1465,13 @@ static DP_CanvasState *load_ora(DP_DrawContext *dc, const char *path,
         0,
         0,
         NULL,
+        NULL,
+        DP_VECTOR_NULL,
     };
     DP_VECTOR_INIT_TYPE(&c.groups, DP_ReadOraGroup, 8);
     DP_VECTOR_INIT_TYPE(&c.children, DP_ReadOraChildren, 8);
     DP_VECTOR_INIT_TYPE(&c.annotations, DP_Annotation *, 8);
+    DP_VECTOR_INIT_TYPE(&c.sparse_pieces, DP_OraLoadLayerPiece, 8);
     DP_CanvasState *cs = ora_read_stack_xml(&c, flags);
     DP_VECTOR_CLEAR_DISPOSE_TYPE(&c.children, DP_ReadOraChildren,
                                  dispose_child);
@@ -1343,6 +1479,8 @@ static DP_CanvasState *load_ora(DP_DrawContext *dc, const char *path,
     DP_VECTOR_CLEAR_DISPOSE_TYPE(&c.annotations, DP_Annotation *,
                                  dispose_annotation);
     DP_VECTOR_CLEAR_DISPOSE_TYPE(&c.tracks, DP_ReadOraTrack, dispose_track);
+    DP_VECTOR_CLEAR_DISPOSE_TYPE(&c.sparse_pieces, DP_OraLoadLayerPiece,
+                                 dispose_sparse_piece);
     DP_free(c.text);
     DP_zip_reader_free(zr);
     if (cs) {
@@ -1460,7 +1598,7 @@ static DP_CanvasState *load(DP_DrawContext *dc, const char *path,
                             void *copy_dpcs_user, DP_LoadResult *out_result,
                             DP_SaveImageType *out_type)
 {
-    DP_Input *input = DP_file_input_new_from_path(path);
+    DP_Input *input = DP_file_input_new_mapped_from_path(path);
     if (!input) {
         assign_load_result(out_result, DP_LOAD_RESULT_OPEN_ERROR);
         assign_type(out_type, DP_SAVE_IMAGE_UNKNOWN);
@@ -1604,7 +1742,7 @@ DP_Player *DP_load_recording(const char *path, DP_LoadResult *out_result)
 {
     if (path) {
         DP_PERF_BEGIN_DETAIL(fn, "recording", "path=%s", path);
-        DP_Input *input = DP_file_input_new_from_path(path);
+        DP_Input *input = DP_file_input_new_mapped_from_path(path);
         DP_Player *player;
         if (input) {
             player =
@@ -1616,6 +1754,9 @@ DP_Player *DP_load_recording(const char *path, DP_LoadResult *out_result)
                 assign_load_result(out_result,
                                    DP_LOAD_RESULT_RECORDING_INCOMPATIBLE);
             }
+            else if (player) {
+                DP_player_read_ahead_set(player, DP_PLAYER_READ_AHEAD_DEFAULT);
+            }
         }
         else {
             player = NULL;
@@ -1634,7 +1775,7 @@ DP_Player *DP_load_debug_dump(const char *path, DP_LoadResult *out_result)
 {
     if (path) {
         DP_PERF_BEGIN_DETAIL(fn, "dump", "path=%s", path);
-        DP_Input *input = DP_file_input_new_from_path(path);
+        DP_Input *input = DP_file_input_new_mapped_from_path(path);
         DP_Player *player;
         if (input) {
             return DP_player_new(DP_PLAYER_TYPE_DEBUG_DUMP, NULL, input,
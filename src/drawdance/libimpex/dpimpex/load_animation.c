@@ -359,7 +359,7 @@ DP_CanvasState *DP_load_animation_layers(
     unsigned int flags, DP_LoadAnimationSetGroupTitleFn set_group_title,
     DP_LoadAnimationSetTrackTitleFn set_track_title, DP_LoadResult *out_result)
 {
-    DP_Input *input = DP_file_input_new_from_path(path);
+    DP_Input *input = DP_file_input_new_mapped_from_path(path);
     if (!input) {
         assign_load_result(out_result, DP_LOAD_RESULT_OPEN_ERROR);
         return NULL;
@@ -4,6 +4,8 @@ extern "C" {
 #include "utf16be.h"
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/image.h>
 #include <dpengine/layer_content.h>
@@ -11,6 +13,7 @@ extern "C" {
 #include <dpengine/layer_list.h>
 #include <dpengine/layer_props.h>
 #include <dpengine/layer_props_list.h>
+#include <dpengine/tile.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/ids.h>
 }
@@ -38,13 +41,14 @@ extern "C" {
 class DP_PsdFile final : public psd::File {
   public:
     DP_PsdFile(psd::Allocator *allocator)
-        : psd::File(allocator), m_input(nullptr)
+        : psd::File(allocator), m_input(nullptr), m_mutex(DP_mutex_new())
     {
     }
 
     ~DP_PsdFile() override
     {
         DP_input_free(m_input);
+        DP_mutex_free(m_mutex);
     }
 
     DP_PsdFile(const DP_PsdFile &) = delete;
@@ -52,6 +56,12 @@ class DP_PsdFile final : public psd::File {
     DP_PsdFile &operator=(const DP_PsdFile &) = delete;
     DP_PsdFile &operator=(DP_PsdFile &&) = delete;
 
+    // Without a mutex, reads can't happen on multiple threads.
+    bool threadsafe() const
+    {
+        return m_mutex != nullptr;
+    }
+
   private:
     bool DoOpenRead(void *user) override
     {
@@ -76,13 +86,25 @@ class DP_PsdFile final : public psd::File {
     {
         if (count != 0) {
             DP_ASSERT(buffer);
-            if (!DP_input_seek(m_input, DP_uint64_to_size(position))) {
-                return nullptr;
+            // Layers get extracted on multiple threads, the seek and read
+            // must happen together.
+            if (m_mutex) {
+                DP_MUTEX_MUST_LOCK(m_mutex);
             }
-
             bool error;
             size_t size = DP_uint32_to_size(count);
-            size_t read = DP_input_read(m_input, buffer, size, &error);
+            size_t read;
+            if (DP_input_seek(m_input, DP_uint64_to_size(position))) {
+                read = DP_input_read(m_input, buffer, size, &error);
+            }
+            else {
+                error = true;
+                read = 0;
+            }
+            if (m_mutex) {
+                DP_MUTEX_MUST_UNLOCK(m_mutex);
+            }
+
             if (error) {
                 DP_warn("Error reading %u bytes from PSD: %s", count,
                         DP_error());
@@ -113,6 +135,7 @@ class DP_PsdFile final : public psd::File {
     }
 
     DP_Input *m_input;
+    DP_Mutex *m_mutex;
 };
 
 struct DP_PsdLayerPair {
@@ -234,6 +257,14 @@ static void apply_layer_props(DP_TransientLayerProps *tlp, psd::Layer *layer)
     }
 }
 
+struct DP_PsdExtractLayerParams {
+    psd::Document *document;
+    psd::File *file;
+    psd::Allocator *allocator;
+    psd::Layer *layer;
+    DP_TransientLayerContent *tlc;
+};
+
 static void combine8(int size, DP_Pixel8 *pixels, const uint8_t *a,
                      const uint8_t *r, const uint8_t *g, const uint8_t *b)
 {
@@ -243,7 +274,63 @@ static void combine8(int size, DP_Pixel8 *pixels, const uint8_t *a,
         pixel.bytes.r = r ? r[i] : 0;
         pixel.bytes.g = g ? g[i] : 0;
         pixel.bytes.b = b ? b[i] : 0;
-        pixels[i] = DP_pixel8_premultiply(pixel);
+        pixels[i].color = pixel.color;
+    }
+    DP_pixels8_premultiply(pixels, size);
+}
+
+static const uint8_t *channel_row(void *data, int offset)
+{
+    return data ? static_cast<const uint8_t *>(data) + offset : nullptr;
+}
+
+// Converts the layer's channels straight into tiles, a row segment at a time,
+// rather than combining them into a full-size image first and putting that.
+static void put_layer_tiles(DP_TransientLayerContent *tlc, int left, int top,
+                            int right, int bottom, void *a, void *r, void *g,
+                            void *b)
+{
+    int canvas_width = DP_transient_layer_content_width(tlc);
+    int canvas_height = DP_transient_layer_content_height(tlc);
+    int x0 = DP_max_int(left, 0);
+    int y0 = DP_max_int(top, 0);
+    int x1 = DP_min_int(right, canvas_width);
+    int y1 = DP_min_int(bottom, canvas_height);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    int width = right - left;
+    DP_Pixel8 row[DP_TILE_SIZE];
+    for (int ty = y0 / DP_TILE_SIZE; ty * DP_TILE_SIZE < y1; ++ty) {
+        int tile_top = ty * DP_TILE_SIZE;
+        int ys = DP_max_int(y0, tile_top);
+        int ye = DP_min_int(y1, tile_top + DP_TILE_SIZE);
+        for (int tx = x0 / DP_TILE_SIZE; tx * DP_TILE_SIZE < x1; ++tx) {
+            int tile_left = tx * DP_TILE_SIZE;
+            int xs = DP_max_int(x0, tile_left);
+            int count = DP_min_int(x1, tile_left + DP_TILE_SIZE) - xs;
+
+            DP_TransientTile *tt = DP_transient_tile_new_blank(1);
+            DP_Pixel15 *pixels = DP_transient_tile_pixels(tt);
+            for (int y = ys; y < ye; ++y) {
+                int offset = (y - top) * width + (xs - left);
+                combine8(count, row, channel_row(a, offset),
+                         channel_row(r, offset), channel_row(g, offset),
+                         channel_row(b, offset));
+                DP_pixels8_to_15(pixels + (y - tile_top) * DP_TILE_SIZE
+                                     + (xs - tile_left),
+                                 row, count);
+            }
+
+            if (DP_transient_tile_blank(tt)) {
+                DP_transient_tile_decref(tt);
+            }
+            else {
+                DP_transient_layer_content_transient_tile_at_set_noinc(
+                    tlc, tx, ty, tt);
+            }
+        }
     }
 }
 
@@ -293,28 +380,38 @@ static void extract_layer_pixels(psd::Document *document, psd::Layer *layer,
         }
     }
     if (a || r || g || b) {
-        int width = right - left;
-        int height = bottom - top;
-        int size = width * height;
-        DP_Image *img = DP_image_new(width, height);
-        DP_Pixel8 *pixels = DP_image_pixels(img);
         switch (document->bitsPerChannel) {
         case 8:
-            combine8(size, pixels, static_cast<uint8_t *>(a),
-                     static_cast<uint8_t *>(r), static_cast<uint8_t *>(g),
-                     static_cast<uint8_t *>(b));
+            put_layer_tiles(tlc, left, top, right, bottom, a, r, g, b);
             break;
         default:
             DP_UNREACHABLE();
         }
-        DP_transient_layer_content_put_image(tlc, 1, DP_BLEND_MODE_REPLACE,
-                                             left, top, img);
-        DP_image_free(img);
     }
 }
 
-static DP_PsdLayerPair extract_layer_content(psd::Document *document,
-                                             int &element_id, psd::Layer *layer)
+static void extract_layer_job(void *user, DP_UNUSED int thread_index)
+{
+    DP_PsdExtractLayerParams *params =
+        static_cast<DP_PsdExtractLayerParams *>(user);
+    psd::Allocator *allocator = params->allocator;
+    psd::Layer *layer = params->layer;
+    psd::ExtractLayer(params->document, params->file, allocator, layer);
+    extract_layer_pixels(params->document, layer, params->tlc);
+    // The channels aren't needed anymore, so don't keep them around until the
+    // whole layer section gets destroyed.
+    unsigned int channel_count = layer->channelCount;
+    for (unsigned int i = 0; i < channel_count; ++i) {
+        psd::Channel *channel = &layer->channels[i];
+        allocator->Free(channel->data);
+        channel->data = nullptr;
+    }
+}
+
+static DP_PsdLayerPair
+extract_layer_content(psd::Document *document, psd::File *file,
+                      psd::Allocator *allocator, DP_Worker *worker,
+                      int &element_id, psd::Layer *layer)
 {
     DP_PsdLayerPair p;
     int layer_id = DP_layer_id_make(1u, element_id++);
@@ -323,14 +420,23 @@ static DP_PsdLayerPair extract_layer_content(psd::Document *document,
 
     p.t.lc = DP_transient_layer_content_new_init(
         int(document->width), int(document->height), nullptr);
-    extract_layer_pixels(document, layer, p.t.lc);
+
+    DP_PsdExtractLayerParams params = {document, file, allocator, layer,
+                                       p.t.lc};
+    if (worker) {
+        DP_worker_push(worker, &params);
+    }
+    else {
+        extract_layer_job(&params, 0);
+    }
 
     return p;
 }
 
 static std::vector<DP_PsdLayerPair> extract_layers_recursive(
     psd::Document *document, psd::File *file, psd::Allocator *allocator,
-    psd::LayerMaskSection *section, unsigned int &i, int &element_id);
+    DP_Worker *worker, psd::LayerMaskSection *section, unsigned int &i,
+    int &element_id);
 
 static std::pair<DP_TransientLayerPropsList *, DP_TransientLayerList *>
 build_layer_lists(const std::vector<DP_PsdLayerPair> &layers)
@@ -359,15 +465,15 @@ build_layer_lists(const std::vector<DP_PsdLayerPair> &layers)
     return {tlpl, tll};
 }
 
-static DP_PsdLayerPair extract_layer_group(psd::Document *document,
-                                           psd::File *file,
-                                           psd::Allocator *allocator,
-                                           psd::LayerMaskSection *section,
-                                           unsigned int &i, int &element_id)
+static DP_PsdLayerPair
+extract_layer_group(psd::Document *document, psd::File *file,
+                    psd::Allocator *allocator, DP_Worker *worker,
+                    psd::LayerMaskSection *section, unsigned int &i,
+                    int &element_id)
 {
     int group_id = DP_layer_id_make(1u, element_id++);
     std::vector<DP_PsdLayerPair> layers = extract_layers_recursive(
-        document, file, allocator, section, i, element_id);
+        document, file, allocator, worker, section, i, element_id);
 
     auto [tlpl, tll] = build_layer_lists(layers);
 
@@ -386,7 +492,8 @@ static DP_PsdLayerPair extract_layer_group(psd::Document *document,
 
 static std::vector<DP_PsdLayerPair> extract_layers_recursive(
     psd::Document *document, psd::File *file, psd::Allocator *allocator,
-    psd::LayerMaskSection *section, unsigned int &i, int &element_id)
+    DP_Worker *worker, psd::LayerMaskSection *section, unsigned int &i,
+    int &element_id)
 {
     std::vector<DP_PsdLayerPair> layers;
     while (i < section->layerCount) {
@@ -396,7 +503,8 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
             // Start of a new group.
             ++i;
             layers.push_back(extract_layer_group(document, file, allocator,
-                                                 section, i, element_id));
+                                                 worker, section, i,
+                                                 element_id));
         }
         else if (type == psd::layerType::OPEN_FOLDER
                  || type == psd::layerType::CLOSED_FOLDER) {
@@ -406,9 +514,8 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
         else {
             // Regular layer.
             ++i;
-            psd::ExtractLayer(document, file, allocator, layer);
-            layers.push_back(
-                extract_layer_content(document, element_id, layer));
+            layers.push_back(extract_layer_content(
+                document, file, allocator, worker, element_id, layer));
         }
     }
     return layers;
@@ -416,21 +523,26 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
 
 static DP_TransientCanvasState *extract_layers(psd::Document *document,
                                                psd::File *file,
-                                               psd::Allocator *allocator)
+                                               psd::Allocator *allocator,
+                                               DP_Worker *worker)
 {
     psd::LayerMaskSection *section =
         psd::ParseLayerMaskSection(document, file, allocator);
     if (!section) {
         DP_error_set("Failed to read layers section from PSD");
+        DP_worker_free_join(worker);
         return nullptr;
     }
 
     unsigned int i = 0;
     int element_id = 0;
     std::vector<DP_PsdLayerPair> layers = extract_layers_recursive(
-        document, file, allocator, section, i, element_id);
+        document, file, allocator, worker, section, i, element_id);
     auto [tlpl, tll] = build_layer_lists(layers);
 
+    // The jobs refer to the layers in the section, so they must finish before
+    // it gets destroyed.
+    DP_worker_free_join(worker);
     psd::DestroyLayerMaskSection(section, allocator);
 
     DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
@@ -491,7 +603,19 @@ extern "C" DP_CanvasState *DP_load_psd(DP_DrawContext *dc, DP_Input *input,
         return nullptr;
     }
 
-    DP_TransientCanvasState *tcs = extract_layers(document, &file, &allocator);
+    // Reading and decoding the channels of each layer happens on the worker,
+    // the file serializes the actual reads.
+    DP_Worker *worker = nullptr;
+    if (file.threadsafe()) {
+        worker = DP_worker_new(64, sizeof(DP_PsdExtractLayerParams),
+                               DP_worker_cpu_count(32), extract_layer_job);
+        if (!worker) {
+            DP_warn("Error creating worker: %s", DP_error());
+        }
+    }
+
+    DP_TransientCanvasState *tcs =
+        extract_layers(document, &file, &allocator, worker);
     psd::DestroyDocument(document, &allocator);
     file.Close();
     if (tcs) {
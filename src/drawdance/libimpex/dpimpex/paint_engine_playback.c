@@ -349,6 +349,57 @@ DP_PlayerResult DP_paint_engine_playback_play(
                                  filter_message_or_null, push_message, user);
 }
 
+DP_PlayerResult DP_player_playback_guess_msecs(
+    DP_Player *player, DP_PaintEngineFilterMessageFn filter_message_or_null,
+    void *user, long long *out_msecs)
+{
+    DP_ASSERT(player);
+    DP_ASSERT(out_msecs);
+    // Same timing as the millisecond playback above, but without handling any
+    // of the messages. Used to estimate how long playing back takes.
+    long long msecs = 0;
+    bool next_has_time = true;
+    while (true) {
+        DP_Message *msg;
+        DP_PlayerResult result = DP_player_step(player, true, &msg);
+        if (result == DP_PLAYER_SUCCESS) {
+            bool should_time = true;
+            if (filter_message_or_null) {
+                unsigned int flags = filter_message_or_null(user, msg);
+                if (flags & DP_PAINT_ENGINE_FILTER_MESSAGE_FLAG_NO_TIME) {
+                    should_time = false;
+                }
+            }
+
+            DP_MessageType type = DP_message_type(msg);
+            if (type == DP_MSG_INTERVAL) {
+                if (should_time) {
+                    DP_MsgInterval *mi = DP_message_internal(msg);
+                    msecs += DP_min_int(1000, DP_msg_interval_msecs(mi));
+                }
+            }
+            else if (next_has_time) {
+                long long message_msecs =
+                    guess_message_msecs(msg, type, &next_has_time);
+                if (should_time) {
+                    msecs += message_msecs;
+                }
+            }
+            else {
+                next_has_time = true;
+            }
+            DP_message_decref(msg);
+        }
+        else if (result == DP_PLAYER_ERROR_PARSE) {
+            DP_warn("Can't guess message time: %s", DP_error());
+        }
+        else {
+            *out_msecs = msecs;
+            return result;
+        }
+    }
+}
+
 bool DP_paint_engine_playback_index_build(
     DP_PaintEngine *pe, DP_DrawContext *dc,
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
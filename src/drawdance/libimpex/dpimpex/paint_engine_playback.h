@@ -26,6 +26,13 @@ DP_PlayerResult DP_paint_engine_playback_play(
     DP_PaintEngineFilterMessageFn filter_message_or_null,
     DP_PaintEnginePushMessageFn push_message, void *user);
 
+// Steps through the rest of the recording and sums up how many milliseconds
+// playing it back via DP_paint_engine_playback_play would take. Returns
+// DP_PLAYER_RECORDING_END if it got through the whole thing.
+DP_PlayerResult DP_player_playback_guess_msecs(
+    DP_Player *player, DP_PaintEngineFilterMessageFn filter_message_or_null,
+    void *user, long long *out_msecs);
+
 bool DP_paint_engine_playback_index_build(
     DP_PaintEngine *pe, DP_DrawContext *dc,
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
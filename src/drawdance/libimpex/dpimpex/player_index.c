@@ -1,19 +1,25 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "player_index.h"
 #include "image_impex.h"
+#include "image_png.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
+#include <dpcommon/worker.h>
 #include <dpengine/annotation.h>
 #include <dpengine/annotation_list.h>
 #include <dpengine/canvas_history.h>
 #include <dpengine/document_metadata.h>
 #include <dpengine/draw_context.h>
 #include <dpengine/dump_reader.h>
+#include <dpengine/history_blocks.h>
 #include <dpengine/image.h>
 #include <dpengine/key_frame.h>
 #include <dpengine/layer_content.h>
@@ -23,13 +29,18 @@
 #include <dpengine/layer_props_list.h>
 #include <dpengine/local_state.h>
 #include <dpengine/player.h>
+#include <dpengine/recorder.h>
+#include <dpengine/seekable_zstd.h>
 #include <dpengine/tile.h>
 #include <dpengine/timeline.h>
 #include <dpengine/track.h>
 #include <dpmsg/acl.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/message_queue.h>
 #include <dpmsg/protover.h>
+#include <dpmsg/reset_stream.h>
 #include <dpmsg/text_reader.h>
 #include <parson.h>
 #include <uthash_inc.h>
@@ -41,6 +52,12 @@
 #define INDEX_VERSION_LENGTH  2
 #define INDEX_HEADER_LENGTH   (INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH + 12)
 #define INITAL_ENTRY_CAPACITY 64
+// How many snapshots the replay may get ahead of their serialization.
+#define MAX_QUEUED_SNAPSHOTS  4
+
+// Offset of the keyframe data within a recorded keyframe message: the message
+// header, the data type, the recipient and the kind.
+#define KEYFRAME_DATA_OFFSET (DP_MESSAGE_HEADER_LENGTH + 3)
 
 static_assert(INDEX_MAGIC_LENGTH < sizeof(DP_OutputBinaryEntry),
               "index header fits into output binary entry");
@@ -57,6 +74,24 @@ typedef struct DP_BuildIndexTileMap {
     UT_hash_handle hh;
 } DP_BuildIndexTileMap;
 
+// Tiles written anywhere in the index so far, by content. Lets snapshots
+// refer to tiles that went away and then came back, like after an undo, or
+// that repeat in a different place entirely, rather than writing them again.
+typedef struct DP_BuildIndexContentMap {
+    uint64_t hash;
+    DP_Tile *t;
+    size_t offset;
+    UT_hash_handle hh;
+} DP_BuildIndexContentMap;
+
+typedef struct DP_BuildIndexCompressedTile {
+    DP_Tile *t;
+    uint64_t hash;
+    size_t size;
+    unsigned char *data;
+    UT_hash_handle hh;
+} DP_BuildIndexCompressedTile;
+
 typedef struct DP_BuildIndexLayerKey {
     union {
         DP_LayerContent *lc;
@@ -91,15 +126,24 @@ typedef struct DP_BuildIndexMaps {
     } timeline;
 } DP_BuildIndexMaps;
 
+// Everything a snapshot needs, taken from the replay so that it can be
+// serialized on another thread while the replay keeps going.
+typedef struct DP_BuildIndexJob {
+    long long message_index;
+    size_t message_offset;
+    DP_CanvasState *cs;
+    DP_Vector messages;
+} DP_BuildIndexJob;
+
 typedef struct DP_BuildIndexEntryContext {
     DP_Output *output;
-    DP_AclState *acls;
-    DP_LocalState *local_state;
-    DP_CanvasHistory *ch;
+    DP_BuildIndexJob *job;
     DP_CanvasState *cs;
     DP_DrawContext *dc;
     DP_BuildIndexMaps current;
     DP_BuildIndexMaps *last;
+    DP_BuildIndexCompressedTile *compressed;
+    DP_BuildIndexContentMap **contents;
     int message_count;
     struct {
         size_t history;
@@ -114,6 +158,12 @@ typedef struct DP_BuildIndexEntryContext {
     } annotation;
 } DP_BuildIndexEntryContext;
 
+struct DP_BuildIndexCompressJob {
+    DP_BuildIndexEntryContext *e;
+    DP_BuildIndexCompressedTile *ct;
+    DP_Pixel8 *pixel_buffers;
+};
+
 typedef struct DP_BuildIndexContext {
     DP_Player *player;
     DP_Output *output;
@@ -124,9 +174,20 @@ typedef struct DP_BuildIndexContext {
     long long message_count;
     DP_Vector entries;
     DP_BuildIndexMaps last;
+    DP_BuildIndexContentMap *contents;
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn;
     DP_PlayerIndexProgressFn progress_fn;
     void *user;
+    struct {
+        DP_Thread *thread;
+        DP_DrawContext *dc;
+        DP_Mutex *mutex;
+        DP_Semaphore *sem_queued;
+        DP_Semaphore *sem_space;
+        DP_Queue queue;
+        DP_Atomic failed;
+        char *error;
+    } serializer;
 } DP_BuildIndexContext;
 
 struct DP_BuildIndexLayerProps {
@@ -181,21 +242,6 @@ static bool write_index_history_message_dec(DP_BuildIndexEntryContext *e,
     }
 }
 
-static bool init_reset_image(void *user, DP_CanvasState *cs)
-{
-    DP_BuildIndexEntryContext *e = user;
-    e->cs = cs;
-    return write_index_history_message_dec(
-               e, DP_acl_state_msg_feature_access_all_new(0))
-        && write_index_history_message_dec(
-               e, DP_acl_state_msg_feature_limits_none_new(0));
-}
-
-static bool write_reset_image_message(void *user, DP_Message *msg)
-{
-    return write_index_history_message_dec(user, msg);
-}
-
 static bool write_index_history(DP_BuildIndexEntryContext *e)
 {
     bool error;
@@ -204,21 +250,13 @@ static bool write_index_history(DP_BuildIndexEntryContext *e)
         return false;
     }
 
-    if (!DP_canvas_history_reset_image_new(e->ch, init_reset_image,
-                                           write_reset_image_message, e)) {
-        return false;
-    }
-
-    // The state of the permissions at this point.
-    if (!DP_acl_state_reset_image_build(
-            e->acls, 0, DP_ACL_STATE_RESET_IMAGE_RECORDING_FLAGS, NULL, NULL,
-            write_reset_image_message, e)) {
-        return false;
-    }
-    // Local changes (hidden layers, local canvas background).
-    if (!DP_local_state_reset_image_build(e->local_state, e->dc,
-                                          write_reset_image_message, e)) {
-        return false;
+    DP_Vector *messages = &e->job->messages;
+    size_t count = messages->used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_Message *msg = DP_message_vector_at(messages, i);
+        if (!write_index_history_message_dec(e, DP_message_incref(msg))) {
+            return false;
+        }
     }
 
     e->offset.history = offset;
@@ -264,29 +302,220 @@ static unsigned char *get_compression_buffer(size_t size, void *user)
     return pool + sizeof(uint16_t);
 }
 
-static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
+static unsigned char *get_precompression_buffer(size_t size, void *user)
 {
-    size_t size = DP_tile_compress_deflate(
-        t, DP_draw_context_tile8_buffer(e->dc), get_compression_buffer, e->dc);
-    if (size == 0) {
-        return 0;
+    DP_BuildIndexCompressedTile *ct = user;
+    ct->data = DP_malloc(sizeof(uint16_t) + size);
+    return ct->data + sizeof(uint16_t);
+}
+
+static size_t search_tile_content(DP_BuildIndexEntryContext *e, DP_Tile *t,
+                                  uint64_t hash)
+{
+    DP_BuildIndexContentMap *entry;
+    HASH_FIND(hh, *e->contents, &hash, sizeof(hash), entry);
+    // A hash collision with different pixels just gets written separately.
+    return entry && DP_tile_pixels_equal(entry->t, t) ? entry->offset : 0;
+}
+
+static void precompress_index_tile_job(void *element, int thread_index)
+{
+    struct DP_BuildIndexCompressJob *job = element;
+    DP_BuildIndexCompressedTile *ct = job->ct;
+    DP_Pixel8 *pixel_buffer =
+        job->pixel_buffers + DP_int_to_size(thread_index) * DP_TILE_LENGTH;
+    ct->hash = DP_tile_pixels_hash(ct->t);
+    // The content map only changes while writing, so it's safe to look at
+    // here. If the tile is already in there, it won't be written again.
+    if (search_tile_content(job->e, ct->t, ct->hash) == 0) {
+        ct->size = DP_tile_compress_deflate(ct->t, pixel_buffer,
+                                            get_precompression_buffer, ct);
     }
+}
 
-    bool error;
-    size_t offset = DP_output_tell(e->output, &error);
-    if (error) {
-        return 0;
+static void free_compressed_tiles(DP_BuildIndexEntryContext *e)
+{
+    DP_BuildIndexCompressedTile *ct, *tmp;
+    HASH_ITER(hh, e->compressed, ct, tmp) {
+        HASH_DEL(e->compressed, ct);
+        DP_free(ct->data);
+        DP_free(ct);
     }
+}
 
-    unsigned char *buffer = DP_draw_context_pool(e->dc);
+static bool write_compressed_tile(DP_BuildIndexEntryContext *e,
+                                  unsigned char *buffer, size_t size)
+{
     DP_write_littleendian_uint16(DP_size_to_uint16(size), buffer);
-    if (!DP_output_write(e->output, buffer, size + sizeof(uint16_t))) {
-        return 0;
+    return DP_output_write(e->output, buffer, size + sizeof(uint16_t));
+}
+
+static bool write_index_tile_content(DP_BuildIndexEntryContext *e, DP_Tile *t,
+                                     uint64_t hash, size_t offset,
+                                     DP_BuildIndexCompressedTile *ct_or_null)
+{
+    bool ok;
+    if (ct_or_null) {
+        ok = ct_or_null->size != 0
+          && write_compressed_tile(e, ct_or_null->data, ct_or_null->size);
+    }
+    else {
+        size_t size =
+            DP_tile_compress_deflate(t, DP_draw_context_tile8_buffer(e->dc),
+                                     get_compression_buffer, e->dc);
+        ok = size != 0
+          && write_compressed_tile(e, DP_draw_context_pool(e->dc), size);
+    }
+
+    if (ok) {
+        DP_BuildIndexContentMap *entry;
+        HASH_FIND(hh, *e->contents, &hash, sizeof(hash), entry);
+        if (!entry) {
+            entry = DP_malloc(sizeof(*entry));
+            entry->hash = hash;
+            entry->t = DP_tile_incref(t);
+            entry->offset = offset;
+            HASH_ADD(hh, *e->contents, hash, sizeof(entry->hash), entry);
+        }
+    }
+    return ok;
+}
+
+static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
+{
+    DP_BuildIndexCompressedTile *ct;
+    HASH_FIND_PTR(e->compressed, &t, ct);
+    if (ct) {
+        HASH_DEL(e->compressed, ct);
     }
 
+    uint64_t hash = ct ? ct->hash : DP_tile_pixels_hash(t);
+    size_t offset = search_tile_content(e, t, hash);
+    if (offset == 0) {
+        bool error;
+        offset = DP_output_tell(e->output, &error);
+        if (error || !write_index_tile_content(e, t, hash, offset, ct)) {
+            offset = 0;
+        }
+    }
+
+    if (ct) {
+        DP_free(ct->data);
+        DP_free(ct);
+    }
+
+    if (offset != 0) {
+        // Remember the tile, so that it gets reused if it shows up again.
+        DP_BuildIndexTileMap *entry = DP_malloc(sizeof(*entry));
+        entry->t = DP_tile_incref(t);
+        entry->offset = offset;
+        HASH_ADD_PTR(e->current.tiles, t, entry);
+    }
     return offset;
 }
 
+static void precompress_index_tile(DP_BuildIndexEntryContext *e,
+                                   DP_Worker *worker, DP_Pixel8 *pixel_buffers,
+                                   DP_Tile *t)
+{
+    DP_BuildIndexCompressedTile *ct;
+    bool should_compress = t && !search_tile(e->current.tiles, t)
+                        && !search_tile(e->last->tiles, t);
+    if (should_compress) {
+        HASH_FIND_PTR(e->compressed, &t, ct);
+        if (!ct) {
+            // The tile is kept alive by the canvas state being serialized.
+            ct = DP_malloc(sizeof(*ct));
+            ct->t = t;
+            ct->size = 0;
+            ct->data = NULL;
+            HASH_ADD_PTR(e->compressed, t, ct);
+            struct DP_BuildIndexCompressJob job = {e, ct, pixel_buffers};
+            DP_worker_push(worker, &job);
+        }
+    }
+}
+
+static bool is_relevant_sublayer(DP_LayerProps *sub_lp);
+
+static void precompress_index_layer_content(DP_BuildIndexEntryContext *e,
+                                            DP_Worker *worker,
+                                            DP_Pixel8 *pixel_buffers,
+                                            DP_LayerContent *lc)
+{
+    DP_LayerPropsList *sub_lpl = DP_layer_content_sub_props_noinc(lc);
+    DP_LayerList *sub_ll = DP_layer_content_sub_contents_noinc(lc);
+    int sub_count = DP_layer_props_list_count(sub_lpl);
+    for (int i = 0; i < sub_count; ++i) {
+        if (is_relevant_sublayer(DP_layer_props_list_at_noinc(sub_lpl, i))) {
+            precompress_index_layer_content(
+                e, worker, pixel_buffers,
+                DP_layer_list_content_at_noinc(sub_ll, i));
+        }
+    }
+
+    DP_TileCounts tile_counts = DP_tile_counts_round(
+        DP_layer_content_width(lc), DP_layer_content_height(lc));
+    for (int y = 0; y < tile_counts.y; ++y) {
+        for (int x = 0; x < tile_counts.x; ++x) {
+            precompress_index_tile(e, worker, pixel_buffers,
+                                   DP_layer_content_tile_at_noinc(lc, x, y));
+        }
+    }
+}
+
+static void precompress_index_layer_list(DP_BuildIndexEntryContext *e,
+                                         DP_Worker *worker,
+                                         DP_Pixel8 *pixel_buffers,
+                                         DP_LayerList *ll,
+                                         DP_LayerPropsList *lpl)
+{
+    int count = DP_layer_list_count(ll);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+            precompress_index_layer_list(e, worker, pixel_buffers,
+                                         DP_layer_group_children_noinc(lg),
+                                         child_lpl);
+        }
+        else {
+            precompress_index_layer_content(
+                e, worker, pixel_buffers,
+                DP_layer_list_entry_content_noinc(lle));
+        }
+    }
+}
+
+// Compresses the tiles that the snapshot will have to write in parallel ahead
+// of time. The writing itself has to happen in order afterwards, since each
+// tile's offset depends on everything written before it.
+static void precompress_index_tiles(DP_BuildIndexEntryContext *e)
+{
+    int thread_count = DP_worker_cpu_count(128);
+    DP_Worker *worker =
+        DP_worker_new_with_priority(
+            1024, sizeof(struct DP_BuildIndexCompressJob), thread_count,
+            DP_WORKER_PRIORITY_LOW, precompress_index_tile_job);
+    if (!worker) {
+        DP_warn("Index failed to create worker: %s", DP_error());
+        return; // Tiles will just get compressed while writing instead.
+    }
+
+    DP_Pixel8 *pixel_buffers = DP_malloc(sizeof(*pixel_buffers) * DP_TILE_LENGTH
+                                         * DP_int_to_size(thread_count));
+    DP_CanvasState *cs = e->cs;
+    precompress_index_layer_list(e, worker, pixel_buffers,
+                                 DP_canvas_state_layers_noinc(cs),
+                                 DP_canvas_state_layer_props_noinc(cs));
+    precompress_index_tile(e, worker, pixel_buffers,
+                           DP_canvas_state_background_tile_noinc(cs));
+    DP_worker_free_join(worker);
+    DP_free(pixel_buffers);
+}
+
 static bool maybe_write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t,
                                    size_t *out_offset)
 {
@@ -839,7 +1068,8 @@ static bool write_index_thumbnail(DP_BuildIndexEntryContext *e)
         return false;
     }
 
-    bool write_ok = DP_image_write_png(thumb, output);
+    bool write_ok =
+        DP_image_write_png_level(thumb, output, DP_IMAGE_PNG_LEVEL_FAST);
     DP_image_free(thumb);
     if (!write_ok) {
         return false;
@@ -900,27 +1130,44 @@ static void dispose_index_maps(DP_BuildIndexMaps *maps)
     DP_timeline_decref_nullable(maps->timeline.tl);
 }
 
-static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
-                             size_t message_offset)
+static void dispose_index_contents(DP_BuildIndexContentMap **contents)
+{
+    DP_BuildIndexContentMap *entry, *tmp;
+    HASH_ITER(hh, *contents, entry, tmp) {
+        HASH_DEL(*contents, entry);
+        DP_tile_decref(entry->t);
+        DP_free(entry);
+    }
+}
+
+static void dispose_index_job(DP_BuildIndexJob *job)
+{
+    DP_message_vector_dispose(&job->messages);
+    DP_canvas_state_decref_nullable(job->cs);
+}
+
+static bool write_index_job(DP_BuildIndexContext *c, DP_BuildIndexJob *job)
 {
     DP_BuildIndexEntryContext e = {c->output,
-                                   c->acls,
-                                   c->local_state,
-                                   c->ch,
-                                   NULL,
-                                   c->dc,
+                                   job,
+                                   job->cs,
+                                   c->serializer.dc,
                                    {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
                                    &c->last,
+                                   NULL,
+                                   &c->contents,
                                    0,
                                    {0, 0, 0, 0, 0},
                                    {NULL, 0}};
+    precompress_index_tiles(&e);
     bool ok = write_index_snapshot(&e) && write_index_thumbnail(&e);
+    free_compressed_tiles(&e);
     if (!ok) {
         dispose_index_maps(&e.current);
         return false;
     }
 
-    DP_PlayerIndexEntry entry = {message_index, message_offset,
+    DP_PlayerIndexEntry entry = {job->message_index, job->message_offset,
                                  e.offset.snapshot, e.offset.thumbnail};
     DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
 
@@ -930,6 +1177,148 @@ static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
     return true;
 }
 
+static DP_BuildIndexJob shift_index_job(DP_BuildIndexContext *c)
+{
+    DP_SEMAPHORE_MUST_WAIT(c->serializer.sem_queued);
+    DP_MUTEX_MUST_LOCK(c->serializer.mutex);
+    DP_BuildIndexJob job = *(DP_BuildIndexJob *)DP_queue_peek(
+        &c->serializer.queue, sizeof(DP_BuildIndexJob));
+    DP_queue_shift(&c->serializer.queue);
+    DP_MUTEX_MUST_UNLOCK(c->serializer.mutex);
+    DP_SEMAPHORE_MUST_POST(c->serializer.sem_space);
+    return job;
+}
+
+static void run_index_serializer(void *user)
+{
+    DP_thread_role_set(DP_THREAD_ROLE_BACKGROUND);
+    DP_BuildIndexContext *c = user;
+    while (true) {
+        DP_BuildIndexJob job = shift_index_job(c);
+        if (!job.cs) {
+            break;
+        }
+        // After a failure, keep draining the queue so the replay can't get
+        // stuck waiting for space in it.
+        bool failed = DP_atomic_get(&c->serializer.failed);
+        if (!failed && !write_index_job(c, &job)) {
+            c->serializer.error = DP_strdup(DP_error());
+            DP_atomic_set(&c->serializer.failed, 1);
+        }
+        dispose_index_job(&job);
+    }
+}
+
+static void push_index_job(DP_BuildIndexContext *c, DP_BuildIndexJob job)
+{
+    DP_SEMAPHORE_MUST_WAIT(c->serializer.sem_space);
+    DP_MUTEX_MUST_LOCK(c->serializer.mutex);
+    *(DP_BuildIndexJob *)DP_queue_push(&c->serializer.queue,
+                                       sizeof(DP_BuildIndexJob)) = job;
+    DP_MUTEX_MUST_UNLOCK(c->serializer.mutex);
+    DP_SEMAPHORE_MUST_POST(c->serializer.sem_queued);
+}
+
+static bool start_index_serializer(DP_BuildIndexContext *c)
+{
+    DP_queue_init(&c->serializer.queue, MAX_QUEUED_SNAPSHOTS,
+                  sizeof(DP_BuildIndexJob));
+    c->serializer.dc = DP_draw_context_new();
+    c->serializer.mutex = DP_mutex_new();
+    c->serializer.sem_queued = DP_semaphore_new(0);
+    c->serializer.sem_space = DP_semaphore_new(MAX_QUEUED_SNAPSHOTS);
+    if (c->serializer.mutex && c->serializer.sem_queued
+        && c->serializer.sem_space) {
+        c->serializer.thread = DP_thread_new(run_index_serializer, c);
+    }
+    return c->serializer.thread != NULL;
+}
+
+static bool finish_index_serializer(DP_BuildIndexContext *c)
+{
+    if (c->serializer.thread) {
+        push_index_job(c, (DP_BuildIndexJob){0, 0, NULL, DP_VECTOR_NULL});
+        DP_thread_free_join(c->serializer.thread);
+        c->serializer.thread = NULL;
+    }
+
+    char *error = c->serializer.error;
+    if (error) {
+        DP_error_set("%s", error);
+        DP_free(error);
+        c->serializer.error = NULL;
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static void dispose_index_serializer(DP_BuildIndexContext *c)
+{
+    DP_ASSERT(!c->serializer.thread);
+    DP_Queue *queue = &c->serializer.queue;
+    DP_BuildIndexJob *job;
+    while ((job = DP_queue_peek(queue, sizeof(*job))) != NULL) {
+        dispose_index_job(job);
+        DP_queue_shift(queue);
+    }
+    DP_queue_dispose(queue);
+    DP_semaphore_free(c->serializer.sem_space);
+    DP_semaphore_free(c->serializer.sem_queued);
+    DP_mutex_free(c->serializer.mutex);
+    DP_draw_context_free(c->serializer.dc);
+}
+
+static bool collect_index_history_state(void *user, DP_CanvasState *cs)
+{
+    DP_BuildIndexJob *job = user;
+    job->cs = DP_canvas_state_incref(cs);
+    DP_message_vector_push_noinc(&job->messages,
+                                 DP_acl_state_msg_feature_access_all_new(0));
+    DP_message_vector_push_noinc(&job->messages,
+                                 DP_acl_state_msg_feature_limits_none_new(0));
+    return true;
+}
+
+static bool collect_index_history_message(void *user, DP_Message *msg)
+{
+    DP_BuildIndexJob *job = user;
+    DP_message_vector_push_noinc(&job->messages, msg);
+    return true;
+}
+
+static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
+                             size_t message_offset)
+{
+    if (DP_atomic_get(&c->serializer.failed)) {
+        return false; // The error gets reported when finishing up.
+    }
+
+    DP_BuildIndexJob job = {message_index, message_offset, NULL,
+                            DP_VECTOR_NULL};
+    DP_message_vector_init(&job.messages, INITAL_ENTRY_CAPACITY);
+    bool ok =
+        DP_canvas_history_reset_image_new(c->ch, collect_index_history_state,
+                                          collect_index_history_message, &job)
+        // The state of the permissions at this point.
+        && DP_acl_state_reset_image_build(
+            c->acls, 0, DP_ACL_STATE_RESET_IMAGE_RECORDING_FLAGS, NULL, NULL,
+            collect_index_history_message, &job)
+        // Local changes (hidden layers, local canvas background).
+        && DP_local_state_reset_image_build(c->local_state, c->dc,
+                                            collect_index_history_message,
+                                            &job);
+    if (ok) {
+        push_index_job(c, job);
+        return true;
+    }
+    else {
+        dispose_index_job(&job);
+        return false;
+    }
+}
+
 static bool write_index_messages(DP_BuildIndexContext *c)
 {
     DP_Player *player = c->player;
@@ -1040,8 +1429,15 @@ static bool write_index_finish(DP_BuildIndexContext *c)
 
 static bool write_index(DP_BuildIndexContext *c)
 {
-    return write_index_header(c) && write_index_messages(c)
-        && write_index_finish(c) && DP_output_flush(c->output);
+    // Replay happens on this thread, snapshots get serialized on another one.
+    // The serializer must be finished before touching the output again.
+    if (!write_index_header(c) || !start_index_serializer(c)) {
+        return false;
+    }
+    bool messages_ok = write_index_messages(c);
+    bool serializer_ok = finish_index_serializer(c);
+    return messages_ok && serializer_ok && write_index_finish(c)
+        && DP_output_flush(c->output);
 }
 
 bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
@@ -1063,7 +1459,7 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
         return false;
     }
 
-    DP_Input *input = DP_file_input_new_from_path(recording_path);
+    DP_Input *input = DP_file_input_new_mapped_from_path(recording_path);
     if (!input) {
         return false;
     }
@@ -1077,6 +1473,7 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
         DP_player_free(player);
         return false;
     }
+    DP_player_read_ahead_set(index_player, DP_PLAYER_READ_AHEAD_DEFAULT);
 
     const char *path = DP_player_index_path(player);
     DP_Output *output = DP_file_output_save_new_from_path(path);
@@ -1098,11 +1495,17 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
                               0,
                               DP_VECTOR_NULL,
                               {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
+                              NULL,
                               should_snapshot_fn,
                               progress_fn,
-                              user};
+                              user,
+                              {NULL, NULL, NULL, NULL, NULL, DP_QUEUE_NULL,
+                               DP_ATOMIC_INIT(0), NULL}};
     DP_VECTOR_INIT_TYPE(&c.entries, DP_PlayerIndexEntry, INITAL_ENTRY_CAPACITY);
     bool ok = write_index(&c);
+    finish_index_serializer(&c);
+    dispose_index_serializer(&c);
+    dispose_index_contents(&c.contents);
     dispose_index_maps(&c.last);
     DP_vector_dispose(&c.entries);
     DP_canvas_history_free(ch);
@@ -1243,6 +1646,146 @@ static bool read_index_entries(DP_ReadIndexContext *c)
     }
 }
 
+static bool read_keyframe_message(DP_BufferedInput *input, size_t offset,
+                                  size_t length, unsigned char kind)
+{
+    if (!DP_buffered_input_seek(input, offset)
+        || !read_index_input(input, length)) {
+        return false;
+    }
+
+    const unsigned char *d = input->buffer;
+    size_t payload_length = DP_read_bigendian_uint16(d);
+    bool valid = payload_length + DP_MESSAGE_HEADER_LENGTH == length
+              && d[2] == DP_MSG_DATA
+              && d[DP_MESSAGE_HEADER_LENGTH] == DP_RECORDER_KEYFRAME_DATA_TYPE
+              && d[DP_MESSAGE_HEADER_LENGTH + 2] == kind;
+    if (valid) {
+        return true;
+    }
+    else {
+        DP_error_set("No keyframe data of kind %d at offset %zu", (int)kind,
+                     offset);
+        return false;
+    }
+}
+
+static bool read_keyframe_trailer(DP_ReadIndexContext *c, size_t length,
+                                  size_t body_offset)
+{
+    size_t trailer_length = DP_RECORDER_KEYFRAME_TRAILER_LENGTH;
+    size_t magic_length = sizeof(DP_RECORDER_KEYFRAME_TRAILER_MAGIC) - 1;
+    bool have_trailer =
+        length >= body_offset + trailer_length
+        && read_keyframe_message(&c->input, length - trailer_length,
+                                 trailer_length,
+                                 DP_RECORDER_KEYFRAME_KIND_TRAILER)
+        && memcmp(c->input.buffer + trailer_length - magic_length,
+                  DP_RECORDER_KEYFRAME_TRAILER_MAGIC, magic_length)
+               == 0;
+    if (have_trailer) {
+        const unsigned char *d = c->input.buffer + KEYFRAME_DATA_OFFSET;
+        c->message_count = DP_read_littleendian_uint32(d);
+        c->index_offset = read_littleendian_size(d + 4);
+        return true;
+    }
+    else {
+        DP_error_set("Recording has no keyframe trailer");
+        return false;
+    }
+}
+
+static bool read_keyframe_entries(DP_ReadIndexContext *c, size_t body_offset)
+{
+    DP_VECTOR_INIT_TYPE(&c->entries, DP_PlayerIndexEntry,
+                        INITAL_ENTRY_CAPACITY);
+
+    // Keyframes point to their predecessor, so walk them backwards from the
+    // last one. Each must lie before the snapshot of the one after it.
+    size_t offset = c->index_offset;
+    size_t limit = SIZE_MAX;
+    while (offset != 0) {
+        if (offset < body_offset || offset >= limit) {
+            DP_error_set("Keyframe offset %zu out of bounds", offset);
+            return false;
+        }
+
+        if (!read_keyframe_message(&c->input, offset,
+                                   DP_RECORDER_KEYFRAME_LENGTH,
+                                   DP_RECORDER_KEYFRAME_KIND_KEYFRAME)) {
+            return false;
+        }
+
+        const unsigned char *d = c->input.buffer + KEYFRAME_DATA_OFFSET;
+        DP_PlayerIndexEntry entry = {
+            DP_read_littleendian_uint32(d),
+            offset + DP_RECORDER_KEYFRAME_LENGTH,
+            read_littleendian_size(d + 4),
+            0,
+        };
+        if (entry.snapshot_offset < body_offset
+            || entry.snapshot_offset > offset) {
+            DP_error_set("Keyframe snapshot offset %zu out of bounds",
+                         entry.snapshot_offset);
+            return false;
+        }
+
+        DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
+        limit = entry.snapshot_offset;
+        offset = read_littleendian_size(d + 12);
+    }
+
+    size_t count = c->entries.used;
+    DP_PlayerIndexEntry *entries = c->entries.elements;
+    for (size_t i = 0; i < count / 2; ++i) {
+        DP_PlayerIndexEntry tmp = entries[i];
+        entries[i] = entries[count - i - 1];
+        entries[count - i - 1] = tmp;
+    }
+    DP_debug("Read %zu embedded keyframe(s)", count);
+    return true;
+}
+
+static bool load_embedded_index(DP_Player *player)
+{
+    const char *path = DP_player_recording_path(player);
+    DP_Input *input = DP_file_input_new_from_path(path);
+    if (input) {
+        input = DP_history_blocks_input_new_detect(input, path);
+    }
+    input = input ? DP_seekable_zstd_input_new_detect(input) : NULL;
+    if (!input) {
+        return false;
+    }
+
+    bool error;
+    size_t length = DP_input_length(input, &error);
+    if (error) {
+        DP_input_free(input);
+        return false;
+    }
+
+    DP_PERF_BEGIN_DETAIL(fn, "index_load_embedded", "path=%s", path);
+    DP_ReadIndexContext c = {DP_buffered_input_init(input), 0, 0,
+                             DP_VECTOR_NULL};
+
+    size_t body_offset = DP_player_body_offset(player);
+    bool ok = read_keyframe_trailer(&c, length, body_offset)
+           && read_keyframe_entries(&c, body_offset);
+    if (ok) {
+        DP_player_index_set(
+            player, (DP_PlayerIndex){c.input, c.message_count,
+                                     c.entries.elements, c.entries.used, true});
+    }
+    else {
+        DP_vector_dispose(&c.entries);
+        DP_buffered_input_dispose(&c.input);
+    }
+
+    DP_PERF_END(fn);
+    return ok;
+}
+
 bool DP_player_index_load(DP_Player *player)
 {
     DP_ASSERT(player);
@@ -1259,7 +1802,9 @@ bool DP_player_index_load(DP_Player *player)
 
     DP_Input *input = DP_file_input_new_from_path(path);
     if (!input) {
-        return false;
+        // Without an index file, a binary recording may still carry keyframes.
+        return DP_player_type(player) == DP_PLAYER_TYPE_BINARY
+            && load_embedded_index(player);
     }
 
     DP_PERF_BEGIN_DETAIL(fn, "index_load", "path=%s", path);
@@ -1270,7 +1815,7 @@ bool DP_player_index_load(DP_Player *player)
     if (ok) {
         DP_player_index_set(player, (DP_PlayerIndex){c.input, c.message_count,
                                                      c.entries.elements,
-                                                     c.entries.used});
+                                                     c.entries.used, false});
     }
     else {
         DP_vector_dispose(&c.entries);
@@ -1845,6 +2390,83 @@ static bool read_index_snapshot(DP_ReadSnapshotContext *c)
         && read_index_history(c, history_offset, message_count);
 }
 
+static bool collect_keyframe_message(void *user, DP_Message *msg)
+{
+    DP_message_vector_push_noinc(user, msg);
+    return true;
+}
+
+static bool read_keyframe_snapshot_chunks(DP_BufferedInput *input,
+                                          DP_ResetStreamConsumer *rsc,
+                                          size_t offset, size_t end)
+{
+    while (offset < end) {
+        if (!read_index_input(input, DP_MESSAGE_HEADER_LENGTH)) {
+            return false;
+        }
+
+        size_t length = DP_read_bigendian_uint16(input->buffer);
+        bool valid = input->buffer[2] == DP_MSG_DATA && length > 3
+                  && read_index_input(input, length)
+                  && input->buffer[0] == DP_RECORDER_KEYFRAME_DATA_TYPE
+                  && input->buffer[2] == DP_RECORDER_KEYFRAME_KIND_SNAPSHOT;
+        if (!valid) {
+            DP_error_set("No keyframe snapshot chunk at offset %zu", offset);
+            return false;
+        }
+
+        if (!DP_reset_stream_consumer_push(rsc, input->buffer + 3,
+                                           length - 3)) {
+            return false;
+        }
+
+        offset += DP_MESSAGE_HEADER_LENGTH + length;
+    }
+    return true;
+}
+
+static DP_PlayerIndexEntrySnapshot *
+load_embedded_snapshot(DP_BufferedInput *input, DP_PlayerIndexEntry entry)
+{
+    size_t snapshot_offset = entry.snapshot_offset;
+    if (!DP_buffered_input_seek(input, snapshot_offset)) {
+        return NULL;
+    }
+
+    DP_Vector msgs;
+    DP_message_vector_init(&msgs, INITAL_ENTRY_CAPACITY);
+    DP_ResetStreamConsumer *rsc =
+        DP_reset_stream_consumer_new(collect_keyframe_message, &msgs, true);
+    if (!rsc) {
+        DP_message_vector_dispose(&msgs);
+        return NULL;
+    }
+
+    size_t keyframe_offset = entry.message_offset - DP_RECORDER_KEYFRAME_LENGTH;
+    if (!read_keyframe_snapshot_chunks(input, rsc, snapshot_offset,
+                                       keyframe_offset)) {
+        DP_reset_stream_consumer_free_discard(rsc);
+        DP_message_vector_dispose(&msgs);
+        return NULL;
+    }
+
+    if (!DP_reset_stream_consumer_free_finish(rsc)) {
+        DP_message_vector_dispose(&msgs);
+        return NULL;
+    }
+
+    // The snapshot is a reset image, so it starts from a blank canvas and
+    // builds up the state through its messages, which we take over as-is.
+    size_t count = msgs.used;
+    DP_PlayerIndexEntrySnapshot *snapshot = DP_malloc(
+        DP_FLEX_SIZEOF(DP_PlayerIndexEntrySnapshot, messages, count));
+    snapshot->cs = DP_canvas_state_new();
+    snapshot->message_count = DP_size_to_int(count);
+    memcpy(snapshot->messages, msgs.elements, sizeof(DP_Message *) * count);
+    DP_vector_dispose(&msgs);
+    return snapshot;
+}
+
 DP_PlayerIndexEntrySnapshot *
 DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
                            DP_PlayerIndexEntry entry)
@@ -1859,7 +2481,17 @@ DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
         return snapshot;
     }
 
-    DP_BufferedInput *input = &DP_player_index(player)->input;
+    DP_PlayerIndex *pi = DP_player_index(player);
+    DP_BufferedInput *input = &pi->input;
+    if (pi->embedded) {
+        DP_PERF_BEGIN_DETAIL(fn, "index_entry_load_embedded", "offset=%zu",
+                             snapshot_offset);
+        DP_PlayerIndexEntrySnapshot *snapshot =
+            load_embedded_snapshot(input, entry);
+        DP_PERF_END(fn);
+        return snapshot;
+    }
+
     if (!DP_buffered_input_seek(input, snapshot_offset)) {
         return NULL;
     }
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "save.h"
 #include "image_impex.h"
+#include "image_jpeg.h"
 #include "image_png.h"
 #include "save_psd.h"
 #include "zip_archive.h"
@@ -12,6 +13,7 @@
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
 #include <dpcommon/threading.h>
+#include <dpcommon/vector.h>
 #include <dpcommon/worker.h>
 #include <dpengine/annotation.h>
 #include <dpengine/annotation_list.h>
@@ -204,16 +206,21 @@ bool DP_save_image_type_is_flat_image(DP_SaveImageType type)
 }
 
 
+#define ORA_SPARSE_MAX_PIECES 64
+
 typedef struct DP_SaveOraLayer {
     int layer_id;
     int index;
     int offset_x, offset_y;
+    int piece_count;
+    DP_Rect *pieces;
     UT_hash_handle hh;
 } DP_SaveOraLayer;
 
 typedef struct DP_SaveOraContext {
     DP_ZipWriter *zw;
     DP_SaveOraLayer *layers;
+    bool sparse_layers;
     int clipping_groups;
     struct {
         size_t capacity;
@@ -229,6 +236,8 @@ static DP_SaveOraLayer *save_ora_context_layer_insert(DP_SaveOraContext *c,
     sol->index = index;
     sol->offset_x = 0;
     sol->offset_y = 0;
+    sol->piece_count = 0;
+    sol->pieces = NULL;
     HASH_ADD_INT(c->layers, layer_id, sol);
     return sol;
 }
@@ -246,11 +255,18 @@ static int save_ora_context_index_get(DP_SaveOraContext *c, int layer_id)
     }
 }
 
-static void save_ora_context_offsets_get(DP_SaveOraContext *c, int layer_id,
-                                         int *out_offset_x, int *out_offset_y)
+static DP_SaveOraLayer *save_ora_context_layer_get(DP_SaveOraContext *c,
+                                                   int layer_id)
 {
     DP_SaveOraLayer *sol;
     HASH_FIND_INT(c->layers, &layer_id, sol);
+    return sol;
+}
+
+static void save_ora_context_offsets_get(DP_SaveOraContext *c, int layer_id,
+                                         int *out_offset_x, int *out_offset_y)
+{
+    DP_SaveOraLayer *sol = save_ora_context_layer_get(c, layer_id);
     if (sol) {
         *out_offset_x = sol->offset_x;
         *out_offset_y = sol->offset_y;
@@ -291,6 +307,7 @@ static void save_ora_context_dispose(DP_SaveOraContext *c)
     DP_SaveOraLayer *sol, *tmp;
     HASH_ITER(hh, c->layers, sol, tmp) {
         HASH_DEL(c->layers, sol);
+        DP_free(sol->pieces);
         DP_free(sol);
     }
 }
@@ -332,8 +349,9 @@ struct DP_OraWriteUpixelsParams {
 static bool ora_write_png_upixels(void *user, DP_Output *output)
 {
     struct DP_OraWriteUpixelsParams *params = user;
-    return DP_image_png_write_unpremultiplied(output, params->width,
-                                              params->height, params->pixels);
+    return DP_image_png_write_unpremultiplied_level(
+        output, params->width, params->height, params->pixels,
+        DP_IMAGE_PNG_LEVEL_FAST);
 }
 
 static bool ora_store_png_upixels(DP_SaveOraContext *c, DP_UPixel8 *pixels,
@@ -349,7 +367,7 @@ static bool ora_store_png_upixels(DP_SaveOraContext *c, DP_UPixel8 *pixels,
 static bool ora_write_png_image(void *user, DP_Output *output)
 {
     DP_Image *img = user;
-    return DP_image_write_png(img, output);
+    return DP_image_write_png_level(img, output, DP_IMAGE_PNG_LEVEL_FAST);
 }
 
 static bool ora_store_png_image(DP_SaveOraContext *c, DP_Image *img,
@@ -359,21 +377,107 @@ static bool ora_store_png_image(DP_SaveOraContext *c, DP_Image *img,
                : ora_store_png_upixels(c, NULL, 0, 0, name);
 }
 
-static bool ora_store_layer(DP_SaveOraContext *c, DP_LayerContent *lc,
-                            DP_SaveOraLayer *sol)
+typedef struct DP_SaveOraLayerJob {
+    DP_LayerContent *lc;
+    DP_SaveOraLayer *sol;
+    int piece; // Index into the layer's pieces or -1 for the whole layer.
+    DP_Semaphore *sem_done;
+    void *buffer;
+    size_t size;
+    char *error;
+} DP_SaveOraLayerJob;
+
+// Sparse layers are stored as a group of pieces that only cover the painted
+// tiles, instead of as one image of the layer's entire bounds. Other programs
+// see that as a group with the layer's properties, which looks the same, but
+// it doesn't turn back into a single layer for them. So this is opt-in.
+static bool ora_sparse_layers_enabled(void)
 {
-    int width, height;
-    DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
-        lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
-    const char *name =
-        save_ora_context_format(c, "data/layer-%04x.png", sol->layer_id);
-    bool ok = ora_store_png_upixels(c, pixels, width, height, name);
-    DP_free(pixels);
-    return ok;
+    const char *value = getenv("DP_ORA_SPARSE_LAYERS");
+    return value && !DP_str_equal(value, "") && !DP_str_equal(value, "0");
+}
+
+static bool ora_extend_sparse_piece(DP_Vector *pieces, int x1, int x2, int y)
+{
+    size_t count = pieces->used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_Rect *r = &DP_VECTOR_AT_TYPE(pieces, DP_Rect, i);
+        if (r->x1 == x1 && r->x2 == x2 && r->y2 == y - 1) {
+            r->y2 = y;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Splits the painted tiles of a layer into runs along each row and merges
+// runs spanning the same columns in consecutive rows. Returns 0 if that
+// wouldn't leave out at least half of the layer's bounds or it would make too
+// many small images, in which case the layer is stored whole.
+static int ora_find_sparse_pieces(DP_LayerContent *lc, DP_Rect **out_pieces)
+{
+    int width = DP_layer_content_width(lc);
+    int height = DP_layer_content_height(lc);
+    DP_TileCounts tc = DP_tile_counts_round(width, height);
+    DP_Vector pieces;
+    DP_VECTOR_INIT_TYPE(&pieces, DP_Rect, 8);
+    DP_Rect bounds = {tc.x, tc.y, -1, -1};
+    int painted = 0;
+
+    bool too_many = false;
+    for (int y = 0; !too_many && y < tc.y; ++y) {
+        int x = 0;
+        while (x < tc.x) {
+            if (!DP_layer_content_tile_at_noinc(lc, x, y)) {
+                ++x;
+                continue;
+            }
+
+            int x1 = x;
+            while (x < tc.x && DP_layer_content_tile_at_noinc(lc, x, y)) {
+                ++x;
+            }
+            int x2 = x - 1;
+            painted += x - x1;
+            bounds.x1 = DP_min_int(bounds.x1, x1);
+            bounds.y1 = DP_min_int(bounds.y1, y);
+            bounds.x2 = DP_max_int(bounds.x2, x2);
+            bounds.y2 = y;
+
+            if (!ora_extend_sparse_piece(&pieces, x1, x2, y)) {
+                if (pieces.used == ORA_SPARSE_MAX_PIECES) {
+                    too_many = true;
+                    break;
+                }
+                DP_Rect r = {x1, y, x2, y};
+                DP_VECTOR_PUSH_TYPE(&pieces, DP_Rect, r);
+            }
+        }
+    }
+
+    int count = DP_size_to_int(pieces.used);
+    if (too_many || count < 2
+        || painted * 2 > DP_rect_width(bounds) * DP_rect_height(bounds)) {
+        DP_vector_dispose(&pieces);
+        return 0;
+    }
+
+    DP_Rect *rects = pieces.elements;
+    for (int i = 0; i < count; ++i) {
+        DP_Rect *r = &rects[i];
+        int left = r->x1 * DP_TILE_SIZE;
+        int top = r->y1 * DP_TILE_SIZE;
+        int right = DP_min_int((r->x2 + 1) * DP_TILE_SIZE, width);
+        int bottom = DP_min_int((r->y2 + 1) * DP_TILE_SIZE, height);
+        *r = DP_rect_make(left, top, right - left, bottom - top);
+    }
+    *out_pieces = rects;
+    return count;
 }
 
-static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
-                             DP_LayerList *ll, DP_LayerPropsList *lpl)
+static void ora_collect_layers(DP_SaveOraContext *c, DP_Vector *jobs,
+                               int *next_index, DP_LayerList *ll,
+                               DP_LayerPropsList *lpl)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(DP_layer_props_list_count(lpl) == count);
@@ -387,28 +491,202 @@ static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
             DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
             DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
             DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
-            if (!ora_store_layers(c, next_index, child_ll, child_lpl)) {
-                return false;
-            }
+            ora_collect_layers(c, jobs, next_index, child_ll, child_lpl);
         }
         else {
             DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
-            if (!ora_store_layer(c, lc, sol)) {
-                return false;
+            if (c->sparse_layers) {
+                sol->piece_count = ora_find_sparse_pieces(lc, &sol->pieces);
+            }
+
+            if (sol->piece_count == 0) {
+                DP_SaveOraLayerJob job = {lc, sol, -1, NULL, NULL, 0, NULL};
+                DP_VECTOR_PUSH_TYPE(jobs, DP_SaveOraLayerJob, job);
+            }
+            else {
+                for (int j = 0; j < sol->piece_count; ++j) {
+                    DP_SaveOraLayerJob job = {lc, sol, j, NULL, NULL, 0, NULL};
+                    DP_VECTOR_PUSH_TYPE(jobs, DP_SaveOraLayerJob, job);
+                }
             }
         }
     }
+}
+
+static void ora_encode_layer(DP_SaveOraLayerJob *job)
+{
+    static DP_UPixel8 null_pixels[] = {{0}};
+    DP_SaveOraLayer *sol = job->sol;
+    int width, height;
+    DP_UPixel8 *pixels;
+    if (job->piece < 0) {
+        pixels = DP_layer_content_to_upixels8_cropped(
+            job->lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
+    }
+    else {
+        DP_Rect r = sol->pieces[job->piece];
+        width = DP_rect_width(r);
+        height = DP_rect_height(r);
+        pixels = DP_layer_content_to_upixels8(job->lc, r.x1, r.y1, width,
+                                              height);
+    }
+
+    void **buffer_ptr;
+    size_t *size_ptr;
+    DP_Output *output = DP_mem_output_new(64, false, &buffer_ptr, &size_ptr);
+    bool ok = pixels
+                ? DP_image_png_write_unpremultiplied_level(
+                      output, width, height, pixels, DP_IMAGE_PNG_LEVEL_FAST)
+                : DP_image_png_write_unpremultiplied_level(
+                      output, 1, 1, null_pixels, DP_IMAGE_PNG_LEVEL_FAST);
+    void *buffer = *buffer_ptr;
+    size_t size = *size_ptr;
+    DP_output_free(output);
+    DP_free(pixels);
+
+    if (ok) {
+        job->buffer = buffer;
+        job->size = size;
+    }
+    else {
+        DP_free(buffer);
+        job->error = DP_strdup(DP_error());
+    }
+}
+
+static void ora_encode_layer_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_SaveOraLayerJob *job = *(DP_SaveOraLayerJob **)element;
+    ora_encode_layer(job);
+    DP_SEMAPHORE_MUST_POST(job->sem_done);
+}
+
+static bool ora_store_encoded_layer(DP_SaveOraContext *c,
+                                    DP_SaveOraLayerJob *job)
+{
+    if (job->error) {
+        DP_error_set("%s", job->error);
+        DP_free(job->error);
+        job->error = NULL;
+        return false;
+    }
+
+    int layer_id = job->sol->layer_id;
+    const char *name =
+        job->piece < 0
+            ? save_ora_context_format(c, "data/layer-%04x.png", layer_id)
+            : save_ora_context_format(c, "data/layer-%04x-%d.png", layer_id,
+                                      job->piece);
+    void *buffer = job->buffer;
+    job->buffer = NULL;
+    return DP_zip_writer_add_file(c->zw, name, buffer, job->size, false, true);
+}
+
+static bool ora_store_layers_sequential(DP_SaveOraContext *c,
+                                        DP_SaveOraLayerJob *jobs, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        ora_encode_layer(&jobs[i]);
+        if (!ora_store_encoded_layer(c, &jobs[i])) {
+            return false;
+        }
+    }
     return true;
 }
 
+// Converting and PNG-encoding layers is by far the slowest part of saving,
+// so it's farmed out to a worker. Only a window of layers is in flight at a
+// time, so that not every encoded layer has to sit in memory at once, and
+// the zip writes happen here in order as the layers in front finish.
+static bool ora_store_layers_parallel(DP_SaveOraContext *c, DP_Worker *worker,
+                                      DP_SaveOraLayerJob *jobs, int count)
+{
+    int window = DP_min_int(count, DP_worker_thread_count(worker) * 2);
+    DP_Semaphore **sems = DP_malloc(sizeof(*sems) * DP_int_to_size(window));
+    int sem_count = 0;
+    for (; sem_count < window; ++sem_count) {
+        sems[sem_count] = DP_semaphore_new(0);
+        if (!sems[sem_count]) {
+            break;
+        }
+    }
+
+    bool ok;
+    if (sem_count == window) {
+        ok = true;
+        int pushed = 0;
+        for (int written = 0; written < count; ++written) {
+            while (pushed < count && pushed - written < window) {
+                DP_SaveOraLayerJob *job = &jobs[pushed];
+                job->sem_done = sems[pushed % window];
+                DP_worker_push(worker, &job);
+                ++pushed;
+            }
+
+            // Once something fails, the remaining jobs still have to be
+            // waited on, since they're writing into the job array.
+            DP_SEMAPHORE_MUST_WAIT(jobs[written].sem_done);
+            if (ok) {
+                ok = ora_store_encoded_layer(c, &jobs[written]);
+                if (!ok) {
+                    count = pushed;
+                }
+            }
+        }
+    }
+    else {
+        ok = false;
+    }
+
+    for (int i = 0; i < sem_count; ++i) {
+        DP_semaphore_free(sems[i]);
+    }
+    DP_free(sems);
+    return ok;
+}
+
+static bool ora_store_layers(DP_SaveOraContext *c, DP_CanvasState *cs)
+{
+    DP_Vector jobs;
+    DP_VECTOR_INIT_TYPE(&jobs, DP_SaveOraLayerJob, 64);
+    int next_index = 0;
+    ora_collect_layers(c, &jobs, &next_index, DP_canvas_state_layers_noinc(cs),
+                       DP_canvas_state_layer_props_noinc(cs));
+
+    int count = DP_size_to_int(jobs.used);
+    DP_SaveOraLayerJob *elements = jobs.elements;
+    DP_Worker *worker =
+        count > 1 ? DP_worker_new(DP_int_to_size(count),
+                                  sizeof(DP_SaveOraLayerJob *),
+                                  DP_worker_cpu_count(32), ora_encode_layer_job)
+                  : NULL;
+
+    bool ok;
+    if (worker) {
+        ok = ora_store_layers_parallel(c, worker, elements, count);
+        DP_worker_free_join(worker);
+    }
+    else {
+        ok = ora_store_layers_sequential(c, elements, count);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        DP_free(elements[i].buffer);
+        DP_free(elements[i].error);
+    }
+    DP_vector_dispose(&jobs);
+    return ok;
+}
+
 static bool ora_store_background(DP_SaveOraContext *c, DP_CanvasState *cs)
 {
     DP_Tile *t = DP_canvas_state_background_tile_noinc(cs);
     if (t && !DP_tile_blank(t)) {
         DP_UPixel8 *tile_pixels =
             DP_malloc(sizeof(*tile_pixels) * DP_TILE_LENGTH);
-        DP_pixels15_to_8_unpremultiply(tile_pixels, DP_tile_pixels(t),
-                                       DP_TILE_LENGTH);
+        DP_pixels15_to_8_unpremultiply(
+            tile_pixels, DP_tile_pixels_acquire(t), DP_TILE_LENGTH);
+        DP_tile_pixels_release(t);
         if (!ora_store_png_upixels(c, tile_pixels, DP_TILE_SIZE, DP_TILE_SIZE,
                                    "data/background-tile.png")) {
             DP_free(tile_pixels);
@@ -578,6 +856,45 @@ static DP_LayerProps *ora_clip_base(DP_LayerPropsList *lpl, int start)
     return lp;
 }
 
+static bool ora_write_sparse_layer_xml(DP_SaveOraContext *c,
+                                       DP_Output *output, DP_LayerProps *lp,
+                                       bool is_clip_base, bool in_clip)
+{
+    int layer_id = DP_layer_props_id(lp);
+    DP_SaveOraLayer *sol = save_ora_context_layer_get(c, layer_id);
+    if (!sol || sol->piece_count == 0) {
+        return false;
+    }
+
+    DP_OUTPUT_PRINT_LITERAL(output, "<stack");
+    if (is_clip_base) {
+        ora_write_layer_title(c, output, lp);
+    }
+    else {
+        ora_write_layer_props_xml(c, output, lp, false, in_clip);
+    }
+    DP_OUTPUT_PRINT_LITERAL(output, " isolation=\"isolate\"");
+    DP_OUTPUT_PRINT_LITERAL(output, " drawpile:sparse-layer=\"true\">");
+
+    for (int i = 0; i < sol->piece_count; ++i) {
+        DP_Rect r = sol->pieces[i];
+        DP_OUTPUT_PRINT_LITERAL(output, "<layer");
+        ORA_APPEND_ATTR(c, output, "src", "data/layer-%04x-%d.png", layer_id,
+                        i);
+        ORA_APPEND_ATTR(c, output, "name", "%d", i + 1);
+        if (r.x1 != 0) {
+            ORA_APPEND_ATTR(c, output, "x", "%d", r.x1);
+        }
+        if (r.y1 != 0) {
+            ORA_APPEND_ATTR(c, output, "y", "%d", r.y1);
+        }
+        DP_OUTPUT_PRINT_LITERAL(output, "/>");
+    }
+
+    DP_OUTPUT_PRINT_LITERAL(output, "</stack>");
+    return true;
+}
+
 static void ora_write_layers_xml(DP_SaveOraContext *c, DP_Output *output,
                                  DP_LayerList *ll, DP_LayerPropsList *lpl)
 {
@@ -630,7 +947,8 @@ static void ora_write_layers_xml(DP_SaveOraContext *c, DP_Output *output,
                 DP_OUTPUT_PRINT_LITERAL(output, "</stack>");
             }
         }
-        else {
+        else if (!ora_write_sparse_layer_xml(c, output, lp, is_clip_base,
+                                             in_clip)) {
             DP_OUTPUT_PRINT_LITERAL(output, "<layer");
             int layer_id = DP_layer_props_id(lp);
             ORA_APPEND_ATTR(c, output, "src", "data/layer-%04x.png", layer_id);
@@ -884,13 +1202,9 @@ static DP_SaveResult save_ora(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_WRITE_ERROR;
     }
 
-    DP_SaveOraContext c = {zw, NULL, 0, {0, NULL}};
-    int next_index = 0;
-    bool content_ok =
-        ora_store_layers(&c, &next_index, DP_canvas_state_layers_noinc(cs),
-                         DP_canvas_state_layer_props_noinc(cs))
-        && ora_store_background(&c, cs) && ora_store_merged(&c, cs, dc)
-        && ora_store_xml(&c, cs);
+    DP_SaveOraContext c = {zw, NULL, ora_sparse_layers_enabled(), 0, {0, NULL}};
+    bool content_ok = ora_store_layers(&c, cs) && ora_store_background(&c, cs)
+                   && ora_store_merged(&c, cs, dc) && ora_store_xml(&c, cs);
     save_ora_context_dispose(&c);
     if (!content_ok) {
         DP_warn("Save '%s': %s", path, DP_error());
@@ -997,6 +1311,217 @@ static void bake_annotations(DP_AnnotationList *al, DP_DrawContext *dc,
     }
 }
 
+// Streaming flat images flattens one band of tile rows at a time on a worker
+// and hands them to the PNG or JPEG encoder row by row, so memory use only
+// depends on the image width instead of it having to exist in its entirety.
+// A window of bands is in flight, each band has its own image and semaphore.
+typedef struct DP_SaveFlatBand {
+    DP_Image *img;
+    DP_Semaphore *sem_done;
+    bool ok;
+} DP_SaveFlatBand;
+
+typedef struct DP_SaveFlatStream {
+    DP_CanvasState *cs;
+    const DP_ViewModeFilter *vmf_or_null;
+    DP_Rect area;
+    int offset;
+    int band_count;
+    int window;
+    DP_Worker *worker;
+    DP_SaveFlatBand *bands;
+    int current_band;
+} DP_SaveFlatStream;
+
+typedef struct DP_SaveFlatBandJob {
+    DP_SaveFlatStream *sfs;
+    int band;
+} DP_SaveFlatBandJob;
+
+// Bands are aligned to tile rows, so the first one may be shorter.
+static int save_flat_stream_band_top(DP_SaveFlatStream *sfs, int band)
+{
+    return DP_max_int(0, band * DP_TILE_SIZE - sfs->offset);
+}
+
+static int save_flat_stream_band_bottom(DP_SaveFlatStream *sfs, int band)
+{
+    return DP_min_int(DP_rect_height(sfs->area),
+                      (band + 1) * DP_TILE_SIZE - sfs->offset);
+}
+
+static void save_flat_stream_flatten_band(DP_SaveFlatStream *sfs, int band)
+{
+    DP_SaveFlatBand *sfb = &sfs->bands[band % sfs->window];
+    int top = save_flat_stream_band_top(sfs, band);
+    int bottom = save_flat_stream_band_bottom(sfs, band);
+    DP_Rect band_area =
+        DP_rect_make(sfs->area.x1, sfs->area.y1 + top,
+                     DP_rect_width(sfs->area), bottom - top);
+    // The image gets reused between bands of the same size, parts outside of
+    // the canvas don't get written to, so they have to be cleared manually.
+    if (sfb->img && DP_image_height(sfb->img) == bottom - top) {
+        memset(DP_image_pixels(sfb->img), 0,
+               sizeof(DP_Pixel8) * DP_int_to_size(DP_rect_width(band_area))
+                   * DP_int_to_size(bottom - top));
+    }
+    sfb->ok = DP_canvas_state_into_flat_image(
+                  sfs->cs, DP_FLAT_IMAGE_RENDER_FLAGS, &band_area,
+                  sfs->vmf_or_null, &sfb->img)
+           != NULL;
+}
+
+static void save_flat_stream_band_job(void *element,
+                                      DP_UNUSED int thread_index)
+{
+    DP_SaveFlatBandJob *job = element;
+    DP_SaveFlatStream *sfs = job->sfs;
+    save_flat_stream_flatten_band(sfs, job->band);
+    DP_SEMAPHORE_MUST_POST(sfs->bands[job->band % sfs->window].sem_done);
+}
+
+static void save_flat_stream_push_band(DP_SaveFlatStream *sfs, int band)
+{
+    if (band < sfs->band_count) {
+        DP_SaveFlatBandJob job = {sfs, band};
+        DP_worker_push(sfs->worker, &job);
+    }
+}
+
+static const DP_Pixel8 *save_flat_stream_get_row(void *user, int y)
+{
+    DP_SaveFlatStream *sfs = user;
+    int band = (y + sfs->offset) / DP_TILE_SIZE;
+    DP_SaveFlatBand *sfb = &sfs->bands[band % sfs->window];
+    if (band != sfs->current_band) {
+        DP_ASSERT(band == sfs->current_band + 1);
+        DP_SEMAPHORE_MUST_WAIT(sfb->sem_done);
+        // The previous band's slot is free now, so the next one can go in.
+        save_flat_stream_push_band(sfs, band + sfs->window - 1);
+        sfs->current_band = band;
+        if (!sfb->ok) {
+            DP_error_set("Error flattening rows %d to %d",
+                         save_flat_stream_band_top(sfs, band),
+                         save_flat_stream_band_bottom(sfs, band) - 1);
+            return NULL;
+        }
+    }
+    int row = y - save_flat_stream_band_top(sfs, band);
+    return DP_image_pixels(sfb->img)
+         + DP_int_to_size(row) * DP_int_to_size(DP_rect_width(sfs->area));
+}
+
+static bool save_flat_stream_write(DP_SaveFlatStream *sfs,
+                                   DP_SaveImageType type, DP_Output *output)
+{
+    int width = DP_rect_width(sfs->area);
+    int height = DP_rect_height(sfs->area);
+    if (type == DP_SAVE_IMAGE_PNG) {
+        return DP_image_png_write_rows(output, width, height,
+                                       DP_IMAGE_PNG_LEVEL_DEFAULT,
+                                       save_flat_stream_get_row, sfs);
+    }
+    else {
+        DP_ASSERT(type == DP_SAVE_IMAGE_JPEG);
+        return DP_image_jpeg_write_rows(output, width, height, 100,
+                                        save_flat_stream_get_row, sfs);
+    }
+}
+
+// Returns false if streaming isn't possible, in which case the caller should
+// fall back to flattening the whole image. Otherwise the result is assigned.
+static bool save_flat_image_stream(DP_CanvasState *cs, DP_Rect *crop,
+                                   DP_SaveImageType type, const char *path,
+                                   const DP_ViewModeFilter *vmf_or_null,
+                                   DP_SaveResult *out_result)
+{
+    DP_Rect area = crop ? *crop
+                        : DP_rect_make(0, 0, DP_canvas_state_width(cs),
+                                       DP_canvas_state_height(cs));
+    if (!DP_rect_valid(area)) {
+        return false;
+    }
+
+    int offset = ((area.y1 % DP_TILE_SIZE) + DP_TILE_SIZE) % DP_TILE_SIZE;
+    int band_count =
+        (DP_rect_height(area) + offset + DP_TILE_SIZE - 1) / DP_TILE_SIZE;
+    // Not worth the overhead if it all fits into a couple of bands anyway.
+    if (band_count < 4) {
+        return false;
+    }
+
+    int thread_count = DP_worker_cpu_count(32);
+    int window = DP_min_int(band_count, thread_count * 2);
+    DP_Worker *worker =
+        DP_worker_new(DP_int_to_size(window), sizeof(DP_SaveFlatBandJob),
+                      thread_count, save_flat_stream_band_job);
+    if (!worker) {
+        DP_warn("Save streaming: %s", DP_error());
+        return false;
+    }
+
+    DP_SaveFlatBand *bands = DP_malloc_zeroed(sizeof(*bands)
+                                              * DP_int_to_size(window));
+    int sem_count = 0;
+    for (; sem_count < window; ++sem_count) {
+        bands[sem_count].sem_done = DP_semaphore_new(0);
+        if (!bands[sem_count].sem_done) {
+            break;
+        }
+    }
+
+    bool streamed;
+    if (sem_count == window) {
+        DP_Output *output = DP_file_output_save_new_from_path(path);
+        if (output) {
+            DP_SaveFlatStream sfs = {
+                cs,
+                vmf_or_null,
+                area,
+                offset,
+                band_count,
+                window,
+                worker,
+                bands,
+                -1,
+            };
+            for (int i = 0; i < window; ++i) {
+                save_flat_stream_push_band(&sfs, i);
+            }
+
+            bool ok = save_flat_stream_write(&sfs, type, output);
+            if (!ok) {
+                DP_warn("Save streaming: %s", DP_error());
+            }
+            // Joining before anything gets freed, since bands might still be
+            // getting flattened if the encoder bailed out early.
+            DP_worker_free_join(worker);
+            worker = NULL;
+            DP_output_free(output);
+            *out_result =
+                ok ? DP_SAVE_RESULT_SUCCESS : DP_SAVE_RESULT_WRITE_ERROR;
+        }
+        else {
+            DP_warn("Save: %s", DP_error());
+            *out_result = DP_SAVE_RESULT_OPEN_ERROR;
+        }
+        streamed = true;
+    }
+    else {
+        streamed = false;
+    }
+
+    DP_worker_free_join(worker);
+    for (int i = 0; i < window; ++i) {
+        DP_image_free(bands[i].img);
+    }
+    for (int i = 0; i < sem_count; ++i) {
+        DP_semaphore_free(bands[i].sem_done);
+    }
+    DP_free(bands);
+    return streamed;
+}
+
 static DP_SaveResult
 save_flat_image(DP_CanvasState *cs, DP_DrawContext *dc, DP_Rect *crop,
                 DP_SaveImageType type, const char *path,
@@ -1008,6 +1533,15 @@ save_flat_image(DP_CanvasState *cs, DP_DrawContext *dc, DP_Rect *crop,
         return DP_SAVE_RESULT_BAD_DIMENSIONS;
     }
 
+    // Baking annotations needs the whole image, so that doesn't stream.
+    DP_SaveResult stream_result;
+    if ((type == DP_SAVE_IMAGE_PNG || type == DP_SAVE_IMAGE_JPEG)
+        && !bake_annotation
+        && save_flat_image_stream(cs, crop, type, path, vmf_or_null,
+                                  &stream_result)) {
+        return stream_result;
+    }
+
     DP_Image *img = DP_canvas_state_to_flat_image(
         cs, DP_FLAT_IMAGE_RENDER_FLAGS, crop, vmf_or_null);
     if (!img) {
@@ -1040,10 +1574,8 @@ static bool write_project_thumbnail(DP_UNUSED void *user, DP_Image *img,
     return DP_image_write_jpeg_quality(img, output, 80);
 }
 
-static DP_SaveResult save_project_canvas(DP_CanvasState *cs, const char *path)
+static DP_SaveResult project_canvas_save_result(int result)
 {
-    int result =
-        DP_project_canvas_save(cs, path, write_project_thumbnail, NULL);
     switch (result) {
     case 0:
         return DP_SAVE_RESULT_SUCCESS;
@@ -1062,6 +1594,12 @@ static DP_SaveResult save_project_canvas(DP_CanvasState *cs, const char *path)
     }
 }
 
+static DP_SaveResult save_project_canvas(DP_CanvasState *cs, const char *path)
+{
+    return project_canvas_save_result(
+        DP_project_canvas_save(cs, path, write_project_thumbnail, NULL));
+}
+
 
 static DP_SaveResult save(DP_CanvasState *cs, DP_DrawContext *dc,
                           DP_SaveImageType type, const char *path,
@@ -1110,6 +1648,23 @@ DP_SaveResult DP_save(DP_CanvasState *cs, DP_DrawContext *dc,
     }
 }
 
+DP_SaveResult DP_save_project_canvas_incremental(DP_CanvasState *cs,
+                                                 const char *path,
+                                                 DP_ProjectSaveState *pss)
+{
+    if (cs && path && pss) {
+        DP_PERF_BEGIN_DETAIL(fn, "image", "path=%s", path);
+        DP_SaveResult result =
+            project_canvas_save_result(DP_project_canvas_save_incremental(
+                cs, path, pss, write_project_thumbnail, NULL));
+        DP_PERF_END(fn);
+        return result;
+    }
+    else {
+        return DP_SAVE_RESULT_BAD_ARGUMENTS;
+    }
+}
+
 
 #if defined(_WIN32)
 #    define PREFERRED_PATH_SEPARATOR "\\"
@@ -1223,7 +1778,7 @@ static unsigned char *generate_frame_png(struct DP_SaveFrameContext *c,
     void **buffer_ptr;
     size_t *size_ptr;
     DP_Output *output = DP_mem_output_new(64, false, &buffer_ptr, &size_ptr);
-    bool ok = DP_image_write_png(img, output);
+    bool ok = DP_image_write_png_level(img, output, DP_IMAGE_PNG_LEVEL_FAST);
     void *buffer = *buffer_ptr;
     size_t size = *size_ptr;
     DP_output_free_discard(output);
@@ -1288,7 +1843,7 @@ static char *save_frame(struct DP_SaveFrameContext *c, DP_ViewModeBuffer *vmb,
         return NULL;
     }
 
-    if (!DP_image_write_png(img, output)) {
+    if (!DP_image_write_png_level(img, output, DP_IMAGE_PNG_LEVEL_FAST)) {
         DP_output_free_discard(output);
         DP_free(path);
         set_error_result(c, DP_SAVE_RESULT_WRITE_ERROR);
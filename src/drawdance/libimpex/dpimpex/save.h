@@ -7,6 +7,7 @@
 typedef struct DP_Annotation DP_Annotation;
 typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_DrawContext DP_DrawContext;
+typedef struct DP_ProjectSaveState DP_ProjectSaveState;
 typedef struct DP_Rect DP_Rect;
 typedef struct DP_ViewModeFilter DP_ViewModeFilter;
 
@@ -41,6 +42,12 @@ DP_SaveResult DP_save(DP_CanvasState *cs, DP_DrawContext *dc,
                       const DP_ViewModeFilter *vmf_or_null,
                       DP_SaveBakeAnnotationFn bake_annotation, void *user);
 
+// Saves in the project canvas format, only writing tiles that changed since
+// the last save with the same state. See DP_project_canvas_save_incremental.
+DP_SaveResult DP_save_project_canvas_incremental(DP_CanvasState *cs,
+                                                 const char *path,
+                                                 DP_ProjectSaveState *pss);
+
 
 typedef bool (*DP_SaveAnimationProgressFn)(void *user, double progress);
 
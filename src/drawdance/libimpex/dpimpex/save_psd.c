@@ -6,6 +6,9 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/output.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/vector.h>
+#include <dpcommon/worker.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/draw_context.h>
 #include <dpengine/layer_content.h>
@@ -524,46 +527,6 @@ static size_t rle_compress(size_t stride, const uint8_t *src,
 }
 // SPDX-SnippetEnd
 
-static bool write_channel(DP_Output *out, size_t rows, size_t stride,
-                          const DP_UPixel8 *pixels, size_t counts_length,
-                          unsigned char *counts, uint8_t *src,
-                          unsigned char *dst, uint8_t (*extract)(DP_UPixel8),
-                          size_t *out_pos)
-{
-    bool error;
-    size_t start_pos = DP_output_tell(out, &error);
-    if (error || !DP_OUTPUT_WRITE_BYTES_LITERAL(out, 0, 1)) {
-        return false;
-    }
-
-    memset(counts, 0, counts_length);
-    if (!DP_output_write(out, counts, counts_length)) {
-        return false;
-    }
-
-    for (size_t i = 0; i < rows; ++i) {
-        size_t offset = i * stride;
-        extract_channel(stride, pixels + offset, src, extract);
-
-        size_t length = rle_compress(stride, src, dst);
-        if (!DP_output_write(out, dst, length)) {
-            return false;
-        }
-
-        DP_write_bigendian_uint16(DP_size_to_uint16(length), counts + i * 2);
-    }
-
-    size_t end_pos = DP_output_tell(out, &error);
-    if (error) {
-        return false;
-    }
-
-    *out_pos = end_pos - start_pos;
-    return DP_output_seek(out, start_pos + 2)
-        && DP_output_write(out, counts, counts_length)
-        && DP_output_seek(out, end_pos);
-}
-
 static uint8_t get_upixel8_a(DP_UPixel8 pixel)
 {
     return pixel.a;
@@ -584,58 +547,156 @@ static uint8_t get_upixel8_b(DP_UPixel8 pixel)
     return pixel.b;
 }
 
-static bool write_pixel_channels(DP_DrawContext *dc, DP_Output *out,
-                                 size_t rows, size_t stride,
-                                 const DP_UPixel8 *pixels, size_t *out_a,
-                                 size_t *out_r, size_t *out_g, size_t *out_b)
+
+typedef struct DP_SavePsdLayerJob {
+    DP_LayerContent *lc; // NULL for group boundaries, which get no pixels.
+    bool censored;
+    bool background;
+    size_t pos;
+    DP_Semaphore *sem_done;
+    unsigned char *buffer;
+    size_t size;
+    int offset_x, offset_y, width, height;
+    size_t channel_sizes[4];
+} DP_SavePsdLayerJob;
+
+static void push_layer_job(DP_Vector *jobs, DP_LayerContent *lc_or_null,
+                           bool censored, bool background, size_t pos)
 {
-    size_t counts_length = rows * 2;
-    size_t pool_size = counts_length + stride * 3;
-    unsigned char *counts = DP_draw_context_pool_require(dc, pool_size);
-    uint8_t *src = counts + counts_length;
-    unsigned char *dst = src + stride;
-    return write_channel(out, rows, stride, pixels, counts_length, counts, src,
-                         dst, get_upixel8_a, out_a)
-        && write_channel(out, rows, stride, pixels, counts_length, counts, src,
-                         dst, get_upixel8_r, out_r)
-        && write_channel(out, rows, stride, pixels, counts_length, counts, src,
-                         dst, get_upixel8_g, out_g)
-        && write_channel(out, rows, stride, pixels, counts_length, counts, src,
-                         dst, get_upixel8_b, out_b);
-}
-
-static bool write_pixel_data(DP_DrawContext *dc, DP_Output *out, size_t pos,
-                             const DP_UPixel8 *pixels, int offset_x,
-                             int offset_y, int width, int height)
-{
-    if (pixels && width > 0 && height > 0) {
+    DP_SavePsdLayerJob job = {
+        lc_or_null, censored, background, pos, NULL, NULL, 0, 0, 0, 0, 0,
+        {0, 0, 0, 0}};
+    DP_VECTOR_PUSH_TYPE(jobs, DP_SavePsdLayerJob, job);
+}
+
+static void collect_layer_jobs_recursive(DP_Vector *jobs, DP_LayerList *ll,
+                                         DP_LayerPropsList *lpl,
+                                         DP_SavePsdLayerOffsets *layer_offsets,
+                                         bool parent_censored)
+{
+    int count = DP_layer_props_list_count(lpl);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            push_layer_job(jobs, NULL, false, false, 0);
+            collect_layer_jobs_recursive(
+                jobs,
+                DP_layer_group_children_noinc(
+                    DP_layer_list_group_at_noinc(ll, i)),
+                child_lpl, layer_offsets, DP_layer_props_censored_any(lp));
+            push_layer_job(jobs, NULL, false, false, 0);
+        }
+        else {
+            push_layer_job(jobs, DP_layer_list_content_at_noinc(ll, i),
+                           parent_censored || DP_layer_props_censored_any(lp),
+                           false, get_layer_offset(layer_offsets, lp));
+        }
+    }
+}
+
+static size_t encode_channel(size_t rows, size_t stride,
+                             const DP_UPixel8 *pixels, uint8_t *src,
+                             unsigned char *dst, uint8_t (*extract)(DP_UPixel8),
+                             unsigned char *buffer)
+{
+    // Compression type: run-length encoding, then the compressed length of
+    // each row, then the rows themselves.
+    buffer[0] = 0;
+    buffer[1] = 1;
+    unsigned char *counts = buffer + 2;
+    size_t used = 2 + rows * 2;
+    for (size_t i = 0; i < rows; ++i) {
+        size_t offset = i * stride;
+        extract_channel(stride, pixels + offset, src, extract);
+        size_t length = rle_compress(stride, src, dst);
+        memcpy(buffer + used, dst, length);
+        used += length;
+        DP_write_bigendian_uint16(DP_size_to_uint16(length), counts + i * 2);
+    }
+    return used;
+}
+
+static void encode_layer(DP_SavePsdLayerJob *job)
+{
+    DP_UPixel8 *pixels;
+    if (job->background) {
+        pixels = DP_layer_content_to_upixels8(job->lc, 0, 0, job->width,
+                                              job->height);
+    }
+    else {
+        pixels = DP_layer_content_to_upixels8_cropped(
+            job->lc, job->censored, &job->offset_x, &job->offset_y,
+            &job->width, &job->height);
+    }
+
+    if (pixels && job->width > 0 && job->height > 0) {
         // We got some pixel data, run-length encode it. That's the default in
-        // Photoshop apparently and Krita also always uses this option.
-        size_t rows = DP_int_to_size(height);
-        size_t stride = DP_int_to_size(width);
-        size_t a, r, g, b;
-        if (!write_pixel_channels(dc, out, rows, stride, pixels, &a, &r, &g,
-                                  &b)) {
+        // Photoshop apparently and Krita also always uses this option. A row
+        // compresses to at most one length byte per 128 bytes on top of its
+        // own size, which gives an upper bound for the buffer.
+        size_t rows = DP_int_to_size(job->height);
+        size_t stride = DP_int_to_size(job->width);
+        size_t channel_bound = 2 + rows * (2 + stride + stride / 128 + 1);
+        unsigned char *buffer = DP_malloc(channel_bound * 4);
+        uint8_t *src = DP_malloc(stride * 3);
+        unsigned char *dst = src + stride;
+
+        uint8_t (*extracts[])(DP_UPixel8) = {get_upixel8_a, get_upixel8_r,
+                                             get_upixel8_g, get_upixel8_b};
+        size_t used = 0;
+        for (int i = 0; i < 4; ++i) {
+            size_t size = encode_channel(rows, stride, pixels, src, dst,
+                                         extracts[i], buffer + used);
+            job->channel_sizes[i] = size;
+            used += size;
+        }
+
+        DP_free(src);
+        job->buffer = DP_realloc(buffer, used);
+        job->size = used;
+    }
+    DP_free(pixels);
+}
+
+static void encode_layer_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_SavePsdLayerJob *job = *(DP_SavePsdLayerJob **)element;
+    encode_layer(job);
+    DP_SEMAPHORE_MUST_POST(job->sem_done);
+}
+
+static bool write_encoded_layer(DP_Output *out, DP_SavePsdLayerJob *job)
+{
+    if (job->buffer) {
+        bool ok = DP_output_write(out, job->buffer, job->size);
+        DP_free(job->buffer);
+        job->buffer = NULL;
+        if (!ok) {
             return false;
         }
 
         // Go back and fill in the channel size information.
         bool error;
         size_t end_pos = DP_output_tell(out, &error);
-        return !error && DP_output_seek(out, pos)
+        int offset_x = job->offset_x;
+        int offset_y = job->offset_y;
+        size_t *sizes = job->channel_sizes;
+        return !error && DP_output_seek(out, job->pos)
             && DP_OUTPUT_WRITE_BIGENDIAN(
                 out,
                 // Bounding rectangle.
                 DP_OUTPUT_UINT32(DP_int_to_uint32(offset_y)),
                 DP_OUTPUT_UINT32(DP_int_to_uint32(offset_x)),
-                DP_OUTPUT_UINT32(DP_int_to_uint32(offset_y + height)),
-                DP_OUTPUT_UINT32(DP_int_to_uint32(offset_x + width)),
+                DP_OUTPUT_UINT32(DP_int_to_uint32(offset_y + job->height)),
+                DP_OUTPUT_UINT32(DP_int_to_uint32(offset_x + job->width)),
                 // Number of channels, always 4 for ARGB.
                 DP_OUTPUT_UINT16(4),
                 // Channel ids and the sizes of their pixel data.
-                DP_OUTPUT_INT16(-1), DP_OUTPUT_UINT32(a), DP_OUTPUT_INT16(0),
-                DP_OUTPUT_UINT32(r), DP_OUTPUT_INT16(1), DP_OUTPUT_UINT32(g),
-                DP_OUTPUT_INT16(2), DP_OUTPUT_UINT32(b), DP_OUTPUT_END)
+                DP_OUTPUT_INT16(-1), DP_OUTPUT_UINT32(sizes[0]),
+                DP_OUTPUT_INT16(0), DP_OUTPUT_UINT32(sizes[1]),
+                DP_OUTPUT_INT16(1), DP_OUTPUT_UINT32(sizes[2]),
+                DP_OUTPUT_INT16(2), DP_OUTPUT_UINT32(sizes[3]), DP_OUTPUT_END)
             && DP_output_seek(out, end_pos);
     }
     else {
@@ -644,72 +705,120 @@ static bool write_pixel_data(DP_DrawContext *dc, DP_Output *out, size_t pos,
     }
 }
 
-static bool write_background_pixel_data(DP_CanvasState *cs, DP_DrawContext *dc,
-                                        DP_Output *out,
-                                        DP_SavePsdLayerOffsets *layer_offsets)
+static bool write_layer_jobs_sequential(DP_Output *out,
+                                        DP_SavePsdLayerJob *jobs, int count)
 {
-    int width = DP_canvas_state_width(cs);
-    int height = DP_canvas_state_height(cs);
-    DP_TransientLayerContent *tlc = DP_transient_layer_content_new_init(
-        width, height, DP_canvas_state_background_tile_noinc(cs));
-    DP_UPixel8 *pixels = DP_layer_content_to_upixels8((DP_LayerContent *)tlc, 0,
-                                                      0, width, height);
-    DP_transient_layer_content_decref(tlc);
-    return write_pixel_data(dc, out, layer_offsets->background_pos, pixels, 0,
-                            0, width, height);
-}
-
-static bool write_layer_content_pixel_data(DP_LayerContent *lc, bool censored,
-                                           DP_DrawContext *dc, DP_Output *out,
-                                           size_t pos)
-{
-    int offset_x, offset_y, width, height;
-    DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
-        lc, censored, &offset_x, &offset_y, &width, &height);
-    bool ok = write_pixel_data(dc, out, pos, pixels, offset_x, offset_y, width,
-                               height);
-    DP_free(pixels);
-    return ok;
+    for (int i = 0; i < count; ++i) {
+        DP_SavePsdLayerJob *job = &jobs[i];
+        if (job->lc) {
+            encode_layer(job);
+        }
+        if (!write_encoded_layer(out, job)) {
+            return false;
+        }
+    }
+    return true;
 }
 
-static bool write_layer_pixel_data_recursive(
-    DP_LayerList *ll, DP_LayerPropsList *lpl, DP_DrawContext *dc,
-    DP_Output *out, DP_SavePsdLayerOffsets *layer_offsets, bool parent_censored)
+// Extracting and compressing the channels is the slow part, so that's done on
+// a worker. Only a window of layers is in flight, to keep the compressed data
+// waiting to be written bounded. The writing itself happens in order here.
+static bool write_layer_jobs_parallel(DP_Output *out, DP_Worker *worker,
+                                      DP_SavePsdLayerJob *jobs, int count)
 {
-    int count = DP_layer_props_list_count(lpl);
-    bool ok = true;
-    for (int i = 0; ok && i < count; ++i) {
-        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
-        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
-        if (child_lpl) {
-            ok = write_pixel_data(dc, out, 0, NULL, 0, 0, 0, 0)
-              && write_layer_pixel_data_recursive(
-                     DP_layer_group_children_noinc(
-                         DP_layer_list_group_at_noinc(ll, i)),
-                     child_lpl, dc, out, layer_offsets,
-                     DP_layer_props_censored_any(lp))
-              && write_pixel_data(dc, out, 0, NULL, 0, 0, 0, 0);
+    int window = DP_min_int(count, DP_worker_thread_count(worker) * 2);
+    DP_Semaphore **sems = DP_malloc(sizeof(*sems) * DP_int_to_size(window));
+    int sem_count = 0;
+    for (; sem_count < window; ++sem_count) {
+        sems[sem_count] = DP_semaphore_new(0);
+        if (!sems[sem_count]) {
+            break;
         }
-        else {
-            ok = write_layer_content_pixel_data(
-                DP_layer_list_content_at_noinc(ll, i),
-                parent_censored || DP_layer_props_censored_any(lp), dc, out,
-                get_layer_offset(layer_offsets, lp));
+    }
+
+    bool ok;
+    if (sem_count == window) {
+        ok = true;
+        int pushed = 0;
+        for (int written = 0; written < count; ++written) {
+            while (pushed < count && pushed - written < window) {
+                DP_SavePsdLayerJob *job = &jobs[pushed];
+                if (job->lc) {
+                    job->sem_done = sems[pushed % window];
+                    DP_worker_push(worker, &job);
+                }
+                ++pushed;
+            }
+
+            // After an error, jobs already pushed still need to be waited on,
+            // since they're writing into the job array.
+            DP_SavePsdLayerJob *job = &jobs[written];
+            if (job->sem_done) {
+                DP_SEMAPHORE_MUST_WAIT(job->sem_done);
+            }
+            if (ok) {
+                ok = write_encoded_layer(out, job);
+                if (!ok) {
+                    count = pushed;
+                }
+            }
         }
     }
+    else {
+        ok = false;
+    }
+
+    for (int i = 0; i < sem_count; ++i) {
+        DP_semaphore_free(sems[i]);
+    }
+    DP_free(sems);
     return ok;
 }
 
 static bool
-write_layer_pixel_data_section(DP_CanvasState *cs, DP_DrawContext *dc,
-                               DP_Output *out,
+write_layer_pixel_data_section(DP_CanvasState *cs, DP_Output *out,
                                DP_SavePsdLayerOffsets *layer_offsets)
 {
-    return write_background_pixel_data(cs, dc, out, layer_offsets)
-        && write_layer_pixel_data_recursive(
-               DP_canvas_state_layers_noinc(cs),
-               DP_canvas_state_layer_props_noinc(cs), dc, out, layer_offsets,
-               false);
+    int width = DP_canvas_state_width(cs);
+    int height = DP_canvas_state_height(cs);
+    DP_TransientLayerContent *background_tlc =
+        DP_transient_layer_content_new_init(
+            width, height, DP_canvas_state_background_tile_noinc(cs));
+
+    DP_Vector jobs;
+    DP_VECTOR_INIT_TYPE(&jobs, DP_SavePsdLayerJob, 64);
+    push_layer_job(&jobs, (DP_LayerContent *)background_tlc, false, true,
+                   layer_offsets->background_pos);
+    DP_SavePsdLayerJob *background_job = jobs.elements;
+    background_job->width = width;
+    background_job->height = height;
+    collect_layer_jobs_recursive(&jobs, DP_canvas_state_layers_noinc(cs),
+                                 DP_canvas_state_layer_props_noinc(cs),
+                                 layer_offsets, false);
+
+    int count = DP_size_to_int(jobs.used);
+    DP_SavePsdLayerJob *elements = jobs.elements;
+    DP_Worker *worker =
+        count > 1 ? DP_worker_new(DP_int_to_size(count),
+                                  sizeof(DP_SavePsdLayerJob *),
+                                  DP_worker_cpu_count(32), encode_layer_job)
+                  : NULL;
+
+    bool ok;
+    if (worker) {
+        ok = write_layer_jobs_parallel(out, worker, elements, count);
+        DP_worker_free_join(worker);
+    }
+    else {
+        ok = write_layer_jobs_sequential(out, elements, count);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        DP_free(elements[i].buffer);
+    }
+    DP_vector_dispose(&jobs);
+    DP_transient_layer_content_decref(background_tlc);
+    return ok;
 }
 
 static bool write_layer_info_section(DP_CanvasState *cs, DP_DrawContext *dc,
@@ -737,7 +846,7 @@ static bool write_layer_info_section(DP_CanvasState *cs, DP_DrawContext *dc,
         // Remaining layer info.
         && write_layer_infos_recursive(lpl, dc, out, layer_offsets)
         // Channel pixel data.
-        && write_layer_pixel_data_section(cs, dc, out, layer_offsets)
+        && write_layer_pixel_data_section(cs, out, layer_offsets)
         // Fill in section size.
         && write_size_prefix(out, section_start, 2);
 }
@@ -5,14 +5,18 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
 #include <dpcommon/output.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpengine/canvas_state.h>
 #include <dpengine/image.h>
+#include <dpengine/pixels.h>
 #include <dpengine/view_mode.h>
 #include <libavcodec/avcodec.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
 #include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 
@@ -20,6 +24,12 @@
 // Same as IO_BUFFER_SIZE in ffmpeg's avio.c.
 #define BUFFER_SIZE 32768
 
+// Hardware encoders take NV12 frames, which they usually get uploaded into a
+// fixed pool of surfaces. That pool has to fit the frames being rendered ahead
+// plus the ones the encoder is holding onto for lookahead and references.
+#define HARDWARE_SW_PIX_FMT      AV_PIX_FMT_NV12
+#define HARDWARE_FRAME_POOL_SIZE 32
+
 // FFMPEG broke their API in a weird way when they added const and then switched
 // up how you check for it. We just cast away constness from pointers when
 // passing them to functions to get around that.
@@ -71,6 +81,36 @@ static enum AVCodecID get_format_codec_id(int format)
     }
 }
 
+typedef struct DP_SaveVideoHardwareEncoder {
+    const char *name;
+    enum AVHWDeviceType device_type;
+    enum AVPixelFormat pix_fmt;
+} DP_SaveVideoHardwareEncoder;
+
+// Encoders to try in order. NVENC and VideoToolbox can't encode VP8 or VP9,
+// so there's nothing for them here.
+static const DP_SaveVideoHardwareEncoder *
+get_format_hardware_encoders(int format)
+{
+    static const DP_SaveVideoHardwareEncoder vp9_encoders[] = {
+        {"vp9_vaapi", AV_HWDEVICE_TYPE_VAAPI, AV_PIX_FMT_VAAPI},
+        {"vp9_qsv", AV_HWDEVICE_TYPE_QSV, AV_PIX_FMT_QSV},
+        {NULL, AV_HWDEVICE_TYPE_NONE, AV_PIX_FMT_NONE},
+    };
+    static const DP_SaveVideoHardwareEncoder vp8_encoders[] = {
+        {"vp8_vaapi", AV_HWDEVICE_TYPE_VAAPI, AV_PIX_FMT_VAAPI},
+        {NULL, AV_HWDEVICE_TYPE_NONE, AV_PIX_FMT_NONE},
+    };
+    switch (format) {
+    case DP_SAVE_VIDEO_FORMAT_MP4_VP9:
+        return vp9_encoders;
+    case DP_SAVE_VIDEO_FORMAT_WEBM_VP8:
+        return vp8_encoders;
+    default:
+        return NULL;
+    }
+}
+
 bool DP_save_video_format_supported(int format)
 {
     enum AVCodecID codec_id = get_format_codec_id(format);
@@ -195,7 +235,6 @@ static void set_format_codec_params(int format, AVCodecContext *codec_context)
 {
     switch (format) {
     case DP_SAVE_VIDEO_FORMAT_PALETTE:
-    case DP_SAVE_VIDEO_FORMAT_GIF:
         break;
     case DP_SAVE_VIDEO_FORMAT_WEBM_VP8:
         codec_context->bit_rate = 1 * 1024 * 1024;
@@ -205,6 +244,12 @@ static void set_format_codec_params(int format, AVCodecContext *codec_context)
         codec_context->bit_rate = 0;
         set_option(codec_context->priv_data, "crf", "20");
         break;
+    case DP_SAVE_VIDEO_FORMAT_GIF:
+        // Crop each frame to what changed and make unchanged pixels
+        // transparent, which is what keeps long animations small.
+        set_option(codec_context->priv_data, "gifflags",
+                   "+offsetting+transdiff");
+        break;
     case DP_SAVE_VIDEO_FORMAT_WEBP:
         set_option(codec_context->priv_data, "lossless", "1");
         set_option(codec_context->priv_data, "preset", "drawing");
@@ -240,7 +285,9 @@ static const char *get_format_filter(int format)
     case DP_SAVE_VIDEO_FORMAT_PALETTE:
         return "palettegen=stats_mode=full";
     case DP_SAVE_VIDEO_FORMAT_GIF:
-        return "[in][palette]paletteuse[out]";
+        // Only dither the rectangle that changed from the previous frame, so
+        // that the rest stays identical and the encoder can skip over it.
+        return "[in][palette]paletteuse=diff_mode=rectangle[out]";
     default:
         return NULL;
     }
@@ -443,6 +490,382 @@ static DP_SaveResult filter_frame(AVCodecContext *codec_context,
     }
 }
 
+// Flattening and scaling frames is slow, so it runs ahead on a worker while
+// the frames get encoded here in order. Each slot in the window has its own
+// buffers, since the encoder may still be holding onto a frame it was given.
+// With a hardware encoder, each slot also gets a surface from the encoder's
+// pool. Where the platform can map those into memory, frames get scaled right
+// into them, otherwise they're scaled into the software frame and uploaded.
+typedef struct DP_SaveVideoRender {
+    DP_CanvasState *cs;
+    DP_Rect crop;
+    unsigned int flat_image_flags;
+    AVBufferRef *hw_frames_context;
+} DP_SaveVideoRender;
+
+typedef struct DP_SaveVideoSlot {
+    const DP_SaveVideoRender *render;
+    DP_Semaphore *sem_done;
+    DP_ViewModeBuffer vmb;
+    DP_Image *img;
+    struct SwsContext *sws_context;
+    AVFrame *frame;
+    AVFrame *hw_frame;
+    AVFrame *mapped_frame;
+    bool map_failed;
+    int frame_index;
+    char *error;
+} DP_SaveVideoSlot;
+
+// A run of identical frames, which only gets rendered once.
+typedef struct DP_SaveVideoRun {
+    int frame_index;
+    int instances;
+} DP_SaveVideoRun;
+
+static bool init_slot(DP_SaveVideoSlot *slot, const DP_SaveVideoRender *render,
+                      int input_width, int input_height, int output_width,
+                      int output_height, int pix_fmt, int scaling_flags)
+{
+    slot->render = render;
+    DP_view_mode_buffer_init(&slot->vmb);
+
+    slot->sem_done = DP_semaphore_new(0);
+    if (!slot->sem_done) {
+        return false;
+    }
+
+    slot->frame = av_frame_alloc();
+    if (!slot->frame) {
+        DP_error_set("Failed to allocate frame");
+        return false;
+    }
+
+    slot->frame->width = output_width;
+    slot->frame->height = output_height;
+    slot->frame->format = pix_fmt;
+
+    int err = av_frame_get_buffer(slot->frame, 0);
+    if (err != 0) {
+        DP_error_set("Error getting frame buffer: %s", av_err2str(err));
+        return false;
+    }
+
+    if (render->hw_frames_context) {
+        slot->hw_frame = av_frame_alloc();
+        slot->mapped_frame = av_frame_alloc();
+        if (!slot->hw_frame || !slot->mapped_frame) {
+            DP_error_set("Failed to allocate hardware frame");
+            return false;
+        }
+    }
+
+    slot->sws_context = sws_getContext(input_width, input_height,
+                                       AV_PIX_FMT_BGRA, output_width,
+                                       output_height, pix_fmt, scaling_flags,
+                                       NULL, NULL, NULL);
+    if (!slot->sws_context) {
+        DP_error_set("Failed to allocate scaling context");
+        return false;
+    }
+
+    return true;
+}
+
+static void dispose_slot(DP_SaveVideoSlot *slot)
+{
+    DP_free(slot->error);
+    sws_freeContext(slot->sws_context);
+    av_frame_free(&slot->mapped_frame);
+    av_frame_free(&slot->hw_frame);
+    av_frame_free(&slot->frame);
+    DP_image_free(slot->img);
+    DP_view_mode_buffer_dispose(&slot->vmb);
+    if (slot->sem_done) {
+        DP_semaphore_free(slot->sem_done);
+    }
+}
+
+static bool scale_slot(DP_SaveVideoSlot *slot, AVFrame *frame)
+{
+    const DP_Rect *crop = &slot->render->crop;
+    const uint8_t *data = (const uint8_t *)DP_image_pixels(slot->img);
+    const int stride = DP_rect_width(*crop) * 4;
+    int err = sws_scale(slot->sws_context, &data, &stride, 0,
+                        DP_rect_height(*crop), frame->data, frame->linesize);
+    if (err < 0) {
+        slot->error = DP_format("Error scaling frame: %s", av_err2str(err));
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static bool scale_slot_mapped(DP_SaveVideoSlot *slot)
+{
+    AVFrame *mapped_frame = slot->mapped_frame;
+    mapped_frame->format = HARDWARE_SW_PIX_FMT;
+    int err = av_hwframe_map(mapped_frame, slot->hw_frame,
+                             AV_HWFRAME_MAP_WRITE | AV_HWFRAME_MAP_OVERWRITE);
+    if (err != 0) {
+        DP_debug("Can't map hardware frame, uploading instead: %s",
+                 av_err2str(err));
+        slot->map_failed = true;
+        return false;
+    }
+
+    // Unreferencing the mapped frame unmaps it, writing it back if needed. A
+    // scaling error is reported through the slot, no point in retrying it.
+    scale_slot(slot, mapped_frame);
+    av_frame_unref(mapped_frame);
+    return true;
+}
+
+static void scale_slot_hardware(DP_SaveVideoSlot *slot)
+{
+    AVFrame *hw_frame = slot->hw_frame;
+    av_frame_unref(hw_frame);
+    int err =
+        av_hwframe_get_buffer(slot->render->hw_frames_context, hw_frame, 0);
+    if (err != 0) {
+        slot->error =
+            DP_format("Error getting hardware frame: %s", av_err2str(err));
+        return;
+    }
+
+    if (slot->map_failed || !scale_slot_mapped(slot)) {
+        err = av_frame_make_writable(slot->frame);
+        if (err != 0) {
+            slot->error =
+                DP_format("Error making frame writeable: %s", av_err2str(err));
+            return;
+        }
+
+        if (scale_slot(slot, slot->frame)) {
+            err = av_hwframe_transfer_data(hw_frame, slot->frame, 0);
+            if (err != 0) {
+                slot->error = DP_format("Error uploading hardware frame: %s",
+                                        av_err2str(err));
+            }
+        }
+    }
+}
+
+static AVFrame *get_slot_output_frame(DP_SaveVideoSlot *slot)
+{
+    return slot->hw_frame ? slot->hw_frame : slot->frame;
+}
+
+static void render_slot(DP_SaveVideoSlot *slot)
+{
+    // Hardware frames are fresh from the pool every time, but the software
+    // frame may still be referenced by the encoder from the last go-around.
+    if (!slot->hw_frame) {
+        int err = av_frame_make_writable(slot->frame);
+        if (err != 0) {
+            slot->error =
+                DP_format("Error making frame writeable: %s", av_err2str(err));
+            return;
+        }
+    }
+
+    const DP_SaveVideoRender *render = slot->render;
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
+        &slot->vmb, render->cs, slot->frame_index);
+    if (!DP_canvas_state_into_flat_image(render->cs, render->flat_image_flags,
+                                         &render->crop, &vmf, &slot->img)) {
+        slot->error = DP_strdup(DP_error());
+        return;
+    }
+
+    if (slot->hw_frame) {
+        scale_slot_hardware(slot);
+    }
+    else {
+        scale_slot(slot, slot->frame);
+    }
+}
+
+static void render_slot_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_SaveVideoSlot *slot = *(DP_SaveVideoSlot **)element;
+    render_slot(slot);
+    DP_SEMAPHORE_MUST_POST(slot->sem_done);
+}
+
+static void push_slot(DP_Worker *worker, DP_SaveVideoSlot *slot,
+                      int frame_index)
+{
+    slot->frame_index = frame_index;
+    if (worker) {
+        DP_worker_push(worker, &slot);
+    }
+    else {
+        render_slot_job(&slot, 0);
+    }
+}
+
+static int collect_runs(DP_CanvasState *cs, int start, int end_inclusive,
+                        int loops, DP_SaveVideoRun **out_runs)
+{
+    int frame_count = end_inclusive - start + 1;
+    DP_SaveVideoRun *runs = DP_malloc(sizeof(*runs)
+                                      * DP_int_to_size(frame_count * loops));
+    int run_count = 0;
+    int frame_index = start;
+    while (frame_index <= end_inclusive) {
+        int instances = 1;
+        while (frame_index < end_inclusive
+               && DP_canvas_state_same_frame(cs, frame_index,
+                                             frame_index + 1)) {
+            ++frame_index;
+            ++instances;
+        }
+        runs[run_count++] =
+            (DP_SaveVideoRun){frame_index - instances + 1, instances};
+        ++frame_index;
+    }
+
+    // Every loop is the same sequence of runs.
+    int runs_per_loop = run_count;
+    for (int i = 1; i < loops; ++i) {
+        memcpy(runs + run_count, runs,
+               sizeof(*runs) * DP_int_to_size(runs_per_loop));
+        run_count += runs_per_loop;
+    }
+
+    *out_runs = runs;
+    return run_count;
+}
+
+static AVCodecContext *alloc_codec_context(const AVCodec *codec, int width,
+                                           int height, int framerate,
+                                           int pix_fmt)
+{
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    if (codec_context) {
+        codec_context->width = width;
+        codec_context->height = height;
+        codec_context->pix_fmt = pix_fmt;
+        codec_context->framerate = av_make_q(framerate, 1);
+        codec_context->time_base = av_make_q(1, framerate);
+    }
+    else {
+        DP_error_set("Failed to allocate codec context");
+    }
+    return codec_context;
+}
+
+static AVCodecContext *
+open_hardware_codec_context(const DP_SaveVideoHardwareEncoder *encoder,
+                            int width, int height, int framerate)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(encoder->name);
+    if (!codec) {
+        DP_debug("Hardware encoder %s not compiled in", encoder->name);
+        return NULL;
+    }
+
+    AVBufferRef *device_context = NULL;
+    int err = av_hwdevice_ctx_create(&device_context, encoder->device_type,
+                                     NULL, NULL, 0);
+    if (err < 0) {
+        DP_info("No %s device for hardware encoder %s: %s",
+                av_hwdevice_get_type_name(encoder->device_type), encoder->name,
+                av_err2str(err));
+        return NULL;
+    }
+
+    AVBufferRef *frames_context = av_hwframe_ctx_alloc(device_context);
+    av_buffer_unref(&device_context);
+    if (!frames_context) {
+        DP_info("Failed to allocate frames for hardware encoder %s",
+                encoder->name);
+        return NULL;
+    }
+
+    AVHWFramesContext *frames = (AVHWFramesContext *)frames_context->data;
+    frames->format = encoder->pix_fmt;
+    frames->sw_format = HARDWARE_SW_PIX_FMT;
+    frames->width = width;
+    frames->height = height;
+    frames->initial_pool_size = HARDWARE_FRAME_POOL_SIZE;
+    err = av_hwframe_ctx_init(frames_context);
+    if (err < 0) {
+        DP_info("Error initializing frames for hardware encoder %s: %s",
+                encoder->name, av_err2str(err));
+        av_buffer_unref(&frames_context);
+        return NULL;
+    }
+
+    AVCodecContext *codec_context =
+        alloc_codec_context(codec, width, height, framerate, encoder->pix_fmt);
+    if (!codec_context) {
+        av_buffer_unref(&frames_context);
+        return NULL;
+    }
+
+    // Hardware encoders don't have a constant quality mode in common, so give
+    // them a bit rate that's generous for drawings at this size instead.
+    codec_context->bit_rate = (int64_t)width * (int64_t)height
+                            * (int64_t)framerate / (int64_t)4;
+    codec_context->hw_frames_ctx = frames_context;
+    err = avcodec_open2(codec_context, codec, NULL);
+    if (err != 0) {
+        DP_info("Error opening hardware encoder %s: %s", encoder->name,
+                av_err2str(err));
+        avcodec_free_context(&codec_context);
+        return NULL;
+    }
+
+    DP_info("Using hardware encoder %s", encoder->name);
+    return codec_context;
+}
+
+static AVCodecContext *open_codec_context(int format, unsigned int flags,
+                                          enum AVCodecID codec_id, int width,
+                                          int height, int framerate,
+                                          DP_SaveResult *out_result)
+{
+    const DP_SaveVideoHardwareEncoder *encoders =
+        flags & DP_SAVE_VIDEO_FLAGS_HARDWARE
+            ? get_format_hardware_encoders(format)
+            : NULL;
+    for (int i = 0; encoders && encoders[i].name; ++i) {
+        AVCodecContext *codec_context =
+            open_hardware_codec_context(&encoders[i], width, height, framerate);
+        if (codec_context) {
+            return codec_context;
+        }
+    }
+
+    const AVCodec *codec = avcodec_find_encoder(codec_id);
+    if (!codec) {
+        DP_error_set("Failed to find codec for '%s'", get_format_name(format));
+        *out_result = DP_SAVE_RESULT_UNKNOWN_FORMAT;
+        return NULL;
+    }
+
+    AVCodecContext *codec_context = alloc_codec_context(
+        codec, width, height, framerate, get_format_pix_fmt(format, false));
+    if (!codec_context) {
+        *out_result = DP_SAVE_RESULT_INTERNAL_ERROR;
+        return NULL;
+    }
+
+    set_format_codec_params(format, codec_context);
+    int err = avcodec_open2(codec_context, codec, NULL);
+    if (err != 0) {
+        DP_error_set("Error opening codec: %s", av_err2str(err));
+        avcodec_free_context(&codec_context);
+        *out_result = DP_SAVE_RESULT_INTERNAL_ERROR;
+        return NULL;
+    }
+
+    return codec_context;
+}
+
 DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
 {
     DP_SaveResult result = DP_SAVE_RESULT_SUCCESS;
@@ -458,13 +881,12 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
     AVFilterContext *buffersink_context = NULL;
     DP_Output *output = NULL;
     AVFrame *palette_frame = NULL;
-    AVFrame *frame = NULL;
     AVFrame *filtered_frame = NULL;
     AVPacket *packet = NULL;
-    struct SwsContext *sws_context = NULL;
-    DP_ViewModeBuffer vmb;
-    DP_view_mode_buffer_init(&vmb);
-    DP_Image *img = NULL;
+    DP_Worker *worker = NULL;
+    DP_SaveVideoSlot *slots = NULL;
+    int slot_count = 0;
+    DP_SaveVideoRun *runs = NULL;
 
     DP_Rect crop;
     const char *format_name;
@@ -529,28 +951,21 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
         goto cleanup;
     }
 
-    const AVCodec *codec = avcodec_find_encoder(codec_id);
-    if (!codec) {
-        DP_error_set("Failed to find codec for '%s'", format_name);
-        result = DP_SAVE_RESULT_UNKNOWN_FORMAT;
-        goto cleanup;
-    }
-
-    codec_context = avcodec_alloc_context3(codec);
+    codec_context = open_codec_context(
+        params.format, params.flags, codec_id,
+        get_format_codec_dimension(params.format, output_width),
+        get_format_codec_dimension(params.format, output_height), framerate,
+        &result);
     if (!codec_context) {
-        DP_error_set("Failed to allocate codec context");
-        result = DP_SAVE_RESULT_INTERNAL_ERROR;
         goto cleanup;
     }
 
-    codec_context->width =
-        get_format_codec_dimension(params.format, output_width);
-    codec_context->height =
-        get_format_codec_dimension(params.format, output_height);
-    codec_context->pix_fmt = get_format_pix_fmt(params.format, false);
-    codec_context->framerate = av_make_q(framerate, 1);
-    codec_context->time_base = av_make_q(1, framerate);
-    set_format_codec_params(params.format, codec_context);
+    // With a hardware encoder, frames get rendered in its software format
+    // and then uploaded into its surfaces. The codec context owns them.
+    AVBufferRef *hw_frames_context = codec_context->hw_frames_ctx;
+    int frame_pix_fmt = hw_frames_context
+                          ? HARDWARE_SW_PIX_FMT
+                          : get_format_pix_fmt(params.format, true);
 
     int err = avformat_alloc_output_context2(
         &format_context, REMOVE_CONST(output_format), NULL,
@@ -573,13 +988,6 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
     }
 
     stream->time_base = codec_context->time_base;
-    err = avcodec_open2(codec_context, codec, NULL);
-    if (err != 0) {
-        DP_error_set("Error opening codec: %s", av_err2str(err));
-        result = DP_SAVE_RESULT_INTERNAL_ERROR;
-        goto cleanup;
-    }
-
     codec_parameters = avcodec_parameters_alloc();
     if (!codec_parameters) {
         DP_error_set("Failed to create codec parameters");
@@ -800,24 +1208,6 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
         goto cleanup;
     }
 
-    frame = av_frame_alloc();
-    if (!frame) {
-        DP_error_set("Failed to allocate frame");
-        result = DP_SAVE_RESULT_INTERNAL_ERROR;
-        goto cleanup;
-    }
-
-    frame->width = output_width;
-    frame->height = output_height;
-    frame->format = get_format_pix_fmt(params.format, true);
-
-    err = av_frame_get_buffer(frame, 0);
-    if (err != 0) {
-        DP_error_set("Error getting frame buffer: %s", av_err2str(err));
-        result = DP_SAVE_RESULT_INTERNAL_ERROR;
-        goto cleanup;
-    }
-
     packet = av_packet_alloc();
     if (!packet) {
         DP_error_set("Failed to allocate packet");
@@ -825,16 +1215,36 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
         goto cleanup;
     }
 
-    sws_context = sws_getContext(input_width, input_height, AV_PIX_FMT_BGRA,
-                                 output_width, output_height, frame->format,
-                                 get_scaling_flags(params.flags, input_width,
-                                                   input_height, output_width,
-                                                   output_height),
-                                 NULL, NULL, NULL);
-    if (!sws_context) {
-        DP_error_set("Failed to allocate scaling context");
-        result = DP_SAVE_RESULT_INTERNAL_ERROR;
-        goto cleanup;
+    DP_SaveVideoRender render = {params.cs, crop,
+                                 get_format_flat_image_flags(params.format),
+                                 hw_frames_context};
+    int run_count =
+        collect_runs(params.cs, start, end_inclusive, loops, &runs);
+    int thread_count = DP_worker_cpu_count(8);
+    int window = DP_min_int(run_count, thread_count * 2);
+    if (window > 1) {
+        worker = DP_worker_new(DP_int_to_size(window),
+                               sizeof(DP_SaveVideoSlot *), thread_count,
+                               render_slot_job);
+        if (!worker) {
+            DP_warn("Error creating video worker: %s", DP_error());
+            window = 1;
+        }
+    }
+
+    int scaling_flags =
+        get_scaling_flags(params.flags, input_width, input_height,
+                          output_width, output_height);
+    slots = DP_malloc_zeroed(sizeof(*slots) * DP_int_to_size(window));
+    for (int i = 0; i < window; ++i) {
+        // Counted before initializing, since a partial init needs disposal.
+        ++slot_count;
+        if (!init_slot(&slots[i], &render, input_width, input_height,
+                       output_width, output_height, frame_pix_fmt,
+                       scaling_flags)) {
+            result = DP_SAVE_RESULT_INTERNAL_ERROR;
+            goto cleanup;
+        }
     }
 
     if (!report_progress(params.progress_fn, params.user, 0.0)) {
@@ -892,73 +1302,59 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
     int frames_done = 0;
     int64_t duration =
         get_format_frame_duration(params.format, codec_context, stream);
-    int instances = 0;
-    frame->pts = 0;
-    unsigned int flat_image_flags = get_format_flat_image_flags(params.format);
-    for (int loop_index = 0; loop_index < loops; ++loop_index) {
-        int frame_index = start;
-        while (frame_index <= end_inclusive) {
-            err = av_frame_make_writable(frame);
-            if (err != 0) {
-                DP_error_set("Error making frame writeable: %s",
-                             av_err2str(err));
-                result = DP_SAVE_RESULT_INTERNAL_ERROR;
-                goto cleanup;
-            }
+    int64_t pts = 0;
+    AVFrame *last_frame = NULL;
+    int last_instances = 0;
+    int pushed = 0;
+    for (int done = 0; done < run_count; ++done) {
+        while (pushed < run_count && pushed - done < window) {
+            push_slot(worker, &slots[pushed % window],
+                      runs[pushed].frame_index);
+            ++pushed;
+        }
 
-            instances = 1;
-            while (frame_index < end_inclusive
-                   && DP_canvas_state_same_frame(params.cs, frame_index,
-                                                 frame_index + 1)) {
-                ++frame_index;
-                ++instances;
-            }
+        // Bailing out here is okay, cleanup joins the worker before freeing
+        // any of the slots, which might still be getting rendered into.
+        DP_SaveVideoSlot *slot = &slots[done % window];
+        DP_SEMAPHORE_MUST_WAIT(slot->sem_done);
+        if (slot->error) {
+            DP_error_set("%s", slot->error);
+            result = DP_SAVE_RESULT_INTERNAL_ERROR;
+            goto cleanup;
+        }
 
-            DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
-                &vmb, params.cs, frame_index - instances + 1);
-            if (!DP_canvas_state_into_flat_image(params.cs, flat_image_flags,
-                                                 &crop, &vmf, &img)) {
-                result = DP_SAVE_RESULT_INTERNAL_ERROR;
-                goto cleanup;
-            }
-            const uint8_t *data = (const uint8_t *)DP_image_pixels(img);
-            const int stride = input_width * 4;
-            sws_scale(sws_context, &data, &stride, 0, input_height, frame->data,
-                      frame->linesize);
-
-            result = filter_frame(codec_context, format_context, frame, packet,
-                                  buffersrc_context, buffersink_context,
-                                  filtered_frame);
-            if (result != DP_SAVE_RESULT_SUCCESS) {
-                goto cleanup;
-            }
+        AVFrame *frame = get_slot_output_frame(slot);
+        frame->pts = pts;
+        result = filter_frame(codec_context, format_context, frame, packet,
+                              buffersrc_context, buffersink_context,
+                              filtered_frame);
+        if (result != DP_SAVE_RESULT_SUCCESS) {
+            goto cleanup;
+        }
 
-            frame->pts += duration * instances;
-            frames_done += instances;
-            ++frame_index;
-            if (!report_frame_progress(params.progress_fn, params.user,
-                                       frames_done, frames_to_do)) {
-                result = DP_SAVE_RESULT_CANCEL;
-                goto cleanup;
-            }
+        last_frame = frame;
+        last_instances = runs[done].instances;
+        pts += duration * last_instances;
+        frames_done += last_instances;
+        if (!report_frame_progress(params.progress_fn, params.user,
+                                   frames_done, frames_to_do)) {
+            result = DP_SAVE_RESULT_CANCEL;
+            goto cleanup;
         }
     }
 
-    DP_image_free(img);
-    img = NULL;
-
-    if (instances > 1) {
-        frame->pts -= duration;
-        result =
-            filter_frame(codec_context, format_context, frame, packet,
-                         buffersrc_context, buffersink_context, filtered_frame);
+    // Repeat the last frame at the end of a run, otherwise the encoder doesn't
+    // know how long it's supposed to last.
+    if (last_instances > 1) {
+        last_frame->pts = pts - duration;
+        result = filter_frame(codec_context, format_context, last_frame,
+                              packet, buffersrc_context, buffersink_context,
+                              filtered_frame);
         if (result != DP_SAVE_RESULT_SUCCESS) {
             goto cleanup;
         }
     }
 
-    av_frame_free(&frame);
-
     if (!report_progress(params.progress_fn, params.user, 0.98)) {
         result = DP_SAVE_RESULT_CANCEL;
         goto cleanup;
@@ -1009,9 +1405,12 @@ DP_SaveResult DP_save_animation_video(DP_SaveVideoParams params)
     }
 
 cleanup:
-    DP_image_free(img);
-    DP_view_mode_buffer_dispose(&vmb);
-    sws_freeContext(sws_context);
+    DP_worker_free_join(worker);
+    for (int i = 0; i < slot_count; ++i) {
+        dispose_slot(&slots[i]);
+    }
+    DP_free(slots);
+    DP_free(runs);
     if (format_context && format_context->pb) {
         av_freep(&format_context->pb->buffer);
         avio_context_free(&format_context->pb);
@@ -1024,7 +1423,6 @@ cleanup:
     avfilter_inout_free(&filter_outputs);
     avfilter_inout_free(&filter_palette_outputs);
     av_packet_free(&packet);
-    av_frame_free(&frame);
     av_frame_free(&filtered_frame);
     av_frame_free(&palette_frame);
     avcodec_parameters_free(&codec_parameters);
@@ -1034,17 +1432,320 @@ cleanup:
 }
 
 
-struct DP_GifProgressParams {
-    bool palette;
-    DP_SaveAnimationProgressFn progress_fn;
-    void *user;
-};
+// The GIF palette is generated from a histogram of all frames, weighted by
+// how long they're shown. Each worker thread has a histogram of its own that
+// it adds the frames it renders into, those get merged at the end and then
+// median cut down to the palette size. Colors are binned at 5 bits per
+// channel, but the bins keep sums of their exact colors, so the palette
+// entries are the true averages. The histogram is taken from the frames
+// before scaling, which doesn't make a difference to the colors that matter.
+#define GIF_HISTOGRAM_BITS      5
+#define GIF_HISTOGRAM_BIN_COUNT (1 << (GIF_HISTOGRAM_BITS * 3))
+// One entry is left over for the transparent color, which goes last.
+#define GIF_PALETTE_COLOR_COUNT 255
+
+typedef struct DP_GifHistogramBin {
+    uint64_t count;
+    uint64_t sums[3];
+} DP_GifHistogramBin;
+
+typedef struct DP_GifHistogramThread {
+    DP_ViewModeBuffer vmb;
+    DP_Image *img;
+    char *error;
+    DP_GifHistogramBin bins[GIF_HISTOGRAM_BIN_COUNT];
+} DP_GifHistogramThread;
 
-static bool on_gif_progress_palette(void *user, double progress)
+typedef struct DP_GifHistogramContext {
+    DP_CanvasState *cs;
+    DP_Rect crop;
+    DP_GifHistogramThread **threads;
+} DP_GifHistogramContext;
+
+typedef struct DP_GifHistogramJob {
+    DP_GifHistogramContext *ctx;
+    DP_SaveVideoRun run;
+} DP_GifHistogramJob;
+
+typedef struct DP_GifPaletteEntry {
+    uint8_t channels[3];
+    uint64_t count;
+    uint64_t sums[3];
+} DP_GifPaletteEntry;
+
+typedef struct DP_GifPaletteBox {
+    int start;
+    int end;
+    int split_channel;
+    int split_range;
+} DP_GifPaletteBox;
+
+static void histogram_job(void *element, int thread_index)
 {
-    DP_SaveGifParams *params = user;
-    DP_SaveAnimationProgressFn progress_fn = params->progress_fn;
-    return progress_fn ? progress_fn(params->user, progress * 0.49) : true;
+    DP_GifHistogramJob *job = element;
+    DP_GifHistogramContext *ctx = job->ctx;
+    DP_GifHistogramThread *t = ctx->threads[thread_index];
+    if (t->error) {
+        return;
+    }
+
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
+        &t->vmb, ctx->cs, job->run.frame_index);
+    if (!DP_canvas_state_into_flat_image(
+            ctx->cs, get_format_flat_image_flags(DP_SAVE_VIDEO_FORMAT_GIF),
+            &ctx->crop, &vmf, &t->img)) {
+        t->error = DP_strdup(DP_error());
+        return;
+    }
+
+    uint64_t instances = (uint64_t)job->run.instances;
+    const DP_Pixel8 *pixels = DP_image_pixels(t->img);
+    size_t pixel_count = DP_int_to_size(DP_image_width(t->img))
+                       * DP_int_to_size(DP_image_height(t->img));
+    unsigned int shift = 8u - GIF_HISTOGRAM_BITS;
+    for (size_t i = 0; i < pixel_count; ++i) {
+        // Alpha is one bit, transparent pixels get their own palette entry.
+        DP_Pixel8 pixel = pixels[i];
+        if (pixel.a != 0) {
+            size_t index = ((size_t)(pixel.r >> shift)
+                            << (GIF_HISTOGRAM_BITS * 2))
+                         | ((size_t)(pixel.g >> shift) << GIF_HISTOGRAM_BITS)
+                         | (size_t)(pixel.b >> shift);
+            DP_GifHistogramBin *bin = &t->bins[index];
+            bin->count += instances;
+            bin->sums[0] += (uint64_t)pixel.r * instances;
+            bin->sums[1] += (uint64_t)pixel.g * instances;
+            bin->sums[2] += (uint64_t)pixel.b * instances;
+        }
+    }
+}
+
+#define DEFINE_COMPARE_ENTRIES(CHANNEL)                                    \
+    static int compare_entries_##CHANNEL(const void *a, const void *b)     \
+    {                                                                      \
+        int ca = ((const DP_GifPaletteEntry *)a)->channels[CHANNEL];       \
+        int cb = ((const DP_GifPaletteEntry *)b)->channels[CHANNEL];       \
+        return ca - cb;                                                    \
+    }
+
+DEFINE_COMPARE_ENTRIES(0)
+DEFINE_COMPARE_ENTRIES(1)
+DEFINE_COMPARE_ENTRIES(2)
+
+static void measure_box(DP_GifPaletteEntry *entries, DP_GifPaletteBox *box)
+{
+    int min[3] = {255, 255, 255};
+    int max[3] = {0, 0, 0};
+    for (int i = box->start; i < box->end; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            int value = entries[i].channels[c];
+            min[c] = DP_min_int(min[c], value);
+            max[c] = DP_max_int(max[c], value);
+        }
+    }
+    box->split_channel = 0;
+    box->split_range = -1;
+    if (box->end - box->start > 1) {
+        for (int c = 0; c < 3; ++c) {
+            int range = max[c] - min[c];
+            if (range > box->split_range) {
+                box->split_channel = c;
+                box->split_range = range;
+            }
+        }
+    }
+}
+
+static void split_box(DP_GifPaletteEntry *entries, DP_GifPaletteBox *box,
+                      DP_GifPaletteBox *out_box)
+{
+    static int (*const compare_fns[])(const void *, const void *) = {
+        compare_entries_0, compare_entries_1, compare_entries_2};
+    int start = box->start;
+    int end = box->end;
+    qsort(entries + start, DP_int_to_size(end - start), sizeof(*entries),
+          compare_fns[box->split_channel]);
+
+    uint64_t total = 0;
+    for (int i = start; i < end; ++i) {
+        total += entries[i].count;
+    }
+
+    // Split at the weighted median, but leave at least one entry on each side.
+    int split = start + 1;
+    uint64_t accumulated = entries[start].count;
+    while (split < end - 1 && accumulated < total / 2) {
+        accumulated += entries[split].count;
+        ++split;
+    }
+
+    *out_box = (DP_GifPaletteBox){split, end, 0, -1};
+    box->end = split;
+    measure_box(entries, box);
+    measure_box(entries, out_box);
+}
+
+static int median_cut(DP_GifPaletteEntry *entries, int entry_count,
+                      DP_GifPaletteBox *boxes)
+{
+    if (entry_count == 0) {
+        return 0;
+    }
+
+    boxes[0] = (DP_GifPaletteBox){0, entry_count, 0, -1};
+    measure_box(entries, &boxes[0]);
+    int box_count = 1;
+    while (box_count < GIF_PALETTE_COLOR_COUNT) {
+        int best = -1;
+        int best_range = 0;
+        for (int i = 0; i < box_count; ++i) {
+            if (boxes[i].split_range > best_range) {
+                best = i;
+                best_range = boxes[i].split_range;
+            }
+        }
+        if (best == -1) {
+            break; // Every box is down to a single color.
+        }
+        split_box(entries, &boxes[best], &boxes[box_count++]);
+    }
+    return box_count;
+}
+
+static void write_palette(DP_GifHistogramBin *bins, unsigned char *out)
+{
+    DP_GifPaletteEntry *entries =
+        DP_malloc(sizeof(*entries) * GIF_HISTOGRAM_BIN_COUNT);
+    int entry_count = 0;
+    for (int i = 0; i < GIF_HISTOGRAM_BIN_COUNT; ++i) {
+        DP_GifHistogramBin *bin = &bins[i];
+        uint64_t count = bin->count;
+        if (count != 0) {
+            DP_GifPaletteEntry *entry = &entries[entry_count++];
+            entry->count = count;
+            for (int c = 0; c < 3; ++c) {
+                entry->sums[c] = bin->sums[c];
+                entry->channels[c] = (uint8_t)(bin->sums[c] / count);
+            }
+        }
+    }
+
+    DP_GifPaletteBox boxes[GIF_PALETTE_COLOR_COUNT];
+    int box_count = median_cut(entries, entry_count, boxes);
+
+    // BGRA order, unused entries are opaque black. The transparent color has
+    // to be the only one with zero alpha, since paletteuse looks for it.
+    memset(out, 0, DP_SAVE_VIDEO_GIF_PALETTE_BYTES);
+    for (int i = 0; i < GIF_PALETTE_COLOR_COUNT; ++i) {
+        if (i < box_count) {
+            uint64_t count = 0;
+            uint64_t sums[3] = {0, 0, 0};
+            for (int j = boxes[i].start; j < boxes[i].end; ++j) {
+                count += entries[j].count;
+                for (int c = 0; c < 3; ++c) {
+                    sums[c] += entries[j].sums[c];
+                }
+            }
+            out[i * 4 + 0] = (unsigned char)((sums[2] + count / 2) / count);
+            out[i * 4 + 1] = (unsigned char)((sums[1] + count / 2) / count);
+            out[i * 4 + 2] = (unsigned char)((sums[0] + count / 2) / count);
+        }
+        out[i * 4 + 3] = 255;
+    }
+    DP_free(entries);
+}
+
+static DP_SaveResult generate_gif_palette(DP_SaveGifParams *params,
+                                          DP_Rect crop, unsigned char *out)
+{
+    int frame_count = DP_canvas_state_frame_count(params->cs);
+    int start = params->start < 0 ? 0 : params->start;
+    int end_inclusive =
+        params->end_inclusive < 0 || params->end_inclusive > frame_count - 1
+            ? frame_count - 1
+            : params->end_inclusive;
+    if (start > end_inclusive) {
+        DP_error_set("Frame range is empty");
+        return DP_SAVE_RESULT_BAD_ARGUMENTS;
+    }
+
+    DP_SaveVideoRun *runs;
+    int run_count = collect_runs(params->cs, start, end_inclusive, 1, &runs);
+    int thread_count = DP_worker_cpu_count(8);
+    DP_GifHistogramThread **threads =
+        DP_malloc(sizeof(*threads) * DP_int_to_size(thread_count));
+    for (int i = 0; i < thread_count; ++i) {
+        threads[i] = DP_malloc_zeroed(sizeof(*threads[i]));
+        DP_view_mode_buffer_init(&threads[i]->vmb);
+    }
+
+    DP_GifHistogramContext ctx = {params->cs, crop, threads};
+    DP_Worker *worker =
+        thread_count > 1 && run_count > 1
+            ? DP_worker_new(DP_int_to_size(thread_count * 2),
+                            sizeof(DP_GifHistogramJob), thread_count,
+                            histogram_job)
+            : NULL;
+
+    // Frames are pushed in batches so that progress and cancellation can be
+    // checked in between. Without a worker, they're just done right here.
+    DP_SaveResult result = DP_SAVE_RESULT_SUCCESS;
+    int batch_size = thread_count * 2;
+    for (int done = 0; done < run_count; done += batch_size) {
+        int batch_end = DP_min_int(done + batch_size, run_count);
+        for (int i = done; i < batch_end; ++i) {
+            DP_GifHistogramJob job = {&ctx, runs[i]};
+            if (worker) {
+                DP_worker_push(worker, &job);
+            }
+            else {
+                histogram_job(&job, 0);
+            }
+        }
+        if (worker) {
+            DP_worker_wait(worker);
+        }
+
+        DP_SaveAnimationProgressFn progress_fn = params->progress_fn;
+        double progress = DP_int_to_double(batch_end)
+                        / DP_int_to_double(run_count) * 0.49;
+        if (progress_fn && !progress_fn(params->user, progress)) {
+            result = DP_SAVE_RESULT_CANCEL;
+            break;
+        }
+    }
+    DP_worker_free_join(worker);
+
+    for (int i = 0; i < thread_count; ++i) {
+        if (threads[i]->error && result == DP_SAVE_RESULT_SUCCESS) {
+            DP_error_set("%s", threads[i]->error);
+            result = DP_SAVE_RESULT_INTERNAL_ERROR;
+        }
+    }
+
+    if (result == DP_SAVE_RESULT_SUCCESS) {
+        DP_GifHistogramBin *bins = threads[0]->bins;
+        for (int i = 1; i < thread_count; ++i) {
+            DP_GifHistogramBin *thread_bins = threads[i]->bins;
+            for (int j = 0; j < GIF_HISTOGRAM_BIN_COUNT; ++j) {
+                bins[j].count += thread_bins[j].count;
+                for (int c = 0; c < 3; ++c) {
+                    bins[j].sums[c] += thread_bins[j].sums[c];
+                }
+            }
+        }
+        write_palette(bins, out);
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_free(threads[i]->error);
+        DP_image_free(threads[i]->img);
+        DP_view_mode_buffer_dispose(&threads[i]->vmb);
+        DP_free(threads[i]);
+    }
+    DP_free(threads);
+    DP_free(runs);
+    return result;
 }
 
 static bool on_gif_progress_gif(void *user, double progress)
@@ -1073,30 +1774,15 @@ DP_SaveResult DP_save_animation_video_gif(DP_SaveGifParams params)
         return DP_SAVE_RESULT_BAD_DIMENSIONS;
     }
 
-    // Generate GIF palette into an in-memory buffer.
-    void **buffer_ptr;
-    size_t *size_ptr;
-    DP_Output *palette_output = DP_mem_output_new(
-        DP_SAVE_VIDEO_GIF_PALETTE_BYTES, true, &buffer_ptr, &size_ptr);
-    if (!palette_output) {
-        return DP_SAVE_RESULT_INTERNAL_ERROR;
-    }
-
-    DP_SaveResult result = DP_save_animation_video((DP_SaveVideoParams){
-        params.cs, params.area, DP_SAVE_VIDEO_DESTINATION_OUTPUT,
-        palette_output, NULL, 0, params.flags, DP_SAVE_VIDEO_FORMAT_PALETTE,
-        params.width, params.height, params.start, params.end_inclusive,
-        params.framerate, 1, on_gif_progress_palette, &params});
-
+    unsigned char palette[DP_SAVE_VIDEO_GIF_PALETTE_BYTES];
+    DP_SaveResult result = generate_gif_palette(&params, crop, palette);
     if (result == DP_SAVE_RESULT_SUCCESS) {
         // Render out the actual GIF based on the generated palette.
         result = DP_save_animation_video((DP_SaveVideoParams){
             params.cs, params.area, params.destination, params.path_or_output,
-            *buffer_ptr, *size_ptr, params.flags, DP_SAVE_VIDEO_FORMAT_GIF,
+            palette, sizeof(palette), params.flags, DP_SAVE_VIDEO_FORMAT_GIF,
             params.width, params.height, params.start, params.end_inclusive,
             params.framerate, 1, on_gif_progress_gif, &params});
     }
-
-    DP_output_free(palette_output);
     return result;
 }
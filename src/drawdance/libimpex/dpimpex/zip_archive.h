@@ -30,9 +30,25 @@ bool DP_zip_writer_free_finish(DP_ZipWriter *zw) DP_MUST_CHECK;
 
 bool DP_zip_writer_add_dir(DP_ZipWriter *zw, const char *path) DP_MUST_CHECK;
 
+// Deflating data that's compressed already just burns CPU time for no gain,
+// so entries that look like PNG, JPEG, WEBP, zip or gzip data get stored as-is
+// even if deflate is requested.
 bool DP_zip_writer_add_file(DP_ZipWriter *zw, const char *path,
                             const void *buffer, size_t size, bool deflate,
                             bool take_buffer) DP_MUST_CHECK;
 
+DP_INLINE bool DP_zip_writer_content_compressed(const void *buffer,
+                                                size_t size)
+{
+    const unsigned char *b = (const unsigned char *)buffer;
+    return (size >= 4 && b[0] == 0x89 && b[1] == 'P' && b[2] == 'N'
+            && b[3] == 'G')
+        || (size >= 3 && b[0] == 0xff && b[1] == 0xd8 && b[2] == 0xff)
+        || (size >= 12 && memcmp(b, "RIFF", 4) == 0
+            && memcmp(b + 8, "WEBP", 4) == 0)
+        || (size >= 4 && b[0] == 'P' && b[1] == 'K' && b[2] == 3 && b[3] == 4)
+        || (size >= 2 && b[0] == 0x1f && b[1] == 0x8b);
+}
+
 
 #endif
@@ -115,8 +115,10 @@ extern "C" bool DP_zip_writer_add_file(DP_ZipWriter *zw, const char *path,
 {
     KZip *kz = reinterpret_cast<KZip *>(zw);
 
-    kz->setCompression(deflate ? KZip::DeflateCompression
-                               : KZip::NoCompression);
+    kz->setCompression(
+        deflate && !DP_zip_writer_content_compressed(buffer, size)
+            ? KZip::DeflateCompression
+            : KZip::NoCompression);
 
     QByteArray data = QByteArray::fromRawData(static_cast<const char *>(buffer),
                                               DP_size_to_int(size));
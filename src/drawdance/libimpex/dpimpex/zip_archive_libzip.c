@@ -211,7 +211,10 @@ bool DP_zip_writer_add_file(DP_ZipWriter *zw, const char *path,
     }
 
     zip_uint64_t uindex = (zip_uint64_t)index;
-    zip_int32_t compression = deflate ? ZIP_CM_DEFLATE : ZIP_CM_STORE;
+    zip_int32_t compression =
+        deflate && !DP_zip_writer_content_compressed(buffer, size)
+            ? ZIP_CM_DEFLATE
+            : ZIP_CM_STORE;
     if (zip_set_file_compression(archive, uindex, compression, 0) != 0) {
         DP_error_set("Error setting compression for '%s': %s", path,
                      archive_strerror(archive));
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/conversions.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpengine/image.h>
+#include <dpengine/pixels.h>
+#include <dpimpex/image_qoi.h>
+#include <dptest_impex.h>
+
+
+// Opaque and fully transparent pixels survive premultiplication unchanged, so
+// the image should come back exactly the same. The mix of runs, repeats and
+// noise exercises all the different QOI operations.
+static DP_Image *generate_image(int width, int height)
+{
+    DP_Image *img = DP_image_new(width, height);
+    DP_Pixel8 *pixels = DP_image_pixels(img);
+    unsigned int seed = 1u;
+    int count = width * height;
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned int r = seed >> 16u;
+        switch (r % 4u) {
+        case 0:
+            pixels[i] = i == 0 ? (DP_Pixel8){0} : pixels[i - 1];
+            break;
+        case 1:
+            pixels[i] = (DP_Pixel8){0};
+            break;
+        case 2:
+            pixels[i] = (DP_Pixel8){
+                .b = (uint8_t)(r % 8u), .g = 10, .r = 20, .a = 255};
+            break;
+        default:
+            pixels[i] = (DP_Pixel8){.b = (uint8_t)r,
+                                    .g = (uint8_t)(r >> 3u),
+                                    .r = (uint8_t)(r >> 5u),
+                                    .a = 255};
+            break;
+        }
+    }
+    return img;
+}
+
+static void roundtrip_qoi(TEST_PARAMS, int width, int height)
+{
+    DP_Image *img = generate_image(width, height);
+
+    void **buffer_ptr;
+    size_t *size_ptr;
+    DP_Output *output = DP_mem_output_new(1024, false, &buffer_ptr, &size_ptr);
+    OK(DP_image_qoi_write(output, width, height, DP_image_pixels(img)),
+       "write %dx%d QOI", width, height);
+    void *buffer = *buffer_ptr;
+    size_t size = *size_ptr;
+    DP_output_free(output);
+
+    DP_Input *input = DP_mem_input_new_free_on_close(buffer, size);
+    DP_Image *result = DP_image_qoi_read(input);
+    DP_input_free(input);
+
+    if (NOT_NULL_OK(result, "read %dx%d QOI", width, height)) {
+        INT_EQ_OK(DP_image_width(result), width, "width matches");
+        INT_EQ_OK(DP_image_height(result), height, "height matches");
+        size_t bytes = sizeof(DP_Pixel8) * DP_int_to_size(width)
+                     * DP_int_to_size(height);
+        OK(memcmp(DP_image_pixels(img), DP_image_pixels(result), bytes) == 0,
+           "pixels match");
+    }
+
+    DP_image_free(result);
+    DP_image_free(img);
+}
+
+static void image_qoi_roundtrip_small(TEST_PARAMS)
+{
+    roundtrip_qoi(TEST_ARGS, 100, 75);
+}
+
+static void image_qoi_roundtrip_strips(TEST_PARAMS)
+{
+    // Big enough to be split into strips and encoded in parallel.
+    roundtrip_qoi(TEST_ARGS, 2900, 2300);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(image_qoi_roundtrip_small);
+    REGISTER_TEST(image_qoi_roundtrip_strips);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
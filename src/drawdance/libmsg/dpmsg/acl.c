@@ -41,12 +41,36 @@ typedef struct DP_AnnotationAclEntry {
     UT_hash_handle hh;
 } DP_AnnotationAclEntry;
 
+// Number of recent target layers remembered per user. Moving a selection or
+// blending between layers touches two of them, dabs mostly just one.
+#define DP_ACL_DECISION_CACHE_LAYERS 4
+
+typedef struct DP_AclDecisionCacheLayer {
+    int layer_id;
+    bool locked;
+} DP_AclDecisionCacheLayer;
+
+// Results of the permission checks for a user's drawing commands, so that a
+// stream of dabs, fills and moves doesn't redo the tier calculations and hash
+// lookups for each message. An entry is only valid if its generation matches
+// that of the ACL state, which gets bumped on every change to it.
+typedef struct DP_AclDecisionCacheEntry {
+    unsigned int generation;
+    unsigned int features; // Bit set for each feature the user can use.
+    int tier_limit;
+    int layer_count;
+    int layer_next;
+    DP_AclDecisionCacheLayer layers[DP_ACL_DECISION_CACHE_LAYERS];
+} DP_AclDecisionCacheEntry;
+
 struct DP_AclState {
     uint8_t local_user_id;
     DP_UserAcls users;
     DP_LayerAclEntry *layers;
     DP_AnnotationAclEntry *annotations;
     DP_FeatureTiers feature;
+    unsigned int generation;
+    DP_AclDecisionCacheEntry decision_cache[256];
 };
 
 typedef struct DP_AccessTierAttributes {
@@ -326,10 +350,20 @@ static DP_FeatureTiers null_feature_tiers(void)
 static DP_AclState null_acl_state(void)
 {
     return (DP_AclState){
-        0, {{0}, {0}, {0}, {0}, false}, NULL, NULL, null_feature_tiers(),
+        0, {{0}, {0}, {0}, {0}, false}, NULL, NULL, null_feature_tiers(), 1,
+        {{0, 0, 0, 0, 0, {{0, false}}}},
     };
 }
 
+static void invalidate_decision_cache(DP_AclState *acls)
+{
+    // Generation 0 is never valid, since that's what the cache starts with.
+    if (++acls->generation == 0) {
+        memset(acls->decision_cache, 0, sizeof(acls->decision_cache));
+        acls->generation = 1;
+    }
+}
+
 DP_AclState *DP_acl_state_new(void)
 {
     DP_AclState *acls = DP_malloc(sizeof(*acls));
@@ -932,6 +966,7 @@ static bool handle_layer_delete(DP_AclState *acls, int layer_id, int merge_id,
         if (entry) {
             HASH_DEL(acls->layers, entry);
             DP_free(entry);
+            invalidate_decision_cache(acls);
         }
         return true; // Layer is gone, so no need to report a change for it.
     }
@@ -1118,25 +1153,74 @@ static int mypaint_blend_dabs_max_dab_size(void *internal)
         DP_mypaint_blend_dab_size(DP_mypaint_blend_dab_at(dabs, i)));
 }
 
+static DP_AclDecisionCacheEntry *get_decision_cache_entry(DP_AclState *acls,
+                                                          uint8_t user_id)
+{
+    DP_AclDecisionCacheEntry *entry = &acls->decision_cache[user_id];
+    if (entry->generation != acls->generation) {
+        DP_AccessTier tier = DP_acl_state_user_tier(acls, user_id);
+        unsigned int features = 0;
+        for (int i = 0; i < DP_FEATURE_COUNT; ++i) {
+            DP_AccessTier feature_tier = acls->feature.tiers[i];
+            if (feature_tier == DP_ACCESS_TIER_GUEST || tier <= feature_tier) {
+                features |= 1u << (unsigned int)i;
+            }
+        }
+        entry->generation = acls->generation;
+        entry->features = features;
+        entry->tier_limit =
+            acls->feature.limits[DP_FEATURE_LIMIT_BRUSH_SIZE][tier];
+        entry->layer_count = 0;
+        entry->layer_next = 0;
+    }
+    return entry;
+}
+
+static bool cached_can_use_feature(DP_AclDecisionCacheEntry *entry,
+                                   DP_Feature feature)
+{
+    return entry->features & (1u << (unsigned int)feature);
+}
+
+static bool cached_layer_locked(DP_AclState *acls,
+                                DP_AclDecisionCacheEntry *entry,
+                                uint8_t user_id, int layer_id)
+{
+    int layer_count = entry->layer_count;
+    for (int i = 0; i < layer_count; ++i) {
+        if (entry->layers[i].layer_id == layer_id) {
+            return entry->layers[i].locked;
+        }
+    }
+
+    bool locked = DP_acl_state_layer_locked_for(acls, user_id, layer_id);
+    int index;
+    if (layer_count < DP_ACL_DECISION_CACHE_LAYERS) {
+        index = layer_count;
+        entry->layer_count = layer_count + 1;
+    }
+    else {
+        index = entry->layer_next;
+        entry->layer_next = (index + 1) % DP_ACL_DECISION_CACHE_LAYERS;
+    }
+    entry->layers[index] = (DP_AclDecisionCacheLayer){layer_id, locked};
+    return locked;
+}
+
 static bool handle_draw_dabs(DP_AclState *acls, DP_Message *msg,
                              uint8_t user_id, bool (*is_pigment)(void *),
                              int (*get_layer_id)(void *),
                              int (*get_max_dab_size)(void *))
 {
     void *internal = DP_message_internal(msg);
-    if (is_pigment(internal)
-        && !DP_acl_state_can_use_feature(acls, DP_FEATURE_SLOW_BRUSH,
-                                         user_id)) {
-        return false;
-    }
-
-    int layer_id = get_layer_id(internal);
-    if (DP_acl_state_layer_locked_for(acls, user_id, layer_id)) {
+    DP_AclDecisionCacheEntry *entry = get_decision_cache_entry(acls, user_id);
+    if (cached_layer_locked(acls, entry, user_id, get_layer_id(internal))
+        || (!cached_can_use_feature(entry, DP_FEATURE_SLOW_BRUSH)
+            && is_pigment(internal))) {
         return false;
     }
 
-    int *brush_size_limits = acls->feature.limits[DP_FEATURE_LIMIT_BRUSH_SIZE];
-    int tier_limit = brush_size_limits[DP_acl_state_user_tier(acls, user_id)];
+    int tier_limit = entry->tier_limit;
     if (tier_limit == 0
         || (tier_limit > 0 && get_max_dab_size(internal) > tier_limit)) {
         return false;
@@ -1151,15 +1235,30 @@ static bool handle_move(DP_AclState *acls, uint8_t user_id, bool override,
     if (override) {
         return true;
     }
-    if (DP_acl_state_can_use_feature(acls, DP_FEATURE_REGION_MOVE, user_id)) {
-        return !DP_acl_state_layer_locked_for(acls, user_id, source_id)
-            && !DP_acl_state_layer_locked_for(acls, user_id, target_id);
+    DP_AclDecisionCacheEntry *entry = get_decision_cache_entry(acls, user_id);
+    if (cached_can_use_feature(entry, DP_FEATURE_REGION_MOVE)) {
+        return !cached_layer_locked(acls, entry, user_id, source_id)
+            && !cached_layer_locked(acls, entry, user_id, target_id);
     }
     else {
         return false;
     }
 }
 
+static bool handle_put_image_or_fill(DP_AclState *acls, uint8_t user_id,
+                                     int layer_id)
+{
+    DP_AclDecisionCacheEntry *entry = get_decision_cache_entry(acls, user_id);
+    return cached_can_use_feature(entry, DP_FEATURE_PUT_IMAGE)
+        && !cached_layer_locked(acls, entry, user_id, layer_id);
+}
+
+static bool can_use_mypaint(DP_AclState *acls, uint8_t user_id)
+{
+    return cached_can_use_feature(get_decision_cache_entry(acls, user_id),
+                                  DP_FEATURE_MYPAINT);
+}
+
 static bool handle_move_rect(DP_AclState *acls, DP_Message *msg,
                              uint8_t user_id, bool override)
 {
@@ -1237,20 +1336,16 @@ static bool handle_command_message(DP_AclState *acls, DP_Message *msg,
         return override
             // Compatibility hack: local match command disguised as put image.
             || DP_msg_put_image_mode(mpi) == DP_BLEND_MODE_COMPAT_LOCAL_MATCH
-            || (DP_acl_state_can_use_feature(acls, DP_FEATURE_PUT_IMAGE,
-                                             user_id)
-                && !DP_acl_state_layer_locked_for(
-                    acls, user_id,
-                    DP_protocol_to_layer_id(DP_msg_put_image_layer(mpi))));
+            || handle_put_image_or_fill(
+                   acls, user_id,
+                   DP_protocol_to_layer_id(DP_msg_put_image_layer(mpi)));
     }
     case DP_MSG_FILL_RECT:
         return override
-            || (DP_acl_state_can_use_feature(acls, DP_FEATURE_PUT_IMAGE,
-                                             user_id)
-                && !DP_acl_state_layer_locked_for(
-                    acls, user_id,
-                    DP_protocol_to_layer_id(
-                        DP_msg_fill_rect_layer(DP_message_internal(msg)))));
+            || handle_put_image_or_fill(
+                   acls, user_id,
+                   DP_protocol_to_layer_id(
+                       DP_msg_fill_rect_layer(DP_message_internal(msg))));
     case DP_MSG_ANNOTATION_CREATE:
         return handle_annotation_create(acls, msg, user_id, override);
     case DP_MSG_ANNOTATION_RESHAPE:
@@ -1279,13 +1374,13 @@ static bool handle_command_message(DP_AclState *acls, DP_Message *msg,
                                 pixel_dabs_layer_id, pixel_dabs_max_dab_size);
     case DP_MSG_DRAW_DABS_MYPAINT:
         return override
-            || (DP_acl_state_can_use_feature(acls, DP_FEATURE_MYPAINT, user_id)
+            || (can_use_mypaint(acls, user_id)
                 && handle_draw_dabs(acls, msg, user_id, mypaint_dabs_pigment,
                                     mypaint_dabs_layer_id,
                                     mypaint_dabs_max_dab_size));
     case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
         return override
-            || (DP_acl_state_can_use_feature(acls, DP_FEATURE_MYPAINT, user_id)
+            || (can_use_mypaint(acls, user_id)
                 && handle_draw_dabs(acls, msg, user_id,
                                     mypaint_blend_dabs_pigment,
                                     mypaint_blend_dabs_layer_id,
@@ -1343,6 +1438,46 @@ static bool handle_command_message(DP_AclState *acls, DP_Message *msg,
     }
 }
 
+static uint8_t handle_acl_message(DP_AclState *acls, DP_Message *msg,
+                                  DP_MessageType type, bool override)
+{
+    switch (type) {
+    case DP_MSG_JOIN:
+        return handle_join(acls, msg);
+    case DP_MSG_LEAVE:
+        return handle_leave(acls, msg);
+    case DP_MSG_SESSION_OWNER:
+        return handle_session_owner(acls, msg);
+    case DP_MSG_TRUSTED_USERS:
+        return handle_trusted_users(acls, msg);
+    case DP_MSG_INTERNAL:
+        return handle_internal(acls, msg);
+    case DP_MSG_LASER_TRAIL:
+        return filter_unless(
+            override
+            || DP_acl_state_can_use_feature(acls, DP_FEATURE_LASER,
+                                            message_user_id(msg)));
+    case DP_MSG_USER_ACL:
+        return handle_user_acl(acls, msg, override);
+    case DP_MSG_LAYER_ACL:
+        return handle_layer_acl(acls, msg, override);
+    case DP_MSG_FEATURE_ACCESS_LEVELS:
+        return handle_feature_access_levels(acls, msg, override);
+    case DP_MSG_DEFAULT_LAYER:
+        return filter_unless(
+            override || DP_acl_state_is_op(acls, message_user_id(msg)));
+    case DP_MSG_UNDO_DEPTH:
+        return filter_unless(
+            override || DP_acl_state_is_op(acls, message_user_id(msg)));
+    case DP_MSG_LOCAL_CHANGE:
+        return filter_unless(override || message_user_id(msg) == 0);
+    case DP_MSG_FEATURE_LIMITS:
+        return handle_feature_limits(acls, msg, override);
+    default:
+        return 0;
+    }
+}
+
 uint8_t DP_acl_state_handle(DP_AclState *acls, DP_Message *msg, bool override)
 {
     DP_ASSERT(acls);
@@ -1350,41 +1485,11 @@ uint8_t DP_acl_state_handle(DP_AclState *acls, DP_Message *msg, bool override)
     DP_MessageType type = DP_message_type(msg);
     // Command messages (128 and up) need common handling.
     if (type < 128) {
-        switch (type) {
-        case DP_MSG_JOIN:
-            return handle_join(acls, msg);
-        case DP_MSG_LEAVE:
-            return handle_leave(acls, msg);
-        case DP_MSG_SESSION_OWNER:
-            return handle_session_owner(acls, msg);
-        case DP_MSG_TRUSTED_USERS:
-            return handle_trusted_users(acls, msg);
-        case DP_MSG_INTERNAL:
-            return handle_internal(acls, msg);
-        case DP_MSG_LASER_TRAIL:
-            return filter_unless(
-                override
-                || DP_acl_state_can_use_feature(acls, DP_FEATURE_LASER,
-                                                message_user_id(msg)));
-        case DP_MSG_USER_ACL:
-            return handle_user_acl(acls, msg, override);
-        case DP_MSG_LAYER_ACL:
-            return handle_layer_acl(acls, msg, override);
-        case DP_MSG_FEATURE_ACCESS_LEVELS:
-            return handle_feature_access_levels(acls, msg, override);
-        case DP_MSG_DEFAULT_LAYER:
-            return filter_unless(
-                override || DP_acl_state_is_op(acls, message_user_id(msg)));
-        case DP_MSG_UNDO_DEPTH:
-            return filter_unless(
-                override || DP_acl_state_is_op(acls, message_user_id(msg)));
-        case DP_MSG_LOCAL_CHANGE:
-            return filter_unless(override || message_user_id(msg) == 0);
-        case DP_MSG_FEATURE_LIMITS:
-            return handle_feature_limits(acls, msg, override);
-        default:
-            return 0;
+        uint8_t result = handle_acl_message(acls, msg, type, override);
+        if (result & DP_ACL_STATE_CHANGE_MASK) {
+            invalidate_decision_cache(acls);
         }
+        return result;
     }
     else {
         if (override || !acls->users.all_locked) {
@@ -244,27 +244,46 @@ double DP_binary_reader_progress(DP_BinaryReader *reader)
 static void ensure_buffer_size(DP_BinaryReader *reader, size_t required_size)
 {
     if (reader->buffer_size < required_size) {
-        reader->buffer = DP_realloc(
-            reader->buffer,
-            required_size < MIN_BUFFER_SIZE ? MIN_BUFFER_SIZE : required_size);
+        size_t new_size =
+            required_size < MIN_BUFFER_SIZE ? MIN_BUFFER_SIZE : required_size;
+        reader->buffer = DP_realloc(reader->buffer, new_size);
+        reader->buffer_size = new_size;
     }
 }
 
-static size_t read_into(DP_BinaryReader *reader, size_t size, size_t offset,
-                        bool *out_error)
+// Returns where the message starts, offset bytes before the data just read.
+// Memory inputs get borrowed from directly instead of copying into the buffer,
+// which works because consecutive borrows are contiguous.
+static const unsigned char *read_into(DP_BinaryReader *reader, size_t size,
+                                      size_t offset, size_t *out_read,
+                                      bool *out_error)
 {
-    ensure_buffer_size(reader, size + offset);
-    size_t read =
-        DP_input_read(reader->input, reader->buffer + offset, size, out_error);
+    const unsigned char *data;
+    size_t read;
+    const unsigned char *borrowed = DP_input_borrow(reader->input, size, &read);
+    if (borrowed) {
+        *out_error = false;
+        data = borrowed - offset;
+    }
+    else {
+        ensure_buffer_size(reader, size + offset);
+        read = DP_input_read(reader->input, reader->buffer + offset, size,
+                             out_error);
+        data = reader->buffer;
+    }
     reader->input_offset += read;
-    return read;
+    *out_read = read;
+    return data;
 }
 
-static DP_BinaryReaderResult read_message_header(DP_BinaryReader *reader,
-                                                 size_t *out_body_length)
+static DP_BinaryReaderResult
+read_message_header(DP_BinaryReader *reader, const unsigned char **out_message,
+                    size_t *out_body_length)
 {
+    size_t read;
     bool error;
-    size_t read = read_into(reader, DP_MESSAGE_HEADER_LENGTH, 0, &error);
+    const unsigned char *message =
+        read_into(reader, DP_MESSAGE_HEADER_LENGTH, 0, &read, &error);
     if (error) {
         return DP_BINARY_READER_ERROR_INPUT;
     }
@@ -277,7 +296,8 @@ static DP_BinaryReaderResult read_message_header(DP_BinaryReader *reader,
         return DP_BINARY_READER_ERROR_INPUT;
     }
     else {
-        *out_body_length = DP_read_bigendian_uint16(reader->buffer);
+        *out_message = message;
+        *out_body_length = DP_read_bigendian_uint16(message);
         return DP_BINARY_READER_SUCCESS;
     }
 }
@@ -288,15 +308,18 @@ read_message(DP_BinaryReader *reader, bool decode_opaque,
                                            size_t bufsize, bool decode_opaque),
              DP_Message **out_msg)
 {
+    const unsigned char *message;
     size_t body_length;
-    DP_BinaryReaderResult result = read_message_header(reader, &body_length);
+    DP_BinaryReaderResult result =
+        read_message_header(reader, &message, &body_length);
     if (result != DP_BINARY_READER_SUCCESS) {
         return result;
     }
 
+    size_t read;
     bool error;
-    size_t read =
-        read_into(reader, body_length, DP_MESSAGE_HEADER_LENGTH, &error);
+    message = read_into(reader, body_length, DP_MESSAGE_HEADER_LENGTH, &read,
+                        &error);
     if (error) {
         return DP_BINARY_READER_ERROR_INPUT;
     }
@@ -307,7 +330,7 @@ read_message(DP_BinaryReader *reader, bool decode_opaque,
     }
 
     DP_Message *msg = deserialize_fn(
-        reader->buffer, DP_MESSAGE_HEADER_LENGTH + body_length, decode_opaque);
+        message, DP_MESSAGE_HEADER_LENGTH + body_length, decode_opaque);
     if (msg) {
         *out_msg = msg;
         return DP_BINARY_READER_SUCCESS;
@@ -343,8 +366,10 @@ int DP_binary_reader_skip_message(DP_BinaryReader *reader, uint8_t *out_type,
 {
     DP_ASSERT(reader);
 
+    const unsigned char *message;
     size_t body_length;
-    DP_BinaryReaderResult result = read_message_header(reader, &body_length);
+    DP_BinaryReaderResult result =
+        read_message_header(reader, &message, &body_length);
     if (result != DP_BINARY_READER_SUCCESS) {
         return -1;
     }
@@ -355,10 +380,10 @@ int DP_binary_reader_skip_message(DP_BinaryReader *reader, uint8_t *out_type,
     }
 
     if (out_type) {
-        *out_type = reader->buffer[2];
+        *out_type = message[2];
     }
     if (out_context_id) {
-        *out_context_id = reader->buffer[3];
+        *out_context_id = message[3];
     }
     return DP_size_to_int(DP_MESSAGE_HEADER_LENGTH + body_length);
 }
@@ -117,3 +117,9 @@ size_t DP_binary_writer_write_message(DP_BinaryWriter *writer, DP_Message *msg)
              ? length
              : 0;
 }
+
+size_t DP_binary_writer_tell(DP_BinaryWriter *writer, bool *out_error)
+{
+    DP_ASSERT(writer);
+    return DP_output_tell(writer->output, out_error);
+}
@@ -43,5 +43,8 @@ bool DP_binary_writer_write_header(DP_BinaryWriter *writer,
 size_t DP_binary_writer_write_message(DP_BinaryWriter *writer,
                                       DP_Message *msg) DP_MUST_CHECK;
 
+// Current offset into the output, requires it to be seekable.
+size_t DP_binary_writer_tell(DP_BinaryWriter *writer, bool *out_error);
+
 
 #endif
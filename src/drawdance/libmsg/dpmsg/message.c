@@ -26,6 +26,9 @@
 #include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/memory_pool.h>
+#include <dpcommon/threading.h>
 
 #define FLAG_NONE   0x0
 #define FLAG_OPAQUE 0x1
@@ -35,15 +38,132 @@ typedef DP_Message *(*DP_MessageDeserializeFn)(unsigned int context_id,
                                                const unsigned char *buffer,
                                                size_t length);
 
+// The pool index is the size class plus one, or zero if the message was too
+// large for any of them and got allocated individually.
 struct DP_Message {
     DP_Atomic refcount;
     uint8_t type;
     uint8_t flags;
+    uint8_t pool;
+    uint8_t shard;
     unsigned int context_id;
     const DP_MessageMethods *methods;
     alignas(DP_max_align_t) unsigned char internal[];
 };
 
+// Small messages, which are most of them, especially dabs, are allocated from
+// pools in a few size classes. Like with tiles, the pools are split into shards
+// picked by the allocating thread, so that e.g. the network and paint threads
+// usually don't contend. A message always goes back to the shard it came from,
+// each shard has its own spin lock. The pools only grow, they keep their
+// memory around for the next bunch of messages.
+#define MESSAGE_SHARD_COUNT       8
+#define MESSAGE_SHARD_INDEX_SHIFT 61
+#define MESSAGE_POOL_BUCKET_BYTES 65536
+static_assert(MESSAGE_SHARD_COUNT == 1 << (64 - MESSAGE_SHARD_INDEX_SHIFT),
+              "Message shard index shift matches shard count");
+
+static const size_t message_size_classes[] = {
+    64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+#define MESSAGE_SIZE_CLASS_COUNT \
+    ((int)(sizeof(message_size_classes) / sizeof(message_size_classes[0])))
+
+typedef struct DP_MessageShard {
+    DP_Atomic lock;
+    DP_MemoryPool pools[MESSAGE_SIZE_CLASS_COUNT];
+} DP_MessageShard;
+
+static DP_MessageShard message_shards[MESSAGE_SHARD_COUNT];
+static DP_Atomic message_large_count;
+
+static int message_size_class(size_t size)
+{
+    for (int i = 0; i < MESSAGE_SIZE_CLASS_COUNT; ++i) {
+        if (size <= message_size_classes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static unsigned int message_current_shard_index(void)
+{
+    DP_ThreadId id = DP_thread_current_id();
+    uint64_t x = 0;
+    memcpy(&x, &id, DP_min_size(sizeof(id), sizeof(x)));
+    return (unsigned int)((x * 0x9e3779b97f4a7c15u)
+                          >> MESSAGE_SHARD_INDEX_SHIFT);
+}
+
+static DP_Message *alloc_message(size_t size)
+{
+    int size_class = message_size_class(size);
+    DP_Message *msg;
+    if (size_class == -1) {
+        msg = DP_malloc_zeroed(size);
+        msg->pool = 0;
+        msg->shard = 0;
+        DP_atomic_inc(&message_large_count);
+    }
+    else {
+        unsigned int shard_index = message_current_shard_index();
+        DP_MessageShard *shard = &message_shards[shard_index];
+        DP_MemoryPool *pool = &shard->pools[size_class];
+        DP_atomic_lock(&shard->lock);
+        if (!pool->buckets) {
+            size_t el_size = message_size_classes[size_class];
+            *pool = DP_memory_pool_new(el_size,
+                                       MESSAGE_POOL_BUCKET_BYTES / el_size);
+        }
+        msg = DP_memory_pool_alloc_el(pool);
+        DP_atomic_unlock(&shard->lock);
+        memset(msg, 0, size);
+        msg->pool = (uint8_t)(size_class + 1);
+        msg->shard = (uint8_t)shard_index;
+    }
+    return msg;
+}
+
+static void free_message(DP_Message *msg)
+{
+    int pool_index = msg->pool;
+    if (pool_index == 0) {
+        DP_free(msg);
+        DP_atomic_add(&message_large_count, -1);
+    }
+    else {
+        DP_MessageShard *shard = &message_shards[msg->shard];
+        DP_atomic_lock(&shard->lock);
+        DP_memory_pool_free_el(&shard->pools[pool_index - 1], msg);
+        DP_atomic_unlock(&shard->lock);
+    }
+}
+
+DP_MessageAllocationStatistics DP_message_allocation_statistics(void)
+{
+    DP_MessageAllocationStatistics total = {
+        0, 0, 0, 0, DP_int_to_size(DP_atomic_get(&message_large_count))};
+    for (int i = 0; i < MESSAGE_SHARD_COUNT; ++i) {
+        DP_MessageShard *shard = &message_shards[i];
+        DP_atomic_lock(&shard->lock);
+        for (int j = 0; j < MESSAGE_SIZE_CLASS_COUNT; ++j) {
+            DP_MemoryPool *pool = &shard->pools[j];
+            if (pool->buckets) {
+                DP_MemoryPoolStatistics mps = DP_memory_pool_statistics(pool);
+                size_t el_total = mps.buckets_len * mps.bucket_el_count;
+                total.pooled += el_total - mps.el_free;
+                total.pool_capacity += el_total;
+                total.pooled_bytes += (el_total - mps.el_free) * mps.el_size;
+                total.pool_bytes += el_total * mps.el_size;
+            }
+        }
+        DP_atomic_unlock(&shard->lock);
+    }
+    return total;
+}
+
 DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
                            const DP_MessageMethods *methods,
                            size_t internal_size)
@@ -58,7 +178,7 @@ DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
     DP_ASSERT(methods->write_payload_text);
     DP_ASSERT(internal_size <= SIZE_MAX - sizeof(DP_Message));
     DP_Message *msg =
-        DP_malloc_zeroed(DP_FLEX_SIZEOF(DP_Message, internal, internal_size));
+        alloc_message(DP_FLEX_SIZEOF(DP_Message, internal, internal_size));
     DP_atomic_set(&msg->refcount, 1);
     msg->type = (uint8_t)type;
     msg->flags = FLAG_NONE;
@@ -67,11 +187,26 @@ DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
     return msg;
 }
 
+// Opaque messages keep the header in wire format right in front of the body,
+// so that relaying them doesn't require serializing them over and over again.
 typedef struct DP_OpaqueMessage {
     size_t length;
+    unsigned char header[DP_MESSAGE_HEADER_LENGTH];
     unsigned char body[];
 } DP_OpaqueMessage;
 
+static void opaque_header_write(DP_Message *msg)
+{
+    DP_OpaqueMessage *om = (void *)msg->internal;
+    size_t written = 0;
+    written += DP_write_bigendian_uint16(
+        (uint16_t)DP_min_size(om->length, UINT16_MAX), om->header);
+    written += DP_write_bigendian_uint8(msg->type, om->header + written);
+    written += DP_write_bigendian_uint8((uint8_t)msg->context_id,
+                                        om->header + written);
+    DP_ASSERT(written == DP_MESSAGE_HEADER_LENGTH);
+}
+
 static size_t opaque_payload_length(DP_Message *msg)
 {
     DP_OpaqueMessage *om = (void *)msg->internal;
@@ -126,7 +261,7 @@ DP_Message *DP_message_new_opaque(DP_MessageType type, unsigned int context_id,
     DP_ASSERT(type <= DP_MESSAGE_MAX);
     DP_ASSERT(context_id <= UINT8_MAX);
     DP_ASSERT(length <= SIZE_MAX - sizeof(DP_Message));
-    DP_Message *msg = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+    DP_Message *msg = alloc_message(DP_FLEX_SIZEOF(
         DP_Message, internal, DP_FLEX_SIZEOF(DP_OpaqueMessage, body, length)));
     DP_atomic_set(&msg->refcount, 1);
     msg->type = (uint8_t)type;
@@ -135,6 +270,7 @@ DP_Message *DP_message_new_opaque(DP_MessageType type, unsigned int context_id,
     msg->methods = &opaque_methods;
     DP_OpaqueMessage *om = (void *)msg->internal;
     om->length = length;
+    opaque_header_write(msg);
     if (length != 0) {
         memcpy(om->body, body, length);
     }
@@ -159,7 +295,7 @@ void DP_message_decref(DP_Message *msg)
     DP_ASSERT(msg);
     DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
     if (DP_atomic_dec(&msg->refcount)) {
-        DP_free(msg);
+        free_message(msg);
     }
 }
 
@@ -224,6 +360,9 @@ void DP_message_context_id_set(DP_Message *msg, unsigned int context_id)
     DP_ASSERT(msg);
     DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
     msg->context_id = context_id;
+    if (msg->flags & FLAG_OPAQUE) {
+        opaque_header_write(msg);
+    }
 }
 
 void *DP_message_internal(DP_Message *msg)
@@ -345,6 +484,57 @@ size_t DP_message_serialize_compat(DP_Message *msg, bool write_body_length,
 }
 #endif
 
+static const unsigned char *serialized_opaque(DP_Message *msg,
+                                              bool write_body_length,
+                                              size_t *out_length)
+{
+    DP_OpaqueMessage *om = (void *)msg->internal;
+    size_t length = om->length;
+    if (msg->context_id > UINT8_MAX || length > UINT16_MAX) {
+        return NULL; // Let regular serialization report the error.
+    }
+    else if (write_body_length) {
+        *out_length = DP_MESSAGE_HEADER_LENGTH + length;
+        return om->header;
+    }
+    else {
+        *out_length = DP_MESSAGE_HEADER_LENGTH - 2 + length;
+        return om->header + 2;
+    }
+}
+
+const unsigned char *DP_message_serialized_noinc(DP_Message *msg,
+                                                 bool write_body_length,
+                                                 size_t *out_length)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_ASSERT(out_length);
+    if (msg->flags & FLAG_OPAQUE) {
+        return serialized_opaque(msg, write_body_length, out_length);
+    }
+    else {
+        return NULL;
+    }
+}
+
+#ifdef DP_PROTOCOL_COMPAT_VERSION
+const unsigned char *DP_message_serialized_compat_noinc(DP_Message *msg,
+                                                        bool write_body_length,
+                                                        size_t *out_length)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_ASSERT(out_length);
+    if ((msg->flags & FLAG_OPAQUE) && DP_message_type_compatible(msg->type)) {
+        return serialized_opaque(msg, write_body_length, out_length);
+    }
+    else {
+        return NULL;
+    }
+}
+#endif
+
 size_t DP_message_serialize_body(DP_Message *msg,
                                  DP_GetMessageBufferFn get_buffer, void *user)
 {
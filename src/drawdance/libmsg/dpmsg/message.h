@@ -49,6 +49,16 @@ typedef struct DP_Message DP_Message;
 
 typedef unsigned char *(*DP_GetMessageBufferFn)(void *user, size_t length);
 
+typedef struct DP_MessageAllocationStatistics {
+    size_t pooled;        // Messages currently allocated from the pools.
+    size_t pool_capacity; // How many messages the pools have room for.
+    size_t pooled_bytes;  // Pool memory used by messages, rounded up.
+    size_t pool_bytes;    // Memory taken up by the pools in total.
+    size_t large;         // Messages too large for the pools.
+} DP_MessageAllocationStatistics;
+
+DP_MessageAllocationStatistics DP_message_allocation_statistics(void);
+
 
 DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
                            const DP_MessageMethods *methods,
@@ -101,6 +111,19 @@ size_t DP_message_serialize_compat(DP_Message *msg, bool write_body_length,
                                    void *user) DP_MUST_CHECK;
 #endif
 
+// Returns the message in serialized form without copying anything if it's
+// already stored that way, which is the case for opaque messages. Otherwise
+// returns NULL, then the message has to be serialized the regular way.
+const unsigned char *DP_message_serialized_noinc(DP_Message *msg,
+                                                 bool write_body_length,
+                                                 size_t *out_length);
+
+#ifdef DP_PROTOCOL_COMPAT_VERSION
+const unsigned char *DP_message_serialized_compat_noinc(DP_Message *msg,
+                                                        bool write_body_length,
+                                                        size_t *out_length);
+#endif
+
 size_t DP_message_serialize_body(DP_Message *msg,
                                  DP_GetMessageBufferFn get_buffer,
                                  void *user) DP_MUST_CHECK;
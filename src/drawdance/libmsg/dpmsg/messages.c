@@ -1498,40 +1498,49 @@ static void assign_string(char *dst, const char *src, size_t len)
     dst[len] = '\0';
 }
 
-static int8_t read_int8(const unsigned char *buffer, size_t *read)
-{
-    *read += 1;
-    return DP_read_bigendian_int8(buffer);
-}
-
-static int32_t read_int32(const unsigned char *buffer, size_t *read)
-{
-    *read += 4;
-    return DP_read_bigendian_int32(buffer);
-}
+// The field readers and writers decode and encode the bytes themselves
+// instead of calling into dpcommon/binary.h, since they're in the hot path of
+// every message and this way the compiler can inline and unroll them, which
+// makes a big difference for the long arrays of dabs in drawing commands.
 
 static uint8_t read_uint8(const unsigned char *buffer, size_t *read)
 {
     *read += 1;
-    return DP_read_bigendian_uint8(buffer);
+    return buffer[0];
 }
 
 static uint16_t read_uint16(const unsigned char *buffer, size_t *read)
 {
     *read += 2;
-    return DP_read_bigendian_uint16(buffer);
+    return DP_uint_to_uint16((DP_uchar_to_uint(buffer[0]) << 8u)
+                             + DP_uchar_to_uint(buffer[1]));
 }
 
 static uint32_t read_uint24(const unsigned char *buffer, size_t *read)
 {
     *read += 3;
-    return DP_read_bigendian_uint24(buffer);
+    return DP_uint_to_uint32((DP_uchar_to_uint(buffer[0]) << 16u)
+                             + (DP_uchar_to_uint(buffer[1]) << 8u)
+                             + DP_uchar_to_uint(buffer[2]));
 }
 
 static uint32_t read_uint32(const unsigned char *buffer, size_t *read)
 {
     *read += 4;
-    return DP_read_bigendian_uint32(buffer);
+    return DP_uint_to_uint32((DP_uchar_to_uint(buffer[0]) << 24u)
+                             + (DP_uchar_to_uint(buffer[1]) << 16u)
+                             + (DP_uchar_to_uint(buffer[2]) << 8u)
+                             + DP_uchar_to_uint(buffer[3]));
+}
+
+static int8_t read_int8(const unsigned char *buffer, size_t *read)
+{
+    return DP_uint8_to_int8(read_uint8(buffer, read));
+}
+
+static int32_t read_int32(const unsigned char *buffer, size_t *read)
+{
+    return DP_uint32_to_int32(read_uint32(buffer, read));
 }
 
 static bool read_bool(const unsigned char *buffer, size_t *read)
@@ -1539,6 +1548,46 @@ static bool read_bool(const unsigned char *buffer, size_t *read)
     return read_uint8(buffer, read) != 0;
 }
 
+static size_t write_uint8(uint8_t x, unsigned char *out)
+{
+    out[0] = x;
+    return 1;
+}
+
+static size_t write_uint16(uint16_t x, unsigned char *out)
+{
+    out[0] = DP_uint_to_uchar((x >> 8u) & 0xffu);
+    out[1] = DP_uint_to_uchar(x & 0xffu);
+    return 2;
+}
+
+static size_t write_uint24(uint32_t x, unsigned char *out)
+{
+    out[0] = DP_uint_to_uchar((x >> 16u) & 0xffu);
+    out[1] = DP_uint_to_uchar((x >> 8u) & 0xffu);
+    out[2] = DP_uint_to_uchar(x & 0xffu);
+    return 3;
+}
+
+static size_t write_uint32(uint32_t x, unsigned char *out)
+{
+    out[0] = DP_uint_to_uchar((x >> 24u) & 0xffu);
+    out[1] = DP_uint_to_uchar((x >> 16u) & 0xffu);
+    out[2] = DP_uint_to_uchar((x >> 8u) & 0xffu);
+    out[3] = DP_uint_to_uchar(x & 0xffu);
+    return 4;
+}
+
+static size_t write_int8(int8_t x, unsigned char *out)
+{
+    return write_uint8((uint8_t)x, out);
+}
+
+static size_t write_int32(int32_t x, unsigned char *out)
+{
+    return write_uint32((uint32_t)x, out);
+}
+
 static const char *read_string_with_length(const unsigned char *buffer,
                                            size_t len, size_t *read)
 {
@@ -1609,7 +1658,7 @@ static size_t write_bytes(const unsigned char *DP_RESTRICT x, int count,
 static size_t write_string_with_length(const char *DP_RESTRICT x, size_t len,
                                        unsigned char *DP_RESTRICT out)
 {
-    size_t written = DP_write_bigendian_uint8(DP_size_to_uint8(len), out);
+    size_t written = write_uint8(DP_size_to_uint8(len), out);
     return written + DP_write_bytes(x, 1, len, out + written);
 }
 
@@ -1669,7 +1718,7 @@ static size_t write_track_ids_compat(const uint16_t *DP_RESTRICT track_ids,
     if (count > 0) {
         size_t written = 0;
         for (int i = 0; i < count; ++i) {
-            written += DP_write_bigendian_uint16(
+            written += write_uint16(
                 convert_other_id_compat(track_ids[i]), out + written);
         }
         return written;
@@ -1699,11 +1748,11 @@ write_key_frame_layer_flags_compat(const uint32_t *DP_RESTRICT id_flag_pairs,
     if (count > 0) {
         size_t written = 0;
         for (int i = 0; i < count; ++i) {
-            written += DP_write_bigendian_uint16(
+            written += write_uint16(
                 serialize_layer_id_compat(id_flag_pairs[i]
                                           & (uint32_t)0xffffffu),
                 out + written);
-            written += DP_write_bigendian_uint16(
+            written += write_uint16(
                 DP_uint32_to_uint16((id_flag_pairs[i] & (uint32_t)0xff000000u)
                                     >> (uint32_t)24u),
                 out + written);
@@ -1862,7 +1911,7 @@ static size_t msg_disconnect_serialize_payload(DP_Message *msg,
 {
     DP_MsgDisconnect *md = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(md->reason, data + written);
+    written += write_uint8(md->reason, data + written);
     written += DP_write_bytes(md->message, 1, md->message_len, data + written);
     DP_ASSERT(written == msg_disconnect_payload_length(msg));
     return written;
@@ -1984,7 +2033,7 @@ static size_t msg_ping_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgPing *mp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mp->is_pong, data + written);
+    written += write_uint8(mp->is_pong, data + written);
     DP_ASSERT(written == msg_ping_payload_length(msg));
     return written;
 }
@@ -2247,7 +2296,7 @@ static size_t msg_join_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgJoin *mj = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mj->flags, data + written);
+    written += write_uint8(mj->flags, data + written);
     written += write_string_with_length(((char *)mj->name_avatar), mj->name_len,
                                         data + written);
     written += write_bytes(mj->name_avatar + mj->name_len + 1, mj->avatar_size,
@@ -2610,8 +2659,8 @@ static size_t msg_chat_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgChat *mc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mc->tflags, data + written);
-    written += DP_write_bigendian_uint8(mc->oflags, data + written);
+    written += write_uint8(mc->tflags, data + written);
+    written += write_uint8(mc->oflags, data + written);
     written += DP_write_bytes(mc->message, 1, mc->message_len, data + written);
     DP_ASSERT(written == msg_chat_payload_length(msg));
     return written;
@@ -2919,8 +2968,8 @@ static size_t msg_private_chat_serialize_payload(DP_Message *msg,
 {
     DP_MsgPrivateChat *mpc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mpc->target, data + written);
-    written += DP_write_bigendian_uint8(mpc->oflags, data + written);
+    written += write_uint8(mpc->target, data + written);
+    written += write_uint8(mpc->oflags, data + written);
     written +=
         DP_write_bytes(mpc->message, 1, mpc->message_len, data + written);
     DP_ASSERT(written == msg_private_chat_payload_length(msg));
@@ -3181,7 +3230,7 @@ static size_t msg_interval_serialize_payload(DP_Message *msg,
 {
     DP_MsgInterval *mi = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mi->msecs, data + written);
+    written += write_uint16(mi->msecs, data + written);
     DP_ASSERT(written == msg_interval_payload_length(msg));
     return written;
 }
@@ -3278,8 +3327,8 @@ static size_t msg_laser_trail_serialize_payload(DP_Message *msg,
 {
     DP_MsgLaserTrail *mlt = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint32(mlt->color, data + written);
-    written += DP_write_bigendian_uint8(mlt->persistence, data + written);
+    written += write_uint32(mlt->color, data + written);
+    written += write_uint8(mlt->persistence, data + written);
     DP_ASSERT(written == msg_laser_trail_payload_length(msg));
     return written;
 }
@@ -3388,8 +3437,8 @@ static size_t msg_move_pointer_serialize_payload(DP_Message *msg,
 {
     DP_MsgMovePointer *mmp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_int32(mmp->x, data + written);
-    written += DP_write_bigendian_int32(mmp->y, data + written);
+    written += write_int32(mmp->x, data + written);
+    written += write_int32(mmp->y, data + written);
     DP_ASSERT(written == msg_move_pointer_payload_length(msg));
     return written;
 }
@@ -3627,8 +3676,8 @@ static size_t msg_layer_acl_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerAcl *mla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mla->id, data + written);
-    written += DP_write_bigendian_uint8(mla->flags, data + written);
+    written += write_uint24(mla->id, data + written);
+    written += write_uint8(mla->flags, data + written);
     written += DP_write_bigendian_uint8_array(
         mla->exclusive, mla->exclusive_count, data + written);
     DP_ASSERT(written == msg_layer_acl_payload_length(msg));
@@ -3640,10 +3689,8 @@ static size_t msg_layer_acl_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerAcl *mla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mla->id),
-                                         data + written);
-    written +=
-        DP_write_bigendian_uint8(mla->flags & (uint8_t)0x83, data + written);
+    written += write_uint16(serialize_layer_id_compat(mla->id), data + written);
+    written += write_uint8(mla->flags & (uint8_t)0x83, data + written);
     written += DP_write_bigendian_uint8_array(
         mla->exclusive, mla->exclusive_count, data + written);
     DP_ASSERT(written == msg_layer_acl_payload_length_compat(msg));
@@ -3939,7 +3986,7 @@ static size_t msg_default_layer_serialize_payload(DP_Message *msg,
 {
     DP_MsgDefaultLayer *mdl = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mdl->id, data + written);
+    written += write_uint24(mdl->id, data + written);
     DP_ASSERT(written == msg_default_layer_payload_length(msg));
     return written;
 }
@@ -3949,8 +3996,7 @@ static size_t msg_default_layer_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgDefaultLayer *mdl = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mdl->id),
-                                         data + written);
+    written += write_uint16(serialize_layer_id_compat(mdl->id), data + written);
     DP_ASSERT(written == msg_default_layer_payload_length_compat(msg));
     return written;
 }
@@ -4058,7 +4104,7 @@ static size_t msg_undo_depth_serialize_payload(DP_Message *msg,
 {
     DP_MsgUndoDepth *mud = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mud->depth, data + written);
+    written += write_uint8(mud->depth, data + written);
     DP_ASSERT(written == msg_undo_depth_payload_length(msg));
     return written;
 }
@@ -4167,8 +4213,8 @@ static size_t msg_data_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgData *md = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(md->type, data + written);
-    written += DP_write_bigendian_uint8(md->recipient, data + written);
+    written += write_uint8(md->type, data + written);
+    written += write_uint8(md->recipient, data + written);
     written += write_bytes(md->body, md->body_size, data + written);
     DP_ASSERT(written == msg_data_payload_length(msg));
     return written;
@@ -4338,7 +4384,7 @@ static size_t msg_local_change_serialize_payload(DP_Message *msg,
 {
     DP_MsgLocalChange *mlc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mlc->type, data + written);
+    written += write_uint8(mlc->type, data + written);
     written += write_bytes(mlc->body, mlc->body_size, data + written);
     DP_ASSERT(written == msg_local_change_payload_length(msg));
     return written;
@@ -4629,10 +4675,10 @@ static size_t msg_canvas_resize_serialize_payload(DP_Message *msg,
 {
     DP_MsgCanvasResize *mcr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_int32(mcr->top, data + written);
-    written += DP_write_bigendian_int32(mcr->right, data + written);
-    written += DP_write_bigendian_int32(mcr->bottom, data + written);
-    written += DP_write_bigendian_int32(mcr->left, data + written);
+    written += write_int32(mcr->top, data + written);
+    written += write_int32(mcr->right, data + written);
+    written += write_int32(mcr->bottom, data + written);
+    written += write_int32(mcr->left, data + written);
     DP_ASSERT(written == msg_canvas_resize_payload_length(msg));
     return written;
 }
@@ -4791,11 +4837,11 @@ static size_t msg_layer_attributes_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerAttributes *mla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mla->id, data + written);
-    written += DP_write_bigendian_uint8(mla->sublayer, data + written);
-    written += DP_write_bigendian_uint8(mla->flags, data + written);
-    written += DP_write_bigendian_uint8(mla->opacity, data + written);
-    written += DP_write_bigendian_uint8(mla->blend, data + written);
+    written += write_uint24(mla->id, data + written);
+    written += write_uint8(mla->sublayer, data + written);
+    written += write_uint8(mla->flags, data + written);
+    written += write_uint8(mla->opacity, data + written);
+    written += write_uint8(mla->blend, data + written);
     DP_ASSERT(written == msg_layer_attributes_payload_length(msg));
     return written;
 }
@@ -4805,13 +4851,11 @@ static size_t msg_layer_attributes_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerAttributes *mla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mla->id),
-                                         data + written);
-    written += DP_write_bigendian_uint8(mla->sublayer, data + written);
-    written +=
-        DP_write_bigendian_uint8(mla->flags & (uint8_t)0x7, data + written);
-    written += DP_write_bigendian_uint8(mla->opacity, data + written);
-    written += DP_write_bigendian_uint8(mla->blend, data + written);
+    written += write_uint16(serialize_layer_id_compat(mla->id), data + written);
+    written += write_uint8(mla->sublayer, data + written);
+    written += write_uint8(mla->flags & (uint8_t)0x7, data + written);
+    written += write_uint8(mla->opacity, data + written);
+    written += write_uint8(mla->blend, data + written);
     DP_ASSERT(written == msg_layer_attributes_payload_length_compat(msg));
     return written;
 }
@@ -4991,7 +5035,7 @@ static size_t msg_layer_retitle_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerRetitle *mlr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mlr->id, data + written);
+    written += write_uint24(mlr->id, data + written);
     written += DP_write_bytes(mlr->title, 1, mlr->title_len, data + written);
     DP_ASSERT(written == msg_layer_retitle_payload_length(msg));
     return written;
@@ -5002,8 +5046,7 @@ static size_t msg_layer_retitle_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerRetitle *mlr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mlr->id),
-                                         data + written);
+    written += write_uint16(serialize_layer_id_compat(mlr->id), data + written);
     written += DP_write_bytes(mlr->title, 1, mlr->title_len, data + written);
     DP_ASSERT(written == msg_layer_retitle_payload_length_compat(msg));
     return written;
@@ -5154,12 +5197,12 @@ static size_t msg_put_image_serialize_payload(DP_Message *msg,
 {
     DP_MsgPutImage *mpi = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mpi->layer, data + written);
-    written += DP_write_bigendian_uint8(mpi->mode, data + written);
-    written += DP_write_bigendian_uint32(mpi->x, data + written);
-    written += DP_write_bigendian_uint32(mpi->y, data + written);
-    written += DP_write_bigendian_uint32(mpi->w, data + written);
-    written += DP_write_bigendian_uint32(mpi->h, data + written);
+    written += write_uint24(mpi->layer, data + written);
+    written += write_uint8(mpi->mode, data + written);
+    written += write_uint32(mpi->x, data + written);
+    written += write_uint32(mpi->y, data + written);
+    written += write_uint32(mpi->w, data + written);
+    written += write_uint32(mpi->h, data + written);
     written += write_bytes(mpi->image, mpi->image_size, data + written);
     DP_ASSERT(written == msg_put_image_payload_length(msg));
     return written;
@@ -5170,14 +5213,14 @@ static size_t msg_put_image_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgPutImage *mpi = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mpi->layer),
+    written += write_uint16(serialize_layer_id_compat(mpi->layer),
                                          data + written);
-    written += DP_write_bigendian_uint8(DP_blend_mode_to_compatible(mpi->mode),
+    written += write_uint8(DP_blend_mode_to_compatible(mpi->mode),
                                         data + written);
-    written += DP_write_bigendian_uint32(mpi->x, data + written);
-    written += DP_write_bigendian_uint32(mpi->y, data + written);
-    written += DP_write_bigendian_uint32(mpi->w, data + written);
-    written += DP_write_bigendian_uint32(mpi->h, data + written);
+    written += write_uint32(mpi->x, data + written);
+    written += write_uint32(mpi->y, data + written);
+    written += write_uint32(mpi->w, data + written);
+    written += write_uint32(mpi->h, data + written);
     written += write_bytes(mpi->image, mpi->image_size, data + written);
     DP_ASSERT(written == msg_put_image_payload_length_compat(msg));
     return written;
@@ -5214,13 +5257,13 @@ void DP_msg_put_image_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_PUT_IMAGE_MATCH_LENGTH);
     const DP_MsgPutImage *mpi = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mpi->layer, data + written);
-    written += DP_write_bigendian_uint8(mpi->mode, data + written);
-    written += DP_write_bigendian_uint32(mpi->x, data + written);
-    written += DP_write_bigendian_uint32(mpi->y, data + written);
-    written += DP_write_bigendian_uint32(mpi->w, data + written);
-    written += DP_write_bigendian_uint32(mpi->h, data + written);
-    written += DP_write_bigendian_uint16(mpi->image_size, data + written);
+    written += write_uint24(mpi->layer, data + written);
+    written += write_uint8(mpi->mode, data + written);
+    written += write_uint32(mpi->x, data + written);
+    written += write_uint32(mpi->y, data + written);
+    written += write_uint32(mpi->w, data + written);
+    written += write_uint32(mpi->h, data + written);
+    written += write_uint16(mpi->image_size, data + written);
     DP_ASSERT(written == DP_MSG_PUT_IMAGE_MATCH_LENGTH);
 }
 
@@ -5423,13 +5466,13 @@ static size_t msg_fill_rect_serialize_payload(DP_Message *msg,
 {
     DP_MsgFillRect *mfr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mfr->layer, data + written);
-    written += DP_write_bigendian_uint8(mfr->mode, data + written);
-    written += DP_write_bigendian_uint32(mfr->x, data + written);
-    written += DP_write_bigendian_uint32(mfr->y, data + written);
-    written += DP_write_bigendian_uint32(mfr->w, data + written);
-    written += DP_write_bigendian_uint32(mfr->h, data + written);
-    written += DP_write_bigendian_uint32(mfr->color, data + written);
+    written += write_uint24(mfr->layer, data + written);
+    written += write_uint8(mfr->mode, data + written);
+    written += write_uint32(mfr->x, data + written);
+    written += write_uint32(mfr->y, data + written);
+    written += write_uint32(mfr->w, data + written);
+    written += write_uint32(mfr->h, data + written);
+    written += write_uint32(mfr->color, data + written);
     DP_ASSERT(written == msg_fill_rect_payload_length(msg));
     return written;
 }
@@ -5439,15 +5482,15 @@ static size_t msg_fill_rect_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgFillRect *mfr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mfr->layer),
+    written += write_uint16(serialize_layer_id_compat(mfr->layer),
                                          data + written);
-    written += DP_write_bigendian_uint8(DP_blend_mode_to_compatible(mfr->mode),
+    written += write_uint8(DP_blend_mode_to_compatible(mfr->mode),
                                         data + written);
-    written += DP_write_bigendian_uint32(mfr->x, data + written);
-    written += DP_write_bigendian_uint32(mfr->y, data + written);
-    written += DP_write_bigendian_uint32(mfr->w, data + written);
-    written += DP_write_bigendian_uint32(mfr->h, data + written);
-    written += DP_write_bigendian_uint32(mfr->color, data + written);
+    written += write_uint32(mfr->x, data + written);
+    written += write_uint32(mfr->y, data + written);
+    written += write_uint32(mfr->w, data + written);
+    written += write_uint32(mfr->h, data + written);
+    written += write_uint32(mfr->color, data + written);
     DP_ASSERT(written == msg_fill_rect_payload_length_compat(msg));
     return written;
 }
@@ -5480,13 +5523,13 @@ void DP_msg_fill_rect_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_FILL_RECT_MATCH_LENGTH);
     const DP_MsgFillRect *mfr = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mfr->layer, data + written);
-    written += DP_write_bigendian_uint8(mfr->mode, data + written);
-    written += DP_write_bigendian_uint32(mfr->x, data + written);
-    written += DP_write_bigendian_uint32(mfr->y, data + written);
-    written += DP_write_bigendian_uint32(mfr->w, data + written);
-    written += DP_write_bigendian_uint32(mfr->h, data + written);
-    written += DP_write_bigendian_uint32(mfr->color, data + written);
+    written += write_uint24(mfr->layer, data + written);
+    written += write_uint8(mfr->mode, data + written);
+    written += write_uint32(mfr->x, data + written);
+    written += write_uint32(mfr->y, data + written);
+    written += write_uint32(mfr->w, data + written);
+    written += write_uint32(mfr->h, data + written);
+    written += write_uint32(mfr->color, data + written);
     DP_ASSERT(written == DP_MSG_FILL_RECT_MATCH_LENGTH);
 }
 
@@ -5653,7 +5696,7 @@ static size_t msg_pen_up_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgPenUp *mpu = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mpu->layer, data + written);
+    written += write_uint24(mpu->layer, data + written);
     DP_ASSERT(written == msg_pen_up_payload_length(msg));
     return written;
 }
@@ -5764,11 +5807,11 @@ static size_t msg_annotation_create_serialize_payload(DP_Message *msg,
 {
     DP_MsgAnnotationCreate *mac = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mac->id, data + written);
-    written += DP_write_bigendian_int32(mac->x, data + written);
-    written += DP_write_bigendian_int32(mac->y, data + written);
-    written += DP_write_bigendian_uint16(mac->w, data + written);
-    written += DP_write_bigendian_uint16(mac->h, data + written);
+    written += write_uint16(mac->id, data + written);
+    written += write_int32(mac->x, data + written);
+    written += write_int32(mac->y, data + written);
+    written += write_uint16(mac->w, data + written);
+    written += write_uint16(mac->h, data + written);
     DP_ASSERT(written == msg_annotation_create_payload_length(msg));
     return written;
 }
@@ -5779,12 +5822,11 @@ msg_annotation_create_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgAnnotationCreate *mac = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mac->id),
-                                         data + written);
-    written += DP_write_bigendian_int32(mac->x, data + written);
-    written += DP_write_bigendian_int32(mac->y, data + written);
-    written += DP_write_bigendian_uint16(mac->w, data + written);
-    written += DP_write_bigendian_uint16(mac->h, data + written);
+    written += write_uint16(convert_other_id_compat(mac->id), data + written);
+    written += write_int32(mac->x, data + written);
+    written += write_int32(mac->y, data + written);
+    written += write_uint16(mac->w, data + written);
+    written += write_uint16(mac->h, data + written);
     DP_ASSERT(written == msg_annotation_create_payload_length_compat(msg));
     return written;
 }
@@ -5949,11 +5991,11 @@ static size_t msg_annotation_reshape_serialize_payload(DP_Message *msg,
 {
     DP_MsgAnnotationReshape *mar = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mar->id, data + written);
-    written += DP_write_bigendian_int32(mar->x, data + written);
-    written += DP_write_bigendian_int32(mar->y, data + written);
-    written += DP_write_bigendian_uint16(mar->w, data + written);
-    written += DP_write_bigendian_uint16(mar->h, data + written);
+    written += write_uint16(mar->id, data + written);
+    written += write_int32(mar->x, data + written);
+    written += write_int32(mar->y, data + written);
+    written += write_uint16(mar->w, data + written);
+    written += write_uint16(mar->h, data + written);
     DP_ASSERT(written == msg_annotation_reshape_payload_length(msg));
     return written;
 }
@@ -5964,12 +6006,11 @@ msg_annotation_reshape_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgAnnotationReshape *mar = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mar->id),
-                                         data + written);
-    written += DP_write_bigendian_int32(mar->x, data + written);
-    written += DP_write_bigendian_int32(mar->y, data + written);
-    written += DP_write_bigendian_uint16(mar->w, data + written);
-    written += DP_write_bigendian_uint16(mar->h, data + written);
+    written += write_uint16(convert_other_id_compat(mar->id), data + written);
+    written += write_int32(mar->x, data + written);
+    written += write_int32(mar->y, data + written);
+    written += write_uint16(mar->w, data + written);
+    written += write_uint16(mar->h, data + written);
     DP_ASSERT(written == msg_annotation_reshape_payload_length_compat(msg));
     return written;
 }
@@ -6154,10 +6195,10 @@ static size_t msg_annotation_edit_serialize_payload(DP_Message *msg,
 {
     DP_MsgAnnotationEdit *mae = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mae->id, data + written);
-    written += DP_write_bigendian_uint32(mae->bg, data + written);
-    written += DP_write_bigendian_uint8(mae->flags, data + written);
-    written += DP_write_bigendian_uint8(mae->border, data + written);
+    written += write_uint16(mae->id, data + written);
+    written += write_uint32(mae->bg, data + written);
+    written += write_uint8(mae->flags, data + written);
+    written += write_uint8(mae->border, data + written);
     written += DP_write_bytes(mae->text, 1, mae->text_len, data + written);
     DP_ASSERT(written == msg_annotation_edit_payload_length(msg));
     return written;
@@ -6168,12 +6209,10 @@ static size_t msg_annotation_edit_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgAnnotationEdit *mae = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mae->id),
-                                         data + written);
-    written += DP_write_bigendian_uint32(mae->bg, data + written);
-    written +=
-        DP_write_bigendian_uint8(mae->flags & (uint8_t)0x7, data + written);
-    written += DP_write_bigendian_uint8(mae->border, data + written);
+    written += write_uint16(convert_other_id_compat(mae->id), data + written);
+    written += write_uint32(mae->bg, data + written);
+    written += write_uint8(mae->flags & (uint8_t)0x7, data + written);
+    written += write_uint8(mae->border, data + written);
     written += DP_write_bytes(mae->text, 1, mae->text_len, data + written);
     DP_ASSERT(written == msg_annotation_edit_payload_length_compat(msg));
     return written;
@@ -6370,7 +6409,7 @@ static size_t msg_annotation_delete_serialize_payload(DP_Message *msg,
 {
     DP_MsgAnnotationDelete *mad = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mad->id, data + written);
+    written += write_uint16(mad->id, data + written);
     DP_ASSERT(written == msg_annotation_delete_payload_length(msg));
     return written;
 }
@@ -6381,8 +6420,7 @@ msg_annotation_delete_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgAnnotationDelete *mad = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mad->id),
-                                         data + written);
+    written += write_uint16(convert_other_id_compat(mad->id), data + written);
     DP_ASSERT(written == msg_annotation_delete_payload_length_compat(msg));
     return written;
 }
@@ -6502,12 +6540,12 @@ static size_t msg_put_tile_serialize_payload(DP_Message *msg,
 {
     DP_MsgPutTile *mpt = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mpt->user, data + written);
-    written += DP_write_bigendian_uint24(mpt->layer, data + written);
-    written += DP_write_bigendian_uint8(mpt->sublayer, data + written);
-    written += DP_write_bigendian_uint16(mpt->col, data + written);
-    written += DP_write_bigendian_uint16(mpt->row, data + written);
-    written += DP_write_bigendian_uint16(mpt->repeat, data + written);
+    written += write_uint8(mpt->user, data + written);
+    written += write_uint24(mpt->layer, data + written);
+    written += write_uint8(mpt->sublayer, data + written);
+    written += write_uint16(mpt->col, data + written);
+    written += write_uint16(mpt->row, data + written);
+    written += write_uint16(mpt->repeat, data + written);
     written += write_bytes(mpt->image, mpt->image_size, data + written);
     DP_ASSERT(written == msg_put_tile_payload_length(msg));
     return written;
@@ -6518,12 +6556,12 @@ static size_t msg_put_tile_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgPutTile *mpt = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mpt->layer),
+    written += write_uint16(serialize_layer_id_compat(mpt->layer),
                                          data + written);
-    written += DP_write_bigendian_uint8(mpt->sublayer, data + written);
-    written += DP_write_bigendian_uint16(mpt->col, data + written);
-    written += DP_write_bigendian_uint16(mpt->row, data + written);
-    written += DP_write_bigendian_uint16(mpt->repeat, data + written);
+    written += write_uint8(mpt->sublayer, data + written);
+    written += write_uint16(mpt->col, data + written);
+    written += write_uint16(mpt->row, data + written);
+    written += write_uint16(mpt->repeat, data + written);
     written += write_bytes(mpt->image, mpt->image_size, data + written);
     DP_ASSERT(written == msg_put_tile_payload_length_compat(msg));
     return written;
@@ -6851,11 +6889,11 @@ static size_t classic_dab_serialize_payload(DP_ClassicDab *cd,
                                             unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(cd->x, data + written);
-    written += DP_write_bigendian_int8(cd->y, data + written);
-    written += DP_write_bigendian_uint24(cd->size, data + written);
-    written += DP_write_bigendian_uint8(cd->hardness, data + written);
-    written += DP_write_bigendian_uint8(cd->opacity, data + written);
+    written += write_int8(cd->x, data + written);
+    written += write_int8(cd->y, data + written);
+    written += write_uint24(cd->size, data + written);
+    written += write_uint8(cd->hardness, data + written);
+    written += write_uint8(cd->opacity, data + written);
     return written;
 }
 
@@ -7005,12 +7043,11 @@ static size_t classic_dab_serialize_payload_compat(DP_ClassicDab *cd,
                                                    unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(cd->x, data + written);
-    written += DP_write_bigendian_int8(cd->y, data + written);
-    written += DP_write_bigendian_uint16(DP_uint32_to_uint16(cd->size),
-                                         data + written);
-    written += DP_write_bigendian_uint8(cd->hardness, data + written);
-    written += DP_write_bigendian_uint8(cd->opacity, data + written);
+    written += write_int8(cd->x, data + written);
+    written += write_int8(cd->y, data + written);
+    written += write_uint16(DP_uint32_to_uint16(cd->size), data + written);
+    written += write_uint8(cd->hardness, data + written);
+    written += write_uint8(cd->opacity, data + written);
     return written;
 }
 
@@ -7069,12 +7106,12 @@ static size_t msg_draw_dabs_classic_serialize_payload(DP_Message *msg,
 {
     DP_MsgDrawDabsClassic *mddc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddc->flags, data + written);
-    written += DP_write_bigendian_uint24(mddc->layer, data + written);
-    written += DP_write_bigendian_int32(mddc->x, data + written);
-    written += DP_write_bigendian_int32(mddc->y, data + written);
-    written += DP_write_bigendian_uint32(mddc->color, data + written);
-    written += DP_write_bigendian_uint8(mddc->mode, data + written);
+    written += write_uint8(mddc->flags, data + written);
+    written += write_uint24(mddc->layer, data + written);
+    written += write_int32(mddc->x, data + written);
+    written += write_int32(mddc->y, data + written);
+    written += write_uint32(mddc->color, data + written);
+    written += write_uint8(mddc->mode, data + written);
     written += classic_dab_serialize_payloads(mddc->dabs, mddc->dabs_count,
                                               data + written);
     DP_ASSERT(written == msg_draw_dabs_classic_payload_length(msg));
@@ -7087,12 +7124,12 @@ msg_draw_dabs_classic_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgDrawDabsClassic *mddc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mddc->layer),
+    written += write_uint16(serialize_layer_id_compat(mddc->layer),
                                          data + written);
-    written += DP_write_bigendian_int32(mddc->x, data + written);
-    written += DP_write_bigendian_int32(mddc->y, data + written);
-    written += DP_write_bigendian_uint32(mddc->color, data + written);
-    written += DP_write_bigendian_uint8(DP_blend_mode_to_compatible(mddc->mode),
+    written += write_int32(mddc->x, data + written);
+    written += write_int32(mddc->y, data + written);
+    written += write_uint32(mddc->color, data + written);
+    written += write_uint8(DP_blend_mode_to_compatible(mddc->mode),
                                         data + written);
     written += classic_dab_serialize_payloads_compat(
         mddc->dabs, mddc->dabs_count, data + written);
@@ -7131,13 +7168,13 @@ void DP_msg_draw_dabs_classic_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_DRAW_DABS_CLASSIC_MATCH_LENGTH);
     const DP_MsgDrawDabsClassic *mddc = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddc->flags, data + written);
-    written += DP_write_bigendian_uint24(mddc->layer, data + written);
-    written += DP_write_bigendian_int32(mddc->x, data + written);
-    written += DP_write_bigendian_int32(mddc->y, data + written);
-    written += DP_write_bigendian_uint32(mddc->color, data + written);
-    written += DP_write_bigendian_uint8(mddc->mode, data + written);
-    written += DP_write_bigendian_uint16(mddc->dabs_count, data + written);
+    written += write_uint8(mddc->flags, data + written);
+    written += write_uint24(mddc->layer, data + written);
+    written += write_int32(mddc->x, data + written);
+    written += write_int32(mddc->y, data + written);
+    written += write_uint32(mddc->color, data + written);
+    written += write_uint8(mddc->mode, data + written);
+    written += write_uint16(mddc->dabs_count, data + written);
     DP_ASSERT(written == DP_MSG_DRAW_DABS_CLASSIC_MATCH_LENGTH);
 }
 
@@ -7342,10 +7379,10 @@ struct DP_PixelDab {
 static size_t pixel_dab_serialize_payload(DP_PixelDab *pd, unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(pd->x, data + written);
-    written += DP_write_bigendian_int8(pd->y, data + written);
-    written += DP_write_bigendian_uint16(pd->size, data + written);
-    written += DP_write_bigendian_uint8(pd->opacity, data + written);
+    written += write_int8(pd->x, data + written);
+    written += write_int8(pd->y, data + written);
+    written += write_uint16(pd->size, data + written);
+    written += write_uint8(pd->opacity, data + written);
     return written;
 }
 
@@ -7480,11 +7517,10 @@ static size_t pixel_dab_serialize_payload_compat(DP_PixelDab *pd,
                                                  unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(pd->x, data + written);
-    written += DP_write_bigendian_int8(pd->y, data + written);
-    written +=
-        DP_write_bigendian_uint8(DP_uint16_to_uint8(pd->size), data + written);
-    written += DP_write_bigendian_uint8(pd->opacity, data + written);
+    written += write_int8(pd->x, data + written);
+    written += write_int8(pd->y, data + written);
+    written += write_uint8(DP_uint16_to_uint8(pd->size), data + written);
+    written += write_uint8(pd->opacity, data + written);
     return written;
 }
 
@@ -7540,12 +7576,12 @@ static size_t msg_draw_dabs_pixel_serialize_payload(DP_Message *msg,
 {
     DP_MsgDrawDabsPixel *mddp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddp->flags, data + written);
-    written += DP_write_bigendian_uint24(mddp->layer, data + written);
-    written += DP_write_bigendian_int32(mddp->x, data + written);
-    written += DP_write_bigendian_int32(mddp->y, data + written);
-    written += DP_write_bigendian_uint32(mddp->color, data + written);
-    written += DP_write_bigendian_uint8(mddp->mode, data + written);
+    written += write_uint8(mddp->flags, data + written);
+    written += write_uint24(mddp->layer, data + written);
+    written += write_int32(mddp->x, data + written);
+    written += write_int32(mddp->y, data + written);
+    written += write_uint32(mddp->color, data + written);
+    written += write_uint8(mddp->mode, data + written);
     written += pixel_dab_serialize_payloads(mddp->dabs, mddp->dabs_count,
                                             data + written);
     DP_ASSERT(written == msg_draw_dabs_pixel_payload_length(msg));
@@ -7557,12 +7593,12 @@ static size_t msg_draw_dabs_pixel_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgDrawDabsPixel *mddp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mddp->layer),
+    written += write_uint16(serialize_layer_id_compat(mddp->layer),
                                          data + written);
-    written += DP_write_bigendian_int32(mddp->x, data + written);
-    written += DP_write_bigendian_int32(mddp->y, data + written);
-    written += DP_write_bigendian_uint32(mddp->color, data + written);
-    written += DP_write_bigendian_uint8(DP_blend_mode_to_compatible(mddp->mode),
+    written += write_int32(mddp->x, data + written);
+    written += write_int32(mddp->y, data + written);
+    written += write_uint32(mddp->color, data + written);
+    written += write_uint8(DP_blend_mode_to_compatible(mddp->mode),
                                         data + written);
     written += pixel_dab_serialize_payloads_compat(mddp->dabs, mddp->dabs_count,
                                                    data + written);
@@ -7600,13 +7636,13 @@ void DP_msg_draw_dabs_pixel_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_DRAW_DABS_PIXEL_MATCH_LENGTH);
     const DP_MsgDrawDabsPixel *mddp = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddp->flags, data + written);
-    written += DP_write_bigendian_uint24(mddp->layer, data + written);
-    written += DP_write_bigendian_int32(mddp->x, data + written);
-    written += DP_write_bigendian_int32(mddp->y, data + written);
-    written += DP_write_bigendian_uint32(mddp->color, data + written);
-    written += DP_write_bigendian_uint8(mddp->mode, data + written);
-    written += DP_write_bigendian_uint16(mddp->dabs_count, data + written);
+    written += write_uint8(mddp->flags, data + written);
+    written += write_uint24(mddp->layer, data + written);
+    written += write_int32(mddp->x, data + written);
+    written += write_int32(mddp->y, data + written);
+    written += write_uint32(mddp->color, data + written);
+    written += write_uint8(mddp->mode, data + written);
+    written += write_uint16(mddp->dabs_count, data + written);
     DP_ASSERT(written == DP_MSG_DRAW_DABS_PIXEL_MATCH_LENGTH);
 }
 
@@ -7929,13 +7965,13 @@ static size_t mypaint_dab_serialize_payload(DP_MyPaintDab *mpd,
                                             unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(mpd->x, data + written);
-    written += DP_write_bigendian_int8(mpd->y, data + written);
-    written += DP_write_bigendian_uint24(mpd->size, data + written);
-    written += DP_write_bigendian_uint8(mpd->hardness, data + written);
-    written += DP_write_bigendian_uint8(mpd->opacity, data + written);
-    written += DP_write_bigendian_uint8(mpd->angle, data + written);
-    written += DP_write_bigendian_uint8(mpd->aspect_ratio, data + written);
+    written += write_int8(mpd->x, data + written);
+    written += write_int8(mpd->y, data + written);
+    written += write_uint24(mpd->size, data + written);
+    written += write_uint8(mpd->hardness, data + written);
+    written += write_uint8(mpd->opacity, data + written);
+    written += write_uint8(mpd->angle, data + written);
+    written += write_uint8(mpd->aspect_ratio, data + written);
     return written;
 }
 
@@ -8112,14 +8148,13 @@ static size_t mypaint_dab_serialize_payload_compat(DP_MyPaintDab *mpd,
                                                    unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(mpd->x, data + written);
-    written += DP_write_bigendian_int8(mpd->y, data + written);
-    written += DP_write_bigendian_uint16(DP_uint32_to_uint16(mpd->size),
-                                         data + written);
-    written += DP_write_bigendian_uint8(mpd->hardness, data + written);
-    written += DP_write_bigendian_uint8(mpd->opacity, data + written);
-    written += DP_write_bigendian_uint8(mpd->angle, data + written);
-    written += DP_write_bigendian_uint8(mpd->aspect_ratio, data + written);
+    written += write_int8(mpd->x, data + written);
+    written += write_int8(mpd->y, data + written);
+    written += write_uint16(DP_uint32_to_uint16(mpd->size), data + written);
+    written += write_uint8(mpd->hardness, data + written);
+    written += write_uint8(mpd->opacity, data + written);
+    written += write_uint8(mpd->angle, data + written);
+    written += write_uint8(mpd->aspect_ratio, data + written);
     return written;
 }
 
@@ -8184,15 +8219,15 @@ static size_t msg_draw_dabs_mypaint_serialize_payload(DP_Message *msg,
 {
     DP_MsgDrawDabsMyPaint *mddmp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddmp->flags, data + written);
-    written += DP_write_bigendian_uint24(mddmp->layer, data + written);
-    written += DP_write_bigendian_int32(mddmp->x, data + written);
-    written += DP_write_bigendian_int32(mddmp->y, data + written);
-    written += DP_write_bigendian_uint32(mddmp->color, data + written);
-    written += DP_write_bigendian_uint8(mddmp->lock_alpha, data + written);
-    written += DP_write_bigendian_uint8(mddmp->colorize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->posterize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->mode, data + written);
+    written += write_uint8(mddmp->flags, data + written);
+    written += write_uint24(mddmp->layer, data + written);
+    written += write_int32(mddmp->x, data + written);
+    written += write_int32(mddmp->y, data + written);
+    written += write_uint32(mddmp->color, data + written);
+    written += write_uint8(mddmp->lock_alpha, data + written);
+    written += write_uint8(mddmp->colorize, data + written);
+    written += write_uint8(mddmp->posterize, data + written);
+    written += write_uint8(mddmp->mode, data + written);
     written += mypaint_dab_serialize_payloads(mddmp->dabs, mddmp->dabs_count,
                                               data + written);
     DP_ASSERT(written == msg_draw_dabs_mypaint_payload_length(msg));
@@ -8205,15 +8240,15 @@ msg_draw_dabs_mypaint_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgDrawDabsMyPaint *mddmp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mddmp->layer), data + written);
-    written += DP_write_bigendian_int32(mddmp->x, data + written);
-    written += DP_write_bigendian_int32(mddmp->y, data + written);
-    written += DP_write_bigendian_uint32(mddmp->color, data + written);
-    written += DP_write_bigendian_uint8(mddmp->lock_alpha, data + written);
-    written += DP_write_bigendian_uint8(mddmp->colorize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->posterize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->mode, data + written);
+    written += write_int32(mddmp->x, data + written);
+    written += write_int32(mddmp->y, data + written);
+    written += write_uint32(mddmp->color, data + written);
+    written += write_uint8(mddmp->lock_alpha, data + written);
+    written += write_uint8(mddmp->colorize, data + written);
+    written += write_uint8(mddmp->posterize, data + written);
+    written += write_uint8(mddmp->mode, data + written);
     written += mypaint_dab_serialize_payloads_compat(
         mddmp->dabs, mddmp->dabs_count, data + written);
     DP_ASSERT(written == msg_draw_dabs_mypaint_payload_length_compat(msg));
@@ -8256,16 +8291,16 @@ void DP_msg_draw_dabs_mypaint_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_DRAW_DABS_MYPAINT_MATCH_LENGTH);
     const DP_MsgDrawDabsMyPaint *mddmp = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddmp->flags, data + written);
-    written += DP_write_bigendian_uint24(mddmp->layer, data + written);
-    written += DP_write_bigendian_int32(mddmp->x, data + written);
-    written += DP_write_bigendian_int32(mddmp->y, data + written);
-    written += DP_write_bigendian_uint32(mddmp->color, data + written);
-    written += DP_write_bigendian_uint8(mddmp->lock_alpha, data + written);
-    written += DP_write_bigendian_uint8(mddmp->colorize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->posterize, data + written);
-    written += DP_write_bigendian_uint8(mddmp->mode, data + written);
-    written += DP_write_bigendian_uint16(mddmp->dabs_count, data + written);
+    written += write_uint8(mddmp->flags, data + written);
+    written += write_uint24(mddmp->layer, data + written);
+    written += write_int32(mddmp->x, data + written);
+    written += write_int32(mddmp->y, data + written);
+    written += write_uint32(mddmp->color, data + written);
+    written += write_uint8(mddmp->lock_alpha, data + written);
+    written += write_uint8(mddmp->colorize, data + written);
+    written += write_uint8(mddmp->posterize, data + written);
+    written += write_uint8(mddmp->mode, data + written);
+    written += write_uint16(mddmp->dabs_count, data + written);
     DP_ASSERT(written == DP_MSG_DRAW_DABS_MYPAINT_MATCH_LENGTH);
 }
 
@@ -8511,13 +8546,13 @@ static size_t mypaint_blend_dab_serialize_payload(DP_MyPaintBlendDab *mpbd,
                                                   unsigned char *data)
 {
     size_t written = 0;
-    written += DP_write_bigendian_int8(mpbd->x, data + written);
-    written += DP_write_bigendian_int8(mpbd->y, data + written);
-    written += DP_write_bigendian_uint24(mpbd->size, data + written);
-    written += DP_write_bigendian_uint8(mpbd->hardness, data + written);
-    written += DP_write_bigendian_uint8(mpbd->opacity, data + written);
-    written += DP_write_bigendian_uint8(mpbd->angle, data + written);
-    written += DP_write_bigendian_uint8(mpbd->aspect_ratio, data + written);
+    written += write_int8(mpbd->x, data + written);
+    written += write_int8(mpbd->y, data + written);
+    written += write_uint24(mpbd->size, data + written);
+    written += write_uint8(mpbd->hardness, data + written);
+    written += write_uint8(mpbd->opacity, data + written);
+    written += write_uint8(mpbd->angle, data + written);
+    written += write_uint8(mpbd->aspect_ratio, data + written);
     return written;
 }
 
@@ -8721,12 +8756,12 @@ static size_t msg_draw_dabs_mypaint_blend_serialize_payload(DP_Message *msg,
 {
     DP_MsgDrawDabsMyPaintBlend *mddmpb = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddmpb->flags, data + written);
-    written += DP_write_bigendian_uint24(mddmpb->layer, data + written);
-    written += DP_write_bigendian_int32(mddmpb->x, data + written);
-    written += DP_write_bigendian_int32(mddmpb->y, data + written);
-    written += DP_write_bigendian_uint32(mddmpb->color, data + written);
-    written += DP_write_bigendian_uint8(mddmpb->mode, data + written);
+    written += write_uint8(mddmpb->flags, data + written);
+    written += write_uint24(mddmpb->layer, data + written);
+    written += write_int32(mddmpb->x, data + written);
+    written += write_int32(mddmpb->y, data + written);
+    written += write_uint32(mddmpb->color, data + written);
+    written += write_uint8(mddmpb->mode, data + written);
     written += mypaint_blend_dab_serialize_payloads(
         mddmpb->dabs, mddmpb->dabs_count, data + written);
     DP_ASSERT(written == msg_draw_dabs_mypaint_blend_payload_length(msg));
@@ -8766,13 +8801,13 @@ void DP_msg_draw_dabs_mypaint_blend_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_DRAW_DABS_MYPAINT_BLEND_MATCH_LENGTH);
     const DP_MsgDrawDabsMyPaintBlend *mddmpb = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mddmpb->flags, data + written);
-    written += DP_write_bigendian_uint24(mddmpb->layer, data + written);
-    written += DP_write_bigendian_int32(mddmpb->x, data + written);
-    written += DP_write_bigendian_int32(mddmpb->y, data + written);
-    written += DP_write_bigendian_uint32(mddmpb->color, data + written);
-    written += DP_write_bigendian_uint8(mddmpb->mode, data + written);
-    written += DP_write_bigendian_uint16(mddmpb->dabs_count, data + written);
+    written += write_uint8(mddmpb->flags, data + written);
+    written += write_uint24(mddmpb->layer, data + written);
+    written += write_int32(mddmpb->x, data + written);
+    written += write_int32(mddmpb->y, data + written);
+    written += write_uint32(mddmpb->color, data + written);
+    written += write_uint8(mddmpb->mode, data + written);
+    written += write_uint16(mddmpb->dabs_count, data + written);
     DP_ASSERT(written == DP_MSG_DRAW_DABS_MYPAINT_BLEND_MATCH_LENGTH);
 }
 
@@ -8974,16 +9009,16 @@ static size_t msg_move_rect_serialize_payload(DP_Message *msg,
 {
     DP_MsgMoveRect *mmr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mmr->layer, data + written);
-    written += DP_write_bigendian_uint24(mmr->source, data + written);
-    written += DP_write_bigendian_int32(mmr->sx, data + written);
-    written += DP_write_bigendian_int32(mmr->sy, data + written);
-    written += DP_write_bigendian_int32(mmr->tx, data + written);
-    written += DP_write_bigendian_int32(mmr->ty, data + written);
-    written += DP_write_bigendian_int32(mmr->w, data + written);
-    written += DP_write_bigendian_int32(mmr->h, data + written);
-    written += DP_write_bigendian_uint8(mmr->blend, data + written);
-    written += DP_write_bigendian_uint8(mmr->opacity, data + written);
+    written += write_uint24(mmr->layer, data + written);
+    written += write_uint24(mmr->source, data + written);
+    written += write_int32(mmr->sx, data + written);
+    written += write_int32(mmr->sy, data + written);
+    written += write_int32(mmr->tx, data + written);
+    written += write_int32(mmr->ty, data + written);
+    written += write_int32(mmr->w, data + written);
+    written += write_int32(mmr->h, data + written);
+    written += write_uint8(mmr->blend, data + written);
+    written += write_uint8(mmr->opacity, data + written);
     written += write_bytes(mmr->mask, mmr->mask_size, data + written);
     DP_ASSERT(written == msg_move_rect_payload_length(msg));
     return written;
@@ -8994,16 +9029,16 @@ static size_t msg_move_rect_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgMoveRect *mmr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mmr->layer),
+    written += write_uint16(serialize_layer_id_compat(mmr->layer),
                                          data + written);
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mmr->source),
+    written += write_uint16(serialize_layer_id_compat(mmr->source),
                                          data + written);
-    written += DP_write_bigendian_int32(mmr->sx, data + written);
-    written += DP_write_bigendian_int32(mmr->sy, data + written);
-    written += DP_write_bigendian_int32(mmr->tx, data + written);
-    written += DP_write_bigendian_int32(mmr->ty, data + written);
-    written += DP_write_bigendian_int32(mmr->w, data + written);
-    written += DP_write_bigendian_int32(mmr->h, data + written);
+    written += write_int32(mmr->sx, data + written);
+    written += write_int32(mmr->sy, data + written);
+    written += write_int32(mmr->tx, data + written);
+    written += write_int32(mmr->ty, data + written);
+    written += write_int32(mmr->w, data + written);
+    written += write_int32(mmr->h, data + written);
     written += write_bytes(mmr->mask, mmr->mask_size, data + written);
     DP_ASSERT(written == msg_move_rect_payload_length_compat(msg));
     return written;
@@ -9045,17 +9080,17 @@ void DP_msg_move_rect_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_MOVE_RECT_MATCH_LENGTH);
     const DP_MsgMoveRect *mmr = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mmr->layer, data + written);
-    written += DP_write_bigendian_uint24(mmr->source, data + written);
-    written += DP_write_bigendian_int32(mmr->sx, data + written);
-    written += DP_write_bigendian_int32(mmr->sy, data + written);
-    written += DP_write_bigendian_int32(mmr->tx, data + written);
-    written += DP_write_bigendian_int32(mmr->ty, data + written);
-    written += DP_write_bigendian_int32(mmr->w, data + written);
-    written += DP_write_bigendian_int32(mmr->h, data + written);
-    written += DP_write_bigendian_uint8(mmr->blend, data + written);
-    written += DP_write_bigendian_uint8(mmr->opacity, data + written);
-    written += DP_write_bigendian_uint16(mmr->mask_size, data + written);
+    written += write_uint24(mmr->layer, data + written);
+    written += write_uint24(mmr->source, data + written);
+    written += write_int32(mmr->sx, data + written);
+    written += write_int32(mmr->sy, data + written);
+    written += write_int32(mmr->tx, data + written);
+    written += write_int32(mmr->ty, data + written);
+    written += write_int32(mmr->w, data + written);
+    written += write_int32(mmr->h, data + written);
+    written += write_uint8(mmr->blend, data + written);
+    written += write_uint8(mmr->opacity, data + written);
+    written += write_uint16(mmr->mask_size, data + written);
     DP_ASSERT(written == DP_MSG_MOVE_RECT_MATCH_LENGTH);
 }
 
@@ -9316,8 +9351,8 @@ static size_t msg_set_metadata_int_serialize_payload(DP_Message *msg,
 {
     DP_MsgSetMetadataInt *msmi = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msmi->field, data + written);
-    written += DP_write_bigendian_int32(msmi->value, data + written);
+    written += write_uint8(msmi->field, data + written);
+    written += write_int32(msmi->value, data + written);
     DP_ASSERT(written == msg_set_metadata_int_payload_length(msg));
     return written;
 }
@@ -9453,11 +9488,11 @@ static size_t msg_layer_tree_create_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerTreeCreate *mltc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mltc->id, data + written);
-    written += DP_write_bigendian_uint24(mltc->source, data + written);
-    written += DP_write_bigendian_uint24(mltc->target, data + written);
-    written += DP_write_bigendian_uint32(mltc->fill, data + written);
-    written += DP_write_bigendian_uint8(mltc->flags, data + written);
+    written += write_uint24(mltc->id, data + written);
+    written += write_uint24(mltc->source, data + written);
+    written += write_uint24(mltc->target, data + written);
+    written += write_uint32(mltc->fill, data + written);
+    written += write_uint8(mltc->flags, data + written);
     written += DP_write_bytes(mltc->title, 1, mltc->title_len, data + written);
     DP_ASSERT(written == msg_layer_tree_create_payload_length(msg));
     return written;
@@ -9469,14 +9504,14 @@ msg_layer_tree_create_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerTreeCreate *mltc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mltc->id),
+    written += write_uint16(serialize_layer_id_compat(mltc->id),
                                          data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mltc->source), data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mltc->target), data + written);
-    written += DP_write_bigendian_uint32(mltc->fill, data + written);
-    written += DP_write_bigendian_uint8(mltc->flags, data + written);
+    written += write_uint32(mltc->fill, data + written);
+    written += write_uint8(mltc->flags, data + written);
     written += DP_write_bytes(mltc->title, 1, mltc->title_len, data + written);
     DP_ASSERT(written == msg_layer_tree_create_payload_length_compat(msg));
     return written;
@@ -9682,9 +9717,9 @@ static size_t msg_layer_tree_move_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerTreeMove *mltm = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mltm->layer, data + written);
-    written += DP_write_bigendian_uint24(mltm->parent, data + written);
-    written += DP_write_bigendian_uint24(mltm->sibling, data + written);
+    written += write_uint24(mltm->layer, data + written);
+    written += write_uint24(mltm->parent, data + written);
+    written += write_uint24(mltm->sibling, data + written);
     DP_ASSERT(written == msg_layer_tree_move_payload_length(msg));
     return written;
 }
@@ -9694,11 +9729,11 @@ static size_t msg_layer_tree_move_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerTreeMove *mltm = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mltm->layer),
+    written += write_uint16(serialize_layer_id_compat(mltm->layer),
                                          data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mltm->parent), data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mltm->sibling), data + written);
     DP_ASSERT(written == msg_layer_tree_move_payload_length_compat(msg));
     return written;
@@ -9841,8 +9876,8 @@ static size_t msg_layer_tree_delete_serialize_payload(DP_Message *msg,
 {
     DP_MsgLayerTreeDelete *mltd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mltd->id, data + written);
-    written += DP_write_bigendian_uint24(mltd->merge_to, data + written);
+    written += write_uint24(mltd->id, data + written);
+    written += write_uint24(mltd->merge_to, data + written);
     DP_ASSERT(written == msg_layer_tree_delete_payload_length(msg));
     return written;
 }
@@ -9853,9 +9888,9 @@ msg_layer_tree_delete_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgLayerTreeDelete *mltd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mltd->id),
+    written += write_uint16(serialize_layer_id_compat(mltd->id),
                                          data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         serialize_layer_id_compat(mltd->merge_to), data + written);
     DP_ASSERT(written == msg_layer_tree_delete_payload_length_compat(msg));
     return written;
@@ -10016,23 +10051,23 @@ static size_t msg_transform_region_serialize_payload(DP_Message *msg,
 {
     DP_MsgTransformRegion *mtr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mtr->layer, data + written);
-    written += DP_write_bigendian_uint24(mtr->source, data + written);
-    written += DP_write_bigendian_int32(mtr->bx, data + written);
-    written += DP_write_bigendian_int32(mtr->by, data + written);
-    written += DP_write_bigendian_int32(mtr->bw, data + written);
-    written += DP_write_bigendian_int32(mtr->bh, data + written);
-    written += DP_write_bigendian_int32(mtr->x1, data + written);
-    written += DP_write_bigendian_int32(mtr->y1, data + written);
-    written += DP_write_bigendian_int32(mtr->x2, data + written);
-    written += DP_write_bigendian_int32(mtr->y2, data + written);
-    written += DP_write_bigendian_int32(mtr->x3, data + written);
-    written += DP_write_bigendian_int32(mtr->y3, data + written);
-    written += DP_write_bigendian_int32(mtr->x4, data + written);
-    written += DP_write_bigendian_int32(mtr->y4, data + written);
-    written += DP_write_bigendian_uint8(mtr->mode, data + written);
-    written += DP_write_bigendian_uint8(mtr->blend, data + written);
-    written += DP_write_bigendian_uint8(mtr->opacity, data + written);
+    written += write_uint24(mtr->layer, data + written);
+    written += write_uint24(mtr->source, data + written);
+    written += write_int32(mtr->bx, data + written);
+    written += write_int32(mtr->by, data + written);
+    written += write_int32(mtr->bw, data + written);
+    written += write_int32(mtr->bh, data + written);
+    written += write_int32(mtr->x1, data + written);
+    written += write_int32(mtr->y1, data + written);
+    written += write_int32(mtr->x2, data + written);
+    written += write_int32(mtr->y2, data + written);
+    written += write_int32(mtr->x3, data + written);
+    written += write_int32(mtr->y3, data + written);
+    written += write_int32(mtr->x4, data + written);
+    written += write_int32(mtr->y4, data + written);
+    written += write_uint8(mtr->mode, data + written);
+    written += write_uint8(mtr->blend, data + written);
+    written += write_uint8(mtr->opacity, data + written);
     written += write_bytes(mtr->mask, mtr->mask_size, data + written);
     DP_ASSERT(written == msg_transform_region_payload_length(msg));
     return written;
@@ -10043,23 +10078,23 @@ static size_t msg_transform_region_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgTransformRegion *mtr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mtr->layer),
+    written += write_uint16(serialize_layer_id_compat(mtr->layer),
                                          data + written);
-    written += DP_write_bigendian_uint16(serialize_layer_id_compat(mtr->source),
+    written += write_uint16(serialize_layer_id_compat(mtr->source),
                                          data + written);
-    written += DP_write_bigendian_int32(mtr->bx, data + written);
-    written += DP_write_bigendian_int32(mtr->by, data + written);
-    written += DP_write_bigendian_int32(mtr->bw, data + written);
-    written += DP_write_bigendian_int32(mtr->bh, data + written);
-    written += DP_write_bigendian_int32(mtr->x1, data + written);
-    written += DP_write_bigendian_int32(mtr->y1, data + written);
-    written += DP_write_bigendian_int32(mtr->x2, data + written);
-    written += DP_write_bigendian_int32(mtr->y2, data + written);
-    written += DP_write_bigendian_int32(mtr->x3, data + written);
-    written += DP_write_bigendian_int32(mtr->y3, data + written);
-    written += DP_write_bigendian_int32(mtr->x4, data + written);
-    written += DP_write_bigendian_int32(mtr->y4, data + written);
-    written += DP_write_bigendian_uint8(mtr->mode, data + written);
+    written += write_int32(mtr->bx, data + written);
+    written += write_int32(mtr->by, data + written);
+    written += write_int32(mtr->bw, data + written);
+    written += write_int32(mtr->bh, data + written);
+    written += write_int32(mtr->x1, data + written);
+    written += write_int32(mtr->y1, data + written);
+    written += write_int32(mtr->x2, data + written);
+    written += write_int32(mtr->y2, data + written);
+    written += write_int32(mtr->x3, data + written);
+    written += write_int32(mtr->y3, data + written);
+    written += write_int32(mtr->x4, data + written);
+    written += write_int32(mtr->y4, data + written);
+    written += write_uint8(mtr->mode, data + written);
     written += write_bytes(mtr->mask, mtr->mask_size, data + written);
     DP_ASSERT(written == msg_transform_region_payload_length_compat(msg));
     return written;
@@ -10110,24 +10145,24 @@ void DP_msg_transform_region_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_TRANSFORM_REGION_MATCH_LENGTH);
     const DP_MsgTransformRegion *mtr = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint24(mtr->layer, data + written);
-    written += DP_write_bigendian_uint24(mtr->source, data + written);
-    written += DP_write_bigendian_int32(mtr->bx, data + written);
-    written += DP_write_bigendian_int32(mtr->by, data + written);
-    written += DP_write_bigendian_int32(mtr->bw, data + written);
-    written += DP_write_bigendian_int32(mtr->bh, data + written);
-    written += DP_write_bigendian_int32(mtr->x1, data + written);
-    written += DP_write_bigendian_int32(mtr->y1, data + written);
-    written += DP_write_bigendian_int32(mtr->x2, data + written);
-    written += DP_write_bigendian_int32(mtr->y2, data + written);
-    written += DP_write_bigendian_int32(mtr->x3, data + written);
-    written += DP_write_bigendian_int32(mtr->y3, data + written);
-    written += DP_write_bigendian_int32(mtr->x4, data + written);
-    written += DP_write_bigendian_int32(mtr->y4, data + written);
-    written += DP_write_bigendian_uint8(mtr->mode, data + written);
-    written += DP_write_bigendian_uint8(mtr->blend, data + written);
-    written += DP_write_bigendian_uint8(mtr->opacity, data + written);
-    written += DP_write_bigendian_uint16(mtr->mask_size, data + written);
+    written += write_uint24(mtr->layer, data + written);
+    written += write_uint24(mtr->source, data + written);
+    written += write_int32(mtr->bx, data + written);
+    written += write_int32(mtr->by, data + written);
+    written += write_int32(mtr->bw, data + written);
+    written += write_int32(mtr->bh, data + written);
+    written += write_int32(mtr->x1, data + written);
+    written += write_int32(mtr->y1, data + written);
+    written += write_int32(mtr->x2, data + written);
+    written += write_int32(mtr->y2, data + written);
+    written += write_int32(mtr->x3, data + written);
+    written += write_int32(mtr->y3, data + written);
+    written += write_int32(mtr->x4, data + written);
+    written += write_int32(mtr->y4, data + written);
+    written += write_uint8(mtr->mode, data + written);
+    written += write_uint8(mtr->blend, data + written);
+    written += write_uint8(mtr->opacity, data + written);
+    written += write_uint16(mtr->mask_size, data + written);
     DP_ASSERT(written == DP_MSG_TRANSFORM_REGION_MATCH_LENGTH);
 }
 
@@ -10470,9 +10505,9 @@ static size_t msg_track_create_serialize_payload(DP_Message *msg,
 {
     DP_MsgTrackCreate *mtc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mtc->id, data + written);
-    written += DP_write_bigendian_uint16(mtc->insert_id, data + written);
-    written += DP_write_bigendian_uint16(mtc->source_id, data + written);
+    written += write_uint16(mtc->id, data + written);
+    written += write_uint16(mtc->insert_id, data + written);
+    written += write_uint16(mtc->source_id, data + written);
     written += DP_write_bytes(mtc->title, 1, mtc->title_len, data + written);
     DP_ASSERT(written == msg_track_create_payload_length(msg));
     return written;
@@ -10483,11 +10518,10 @@ static size_t msg_track_create_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgTrackCreate *mtc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mtc->id),
-                                         data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(convert_other_id_compat(mtc->id), data + written);
+    written += write_uint16(
         convert_other_id_compat(mtc->insert_id), data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         convert_other_id_compat(mtc->source_id), data + written);
     written += DP_write_bytes(mtc->title, 1, mtc->title_len, data + written);
     DP_ASSERT(written == msg_track_create_payload_length_compat(msg));
@@ -10663,7 +10697,7 @@ static size_t msg_track_retitle_serialize_payload(DP_Message *msg,
 {
     DP_MsgTrackRetitle *mtr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mtr->id, data + written);
+    written += write_uint16(mtr->id, data + written);
     written += DP_write_bytes(mtr->title, 1, mtr->title_len, data + written);
     DP_ASSERT(written == msg_track_retitle_payload_length(msg));
     return written;
@@ -10674,8 +10708,7 @@ static size_t msg_track_retitle_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgTrackRetitle *mtr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mtr->id),
-                                         data + written);
+    written += write_uint16(convert_other_id_compat(mtr->id), data + written);
     written += DP_write_bytes(mtr->title, 1, mtr->title_len, data + written);
     DP_ASSERT(written == msg_track_retitle_payload_length_compat(msg));
     return written;
@@ -10816,7 +10849,7 @@ static size_t msg_track_delete_serialize_payload(DP_Message *msg,
 {
     DP_MsgTrackDelete *mtd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mtd->id, data + written);
+    written += write_uint16(mtd->id, data + written);
     DP_ASSERT(written == msg_track_delete_payload_length(msg));
     return written;
 }
@@ -10826,8 +10859,7 @@ static size_t msg_track_delete_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgTrackDelete *mtd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(convert_other_id_compat(mtd->id),
-                                         data + written);
+    written += write_uint16(convert_other_id_compat(mtd->id), data + written);
     DP_ASSERT(written == msg_track_delete_payload_length_compat(msg));
     return written;
 }
@@ -11120,11 +11152,11 @@ static size_t msg_key_frame_set_serialize_payload(DP_Message *msg,
 {
     DP_MsgKeyFrameSet *mkfs = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mkfs->track_id, data + written);
-    written += DP_write_bigendian_uint16(mkfs->frame_index, data + written);
-    written += DP_write_bigendian_uint24(mkfs->source_id, data + written);
-    written += DP_write_bigendian_uint16(mkfs->source_index, data + written);
-    written += DP_write_bigendian_uint8(mkfs->source, data + written);
+    written += write_uint16(mkfs->track_id, data + written);
+    written += write_uint16(mkfs->frame_index, data + written);
+    written += write_uint24(mkfs->source_id, data + written);
+    written += write_uint16(mkfs->source_index, data + written);
+    written += write_uint8(mkfs->source, data + written);
     DP_ASSERT(written == msg_key_frame_set_payload_length(msg));
     return written;
 }
@@ -11134,16 +11166,16 @@ static size_t msg_key_frame_set_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgKeyFrameSet *mkfs = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         convert_other_id_compat(mkfs->track_id), data + written);
-    written += DP_write_bigendian_uint16(mkfs->frame_index, data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(mkfs->frame_index, data + written);
+    written += write_uint16(
         mkfs->source == DP_MSG_KEY_FRAME_SET_SOURCE_LAYER
             ? serialize_layer_id_compat(mkfs->source_id)
             : convert_other_id_compat(mkfs->source_id),
         data + written);
-    written += DP_write_bigendian_uint16(mkfs->source_index, data + written);
-    written += DP_write_bigendian_uint8(mkfs->source, data + written);
+    written += write_uint16(mkfs->source_index, data + written);
+    written += write_uint8(mkfs->source, data + written);
     DP_ASSERT(written == msg_key_frame_set_payload_length_compat(msg));
     return written;
 }
@@ -11319,8 +11351,8 @@ static size_t msg_key_frame_retitle_serialize_payload(DP_Message *msg,
 {
     DP_MsgKeyFrameRetitle *mkfr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mkfr->track_id, data + written);
-    written += DP_write_bigendian_uint16(mkfr->frame_index, data + written);
+    written += write_uint16(mkfr->track_id, data + written);
+    written += write_uint16(mkfr->frame_index, data + written);
     written += DP_write_bytes(mkfr->title, 1, mkfr->title_len, data + written);
     DP_ASSERT(written == msg_key_frame_retitle_payload_length(msg));
     return written;
@@ -11332,9 +11364,9 @@ msg_key_frame_retitle_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgKeyFrameRetitle *mkfr = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         convert_other_id_compat(mkfr->track_id), data + written);
-    written += DP_write_bigendian_uint16(mkfr->frame_index, data + written);
+    written += write_uint16(mkfr->frame_index, data + written);
     written += DP_write_bytes(mkfr->title, 1, mkfr->title_len, data + written);
     DP_ASSERT(written == msg_key_frame_retitle_payload_length_compat(msg));
     return written;
@@ -11501,8 +11533,8 @@ msg_key_frame_layer_attributes_serialize_payload(DP_Message *msg,
 {
     DP_MsgKeyFrameLayerAttributes *mkfla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mkfla->track_id, data + written);
-    written += DP_write_bigendian_uint16(mkfla->frame_index, data + written);
+    written += write_uint16(mkfla->track_id, data + written);
+    written += write_uint16(mkfla->frame_index, data + written);
     written += DP_write_bigendian_uint32_array(
         mkfla->layer_flags, mkfla->layer_flags_count, data + written);
     DP_ASSERT(written == msg_key_frame_layer_attributes_payload_length(msg));
@@ -11515,9 +11547,9 @@ msg_key_frame_layer_attributes_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgKeyFrameLayerAttributes *mkfla = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         convert_other_id_compat(mkfla->track_id), data + written);
-    written += DP_write_bigendian_uint16(mkfla->frame_index, data + written);
+    written += write_uint16(mkfla->frame_index, data + written);
     written += write_key_frame_layer_flags_compat(
         mkfla->layer_flags, mkfla->layer_flags_count, data + written);
     DP_ASSERT(written
@@ -11713,11 +11745,10 @@ static size_t msg_key_frame_delete_serialize_payload(DP_Message *msg,
 {
     DP_MsgKeyFrameDelete *mkfd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(mkfd->track_id, data + written);
-    written += DP_write_bigendian_uint16(mkfd->frame_index, data + written);
-    written += DP_write_bigendian_uint16(mkfd->move_track_id, data + written);
-    written +=
-        DP_write_bigendian_uint16(mkfd->move_frame_index, data + written);
+    written += write_uint16(mkfd->track_id, data + written);
+    written += write_uint16(mkfd->frame_index, data + written);
+    written += write_uint16(mkfd->move_track_id, data + written);
+    written += write_uint16(mkfd->move_frame_index, data + written);
     DP_ASSERT(written == msg_key_frame_delete_payload_length(msg));
     return written;
 }
@@ -11727,13 +11758,12 @@ static size_t msg_key_frame_delete_serialize_payload_compat(DP_Message *msg,
 {
     DP_MsgKeyFrameDelete *mkfd = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(
         convert_other_id_compat(mkfd->track_id), data + written);
-    written += DP_write_bigendian_uint16(mkfd->frame_index, data + written);
-    written += DP_write_bigendian_uint16(
+    written += write_uint16(mkfd->frame_index, data + written);
+    written += write_uint16(
         convert_other_id_compat(mkfd->move_track_id), data + written);
-    written +=
-        DP_write_bigendian_uint16(mkfd->move_frame_index, data + written);
+    written += write_uint16(mkfd->move_frame_index, data + written);
     DP_ASSERT(written == msg_key_frame_delete_payload_length_compat(msg));
     return written;
 }
@@ -11913,12 +11943,12 @@ static size_t msg_selection_put_serialize_payload(DP_Message *msg,
 {
     DP_MsgSelectionPut *msp = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msp->selection_id, data + written);
-    written += DP_write_bigendian_uint8(msp->op, data + written);
-    written += DP_write_bigendian_int32(msp->x, data + written);
-    written += DP_write_bigendian_int32(msp->y, data + written);
-    written += DP_write_bigendian_uint32(msp->w, data + written);
-    written += DP_write_bigendian_uint32(msp->h, data + written);
+    written += write_uint8(msp->selection_id, data + written);
+    written += write_uint8(msp->op, data + written);
+    written += write_int32(msp->x, data + written);
+    written += write_int32(msp->y, data + written);
+    written += write_uint32(msp->w, data + written);
+    written += write_uint32(msp->h, data + written);
     written += write_bytes(msp->mask, msp->mask_size, data + written);
     DP_ASSERT(written == msg_selection_put_payload_length(msg));
     return written;
@@ -11955,13 +11985,13 @@ void DP_msg_selection_put_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_SELECTION_PUT_MATCH_LENGTH);
     const DP_MsgSelectionPut *msp = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msp->selection_id, data + written);
-    written += DP_write_bigendian_uint8(msp->op, data + written);
-    written += DP_write_bigendian_int32(msp->x, data + written);
-    written += DP_write_bigendian_int32(msp->y, data + written);
-    written += DP_write_bigendian_uint32(msp->w, data + written);
-    written += DP_write_bigendian_uint32(msp->h, data + written);
-    written += DP_write_bigendian_uint16(msp->mask_size, data + written);
+    written += write_uint8(msp->selection_id, data + written);
+    written += write_uint8(msp->op, data + written);
+    written += write_int32(msp->x, data + written);
+    written += write_int32(msp->y, data + written);
+    written += write_uint32(msp->w, data + written);
+    written += write_uint32(msp->h, data + written);
+    written += write_uint16(msp->mask_size, data + written);
     DP_ASSERT(written == DP_MSG_SELECTION_PUT_MATCH_LENGTH);
 }
 
@@ -12128,7 +12158,7 @@ static size_t msg_selection_clear_serialize_payload(DP_Message *msg,
 {
     DP_MsgSelectionClear *msc = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msc->selection_id, data + written);
+    written += write_uint8(msc->selection_id, data + written);
     DP_ASSERT(written == msg_selection_clear_payload_length(msg));
     return written;
 }
@@ -12154,7 +12184,7 @@ void DP_msg_selection_clear_local_match_set(DP_UNUSED size_t size,
     DP_ASSERT(size == DP_MSG_SELECTION_CLEAR_MATCH_LENGTH);
     const DP_MsgSelectionClear *msc = user;
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msc->selection_id, data + written);
+    written += write_uint8(msc->selection_id, data + written);
     DP_ASSERT(written == DP_MSG_SELECTION_CLEAR_MATCH_LENGTH);
 }
 
@@ -12242,7 +12272,7 @@ static size_t msg_local_match_serialize_payload(DP_Message *msg,
 {
     DP_MsgLocalMatch *mlm = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mlm->type, data + written);
+    written += write_uint8(mlm->type, data + written);
     written += write_bytes(mlm->data, mlm->data_size, data + written);
     DP_ASSERT(written == msg_local_match_payload_length(msg));
     return written;
@@ -12378,10 +12408,10 @@ static size_t msg_sync_selection_tile_serialize_payload(DP_Message *msg,
 {
     DP_MsgSyncSelectionTile *msst = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(msst->user, data + written);
-    written += DP_write_bigendian_uint8(msst->selection_id, data + written);
-    written += DP_write_bigendian_uint16(msst->col, data + written);
-    written += DP_write_bigendian_uint16(msst->row, data + written);
+    written += write_uint8(msst->user, data + written);
+    written += write_uint8(msst->selection_id, data + written);
+    written += write_uint16(msst->col, data + written);
+    written += write_uint16(msst->row, data + written);
     written += write_bytes(msst->mask, msst->mask_size, data + written);
     DP_ASSERT(written == msg_sync_selection_tile_payload_length(msg));
     return written;
@@ -12962,8 +12992,8 @@ static size_t msg_undo_serialize_payload(DP_Message *msg, unsigned char *data)
 {
     DP_MsgUndo *mu = DP_message_internal(msg);
     size_t written = 0;
-    written += DP_write_bigendian_uint8(mu->override_user, data + written);
-    written += DP_write_bigendian_uint8(mu->redo, data + written);
+    written += write_uint8(mu->override_user, data + written);
+    written += write_uint8(mu->redo, data + written);
     DP_ASSERT(written == msg_undo_payload_length(msg));
     return written;
 }
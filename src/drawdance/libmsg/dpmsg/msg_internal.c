@@ -90,6 +90,13 @@ typedef struct DP_MsgInternalReconnectStateApply {
     DP_CanvasHistoryReconnectState *chrs;
 } DP_MsgInternalReconnectStateApply;
 
+typedef struct DP_MsgInternalMemoryReport {
+    DP_MsgInternal parent;
+    DP_MemoryReport *mr;
+    void (*callback)(void *, DP_MemoryReport *);
+    void *user;
+} DP_MsgInternalMemoryReport;
+
 static size_t payload_length(DP_UNUSED DP_Message *msg)
 {
     DP_warn("DP_MsgInternal: payload_length called on internal message");
@@ -303,6 +310,28 @@ DP_msg_internal_reconnect_state_apply_new(unsigned int context_id,
     return msg;
 }
 
+DP_Message *DP_msg_internal_memory_report_new(
+    unsigned int context_id, DP_MemoryReport *mr,
+    void (*callback)(void *, DP_MemoryReport *), void *user)
+{
+    DP_ASSERT(mr);
+    DP_ASSERT(callback);
+    DP_Message *msg =
+        msg_internal_new(context_id, DP_MSG_INTERNAL_TYPE_MEMORY_REPORT,
+                         sizeof(DP_MsgInternalMemoryReport));
+    DP_MsgInternalMemoryReport *mimr = DP_message_internal(msg);
+    mimr->mr = mr;
+    mimr->callback = callback;
+    mimr->user = user;
+    return msg;
+}
+
+DP_Message *DP_msg_internal_trim_memory_new(unsigned int context_id)
+{
+    return msg_internal_new(context_id, DP_MSG_INTERNAL_TYPE_TRIM_MEMORY,
+                            sizeof(DP_MsgInternal));
+}
+
 
 DP_MsgInternal *DP_msg_internal_cast(DP_Message *msg)
 {
@@ -411,3 +440,16 @@ DP_msg_internal_reconnect_state_apply_get(DP_MsgInternal *mi)
         (DP_MsgInternalReconnectStateApply *)mi;
     return mirsa->chrs;
 }
+
+DP_MemoryReport *DP_msg_internal_memory_report_get(DP_MsgInternal *mi)
+{
+    DP_MsgInternalMemoryReport *mimr = (DP_MsgInternalMemoryReport *)mi;
+    return mimr->mr;
+}
+
+void DP_msg_internal_memory_report_call(DP_MsgInternal *mi,
+                                        DP_MemoryReport *mr_or_null)
+{
+    DP_MsgInternalMemoryReport *mimr = (DP_MsgInternalMemoryReport *)mi;
+    mimr->callback(mimr->user, mr_or_null);
+}
@@ -24,6 +24,7 @@
 #include <dpcommon/common.h>
 
 typedef struct DP_CanvasHistoryReconnectState DP_CanvasHistoryReconnectState;
+typedef struct DP_MemoryReport DP_MemoryReport;
 typedef struct DP_Message DP_Message;
 
 typedef enum DP_MsgInternalType {
@@ -43,6 +44,8 @@ typedef enum DP_MsgInternalType {
     DP_MSG_INTERNAL_TYPE_PAINT_SYNC,
     DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_MAKE,
     DP_MSG_INTERNAL_TYPE_RECONNECT_STATE_APPLY,
+    DP_MSG_INTERNAL_TYPE_MEMORY_REPORT,
+    DP_MSG_INTERNAL_TYPE_TRIM_MEMORY,
     DP_MSG_INTERNAL_TYPE_COUNT,
 } DP_MsgInternalType;
 
@@ -95,6 +98,16 @@ DP_Message *
 DP_msg_internal_reconnect_state_apply_new(unsigned int context_id,
                                           DP_CanvasHistoryReconnectState *chrs);
 
+// The paint engine adds the canvas history to the given report and passes it
+// to the callback. If the message is dropped instead, the report is freed and
+// the callback gets NULL.
+DP_Message *DP_msg_internal_memory_report_new(
+    unsigned int context_id, DP_MemoryReport *mr,
+    void (*callback)(void *, DP_MemoryReport *), void *user);
+
+// Makes the paint engine release memory that its paint thread is holding on to.
+DP_Message *DP_msg_internal_trim_memory_new(unsigned int context_id);
+
 DP_MsgInternal *DP_msg_internal_cast(DP_Message *msg);
 
 
@@ -128,5 +141,10 @@ void DP_msg_internal_reconnect_state_make_call(
 DP_CanvasHistoryReconnectState *
 DP_msg_internal_reconnect_state_apply_get(DP_MsgInternal *mi);
 
+DP_MemoryReport *DP_msg_internal_memory_report_get(DP_MsgInternal *mi);
+
+void DP_msg_internal_memory_report_call(DP_MsgInternal *mi,
+                                        DP_MemoryReport *mr_or_null);
+
 
 #endif
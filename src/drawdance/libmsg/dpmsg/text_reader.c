@@ -32,7 +32,7 @@
 #include <parson.h>
 
 
-#define MIN_READ_CAPACITY 4096
+#define MIN_READ_CAPACITY 65536
 
 typedef struct DP_TextReaderField {
     size_t key_offset;
@@ -52,6 +52,7 @@ struct DP_TextReader {
     size_t line_end;
     struct {
         size_t capacity;
+        size_t start;
         size_t used;
         char *buffer;
     } read;
@@ -69,7 +70,8 @@ DP_TextReader *DP_text_reader_new(DP_Input *input)
     }
 
     DP_TextReader *reader = DP_malloc(sizeof(*reader));
-    *reader = (DP_TextReader){input, input_length, 0, 0, 0, {0, 0, NULL}, NULL};
+    *reader = (DP_TextReader){
+        input, input_length, 0, 0, 0, {0, 0, 0, NULL}, NULL};
     return reader;
 }
 
@@ -106,6 +108,7 @@ bool DP_text_reader_seek(DP_TextReader *reader, size_t offset)
     }
     else {
         reader->input_offset = offset;
+        reader->read.start = 0;
         reader->read.used = 0;
         reader->line_end = 0;
         return true;
@@ -125,8 +128,17 @@ static bool buffer_more(DP_TextReader *reader)
     DP_Input *input = reader->input;
     if (input) {
         size_t capacity = reader->read.capacity;
+        size_t start = reader->read.start;
         size_t used = reader->read.used;
         size_t capacity_left = capacity - used;
+        // Consumed lines are only shifted out when we run out of space, doing
+        // it after every line is a whole lot of pointless moving around.
+        if (capacity_left == 0 && start != 0) {
+            used -= start;
+            memmove(reader->read.buffer, reader->read.buffer + start, used);
+            reader->read.start = 0;
+            capacity_left = capacity - used;
+        }
         if (capacity_left == 0) {
             size_t new_capacity = DP_max_size(MIN_READ_CAPACITY, capacity * 2);
             // Allocate an extra byte so we can always append a null terminator.
@@ -141,6 +153,7 @@ static bool buffer_more(DP_TextReader *reader)
                                     capacity_left, &error);
         if (error) {
             DP_input_free(input);
+            reader->read.start = 0;
             reader->read.used = 0;
             return false;
         }
@@ -158,15 +171,15 @@ static bool buffer_line(DP_TextReader *reader, size_t *out_len)
 {
     size_t i = 0;
     while (true) {
-        if (i == reader->read.used) {
+        if (i == reader->read.used - reader->read.start) {
             if (!buffer_more(reader)) {
                 return false;
             }
-            if (i == reader->read.used) {
+            if (i == reader->read.used - reader->read.start) {
                 break;
             }
         }
-        if (reader->read.buffer[i] == '\n') {
+        if (reader->read.buffer[reader->read.start + i] == '\n') {
             ++i;
             break;
         }
@@ -183,14 +196,17 @@ static void regurgitate_line(DP_TextReader *reader)
 
 static void consume_line(DP_TextReader *reader)
 {
-    DP_ASSERT(reader->line_end <= reader->read.used);
+    DP_ASSERT(reader->line_end <= reader->read.used - reader->read.start);
     size_t consume = reader->line_end;
-    size_t new_used = reader->read.used - consume;
+    size_t new_start = reader->read.start + consume;
     reader->input_offset += consume;
     reader->line_end = 0;
-    reader->read.used = new_used;
-    if (new_used != 0) {
-        memmove(reader->read.buffer, reader->read.buffer + consume, new_used);
+    if (new_start == reader->read.used) {
+        reader->read.start = 0;
+        reader->read.used = 0;
+    }
+    else {
+        reader->read.start = new_start;
     }
 }
 
@@ -211,7 +227,7 @@ static bool buffer_relevant_line(DP_TextReader *reader, size_t *out_start,
             return true;
         }
 
-        char *buffer = reader->read.buffer;
+        char *buffer = reader->read.buffer + reader->read.start;
         for (size_t i = 0; i < len; ++i) {
             char c = buffer[i];
             if (c == '#') {
@@ -328,7 +344,7 @@ DP_TextReaderResult DP_text_reader_read_header_field(DP_TextReader *reader,
         return DP_TEXT_READER_ERROR_INPUT;
     }
 
-    char *buffer = reader->read.buffer;
+    char *buffer = reader->read.buffer + reader->read.start;
     char *key, *value;
     if (end == 0 || buffer[start] != '!') {
         regurgitate_line(reader); // This isn't a header line, don't consume it.
@@ -375,7 +391,7 @@ DP_TextReaderResult DP_text_reader_read_message(DP_TextReader *reader,
             return DP_TEXT_READER_INPUT_END;
         }
 
-        char *buffer = reader->read.buffer;
+        char *buffer = reader->read.buffer + reader->read.start;
         size_t context_id_end = skip_non_ws(buffer, start, end);
         buffer[context_id_end] = '\0';
         unsigned int context_id;
@@ -30,14 +30,22 @@
 #include <parson.h>
 
 #define DECIMAL_BUFFER_SIZE 1024
+#define OUTPUT_BUFFER_SIZE  65536
 
+#define PRINT_LITERAL(WRITER, LITERAL) \
+    write_raw((WRITER), "" LITERAL, strlen(LITERAL))
 
+
+// Text recordings consist of a huge number of tiny writes, so they're collected
+// in a large buffer here instead of each one going through the output.
 struct DP_TextWriter {
     DP_Output *output;
     bool payload_open;
     bool first_subobject;
     bool first_subfield;
+    size_t used;
     char decimal_buffer[DECIMAL_BUFFER_SIZE];
+    char buffer[OUTPUT_BUFFER_SIZE];
 };
 
 DP_TextWriter *DP_text_writer_new(DP_Output *output)
@@ -48,50 +56,161 @@ DP_TextWriter *DP_text_writer_new(DP_Output *output)
     writer->payload_open = false;
     writer->first_subobject = false;
     writer->first_subfield = false;
+    writer->used = 0;
     return writer;
 }
 
+static bool flush_buffer(DP_TextWriter *writer)
+{
+    size_t used = writer->used;
+    if (used == 0) {
+        return true;
+    }
+    else {
+        writer->used = 0;
+        return DP_output_write(writer->output, writer->buffer, used);
+    }
+}
+
 void DP_text_writer_free(DP_TextWriter *writer)
 {
     if (writer) {
+        if (!flush_buffer(writer)) {
+            DP_warn("Error flushing text writer: %s", DP_error());
+        }
         DP_output_free(writer->output);
         DP_free(writer);
     }
 }
 
 
-static bool print_header_field_prefix(DP_Output *output, const char *key)
+static bool write_raw(DP_TextWriter *writer, const char *value, size_t len)
+{
+    if (OUTPUT_BUFFER_SIZE - writer->used < len) {
+        if (!flush_buffer(writer)) {
+            return false;
+        }
+        else if (len > OUTPUT_BUFFER_SIZE) {
+            return DP_output_write(writer->output, value, len);
+        }
+    }
+    memcpy(writer->buffer + writer->used, value, len);
+    writer->used += len;
+    return true;
+}
+
+static bool write_cstr(DP_TextWriter *writer, const char *value)
+{
+    return write_raw(writer, value, strlen(value));
+}
+
+static bool vformat(DP_TextWriter *writer, const char *fmt, va_list ap)
+{
+    size_t capacity_left = OUTPUT_BUFFER_SIZE - writer->used;
+    va_list aq;
+    va_copy(aq, ap);
+    int len = vsnprintf(writer->buffer + writer->used, capacity_left, fmt, aq);
+    va_end(aq);
+
+    if (len < 0) {
+        DP_error_set("Format encoding error");
+        return false;
+    }
+
+    // The null terminator has to fit too, even though it's not kept around.
+    size_t slen = DP_int_to_size(len);
+    if (slen < capacity_left) {
+        writer->used += slen;
+        return true;
+    }
+    else if (!flush_buffer(writer)) {
+        return false;
+    }
+    else if (slen < OUTPUT_BUFFER_SIZE) {
+        vsnprintf(writer->buffer, OUTPUT_BUFFER_SIZE, fmt, ap);
+        writer->used = slen;
+        return true;
+    }
+    else {
+        return DP_output_vformat(writer->output, fmt, ap);
+    }
+}
+
+static bool format(DP_TextWriter *writer, const char *fmt, ...)
+    DP_FORMAT(2, 3);
+
+static bool format(DP_TextWriter *writer, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    bool ok = vformat(writer, fmt, ap);
+    va_end(ap);
+    return ok;
+}
+
+// Hand-rolled integer formatting, since going through printf for every single
+// number in a recording is a significant amount of overhead.
+static bool write_uint(DP_TextWriter *writer, unsigned int value)
+{
+    char digits[16];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = (char)('0' + value % 10u);
+        value /= 10u;
+    } while (value != 0u);
+    return write_raw(writer, digits + i, sizeof(digits) - i);
+}
+
+static bool write_int(DP_TextWriter *writer, int value)
+{
+    if (value < 0) {
+        return PRINT_LITERAL(writer, "-")
+            && write_uint(writer, 0u - (unsigned int)value);
+    }
+    else {
+        return write_uint(writer, (unsigned int)value);
+    }
+}
+
+static bool write_key(DP_TextWriter *writer, const char *key)
+{
+    return PRINT_LITERAL(writer, "\"") && write_cstr(writer, key)
+        && PRINT_LITERAL(writer, "\":");
+}
+
+
+static bool print_header_field_prefix(DP_TextWriter *writer, const char *key)
 {
-    return DP_output_write(output, "!", 1) && DP_output_print(output, key)
-        && DP_output_write(output, "=", 1);
+    return PRINT_LITERAL(writer, "!") && write_cstr(writer, key)
+        && PRINT_LITERAL(writer, "=");
 }
 
-static bool print_header_field_suffix(DP_Output *output)
+static bool print_header_field_suffix(DP_TextWriter *writer)
 {
-    return DP_output_write(output, "\n", 1);
+    return PRINT_LITERAL(writer, "\n");
 }
 
-static bool print_header_field(DP_Output *output, const char *key,
+static bool print_header_field(DP_TextWriter *writer, const char *key,
                                const char *value)
 {
-    return print_header_field_prefix(output, key)
-        && DP_output_print(output, value) && print_header_field_suffix(output);
+    return print_header_field_prefix(writer, key) && write_cstr(writer, value)
+        && print_header_field_suffix(writer);
 }
 
-static bool write_header_field(DP_Output *output, const char *key,
+static bool write_header_field(DP_TextWriter *writer, const char *key,
                                JSON_Value *value)
 {
     switch (json_type(value)) {
     case JSONNull:
-        return print_header_field(output, key, "null");
+        return print_header_field(writer, key, "null");
     case JSONString:
-        return print_header_field(output, key, json_string(value));
+        return print_header_field(writer, key, json_string(value));
     case JSONNumber:
-        return print_header_field_prefix(output, key)
-            && DP_output_format(output, "%f", json_number(value))
-            && print_header_field_suffix(output);
+        return print_header_field_prefix(writer, key)
+            && format(writer, "%f", json_number(value))
+            && print_header_field_suffix(writer);
     case JSONBoolean:
-        return print_header_field(output, key,
+        return print_header_field(writer, key,
                                   json_boolean(value) ? "true" : "false");
     default:
         DP_error_set("Header field '%s' cannot be represented as text", key);
@@ -104,12 +223,11 @@ bool DP_text_writer_write_header(DP_TextWriter *writer, JSON_Object *header)
     DP_ASSERT(writer);
     DP_ASSERT(header);
 
-    DP_Output *output = writer->output;
     size_t count = json_object_get_count(header);
     for (size_t i = 0; i < count; ++i) {
         const char *key = json_object_get_name(header, i);
         JSON_Value *value = json_object_get_value_at(header, i);
-        if (!write_header_field(output, key, value)) {
+        if (!write_header_field(writer, key, value)) {
             return false;
         }
     }
@@ -123,18 +241,19 @@ bool DP_text_writer_start_message(DP_TextWriter *writer, DP_Message *msg)
     DP_ASSERT(msg);
     writer->payload_open = false;
     writer->first_subobject = false;
-    return DP_output_format(writer->output, "%d %s", DP_message_context_id(msg),
-                            DP_message_name(msg));
+    return write_uint(writer, DP_message_context_id(msg))
+        && PRINT_LITERAL(writer, " ")
+        && write_cstr(writer, DP_message_name(msg));
 }
 
 bool DP_text_writer_finish_message(DP_TextWriter *writer)
 {
     DP_ASSERT(writer);
     if (writer->payload_open) {
-        return DP_OUTPUT_PRINT_LITERAL(writer->output, "}\n");
+        return PRINT_LITERAL(writer, "}\n");
     }
     else {
-        return DP_OUTPUT_PRINT_LITERAL(writer->output, "\n");
+        return PRINT_LITERAL(writer, "\n");
     }
 }
 
@@ -142,11 +261,11 @@ bool DP_text_writer_finish_message(DP_TextWriter *writer)
 static bool open_payload(DP_TextWriter *writer)
 {
     if (writer->payload_open) {
-        return DP_OUTPUT_PRINT_LITERAL(writer->output, ",");
+        return PRINT_LITERAL(writer, ",");
     }
     else {
         writer->payload_open = true;
-        return DP_OUTPUT_PRINT_LITERAL(writer->output, " {");
+        return PRINT_LITERAL(writer, " {");
     }
 }
 
@@ -158,7 +277,7 @@ static bool format_argument(DP_TextWriter *writer, const char *fmt, ...)
     if (open_payload(writer)) {
         va_list ap;
         va_start(ap, fmt);
-        bool ok = DP_output_vformat(writer->output, fmt, ap);
+        bool ok = vformat(writer, fmt, ap);
         va_end(ap);
         return ok;
     }
@@ -167,20 +286,27 @@ static bool format_argument(DP_TextWriter *writer, const char *fmt, ...)
     }
 }
 
+static bool open_argument(DP_TextWriter *writer, const char *key)
+{
+    return open_payload(writer) && write_key(writer, key);
+}
+
 
 bool DP_text_writer_write_bool(DP_TextWriter *writer, const char *key,
                                bool value)
 {
     DP_ASSERT(writer);
     DP_ASSERT(key);
-    return format_argument(writer, "\"%s\":%s", key, value ? "true" : "false");
+    return open_argument(writer, key)
+        && (value ? PRINT_LITERAL(writer, "true")
+                  : PRINT_LITERAL(writer, "false"));
 }
 
 bool DP_text_writer_write_int(DP_TextWriter *writer, const char *key, int value)
 {
     DP_ASSERT(writer);
     DP_ASSERT(key);
-    return format_argument(writer, "\"%s\":%d", key, value);
+    return open_argument(writer, key) && write_int(writer, value);
 }
 
 bool DP_text_writer_write_uint(DP_TextWriter *writer, const char *key,
@@ -188,7 +314,7 @@ bool DP_text_writer_write_uint(DP_TextWriter *writer, const char *key,
 {
     DP_ASSERT(writer);
     DP_ASSERT(key);
-    return format_argument(writer, "\"%s\":%u", key, value);
+    return open_argument(writer, key) && write_uint(writer, value);
 }
 
 static const char *format_decimal(DP_TextWriter *writer, double value)
@@ -216,123 +342,123 @@ bool DP_text_writer_write_decimal(DP_TextWriter *writer, const char *key,
 {
     DP_ASSERT(writer);
     DP_ASSERT(key);
-    return format_argument(writer, "\"%s\":%s", key,
-                           format_decimal(writer, value));
+    return open_argument(writer, key)
+        && write_cstr(writer, format_decimal(writer, value));
 }
 
-static bool write_string(DP_Output *output, const char *value, size_t len)
+static bool write_string(DP_TextWriter *writer, const char *value, size_t len)
 {
-    bool ok = DP_OUTPUT_PRINT_LITERAL(output, "\"");
+    bool ok = PRINT_LITERAL(writer, "\"");
     for (size_t i = 0; ok && i < len; ++i) {
         switch (value[i]) {
         case '\"':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\\"");
+            ok = PRINT_LITERAL(writer, "\\\"");
             break;
         case '\\':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\\\");
+            ok = PRINT_LITERAL(writer, "\\\\");
             break;
         case '\b':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\b");
+            ok = PRINT_LITERAL(writer, "\\b");
             break;
         case '\f':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\f");
+            ok = PRINT_LITERAL(writer, "\\f");
             break;
         case '\n':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\n");
+            ok = PRINT_LITERAL(writer, "\\n");
             break;
         case '\r':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\r");
+            ok = PRINT_LITERAL(writer, "\\r");
             break;
         case '\t':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\t");
+            ok = PRINT_LITERAL(writer, "\\t");
             break;
         case '\x00':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0000");
+            ok = PRINT_LITERAL(writer, "\\u0000");
             break;
         case '\x01':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0001");
+            ok = PRINT_LITERAL(writer, "\\u0001");
             break;
         case '\x02':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0002");
+            ok = PRINT_LITERAL(writer, "\\u0002");
             break;
         case '\x03':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0003");
+            ok = PRINT_LITERAL(writer, "\\u0003");
             break;
         case '\x04':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0004");
+            ok = PRINT_LITERAL(writer, "\\u0004");
             break;
         case '\x05':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0005");
+            ok = PRINT_LITERAL(writer, "\\u0005");
             break;
         case '\x06':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0006");
+            ok = PRINT_LITERAL(writer, "\\u0006");
             break;
         case '\x07':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0007");
+            ok = PRINT_LITERAL(writer, "\\u0007");
             break;
         case '\x0b':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u000b");
+            ok = PRINT_LITERAL(writer, "\\u000b");
             break;
         case '\x0e':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u000e");
+            ok = PRINT_LITERAL(writer, "\\u000e");
             break;
         case '\x0f':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u000f");
+            ok = PRINT_LITERAL(writer, "\\u000f");
             break;
         case '\x10':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0010");
+            ok = PRINT_LITERAL(writer, "\\u0010");
             break;
         case '\x11':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0011");
+            ok = PRINT_LITERAL(writer, "\\u0011");
             break;
         case '\x12':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0012");
+            ok = PRINT_LITERAL(writer, "\\u0012");
             break;
         case '\x13':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0013");
+            ok = PRINT_LITERAL(writer, "\\u0013");
             break;
         case '\x14':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0014");
+            ok = PRINT_LITERAL(writer, "\\u0014");
             break;
         case '\x15':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0015");
+            ok = PRINT_LITERAL(writer, "\\u0015");
             break;
         case '\x16':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0016");
+            ok = PRINT_LITERAL(writer, "\\u0016");
             break;
         case '\x17':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0017");
+            ok = PRINT_LITERAL(writer, "\\u0017");
             break;
         case '\x18':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0018");
+            ok = PRINT_LITERAL(writer, "\\u0018");
             break;
         case '\x19':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u0019");
+            ok = PRINT_LITERAL(writer, "\\u0019");
             break;
         case '\x1a':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001a");
+            ok = PRINT_LITERAL(writer, "\\u001a");
             break;
         case '\x1b':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001b");
+            ok = PRINT_LITERAL(writer, "\\u001b");
             break;
         case '\x1c':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001c");
+            ok = PRINT_LITERAL(writer, "\\u001c");
             break;
         case '\x1d':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001d");
+            ok = PRINT_LITERAL(writer, "\\u001d");
             break;
         case '\x1e':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001e");
+            ok = PRINT_LITERAL(writer, "\\u001e");
             break;
         case '\x1f':
-            ok = DP_OUTPUT_PRINT_LITERAL(output, "\\u001f");
+            ok = PRINT_LITERAL(writer, "\\u001f");
             break;
         default:
-            ok = DP_output_write(output, value + i, 1);
+            ok = write_raw(writer, value + i, 1);
             break;
         }
     }
-    return ok && DP_OUTPUT_PRINT_LITERAL(output, "\"");
+    return ok && PRINT_LITERAL(writer, "\"");
 }
 
 bool DP_text_writer_write_string(DP_TextWriter *writer, const char *key,
@@ -343,11 +469,10 @@ bool DP_text_writer_write_string(DP_TextWriter *writer, const char *key,
     DP_ASSERT(value);
     size_t len = strlen(value);
     if (len == 0) {
-        return format_argument(writer, "\"%s\":\"\"", key);
+        return open_argument(writer, key) && PRINT_LITERAL(writer, "\"\"");
     }
     else {
-        return format_argument(writer, "\"%s\":", key)
-            && write_string(writer->output, value, len);
+        return open_argument(writer, key) && write_string(writer, value, len);
     }
 }
 
@@ -388,8 +513,12 @@ bool DP_text_writer_write_base64(DP_TextWriter *writer, const char *key,
     }
     else {
         DP_ASSERT(value);
-        char *base64 = DP_base64_encode(value, DP_int_to_size(length), NULL);
-        bool ok = format_argument(writer, "\"%s\":\"%s\"", key, base64);
+        size_t base64_length;
+        char *base64 =
+            DP_base64_encode(value, DP_int_to_size(length), &base64_length);
+        bool ok = open_argument(writer, key) && PRINT_LITERAL(writer, "\"")
+               && write_raw(writer, base64, base64_length)
+               && PRINT_LITERAL(writer, "\"");
         DP_free(base64);
         return ok;
     }
@@ -405,7 +534,6 @@ bool DP_text_writer_write_flags(DP_TextWriter *writer, const char *key,
     DP_ASSERT(names);
     DP_ASSERT(values);
     bool first = true;
-    DP_Output *output = writer->output;
     for (int i = 0; i < count; ++i) {
         if (value & values[i]) {
             const char *name = names[i];
@@ -415,33 +543,34 @@ bool DP_text_writer_write_flags(DP_TextWriter *writer, const char *key,
                     return false;
                 }
             }
-            else if (!DP_output_format(output, ",\"%s\"", name)) {
+            else if (!format(writer, ",\"%s\"", name)) {
                 return false;
             }
         }
     }
-    return first ? true : DP_OUTPUT_PRINT_LITERAL(output, "]");
-}
-
-
-#define WRITE_LIST(WRITER, KEY, VALUE, COUNT, TYPE, FMT)         \
-    do {                                                         \
-        if (COUNT == 0) {                                        \
-            return true;                                         \
-        }                                                        \
-        else {                                                   \
-            if (!format_argument(WRITER, "\"%s\":[" FMT, KEY,    \
-                                 (TYPE)VALUE[0])) {              \
-                return false;                                    \
-            }                                                    \
-            for (int _i = 1; _i < COUNT; ++_i) {                 \
-                if (!DP_output_format(writer->output, "," FMT,   \
-                                      (TYPE)VALUE[_i])) {        \
-                    return false;                                \
-                }                                                \
-            }                                                    \
-            return DP_OUTPUT_PRINT_LITERAL(writer->output, "]"); \
-        }                                                        \
+    return first ? true : PRINT_LITERAL(writer, "]");
+}
+
+
+#define WRITE_LIST(WRITER, KEY, VALUE, COUNT, TYPE, WRITE_FN) \
+    do {                                                      \
+        if (COUNT == 0) {                                     \
+            return true;                                      \
+        }                                                     \
+        else {                                                \
+            if (!open_argument(WRITER, KEY)                   \
+                || !PRINT_LITERAL(WRITER, "[")                \
+                || !WRITE_FN(WRITER, (TYPE)VALUE[0])) {       \
+                return false;                                 \
+            }                                                 \
+            for (int _i = 1; _i < COUNT; ++_i) {              \
+                if (!PRINT_LITERAL(WRITER, ",")               \
+                    || !WRITE_FN(WRITER, (TYPE)VALUE[_i])) {  \
+                    return false;                             \
+                }                                             \
+            }                                                 \
+            return PRINT_LITERAL(WRITER, "]");                \
+        }                                                     \
     } while (0)
 
 bool DP_text_writer_write_uint8_list(DP_TextWriter *writer, const char *key,
@@ -451,7 +580,7 @@ bool DP_text_writer_write_uint8_list(DP_TextWriter *writer, const char *key,
     DP_ASSERT(key);
     DP_ASSERT(count >= 0);
     DP_ASSERT(value || count == 0);
-    WRITE_LIST(writer, key, value, count, unsigned int, "%u");
+    WRITE_LIST(writer, key, value, count, unsigned int, write_uint);
 }
 
 bool DP_text_writer_write_uint16_list(DP_TextWriter *writer, const char *key,
@@ -461,7 +590,7 @@ bool DP_text_writer_write_uint16_list(DP_TextWriter *writer, const char *key,
     DP_ASSERT(key);
     DP_ASSERT(count >= 0);
     DP_ASSERT(value || count == 0);
-    WRITE_LIST(writer, key, value, count, unsigned int, "%u");
+    WRITE_LIST(writer, key, value, count, unsigned int, write_uint);
 }
 
 bool DP_text_writer_write_uint24_list(DP_TextWriter *writer, const char *key,
@@ -471,7 +600,7 @@ bool DP_text_writer_write_uint24_list(DP_TextWriter *writer, const char *key,
     DP_ASSERT(key);
     DP_ASSERT(count >= 0);
     DP_ASSERT(value || count == 0);
-    WRITE_LIST(writer, key, value, count, unsigned int, "%u");
+    WRITE_LIST(writer, key, value, count, unsigned int, write_uint);
 }
 
 bool DP_text_writer_write_uint32_list(DP_TextWriter *writer, const char *key,
@@ -481,7 +610,7 @@ bool DP_text_writer_write_uint32_list(DP_TextWriter *writer, const char *key,
     DP_ASSERT(key);
     DP_ASSERT(count >= 0);
     DP_ASSERT(value || count == 0);
-    WRITE_LIST(writer, key, value, count, unsigned int, "%u");
+    WRITE_LIST(writer, key, value, count, unsigned int, write_uint);
 }
 
 bool DP_text_writer_write_int32_list(DP_TextWriter *writer, const char *key,
@@ -491,20 +620,20 @@ bool DP_text_writer_write_int32_list(DP_TextWriter *writer, const char *key,
     DP_ASSERT(key);
     DP_ASSERT(count >= 0);
     DP_ASSERT(value || count == 0);
-    WRITE_LIST(writer, key, value, count, int, "%d");
+    WRITE_LIST(writer, key, value, count, int, write_int);
 }
 
 bool DP_text_writer_start_subs(DP_TextWriter *writer)
 {
     DP_ASSERT(writer);
     writer->first_subobject = true;
-    return format_argument(writer, "\"_\":[");
+    return open_payload(writer) && PRINT_LITERAL(writer, "\"_\":[");
 }
 
 bool DP_text_writer_finish_subs(DP_TextWriter *writer)
 {
     DP_ASSERT(writer);
-    return DP_OUTPUT_PRINT_LITERAL(writer->output, "]");
+    return PRINT_LITERAL(writer, "]");
 }
 
 bool DP_text_writer_start_subobject(DP_TextWriter *writer)
@@ -512,14 +641,14 @@ bool DP_text_writer_start_subobject(DP_TextWriter *writer)
     DP_ASSERT(writer);
     writer->first_subfield = true;
     return writer->first_subobject
-             ? DP_OUTPUT_PRINT_LITERAL(writer->output, "{")
-             : DP_OUTPUT_PRINT_LITERAL(writer->output, ",{");
+             ? PRINT_LITERAL(writer, "{")
+             : PRINT_LITERAL(writer, ",{");
 }
 
 bool DP_text_writer_finish_subobject(DP_TextWriter *writer)
 {
     writer->first_subobject = false;
-    return DP_OUTPUT_PRINT_LITERAL(writer->output, "}");
+    return PRINT_LITERAL(writer, "}");
 }
 
 static bool format_subfield(DP_TextWriter *writer, const char *fmt, ...)
@@ -530,36 +659,47 @@ static bool format_subfield(DP_TextWriter *writer, const char *fmt, ...)
     if (writer->first_subfield) {
         writer->first_subfield = false;
     }
-    else if (!DP_OUTPUT_PRINT_LITERAL(writer->output, ",")) {
+    else if (!PRINT_LITERAL(writer, ",")) {
         return false;
     }
     va_list ap;
     va_start(ap, fmt);
-    bool ok = DP_output_vformat(writer->output, fmt, ap);
+    bool ok = vformat(writer, fmt, ap);
     va_end(ap);
     return ok;
 }
 
+static bool open_subfield(DP_TextWriter *writer, const char *key)
+{
+    if (writer->first_subfield) {
+        writer->first_subfield = false;
+    }
+    else if (!PRINT_LITERAL(writer, ",")) {
+        return false;
+    }
+    return write_key(writer, key);
+}
+
 bool DP_text_writer_write_subfield_int(DP_TextWriter *writer, const char *key,
                                        int value)
 {
     DP_ASSERT(writer);
-    return format_subfield(writer, "\"%s\":%d", key, value);
+    return open_subfield(writer, key) && write_int(writer, value);
 }
 
 bool DP_text_writer_write_subfield_uint(DP_TextWriter *writer, const char *key,
                                         unsigned int value)
 {
     DP_ASSERT(writer);
-    return format_subfield(writer, "\"%s\":%u", key, value);
+    return open_subfield(writer, key) && write_uint(writer, value);
 }
 
 bool DP_text_writer_write_subfield_decimal(DP_TextWriter *writer,
                                            const char *key, double value)
 {
     DP_ASSERT(writer);
-    return format_subfield(writer, "\"%s\":%s", key,
-                           format_decimal(writer, value));
+    return open_subfield(writer, key)
+        && write_cstr(writer, format_decimal(writer, value));
 }
 
 bool DP_text_writer_write_subfield_rgb_color(DP_TextWriter *writer,
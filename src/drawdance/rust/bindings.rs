@@ -42,6 +42,7 @@ pub const DP_CANVAS_HISTORY_UNDO_DEPTH_MIN: u32 = 3;
 pub const DP_CANVAS_HISTORY_UNDO_DEPTH_MAX: u32 = 255;
 pub const DP_PREVIEW_BASE_SUBLAYER_ID: i32 = -100;
 pub const DP_PREVIEW_TRANSFORM_COUNT: u32 = 16;
+pub const DP_RENDERER_LOD_MAX: u32 = 6;
 pub const DP_PAINT_ENGINE_FILTER_MESSAGE_FLAG_NO_TIME: u32 = 1;
 pub const DP_LOAD_FLAG_NONE: u32 = 0;
 pub const DP_LOAD_FLAG_SINGLE_THREAD: u32 = 1;
@@ -860,12 +861,24 @@ extern "C" {
 extern "C" {
     pub fn DP_input_qiodevice(input: *mut DP_Input) -> *mut QIODevice;
 }
+extern "C" {
+    pub fn DP_input_borrow(
+        input: *mut DP_Input,
+        size: usize,
+        out_size: *mut usize,
+    ) -> *const ::std::os::raw::c_void;
+}
 extern "C" {
     pub fn DP_file_input_new_from_stdin(close: bool) -> *mut DP_Input;
 }
 extern "C" {
     pub fn DP_file_input_new_from_path(path: *const ::std::os::raw::c_char) -> *mut DP_Input;
 }
+extern "C" {
+    pub fn DP_file_input_new_mapped_from_path(
+        path: *const ::std::os::raw::c_char,
+    ) -> *mut DP_Input;
+}
 pub type DP_MemInputFreeFn = ::std::option::Option<
     unsafe extern "C" fn(
         buffer: *mut ::std::os::raw::c_void,
@@ -1351,6 +1364,13 @@ extern "C" {
         ap: *mut __va_list_tag,
     ) -> ::std::os::raw::c_int;
 }
+extern "C" {
+    pub fn DP_perf_begin_detail(
+        realm: *const ::std::os::raw::c_char,
+        categories: *const ::std::os::raw::c_char,
+        detail_or_null: *const ::std::os::raw::c_char,
+    ) -> ::std::os::raw::c_int;
+}
 extern "C" {
     pub fn DP_perf_end_internal(output: *mut DP_Output, handle: ::std::os::raw::c_int);
 }
@@ -2191,6 +2211,13 @@ extern "C" {
         frame_index_b: ::std::os::raw::c_int,
     ) -> bool;
 }
+extern "C" {
+    pub fn DP_canvas_state_same_frame_content(
+        cs: *mut DP_CanvasState,
+        prev: *mut DP_CanvasState,
+        frame_index: ::std::os::raw::c_int,
+    ) -> bool;
+}
 extern "C" {
     pub fn DP_canvas_state_handle(
         cs: *mut DP_CanvasState,
@@ -2249,6 +2276,15 @@ extern "C" {
         y: ::std::os::raw::c_int,
     ) -> DP_Pixel15;
 }
+extern "C" {
+    pub fn DP_canvas_state_flatten_tile_sampled_to(
+        cs: *mut DP_CanvasState,
+        tile_index: ::std::os::raw::c_int,
+        tt: *mut DP_TransientTile,
+        step: ::std::os::raw::c_int,
+        selection_tint: *mut DP_UPixel15,
+    );
+}
 extern "C" {
     pub fn DP_canvas_state_to_flat_separated_urgba8(
         cs: *mut DP_CanvasState,
@@ -2268,6 +2304,32 @@ extern "C" {
         vmf: *const DP_ViewModeFilter,
     ) -> *mut DP_TransientTile;
 }
+extern "C" {
+    pub fn DP_canvas_state_flatten_tile_range_to(
+        cs: *mut DP_CanvasState,
+        tile_index: ::std::os::raw::c_int,
+        tt_or_null: *mut DP_TransientTile,
+        include_sublayers: bool,
+        start: ::std::os::raw::c_int,
+        end: ::std::os::raw::c_int,
+    ) -> *mut DP_TransientTile;
+}
+extern "C" {
+    pub fn DP_canvas_state_flatten_selection_tile_to(
+        cs: *mut DP_CanvasState,
+        tile_index: ::std::os::raw::c_int,
+        tt_or_null: *mut DP_TransientTile,
+        include_sublayers: bool,
+        selection_tint: *mut DP_UPixel15,
+    ) -> *mut DP_TransientTile;
+}
+extern "C" {
+    pub fn DP_canvas_state_flatten_split_index(
+        cs: *mut DP_CanvasState,
+        layer_id: ::std::os::raw::c_int,
+        out_above_mergeable: *mut bool,
+    ) -> ::std::os::raw::c_int;
+}
 extern "C" {
     pub fn DP_canvas_state_flatten_tile(
         cs: *mut DP_CanvasState,
@@ -3956,6 +4018,17 @@ extern "C" {
         only_layer_id: ::std::os::raw::c_int,
     );
 }
+extern "C" {
+    pub fn DP_layer_list_diff_range(
+        ll: *mut DP_LayerList,
+        lpl: *mut DP_LayerPropsList,
+        prev_ll: *mut DP_LayerList,
+        prev_lpl: *mut DP_LayerPropsList,
+        diff: *mut DP_CanvasDiff,
+        start: ::std::os::raw::c_int,
+        end: ::std::os::raw::c_int,
+    );
+}
 extern "C" {
     pub fn DP_layer_list_diff_mark(ll: *mut DP_LayerList, diff: *mut DP_CanvasDiff);
 }
@@ -5119,12 +5192,26 @@ extern "C" {
         output: *mut DP_Output,
     ) -> *mut DP_Recorder;
 }
+extern "C" {
+    pub fn DP_recorder_new_keyframes_inc(
+        type_: DP_RecorderType,
+        header: *mut JSON_Value,
+        cs_or_null: *mut DP_CanvasState,
+        keyframe_interval: ::std::os::raw::c_int,
+        get_time_fn: DP_RecorderGetTimeMsFn,
+        get_time_user: *mut ::std::os::raw::c_void,
+        output: *mut DP_Output,
+    ) -> *mut DP_Recorder;
+}
 extern "C" {
     pub fn DP_recorder_free_join(r: *mut DP_Recorder, out_error: *mut *mut ::std::os::raw::c_char);
 }
 extern "C" {
     pub fn DP_recorder_type(r: *mut DP_Recorder) -> DP_RecorderType;
 }
+extern "C" {
+    pub fn DP_recorder_keyframe_interval(r: *mut DP_Recorder) -> ::std::os::raw::c_int;
+}
 extern "C" {
     pub fn DP_recorder_header(r: *mut DP_Recorder) -> *mut JSON_Value;
 }
@@ -5865,6 +5952,7 @@ extern "C" {
     pub fn DP_canvas_history_recorder_new(
         ch: *mut DP_CanvasHistory,
         type_: DP_RecorderType,
+        keyframe_interval: ::std::os::raw::c_int,
         header: *mut JSON_Value,
         get_time_fn: DP_RecorderGetTimeMsFn,
         get_time_user: *mut ::std::os::raw::c_void,
@@ -5971,10 +6059,16 @@ pub struct DP_ViewModeTrack {
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
+pub struct DP_OnionSkinCache {
+    _unused: [u8; 0],
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
 pub struct DP_ViewModeBuffer {
     pub capacity: ::std::os::raw::c_int,
     pub count: ::std::os::raw::c_int,
     pub tracks: *mut DP_ViewModeTrack,
+    pub onion_skin_cache: *mut DP_OnionSkinCache,
 }
 #[test]
 fn bindgen_test_layout_DP_ViewModeBuffer() {
@@ -5982,7 +6076,7 @@ fn bindgen_test_layout_DP_ViewModeBuffer() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::std::mem::size_of::<DP_ViewModeBuffer>(),
-        16usize,
+        24usize,
         concat!("Size of: ", stringify!(DP_ViewModeBuffer))
     );
     assert_eq!(
@@ -6020,6 +6114,16 @@ fn bindgen_test_layout_DP_ViewModeBuffer() {
             stringify!(tracks)
         )
     );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).onion_skin_cache) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_ViewModeBuffer),
+            "::",
+            stringify!(onion_skin_cache)
+        )
+    );
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -6559,6 +6663,9 @@ extern "C" {
 extern "C" {
     pub fn DP_view_mode_context_excludes_everything(vmc: *const DP_ViewModeContext) -> bool;
 }
+extern "C" {
+    pub fn DP_view_mode_context_normal(vmc: *const DP_ViewModeContext) -> bool;
+}
 extern "C" {
     pub fn DP_view_mode_context_root_at(
         vmcr: *const DP_ViewModeContextRoot,
@@ -6670,6 +6777,44 @@ extern "C" {
         tint: DP_UPixel8,
     );
 }
+extern "C" {
+    pub fn DP_onion_skin_cache_new() -> *mut DP_OnionSkinCache;
+}
+extern "C" {
+    pub fn DP_onion_skin_cache_free(osc_or_null: *mut DP_OnionSkinCache);
+}
+extern "C" {
+    pub fn DP_onion_skin_cache_clear(osc: *mut DP_OnionSkinCache);
+}
+extern "C" {
+    pub fn DP_view_mode_context_onion_skin_cache(
+        vmc: *const DP_ViewModeContext,
+    ) -> *mut DP_OnionSkinCache;
+}
+extern "C" {
+    pub fn DP_onion_skin_cache_search(
+        osc: *mut DP_OnionSkinCache,
+        vmc: *const DP_ViewModeContext,
+        lle: *mut DP_LayerListEntry,
+        lp: *mut DP_LayerProps,
+        tile_index: ::std::os::raw::c_int,
+        opacity: u16,
+        include_sublayers: bool,
+        out_tile_or_null: *mut *mut DP_Tile,
+    ) -> bool;
+}
+extern "C" {
+    pub fn DP_onion_skin_cache_insert(
+        osc: *mut DP_OnionSkinCache,
+        vmc: *const DP_ViewModeContext,
+        lle: *mut DP_LayerListEntry,
+        lp: *mut DP_LayerProps,
+        tile_index: ::std::os::raw::c_int,
+        opacity: u16,
+        include_sublayers: bool,
+        tile_or_null: *mut DP_Tile,
+    );
+}
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct DP_MsgLocalChange {
@@ -6990,6 +7135,17 @@ pub const DP_PLAYER_PASS_CLIENT_PLAYBACK: DP_PlayerPass = 0;
 pub const DP_PLAYER_PASS_FEATURE_ACCESS: DP_PlayerPass = 1;
 pub const DP_PLAYER_PASS_ALL: DP_PlayerPass = 2;
 pub type DP_PlayerPass = ::std::os::raw::c_uint;
+pub const DP_PLAYER_REPLAY_STEP_NONE: DP_PlayerReplayStep = 0;
+pub const DP_PLAYER_REPLAY_STEP_MESSAGES: DP_PlayerReplayStep = 1;
+pub const DP_PLAYER_REPLAY_STEP_UNDO_POINTS: DP_PlayerReplayStep = 2;
+pub type DP_PlayerReplayStep = ::std::os::raw::c_uint;
+pub type DP_PlayerReplayOutputFn = ::std::option::Option<
+    unsafe extern "C" fn(
+        user: *mut ::std::os::raw::c_void,
+        cs: *mut DP_CanvasState,
+        last: bool,
+    ) -> bool,
+>;
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct DP_PlayerIndexEntry {
@@ -7206,18 +7362,34 @@ extern "C" {
         position: ::std::os::raw::c_longlong,
     ) -> bool;
 }
+extern "C" {
+    pub fn DP_player_replay(
+        player: *mut DP_Player,
+        dc: *mut DP_DrawContext,
+        step: DP_PlayerReplayStep,
+        steps: ::std::os::raw::c_longlong,
+        output_fn: DP_PlayerReplayOutputFn,
+        user: *mut ::std::os::raw::c_void,
+    ) -> DP_PlayerResult;
+}
 pub const DP_PREVIEW_CUT: DP_PreviewType = 0;
 pub const DP_PREVIEW_DABS: DP_PreviewType = 1;
 pub const DP_PREVIEW_FILL: DP_PreviewType = 2;
-pub const DP_PREVIEW_TRANSFORM_FIRST: DP_PreviewType = 3;
-pub const DP_PREVIEW_TRANSFORM_LAST: DP_PreviewType = 18;
-pub const DP_PREVIEW_COUNT: DP_PreviewType = 19;
+pub const DP_PREVIEW_STROKE: DP_PreviewType = 3;
+pub const DP_PREVIEW_TRANSFORM_FIRST: DP_PreviewType = 4;
+pub const DP_PREVIEW_TRANSFORM_LAST: DP_PreviewType = 19;
+pub const DP_PREVIEW_COUNT: DP_PreviewType = 20;
 pub type DP_PreviewType = ::std::os::raw::c_uint;
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct DP_Preview {
     _unused: [u8; 0],
 }
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct DP_PreviewTransformSource {
+    _unused: [u8; 0],
+}
 pub type DP_PreviewTransformGetPixelsFn = ::std::option::Option<
     unsafe extern "C" fn(user: *mut ::std::os::raw::c_void) -> *const DP_Pixel8,
 >;
@@ -7285,7 +7457,41 @@ extern "C" {
     ) -> *mut DP_Preview;
 }
 extern "C" {
-    pub fn DP_preview_new_transform(
+    pub fn DP_preview_transform_source_new(
+        width: ::std::os::raw::c_int,
+        height: ::std::os::raw::c_int,
+        get_pixels: DP_PreviewTransformGetPixelsFn,
+        dispose_pixels: DP_PreviewTransformDisposePixelsFn,
+        user: *mut ::std::os::raw::c_void,
+    ) -> *mut DP_PreviewTransformSource;
+}
+extern "C" {
+    pub fn DP_preview_transform_source_incref(
+        pvts: *mut DP_PreviewTransformSource,
+    ) -> *mut DP_PreviewTransformSource;
+}
+extern "C" {
+    pub fn DP_preview_transform_source_decref(
+        pvts: *mut DP_PreviewTransformSource,
+    );
+}
+extern "C" {
+    pub fn DP_preview_transform_source_decref_nullable(
+        pvts_or_null: *mut DP_PreviewTransformSource,
+    );
+}
+extern "C" {
+    pub fn DP_preview_transform_source_width(
+        pvts: *mut DP_PreviewTransformSource,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    pub fn DP_preview_transform_source_height(
+        pvts: *mut DP_PreviewTransformSource,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    pub fn DP_preview_new_transform_inc(
         id: ::std::os::raw::c_int,
         initial_offset_x: ::std::os::raw::c_int,
         initial_offset_y: ::std::os::raw::c_int,
@@ -7294,13 +7500,10 @@ extern "C" {
         opacity: u16,
         x: ::std::os::raw::c_int,
         y: ::std::os::raw::c_int,
-        width: ::std::os::raw::c_int,
-        height: ::std::os::raw::c_int,
         dst_quad: *const DP_Quad,
         interpolation: ::std::os::raw::c_int,
-        get_pixels: DP_PreviewTransformGetPixelsFn,
-        dispose_pixels: DP_PreviewTransformDisposePixelsFn,
-        user: *mut ::std::os::raw::c_void,
+        reduced: bool,
+        pvts: *mut DP_PreviewTransformSource,
     ) -> *mut DP_Preview;
 }
 extern "C" {
@@ -7369,8 +7572,18 @@ pub type DP_RendererTileFn = ::std::option::Option<
         x: ::std::os::raw::c_int,
         y: ::std::os::raw::c_int,
         pixels: *mut DP_Pixel8,
+        rect: DP_Rect,
     ),
 >;
+pub type DP_RendererTileSlotFn = ::std::option::Option<
+    unsafe extern "C" fn(
+        user: *mut ::std::os::raw::c_void,
+        x: ::std::os::raw::c_int,
+        y: ::std::os::raw::c_int,
+        out_width: *mut ::std::os::raw::c_int,
+        out_height: *mut ::std::os::raw::c_int,
+    ) -> *mut DP_Pixel8,
+>;
 pub type DP_RendererUnlockFn =
     ::std::option::Option<unsafe extern "C" fn(user: *mut ::std::os::raw::c_void)>;
 pub type DP_RendererResizeFn = ::std::option::Option<
@@ -7396,6 +7609,7 @@ extern "C" {
         checker_color2: DP_Pixel8,
         selection_color: DP_UPixel15,
         tile_fn: DP_RendererTileFn,
+        tile_slot_fn_or_null: DP_RendererTileSlotFn,
         unlock_fn: DP_RendererUnlockFn,
         resize_fn: DP_RendererResizeFn,
         user: *mut ::std::os::raw::c_void,
@@ -7407,12 +7621,84 @@ extern "C" {
 extern "C" {
     pub fn DP_renderer_thread_count(renderer: *mut DP_Renderer) -> ::std::os::raw::c_int;
 }
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct DP_RendererStatistics {
+    pub jobs: usize,
+    pub claims: usize,
+    pub steals: usize,
+    pub queue_wait_ns: ::std::os::raw::c_ulonglong,
+}
+#[test]
+fn bindgen_test_layout_DP_RendererStatistics() {
+    const UNINIT: ::std::mem::MaybeUninit<DP_RendererStatistics> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<DP_RendererStatistics>(),
+        32usize,
+        concat!("Size of: ", stringify!(DP_RendererStatistics))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<DP_RendererStatistics>(),
+        8usize,
+        concat!("Alignment of ", stringify!(DP_RendererStatistics))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).jobs) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_RendererStatistics),
+            "::",
+            stringify!(jobs)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).claims) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_RendererStatistics),
+            "::",
+            stringify!(claims)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).steals) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_RendererStatistics),
+            "::",
+            stringify!(steals)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).queue_wait_ns) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_RendererStatistics),
+            "::",
+            stringify!(queue_wait_ns)
+        )
+    );
+}
+extern "C" {
+    pub fn DP_renderer_statistics(renderer: *mut DP_Renderer) -> DP_RendererStatistics;
+}
 extern "C" {
     pub fn DP_renderer_checkers(renderer: *mut DP_Renderer) -> bool;
 }
 extern "C" {
     pub fn DP_renderer_checkers_visible(renderer: *mut DP_Renderer) -> bool;
 }
+extern "C" {
+    pub fn DP_renderer_local_drawing_in_progress_set(
+        renderer: *mut DP_Renderer,
+        local_drawing_in_progress: bool,
+    );
+}
 extern "C" {
     pub fn DP_renderer_apply(
         renderer: *mut DP_Renderer,
@@ -7425,6 +7711,7 @@ extern "C" {
         selection_color: DP_UPixel15,
         view_tile_bounds: DP_Rect,
         render_outside_view: bool,
+        lod: ::std::os::raw::c_int,
         mode: DP_RendererMode,
     );
 }
@@ -7629,6 +7916,7 @@ extern "C" {
         checker_color2: u32,
         selection_color: u32,
         renderer_tile_fn: DP_RendererTileFn,
+        renderer_tile_slot_fn_or_null: DP_RendererTileSlotFn,
         renderer_unlock_fn: DP_RendererUnlockFn,
         renderer_resize_fn: DP_RendererResizeFn,
         renderer_user: *mut ::std::os::raw::c_void,
@@ -7654,6 +7942,181 @@ extern "C" {
 extern "C" {
     pub fn DP_paint_engine_render_thread_count(pe: *mut DP_PaintEngine) -> ::std::os::raw::c_int;
 }
+extern "C" {
+    pub fn DP_paint_engine_render_statistics(pe: *mut DP_PaintEngine) -> DP_RendererStatistics;
+}
+pub const DP_PAINT_ENGINE_DAB_CLASSIC: DP_PaintEngineDabType = 0;
+pub const DP_PAINT_ENGINE_DAB_PIXEL: DP_PaintEngineDabType = 1;
+pub const DP_PAINT_ENGINE_DAB_PIXEL_SQUARE: DP_PaintEngineDabType = 2;
+pub const DP_PAINT_ENGINE_DAB_MYPAINT: DP_PaintEngineDabType = 3;
+pub const DP_PAINT_ENGINE_DAB_MYPAINT_BLEND: DP_PaintEngineDabType = 4;
+pub const DP_PAINT_ENGINE_DAB_TYPE_COUNT: DP_PaintEngineDabType = 5;
+pub type DP_PaintEngineDabType = ::std::os::raw::c_uint;
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct DP_PaintEngineMultidabStatistics {
+    pub budget_ns: f64,
+    pub scales: [f64; 5usize],
+    pub batches: usize,
+    pub batch_ns: ::std::os::raw::c_ulonglong,
+    pub estimated_ns: f64,
+}
+#[test]
+fn bindgen_test_layout_DP_PaintEngineMultidabStatistics() {
+    const UNINIT: ::std::mem::MaybeUninit<DP_PaintEngineMultidabStatistics> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<DP_PaintEngineMultidabStatistics>(),
+        72usize,
+        concat!("Size of: ", stringify!(DP_PaintEngineMultidabStatistics))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<DP_PaintEngineMultidabStatistics>(),
+        8usize,
+        concat!("Alignment of ", stringify!(DP_PaintEngineMultidabStatistics))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).budget_ns) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineMultidabStatistics),
+            "::",
+            stringify!(budget_ns)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).scales) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineMultidabStatistics),
+            "::",
+            stringify!(scales)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).batches) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineMultidabStatistics),
+            "::",
+            stringify!(batches)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).batch_ns) as usize - ptr as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineMultidabStatistics),
+            "::",
+            stringify!(batch_ns)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).estimated_ns) as usize - ptr as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineMultidabStatistics),
+            "::",
+            stringify!(estimated_ns)
+        )
+    );
+}
+extern "C" {
+    pub fn DP_paint_engine_multidab_statistics(pe: *mut DP_PaintEngine) -> DP_PaintEngineMultidabStatistics;
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct DP_PaintEngineQueueStatistics {
+    pub queued: ::std::os::raw::c_int,
+    pub max_queued: ::std::os::raw::c_int,
+    pub handled: ::std::os::raw::c_ulonglong,
+    pub skipped: ::std::os::raw::c_ulonglong,
+    pub queue_ns: ::std::os::raw::c_ulonglong,
+    pub max_queue_ns: ::std::os::raw::c_ulonglong,
+}
+#[test]
+fn bindgen_test_layout_DP_PaintEngineQueueStatistics() {
+    const UNINIT: ::std::mem::MaybeUninit<DP_PaintEngineQueueStatistics> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<DP_PaintEngineQueueStatistics>(),
+        40usize,
+        concat!("Size of: ", stringify!(DP_PaintEngineQueueStatistics))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<DP_PaintEngineQueueStatistics>(),
+        8usize,
+        concat!("Alignment of ", stringify!(DP_PaintEngineQueueStatistics))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).queued) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(queued)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).max_queued) as usize - ptr as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(max_queued)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).handled) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(handled)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).skipped) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(skipped)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).queue_ns) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(queue_ns)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).max_queue_ns) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_PaintEngineQueueStatistics),
+            "::",
+            stringify!(max_queue_ns)
+        )
+    );
+}
+extern "C" {
+    pub fn DP_paint_engine_queue_statistics(pe: *mut DP_PaintEngine) -> DP_PaintEngineQueueStatistics;
+}
 extern "C" {
     pub fn DP_paint_engine_local_drawing_in_progress_set(
         pe: *mut DP_PaintEngine,
@@ -7747,6 +8210,7 @@ extern "C" {
     pub fn DP_paint_engine_recorder_start(
         pe: *mut DP_PaintEngine,
         type_: DP_RecorderType,
+        keyframe_interval: ::std::os::raw::c_int,
         header: *mut JSON_Value,
         path: *const ::std::os::raw::c_char,
     ) -> bool;
@@ -7805,6 +8269,7 @@ extern "C" {
         pe: *mut DP_PaintEngine,
         tile_bounds: DP_Rect,
         render_outside_tile_bounds: bool,
+        zoom: f64,
     );
 }
 extern "C" {
@@ -7835,6 +8300,8 @@ extern "C" {
         height: ::std::os::raw::c_int,
         dst_quad: *const DP_Quad,
         interpolation: ::std::os::raw::c_int,
+        reduced: bool,
+        source_key: ::std::os::raw::c_longlong,
         get_pixels: DP_PreviewTransformGetPixelsFn,
         dispose_pixels: DP_PreviewTransformDisposePixelsFn,
         user: *mut ::std::os::raw::c_void,
@@ -8257,7 +8724,10 @@ extern "C" {
     pub fn DP_tile_context_id(tile: *mut DP_Tile) -> ::std::os::raw::c_uint;
 }
 extern "C" {
-    pub fn DP_tile_pixels(tile: *mut DP_Tile) -> *const DP_Pixel15;
+    pub fn DP_tile_pixels_acquire(tile: *mut DP_Tile) -> *const DP_Pixel15;
+}
+extern "C" {
+    pub fn DP_tile_pixels_release(tile: *mut DP_Tile);
 }
 extern "C" {
     pub fn DP_tile_pixel_at(
@@ -8278,9 +8748,16 @@ extern "C" {
 extern "C" {
     pub fn DP_tile_pixels_equal(t1: *mut DP_Tile, t2: *mut DP_Tile) -> bool;
 }
+extern "C" {
+    pub fn DP_tile_pixels_hash(tile: *mut DP_Tile) -> u64;
+}
 extern "C" {
     pub fn DP_tile_pixels_equal_pixel(tile: *mut DP_Tile, pixel: DP_Pixel15) -> bool;
 }
+extern "C" {
+    pub fn DP_tile_pixels_diff_bounds(t1_or_null: *mut DP_Tile, t2_or_null: *mut DP_Tile)
+        -> DP_Rect;
+}
 extern "C" {
     pub fn DP_tile_compress_pixel8be(
         pixel: DP_Pixel15,
@@ -9184,6 +9661,14 @@ extern "C" {
         user: *mut ::std::os::raw::c_void,
     ) -> DP_PlayerResult;
 }
+extern "C" {
+    pub fn DP_player_playback_guess_msecs(
+        player: *mut DP_Player,
+        filter_message_or_null: DP_PaintEngineFilterMessageFn,
+        user: *mut ::std::os::raw::c_void,
+        out_msecs: *mut ::std::os::raw::c_longlong,
+    ) -> DP_PlayerResult;
+}
 extern "C" {
     pub fn DP_paint_engine_playback_index_build(
         pe: *mut DP_PaintEngine,
@@ -14081,6 +14566,20 @@ extern "C" {
         user: *mut ::std::os::raw::c_void,
     ) -> usize;
 }
+extern "C" {
+    pub fn DP_message_serialized_noinc(
+        msg: *mut DP_Message,
+        write_body_length: bool,
+        out_length: *mut usize,
+    ) -> *const ::std::os::raw::c_uchar;
+}
+extern "C" {
+    pub fn DP_message_serialized_compat_noinc(
+        msg: *mut DP_Message,
+        write_body_length: bool,
+        out_length: *mut usize,
+    ) -> *const ::std::os::raw::c_uchar;
+}
 extern "C" {
     pub fn DP_message_serialize_body(
         msg: *mut DP_Message,
@@ -4,4 +4,4 @@ mod output;
 mod perf;
 
 pub use output::Output;
-pub use perf::Perf;
+pub use perf::{Perf, PerfSection};
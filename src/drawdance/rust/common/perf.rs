@@ -1,8 +1,15 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 use super::Output;
-use crate::{dp_error_anyhow, DP_perf_close, DP_perf_is_open, DP_perf_open};
+use crate::{
+    dp_error_anyhow, DP_perf_begin_detail, DP_perf_close, DP_perf_end_internal, DP_perf_is_open,
+    DP_perf_open, DP_perf_output, DP_PERF_INVALID_HANDLE,
+};
 use anyhow::Result;
-use std::{env, ffi::CString};
+use std::{
+    env,
+    ffi::{c_int, CStr, CString},
+    ptr::null,
+};
 
 pub struct Perf;
 
@@ -28,3 +35,37 @@ impl Drop for Perf {
         }
     }
 }
+
+// Measured section, ends when dropped. Does nothing if perf isn't open.
+pub struct PerfSection {
+    handle: c_int,
+}
+
+impl PerfSection {
+    pub fn begin(realm: &'static CStr, categories: &'static CStr, detail: &str) -> Self {
+        let handle = if unsafe { DP_perf_is_open() } {
+            let cdetail = CString::new(detail).ok();
+            unsafe {
+                DP_perf_begin_detail(
+                    realm.as_ptr(),
+                    categories.as_ptr(),
+                    cdetail.as_ref().map_or(null(), |s| s.as_ptr()),
+                )
+            }
+        } else {
+            DP_PERF_INVALID_HANDLE
+        };
+        PerfSection { handle }
+    }
+}
+
+impl Drop for PerfSection {
+    fn drop(&mut self) {
+        if self.handle != DP_PERF_INVALID_HANDLE {
+            let output = unsafe { DP_perf_output };
+            if !output.is_null() {
+                unsafe { DP_perf_end_internal(output, self.handle) }
+            }
+        }
+    }
+}
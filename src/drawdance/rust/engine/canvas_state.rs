@@ -126,6 +126,10 @@ pub struct CanvasState {
     data: *mut DP_CanvasState,
 }
 
+// Persistent canvas states are immutable and their refcount is atomic, so they
+// can be handed off to other threads, e.g. to save them in the background.
+unsafe impl Send for CanvasState {}
+
 pub type AttachedCanvasState<'a, P> = Attached<'a, CanvasState, P>;
 pub type DetachedCanvasState = Detached<DP_CanvasState, CanvasState>;
 
@@ -21,6 +21,10 @@ pub struct Image {
     image: *mut DP_Image,
 }
 
+// Images are plain pixel buffers with no shared state, so they can be handed
+// off to other threads for scaling and output.
+unsafe impl Send for Image {}
+
 impl Image {
     pub fn new(width: usize, height: usize) -> Result<Self> {
         if width > 0 && height > 0 {
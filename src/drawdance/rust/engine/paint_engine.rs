@@ -1,4 +1,4 @@
-use super::{AclState, DrawContext, Image, Player};
+use super::{AclState, CanvasState, DetachedCanvasState, DrawContext, Image, Player};
 use crate::{
     dp_error_anyhow, msg::Message, DP_AnnotationList, DP_CanvasState, DP_DocumentMetadata,
     DP_ImageScaleInterpolation, DP_LayerPropsList, DP_Message, DP_PaintEngine, DP_Pixel15,
@@ -75,6 +75,7 @@ impl PaintEngine {
                 0xff878787u32,
                 0x0u32,
                 Some(Self::on_renderer_tile),
+                None,
                 Some(Self::on_renderer_unlock),
                 Some(Self::on_renderer_resize),
                 user.cast(),
@@ -170,6 +171,7 @@ impl PaintEngine {
         tile_x: c_int,
         tile_y: c_int,
         pixels: *mut DP_Pixel8,
+        _rect: DP_Rect,
     ) {
         let pe = unsafe { user.cast::<Self>().as_mut().unwrap_unchecked() };
         let from_x = tile_x as usize * Self::TILE_SIZE;
@@ -351,13 +353,35 @@ impl PaintEngine {
     extern "C" fn on_move_pointer(_user: *mut c_void, _context_id: c_uint, _x: c_int, _y: c_int) {}
 
     pub fn render(&mut self) {
-        let user: *mut Self = self;
-        let tile_bounds = DP_Rect {
+        self.tick(DP_Rect {
             x1: 0,
             y1: 0,
             x2: c_int::from(u16::MAX),
             y2: c_int::from(u16::MAX),
-        };
+        });
+        unsafe { DP_paint_engine_render_everything(self.paint_engine) };
+        self.render_barrier.wait();
+    }
+
+    // Brings the view canvas state up to date without rendering anything, for
+    // when the caller is going to flatten it themselves.
+    pub fn sync(&mut self) {
+        self.tick(DP_Rect {
+            x1: 0,
+            y1: 0,
+            x2: -1,
+            y2: -1,
+        });
+    }
+
+    pub fn view_canvas_state(&self) -> Option<DetachedCanvasState> {
+        CanvasState::new_detached_noinc_nullable(unsafe {
+            DP_paint_engine_view_canvas_state_inc(self.paint_engine)
+        })
+    }
+
+    fn tick(&mut self, tile_bounds: DP_Rect) {
+        let user: *mut Self = self;
         unsafe {
             DP_paint_engine_tick(
                 self.paint_engine,
@@ -377,9 +401,7 @@ impl PaintEngine {
                 Some(Self::on_censored_layer_revealed),
                 user.cast(),
             );
-            DP_paint_engine_render_everything(self.paint_engine);
         }
-        self.render_barrier.wait();
     }
 
     extern "C" fn on_catchup(_user: *mut c_void, _progress: c_int) {}
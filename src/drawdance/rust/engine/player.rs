@@ -1,18 +1,26 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+use super::{CanvasState, DetachedCanvasState, DrawContext};
 use crate::{
-    dp_error_anyhow, json_object_get_string, json_value_get_object, msg::Message, DP_Input,
-    DP_Message, DP_Player, DP_PlayerCompatibility, DP_PlayerPass, DP_PlayerType,
-    DP_file_input_new_from_path, DP_file_input_new_from_stdin, DP_player_acl_override_set,
-    DP_player_compatibility, DP_player_compatible, DP_player_free, DP_player_header, DP_player_new,
-    DP_player_pass_set, DP_player_step, DP_player_type, JSON_Value, DP_PLAYER_RECORDING_END,
-    DP_PLAYER_SUCCESS,
+    dp_error_anyhow, json_object_get_string, json_value_get_object, msg::Message, DP_CanvasState,
+    DP_Input, DP_Message, DP_Player, DP_PlayerCompatibility, DP_PlayerPass, DP_PlayerReplayStep,
+    DP_PlayerType, DP_file_input_new_from_stdin, DP_file_input_new_mapped_from_path,
+    DP_message_type, DP_player_acl_override_set, DP_player_compatibility, DP_player_compatible,
+    DP_player_free, DP_player_header, DP_player_new, DP_player_pass_set,
+    DP_player_playback_guess_msecs, DP_player_replay, DP_player_step, DP_player_type, JSON_Value,
+    DP_MSG_INTERVAL, DP_MSG_UNDO, DP_PAINT_ENGINE_FILTER_MESSAGE_FLAG_NO_TIME,
+    DP_PLAYER_RECORDING_END, DP_PLAYER_SUCCESS,
 };
-use anyhow::{anyhow, Result};
+use anyhow::{anyhow, Error, Result};
 use std::{
-    ffi::{c_char, CStr, CString},
+    ffi::{c_char, c_longlong, c_uint, c_void, CStr, CString},
     ptr::{self, null_mut},
 };
 
+struct ReplayContext<'a> {
+    output: &'a mut dyn FnMut(DetachedCanvasState, bool) -> Result<()>,
+    error: Option<Error>,
+}
+
 pub struct Player {
     player: *mut DP_Player,
 }
@@ -28,7 +36,7 @@ impl Player {
 
     pub fn new_from_path(ptype: DP_PlayerType, path: String) -> Result<Self> {
         let cpath = CString::new(path)?;
-        let input = unsafe { DP_file_input_new_from_path(cpath.as_ptr()) };
+        let input = unsafe { DP_file_input_new_mapped_from_path(cpath.as_ptr()) };
         if input.is_null() {
             return Err(dp_error_anyhow());
         }
@@ -129,6 +137,80 @@ impl Player {
             Err(dp_error_anyhow())
         }
     }
+
+    pub fn replay<F>(
+        &mut self,
+        dc: &mut DrawContext,
+        step: DP_PlayerReplayStep,
+        steps: i64,
+        mut output: F,
+    ) -> Result<()>
+    where
+        F: FnMut(DetachedCanvasState, bool) -> Result<()>,
+    {
+        let mut ctx = ReplayContext {
+            output: &mut output,
+            error: None,
+        };
+        let user: *mut ReplayContext = &mut ctx;
+        let result = unsafe {
+            DP_player_replay(
+                self.player,
+                dc.as_ptr(),
+                step,
+                steps,
+                Some(Self::on_replay_output),
+                user.cast(),
+            )
+        };
+        if result == DP_PLAYER_RECORDING_END {
+            Ok(())
+        } else if let Some(e) = ctx.error {
+            Err(e)
+        } else {
+            Err(dp_error_anyhow())
+        }
+    }
+
+    // How many milliseconds a timelapse of the rest of the recording would
+    // cover, ignoring dead air and undos like PaintEngine's timelapse playback.
+    pub fn guess_timelapse_msecs(&mut self) -> Result<i64> {
+        let mut msecs: c_longlong = 0;
+        let result = unsafe {
+            DP_player_playback_guess_msecs(
+                self.player,
+                Some(Self::on_filter_timelapse_message),
+                null_mut(),
+                &mut msecs,
+            )
+        };
+        if result == DP_PLAYER_RECORDING_END {
+            Ok(msecs)
+        } else {
+            Err(dp_error_anyhow())
+        }
+    }
+
+    extern "C" fn on_filter_timelapse_message(_user: *mut c_void, msg: *mut DP_Message) -> c_uint {
+        let msg_type = unsafe { DP_message_type(msg) };
+        if msg_type == DP_MSG_INTERVAL || msg_type == DP_MSG_UNDO {
+            DP_PAINT_ENGINE_FILTER_MESSAGE_FLAG_NO_TIME
+        } else {
+            0
+        }
+    }
+
+    extern "C" fn on_replay_output(user: *mut c_void, cs: *mut DP_CanvasState, last: bool) -> bool {
+        let ctx = unsafe { user.cast::<ReplayContext>().as_mut().unwrap_unchecked() };
+        let cs = CanvasState::new_detached_inc(unsafe { &mut *cs });
+        match (ctx.output)(cs, last) {
+            Ok(_) => true,
+            Err(e) => {
+                ctx.error = Some(e);
+                false
+            }
+        }
+    }
 }
 
 impl Drop for Player {
@@ -0,0 +1,775 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Load generator for drawpile-srv. Connects a bunch of clients to existing
+// sessions through the regular login process, has them replay the strokes from
+// recordings at a fixed rate and reports how the server holds up. Latency is
+// measured from sending a message until the server relays it back to us.
+extern "C" {
+#include <dpengine/player.h>
+#include <dpimpex/load.h>
+#include <dpmsg/message.h>
+}
+#include "libclient/net/client.h"
+#include "libclient/net/login.h"
+#include "libclient/net/message.h"
+#include "libclient/net/server.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QVector>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <dpcommon/platform_qt.h>
+
+namespace {
+
+struct Options {
+	QVector<QUrl> urls;
+	QStringList recordingPaths;
+	int clients = 10;
+	double rate = 50.0;
+	int durationSecs = 60;
+	int reportIntervalSecs = 5;
+	int connectIntervalMsecs = 100;
+	int timeoutSecs = 30;
+	QString usernamePrefix = QStringLiteral("bench");
+	QString sessionPassword;
+};
+
+// Fixed buckets of 0.1ms up to 10 seconds, so that long runs with lots of
+// clients don't have to keep every sample around to get percentiles.
+class LatencyHistogram {
+public:
+	LatencyHistogram()
+		: m_buckets(int(BUCKET_COUNT) + 1, 0)
+	{
+	}
+
+	void add(qint64 nsecs)
+	{
+		qint64 bucket = qBound(qint64(0), nsecs / BUCKET_NSECS, BUCKET_COUNT);
+		int i = int(bucket);
+		++m_buckets[i];
+		++m_count;
+		m_maxNsecs = qMax(m_maxNsecs, nsecs);
+	}
+
+	void clear()
+	{
+		m_buckets.fill(0);
+		m_count = 0;
+		m_maxNsecs = 0;
+	}
+
+	qint64 count() const { return m_count; }
+
+	double percentileMsecs(double percentile) const
+	{
+		qint64 target = qint64(double(m_count) * percentile / 100.0);
+		qint64 seen = 0;
+		for(int i = 0, count = m_buckets.size(); i < count; ++i) {
+			seen += m_buckets[i];
+			if(seen > target) {
+				return nsecsToMsecs(qint64(i) * BUCKET_NSECS);
+			}
+		}
+		return maxMsecs();
+	}
+
+	double maxMsecs() const { return nsecsToMsecs(m_maxNsecs); }
+
+	static double nsecsToMsecs(qint64 nsecs) { return double(nsecs) / 1.0e6; }
+
+private:
+	static constexpr qint64 BUCKET_NSECS = 100000;
+	static constexpr qint64 BUCKET_COUNT = 100000;
+
+	QVector<qint64> m_buckets;
+	qint64 m_count = 0;
+	qint64 m_maxNsecs = 0;
+};
+
+class Bench;
+
+class BenchClient final : public QObject, public net::Client::CommandHandler {
+public:
+	enum class State { Idle, Connecting, CatchingUp, Running, Disconnected };
+
+	BenchClient(
+		Bench *bench, int index, const QUrl &url,
+		const QVector<QByteArray> *strokes, QObject *parent = nullptr);
+
+	State state() const { return m_state; }
+	int uploadQueueBytes() const { return m_client->uploadQueueBytes(); }
+
+	void connectToServer();
+	void disconnectFromServer();
+	void tick(qint64 nowNsecs);
+
+	void handleCommands(
+		int count, const net::Message *msgs, bool mayContainMeta) override;
+	void handleLocalCommands(int count, const net::Message *msgs) override;
+	int commandBacklog() const override { return 0; }
+
+private:
+	struct Sent {
+		qint64 nsecs;
+		DP_MessageType type;
+		size_t length;
+	};
+
+	void onLoggedIn();
+	void onCatchupProgress(int percentage);
+	void onDisconnected(const QString &message, bool localDisconnect);
+	void connectLoginHandler(net::LoginHandler *login);
+
+	Bench *m_bench;
+	int m_index;
+	QUrl m_url;
+	QString m_username;
+	const QVector<QByteArray> *m_strokes;
+	net::Client *m_client;
+	State m_state = State::Idle;
+	qint64 m_connectNsecs = 0;
+	qint64 m_runningNsecs = 0;
+	qint64 m_sentCount = 0;
+	int m_nextStroke = 0;
+	std::deque<Sent> m_inFlight;
+};
+
+class Bench final : public QObject {
+public:
+	Bench(const Options &options, QObject *parent = nullptr);
+
+	bool loadRecordings();
+	void start();
+
+	qint64 nowNsecs() const { return m_clock.nsecsElapsed(); }
+	const Options &options() const { return m_options; }
+
+	void recordJoin(qint64 nsecs) { m_joinNsecs.append(nsecs); }
+	void recordCatchup(qint64 nsecs) { m_catchupNsecs.append(nsecs); }
+
+	void recordLatency(qint64 nsecs)
+	{
+		m_intervalLatency.add(nsecs);
+		m_totalLatency.add(nsecs);
+	}
+
+	void recordSent(int count) { m_intervalSent += count; }
+	void recordBytesReceived(int bytes) { m_intervalBytesReceived += bytes; }
+
+	void recordHistorySize(int historySize)
+	{
+		m_historySize = qMax(m_historySize, qint64(historySize));
+	}
+
+	void recordDisconnect(int index, const QString &message);
+
+private:
+	void connectNextClient();
+	void tick();
+	void report();
+	void finish();
+	void printSummary();
+
+	static QString describeTimes(QVector<qint64> nsecs);
+
+	Options m_options;
+	QVector<QVector<QByteArray>> m_recordings;
+	QVector<BenchClient *> m_clients;
+	QElapsedTimer m_clock;
+	QTimer *m_tickTimer;
+	QTimer *m_reportTimer;
+	int m_clientsStarted = 0;
+	LatencyHistogram m_intervalLatency;
+	LatencyHistogram m_totalLatency;
+	QVector<qint64> m_joinNsecs;
+	QVector<qint64> m_catchupNsecs;
+	qint64 m_intervalSent = 0;
+	qint64 m_intervalBytesReceived = 0;
+	qint64 m_lastReportNsecs = 0;
+	qint64 m_historySize = 0;
+	qint64 m_lastHistorySize = 0;
+	int m_maxUploadQueueBytes = 0;
+	int m_disconnects = 0;
+	bool m_finished = false;
+};
+
+
+// Only replay things that make up strokes. Anything structural, like layer
+// creation or resizes, would mess up the session for everyone else.
+static bool isStrokeMessage(DP_MessageType type)
+{
+	switch(type) {
+	case DP_MSG_UNDO_POINT:
+	case DP_MSG_PEN_UP:
+	case DP_MSG_DRAW_DABS_CLASSIC:
+	case DP_MSG_DRAW_DABS_PIXEL:
+	case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+	case DP_MSG_DRAW_DABS_MYPAINT:
+	case DP_MSG_DRAW_DABS_MYPAINT_BLEND:
+	case DP_MSG_MOVE_POINTER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Messages are kept serialized so that each client can deserialize its own
+// copy and put its own context id into it.
+static bool loadStrokes(const QString &path, QVector<QByteArray> &outStrokes)
+{
+	DP_LoadResult result;
+	DP_Player *player = DP_load_recording(path.toUtf8().constData(), &result);
+	if(!player) {
+		fprintf(
+			stderr, "Error loading '%s' (%d): %s\n", qUtf8Printable(path),
+			int(result), DP_error());
+		return false;
+	}
+
+	bool ok = true;
+	while(true) {
+		DP_Message *msg;
+		DP_PlayerResult pr = DP_player_step(player, false, &msg);
+		if(pr == DP_PLAYER_SUCCESS) {
+			net::Message message = net::Message::noinc(msg);
+			if(isStrokeMessage(message.type())) {
+				QByteArray buffer;
+				if(message.serialize(buffer)) {
+					outStrokes.append(buffer);
+				}
+			}
+		} else if(pr == DP_PLAYER_RECORDING_END) {
+			break;
+		} else if(pr == DP_PLAYER_ERROR_PARSE) {
+			fprintf(
+				stderr, "Skipping message in '%s': %s\n", qUtf8Printable(path),
+				DP_error());
+		} else {
+			fprintf(
+				stderr, "Error reading '%s': %s\n", qUtf8Printable(path),
+				DP_error());
+			ok = false;
+			break;
+		}
+	}
+	DP_player_free(player);
+
+	if(ok && outStrokes.isEmpty()) {
+		fprintf(stderr, "No strokes in '%s'\n", qUtf8Printable(path));
+		ok = false;
+	}
+	return ok;
+}
+
+
+BenchClient::BenchClient(
+	Bench *bench, int index, const QUrl &url,
+	const QVector<QByteArray> *strokes, QObject *parent)
+	: QObject(parent)
+	, m_bench(bench)
+	, m_index(index)
+	, m_url(url)
+	, m_strokes(strokes)
+	, m_client(new net::Client(this, this))
+{
+	m_username = bench->options().usernamePrefix + QString::number(index);
+	// Smoothing would hold back received messages and skew the latency.
+	m_client->setSmoothDrainRate(0);
+	connect(
+		m_client, &net::Client::serverLoggedIn, this, &BenchClient::onLoggedIn);
+	connect(
+		m_client, &net::Client::catchupProgress, this,
+		&BenchClient::onCatchupProgress);
+	connect(
+		m_client, &net::Client::serverDisconnected, this,
+		[this](const QString &message, const QString &, bool localDisconnect) {
+			onDisconnected(message, localDisconnect);
+		});
+	connect(m_client, &net::Client::bytesReceived, this, [this](int bytes) {
+		m_bench->recordBytesReceived(bytes);
+	});
+	connect(
+		m_client, &net::Client::serverStatusUpdate, this,
+		[this](int historySize) {
+			m_bench->recordHistorySize(historySize);
+		});
+}
+
+void BenchClient::connectToServer()
+{
+	QUrl url = m_url;
+	url.setUserName(m_username);
+	QUrlQuery query(url);
+	query.addQueryItem(QStringLiteral("loginmethod"), QStringLiteral("guest"));
+	url.setQuery(query);
+
+	QUrl loginUrl = net::Server::fixUpAddress(url, true);
+	QString autoJoinId = net::Server::extractAutoJoinIdFromUrl(loginUrl);
+	net::LoginHandler *login = new net::LoginHandler(
+		QSharedPointer<const net::LoginHostParams>(nullptr), autoJoinId,
+		loginUrl, 0, QStringList(), QJsonObject(), this);
+	connectLoginHandler(login);
+
+	m_state = State::Connecting;
+	m_connectNsecs = m_bench->nowNsecs();
+	m_client->connectToServer(m_bench->options().timeoutSecs, 0, login, false);
+}
+
+void BenchClient::disconnectFromServer()
+{
+	if(m_state != State::Disconnected && m_state != State::Idle) {
+		m_client->disconnectFromServer();
+	}
+}
+
+void BenchClient::tick(qint64 nowNsecs)
+{
+	if(m_state != State::Running) {
+		return;
+	}
+
+	double elapsedSecs = double(nowNsecs - m_runningNsecs) / 1.0e9;
+	qint64 due = qint64(elapsedSecs * m_bench->options().rate) - m_sentCount;
+	if(due <= 0) {
+		return;
+	}
+
+	unsigned int contextId = m_client->myId();
+	int strokeCount = m_strokes->size();
+	net::MessageList msgs;
+	msgs.reserve(int(due));
+	for(qint64 i = 0; i < due; ++i) {
+		const QByteArray &buffer = m_strokes->at(m_nextStroke);
+		m_nextStroke = (m_nextStroke + 1) % strokeCount;
+		net::Message msg = net::Message::deserialize(
+			reinterpret_cast<const unsigned char *>(buffer.constData()),
+			size_t(buffer.size()), false);
+		if(!msg.isNull()) {
+			msg.setContextId(contextId);
+			m_inFlight.push_back({nowNsecs, msg.type(), msg.length()});
+			msgs.append(msg);
+		}
+	}
+
+	m_sentCount += due;
+	m_client->sendCommands(msgs.size(), msgs.constData());
+	m_bench->recordSent(msgs.size());
+}
+
+void BenchClient::handleCommands(
+	int count, const net::Message *msgs, bool mayContainMeta)
+{
+	Q_UNUSED(mayContainMeta);
+	if(m_state != State::Running) {
+		return;
+	}
+
+	qint64 nowNsecs = m_bench->nowNsecs();
+	unsigned int contextId = m_client->myId();
+	for(int i = 0; i < count; ++i) {
+		const net::Message &msg = msgs[i];
+		if(msg.contextId() == contextId && isStrokeMessage(msg.type())) {
+			// The server relays our messages back in order, but it may drop
+			// some, e.g. if the session is locked. Skip those to resync.
+			DP_MessageType type = msg.type();
+			size_t length = msg.length();
+			while(!m_inFlight.empty()) {
+				Sent sent = m_inFlight.front();
+				m_inFlight.pop_front();
+				if(sent.type == type && sent.length == length) {
+					m_bench->recordLatency(nowNsecs - sent.nsecs);
+					break;
+				}
+			}
+		}
+	}
+}
+
+void BenchClient::handleLocalCommands(int count, const net::Message *msgs)
+{
+	Q_UNUSED(count);
+	Q_UNUSED(msgs);
+}
+
+void BenchClient::onLoggedIn()
+{
+	m_state = State::CatchingUp;
+	m_bench->recordJoin(m_bench->nowNsecs() - m_connectNsecs);
+	if(m_client->isFullyCaughtUp()) {
+		onCatchupProgress(100);
+	}
+}
+
+void BenchClient::onCatchupProgress(int percentage)
+{
+	if(percentage >= 100 && m_state == State::CatchingUp) {
+		qint64 nowNsecs = m_bench->nowNsecs();
+		m_bench->recordCatchup(nowNsecs - m_connectNsecs);
+		m_state = State::Running;
+		m_runningNsecs = nowNsecs;
+	}
+}
+
+void BenchClient::onDisconnected(const QString &message, bool localDisconnect)
+{
+	m_state = State::Disconnected;
+	m_inFlight.clear();
+	if(!localDisconnect) {
+		m_bench->recordDisconnect(m_index, message);
+	}
+}
+
+void BenchClient::connectLoginHandler(net::LoginHandler *login)
+{
+	using LoginMethod = net::LoginHandler::LoginMethod;
+	QString username = m_username;
+	connect(
+		login, &net::LoginHandler::ruleAcceptanceNeeded, login,
+		&net::LoginHandler::acceptRules);
+	connect(
+		login, &net::LoginHandler::certificateCheckNeeded, login,
+		&net::LoginHandler::acceptServerCertificate);
+	connect(
+		login, &net::LoginHandler::loginMethodChoiceNeeded, login,
+		[login, username] {
+			login->selectIdentity(username, QString(), LoginMethod::Guest);
+		});
+	connect(
+		login, &net::LoginHandler::usernameNeeded, login, [login, username] {
+			login->selectIdentity(username, QString(), LoginMethod::Guest);
+		});
+	connect(
+		login, &net::LoginHandler::sessionConfirmationNeeded, login,
+		&net::LoginHandler::confirmJoinSelectedSession);
+	connect(
+		login, &net::LoginHandler::sessionPasswordNeeded, login,
+		[this, login] {
+			login->sendSessionPassword(m_bench->options().sessionPassword);
+		});
+	connect(
+		login, &net::LoginHandler::loginNeeded, login,
+		&net::LoginHandler::cancelLogin);
+	connect(
+		login, &net::LoginHandler::sessionChoiceNeeded, login,
+		&net::LoginHandler::cancelLogin);
+	connect(
+		login, &net::LoginHandler::replacedByRedirect, this,
+		[this](net::LoginHandler *redirectLogin) {
+			connectLoginHandler(redirectLogin);
+		});
+}
+
+
+Bench::Bench(const Options &options, QObject *parent)
+	: QObject(parent)
+	, m_options(options)
+	, m_tickTimer(new QTimer(this))
+	, m_reportTimer(new QTimer(this))
+{
+	m_tickTimer->setTimerType(Qt::PreciseTimer);
+	m_tickTimer->setInterval(10);
+	connect(m_tickTimer, &QTimer::timeout, this, &Bench::tick);
+	m_reportTimer->setInterval(m_options.reportIntervalSecs * 1000);
+	connect(m_reportTimer, &QTimer::timeout, this, &Bench::report);
+}
+
+bool Bench::loadRecordings()
+{
+	for(const QString &path : m_options.recordingPaths) {
+		QVector<QByteArray> strokes;
+		if(!loadStrokes(path, strokes)) {
+			return false;
+		}
+		printf(
+			"Loaded %d stroke messages from '%s'\n", strokes.size(),
+			qUtf8Printable(path));
+		m_recordings.append(strokes);
+	}
+	return true;
+}
+
+void Bench::start()
+{
+	int urlCount = m_options.urls.size();
+	int recordingCount = m_recordings.size();
+	for(int i = 0; i < m_options.clients; ++i) {
+		m_clients.append(new BenchClient(
+			this, i + 1, m_options.urls[i % urlCount],
+			&m_recordings[i % recordingCount], this));
+	}
+
+	m_clock.start();
+	m_tickTimer->start();
+	m_reportTimer->start();
+	if(m_options.durationSecs > 0) {
+		QTimer::singleShot(m_options.durationSecs * 1000, this, &Bench::finish);
+	}
+	connectNextClient();
+}
+
+void Bench::recordDisconnect(int index, const QString &message)
+{
+	++m_disconnects;
+	fprintf(
+		stderr, "Client %d disconnected: %s\n", index, qUtf8Printable(message));
+}
+
+void Bench::connectNextClient()
+{
+	if(!m_finished && m_clientsStarted < m_clients.size()) {
+		m_clients[m_clientsStarted++]->connectToServer();
+		QTimer::singleShot(
+			m_options.connectIntervalMsecs, this, &Bench::connectNextClient);
+	}
+}
+
+void Bench::tick()
+{
+	qint64 now = nowNsecs();
+	for(BenchClient *client : m_clients) {
+		client->tick(now);
+		if(client->state() == BenchClient::State::Running) {
+			m_maxUploadQueueBytes =
+				qMax(m_maxUploadQueueBytes, client->uploadQueueBytes());
+		}
+	}
+}
+
+void Bench::report()
+{
+	qint64 now = nowNsecs();
+	double intervalSecs = double(now - m_lastReportNsecs) / 1.0e9;
+	int running = 0;
+	for(const BenchClient *client : m_clients) {
+		if(client->state() == BenchClient::State::Running) {
+			++running;
+		}
+	}
+
+	printf(
+		"[%7.1fs] %d/%d running, %d disconnected | sent %.0f msg/s, "
+		"received %.1f KiB/s | latency p50 %.1fms p90 %.1fms p99 %.1fms "
+		"max %.1fms | upload queue max %d B | history %lld B (%+lld)\n",
+		double(now) / 1.0e9, running, m_clients.size(), m_disconnects,
+		double(m_intervalSent) / intervalSecs,
+		double(m_intervalBytesReceived) / 1024.0 / intervalSecs,
+		m_intervalLatency.percentileMsecs(50.0),
+		m_intervalLatency.percentileMsecs(90.0),
+		m_intervalLatency.percentileMsecs(99.0), m_intervalLatency.maxMsecs(),
+		m_maxUploadQueueBytes, m_historySize,
+		m_historySize - m_lastHistorySize);
+	fflush(stdout);
+
+	m_lastReportNsecs = now;
+	m_intervalLatency.clear();
+	m_intervalSent = 0;
+	m_intervalBytesReceived = 0;
+	m_maxUploadQueueBytes = 0;
+	m_lastHistorySize = m_historySize;
+}
+
+void Bench::finish()
+{
+	if(!m_finished) {
+		m_finished = true;
+		report();
+		m_tickTimer->stop();
+		m_reportTimer->stop();
+		printSummary();
+		for(BenchClient *client : m_clients) {
+			client->disconnectFromServer();
+		}
+		// Give the disconnects a moment to go out.
+		QTimer::singleShot(1000, qApp, &QCoreApplication::quit);
+	}
+}
+
+void Bench::printSummary()
+{
+	printf(
+		"\nClients: %d started, %d joined, %d caught up, %d disconnected\n",
+		m_clientsStarted, m_joinNsecs.size(), m_catchupNsecs.size(),
+		m_disconnects);
+	printf("Join time: %s\n", qUtf8Printable(describeTimes(m_joinNsecs)));
+	printf(
+		"Join and catch-up time: %s\n",
+		qUtf8Printable(describeTimes(m_catchupNsecs)));
+	printf(
+		"Relay latency over %lld messages: p50 %.1fms p90 %.1fms p99 %.1fms "
+		"p99.9 %.1fms max %.1fms\n",
+		m_totalLatency.count(), m_totalLatency.percentileMsecs(50.0),
+		m_totalLatency.percentileMsecs(90.0),
+		m_totalLatency.percentileMsecs(99.0),
+		m_totalLatency.percentileMsecs(99.9), m_totalLatency.maxMsecs());
+	fflush(stdout);
+}
+
+QString Bench::describeTimes(QVector<qint64> nsecs)
+{
+	if(nsecs.isEmpty()) {
+		return QStringLiteral("n/a");
+	}
+	std::sort(nsecs.begin(), nsecs.end());
+	return QStringLiteral("min %1ms median %2ms max %3ms")
+		.arg(LatencyHistogram::nsecsToMsecs(nsecs.first()), 0, 'f', 1)
+		.arg(LatencyHistogram::nsecsToMsecs(nsecs[nsecs.size() / 2]), 0, 'f', 1)
+		.arg(LatencyHistogram::nsecsToMsecs(nsecs.last()), 0, 'f', 1);
+}
+
+
+static bool parseOptions(const QCoreApplication &app, Options &options)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription(QStringLiteral(
+		"Connects clients to sessions on a Drawpile server and replays strokes "
+		"from recordings to measure how the server holds up under load. The "
+		"sessions must already exist and allow guests to draw."));
+	parser.addHelpOption();
+	parser.addPositionalArgument(
+		QStringLiteral("urls"),
+		QStringLiteral("Session URLs, like drawpile://host:27750/session or "
+					   "wss://host/drawpile-web/ws?session=session. Clients "
+					   "are spread across them."),
+		QStringLiteral("url..."));
+
+	QCommandLineOption recordingOption(
+		{QStringLiteral("r"), QStringLiteral("recording")},
+		QStringLiteral("Recording to take strokes from, can be given multiple "
+					   "times. Clients are spread across them."),
+		QStringLiteral("path"));
+	QCommandLineOption clientsOption(
+		{QStringLiteral("c"), QStringLiteral("clients")},
+		QStringLiteral("Number of clients to connect (default 10.)"),
+		QStringLiteral("count"), QStringLiteral("10"));
+	QCommandLineOption rateOption(
+		QStringLiteral("rate"),
+		QStringLiteral("Messages per second each client sends (default 50.)"),
+		QStringLiteral("rate"), QStringLiteral("50"));
+	QCommandLineOption durationOption(
+		{QStringLiteral("d"), QStringLiteral("duration")},
+		QStringLiteral("Seconds to run for, 0 runs until interrupted (default "
+					   "60.)"),
+		QStringLiteral("seconds"), QStringLiteral("60"));
+	QCommandLineOption reportIntervalOption(
+		QStringLiteral("report-interval"),
+		QStringLiteral("Seconds between progress reports (default 5.)"),
+		QStringLiteral("seconds"), QStringLiteral("5"));
+	QCommandLineOption connectIntervalOption(
+		QStringLiteral("connect-interval"),
+		QStringLiteral("Milliseconds between connecting each client (default "
+					   "100.)"),
+		QStringLiteral("msecs"), QStringLiteral("100"));
+	QCommandLineOption timeoutOption(
+		QStringLiteral("timeout"),
+		QStringLiteral("Network timeout in seconds (default 30.)"),
+		QStringLiteral("seconds"), QStringLiteral("30"));
+	QCommandLineOption usernameOption(
+		QStringLiteral("username"),
+		QStringLiteral("Prefix for client usernames, their number gets "
+					   "appended (default bench.)"),
+		QStringLiteral("prefix"), QStringLiteral("bench"));
+	QCommandLineOption sessionPasswordOption(
+		QStringLiteral("session-password"),
+		QStringLiteral("Password for joining the sessions."),
+		QStringLiteral("password"));
+	parser.addOptions(
+		{recordingOption, clientsOption, rateOption, durationOption,
+		 reportIntervalOption, connectIntervalOption, timeoutOption,
+		 usernameOption, sessionPasswordOption});
+	parser.process(app);
+
+	for(const QString &arg : parser.positionalArguments()) {
+		QUrl url(arg);
+		if(!url.isValid() || url.host().isEmpty()) {
+			fprintf(stderr, "Invalid session URL '%s'\n", qUtf8Printable(arg));
+			return false;
+		}
+		options.urls.append(url);
+	}
+	if(options.urls.isEmpty()) {
+		fputs("No session URLs given\n", stderr);
+		return false;
+	}
+
+	options.recordingPaths = parser.values(recordingOption);
+	if(options.recordingPaths.isEmpty()) {
+		fputs("No recordings given\n", stderr);
+		return false;
+	}
+
+	bool ok;
+	options.clients = parser.value(clientsOption).toInt(&ok);
+	if(!ok || options.clients < 1) {
+		fputs("Invalid client count\n", stderr);
+		return false;
+	}
+
+	options.rate = parser.value(rateOption).toDouble(&ok);
+	if(!ok || options.rate <= 0.0) {
+		fputs("Invalid rate\n", stderr);
+		return false;
+	}
+
+	options.durationSecs = parser.value(durationOption).toInt(&ok);
+	if(!ok || options.durationSecs < 0) {
+		fputs("Invalid duration\n", stderr);
+		return false;
+	}
+
+	options.reportIntervalSecs = parser.value(reportIntervalOption).toInt(&ok);
+	if(!ok || options.reportIntervalSecs < 1) {
+		fputs("Invalid report interval\n", stderr);
+		return false;
+	}
+
+	options.connectIntervalMsecs =
+		parser.value(connectIntervalOption).toInt(&ok);
+	if(!ok || options.connectIntervalMsecs < 0) {
+		fputs("Invalid connect interval\n", stderr);
+		return false;
+	}
+
+	options.timeoutSecs = parser.value(timeoutOption).toInt(&ok);
+	if(!ok || options.timeoutSecs < 1) {
+		fputs("Invalid timeout\n", stderr);
+		return false;
+	}
+
+	options.usernamePrefix = parser.value(usernameOption);
+	options.sessionPassword = parser.value(sessionPasswordOption);
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	// The login process deals with avatar pixmaps, so it needs a GUI
+	// application, but there's no reason to put up any windows.
+	if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+	QGuiApplication app(argc, argv);
+	DP_QT_LOCALE_RESET();
+	app.setOrganizationName("drawpile");
+	app.setOrganizationDomain("drawpile.net");
+	app.setApplicationName("bench_server");
+
+	Options options;
+	if(!parseOptions(app, options)) {
+		return 2;
+	}
+
+	Bench bench(options);
+	if(!bench.loadRecordings()) {
+		return 1;
+	}
+
+	bench.start();
+	return app.exec();
+}
@@ -1,4 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/worker.h>
+}
 #include "libclient/brushes/brushpresetmodel.h"
 #include "libclient/drawdance/ziparchive.h"
 #include "libclient/utils/wasmpersistence.h"
@@ -6,8 +9,10 @@
 #include "libshared/util/paths.h"
 #include "libshared/util/qtcompat.h"
 #include <QBuffer>
+#include <QCryptographicHash>
 #include <QDirIterator>
 #include <QIcon>
+#include <QImage>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -28,6 +33,8 @@ static constexpr int UNTAGGED_ROW = 1;
 static constexpr int TAG_OFFSET = 2;
 static constexpr int ALL_ID = -1;
 static constexpr int UNTAGGED_ID = -2;
+// Below this many presets to decode, spinning up worker threads isn't worth it.
+static constexpr int PARALLEL_DECODE_MIN_PRESETS = 16;
 
 namespace {
 typedef QVector<QPair<QString, QStringList>> OldMetadata;
@@ -51,6 +58,35 @@ struct CachedPreset : Preset {
 	QSet<int> tagIds;
 };
 
+// Thumbnails and brushes of presets as decoded from the database, along with
+// a hash of the stored blobs they came from. Decoding thousands of PNGs and
+// brush JSON documents on every refresh of the preset list is slow.
+struct DecodedPreset {
+	QByteArray key;
+	QPixmap originalThumbnail;
+	ActiveBrush originalBrush;
+	std::optional<QPixmap> changedThumbnail;
+	std::optional<ActiveBrush> changedBrush;
+};
+
+// Stored blobs of a preset waiting to be decoded. Thumbnails are decoded into
+// images first, since pixmaps can only be created on the main thread.
+struct PendingPreset {
+	int id;
+	QByteArray key;
+	bool haveOriginalThumbnail;
+	QByteArray originalThumbnail;
+	QByteArray originalData;
+	bool haveChangedThumbnail;
+	QByteArray changedThumbnail;
+	bool haveChangedData;
+	QByteArray changedData;
+	QImage originalThumbnailImage;
+	QImage changedThumbnailImage;
+	ActiveBrush originalBrush;
+	std::optional<ActiveBrush> changedBrush;
+};
+
 struct PresetChange {
 	std::optional<QString> name;
 	std::optional<QString> description;
@@ -805,32 +841,60 @@ private:
 							  "p.thumbnail, p.data order by lower(p.name)");
 
 		if(query.exec(sql, params)) {
+			QVector<PendingPreset> pendingPresets;
 			while(query.next()) {
 				CachedPreset cp;
-				readPreset(cp, query);
+				readPresetText(cp, query);
 				parseGroupedTagIds(query.columnText16(9), cp.tagIds);
+				PendingPreset pp = readPendingPreset(cp.id, query);
+				if(!isDecoded(pp)) {
+					pendingPresets.append(pp);
+				}
 				m_presetCache.append(cp);
 			}
+
+			decodePendingPresets(pendingPresets);
+			for(CachedPreset &cp : m_presetCache) {
+				assignDecodedPreset(cp, m_decodedPresets[cp.id]);
+			}
+		}
+
+		// With every preset loaded, anything not among them was deleted.
+		if(m_tagIdToFilter == ALL_ID) {
+			QSet<int> presetIds;
+			for(const CachedPreset &cp : m_presetCache) {
+				presetIds.insert(cp.id);
+			}
+			for(QHash<int, DecodedPreset>::iterator
+					it = m_decodedPresets.begin(),
+					end = m_decodedPresets.end();
+				it != end;) {
+				if(presetIds.contains(it.key())) {
+					++it;
+				} else {
+					it = m_decodedPresets.erase(it);
+				}
+			}
 		}
 	}
 
 	void readPreset(Preset &preset, drawdance::Query &query)
+	{
+		readPresetText(preset, query);
+		PendingPreset pp = readPendingPreset(preset.id, query);
+		if(!isDecoded(pp)) {
+			decodePendingPreset(pp);
+			storeDecodedPreset(pp);
+		}
+		assignDecodedPreset(preset, m_decodedPresets[preset.id]);
+	}
+
+	static void readPresetText(Preset &preset, drawdance::Query &query)
 	{
 		preset.id = query.columnInt(0);
 		preset.originalName = query.columnText16(1);
 		preset.originalDescription = query.columnText16(2);
 
-		QPixmap pixmap;
-		if(!query.columnNull(3)) {
-			if(pixmap.loadFromData(query.columnBlob(3))) {
-				preset.originalThumbnail = pixmap;
-			} else {
-				qWarning("Error loading thumbnail for preset %d", preset.id);
-			}
-		}
-
-		preset.originalBrush = loadBrush(preset.id, query.columnBlob(4));
-
 		if(!query.columnNull(5)) {
 			preset.changedName = query.columnText16(5);
 		}
@@ -838,21 +902,127 @@ private:
 		if(!query.columnNull(6)) {
 			preset.changedDescription = query.columnText16(6);
 		}
+	}
 
-		if(!query.columnNull(7)) {
-			if(pixmap.loadFromData(query.columnBlob(7))) {
-				preset.changedThumbnail = pixmap;
-			} else {
-				qWarning(
-					"Error loading changed thumbnail for preset %d", preset.id);
+	static void assignDecodedPreset(Preset &preset, const DecodedPreset &dp)
+	{
+		preset.originalThumbnail = dp.originalThumbnail;
+		preset.originalBrush = dp.originalBrush;
+		preset.changedThumbnail = dp.changedThumbnail;
+		preset.changedBrush = dp.changedBrush;
+	}
+
+	static PendingPreset readPendingPreset(int presetId, drawdance::Query &query)
+	{
+		PendingPreset pp;
+		pp.id = presetId;
+		pp.haveOriginalThumbnail = !query.columnNull(3);
+		pp.originalThumbnail = query.columnBlob(3);
+		pp.originalData = query.columnBlob(4);
+		pp.haveChangedThumbnail = !query.columnNull(7);
+		pp.changedThumbnail = query.columnBlob(7);
+		pp.haveChangedData = !query.columnNull(8);
+		pp.changedData = query.columnBlob(8);
+
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		addBlobToHash(hash, pp.haveOriginalThumbnail, pp.originalThumbnail);
+		addBlobToHash(hash, true, pp.originalData);
+		addBlobToHash(hash, pp.haveChangedThumbnail, pp.changedThumbnail);
+		addBlobToHash(hash, pp.haveChangedData, pp.changedData);
+		pp.key = hash.result();
+		return pp;
+	}
+
+	bool isDecoded(const PendingPreset &pp) const
+	{
+		QHash<int, DecodedPreset>::const_iterator it =
+			m_decodedPresets.constFind(pp.id);
+		return it != m_decodedPresets.constEnd() && it->key == pp.key;
+	}
+
+	// Doesn't touch any shared state, so that it can run on worker threads.
+	static void decodePendingPreset(PendingPreset &pp)
+	{
+		if(pp.haveOriginalThumbnail &&
+		   !pp.originalThumbnailImage.loadFromData(pp.originalThumbnail)) {
+			qWarning("Error loading thumbnail for preset %d", pp.id);
+		}
+
+		pp.originalBrush = loadBrush(pp.id, pp.originalData);
+
+		if(pp.haveChangedThumbnail &&
+		   !pp.changedThumbnailImage.loadFromData(pp.changedThumbnail)) {
+			qWarning("Error loading changed thumbnail for preset %d", pp.id);
+		}
+
+		if(pp.haveChangedData) {
+			pp.changedBrush = loadBrush(pp.id, pp.changedData);
+		}
+	}
+
+	static void decodePendingPresetJob(void *element, int threadIndex)
+	{
+		Q_UNUSED(threadIndex);
+		decodePendingPreset(**static_cast<PendingPreset **>(element));
+	}
+
+	// Decoding thousands of PNGs and brush JSON documents is what takes the
+	// longest when loading presets at startup, so spread it across threads.
+	void decodePendingPresets(QVector<PendingPreset> &pendingPresets)
+	{
+		int count = pendingPresets.size();
+		DP_Worker *worker =
+			count < PARALLEL_DECODE_MIN_PRESETS
+				? nullptr
+				: DP_worker_new(
+					  size_t(count), sizeof(PendingPreset *),
+					  DP_worker_cpu_count(16), decodePendingPresetJob);
+		if(worker) {
+			for(int i = 0; i < count; ++i) {
+				PendingPreset *pp = &pendingPresets[i];
+				DP_worker_push(worker, &pp);
+			}
+			DP_worker_free_join(worker);
+		} else {
+			for(int i = 0; i < count; ++i) {
+				decodePendingPreset(pendingPresets[i]);
 			}
 		}
 
-		if(!query.columnNull(8)) {
-			preset.changedBrush = loadBrush(preset.id, query.columnBlob(8));
+		for(int i = 0; i < count; ++i) {
+			storeDecodedPreset(pendingPresets[i]);
 		}
 	}
 
+	void storeDecodedPreset(const PendingPreset &pp)
+	{
+		DecodedPreset &dp = m_decodedPresets[pp.id];
+		dp.key = pp.key;
+		if(pp.originalThumbnailImage.isNull()) {
+			dp.originalThumbnail = QPixmap();
+		} else {
+			dp.originalThumbnail = QPixmap::fromImage(pp.originalThumbnailImage);
+		}
+		dp.originalBrush = pp.originalBrush;
+		if(pp.changedThumbnailImage.isNull()) {
+			dp.changedThumbnail.reset();
+		} else {
+			dp.changedThumbnail = QPixmap::fromImage(pp.changedThumbnailImage);
+		}
+		dp.changedBrush = pp.changedBrush;
+	}
+
+	static void addBlobToHash(
+		QCryptographicHash &hash, bool present, const QByteArray &blob)
+	{
+		// Length prefix, so that different splits of the same bytes between
+		// columns don't end up with the same hash.
+		qint64 length = present ? qint64(blob.size()) : qint64(-1);
+		hash.addData(QByteArray::fromRawData(
+			reinterpret_cast<const char *>(&length), int(sizeof(length))));
+		hash.addData(blob);
+	}
+
 	static QString getActionName(const QKeySequence &shortcut)
 	{
 		return QStringLiteral("__brushshortcut_%1")
@@ -1024,6 +1194,7 @@ private:
 	QHash<int, PresetChange> m_presetChanges;
 	QVector<CachedTag> m_tagCache;
 	QVector<CachedPreset> m_presetCache;
+	QHash<int, DecodedPreset> m_decodedPresets;
 	PresetShortcutMap m_presetShortcuts;
 	BrushPresetModel *m_presetModel = nullptr;
 	int m_presetIconSize = BrushPresetModel::THUMBNAIL_SIZE;
@@ -103,6 +103,8 @@ CanvasModel::CanvasModel(
 	settings.bindEngineFrameRate(m_paintengine, &PaintEngine::setFps);
 	settings.bindEngineSnapshotCount(
 		m_paintengine, &PaintEngine::setSnapshotMaxCount);
+	settings.bindEngineSnapshotMaxMemory(
+		m_paintengine, &PaintEngine::setSnapshotMaxMemoryMiB);
 	settings.bindEngineSnapshotInterval(this, [this](int minDelaySec) {
 		m_paintengine->setSnapshotMinDelayMs(minDelaySec * 1000LL);
 	});
@@ -203,9 +205,12 @@ void CanvasModel::disconnectedFromServer()
 	emit compatibilityModeChanged(m_compatibilityMode);
 }
 
-void CanvasModel::handleCommands(int count, const net::Message *msgs)
+void CanvasModel::handleCommands(
+	int count, const net::Message *msgs, bool mayContainMeta)
 {
-	handleMetaMessages(count, msgs);
+	if(mayContainMeta) {
+		handleMetaMessages(count, msgs);
+	}
 	if(m_paintengine->receiveMessages(false, count, msgs) != 0 && !m_dirty &&
 	   net::anyMessageDirtiesCanvas(count, msgs)) {
 		emit canvasModified();
@@ -151,7 +151,8 @@ public:
 	void resetCanvas();
 
 	//! Handle a meta/command message received from the server
-	void handleCommands(int count, const net::Message *msgs);
+	void handleCommands(
+		int count, const net::Message *msgs, bool mayContainMeta = true);
 
 	//! Handle a local drawing command (will be put in the local fork)
 	void handleLocalCommands(int count, const net::Message *msgs);
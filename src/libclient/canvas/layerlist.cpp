@@ -11,6 +11,7 @@ extern "C" {
 #include <QImage>
 #include <QRegularExpression>
 #include <QStringList>
+#include <algorithm>
 
 namespace canvas {
 
@@ -621,6 +622,111 @@ static int getAutoselect(
 	return -1;
 }
 
+static bool isSameItemContent(const LayerListItem &a, const LayerListItem &b)
+{
+	// Everything except for the position in the tree.
+	return a.id == b.id && a.title == b.title && a.color == b.color &&
+		   a.opacity == b.opacity && a.blend == b.blend &&
+		   a.sketchOpacity == b.sketchOpacity && a.sketchTint == b.sketchTint &&
+		   a.hidden == b.hidden && a.censoredRemote == b.censoredRemote &&
+		   a.censoredLocal == b.censoredLocal && a.revealed == b.revealed &&
+		   a.isolated == b.isolated && a.clip == b.clip &&
+		   a.alphaLock == b.alphaLock && a.group == b.group &&
+		   a.children == b.children;
+}
+
+// Number of items in the subtree of the given item, including itself.
+static int getSubtreeSize(const LayerListItem &item)
+{
+	return (item.right - item.left + 1) / 2;
+}
+
+// Index of the parent group of each item, -1 for top-level items.
+static QVector<int> getParents(const QVector<LayerListItem> &items)
+{
+	int count = items.size();
+	QVector<int> parents;
+	parents.reserve(count);
+	QVector<int> groups;
+	for(int i = 0; i < count; ++i) {
+		const LayerListItem &item = items[i];
+		while(!groups.isEmpty() && items[groups.last()].right < item.left) {
+			groups.removeLast();
+		}
+		parents.append(groups.isEmpty() ? -1 : groups.last());
+		if(item.group) {
+			groups.append(i);
+		}
+	}
+	return parents;
+}
+
+static bool isSamePosition(
+	const QVector<LayerListItem> &aItems, const QVector<int> &aParents, int a,
+	const QVector<LayerListItem> &bItems, const QVector<int> &bParents, int b)
+{
+	if(aItems[a].id != bItems[b].id) {
+		return false;
+	}
+	int aParent = aParents[a];
+	int bParent = bParents[b];
+	if(aParent < 0 || bParent < 0) {
+		return aParent == bParent;
+	} else {
+		return aItems[aParent].id == bItems[bParent].id;
+	}
+}
+
+// Looks for a run of sibling subtrees in the longer list that leaves exactly
+// the shorter list when taken out. That's what adding or deleting layers looks
+// like, which is the only kind of structural change that happens frequently.
+static bool findInsertedBlock(
+	const QVector<LayerListItem> &shorterItems,
+	const QVector<int> &shorterParents,
+	const QVector<LayerListItem> &longerItems,
+	const QVector<int> &longerParents, int &outStart, int &outRows)
+{
+	int shorterCount = shorterItems.size();
+	int blockCount = longerItems.size() - shorterCount;
+	Q_ASSERT(blockCount > 0);
+
+	int start = 0;
+	while(start < shorterCount &&
+		  isSamePosition(
+			  shorterItems, shorterParents, start, longerItems, longerParents,
+			  start)) {
+		++start;
+	}
+
+	for(int i = start; i < shorterCount; ++i) {
+		if(!isSamePosition(
+			   shorterItems, shorterParents, i, longerItems, longerParents,
+			   i + blockCount)) {
+			return false;
+		}
+	}
+
+	int end = start + blockCount;
+	int parent = longerParents[start];
+	int rows = 0;
+	int i = start;
+	while(i < end) {
+		if(longerParents[i] != parent) {
+			return false;
+		}
+		i += getSubtreeSize(longerItems[i]);
+		++rows;
+	}
+
+	if(i == end) {
+		outStart = start;
+		outRows = rows;
+		return true;
+	} else {
+		return false;
+	}
+}
+
 void LayerListModel::setLayers(
 	const drawdance::LayerPropsList &lpl, const QSet<int> &revealedLayers)
 {
@@ -651,15 +757,12 @@ void LayerListModel::setLayers(
 		}
 	}
 
-	beginResetModel();
-	m_rootLayerCount = lpl.count();
-	m_items = newItems;
-	if(m_checkMode) {
-		m_checkStates = checkStates;
-	}
-	endResetModel();
+	bool reset = updateItems(newItems, checkStates, lpl.count());
 
 	emit layersChanged(m_items);
+	if(!reset) {
+		emit layersUpdated();
+	}
 	if(m_fillSourceLayerId != 0 && !layerIndex(m_fillSourceLayerId).isValid()) {
 		m_fillSourceLayerId = 0;
 		emit fillSourceSet(0);
@@ -676,6 +779,184 @@ void LayerListModel::setLayers(
 	}
 }
 
+bool LayerListModel::updateItems(
+	const QVector<LayerListItem> &newItems,
+	const QHash<int, CheckState> &checkStates, int rootLayerCount)
+{
+	// The view holds on to persistent indexes for the expanded groups and the
+	// selection, so resetting the model on every little change is costly and
+	// makes the layer list flicker. Instead, figure out what changed and only
+	// signal that. Anything more complicated just falls back to a reset.
+	QVector<LayerListItem> oldItems = m_items;
+	QHash<int, CheckState> oldCheckStates = m_checkStates;
+	QVector<int> oldParents = getParents(oldItems);
+	QVector<int> newParents = getParents(newItems);
+	int oldCount = oldItems.size();
+	int newCount = newItems.size();
+
+	QHash<int, int> oldPositions;
+	oldPositions.reserve(oldCount);
+	for(int i = 0; i < oldCount; ++i) {
+		oldPositions.insert(oldItems[i].id, i);
+	}
+
+	bool sameStructure = oldCount == newCount;
+	for(int i = 0; sameStructure && i < newCount; ++i) {
+		sameStructure =
+			isSamePosition(oldItems, oldParents, i, newItems, newParents, i);
+	}
+
+	int blockStart = 0;
+	int blockRows = 0;
+	int changedParent = -2;
+	if(sameStructure) {
+		replaceItems(newItems, checkStates, rootLayerCount);
+	} else if(
+		newCount > oldCount &&
+		findInsertedBlock(
+			oldItems, oldParents, newItems, newParents, blockStart,
+			blockRows)) {
+		changedParent = newParents[blockStart];
+		int first = newItems[blockStart].relIndex;
+		beginInsertRows(
+			changedParent < 0
+				? QModelIndex()
+				: createIndex(
+					  oldItems[changedParent].relIndex, 0, changedParent),
+			first, first + blockRows - 1);
+		replaceItems(newItems, checkStates, rootLayerCount);
+		shiftPersistentIndexes(blockStart, newCount - oldCount);
+		endInsertRows();
+	} else if(
+		newCount < oldCount &&
+		findInsertedBlock(
+			newItems, newParents, oldItems, oldParents, blockStart,
+			blockRows)) {
+		changedParent = oldParents[blockStart];
+		int first = oldItems[blockStart].relIndex;
+		beginRemoveRows(
+			changedParent < 0
+				? QModelIndex()
+				: createIndex(
+					  oldItems[changedParent].relIndex, 0, changedParent),
+			first, first + blockRows - 1);
+		replaceItems(newItems, checkStates, rootLayerCount);
+		// Indexes into the removed rows get invalidated by Qt.
+		shiftPersistentIndexes(
+			blockStart + oldCount - newCount, newCount - oldCount);
+		endRemoveRows();
+	} else if(
+		oldCount == newCount &&
+		std::all_of(
+			newItems.constBegin(), newItems.constEnd(),
+			[&oldPositions](const LayerListItem &item) {
+				return oldPositions.contains(item.id);
+			})) {
+		// Layers were moved around, but none were added or removed.
+		emit layoutAboutToBeChanged();
+		replaceItems(newItems, checkStates, rootLayerCount);
+		QHash<int, int> newPositions;
+		newPositions.reserve(newCount);
+		for(int i = 0; i < newCount; ++i) {
+			newPositions.insert(newItems[i].id, i);
+		}
+		QModelIndexList fromIndexes = persistentIndexList();
+		QModelIndexList toIndexes;
+		toIndexes.reserve(fromIndexes.size());
+		for(const QModelIndex &from : fromIndexes) {
+			int i = newPositions.value(oldItems[from.internalId()].id);
+			toIndexes.append(createIndex(newItems[i].relIndex, 0, i));
+		}
+		changePersistentIndexList(fromIndexes, toIndexes);
+		emit layoutChanged();
+		return false;
+	} else {
+		beginResetModel();
+		replaceItems(newItems, checkStates, rootLayerCount);
+		endResetModel();
+		return true;
+	}
+
+	// Some roles depend on the parent groups or the siblings, so changes to
+	// those have to be signalled for those items too.
+	QVector<bool> changed(newCount, false);
+	for(int i = 0; i < newCount; ++i) {
+		const LayerListItem &item = newItems[i];
+		int oldPos = oldPositions.value(item.id, -1);
+		if(oldPos < 0) {
+			continue; // Newly inserted, the view already knows about it.
+		}
+
+		const LayerListItem &oldItem = oldItems[oldPos];
+		bool contentChanged = !isSameItemContent(oldItem, item);
+		if(contentChanged ||
+		   (m_checkMode && oldCheckStates.value(item.id, Unchecked) !=
+							   checkStates.value(item.id, Unchecked))) {
+			changed[i] = true;
+		}
+
+		if(contentChanged) {
+			if(item.group) {
+				int end = i + getSubtreeSize(item);
+				for(int j = i + 1; j < end; ++j) {
+					changed[j] = true;
+				}
+			}
+			if(oldItem.clip != item.clip || oldItem.isolated != item.isolated) {
+				for(int j = 0; j < newCount; ++j) {
+					if(newParents[j] == newParents[i]) {
+						changed[j] = true;
+					}
+				}
+			}
+		}
+	}
+
+	// Siblings of inserted or removed items may have become (un)clippable.
+	if(changedParent != -2) {
+		for(int i = 0; i < newCount; ++i) {
+			if(newParents[i] == changedParent &&
+			   oldPositions.contains(newItems[i].id)) {
+				changed[i] = true;
+			}
+		}
+	}
+
+	for(int i = 0; i < newCount; ++i) {
+		if(changed[i]) {
+			QModelIndex idx = createIndex(newItems[i].relIndex, 0, i);
+			emit dataChanged(idx, idx);
+		}
+	}
+	return false;
+}
+
+void LayerListModel::replaceItems(
+	const QVector<LayerListItem> &newItems,
+	const QHash<int, CheckState> &checkStates, int rootLayerCount)
+{
+	m_rootLayerCount = rootLayerCount;
+	m_items = newItems;
+	if(m_checkMode) {
+		m_checkStates = checkStates;
+	}
+}
+
+void LayerListModel::shiftPersistentIndexes(int start, int offset)
+{
+	QModelIndexList fromIndexes;
+	QModelIndexList toIndexes;
+	const QModelIndexList persistentIndexes = persistentIndexList();
+	for(const QModelIndex &from : persistentIndexes) {
+		int i = int(from.internalId());
+		if(i >= start) {
+			fromIndexes.append(from);
+			toIndexes.append(createIndex(from.row(), 0, i + offset));
+		}
+	}
+	changePersistentIndexList(fromIndexes, toIndexes);
+}
+
 void LayerListModel::setLayersVisibleInFrame(
 	const QSet<int> &layers, int viewMode)
 {
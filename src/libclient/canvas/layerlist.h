@@ -265,6 +265,9 @@ public slots:
 signals:
 	void layersChanged(const QVector<LayerListItem> &items);
 
+	//! Layers changed, but with granular model signals instead of a reset
+	void layersUpdated();
+
 	//! A new layer was created that should be automatically selected
 	void autoSelectRequest(int);
 
@@ -286,6 +289,17 @@ private:
 		const QSet<int> &takenIds, const QVector<int> &takenPerUser,
 		unsigned int contextId) const;
 
+	// Returns true if the model had to be reset.
+	bool updateItems(
+		const QVector<LayerListItem> &newItems,
+		const QHash<int, CheckState> &checkStates, int rootLayerCount);
+
+	void replaceItems(
+		const QVector<LayerListItem> &newItems,
+		const QHash<int, CheckState> &checkStates, int rootLayerCount);
+
+	void shiftPersistentIndexes(int start, int offset);
+
 	CheckState flattenLayerList(
 		QVector<LayerListItem> &newItems, QHash<int, CheckState> &checkStates,
 		int &index, const drawdance::LayerPropsList &lpl,
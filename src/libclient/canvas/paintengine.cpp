@@ -2,8 +2,11 @@
 extern "C" {
 #include <dpcommon/threading.h>
 #include <dpengine/layer_routes.h>
+#include <dpengine/memory_report.h>
 #include <dpengine/paint_engine.h>
+#include <dpengine/pixels.h>
 #include <dpengine/recorder.h>
+#include <dpengine/snapshots.h>
 #include <dpengine/tile.h>
 #include <dpmsg/msg_internal.h>
 }
@@ -18,7 +21,9 @@ extern "C" {
 #include "libclient/net/message.h"
 #include "libclient/settings.h"
 #include "libshared/util/qtcompat.h"
+#include <QLoggingCategory>
 #include <QPainter>
+#include <QPointer>
 #include <QSet>
 #include <QTimer>
 #include <QtEndian>
@@ -31,6 +36,9 @@ extern "C" {
 
 #define DP_PERF_CONTEXT "paint_engine"
 
+Q_LOGGING_CATEGORY(
+	lcDpPaintEngine, "net.drawpile.canvas.paintengine", QtWarningMsg)
+
 static DP_Rect toDpRect(const QRect &canvasViewTileArea)
 {
 	DP_Rect tileBounds = {
@@ -60,6 +68,7 @@ PaintEngine::PaintEngine(
 		  checkerColor1, checkerColor2, Qt::transparent,
 		  m_useTileCache ? PaintEngine::onRenderTileToTileCache
 						 : PaintEngine::onRenderTileToPixmap,
+		  m_useTileCache ? PaintEngine::onRenderTileSlotTileCache : nullptr,
 		  PaintEngine::onRenderUnlock,
 		  m_useTileCache ? PaintEngine::onRenderResizeTileCache
 						 : PaintEngine::onRenderResizePixmap,
@@ -68,6 +77,7 @@ PaintEngine::PaintEngine(
 		  this)
 	, m_fps{fps}
 	, m_timerId{0}
+	, m_modelUpdateTickInterval{1}
 	, m_cacheMutex{nullptr}
 	, m_viewSem{nullptr}
 	, m_sampleColorLastDiameter(-1)
@@ -110,6 +120,11 @@ void PaintEngine::setSnapshotMaxCount(int snapshotMaxCount)
 	m_snapshotQueue.setMaxCount(snapshotMaxCount);
 }
 
+void PaintEngine::setSnapshotMaxMemoryMiB(int snapshotMaxMemoryMiB)
+{
+	m_snapshotQueue.setMaxBytes(snapshotMaxMemoryMiB * 1024LL * 1024LL);
+}
+
 void PaintEngine::setSnapshotMinDelayMs(long long snapshotMinDelayMs)
 {
 	m_snapshotQueue.setMinDelayMs(snapshotMinDelayMs);
@@ -127,6 +142,9 @@ void PaintEngine::start()
 	}
 	int fps = qBound(1, m_fps, 120);
 	m_timerId = startTimer(1000 / fps, Qt::PreciseTimer);
+	// At or below the maximum model update rate, every tick delivers.
+	m_modelUpdateTickInterval =
+		(fps + MAX_MODEL_UPDATE_FPS - 1) / MAX_MODEL_UPDATE_FPS;
 }
 
 void PaintEngine::reset(
@@ -137,12 +155,16 @@ void PaintEngine::reset(
 		m_acls, m_snapshotQueue, localUserId, !m_useTileCache,
 		m_useTileCache ? PaintEngine::onRenderTileToTileCache
 					   : PaintEngine::onRenderTileToPixmap,
+		m_useTileCache ? PaintEngine::onRenderTileSlotTileCache : nullptr,
 		PaintEngine::onRenderUnlock,
 		m_useTileCache ? PaintEngine::onRenderResizeTileCache
 					   : PaintEngine::onRenderResizePixmap,
 		this, ON_SOFT_RESET_FN, this, PaintEngine::onPlayback,
 		PaintEngine::onDumpPlayback, this, PaintEngine::onStreamResetStart,
 		this, canvasState, player);
+	// Whatever is still pending belongs to the old state, but models keep the
+	// order of updates they see, so deliver it rather than dropping it.
+	flushPendingModels();
 	DP_mutex_lock(m_cacheMutex);
 	if(m_useTileCache) {
 		m_cache.tile->clear();
@@ -161,7 +183,6 @@ void PaintEngine::reset(
 void PaintEngine::timerEvent(QTimerEvent *)
 {
 	DP_PERF_SCOPE("tick");
-	m_revealedLayers.clear();
 	DP_paint_engine_tick(
 		m_paintEngine.get(), toDpRect(m_canvasViewTileArea),
 		m_renderOutsideView, &PaintEngine::onCatchup,
@@ -175,11 +196,86 @@ void PaintEngine::timerEvent(QTimerEvent *)
 	if(m_tileCacheDirtyCheckOnTick && m_cache.tile->needsDirtyCheck()) {
 		emit tileCacheDirtyCheckNeeded();
 	}
+	if(m_ticksSinceModelUpdate < m_modelUpdateTickInterval) {
+		++m_ticksSinceModelUpdate;
+	}
+	if(m_flushModelsOnTick ||
+	   m_ticksSinceModelUpdate >= m_modelUpdateTickInterval) {
+		flushPendingModels();
+	}
+	if(m_flushModelsOnTick) {
+		m_flushModelsOnTick = false;
+		logModelUpdateStats();
+	}
+}
+
+bool PaintEngine::setModelPending(PendingModel model)
+{
+	bool wasPending = m_pendingModels & model;
+	m_pendingModels |= model;
+	return wasPending;
+}
+
+void PaintEngine::flushPendingModels()
+{
+	unsigned int pending = m_pendingModels;
+	if(pending == 0) {
+		return;
+	}
+
+	DP_PERF_SCOPE("flush_models");
+	m_pendingModels = 0;
+	m_ticksSinceModelUpdate = 0;
+	++m_modelUpdateStats.delivered;
+
+	if(pending & PendingLayerProps) {
+		drawdance::LayerPropsList lpl = std::move(m_pendingLayerProps);
+		QSet<int> revealedLayers;
+		revealedLayers.swap(m_revealedLayers);
+		emit layersChanged(lpl, revealedLayers);
+	}
+
+	if(pending & PendingAnnotations) {
+		drawdance::AnnotationList al = m_pendingAnnotations;
+		m_pendingAnnotations = drawdance::AnnotationList::noinc(nullptr);
+		emit annotationsChanged(al);
+	}
+
+	if(pending & PendingDocumentMetadata) {
+		drawdance::DocumentMetadata dm = m_pendingDocumentMetadata;
+		m_pendingDocumentMetadata = drawdance::DocumentMetadata::noinc(nullptr);
+		emit documentMetadataChanged(dm);
+	}
+
+	if(pending & PendingTimeline) {
+		drawdance::Timeline tl = std::move(m_pendingTimeline);
+		emit timelineChanged(tl);
+	}
+
+	if(pending & PendingSelections) {
+		drawdance::SelectionSet ss = m_pendingSelections;
+		m_pendingSelections = drawdance::SelectionSet::null();
+		emit selectionsChanged(ss);
+	}
+
 	if(m_updateLayersVisibleInFrame) {
 		updateLayersVisibleInFrame();
 	}
 }
 
+void PaintEngine::logModelUpdateStats() const
+{
+	const ModelUpdateStats &stats = m_modelUpdateStats;
+	qCDebug(
+		lcDpPaintEngine,
+		"Model updates: %lld delivered, skipped %lld layer props, "
+		"%lld annotations, %lld document metadata, %lld timeline, "
+		"%lld selections",
+		stats.delivered, stats.layerPropsSkipped, stats.annotationsSkipped,
+		stats.documentMetadataSkipped, stats.timelineSkipped,
+		stats.selectionsSkipped);
+}
+
 void PaintEngine::updateLayersVisibleInFrame()
 {
 	m_updateLayersVisibleInFrame = false;
@@ -196,6 +292,42 @@ int PaintEngine::receiveMessages(
 		&PaintEngine::onLaserTrail, &PaintEngine::onMovePointer, this);
 }
 
+int PaintEngine::queuedMessageCount() const
+{
+	return m_paintEngine.queuedMessageCount();
+}
+
+DP_PaintEngineQueueStatistics PaintEngine::queueStatistics() const
+{
+	return m_paintEngine.queueStatistics();
+}
+
+DP_RendererStatistics PaintEngine::renderStatistics() const
+{
+	return m_paintEngine.renderStatistics();
+}
+
+void PaintEngine::requestMemoryReport()
+{
+	DP_MemoryReport *mr = DP_memory_report_new();
+	DP_paint_engine_memory_report_add_view(m_paintEngine.get(), mr);
+	DP_snapshot_queue_memory_report_add(m_snapshotQueue.get(), mr);
+	QPointer<PaintEngine> *target = new QPointer<PaintEngine>(this);
+	net::Message msg = net::makeInternalMemoryReportMessage(
+		0, mr, &PaintEngine::onMemoryReport, target);
+	if(receiveMessages(false, 1, &msg) == 0) {
+		DP_memory_report_free(mr);
+		delete target;
+	}
+}
+
+void PaintEngine::trimMemory()
+{
+	size_t snapshots = DP_snapshot_queue_trim(m_snapshotQueue.get());
+	qInfo("Trimming memory, evicted %zu reset snapshot(s)", snapshots);
+	DP_paint_engine_trim_memory(m_paintEngine.get());
+}
+
 void PaintEngine::enqueueReset()
 {
 	net::Message msg = net::makeInternalResetMessage(0);
@@ -529,6 +661,21 @@ bool PaintEngine::checkersVisible() const
 QColor PaintEngine::sampleColor(int x, int y, int layerId, int diameter)
 {
 	if(layerId == 0) {
+		// Picking single pixels happens continuously while dragging, so read
+		// those straight out of the cache if possible instead of making an
+		// image out of them every time.
+		if(diameter < 2 && m_useTileCache) {
+			DP_Pixel8 pixel;
+			DP_mutex_lock(m_cacheMutex);
+			bool havePixel = m_cache.tile->pixelAt(x, y, pixel);
+			DP_mutex_unlock(m_cacheMutex);
+			if(havePixel) {
+				DP_UPixelFloat color =
+					DP_upixel8_to_float(DP_pixel8_unpremultiply(pixel));
+				return QColor::fromRgbF(color.r, color.g, color.b, color.a);
+			}
+		}
+
 		// Only extract the part of the pixmap that we want to sample from,
 		// since grabbing the whole thing is pretty slow.
 		QPoint pos;
@@ -741,10 +888,12 @@ void PaintEngine::clearCutPreview()
 
 void PaintEngine::previewTransform(
 	int id, int layerId, int blendMode, qreal opacity, int x, int y,
-	const QImage &img, const QPolygon &dstPolygon, int interpolation)
+	const QImage &img, const QPolygon &dstPolygon, int interpolation,
+	bool reduced)
 {
 	m_paintEngine.previewTransform(
-		id, layerId, blendMode, opacity, x, y, img, dstPolygon, interpolation);
+		id, layerId, blendMode, opacity, x, y, img, dstPolygon, interpolation,
+		reduced);
 }
 
 void PaintEngine::clearTransformPreview(int id)
@@ -811,15 +960,17 @@ void PaintEngine::setCanvasViewArea(const QRect &area)
 	// We can't use QPoint::operator/ because that rounds instead of truncates.
 	setCanvasViewTileArea(QRect(
 		QPoint(area.left() / DP_TILE_SIZE, area.top() / DP_TILE_SIZE),
-		QPoint(area.right() / DP_TILE_SIZE, area.bottom() / DP_TILE_SIZE)));
+		QPoint(area.right() / DP_TILE_SIZE, area.bottom() / DP_TILE_SIZE)),
+		1.0);
 }
 
-void PaintEngine::setCanvasViewTileArea(const QRect &canvasViewTileArea)
+void PaintEngine::setCanvasViewTileArea(
+	const QRect &canvasViewTileArea, qreal zoom)
 {
 	m_canvasViewTileArea = canvasViewTileArea;
 	DP_paint_engine_change_bounds(
 		m_paintEngine.get(), toDpRect(m_canvasViewTileArea),
-		m_renderOutsideView);
+		m_renderOutsideView, zoom);
 	DP_SEMAPHORE_MUST_WAIT(m_viewSem);
 	if(m_tileCacheDirtyCheckOnTick) {
 		emit tileCacheDirtyCheckNeeded();
@@ -949,6 +1100,28 @@ void PaintEngine::onUndoDepthLimitSet(void *user, int undoDepthLimit)
 	emit pe->undoDepthLimitSet(undoDepthLimit);
 }
 
+void PaintEngine::onMemoryReport(void *user, DP_MemoryReport *mrOrNull)
+{
+	QPointer<PaintEngine> *target = static_cast<QPointer<PaintEngine> *>(user);
+	// Computing the report may take a moment on large canvases with a lot of
+	// history, so it's done on the main thread instead of stalling painting.
+	// If the paint engine goes away before that, the report just gets dropped.
+	if(mrOrNull && !target->isNull()) {
+		QSharedPointer<DP_MemoryReport> report(
+			mrOrNull, DP_memory_report_free);
+		QMetaObject::invokeMethod(
+			target->data(),
+			[pe = target->data(), report] {
+				DP_memory_report_compute(report.data());
+				emit pe->memoryReportReady(report);
+			},
+			Qt::QueuedConnection);
+	} else {
+		DP_memory_report_free(mrOrNull);
+	}
+	delete target;
+}
+
 void PaintEngine::onCensoredLayerRevealed(void *user, int layerId)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
@@ -958,6 +1131,10 @@ void PaintEngine::onCensoredLayerRevealed(void *user, int layerId)
 void PaintEngine::onCatchup(void *user, int progress)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
+	// Don't leave the models lagging behind once catchup is done.
+	if(progress >= 100) {
+		pe->m_flushModelsOnTick = true;
+	}
 	emit pe->caughtUpTo(progress);
 }
 
@@ -977,36 +1154,49 @@ void PaintEngine::onLayerPropsChanged(void *user, DP_LayerPropsList *lpl)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
 	pe->m_updateLayersVisibleInFrame = true;
-	emit pe->layersChanged(
-		drawdance::LayerPropsList::inc(lpl), pe->m_revealedLayers);
+	if(pe->setModelPending(PendingLayerProps)) {
+		++pe->m_modelUpdateStats.layerPropsSkipped;
+	}
+	pe->m_pendingLayerProps = drawdance::LayerPropsList::inc(lpl);
 }
 
 void PaintEngine::onAnnotationsChanged(void *user, DP_AnnotationList *al)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	emit pe->annotationsChanged(drawdance::AnnotationList::inc(al));
+	if(pe->setModelPending(PendingAnnotations)) {
+		++pe->m_modelUpdateStats.annotationsSkipped;
+	}
+	pe->m_pendingAnnotations = drawdance::AnnotationList::inc(al);
 }
 
 void PaintEngine::onDocumentMetadataChanged(void *user, DP_DocumentMetadata *dm)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
 	pe->m_updateLayersVisibleInFrame = true;
-	emit pe->documentMetadataChanged(drawdance::DocumentMetadata::inc(dm));
+	if(pe->setModelPending(PendingDocumentMetadata)) {
+		++pe->m_modelUpdateStats.documentMetadataSkipped;
+	}
+	pe->m_pendingDocumentMetadata = drawdance::DocumentMetadata::inc(dm);
 }
 
 void PaintEngine::onTimelineChanged(void *user, DP_Timeline *tl)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
 	pe->m_updateLayersVisibleInFrame = true;
-	emit pe->timelineChanged(drawdance::Timeline::inc(tl));
+	if(pe->setModelPending(PendingTimeline)) {
+		++pe->m_modelUpdateStats.timelineSkipped;
+	}
+	pe->m_pendingTimeline = drawdance::Timeline::inc(tl);
 }
 
 void PaintEngine::onSelectionsChanged(void *user, DP_SelectionSet *ssOrNull)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	emit pe->selectionsChanged(
-		ssOrNull ? drawdance::SelectionSet::inc(ssOrNull)
-				 : drawdance::SelectionSet::null());
+	if(pe->setModelPending(PendingSelections)) {
+		++pe->m_modelUpdateStats.selectionsSkipped;
+	}
+	pe->m_pendingSelections = ssOrNull ? drawdance::SelectionSet::inc(ssOrNull)
+									   : drawdance::SelectionSet::null();
 }
 
 void PaintEngine::onCursorMoved(
@@ -1018,22 +1208,26 @@ void PaintEngine::onCursorMoved(
 }
 
 void PaintEngine::onRenderTileToPixmap(
-	void *user, int tileX, int tileY, DP_Pixel8 *pixels)
+	void *user, int tileX, int tileY, DP_Pixel8 *pixels, DP_Rect rect)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
 	DP_mutex_lock(pe->m_cacheMutex);
-	QRect area = pe->m_cache.pixmap->render(tileX, tileY, pixels);
+	QRect area = pe->m_cache.pixmap->render(
+		tileX, tileY, pixels,
+		QRect(QPoint(rect.x1, rect.y1), QPoint(rect.x2, rect.y2)));
 	DP_mutex_unlock(pe->m_cacheMutex);
 	emit pe->areaChanged(area);
 }
 
 void PaintEngine::onRenderTileToTileCache(
-	void *user, int tileX, int tileY, DP_Pixel8 *pixels)
+	void *user, int tileX, int tileY, DP_Pixel8 *pixels, DP_Rect rect)
 {
+	// The cache mutex was locked in onRenderTileSlotTileCache, since the
+	// renderer may have written the pixels into the cache directly.
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	DP_mutex_lock(pe->m_cacheMutex);
-	TileCache::RenderResult result =
-		pe->m_cache.tile->render(tileX, tileY, pixels);
+	TileCache::RenderResult result = pe->m_cache.tile->render(
+		tileX, tileY, pixels,
+		QRect(QPoint(rect.x1, rect.y1), QPoint(rect.x2, rect.y2)));
 	if(result.dirtyCheck && !pe->m_tileCacheDirtyCheckOnTick) {
 		emit pe->tileCacheDirtyCheckNeeded();
 	}
@@ -1043,6 +1237,14 @@ void PaintEngine::onRenderTileToTileCache(
 	DP_mutex_unlock(pe->m_cacheMutex);
 }
 
+DP_Pixel8 *PaintEngine::onRenderTileSlotTileCache(
+	void *user, int tileX, int tileY, int *outWidth, int *outHeight)
+{
+	PaintEngine *pe = static_cast<PaintEngine *>(user);
+	DP_mutex_lock(pe->m_cacheMutex);
+	return pe->m_cache.tile->renderSlot(tileX, tileY, *outWidth, *outHeight);
+}
+
 void PaintEngine::onRenderUnlock(void *user)
 {
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
@@ -5,23 +5,28 @@ extern "C" {
 #include <dpengine/draw_context.h>
 }
 #include "libclient/drawdance/aclstate.h"
+#include "libclient/drawdance/annotationlist.h"
 #include "libclient/drawdance/canvashistory.h"
 #include "libclient/drawdance/canvasstate.h"
+#include "libclient/drawdance/documentmetadata.h"
+#include "libclient/drawdance/layerpropslist.h"
 #include "libclient/drawdance/paintengine.h"
 #include "libclient/drawdance/selectionset.h"
 #include "libclient/drawdance/snapshotqueue.h"
+#include "libclient/drawdance/timeline.h"
 #include <QColor>
 #include <QObject>
 #include <QPainter>
 #include <QPixmap>
 #include <QSet>
+#include <QSharedPointer>
 #include <functional>
 
+struct DP_MemoryReport;
 struct DP_Mutex;
 struct DP_Semaphore;
 
 namespace drawdance {
-class LayerPropsList;
 class ViewModeBuffer;
 }
 
@@ -37,6 +42,20 @@ class TileCache;
 class PaintEngine final : public QObject {
 	Q_OBJECT
 public:
+	// Model updates (layers, annotations, timeline etc.) are delivered at most
+	// this often, changes in between get coalesced into a single update.
+	static constexpr int MAX_MODEL_UPDATE_FPS = 30;
+
+	// How many model updates got replaced by a later one before delivery.
+	struct ModelUpdateStats {
+		long long delivered = 0;
+		long long layerPropsSkipped = 0;
+		long long annotationsSkipped = 0;
+		long long documentMetadataSkipped = 0;
+		long long timelineSkipped = 0;
+		long long selectionsSkipped = 0;
+	};
+
 	PaintEngine(
 		int canvasImplementation, const QColor &checkerColor1,
 		const QColor &checkerColor2, const QColor &selectionColor, int fps,
@@ -54,6 +73,7 @@ public:
 
 	void setFps(int fps);
 	void setSnapshotMaxCount(int snapshotMaxCount);
+	void setSnapshotMaxMemoryMiB(int snapshotMaxMemoryMiB);
 	void setSnapshotMinDelayMs(long long snapshotMinDelayMs);
 	void setWantCanvasHistoryDump(bool wantCanvasHistoryDump);
 
@@ -71,13 +91,18 @@ public:
 	void withTileCache(const std::function<void(TileCache &)> &fn);
 
 	void setCanvasViewArea(const QRect &area);
-	void setCanvasViewTileArea(const QRect &canvasViewTileArea);
+	void setCanvasViewTileArea(const QRect &canvasViewTileArea, qreal zoom);
 
 	void setRenderOutsideView(bool renderOutsideView);
 
 	//! Get the number of frames in an animated canvas
 	int frameCount() const;
 
+	const ModelUpdateStats &modelUpdateStats() const
+	{
+		return m_modelUpdateStats;
+	}
+
 	DP_ViewModeFilter viewModeFilter(
 		drawdance::ViewModeBuffer &vmb,
 		const drawdance::CanvasState &canvasState) const;
@@ -101,6 +126,21 @@ public:
 		bool local, int count, const net::Message *msgs,
 		bool overrideAcls = false);
 
+	//! Messages received, but not yet handled by the paint thread.
+	int queuedMessageCount() const;
+
+	DP_PaintEngineQueueStatistics queueStatistics() const;
+	DP_RendererStatistics renderStatistics() const;
+
+	//! Gather up the tile memory used by the canvas, its history, snapshots
+	//! and render caches. The history is added on the paint thread, so the
+	//! result arrives later via memoryReportReady, already computed.
+	void requestMemoryReport();
+
+	//! Throw away caches, snapshots and save points that can be recreated,
+	//! in response to the system running low on memory.
+	void trimMemory();
+
 	void enqueueReset();
 
 	void enqueueLoadBlank(
@@ -255,7 +295,8 @@ public:
 	void clearCutPreview();
 	void previewTransform(
 		int id, int layerId, int blendMode, qreal opacity, int x, int y,
-		const QImage &img, const QPolygon &dstPolygon, int interpolation);
+		const QImage &img, const QPolygon &dstPolygon, int interpolation,
+		bool reduced);
 	void clearTransformPreview(int id);
 	void clearAllTransformPreviews();
 	void previewDabs(int layerId, const net::MessageList &msgs);
@@ -298,6 +339,7 @@ signals:
 	void laserTrail(int userId, int persistence, uint32_t color);
 	void defaultLayer(uint16_t layerId);
 	void undoDepthLimitSet(int undoDepthLimit);
+	void memoryReportReady(const QSharedPointer<DP_MemoryReport> &report);
 
 protected:
 	void timerEvent(QTimerEvent *) override;
@@ -324,6 +366,7 @@ private:
 	static void onMovePointer(void *user, unsigned int contextId, int x, int y);
 	static void onDefaultLayer(void *user, int layerId);
 	static void onUndoDepthLimitSet(void *user, int undoDepthLimit);
+	static void onMemoryReport(void *user, DP_MemoryReport *mrOrNull);
 	static void onCensoredLayerRevealed(void *user, int layerId);
 	static void onCatchup(void *user, int progress);
 	static void onResetLockChanged(void *user, bool locked);
@@ -337,11 +380,14 @@ private:
 		void *user, unsigned int flags, unsigned int contextId, int layerId,
 		int x, int y);
 
-	static void
-	onRenderTileToPixmap(void *user, int tileX, int tileY, DP_Pixel8 *pixels);
+	static void onRenderTileToPixmap(
+		void *user, int tileX, int tileY, DP_Pixel8 *pixels, DP_Rect rect);
 
 	static void onRenderTileToTileCache(
-		void *user, int tileX, int tileY, DP_Pixel8 *pixels);
+		void *user, int tileX, int tileY, DP_Pixel8 *pixels, DP_Rect rect);
+
+	static DP_Pixel8 *onRenderTileSlotTileCache(
+		void *user, int tileX, int tileY, int *outWidth, int *outHeight);
 
 	static void onRenderUnlock(void *user);
 
@@ -353,8 +399,20 @@ private:
 		void *user, int width, int height, int prevWidth, int prevHeight,
 		int offsetX, int offsetY);
 
+	enum PendingModel {
+		PendingLayerProps = 1 << 0,
+		PendingAnnotations = 1 << 1,
+		PendingDocumentMetadata = 1 << 2,
+		PendingTimeline = 1 << 3,
+		PendingSelections = 1 << 4,
+	};
+
 	void start();
 
+	bool setModelPending(PendingModel model);
+	void flushPendingModels();
+	void logModelUpdateStats() const;
+
 	void updateLayersVisibleInFrame();
 
 	void updateSelectionColor();
@@ -368,6 +426,19 @@ private:
 	drawdance::PaintEngine m_paintEngine;
 	int m_fps;
 	int m_timerId;
+	int m_modelUpdateTickInterval;
+	int m_ticksSinceModelUpdate = 0;
+	unsigned int m_pendingModels = 0;
+	bool m_flushModelsOnTick = false;
+	drawdance::LayerPropsList m_pendingLayerProps;
+	drawdance::AnnotationList m_pendingAnnotations =
+		drawdance::AnnotationList::noinc(nullptr);
+	drawdance::DocumentMetadata m_pendingDocumentMetadata =
+		drawdance::DocumentMetadata::noinc(nullptr);
+	drawdance::Timeline m_pendingTimeline;
+	drawdance::SelectionSet m_pendingSelections =
+		drawdance::SelectionSet::null();
+	ModelUpdateStats m_modelUpdateStats;
 	QSet<int> m_revealedLayers;
 	union {
 		PixmapCache *pixmap;
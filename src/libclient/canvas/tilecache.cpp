@@ -38,10 +38,8 @@ void PixmapGrid::resize(int prevWidth, int prevHeight, int width, int height)
 
 void PixmapGrid::renderTile(const QRect &rect, const DP_Pixel8 *src)
 {
-	Q_ASSERT(rect.x() % DP_TILE_SIZE == 0);
-	Q_ASSERT(rect.y() % DP_TILE_SIZE == 0);
-	Q_ASSERT(rect.width() <= DP_TILE_SIZE);
-	Q_ASSERT(rect.height() <= DP_TILE_SIZE);
+	Q_ASSERT(rect.x() / DP_TILE_SIZE == rect.right() / DP_TILE_SIZE);
+	Q_ASSERT(rect.y() / DP_TILE_SIZE == rect.bottom() / DP_TILE_SIZE);
 	Q_ASSERT(src);
 	QPoint point = rect.topLeft();
 	for(Cell &cell : m_cells) {
@@ -53,7 +51,9 @@ void PixmapGrid::renderTile(const QRect &rect, const DP_Pixel8 *src)
 				QImage(
 					reinterpret_cast<const uchar *>(src), DP_TILE_SIZE,
 					DP_TILE_SIZE, QImage::Format_ARGB32_Premultiplied),
-				QRect(0, 0, rect.width(), rect.height()));
+				QRect(
+					rect.x() % DP_TILE_SIZE, rect.y() % DP_TILE_SIZE,
+					rect.width(), rect.height()));
 			break;
 		}
 	}
@@ -129,12 +129,16 @@ void PixmapCache::resize(int width, int height)
 	m_grid.resize(prevWidth, prevHeight, width, height);
 }
 
-QRect PixmapCache::render(int tileX, int tileY, const DP_Pixel8 *src)
+QRect PixmapCache::render(
+	int tileX, int tileY, const DP_Pixel8 *src, const QRect &dirty)
 {
 	int w = tileX < m_lastTileX ? DP_TILE_SIZE : m_lastWidth;
 	int h = tileY < m_lastTileY ? DP_TILE_SIZE : m_lastHeight;
-	QRect rect(tileX * DP_TILE_SIZE, tileY * DP_TILE_SIZE, w, h);
-	m_grid.renderTile(rect, src);
+	QRect rect = dirty.intersected(QRect(0, 0, w, h))
+					 .translated(tileX * DP_TILE_SIZE, tileY * DP_TILE_SIZE);
+	if(!rect.isEmpty()) {
+		m_grid.renderTile(rect, src);
+	}
 	return rect;
 }
 
@@ -217,6 +221,24 @@ public:
 
 	bool needsDirtyCheck() const { return m_needsDirtyCheck; }
 
+	bool checkDirtyTilesReset(const QRect &tileArea)
+	{
+		if(m_resized) {
+			return true;
+		}
+		int right = qMin(tileArea.right(), m_xtiles - 1);
+		int bottom = qMin(tileArea.bottom(), m_ytiles - 1);
+		for(int tileY = qMax(0, tileArea.top()); tileY <= bottom; ++tileY) {
+			for(int tileX = qMax(0, tileArea.left()); tileX <= right; ++tileX) {
+				if(m_dirtyTiles[tileIndex(tileX, tileY)]) {
+					return true;
+				}
+			}
+		}
+		m_needsDirtyCheck = false;
+		return false;
+	}
+
 	bool paintDirtyNavigatorTilesReset(bool all, QPixmap &cache)
 	{
 		QSize targetSize = cache.size();
@@ -248,9 +270,13 @@ public:
 
 	virtual const QVector<PixmapGrid::Cell> *pixmapCells() { return nullptr; }
 
-	virtual RenderResult render(int tileX, int tileY, const DP_Pixel8 *src) = 0;
+	virtual DP_Pixel8 *renderSlot(int, int, int &, int &) { return nullptr; }
+	virtual void setNavigatorSize(const QSize &) {}
+	virtual RenderResult render(
+		int tileX, int tileY, const DP_Pixel8 *src, const QRect &dirty) = 0;
 	virtual QImage toImage() = 0;
 	virtual QImage toSubImage(const QRect &rect) = 0;
+	virtual bool pixelAt(int, int, DP_Pixel8 &) const { return false; }
 	virtual void
 	eachDirtyTileReset(const QRect &tileArea, const OnTileFn &fn) = 0;
 
@@ -297,23 +323,50 @@ class TileCache::GlCanvasImpl : public BaseImpl {
 public:
 	~GlCanvasImpl() override { DP_free(m_pixels); }
 
-	RenderResult render(int tileX, int tileY, const DP_Pixel8 *src) override
+	DP_Pixel8 *renderSlot(
+		int tileX, int tileY, int &outWidth, int &outHeight) override
+	{
+		if(tileX >= 0 && tileX < m_xtiles && tileY >= 0 && tileY < m_ytiles) {
+			outWidth = tileX < m_lastTileX ? DP_TILE_SIZE : m_lastWidth;
+			outHeight = tileY < m_lastTileY ? DP_TILE_SIZE : m_lastHeight;
+			return pixelsAt(tileIndex(tileX, tileY));
+		} else {
+			return nullptr;
+		}
+	}
+
+	RenderResult render(
+		int tileX, int tileY, const DP_Pixel8 *src,
+		const QRect &dirty) override
 	{
 		bool plainX = tileX < m_lastTileX;
 		bool plainY = tileY < m_lastTileY;
 		int i = tileIndex(tileX, tileY);
 		DP_Pixel8 *dst = pixelsAt(i);
-		if(plainX && plainY) {
+		int w = plainX ? DP_TILE_SIZE : m_lastWidth;
+		int h = plainY ? DP_TILE_SIZE : m_lastHeight;
+		QRect r = dirty.intersected(QRect(0, 0, w, h));
+		if(r.isEmpty()) {
+			return RenderResult();
+		} else if(src == dst) {
+			// The renderer wrote directly into our slot, nothing to copy.
+		} else if(r.width() == DP_TILE_SIZE && r.height() == DP_TILE_SIZE) {
 			memcpy(dst, src, DP_TILE_LENGTH * sizeof(*dst));
 		} else {
-			int w = plainX ? DP_TILE_SIZE : m_lastWidth;
-			int h = plainY ? DP_TILE_SIZE : m_lastHeight;
-			size_t row_size = size_t(w) * sizeof(*dst);
-			for(int y = 0; y < h; ++y) {
-				memcpy(dst + y * w, src + y * DP_TILE_SIZE, row_size);
+			// The tile is still uploaded in its entirety, but only the changed
+			// rows and columns need to be copied into it.
+			size_t row_size = size_t(r.width()) * sizeof(*dst);
+			for(int y = r.top(); y <= r.bottom(); ++y) {
+				memcpy(
+					dst + y * w + r.x(), src + y * DP_TILE_SIZE + r.x(),
+					row_size);
 			}
 		}
 
+		if(m_navigatorLevel > 0) {
+			reduceNavigatorTile(tileX, tileY, dst, w, r);
+		}
+
 		RenderResult result;
 		bool &dirtyTile = m_dirtyTiles[i];
 		if(!dirtyTile) {
@@ -389,6 +442,21 @@ public:
 		}
 	}
 
+	bool pixelAt(int x, int y, DP_Pixel8 &outPixel) const override
+	{
+		if(x >= 0 && y >= 0 && x < m_width && y < m_height) {
+			int tileX = x / DP_TILE_SIZE;
+			int tileY = y / DP_TILE_SIZE;
+			int tileWidth = tileX < m_lastTileX ? DP_TILE_SIZE : m_lastWidth;
+			const DP_Pixel8 *tilePixels = pixelsAt(tileIndex(tileX, tileY));
+			outPixel = tilePixels[(y % DP_TILE_SIZE) * tileWidth +
+								  (x % DP_TILE_SIZE)];
+		} else {
+			outPixel.color = 0;
+		}
+		return true;
+	}
+
 	void eachDirtyTileReset(const QRect &tileArea, const OnTileFn &fn) override
 	{
 		int right = qMin(tileArea.right(), m_xtiles - 1);
@@ -406,12 +474,42 @@ public:
 		m_needsDirtyCheck = false;
 	}
 
+	void setNavigatorSize(const QSize &navigatorSize) override
+	{
+		int level = 0;
+		if(!navigatorSize.isEmpty()) {
+			while(level < NAVIGATOR_LEVEL_MAX &&
+				  (m_width >> (level + 1)) >= navigatorSize.width() &&
+				  (m_height >> (level + 1)) >= navigatorSize.height()) {
+				++level;
+			}
+		}
+
+		if(level != m_navigatorLevel) {
+			m_navigatorLevel = level;
+			resizeNavigatorImage();
+			if(level > 0) {
+				for(int tileY = 0; tileY < m_ytiles; ++tileY) {
+					for(int tileX = 0; tileX < m_xtiles; ++tileX) {
+						QRect rect = rectAt(tileX, tileY);
+						reduceNavigatorTile(
+							tileX, tileY, pixelsAt(tileIndex(tileX, tileY)),
+							rect.width(), QRect(QPoint(0, 0), rect.size()));
+					}
+				}
+			}
+			m_dirtyNavigatorTiles.fill(true);
+			m_needsNavigatorDirtyCheck = true;
+		}
+	}
+
 protected:
 	void clearImpl() override
 	{
 		DP_free(m_pixels);
 		m_pixels = nullptr;
 		m_capacity = 0;
+		m_navigatorImage = QImage();
 	}
 
 	void resizeImpl(
@@ -432,35 +530,118 @@ protected:
 				static_cast<DP_Pixel8 *>(DP_malloc_zeroed(requiredCapacity));
 			m_capacity = requiredCapacity;
 		}
+		resizeNavigatorImage();
 	}
 
 	void paintNavigatorTileImpl(
 		QPainter &painter, int i, const QRect &sourceRect,
 		const QRect &targetRect) override
 	{
-		painter.drawImage(
-			targetRect, QImage(
-							reinterpret_cast<const uchar *>(pixelsAt(i)),
-							sourceRect.width(), sourceRect.height(),
-							QImage::Format_ARGB32_Premultiplied));
+		if(m_navigatorLevel > 0) {
+			qreal n = qreal(1 << m_navigatorLevel);
+			painter.drawImage(
+				QRectF(targetRect), m_navigatorImage,
+				QRectF(
+					sourceRect.x() / n, sourceRect.y() / n,
+					sourceRect.width() / n, sourceRect.height() / n));
+		} else {
+			painter.drawImage(
+				targetRect, QImage(
+								reinterpret_cast<const uchar *>(pixelsAt(i)),
+								sourceRect.width(), sourceRect.height(),
+								QImage::Format_ARGB32_Premultiplied));
+		}
 	}
 
 private:
+	// Tiles are 64 pixels wide, so this reduces each of them to one pixel.
+	static constexpr int NAVIGATOR_LEVEL_MAX = 6;
+
 	DP_Pixel8 *pixelsAt(int i) const { return m_pixels + i * DP_TILE_LENGTH; }
 
+	void resizeNavigatorImage()
+	{
+		if(m_navigatorLevel > 0) {
+			int n = 1 << m_navigatorLevel;
+			m_navigatorImage = QImage(
+				(m_width + n - 1) >> m_navigatorLevel,
+				(m_height + n - 1) >> m_navigatorLevel,
+				QImage::Format_ARGB32_Premultiplied);
+			m_navigatorImage.fill(0);
+		} else {
+			m_navigatorImage = QImage();
+		}
+	}
+
+	// Averages the given part of the tile down into the navigator image, which
+	// is the canvas shrunk by a power of two. This happens when the tile is
+	// rendered, so the navigator itself only has to scale by what's left.
+	void reduceNavigatorTile(
+		int tileX, int tileY, const DP_Pixel8 *pixels, int width,
+		const QRect &rect)
+	{
+		int level = m_navigatorLevel;
+		int n = 1 << level;
+		int height = tileY < m_lastTileY ? DP_TILE_SIZE : m_lastHeight;
+		int left = rect.left() >> level;
+		int top = rect.top() >> level;
+		int right = rect.right() >> level;
+		int bottom = rect.bottom() >> level;
+		int dstX = (tileX * DP_TILE_SIZE) >> level;
+		int dstY = (tileY * DP_TILE_SIZE) >> level;
+		for(int by = top; by <= bottom; ++by) {
+			int sy0 = by << level;
+			int sy1 = qMin(sy0 + n, height);
+			DP_Pixel8 *out =
+				reinterpret_cast<DP_Pixel8 *>(
+					m_navigatorImage.scanLine(dstY + by)) +
+				dstX + left;
+			for(int bx = left; bx <= right; ++bx) {
+				int sx0 = bx << level;
+				int sx1 = qMin(sx0 + n, width);
+				uint b = 0, g = 0, r = 0, a = 0;
+				for(int sy = sy0; sy < sy1; ++sy) {
+					const DP_Pixel8 *in = pixels + sy * width + sx0;
+					for(int sx = sx0; sx < sx1; ++sx) {
+						b += in->b;
+						g += in->g;
+						r += in->r;
+						a += in->a;
+						++in;
+					}
+				}
+				uint count = uint((sy1 - sy0) * (sx1 - sx0));
+				uint half = count / 2u;
+				out->b = uint8_t((b + half) / count);
+				out->g = uint8_t((g + half) / count);
+				out->r = uint8_t((r + half) / count);
+				out->a = uint8_t((a + half) / count);
+				++out;
+			}
+		}
+	}
+
 	DP_Pixel8 *m_pixels = nullptr;
 	size_t m_capacity = 0;
+	int m_navigatorLevel = 0;
+	QImage m_navigatorImage;
 };
 
 class TileCache::SoftwareCanvasImpl : public BaseImpl {
 public:
 	~SoftwareCanvasImpl() override {}
 
-	RenderResult render(int tileX, int tileY, const DP_Pixel8 *src) override
+	RenderResult render(
+		int tileX, int tileY, const DP_Pixel8 *src,
+		const QRect &dirty) override
 	{
 		int w = tileX < m_lastTileX ? DP_TILE_SIZE : m_lastWidth;
 		int h = tileY < m_lastTileY ? DP_TILE_SIZE : m_lastHeight;
-		QRect rect(tileX * DP_TILE_SIZE, tileY * DP_TILE_SIZE, w, h);
+		QRect rect = dirty.intersected(QRect(0, 0, w, h))
+						 .translated(tileX * DP_TILE_SIZE, tileY * DP_TILE_SIZE);
+		if(rect.isEmpty()) {
+			return RenderResult();
+		}
 		m_grid.renderTile(rect, src);
 
 		RenderResult result;
@@ -572,10 +753,21 @@ void TileCache::resize(int width, int height, int offsetX, int offsetY)
 	d->resize(width, height, offsetX, offsetY);
 }
 
-TileCache::RenderResult
-TileCache::render(int tileX, int tileY, const DP_Pixel8 *src)
+DP_Pixel8 *
+TileCache::renderSlot(int tileX, int tileY, int &outWidth, int &outHeight)
+{
+	return d->renderSlot(tileX, tileY, outWidth, outHeight);
+}
+
+void TileCache::setNavigatorSize(const QSize &navigatorSize)
+{
+	d->setNavigatorSize(navigatorSize);
+}
+
+TileCache::RenderResult TileCache::render(
+	int tileX, int tileY, const DP_Pixel8 *src, const QRect &dirty)
 {
-	return d->render(tileX, tileY, src);
+	return d->render(tileX, tileY, src, dirty);
 }
 
 QImage TileCache::toImage() const
@@ -588,6 +780,11 @@ QImage TileCache::toSubImage(const QRect &rect)
 	return d->toSubImage(rect);
 }
 
+bool TileCache::pixelAt(int x, int y, DP_Pixel8 &outPixel) const
+{
+	return d->pixelAt(x, y, outPixel);
+}
+
 bool TileCache::getResizeReset(Resize &outResize)
 {
 	return d->getResizeReset(outResize);
@@ -603,6 +800,11 @@ void TileCache::eachDirtyTileReset(const QRect &tileArea, const OnTileFn &fn)
 	d->eachDirtyTileReset(tileArea, fn);
 }
 
+bool TileCache::checkDirtyTilesReset(const QRect &tileArea)
+{
+	return d->checkDirtyTilesReset(tileArea);
+}
+
 bool TileCache::paintDirtyNavigatorTilesReset(bool all, QPixmap &cache)
 {
 	return d->paintDirtyNavigatorTilesReset(all, cache);
@@ -30,8 +30,8 @@ public:
 	void clear();
 	void resize(int prevWidth, int prevHeight, int width, int height);
 
-	// The given rect must have tile-aligned x and y coordinates as well as a
-	// size that's equal to or less than the dimensions of a tile.
+	// The given rect must lie within a single tile. The source pixels are the
+	// whole tile, only the part of it covered by the rect is rendered.
 	void renderTile(const QRect &rect, const DP_Pixel8 *src);
 
 	QImage toImage(int width, int height) const;
@@ -52,7 +52,9 @@ public:
 	void clear();
 	void resize(int width, int height);
 
-	QRect render(int tileX, int tileY, const DP_Pixel8 *src);
+	// The dirty rect is relative to the tile, only pixels within it are used.
+	QRect render(
+		int tileX, int tileY, const DP_Pixel8 *src, const QRect &dirty);
 
 	QImage toImage() const;
 	QImage toSubImage(const QRect &rect);
@@ -109,16 +111,38 @@ public:
 	void clear();
 	void resize(int width, int height, int offsetX, int offsetY);
 
-	RenderResult render(int tileX, int tileY, const DP_Pixel8 *src);
+	// Storage for the given tile that the renderer can write into directly,
+	// null if the implementation doesn't have any. The slot is outWidth pixels
+	// wide and outHeight pixels tall. Pass it to render() afterwards.
+	DP_Pixel8 *renderSlot(int tileX, int tileY, int &outWidth, int &outHeight);
+
+	// The dirty rect is relative to the tile, only pixels within it are used.
+	RenderResult
+	render(int tileX, int tileY, const DP_Pixel8 *src, const QRect &dirty);
 
 	QImage toImage() const;
 	QImage toSubImage(const QRect &rect);
 
+	// Reads a single pixel straight from the cache, transparent if it's out
+	// of bounds. Returns false if the implementation can't do that without
+	// copying stuff around, use toSubImage in that case.
+	bool pixelAt(int x, int y, DP_Pixel8 &outPixel) const;
+
 	bool getResizeReset(Resize &outResize);
 	bool needsDirtyCheck() const;
 	void eachDirtyTileReset(const QRect &tileArea, const OnTileFn &fn);
+	// Whether there's a pending resize or any dirty tiles within the given
+	// area. If not, the dirty check is considered done, same as after calling
+	// eachDirtyTileReset, so that the next render will ask for another one.
+	bool checkDirtyTilesReset(const QRect &tileArea);
 	bool paintDirtyNavigatorTilesReset(bool all, QPixmap &cache);
 
+	// Size of the navigator thumbnail. If it's much smaller than the canvas,
+	// the OpenGL implementation keeps a shrunk copy of the canvas up to date
+	// as tiles are rendered, so that painting the navigator is cheap. Pass an
+	// empty size to turn that off again.
+	void setNavigatorSize(const QSize &navigatorSize);
+
 private:
 	class BaseImpl;
 	class GlCanvasImpl;
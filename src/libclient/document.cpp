@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 extern "C" {
+#include <dpengine/project.h>
 #include <dpengine/snapshots.h>
 #include <dpimpex/load.h>
 #include <dpmsg/reset_stream.h>
@@ -75,6 +76,14 @@ Document::Document(
 	m_autosaveTimer->setSingleShot(true);
 	connect(m_autosaveTimer, &QTimer::timeout, this, &Document::autosaveNow);
 
+	m_pointerMoveTimer = new QTimer(this);
+	m_pointerMoveTimer->setSingleShot(true);
+	m_pointerMoveTimer->setTimerType(Qt::PreciseTimer);
+	m_pointerMoveTimer->setInterval(POINTER_MOVE_INTERVAL_MSEC);
+	connect(
+		m_pointerMoveTimer, &QTimer::timeout, this,
+		&Document::sendPendingPointerMove);
+
 	// Make connections
 	connect(
 		m_client, &net::Client::serverConnected, this,
@@ -155,6 +164,11 @@ Document::Document(
 
 void Document::initCanvas()
 {
+	clearAutosaveState();
+	if(!m_generatingThumbnail) {
+		m_thumbnailCanvasState = drawdance::CanvasState::null();
+		m_thumbnailData.clear();
+	}
 	delete m_canvas;
 
 	m_canvas = new canvas::CanvasModel{
@@ -977,10 +991,11 @@ bool Document::isCompatibilityMode() const
 	return m_client->isCompatibilityMode();
 }
 
-void Document::handleCommands(int count, const net::Message *msgs)
+void Document::handleCommands(
+	int count, const net::Message *msgs, bool mayContainMeta)
 {
 	if(m_canvas) {
-		m_canvas->handleCommands(count, msgs);
+		m_canvas->handleCommands(count, msgs, mayContainMeta);
 	}
 }
 
@@ -991,6 +1006,11 @@ void Document::handleLocalCommands(int count, const net::Message *msgs)
 	}
 }
 
+int Document::commandBacklog() const
+{
+	return m_canvas ? m_canvas->paintEngine()->queuedMessageCount() : 0;
+}
+
 bool Document::checkPermission(int feature)
 {
 	return m_canvas && m_canvas->checkPermission(feature);
@@ -1018,7 +1038,7 @@ void Document::autosaveNow()
 
 	saveCanvasState(
 		m_canvas->paintEngine()->viewCanvasState(), true, false, currentPath(),
-		currentType());
+		currentType(), true);
 }
 
 void Document::clearConfig()
@@ -1084,13 +1104,31 @@ void Document::saveCanvasStateAs(
 
 void Document::saveCanvasState(
 	const drawdance::CanvasState &canvasState, bool isCurrentState,
-	bool exported, const QString &path, DP_SaveImageType type)
+	bool exported, const QString &path, DP_SaveImageType type, bool autosave)
 {
 	Q_ASSERT(!m_saveInProgress);
 	m_saveInProgress = true;
 
 	CanvasSaverRunnable *saver = new CanvasSaverRunnable(
 		canvasState, type, path, m_canvas ? m_canvas->paintEngine() : nullptr);
+	// Android saves go through a temporary file, so there's nothing to reuse.
+#ifndef Q_OS_ANDROID
+	if(autosave && type == DP_SAVE_IMAGE_PROJECT_CANVAS) {
+		if(!m_autosaveState || m_autosaveStatePath != path) {
+			m_autosaveState.reset(
+				DP_project_save_state_new(), DP_project_save_state_free);
+			m_autosaveStatePath = path;
+		}
+		saver->setIncrementalSaveState(m_autosaveState);
+	} else
+#else
+	Q_UNUSED(autosave);
+#endif
+	if(path == m_autosaveStatePath) {
+		// The state holds on to the tiles of the last autosave. The next one
+		// would notice that the file got overwritten anyway, so let go of it.
+		clearAutosaveState();
+	}
 	if(isCurrentState && (!exported || type == DP_SAVE_IMAGE_ORA)) {
 		unmarkDirty();
 	}
@@ -1101,6 +1139,12 @@ void Document::saveCanvasState(
 	QThreadPool::globalInstance()->start(saver);
 }
 
+void Document::clearAutosaveState()
+{
+	m_autosaveState.reset();
+	m_autosaveStatePath.clear();
+}
+
 void Document::exportTemplate(const QString &path)
 {
 	net::MessageList snapshot = m_canvas->generateSnapshot(
@@ -1171,9 +1215,25 @@ bool Document::isDirty() const
 
 void Document::sendPointerMove(const QPointF &point)
 {
-	m_client->sendMessage(
-		net::makeMovePointerMessage(
-			m_client->myId(), point.x() * 4, point.y() * 4));
+	m_pendingPointerMove = point;
+	m_havePendingPointerMove = true;
+	if(!m_pointerMoveTimer->isActive()) {
+		sendPendingPointerMove();
+	}
+}
+
+void Document::sendPendingPointerMove()
+{
+	// The first motion goes out immediately, subsequent ones only once the
+	// interval has passed, with the last position being sent at the end.
+	if(m_havePendingPointerMove) {
+		m_havePendingPointerMove = false;
+		m_client->sendMessage(
+			net::makeMovePointerMessage(
+				m_client->myId(), m_pendingPointerMove.x() * 4,
+				m_pendingPointerMove.y() * 4));
+		m_pointerMoveTimer->start();
+	}
 }
 
 void Document::sendSessionConf(const QJsonObject &sessionconf)
@@ -2048,28 +2108,41 @@ void Document::onThumbnailRequested(
 {
 	if(!m_canvas) {
 		qWarning("Thumbnail requested without a canvas");
-		m_client->sendMessage(
-			net::ServerCommand::make(
-				QStringLiteral("thumbnail-error"),
-				{QString::fromUtf8(correlator), QStringLiteral("nocanvas")}));
+		sendThumbnailError(correlator, QStringLiteral("nocanvas"));
+		return;
+	}
+
+	ThumbnailRequest request = {
+		correlator, maxWidth, maxHeight, quality, format};
+	if(sendCachedThumbnail(request)) {
 		return;
 	}
 
 	if(m_generatingThumbnail) {
-		qWarning(
-			"Thumbnail requested while thumbnail generation is in progress");
-		m_client->sendMessage(
-			net::ServerCommand::make(
-				QStringLiteral("thumbnail-error"),
-				{QString::fromUtf8(correlator), QStringLiteral("inprogress")}));
+		if(m_pendingThumbnailRequests.size() <
+		   MAX_PENDING_THUMBNAIL_REQUESTS) {
+			m_pendingThumbnailRequests.append(request);
+		} else {
+			qWarning("Too many thumbnail requests while generation is in "
+					 "progress");
+			sendThumbnailError(correlator, QStringLiteral("inprogress"));
+		}
 		return;
 	}
+
+	startThumbnailGeneration(request);
+}
+
+void Document::startThumbnailGeneration(const ThumbnailRequest &request)
+{
 	m_generatingThumbnail = true;
+	m_thumbnailRequest = request;
+	m_thumbnailCanvasState = m_canvas->paintEngine()->historyCanvasState();
+	m_thumbnailData.clear();
 
 	ThumbnailerRunnable *runnable = new ThumbnailerRunnable(
-		m_client->myId(), correlator,
-		m_canvas->paintEngine()->historyCanvasState(), maxWidth, maxHeight,
-		quality, format);
+		m_client->myId(), request.correlator, m_thumbnailCanvasState,
+		request.maxWidth, request.maxHeight, request.quality, request.format);
 	connect(
 		runnable, &ThumbnailerRunnable::thumbnailGenerationFinished, this,
 		&Document::onThumbnailGenerationFinished);
@@ -2079,22 +2152,70 @@ void Document::onThumbnailRequested(
 	QThreadPool::globalInstance()->start(runnable);
 }
 
-void Document::onThumbnailGenerationFinished(const net::Message &msg)
+bool Document::sendCachedThumbnail(const ThumbnailRequest &request)
 {
-	m_generatingThumbnail = false;
+	// The server tends to ask for thumbnails of idle sessions repeatedly, no
+	// need to render the same image again when the canvas hasn't changed.
+	bool haveCachedThumbnail =
+		!m_generatingThumbnail && !m_thumbnailData.isEmpty() &&
+		request.hasSameParameters(m_thumbnailRequest) &&
+		m_thumbnailCanvasState.get() ==
+			m_canvas->paintEngine()->historyCanvasState().get();
+	if(!haveCachedThumbnail) {
+		return false;
+	}
+
+	net::Message msg = net::makeThumbnailMessage(
+		m_client->myId(), request.correlator, m_thumbnailData);
+	if(msg.isNull()) {
+		// A longer correlator can push it over the limit, so generate anew,
+		// the encoder will keep it within the size limit.
+		return false;
+	}
+
+	qDebug("Sending cached thumbnail");
 	m_client->sendMessage(msg);
+	return true;
 }
 
-void Document::onThumbnailGenerationFailed(
+void Document::sendThumbnailError(
 	const QByteArray &correlator, const QString &error)
 {
-	m_generatingThumbnail = false;
 	m_client->sendMessage(
 		net::ServerCommand::make(
 			QStringLiteral("thumbnail-error"),
 			{QString::fromUtf8(correlator), error}));
 }
 
+void Document::processPendingThumbnailRequests()
+{
+	QVector<ThumbnailRequest> requests;
+	requests.swap(m_pendingThumbnailRequests);
+	for(const ThumbnailRequest &request : requests) {
+		onThumbnailRequested(
+			request.correlator, request.maxWidth, request.maxHeight,
+			request.quality, request.format);
+	}
+}
+
+void Document::onThumbnailGenerationFinished(
+	const net::Message &msg, const QByteArray &data)
+{
+	m_generatingThumbnail = false;
+	m_thumbnailData = data;
+	m_client->sendMessage(msg);
+	processPendingThumbnailRequests();
+}
+
+void Document::onThumbnailGenerationFailed(
+	const QByteArray &correlator, const QString &error)
+{
+	m_generatingThumbnail = false;
+	m_thumbnailCanvasState = drawdance::CanvasState::null();
+	sendThumbnailError(correlator, error);
+	processPendingThumbnailRequests();
+}
+
 #ifdef HAVE_CLIPBOARD_EMULATION
 QMimeData Document::clipboardData;
 #endif
@@ -15,7 +15,9 @@ extern "C" {
 #include "libclient/net/message.h"
 #include <QJsonObject>
 #include <QObject>
+#include <QPointF>
 #include <QQueue>
+#include <QSharedPointer>
 #include <QStringListModel>
 #ifdef Q_OS_ANDROID
 #	include <QMimeData>
@@ -25,6 +27,7 @@ class QMimeData;
 class QString;
 class QTemporaryDir;
 class QTimer;
+struct DP_ProjectSaveState;
 
 namespace canvas {
 class CanvasModel;
@@ -179,8 +182,10 @@ public:
 
 	bool isCompatibilityMode() const;
 
-	void handleCommands(int count, const net::Message *msgs) override;
+	void handleCommands(
+		int count, const net::Message *msgs, bool mayContainMeta) override;
 	void handleLocalCommands(int count, const net::Message *msgs) override;
+	int commandBacklog() const override;
 
 	bool checkPermission(int feature);
 
@@ -326,14 +331,41 @@ private slots:
 	void unmarkDirty();
 
 	void autosaveNow();
+	void sendPendingPointerMove();
 	void onCanvasSaved(const QString &errorMessage, qint64 elapsedMsec);
 
 private:
+	struct ThumbnailRequest {
+		QByteArray correlator;
+		int maxWidth = 0;
+		int maxHeight = 0;
+		int quality = 0;
+		QString format;
+
+		bool hasSameParameters(const ThumbnailRequest &other) const
+		{
+			return maxWidth == other.maxWidth &&
+				   maxHeight == other.maxHeight && quality == other.quality &&
+				   format == other.format;
+		}
+	};
+
+	// Requests arriving while a thumbnail is being generated get answered
+	// once it's done, up to this many. Past that, they're rejected.
+	static constexpr int MAX_PENDING_THUMBNAIL_REQUESTS = 8;
+
+	// Pointer movement is sent no more often than this. Everyone else's
+	// markers glide between positions anyway, so there's no use in sending
+	// every single mouse motion to every user in the session.
+	static constexpr int POINTER_MOVE_INTERVAL_MSEC = 33;
+
 	void clearConfig();
 
 	void saveCanvasState(
 		const drawdance::CanvasState &canvasState, bool isCurrentState,
-		bool exported, const QString &path, DP_SaveImageType type);
+		bool exported, const QString &path, DP_SaveImageType type,
+		bool autosave = false);
+	void clearAutosaveState();
 	QImage selectionToImage();
 	void setCurrentPath(const QString &path, DP_SaveImageType type);
 	void setExportPath(const QString &path, DP_SaveImageType type);
@@ -389,7 +421,12 @@ private:
 	void onThumbnailRequested(
 		const QByteArray &correlator, int maxWidth, int maxHeight, int quality,
 		const QString &format);
-	void onThumbnailGenerationFinished(const net::Message &msg);
+	void startThumbnailGeneration(const ThumbnailRequest &request);
+	bool sendCachedThumbnail(const ThumbnailRequest &request);
+	void sendThumbnailError(const QByteArray &correlator, const QString &error);
+	void processPendingThumbnailRequests();
+	void onThumbnailGenerationFinished(
+		const net::Message &msg, const QByteArray &data);
 	void onThumbnailGenerationFailed(
 		const QByteArray &correlator, const QString &error);
 
@@ -425,7 +462,19 @@ private:
 	bool m_saveInProgress = false;
 	bool m_wantCanvasHistoryDump = false;
 	bool m_generatingThumbnail = false;
+	ThumbnailRequest m_thumbnailRequest;
+	QVector<ThumbnailRequest> m_pendingThumbnailRequests;
+	// Last generated thumbnail and the canvas state it was generated from.
+	// Holding on to the state keeps its address from being reused, so
+	// comparing it against the current one is enough to tell if it changed.
+	drawdance::CanvasState m_thumbnailCanvasState;
+	QByteArray m_thumbnailData;
 	QTimer *m_autosaveTimer;
+	QTimer *m_pointerMoveTimer;
+	QPointF m_pendingPointerMove;
+	bool m_havePendingPointerMove = false;
+	QSharedPointer<DP_ProjectSaveState> m_autosaveState;
+	QString m_autosaveStatePath;
 
 	QJsonObject m_cumulativeConfig;
 	bool m_sessionPersistent = false;
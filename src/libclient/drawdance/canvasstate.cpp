@@ -271,6 +271,12 @@ bool CanvasState::sameFrame(int frameIndexA, int frameIndexB) const
 	return DP_canvas_state_same_frame(m_data, frameIndexA, frameIndexB);
 }
 
+bool CanvasState::sameFrameContent(
+	const CanvasState &prev, int frameIndex) const
+{
+	return DP_canvas_state_same_frame_content(m_data, prev.m_data, frameIndex);
+}
+
 QSet<int>
 CanvasState::getLayersVisibleInTrackFrame(int trackId, int frameIndex) const
 {
@@ -427,16 +433,17 @@ DP_FloodFillResult CanvasState::floodFill(
 	const QColor &fillColor, double tolerance, int layerId, int sizeLimit,
 	int gap, int expand, DP_FloodFillKernel kernel, int featherRadius,
 	bool fromEdge, bool continuous, bool includeSublayers, DP_ViewMode viewMode,
-	int activeLayerId, int activeFrameIndex, const QAtomicInt &cancel,
-	QImage &outImg, int &outX, int &outY) const
+	int activeLayerId, int activeFrameIndex, DP_FloodFillCache *cache,
+	const QAtomicInt &cancel, QImage &outImg, int &outX, int &outY) const
 {
 	DP_UPixelFloat fillPixel = DP_upixel_float_from_color(fillColor.rgba());
 	DP_Image *img;
 	DP_FloodFillResult result = DP_flood_fill(
 		m_data, contextId, selectionId, x, y, fillPixel, tolerance, layerId,
 		sizeLimit, gap, expand, kernel, featherRadius, fromEdge, continuous,
-		includeSublayers, viewMode, activeLayerId, activeFrameIndex, &img,
-		&outX, &outY, shouldCancelFloodFill, const_cast<QAtomicInt *>(&cancel));
+		includeSublayers, viewMode, activeLayerId, activeFrameIndex, cache,
+		&img, &outX, &outY, shouldCancelFloodFill,
+		const_cast<QAtomicInt *>(&cancel));
 	if(result == DP_FLOOD_FILL_SUCCESS) {
 		outImg = wrapImage(img);
 	}
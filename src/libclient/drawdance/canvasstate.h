@@ -77,6 +77,7 @@ public:
 	int framerate() const;
 
 	bool sameFrame(int frameIndexA, int frameIndexB) const;
+	bool sameFrameContent(const CanvasState &prev, int frameIndex) const;
 
 	QSet<int> getLayersVisibleInTrackFrame(int trackId, int frameIndex) const;
 
@@ -112,7 +113,8 @@ public:
 		int gap, int expand, DP_FloodFillKernel kernel, int featherRadius,
 		bool fromEdge, bool continuous, bool includeSublayers,
 		DP_ViewMode viewMode, int activeLayerId, int activeFrameIndex,
-		const QAtomicInt &cancel, QImage &outImg, int &outX, int &outY) const;
+		DP_FloodFillCache *cache, const QAtomicInt &cancel, QImage &outImg,
+		int &outX, int &outY) const;
 
 	DP_FloodFillResult selectionFill(
 		unsigned int contextId, int selectionId, const QColor &fillColor,
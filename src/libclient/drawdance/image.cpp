@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 extern "C" {
 #include <dpcommon/geom.h>
+#include <dpengine/gradient.h>
 #include <dpengine/image.h>
 }
 #include "libclient/drawdance/global.h"
@@ -91,4 +92,27 @@ QImage transformImage(
 	return QImage();
 }
 
+QImage renderGradient(const DP_Gradient &gradient, const QImage &mask)
+{
+	if(mask.isNull()) {
+		return QImage();
+	}
+
+	// Only the alpha channel of the mask matters, which is in the same place
+	// whether the image is premultiplied or not.
+	QImage::Format format = mask.format();
+	QImage argbMask = format == QImage::Format_ARGB32_Premultiplied ||
+							  format == QImage::Format_ARGB32
+						  ? mask
+						  : mask.convertToFormat(
+								QImage::Format_ARGB32_Premultiplied);
+	DP_Image *img = DP_gradient_render(
+		&gradient, argbMask.width(), argbMask.height(),
+		reinterpret_cast<const DP_Pixel8 *>(argbMask.constBits()));
+	if(!img) {
+		qWarning("Error rendering gradient: %s", DP_error());
+	}
+	return wrapImage(img);
+}
+
 }
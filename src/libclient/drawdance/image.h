@@ -3,6 +3,7 @@
 #define DRAWDANCE_IMAGE_H
 #include <QImage>
 
+typedef struct DP_Gradient DP_Gradient;
 typedef struct DP_Image DP_Image;
 typedef union DP_Pixel8 DP_Pixel8;
 
@@ -20,6 +21,10 @@ QImage transformImage(
 	const QImage &source, const QPolygon &dstQuad, int interpolation,
 	bool checkBounds, QPoint *outOffset = nullptr);
 
+// Renders the gradient clipped to the alpha of the given mask, with the
+// result being the same size. Returns a null image if the mask is null.
+QImage renderGradient(const DP_Gradient &gradient, const QImage &mask);
+
 }
 
 #endif
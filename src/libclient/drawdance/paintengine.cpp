@@ -18,8 +18,9 @@ PaintEngine::PaintEngine(
 	AclState &acls, SnapshotQueue &sq, bool wantCanvasHistoryDump,
 	bool rendererChecker, const QColor &checkerColor1,
 	const QColor &checkerColor2, const QColor &selectionColor,
-	DP_RendererTileFn rendererTileFn, DP_RendererUnlockFn rendererUnlockFn,
-	DP_RendererResizeFn rendererResizeFn, void *rendererUser,
+	DP_RendererTileFn rendererTileFn, DP_RendererTileSlotFn rendererTileSlotFn,
+	DP_RendererUnlockFn rendererUnlockFn, DP_RendererResizeFn rendererResizeFn,
+	void *rendererUser,
 	DP_CanvasHistorySoftResetFn softResetFn, void *softResetUser,
 	DP_PaintEnginePlaybackFn playbackFn,
 	DP_PaintEngineDumpPlaybackFn dumpPlaybackFn, void *playbackUser,
@@ -32,7 +33,7 @@ PaintEngine::PaintEngine(
 		  m_paintDc.get(), m_mainDc.get(), m_previewDc.get(), acls.get(),
 		  canvasState.get(), rendererChecker, checkerColor1.rgba(),
 		  checkerColor2.rgba(), selectionColor.rgba(), rendererTileFn,
-		  rendererUnlockFn, rendererResizeFn, rendererUser,
+		  rendererTileSlotFn, rendererUnlockFn, rendererResizeFn, rendererUser,
 		  DP_snapshot_queue_on_save_point, sq.get(), softResetFn, softResetUser,
 		  wantCanvasHistoryDump, getDumpDir().toUtf8().constData(),
 		  &PaintEngine::getTimeMs, nullptr, nullptr, playbackFn, dumpPlaybackFn,
@@ -53,6 +54,7 @@ DP_PaintEngine *PaintEngine::get() const
 net::MessageList PaintEngine::reset(
 	AclState &acls, SnapshotQueue &sq, uint8_t localUserId,
 	bool rendererChecker, DP_RendererTileFn rendererTileFn,
+	DP_RendererTileSlotFn rendererTileSlotFn,
 	DP_RendererUnlockFn rendererUnlockFn, DP_RendererResizeFn rendererResizeFn,
 	void *rendererUser, DP_CanvasHistorySoftResetFn softResetFn,
 	void *softResetUser, DP_PaintEnginePlaybackFn playbackFn,
@@ -75,7 +77,7 @@ net::MessageList PaintEngine::reset(
 		m_paintDc.get(), m_mainDc.get(), m_previewDc.get(), acls.get(),
 		canvasState.get(), rendererChecker, checkerColor1.rgba(),
 		checkerColor2.rgba(), selectionColor.rgba(), rendererTileFn,
-		rendererUnlockFn, rendererResizeFn, rendererUser,
+		rendererTileSlotFn, rendererUnlockFn, rendererResizeFn, rendererUser,
 		DP_snapshot_queue_on_save_point, sq.get(), softResetFn, softResetUser,
 		wantCanvasHistoryDump, getDumpDir().toUtf8().constData(),
 		&PaintEngine::getTimeMs, nullptr, player, playbackFn, dumpPlaybackFn,
@@ -88,6 +90,21 @@ int PaintEngine::renderThreadCount() const
 	return DP_paint_engine_render_thread_count(m_data);
 }
 
+int PaintEngine::queuedMessageCount() const
+{
+	return DP_paint_engine_queue_statistics(m_data).queued;
+}
+
+DP_PaintEngineQueueStatistics PaintEngine::queueStatistics() const
+{
+	return DP_paint_engine_queue_statistics(m_data);
+}
+
+DP_RendererStatistics PaintEngine::renderStatistics() const
+{
+	return DP_paint_engine_render_statistics(m_data);
+}
+
 void PaintEngine::setLocalDrawingInProgress(bool localDrawingInProgress)
 {
 	DP_paint_engine_local_drawing_in_progress_set(
@@ -205,9 +222,14 @@ RecordStartResult PaintEngine::startRecorder(
 		return result;
 	}
 
+	// Binary recordings get keyframes embedded, so that they can be seeked
+	// through right away without building an index. Same interval as the one
+	// used when building an index.
+	static constexpr int KEYFRAME_INTERVAL = 10000;
 	QByteArray pathBytes = path.toUtf8();
 	if(DP_paint_engine_recorder_start(
-		   m_data, recorderType, header, pathBytes.constData())) {
+		   m_data, recorderType, KEYFRAME_INTERVAL, header,
+		   pathBytes.constData())) {
 		return RECORD_START_SUCCESS;
 	} else {
 		return RECORD_START_OPEN_ERROR;
@@ -407,7 +429,8 @@ void PaintEngine::clearCutPreview()
 
 void PaintEngine::previewTransform(
 	int id, int layerId, int blendMode, qreal opacity, int x, int y,
-	const QImage &img, const QPolygon &dstPolygon, int interpolation)
+	const QImage &img, const QPolygon &dstPolygon, int interpolation,
+	bool reduced)
 {
 	if(id >= 0 && id < DP_PREVIEW_TRANSFORM_COUNT) {
 		QPoint p1 = dstPolygon.point(0);
@@ -419,8 +442,9 @@ void PaintEngine::previewTransform(
 		DP_paint_engine_preview_transform(
 			m_data, id, layerId, blendMode,
 			DP_channel_float_to_15(qBound(0.0, opacity, 1.0)), x, y,
-			img.width(), img.height(), &dstQuad, interpolation,
-			getTransformPreviewPixels, disposeTransformPreviewPixels,
+			img.width(), img.height(), &dstQuad, interpolation, reduced,
+			img.cacheKey(), getTransformPreviewPixels,
+			disposeTransformPreviewPixels,
 			new QImage{img});
 	} else {
 		qWarning("Invalid preview transform id %d", id);
@@ -33,7 +33,9 @@ public:
 		AclState &acls, SnapshotQueue &sq, bool wantCanvasHistoryDump,
 		bool rendererChecker, const QColor &checkerColor1,
 		const QColor &checkerColor2, const QColor &selectionColor,
-		DP_RendererTileFn rendererTileFn, DP_RendererUnlockFn rendererUnlockFn,
+		DP_RendererTileFn rendererTileFn,
+		DP_RendererTileSlotFn rendererTileSlotFn,
+		DP_RendererUnlockFn rendererUnlockFn,
 		DP_RendererResizeFn rendererResizeFn, void *rendererUser,
 		DP_CanvasHistorySoftResetFn softResetFn, void *softResetUser,
 		DP_PaintEnginePlaybackFn playbackFn,
@@ -54,6 +56,7 @@ public:
 	net::MessageList reset(
 		AclState &acls, SnapshotQueue &sq, uint8_t localUserId,
 		bool rendererChecker, DP_RendererTileFn rendererTileFn,
+		DP_RendererTileSlotFn rendererTileSlotFn,
 		DP_RendererUnlockFn rendererUnlockFn,
 		DP_RendererResizeFn rendererResizeFn, void *rendererUser,
 		DP_CanvasHistorySoftResetFn softResetFn, void *softResetUser,
@@ -66,6 +69,13 @@ public:
 
 	int renderThreadCount() const;
 
+	//! Messages currently waiting for the paint thread.
+	int queuedMessageCount() const;
+
+	//! Cumulative counters, take the difference between two calls for rates.
+	DP_PaintEngineQueueStatistics queueStatistics() const;
+	DP_RendererStatistics renderStatistics() const;
+
 	void setLocalDrawingInProgress(bool localDrawingInProgress);
 
 	void setWantCanvasHistoryDump(bool wantCanvasHistoryDump);
@@ -133,7 +143,8 @@ public:
 	void clearCutPreview();
 	void previewTransform(
 		int id, int layerId, int blendMode, qreal opacity, int x, int y,
-		const QImage &img, const QPolygon &dstPolygon, int interpolation);
+		const QImage &img, const QPolygon &dstPolygon, int interpolation,
+		bool reduced);
 	void clearTransformPreview(int id);
 	void clearAllTransformPreviews();
 	void previewDabs(int layerId, int count, const net::Message *msgs);
@@ -9,8 +9,25 @@ namespace drawdance {
 
 bool Perf::open(const QString &path)
 {
-    DP_Output *output = DP_gzip_output_new_from_path(path.toUtf8().constData());
-    return output ? DP_perf_open(output) : false;
+    // Files ending in .json or .json.gz are written in Chrome's trace event
+    // format, which can be loaded into Perfetto or chrome://tracing. The
+    // DRAWPILE_PERF_FILTER environment variable can be set to a comma-separated
+    // list of category prefixes to only record those.
+    QByteArray pathBytes = path.toUtf8();
+    bool json = path.endsWith(QStringLiteral(".json"), Qt::CaseInsensitive);
+    bool chromeTrace =
+        json || path.endsWith(QStringLiteral(".json.gz"), Qt::CaseInsensitive);
+    DP_Output *output =
+        json ? DP_file_output_new_from_path(pathBytes.constData())
+             : DP_gzip_output_new_from_path(pathBytes.constData());
+    if(!output) {
+        return false;
+    }
+
+    QByteArray filter = qgetenv("DRAWPILE_PERF_FILTER");
+    return DP_perf_open_with(
+        output, chromeTrace ? DP_PERF_FORMAT_CHROME_TRACE : DP_PERF_FORMAT_TEXT,
+        filter.isEmpty() ? nullptr : filter.constData());
 }
 
 bool Perf::close()
@@ -34,6 +34,11 @@ void SnapshotQueue::setMaxCount(int maxCount)
     DP_snapshot_queue_max_count_set(m_data, qMax(0, maxCount));
 }
 
+void SnapshotQueue::setMaxBytes(long long maxBytes)
+{
+    DP_snapshot_queue_max_bytes_set(m_data, size_t(qMax(0LL, maxBytes)));
+}
+
 void SnapshotQueue::setMinDelayMs(long long minDelayMs)
 {
     DP_snapshot_queue_min_delay_ms_set(m_data, minDelayMs);
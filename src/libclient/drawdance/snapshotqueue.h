@@ -29,6 +29,7 @@ public:
     DP_SnapshotQueue *get();
 
     void setMaxCount(int maxCount);
+    void setMaxBytes(long long maxBytes);
     void setMinDelayMs(long long minDelayMs);
 
     void getSnapshotsWith(GetSnapshotsFn get) const;
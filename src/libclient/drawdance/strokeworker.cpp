@@ -67,6 +67,11 @@ void StrokeWorker::flushDabs()
 	DP_stroke_worker_dabs_flush(m_data);
 }
 
+bool StrokeWorker::canDeferDabs() const
+{
+	return DP_stroke_worker_dabs_deferrable(m_data);
+}
+
 void StrokeWorker::pushMessageNoinc(DP_Message *msg)
 {
 	DP_stroke_worker_message_push_noinc(m_data, msg);
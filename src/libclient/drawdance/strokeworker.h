@@ -51,6 +51,7 @@ public:
 		const DP_BrushEngineStrokeParams &besp, bool eraserOverride);
 
 	void flushDabs();
+	bool canDeferDabs() const;
 
 	void pushMessageNoinc(DP_Message *msg);
 
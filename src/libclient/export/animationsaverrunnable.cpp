@@ -21,7 +21,7 @@ AnimationSaverRunnable::AnimationSaverRunnable(
 	const QString &path,
 #endif
 	int format, int width, int height, int loops, int start, int end,
-	int framerate, const QRect &crop, bool scaleSmooth,
+	int framerate, const QRect &crop, bool scaleSmooth, bool hardware,
 	const drawdance::CanvasState &canvasState, QObject *parent)
 	: QObject(parent)
 #ifndef __EMSCRIPTEN__
@@ -37,6 +37,7 @@ AnimationSaverRunnable::AnimationSaverRunnable(
 	, m_crop(crop)
 	, m_canvasState(canvasState)
 	, m_scaleSmooth(scaleSmooth)
+	, m_hardware(hardware)
 	, m_cancelled(false)
 {
 }
@@ -119,8 +120,10 @@ void AnimationSaverRunnable::run()
 			const_cast<char *>(pathBytes.constData()),
 			nullptr,
 			0,
-			m_scaleSmooth ? DP_SAVE_VIDEO_FLAGS_SCALE_SMOOTH
-						  : DP_SAVE_VIDEO_FLAGS_NONE,
+			(m_scaleSmooth ? DP_SAVE_VIDEO_FLAGS_SCALE_SMOOTH
+						   : DP_SAVE_VIDEO_FLAGS_NONE) |
+				(m_hardware ? DP_SAVE_VIDEO_FLAGS_HARDWARE
+							: DP_SAVE_VIDEO_FLAGS_NONE),
 			formatToSaveVideoFormat(),
 			m_width,
 			m_height,
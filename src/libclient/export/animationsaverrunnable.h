@@ -20,7 +20,7 @@ public:
 		const QString &path,
 #endif
 		int format, int width, int height, int loops, int start, int end,
-		int framerate, const QRect &crop, bool scaleSmooth,
+		int framerate, const QRect &crop, bool scaleSmooth, bool hardware,
 		const drawdance::CanvasState &canvasState, QObject *parent = nullptr);
 
 	void run() override;
@@ -61,6 +61,7 @@ private:
 	const QRect m_crop;
 	const drawdance::CanvasState m_canvasState;
 	const bool m_scaleSmooth;
+	const bool m_hardware;
 	bool m_cancelled;
 };
 
@@ -6,9 +6,8 @@ extern "C" {
 #include "libclient/drawdance/annotation.h"
 #include "libclient/drawdance/global.h"
 #include "libclient/export/canvassaverrunnable.h"
-#include "libclient/utils/annotations.h"
+#include "libclient/utils/annotationrastercache.h"
 #include <QElapsedTimer>
-#include <QPainter>
 #include <QRandomGenerator>
 #include <QTemporaryDir>
 #ifdef Q_OS_ANDROID
@@ -59,9 +58,15 @@ void CanvasSaverRunnable::run()
 
 	const char *path = pathBytes.constData();
 	drawdance::DrawContext dc = drawdance::DrawContextPool::acquire();
-	DP_SaveResult result = DP_save(
-		m_canvasState.get(), dc.get(), m_type, path, m_vmb ? &m_vmf : nullptr,
-		bakeAnnotation, this);
+	DP_SaveResult result;
+	if(m_incrementalSaveState && m_type == DP_SAVE_IMAGE_PROJECT_CANVAS) {
+		result = DP_save_project_canvas_incremental(
+			m_canvasState.get(), path, m_incrementalSaveState.get());
+	} else {
+		result = DP_save(
+			m_canvasState.get(), dc.get(), m_type, path,
+			m_vmb ? &m_vmf : nullptr, bakeAnnotation, this);
+	}
 
 #ifdef Q_OS_ANDROID
 	QFile tempFile(tempPath);
@@ -120,15 +125,8 @@ bool CanvasSaverRunnable::bakeAnnotation(
 	void *user, DP_Annotation *a, unsigned char *out)
 {
 	Q_UNUSED(user);
-	drawdance::Annotation annotation = drawdance::Annotation::inc(a);
-	QImage img(
-		out, annotation.width(), annotation.height(),
-		QImage::Format_ARGB32_Premultiplied);
-	img.fill(0);
-	QPainter painter(&img);
-	utils::paintAnnotation(
-		&painter, annotation.size(), annotation.backgroundColor(),
-		annotation.text(), annotation.alias(), annotation.valign());
+	utils::AnnotationRasterCache::global().bake(
+		drawdance::Annotation::inc(a), out);
 	return true;
 }
 
@@ -9,9 +9,11 @@ extern "C" {
 #include <QByteArray>
 #include <QObject>
 #include <QRunnable>
+#include <QSharedPointer>
 
 class QFile;
 class QTemporaryDir;
+struct DP_ProjectSaveState;
 
 namespace canvas {
 class PaintEngine;
@@ -30,6 +32,18 @@ public:
 
 	~CanvasSaverRunnable() override;
 
+	/**
+	 * @brief Save a project canvas incrementally
+	 *
+	 * Only tiles that changed since the last save with the same state get
+	 * written. The state must not be used by two saves at the same time.
+	 */
+	void setIncrementalSaveState(
+		const QSharedPointer<DP_ProjectSaveState> &incrementalSaveState)
+	{
+		m_incrementalSaveState = incrementalSaveState;
+	}
+
 	void run() override;
 
 	static QString saveResultToErrorString(
@@ -60,6 +74,7 @@ private:
 	drawdance::ViewModeBuffer *m_vmb = nullptr;
 	DP_ViewModeFilter m_vmf;
 	QTemporaryDir *m_tempDir;
+	QSharedPointer<DP_ProjectSaveState> m_incrementalSaveState;
 };
 
 #endif
@@ -59,11 +59,11 @@ void ThumbnailerRunnable::run()
 		return;
 	}
 
-	net::Message msg = net::makeThumbnailMessage(
-		m_contextId, m_correlator,
-		QByteArray::fromRawData(
-			reinterpret_cast<const char *>(buffer), compat::castSize(size)));
+	QByteArray data(
+		reinterpret_cast<const char *>(buffer), compat::castSize(size));
 	DP_free(buffer);
+	net::Message msg =
+		net::makeThumbnailMessage(m_contextId, m_correlator, data);
 	if(msg.isNull()) {
 		// Should really be caught in the write functions below.
 		qCWarning(
@@ -76,7 +76,7 @@ void ThumbnailerRunnable::run()
 		return;
 	}
 
-	emit thumbnailGenerationFinished(msg);
+	emit thumbnailGenerationFinished(msg, data);
 }
 
 int ThumbnailerRunnable::sanitizeDimension(int dimension)
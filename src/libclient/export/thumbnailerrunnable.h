@@ -23,7 +23,10 @@ public:
 	void run() override;
 
 signals:
-	void thumbnailGenerationFinished(const net::Message &msg);
+	// The data is the encoded image without the correlator, so that it can be
+	// reused to answer further requests for the same thumbnail.
+	void thumbnailGenerationFinished(
+		const net::Message &msg, const QByteArray &data);
 	void thumbnailGenerationFailed(
 		const QByteArray &correlator, const QString &error);
 
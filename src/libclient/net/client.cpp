@@ -8,6 +8,9 @@
 #include <QDebug>
 #include <QLoggingCategory>
 #include <QTimer>
+#ifdef DP_HAVE_BUILTIN_SERVER
+#	include "libclient/net/localserver.h"
+#endif
 #ifdef Q_OS_ANDROID
 #	include "libshared/util/androidutils.h"
 #endif
@@ -46,8 +49,16 @@ void Client::connectToServerInternal(
 						<< "connected" << isConnected();
 	Q_ASSERT(!isConnected());
 
-	m_server =
-		Server::make(loginhandler->url(), m_timeoutSecs, m_proxyMode, this);
+#ifdef DP_HAVE_BUILTIN_SERVER
+	// Redirects lead elsewhere, those always need a real connection.
+	if(m_builtin && !redirect && m_builtinServer) {
+		m_server = new LocalServer(m_builtinServer, m_timeoutSecs, this);
+	} else
+#endif
+	{
+		m_server =
+			Server::make(loginhandler->url(), m_timeoutSecs, m_proxyMode, this);
+	}
 	m_server->setSmoothDrainRate(m_smoothDrainRate);
 
 #ifdef Q_OS_ANDROID
@@ -185,6 +196,9 @@ void Client::handleConnect(const LoggedInParams &params)
 	m_isAuthenticated = params.auth;
 	m_supportsAutoReset = params.supportsAutoReset;
 	m_supportsSkipCatchup = params.supportsSkipCatchup;
+	m_supportsBacklogReports = params.supportsBacklogReports;
+	m_reportedBacklog = 0;
+	m_backlogReportTimer.invalidate();
 	m_compatibilityMode = params.compatibilityMode;
 	m_historyIndex.clear();
 
@@ -333,7 +347,7 @@ void Client::sendRemoteMessages(int count, const net::Message *msgs)
 	if(m_server) {
 		m_server->sendMessages(count, msgs);
 	} else {
-		m_commandHandler->handleCommands(count, msgs);
+		m_commandHandler->handleCommands(count, msgs, true);
 	}
 }
 
@@ -377,7 +391,12 @@ void Client::handleMessages(int count, net::Message *msgs)
 		m_catchupTimer->stop();
 	}
 
+	// Since we're looking at every message here anyway, keep track of whether
+	// the run of messages being passed along contains anything that the user
+	// interface has to deal with, so that the canvas doesn't have to go over
+	// pure runs of drawing commands again just to find out there's nothing.
 	int handled = 0;
+	bool mayContainMeta = false;
 	for(int i = 0; i < count; ++i) {
 		net::Message &msg = msgs[i];
 
@@ -389,15 +408,23 @@ void Client::handleMessages(int count, net::Message *msgs)
 		case DP_MSG_SERVER_COMMAND: {
 			int handleCount = i - handled;
 			if(handleCount > 0) {
-				m_commandHandler->handleCommands(handleCount, msgs + handled);
+				m_commandHandler->handleCommands(
+					handleCount, msgs + handled, mayContainMeta);
 			}
 			handled = i;
+			mayContainMeta = false;
 			handleServerReply(ServerReply::fromMessage(msg), i);
 			break;
 		}
 		case DP_MSG_DATA:
 			handleData(msg);
 			break;
+		case DP_MSG_JOIN:
+		case DP_MSG_LEAVE:
+		case DP_MSG_CHAT:
+		case DP_MSG_PRIVATE_CHAT:
+			mayContainMeta = true;
+			break;
 		default:
 			break;
 		}
@@ -405,8 +432,10 @@ void Client::handleMessages(int count, net::Message *msgs)
 
 	int handleCount = count - handled;
 	if(handleCount > 0) {
-		m_commandHandler->handleCommands(handleCount, msgs + handled);
+		m_commandHandler->handleCommands(
+			handleCount, msgs + handled, mayContainMeta);
 	}
+	updateBacklog();
 
 	// The server can send a "catchup" message when there is a significant
 	// number of messages queued. During login, we can show a progress bar and
@@ -833,6 +862,25 @@ void Client::setSmoothDrainRate(int smoothDrainRate)
 	}
 }
 
+void Client::updateBacklog()
+{
+	int backlog = m_commandHandler->commandBacklog();
+	m_server->setSmoothBacklog(backlog);
+
+	// The server uses this to hand out catch-up batches, so it only needs to
+	// hear about it every once in a while. Reports go stale on their own.
+	if(m_supportsBacklogReports && (backlog != 0 || m_reportedBacklog != 0) &&
+	   (!m_backlogReportTimer.isValid() ||
+		m_backlogReportTimer.hasExpired(BACKLOG_REPORT_INTERVAL_MSEC))) {
+		m_reportedBacklog = backlog;
+		m_backlogReportTimer.start();
+		QJsonObject kwargs;
+		kwargs[QStringLiteral("queued")] = backlog;
+		sendMessage(
+			net::ServerCommand::make(QStringLiteral("backlog"), {}, kwargs));
+	}
+}
+
 void Client::finishCatchup(const char *reason, int handledMessageIndex)
 {
 	qInfo(
@@ -3,8 +3,10 @@
 #define DP_NET_CLIENT_H
 #include "libclient/net/server.h"
 #include "libshared/util/historyindex.h"
+#include <QElapsedTimer>
 #include <QMetaObject>
 #include <QObject>
+#include <QPointer>
 #include <QSslCertificate>
 #include <QUrl>
 #include <QVector>
@@ -14,6 +16,10 @@ class QJsonArray;
 class QTimer;
 struct DP_MsgData;
 
+namespace server {
+class BuiltinServer;
+}
+
 namespace utils {
 class AndroidWakeLock;
 class AndroidWifiLock;
@@ -43,10 +49,17 @@ public:
 	public:
 		virtual ~CommandHandler();
 
-		virtual void handleCommands(int count, const net::Message *msgs) = 0;
+		// Messages relevant to the user interface, like chat, joins and
+		// leaves, can only be in there if mayContainMeta is true. Otherwise
+		// they're all drawing commands that can go straight to the canvas.
+		virtual void handleCommands(
+			int count, const net::Message *msgs, bool mayContainMeta) = 0;
 
 		virtual void
 		handleLocalCommands(int count, const net::Message *msgs) = 0;
+
+		//! Number of handled commands that are still waiting to be executed.
+		virtual int commandBacklog() const = 0;
 	};
 
 	explicit Client(CommandHandler *commandHandler, QObject *parent = nullptr);
@@ -90,6 +103,19 @@ public:
 
 	bool isBuiltin() const { return m_builtin; }
 
+#ifdef DP_HAVE_BUILTIN_SERVER
+	/**
+	 * @brief Set the builtin server running in this process
+	 *
+	 * When connecting to it as the builtin host, messages are passed to it
+	 * directly instead of going through a loopback socket.
+	 */
+	void setBuiltinServer(server::BuiltinServer *builtinServer)
+	{
+		m_builtinServer = builtinServer;
+	}
+#endif
+
 	/**
 	 * @brief Is the user connected and logged in?
 	 * @return true if there is an active network connection and login process
@@ -316,6 +342,7 @@ private slots:
 
 private:
 	static constexpr int CATCHUP_TIMER_MSEC = 4000;
+	static constexpr qint64 BACKLOG_REPORT_INTERVAL_MSEC = 1000;
 
 	// Guess if we're connected to a thick server session. Checking for the
 	// auto-reset support of the session should, at the time of writing, be a
@@ -342,6 +369,7 @@ private:
 	void handleData(const net::Message &msg);
 	void handleUserInfo(const net::Message &msg, DP_MsgData *md);
 	void finishCatchup(const char *reason, int handledMessageIndex = 0);
+	void updateBacklog();
 
 	CommandHandler *const m_commandHandler;
 	Server *m_server = nullptr;
@@ -359,10 +387,14 @@ private:
 	QPixmap m_usedAvatar;
 	uint8_t m_myId = 1;
 	bool m_builtin = false;
+#ifdef DP_HAVE_BUILTIN_SERVER
+	QPointer<server::BuiltinServer> m_builtinServer;
+#endif
 	UserFlags m_userFlags = UserFlag::None;
 	bool m_isAuthenticated = false;
 	bool m_supportsAutoReset = false;
 	bool m_supportsSkipCatchup = false;
+	bool m_supportsBacklogReports = false;
 	bool m_compatibilityMode = false;
 
 	int m_timeoutSecs = 0;
@@ -374,6 +406,8 @@ private:
 	QTimer *m_catchupTimer;
 
 	int m_smoothDrainRate = 0;
+	int m_reportedBacklog = 0;
+	QElapsedTimer m_backlogReportTimer;
 	HistoryIndex m_historyIndex;
 };
 
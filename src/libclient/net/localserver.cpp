@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libclient/net/localserver.h"
+#include "libclient/server/builtinserver.h"
+#include "libshared/net/localmessagequeue.h"
+#include <QDebug>
+
+namespace net {
+
+LocalServer::LocalServer(
+	server::BuiltinServer *builtinServer, int timeoutSecs, Client *client)
+	: Server(client)
+	, m_builtinServer(builtinServer)
+{
+	m_msgqueue = new LocalMessageQueue(true, this);
+	m_msgqueue->setIdleTimeout(timeoutSecs * 1000);
+	m_msgqueue->setPingInterval(15 * 1000);
+
+	connect(
+		m_msgqueue, &LocalMessageQueue::stateChanged, this,
+		&LocalServer::handleSocketStateChange);
+
+	connectMessageQueue(m_msgqueue);
+}
+
+bool LocalServer::hasSslSupport() const
+{
+	return false;
+}
+
+QSslCertificate LocalServer::hostCertificate() const
+{
+	return QSslCertificate();
+}
+
+MessageQueue *LocalServer::messageQueue() const
+{
+	return m_msgqueue;
+}
+
+void LocalServer::connectToHost(const QUrl &url)
+{
+	qDebug() << "LocalServer connecting to builtin server for" << url;
+	if(!m_builtinServer || !m_builtinServer->connectLocalClient(m_msgqueue)) {
+		m_socketError = QAbstractSocket::ConnectionRefusedError;
+		m_socketErrorString = tr("The builtin server is not running.");
+		// Report it asynchronously, same as a socket would.
+		QMetaObject::invokeMethod(
+			this, &LocalServer::handleSocketError, Qt::QueuedConnection);
+	}
+}
+
+void LocalServer::disconnectFromHost()
+{
+	m_msgqueue->close();
+}
+
+void LocalServer::abortConnection()
+{
+	m_msgqueue->abort();
+}
+
+bool LocalServer::isConnected() const
+{
+	return m_msgqueue->state() != QAbstractSocket::UnconnectedState;
+}
+
+QAbstractSocket::SocketError LocalServer::socketError() const
+{
+	return m_socketError;
+}
+
+QString LocalServer::socketErrorString() const
+{
+	return m_socketErrorString;
+}
+
+bool LocalServer::loginStartTls(LoginHandler *loginstate)
+{
+	Q_UNUSED(loginstate);
+	return false;
+}
+
+bool LocalServer::loginIgnoreTlsErrors(const QList<QSslError> &ignore)
+{
+	Q_UNUSED(ignore);
+	return false;
+}
+
+bool LocalServer::isWebSocket() const
+{
+	return false;
+}
+
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBCLIENT_NET_LOCALSERVER_H
+#define LIBCLIENT_NET_LOCALSERVER_H
+#include "libclient/net/server.h"
+#include <QPointer>
+
+namespace server {
+class BuiltinServer;
+}
+
+namespace net {
+
+class LocalMessageQueue;
+
+/**
+ * @brief Connection to the builtin server running in this same process
+ *
+ * Messages are passed to the server directly instead of going through a
+ * loopback socket, so they don't need to be serialized and parsed again.
+ */
+class LocalServer final : public Server {
+	Q_OBJECT
+public:
+	explicit LocalServer(
+		server::BuiltinServer *builtinServer, int timeoutSecs, Client *client);
+
+	bool hasSslSupport() const override;
+
+	QSslCertificate hostCertificate() const override;
+
+protected:
+	MessageQueue *messageQueue() const override;
+	void connectToHost(const QUrl &url) override;
+	void disconnectFromHost() override;
+	void abortConnection() override;
+	bool isConnected() const override;
+	QAbstractSocket::SocketError socketError() const override;
+	QString socketErrorString() const override;
+	bool loginStartTls(LoginHandler *loginstate) override;
+	bool loginIgnoreTlsErrors(const QList<QSslError> &ignore) override;
+	bool isWebSocket() const override;
+
+private:
+	QPointer<server::BuiltinServer> m_builtinServer;
+	LocalMessageQueue *m_msgqueue;
+	QAbstractSocket::SocketError m_socketError =
+		QAbstractSocket::UnknownSocketError;
+	QString m_socketErrorString;
+};
+
+}
+
+#endif
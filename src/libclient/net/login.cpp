@@ -224,6 +224,10 @@ void LoginHandler::expectHello(const ServerReply &msg)
 			m_mayRedirect = true;
 		} else if(flag == QStringLiteral("RIN")) {
 			m_acceptsRedirects = true;
+		} else if(flag == QStringLiteral("ZSTD")) {
+			m_supportsStreamCompression = true;
+		} else if(flag == QStringLiteral("MBATCH")) {
+			m_supportsMessageBatching = true;
 		} else {
 			qCWarning(lcDpLogin) << "Unknown server capability:" << flag;
 		}
@@ -341,6 +345,14 @@ void LoginHandler::sendSessionPassword(const QString &password)
 
 void LoginHandler::sendClientInfo()
 {
+	// Compression starts after STARTTLS, since that has to happen first.
+	if(m_supportsStreamCompression) {
+		m_server->messageQueue()->startStreamCompression();
+	}
+	if(m_supportsMessageBatching) {
+		m_server->messageQueue()->startMessageBatching();
+	}
+
 	if(m_supportsClientInfo) {
 		setState(EXPECT_CLIENT_INFO_OK);
 		send(
@@ -492,6 +492,8 @@ private:
 	bool m_supportsModBanImpEx = false;
 	bool m_supportsClientInfo = false;
 	bool m_supportsLookup = false;
+	bool m_supportsStreamCompression = false;
+	bool m_supportsMessageBatching = false;
 	bool m_supportsExtAuthAvatars = false;
 	bool m_mayRedirect = false;
 	bool m_acceptsRedirects = false;
@@ -101,6 +101,14 @@ Message makeInternalCleanupMessage(uint8_t contextId)
 	return Message::noinc(DP_msg_internal_cleanup_new(contextId));
 }
 
+Message makeInternalMemoryReportMessage(
+	uint8_t contextId, DP_MemoryReport *mr,
+	void (*callback)(void *, DP_MemoryReport *), void *user)
+{
+	return Message::noinc(
+		DP_msg_internal_memory_report_new(contextId, mr, callback, user));
+}
+
 Message makeInternalPaintSyncMessage(
 	uint8_t contextId, void (*callback)(void *), void *user)
 {
@@ -14,6 +14,7 @@ class QImage;
 class QJsonDocument;
 class QString;
 struct DP_CanvasHistoryReconnectState;
+struct DP_MemoryReport;
 struct DP_OnionSkins;
 
 namespace net {
@@ -54,6 +55,10 @@ Message makeInternalCatchupMessage(uint8_t contextId, int progress);
 
 Message makeInternalCleanupMessage(uint8_t contextId);
 
+Message makeInternalMemoryReportMessage(
+	uint8_t contextId, DP_MemoryReport *mr,
+	void (*callback)(void *, DP_MemoryReport *), void *user);
+
 Message makeInternalPaintSyncMessage(
 	uint8_t contextId, void (*callback)(void *), void *user);
 
@@ -528,6 +528,7 @@ void Server::loginSuccess()
 		m_loginstate->isAuthenticated(),
 		!sessionFlags.contains(QStringLiteral("NOAUTORESET")),
 		sessionFlags.contains(QStringLiteral("SKIP")),
+		sessionFlags.contains(QStringLiteral("BACKLOG")),
 		m_loginstate->skipCatchup(),
 		m_loginstate->compatibilityMode(),
 		m_loginstate->userId(),
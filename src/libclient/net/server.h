@@ -26,6 +26,7 @@ struct LoggedInParams {
 	bool auth;
 	bool supportsAutoReset;
 	bool supportsSkipCatchup;
+	bool supportsBacklogReports;
 	bool skipCatchup;
 	bool compatibilityMode;
 	uint8_t userId;
@@ -128,6 +129,11 @@ public:
 		messageQueue()->setSmoothDrainRate(smoothDrainRate);
 	}
 
+	void setSmoothBacklog(int smoothBacklog)
+	{
+		messageQueue()->setSmoothBacklog(smoothBacklog);
+	}
+
 	// Artificial lag for debugging.
 	int artificialLagMs() const { return messageQueue()->artificalLagMs(); }
 
@@ -9,6 +9,12 @@ BuiltinClient::BuiltinClient(
 {
 }
 
+BuiltinClient::BuiltinClient(
+	net::LocalMessageQueue *queue, ServerLog *logger, QObject *parent)
+	: Client{queue, logger, parent}
+{
+}
+
 BuiltinClient::~BuiltinClient()
 {
 	emit builtinClientDestroyed(this);
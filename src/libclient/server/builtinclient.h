@@ -3,6 +3,10 @@
 #define LIBCLIENT_SERVER_BUILTINCLIENT_H
 #include "libserver/client.h"
 
+namespace net {
+class LocalMessageQueue;
+}
+
 namespace server {
 
 class BuiltinClient final : public Client {
@@ -11,6 +15,10 @@ public:
 	BuiltinClient(
 		QTcpSocket *socket, ServerLog *logger, QObject *parent = nullptr);
 
+	BuiltinClient(
+		net::LocalMessageQueue *queue, ServerLog *logger,
+		QObject *parent = nullptr);
+
 	~BuiltinClient() override;
 
 	BuiltinClient(const BuiltinClient &) = delete;
@@ -6,6 +6,7 @@
 #include "libserver/client.h"
 #include "libserver/inmemoryconfig.h"
 #include "libserver/loginhandler.h"
+#include "libshared/net/localmessagequeue.h"
 #include "libshared/net/proxy.h"
 #include <QJsonArray>
 #include <QNetworkProxy>
@@ -111,6 +112,20 @@ bool BuiltinServer::start(
 	return true;
 }
 
+bool BuiltinServer::connectLocalClient(net::LocalMessageQueue *clientQueue)
+{
+	if(!m_server) {
+		qWarning("Local client connected to builtin server that isn't running");
+		return false;
+	}
+
+	qInfo("New local client connected to builtin server");
+	net::LocalMessageQueue *queue = new net::LocalMessageQueue{true};
+	net::LocalMessageQueue::connectPair(clientQueue, queue);
+	addClient(new BuiltinClient{queue, m_config->logger(), this});
+	return true;
+}
+
 void BuiltinServer::stop()
 {
 	if(m_server) {
@@ -145,7 +160,11 @@ void BuiltinServer::newClient()
 		"New client connected to builtin server (%s)",
 		qUtf8Printable(socket->peerAddress().toString()));
 
-	BuiltinClient *client = new BuiltinClient{socket, m_config->logger(), this};
+	addClient(new BuiltinClient{socket, m_config->logger(), this});
+}
+
+void BuiltinServer::addClient(BuiltinClient *client)
+{
 	client->setConnectionTimeout(
 		m_config->getConfigTime(config::ClientTimeout) * 1000);
 
@@ -7,6 +7,10 @@
 
 class QTcpServer;
 
+namespace net {
+class LocalMessageQueue;
+}
+
 namespace canvas {
 class PaintEngine;
 }
@@ -57,6 +61,15 @@ public:
 		quint16 preferredPort, int clientTimeout, int proxyMode,
 		QString *outErrorMessage = nullptr);
 
+	/**
+	 * @brief Connect a client in this process without going through a socket
+	 *
+	 * This is for the hosting user, whose messages then get passed back and
+	 * forth as they are instead of being serialized and deserialized on both
+	 * ends. Returns false if the server isn't running.
+	 */
+	bool connectLocalClient(net::LocalMessageQueue *clientQueue);
+
 public slots:
 	void stop();
 	void doInternalReset(const drawdance::CanvasState &canvasState);
@@ -66,6 +79,7 @@ private slots:
 	void removeClient(BuiltinClient *client);
 
 private:
+	void addClient(BuiltinClient *client);
 	ServerConfig *initConfig();
 	bool matchesSession(const QString &idOrAlias) const;
 
@@ -19,7 +19,8 @@ BuiltinSession::BuiltinSession(
 	const QString &founder, QObject *parent)
 	: Session(
 		  new InMemoryHistory{
-			  id, idAlias, protocol::ProtocolVersion::current(), founder},
+			  id, idAlias, protocol::ProtocolVersion::current(), founder,
+			  true},
 		  config, announcements, parent)
 	, m_paintEngine{paintEngine}
 	, m_acls{m_paintEngine->aclState().clone(0)}
@@ -37,6 +38,11 @@ bool BuiltinSession::supportsSkipCatchup() const
 	return false;
 }
 
+bool BuiltinSession::supportsBacklogReports() const
+{
+	return false;
+}
+
 bool BuiltinSession::supportsSizeLimit() const
 {
 	return false;
@@ -40,6 +40,7 @@ SETTING(parentalControlsTags        , ParentalControlsTags        , "pc/tagwords
 SETTING(engineFrameRate             , EngineFrameRate             , "settings/paintengine/fps"              , 60)
 SETTING(engineSnapshotCount         , EngineSnapshotCount         , "settings/paintengine/snapshotcount"    , SNAPSHOT_COUNT_DEFAULT)
 SETTING(engineSnapshotInterval      , EngineSnapshotInterval      , "settings/paintengine/snapshotinterval" , 10)
+SETTING(engineSnapshotMaxMemory     , EngineSnapshotMaxMemory     , "settings/paintengine/snapshotmaxmemory", 1024)
 SETTING(engineUndoDepth             , EngineUndoDepth             , "settings/paintengine/undodepthlimit"   , ENGINE_UNDO_LIMIT_DEFAULT)
 SETTING(listServers                 , ListServers                 , "listservers"                           , QVector<QVariantMap>())
 SETTING(selectionColor              , SelectionColor              , "settings/selectioncolor"               , SELECTION_COLOR_DEFAULT)
@@ -21,6 +21,7 @@ class FloodFill::Task final : public ToolController::Task {
 public:
 	Task(
 		FloodFill *tool, const QAtomicInt &cancel,
+		const QSharedPointer<DP_FloodFillCache> &fillCache,
 		const drawdance::CanvasState &canvasState, unsigned int contextId,
 		const QPointF &point, const QColor &fillColor, double tolerance,
 		int sourceLayerId, int size, int gap, int expansion,
@@ -29,6 +30,7 @@ public:
 		bool editable, bool dragging)
 		: m_tool(tool)
 		, m_cancel(cancel)
+		, m_fillCache(fillCache)
 		, m_canvasState(canvasState)
 		, m_contextId(contextId)
 		, m_point(point)
@@ -68,7 +70,8 @@ public:
 				m_sourceLayerId, size, continuous ? m_gap : 0, m_expansion,
 				m_kernel, m_featherRadius, false, continuous,
 				!m_editable && !m_dragging, m_viewMode, m_activeLayerId,
-				m_activeFrameIndex, m_cancel, m_img, m_x, m_y);
+				m_activeFrameIndex, m_fillCache.data(), m_cancel, m_img, m_x,
+				m_y);
 		}
 		if(m_result != DP_FLOOD_FILL_SUCCESS &&
 		   m_result != DP_FLOOD_FILL_CANCELLED) {
@@ -89,6 +92,7 @@ public:
 private:
 	FloodFill *m_tool;
 	const QAtomicInt &m_cancel;
+	QSharedPointer<DP_FloodFillCache> m_fillCache;
 	drawdance::CanvasState m_canvasState;
 	unsigned int m_contextId;
 	QPointF m_point;
@@ -120,6 +124,7 @@ FloodFill::FloodFill(ToolController &owner)
 			  Capability::AllowToolAdjust2 | Capability::AllowToolAdjust3)
 	, m_kernel(int(DP_FLOOD_FILL_KERNEL_ROUND))
 	, m_blendMode(DP_BLEND_MODE_NORMAL)
+	, m_fillCache(DP_flood_fill_cache_new(), DP_flood_fill_cache_free)
 	, m_originalBlendMode(m_blendMode)
 {
 }
@@ -331,7 +336,7 @@ void FloodFill::fillAt(const QPointF &point, int activeLayerId, bool editable)
 		requestToolNotice(
 			QCoreApplication::translate("FillSettings", "Filling…"));
 		m_owner.executeAsync(new Task(
-			this, m_cancel, paintEngine->viewCanvasState(),
+			this, m_cancel, m_fillCache, paintEngine->viewCanvasState(),
 			canvas->localUserId(), point, fillColor,
 			(m_dragging ? qRound(m_dragTolerance) : m_tolerance) / 255.0,
 			layerId, m_size, m_gap, m_expansion, DP_FloodFillKernel(m_kernel),
@@ -6,6 +6,9 @@
 #include <QAtomicInt>
 #include <QImage>
 #include <QPoint>
+#include <QSharedPointer>
+
+struct DP_FloodFillCache;
 
 namespace tools {
 
@@ -90,6 +93,7 @@ private:
 	bool m_pendingEditable = false;
 	bool m_dragging = false;
 	QAtomicInt m_cancel = false;
+	QSharedPointer<DP_FloodFillCache> m_fillCache;
 	QPointF m_lastPoint;
 	QPointF m_dragPrevPoint;
 	qreal m_dragTolerance = 0.0;
@@ -111,6 +111,11 @@ Freehand::Freehand(ToolController &owner, DP_MaskSync *ms)
 	QObject::connect(&m_pollTimer, &QTimer::timeout, [this] {
 		poll();
 	});
+	m_flushTimer.setSingleShot(true);
+	m_flushTimer.setTimerType(Qt::PreciseTimer);
+	QObject::connect(&m_flushTimer, &QTimer::timeout, [this] {
+		flushDabs();
+	});
 }
 
 Freehand::~Freehand()
@@ -199,7 +204,7 @@ void Freehand::strokeTo(const canvas::Point &point)
 	}
 
 	m_strokeWorker.strokeTo(point, canvasState);
-	m_strokeWorker.flushDabs();
+	flushDabsDeferred();
 }
 
 void Freehand::end(const EndParams &)
@@ -217,6 +222,8 @@ void Freehand::end(const EndParams &)
 			m_strokeWorker.strokeTo(m_start, canvasState);
 		}
 
+		// Ending the stroke flushes any dabs still being held back.
+		m_flushTimer.stop();
 		m_strokeWorker.endStroke(
 			QDateTime::currentMSecsSinceEpoch(), canvasState, true);
 	}
@@ -338,9 +345,30 @@ void Freehand::poll()
 	drawdance::CanvasState canvasState =
 		m_owner.model()->paintEngine()->sampleCanvasState();
 	m_strokeWorker.poll(QDateTime::currentMSecsSinceEpoch(), canvasState);
+	flushDabs();
+}
+
+void Freehand::flushDabs()
+{
+	m_flushTimer.stop();
+	m_flushElapsed.start();
 	m_strokeWorker.flushDabs();
 }
 
+void Freehand::flushDabsDeferred()
+{
+	if(!m_strokeWorker.canDeferDabs() || !m_flushElapsed.isValid()) {
+		flushDabs();
+	} else {
+		qint64 remaining = DAB_FLUSH_INTERVAL_MSEC - m_flushElapsed.elapsed();
+		if(remaining <= 0) {
+			flushDabs();
+		} else if(!m_flushTimer.isActive()) {
+			m_flushTimer.start(int(remaining));
+		}
+	}
+}
+
 DP_CanvasState *Freehand::sync()
 {
 	if(isOnMainThread()) {
@@ -5,6 +5,7 @@
 #include "libclient/tools/tool.h"
 #include "libshared/net/message.h"
 #include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QTimer>
 
 struct DP_LayerContent;
@@ -68,13 +69,21 @@ private:
 	void flushMessages();
 	void pollControl(bool enable);
 	void poll();
+	void flushDabs();
+	void flushDabsDeferred();
 	DP_CanvasState *sync();
 	void syncUnlock();
 	static void syncUnlockCallback(void *user);
 
 	static bool isOnMainThread();
 
+	// Input can arrive much faster than anyone can see it, so dabs are sent
+	// out at most this often during a stroke rather than once per input.
+	static constexpr int DAB_FLUSH_INTERVAL_MSEC = 8;
+
 	QTimer m_pollTimer;
+	QTimer m_flushTimer;
+	QElapsedTimer m_flushElapsed;
 	drawdance::StrokeWorker m_strokeWorker;
 	AntiOverflowSource m_antiOverflowSource;
 	DP_Mutex *m_mutex;
@@ -1,22 +1,30 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpengine/gradient.h>
+}
 #include "libclient/tools/gradient.h"
 #include "libclient/canvas/canvasmodel.h"
 #include "libclient/canvas/layerlist.h"
 #include "libclient/canvas/paintengine.h"
 #include "libclient/canvas/selectionmodel.h"
+#include "libclient/drawdance/image.h"
 #include "libclient/net/client.h"
 #include "libclient/tools/toolcontroller.h"
 #include "libclient/tools/utils.h"
 #include "libclient/utils/cursors.h"
 #include <QAtomicInteger>
 #include <QCursor>
-#include <QGradient>
 #include <QLineF>
-#include <QPainter>
-#include <QPainterPath>
 
 namespace tools {
 
+static DP_UPixelFloat toUPixelFloat(const QColor &color)
+{
+	return DP_UPixelFloat{
+		float(color.blueF()), float(color.greenF()), float(color.redF()),
+		float(color.alphaF())};
+}
+
 GradientTool::GradientTool(ToolController &owner)
 	: Tool(
 		  owner, GRADIENT, utils::Cursors::gradient(),
@@ -369,66 +377,46 @@ QImage GradientTool::applyGradient(const QImage &mask, const QLineF &line) const
 {
 	if(mask.isNull()) {
 		return QImage();
-	} else {
-		switch(m_shape) {
-		case Shape::Linear:
-			return applyLinearGradient(mask, line);
-		case Shape::Radial:
-			return applyRadialGradient(mask, line);
-		default:
-			qWarning("Invalid gradient shape %d", int(m_shape));
-			return QImage();
-		}
 	}
-}
-
-QImage
-GradientTool::applyLinearGradient(const QImage &mask, const QLineF &line) const
-{
-	QLinearGradient gradient(line.p1(), line.p2());
-	prepareGradient(gradient);
-	return paintGradient(mask, gradient);
-}
 
-QImage
-GradientTool::applyRadialGradient(const QImage &mask, const QLineF &line) const
-{
-	QRadialGradient gradient(
-		line.p1(), line.length(), line.pointAt(qBound(0.0, m_focus, 1.0)));
-	prepareGradient(gradient);
-	return paintGradient(mask, gradient);
-}
+	DP_Gradient gradient;
+	switch(m_shape) {
+	case Shape::Linear:
+		gradient.shape = DP_GRADIENT_SHAPE_LINEAR;
+		break;
+	case Shape::Radial:
+		gradient.shape = DP_GRADIENT_SHAPE_RADIAL;
+		break;
+	default:
+		qWarning("Invalid gradient shape %d", int(m_shape));
+		return QImage();
+	}
 
-void GradientTool::prepareGradient(QGradient &gradient) const
-{
-	gradient.setColorAt(0.0, m_color1);
-	gradient.setColorAt(1.0, m_color2);
 	switch(m_spread) {
 	case Spread::Pad:
-		gradient.setSpread(QGradient::PadSpread);
+		gradient.spread = DP_GRADIENT_SPREAD_PAD;
 		break;
 	case Spread::Reflect:
-		gradient.setSpread(QGradient::ReflectSpread);
+		gradient.spread = DP_GRADIENT_SPREAD_REFLECT;
 		break;
 	case Spread::Repeat:
-		gradient.setSpread(QGradient::RepeatSpread);
+		gradient.spread = DP_GRADIENT_SPREAD_REPEAT;
 		break;
 	default:
 		qWarning("Unknown gradient spread %d", int(m_spread));
+		gradient.spread = DP_GRADIENT_SPREAD_PAD;
 		break;
 	}
-}
 
-QImage
-GradientTool::paintGradient(const QImage &mask, QGradient &gradient) const
-{
-	QImage img = mask.copy();
-	QPainter painter(&img);
-	painter.setCompositionMode(QPainter::CompositionMode_SourceIn);
-	painter.setPen(Qt::NoPen);
-	painter.setBrush(gradient);
-	painter.drawRect(img.rect());
-	return img;
+	gradient.x1 = line.x1();
+	gradient.y1 = line.y1();
+	gradient.x2 = line.x2();
+	gradient.y2 = line.y2();
+	gradient.focus = qBound(0.0, m_focus, 1.0);
+	gradient.color1 = toUPixelFloat(m_color1);
+	gradient.color2 = toUPixelFloat(m_color2);
+	gradient.dither = false;
+	return drawdance::renderGradient(gradient, mask);
 }
 
 void GradientTool::previewPending()
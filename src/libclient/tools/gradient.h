@@ -10,8 +10,6 @@
 #include <QPointF>
 #include <QVector>
 
-class QGradient;
-
 namespace tools {
 
 class GradientTool final : public Tool {
@@ -50,10 +48,6 @@ private:
 
 	void updatePending();
 	QImage applyGradient(const QImage &mask, const QLineF &line) const;
-	QImage applyLinearGradient(const QImage &mask, const QLineF &line) const;
-	QImage applyRadialGradient(const QImage &mask, const QLineF &line) const;
-	void prepareGradient(QGradient &gradient) const;
-	QImage paintGradient(const QImage &mask, QGradient &gradient) const;
 
 	void previewPending();
 
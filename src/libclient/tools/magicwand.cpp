@@ -16,6 +16,7 @@ class MagicWandTool::Task final : public ToolController::Task {
 public:
 	Task(
 		MagicWandTool *tool, const QAtomicInt &cancel,
+		const QSharedPointer<DP_FloodFillCache> &fillCache,
 		const drawdance::CanvasState &canvasState, const QPointF &point,
 		int size, double tolerance, int sourceLayerId, int gap, int expansion,
 		DP_FloodFillKernel kernel, int featherRadius, bool continuous,
@@ -23,6 +24,7 @@ public:
 		int activeFrameIndex, const QColor &fillColor)
 		: m_tool(tool)
 		, m_cancel(cancel)
+		, m_fillCache(fillCache)
 		, m_canvasState(canvasState)
 		, m_point(point)
 		, m_size(size)
@@ -47,7 +49,8 @@ public:
 			0, 0, m_point.x(), m_point.y(), m_fillColor, m_tolerance,
 			m_sourceLayerId, m_size, m_continuous ? m_gap : 0, m_expansion,
 			m_kernel, m_featherRadius, false, m_continuous, false, m_viewMode,
-			m_activeLayerId, m_activeFrameIndex, m_cancel, m_img, m_x, m_y);
+			m_activeLayerId, m_activeFrameIndex, m_fillCache.data(), m_cancel,
+			m_img, m_x, m_y);
 		if(m_result != DP_FLOOD_FILL_SUCCESS &&
 		   m_result != DP_FLOOD_FILL_CANCELLED) {
 			m_error = QString::fromUtf8(DP_error());
@@ -65,6 +68,7 @@ public:
 private:
 	MagicWandTool *m_tool;
 	const QAtomicInt &m_cancel;
+	QSharedPointer<DP_FloodFillCache> m_fillCache;
 	drawdance::CanvasState m_canvasState;
 	QPointF m_point;
 	int m_size;
@@ -90,6 +94,7 @@ private:
 
 MagicWandTool::MagicWandTool(ToolController &owner)
 	: Tool(owner, MAGICWAND, Cursors::magicWand(), Capability::AllowColorPick)
+	, m_fillCache(DP_flood_fill_cache_new(), DP_flood_fill_cache_free)
 {
 }
 
@@ -293,7 +298,7 @@ void MagicWandTool::fillAt(const QPointF &point, bool constrain, bool center)
 
 		canvas::PaintEngine *paintEngine = canvas->paintEngine();
 		m_owner.executeAsync(new Task(
-			this, m_cancel, paintEngine->viewCanvasState(), point,
+			this, m_cancel, m_fillCache, paintEngine->viewCanvasState(), point,
 			selectionParams.size,
 			(m_dragging ? m_dragTolerance : selectionParams.tolerance) / 255.0,
 			layerId, selectionParams.gap, selectionParams.expansion,
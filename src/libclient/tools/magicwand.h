@@ -6,6 +6,9 @@
 #include "libclient/tools/toolcontroller.h"
 #include <QImage>
 #include <QPoint>
+#include <QSharedPointer>
+
+struct DP_FloodFillCache;
 
 namespace tools {
 
@@ -57,6 +60,7 @@ private:
 	bool m_held = false;
 	bool m_dragging = false;
 	QAtomicInt m_cancel;
+	QSharedPointer<DP_FloodFillCache> m_fillCache;
 	QPointF m_lastPoint;
 	QPointF m_dragPrevPoint;
 	qreal m_dragTolerance = 0.0;
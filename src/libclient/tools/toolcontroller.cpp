@@ -51,6 +51,7 @@ ToolController::ToolController(net::Client *client, QObject *parent)
 	, m_transformPreviewAccurate(true)
 	, m_transformInterpolation{DP_MSG_TRANSFORM_REGION_MODE_BILINEAR}
 	, m_transformPreviewIdsUsed(0)
+	, m_transformPreviewReduced(false)
 	, m_threadPool{this}
 	, m_taskCount{0}
 {
@@ -87,6 +88,9 @@ ToolController::ToolController(net::Client *client, QObject *parent)
 	connect(
 		this, &ToolController::asyncExecutionFinished, this,
 		&ToolController::notifyAsyncExecutionFinished, Qt::QueuedConnection);
+	connect(
+		this, &ToolController::transformToolStateChanged, this,
+		&ToolController::updateReducedTransformPreview);
 }
 
 void ToolController::registerTool(Tool *tool)
@@ -385,6 +389,9 @@ void ToolController::updateTransformPreview()
 			QPolygon dstPolygon = transform->dstQuad().polygon().toPolygon();
 			int interpolation =
 				transform->getEffectiveInterpolation(m_transformInterpolation);
+			// Dragging the transform around previews it at a lower resolution
+			// and switches back to full resolution once the drag ends.
+			bool reduced = transformTool()->isDragging();
 			int idsUsed = 0;
 			if(transform->isMovedFromCanvas()) {
 				int singleLayerMoveId =
@@ -395,7 +402,7 @@ void ToolController::updateTransformPreview()
 					if(!layerImage.isNull()) {
 						paintEngine->previewTransform(
 							idsUsed++, m_activeLayer, blendMode, opacity, x, y,
-							layerImage, dstPolygon, interpolation);
+							layerImage, dstPolygon, interpolation, reduced);
 					}
 				} else {
 					for(int layerId : transform->layerIds()) {
@@ -403,7 +410,7 @@ void ToolController::updateTransformPreview()
 						if(!layerImage.isNull()) {
 							paintEngine->previewTransform(
 								idsUsed++, layerId, blendMode, opacity, x, y,
-								layerImage, dstPolygon, interpolation);
+								layerImage, dstPolygon, interpolation, reduced);
 						}
 					}
 				}
@@ -415,19 +422,31 @@ void ToolController::updateTransformPreview()
 						? canvas::blendmode::toAlphaPreserving(blendMode)
 						: blendMode,
 					opacity, x, y, transform->floatingImage(), dstPolygon,
-					interpolation);
+					interpolation, reduced);
 			}
 
 			for(int i = idsUsed; i < m_transformPreviewIdsUsed; ++i) {
 				paintEngine->clearTransformPreview(i);
 			}
 			m_transformPreviewIdsUsed = idsUsed;
+			m_transformPreviewReduced = reduced;
 		} else {
 			paintEngine->clearAllTransformPreviews();
+			m_transformPreviewReduced = false;
 		}
 	}
 }
 
+void ToolController::updateReducedTransformPreview(
+	int mode, int handle, bool dragging)
+{
+	Q_UNUSED(mode);
+	Q_UNUSED(handle);
+	if(!dragging && m_transformPreviewReduced) {
+		updateTransformPreview();
+	}
+}
+
 void ToolController::setTransformCutPreview(
 	const QSet<int> &layerIds, const QRect &maskBounds, const QImage &mask)
 {
@@ -304,6 +304,7 @@ private slots:
 	void updateLayerAlphaLock(int layerId, bool alphaLock);
 	void updateSelection();
 	void updateTransformPreview();
+	void updateReducedTransformPreview(int mode, int handle, bool dragging);
 	void setTransformCutPreview(
 		const QSet<int> &layerIds, const QRect &maskBounds, const QImage &mask);
 	void clearTransformCutPreview();
@@ -352,6 +353,7 @@ private:
 	bool m_transformPreviewAccurate;
 	int m_transformInterpolation;
 	int m_transformPreviewIdsUsed;
+	bool m_transformPreviewReduced;
 	Tool::BeginParams m_hotSwapParams;
 	SelectionParams m_selectionParams;
 
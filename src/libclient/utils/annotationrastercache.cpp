@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libclient/utils/annotationrastercache.h"
+#include "libclient/drawdance/annotation.h"
+#include "libclient/utils/annotations.h"
+#include <QPainter>
+#include <cstring>
+
+namespace utils {
+
+AnnotationRasterCache &AnnotationRasterCache::global()
+{
+	static AnnotationRasterCache instance;
+	return instance;
+}
+
+AnnotationRasterCache::AnnotationRasterCache()
+	: m_cache(MAX_COST_BYTES)
+{
+}
+
+void AnnotationRasterCache::bake(
+	const drawdance::Annotation &annotation, unsigned char *out)
+{
+	QByteArray key = makeKey(annotation);
+	int width = annotation.width();
+	int height = annotation.height();
+	size_t size = size_t(width) * size_t(height) * sizeof(quint32);
+	{
+		QMutexLocker locker(&m_mutex);
+		const QImage *cached = m_cache.object(key);
+		if(cached) {
+			memcpy(out, cached->constBits(), size);
+			return;
+		}
+	}
+
+	// Render outside of the lock, other threads can bake in the meantime.
+	QImage img(out, width, height, QImage::Format_ARGB32_Premultiplied);
+	img.fill(0);
+	{
+		QPainter painter(&img);
+		paintAnnotation(
+			&painter, annotation.size(), annotation.backgroundColor(),
+			annotation.text(), annotation.alias(), annotation.valign());
+	}
+
+	int cost = size > size_t(MAX_COST_BYTES) ? MAX_COST_BYTES : int(size);
+	QMutexLocker locker(&m_mutex);
+	m_cache.insert(key, new QImage(img.copy()), cost);
+}
+
+void AnnotationRasterCache::clear()
+{
+	QMutexLocker locker(&m_mutex);
+	m_cache.clear();
+}
+
+QByteArray
+AnnotationRasterCache::makeKey(const drawdance::Annotation &annotation)
+{
+	// Position and id don't affect what the annotation looks like.
+	quint32 header[] = {
+		quint32(annotation.width()),
+		quint32(annotation.height()),
+		quint32(annotation.backgroundColor().rgba()),
+		quint32(annotation.valign()),
+		quint32(annotation.alias() ? 1 : 0),
+	};
+	QByteArray key(reinterpret_cast<const char *>(header), sizeof(header));
+	key.append(annotation.textBytes());
+	return key;
+}
+
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBCLIENT_UTILS_ANNOTATIONRASTERCACHE_H
+#define LIBCLIENT_UTILS_ANNOTATIONRASTERCACHE_H
+#include <QByteArray>
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+
+namespace drawdance {
+class Annotation;
+}
+
+namespace utils {
+
+// Rendered annotations for baking into exported images, shared between all
+// exports. They're keyed by what the annotation looks like, not by where it
+// is, so exporting again or after moving annotations around doesn't render
+// them from scratch. Editing an annotation changes its key, the stale raster
+// just falls out of the cache eventually.
+class AnnotationRasterCache final {
+public:
+	static AnnotationRasterCache &global();
+
+	// Fills the buffer, which must hold width * height premultiplied ARGB32
+	// pixels, reusing the cached raster if there is one. Thread-safe.
+	void bake(const drawdance::Annotation &annotation, unsigned char *out);
+
+	void clear();
+
+private:
+	static constexpr int MAX_COST_BYTES = 64 * 1024 * 1024;
+
+	AnnotationRasterCache();
+
+	static QByteArray makeKey(const drawdance::Annotation &annotation);
+
+	QMutex m_mutex;
+	QCache<QByteArray, QImage> m_cache;
+};
+
+}
+
+#endif
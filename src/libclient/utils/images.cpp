@@ -96,7 +96,8 @@ QStringList fileFormatFilterList(FileFormatOptions formats)
 
 	if(formats.testFlag(FileFormatOption::Profile)) {
 		if(formats.testFlag(FileFormatOption::Save)) {
-			filter << QGuiApplication::tr("Performance Profile (%1)").arg("*.dpperf");
+			filter << QGuiApplication::tr("Performance Profile (%1)").arg("*.dpperf")
+				<< QGuiApplication::tr("Chrome Trace (%1)").arg("*.json.gz");
 		} else {
 			// Can't read performance profiles.
 		}
@@ -1,365 +1,366 @@
-// SPDX-License-Identifier: GPL-2.0-or-later
-// Based on KisOutlineGenerator from Krita
-// SPDX-FileCopyrightText: 2004 Boudewijn Rempt <boud@valdyas.org>
-// SPDX-FileCopyrightText: 2007, 2010 Sven Langkamp <sven.langkamp@gmail.com>
-// Outline algorithm based of the limn of fontutils
-// SPDX-FileCopyrightText: 1992 Karl Berry <karl@cs.umb.edu>
-// SPDX-FileCopyrightText: 1992 Kathryn Hargreaves <letters@cs.umb.edu>
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/worker.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+}
 #include "libclient/utils/selectionoutlinegenerator.h"
-#include "libshared/util/qtcompat.h"
+#include <QHash>
 #include <QPolygon>
-#include <QScopedPointer>
 
 namespace {
 
-enum EdgeType {
-	TopEdge = 1,
-	LeftEdge = 2,
-	BottomEdge = 3,
-	RightEdge = 0,
-	NoEdge = 4
-};
+// Below this many tiles to trace, spinning up worker threads isn't worth it.
+constexpr int PARALLEL_MIN_TILES = 16;
 
-EdgeType nextEdge(EdgeType edge)
-{
-	return edge == NoEdge ? edge : EdgeType((edge + 1) % 4);
-}
+enum Direction { Right = 0, Down = 1, Left = 2, Up = 3 };
 
-#define TRY_PIXEL(deltaRow, deltaCol, test_edge)                               \
-	{                                                                          \
-		long long test_row = *row + deltaRow;                                  \
-		long long test_col = *col + deltaCol;                                  \
-		if((0LL <= (test_row) && (test_row) < m_scaledHeight &&                \
-			0LL <= (test_col) && (test_col) < m_scaledWidth) &&                \
-		   isOutlineEdge(test_edge, test_col, test_row)) {                     \
-			*row = test_row;                                                   \
-			*col = test_col;                                                   \
-			*edge = test_edge;                                                 \
-			break;                                                             \
-		}                                                                      \
-	}
+struct TilePixels {
+	DP_Tile *tile;
+	const DP_Pixel15 *pixels;
+	int width;
+	int height;
 
-class OutlineMap {
-	COMPAT_DISABLE_COPY_MOVE(OutlineMap)
-public:
-	static constexpr long long DIMENSION_LIMIT = 2048;
-
-	OutlineMap(
-		const QImage &mask, long long scaledWidth, long long scaledHeight)
-		: m_actualWidth(mask.width())
-		, m_actualHeight(mask.height())
-		, m_scaledWidth(scaledWidth)
-		, m_scaledHeight(scaledHeight)
-		, m_bits(reinterpret_cast<const uint32_t *>(mask.constBits()))
+	bool at(int x, int y) const
 	{
+		return x < width && y < height && pixels[y * DP_TILE_SIZE + x].a != 0;
 	}
+};
 
-	virtual ~OutlineMap() { delete[] m_marks; }
-
-	virtual uint32_t at(long long x, long long y) const = 0;
-	virtual bool isFullyOpaque() const = 0;
-	virtual void
-	appendToPath(QPolygon &path, long long x, long long y) const = 0;
-
-	long long actualWidth() const { return m_actualWidth; }
-	long long actualHeight() const { return m_actualHeight; }
-	long long scaledWidth() const { return m_scaledWidth; }
-	long long scaledHeight() const { return m_scaledHeight; }
-
-	void allocateMarks()
-	{
-		Q_ASSERT(!m_marks);
-		long long size = m_scaledWidth * m_scaledHeight;
-		m_marks = new uint8_t[size];
-		memset(m_marks, 0, size);
-	}
+struct TraceContext {
+	DP_LayerContent *lc;
+	int width;
+	int height;
+	int xtiles;
+	int ytiles;
+	QAtomicInt *running;
+};
 
-	uint8_t *pickMark(long long x, long long y)
-	{
-		Q_ASSERT(x >= 0);
-		Q_ASSERT(y >= 0);
-		Q_ASSERT(x < m_scaledWidth);
-		Q_ASSERT(y < m_scaledHeight);
-		return m_marks + y * m_scaledWidth + x;
-	}
+struct TraceJob {
+	const TraceContext *ctx;
+	int tx;
+	int ty;
+	QVector<QLine> *edges;
+};
 
-	bool isTransparent(long long x, long long y) const
-	{
-		return qAlpha(at(x, y)) == 0LL;
+DP_Tile *tileAt(const TraceContext &ctx, int tx, int ty)
+{
+	// The grid has an extra row and column past the edge of the canvas, since
+	// edges along the bottom and right are traced by the tiles beyond them.
+	if(tx >= 0 && ty >= 0 && tx < ctx.xtiles && ty < ctx.ytiles) {
+		return DP_layer_content_tile_at_noinc(ctx.lc, tx, ty);
+	} else {
+		return nullptr;
 	}
+}
 
-	bool isOutlineEdge(EdgeType edge, long long x, long long y) const
-	{
-		if(!isTransparent(x, y)) {
-			switch(edge) {
-			case LeftEdge:
-				return x == 0LL || isTransparent(x - 1LL, y);
-			case TopEdge:
-				return y == 0LL || isTransparent(x, y - 1LL);
-			case RightEdge:
-				return x == m_scaledWidth - 1LL || isTransparent(x + 1LL, y);
-			case BottomEdge:
-				return y == m_scaledHeight - 1LL || isTransparent(x, y + 1LL);
-			case NoEdge:
-				break;
-			}
-		}
-		return false;
+TilePixels acquireTilePixels(const TraceContext &ctx, int tx, int ty)
+{
+	DP_Tile *t = tileAt(ctx, tx, ty);
+	if(t) {
+		return {
+			t, DP_tile_pixels_acquire(t),
+			qBound(0, ctx.width - tx * DP_TILE_SIZE, DP_TILE_SIZE),
+			qBound(0, ctx.height - ty * DP_TILE_SIZE, DP_TILE_SIZE)};
+	} else {
+		return {nullptr, nullptr, 0, 0};
 	}
+}
 
-	void nextOutlineEdge(EdgeType *edge, long long *row, long long *col) const
-	{
-		long long originalRow = *row;
-		long long originalCol = *col;
-
-		switch(*edge) {
-		case RightEdge:
-			TRY_PIXEL(-1LL, 0LL, RightEdge);
-			TRY_PIXEL(-1LL, 1LL, BottomEdge);
-			break;
-		case TopEdge:
-			TRY_PIXEL(0LL, -1LL, TopEdge);
-			TRY_PIXEL(-1LL, -1LL, RightEdge);
-			break;
-		case LeftEdge:
-			TRY_PIXEL(1LL, 0LL, LeftEdge);
-			TRY_PIXEL(1LL, -1LL, TopEdge);
-			break;
-		case BottomEdge:
-			TRY_PIXEL(0LL, 1LL, BottomEdge);
-			TRY_PIXEL(1LL, 1LL, LeftEdge);
-			break;
-		default:
-			break;
-		}
-
-		if(*row == originalRow && *col == originalCol) {
-			*edge = nextEdge(*edge);
-		}
+void releaseTilePixels(const TilePixels &tp)
+{
+	if(tp.tile) {
+		DP_tile_pixels_release(tp.tile);
 	}
+}
 
-	void appendCoordinate(
-		QPolygon &path, long long x, long long y, EdgeType edge) const
-	{
-		if(edge == TopEdge) {
-			++x;
-		} else if(edge == BottomEdge) {
-			++y;
-		} else if(edge == RightEdge) {
-			++x;
-			++y;
-		}
-		appendToPath(path, x, y);
+// Edges are directed so that the selected area is always to their right,
+// which lets them be stitched into polygons by just following them along.
+void appendHorizontalEdge(
+	QVector<QLine> &edges, int state, int x0, int x1, int y)
+{
+	if(state > 0) {
+		edges.append(QLine(x0, y, x1, y));
+	} else if(state < 0) {
+		edges.append(QLine(x1, y, x0, y));
 	}
+}
 
-protected:
-	const long long m_actualWidth;
-	const long long m_actualHeight;
-	const long long m_scaledWidth;
-	const long long m_scaledHeight;
-	const uint32_t *const m_bits;
-
-private:
-	uint8_t *m_marks = nullptr;
-};
-
-class PlainOutlineMap final : public OutlineMap {
-	COMPAT_DISABLE_COPY_MOVE(PlainOutlineMap)
-public:
-	PlainOutlineMap(const QImage &mask)
-		: OutlineMap(mask, mask.width(), mask.height())
-	{
+void appendVerticalEdge(
+	QVector<QLine> &edges, int state, int x, int y0, int y1)
+{
+	if(state > 0) {
+		edges.append(QLine(x, y1, x, y0));
+	} else if(state < 0) {
+		edges.append(QLine(x, y0, x, y1));
 	}
+}
 
-	uint32_t at(long long x, long long y) const override
-	{
-		return m_bits[y * m_actualWidth + x];
-	}
+int edgeState(bool inside, bool outside)
+{
+	return inside == outside ? 0 : inside ? 1 : -1;
+}
 
-	bool isFullyOpaque() const override
-	{
-		long long size = m_actualWidth * m_actualHeight;
-		for(long long i = 0LL; i < size; ++i) {
-			if(qAlpha(m_bits[i]) == 0u) {
-				return false;
+// Each tile traces the edges along the tops and left sides of its pixels, so
+// it depends on itself and on the tiles above and to the left of it.
+void traceTile(
+	const TraceContext &ctx, int tx, int ty, QVector<QLine> &outEdges)
+{
+	TilePixels self = acquireTilePixels(ctx, tx, ty);
+	TilePixels top = acquireTilePixels(ctx, tx, ty - 1);
+	TilePixels left = acquireTilePixels(ctx, tx - 1, ty);
+
+	int tileX = tx * DP_TILE_SIZE;
+	int tileY = ty * DP_TILE_SIZE;
+	for(int y = 0; y < DP_TILE_SIZE; ++y) {
+		int runState = 0;
+		int runStart = 0;
+		for(int x = 0; x < DP_TILE_SIZE; ++x) {
+			bool above =
+				y == 0 ? top.at(x, DP_TILE_SIZE - 1) : self.at(x, y - 1);
+			int state = edgeState(self.at(x, y), above);
+			if(state != runState) {
+				appendHorizontalEdge(
+					outEdges, runState, tileX + runStart, tileX + x,
+					tileY + y);
+				runState = state;
+				runStart = x;
 			}
 		}
-		return true;
-	}
-
-	void appendToPath(QPolygon &path, long long x, long long y) const override
-	{
-		path.append(QPoint(x, y));
-	}
-};
-
-class ScaledOutlineMap final : public OutlineMap {
-	COMPAT_DISABLE_COPY_MOVE(ScaledOutlineMap)
-public:
-	ScaledOutlineMap(const QImage &mask)
-		: OutlineMap(
-			  mask, clampDimension(mask.width()), clampDimension(mask.height()))
-		, m_ratioX(qreal(m_actualWidth) / qreal(m_scaledWidth))
-		, m_ratioY(qreal(m_actualHeight) / qreal(m_scaledHeight))
-	{
+		appendHorizontalEdge(
+			outEdges, runState, tileX + runStart, tileX + DP_TILE_SIZE,
+			tileY + y);
 	}
 
-	uint32_t at(long long x, long long y) const override
-	{
-		long long actualX = toActualX(x);
-		Q_ASSERT(actualX >= 0LL);
-		Q_ASSERT(actualX < m_actualWidth);
-		long long actualY = toActualY(y);
-		Q_ASSERT(actualY >= 0LL);
-		Q_ASSERT(actualY < m_actualHeight);
-		return m_bits[actualY * m_actualWidth + actualX];
-	}
-
-	bool isFullyOpaque() const override
-	{
-		for(long long y = 0LL; y < m_scaledHeight; ++y) {
-			for(long long x = 0LL; x < m_scaledWidth; ++x) {
-				if(isTransparent(x, y)) {
-					return false;
-				}
+	for(int x = 0; x < DP_TILE_SIZE; ++x) {
+		int runState = 0;
+		int runStart = 0;
+		for(int y = 0; y < DP_TILE_SIZE; ++y) {
+			bool before =
+				x == 0 ? left.at(DP_TILE_SIZE - 1, y) : self.at(x - 1, y);
+			int state = edgeState(self.at(x, y), before);
+			if(state != runState) {
+				appendVerticalEdge(
+					outEdges, runState, tileX + x, tileY + runStart,
+					tileY + y);
+				runState = state;
+				runStart = y;
 			}
 		}
-		return true;
-	}
-
-	void appendToPath(QPolygon &path, long long x, long long y) const override
-	{
-		path.append(QPoint(toActualX(x), toActualY(y)));
+		appendVerticalEdge(
+			outEdges, runState, tileX + x, tileY + runStart,
+			tileY + DP_TILE_SIZE);
 	}
 
-private:
-	static long long clampDimension(long long dimension)
-	{
-		return dimension < DIMENSION_LIMIT ? dimension : DIMENSION_LIMIT;
-	}
+	releaseTilePixels(left);
+	releaseTilePixels(top);
+	releaseTilePixels(self);
+}
 
-	long long toActualX(long long scaledX) const
-	{
-		return qRound64(qreal(scaledX) * m_ratioX);
+void handleTraceJob(void *element, int threadIndex)
+{
+	Q_UNUSED(threadIndex);
+	TraceJob *job = static_cast<TraceJob *>(element);
+	if(*job->ctx->running) {
+		traceTile(*job->ctx, job->tx, job->ty, *job->edges);
 	}
+}
 
-	long long toActualY(long long scaledY) const
-	{
-		return qRound64(qreal(scaledY) * m_ratioY);
-	}
+bool isOpaqueTile(DP_Tile *t)
+{
+	return t && DP_tile_opaque_ident(t);
+}
 
-	const qreal m_ratioX;
-	const qreal m_ratioY;
-};
+quint64 pointKey(const QPoint &p)
+{
+	return (quint64(quint32(p.x())) << 32) | quint64(quint32(p.y()));
+}
 
-OutlineMap *makeOutlineSource(const QImage &mask)
+int edgeDirection(const QLine &edge)
 {
-	if(mask.width() < OutlineMap::DIMENSION_LIMIT &&
-	   mask.height() < OutlineMap::DIMENSION_LIMIT) {
-		return new PlainOutlineMap(mask);
+	if(edge.dx() > 0) {
+		return Right;
+	} else if(edge.dx() < 0) {
+		return Left;
+	} else if(edge.dy() > 0) {
+		return Down;
 	} else {
-		return new ScaledOutlineMap(mask);
+		return Up;
 	}
 }
 
-QPainterPath generateOutline(
-	const QImage &mask, bool simple, int xOffset, int yOffset,
-	QAtomicInt &running)
+// Follows the edges around into closed polygons. Where two of them touch at a
+// corner, turning right keeps them apart instead of making a figure eight.
+QPainterPath stitchEdges(
+	const QVector<QLine> &edges, const QPoint &offset,
+	const QAtomicInt &running)
 {
-	Q_ASSERT(mask.format() == QImage::Format_ARGB32_Premultiplied);
-	QScopedPointer<OutlineMap> o(makeOutlineSource(mask));
-
-	QPainterPath paths;
-	if(o->isFullyOpaque()) {
-		paths.addRect(xOffset, yOffset, o->actualWidth(), o->actualHeight());
-		return paths;
+	int count = edges.size();
+	QHash<quint64, int> heads;
+	heads.reserve(count);
+	QVector<int> next(count);
+	for(int i = 0; i < count; ++i) {
+		quint64 key = pointKey(edges[i].p1());
+		next[i] = heads.value(key, -1);
+		heads.insert(key, i);
 	}
 
-	o->allocateMarks();
-
-	long long scaledWidth = o->scaledWidth();
-	long long scaledHeight = o->scaledHeight();
-	for(long long y = 0; y < scaledHeight; y++) {
-		if(!running) {
-			paths.clear();
-			break;
+	QPainterPath path;
+	QVector<bool> used(count, false);
+	for(int i = 0; i < count; ++i) {
+		if(used[i]) {
+			continue;
+		} else if(!running) {
+			return QPainterPath();
 		}
 
-		for(long long x = 0; x < scaledWidth; x++) {
-			if(o->isTransparent(x, y)) {
-				continue;
-			}
-
-			const EdgeType initialEdge = TopEdge;
-
-			EdgeType startEdge = initialEdge;
-			while(startEdge != NoEdge &&
-				  (*o->pickMark(x, y) & (1 << startEdge) ||
-				   !o->isOutlineEdge(startEdge, x, y))) {
-
-				startEdge = nextEdge(startEdge);
-				if(startEdge == initialEdge)
-					startEdge = NoEdge;
+		QPolygon polygon;
+		int lastDirection = -1;
+		int current = i;
+		while(current != -1) {
+			used[current] = true;
+			const QLine &edge = edges[current];
+			int direction = edgeDirection(edge);
+			// Straight lines, including ones running across tile borders,
+			// don't need any points in the middle of them.
+			if(direction != lastDirection) {
+				polygon.append(edge.p1() - offset);
+				lastDirection = direction;
 			}
 
-			if(startEdge != NoEdge) {
-				QPolygon path;
-				const bool clockwise = startEdge == BottomEdge;
-
-				long long row = y, col = x;
-				EdgeType currentEdge = startEdge;
-				EdgeType lastEdge = NoEdge;
-
-				if(currentEdge == BottomEdge) {
-					o->appendCoordinate(
-						path, col + xOffset, row + yOffset, currentEdge);
-					lastEdge = BottomEdge;
+			current = -1;
+			int currentRank = 0;
+			for(int j = heads.value(pointKey(edge.p2()), -1); j != -1;
+				j = next[j]) {
+				if(!used[j]) {
+					int turn = (edgeDirection(edges[j]) - direction + 4) % 4;
+					int rank = turn == 1 ? 3 : turn == 0 ? 2 : 1;
+					if(rank > currentRank) {
+						current = j;
+						currentRank = rank;
+					}
 				}
+			}
+		}
 
-				while(true) {
-					*o->pickMark(col, row) |= 1 << currentEdge;
-					o->nextOutlineEdge(&currentEdge, &row, &col);
-
-					// While following a straight line no points need to be
-					// added
-					if(lastEdge != currentEdge) {
-						o->appendCoordinate(
-							path, col + xOffset, row + yOffset, currentEdge);
-						lastEdge = currentEdge;
-					}
+		path.addPolygon(polygon);
+		path.closeSubpath();
+	}
+	return path;
+}
 
-					if(row == y && col == x && currentEdge == startEdge) {
-						if(startEdge != BottomEdge) {
-							// add last point of the polygon
-							o->appendCoordinate(
-								path, col + xOffset, row + yOffset, NoEdge);
-						}
-						break;
-					}
-				}
+SelectionOutlinePath generateOutline(
+	const drawdance::LayerContent &content, const QRect &bounds,
+	const SelectionOutlineCache *previous, QAtomicInt &running)
+{
+	DP_LayerContent *lc = content.get();
+	int width = DP_layer_content_width(lc);
+	int height = DP_layer_content_height(lc);
+	TraceContext ctx = {
+		lc,
+		width,
+		height,
+		DP_tile_count_round(width),
+		DP_tile_count_round(height),
+		&running};
+
+	DP_LayerContent *prevLc = nullptr;
+	if(previous && !previous->content.isNull()) {
+		DP_LayerContent *prevContent = previous->content.get();
+		if(DP_layer_content_width(prevContent) == width &&
+		   DP_layer_content_height(prevContent) == height) {
+			prevLc = prevContent;
+		}
+	}
+	TraceContext prevCtx = ctx;
+	prevCtx.lc = prevLc;
+
+	SelectionOutlineCache *cache = new SelectionOutlineCache{content, {}};
+	SelectionOutlinePath result = {QPainterPath(), {}};
+	result.cache.reset(cache);
+	int gridWidth = ctx.xtiles + 1;
+	cache->tileEdges.resize(gridWidth * (ctx.ytiles + 1));
+
+	// Tiles outside of the selection bounds are transparent, so they don't have
+	// any edges to trace, except for the ones just past its bottom and right.
+	int left = qMax(0, bounds.left() / DP_TILE_SIZE);
+	int top = qMax(0, bounds.top() / DP_TILE_SIZE);
+	int right = qMin(ctx.xtiles, (bounds.right() + 1) / DP_TILE_SIZE);
+	int bottom = qMin(ctx.ytiles, (bounds.bottom() + 1) / DP_TILE_SIZE);
+
+	QVector<TraceJob> jobs;
+	QVector<QLine> *tileEdges = cache->tileEdges.data();
+	for(int ty = top; ty <= bottom; ++ty) {
+		for(int tx = left; tx <= right; ++tx) {
+			DP_Tile *self = tileAt(ctx, tx, ty);
+			DP_Tile *above = tileAt(ctx, tx, ty - 1);
+			DP_Tile *before = tileAt(ctx, tx - 1, ty);
+			int i = ty * gridWidth + tx;
+			if(prevLc && self == tileAt(prevCtx, tx, ty) &&
+			   above == tileAt(prevCtx, tx, ty - 1) &&
+			   before == tileAt(prevCtx, tx - 1, ty)) {
+				tileEdges[i] = previous->tileEdges[i];
+			} else if(!self && !above && !before) {
+				continue;
+			} else if(
+				isOpaqueTile(self) && isOpaqueTile(above) &&
+				isOpaqueTile(before) && (tx + 1) * DP_TILE_SIZE <= width &&
+				(ty + 1) * DP_TILE_SIZE <= height) {
+				continue;
+			} else {
+				jobs.append({&ctx, tx, ty, &tileEdges[i]});
+			}
+		}
+	}
 
-				if(!simple || !clockwise) {
-					paths.addPolygon(path);
-				}
+	int jobCount = jobs.size();
+	if(jobCount < PARALLEL_MIN_TILES) {
+		for(int i = 0; i < jobCount; ++i) {
+			handleTraceJob(&jobs[i], 0);
+		}
+	} else {
+		DP_Worker *worker = DP_worker_new_with_priority(
+			size_t(jobCount), sizeof(TraceJob), DP_worker_cpu_count(16),
+			DP_WORKER_PRIORITY_LOW, handleTraceJob);
+		if(worker) {
+			for(int i = 0; i < jobCount; ++i) {
+				DP_worker_push(worker, &jobs[i]);
+			}
+			DP_worker_free_join(worker);
+		} else {
+			qWarning("Error creating outline worker: %s", DP_error());
+			for(int i = 0; i < jobCount; ++i) {
+				handleTraceJob(&jobs[i], 0);
 			}
 		}
 	}
 
-	return paths;
+	if(running) {
+		QVector<QLine> edges;
+		for(int ty = top; ty <= bottom; ++ty) {
+			for(int tx = left; tx <= right; ++tx) {
+				edges.append(tileEdges[ty * gridWidth + tx]);
+			}
+		}
+		result.value = stitchEdges(edges, bounds.topLeft(), running);
+	}
+	return result;
 }
 
 }
 
 
 SelectionOutlineGenerator::SelectionOutlineGenerator(
-	unsigned int executionId, const QImage &mask, bool simple, int xOffset,
-	int yOffset, QObject *parent)
+	unsigned int executionId, const drawdance::LayerContent &content,
+	const QRect &bounds,
+	const QSharedPointer<const SelectionOutlineCache> &previous,
+	QObject *parent)
 	: QObject(parent)
 	, m_executionId(executionId)
-	, m_mask(mask)
-	, m_simple(simple)
-	, m_xOffset(xOffset)
-	, m_yOffset(yOffset)
+	, m_content(content)
+	, m_bounds(bounds)
+	, m_previous(previous)
 {
 	qRegisterMetaType<SelectionOutlinePath>();
 }
@@ -367,8 +368,8 @@ SelectionOutlineGenerator::SelectionOutlineGenerator(
 void SelectionOutlineGenerator::run()
 {
 	if(m_running) {
-		SelectionOutlinePath path = {
-			generateOutline(m_mask, m_simple, m_xOffset, m_yOffset, m_running)};
+		SelectionOutlinePath path =
+			generateOutline(m_content, m_bounds, m_previous.data(), m_running);
 		if(m_running) {
 			emit outlineGenerated(m_executionId, path);
 		}
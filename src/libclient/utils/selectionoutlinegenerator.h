@@ -1,30 +1,43 @@
-// SPDX-License-Identifier: GPL-2.0-or-later
-// Based on KisOutlineGenerator from Krita
-// SPDX-FileCopyrightText: 2004 Boudewijn Rempt <boud@valdyas.org>
-// SPDX-FileCopyrightText: 2007, 2010 Sven Langkamp <sven.langkamp@gmail.com>
-// Outline algorithm based of the limn of fontutils
-// SPDX-FileCopyrightText: 1992 Karl Berry <karl@cs.umb.edu>
-// SPDX-FileCopyrightText: 1992 Kathryn Hargreaves <letters@cs.umb.edu>
+// SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef LIBCLIENT_UTILS_SELECTIONOUTLINEGENERATOR_H
 #define LIBCLIENT_UTILS_SELECTIONOUTLINEGENERATOR_H
+#include "libclient/drawdance/layercontent.h"
 #include <QAtomicInt>
-#include <QImage>
+#include <QLine>
 #include <QObject>
 #include <QPainterPath>
+#include <QRect>
 #include <QRunnable>
+#include <QSharedPointer>
+#include <QVector>
+
+// Edges traced from each tile of a selection mask, in canvas coordinates.
+// Holds on to the content they were traced from, so that the next outline
+// can tell which tiles changed by comparing them and only retrace those.
+struct SelectionOutlineCache {
+	drawdance::LayerContent content;
+	QVector<QVector<QLine>> tileEdges;
+};
 
 // Qt5 doesn't have a metatype registered for QPainterPath.
 struct SelectionOutlinePath {
 	QPainterPath value;
+	QSharedPointer<const SelectionOutlineCache> cache;
 };
 Q_DECLARE_METATYPE(SelectionOutlinePath)
 
+// Traces the outline of a selection tile by tile, in parallel if there's
+// enough of them, then stitches the edges together into polygons. The path
+// is relative to the top-left of the given bounds. If a cache from a previous
+// outline is given, tiles that are unchanged since then aren't traced again.
 class SelectionOutlineGenerator : public QObject, public QRunnable {
 	Q_OBJECT
 public:
 	explicit SelectionOutlineGenerator(
-		unsigned int executionId, const QImage &mask, bool simple, int xOffset,
-		int yOffset, QObject *parent = nullptr);
+		unsigned int executionId, const drawdance::LayerContent &content,
+		const QRect &bounds,
+		const QSharedPointer<const SelectionOutlineCache> &previous,
+		QObject *parent = nullptr);
 
 	void run() override;
 
@@ -37,10 +50,9 @@ signals:
 
 private:
 	const unsigned int m_executionId;
-	const QImage m_mask;
-	const bool m_simple;
-	const int m_xOffset;
-	const int m_yOffset;
+	const drawdance::LayerContent m_content;
+	const QRect m_bounds;
+	const QSharedPointer<const SelectionOutlineCache> m_previous;
 	QAtomicInt m_running = 1;
 };
 
@@ -2,6 +2,7 @@
 
 #include "libserver/announcements.h"
 #include "libserver/announcable.h"
+#include "libserver/profiler.h"
 
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
@@ -20,6 +21,9 @@ Announcements::Announcements(server::ServerConfig *config, QObject *parent)
 
 void Announcements::announceSession(Announcable *session, const QUrl &listServer)
 {
+	server::Profiler::Scope profilerScope(
+		server::Profiler::Category::Announcements);
+
 	Q_ASSERT(session);
 
 	if(!listServer.isValid() || !m_config->isAllowedAnnouncementUrl(listServer)) {
@@ -58,6 +62,8 @@ void Announcements::announceSession(Announcable *session, const QUrl &listServer
 	auto *response = sessionlisting::announceSession(listServer, description);
 
 	connect(response, &AnnouncementApiResponse::finished, this, [listServer, session, description, response, this](const QVariant &result, const QString &message, const QString &error) {
+		server::Profiler::Scope profilerScope(
+			server::Profiler::Category::Announcements);
 		response->deleteLater();
 
 		Listing *listing = findListing(listServer, session);
@@ -113,6 +119,9 @@ void Announcements::announceSession(Announcable *session, const QUrl &listServer
 
 void Announcements::unlistSession(Announcable *session, const QUrl &listServer, bool delist)
 {
+	server::Profiler::Scope profilerScope(
+		server::Profiler::Category::Announcements);
+
 	QMutableVectorIterator<Listing> i(m_announcements);
 	QSet<Announcable*> changes;
 
@@ -171,12 +180,16 @@ void Announcements::timerEvent(QTimerEvent *event)
 
 void Announcements::refreshListings()
 {
+	server::Profiler::Scope profilerScope(
+		server::Profiler::Category::Announcements);
+
 	using Update = QPair<Announcement, Session>;
 
 	QSet<QUrl> refreshServers;
 	for(Listing &listing : m_announcements) {
 		bool shouldRefresh =
 			!refreshServers.contains(listing.listServer) &&
+			!m_pendingRefreshes.contains(listing.listServer) &&
 			listing.finishedListing &&
 			(listing.refreshTimer.hasExpired(
 				 listing.announcement.refreshInterval * 60 * 1000) ||
@@ -186,10 +199,14 @@ void Announcements::refreshListings()
 		}
 	}
 
+	// Everything listed at the same server goes into a single bulk request,
+	// listings that aren't due yet just get refreshed early.
 	for(QUrl refreshServer : refreshServers) {
 		QVector<Update> updates;
 		for(Listing &listing : m_announcements) {
-			if(listing.listServer == refreshServer) {
+			// Listings still being announced don't have a listing id yet.
+			if(listing.listServer == refreshServer &&
+			   listing.finishedListing) {
 				updates.append(
 					{listing.announcement,
 					 listing.session->getSessionAnnouncement()});
@@ -215,6 +232,7 @@ void Announcements::refreshListings()
 				.to(m_config->logger());
 		}
 
+		m_pendingRefreshes.insert(refreshServer);
 		AnnouncementApiResponse *response =
 			sessionlisting::refreshSessions(updates);
 
@@ -223,7 +241,10 @@ void Announcements::refreshListings()
 			[this, refreshServer, updates, response](
 				const QVariant &result, const QString &message,
 				const QString &error) {
+				server::Profiler::Scope profilerScope(
+					server::Profiler::Category::Announcements);
 				response->deleteLater();
+				m_pendingRefreshes.remove(refreshServer);
 
 				if(!message.isEmpty()) {
 					server::Log()
@@ -6,6 +6,7 @@
 #include "libshared/listings/announcementapi.h"
 
 #include <QObject>
+#include <QSet>
 #include <QVector>
 #include <QElapsedTimer>
 
@@ -78,6 +79,9 @@ private:
 	void refreshListings();
 
 	QVector<Listing> m_announcements;
+	// List servers with a bulk refresh in flight. Slow list servers would
+	// otherwise get another batch of every listing stacked on top.
+	QSet<QUrl> m_pendingRefreshes;
 	server::ServerConfig *m_config;
 
 	int m_timerId;
@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Benchmark for the server's session history storage. Fills an in-memory and a
+// file-backed history with generated strokes and measures how long adding
+// messages, getting batches out of memory and off the disk, releasing cached
+// blocks, swapping in a streamed reset and loading the history back from its
+// journal and recording files take.
+extern "C" {
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+}
+#include "libserver/filedhistory.h"
+#include "libserver/inmemoryhistory.h"
+#include "libshared/net/message.h"
+#include "libshared/net/protover.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QVector>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <dpcommon/platform_qt.h>
+
+using server::FiledHistory;
+using server::InMemoryHistory;
+using server::SessionHistory;
+
+namespace {
+
+struct Options {
+	int messages = 200000;
+	int dabs = 24;
+	int resetMessages = 10000;
+	int loadRepeat = 5;
+	unsigned int seed = 1;
+	QString dir;
+};
+
+struct PixelDabsUser {
+	std::mt19937 *rng;
+};
+
+static void setPixelDabs(int count, DP_PixelDab *pds, void *user)
+{
+	std::mt19937 &rng = *static_cast<PixelDabsUser *>(user)->rng;
+	std::uniform_int_distribution<int> offset(-8, 8);
+	std::uniform_int_distribution<int> size(1, 64);
+	std::uniform_int_distribution<int> opacity(1, 255);
+	for(int i = 0; i < count; ++i) {
+		DP_pixel_dab_init(
+			pds, i, int8_t(offset(rng)), int8_t(offset(rng)),
+			uint16_t(size(rng)), uint8_t(opacity(rng)));
+	}
+}
+
+// Strokes of a handful of dab messages each, followed by a pen up and undo
+// point, roughly like what a session full of drawing looks like.
+static net::MessageList
+generateMessages(int count, int dabs, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> strokeLength(2, 40);
+	std::uniform_int_distribution<int> coordinate(0, 4000);
+	std::uniform_int_distribution<uint32_t> color;
+	std::uniform_int_distribution<int> user(1, 20);
+	PixelDabsUser dabsUser = {&rng};
+
+	net::MessageList msgs;
+	msgs.reserve(count);
+	while(msgs.size() < count) {
+		unsigned int contextId = unsigned(user(rng));
+		uint32_t layerId = (contextId << 8) | 1u;
+		for(int i = strokeLength(rng); i > 0 && msgs.size() < count; --i) {
+			msgs.append(net::Message::noinc(DP_msg_draw_dabs_pixel_new(
+				contextId, 0, layerId, coordinate(rng) * 4, coordinate(rng) * 4,
+				color(rng) | 0xff000000u, DP_BLEND_MODE_NORMAL, setPixelDabs,
+				dabs, &dabsUser)));
+		}
+		if(msgs.size() < count) {
+			msgs.append(
+				net::Message::noinc(DP_msg_pen_up_new(contextId, layerId)));
+		}
+		if(msgs.size() < count) {
+			msgs.append(net::Message::noinc(DP_msg_undo_point_new(contextId)));
+		}
+	}
+	return msgs;
+}
+
+static size_t totalLength(const net::MessageList &msgs)
+{
+	size_t length = 0;
+	for(const net::Message &msg : msgs) {
+		length += msg.length();
+	}
+	return length;
+}
+
+static double nsecsToMsecs(qint64 nsecs)
+{
+	return double(nsecs) / 1.0e6;
+}
+
+static QString describeTimes(QVector<qint64> nsecs)
+{
+	if(nsecs.isEmpty()) {
+		return QStringLiteral("n/a");
+	}
+	std::sort(nsecs.begin(), nsecs.end());
+	qint64 total = 0;
+	for(qint64 n : nsecs) {
+		total += n;
+	}
+	return QStringLiteral("%1 calls, total %2ms, min %3ms, median %4ms, p99 "
+						  "%5ms, max %6ms")
+		.arg(nsecs.size())
+		.arg(nsecsToMsecs(total), 0, 'f', 3)
+		.arg(nsecsToMsecs(nsecs.first()), 0, 'f', 3)
+		.arg(nsecsToMsecs(nsecs[nsecs.size() / 2]), 0, 'f', 3)
+		.arg(nsecsToMsecs(nsecs[(nsecs.size() - 1) * 99 / 100]), 0, 'f', 3)
+		.arg(nsecsToMsecs(nsecs.last()), 0, 'f', 3);
+}
+
+static void print(const char *history, const char *what, const QString &text)
+{
+	printf("%-9s %-16s %s\n", history, what, qUtf8Printable(text));
+	fflush(stdout);
+}
+
+static bool benchAdd(
+	const char *name, SessionHistory *history, const net::MessageList &msgs,
+	size_t bytes)
+{
+	QElapsedTimer timer;
+	timer.start();
+	for(const net::Message &msg : msgs) {
+		if(!history->addMessage(msg)) {
+			fprintf(stderr, "%s: adding message failed\n", name);
+			return false;
+		}
+	}
+	qint64 nsecs = timer.nsecsElapsed();
+	double secs = double(nsecs) / 1.0e9;
+	print(
+		name, "addMessage",
+		QStringLiteral("%1 messages in %2ms, %3 msg/s, %4 MiB/s")
+			.arg(msgs.size())
+			.arg(nsecsToMsecs(nsecs), 0, 'f', 3)
+			.arg(double(msgs.size()) / secs, 0, 'f', 0)
+			.arg(double(bytes) / 1024.0 / 1024.0 / secs, 0, 'f', 2));
+	return true;
+}
+
+// Walks through the whole history the same way catching up clients do.
+static bool
+benchGetBatch(const char *name, const char *what, const SessionHistory *history)
+{
+	QVector<qint64> nsecs;
+	long long messageCount = 0;
+	long long after = history->firstIndex() - 1LL;
+	long long lastIndex = history->lastIndex();
+	QElapsedTimer timer;
+	while(after < lastIndex) {
+		timer.start();
+		server::HistoryBatch batch;
+		long long batchLast;
+		std::tie(batch, batchLast) = history->getBatch(after);
+		nsecs.append(timer.nsecsElapsed());
+		if(batch.isEmpty() || batchLast <= after) {
+			fprintf(stderr, "%s: got stuck at index %lld\n", name, after);
+			return false;
+		}
+		messageCount += batch.size();
+		after = batchLast;
+	}
+
+	long long expected = lastIndex - history->firstIndex() + 1LL;
+	if(messageCount != expected) {
+		fprintf(
+			stderr, "%s: got %lld messages, expected %lld\n", name,
+			messageCount, expected);
+		return false;
+	}
+	print(name, what, describeTimes(nsecs));
+	return true;
+}
+
+static void benchCleanup(const char *name, SessionHistory *history)
+{
+	QElapsedTimer timer;
+	timer.start();
+	history->cleanupBatches(history->lastIndex() + 1LL);
+	print(
+		name, "cleanupBatches",
+		QStringLiteral("%1ms").arg(
+			nsecsToMsecs(timer.nsecsElapsed()), 0, 'f', 3));
+}
+
+// The server builds a reset image itself for thumbnails and the like, which
+// goes through the same path as a client-streamed one minus the compression.
+static bool benchStreamedReset(
+	const char *name, SessionHistory *history, const net::MessageList &image)
+{
+	constexpr uint8_t CTX_ID = 1;
+	QElapsedTimer timer;
+	timer.start();
+	server::StreamResetStartResult startResult = history->startStreamedReset(
+		CTX_ID, QStringLiteral("bench"), net::MessageList());
+	qint64 startNsecs = timer.nsecsElapsed();
+	if(startResult != server::StreamResetStartResult::Ok) {
+		fprintf(
+			stderr, "%s: starting streamed reset failed (%d)\n", name,
+			int(startResult));
+		return false;
+	}
+
+	timer.start();
+	for(const net::Message &msg : image) {
+		server::StreamResetAddResult addResult =
+			history->addStreamResetImageMessage(CTX_ID, msg);
+		if(addResult != server::StreamResetAddResult::Ok) {
+			fprintf(
+				stderr, "%s: adding streamed reset message failed (%d)\n", name,
+				int(addResult));
+			return false;
+		}
+	}
+	qint64 addNsecs = timer.nsecsElapsed();
+
+	timer.start();
+	server::StreamResetPrepareResult prepareResult =
+		history->prepareStreamedReset(CTX_ID, int(image.size()));
+	qint64 prepareNsecs = timer.nsecsElapsed();
+	if(prepareResult != server::StreamResetPrepareResult::Ok) {
+		fprintf(
+			stderr, "%s: preparing streamed reset failed (%d)\n", name,
+			int(prepareResult));
+		return false;
+	}
+
+	timer.start();
+	long long offset;
+	QString error;
+	if(!history->resolveStreamedReset(offset, error)) {
+		fprintf(
+			stderr, "%s: resolving streamed reset failed: %s\n", name,
+			qUtf8Printable(error));
+		return false;
+	}
+	qint64 resolveNsecs = timer.nsecsElapsed();
+
+	print(
+		name, "streamed reset",
+		QStringLiteral("%1 messages, start %2ms, add %3ms, prepare %4ms, "
+					   "swap %5ms")
+			.arg(image.size())
+			.arg(nsecsToMsecs(startNsecs), 0, 'f', 3)
+			.arg(nsecsToMsecs(addNsecs), 0, 'f', 3)
+			.arg(nsecsToMsecs(prepareNsecs), 0, 'f', 3)
+			.arg(nsecsToMsecs(resolveNsecs), 0, 'f', 3));
+	return true;
+}
+
+static bool benchInMemory(
+	const net::MessageList &msgs, size_t bytes, const net::MessageList &image)
+{
+	const char *name = "inmemory";
+	InMemoryHistory history(
+		QStringLiteral("bench"), QString(),
+		protocol::ProtocolVersion::current(), QStringLiteral("bench"));
+	return benchAdd(name, &history, msgs, bytes) &&
+		   benchGetBatch(name, "getBatch", &history) &&
+		   benchStreamedReset(name, &history, image) &&
+		   benchGetBatch(name, "getBatch reset", &history);
+}
+
+static bool benchFiled(
+	const Options &options, const QDir &dir, const net::MessageList &msgs,
+	size_t bytes, const net::MessageList &image)
+{
+	const char *name = "filed";
+	QString id = QStringLiteral("bench%1").arg(options.seed);
+	QString journalPath =
+		dir.absoluteFilePath(FiledHistory::journalFilename(id));
+	{
+		std::unique_ptr<FiledHistory> history(FiledHistory::startNew(
+			dir, id, QString(), protocol::ProtocolVersion::current(),
+			QStringLiteral("bench"), nullptr));
+		if(!history) {
+			fprintf(
+				stderr, "%s: creating history in '%s' failed\n", name,
+				qUtf8Printable(dir.absolutePath()));
+			return false;
+		}
+		if(!benchAdd(name, history.get(), msgs, bytes) ||
+		   !benchGetBatch(name, "getBatch warm", history.get())) {
+			return false;
+		}
+		benchCleanup(name, history.get());
+		if(!benchGetBatch(name, "getBatch cold", history.get()) ||
+		   !benchGetBatch(name, "getBatch rewarm", history.get())) {
+			return false;
+		}
+	}
+
+	// Loading scans through the whole recording to find the block boundaries,
+	// which is what the server does for every persistent session on startup.
+	QVector<qint64> loadNsecs;
+	std::unique_ptr<FiledHistory> history;
+	for(int i = 0; i < options.loadRepeat; ++i) {
+		history.reset();
+		QElapsedTimer timer;
+		timer.start();
+		history.reset(FiledHistory::load(journalPath, nullptr));
+		loadNsecs.append(timer.nsecsElapsed());
+		if(!history) {
+			fprintf(
+				stderr, "%s: loading '%s' failed\n", name,
+				qUtf8Printable(journalPath));
+			return false;
+		}
+	}
+	print(name, "load", describeTimes(loadNsecs));
+
+	return benchGetBatch(name, "getBatch loaded", history.get()) &&
+		   benchStreamedReset(name, history.get(), image) &&
+		   benchGetBatch(name, "getBatch reset", history.get());
+}
+
+static bool parseOptions(const QCoreApplication &app, Options &options)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription(QStringLiteral(
+		"Measures the performance of the server's in-memory and file-backed "
+		"session history with generated messages."));
+	parser.addHelpOption();
+
+	QCommandLineOption messagesOption(
+		{QStringLiteral("n"), QStringLiteral("messages")},
+		QStringLiteral("Number of messages to add (default 200000.)"),
+		QStringLiteral("count"), QStringLiteral("200000"));
+	QCommandLineOption dabsOption(
+		QStringLiteral("dabs"),
+		QStringLiteral("Dabs per draw message (default 24.)"),
+		QStringLiteral("count"), QStringLiteral("24"));
+	QCommandLineOption resetOption(
+		QStringLiteral("reset-messages"),
+		QStringLiteral("Number of messages in the streamed reset image "
+					   "(default 10000.)"),
+		QStringLiteral("count"), QStringLiteral("10000"));
+	QCommandLineOption loadRepeatOption(
+		QStringLiteral("load-repeat"),
+		QStringLiteral("How often to load the file-backed history (default "
+					   "5.)"),
+		QStringLiteral("count"), QStringLiteral("5"));
+	QCommandLineOption seedOption(
+		QStringLiteral("seed"),
+		QStringLiteral("Random seed for generating messages (default 1.)"),
+		QStringLiteral("seed"), QStringLiteral("1"));
+	QCommandLineOption dirOption(
+		QStringLiteral("dir"),
+		QStringLiteral("Directory to put the file-backed history in, to "
+					   "measure a specific disk. Defaults to a temporary "
+					   "directory."),
+		QStringLiteral("path"));
+	parser.addOptions(
+		{messagesOption, dabsOption, resetOption, loadRepeatOption, seedOption,
+		 dirOption});
+	parser.process(app);
+
+	bool ok;
+	options.messages = parser.value(messagesOption).toInt(&ok);
+	if(!ok || options.messages < 1) {
+		fputs("Invalid message count\n", stderr);
+		return false;
+	}
+
+	options.dabs = parser.value(dabsOption).toInt(&ok);
+	if(!ok || options.dabs < 1 ||
+	   options.dabs > DP_MSG_DRAW_DABS_PIXEL_DABS_MAX_COUNT) {
+		fputs("Invalid dab count\n", stderr);
+		return false;
+	}
+
+	options.resetMessages = parser.value(resetOption).toInt(&ok);
+	if(!ok || options.resetMessages < 1) {
+		fputs("Invalid reset message count\n", stderr);
+		return false;
+	}
+
+	options.loadRepeat = parser.value(loadRepeatOption).toInt(&ok);
+	if(!ok || options.loadRepeat < 1) {
+		fputs("Invalid load repeat count\n", stderr);
+		return false;
+	}
+
+	options.seed = parser.value(seedOption).toUInt(&ok);
+	if(!ok) {
+		fputs("Invalid seed\n", stderr);
+		return false;
+	}
+
+	options.dir = parser.value(dirOption);
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+	DP_QT_LOCALE_RESET();
+	app.setOrganizationName("drawpile");
+	app.setOrganizationDomain("drawpile.net");
+	app.setApplicationName("bench_history");
+
+	Options options;
+	if(!parseOptions(app, options)) {
+		return 2;
+	}
+
+	QTemporaryDir tempDir;
+	QDir dir;
+	if(options.dir.isEmpty()) {
+		if(!tempDir.isValid()) {
+			fputs("Can't create temporary directory\n", stderr);
+			return 1;
+		}
+		dir.setPath(tempDir.path());
+	} else {
+		tempDir.remove();
+		dir.setPath(options.dir);
+		if(!dir.mkpath(QStringLiteral("."))) {
+			fprintf(
+				stderr, "Can't create directory '%s'\n",
+				qUtf8Printable(options.dir));
+			return 1;
+		}
+	}
+
+	net::MessageList msgs =
+		generateMessages(options.messages, options.dabs, options.seed);
+	net::MessageList image = generateMessages(
+		options.resetMessages, options.dabs, options.seed + 1u);
+	size_t bytes = totalLength(msgs);
+	printf(
+		"Generated %d messages, %.2f MiB, reset image of %d messages\n",
+		int(msgs.size()), double(bytes) / 1024.0 / 1024.0, int(image.size()));
+
+	if(!benchInMemory(msgs, bytes, image) ||
+	   !benchFiled(options, dir, msgs, bytes, image)) {
+		return 1;
+	}
+	return 0;
+}
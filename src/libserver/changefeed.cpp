@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/changefeed.h"
+
+namespace server {
+
+ChangeFeed::ChangeFeed(int maxChanges)
+	: m_maxChanges(qMax(1, maxChanges))
+{
+}
+
+quint64 ChangeFeed::append(const QString &type, const QJsonObject &data)
+{
+	while(m_changes.size() >= m_maxChanges) {
+		m_changes.dequeue();
+	}
+	m_changes.enqueue({++m_lastSeq, type, data});
+	return m_lastSeq;
+}
+
+bool ChangeFeed::changesSince(quint64 seq, QJsonArray &outChanges) const
+{
+	if(seq > m_lastSeq) {
+		return false;
+	}
+
+	// Sequence numbers are consecutive, so the oldest one kept must be at most
+	// one past the given one, otherwise something in between was dropped.
+	if(seq != m_lastSeq && m_changes.first().seq > seq + 1) {
+		return false;
+	}
+
+	for(const Change &change : m_changes) {
+		if(change.seq > seq) {
+			outChanges.append(QJsonObject{
+				{QStringLiteral("seq"), double(change.seq)},
+				{QStringLiteral("type"), change.type},
+				{QStringLiteral("data"), change.data},
+			});
+		}
+	}
+	return true;
+}
+
+QJsonObject ChangeFeed::toJson(quint64 since) const
+{
+	QJsonArray changes;
+	bool complete = changesSince(since, changes);
+	return QJsonObject{
+		{QStringLiteral("seq"), double(m_lastSeq)},
+		{QStringLiteral("resync"), !complete},
+		{QStringLiteral("changes"), changes},
+	};
+}
+
+}
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_CHANGEFEED_H
+#define LIBSERVER_CHANGEFEED_H
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QQueue>
+#include <QString>
+
+namespace server {
+
+/**
+ * @brief Numbered log of recent changes to sessions and users
+ *
+ * Things like the web admin otherwise have to fetch the full session and user
+ * listings over and over to notice that anything changed. Instead, they can
+ * remember the sequence number of the last change they saw and only ask for
+ * what happened after it.
+ *
+ * Only a limited number of changes are kept. Pollers that fall further behind
+ * than that, or that pass a sequence number from before a server restart, are
+ * told to start over from the full listings.
+ */
+class ChangeFeed final {
+public:
+	static constexpr int DEFAULT_MAX_CHANGES = 1000;
+
+	explicit ChangeFeed(int maxChanges = DEFAULT_MAX_CHANGES);
+
+	//! Record a change and return its sequence number.
+	quint64 append(const QString &type, const QJsonObject &data);
+
+	//! Sequence number of the last change, 0 if there haven't been any.
+	quint64 lastSeq() const { return m_lastSeq; }
+
+	/**
+	 * @brief Get the changes after the given sequence number
+	 *
+	 * Returns false if some of those changes were already dropped or the
+	 * sequence number is from the future, in which case the poller has to
+	 * refetch everything.
+	 */
+	bool changesSince(quint64 seq, QJsonArray &outChanges) const;
+
+	//! The response for the changes API.
+	QJsonObject toJson(quint64 since) const;
+
+private:
+	struct Change {
+		quint64 seq;
+		QString type;
+		QJsonObject data;
+	};
+
+	const int m_maxChanges;
+	quint64 m_lastSeq = 0;
+	QQueue<Change> m_changes;
+};
+
+}
+
+#endif
@@ -1,13 +1,20 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpengine/message_cost.h>
+}
 #include "libserver/client.h"
+#include "libserver/messagestats.h"
+#include "libserver/profiler.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/session.h"
 #include "libserver/sessionhistory.h"
+#include "libshared/net/localmessagequeue.h"
 #include "libshared/net/messagequeue.h"
 #include "libshared/net/servercmd.h"
 #include "libshared/net/tcpmessagequeue.h"
 #include "libshared/util/qtcompat.h"
+#include <QElapsedTimer>
 #include <QPointer>
 #include <QRandomGenerator>
 #include <QSslSocket>
@@ -15,6 +22,7 @@
 #include <QTcpSocket>
 #include <QTimeZone>
 #include <QTimer>
+#include <QtMath>
 #ifdef HAVE_WEBSOCKETS
 #	include <QWebSocket>
 #	include "libshared/net/websocketmessagequeue.h"
@@ -134,6 +142,38 @@ private:
 };
 #endif
 
+class ClientLocalSocket final : public ClientSocket {
+	COMPAT_DISABLE_COPY_MOVE(ClientLocalSocket)
+public:
+	ClientLocalSocket(net::LocalMessageQueue *queue)
+		: m_queue(queue)
+	{
+		Q_ASSERT(queue);
+	}
+
+	virtual ~ClientLocalSocket() override = default;
+
+	virtual QHostAddress peerAddress() const override
+	{
+		return QHostAddress(QHostAddress::LocalHost);
+	}
+
+	virtual QString errorString() const override { return QString(); }
+
+	virtual void abort() override { m_queue->abort(); }
+
+	virtual bool isBrowser() const override { return false; }
+
+	virtual bool hasSslSupport() const override { return false; }
+
+	virtual bool isSecure() const override { return false; }
+
+	virtual void startTls() override { Q_ASSERT(false); }
+
+private:
+	net::LocalMessageQueue *m_queue;
+};
+
 struct Client::Private {
 	QPointer<Session> session;
 	ClientSocket *socket;
@@ -151,6 +191,18 @@ struct Client::Private {
 
 	qint64 lastActive = 0;
 	qint64 lastActiveDrawing = 0;
+	int renderBacklog = 0;
+	QElapsedTimer renderBacklogTimer;
+	MessageStats receiveStats;
+
+	// In estimated paint engine nanoseconds, like the budget. Refills with the
+	// time elapsed since the timer was last started, can go into debt.
+	double drawCostCredit = 0.0;
+	QElapsedTimer drawCostTimer;
+	double drawCostTotal = 0.0;
+	qint64 drawCostThrottled = 0;
+	qint64 drawCostRejected = 0;
+	bool drawCostResumePending = false;
 
 	uint8_t id = 0;
 	bool isOperator = false;
@@ -226,6 +278,24 @@ Client::Client(
 }
 #endif
 
+Client::Client(
+	net::LocalMessageQueue *queue, ServerLog *logger, QObject *parent)
+	: QObject(parent)
+	, d(new Private(new ClientLocalSocket(queue), logger))
+{
+	d->msgqueue = queue;
+	queue->setParent(this);
+	connect(
+		queue, &net::LocalMessageQueue::disconnected, this,
+		&Client::socketDisconnect);
+	connect(
+		d->msgqueue, &net::MessageQueue::messageAvailable, this,
+		&Client::receiveMessages);
+	connect(
+		d->msgqueue, &net::MessageQueue::badData, this, &Client::gotBadData);
+	connect(d->msgqueue, &net::MessageQueue::timedOut, this, &Client::timedOut);
+}
+
 Client::~Client()
 {
 	delete d;
@@ -236,6 +306,11 @@ net::MessageQueue *Client::messageQueue()
 	return d->msgqueue;
 }
 
+const net::MessageQueue *Client::messageQueue() const
+{
+	return d->msgqueue;
+}
+
 net::Message Client::joinMessage() const
 {
 	uint8_t flags = (isAuthenticated() ? DP_MSG_JOIN_FLAGS_AUTH : 0) |
@@ -261,6 +336,7 @@ QJsonObject Client::description(bool includeSession) const
 	u["lastActiveDrawing"] =
 		QDateTime::fromMSecsSinceEpoch(d->lastActiveDrawing, utc)
 			.toString(Qt::ISODate);
+	u["renderBacklog"] = renderBacklog();
 	u["auth"] = isAuthenticated();
 	u["op"] = isOperator();
 	u["trusted"] = isTrusted();
@@ -268,6 +344,7 @@ QJsonObject Client::description(bool includeSession) const
 	u["mod"] = isModerator();
 	u["tls"] = isSecure();
 	u[QStringLiteral("browser")] = isBrowser();
+	u[QStringLiteral("drawCost")] = drawCostDescription();
 	if(includeSession && d->session) {
 		u["session"] = d->session->id();
 	}
@@ -303,6 +380,13 @@ JsonApiResult Client::callJsonApi(
 {
 	if(path.size() == 1 && path[0] == QStringLiteral("thumbnail")) {
 		return callThumbnailJsonApi(method, request);
+	} else if(path.size() == 1 && path[0] == QStringLiteral("stats")) {
+		if(method == JsonApiMethod::Get) {
+			return JsonApiResult{
+				JsonApiResult::Ok, QJsonDocument(d->receiveStats.toJson())};
+		} else {
+			return JsonApiBadMethod();
+		}
 	} else if(!path.isEmpty()) {
 		return JsonApiNotFound();
 	}
@@ -468,6 +552,11 @@ Session *Client::session()
 	return d->session.data();
 }
 
+const Session *Client::session() const
+{
+	return d->session.data();
+}
+
 QString Client::uid() const
 {
 	return QString::number(reinterpret_cast<uintptr_t>(this), 16);
@@ -825,6 +914,20 @@ qint64 Client::lastActiveDrawing() const
 	return d->lastActiveDrawing;
 }
 
+int Client::renderBacklog() const
+{
+	return d->renderBacklogTimer.isValid() &&
+				   !d->renderBacklogTimer.hasExpired(RENDER_BACKLOG_STALE_MSECS)
+			   ? d->renderBacklog
+			   : 0;
+}
+
+void Client::setRenderBacklog(int renderBacklog)
+{
+	d->renderBacklog = qMax(0, renderBacklog);
+	d->renderBacklogTimer.start();
+}
+
 QHostAddress Client::peerAddress() const
 {
 	return d->socket->peerAddress();
@@ -865,6 +968,10 @@ bool Client::sendSystemChat(const QString &message, bool alert)
 void Client::receiveMessages()
 {
 	while(d->msgqueue->isPending()) {
+		if(isDrawCostThrottled()) {
+			return;
+		}
+
 		net::Message msg = d->msgqueue->shiftPending();
 		if(msg.isNull()) {
 			continue;
@@ -887,20 +994,145 @@ void Client::receiveMessages()
 									 .arg(msg.type())));
 			}
 		} else {
-			// Enforce origin ID, except when receiving a snapshot
-			if(d->session->initUserId() != d->id) {
+			// Enforce origin ID, except when receiving a snapshot. Messages
+			// from a local client are shared with it, so only touch them if
+			// they're actually wrong.
+			if(d->session->initUserId() != d->id && msg.contextId() != d->id) {
 				msg.setContextId(d->id);
 			}
 
 			if(isHoldLocked()) {
 				d->holdqueue.append(msg);
-			} else {
-				d->session->handleClientMessage(*this, msg);
+				d->receiveStats.add(msg);
+				d->session->messageStats().receive.add(msg);
+			} else if(chargeDrawCost(msg)) {
+				QElapsedTimer handleTimer;
+				handleTimer.start();
+				{
+					Profiler::Scope profilerScope(
+						Profiler::Category::Messages, d->session->id());
+					d->session->handleClientMessage(*this, msg);
+				}
+				qint64 nsecs = handleTimer.nsecsElapsed();
+				d->receiveStats.add(msg, nsecs);
+				if(d->session) {
+					SessionMessageStats &stats = d->session->messageStats();
+					stats.receive.add(msg, nsecs);
+					stats.handleTimes.observe(nsecs);
+				}
 			}
 		}
 	}
 }
 
+int Client::drawCostBudget() const
+{
+	// The init user is uploading a snapshot, which is expensive by nature.
+	const Session *session = d->session.data();
+	if(session && session->initUserId() != d->id) {
+		return session->drawCostBudget();
+	} else {
+		return 0;
+	}
+}
+
+double Client::drawCostCredit(int budget) const
+{
+	// The budget is in milliseconds per second, which happens to be the same
+	// as nanoseconds of credit per microsecond of time elapsed.
+	double capacity = budget * 1.0e6 * DRAW_COST_BURST_SECONDS;
+	if(d->drawCostTimer.isValid()) {
+		double refill =
+			double(d->drawCostTimer.nsecsElapsed()) * budget * 1.0e-3;
+		return qMin(capacity, d->drawCostCredit + refill);
+	} else {
+		return capacity;
+	}
+}
+
+void Client::refillDrawCostCredit(int budget)
+{
+	d->drawCostCredit = drawCostCredit(budget);
+	d->drawCostTimer.start();
+}
+
+bool Client::isDrawCostThrottled()
+{
+	int budget = drawCostBudget();
+	if(budget <= 0) {
+		return false;
+	}
+
+	refillDrawCostCredit(budget);
+	if(d->drawCostCredit >= 0.0) {
+		return false;
+	}
+
+	// Messages keep piling up in the queue until the debt is paid off, which
+	// holds back the whole stream instead of reordering anything in it.
+	if(!d->drawCostResumePending) {
+		d->drawCostResumePending = true;
+		++d->drawCostThrottled;
+		int msecs = qCeil(-d->drawCostCredit / (budget * 1.0e3));
+		QTimer::singleShot(msecs, this, [this] {
+			d->drawCostResumePending = false;
+			receiveMessages();
+		});
+	}
+	return true;
+}
+
+bool Client::chargeDrawCost(const net::Message &msg)
+{
+	int budget = drawCostBudget();
+	if(budget <= 0) {
+		return true;
+	}
+
+	double cost = DP_message_cost(msg.get());
+	if(cost <= 0.0) {
+		return true;
+	}
+
+	double costPerSecond = budget * 1.0e6;
+	if(cost > costPerSecond * DRAW_COST_REJECT_SECONDS) {
+		// Still costs a second of budget, so that getting rejected over and
+		// over doesn't turn into a way to flood the server log.
+		d->drawCostCredit = qMin(d->drawCostCredit, 0.0) - costPerSecond;
+		++d->drawCostRejected;
+		log(Log()
+				.about(Log::Level::Warn, Log::Topic::RuleBreak)
+				.message(QStringLiteral("Dropped %1 estimated to take %2ms, "
+										"draw cost budget is %3ms per second")
+							 .arg(msg.typeName())
+							 .arg(qRound64(cost / 1.0e6))
+							 .arg(budget)));
+		return false;
+	}
+
+	d->drawCostCredit -= cost;
+	d->drawCostTotal += cost;
+	return true;
+}
+
+QJsonObject Client::drawCostDescription() const
+{
+	// Usage is how much of the burst credit is used up, going above 1 means
+	// that the client is being held back until it's paid off its debt.
+	int budget = drawCostBudget();
+	double usage =
+		budget > 0 ? 1.0 - drawCostCredit(budget) /
+							   (budget * 1.0e6 * DRAW_COST_BURST_SECONDS)
+				   : 0.0;
+	return QJsonObject({
+		{QStringLiteral("budget"), budget},
+		{QStringLiteral("usage"), usage},
+		{QStringLiteral("totalMs"), d->drawCostTotal / 1.0e6},
+		{QStringLiteral("throttled"), d->drawCostThrottled},
+		{QStringLiteral("rejected"), d->drawCostRejected},
+	});
+}
+
 void Client::gotBadData(int len, int type)
 {
 	log(Log()
@@ -1060,6 +1292,16 @@ bool Client::hasSslSupport() const
 	return d->socket->hasSslSupport();
 }
 
+bool Client::allowStreamCompression()
+{
+	return d->msgqueue->setStreamCompressionAllowed(true);
+}
+
+bool Client::allowMessageBatching()
+{
+	return d->msgqueue->setMessageBatchingAllowed(true);
+}
+
 bool Client::isSecure() const
 {
 	return d->socket->isSecure();
@@ -14,6 +14,7 @@ class QWebSocket;
 #endif
 
 namespace net {
+class LocalMessageQueue;
 class MessageQueue;
 }
 
@@ -61,6 +62,7 @@ public:
 	 */
 	void setSession(Session *session);
 	Session *session();
+	const Session *session() const;
 
 	/**
 	 * @brief Get a reasonably unique id for this client
@@ -202,6 +204,15 @@ public:
 	 */
 	qint64 lastActiveDrawing() const;
 
+	/**
+	 * @brief Messages waiting for this client's paint engine
+	 *
+	 * This is what the client last reported about itself. Reports that are
+	 * too old to be meaningful anymore count as no backlog at all.
+	 */
+	int renderBacklog() const;
+	void setRenderBacklog(int renderBacklog);
+
 	enum class DisconnectionReason {
 		Kick,	  // kicked by an operator
 		Error,	  // kicked due to some server or protocol error
@@ -262,6 +273,18 @@ public:
 	 */
 	bool hasSslSupport() const;
 
+	/**
+	 * @brief Allow this client to start compressing the message stream
+	 * @return true if this kind of connection supports stream compression
+	 */
+	bool allowStreamCompression();
+
+	/**
+	 * @brief Allow this client to pack multiple messages into each frame
+	 * @return true if this kind of connection supports message batching
+	 */
+	bool allowMessageBatching();
+
 	/**
 	 * @brief Is this connection secure?
 	 * @return
@@ -283,7 +306,7 @@ public:
 	 *
 	 * This is used by the admin API
 	 */
-	QJsonObject description(bool includeSession = true) const;
+	virtual QJsonObject description(bool includeSession = true) const;
 
 	/**
 	 * @brief Call the client's JSON administration API
@@ -360,9 +383,19 @@ protected:
 		QWebSocket *webSocket, const QHostAddress &ip, bool isBrowser,
 		ServerLog *logger, bool decodeOpaque, QObject *parent);
 #endif
+	// For a client in the same process, takes ownership of the queue.
+	Client(net::LocalMessageQueue *queue, ServerLog *logger, QObject *parent);
 	net::MessageQueue *messageQueue();
+	const net::MessageQueue *messageQueue() const;
 
 private:
+	// Clients report their backlog about once a second while they have one.
+	static constexpr qint64 RENDER_BACKLOG_STALE_MSECS = 5000;
+	// Drawing cost credit saved up while idle lasts for this much drawing.
+	static constexpr double DRAW_COST_BURST_SECONDS = 1.0;
+	// Messages that would take more than this much of the budget are dropped.
+	static constexpr double DRAW_COST_REJECT_SECONDS = 10.0;
+
 	void handleSessionMessage(net::Message msg);
 	static bool rollEarlyTrigger();
 	void triggerNormalBan();
@@ -371,6 +404,13 @@ private:
 	void triggerHang();
 	void triggerTimer();
 
+	int drawCostBudget() const;
+	double drawCostCredit(int budget) const;
+	void refillDrawCostCredit(int budget);
+	bool isDrawCostThrottled();
+	bool chargeDrawCost(const net::Message &msg);
+	QJsonObject drawCostDescription() const;
+
 	JsonApiResult
 	callThumbnailJsonApi(JsonApiMethod method, const QJsonObject &request);
 
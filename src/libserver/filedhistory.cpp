@@ -1,20 +1,29 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 extern "C" {
+#include <dpcommon/binary.h>
 #include <dpcommon/input.h>
 #include <dpcommon/input_qt.h>
 #include <dpcommon/output.h>
-#include <dpcommon/output_qt.h>
+#include <dpengine/history_blocks.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/binary_writer.h>
+#include <dpmsg/message.h>
 }
 #include "libserver/filedhistory.h"
+#include "libserver/profiler.h"
+#include "libserver/recordingwriter.h"
 #include "libshared/util/filename.h"
+#include "libshared/util/functionrunnable.h"
 #include "libshared/util/passwordhash.h"
+#include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QSaveFile>
 #include <QScopedPointer>
 #include <QSet>
+#include <QThreadPool>
 #include <QTimerEvent>
 #include <QVarLengthArray>
 #include <dpcommon/platform_qt.h>
@@ -23,6 +32,11 @@ namespace server {
 
 // A block is closed when its size goes above this limit
 static const qint64 MAX_BLOCK_SIZE = 0xffff * 10;
+// How much of the end of the recording the block index is checked against
+static const qint64 BLOCK_INDEX_TAIL_SIZE = 64 * 1024;
+// How many closed blocks are moved to the block file at once, so that catching
+// up on a long recording doesn't stall the session
+static const compat::sizetype MAX_BLOCKS_PER_COMPACTION = 16;
 
 FiledHistory::FiledHistory(
 	const QDir &dir, QFile *journal, const QString &id, const QString &alias,
@@ -45,8 +59,8 @@ FiledHistory::FiledHistory(
 {
 	Q_ASSERT(journal);
 
-	// Flush the recording file periodically
-	startTimer(1000 * 30, Qt::VeryCoarseTimer);
+	// Hand recorded messages off to the writer thread periodically
+	startCommitTimer(1);
 }
 
 FiledHistory::FiledHistory(
@@ -60,6 +74,7 @@ FiledHistory::FiledHistory(
 
 FiledHistory::~FiledHistory()
 {
+	writeBlockIndex();
 	DP_binary_writer_free(m_resetStreamWriter);
 	DP_binary_reader_free(m_resetStreamReader);
 	DP_binary_writer_free(m_writer);
@@ -158,19 +173,25 @@ bool FiledHistory::initRecording()
 	Q_ASSERT(m_blockCache.isEmpty());
 	Q_ASSERT(!m_reader);
 	Q_ASSERT(!m_writer);
+	Q_ASSERT(!m_recordingWriter);
 	QString fileName = uniqueRecordingFilename(m_dir, id(), ++m_fileCount);
-	if(!openRecording(fileName, false, &m_recording, &m_reader, &m_writer)) {
+	if(!openRecording(
+		   fileName, false, &m_recording, &m_reader, &m_writer,
+		   &m_recordingWriter)) {
 		return false;
 	}
 
 	writeFileEntryToJournal(fileName);
-	m_blockCache.addBlock(m_recording->pos(), firstIndex());
+	m_recordingHeaderLength = m_recording->pos();
+	m_blockCache.addBlock(m_recordingHeaderLength, firstIndex());
+	m_blockIndexValid = true;
 	return true;
 }
 
 bool FiledHistory::openRecording(
 	const QString &fileName, bool stream, QFile **outRecording,
-	DP_BinaryReader **outReader, DP_BinaryWriter **outWriter)
+	DP_BinaryReader **outReader, DP_BinaryWriter **outWriter,
+	RecordingWriter **outRecordingWriter)
 {
 	QFile *recording = new QFile(m_dir.absoluteFilePath(fileName), this);
 	if(!recording->open(QFile::ReadWrite)) {
@@ -185,8 +206,8 @@ bool FiledHistory::openRecording(
 	DP_BinaryReader *reader = DP_binary_reader_new(
 		DP_qfile_input_new(recording, false, DP_input_new),
 		DP_BINARY_READER_FLAG_NO_LENGTH | DP_BINARY_READER_FLAG_NO_HEADER);
-	DP_BinaryWriter *writer = DP_binary_writer_new(
-		DP_qfile_output_new(recording, false, DP_output_new));
+	RecordingWriter *recordingWriter;
+	DP_BinaryWriter *writer = newRecordingWriter(recording, &recordingWriter);
 
 	JSON_Value *headerValue = json_value_init_object();
 	JSON_Object *headerObject = json_value_get_object(headerValue);
@@ -205,7 +226,7 @@ bool FiledHistory::openRecording(
 	json_value_free(headerValue);
 
 	if(ok) {
-		if(!recording->flush()) {
+		if(!recordingWriter->sync() || !recording->flush()) {
 			qWarning(
 				"Error flushing recording to '%s': %s",
 				qUtf8Printable(fileName),
@@ -218,6 +239,7 @@ bool FiledHistory::openRecording(
 		*outRecording = recording;
 		*outReader = reader;
 		*outWriter = writer;
+		*outRecordingWriter = recordingWriter;
 		return true;
 	} else {
 		DP_binary_writer_free(writer);
@@ -228,6 +250,15 @@ bool FiledHistory::openRecording(
 	}
 }
 
+DP_BinaryWriter *FiledHistory::newRecordingWriter(
+	QFile *recording, RecordingWriter **outRecordingWriter)
+{
+	RecordingWriter *recordingWriter = new RecordingWriter(recording);
+	recordingWriter->setCommitSize(m_recordingCommitSize);
+	*outRecordingWriter = recordingWriter;
+	return DP_binary_writer_new(RecordingWriter::newOutput(recordingWriter));
+}
+
 void FiledHistory::writeFileEntryToJournal(const QString &fileName)
 {
 	writeStringToJournal(QStringLiteral("FILE %1\n").arg(fileName));
@@ -256,8 +287,14 @@ void FiledHistory::writeBytesToJournal(const QByteArray &bytes)
 	}
 }
 
-void FiledHistory::flushRecording()
+void FiledHistory::flushRecording() const
 {
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
+	// Waits for the writer thread, only after this may the file be touched.
+	if(m_recordingWriter && !m_recordingWriter->sync()) {
+		qWarning("Error writing recording");
+	}
+
 	if(m_recording) {
 		if(!m_recording->flush()) {
 			qWarning(
@@ -267,8 +304,23 @@ void FiledHistory::flushRecording()
 	}
 }
 
+bool FiledHistory::syncResetStreamRecording() const
+{
+	return !m_resetStreamRecordingWriter ||
+		   m_resetStreamRecordingWriter->sync();
+}
+
+void FiledHistory::startCommitTimer(int intervalSecs)
+{
+	if(m_commitTimerId != 0) {
+		killTimer(m_commitTimerId);
+	}
+	m_commitTimerId = startTimer(qMax(1, intervalSecs) * 1000, Qt::CoarseTimer);
+}
+
 void FiledHistory::flushJournal()
 {
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
 	if(m_journal) {
 		if(!m_journal->flush()) {
 			qWarning(
@@ -588,18 +640,47 @@ bool FiledHistory::load()
 	}
 
 	qint64 startOffset = m_recording->pos();
+	m_recordingHeaderLength = startOffset;
 	Q_ASSERT(!m_writer);
-	m_writer = DP_binary_writer_new(
-		DP_qfile_output_new(m_recording, false, DP_output_new));
+	m_writer = newRecordingWriter(m_recording, &m_recordingWriter);
+
+	// Blocks moved to the block file come before those left in the recording.
+	qint64 packedSize;
+	bool packedStale;
+	if(!loadBlockFile(packedSize, packedStale)) {
+		return false;
+	}
+
+	compat::sizetype packedCount = m_blockCache.size();
+	long long rawStartIndex = firstIndex();
+	if(packedCount != 0) {
+		const Block &b = m_blockCache.lastBlock();
+		rawStartIndex = b.startIndex + b.count;
+	}
+
+	// Pick up the block index persisted when the session was last unloaded,
+	// so that only messages recorded after that need to be scanned. If moved
+	// blocks turned out to be stale, the index was written before they were
+	// moved back into the recording, so it doesn't apply anymore.
+	if(packedStale ||
+	   !readBlockIndex(
+		   recordingFile, startOffset, rawStartIndex, packedCount)) {
+		if(!scanPackedBlocks()) {
+			qWarning() << recordingFile << "error scanning block file";
+			return false;
+		}
+		m_blockCache.addBlock(startOffset, rawStartIndex);
+	}
 
-	// Scan the recording file and build the index of blocks
+	// Scan the rest of the recording file and build the index of blocks
 	if(!scanBlocks()) {
 		qWarning() << recordingFile << "error occurred during indexing";
 		return false;
 	}
 
 	const Block &b = m_blockCache.lastBlock();
-	historyLoaded(b.endOffset - startOffset, b.startIndex + b.count);
+	historyLoaded(
+		packedSize + b.endOffset - startOffset, b.startIndex + b.count);
 
 	// If a loaded session is empty, the server expects the first joining client
 	// to supply the initial content, while the client is expecting to join
@@ -609,19 +690,17 @@ bool FiledHistory::load()
 		return false;
 	}
 
+	m_blockIndexValid = true;
 	return true;
 }
 
 bool FiledHistory::scanBlocks()
 {
-	Q_ASSERT(m_blockCache.isEmpty());
-	// Note: m_recording should be at the start of the recording
-
-	m_blockCache.addBlock(m_recording->pos(), firstIndex());
-
-	QSet<uint8_t> users;
+	Q_ASSERT(!m_blockCache.isEmpty());
+	// Note: m_recording should be at the end of the last block
+	Q_ASSERT(m_blockCache.lastBlock().endOffset == m_recording->pos());
 
-	do {
+	while(!m_recording->atEnd()) {
 		uint8_t msgType, ctxId;
 		int msglen = DP_binary_reader_skip_message(m_reader, &msgType, &ctxId);
 		if(msglen < 0) {
@@ -638,29 +717,236 @@ bool FiledHistory::scanBlocks()
 		m_blockCache.incrementLastBlock(msglen);
 		Q_ASSERT(m_blockCache.lastBlock().endOffset == m_recording->pos());
 
-		switch(msgType) {
-		case DP_MSG_JOIN:
-			users.insert(ctxId);
-			break;
-		case DP_MSG_LEAVE:
-			users.remove(ctxId);
+		trackUserMessage(msgType, ctxId);
+		if(msgType == DP_MSG_LEAVE) {
 			idQueue().reserveId(ctxId);
-			break;
 		}
-	} while(!m_recording->atEnd());
+	}
 
 	// There should be no users at the end of the recording.
+	const QSet<uint8_t> users = m_recordedUsers;
 	for(const uint8_t user : users) {
 		net::Message msg = net::makeLeaveMessage(user);
 		m_blockCache.incrementLastBlock(msg.length());
 		if(DP_binary_writer_write_message(m_writer, msg.get()) == 0) {
 			return false;
 		}
+		trackUserMessage(DP_MSG_LEAVE, user);
 		idQueue().reserveId(user);
 	}
 	return true;
 }
 
+void FiledHistory::trackUserMessage(int type, uint8_t ctxId)
+{
+	switch(type) {
+	case DP_MSG_JOIN:
+		m_recordedUsers.insert(ctxId);
+		break;
+	case DP_MSG_LEAVE:
+		m_recordedUsers.remove(ctxId);
+		m_recordedLeaves.removeOne(ctxId);
+		m_recordedLeaves.append(ctxId);
+		break;
+	}
+}
+
+static bool hashRecordingTail(
+	QFile *recording, qint64 startOffset, qint64 endOffset,
+	QByteArray &outHash)
+{
+	// Hashing the whole recording would defeat the purpose of the index, the
+	// size plus the last bit of content is enough to notice it being replaced.
+	qint64 offset = qMax(startOffset, endOffset - BLOCK_INDEX_TAIL_SIZE);
+	if(!recording->seek(offset)) {
+		return false;
+	}
+	QByteArray bytes = recording->read(endOffset - offset);
+	if(bytes.size() != endOffset - offset) {
+		return false;
+	}
+	outHash = QCryptographicHash::hash(bytes, QCryptographicHash::Sha1).toHex();
+	return true;
+}
+
+static QByteArray blockIndexChecksum(const QByteArray &content)
+{
+	return QCryptographicHash::hash(content, QCryptographicHash::Sha1).toHex();
+}
+
+// The block index is a text file next to the journal. It holds the recording
+// file it belongs to, the offset up to which that recording is indexed with a
+// hash of the content just before it, one line per block, the users still
+// joined and the order in which they last left. The last line is a checksum
+// over everything before it.
+bool FiledHistory::readBlockIndex(
+	const QString &recordingFile, qint64 startOffset, long long startIndex,
+	compat::sizetype packedCount)
+{
+	QFile file(blockIndexFilePath());
+	if(!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	QByteArray content = file.readAll();
+	file.close();
+
+	compat::sizetype sumPos = content.lastIndexOf("SUM ");
+	if(sumPos < 0 ||
+	   content.mid(sumPos + 4).trimmed() !=
+		   blockIndexChecksum(content.left(sumPos))) {
+		qWarning() << file.fileName() << "checksum mismatch";
+		return false;
+	}
+
+	QString indexedFile;
+	qint64 endOffset = -1;
+	QByteArray tailHash;
+	QVector<Block> blocks;
+	QSet<uint8_t> users;
+	QVector<uint8_t> leaves;
+	long long indexedPackedCount = 0;
+	bool versionOk = false;
+	bool ok = true;
+	long long nextStartIndex = startIndex;
+	qint64 nextStartOffset = startOffset;
+
+	const QList<QByteArray> lines = content.left(sumPos).split('\n');
+	for(const QByteArray &line : lines) {
+		QList<QByteArray> args = line.trimmed().split(' ');
+		QByteArray cmd = args.takeFirst();
+		if(cmd.isEmpty()) {
+			continue;
+		} else if(cmd == QByteArrayLiteral("DPBLOCKINDEX")) {
+			versionOk = args.size() == 1 && args[0] == QByteArrayLiteral("1");
+			ok = versionOk;
+		} else if(cmd == QByteArrayLiteral("FILE")) {
+			indexedFile = QString::fromUtf8(line.trimmed().mid(5));
+		} else if(cmd == QByteArrayLiteral("END") && args.size() == 2) {
+			endOffset = args[0].toLongLong(&ok);
+			tailHash = args[1];
+		} else if(cmd == QByteArrayLiteral("PACKED") && args.size() == 1) {
+			indexedPackedCount = args[0].toLongLong(&ok);
+		} else if(cmd == QByteArrayLiteral("BLOCK") && args.size() == 2) {
+			bool countOk, offsetOk;
+			long long count = args[0].toLongLong(&countOk);
+			qint64 blockEndOffset = args[1].toLongLong(&offsetOk);
+			ok = ok && countOk && offsetOk && count >= 0 &&
+				 blockEndOffset >= nextStartOffset;
+			blocks.append(Block(nextStartOffset, nextStartIndex));
+			blocks.last().count = count;
+			blocks.last().endOffset = blockEndOffset;
+			nextStartIndex += count;
+			nextStartOffset = blockEndOffset;
+		} else if(
+			cmd == QByteArrayLiteral("USERS") ||
+			cmd == QByteArrayLiteral("LEAVES")) {
+			for(const QByteArray &arg : args) {
+				uint user = arg.toUInt(&ok);
+				ok = ok && user <= 255;
+				if(cmd == QByteArrayLiteral("USERS")) {
+					users.insert(uint8_t(user));
+				} else {
+					leaves.append(uint8_t(user));
+				}
+			}
+		} else {
+			ok = false;
+		}
+
+		if(!ok) {
+			qWarning()
+				<< file.fileName()
+				<< "invalid entry:" << QString::fromUtf8(line.trimmed());
+			return false;
+		}
+	}
+
+	// Only use the index if it matches the recording as it is on disk.
+	QByteArray actualTailHash;
+	if(!versionOk || indexedFile != recordingFile ||
+	   indexedPackedCount != packedCount || blocks.isEmpty() ||
+	   nextStartOffset != endOffset || endOffset > m_recording->size() ||
+	   !hashRecordingTail(m_recording, startOffset, endOffset, actualTailHash) ||
+	   actualTailHash != tailHash || !m_recording->seek(endOffset)) {
+		qWarning() << file.fileName() << "is stale, rescanning recording";
+		m_recording->seek(startOffset);
+		return false;
+	}
+
+	for(const Block &b : blocks) {
+		m_blockCache.restoreBlock(
+			b.startOffset, b.startIndex, b.count, b.endOffset);
+	}
+	for(uint8_t user : leaves) {
+		idQueue().reserveId(user);
+	}
+	m_recordedUsers = users;
+	m_recordedLeaves = leaves;
+	return true;
+}
+
+void FiledHistory::writeBlockIndex() const
+{
+	if(!m_blockIndexValid || !m_recording || !m_recording->isOpen() ||
+	   m_blockCache.isEmpty()) {
+		return;
+	}
+
+	flushRecording();
+	const qint64 prevPos = m_recording->pos();
+	// Blocks moved to the block file are indexed by that, this only covers the
+	// ones still in the recording. The open block always is.
+	const QVector<Block> &blocks = m_blockCache.blocks();
+	compat::sizetype packedCount = m_blockCache.packedCount();
+	qint64 endOffset = blocks.last().endOffset;
+	QByteArray tailHash;
+	bool hashed = hashRecordingTail(
+		m_recording, blocks[packedCount].startOffset, endOffset, tailHash);
+	m_recording->seek(prevPos);
+	if(!hashed) {
+		qWarning(
+			"Error hashing recording for block index: %s",
+			qUtf8Printable(m_recording->errorString()));
+		return;
+	}
+
+	QByteArray content = QByteArrayLiteral("DPBLOCKINDEX 1\nFILE ") +
+						 QFileInfo(*m_recording).fileName().toUtf8() +
+						 QByteArrayLiteral("\nEND ") +
+						 QByteArray::number(endOffset) +
+						 QByteArrayLiteral(" ") + tailHash +
+						 QByteArrayLiteral("\n");
+	if(packedCount != 0) {
+		content += QByteArrayLiteral("PACKED ") +
+				   QByteArray::number(packedCount) + QByteArrayLiteral("\n");
+	}
+	for(compat::sizetype i = packedCount; i < blocks.size(); ++i) {
+		const Block &b = blocks[i];
+		content += QByteArrayLiteral("BLOCK ") + QByteArray::number(b.count) +
+				   QByteArrayLiteral(" ") + QByteArray::number(b.endOffset) +
+				   QByteArrayLiteral("\n");
+	}
+	content += QByteArrayLiteral("USERS");
+	for(uint8_t user : m_recordedUsers) {
+		content += QByteArrayLiteral(" ") + QByteArray::number(user);
+	}
+	content += QByteArrayLiteral("\nLEAVES");
+	for(uint8_t user : m_recordedLeaves) {
+		content += QByteArrayLiteral(" ") + QByteArray::number(user);
+	}
+	content += QByteArrayLiteral("\n");
+	content += QByteArrayLiteral("SUM ") + blockIndexChecksum(content) +
+			   QByteArrayLiteral("\n");
+
+	QSaveFile file(blockIndexFilePath());
+	if(!file.open(QIODevice::WriteOnly) || file.write(content) == -1 ||
+	   !file.commit()) {
+		qWarning(
+			"Error writing block index %s: %s", qUtf8Printable(file.fileName()),
+			qUtf8Printable(file.errorString()));
+	}
+}
+
 void FiledHistory::terminate()
 {
 	discardResetStream();
@@ -668,14 +954,22 @@ void FiledHistory::terminate()
 	m_reader = nullptr;
 	DP_binary_writer_free(m_writer);
 	m_writer = nullptr;
+	m_recordingWriter = nullptr;
 	m_recording->close();
 	m_journal->close();
 	removeOrArchive(m_journal);
 	removeOrArchive(m_recording);
+	discardBlockFile();
 	QFile thumbnailFile(thumbnailFilePath());
 	if(thumbnailFile.exists()) {
 		removeOrArchive(&thumbnailFile);
 	}
+	QFile blockIndexFile(blockIndexFilePath());
+	if(blockIndexFile.exists() && !blockIndexFile.remove()) {
+		qWarning(
+			"Error removing '%s': %s", qUtf8Printable(blockIndexFile.fileName()),
+			qUtf8Printable(blockIndexFile.errorString()));
+	}
 }
 
 void FiledHistory::closeBlock()
@@ -684,6 +978,7 @@ void FiledHistory::closeBlock()
 	flushRecording();
 	flushJournal();
 	m_blockCache.closeLastBlock();
+	compactBlocks();
 }
 
 void FiledHistory::setFounderName(const QString &founder)
@@ -829,6 +1124,8 @@ void FiledHistory::joinUser(uint8_t id, const QString &name)
 
 bool FiledHistory::isStreamResetIoAvailable() const
 {
+	flushRecording();
+	syncResetStreamRecording();
 	return m_recording && m_resetStreamRecording && m_recording->atEnd() &&
 		   m_resetStreamRecording->atEnd();
 }
@@ -843,21 +1140,221 @@ qint64 FiledHistory::resetStreamHeaderPos() const
 	return m_resetStreamHeaderPos;
 }
 
-std::tuple<net::MessageList, long long>
+std::tuple<HistoryBatch, long long>
 FiledHistory::getBatch(long long after) const
 {
 	Block &b = m_blockCache.findBlock(after);
 	long long idxOffset = qMax(0LL, after - b.startIndex + 1LL);
 	if(idxOffset >= b.count) {
-		return std::make_tuple(
-			net::MessageList(), b.startIndex + b.count - 1LL);
+		return std::make_tuple(HistoryBatch(), b.startIndex + b.count - 1LL);
 	}
 
-	if(b.messages.isEmpty() && b.count > 0) {
+	if(b.loadId != 0 || (b.messages.isEmpty() && b.count > 0)) {
 		// Load the block worth of messages to memory if not already loaded
+		loadBlock(b);
+	}
+	Q_ASSERT(b.messages.size() == b.count);
+	return std::make_tuple(
+		HistoryBatch(b.messages, compat::sizetype(idxOffset)),
+		b.startIndex + b.count - 1LL);
+}
+
+std::tuple<HistoryBatch, long long>
+FiledHistory::getBatchNonBlocking(long long after) const
+{
+	Block &b = m_blockCache.findBlock(after);
+	long long idxOffset = qMax(0LL, after - b.startIndex + 1LL);
+	if(idxOffset >= b.count) {
+		return std::make_tuple(HistoryBatch(), b.startIndex + b.count - 1LL);
+	}
+
+	if(b.loadId != 0 || (b.messages.isEmpty() && b.count > 0)) {
+		// Come back when the block is loaded, the client doesn't advance.
+		if(b.loadId == 0) {
+			startLoadingBlock(b);
+		}
+		return std::make_tuple(HistoryBatch(), after);
+	}
+
+	// Read ahead the next block, so that a client catching up doesn't have to
+	// wait for the disk every time it crosses a block boundary.
+	Block *next = m_blockCache.nextBlock(b);
+	if(next && next->loadId == 0 && next->messages.isEmpty() &&
+	   next->count > 0) {
+		startLoadingBlock(*next);
+	}
+
+	Q_ASSERT(b.messages.size() == b.count);
+	return std::make_tuple(
+		HistoryBatch(b.messages, compat::sizetype(idxOffset)),
+		b.startIndex + b.count - 1LL);
+}
+
+bool FiledHistory::getFramedBatch(
+	long long after, const FramedBatchFn &fn, long long &outLastIndex) const
+{
+	// Blocks already in memory are sent the regular way, that doesn't need to
+	// touch the disk and their messages keep their wire format anyway. Blocks
+	// moved to the block file are compressed, so they can't be mapped either.
+	Block &b = m_blockCache.findBlock(after);
+	long long idxOffset = qMax(0LL, after - b.startIndex + 1LL);
+	if(idxOffset >= b.count || b.loadId != 0 || !b.messages.isEmpty() ||
+	   b.isPacked() || !m_recording || !m_recording->isOpen()) {
+		return false;
+	}
+
+	// Mapping the block goes around the write buffer.
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
+	flushRecording();
+	qint64 length = b.endOffset - b.startOffset;
+	uchar *data = m_recording->map(b.startOffset, length);
+	if(!data) {
+		qWarning(
+			"Error mapping history block from %s: %s",
+			qUtf8Printable(m_recording->fileName()),
+			qUtf8Printable(m_recording->errorString()));
+		return false;
+	}
+
+	// Skip over the messages the client already has.
+	size_t size = size_t(length);
+	size_t pos = 0;
+	for(long long m = 0; m < idxOffset && pos < size; ++m) {
+		if(size - pos < DP_MESSAGE_HEADER_LENGTH) {
+			pos = size;
+		} else {
+			pos += DP_MESSAGE_HEADER_LENGTH +
+				   DP_read_bigendian_uint16(data + pos);
+		}
+	}
+
+	bool used = pos < size &&
+				fn(reinterpret_cast<const char *>(data + pos), size - pos);
+	m_recording->unmap(data);
+	if(used) {
+		outLastIndex = b.startIndex + b.count - 1LL;
+	}
+	return used;
+}
+
+static bool parseBlockMessages(
+	const QString &path, const QByteArray &bytes, long long count,
+	net::MessageList &outMessages)
+{
+	const unsigned char *data =
+		reinterpret_cast<const unsigned char *>(bytes.constData());
+	size_t size = size_t(bytes.size());
+	size_t pos = 0;
+	outMessages.reserve(compat::sizetype(count));
+	for(long long m = 0; m < count; ++m) {
+		size_t remaining = size - pos;
+		if(remaining < DP_MESSAGE_HEADER_LENGTH) {
+			qWarning("History block in %s is truncated", qUtf8Printable(path));
+			return false;
+		}
+
+		size_t messageLength =
+			DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(data + pos);
+		DP_Message *msg =
+			messageLength <= remaining
+				? DP_message_deserialize(data + pos, messageLength, false)
+				: nullptr;
+		if(!msg) {
+			qWarning(
+				"Error reading message from history block in %s: %s",
+				qUtf8Printable(path), DP_error());
+			return false;
+		}
+
+		outMessages.append(net::Message::noinc(msg));
+		pos += messageLength;
+	}
+	return true;
+}
+
+static bool readBlockMessages(
+	const QString &path, qint64 offset, qint64 length, long long count,
+	net::MessageList &outMessages)
+{
+	QFile f(path);
+	if(!f.open(QIODevice::ReadOnly) || !f.seek(offset)) {
+		qWarning(
+			"Error opening %s to load history block: %s", qUtf8Printable(path),
+			qUtf8Printable(f.errorString()));
+		return false;
+	}
+
+	QByteArray bytes = f.read(length);
+	if(bytes.size() != length) {
+		qWarning(
+			"Error reading history block from %s at %lld: %s",
+			qUtf8Printable(path), static_cast<long long>(offset),
+			qUtf8Printable(f.errorString()));
+		return false;
+	}
+
+	return parseBlockMessages(path, bytes, count, outMessages);
+}
+
+static bool readPackedBlock(
+	const QString &path, qint64 packedOffset, qint64 packedSize, qint64 length,
+	QByteArray &outBytes)
+{
+	QFile f(path);
+	if(!f.open(QIODevice::ReadOnly)) {
+		qWarning(
+			"Error opening %s to load history block: %s", qUtf8Printable(path),
+			qUtf8Printable(f.errorString()));
+		return false;
+	}
+
+	DP_Input *input = DP_qfile_input_new(&f, false, DP_input_new);
+	DP_HistoryBlock block = {
+		0, 0, size_t(length), size_t(packedOffset), size_t(packedSize)};
+	outBytes.resize(compat::sizetype(length));
+	bool ok = DP_history_block_decompress(input, &block, outBytes.data());
+	DP_input_free(input);
+	if(!ok) {
+		qWarning(
+			"Error reading history block from %s at %lld: %s",
+			qUtf8Printable(path), static_cast<long long>(packedOffset),
+			DP_error());
+	}
+	return ok;
+}
+
+static bool readPackedBlockMessages(
+	const QString &path, qint64 packedOffset, qint64 packedSize, qint64 length,
+	long long count, net::MessageList &outMessages)
+{
+	QByteArray bytes;
+	return readPackedBlock(path, packedOffset, packedSize, length, bytes) &&
+		   parseBlockMessages(path, bytes, count, outMessages);
+}
+
+void FiledHistory::loadBlock(Block &b) const
+{
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
+	QElapsedTimer loadTimer;
+	loadTimer.start();
+	flushRecording();
+
+	// If a background load is in progress, messages added since it started
+	// are already in memory. Only the ones before them come from disk.
+	long long pendingCount = b.messages.size();
+	net::MessageList msgs;
+	msgs.reserve(compat::sizetype(b.count));
+
+	if(b.isPacked()) {
+		// Moved blocks are closed, so nothing can be pending for them.
+		Q_ASSERT(pendingCount == 0);
+		readPackedBlockMessages(
+			m_blockFile->fileName(), b.packedOffset, b.packedSize,
+			b.endOffset - b.startOffset, b.count, msgs);
+	} else {
 		const qint64 prevPos = m_recording->pos();
 		m_recording->seek(b.startOffset);
-		for(int m = 0; m < b.count; ++m) {
+		for(long long m = pendingCount; m < b.count; ++m) {
 			DP_Message *msg;
 			DP_BinaryReaderResult result =
 				DP_binary_reader_read_message(m_reader, false, &msg);
@@ -866,37 +1363,361 @@ FiledHistory::getBatch(long long after) const
 				m_recording->close();
 				break;
 			}
-			b.messages.append(net::Message::noinc(msg));
+			msgs.append(net::Message::noinc(msg));
 		}
-
 		m_recording->seek(prevPos);
 	}
-	Q_ASSERT(b.messages.size() == b.count);
-	return std::make_tuple(
-		b.messages.mid(idxOffset), b.startIndex + b.count - 1LL);
+
+	msgs.append(b.messages);
+	b.messages = msgs;
+	b.loadId = 0;
+	m_blockLoadTimes.observe(loadTimer.nsecsElapsed());
+}
+
+void FiledHistory::startLoadingBlock(Block &b) const
+{
+	// The block is read through a separate file handle, so anything still
+	// sitting in the write buffer has to make it to the file first.
+	flushRecording();
+
+	quint64 loadId = ++m_lastBlockLoadId;
+	b.loadId = loadId;
+
+	bool packed = b.isPacked();
+	QString path = packed ? m_blockFile->fileName() : m_recording->fileName();
+	qint64 offset = packed ? b.packedOffset : b.startOffset;
+	qint64 packedSize = b.packedSize;
+	qint64 length = b.endOffset - b.startOffset;
+	long long count = b.count;
+	QPointer<FiledHistory> self(const_cast<FiledHistory *>(this));
+	utils::FunctionRunnable *runnable =
+		new utils::FunctionRunnable([=]() {
+			QElapsedTimer loadTimer;
+			loadTimer.start();
+			net::MessageList msgs;
+			bool ok = packed ? readPackedBlockMessages(
+								   path, offset, packedSize, length, count,
+								   msgs)
+							 : readBlockMessages(
+								   path, offset, length, count, msgs);
+			qint64 nsecs = loadTimer.nsecsElapsed();
+			// The application object outlives us, the pointer to this
+			// history may only be checked on the main thread.
+			QMetaObject::invokeMethod(
+				QCoreApplication::instance(),
+				[self, loadId, msgs, ok, nsecs]() {
+					if(self) {
+						self->finishLoadingBlock(loadId, msgs, ok, nsecs);
+					}
+				},
+				Qt::QueuedConnection);
+		});
+	QThreadPool::globalInstance()->start(runnable);
+}
+
+void FiledHistory::finishLoadingBlock(
+	quint64 loadId, const net::MessageList &msgs, bool ok, qint64 nsecs)
+{
+	if(ok) {
+		m_blockLoadTimes.observe(nsecs);
+	}
+
+	// If the block is gone or was loaded synchronously in the meantime,
+	// there's nothing to do.
+	Block *b = m_blockCache.findLoadingBlock(loadId);
+	if(!b) {
+		return;
+	}
+
+	b->loadId = 0;
+	if(!ok) {
+		qWarning("Background load failed, reading history block directly");
+		loadBlock(*b);
+	} else if(msgs.size() + b->messages.size() == b->count) {
+		b->messages = msgs + b->messages;
+	} else {
+		// The block was released while loading, it wasn't needed after all.
+		b->messages = net::MessageList();
+		return;
+	}
+	emit newMessagesAvailable();
+}
+
+bool FiledHistory::loadBlockFile(qint64 &outPackedSize, bool &outStale)
+{
+	outPackedSize = 0;
+	outStale = false;
+	QString path = blockFilePath();
+	QFileInfo info(path);
+	if(!info.exists()) {
+		return true;
+	} else if(info.size() < DP_HISTORY_BLOCKS_HEADER_LENGTH) {
+		// Stopped before anything was moved, it'll be created anew.
+		qWarning("Removing empty block file '%s'", qUtf8Printable(path));
+		return QFile::remove(path);
+	}
+
+	m_blockFile = new QFile(path, this);
+	if(!m_blockFile->open(QFile::ReadWrite)) {
+		qWarning(
+			"Error opening '%s': %s", qUtf8Printable(path),
+			qUtf8Printable(m_blockFile->errorString()));
+		return false;
+	}
+
+	DP_Input *input = DP_qfile_input_new(m_blockFile, false, DP_input_new);
+	DP_Input *recordingInput =
+		DP_qfile_input_new(m_recording, false, DP_input_new);
+	size_t headerLength, count, length;
+	size_t current = 0;
+	DP_HistoryBlock *blocks = nullptr;
+	bool ok =
+		DP_history_blocks_read(
+			input, &headerLength, &blocks, &count, &length) &&
+		DP_history_blocks_count_current(
+			input, blocks, count, recordingInput, headerLength, &current);
+	DP_input_free(recordingInput);
+	DP_input_free(input);
+	if(!ok) {
+		qWarning("Error reading '%s': %s", qUtf8Printable(path), DP_error());
+		DP_free(blocks);
+		return false;
+	} else if(qint64(headerLength) != m_recordingHeaderLength) {
+		qWarning(
+			"Block file '%s' is for a recording header of %zu bytes, but the "
+			"recording's is %lld",
+			qUtf8Printable(path), headerLength,
+			static_cast<long long>(m_recordingHeaderLength));
+		DP_free(blocks);
+		return false;
+	}
+
+	long long nextIndex = firstIndex();
+	for(size_t i = 0; i < current; ++i) {
+		const DP_HistoryBlock &hb = blocks[i];
+		m_blockCache.restoreBlock(
+			qint64(hb.recording_offset), nextIndex,
+			static_cast<long long>(hb.message_count),
+			qint64(hb.recording_offset + hb.size), qint64(hb.compressed_offset),
+			qint64(hb.compressed_size));
+		nextIndex += static_cast<long long>(hb.message_count);
+		outPackedSize += qint64(hb.size);
+	}
+
+	// Drop stale blocks and any cut off while writing them, compaction picks
+	// up again from there.
+	qint64 end = current < count ? qint64(blocks[current].compressed_offset) -
+									   DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH
+								 : qint64(length);
+	outStale = current < count;
+	DP_free(blocks);
+	if(end < m_blockFile->size()) {
+		qWarning(
+			"Block file '%s' cut back from %lld to %lld bytes",
+			qUtf8Printable(path),
+			static_cast<long long>(m_blockFile->size()),
+			static_cast<long long>(end));
+		if(!m_blockFile->resize(end)) {
+			qWarning(
+				"Error cutting back '%s': %s", qUtf8Printable(path),
+				qUtf8Printable(m_blockFile->errorString()));
+			return false;
+		}
+	}
+
+	return m_blockFile->seek(end) && m_recording->seek(m_recordingHeaderLength);
+}
+
+bool FiledHistory::scanPackedBlocks()
+{
+	// Users are tracked across the whole history, without a block index to pick
+	// them up from, the moved blocks have to be scanned as well.
+	for(const Block &b : m_blockCache.blocks()) {
+		QByteArray bytes;
+		if(!readPackedBlock(
+			   m_blockFile->fileName(), b.packedOffset, b.packedSize,
+			   b.endOffset - b.startOffset, bytes)) {
+			return false;
+		}
+
+		const unsigned char *data =
+			reinterpret_cast<const unsigned char *>(bytes.constData());
+		size_t size = size_t(bytes.size());
+		size_t pos = 0;
+		while(pos < size && size - pos >= DP_MESSAGE_HEADER_LENGTH) {
+			uint8_t msgType = data[pos + 2];
+			uint8_t ctxId = data[pos + 3];
+			trackUserMessage(msgType, ctxId);
+			if(msgType == DP_MSG_LEAVE) {
+				idQueue().reserveId(ctxId);
+			}
+			pos += DP_MESSAGE_HEADER_LENGTH +
+				   DP_read_bigendian_uint16(data + pos);
+		}
+	}
+	return true;
+}
+
+bool FiledHistory::openBlockFile()
+{
+	QFile *blockFile = new QFile(blockFilePath(), this);
+	unsigned char header[DP_HISTORY_BLOCKS_HEADER_LENGTH];
+	DP_history_blocks_header_write(size_t(m_recordingHeaderLength), header);
+	qint64 headerLength = qint64(sizeof(header));
+	if(!blockFile->open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+	   blockFile->write(reinterpret_cast<const char *>(header), headerLength) !=
+		   headerLength ||
+	   !blockFile->flush()) {
+		qWarning(
+			"Error creating '%s': %s", qUtf8Printable(blockFile->fileName()),
+			qUtf8Printable(blockFile->errorString()));
+		blockFile->remove();
+		delete blockFile;
+		return false;
+	}
+
+	m_blockFile = blockFile;
+	return true;
+}
+
+void FiledHistory::compactBlocks()
+{
+	// Blocks are moved right when one got closed, since then everything in the
+	// recording is in closed blocks and it can be cut back once they're all in
+	// the block file. Stream resets work with offsets into the recording, so
+	// nothing gets moved while one is going on.
+	if(!m_blockCompression || m_resetStreamRecording || !m_recording ||
+	   !m_recording->isOpen() || m_blockCache.isEmpty() ||
+	   m_blockCache.lastBlock().count != 0) {
+		return;
+	}
+
+	compat::sizetype first = m_blockCache.packedCount();
+	compat::sizetype last = m_blockCache.size() - 1;
+	if(first == last) {
+		return;
+	}
+
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
+	flushRecording();
+	if(!m_blockFile && !openBlockFile()) {
+		return;
+	}
+
+	// Moved blocks must come before those in the recording, so this stops at
+	// the first one that can't be moved.
+	const qint64 prevPos = m_recording->pos();
+	qint64 packedEnd = m_blockFile->size();
+	compat::sizetype end = qMin(last, first + MAX_BLOCKS_PER_COMPACTION);
+	compat::sizetype i = first;
+	for(; i < end; ++i) {
+		Block &b = m_blockCache.blockAt(i);
+		if(b.loadId != 0) {
+			break;
+		}
+
+		qint64 length = b.endOffset - b.startOffset;
+		QByteArray bytes;
+		if(m_recording->seek(b.startOffset)) {
+			bytes = m_recording->read(length);
+		}
+		if(bytes.size() != length) {
+			qWarning(
+				"Error reading history block to compress from %s: %s",
+				qUtf8Printable(m_recording->fileName()),
+				qUtf8Printable(m_recording->errorString()));
+			break;
+		}
+
+		size_t entryLength;
+		unsigned char *entry = DP_history_block_compress(
+			size_t(b.startOffset), size_t(b.count), bytes.constData(),
+			size_t(length), &entryLength);
+		if(!entry) {
+			qWarning("Error compressing history block: %s", DP_error());
+			break;
+		}
+
+		qint64 written = m_blockFile->write(
+			reinterpret_cast<const char *>(entry), qint64(entryLength));
+		DP_free(entry);
+		if(written != qint64(entryLength)) {
+			qWarning(
+				"Error writing to %s: %s",
+				qUtf8Printable(m_blockFile->fileName()),
+				qUtf8Printable(m_blockFile->errorString()));
+			m_blockFile->resize(packedEnd);
+			m_blockFile->seek(packedEnd);
+			break;
+		}
+
+		b.packedOffset = packedEnd + DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH;
+		b.packedSize =
+			qint64(entryLength) - DP_HISTORY_BLOCKS_ENTRY_HEADER_LENGTH;
+		packedEnd += qint64(entryLength);
+	}
+	m_recording->seek(prevPos);
+
+	if(!m_blockFile->flush()) {
+		qWarning(
+			"Error flushing %s: %s", qUtf8Printable(m_blockFile->fileName()),
+			qUtf8Printable(m_blockFile->errorString()));
+	} else if(i == last) {
+		// Everything closed is in the block file, so only the empty open block
+		// is left in the recording.
+		if(m_recording->resize(m_recordingHeaderLength) &&
+		   m_recording->seek(m_recordingHeaderLength)) {
+			m_blockCache.moveLastBlock(m_recordingHeaderLength);
+		} else {
+			qWarning(
+				"Error cutting back %s: %s",
+				qUtf8Printable(m_recording->fileName()),
+				qUtf8Printable(m_recording->errorString()));
+			m_recording->seek(prevPos);
+		}
+	}
+}
+
+void FiledHistory::discardBlockFile()
+{
+	if(m_blockFile) {
+		m_blockFile->close();
+		removeOrArchive(m_blockFile);
+		delete m_blockFile;
+		m_blockFile = nullptr;
+	}
 }
 
 void FiledHistory::historyAdd(const net::Message &msg)
 {
 	size_t len = DP_binary_writer_write_message(m_writer, msg.get());
 	m_blockCache.addToLastBlock(msg, len);
+	trackUserMessage(msg.type(), uint8_t(msg.contextId()));
+	compactBlocks();
 }
 
 void FiledHistory::historyReset(const net::MessageList &newHistory)
 {
+	Profiler::Scope profilerScope(Profiler::Category::HistoryIo, id());
+	// Freeing the writer waits for pending writes, so do it before closing.
+	DP_binary_writer_free(m_writer);
+	m_writer = nullptr;
+	m_recordingWriter = nullptr;
+
 	QFile *oldRecording = m_recording;
 	oldRecording->close();
 
 	m_recording = nullptr;
 	DP_binary_reader_free(m_reader);
 	m_reader = nullptr;
-	DP_binary_writer_free(m_writer);
-	m_writer = nullptr;
 	m_blockCache.clear();
+	m_recordedUsers.clear();
+	m_recordedLeaves.clear();
 	initRecording();
 
 	removeOrArchive(oldRecording);
 	delete oldRecording;
+	discardBlockFile();
 
 	for(const net::Message &msg : newHistory) {
 		historyAdd(msg);
@@ -940,10 +1761,12 @@ FiledHistory::openResetStream(const net::MessageList &serverSideStateMessages)
 	m_resetStreamFileCount = ++m_fileCount;
 	m_resetStreamFileName =
 		uniqueRecordingFilename(m_dir, id(), m_resetStreamFileCount);
+	flushRecording();
 	m_resetStreamForkPos = m_recording->pos();
 	if(!openRecording(
 		   m_resetStreamFileName, true, &m_resetStreamRecording,
-		   &m_resetStreamReader, &m_resetStreamWriter)) {
+		   &m_resetStreamReader, &m_resetStreamWriter,
+		   &m_resetStreamRecordingWriter)) {
 		return StreamResetStartResult::WriteError;
 	}
 
@@ -982,7 +1805,7 @@ FiledHistory::addResetStreamMessage(const net::Message &msg)
 StreamResetPrepareResult FiledHistory::prepareResetStream()
 {
 	Q_ASSERT(m_resetStreamRecording);
-	if(m_resetStreamRecording->flush()) {
+	if(syncResetStreamRecording() && m_resetStreamRecording->flush()) {
 		return StreamResetPrepareResult::Ok;
 	} else {
 		qWarning(
@@ -998,6 +1821,12 @@ bool FiledHistory::resolveResetStream(
 {
 	Q_ASSERT(m_resetStreamRecording);
 
+	flushRecording();
+	if(!syncResetStreamRecording()) {
+		outError = QStringLiteral("error writing stream recording");
+		return false;
+	}
+
 	qint64 prevPos = m_recording->pos();
 	qint64 endPos = m_recording->size();
 	qint64 streamPos = m_resetStreamRecording->pos();
@@ -1047,14 +1876,22 @@ bool FiledHistory::resolveResetStream(
 	DP_binary_writer_free(m_writer);
 	m_writer = m_resetStreamWriter;
 	m_resetStreamWriter = nullptr;
+	m_recordingWriter = m_resetStreamRecordingWriter;
+	m_resetStreamRecordingWriter = nullptr;
 
 	removeOrArchive(m_recording);
 	delete m_recording;
 	m_recording = m_resetStreamRecording;
 	m_resetStreamRecording = nullptr;
+	// Only blocks from before the fork were moved, which are now gone.
+	discardBlockFile();
+	m_recordingHeaderLength = m_resetStreamHeaderPos;
 
 	m_blockCache.replaceWithResetStream(
 		m_resetStreamBlockCache, m_resetStreamBlockIndex, newFirstIndex);
+	// Users aren't tracked through the reset image, so the block index for
+	// this recording can't be trusted. The next load will scan it instead.
+	m_blockIndexValid = false;
 
 	outMessageCount = m_blockCache.totalMessageCount();
 	outSizeInBytes = m_recording->pos() - m_resetStreamHeaderPos;
@@ -1118,6 +1955,7 @@ void FiledHistory::discardResetStream()
 		DP_ASSERT(m_resetStreamWriter);
 		DP_binary_writer_free(m_resetStreamWriter);
 		m_resetStreamWriter = nullptr;
+		m_resetStreamRecordingWriter = nullptr;
 
 		DP_ASSERT(m_resetStreamReader);
 		DP_binary_reader_free(m_resetStreamReader);
@@ -1132,9 +1970,41 @@ void FiledHistory::discardResetStream()
 	}
 }
 
-void FiledHistory::timerEvent(QTimerEvent *)
+void FiledHistory::timerEvent(QTimerEvent *event)
 {
-	flushRecording();
+	if(event->timerId() == m_commitTimerId) {
+		if(m_recordingWriter) {
+			m_recordingWriter->commit();
+		}
+		if(m_resetStreamRecordingWriter) {
+			m_resetStreamRecordingWriter->commit();
+		}
+	}
+}
+
+void FiledHistory::setRecordingCommitPolicy(
+	int intervalSecs, size_t commitSize)
+{
+	m_recordingCommitSize = commitSize;
+	if(m_recordingWriter) {
+		m_recordingWriter->setCommitSize(commitSize);
+	}
+	if(m_resetStreamRecordingWriter) {
+		m_resetStreamRecordingWriter->setCommitSize(commitSize);
+	}
+	startCommitTimer(intervalSecs);
+}
+
+void FiledHistory::setBlockCompression(bool enabled)
+{
+	m_blockCompression = enabled;
+	compactBlocks();
+}
+
+QJsonObject FiledHistory::recordingStats() const
+{
+	return m_recordingWriter ? m_recordingWriter->statsToJson()
+							 : QJsonObject();
 }
 
 void FiledHistory::addAnnouncement(const QString &url)
@@ -1346,6 +2216,16 @@ QString FiledHistory::thumbnailFilePath() const
 	return m_dir.absoluteFilePath(QStringLiteral("%1.thumbnail").arg(id()));
 }
 
+QString FiledHistory::blockIndexFilePath() const
+{
+	return m_dir.absoluteFilePath(QStringLiteral("%1.blockindex").arg(id()));
+}
+
+QString FiledHistory::blockFilePath() const
+{
+	return m_recording->fileName() + QStringLiteral(DP_HISTORY_BLOCKS_SUFFIX);
+}
+
 
 FiledHistory::Block &FiledHistory::BlockCache::findBlock(long long after)
 {
@@ -1359,18 +2239,46 @@ FiledHistory::Block &FiledHistory::BlockCache::findBlock(long long after)
 	return m_blocks[i];
 }
 
+FiledHistory::Block *FiledHistory::BlockCache::nextBlock(const Block &b)
+{
+	compat::sizetype i = compat::sizetype(&b - m_blocks.constData()) + 1;
+	return i < m_blocks.size() ? &m_blocks[i] : nullptr;
+}
+
+FiledHistory::Block *FiledHistory::BlockCache::findLoadingBlock(quint64 loadId)
+{
+	for(Block &b : m_blocks) {
+		if(b.loadId == loadId) {
+			return &b;
+		}
+	}
+	return nullptr;
+}
+
 void FiledHistory::BlockCache::addBlock(qint64 offset, long long index)
 {
 	m_blocks.append(Block(offset, index));
 }
 
+void FiledHistory::BlockCache::restoreBlock(
+	qint64 startOffset, long long startIndex, long long count,
+	qint64 endOffset, qint64 packedOffset, qint64 packedSize)
+{
+	Block b(startOffset, startIndex);
+	b.count = count;
+	b.endOffset = endOffset;
+	b.packedOffset = packedOffset;
+	b.packedSize = packedSize;
+	m_blocks.append(b);
+}
+
 void FiledHistory::BlockCache::addToLastBlock(
 	const net::Message &msg, size_t len)
 {
 	Block &b = m_blocks.last();
-	// Add message to cache, if already active (if cache is empty, it will be
-	// loaded from disk when needed)
-	if(!b.messages.isEmpty()) {
+	// Add message to cache, if already active or being loaded (if cache is
+	// empty, it will be loaded from disk when needed)
+	if(!b.messages.isEmpty() || b.loadId != 0) {
 		b.messages.append(msg);
 	}
 	incrementBlock(b, len);
@@ -1393,6 +2301,14 @@ void FiledHistory::BlockCache::closeLastBlock()
 	}
 }
 
+void FiledHistory::BlockCache::moveLastBlock(qint64 offset)
+{
+	Block &b = m_blocks.last();
+	Q_ASSERT(b.count == 0);
+	b.startOffset = offset;
+	b.endOffset = offset;
+}
+
 void FiledHistory::BlockCache::cleanup(long long before)
 {
 	for(Block &b : m_blocks) {
@@ -1418,6 +2334,15 @@ long long FiledHistory::BlockCache::totalMessageCount() const
 	}
 }
 
+compat::sizetype FiledHistory::BlockCache::packedCount() const
+{
+	compat::sizetype count = 0;
+	while(count < m_blocks.size() && m_blocks[count].isPacked()) {
+		++count;
+	}
+	return count;
+}
+
 void FiledHistory::BlockCache::replaceWithResetStream(
 	BlockCache &streamCache, compat::sizetype blockIndex,
 	long long newFirstIndex)
@@ -1433,6 +2358,11 @@ void FiledHistory::BlockCache::replaceWithResetStream(
 	compat::sizetype count = m_blocks.size();
 	for(compat::sizetype i = blockIndex; i < count; ++i) {
 		Block b = m_blocks[i];
+		// A background load would read from the old recording and offsets.
+		if(b.loadId != 0) {
+			b.loadId = 0;
+			b.messages = net::MessageList();
+		}
 		b.startIndex = nextStartIndex;
 		nextStartIndex = b.startIndex + b.count;
 		qint64 offsetSize = b.endOffset - b.startOffset;
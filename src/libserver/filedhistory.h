@@ -7,6 +7,7 @@
 #include "libshared/util/qtcompat.h"
 #include <QDir>
 #include <QPointer>
+#include <QSet>
 #include <QVector>
 
 struct DP_BinaryReader;
@@ -14,6 +15,8 @@ struct DP_BinaryWriter;
 
 namespace server {
 
+class RecordingWriter;
+
 class FiledHistory final : public SessionHistory {
 	Q_OBJECT
 public:
@@ -88,9 +91,19 @@ public:
 	qint64 resetStreamHeaderPos() const override;
 
 	void terminate() override;
+	void setRecordingCommitPolicy(
+		int intervalSecs, size_t commitSize) override;
+	void setBlockCompression(bool enabled) override;
+	QJsonObject recordingStats() const override;
+
 	void cleanupBatches(long long before) override;
-	std::tuple<net::MessageList, long long>
+	std::tuple<HistoryBatch, long long>
 	getBatch(long long after) const override;
+	std::tuple<HistoryBatch, long long>
+	getBatchNonBlocking(long long after) const override;
+	bool getFramedBatch(
+		long long after, const FramedBatchFn &fn,
+		long long &outLastIndex) const override;
 
 	void addAnnouncement(const QString &) override;
 	void removeAnnouncement(const QString &url) override;
@@ -144,6 +157,13 @@ private:
 		long long count;
 		qint64 endOffset;
 		net::MessageList messages;
+		// Non-zero while the block is being loaded in the background. Messages
+		// added in the meantime are already in the messages list.
+		quint64 loadId = 0;
+		// Where the block's zstd frame is in the block file once it's been
+		// moved there. The offsets still span its uncompressed size then.
+		qint64 packedOffset = -1;
+		qint64 packedSize = 0;
 
 		Block(qint64 offset, long long index)
 			: startOffset(offset)
@@ -152,21 +172,33 @@ private:
 			, endOffset(offset)
 		{
 		}
+
+		bool isPacked() const { return packedOffset >= 0; }
 	};
 
 	class BlockCache {
 	public:
 		const Block &lastBlock() const { return m_blocks.last(); }
+		Block &blockAt(compat::sizetype i) { return m_blocks[i]; }
 		Block &findBlock(long long after);
+		Block *nextBlock(const Block &b);
+		Block *findLoadingBlock(quint64 loadId);
+
+		const QVector<Block> &blocks() const { return m_blocks; }
 
 		void addBlock(qint64 offset, long long index);
+		void restoreBlock(
+			qint64 startOffset, long long startIndex, long long count,
+			qint64 endOffset, qint64 packedOffset = -1, qint64 packedSize = 0);
 		void addToLastBlock(const net::Message &msg, size_t len);
 		void incrementLastBlock(size_t len);
 		void closeLastBlock();
+		void moveLastBlock(qint64 offset);
 
 		void cleanup(long long before);
 
 		long long totalMessageCount() const;
+		compat::sizetype packedCount() const;
 
 		compat::sizetype size() const { return m_blocks.size(); }
 		void clear() { m_blocks.clear(); }
@@ -194,28 +226,58 @@ private:
 	bool create();
 	bool load();
 	bool scanBlocks();
+	bool readBlockIndex(
+		const QString &recordingFile, qint64 startOffset, long long startIndex,
+		compat::sizetype packedCount);
+	void writeBlockIndex() const;
+	void trackUserMessage(int type, uint8_t ctxId);
 	bool initRecording();
 	bool openRecording(
 		const QString &fileName, bool stream, QFile **outRecording,
-		DP_BinaryReader **outReader, DP_BinaryWriter **outWriter);
+		DP_BinaryReader **outReader, DP_BinaryWriter **outWriter,
+		RecordingWriter **outRecordingWriter);
+	DP_BinaryWriter *
+	newRecordingWriter(QFile *recording, RecordingWriter **outRecordingWriter);
 
 	void writeFileEntryToJournal(const QString &fileName);
 	void writeStringToJournal(const QString &s);
 	void writeBytesToJournal(const QByteArray &bytes);
-	void flushRecording();
+	void flushRecording() const;
+	bool loadBlockFile(qint64 &outPackedSize, bool &outStale);
+	bool scanPackedBlocks();
+	bool openBlockFile();
+	void compactBlocks();
+	void discardBlockFile();
+	bool syncResetStreamRecording() const;
+	void startCommitTimer(int intervalSecs);
 	void flushJournal();
 	void removeOrArchive(QFile *f) const;
+
+	void loadBlock(Block &b) const;
+	void startLoadingBlock(Block &b) const;
+	void finishLoadingBlock(
+		quint64 loadId, const net::MessageList &msgs, bool ok, qint64 nsecs);
 	bool shouldArchive() const;
 
 	bool copyForkMessagesToResetStream(QString &outError);
 
 	QString thumbnailFilePath() const;
+	QString blockIndexFilePath() const;
+	QString blockFilePath() const;
 
 	QDir m_dir;
 	QFile *m_journal;
 	QFile *m_recording;
 	DP_BinaryReader *m_reader;
 	DP_BinaryWriter *m_writer;
+	// Owned by m_writer's output, gone when that is freed.
+	RecordingWriter *m_recordingWriter = nullptr;
+	size_t m_recordingCommitSize = 64 * 1024;
+	// Closed blocks moved out of the recording, see dpengine/history_blocks.h.
+	QFile *m_blockFile = nullptr;
+	qint64 m_recordingHeaderLength = 0;
+	bool m_blockCompression = false;
+	int m_commitTimerId = 0;
 	QPointer<SessionServer> m_sessionServer;
 
 	// Current state:
@@ -236,6 +298,12 @@ private:
 	QStringList m_announcements;
 
 	mutable BlockCache m_blockCache;
+	mutable quint64 m_lastBlockLoadId = 0;
+	// Users joined at the end of the recording and the order in which users
+	// last left it, so that the block index can stand in for a full scan.
+	QSet<uint8_t> m_recordedUsers;
+	QVector<uint8_t> m_recordedLeaves;
+	bool m_blockIndexValid = false;
 	int m_fileCount;
 	mutable bool m_thumbnailValid = false;
 
@@ -243,6 +311,7 @@ private:
 	QFile *m_resetStreamRecording = nullptr;
 	DP_BinaryReader *m_resetStreamReader = nullptr;
 	DP_BinaryWriter *m_resetStreamWriter = nullptr;
+	RecordingWriter *m_resetStreamRecordingWriter = nullptr;
 	int m_resetStreamFileCount = -1;
 	qint64 m_resetStreamForkPos;
 	qint64 m_resetStreamHeaderPos;
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_HISTORYBATCH_H
+#define LIBSERVER_HISTORYBATCH_H
+#include "libshared/net/message.h"
+#include "libshared/util/qtcompat.h"
+
+namespace server {
+
+/**
+ * @brief A view of consecutive messages in the session history
+ *
+ * This shares the history's own message list instead of copying the range
+ * out of it, so getting a batch doesn't allocate or touch the reference
+ * counts of the individual messages. Histories only append to or replace
+ * their lists, so a batch stays valid even if the history changes, but it
+ * should be let go of quickly so that appending doesn't have to detach.
+ */
+class HistoryBatch final {
+public:
+	HistoryBatch() = default;
+
+	//! A negative count means everything from the offset onwards.
+	explicit HistoryBatch(
+		const net::MessageList &messages, compat::sizetype offset = 0,
+		compat::sizetype count = -1)
+		: m_messages(messages)
+		, m_offset(offset)
+		, m_count(count < 0 ? messages.size() - offset : count)
+	{
+		Q_ASSERT(offset >= 0 && offset <= messages.size());
+		Q_ASSERT(m_count <= messages.size() - offset);
+	}
+
+	compat::sizetype size() const { return m_count; }
+	bool isEmpty() const { return size() == 0; }
+
+	const net::Message &at(compat::sizetype i) const
+	{
+		return m_messages.at(m_offset + i);
+	}
+
+	const net::Message *constData() const
+	{
+		return m_messages.constData() + m_offset;
+	}
+
+	const net::Message *begin() const { return constData(); }
+	const net::Message *end() const { return constData() + m_count; }
+
+	//! Copies the messages out, for when a list of its own is needed.
+	net::MessageList toList() const
+	{
+		return m_offset == 0 && m_count == m_messages.size()
+				   ? m_messages
+				   : m_messages.mid(m_offset, m_count);
+	}
+	operator net::MessageList() const { return toList(); }
+
+private:
+	net::MessageList m_messages;
+	compat::sizetype m_offset = 0;
+	compat::sizetype m_count = 0;
+};
+
+}
+
+#endif
@@ -1,4 +1,8 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/binary.h>
+#include <dpmsg/message.h>
+}
 #include "libserver/inmemoryhistory.h"
 #include "libshared/util/passwordhash.h"
 
@@ -7,7 +11,7 @@ namespace server {
 InMemoryHistory::InMemoryHistory(
 	const QString &id, const QString &alias,
 	const protocol::ProtocolVersion &version, const QString &founder,
-	QObject *parent)
+	bool decodeOpaque, QObject *parent)
 	: SessionHistory(id, parent)
 	, m_alias(alias)
 	, m_founder(founder)
@@ -16,6 +20,7 @@ InMemoryHistory::InMemoryHistory(
 	, m_autoReset(0)
 	, m_flags()
 	, m_nextCatchupKey(INITIAL_CATCHUP_KEY)
+	, m_decodeOpaque(decodeOpaque)
 {
 }
 
@@ -54,34 +59,111 @@ qint64 InMemoryHistory::resetStreamHeaderPos() const
 	return 0;
 }
 
-std::tuple<net::MessageList, long long>
+std::tuple<HistoryBatch, long long>
 InMemoryHistory::getBatch(long long after) const
 {
 	if(after >= lastIndex())
-		return std::make_tuple(net::MessageList(), lastIndex());
+		return std::make_tuple(HistoryBatch(), lastIndex());
 
+	// Everything from the given index onwards goes into a single list, since
+	// users like the builtin server expect to get it all in one go.
 	const long long offset = qMax(0LL, after - firstIndex() + 1LL);
-	Q_ASSERT(offset < m_history.size());
+	const compat::sizetype first = findBlock(offset);
+	Q_ASSERT(first >= 0);
 
-	return std::make_tuple(m_history.mid(offset), lastIndex());
+	net::MessageList msgs;
+	msgs.reserve(compat::sizetype(totalMessageCount(m_blocks) - offset));
+	const compat::sizetype count = m_blocks.size();
+	for(compat::sizetype i = first; i < count; ++i) {
+		const Block &b = m_blocks[i];
+		bool wasDecoded = isDecoded(b);
+		decodeBlock(b);
+		msgs.append(
+			i == first ? b.messages.mid(compat::sizetype(offset - b.start))
+					   : b.messages);
+		// The last block is where new messages go, so it may as well stay.
+		if(!wasDecoded && i != count - 1) {
+			b.messages = net::MessageList();
+		}
+	}
+
+	return std::make_tuple(
+		HistoryBatch(msgs), firstIndex() + offset + msgs.size() - 1LL);
+}
+
+std::tuple<HistoryBatch, long long>
+InMemoryHistory::getBatchNonBlocking(long long after) const
+{
+	if(after >= lastIndex())
+		return std::make_tuple(HistoryBatch(), lastIndex());
+
+	// Hand out the history a block at a time when relaying it to clients, so
+	// that a big catchup goes out over several trips through the event loop
+	// instead of stalling every other session on the server in one go.
+	const long long offset = qMax(0LL, after - firstIndex() + 1LL);
+	const compat::sizetype i = findBlock(offset);
+	Q_ASSERT(i >= 0);
+	const Block &b = m_blocks[i];
+	decodeBlock(b);
+
+	return std::make_tuple(
+		HistoryBatch(b.messages, compat::sizetype(offset - b.start)),
+		firstIndex() + b.start + b.count - 1LL);
+}
+
+bool InMemoryHistory::getFramedBatch(
+	long long after, const FramedBatchFn &fn, long long &outLastIndex) const
+{
+	if(after >= lastIndex())
+		return false;
+
+	const long long offset = qMax(0LL, after - firstIndex() + 1LL);
+	const compat::sizetype i = findBlock(offset);
+	Q_ASSERT(i >= 0);
+	const Block &b = m_blocks[i];
+
+	// Skip over the messages the client already has.
+	const char *data = b.data.constData();
+	size_t size = size_t(b.data.size());
+	size_t pos = messageOffset(b, offset);
+	if(pos < size && fn(data + pos, size - pos)) {
+		outLastIndex = firstIndex() + b.start + b.count - 1LL;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+void InMemoryHistory::cleanupBatches(long long before)
+{
+	for(const Block &b : m_blocks) {
+		if(firstIndex() + b.start + b.count >= before) {
+			break;
+		} else if(!b.messages.isEmpty()) {
+			b.messages = net::MessageList();
+		}
+	}
 }
 
 void InMemoryHistory::historyAdd(const net::Message &msg)
 {
-	m_history.append(msg);
+	appendMessage(m_blocks, msg);
 }
 
 void InMemoryHistory::historyReset(const net::MessageList &newHistory)
 {
 	Q_ASSERT(m_resetStream.isEmpty());
-	m_history = newHistory;
+	m_blocks.clear();
+	for(const net::Message &msg : newHistory) {
+		appendMessage(m_blocks, msg);
+	}
 }
 
 StreamResetStartResult InMemoryHistory::openResetStream(
 	const net::MessageList &serverSideStateMessages)
 {
 	m_resetStream = serverSideStateMessages;
-	m_resetStreamIndex = m_history.size();
+	m_resetStreamIndex = totalMessageCount(m_blocks);
 	return StreamResetStartResult::Ok;
 }
 
@@ -103,27 +185,46 @@ bool InMemoryHistory::resolveResetStream(
 	QString &outError)
 {
 	Q_UNUSED(newFirstIndex);
+	Q_ASSERT(m_resetStreamIndex <= totalMessageCount(m_blocks));
 
-	int end = m_history.size();
-	Q_ASSERT(m_resetStreamIndex <= end);
-
-	size_t sizeInBytes = 0;
+	QVector<Block> blocks;
 	for(const net::Message &msg : m_resetStream) {
-		sizeInBytes += msg.length();
+		appendMessage(blocks, msg);
+	}
+
+	// Messages that came in during the reset are copied over as they are.
+	const compat::sizetype count = m_blocks.size();
+	compat::sizetype forkBlock =
+		qMax(compat::sizetype(0), findBlock(m_resetStreamIndex));
+	for(compat::sizetype i = forkBlock; i < count; ++i) {
+		const Block &b = m_blocks[i];
+		const unsigned char *data =
+			reinterpret_cast<const unsigned char *>(b.data.constData());
+		size_t size = size_t(b.data.size());
+		size_t pos = messageOffset(b, m_resetStreamIndex);
+		while(pos < size) {
+			size_t length =
+				DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(data + pos);
+			Block &last = blockForAppend(blocks);
+			last.data.append(
+				reinterpret_cast<const char *>(data + pos),
+				compat::sizetype(length));
+			++last.count;
+			pos += length;
+		}
 	}
-	for(int i = m_resetStreamIndex; i < end; ++i) {
-		sizeInBytes += m_history[i].length();
+
+	size_t sizeInBytes = 0;
+	for(const Block &b : blocks) {
+		sizeInBytes += size_t(b.data.size());
 	}
 	outSizeInBytes = sizeInBytes;
 
 	size_t sizeLimitInBytes = currentSizeLimit();
 	if(sizeLimitInBytes == 0 || sizeInBytes <= sizeLimitInBytes) {
-		for(int i = m_resetStreamIndex; i < end; ++i) {
-			m_resetStream.append(m_history[i]);
-		}
-		m_history.clear();
-		m_history.swap(m_resetStream);
-		outMessageCount = m_history.size();
+		m_blocks.swap(blocks);
+		m_resetStream.clear();
+		outMessageCount = totalMessageCount(m_blocks);
 		return true;
 	} else {
 		outError = QStringLiteral("total size %1 exceeds limit %2")
@@ -161,4 +262,95 @@ QDateTime InMemoryHistory::thumbnailGeneratedAt() const
 	return m_thumbnailGeneratedAt;
 }
 
+void InMemoryHistory::appendMessage(
+	QVector<Block> &blocks, const net::Message &msg)
+{
+	Block &b = blockForAppend(blocks);
+	// Opaque messages are in wire format already and can just be copied.
+	size_t length;
+	const unsigned char *serialized = msg.serialized(length);
+	if(serialized) {
+		b.data.append(
+			reinterpret_cast<const char *>(serialized),
+			compat::sizetype(length));
+	} else if(!msg.serializeAppend(b.data)) {
+		qWarning("Error serializing message of type %d", int(msg.type()));
+		return;
+	}
+
+	// Keep the message object around if its block is in use already.
+	if(isDecoded(b) && b.count != 0) {
+		b.messages.append(msg);
+	}
+	++b.count;
+}
+
+InMemoryHistory::Block &InMemoryHistory::blockForAppend(QVector<Block> &blocks)
+{
+	if(blocks.isEmpty() || blocks.last().data.size() >= MAX_BLOCK_BYTES) {
+		long long start = 0LL;
+		if(!blocks.isEmpty()) {
+			Block &last = blocks.last();
+			last.data.squeeze();
+			start = last.start + last.count;
+		}
+		blocks.append({start, 0LL, QByteArray(), net::MessageList()});
+		// A block ends with the message that crosses the limit.
+		blocks.last().data.reserve(MAX_BLOCK_BYTES + 0xffff + 1);
+	}
+	return blocks.last();
+}
+
+long long InMemoryHistory::totalMessageCount(const QVector<Block> &blocks)
+{
+	return blocks.isEmpty() ? 0LL : blocks.last().start + blocks.last().count;
+}
+
+size_t InMemoryHistory::messageOffset(const Block &b, long long offset)
+{
+	const unsigned char *data =
+		reinterpret_cast<const unsigned char *>(b.data.constData());
+	size_t size = size_t(b.data.size());
+	size_t pos = 0;
+	for(long long m = b.start; m < offset && pos < size; ++m) {
+		pos += DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(data + pos);
+	}
+	return pos;
+}
+
+compat::sizetype InMemoryHistory::findBlock(long long offset) const
+{
+	compat::sizetype i = m_blocks.size() - 1;
+	for(; i > 0 && m_blocks[i].start > offset; --i) {
+	}
+	return i;
+}
+
+void InMemoryHistory::decodeBlock(const Block &b) const
+{
+	if(isDecoded(b)) {
+		return;
+	}
+
+	net::MessageList msgs;
+	msgs.reserve(compat::sizetype(b.count));
+	const unsigned char *data =
+		reinterpret_cast<const unsigned char *>(b.data.constData());
+	size_t size = size_t(b.data.size());
+	size_t pos = 0;
+	while(pos < size) {
+		size_t length =
+			DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(data + pos);
+		net::Message msg =
+			net::Message::deserialize(data + pos, length, m_decodeOpaque);
+		if(msg.isNull()) {
+			qWarning("Error decoding in-memory history: %s", DP_error());
+			break;
+		}
+		msgs.append(msg);
+		pos += length;
+	}
+	b.messages = msgs;
+}
+
 }
@@ -3,7 +3,9 @@
 #define DP_SERVER_SESSION_INMEMHISTORY_H
 #include "libserver/sessionhistory.h"
 #include "libshared/net/protover.h"
+#include <QByteArray>
 #include <QSet>
+#include <QVector>
 
 namespace server {
 
@@ -13,27 +15,34 @@ namespace server {
 class InMemoryHistory final : public SessionHistory {
 	Q_OBJECT
 public:
+	/**
+	 * @param decodeOpaque whether messages handed out should have their
+	 * bodies decoded, like the ones coming from the clients of the server
+	 * this history belongs to
+	 */
 	InMemoryHistory(
 		const QString &id, const QString &alias,
 		const protocol::ProtocolVersion &version, const QString &founder,
-		QObject *parent = nullptr);
+		bool decodeOpaque = false, QObject *parent = nullptr);
 
 	bool isStreamResetIoAvailable() const override;
 	qint64 resetStreamForkPos() const override;
 	qint64 resetStreamHeaderPos() const override;
 
-	std::tuple<net::MessageList, long long>
+	std::tuple<HistoryBatch, long long>
 	getBatch(long long after) const override;
+	std::tuple<HistoryBatch, long long>
+	getBatchNonBlocking(long long after) const override;
+	bool getFramedBatch(
+		long long after, const FramedBatchFn &fn,
+		long long &outLastIndex) const override;
 
 	void terminate() override
 	{
 		// nothing to do
 	}
 
-	void cleanupBatches(long long) override
-	{
-		// no caching, nothing to do
-	}
+	void cleanupBatches(long long before) override;
 
 	QString idAlias() const override { return m_alias; }
 	QString founderName() const override { return m_founder; }
@@ -114,7 +123,32 @@ protected:
 	void discardResetStream() override;
 
 private:
-	net::MessageList m_history;
+	// Messages are kept in wire format, packed into blocks of about the size of
+	// a FiledHistory block. They are only turned into message objects while
+	// they're being handed out, until cleanupBatches says they're not needed.
+	struct Block {
+		// Index of the first message, relative to firstIndex().
+		long long start;
+		long long count;
+		QByteArray data;
+		mutable net::MessageList messages;
+	};
+
+	static constexpr compat::sizetype MAX_BLOCK_BYTES = 0xffff * 10;
+
+	static void appendMessage(QVector<Block> &blocks, const net::Message &msg);
+	static Block &blockForAppend(QVector<Block> &blocks);
+	static long long totalMessageCount(const QVector<Block> &blocks);
+	static size_t messageOffset(const Block &b, long long offset);
+	static bool isDecoded(const Block &b)
+	{
+		return b.messages.size() == b.count;
+	}
+
+	compat::sizetype findBlock(long long offset) const;
+	void decodeBlock(const Block &b) const;
+
+	QVector<Block> m_blocks;
 	QSet<QString> m_announcements;
 	QString m_alias;
 	QString m_founder;
@@ -129,7 +163,8 @@ private:
 	size_t m_autoReset;
 	Flags m_flags;
 	int m_nextCatchupKey;
-	int m_resetStreamIndex = -1;
+	bool m_decodeOpaque;
+	long long m_resetStreamIndex = -1;
 	net::MessageList m_resetStream;
 };
 
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/ipprefixtree.h"
+
+namespace server {
+
+namespace {
+
+// An IPv6 address as a 128 bit number, for walking through ranges.
+struct Uint128 {
+	quint64 hi;
+	quint64 lo;
+
+	static Uint128 fromAddress(const Q_IPV6ADDR &addr)
+	{
+		Uint128 n = {0, 0};
+		for(int i = 0; i < 8; ++i) {
+			n.hi = (n.hi << 8) | addr.c[i];
+			n.lo = (n.lo << 8) | addr.c[i + 8];
+		}
+		return n;
+	}
+
+	Q_IPV6ADDR toAddress() const
+	{
+		Q_IPV6ADDR addr;
+		for(int i = 0; i < 8; ++i) {
+			addr.c[i] = quint8(hi >> (56 - i * 8));
+			addr.c[i + 8] = quint8(lo >> (56 - i * 8));
+		}
+		return addr;
+	}
+
+	bool operator<=(const Uint128 &other) const
+	{
+		return hi < other.hi || (hi == other.hi && lo <= other.lo);
+	}
+
+	int trailingZeroBits() const
+	{
+		int count = 0;
+		if(lo == 0) {
+			count = 64;
+			quint64 h = hi;
+			while(count < 128 && !(h & 1)) {
+				h >>= 1;
+				++count;
+			}
+		} else {
+			quint64 l = lo;
+			while(!(l & 1)) {
+				l >>= 1;
+				++count;
+			}
+		}
+		return count;
+	}
+
+	// Sets the lowest bits bits, giving the end of the block they span.
+	Uint128 withLowBitsSet(int bits) const
+	{
+		if(bits >= 128) {
+			return {~quint64(0), ~quint64(0)};
+		} else if(bits >= 64) {
+			quint64 mask = bits == 64 ? 0 : (quint64(1) << (bits - 64)) - 1;
+			return {hi | mask, ~quint64(0)};
+		} else {
+			quint64 mask = bits == 0 ? 0 : (quint64(1) << bits) - 1;
+			return {hi, lo | mask};
+		}
+	}
+
+	// Adds one, returns false on overflow.
+	bool increment()
+	{
+		if(++lo == 0) {
+			return ++hi != 0;
+		}
+		return true;
+	}
+};
+
+int bitAt(const Q_IPV6ADDR &addr, int i)
+{
+	return (addr.c[i / 8] >> (7 - i % 8)) & 1;
+}
+
+}
+
+void IpPrefixTree::clear()
+{
+	m_nodes.clear();
+}
+
+void IpPrefixTree::insertPrefix(const Q_IPV6ADDR &addr, int length, int value)
+{
+	if(m_nodes.isEmpty()) {
+		m_nodes.append(Node());
+	}
+
+	int nodeIndex = 0;
+	int bits = qBound(0, length, 128);
+	for(int i = 0; i < bits; ++i) {
+		int bit = bitAt(addr, i);
+		int child = m_nodes[nodeIndex].children[bit];
+		if(child == 0) {
+			child = m_nodes.size();
+			m_nodes.append(Node());
+			m_nodes[nodeIndex].children[bit] = child;
+		}
+		nodeIndex = child;
+	}
+	m_nodes[nodeIndex].values.append(value);
+}
+
+void IpPrefixTree::insertRange(
+	const Q_IPV6ADDR &from, const Q_IPV6ADDR &to, int value)
+{
+	Uint128 start = Uint128::fromAddress(from);
+	Uint128 end = Uint128::fromAddress(to);
+	while(start <= end) {
+		// Take the largest block aligned at the start that fits in the range.
+		int bits = start.trailingZeroBits();
+		while(!(start.withLowBitsSet(bits) <= end)) {
+			--bits;
+		}
+		insertPrefix(start.toAddress(), 128 - bits, value);
+
+		start = start.withLowBitsSet(bits);
+		if(!start.increment()) {
+			break;
+		}
+	}
+}
+
+void IpPrefixTree::lookup(const Q_IPV6ADDR &addr, QVector<int> &outValues) const
+{
+	if(m_nodes.isEmpty()) {
+		return;
+	}
+
+	int nodeIndex = 0;
+	for(int i = 0;; ++i) {
+		const Node &node = m_nodes[nodeIndex];
+		outValues.append(node.values);
+		if(i == 128) {
+			break;
+		}
+		nodeIndex = node.children[bitAt(addr, i)];
+		if(nodeIndex == 0) {
+			break;
+		}
+	}
+}
+
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_IPPREFIXTREE_H
+#define LIBSERVER_IPPREFIXTREE_H
+#include <QHostAddress>
+#include <QVector>
+
+namespace server {
+
+/**
+ * @brief Binary prefix tree to find the address ranges containing an address
+ *
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses, so both kinds go
+ * into the same tree. That's also how the range checks in ServerConfig end up
+ * comparing them. Every prefix or range carries a value, usually the index of
+ * the ban it came from. Lookups take at most 128 steps, no matter how many
+ * bans there are.
+ */
+class IpPrefixTree final {
+public:
+	void clear();
+	bool isEmpty() const { return m_nodes.size() <= 1; }
+
+	//! Insert a prefix of the given length, counted in IPv6 bits.
+	void insertPrefix(const Q_IPV6ADDR &addr, int length, int value);
+
+	/**
+	 * @brief Insert an inclusive range of addresses
+	 *
+	 * The range is split into the prefixes that cover it exactly. Nothing is
+	 * inserted if the start is past the end.
+	 */
+	void insertRange(const Q_IPV6ADDR &from, const Q_IPV6ADDR &to, int value);
+
+	//! Append the values of everything containing the address, in no order.
+	void lookup(const Q_IPV6ADDR &addr, QVector<int> &outValues) const;
+
+	static Q_IPV6ADDR normalize(const QHostAddress &addr)
+	{
+		return addr.toIPv6Address();
+	}
+
+private:
+	struct Node {
+		// Index 0 is the root, which is never anyone's child.
+		int children[2] = {0, 0};
+		QVector<int> values;
+	};
+
+	QVector<Node> m_nodes;
+};
+
+}
+
+#endif
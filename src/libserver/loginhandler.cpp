@@ -2,6 +2,8 @@
 #include "libserver/loginhandler.h"
 #include "cmake-config/config.h"
 #include "libserver/client.h"
+#include "libserver/passwordchecker.h"
+#include "libserver/profiler.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/session.h"
@@ -9,9 +11,11 @@
 #include "libshared/net/servercmd.h"
 #include "libshared/util/authtoken.h"
 #include "libshared/util/networkaccess.h"
+#include "libshared/util/passwordhash.h"
 #include "libshared/util/validators.h"
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QPointer>
 #include <QRegularExpression>
 #include <QStringList>
 #include <utility>
@@ -22,9 +26,11 @@
 // that the target server may verify the source if it wants to. The idea is that
 // we use the same kind of auth token stuff that's used for ext-auth.
 //
-// This is currently not yet implemented in the server. Look for other comments
-// in this file that start with REDIRECTS for more information on where the
-// implementation would go.
+// The server currently only uses this between nodes of a cluster, which send
+// clients looking for a session to the node that hosts it. No token is passed
+// along for that, since the target node applies its usual checks anyway. Look
+// for other comments in this file that start with REDIRECTS for more
+// information on where the rest of the implementation would go.
 
 namespace server {
 
@@ -123,6 +129,14 @@ void LoginHandler::startLoginProcess()
 	if(m_config->getConfigBool(config::AllowCustomAvatars)) {
 		flags << QStringLiteral("AVATAR");
 	}
+	if(m_config->getConfigBool(config::StreamCompression) &&
+	   m_client->allowStreamCompression()) {
+		flags << QStringLiteral("ZSTD");
+	}
+	if(m_config->getConfigBool(config::MessageBatching) &&
+	   m_client->allowMessageBatching()) {
+		flags << QStringLiteral("MBATCH");
+	}
 #ifdef HAVE_LIBSODIUM
 	if(!m_config->internalConfig().cryptKey.isEmpty()) {
 		flags << QStringLiteral("CBANIMPEX");
@@ -135,6 +149,9 @@ void LoginHandler::startLoginProcess()
 	// REDIRECTS: the ROUT flag tells the client that this server may "redirect
 	// out", the RIN flag says that it may accept redirects. See top of file for
 	// more information.
+	if(!m_config->getConfigString(config::ClusterNodeUrl).isEmpty()) {
+		flags << QStringLiteral("ROUT") << QStringLiteral("RIN");
+	}
 
 	QJsonObject methods;
 	bool allowGuestHosts =
@@ -266,6 +283,8 @@ void LoginHandler::announceSessionEnd(const QString &id)
 
 void LoginHandler::handleLoginMessage(const net::Message &msg)
 {
+	Profiler::Scope profilerScope(Profiler::Category::Login);
+
 	if(msg.type() != DP_MSG_SERVER_COMMAND) {
 		m_client->log(
 			Log()
@@ -279,6 +298,14 @@ void LoginHandler::handleLoginMessage(const net::Message &msg)
 	if(m_state == State::Ignore) {
 		// Either the client is supposed to get disconnected or we're
 		// intentionally leaving them hanging because they're banned.
+	} else if(m_passwordCheckPending) {
+		// The client is supposed to wait for the response to its ident or join
+		// command, which we can't give until the password has been checked.
+		m_client->log(
+			Log()
+				.about(Log::Level::Warn, Log::Topic::RuleBreak)
+				.message(
+					"Login command while checking password: " + cmd.cmd));
 	} else if(m_state == State::WaitForSecure) {
 		// Secure mode: wait for STARTTLS before doing anything
 		if(cmd.cmd == "startTls") {
@@ -491,6 +518,9 @@ void LoginHandler::handleLookupMessage(const net::ServerCommand &cmd)
 			Sessions::JoinResult jr = m_sessions->checkSessionJoin(
 				m_client, sessionIdOrAlias, inviteSecret);
 			if(jr.id.isEmpty()) {
+				if(redirectToClusterNode(cmd, sessionIdOrAlias)) {
+					return;
+				}
 				sendError(
 					"lookupFailed",
 					QStringLiteral(
@@ -532,6 +562,41 @@ void LoginHandler::handleLookupMessage(const net::ServerCommand &cmd)
 	send(msg);
 }
 
+bool LoginHandler::redirectToClusterNode(
+	const net::ServerCommand &cmd, const QString &sessionIdOrAlias)
+{
+	// Clients that can't follow redirects don't send a nonce. A client that
+	// was already redirected isn't sent along any further, that would only
+	// happen if the directory is out of date and may just go in circles.
+	QString ownNodeUrl = m_config->getConfigString(config::ClusterNodeUrl);
+	if(ownNodeUrl.isEmpty() || !cmd.kwargs.contains(QStringLiteral("nonce")) ||
+	   cmd.kwargs.contains(QStringLiteral("redirect"))) {
+		return false;
+	}
+
+	QString target =
+		m_config->getClusterSessionNodeUrl(sessionIdOrAlias, ownNodeUrl);
+	if(target.isEmpty()) {
+		return false;
+	}
+
+	m_client->log(
+		Log()
+			.about(Log::Level::Info, Log::Topic::Status)
+			.message(QStringLiteral("Redirecting to cluster node %1 for %2")
+						 .arg(target, sessionIdOrAlias)));
+	// Transparent, so that invite links keep pointing at the node the user
+	// originally came through rather than at whichever one hosts the session.
+	m_state = State::Ignore;
+	send(net::ServerReply::makeResultRedirectLookup(
+		QStringLiteral("Session is hosted elsewhere in the cluster"), target,
+		QJsonObject{
+			{QStringLiteral("transparent"), true},
+			{QStringLiteral("cluster"), ownNodeUrl},
+		}));
+	return true;
+}
+
 void LoginHandler::handleIdentMessage(const net::ServerCommand &cmd)
 {
 	if(cmd.args.size() != 1 && cmd.args.size() != 2) {
@@ -575,8 +640,19 @@ void LoginHandler::handleIdentMessage(const net::ServerCommand &cmd)
 		return;
 	}
 
-	const RegisteredUser userAccount =
-		m_config->getUserAccount(username, password);
+	QByteArray passwordHash;
+	RegisteredUser userAccount =
+		m_config->findUserAccount(username, passwordHash);
+	if(userAccount.status == RegisteredUser::Ok) {
+		bool passwordOk;
+		if(!checkPassword(cmd, password, passwordHash, passwordOk)) {
+			return;
+		} else if(!passwordOk) {
+			userAccount = RegisteredUser{
+				RegisteredUser::BadPass, username, QStringList(), QString()};
+		}
+	}
+
 	if(userAccount.status != RegisteredUser::NotFound) {
 		if(cmd.kwargs.contains("extauth")) {
 			// This should never happen. If it does, it means there's a bug in
@@ -1008,6 +1084,9 @@ static QJsonArray sessionFlags(const Session *session)
 	if(session->supportsSkipCatchup()) {
 		flags.append(QStringLiteral("SKIP"));
 	}
+	if(session->supportsBacklogReports()) {
+		flags.append(QStringLiteral("BACKLOG"));
+	}
 	// TODO for version 3.0: PERSIST should be a session specific flag
 
 	return flags;
@@ -1321,7 +1400,13 @@ void LoginHandler::handleJoinMessage(const net::ServerCommand &cmd)
 			return;
 		}
 
-		if(!invite && !history->checkPassword(password)) {
+		bool passwordOk = true;
+		if(!invite && !checkPassword(
+						  cmd, password, history->passwordHash(), passwordOk)) {
+			return;
+		}
+
+		if(!passwordOk) {
 			++m_sessionPasswordAttempts;
 			m_client->log(
 				Log()
@@ -1387,6 +1472,60 @@ void LoginHandler::handleJoinMessage(const net::ServerCommand &cmd)
 	deleteLater();
 }
 
+// Cheap checks are done right away. Expensive ones are started on the
+// password checker's thread pool and this returns false, in which case the
+// caller must bail out. Once the check is done, the command is handled again
+// from the top, since the session or account may have changed in the meantime,
+// and this call then returns the result of the check.
+bool LoginHandler::checkPassword(
+	const net::ServerCommand &cmd, const QString &password,
+	const QByteArray &hash, bool &outOk)
+{
+	if(password.isEmpty() || !PasswordChecker::isExpensive(hash)) {
+		outOk = passwordhash::check(password, hash);
+		return true;
+	}
+
+	if(m_checkedPasswordAvailable && password == m_checkedPassword &&
+	   hash == m_checkedPasswordHash) {
+		m_checkedPasswordAvailable = false;
+		outOk = m_checkedPasswordOk;
+		return true;
+	}
+
+	m_passwordCheckPending = true;
+	QPointer<LoginHandler> self(this);
+	PasswordChecker::check(
+		password, hash, [self, cmd, password, hash](bool ok) {
+			if(self) {
+				self->finishPasswordCheck(cmd, password, hash, ok);
+			}
+		});
+	return false;
+}
+
+void LoginHandler::finishPasswordCheck(
+	const net::ServerCommand &cmd, const QString &password,
+	const QByteArray &hash, bool ok)
+{
+	Profiler::Scope profilerScope(Profiler::Category::Login);
+	m_passwordCheckPending = false;
+	if(m_state == State::Ignore) {
+		return;
+	}
+
+	m_checkedPasswordAvailable = true;
+	m_checkedPasswordOk = ok;
+	m_checkedPassword = password;
+	m_checkedPasswordHash = hash;
+	if(cmd.cmd == QStringLiteral("ident")) {
+		handleIdentMessage(cmd);
+	} else {
+		handleJoinMessage(cmd);
+	}
+	m_checkedPasswordAvailable = false;
+}
+
 void LoginHandler::checkClientCapabilities(const net::ServerCommand &cmd)
 {
 	const QString capabilities =
@@ -99,9 +99,17 @@ private:
 	void announceServerInfo();
 	void handleClientInfoMessage(const net::ServerCommand &cmd);
 	void handleLookupMessage(const net::ServerCommand &cmd);
+	bool redirectToClusterNode(
+		const net::ServerCommand &cmd, const QString &sessionIdOrAlias);
 	void handleIdentMessage(const net::ServerCommand &cmd);
 	void handleHostMessage(const net::ServerCommand &cmd);
 	void handleJoinMessage(const net::ServerCommand &cmd);
+	bool checkPassword(
+		const net::ServerCommand &cmd, const QString &password,
+		const QByteArray &hash, bool &outOk);
+	void finishPasswordCheck(
+		const net::ServerCommand &cmd, const QString &password,
+		const QByteArray &hash, bool ok);
 	void checkClientCapabilities(const net::ServerCommand &cmd);
 	QJsonObject
 	extractClientInfo(const QJsonObject &o, bool checkAuthenticated);
@@ -162,6 +170,13 @@ private:
 	QString m_lookupInviteSecret;
 	int m_authPasswordAttempts = 0;
 	int m_sessionPasswordAttempts = 0;
+	bool m_passwordCheckPending = false;
+	// Result of a finished background password check, picked up by the
+	// command that started it when it gets handled the second time around.
+	bool m_checkedPasswordAvailable = false;
+	bool m_checkedPasswordOk = false;
+	QString m_checkedPassword;
+	QByteArray m_checkedPasswordHash;
 	QJsonObject m_clientInfo;
 	QJsonObject m_lastLoggedClientInfo;
 	Session *m_lastClientSession = nullptr;
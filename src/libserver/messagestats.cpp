@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpmsg/messages.h>
+}
+#include "libserver/messagestats.h"
+#include "libshared/net/message.h"
+
+namespace server {
+
+void MessageStats::add(const net::Message &msg)
+{
+	Entry &e = m_entries[msg.type()];
+	++e.count;
+	e.bytes += msg.length();
+}
+
+void MessageStats::add(const net::Message &msg, qint64 nsecs)
+{
+	Entry &e = m_entries[msg.type()];
+	++e.count;
+	e.bytes += msg.length();
+	e.nsecs += quint64(qMax(nsecs, qint64(0)));
+}
+
+void MessageStats::add(uint8_t type, size_t length)
+{
+	Entry &e = m_entries[type];
+	++e.count;
+	e.bytes += length;
+}
+
+QJsonObject MessageStats::toJson() const
+{
+	QJsonObject o;
+	for(int i = 0; i < TYPE_COUNT; ++i) {
+		const Entry &e = m_entries[i];
+		if(e.count != 0) {
+			const char *name = DP_message_type_name(DP_MessageType(i));
+			o.insert(
+				qstrcmp(name, "unknown") == 0 ? QString::number(i)
+											  : QString::fromUtf8(name),
+				QJsonObject{
+					{QStringLiteral("count"), double(e.count)},
+					{QStringLiteral("bytes"), double(e.bytes)},
+					{QStringLiteral("msecs"), double(e.nsecs) / 1.0e6},
+				});
+		}
+	}
+	return o;
+}
+
+quint64 MessageStats::totalBytes() const
+{
+	quint64 bytes = 0;
+	for(const Entry &e : m_entries) {
+		bytes += e.bytes;
+	}
+	return bytes;
+}
+
+quint64 MessageStats::totalNsecs() const
+{
+	quint64 nsecs = 0;
+	for(const Entry &e : m_entries) {
+		nsecs += e.nsecs;
+	}
+	return nsecs;
+}
+
+QJsonObject SessionMessageStats::toJson() const
+{
+	return QJsonObject{
+		{QStringLiteral("receive"), receive.toJson()},
+		{QStringLiteral("history"), history.toJson()},
+		{QStringLiteral("relay"), relay.toJson()},
+	};
+}
+
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_MESSAGESTATS_H
+#define LIBSERVER_MESSAGESTATS_H
+#include "libserver/metrics.h"
+#include <QJsonObject>
+#include <QtGlobal>
+
+namespace net {
+class Message;
+}
+
+namespace server {
+
+/**
+ * @brief Per message type counters for one stage of message processing
+ *
+ * This is always on, so it's just a flat table of numbers that gets bumped
+ * for every message. Turning it into something readable only happens when
+ * it's requested through the admin API.
+ */
+class MessageStats final {
+public:
+	void add(const net::Message &msg);
+	void add(const net::Message &msg, qint64 nsecs);
+	void add(uint8_t type, size_t length);
+
+	//! Messages types that haven't been seen are left out.
+	QJsonObject toJson() const;
+
+	quint64 totalBytes() const;
+	quint64 totalNsecs() const;
+
+private:
+	static constexpr int TYPE_COUNT = 256;
+
+	struct Entry {
+		quint64 count = 0;
+		quint64 bytes = 0;
+		quint64 nsecs = 0;
+	};
+
+	Entry m_entries[TYPE_COUNT];
+};
+
+/**
+ * @brief Message stats for the stages a session's messages go through
+ */
+struct SessionMessageStats final {
+	//! Messages received from clients, including time spent handling them.
+	MessageStats receive;
+	//! Messages that made it into the session history.
+	MessageStats history;
+	//! Messages sent out to clients, counted once per recipient.
+	MessageStats relay;
+	//! How long it took to handle each message received, which includes
+	//! adding it to the history and relaying it to caught up clients.
+	MetricsHistogram handleTimes;
+
+	QJsonObject toJson() const;
+};
+
+}
+
+#endif
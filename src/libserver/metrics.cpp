@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/metrics.h"
+
+namespace server {
+
+const qint64 MetricsHistogram::BUCKET_BOUNDS_NSECS[BUCKET_COUNT] = {
+	10000LL,	 50000LL,	  100000LL,	   250000LL,	 500000LL,
+	1000000LL,	 2500000LL,	  5000000LL,   10000000LL,	 25000000LL,
+	50000000LL,	 100000000LL, 1000000000LL, 10000000000LL,
+};
+
+void MetricsHistogram::observe(qint64 nsecs)
+{
+	nsecs = qMax(nsecs, qint64(0));
+	int i = 0;
+	while(i < BUCKET_COUNT && nsecs > BUCKET_BOUNDS_NSECS[i]) {
+		++i;
+	}
+	++m_buckets[i];
+	++m_count;
+	m_sumNsecs += quint64(nsecs);
+}
+
+void MetricsWriter::declare(
+	const char *name, const char *type, const char *help)
+{
+	m_text.append("# HELP ");
+	m_text.append(name);
+	m_text.append(' ');
+	m_text.append(help);
+	m_text.append("\n# TYPE ");
+	m_text.append(name);
+	m_text.append(' ');
+	m_text.append(type);
+	m_text.append('\n');
+}
+
+void MetricsWriter::sample(const char *name, double value)
+{
+	sample(name, QByteArray(), value);
+}
+
+void MetricsWriter::sample(
+	const char *name, const char *labelName, const QString &labelValue,
+	double value)
+{
+	sample(name, label(labelName, labelValue), value);
+}
+
+void MetricsWriter::sample(
+	const char *name, const QByteArray &labels, double value)
+{
+	m_text.append(name);
+	if(!labels.isEmpty()) {
+		m_text.append('{');
+		m_text.append(labels);
+		m_text.append('}');
+	}
+	m_text.append(' ');
+	m_text.append(QByteArray::number(value, 'g', 15));
+	m_text.append('\n');
+}
+
+void MetricsWriter::histogram(
+	const char *name, const QByteArray &labels, const MetricsHistogram &h)
+{
+	QByteArray bucketName = QByteArray(name) + QByteArrayLiteral("_bucket");
+	QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+	quint64 cumulative = 0;
+	for(int i = 0; i <= MetricsHistogram::BUCKET_COUNT; ++i) {
+		cumulative += h.m_buckets[i];
+		QByteArray le =
+			i < MetricsHistogram::BUCKET_COUNT
+				? QByteArray::number(
+					  double(MetricsHistogram::BUCKET_BOUNDS_NSECS[i]) / 1.0e9,
+					  'g', 15)
+				: QByteArrayLiteral("+Inf");
+		sample(
+			bucketName.constData(), prefix + "le=\"" + le + '"',
+			double(cumulative));
+	}
+	sample(
+		(QByteArray(name) + QByteArrayLiteral("_sum")).constData(), labels,
+		double(h.m_sumNsecs) / 1.0e9);
+	sample(
+		(QByteArray(name) + QByteArrayLiteral("_count")).constData(), labels,
+		double(h.m_count));
+}
+
+QByteArray
+MetricsWriter::label(const char *labelName, const QString &labelValue)
+{
+	QByteArray escaped;
+	QByteArray value = labelValue.toUtf8();
+	escaped.reserve(value.size());
+	for(char c : value) {
+		switch(c) {
+		case '\\':
+			escaped.append("\\\\");
+			break;
+		case '"':
+			escaped.append("\\\"");
+			break;
+		case '\n':
+			escaped.append("\\n");
+			break;
+		default:
+			escaped.append(c);
+			break;
+		}
+	}
+	return QByteArray(labelName) + "=\"" + escaped + '"';
+}
+
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_METRICS_H
+#define LIBSERVER_METRICS_H
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+namespace server {
+
+/**
+ * @brief Histogram of durations with fixed bucket bounds
+ *
+ * Observations are sorted into their bucket right away, so recording one is
+ * cheap and never allocates. Only meant to be touched from the main thread.
+ */
+class MetricsHistogram final {
+public:
+	void observe(qint64 nsecs);
+
+	quint64 count() const { return m_count; }
+
+private:
+	friend class MetricsWriter;
+
+	static constexpr int BUCKET_COUNT = 14;
+	static const qint64 BUCKET_BOUNDS_NSECS[BUCKET_COUNT];
+
+	// The last bucket catches everything above the largest bound.
+	quint64 m_buckets[BUCKET_COUNT + 1] = {};
+	quint64 m_count = 0;
+	quint64 m_sumNsecs = 0;
+};
+
+/**
+ * @brief Builds a metrics page in the Prometheus text exposition format
+ *
+ * All samples of a metric have to be written right after its declaration.
+ * Label values are escaped, label names and metric names are used verbatim.
+ */
+class MetricsWriter final {
+public:
+	void declare(const char *name, const char *type, const char *help);
+
+	void sample(const char *name, double value);
+	void sample(
+		const char *name, const char *labelName, const QString &labelValue,
+		double value);
+	void sample(const char *name, const QByteArray &labels, double value);
+
+	//! Durations in the histogram are written out in seconds.
+	void histogram(
+		const char *name, const QByteArray &labels, const MetricsHistogram &h);
+
+	static QByteArray label(const char *labelName, const QString &labelValue);
+
+	const QByteArray &text() const { return m_text; }
+
+private:
+	QByteArray m_text;
+};
+
+}
+
+#endif
@@ -957,6 +957,14 @@ CmdResult thumbnailError(
 	return CmdResult::ok();
 }
 
+CmdResult
+backlog(Client *client, const QJsonArray &args, const QJsonObject &kwargs)
+{
+	Q_UNUSED(args);
+	client->setRenderBacklog(kwargs[QStringLiteral("queued")].toInt());
+	return CmdResult::ok();
+}
+
 SrvCommandSet::SrvCommandSet()
 {
 	commands << SrvCommand("ready-to-autoreset", readyToAutoReset)
@@ -982,7 +990,8 @@ SrvCommandSet::SrvCommandSet()
 			 << SrvCommand("invite-create", createInvite)
 			 << SrvCommand("invite-remove", removeInvite)
 			 << SrvCommand(
-					"thumbnail-error", thumbnailError, SrvCommand::NONOP);
+					"thumbnail-error", thumbnailError, SrvCommand::NONOP)
+			 << SrvCommand("backlog", backlog, SrvCommand::NONOP);
 }
 
 } // end of anonymous namespace
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/passwordchecker.h"
+#include "libshared/util/functionrunnable.h"
+#include "libshared/util/passwordhash.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QThreadPool>
+
+namespace server {
+
+bool PasswordChecker::isExpensive(const QByteArray &hash)
+{
+	return hash.startsWith("sodium;") || hash.startsWith("pbkdf2;");
+}
+
+void PasswordChecker::check(
+	const QString &password, const QByteArray &hash,
+	const std::function<void(bool)> &callback)
+{
+	utils::FunctionRunnable *runnable =
+		new utils::FunctionRunnable([password, hash, callback]() {
+			bool ok = passwordhash::check(password, hash);
+			QMetaObject::invokeMethod(
+				QCoreApplication::instance(),
+				[callback, ok]() {
+					callback(ok);
+				},
+				Qt::QueuedConnection);
+		});
+	threadPool()->start(runnable);
+}
+
+QThreadPool *PasswordChecker::threadPool()
+{
+	static QThreadPool *pool;
+	if(!pool) {
+		// Each Argon2 check can take up dozens of megabytes, so this is kept
+		// to a few threads no matter how many cores there are.
+		pool = new QThreadPool(QCoreApplication::instance());
+		pool->setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+	}
+	return pool;
+}
+
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_PASSWORDCHECKER_H
+#define LIBSERVER_PASSWORDCHECKER_H
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+class QThreadPool;
+
+namespace server {
+
+/**
+ * @brief Checks passwords against their hashes outside of the main thread
+ *
+ * Argon2 and PBKDF2 are slow on purpose and Argon2 also needs a lot of memory,
+ * so a few logins at once would otherwise stall every session on the server.
+ * The checks run on a small pool of their own, excess ones queue up there
+ * instead of piling onto the global thread pool.
+ */
+class PasswordChecker final {
+public:
+	//! Whether checking against this hash takes long enough to bother.
+	static bool isExpensive(const QByteArray &hash);
+
+	/**
+	 * @brief Start checking a password in the background
+	 *
+	 * The callback is called on the main thread once the check is done. The
+	 * caller is responsible for making sure that whatever it captures is
+	 * still alive at that point.
+	 */
+	static void check(
+		const QString &password, const QByteArray &hash,
+		const std::function<void(bool)> &callback);
+
+private:
+	static QThreadPool *threadPool();
+};
+
+}
+
+#endif
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#define DP_PERF_NO_BEGIN_END
+#include <dpcommon/output.h>
+#include <dpcommon/perf.h>
+}
+#include "libserver/profiler.h"
+#include <QHash>
+#include <QJsonArray>
+#include <QVector>
+#include <algorithm>
+
+#define DP_PERF_CONTEXT "server"
+
+namespace server {
+
+namespace {
+
+constexpr int CATEGORY_COUNT = int(Profiler::Category::Count);
+
+// Time is collected into a current window, which becomes the previous window
+// after this long. Reports cover both, so they span one to two of these.
+constexpr qint64 WINDOW_MSECS = 60000;
+
+struct CategoryTimes {
+	qint64 nsecs[CATEGORY_COUNT] = {};
+
+	qint64 total() const
+	{
+		qint64 sum = 0;
+		for(qint64 n : nsecs) {
+			sum += n;
+		}
+		return sum;
+	}
+
+	CategoryTimes operator+(const CategoryTimes &other) const
+	{
+		CategoryTimes sum;
+		for(int i = 0; i < CATEGORY_COUNT; ++i) {
+			sum.nsecs[i] = nsecs[i] + other.nsecs[i];
+		}
+		return sum;
+	}
+};
+
+struct RollingTimes {
+	CategoryTimes current;
+	CategoryTimes previous;
+
+	CategoryTimes combined() const { return current + previous; }
+};
+
+struct ProfilerState {
+	Profiler::Scope *currentScope = nullptr;
+	QElapsedTimer windowTimer;
+	RollingTimes server;
+	QHash<QString, RollingTimes> sessions;
+};
+
+ProfilerState &state()
+{
+	static ProfilerState s;
+	return s;
+}
+
+void rotateWindows(ProfilerState &s)
+{
+	if(!s.windowTimer.isValid()) {
+		s.windowTimer.start();
+		return;
+	}
+
+	qint64 elapsed = s.windowTimer.elapsed();
+	if(elapsed < WINDOW_MSECS) {
+		return;
+	}
+
+	// If a whole window went by without rotating, the current one is too old
+	// to count as the previous one.
+	bool stale = elapsed >= WINDOW_MSECS * 2;
+	s.server.previous = stale ? CategoryTimes() : s.server.current;
+	s.server.current = CategoryTimes();
+	for(QHash<QString, RollingTimes>::iterator it = s.sessions.begin();
+		it != s.sessions.end();) {
+		it->previous = stale ? CategoryTimes() : it->current;
+		it->current = CategoryTimes();
+		if(it->previous.total() == 0) {
+			it = s.sessions.erase(it);
+		} else {
+			++it;
+		}
+	}
+	s.windowTimer.restart();
+}
+
+// DP_perf keeps the category pointer around, so these have to be literals.
+const char *categoryPerfName(Profiler::Category category)
+{
+	switch(category) {
+	case Profiler::Category::Messages:
+		return DP_PERF_CONTEXT ":messages";
+	case Profiler::Category::HistoryIo:
+		return DP_PERF_CONTEXT ":history_io";
+	case Profiler::Category::ResetStream:
+		return DP_PERF_CONTEXT ":reset_stream";
+	case Profiler::Category::Login:
+		return DP_PERF_CONTEXT ":login";
+	case Profiler::Category::Announcements:
+		return DP_PERF_CONTEXT ":announcements";
+	case Profiler::Category::Count:
+		break;
+	}
+	return DP_PERF_CONTEXT ":unknown";
+}
+
+QJsonObject categoryTimesToJson(const CategoryTimes &times)
+{
+	static const QString names[CATEGORY_COUNT] = {
+		QStringLiteral("messages"),	   QStringLiteral("historyIo"),
+		QStringLiteral("resetStream"), QStringLiteral("login"),
+		QStringLiteral("announcements"),
+	};
+	QJsonObject o;
+	for(int i = 0; i < CATEGORY_COUNT; ++i) {
+		o[names[i]] = double(times.nsecs[i]) / 1.0e6;
+	}
+	return o;
+}
+
+}
+
+Profiler::Scope::Scope(Category category, const QString &sessionId)
+	: m_parent(state().currentScope)
+	, m_category(category)
+	, m_sessionId(
+		  sessionId.isEmpty() && m_parent ? m_parent->m_sessionId : sessionId)
+{
+	const char *realm = DP_PERF_XSTR(DP_PERF_REALM);
+	const char *categories = categoryPerfName(category);
+	if(m_sessionId.isEmpty()) {
+		m_perfHandle = DP_perf_begin(realm, categories, nullptr);
+	} else {
+		m_perfHandle = DP_perf_begin(
+			realm, categories, "%s", qUtf8Printable(m_sessionId));
+	}
+	state().currentScope = this;
+	m_timer.start();
+}
+
+Profiler::Scope::~Scope()
+{
+	qint64 nsecs = m_timer.nsecsElapsed();
+	DP_perf_end(m_perfHandle);
+	state().currentScope = m_parent;
+	if(m_parent) {
+		m_parent->m_childNsecs += nsecs;
+	}
+	record(m_category, m_sessionId, qMax(nsecs - m_childNsecs, qint64(0)));
+}
+
+bool Profiler::openTrace(const QString &path)
+{
+	DP_Output *output = DP_gzip_output_new_from_path(qUtf8Printable(path));
+	if(!output || !DP_perf_open(output)) {
+		qWarning(
+			"Error opening profiler trace %s: %s", qUtf8Printable(path),
+			DP_error());
+		return false;
+	}
+	return true;
+}
+
+void Profiler::closeTrace()
+{
+	if(DP_perf_is_open() && !DP_perf_close()) {
+		qWarning("Error closing profiler trace: %s", DP_error());
+	}
+}
+
+QJsonObject Profiler::reportToJson(int topSessionCount)
+{
+	ProfilerState &s = state();
+	rotateWindows(s);
+
+	QVector<QPair<qint64, QString>> ranking;
+	ranking.reserve(s.sessions.size());
+	for(QHash<QString, RollingTimes>::const_iterator
+			it = s.sessions.constBegin(),
+			end = s.sessions.constEnd();
+		it != end; ++it) {
+		ranking.append({it->combined().total(), it.key()});
+	}
+	std::sort(
+		ranking.begin(), ranking.end(),
+		[](const QPair<qint64, QString> &a, const QPair<qint64, QString> &b) {
+			return a.first > b.first;
+		});
+
+	QJsonArray sessions;
+	int count = qMin(topSessionCount, int(ranking.size()));
+	for(int i = 0; i < count; ++i) {
+		const QString &id = ranking[i].second;
+		sessions.append(QJsonObject{
+			{QStringLiteral("id"), id},
+			{QStringLiteral("msecs"), double(ranking[i].first) / 1.0e6},
+			{QStringLiteral("categories"),
+			 categoryTimesToJson(s.sessions[id].combined())},
+		});
+	}
+
+	CategoryTimes server = s.server.combined();
+	return QJsonObject{
+		{QStringLiteral("windowSecs"),
+		 double(WINDOW_MSECS + s.windowTimer.elapsed()) / 1000.0},
+		{QStringLiteral("msecs"), double(server.total()) / 1.0e6},
+		{QStringLiteral("categories"), categoryTimesToJson(server)},
+		{QStringLiteral("sessions"), sessions},
+		{QStringLiteral("trace"), DP_perf_is_open()},
+	};
+}
+
+void Profiler::record(Category category, const QString &sessionId, qint64 nsecs)
+{
+	ProfilerState &s = state();
+	rotateWindows(s);
+	int i = int(category);
+	s.server.current.nsecs[i] += nsecs;
+	if(!sessionId.isEmpty()) {
+		s.sessions[sessionId].current.nsecs[i] += nsecs;
+	}
+}
+
+}
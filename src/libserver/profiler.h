@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_PROFILER_H
+#define LIBSERVER_PROFILER_H
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+
+namespace server {
+
+/**
+ * @brief Accounts where the server's main thread spends its time
+ *
+ * Time is tracked per operation category and per session, in a rolling
+ * window, so that an admin can tell which session is hogging the event loop
+ * when the server hitches. Nested scopes only count their own time, the time
+ * of inner scopes is attributed to those instead.
+ *
+ * Scopes can additionally be written out as a DP_perf trace, the same format
+ * that the client uses for its performance recordings.
+ *
+ * This is all process-wide state and must only be used on the main thread.
+ */
+class Profiler final {
+public:
+	enum class Category {
+		Messages,
+		HistoryIo,
+		ResetStream,
+		Login,
+		Announcements,
+		Count,
+	};
+
+	class Scope final {
+	public:
+		explicit Scope(Category category, const QString &sessionId = QString());
+		~Scope();
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	private:
+		Scope *m_parent;
+		Category m_category;
+		QString m_sessionId;
+		QElapsedTimer m_timer;
+		qint64 m_childNsecs = 0;
+		int m_perfHandle;
+	};
+
+	//! Open a DP_perf trace file, gzip compressed.
+	static bool openTrace(const QString &path);
+	static void closeTrace();
+
+	/**
+	 * @brief Get a report of the last one to two minutes
+	 *
+	 * Contains the time spent per category and the sessions that took up the
+	 * most time, each with their own breakdown by category.
+	 */
+	static QJsonObject reportToJson(int topSessionCount);
+
+private:
+	static void record(
+		Category category, const QString &sessionId, qint64 nsecs);
+};
+
+}
+
+#endif
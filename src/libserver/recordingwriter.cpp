@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/output.h>
+}
+#include "libserver/recordingwriter.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+
+namespace server {
+
+RecordingWriter::RecordingWriter(QFile *file)
+	: m_file(file)
+	, m_thread(QThread::create([this] {
+		run();
+	}))
+{
+	m_thread->start();
+}
+
+RecordingWriter::~RecordingWriter()
+{
+	commit();
+	{
+		QMutexLocker locker(&m_mutex);
+		m_quit = true;
+		m_workAvailable.wakeOne();
+	}
+	m_thread->wait();
+	delete m_thread;
+}
+
+void RecordingWriter::append(const void *data, size_t size)
+{
+	m_pending.append(static_cast<const char *>(data), int(size));
+	if(size_t(m_pending.size()) >= m_commitSize) {
+		commit();
+	}
+}
+
+void RecordingWriter::commit()
+{
+	if(m_pending.isEmpty()) {
+		return;
+	}
+
+	int size = int(m_pending.size());
+	QMutexLocker locker(&m_mutex);
+	if(m_queuedBytes != 0 && m_queuedBytes + size > MAX_QUEUED_BYTES) {
+		// The disk isn't keeping up, hold off until it does.
+		QElapsedTimer stallTimer;
+		stallTimer.start();
+		do {
+			m_workDone.wait(&m_mutex);
+		} while(m_queuedBytes != 0 && m_queuedBytes + size > MAX_QUEUED_BYTES);
+		++m_stalls;
+		m_stallNsecs += quint64(stallTimer.nsecsElapsed());
+	}
+
+	m_queuedBytes += size;
+	m_peakQueuedBytes = qMax(m_peakQueuedBytes, m_queuedBytes);
+	m_queue.enqueue(m_pending);
+	m_pending = QByteArray();
+	m_workAvailable.wakeOne();
+}
+
+bool RecordingWriter::sync()
+{
+	commit();
+	QMutexLocker locker(&m_mutex);
+	while(m_writing || !m_queue.isEmpty()) {
+		m_workDone.wait(&m_mutex);
+	}
+	return !m_error;
+}
+
+QJsonObject RecordingWriter::statsToJson() const
+{
+	QMutexLocker locker(&m_mutex);
+	return QJsonObject{
+		{QStringLiteral("commits"), double(m_commits)},
+		{QStringLiteral("bytes"), double(m_bytesWritten)},
+		{QStringLiteral("writeMsecs"), double(m_writeNsecs) / 1.0e6},
+		{QStringLiteral("queuedBytes"), m_queuedBytes},
+		{QStringLiteral("peakQueuedBytes"), m_peakQueuedBytes},
+		{QStringLiteral("stalls"), double(m_stalls)},
+		{QStringLiteral("stallMsecs"), double(m_stallNsecs) / 1.0e6},
+		{QStringLiteral("error"), m_error},
+	};
+}
+
+void RecordingWriter::run()
+{
+	QMutexLocker locker(&m_mutex);
+	while(true) {
+		while(m_queue.isEmpty() && !m_quit) {
+			m_workAvailable.wait(&m_mutex);
+		}
+
+		if(m_queue.isEmpty()) {
+			break;
+		}
+
+		QByteArray chunk = m_queue.dequeue();
+		m_writing = true;
+		locker.unlock();
+
+		QElapsedTimer writeTimer;
+		writeTimer.start();
+		qint64 written = m_file->write(chunk);
+		bool ok = written == chunk.size();
+		if(!ok) {
+			qWarning(
+				"Error writing %d byte(s) to recording, wrote %lld: %s",
+				int(chunk.size()), static_cast<long long>(written),
+				qUtf8Printable(m_file->errorString()));
+		} else if(!m_file->flush()) {
+			qWarning(
+				"Error flushing recording: %s",
+				qUtf8Printable(m_file->errorString()));
+			ok = false;
+		}
+		quint64 nsecs = quint64(writeTimer.nsecsElapsed());
+
+		locker.relock();
+		m_writing = false;
+		m_queuedBytes -= int(chunk.size());
+		++m_commits;
+		m_bytesWritten += quint64(qMax(written, qint64(0)));
+		m_writeNsecs += nsecs;
+		if(!ok) {
+			m_error = true;
+		}
+		m_workDone.wakeAll();
+	}
+}
+
+struct RecordingWriterOutputState {
+	RecordingWriter *writer;
+};
+
+static RecordingWriter *getWriter(void *internal)
+{
+	return static_cast<RecordingWriterOutputState *>(internal)->writer;
+}
+
+static size_t
+recordingWriterOutputWrite(void *internal, const void *buffer, size_t size)
+{
+	getWriter(internal)->append(buffer, size);
+	return size;
+}
+
+static bool recordingWriterOutputFlush(void *internal)
+{
+	if(getWriter(internal)->sync()) {
+		return true;
+	} else {
+		DP_error_set("Error writing recording");
+		return false;
+	}
+}
+
+static bool recordingWriterOutputDispose(void *internal, bool discard)
+{
+	RecordingWriter *writer = getWriter(internal);
+	bool ok = writer->sync();
+	if(!ok && !discard) {
+		DP_error_set("Error writing recording");
+	}
+	delete writer;
+	return ok;
+}
+
+static const DP_OutputMethods recordingWriterOutputMethods = {
+	recordingWriterOutputWrite,
+	nullptr,
+	recordingWriterOutputFlush,
+	nullptr,
+	nullptr,
+	nullptr,
+	recordingWriterOutputDispose,
+};
+
+static const DP_OutputMethods *
+recordingWriterOutputInit(void *internal, void *arg)
+{
+	*static_cast<RecordingWriterOutputState *>(internal) =
+		*static_cast<RecordingWriterOutputState *>(arg);
+	return &recordingWriterOutputMethods;
+}
+
+DP_Output *RecordingWriter::newOutput(RecordingWriter *writer)
+{
+	RecordingWriterOutputState state = {writer};
+	return DP_output_new(
+		recordingWriterOutputInit, &state, sizeof(RecordingWriterOutputState));
+}
+
+}
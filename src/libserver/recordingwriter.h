@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_RECORDINGWRITER_H
+#define LIBSERVER_RECORDINGWRITER_H
+#include <QByteArray>
+#include <QJsonObject>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+
+struct DP_Output;
+class QFile;
+class QThread;
+
+namespace server {
+
+/**
+ * @brief Writes a session recording file on a thread of its own
+ *
+ * Written data is gathered in memory and handed over to the writer thread in
+ * groups, either when the commit size is reached or when commit() is called,
+ * which the history does on a timer. The writer thread writes and flushes
+ * each group in one go, so a slow disk doesn't hold up message relay.
+ *
+ * If too much data is waiting to be written, committing blocks until the
+ * writer thread catches up. How often and for how long that happens is
+ * counted, along with the rest of the stats.
+ *
+ * The file must not be touched by anything else unless sync() was called
+ * first, which waits until everything has been written.
+ */
+class RecordingWriter final {
+public:
+	explicit RecordingWriter(QFile *file);
+	~RecordingWriter();
+
+	RecordingWriter(const RecordingWriter &) = delete;
+	RecordingWriter &operator=(const RecordingWriter &) = delete;
+
+	/**
+	 * @brief Make an output that writes through the given writer
+	 *
+	 * The output takes ownership of the writer, freeing the output waits for
+	 * everything to be written and then frees the writer too.
+	 */
+	static DP_Output *newOutput(RecordingWriter *writer);
+
+	void setCommitSize(size_t commitSize) { m_commitSize = commitSize; }
+
+	void append(const void *data, size_t size);
+
+	//! Hand everything written so far to the writer thread.
+	void commit();
+
+	//! Commit and wait until it's all in the file. Returns false on error.
+	bool sync();
+
+	QJsonObject statsToJson() const;
+
+private:
+	// Committing blocks when more than this much is waiting to be written.
+	static constexpr int MAX_QUEUED_BYTES = 16 * 1024 * 1024;
+
+	void run();
+
+	QFile *m_file;
+	QThread *m_thread;
+	QByteArray m_pending;
+	size_t m_commitSize = 64 * 1024;
+	mutable QMutex m_mutex;
+	QWaitCondition m_workAvailable;
+	QWaitCondition m_workDone;
+	QQueue<QByteArray> m_queue;
+	int m_queuedBytes = 0;
+	bool m_writing = false;
+	bool m_quit = false;
+	bool m_error = false;
+	quint64 m_commits = 0;
+	quint64 m_bytesWritten = 0;
+	quint64 m_writeNsecs = 0;
+	quint64 m_stalls = 0;
+	quint64 m_stallNsecs = 0;
+	int m_peakQueuedBytes = 0;
+};
+
+}
+
+#endif
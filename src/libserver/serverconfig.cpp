@@ -1,8 +1,10 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
+#include "libshared/util/passwordhash.h"
 #include <QJsonObject>
 #include <QRegularExpression>
+#include <algorithm>
 
 namespace server {
 
@@ -126,6 +128,51 @@ void ServerConfig::setConfigBool(ConfigKey key, bool value)
 		key, value ? QStringLiteral("true") : QStringLiteral("false"));
 }
 
+void ServerConfig::setExternalBans(const QVector<ExtBan> &bans)
+{
+	m_extBans = bans;
+	m_extBanIpTree.clear();
+	m_extBanIpRanges.clear();
+	m_extBanSystemIndex.clear();
+	m_extBanUserIndex.clear();
+
+	int banCount = m_extBans.size();
+	for(int banIndex = 0; banIndex < banCount; ++banIndex) {
+		const ExtBan &ban = m_extBans[banIndex];
+
+		int rangeCount = ban.ips.size();
+		for(int rangeIndex = 0; rangeIndex < rangeCount; ++rangeIndex) {
+			const BanIpRange &range = ban.ips[rangeIndex];
+			if(!range.from.isNull() && !range.to.isNull()) {
+				m_extBanIpTree.insertRange(
+					IpPrefixTree::normalize(range.from),
+					IpPrefixTree::normalize(range.to),
+					m_extBanIpRanges.size());
+				m_extBanIpRanges.append({banIndex, rangeIndex});
+			}
+		}
+
+		// Only the first entry of a ban containing an identifier counts.
+		for(const BanSystemIdentifier &system : ban.system) {
+			for(const QString &sid : system.sids) {
+				QVector<ExtBanRef> &refs = m_extBanSystemIndex[sid];
+				if(refs.isEmpty() || refs.last().banIndex != banIndex) {
+					refs.append({banIndex, system.reaction});
+				}
+			}
+		}
+
+		for(const BanUser &user : ban.users) {
+			for(long long userId : user.ids) {
+				QVector<ExtBanRef> &refs = m_extBanUserIndex[userId];
+				if(refs.isEmpty() || refs.last().banIndex != banIndex) {
+					refs.append({banIndex, user.reaction});
+				}
+			}
+		}
+	}
+}
+
 bool ServerConfig::setExternalBanEnabled(int id, bool enabled)
 {
 	if(enabled) {
@@ -153,6 +200,7 @@ QJsonArray ServerConfig::getExternalBans() const
 				{QStringLiteral("reason"), ban.reason},
 				{QStringLiteral("enabled"),
 				 !m_disabledExtBanIds.contains(ban.id)},
+				{QStringLiteral("hits"), double(m_extBanHits.value(ban.id))},
 			});
 	}
 	return bans;
@@ -166,16 +214,43 @@ bool ServerConfig::isAllowedAnnouncementUrl(const QUrl &url) const
 
 BanResult ServerConfig::isAddressBanned(const QHostAddress &addr) const
 {
+	if(addr.isNull() || m_extBanIpTree.isEmpty()) {
+		return BanResult::notBanned();
+	}
+
+	QVector<int> values;
+	m_extBanIpTree.lookup(IpPrefixTree::normalize(addr), values);
+	if(values.isEmpty()) {
+		return BanResult::notBanned();
+	}
+
+	// The first matching range of the first matching ban wins, like when
+	// going through the bans in order.
+	QVector<ExtBanIpRangeRef> candidates;
+	candidates.reserve(values.size());
+	for(int value : values) {
+		candidates.append(m_extBanIpRanges[value]);
+	}
+	std::sort(
+		candidates.begin(), candidates.end(),
+		[](const ExtBanIpRangeRef &a, const ExtBanIpRangeRef &b) {
+			return a.banIndex < b.banIndex ||
+				   (a.banIndex == b.banIndex && a.rangeIndex < b.rangeIndex);
+		});
+
 	QDateTime now = QDateTime::currentDateTime();
-	for(const ExtBan &ban : m_extBans) {
-		BanReaction reaction = BanReaction::NotBanned;
-		bool banned = !m_disabledExtBanIds.contains(ban.id) &&
-					  ban.expires > now &&
-					  isInAnyRange(addr, ban.ips, &reaction) &&
-					  !isInAnyRange(addr, ban.ipsExcluded);
-		if(banned) {
-			return makeBanResult(
-				ban, addr.toString(), QStringLiteral("IP"), reaction, true);
+	int previousBanIndex = -1;
+	for(const ExtBanIpRangeRef &candidate : candidates) {
+		if(candidate.banIndex == previousBanIndex) {
+			continue;
+		}
+		previousBanIndex = candidate.banIndex;
+
+		const ExtBan &ban = m_extBans[candidate.banIndex];
+		if(isExtBanActive(ban, now) && !isInAnyRange(addr, ban.ipsExcluded)) {
+			return extBanHit(
+				ban, addr.toString(), QStringLiteral("IP"),
+				ban.ips[candidate.rangeIndex].reaction, true);
 		}
 	}
 	return BanResult::notBanned();
@@ -183,15 +258,16 @@ BanResult ServerConfig::isAddressBanned(const QHostAddress &addr) const
 
 BanResult ServerConfig::isSystemBanned(const QString &sid) const
 {
-	QDateTime now = QDateTime::currentDateTime();
-	for(const ExtBan &ban : m_extBans) {
-		BanReaction reaction = BanReaction::NotBanned;
-		bool banned = !m_disabledExtBanIds.contains(ban.id) &&
-					  ban.expires > now &&
-					  isInAnySystem(sid, ban.system, reaction);
-		if(banned) {
-			return makeBanResult(
-				ban, sid, QStringLiteral("SID"), reaction, false);
+	QHash<QString, QVector<ExtBanRef>>::const_iterator it =
+		m_extBanSystemIndex.constFind(sid);
+	if(it != m_extBanSystemIndex.constEnd()) {
+		QDateTime now = QDateTime::currentDateTime();
+		for(const ExtBanRef &ref : it.value()) {
+			const ExtBan &ban = m_extBans[ref.banIndex];
+			if(isExtBanActive(ban, now)) {
+				return extBanHit(
+					ban, sid, QStringLiteral("SID"), ref.reaction, false);
+			}
 		}
 	}
 	return BanResult::notBanned();
@@ -199,16 +275,17 @@ BanResult ServerConfig::isSystemBanned(const QString &sid) const
 
 BanResult ServerConfig::isUserBanned(long long userId) const
 {
-	QDateTime now = QDateTime::currentDateTime();
-	for(const ExtBan &ban : m_extBans) {
-		BanReaction reaction = BanReaction::NotBanned;
-		bool banned = !m_disabledExtBanIds.contains(ban.id) &&
-					  ban.expires > now &&
-					  isInAnyUser(userId, ban.users, reaction);
-		if(banned) {
-			return makeBanResult(
-				ban, QString::number(userId), QStringLiteral("User"), reaction,
-				false);
+	QHash<long long, QVector<ExtBanRef>>::const_iterator it =
+		m_extBanUserIndex.constFind(userId);
+	if(it != m_extBanUserIndex.constEnd()) {
+		QDateTime now = QDateTime::currentDateTime();
+		for(const ExtBanRef &ref : it.value()) {
+			const ExtBan &ban = m_extBans[ref.banIndex];
+			if(isExtBanActive(ban, now)) {
+				return extBanHit(
+					ban, QString::number(userId), QStringLiteral("User"),
+					ref.reaction, false);
+			}
 		}
 	}
 	return BanResult::notBanned();
@@ -217,7 +294,20 @@ BanResult ServerConfig::isUserBanned(long long userId) const
 RegisteredUser ServerConfig::getUserAccount(
 	const QString &username, const QString &password) const
 {
-	Q_UNUSED(password);
+	QByteArray passwordHash;
+	RegisteredUser user = findUserAccount(username, passwordHash);
+	if(user.status == RegisteredUser::Ok &&
+	   !passwordhash::check(password, passwordHash)) {
+		return RegisteredUser{
+			RegisteredUser::BadPass, username, QStringList(), QString()};
+	}
+	return user;
+}
+
+RegisteredUser ServerConfig::findUserAccount(
+	const QString &username, QByteArray &outPasswordHash) const
+{
+	Q_UNUSED(outPasswordHash);
 	return RegisteredUser{
 		RegisteredUser::NotFound, username, QStringList(), nullptr};
 }
@@ -252,6 +342,21 @@ bool ServerConfig::setAdminSectionsLocked(
 	return false;
 }
 
+void ServerConfig::setClusterNodeSessions(
+	const QString &nodeUrl, const QVector<ClusterSession> &sessions)
+{
+	Q_UNUSED(nodeUrl);
+	Q_UNUSED(sessions);
+}
+
+QString ServerConfig::getClusterSessionNodeUrl(
+	const QString &idOrAlias, const QString &ownNodeUrl) const
+{
+	Q_UNUSED(idOrAlias);
+	Q_UNUSED(ownNodeUrl);
+	return QString();
+}
+
 bool ServerConfig::preferWebSockets() const
 {
 #ifdef HAVE_WEBSOCKETS
@@ -332,6 +437,29 @@ bool ServerConfig::matchesBannedAddress(
 	}
 }
 
+bool ServerConfig::bannedAddressToPrefix(
+	const QHostAddress &ip, int subnet, Q_IPV6ADDR &outPrefix, int &outLength)
+{
+	switch(ip.protocol()) {
+	case QAbstractSocket::IPv4Protocol:
+		if(subnet >= 0 && subnet <= 32) {
+			outPrefix = IpPrefixTree::normalize(ip);
+			outLength = 96 + (subnet == 0 ? 32 : subnet);
+			return true;
+		}
+		return false;
+	case QAbstractSocket::IPv6Protocol:
+		if(subnet >= 0 && subnet <= 128) {
+			outPrefix = IpPrefixTree::normalize(ip);
+			outLength = subnet == 0 ? 128 : subnet;
+			return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
 BanReaction ServerConfig::parseReaction(const QString &reaction)
 {
 	if(reaction.isEmpty() || reaction == QStringLiteral("normal")) {
@@ -422,29 +550,17 @@ bool ServerConfig::isAddressInRangeV6(
 	return false;
 }
 
-bool ServerConfig::isInAnySystem(
-	const QString &sid, const QVector<BanSystemIdentifier> &system,
-	BanReaction &outReaction)
+bool ServerConfig::isExtBanActive(const ExtBan &ban, const QDateTime &now) const
 {
-	for(const BanSystemIdentifier &s : system) {
-		if(s.sids.contains(sid)) {
-			outReaction = s.reaction;
-			return true;
-		}
-	}
-	return false;
+	return !m_disabledExtBanIds.contains(ban.id) && ban.expires > now;
 }
 
-bool ServerConfig::isInAnyUser(
-	long long userId, const QVector<BanUser> &users, BanReaction &outReaction)
+BanResult ServerConfig::extBanHit(
+	const ExtBan &ban, const QString &cause, const QString &sourceType,
+	BanReaction reaction, bool isExemptable) const
 {
-	for(const BanUser &u : users) {
-		if(u.ids.contains(userId)) {
-			outReaction = u.reaction;
-			return true;
-		}
-	}
-	return false;
+	++m_extBanHits[ban.id];
+	return makeBanResult(ban, cause, sourceType, reaction, isExemptable);
 }
 
 BanResult ServerConfig::makeBanResult(
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef LIBSERVER_SERVERCONFIG_H
 #define LIBSERVER_SERVERCONFIG_H
+#include "libserver/ipprefixtree.h"
 #include <QDateTime>
 #include <QHash>
 #include <QHostAddress>
@@ -176,7 +177,51 @@ static const ConfigKey
 	// this that the user sets (other than 0, which means disabled) are clamped
 	// to the minimum instead.
 	MinimumAutoresetThreshold(
-		54, "minimumAutoResetThreshold", "0", ConfigKey::SIZE);
+		54, "minimumAutoResetThreshold", "0", ConfigKey::SIZE),
+	// Let clients compress the message stream with zstd. Only applies to TCP
+	// connections, WebSocket framing is left alone.
+	StreamCompression(55, "streamCompression", "true", ConfigKey::BOOL),
+	// Session recordings are written on a separate thread. Messages are handed
+	// to it in groups after this much time or this much data has piled up.
+	RecordingCommitInterval(
+		56, "recordingCommitInterval", "1", ConfigKey::TIME),
+	RecordingCommitSize(57, "recordingCommitSize", "64kb", ConfigKey::SIZE),
+	// Run each session through the paint engine on the server, so that it can
+	// perform autoresets by itself instead of relying on a client to do it.
+	// This costs a fair bit of CPU and memory per session.
+	ServerCanvas(58, "serverCanvas", "false", ConfigKey::BOOL),
+	// Maximum rate at which history is sent to each client that's catching up,
+	// in bytes per second. Live relay to clients that are caught up is always
+	// handled first. Zero means no limit.
+	CatchupRate(59, "catchupRate", "10mb", ConfigKey::SIZE),
+	// Public URL of this server when running as one node in a cluster, such as
+	// drawpile://node1.example.com:27751. Nodes publish their sessions in a
+	// directory shared through the server database and send clients looking
+	// for a session they don't have to the node that does. Empty means this
+	// server isn't part of a cluster.
+	ClusterNodeUrl(60, "clusterNodeUrl", "", ConfigKey::STRING),
+	// Sessions that nobody has been in for this long drop their cached history
+	// and server canvas, which get brought back when someone joins again. Zero
+	// means sessions are never hibernated.
+	HibernateTime(61, "hibernateTime", "0", ConfigKey::TIME),
+	// Let browser clients pack multiple messages into each WebSocket frame
+	// instead of sending every message on its own. Does nothing for TCP
+	// connections, those are a plain stream anyway.
+	MessageBatching(62, "messageBatching", "true", ConfigKey::BOOL),
+	// Compress session recordings as seekable zstd, a series of independent
+	// frames with an index at the end. Playback reads them transparently, other
+	// tools can unpack them with plain zstd.
+	RecordingCompression(
+		63, "recordingCompression", "false", ConfigKey::BOOL),
+	// How much drawing each user may send per second, measured in milliseconds
+	// that the paint engine is estimated to take to apply it. Users going over
+	// have their messages held back until they're within budget again, single
+	// messages way over budget are dropped. Zero means no limit.
+	DrawCostBudget(64, "drawCostBudget", "0", ConfigKey::INT),
+	// Move closed blocks of session history out of the recording into a zstd
+	// compressed block file next to it, leaving only the open block in the
+	// recording. They're decompressed again when a client needs them.
+	HistoryCompression(65, "historyCompression", "false", ConfigKey::BOOL);
 }
 
 //! Settings that are not adjustable after the server has started
@@ -228,6 +273,11 @@ struct RegisteredUser {
 	QString userId;
 };
 
+struct ClusterSession {
+	QString id;
+	QString alias;
+};
+
 enum class BanReaction {
 	NotBanned,
 	Unknown,
@@ -321,7 +371,7 @@ public:
 	void setConfigInt(ConfigKey, int value);
 	void setConfigBool(ConfigKey, bool value);
 
-	void setExternalBans(const QVector<ExtBan> &bans) { m_extBans = bans; }
+	void setExternalBans(const QVector<ExtBan> &bans);
 	virtual bool setExternalBanEnabled(int id, bool enabled);
 	QJsonArray getExternalBans() const;
 
@@ -342,11 +392,23 @@ public:
 	/**
 	 * @brief See if there is a registered user with the given credentials
 	 *
-	 * The default implementation always returns NotFound
+	 * The default implementation looks up the account with findUserAccount
+	 * and checks the password against its hash.
 	 */
 	virtual RegisteredUser
 	getUserAccount(const QString &username, const QString &password) const;
 
+	/**
+	 * @brief Look up a registered user without checking their password
+	 *
+	 * If the status is Ok, outPasswordHash is set to the hash the password
+	 * has to be checked against, so that it can be done off the main thread.
+	 * BadPass is never returned. The default implementation always returns
+	 * NotFound.
+	 */
+	virtual RegisteredUser
+	findUserAccount(const QString &username, QByteArray &outPasswordHash) const;
+
 	virtual bool hasAnyUserAccounts() const;
 
 	virtual bool supportsAdminSectionLocks() const;
@@ -355,6 +417,23 @@ public:
 	virtual bool setAdminSectionsLocked(
 		const QSet<QString> &sections, const QString &password);
 
+	/**
+	 * @brief Replace the sessions listed for a node in the cluster directory
+	 *
+	 * The default implementation does nothing, since there's no one to share
+	 * the directory with.
+	 */
+	virtual void setClusterNodeSessions(
+		const QString &nodeUrl, const QVector<ClusterSession> &sessions);
+
+	/**
+	 * @brief Find another cluster node that hosts the given session
+	 *
+	 * The default implementation always returns an empty string.
+	 */
+	virtual QString getClusterSessionNodeUrl(
+		const QString &idOrAlias, const QString &ownNodeUrl) const;
+
 	bool preferWebSockets() const;
 
 	/**
@@ -404,6 +483,16 @@ protected:
 	static bool matchesBannedAddress(
 		const QHostAddress &addr, const QHostAddress &ip, int subnet);
 
+	/**
+	 * @brief Get the prefix that matchesBannedAddress checks against
+	 *
+	 * Returns false if it doesn't boil down to a plain prefix, in which case
+	 * the address has to be checked with matchesBannedAddress directly.
+	 */
+	static bool bannedAddressToPrefix(
+		const QHostAddress &ip, int subnet, Q_IPV6ADDR &outPrefix,
+		int &outLength);
+
 	static bool isAddressInRange(
 		const QHostAddress &addr, const QHostAddress &from,
 		const QHostAddress &to);
@@ -411,6 +500,21 @@ protected:
 	static QString reactionToString(BanReaction reaction);
 
 private:
+	struct ExtBanIpRangeRef {
+		int banIndex;
+		int rangeIndex;
+	};
+
+	struct ExtBanRef {
+		int banIndex;
+		BanReaction reaction;
+	};
+
+	bool isExtBanActive(const ExtBan &ban, const QDateTime &now) const;
+	BanResult extBanHit(
+		const ExtBan &ban, const QString &cause, const QString &sourceType,
+		BanReaction reaction, bool isExemptable) const;
+
 	static bool isInAnyRange(
 		const QHostAddress &addr, const QVector<BanIpRange> &ranges,
 		BanReaction *outReaction = nullptr);
@@ -423,14 +527,6 @@ private:
 		const QHostAddress &addr, const QHostAddress &from,
 		const QHostAddress &to);
 
-	static bool isInAnySystem(
-		const QString &sid, const QVector<BanSystemIdentifier> &system,
-		BanReaction &outReaction);
-
-	static bool isInAnyUser(
-		long long userId, const QVector<BanUser> &users,
-		BanReaction &outReaction);
-
 	static BanResult makeBanResult(
 		const ExtBan &ban, const QString &cause, const QString &sourceType,
 		BanReaction reaction, bool isExemptable);
@@ -449,6 +545,12 @@ private:
 
 	InternalConfig m_internalCfg;
 	QVector<ExtBan> m_extBans;
+	// Indices into the external bans, rebuilt whenever they are replaced.
+	IpPrefixTree m_extBanIpTree;
+	QVector<ExtBanIpRangeRef> m_extBanIpRanges;
+	QHash<QString, QVector<ExtBanRef>> m_extBanSystemIndex;
+	QHash<long long, QVector<ExtBanRef>> m_extBanUserIndex;
+	mutable QHash<int, quint64> m_extBanHits;
 	QSet<int> m_disabledExtBanIds;
 	QRegularExpression m_nameFilterRegex;
 	QRegularExpression m_forbiddenNameRegex;
@@ -462,7 +564,7 @@ private:
 namespace diagnostic_marker_private {
 class [[maybe_unused]] AbstractServerConfigMarker : ServerConfig {
 	inline RegisteredUser
-	getUserAccount(const QString &, const QString &) const override
+	findUserAccount(const QString &, QByteArray &) const override
 	{
 		return RegisteredUser();
 	}
@@ -2,6 +2,7 @@
 extern "C" {
 #include <dpcommon/output.h>
 #include <dpengine/recorder.h>
+#include <dpengine/seekable_zstd.h>
 }
 #include "libserver/announcements.h"
 #include "libserver/client.h"
@@ -126,6 +127,7 @@ Session::Session(
 	, m_history(history)
 	, m_config(config)
 	, m_announcements(announcements)
+	, m_drawCostBudget(config->getConfigInt(config::DrawCostBudget))
 {
 	m_history->setParent(this);
 	connect(
@@ -135,6 +137,15 @@ Session::Session(
 
 	m_lastEventTime.start();
 
+	// Anything that changes what the session looks like from the outside
+	// goes through these, so that's when the description is stale.
+	connect(this, &Session::sessionAttributeChanged, this, [this] {
+		m_cachedDescriptionTimer.invalidate();
+	});
+	connect(this, &Session::historyReset, this, [this] {
+		m_cachedDescriptionTimer.invalidate();
+	});
+
 	// History already exists? Skip the Initialization state.
 	if(history->sizeInBytes() > 0)
 		m_state = State::Running;
@@ -235,6 +246,7 @@ void Session::switchState(State newstate)
 						QStringLiteral("reset")));
 
 				onSessionReset();
+				emit historyReset(this);
 
 				sendUpdatedSessionProperties();
 			}
@@ -383,6 +395,7 @@ void Session::joinUser(
 				isGhost
 					? QStringLiteral("Moderator in ghost mode joined session")
 					: QStringLiteral("Joined session")));
+	emit userJoined(this, user);
 	emit sessionAttributeChanged(this);
 }
 
@@ -396,6 +409,7 @@ void Session::removeUser(Client *user)
 					 user->peerAddress(), user->sid(), !user->isModerator()});
 
 	Q_ASSERT(user->session() == this);
+	emit userLeft(this, user);
 	bool isGhost = user->isGhost();
 	user->log(
 		Log()
@@ -1876,6 +1890,7 @@ void Session::directToAll(const net::Message &msg)
 {
 	for(Client *c : m_clients) {
 		c->sendDirectMessage(msg);
+		m_messageStats.relay.add(msg);
 	}
 }
 
@@ -1994,6 +2009,11 @@ void Session::restartRecording()
 	qDebug("Starting session recording %s", qPrintable(filename));
 
 	DP_Output *output = DP_file_output_new_from_path(qUtf8Printable(filename));
+	if(output && m_config->getConfigBool(config::RecordingCompression)) {
+		output = DP_seekable_zstd_output_new(
+			output, DP_SEEKABLE_ZSTD_FRAME_SIZE_DEFAULT,
+			DP_SEEKABLE_ZSTD_SYNC_INTERVAL_MS_DEFAULT);
+	}
 	m_recorder =
 		output
 			? DP_recorder_new_inc(
@@ -2013,7 +2033,7 @@ void Session::restartRecording()
 
 	int lastBatchIndex = 0;
 	do {
-		net::MessageList history;
+		HistoryBatch history;
 		std::tie(history, lastBatchIndex) = m_history->getBatch(lastBatchIndex);
 		for(const net::Message &msg : history) {
 			DP_recorder_message_push_inc(m_recorder, msg.get());
@@ -2173,6 +2193,18 @@ void Session::onConfigValueChanged(const ConfigKey &key)
 		if(!m_history->hasOverrideSizeLimit()) {
 			sendUpdatedSessionProperties();
 		}
+	} else if(
+		key.index == config::RecordingCommitInterval.index ||
+		key.index == config::RecordingCommitSize.index) {
+		m_history->setRecordingCommitPolicy(
+			m_config->getConfigTime(config::RecordingCommitInterval),
+			m_config->getConfigSize(config::RecordingCommitSize));
+	} else if(key.index == config::HistoryCompression.index) {
+		m_history->setBlockCompression(
+			m_config->getConfigBool(config::HistoryCompression));
+	} else if(key.index == config::DrawCostBudget.index) {
+		// Read for every message received, so it's cached here.
+		m_drawCostBudget = m_config->getConfigInt(config::DrawCostBudget);
 	}
 }
 
@@ -2301,6 +2333,15 @@ void Session::handleThumbnailError(
 
 QJsonObject Session::getDescription(bool full, bool invite) const
 {
+	// The basic description is asked for by the session listing and by every
+	// login in the lobby, so it's reused for a little while. Counts that
+	// change all the time, like the size, may lag behind by that much.
+	bool cacheable = !full && !invite;
+	if(cacheable && m_cachedDescriptionTimer.isValid() &&
+	   !m_cachedDescriptionTimer.hasExpired(DESCRIPTION_CACHE_MSECS)) {
+		return m_cachedDescription;
+	}
+
 	// The basic description contains just the information
 	// needed for the login session listing
 	QJsonObject o{
@@ -2347,6 +2388,11 @@ QJsonObject Session::getDescription(bool full, bool invite) const
 	}
 #endif
 
+	if(cacheable) {
+		m_cachedDescription = o;
+		m_cachedDescriptionTimer.start();
+	}
+
 	if(full) {
 		// Full descriptions includes detailed info for server admins.
 		o.insert(QStringLiteral("maxSize"), int(m_history->currentSizeLimit()));
@@ -2365,6 +2411,7 @@ QJsonObject Session::getDescription(bool full, bool invite) const
 			QStringLiteral("minResetThreshold"),
 			int(m_history->minimumAutoResetThreshold()));
 
+		o[QStringLiteral("drawCostBudget")] = m_drawCostBudget;
 		o[QStringLiteral("deputies")] =
 			m_history->hasFlag(SessionHistory::Deputies);
 		o[QStringLiteral("hasOpword")] = !m_history->opwordHash().isEmpty();
@@ -2505,6 +2552,19 @@ JsonApiResult Session::callJsonApi(
 			return callInvitesJsonApi(method, tail, request);
 		} else if(head == QStringLiteral("thumbnail")) {
 			return callThumbnailJsonApi(method, tail, request);
+		} else if(head == QStringLiteral("stats")) {
+			if(!tail.isEmpty()) {
+				return JsonApiNotFound();
+			} else if(method != JsonApiMethod::Get) {
+				return JsonApiBadMethod();
+			} else {
+				QJsonObject stats = m_messageStats.toJson();
+				QJsonObject recordingStats = m_history->recordingStats();
+				if(!recordingStats.isEmpty()) {
+					stats[QStringLiteral("recording")] = recordingStats;
+				}
+				return JsonApiResult{JsonApiResult::Ok, QJsonDocument(stats)};
+			}
 		}
 
 		int userId = head.toInt();
@@ -2909,6 +2969,9 @@ JsonApiResult Session::callThumbnailJsonApi(
 				QStringLiteral("No thumbnail available"));
 		}
 
+	} else if(method == JsonApiMethod::Create) {
+		return createServerThumbnail(request);
+
 	} else if(method == JsonApiMethod::Delete) {
 		bool thumbnail =
 			parseRequestBool(request, QStringLiteral("thumbnail"), 1, 1);
@@ -2934,6 +2997,14 @@ JsonApiResult Session::callThumbnailJsonApi(
 	}
 }
 
+JsonApiResult Session::createServerThumbnail(const QJsonObject &request)
+{
+	Q_UNUSED(request);
+	return JsonApiErrorResult(
+		JsonApiResult::BadRequest,
+		QStringLiteral("Server-side thumbnails are not available"));
+}
+
 void Session::timeOutAdminChat()
 {
 	if(m_adminChat) {
@@ -3,6 +3,7 @@
 #define LIBSHARED_SERVER_SESSION_H
 #include "libserver/announcable.h"
 #include "libserver/jsonapi.h"
+#include "libserver/messagestats.h"
 #include "libserver/sessionhistory.h"
 #include "libshared/net/message.h"
 #include <QDateTime>
@@ -113,8 +114,19 @@ public:
 	 */
 	virtual bool supportsAutoReset() const = 0;
 	virtual bool supportsSkipCatchup() const = 0;
+	//! Whether clients should report their render backlog to the session.
+	virtual bool supportsBacklogReports() const = 0;
 	virtual bool supportsSizeLimit() const = 0;
 
+	/**
+	 * @brief Release memory that can be recovered from the history later
+	 *
+	 * Called on sessions that nobody has been in for a while. The session
+	 * wakes up again by itself when the next client joins.
+	 */
+	virtual void hibernate() {}
+	virtual bool isHibernating() const { return false; }
+
 	//! Set session attributes
 	void setSessionConfig(const QJsonObject &conf, Client *changedBy);
 
@@ -226,6 +238,13 @@ public:
 	const SessionHistory *history() const { return m_history; }
 	SessionHistory *history() { return m_history; }
 
+	//! Drawing cost budget per user in milliseconds per second, 0 is unlimited.
+	int drawCostBudget() const { return m_drawCostBudget; }
+
+	//! Get the per message type counters of this session
+	SessionMessageStats &messageStats() { return m_messageStats; }
+	const SessionMessageStats &messageStats() const { return m_messageStats; }
+
 	/**
 	 * @brief Process a message received from a client
 	 * @param client
@@ -430,6 +449,17 @@ signals:
 
 	void sessionDestroyed(Session *thisSession);
 
+	//! A user just joined or is just about to leave this session.
+	void userJoined(Session *thisSession, Client *user);
+	void userLeft(Session *thisSession, Client *user);
+
+	//! The history size was sent out, which happens every so often while the
+	//! session is active, so this is a throttled size change notification.
+	void historySizeChanged(Session *thisSession);
+
+	//! The session history was just reset.
+	void historyReset(Session *thisSession);
+
 private slots:
 	void removeUser(Client *user);
 	void onAnnouncementsChanged(const Announcable *session);
@@ -464,6 +494,9 @@ protected:
 	//! A streamed reset message was received
 	virtual void onResetStream(Client &client, const net::Message &msg) = 0;
 
+	//! Render a thumbnail on the server instead of asking a client for it
+	virtual JsonApiResult createServerThumbnail(const QJsonObject &request);
+
 	//! This message was just added to session history
 	void addedToHistory(const net::Message &msg);
 
@@ -487,6 +520,8 @@ private:
 
 	// If someone sent a drawing command in the last 5 minutes, they are active.
 	static constexpr qint64 ACTIVE_THRESHOLD_MS = 5 * 60 * 1000;
+	// How long the basic session description may be reused.
+	static constexpr qint64 DESCRIPTION_CACHE_MSECS = 5000;
 
 	void addClientMessage(const Client &client, const net::Message &msg);
 
@@ -581,6 +616,10 @@ private:
 	uint m_resetstreamsize = 0;
 
 	QElapsedTimer m_lastEventTime;
+	mutable QJsonObject m_cachedDescription;
+	mutable QElapsedTimer m_cachedDescriptionTimer;
+	SessionMessageStats m_messageStats;
+	int m_drawCostBudget;
 
 	bool m_closed = false;
 };
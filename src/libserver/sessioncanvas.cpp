@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/common.h>
+#include <dpengine/canvas_history.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/snapshots.h>
+#include <dpmsg/acl.h>
+#include <dpmsg/message.h>
+#include <dpmsg/messages.h>
+}
+#include "libserver/sessioncanvas.h"
+#include "libserver/historybatch.h"
+#include "libserver/sessionhistory.h"
+#include <tuple>
+
+namespace server {
+
+SessionCanvas::SessionCanvas()
+	: m_dc(DP_draw_context_new())
+{
+	reset();
+}
+
+SessionCanvas::~SessionCanvas()
+{
+	DP_acl_state_free(m_acls);
+	DP_canvas_history_free(m_canvasHistory);
+	DP_draw_context_free(m_dc);
+}
+
+// The server leaves the body of drawing commands undecoded, since it normally
+// has no use for them. The paint engine needs them decoded though.
+static net::Message decodeMessage(const net::Message &msg)
+{
+	DP_Message *data = msg.get();
+	if(!DP_message_opaque(data)) {
+		return msg;
+	}
+
+	size_t length;
+	const unsigned char *buf =
+		DP_message_serialized_noinc(data, true, &length);
+	if(!buf) {
+		return net::Message::null();
+	}
+
+	return net::Message::deserialize(buf, length, true);
+}
+
+void SessionCanvas::handleMessage(const net::Message &msg)
+{
+	net::Message decoded = decodeMessage(msg);
+	if(decoded.isNull()) {
+		qWarning(
+			"Server canvas: error decoding %s: %s",
+			qUtf8Printable(msg.typeName()), DP_error());
+		return;
+	}
+
+	DP_Message *data = decoded.get();
+	if(DP_acl_state_handle(m_acls, data, false) & DP_ACL_STATE_FILTERED_BIT) {
+		return;
+	}
+
+	switch(decoded.type()) {
+	case DP_MSG_SOFT_RESET:
+		softReset();
+		break;
+	case DP_MSG_UNDO_DEPTH:
+		DP_canvas_history_undo_depth_limit_set(
+			m_canvasHistory, m_dc,
+			DP_msg_undo_depth_depth(DP_msg_undo_depth_cast(data)));
+		m_undoDepthMessage = decoded;
+		break;
+	case DP_MSG_DEFAULT_LAYER:
+		m_defaultLayerMessage = decoded;
+		break;
+	case DP_MSG_CHAT:
+		handleChat(decoded);
+		break;
+	default:
+		if(decoded.isInCommandRange() &&
+		   !DP_canvas_history_handle(m_canvasHistory, m_dc, data)) {
+			qWarning(
+				"Server canvas: error handling %s: %s",
+				qUtf8Printable(decoded.typeName()), DP_error());
+		}
+		break;
+	}
+}
+
+void SessionCanvas::rebuild(const SessionHistory *history)
+{
+	reset();
+	long long lastBatchIndex = history->firstIndex() - 1LL;
+	while(lastBatchIndex < history->lastIndex()) {
+		HistoryBatch batch;
+		std::tie(batch, lastBatchIndex) = history->getBatch(lastBatchIndex);
+		for(const net::Message &msg : batch) {
+			handleMessage(msg);
+		}
+	}
+}
+
+void SessionCanvas::softReset()
+{
+	DP_canvas_history_soft_reset(m_canvasHistory, m_dc, 0, nullptr, nullptr);
+}
+
+net::MessageList SessionCanvas::resetImageHead() const
+{
+	net::MessageList msgs;
+	if(!m_undoDepthMessage.isNull()) {
+		msgs.append(m_undoDepthMessage);
+	}
+	if(!m_pinnedMessage.isNull()) {
+		msgs.append(m_pinnedMessage);
+	}
+	return msgs;
+}
+
+static bool pushAclResetImageMessage(void *user, DP_Message *msg)
+{
+	static_cast<net::MessageList *>(user)->append(net::Message::noinc(msg));
+	return true;
+}
+
+net::MessageList SessionCanvas::resetImageTail() const
+{
+	net::MessageList msgs;
+	if(!m_defaultLayerMessage.isNull()) {
+		msgs.append(m_defaultLayerMessage);
+	}
+	// Operator and trusted states are retained by the server itself.
+	DP_acl_state_reset_image_build(
+		m_acls, 0, DP_ACL_STATE_RESET_IMAGE_SESSION_RESET_FLAGS, nullptr,
+		nullptr, pushAclResetImageMessage, &msgs);
+	return msgs;
+}
+
+DP_CanvasState *SessionCanvas::canvasStateInc() const
+{
+	return DP_canvas_history_get(m_canvasHistory);
+}
+
+static void pushResetImageMessage(void *user, DP_Message *msg)
+{
+	static_cast<net::MessageList *>(user)->append(net::Message::noinc(msg));
+}
+
+void SessionCanvas::appendResetImageDec(
+	net::MessageList &msgs, DP_CanvasState *cs)
+{
+	DP_reset_image_build(cs, 0, false, pushResetImageMessage, &msgs);
+	DP_canvas_state_decref(cs);
+}
+
+void SessionCanvas::reset()
+{
+	DP_acl_state_free(m_acls);
+	DP_canvas_history_free(m_canvasHistory);
+	m_canvasHistory = DP_canvas_history_new(nullptr, nullptr, false, nullptr);
+	m_acls = DP_acl_state_new();
+	m_undoDepthMessage = net::Message::null();
+	m_defaultLayerMessage = net::Message::null();
+	m_pinnedMessage = net::Message::null();
+}
+
+void SessionCanvas::handleChat(const net::Message &msg)
+{
+	DP_MsgChat *mc = DP_msg_chat_cast(msg.get());
+	if(DP_msg_chat_oflags(mc) & DP_MSG_CHAT_OFLAGS_PIN) {
+		// A pinned message of "-" means to remove it.
+		size_t length;
+		const char *text = DP_msg_chat_message(mc, &length);
+		if(length == 1 && text[0] == '-') {
+			m_pinnedMessage = net::Message::null();
+		} else {
+			m_pinnedMessage = msg;
+		}
+	}
+}
+
+}
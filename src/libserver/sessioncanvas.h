@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_SESSIONCANVAS_H
+#define LIBSERVER_SESSIONCANVAS_H
+#include "libshared/net/message.h"
+
+struct DP_AclState;
+struct DP_CanvasHistory;
+struct DP_CanvasState;
+struct DP_DrawContext;
+
+namespace server {
+
+class SessionHistory;
+
+/**
+ * @brief The canvas of a session, maintained on the server
+ *
+ * The thin server normally doesn't look at what's being drawn at all. This
+ * runs the session history through the paint engine the same way clients do,
+ * minus the rendering, so that the server can build a reset image by itself
+ * instead of having to wait for an operator to volunteer one. That costs CPU
+ * and memory on the server, so it's optional.
+ *
+ * Building the reset image can be done on another thread: the canvas state
+ * is immutable, so a reference to it can be handed off.
+ */
+class SessionCanvas final {
+public:
+	SessionCanvas();
+	~SessionCanvas();
+
+	SessionCanvas(const SessionCanvas &) = delete;
+	SessionCanvas &operator=(const SessionCanvas &) = delete;
+
+	//! Handle a message that was just added to the session history.
+	void handleMessage(const net::Message &msg);
+
+	//! Throw away the current state and replay the entire given history.
+	void rebuild(const SessionHistory *history);
+
+	//! Cut off the undo history, done where a streamed reset forks off.
+	void softReset();
+
+	//! Messages that go in front of the canvas in a reset image.
+	net::MessageList resetImageHead() const;
+
+	//! Messages that go after the canvas in a reset image.
+	net::MessageList resetImageTail() const;
+
+	//! The current canvas state, with a reference added.
+	DP_CanvasState *canvasStateInc() const;
+
+	//! Append the canvas part of a reset image and decref the state.
+	static void appendResetImageDec(net::MessageList &msgs, DP_CanvasState *cs);
+
+private:
+	void reset();
+	void handleChat(const net::Message &msg);
+
+	DP_CanvasHistory *m_canvasHistory = nullptr;
+	DP_AclState *m_acls = nullptr;
+	DP_DrawContext *m_dc;
+	net::Message m_undoDepthMessage;
+	net::Message m_defaultLayerMessage;
+	net::Message m_pinnedMessage;
+};
+
+}
+
+#endif
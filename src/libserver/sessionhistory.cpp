@@ -3,6 +3,7 @@ extern "C" {
 #include <dpmsg/reset_stream.h>
 }
 #include "libserver/client.h"
+#include "libserver/profiler.h"
 #include "libserver/sessionhistory.h"
 #include "libshared/net/servercmd.h"
 #include "libshared/util/ulid.h"
@@ -224,6 +225,7 @@ StreamResetStartResult SessionHistory::startStreamedReset(
 	uint8_t ctxId, const QString &correlator,
 	const net::MessageList &serverSideStateMessages)
 {
+	Profiler::Scope profilerScope(Profiler::Category::ResetStream, m_id);
 	if(m_resetStreamState != ResetStreamState::None) {
 		return StreamResetStartResult::AlreadyActive;
 	}
@@ -293,6 +295,7 @@ bool SessionHistory::receiveResetStreamMessage(net::Message &msg)
 StreamResetAddResult
 SessionHistory::addStreamResetMessage(uint8_t ctxId, const net::Message &msg)
 {
+	Profiler::Scope profilerScope(Profiler::Category::ResetStream, m_id);
 	if(m_resetStreamState != ResetStreamState::Streaming) {
 		return StreamResetAddResult::NotActive;
 	}
@@ -327,6 +330,22 @@ SessionHistory::addStreamResetMessage(uint8_t ctxId, const net::Message &msg)
 	return StreamResetAddResult::Ok;
 }
 
+StreamResetAddResult SessionHistory::addStreamResetImageMessage(
+	uint8_t ctxId, const net::Message &msg)
+{
+	if(m_resetStreamState != ResetStreamState::Streaming) {
+		return StreamResetAddResult::NotActive;
+	}
+
+	if(m_resetStreamCtxId != ctxId) {
+		return StreamResetAddResult::InvalidUser;
+	}
+
+	net::Message message = msg;
+	return receiveResetStreamMessage(message) ? StreamResetAddResult::Ok
+											  : m_resetStreamAddError;
+}
+
 StreamResetAbortResult SessionHistory::abortStreamedReset(int ctxId)
 {
 	if(m_resetStreamState == ResetStreamState::Streaming) {
@@ -344,6 +363,7 @@ StreamResetAbortResult SessionHistory::abortStreamedReset(int ctxId)
 StreamResetPrepareResult
 SessionHistory::prepareStreamedReset(uint8_t ctxId, int expectedMessageCount)
 {
+	Profiler::Scope profilerScope(Profiler::Category::ResetStream, m_id);
 	if(m_resetStreamState != ResetStreamState::Streaming) {
 		return StreamResetPrepareResult::NotActive;
 	}
@@ -353,7 +373,9 @@ SessionHistory::prepareStreamedReset(uint8_t ctxId, int expectedMessageCount)
 	}
 
 	m_resetStreamAddError = StreamResetAddResult::ConsumerError;
-	bool freeOk = DP_reset_stream_consumer_free_finish(m_resetStreamConsumer);
+	// There's no consumer if the reset image was added message by message.
+	bool freeOk = !m_resetStreamConsumer ||
+				  DP_reset_stream_consumer_free_finish(m_resetStreamConsumer);
 	m_resetStreamConsumer = nullptr;
 	if(!freeOk) {
 		switch(m_resetStreamAddError) {
@@ -393,6 +415,7 @@ SessionHistory::prepareStreamedReset(uint8_t ctxId, int expectedMessageCount)
 bool SessionHistory::resolveStreamedReset(
 	long long &outOffset, QString &outError)
 {
+	Profiler::Scope profilerScope(Profiler::Category::ResetStream, m_id);
 	if(m_resetStreamState != ResetStreamState::Prepared) {
 		outError = QStringLiteral("reset stream is not prepared");
 		return false;
@@ -1,7 +1,9 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef LIBSERVER_SESSION_HISTORY_H
 #define LIBSERVER_SESSION_HISTORY_H
+#include "libserver/historybatch.h"
 #include "libserver/idqueue.h"
+#include "libserver/metrics.h"
 #include "libserver/sessionban.h"
 #include "libshared/net/message.h"
 #include "libshared/util/historyindex.h"
@@ -9,6 +11,7 @@
 #include <QDateTime>
 #include <QJsonValue>
 #include <QObject>
+#include <functional>
 #include <tuple>
 
 struct DP_ResetStreamConsumer;
@@ -303,6 +306,16 @@ public:
 	StreamResetAddResult
 	addStreamResetMessage(uint8_t ctxId, const net::Message &msg);
 
+	/**
+	 * @brief Add a reset image message to a streamed reset
+	 *
+	 * Unlike addStreamResetMessage, this takes a message of the reset image
+	 * itself instead of a compressed chunk of it. Used when the server builds
+	 * the reset image on its own.
+	 */
+	StreamResetAddResult
+	addStreamResetImageMessage(uint8_t ctxId, const net::Message &msg);
+
 	/**
 	 * @brief Cancel a streaming history reset in progress
 	 *
@@ -354,14 +367,74 @@ public:
 	 *
 	 * This returns a {batch, lastIndex} tuple.
 	 * The batch contains zero or more messages immediately following
-	 * the given index.
+	 * the given index. It shares the history's storage, so don't hold on
+	 * to it for longer than needed.
 	 *
 	 * The second element of the tuple is the index of the last message
 	 * in the batch, or lastIndex() if there were no more available messages
 	 */
-	virtual std::tuple<net::MessageList, long long>
+	virtual std::tuple<HistoryBatch, long long>
 	getBatch(long long after) const = 0;
 
+	/**
+	 * @brief Get a batch of messages without waiting for disk reads
+	 *
+	 * Like getBatch, but if the messages aren't in memory, this returns an
+	 * empty batch with the given index as the last index and loads them in
+	 * the background instead. The newMessagesAvailable() signal is emitted
+	 * once they're ready.
+	 */
+	virtual std::tuple<HistoryBatch, long long>
+	getBatchNonBlocking(long long after) const
+	{
+		return getBatch(after);
+	}
+
+	//! Receives a batch of messages in wire format, returns if it used it.
+	using FramedBatchFn = std::function<bool(const char *, size_t)>;
+
+	/**
+	 * @brief Get a batch of messages in the wire format they were stored in
+	 *
+	 * Storage backends that keep messages in wire format can pass them along
+	 * directly instead of making message objects out of them. If this
+	 * returns false, the batch must be gotten through getBatch instead.
+	 * Otherwise the index of the last message passed is put in outLastIndex.
+	 */
+	virtual bool getFramedBatch(
+		long long after, const FramedBatchFn &fn,
+		long long &outLastIndex) const
+	{
+		Q_UNUSED(after);
+		Q_UNUSED(fn);
+		Q_UNUSED(outLastIndex);
+		return false;
+	}
+
+	/**
+	 * @brief Set how often recorded messages are handed off to be written
+	 *
+	 * Only does something for histories that write to disk.
+	 */
+	virtual void setRecordingCommitPolicy(int intervalSecs, size_t commitSize)
+	{
+		Q_UNUSED(intervalSecs);
+		Q_UNUSED(commitSize);
+	}
+
+	/**
+	 * @brief Set whether closed history blocks get compressed
+	 *
+	 * Only does something for histories that write to disk.
+	 */
+	virtual void setBlockCompression(bool enabled) { Q_UNUSED(enabled); }
+
+	//! Stats about writing to disk, empty if the history doesn't do that.
+	virtual QJsonObject recordingStats() const { return QJsonObject(); }
+
+	//! How long loading history blocks from disk took, if this does that.
+	const MetricsHistogram &blockLoadTimes() const { return m_blockLoadTimes; }
+
 	/**
 	 * @brief Mark messages before the given index as unneeded (for now)
 	 *
@@ -610,6 +683,8 @@ protected:
 	int incrementNextCatchupKey(int &nextCatchupKey);
 
 	SessionBanList m_banlist;
+	// Blocks are loaded lazily while getting batches, which is const.
+	mutable MetricsHistogram m_blockLoadTimes;
 
 private:
 	enum class ResetStreamState { None, Streaming, Prepared };
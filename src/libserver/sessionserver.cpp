@@ -4,6 +4,7 @@
 #include "libserver/filedhistory.h"
 #include "libserver/inmemoryhistory.h"
 #include "libserver/loginhandler.h"
+#include "libserver/metrics.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/templateloader.h"
@@ -219,16 +220,49 @@ void SessionServer::initSession(Session *session)
 	connect(
 		session, &Session::sessionDestroyed, this,
 		&SessionServer::removeSession, Qt::DirectConnection);
+	connect(
+		session, &Session::userJoined, this, &SessionServer::onUserJoined);
+	connect(
+		session, &Session::userLeft, this, &SessionServer::onUserLeft,
+		Qt::DirectConnection);
+	connect(
+		session, &Session::historySizeChanged, this,
+		&SessionServer::onHistorySizeChanged);
+	connect(
+		session, &Session::historyReset, this,
+		&SessionServer::onHistoryReset);
 
+	QJsonObject description = session->getDescription();
+	m_changes.append(QStringLiteral("session-created"), description);
 	emit sessionCreated(session);
-	emit sessionChanged(session->getDescription());
+	emit sessionChanged(description);
+	publishClusterSessions();
 }
 
 void SessionServer::removeSession(Session *session)
 {
 	m_sessions.removeOne(session);
 	m_announcements->unlistSession(session); // just to be safe
+	m_changes.append(
+		QStringLiteral("session-ended"),
+		{{QStringLiteral("id"), session->id()}});
 	emit sessionEnded(session->id());
+	publishClusterSessions();
+}
+
+void SessionServer::publishClusterSessions()
+{
+	QString nodeUrl = m_config->getConfigString(config::ClusterNodeUrl);
+	if(nodeUrl.isEmpty()) {
+		return;
+	}
+
+	QVector<ClusterSession> sessions;
+	sessions.reserve(m_sessions.size());
+	for(const Session *s : m_sessions) {
+		sessions.append({s->id(), s->idAlias()});
+	}
+	m_config->setClusterNodeSessions(nodeUrl, sessions);
 }
 
 Session *SessionServer::getSessionById(const QString &id, bool load)
@@ -332,6 +366,7 @@ void SessionServer::addClient(ThinServerClient *client)
 	connect(
 		client, &ThinServerClient::thinServerClientDestroyed, this,
 		&SessionServer::removeClient, Qt::DirectConnection);
+	m_changes.append(QStringLiteral("user-connected"), client->description());
 
 	emit userCountChanged(m_clients.size());
 
@@ -348,6 +383,10 @@ void SessionServer::addClient(ThinServerClient *client)
 void SessionServer::removeClient(ThinServerClient *client)
 {
 	m_clients.removeOne(client);
+	// This is called from the client's destructor, so only the uid is safe.
+	m_changes.append(
+		QStringLiteral("user-disconnected"),
+		{{QStringLiteral("uid"), client->uid()}});
 	emit userCountChanged(m_clients.size());
 }
 
@@ -389,10 +428,44 @@ void SessionServer::onSessionAttributeChanged(Session *session)
 		session->killSession(
 			QStringLiteral("Session terminated due to being empty"));
 	} else {
-		emit sessionChanged(session->getDescription());
+		QJsonObject description = session->getDescription();
+		m_changes.append(QStringLiteral("session-changed"), description);
+		emit sessionChanged(description);
 	}
 }
 
+void SessionServer::onUserJoined(Session *session, Client *user)
+{
+	m_changes.append(
+		QStringLiteral("user-joined"),
+		{{QStringLiteral("uid"), user->uid()},
+		 {QStringLiteral("session"), session->id()}});
+}
+
+void SessionServer::onUserLeft(Session *session, Client *user)
+{
+	m_changes.append(
+		QStringLiteral("user-left"),
+		{{QStringLiteral("uid"), user->uid()},
+		 {QStringLiteral("session"), session->id()}});
+}
+
+void SessionServer::onHistorySizeChanged(Session *session)
+{
+	m_changes.append(
+		QStringLiteral("session-size"),
+		{{QStringLiteral("id"), session->id()},
+		 {QStringLiteral("size"), double(session->history()->sizeInBytes())}});
+}
+
+void SessionServer::onHistoryReset(Session *session)
+{
+	m_changes.append(
+		QStringLiteral("session-reset"),
+		{{QStringLiteral("id"), session->id()},
+		 {QStringLiteral("size"), double(session->history()->sizeInBytes())}});
+}
+
 void SessionServer::cleanupSessions()
 {
 	qint64 emptySessionLingerTime =
@@ -402,6 +475,7 @@ void SessionServer::cleanupSessions()
 	bool allowIdleOverride =
 		expirationTime > 0 ? m_config->getConfigBool(config::AllowIdleOverride)
 						   : false;
+	qint64 hibernateTime = m_config->getConfigTime(config::HibernateTime) * 1000;
 	for(Session *s : m_sessions) {
 		qint64 lastEventTime = s->lastEventTime();
 		if(!s->history()->hasFlag(SessionHistory::Persistent) &&
@@ -423,8 +497,15 @@ void SessionServer::cleanupSessions()
 					.message(QStringLiteral("Idle session expired.")));
 			s->killSession(QStringLiteral(
 				"Session terminated due to being idle too long"));
+		} else if(
+			hibernateTime > 0 && lastEventTime > hibernateTime &&
+			s->userCount() == 0 && !s->isHibernating()) {
+			s->hibernate();
 		}
 	}
+
+	// Also serves to keep this node's cluster directory entries from expiring.
+	publishClusterSessions();
 }
 
 JsonApiResult SessionServer::callSessionJsonApi(
@@ -525,6 +606,22 @@ JsonApiResult SessionServer::callUserJsonApi(
 	}
 }
 
+JsonApiResult SessionServer::callChangesJsonApi(
+	JsonApiMethod method, const QStringList &path, const QJsonObject &request,
+	bool sectionLocked)
+{
+	Q_UNUSED(sectionLocked);
+	if(!path.isEmpty()) {
+		return JsonApiNotFound();
+	} else if(method != JsonApiMethod::Get) {
+		return JsonApiBadMethod();
+	}
+
+	quint64 since =
+		request.value(QStringLiteral("since")).toVariant().toULongLong();
+	return {JsonApiResult::Ok, QJsonDocument(m_changes.toJson(since))};
+}
+
 ThinServerClient *SessionServer::searchClientByPathUid(const QString &uid)
 {
 	for(ThinServerClient *c : m_clients) {
@@ -535,4 +632,130 @@ ThinServerClient *SessionServer::searchClientByPathUid(const QString &uid)
 	return nullptr;
 }
 
+void SessionServer::writeMetrics(MetricsWriter &w) const
+{
+	w.declare("drawpile_sessions", "gauge", "Number of active sessions.");
+	w.sample("drawpile_sessions", double(m_sessions.size()));
+	w.declare("drawpile_clients", "gauge", "Number of connected clients.");
+	w.sample("drawpile_clients", double(m_clients.size()));
+
+	w.declare(
+		"drawpile_session_users", "gauge", "Number of users in the session.");
+	for(const Session *s : m_sessions) {
+		w.sample(
+			"drawpile_session_users", "session", s->id(),
+			double(s->userCount()));
+	}
+
+	w.declare(
+		"drawpile_session_history_bytes", "gauge",
+		"Size of the session history.");
+	for(const Session *s : m_sessions) {
+		w.sample(
+			"drawpile_session_history_bytes", "session", s->id(),
+			double(s->history()->sizeInBytes()));
+	}
+
+	w.declare(
+		"drawpile_session_history_messages", "gauge",
+		"Number of messages in the session history.");
+	for(const Session *s : m_sessions) {
+		const SessionHistory *h = s->history();
+		w.sample(
+			"drawpile_session_history_messages", "session", s->id(),
+			double(h->lastIndex() - h->firstIndex() + 1LL));
+	}
+
+	w.declare(
+		"drawpile_session_received_bytes_total", "counter",
+		"Bytes of messages received from clients in the session.");
+	for(const Session *s : m_sessions) {
+		w.sample(
+			"drawpile_session_received_bytes_total", "session", s->id(),
+			double(s->messageStats().receive.totalBytes()));
+	}
+
+	w.declare(
+		"drawpile_session_relayed_bytes_total", "counter",
+		"Bytes of messages sent to clients in the session.");
+	for(const Session *s : m_sessions) {
+		w.sample(
+			"drawpile_session_relayed_bytes_total", "session", s->id(),
+			double(s->messageStats().relay.totalBytes()));
+	}
+
+	// Messages are handled on the main thread, so this is where a session's
+	// CPU time goes, apart from background block loads and recording writes.
+	w.declare(
+		"drawpile_session_handle_seconds_total", "counter",
+		"Time spent handling messages received in the session.");
+	for(const Session *s : m_sessions) {
+		w.sample(
+			"drawpile_session_handle_seconds_total", "session", s->id(),
+			double(s->messageStats().receive.totalNsecs()) / 1.0e9);
+	}
+
+	w.declare(
+		"drawpile_session_message_handle_seconds", "histogram",
+		"Time from receiving a message until it's been relayed to clients "
+		"that are caught up.");
+	for(const Session *s : m_sessions) {
+		w.histogram(
+			"drawpile_session_message_handle_seconds",
+			MetricsWriter::label("session", s->id()),
+			s->messageStats().handleTimes);
+	}
+
+	w.declare(
+		"drawpile_session_block_load_seconds", "histogram",
+		"Time taken to load a block of history from disk.");
+	for(const Session *s : m_sessions) {
+		w.histogram(
+			"drawpile_session_block_load_seconds",
+			MetricsWriter::label("session", s->id()),
+			s->history()->blockLoadTimes());
+	}
+
+	QVector<QPair<QByteArray, const ThinServerClient *>> sessionClients;
+	for(const ThinServerClient *c : m_clients) {
+		const Session *s = c->session();
+		if(s) {
+			sessionClients.append(
+				{MetricsWriter::label("session", s->id()) + ',' +
+					 MetricsWriter::label("user", QString::number(c->id())),
+				 c});
+		}
+	}
+
+	w.declare(
+		"drawpile_client_history_lag_messages", "gauge",
+		"Number of history messages the client has yet to be sent.");
+	for(const QPair<QByteArray, const ThinServerClient *> &sc :
+		sessionClients) {
+		w.sample(
+			"drawpile_client_history_lag_messages", sc.first,
+			double(qMax(sc.second->historyLag(), 0LL)));
+	}
+
+	w.declare(
+		"drawpile_client_catching_up", "gauge",
+		"Whether the client is being sent history at a limited rate.");
+	for(const QPair<QByteArray, const ThinServerClient *> &sc :
+		sessionClients) {
+		w.sample(
+			"drawpile_client_catching_up", sc.first,
+			sc.second->isCatchingUp() ? 1.0 : 0.0);
+	}
+
+	w.declare(
+		"drawpile_client_upload_queue_bytes", "gauge",
+		"Bytes waiting to be sent to the client.");
+	for(const QPair<QByteArray, const ThinServerClient *> &sc :
+		sessionClients) {
+		w.sample(
+			"drawpile_client_upload_queue_bytes", sc.first,
+			double(sc.second->uploadQueueBytes()));
+	}
+}
+
 }
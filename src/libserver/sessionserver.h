@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef LIBSERVER_SESSIONSERVER_H
 #define LIBSERVER_SESSIONSERVER_H
+#include "libserver/changefeed.h"
 #include "libserver/jsonapi.h"
 #include "libserver/sessions.h"
 #include "libshared/net/protover.h"
@@ -14,6 +15,7 @@ class Announcements;
 
 namespace server {
 
+class MetricsWriter;
 class Session;
 class SessionHistory;
 class ThinServerClient;
@@ -146,6 +148,19 @@ public:
 		JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request, bool sectionLocked);
 
+	/**
+	 * @brief Get the session and user changes after a given sequence number
+	 *
+	 * This lets the web admin keep its listings up to date without fetching
+	 * all of them again every time.
+	 */
+	JsonApiResult callChangesJsonApi(
+		JsonApiMethod method, const QStringList &path,
+		const QJsonObject &request, bool sectionLocked);
+
+	//! Write session and client metrics for the metrics endpoint.
+	void writeMetrics(MetricsWriter &w) const;
+
 signals:
 	/**
 	 * @brief A session was just created
@@ -181,6 +196,10 @@ private slots:
 	void removeSession(Session *session);
 	void removeClient(ThinServerClient *client);
 	void onSessionAttributeChanged(Session *session);
+	void onUserJoined(Session *session, Client *user);
+	void onUserLeft(Session *session, Client *user);
+	void onHistorySizeChanged(Session *session);
+	void onHistoryReset(Session *session);
 	void cleanupSessions();
 
 private:
@@ -189,6 +208,7 @@ private:
 		const protocol::ProtocolVersion &protocolVersion,
 		const QString &founder);
 	void initSession(Session *session);
+	void publishClusterSessions();
 
 	ThinServerClient *searchClientByPathUid(const QString &uid);
 
@@ -201,6 +221,7 @@ private:
 	QList<Session *> m_sessions;
 	QList<ThinServerClient *> m_clients;
 	QHash<QString, QString> m_nextTemplateIds;
+	ChangeFeed m_changes;
 };
 
 }
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/common.h>
+#include <dpcommon/output.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/image.h>
+#include <dpimpex/image_impex.h>
+#include <dpmsg/messages.h>
+}
+#include "libserver/sessionthumbnailer.h"
+#include "libshared/util/functionrunnable.h"
+#include "libshared/util/qtcompat.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QThreadPool>
+
+namespace server {
+
+SessionThumbnailer::Params
+SessionThumbnailer::makeParams(int maxWidth, int maxHeight, int quality)
+{
+	return Params{
+		maxWidth <= 0 ? DEFAULT_DIMENSION : qMin(MAX_DIMENSION, maxWidth),
+		maxHeight <= 0 ? DEFAULT_DIMENSION : qMin(MAX_DIMENSION, maxHeight),
+		quality <= 0 ? DEFAULT_QUALITY : qMin(101, quality), Format::Webp};
+}
+
+bool SessionThumbnailer::parseFormat(const QString &format, Format &outFormat)
+{
+	if(format.isEmpty() ||
+	   QStringLiteral("webp").compare(format, Qt::CaseInsensitive) == 0) {
+		outFormat = Format::Webp;
+		return true;
+	} else if(
+		QStringLiteral("jpg").compare(format, Qt::CaseInsensitive) == 0 ||
+		QStringLiteral("jpeg").compare(format, Qt::CaseInsensitive) == 0) {
+		outFormat = Format::Jpeg;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+void SessionThumbnailer::generateDec(
+	DP_CanvasState *cs, const Params &params,
+	const std::function<void(const QByteArray &, const QString &)> &callback)
+{
+	utils::FunctionRunnable *runnable =
+		new utils::FunctionRunnable([cs, params, callback]() {
+			// Without a draw context, this samples the canvas directly with
+			// nearest-neighbor scaling instead of flattening all of it first,
+			// which is a lot cheaper on large canvases.
+			Params p = params;
+			void *buffer;
+			size_t size;
+			bool ok = DP_image_thumbnail_from_canvas_write(
+				cs, nullptr, p.maxWidth, p.maxHeight,
+				[](void *user, DP_Image *img, DP_Output *output) {
+					return write(*static_cast<Params *>(user), img, output);
+				},
+				&p, &buffer, &size);
+			DP_canvas_state_decref(cs);
+
+			QByteArray data;
+			QString error;
+			if(ok) {
+				data = QByteArray(
+					static_cast<const char *>(buffer), compat::castSize(size));
+				DP_free(buffer);
+			} else {
+				error = QString::fromUtf8(DP_error());
+			}
+
+			QMetaObject::invokeMethod(
+				QCoreApplication::instance(),
+				[callback, data, error]() {
+					callback(data, error);
+				},
+				Qt::QueuedConnection);
+		});
+	threadPool()->start(runnable);
+}
+
+bool SessionThumbnailer::write(
+	const Params &params, DP_Image *img, DP_Output *output)
+{
+	// Same size limit as thumbnails that clients send, to keep it consistent.
+	size_t maxSize = size_t(DP_MSG_THUMBNAIL_DATA_MAX_SIZE);
+	int quality = params.quality;
+	while(true) {
+		bool ok;
+		if(params.format == Format::Jpeg) {
+			ok = DP_image_write_jpeg_quality(img, output, qMin(100, quality));
+		} else if(quality > 100) {
+			ok = DP_image_write_webp(img, output);
+		} else {
+			ok = DP_image_write_webp_lossy(img, output, quality);
+		}
+		if(!ok) {
+			return false;
+		}
+
+		bool error;
+		size_t size = DP_output_tell(output, &error);
+		if(error) {
+			return false;
+		} else if(size < maxSize) {
+			return true;
+		} else if(quality == 1) {
+			DP_error_set("Could not generate thumbnail <= %zu bytes", maxSize);
+			return false;
+		} else if(!DP_output_clear(output)) {
+			return false;
+		}
+
+		quality = quality > 100
+					  ? 100
+					  : DP_max_int(1, DP_min_int(quality - 10, quality / 2));
+	}
+}
+
+QThreadPool *SessionThumbnailer::threadPool()
+{
+	static QThreadPool *pool;
+	if(!pool) {
+		// Thumbnails aren't urgent, so they get a small share of the cores.
+		pool = new QThreadPool(QCoreApplication::instance());
+		pool->setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 4, 2));
+	}
+	return pool;
+}
+
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_SESSIONTHUMBNAILER_H
+#define LIBSERVER_SESSIONTHUMBNAILER_H
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+struct DP_CanvasState;
+struct DP_Image;
+struct DP_Output;
+class QThreadPool;
+
+namespace server {
+
+/**
+ * @brief Renders session thumbnails from the server canvas
+ *
+ * Thumbnails are normally rendered by a client in the session on request, so
+ * sessions without a capable client never get one. If the session has a
+ * server canvas though, the server has the canvas state at hand already and
+ * can render it by itself.
+ *
+ * That happens on a pool of its own that's kept to a thread or two, so that a
+ * bunch of thumbnail requests at once can't crowd out everything else.
+ *
+ * Only available if the server is built with SERVER_THUMBNAILS, since the
+ * image encoders are otherwise not needed by the server at all.
+ */
+class SessionThumbnailer final {
+public:
+	enum class Format { Jpeg, Webp };
+
+	struct Params {
+		int maxWidth;
+		int maxHeight;
+		int quality;
+		Format format;
+
+		bool operator==(const Params &other) const
+		{
+			return maxWidth == other.maxWidth &&
+				   maxHeight == other.maxHeight && quality == other.quality &&
+				   format == other.format;
+		}
+
+		bool operator!=(const Params &other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	//! Clamps the dimensions and fills in defaults for anything not given.
+	static Params makeParams(int maxWidth, int maxHeight, int quality);
+
+	//! Returns false if the format isn't known, an empty one means default.
+	static bool parseFormat(const QString &format, Format &outFormat);
+
+	/**
+	 * @brief Render a thumbnail in the background
+	 *
+	 * Takes over the given reference to the canvas state. The callback is
+	 * called on the main thread with the encoded image, or with an empty one
+	 * and an error message if that didn't work out.
+	 */
+	static void generateDec(
+		DP_CanvasState *cs, const Params &params,
+		const std::function<void(const QByteArray &, const QString &)>
+			&callback);
+
+private:
+	static constexpr int MAX_DIMENSION = 1000;
+	static constexpr int DEFAULT_DIMENSION = 400;
+	static constexpr int DEFAULT_QUALITY = 80;
+
+	static bool write(const Params &params, DP_Image *img, DP_Output *output);
+
+	static QThreadPool *threadPool();
+};
+
+}
+
+#endif
@@ -3,7 +3,6 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QSslCipher>
-#include <QSslConfiguration>
 #include <QSslSocket>
 
 namespace server {
@@ -47,6 +46,7 @@ bool SslServer::reloadCertChain()
 
 	m_certLastMod = fi.lastModified();
 	m_certchain = chain;
+	updateSslConfiguration();
 	qInfo(
 		"Loaded cert chain from '%s' (last modified %s)",
 		qUtf8Printable(fi.canonicalFilePath()),
@@ -97,6 +97,7 @@ bool SslServer::reloadKey()
 
 	m_keyLastMod = fi.lastModified();
 	m_key = key;
+	updateSslConfiguration();
 	qInfo(
 		"Loaded private %s key from '%s' (last modified %s)",
 		getSslKeyAlgorithmName(m_key.algorithm()),
@@ -166,6 +167,18 @@ SslServer::getSslKeyAlgorithmName(QSsl::KeyAlgorithm algorithm) const
 	return "UNKNOWN";
 }
 
+void SslServer::updateSslConfiguration()
+{
+	// Built once here instead of for every connection, so that sockets all
+	// share the same configuration instead of each making their own copy.
+	m_sslConfiguration = QSslConfiguration::defaultConfiguration();
+	m_sslConfiguration.setLocalCertificateChain(m_certchain);
+	m_sslConfiguration.setPrivateKey(m_key);
+	m_sslConfiguration.setSslOption(QSsl::SslOptionDisableCompression, false);
+	// Tickets can't be redeemed anyway, see the comment on the class.
+	m_sslConfiguration.setSslOption(QSsl::SslOptionDisableSessionTickets, true);
+}
+
 bool SslServer::isValidCert() const
 {
 	return !m_certchain.isEmpty() && !m_key.isNull();
@@ -184,13 +197,7 @@ void SslServer::incomingConnection(qintptr handle)
 	QSslSocket *socket = new QSslSocket(this);
 	socket->setSocketOption(QAbstractSocket::LowDelayOption, true);
 	socket->setSocketDescriptor(handle);
-	socket->setLocalCertificateChain(m_certchain);
-	socket->setPrivateKey(m_key);
-
-	QSslConfiguration sslconf = socket->sslConfiguration();
-	sslconf.setSslOption(QSsl::SslOptionDisableCompression, false);
-	socket->setSslConfiguration(sslconf);
-
+	socket->setSslConfiguration(m_sslConfiguration);
 	addPendingConnection(socket);
 }
 }
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libserver/changefeed.h"
+
+#include <QtTest/QtTest>
+
+using server::ChangeFeed;
+
+class TestChangeFeed final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testEmpty()
+	{
+		ChangeFeed feed;
+		QCOMPARE(feed.lastSeq(), quint64(0));
+
+		QJsonArray changes;
+		QVERIFY(feed.changesSince(0, changes));
+		QVERIFY(changes.isEmpty());
+		QVERIFY(!feed.changesSince(1, changes));
+	}
+
+	void testChangesSince()
+	{
+		ChangeFeed feed;
+		QCOMPARE(feed.append("a", {{"x", 1}}), quint64(1));
+		QCOMPARE(feed.append("b", {{"x", 2}}), quint64(2));
+		QCOMPARE(feed.append("c", {{"x", 3}}), quint64(3));
+
+		QJsonArray changes;
+		QVERIFY(feed.changesSince(1, changes));
+		QCOMPARE(changes.size(), 2);
+		QCOMPARE(changes[0].toObject()["seq"].toInt(), 2);
+		QCOMPARE(changes[0].toObject()["type"].toString(), QString("b"));
+		QCOMPARE(changes[1].toObject()["data"].toObject()["x"].toInt(), 3);
+
+		changes = QJsonArray();
+		QVERIFY(feed.changesSince(3, changes));
+		QVERIFY(changes.isEmpty());
+	}
+
+	void testDropped()
+	{
+		ChangeFeed feed(2);
+		feed.append("a", {});
+		feed.append("b", {});
+		feed.append("c", {});
+
+		QJsonArray changes;
+		QVERIFY(!feed.changesSince(0, changes));
+		QVERIFY(changes.isEmpty());
+		QVERIFY(feed.changesSince(1, changes));
+		QCOMPARE(changes.size(), 2);
+
+		QJsonObject json = feed.toJson(0);
+		QCOMPARE(json["seq"].toInt(), 3);
+		QCOMPARE(json["resync"].toBool(), true);
+		QVERIFY(json["changes"].toArray().isEmpty());
+
+		json = feed.toJson(10);
+		QCOMPARE(json["resync"].toBool(), true);
+	}
+};
+
+QTEST_MAIN(TestChangeFeed)
+#include "changefeed.moc"
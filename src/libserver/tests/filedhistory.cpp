@@ -366,6 +366,50 @@ private slots:
 		}
 	}
 
+	// The block index written on unload should be picked up again and
+	// rejected if it doesn't check out
+	void testBlockIndex()
+	{
+		QString file = makeTestRecording();
+		QString indexFile = m_dir.absoluteFilePath(file);
+		indexFile.replace(".session", ".blockindex");
+		QVERIFY(QFile::exists(indexFile));
+
+		auto testMsg =
+			net::makeChatMessage(1, 0, 0, QStringLiteral("appended"));
+		{
+			std::unique_ptr<FiledHistory> fh{
+				FiledHistory::load(m_dir.absoluteFilePath(file), nullptr)};
+			QVERIFY(fh.get());
+			QCOMPARE(fh->lastIndex(), 2);
+			fh->addMessage(testMsg);
+		}
+
+		// Corrupt the index, loading should fall back to scanning
+		QFile f(indexFile);
+		QVERIFY(f.open(QIODevice::ReadWrite));
+		QByteArray content = f.readAll();
+		content.replace("BLOCK ", "BLOCK 1");
+		QVERIFY(f.resize(0));
+		QVERIFY(f.seek(0));
+		QCOMPARE(f.write(content), qint64(content.size()));
+		f.close();
+
+		std::unique_ptr<FiledHistory> fh{
+			FiledHistory::load(m_dir.absoluteFilePath(file), nullptr)};
+		QVERIFY(fh.get());
+
+		net::MessageList msgs;
+		int lastIdx;
+		std::tie(msgs, lastIdx) = fh->getBatch(-1);
+		QCOMPARE(msgs.size(), 4);
+		QCOMPARE(lastIdx, 3);
+		QVERIFY(msgs.last().equals(testMsg));
+
+		fh->terminate();
+		QVERIFY(!QFile::exists(indexFile));
+	}
+
 private:
 	// Generate a test recording containing three messages.
 	QString makeTestRecording()
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libserver/ipprefixtree.h"
+
+#include <QtTest/QtTest>
+#include <algorithm>
+
+using server::IpPrefixTree;
+
+class TestIpPrefixTree final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testPrefix()
+	{
+		IpPrefixTree tree;
+		QVERIFY(tree.isEmpty());
+		tree.insertPrefix(addr("::ffff:10.0.0.0"), 96 + 8, 1);
+		tree.insertPrefix(addr("::ffff:10.1.2.3"), 128, 2);
+		tree.insertPrefix(addr("2001:db8::"), 32, 3);
+		QVERIFY(!tree.isEmpty());
+
+		QCOMPARE(lookup(tree, "10.1.2.3"), QVector<int>({1, 2}));
+		QCOMPARE(lookup(tree, "::ffff:10.1.2.3"), QVector<int>({1, 2}));
+		QCOMPARE(lookup(tree, "10.200.0.1"), QVector<int>({1}));
+		QCOMPARE(lookup(tree, "11.0.0.1"), QVector<int>());
+		QCOMPARE(lookup(tree, "2001:db8:ffff::1"), QVector<int>({3}));
+		QCOMPARE(lookup(tree, "2001:db9::1"), QVector<int>());
+	}
+
+	void testRange()
+	{
+		IpPrefixTree tree;
+		tree.insertRange(addr("192.168.0.10"), addr("192.168.1.20"), 1);
+		tree.insertRange(addr("::"), addr("ffff:ffff:ffff:ffff::"), 2);
+		tree.insertRange(addr("1.0.0.5"), addr("1.0.0.4"), 3);
+
+		QCOMPARE(lookup(tree, "192.168.0.9"), QVector<int>());
+		QCOMPARE(lookup(tree, "192.168.0.10"), QVector<int>({1}));
+		QCOMPARE(lookup(tree, "192.168.0.255"), QVector<int>({1}));
+		QCOMPARE(lookup(tree, "192.168.1.20"), QVector<int>({1}));
+		QCOMPARE(lookup(tree, "192.168.1.21"), QVector<int>());
+		QCOMPARE(lookup(tree, "ffff:ffff:ffff:ffff::"), QVector<int>({2}));
+		QCOMPARE(lookup(tree, "ffff:ffff:ffff:ffff::1"), QVector<int>());
+		QCOMPARE(lookup(tree, "1.0.0.4"), QVector<int>());
+		QCOMPARE(lookup(tree, "1.0.0.5"), QVector<int>());
+	}
+
+	void testFullRange()
+	{
+		IpPrefixTree tree;
+		tree.insertRange(
+			addr("::"), addr("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff"), 1);
+		QCOMPARE(lookup(tree, "::"), QVector<int>({1}));
+		QCOMPARE(lookup(tree, "8.8.8.8"), QVector<int>({1}));
+		QCOMPARE(
+			lookup(tree, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff"),
+			QVector<int>({1}));
+	}
+
+private:
+	static Q_IPV6ADDR addr(const char *s)
+	{
+		return IpPrefixTree::normalize(QHostAddress(QString::fromUtf8(s)));
+	}
+
+	static QVector<int> lookup(const IpPrefixTree &tree, const char *s)
+	{
+		QVector<int> values;
+		tree.lookup(addr(s), values);
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+		return values;
+	}
+};
+
+QTEST_MAIN(TestIpPrefixTree)
+#include "ipprefixtree.moc"
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libserver/metrics.h"
+
+#include <QtTest/QtTest>
+
+using server::MetricsHistogram;
+using server::MetricsWriter;
+
+class TestMetrics final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testSample()
+	{
+		MetricsWriter w;
+		w.declare("test_total", "counter", "A test counter.");
+		w.sample("test_total", 3.0);
+		w.sample("test_total", "name", QStringLiteral("a\"b\\c"), 4.0);
+		QCOMPARE(
+			w.text(),
+			QByteArray("# HELP test_total A test counter.\n"
+					   "# TYPE test_total counter\n"
+					   "test_total 3\n"
+					   "test_total{name=\"a\\\"b\\\\c\"} 4\n"));
+	}
+
+	void testHistogram()
+	{
+		MetricsHistogram h;
+		h.observe(5000LL);
+		h.observe(2000000LL);
+		h.observe(60000000000LL);
+		QCOMPARE(h.count(), quint64(3));
+
+		MetricsWriter w;
+		w.histogram("test_seconds", MetricsWriter::label("x", "y"), h);
+		QList<QByteArray> lines = w.text().split('\n');
+		QCOMPARE(
+			lines.first(),
+			QByteArray("test_seconds_bucket{x=\"y\",le=\"1e-05\"} 1"));
+		QVERIFY(lines.contains("test_seconds_bucket{x=\"y\",le=\"0.001\"} 1"));
+		QVERIFY(lines.contains("test_seconds_bucket{x=\"y\",le=\"0.0025\"} 2"));
+		QVERIFY(lines.contains("test_seconds_bucket{x=\"y\",le=\"10\"} 2"));
+		QVERIFY(lines.contains("test_seconds_bucket{x=\"y\",le=\"+Inf\"} 3"));
+		QVERIFY(lines.contains("test_seconds_count{x=\"y\"} 3"));
+	}
+};
+
+
+QTEST_MAIN(TestMetrics)
+#include "metrics.moc"
@@ -1,10 +1,26 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/binary.h>
+}
 #include "libserver/thinserverclient.h"
 #include "libserver/thinsession.h"
 #include "libshared/net/messagequeue.h"
 
 namespace server {
 
+static void
+addFramedRelayStats(MessageStats &stats, const char *data, size_t length)
+{
+	const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+	size_t pos = 0;
+	while(length - pos >= DP_MESSAGE_HEADER_LENGTH) {
+		size_t messageLength =
+			DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(bytes + pos);
+		stats.add(bytes[pos + 2], messageLength);
+		pos += qMin(messageLength, length - pos);
+	}
+}
+
 ThinServerClient::ThinServerClient(
 	QTcpSocket *socket, ServerLog *logger, QObject *parent)
 	: Client(socket, logger, false, parent)
@@ -31,25 +47,124 @@ ThinServerClient::~ThinServerClient()
 
 void ThinServerClient::sendNextHistoryBatch()
 {
-	ThinSession *s = static_cast<ThinSession *>(session());
-	net::MessageQueue *mq = messageQueue();
-	// Only enqueue messages for uploading when upload queue is empty
-	// and session is in a normal running state.
-	// (We'll get another messagesAvailable signal when ready)
-	if(s && !mq->isUploading() && s->state() == Session::State::Running) {
+	if(canSendHistoryBatch()) {
+		ThinSession *s = static_cast<ThinSession *>(session());
 		// There may be a streamed reset pending, waiting for clients to catch
 		// up far enough. If the streamed reset is applies, it will change the
 		// history position of all clients, so don't touch it before this point!
 		s->resolvePendingStreamedReset(QStringLiteral("batch"));
 
-		net::MessageList batch;
+		// Clients that are far behind get their history in rate-limited slices
+		// on the session's catch-up tick, so they don't crowd out live relay.
+		if(s->catchupBytesPerTick() > 0 &&
+		   s->history()->lastIndex() - m_historyPosition >
+			   CATCHUP_LAG_MESSAGES) {
+			m_catchingUp = true;
+			s->scheduleCatchup(this);
+		} else {
+			m_catchingUp = false;
+			sendHistoryBatch();
+		}
+	}
+}
+
+void ThinServerClient::sendCatchupBatch(qint64 bytesPerTick)
+{
+	ThinSession *s = static_cast<ThinSession *>(session());
+	m_catchupCredit = qMin(m_catchupCredit + bytesPerTick, bytesPerTick);
+	if(m_catchupCredit <= 0) {
+		// Still paying off an oversized batch, try again next tick.
+		if(s) {
+			s->scheduleCatchup(this);
+		}
+	} else if(canSendHistoryBatch()) {
+		s->resolvePendingStreamedReset(QStringLiteral("catchup"));
+		m_catchupCredit -= qint64(sendHistoryBatch());
+	}
+}
+
+QJsonObject ThinServerClient::description(bool includeSession) const
+{
+	QJsonObject u = Client::description(includeSession);
+	QJsonObject queue = {
+		{QStringLiteral("uploadBytes"), uploadQueueBytes()},
+		{QStringLiteral("catchingUp"), m_catchingUp},
+		{QStringLiteral("catchupCredit"), double(m_catchupCredit)},
+	};
+	long long lag = historyLag();
+	if(lag >= 0LL) {
+		queue[QStringLiteral("historyLag")] = double(lag);
+	}
+	u[QStringLiteral("queue")] = queue;
+	return u;
+}
+
+int ThinServerClient::uploadQueueBytes() const
+{
+	return messageQueue()->uploadQueueBytes();
+}
+
+long long ThinServerClient::historyLag() const
+{
+	const Session *s = session();
+	if(s && m_historyPosition >= 0LL) {
+		return qMax(0LL, s->history()->lastIndex() - m_historyPosition);
+	} else {
+		return -1LL;
+	}
+}
+
+bool ThinServerClient::canSendHistoryBatch() const
+{
+	// Only enqueue messages for uploading when upload queue is empty
+	// and session is in a normal running state.
+	// (We'll get another messagesAvailable signal when ready)
+	const Session *s = session();
+	return s && !messageQueue()->isUploading() &&
+		   s->state() == Session::State::Running;
+}
+
+size_t ThinServerClient::sendHistoryBatch()
+{
+	ThinSession *s = static_cast<ThinSession *>(session());
+	net::MessageQueue *mq = messageQueue();
+	size_t sentBytes = 0;
+
+	// Blocks that are only on disk go out as they were recorded, without
+	// turning them into messages first, if the connection allows it.
+	long long framedLast;
+	bool framed = s->history()->getFramedBatch(
+		m_historyPosition,
+		[&](const char *data, size_t length) {
+			if(mq->sendFramed(data, length)) {
+				addFramedRelayStats(s->messageStats().relay, data, length);
+				sentBytes += length;
+				return true;
+			} else {
+				return false;
+			}
+		},
+		framedLast);
+
+	if(framed) {
+		m_historyPosition = framedLast;
+	} else {
+		HistoryBatch batch;
 		long long batchLast;
-		std::tie(batch, batchLast) = s->history()->getBatch(m_historyPosition);
+		std::tie(batch, batchLast) =
+			s->history()->getBatchNonBlocking(m_historyPosition);
 		m_historyPosition = batchLast;
 		mq->sendMultiple(batch.size(), batch.constData());
 
-		s->cleanupHistoryCache();
+		MessageStats &relayStats = s->messageStats().relay;
+		for(const net::Message &msg : batch) {
+			relayStats.add(msg);
+			sentBytes += msg.length();
+		}
 	}
+
+	s->cleanupHistoryCache();
+	return sentBytes;
 }
 
 void ThinServerClient::connectSendNextHistoryBatch()
@@ -31,6 +31,27 @@ public:
 
 	void addToHistoryPosition(long long offset) { m_historyPosition += offset; }
 
+	//! Whether any history has been sent, otherwise it starts from the top.
+	bool hasReceivedHistory() const { return m_historyPosition >= 0LL; }
+
+	/**
+	 * @brief Send a catch-up batch, called by the session on each tick
+	 *
+	 * Catch-up traffic is limited by a per-client byte budget that refills on
+	 * every tick. A batch is only sent while there's budget left, but it may
+	 * overdraw it, in which case the following ticks pay it off.
+	 */
+	void sendCatchupBatch(qint64 bytesPerTick);
+
+	//! Messages this client is behind on, or -1 if it's not in a session.
+	long long historyLag() const;
+
+	bool isCatchingUp() const { return m_catchingUp; }
+
+	int uploadQueueBytes() const;
+
+	QJsonObject description(bool includeSession = true) const override;
+
 signals:
 	void thinServerClientDestroyed(ThinServerClient *thisClient);
 
@@ -38,9 +59,16 @@ public slots:
 	void sendNextHistoryBatch();
 
 private:
+	// Clients further behind than this many messages are catching up.
+	static constexpr long long CATCHUP_LAG_MESSAGES = 100;
+
 	void connectSendNextHistoryBatch();
+	bool canSendHistoryBatch() const;
+	size_t sendHistoryBatch();
 
 	long long m_historyPosition;
+	qint64 m_catchupCredit = 0;
+	bool m_catchingUp = false;
 };
 
 }
@@ -2,11 +2,18 @@
 #include "libserver/thinsession.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
+#include "libserver/sessioncanvas.h"
 #include "libserver/thinserverclient.h"
 #include "libshared/net/message.h"
 #include "libshared/net/servercmd.h"
+#include "libshared/util/functionrunnable.h"
+#include <QCoreApplication>
+#include <QPointer>
 #include <QRandomGenerator>
+#include <QThreadPool>
 #include <QTimer>
+#include <algorithm>
+#include <limits>
 
 namespace server {
 
@@ -15,12 +22,18 @@ ThinSession::ThinSession(
 	sessionlisting::Announcements *announcements, QObject *parent)
 	: Session(history, config, announcements, parent)
 	, m_autoResetTimer(new QTimer(this))
+	, m_catchupTimer(new QTimer(this))
 {
 	history->setBaseSizeLimit(config->getConfigSize(config::SessionSizeLimit));
 	history->setAutoResetThreshold(
 		config->getConfigSize(config::AutoresetThreshold));
 	history->setMinimumAutoResetThreshold(
 		config->getConfigSize(config::MinimumAutoresetThreshold));
+	history->setRecordingCommitPolicy(
+		config->getConfigTime(config::RecordingCommitInterval),
+		config->getConfigSize(config::RecordingCommitSize));
+	history->setBlockCompression(
+		config->getConfigBool(config::HistoryCompression));
 	sendUpdatedSessionProperties();
 	resetLastStatusUpdate();
 	m_autoResetTimer->setTimerType(Qt::VeryCoarseTimer);
@@ -29,6 +42,24 @@ ThinSession::ThinSession(
 	connect(
 		m_autoResetTimer, &QTimer::timeout, this,
 		&ThinSession::triggerAutoReset);
+	m_catchupTimer->setInterval(CATCHUP_TICK_MSECS);
+	m_catchupTimer->setSingleShot(true);
+	connect(
+		m_catchupTimer, &QTimer::timeout, this,
+		&ThinSession::sendCatchupBatches);
+	connect(
+		config, &ServerConfig::configValueChanged, this,
+		[this](const ConfigKey &key) {
+			if(key.index == config::ServerCanvas.index) {
+				updateServerCanvas();
+			}
+		});
+	updateServerCanvas();
+}
+
+ThinSession::~ThinSession()
+{
+	delete m_canvas;
 }
 
 void ThinSession::addToHistory(const net::Message &msg)
@@ -46,6 +77,10 @@ void ThinSession::addToHistory(const net::Message &msg)
 		// like that, so it's not worth putting immense effort into handling it.
 		net::Message em = msg.asEmergencyMessage();
 		if(!em.isNull() && history()->addEmergencyMessage(em)) {
+			messageStats().history.add(em);
+			if(m_canvas) {
+				m_canvas->handleMessage(em);
+			}
 			addedToHistory(em);
 		} else if(msg.isServerMeta()) {
 			directToAll(msg);
@@ -77,6 +112,10 @@ void ThinSession::addToHistory(const net::Message &msg)
 		}
 	}
 
+	messageStats().history.add(msg);
+	if(m_canvas) {
+		m_canvas->handleMessage(msg);
+	}
 	addedToHistory(msg);
 	checkAutoResetQuery();
 
@@ -97,6 +136,56 @@ void ThinSession::cleanupHistoryCache()
 	history()->cleanupBatches(minIdx);
 }
 
+void ThinSession::scheduleCatchup(ThinServerClient *client)
+{
+	if(!m_catchupClients.contains(client)) {
+		m_catchupClients.append(client);
+	}
+	if(!m_catchupTimer->isActive()) {
+		m_catchupTimer->start();
+	}
+}
+
+qint64 ThinSession::catchupBytesPerTick() const
+{
+	qint64 bytesPerSecond =
+		qint64(config()->getConfigSize(config::CatchupRate));
+	return bytesPerSecond <= 0
+			   ? 0
+			   : qMax(bytesPerSecond * CATCHUP_TICK_MSECS / 1000, qint64(1));
+}
+
+void ThinSession::sendCatchupBatches()
+{
+	// Every waiting client gets one turn per tick, in the order they queued
+	// up. Those that still have catching up to do queue up again once their
+	// batch is sent, which puts them at the back of the line. Clients that
+	// report falling behind on rendering go last and get a smaller budget,
+	// sending them more just piles up in their paint engine anyway.
+	QVector<QPointer<ThinServerClient>> catchupClients;
+	catchupClients.swap(m_catchupClients);
+	std::stable_sort(
+		catchupClients.begin(), catchupClients.end(),
+		[](const QPointer<ThinServerClient> &a,
+		   const QPointer<ThinServerClient> &b) {
+			return (a ? a->renderBacklog() : 0) < (b ? b->renderBacklog() : 0);
+		});
+	qint64 bytesPerTick = catchupBytesPerTick();
+	for(const QPointer<ThinServerClient> &tsc : catchupClients) {
+		if(tsc && tsc->session() == this) {
+			if(bytesPerTick > 0) {
+				qint64 backlog = tsc->renderBacklog();
+				tsc->sendCatchupBatch(qMax(
+					bytesPerTick * CATCHUP_BACKLOG_THRESHOLD /
+						(CATCHUP_BACKLOG_THRESHOLD + backlog),
+					qint64(1)));
+			} else {
+				tsc->sendNextHistoryBatch();
+			}
+		}
+	}
+}
+
 QJsonObject ThinSession::getDescription(bool full, bool invite) const
 {
 	QJsonObject o = Session::getDescription(full, invite);
@@ -139,6 +228,7 @@ QJsonObject ThinSession::getDescription(bool full, bool invite) const
 			{QStringLiteral("historyFirstIndex"), double(hist->firstIndex())},
 			{QStringLiteral("historyLastIndex"), double(hist->lastIndex())},
 			{QStringLiteral("requestStatus"), autoresetRequestStatus},
+			{QStringLiteral("serverCanvas"), m_canvas != nullptr},
 			{QStringLiteral("sessionState"), sessionState},
 			{QStringLiteral("stream"), hist->getStreamedResetDescription()},
 		});
@@ -148,6 +238,8 @@ QJsonObject ThinSession::getDescription(bool full, bool invite) const
 		}
 
 		o[QStringLiteral("autoreset")] = a;
+		o[QStringLiteral("catchupQueue")] = m_catchupClients.size();
+		o[QStringLiteral("hibernating")] = m_hibernating;
 	}
 	return o;
 }
@@ -313,6 +405,9 @@ ThinSession::handleStreamResetStart(int ctxId, const QString &correlator)
 	QString error;
 	switch(result) {
 	case StreamResetStartResult::Ok:
+		if(m_canvas) {
+			m_canvas->softReset();
+		}
 		c->setResetFlags(
 			result == StreamResetStartResult::Ok ? Client::ResetFlag::Streaming
 												 : Client::ResetFlag::None);
@@ -517,12 +612,17 @@ void ThinSession::resolvePendingStreamedReset(const QString &cause)
 									prevAutoResetThresholdBase),
 								locale.formattedDataSize(
 									hist->autoResetThresholdBase()))));
+			// Clients that haven't gotten any history yet just start at the
+			// top of the new one, instead of downloading the old one first.
 			for(Client *c : clients()) {
 				ThinServerClient *tsc = static_cast<ThinServerClient *>(c);
-				tsc->addToHistoryPosition(offset);
+				if(tsc->hasReceivedHistory()) {
+					tsc->addToHistoryPosition(offset);
+				}
 			}
 			clearAutoReset();
 			sendStatusUpdate(false);
+			emit historyReset(this);
 			sendUpdatedSessionProperties();
 		} else {
 			log(Log()
@@ -544,6 +644,9 @@ void ThinSession::onSessionInitialized()
 void ThinSession::onSessionReset()
 {
 	clearAutoReset();
+	if(m_canvas) {
+		m_canvas->rebuild(history());
+	}
 	directToAll(
 		net::ServerReply::makeCatchup(
 			history()->lastIndex() - history()->firstIndex(), 0));
@@ -554,6 +657,7 @@ void ThinSession::onSessionReset()
 
 void ThinSession::onClientJoin(Client *client, bool host, long long historyPos)
 {
+	wakeUp();
 	ThinServerClient *tsc = static_cast<ThinServerClient *>(client);
 	if(!host && historyPos > 0LL) {
 		tsc->log(
@@ -687,6 +791,98 @@ void ThinSession::onStateChanged()
 	clearAutoReset();
 }
 
+JsonApiResult ThinSession::createServerThumbnail(const QJsonObject &request)
+{
+#ifdef HAVE_SERVER_THUMBNAILS
+	if(!m_canvas) {
+		return JsonApiErrorResult(
+			JsonApiResult::BadRequest,
+			QStringLiteral("Session has no server canvas"));
+	}
+
+	int maxWidth = parseRequestInt(request, QStringLiteral("maxWidth"), 0, -1);
+	int maxHeight =
+		parseRequestInt(request, QStringLiteral("maxHeight"), 0, -1);
+	int quality = parseRequestInt(request, QStringLiteral("quality"), 0, -1);
+	if(maxWidth < 0 || maxHeight < 0 || quality < 0) {
+		return JsonApiErrorResult(
+			JsonApiResult::BadRequest,
+			QStringLiteral("maxWidth, maxHeight and quality must be numbers"));
+	}
+
+	SessionThumbnailer::Params params =
+		SessionThumbnailer::makeParams(maxWidth, maxHeight, quality);
+	if(!SessionThumbnailer::parseFormat(
+		   request.value(QStringLiteral("format")).toString(),
+		   params.format)) {
+		return JsonApiErrorResult(
+			JsonApiResult::BadRequest,
+			QStringLiteral("Unknown thumbnail format"));
+	}
+
+	SessionHistory *hist = history();
+	long long index = hist->lastIndex();
+	if(hist->hasThumbnail() && index == m_serverThumbnailIndex &&
+	   params == m_serverThumbnailParams) {
+		return JsonApiResult{
+			JsonApiResult::Ok,
+			QJsonDocument(QJsonObject{
+				{QStringLiteral("status"), QStringLiteral("cached")}})};
+	}
+
+	if(m_serverThumbnailPending) {
+		return JsonApiErrorResult(
+			JsonApiResult::Conflict,
+			QStringLiteral("Server is already generating a thumbnail"));
+	}
+
+	m_serverThumbnailPending = true;
+	QPointer<ThinSession> self(this);
+	SessionThumbnailer::generateDec(
+		m_canvas->canvasStateInc(), params,
+		[self, index, params](const QByteArray &data, const QString &error) {
+			if(self) {
+				self->finishServerThumbnail(index, params, data, error);
+			}
+		});
+	log(Log()
+			.about(Log::Level::Info, Log::Topic::Status)
+			.message(QStringLiteral("Server thumbnail generation started")));
+	return JsonApiResult{
+		JsonApiResult::Accepted,
+		QJsonDocument(QJsonObject{
+			{QStringLiteral("status"), QStringLiteral("started")}})};
+#else
+	return Session::createServerThumbnail(request);
+#endif
+}
+
+#ifdef HAVE_SERVER_THUMBNAILS
+void ThinSession::finishServerThumbnail(
+	long long index, const SessionThumbnailer::Params &params,
+	const QByteArray &data, const QString &error)
+{
+	m_serverThumbnailPending = false;
+	if(data.isEmpty()) {
+		log(Log()
+				.about(Log::Level::Warn, Log::Topic::Status)
+				.message(
+					QStringLiteral("Server thumbnail generation failed: %1")
+						.arg(error)));
+	} else if(!history()->setThumbnail(data)) {
+		log(Log()
+				.about(Log::Level::Warn, Log::Topic::Status)
+				.message(QStringLiteral("Server thumbnail write error")));
+	} else {
+		m_serverThumbnailIndex = index;
+		m_serverThumbnailParams = params;
+		log(Log()
+				.about(Log::Level::Info, Log::Topic::Status)
+				.message(QStringLiteral("Server thumbnail set")));
+	}
+}
+#endif
+
 void ThinSession::sendStatusUpdate(bool forceHistoryIndex)
 {
 	SessionHistory *hist = history();
@@ -695,6 +891,7 @@ void ThinSession::sendStatusUpdate(bool forceHistoryIndex)
 			int(hist->sizeInBytes()),
 			getHistoryIndex(forceHistoryIndex, true)));
 	resetLastStatusUpdate();
+	emit historySizeChanged(this);
 }
 
 void ThinSession::checkAutoResetQuery()
@@ -724,6 +921,12 @@ void ThinSession::checkAutoResetQuery()
 						history()->autoResetThreshold()))
 					.arg(locale.formattedDataSize(autoResetThreshold))));
 
+	// With a canvas of our own, we can build the reset image ourselves.
+	if(m_canvas && autoResetThreshold > 0) {
+		startServerCanvasAutoReset();
+		return;
+	}
+
 	// Legacy alert for Drawpile 2.0.x versions
 	directToAll(
 		net::ServerReply::makeSizeLimitWarning(
@@ -752,6 +955,160 @@ void ThinSession::checkAutoResetQuery()
 	m_autoResetTimer->start(AUTORESET_RESPONSE_DELAY_MSECS);
 }
 
+void ThinSession::startServerCanvasAutoReset()
+{
+	// The payload is only used to tell apart server-side autoresets, no client
+	// knows it, so none of them will consider the streamed reset theirs.
+	m_autoResetPayload = generateAutoResetPayload();
+	SessionHistory *hist = history();
+	StreamResetStartResult result = hist->startStreamedReset(
+		0, m_autoResetPayload, serverSideStateMessages());
+	if(result != StreamResetStartResult::Ok) {
+		log(Log()
+				.about(Log::Level::Warn, Log::Topic::Status)
+				.message(QStringLiteral("Server canvas autoreset could not "
+										"start streamed reset, error %1")
+							 .arg(int(result))));
+		clearAutoReset(AUTORESET_FAILURE_RETRY_MSECS);
+		return;
+	}
+
+	m_canvas->softReset();
+	m_autoResetRequestStatus = AutoResetState::Requested;
+	log(Log()
+			.about(Log::Level::Info, Log::Topic::Status)
+			.message(QStringLiteral("Building server canvas reset image (fork "
+									"pos %1, stream pos %2)")
+						 .arg(hist->resetStreamForkPos())
+						 .arg(hist->resetStreamHeaderPos())));
+
+	// Compressing the layers takes a while on large canvases, so that's done
+	// in the background. The canvas state is immutable, so that's fine.
+	net::MessageList head = m_canvas->resetImageHead();
+	net::MessageList tail = m_canvas->resetImageTail();
+	DP_CanvasState *cs = m_canvas->canvasStateInc();
+	QString payload = m_autoResetPayload;
+	QPointer<ThinSession> self(this);
+	utils::FunctionRunnable *runnable =
+		new utils::FunctionRunnable([=]() {
+			net::MessageList image = head;
+			SessionCanvas::appendResetImageDec(image, cs);
+			image.append(tail);
+			// The application object outlives us, the pointer to this
+			// session may only be checked on the main thread.
+			QMetaObject::invokeMethod(
+				QCoreApplication::instance(),
+				[self, payload, image]() {
+					if(self) {
+						self->finishServerCanvasAutoReset(payload, image);
+					}
+				},
+				Qt::QueuedConnection);
+		});
+	QThreadPool::globalInstance()->start(runnable);
+}
+
+void ThinSession::finishServerCanvasAutoReset(
+	const QString &payload, const net::MessageList &image)
+{
+	// The reset may have been cleared in the meantime, e.g. by a hard reset.
+	if(m_autoResetRequestStatus != AutoResetState::Requested ||
+	   payload != m_autoResetPayload) {
+		log(Log()
+				.about(Log::Level::Debug, Log::Topic::Status)
+				.message(QStringLiteral(
+					"Discarding stale server canvas reset image")));
+		return;
+	}
+
+	SessionHistory *hist = history();
+	for(const net::Message &msg : image) {
+		StreamResetAddResult result = hist->addStreamResetImageMessage(0, msg);
+		if(result != StreamResetAddResult::Ok) {
+			log(Log()
+					.about(Log::Level::Warn, Log::Topic::Status)
+					.message(QStringLiteral("Server canvas autoreset could "
+											"not add %1 message, error %2")
+								 .arg(msg.typeName())
+								 .arg(int(result))));
+			clearAutoReset(AUTORESET_FAILURE_RETRY_MSECS);
+			return;
+		}
+	}
+
+	StreamResetPrepareResult result =
+		hist->prepareStreamedReset(0, int(image.size()));
+	if(result != StreamResetPrepareResult::Ok) {
+		log(Log()
+				.about(Log::Level::Warn, Log::Topic::Status)
+				.message(QStringLiteral("Server canvas autoreset could not "
+										"prepare streamed reset, error %1")
+							 .arg(int(result))));
+		clearAutoReset(AUTORESET_FAILURE_RETRY_MSECS);
+		return;
+	}
+
+	log(Log()
+			.about(Log::Level::Info, Log::Topic::Status)
+			.message(QStringLiteral("Prepared server canvas reset image with "
+									"%1 messages")
+						 .arg(image.size())));
+	resolvePendingStreamedReset(QStringLiteral("server canvas"));
+}
+
+void ThinSession::updateServerCanvas()
+{
+	// Compatibility sessions speak an older protocol that the paint engine
+	// would have to translate, so those are always left to the clients.
+	bool enabled = config()->getConfigBool(config::ServerCanvas) &&
+				   history()->protocolVersion().isCurrent() && !m_hibernating;
+	if(enabled && !m_canvas) {
+		m_canvas = new SessionCanvas;
+		m_canvas->rebuild(history());
+		log(Log()
+				.about(Log::Level::Info, Log::Topic::Status)
+				.message(QStringLiteral("Server canvas enabled")));
+	} else if(!enabled && m_canvas) {
+		// A server canvas autoreset in progress can't be finished anymore.
+		if(m_autoResetRequestStatus == AutoResetState::Requested) {
+			clearAutoReset();
+		}
+		delete m_canvas;
+		m_canvas = nullptr;
+		log(Log()
+				.about(Log::Level::Info, Log::Topic::Status)
+				.message(QStringLiteral("Server canvas disabled")));
+	}
+}
+
+void ThinSession::hibernate()
+{
+	if(m_hibernating || !clients().isEmpty()) {
+		return;
+	}
+
+	// The server canvas gets rebuilt from the history when someone joins, so
+	// it and the cached history blocks can go for now. Histories that live
+	// only in memory have nothing to release.
+	m_hibernating = true;
+	updateServerCanvas();
+	history()->cleanupBatches(std::numeric_limits<long long>::max());
+	log(Log()
+			.about(Log::Level::Debug, Log::Topic::Status)
+			.message(QStringLiteral("Hibernating")));
+}
+
+void ThinSession::wakeUp()
+{
+	if(m_hibernating) {
+		m_hibernating = false;
+		log(Log()
+				.about(Log::Level::Debug, Log::Topic::Status)
+				.message(QStringLiteral("Waking up from hibernation")));
+		updateServerCanvas();
+	}
+}
+
 QString ThinSession::generateAutoResetPayload()
 {
 	static uint32_t autoResetIndex;
@@ -933,9 +1290,12 @@ bool ThinSession::checkStreamedResetStart(const QString &cause)
 
 	long long resetStreamStartIndex = hist->resetStreamStartIndex();
 	for(Client *c : clients()) {
+		// Clients that just joined and haven't received anything don't hold up
+		// the reset, they get served the new history once it's in place.
 		ThinServerClient *tsc = static_cast<ThinServerClient *>(c);
 		long long historyPosition = tsc->historyPosition();
-		if(historyPosition < resetStreamStartIndex) {
+		if(tsc->hasReceivedHistory() &&
+		   historyPosition < resetStreamStartIndex) {
 			if(m_lastAutoResetWarning.hasExpired()) {
 				m_lastAutoResetWarning.setRemainingTime(
 					AUTORESET_RESOLVE_LOG_MSECS);
@@ -948,7 +1308,7 @@ bool ThinSession::checkStreamedResetStart(const QString &cause)
 								.arg(
 									cause, QString::number(tsc->id()),
 									QString::number(historyPosition),
-									QString::number(historyPosition))));
+									QString::number(resetStreamStartIndex))));
 			}
 			return false;
 		}
@@ -2,12 +2,19 @@
 #ifndef DP_SERVER_THINSESSION_H
 #define DP_SERVER_THINSESSION_H
 #include "libserver/session.h"
+#ifdef HAVE_SERVER_THUMBNAILS
+#	include "libserver/sessionthumbnailer.h"
+#endif
 #include <QDeadlineTimer>
+#include <QPointer>
 
 class QTimer;
 
 namespace server {
 
+class SessionCanvas;
+class ThinServerClient;
+
 /**
  * The (thin) serverside session state.
  */
@@ -19,6 +26,8 @@ public:
 		sessionlisting::Announcements *announcements,
 		QObject *parent = nullptr);
 
+	~ThinSession() override;
+
 	void readyToAutoReset(
 		const AutoResetResponseParams &params, const QString &payload) override;
 
@@ -34,10 +43,20 @@ public:
 
 	void cleanupHistoryCache();
 
+	//! Queue a client that's catching up to be sent its next batch.
+	void scheduleCatchup(ThinServerClient *client);
+
+	//! Catch-up budget per client per tick, zero means unlimited.
+	qint64 catchupBytesPerTick() const;
+
 	bool supportsAutoReset() const override { return true; }
 	bool supportsSkipCatchup() const override { return true; }
+	bool supportsBacklogReports() const override { return true; }
 	bool supportsSizeLimit() const override { return true; }
 
+	void hibernate() override;
+	bool isHibernating() const override { return m_hibernating; }
+
 	QJsonObject
 	getDescription(bool full = false, bool invite = false) const override;
 
@@ -50,6 +69,7 @@ protected:
 	void onClientDeop(Client *client) override;
 	void onResetStream(Client &client, const net::Message &msg) override;
 	void onStateChanged() override;
+	JsonApiResult createServerThumbnail(const QJsonObject &request) override;
 
 private:
 	// Give up on autoreset requests after 3 minutes.
@@ -60,6 +80,10 @@ private:
 	static constexpr int AUTORESET_FAILURE_RETRY_MSECS = 30000;
 	// Don't spam reset failure logs, once every minute is enough.
 	static constexpr int AUTORESET_RESOLVE_LOG_MSECS = 60000;
+	// Clients catching up get a slice of history this often.
+	static constexpr int CATCHUP_TICK_MSECS = 10;
+	// A client this many messages behind on rendering gets half the budget.
+	static constexpr qint64 CATCHUP_BACKLOG_THRESHOLD = 1000;
 
 	enum class AutoResetState { NotSent, Queried, QueriedWaiting, Requested };
 
@@ -80,11 +104,24 @@ private:
 	void checkAutoResetQuery();
 	static QString generateAutoResetPayload();
 	void triggerAutoReset();
+	void startServerCanvasAutoReset();
+	void finishServerCanvasAutoReset(
+		const QString &payload, const net::MessageList &image);
+	void updateServerCanvas();
+	void wakeUp();
 	void invalidateAutoResetCandidate(int ctxId);
 	void clearAutoReset(int delay = 0);
 
 	bool checkStreamedResetStart(const QString &cause);
 
+	void sendCatchupBatches();
+
+#ifdef HAVE_SERVER_THUMBNAILS
+	void finishServerThumbnail(
+		long long index, const SessionThumbnailer::Params &params,
+		const QByteArray &data, const QString &error);
+#endif
+
 	QDeadlineTimer m_lastStatusUpdate;
 	QDeadlineTimer m_lastSizeWarning;
 	QDeadlineTimer m_autoResetDelay;
@@ -93,6 +130,17 @@ private:
 	QTimer *m_autoResetTimer;
 	QString m_autoResetPayload;
 	QVector<AutoResetCandidate> m_autoResetCandidates;
+	SessionCanvas *m_canvas = nullptr;
+	bool m_hibernating = false;
+	QTimer *m_catchupTimer;
+	QVector<QPointer<ThinServerClient>> m_catchupClients;
+#ifdef HAVE_SERVER_THUMBNAILS
+	// The last thumbnail rendered on the server is reused as long as nothing
+	// was added to the history since and it's asked for in the same way.
+	bool m_serverThumbnailPending = false;
+	long long m_serverThumbnailIndex = -1;
+	SessionThumbnailer::Params m_serverThumbnailParams = {};
+#endif
 };
 
 }
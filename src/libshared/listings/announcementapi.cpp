@@ -21,6 +21,11 @@ static void setCommonRequestParameters(QNetworkRequest &req) {
 	req.setHeader(QNetworkRequest::UserAgentHeader, USER_AGENT);
 #endif
 	req.setMaximumRedirectsAllowed(2);
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+	// Qt6 does this by default. Lets announcements, refreshes and unlistings
+	// to the same list server share a single connection where supported.
+	req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+#endif
 }
 
 static QString slashcat(QString s, const QString &s2)
@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libshared/net/localmessagequeue.h"
+#include "libshared/util/qtcompat.h"
+#include <QDebug>
+#include <QTimer>
+#include <limits>
+
+namespace net {
+
+LocalMessageQueue::LocalMessageQueue(bool decodeOpaque, QObject *parent)
+	: MessageQueue(decodeOpaque, parent)
+{
+}
+
+LocalMessageQueue::~LocalMessageQueue()
+{
+	// The other end notices that its peer is gone next time it delivers, but
+	// it may not have anything to deliver, so tell it to close in any case.
+	if(m_peer) {
+		QPointer<LocalMessageQueue> peer = m_peer;
+		QMetaObject::invokeMethod(
+			peer.data(),
+			[peer] {
+				if(peer) {
+					peer->closeInternal(false);
+				}
+			},
+			Qt::QueuedConnection);
+	}
+}
+
+void LocalMessageQueue::connectPair(LocalMessageQueue *a, LocalMessageQueue *b)
+{
+	Q_ASSERT(a);
+	Q_ASSERT(b);
+	Q_ASSERT(a != b);
+	Q_ASSERT(!a->m_peer);
+	Q_ASSERT(!b->m_peer);
+	a->m_peer = b;
+	b->m_peer = a;
+	a->setState(QAbstractSocket::ConnectedState);
+	b->setState(QAbstractSocket::ConnectedState);
+}
+
+void LocalMessageQueue::close()
+{
+	if(m_outbox.isEmpty()) {
+		closeInternal(true);
+	} else {
+		m_closeAfterDelivery = true;
+	}
+}
+
+void LocalMessageQueue::abort()
+{
+	closeInternal(true);
+}
+
+int LocalMessageQueue::uploadQueueBytes() const
+{
+	return int(qMin(m_outboxBytes, size_t(std::numeric_limits<int>::max())));
+}
+
+bool LocalMessageQueue::isUploading() const
+{
+	return !m_outbox.isEmpty();
+}
+
+void LocalMessageQueue::enqueueMessages(int count, const net::Message *msgs)
+{
+	if(m_state == QAbstractSocket::ConnectedState) {
+		for(int i = 0; i < count; ++i) {
+			const net::Message &msg = msgs[i];
+			if(!msg.isNull()) {
+				m_outbox.append(msg);
+				m_outboxBytes += msg.length();
+			}
+		}
+		scheduleDelivery();
+	}
+}
+
+void LocalMessageQueue::enqueuePing(bool pong)
+{
+	net::Message msg = net::makePingMessage(0, pong);
+	enqueueMessages(1, &msg);
+}
+
+QAbstractSocket::SocketState LocalMessageQueue::getSocketState()
+{
+	return m_state;
+}
+
+void LocalMessageQueue::abortSocket()
+{
+	abort();
+}
+
+void LocalMessageQueue::deliver()
+{
+	m_deliveryScheduled = false;
+	if(m_state != QAbstractSocket::ConnectedState) {
+		return;
+	}
+
+	if(!m_peer) {
+		qWarning("Local message queue peer vanished");
+		closeInternal(false);
+		return;
+	}
+
+	if(!m_outbox.isEmpty()) {
+		net::MessageList msgs;
+		msgs.swap(m_outbox);
+		size_t bytes = m_outboxBytes;
+		m_outboxBytes = 0;
+		m_peer->receiveLocal(msgs);
+		emit bytesSent(compat::cast_6<int>(bytes));
+	}
+
+	if(m_outbox.isEmpty()) {
+		emit allSent();
+		if(m_closeAfterDelivery ||
+		   (m_gracefullyDisconnecting && !m_quietDisconnecting)) {
+			qInfo("All sent, gracefully disconnecting.");
+			closeInternal(true);
+		}
+	}
+}
+
+void LocalMessageQueue::afterDisconnectSent()
+{
+	// Nothing to do, the connection is closed once the disconnect message has
+	// been delivered, same as a socket does when everything has been written.
+}
+
+void LocalMessageQueue::scheduleDelivery()
+{
+	if(!m_deliveryScheduled) {
+		m_deliveryScheduled = true;
+		QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+	}
+}
+
+void LocalMessageQueue::receiveLocal(const net::MessageList &msgs)
+{
+	// Ignore incoming messages while we're in the process of disconnecting.
+	if(m_state != QAbstractSocket::ConnectedState ||
+	   (m_gracefullyDisconnecting && !m_quietDisconnecting)) {
+		return;
+	}
+
+	bool gotmessages = false;
+	bool smoothFlush = false;
+	int disconnectReason = -1;
+	QString disconnectMessage;
+	size_t bytes = 0;
+
+	for(const net::Message &msg : msgs) {
+		bytes += msg.length();
+		int type = msg.type();
+		if(type == DP_MSG_PING) {
+			// Pings are handled internally
+			handlePing(DP_msg_ping_is_pong(DP_msg_ping_cast(msg.get())));
+
+		} else if(type == DP_MSG_KEEP_ALIVE) {
+			// Nothing to do, just keeps the connection alive.
+
+		} else if(type == DP_MSG_DISCONNECT) {
+			// Graceful disconnects are also handled internally
+			DP_MsgDisconnect *md = DP_msg_disconnect_cast(msg.get());
+			size_t messageLength;
+			const char *message =
+				DP_msg_disconnect_message(md, &messageLength);
+			smoothFlush = true;
+			disconnectReason = DP_msg_disconnect_reason(md);
+			disconnectMessage =
+				QString::fromUtf8(message, compat::castSize(messageLength));
+
+		} else if(m_gracefullyDisconnecting) {
+			// Just keep echoing everything that has a client effect.
+			if(type == MSG_TYPE_CHAT || type == MSG_TYPE_PRIVATE_CHAT ||
+			   type >= MSG_TYPE_CLIENT_META) {
+				enqueueMessages(1, &msg);
+			}
+
+		} else {
+			// The rest are normal messages
+			if(m_smoothTimer) {
+				// Undos already have a delay because they require a round
+				// trip, we don't want to make them even slower.
+				bool ownUndoReceived = m_contextId != 0 &&
+									   type == DP_MSG_UNDO &&
+									   msg.contextId() == m_contextId;
+				if(ownUndoReceived) {
+					smoothFlush = true;
+				}
+				m_smoothBuffer.append(msg);
+			} else {
+				m_inbox.append(msg);
+			}
+			gotmessages = true;
+		}
+	}
+
+	resetLastRecvTimer();
+	emit bytesReceived(compat::cast_6<int>(bytes));
+
+	if(gotmessages) {
+		if(m_smoothTimer) {
+			if(smoothFlush) {
+				m_inbox.append(m_smoothBuffer);
+				m_smoothBuffer.clear();
+				emit messageAvailable();
+				m_smoothTimer->stop();
+			} else {
+				m_smoothMessagesToDrain = smoothMessagesToDrainFromBuffer();
+				if(!m_smoothTimer->isActive()) {
+					receiveSmoothedMessages();
+				}
+			}
+		} else {
+			emit messageAvailable();
+		}
+	}
+
+	if(disconnectReason != -1) {
+		emit gracefulDisconnect(
+			GracefulDisconnect(disconnectReason), disconnectMessage);
+	}
+}
+
+void LocalMessageQueue::setState(QAbstractSocket::SocketState state)
+{
+	if(state != m_state) {
+		m_state = state;
+		emit stateChanged(state);
+	}
+}
+
+void LocalMessageQueue::closeInternal(bool notifyPeer)
+{
+	if(m_state == QAbstractSocket::UnconnectedState) {
+		return;
+	}
+
+	QPointer<LocalMessageQueue> peer = m_peer;
+	m_peer = nullptr;
+	m_outbox.clear();
+	m_outboxBytes = 0;
+	m_closeAfterDelivery = false;
+
+	// The other end gets to finish whatever it's doing first, like it would
+	// when the remote end of a socket closes it.
+	if(notifyPeer && peer) {
+		QMetaObject::invokeMethod(
+			peer.data(),
+			[peer] {
+				if(peer) {
+					peer->closeInternal(false);
+				}
+			},
+			Qt::QueuedConnection);
+	}
+
+	setState(QAbstractSocket::ClosingState);
+	setState(QAbstractSocket::UnconnectedState);
+	emit disconnected();
+}
+
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSHARED_NET_LOCALMESSAGEQUEUE_H
+#define LIBSHARED_NET_LOCALMESSAGEQUEUE_H
+#include "libshared/net/messagequeue.h"
+#include <QPointer>
+
+namespace net {
+
+/**
+ * @brief A message queue connected directly to another one in this process
+ *
+ * Messages are handed to the other end as they are, without serializing and
+ * deserializing them. This is used by the user hosting a session on the
+ * builtin server, whose client would otherwise talk to it over a loopback
+ * socket. Both ends must live on the same thread.
+ *
+ * Delivery is always queued, so neither end gets called back from within
+ * its own sending code, same as with a socket.
+ */
+class LocalMessageQueue final : public MessageQueue {
+	Q_OBJECT
+public:
+	explicit LocalMessageQueue(bool decodeOpaque, QObject *parent = nullptr);
+
+	~LocalMessageQueue() override;
+
+	/**
+	 * @brief Connect two unconnected queues to each other
+	 *
+	 * Both ends emit stateChanged with the connected state afterwards.
+	 */
+	static void connectPair(LocalMessageQueue *a, LocalMessageQueue *b);
+
+	QAbstractSocket::SocketState state() const { return m_state; }
+
+	//! Close the connection after everything queued has been delivered.
+	void close();
+
+	//! Close the connection right away, dropping anything still queued.
+	void abort();
+
+	int uploadQueueBytes() const override;
+	bool isUploading() const override;
+
+signals:
+	void stateChanged(QAbstractSocket::SocketState state);
+	void disconnected();
+
+protected:
+	void enqueueMessages(int count, const net::Message *msgs) override;
+	void enqueuePing(bool pong) override;
+
+	QAbstractSocket::SocketState getSocketState() override;
+	void abortSocket() override;
+
+private slots:
+	void deliver();
+
+private:
+	void afterDisconnectSent() override;
+
+	void scheduleDelivery();
+	void receiveLocal(const net::MessageList &msgs);
+	void setState(QAbstractSocket::SocketState state);
+	void closeInternal(bool notifyPeer);
+
+	QPointer<LocalMessageQueue> m_peer;
+	QAbstractSocket::SocketState m_state = QAbstractSocket::UnconnectedState;
+	net::MessageList m_outbox; // messages not yet handed to the peer
+	size_t m_outboxBytes = 0;
+	bool m_deliveryScheduled = false;
+	bool m_closeAfterDelivery = false;
+};
+
+}
+
+#endif
@@ -357,6 +357,49 @@ bool Message::serializeWsCompat(QByteArray &buffer) const
 			   m_data, false, getDeserializeBuffer, &buffer) != 0;
 }
 
+bool Message::serializeAppend(QByteArray &buffer) const
+{
+	int oldLength = buffer.length();
+	if(DP_message_serialize(m_data, true, getAppendBuffer, &buffer) != 0) {
+		return true;
+	} else {
+		buffer.truncate(oldLength);
+		return false;
+	}
+}
+
+bool Message::serializeAppendCompat(QByteArray &buffer) const
+{
+	int oldLength = buffer.length();
+	if(DP_message_serialize_compat(m_data, true, getAppendBuffer, &buffer) !=
+	   0) {
+		return true;
+	} else {
+		buffer.truncate(oldLength);
+		return false;
+	}
+}
+
+const unsigned char *Message::serialized(size_t &outLength) const
+{
+	return DP_message_serialized_noinc(m_data, true, &outLength);
+}
+
+const unsigned char *Message::serializedWs(size_t &outLength) const
+{
+	return DP_message_serialized_noinc(m_data, false, &outLength);
+}
+
+const unsigned char *Message::serializedCompat(size_t &outLength) const
+{
+	return DP_message_serialized_compat_noinc(m_data, true, &outLength);
+}
+
+const unsigned char *Message::serializedWsCompat(size_t &outLength) const
+{
+	return DP_message_serialized_compat_noinc(m_data, false, &outLength);
+}
+
 bool Message::shouldSmoothe() const
 {
 	switch(type()) {
@@ -419,6 +462,14 @@ unsigned char *Message::getDeserializeBuffer(void *user, size_t size)
 	return reinterpret_cast<unsigned char *>(buffer->data());
 }
 
+unsigned char *Message::getAppendBuffer(void *user, size_t size)
+{
+	QByteArray *buffer = static_cast<QByteArray *>(user);
+	int offset = buffer->length();
+	buffer->resize(offset + compat::castSize(size));
+	return reinterpret_cast<unsigned char *>(buffer->data()) + offset;
+}
+
 
 Message makeChatMessage(
 	uint8_t contextId, uint8_t tflags, uint8_t oflags, const QString &message)
@@ -97,6 +97,18 @@ public:
 	bool serializeCompat(QByteArray &buffer) const;
 	bool serializeWsCompat(QByteArray &buffer) const;
 
+	// Like serialize and serializeCompat, but append to the end of the buffer
+	// instead of replacing its contents. Used to batch messages for sending.
+	bool serializeAppend(QByteArray &buffer) const;
+	bool serializeAppendCompat(QByteArray &buffer) const;
+
+	// Messages that are already stored in wire format, which opaque ones are,
+	// can be sent directly from these. They return nullptr for other messages.
+	const unsigned char *serialized(size_t &outLength) const;
+	const unsigned char *serializedWs(size_t &outLength) const;
+	const unsigned char *serializedCompat(size_t &outLength) const;
+	const unsigned char *serializedWsCompat(size_t &outLength) const;
+
 	bool shouldSmoothe() const;
 
 	static void setUchars(size_t size, unsigned char *out, void *user);
@@ -109,6 +121,7 @@ private:
 	explicit Message(DP_Message *cs);
 
 	static unsigned char *getDeserializeBuffer(void *user, size_t size);
+	static unsigned char *getAppendBuffer(void *user, size_t size);
 
 	DP_Message *m_data;
 };
@@ -18,6 +18,7 @@ MessageQueue::MessageQueue(bool decodeOpaque, QObject *parent)
 	, m_smoothDrainRate(DEFAULT_SMOOTH_DRAIN_RATE)
 	, m_smoothTimer(nullptr)
 	, m_smoothMessagesToDrain(INT_MAX)
+	, m_smoothBacklog(0)
 	, m_contextId(0)
 	, m_pingTimer(nullptr)
 	, m_idleTimeout(0)
@@ -35,6 +36,28 @@ MessageQueue::MessageQueue(bool decodeOpaque, QObject *parent)
 	resetKeepAliveTimer();
 }
 
+bool MessageQueue::setStreamCompressionAllowed(bool allowed)
+{
+	Q_UNUSED(allowed);
+	return false;
+}
+
+bool MessageQueue::startStreamCompression()
+{
+	return false;
+}
+
+bool MessageQueue::setMessageBatchingAllowed(bool allowed)
+{
+	Q_UNUSED(allowed);
+	return false;
+}
+
+bool MessageQueue::startMessageBatching()
+{
+	return false;
+}
+
 void MessageQueue::setIdleTimeout(qint64 timeout)
 {
 	m_idleTimeout = timeout;
@@ -76,6 +99,25 @@ void MessageQueue::setSmoothDrainRate(int smoothDrainRate)
 	updateSmoothing();
 }
 
+void MessageQueue::setSmoothBacklog(int smoothBacklog)
+{
+	m_smoothBacklog = qMax(0, smoothBacklog);
+	// Only ever speed up what's already buffered, slowing down is left to
+	// the next batch of messages that arrives.
+	if(m_smoothTimer && !m_smoothBuffer.isEmpty()) {
+		m_smoothMessagesToDrain =
+			qMax(m_smoothMessagesToDrain, smoothMessagesToDrainFromBuffer());
+	}
+}
+
+int MessageQueue::smoothMessagesToDrainFromBuffer() const
+{
+	int drainRate = qMax(
+		1, int(qint64(m_smoothDrainRate) * SMOOTH_BACKLOG_THRESHOLD /
+			   (SMOOTH_BACKLOG_THRESHOLD + qint64(m_smoothBacklog))));
+	return m_smoothBuffer.size() / drainRate;
+}
+
 void MessageQueue::updateSmoothing()
 {
 	bool enabled = m_smoothEnabled && m_smoothDrainRate > 0;
@@ -159,6 +201,25 @@ void MessageQueue::sendMultiple(int count, const net::Message *msgs)
 	}
 }
 
+bool MessageQueue::sendFramed(const char *data, size_t length)
+{
+	if(m_artificialLagMs != 0 || m_gracefullyDisconnecting) {
+		return false;
+	} else if(enqueueFramed(data, length)) {
+		resetKeepAliveTimer();
+		return true;
+	} else {
+		return false;
+	}
+}
+
+bool MessageQueue::enqueueFramed(const char *data, size_t length)
+{
+	Q_UNUSED(data);
+	Q_UNUSED(length);
+	return false;
+}
+
 void MessageQueue::receiveSmoothedMessages()
 {
 	int count = m_smoothBuffer.size();
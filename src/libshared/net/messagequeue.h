@@ -53,6 +53,16 @@ public:
 	 */
 	void sendMultiple(int count, const net::Message *msgs);
 
+	/**
+	 * @brief Enqueue messages that are already in wire format
+	 *
+	 * This is for relaying recorded messages without turning them into
+	 * message objects first. Returns false if the queue can't send the data
+	 * as-is right now, in which case the messages have to be sent the regular
+	 * way instead.
+	 */
+	bool sendFramed(const char *data, size_t length);
+
 	/**
 	 * @brief Gracefully disconnect
 	 *
@@ -107,6 +117,15 @@ public:
 	void setSmoothEnabled(bool smoothingEnabled);
 	void setSmoothDrainRate(int smoothDrainRate);
 
+	/**
+	 * @brief Set how many received messages are still waiting to be handled
+	 *
+	 * Smoothing holds back messages to spread them out, which only makes
+	 * sense if the receiver keeps up with them. The bigger this backlog, the
+	 * faster the smoothing buffer is drained, down to one interval.
+	 */
+	void setSmoothBacklog(int smoothBacklog);
+
 	int artificalLagMs() { return m_artificialLagMs; }
 
 	void setArtificialLagMs(int msecs);
@@ -118,6 +137,48 @@ public:
 		m_compatibilityMode = compatibilityMode;
 	}
 
+	/**
+	 * @brief Allow the remote end to start zstd compression of the stream
+	 *
+	 * Stream compression is transport-level, it compresses the framed bytes
+	 * rather than individual messages. The server allows it and advertises
+	 * that during login, the client then starts it. The server in turn starts
+	 * compressing its own side once it notices the client doing so.
+	 *
+	 * @return false if this kind of queue doesn't support stream compression
+	 */
+	virtual bool setStreamCompressionAllowed(bool allowed);
+
+	/**
+	 * @brief Compress everything sent from here on out
+	 *
+	 * Also allows the remote end to start compressing in turn.
+	 *
+	 * @return false if this kind of queue doesn't support stream compression
+	 */
+	virtual bool startStreamCompression();
+
+	/**
+	 * @brief Allow the remote end to pack multiple messages into one frame
+	 *
+	 * Only applies to WebSocket connections, which otherwise send every
+	 * message as its own frame. Negotiated like stream compression: the
+	 * server allows it and advertises that during login, the client starts
+	 * it and the server follows suit once it receives a batched frame.
+	 *
+	 * @return false if this kind of queue doesn't support message batching
+	 */
+	virtual bool setMessageBatchingAllowed(bool allowed);
+
+	/**
+	 * @brief Batch up everything sent from here on out
+	 *
+	 * Also allows the remote end to start batching in turn.
+	 *
+	 * @return false if this kind of queue doesn't support message batching
+	 */
+	virtual bool startMessageBatching();
+
 public slots:
 	/**
 	 * @brief Send a Ping message
@@ -182,12 +243,19 @@ protected:
 	static constexpr int MSG_TYPE_DISCONNECT = 1;
 	static constexpr int MSG_TYPE_PING = 2;
 	static constexpr int MSG_TYPE_KEEP_ALIVE = 3;
+	// Transport-level marker that never leaves the message queue, everything
+	// following it in the stream is zstd-compressed.
+	static constexpr int MSG_TYPE_ZSTD_STREAM = 5;
+	// Transport-level container that never leaves the message queue, its body
+	// is a sequence of messages in regular length-prefixed framing.
+	static constexpr int MSG_TYPE_BATCH = 6;
 	static constexpr int MSG_TYPE_CHAT = 35;
 	static constexpr int MSG_TYPE_PRIVATE_CHAT = 38;
 	static constexpr int MSG_TYPE_CLIENT_META = 64;
 
 	virtual void enqueueMessages(int count, const net::Message *msgs) = 0;
 	virtual void enqueuePing(bool pong) = 0;
+	virtual bool enqueueFramed(const char *data, size_t length);
 
 	virtual QAbstractSocket::SocketState getSocketState() = 0;
 	virtual void abortSocket() = 0;
@@ -210,14 +278,20 @@ protected:
 	QTimer *m_smoothTimer;
 	net::MessageList m_smoothBuffer;
 	int m_smoothMessagesToDrain;
+	int m_smoothBacklog;
 	unsigned int m_contextId;
 
+	//! Messages to drain per interval for what's in the smoothing buffer.
+	int smoothMessagesToDrainFromBuffer() const;
+
 private slots:
 	void checkIdleTimeout();
 	void sendArtificallyLaggedMessages();
 
 private:
 	static constexpr int SMOOTHING_INTERVAL_MSEC = 1000 / 60;
+	// A backlog of this many messages halves the effective drain rate.
+	static constexpr int SMOOTH_BACKLOG_THRESHOLD = 250;
 
 	virtual void afterDisconnectSent() = 0;
 
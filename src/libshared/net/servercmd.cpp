@@ -475,6 +475,17 @@ net::Message ServerReply::makeResultJoinLookup(
 	return make(data);
 }
 
+net::Message ServerReply::makeResultRedirectLookup(
+	const QString &message, const QString &target, const QJsonObject &data)
+{
+	return make(
+		{{QStringLiteral("type"), QStringLiteral("result")},
+		 {QStringLiteral("message"), message},
+		 {QStringLiteral("lookup"), QStringLiteral("redirect")},
+		 {QStringLiteral("target"), target},
+		 {QStringLiteral("data"), data}});
+}
+
 net::Message ServerReply::makeResultPasswordNeeded(
 	const QString &message, const QString &state)
 {
@@ -196,6 +196,9 @@ struct ServerReply {
 	static net::Message
 	makeResultJoinLookup(const QString &message, const QJsonObject &session);
 
+	static net::Message makeResultRedirectLookup(
+		const QString &message, const QString &target, const QJsonObject &data);
+
 	static net::Message
 	makeResultPasswordNeeded(const QString &message, const QString &state);
 
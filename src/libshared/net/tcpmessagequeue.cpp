@@ -5,6 +5,7 @@
 #include <QTcpSocket>
 #include <QTimer>
 #include <QtEndian>
+#include <zstd.h>
 
 namespace net {
 
@@ -13,9 +14,11 @@ TcpMessageQueue::TcpMessageQueue(
 	: MessageQueue(decodeOpaque, parent)
 	, m_socket(socket)
 {
-	m_recvbuffer = new char[MAX_BUF_LEN];
+	m_recvbuffer = new char[INITIAL_BUF_LEN];
 	m_recvbytes = 0;
+	m_recvcapacity = INITIAL_BUF_LEN;
 	m_sentbytes = 0;
+	setWriteHighWaterMark(DEFAULT_WRITE_HIGH_WATER_MARK);
 
 	connect(socket, &QTcpSocket::readyRead, this, &TcpMessageQueue::readData);
 	connect(
@@ -29,6 +32,8 @@ TcpMessageQueue::TcpMessageQueue(
 TcpMessageQueue::~TcpMessageQueue()
 {
 	delete[] m_recvbuffer;
+	ZSTD_freeCCtx(m_zstdCctx);
+	ZSTD_freeDCtx(m_zstdDctx);
 }
 
 int TcpMessageQueue::uploadQueueBytes() const
@@ -65,6 +70,25 @@ void TcpMessageQueue::enqueuePing(bool pong)
 	}
 }
 
+bool TcpMessageQueue::enqueueFramed(const char *data, size_t length)
+{
+	// Recorded messages are in the current format, so they can't be used in
+	// compatibility mode. They also can't jump ahead of anything queued or
+	// cross the point where stream compression starts.
+	if(compatibilityMode() || messagesInOutbox() || !m_sendbuffer.isEmpty() ||
+	   m_zstdStarted != (m_zstdCctx != nullptr)) {
+		return false;
+	}
+
+	m_sendbuffer.append(data, compat::castSize(length));
+	if(m_zstdCctx && !compressSendBuffer()) {
+		emit writeError();
+	} else {
+		writeData();
+	}
+	return true;
+}
+
 QAbstractSocket::SocketState TcpMessageQueue::getSocketState()
 {
 	return m_socket->state();
@@ -77,42 +101,48 @@ void TcpMessageQueue::abortSocket()
 
 void TcpMessageQueue::readData()
 {
-	int read, totalread = 0, gotmessages = 0;
+	int progress, read, totalread = 0, gotmessages = 0;
 	bool smoothFlush = false;
 	int disconnectReason = -1;
 	QString disconnectMessage;
 	do {
 		// Read as much as fits in to the message buffer
-		read = m_socket->read(
-			m_recvbuffer + m_recvbytes, MAX_BUF_LEN - m_recvbytes);
-		if(read < 0) {
+		int previousRecvbytes = m_recvbytes;
+		progress = fillRecvBuffer(read);
+		if(progress == FILL_BAD_DATA) {
+			emit badData(m_zstdRecvbuffer.length(), MSG_TYPE_ZSTD_STREAM, 0);
+			return;
+		} else if(progress < 0) {
 			emit readError();
 			return;
 		}
 
 		if(m_gracefullyDisconnecting && !m_quietDisconnecting) {
 			// Ignore incoming data when we're in the process of disconnecting
-			if(read > 0) {
+			m_recvbytes = previousRecvbytes;
+			if(progress > 0) {
 				continue;
 			} else {
 				return;
 			}
 		}
 
-		m_recvbytes += read;
-
-		// Extract all complete messages
+		// Extract all complete messages. They're picked out of the buffer in
+		// place, the leftover partial message is moved to the front only once
+		// at the end, rather than shifting the whole buffer after each message.
+		int offset = 0;
 		int messageLength;
-		while((messageLength = haveWholeMessageToRead()) != 0) {
+		while((messageLength = haveWholeMessageToRead(offset)) != 0) {
 			// Whole message received!
-			int type = static_cast<unsigned char>(m_recvbuffer[2]);
+			const char *message = m_recvbuffer + offset;
+			int type = static_cast<unsigned char>(message[2]);
 			if(type == MSG_TYPE_PING) {
 				// Pings are handled internally
 				if(messageLength != DP_MESSAGE_HEADER_LENGTH + 1) {
 					// Not a valid Ping message!
 					emit badData(messageLength, MSG_TYPE_PING, 0);
 				} else {
-					handlePing(m_recvbuffer[DP_MESSAGE_HEADER_LENGTH]);
+					handlePing(message[DP_MESSAGE_HEADER_LENGTH]);
 				}
 
 			} else if(type == MSG_TYPE_DISCONNECT) {
@@ -122,9 +152,9 @@ void TcpMessageQueue::readData()
 					emit badData(messageLength, MSG_TYPE_DISCONNECT, 0);
 				} else {
 					smoothFlush = true;
-					disconnectReason = m_recvbuffer[DP_MESSAGE_HEADER_LENGTH];
+					disconnectReason = message[DP_MESSAGE_HEADER_LENGTH];
 					disconnectMessage = QString::fromUtf8(
-						m_recvbuffer + DP_MESSAGE_HEADER_LENGTH + 1,
+						message + DP_MESSAGE_HEADER_LENGTH + 1,
 						messageLength - DP_MESSAGE_HEADER_LENGTH - 1);
 				}
 
@@ -132,14 +162,22 @@ void TcpMessageQueue::readData()
 				// Nothing to do, just keeps the connection alive if the client
 				// fails to send out a ping due upload queue saturation.
 
+			} else if(type == MSG_TYPE_ZSTD_STREAM) {
+				// The remainder of the stream is compressed, including what's
+				// left in the reception buffer.
+				if(!startStreamDecompression(offset + messageLength)) {
+					emit badData(messageLength, MSG_TYPE_ZSTD_STREAM, 0);
+					return;
+				}
+
 			} else if(m_gracefullyDisconnecting) {
 				// Just keep echoing everything that has a client effect.
 				if(type == MSG_TYPE_CHAT || type == MSG_TYPE_PRIVATE_CHAT ||
 				   type >= MSG_TYPE_CLIENT_META) {
 					m_outbox.enqueue(Message::noinc(DP_message_new_opaque(
-						DP_MessageType(type), m_recvbuffer[3],
+						DP_MessageType(type), message[3],
 						reinterpret_cast<const unsigned char *>(
-							m_recvbuffer + DP_MESSAGE_HEADER_LENGTH),
+							message + DP_MESSAGE_HEADER_LENGTH),
 						messageLength - DP_MESSAGE_HEADER_LENGTH)));
 					if(m_sendbuffer.isEmpty()) {
 						writeData();
@@ -148,12 +186,12 @@ void TcpMessageQueue::readData()
 
 			} else {
 				// The rest are normal messages
-				net::Message msg = deserializeMessage();
+				net::Message msg = deserializeMessage(message, messageLength);
 				if(msg.isNull()) {
 					qWarning("Error deserializing message: %s", DP_error());
 					emit badData(
 						messageLength, type,
-						static_cast<unsigned char>(m_recvbuffer[3]));
+						static_cast<unsigned char>(message[3]));
 				} else {
 					if(m_smoothTimer) {
 						// Undos already have a delay because they require a
@@ -172,14 +210,18 @@ void TcpMessageQueue::readData()
 				}
 			}
 
-			if(messageLength < m_recvbytes) {
-				// Buffer contains more than one message
+			offset += messageLength;
+		}
+
+		if(offset != 0) {
+			if(offset < m_recvbytes) {
+				// Buffer contains the start of another message
 				memmove(
-					m_recvbuffer, m_recvbuffer + messageLength,
-					m_recvbytes - messageLength);
+					m_recvbuffer, m_recvbuffer + offset, m_recvbytes - offset);
+				m_recvbytes -= offset;
+			} else {
+				m_recvbytes = 0;
 			}
-
-			m_recvbytes -= messageLength;
 		}
 
 		// All whole messages extracted from the work buffer.
@@ -192,7 +234,7 @@ void TcpMessageQueue::readData()
 			QTimer::singleShot(0, this, &TcpMessageQueue::readData);
 			break;
 		}
-	} while(read > 0);
+	} while(progress > 0);
 
 	if(totalread != 0) {
 		resetLastRecvTimer();
@@ -207,8 +249,7 @@ void TcpMessageQueue::readData()
 				emit messageAvailable();
 				m_smoothTimer->stop();
 			} else {
-				m_smoothMessagesToDrain =
-					m_smoothBuffer.size() / m_smoothDrainRate;
+				m_smoothMessagesToDrain = smoothMessagesToDrainFromBuffer();
 				if(!m_smoothTimer->isActive()) {
 					receiveSmoothedMessages();
 				}
@@ -257,80 +298,303 @@ void TcpMessageQueue::afterDisconnectSent()
 	m_recvbytes = 0;
 }
 
-int TcpMessageQueue::haveWholeMessageToRead()
+bool TcpMessageQueue::setStreamCompressionAllowed(bool allowed)
+{
+	m_zstdAllowed = allowed;
+	return true;
+}
+
+bool TcpMessageQueue::startStreamCompression()
+{
+	if(!m_zstdStarted) {
+		m_zstdAllowed = true;
+		m_zstdStarted = true;
+		m_outbox.enqueue(Message::noinc(DP_message_new_opaque(
+			DP_MessageType(MSG_TYPE_ZSTD_STREAM), 0, nullptr, 0)));
+		if(m_sendbuffer.isEmpty()) {
+			writeData();
+		}
+	}
+	return true;
+}
+
+int TcpMessageQueue::fillRecvBuffer(int &outRead)
+{
+	ensureRecvBufferSpace();
+	if(!m_zstdDctx) {
+		outRead = m_socket->read(
+			m_recvbuffer + m_recvbytes, m_recvcapacity - m_recvbytes);
+		if(outRead > 0) {
+			m_recvbytes += outRead;
+		}
+		return outRead;
+	}
+
+	// Compressed stream: read from the socket only once everything read
+	// previously has been decompressed, since the reception buffer may not
+	// have had room for all of it.
+	outRead = 0;
+	if(m_zstdRecvbytes >= m_zstdRecvbuffer.length()) {
+		int length = int(qMin(m_socket->bytesAvailable(), qint64(MAX_BUF_LEN)));
+		m_zstdRecvbuffer.resize(length);
+		outRead = length <= 0
+					  ? 0
+					  : int(m_socket->read(m_zstdRecvbuffer.data(), length));
+		if(outRead < 0) {
+			return -1;
+		}
+		m_zstdRecvbuffer.truncate(outRead);
+		m_zstdRecvbytes = 0;
+	}
+
+	ZSTD_inBuffer in = {
+		m_zstdRecvbuffer.constData(), size_t(m_zstdRecvbuffer.length()),
+		size_t(m_zstdRecvbytes)};
+	ZSTD_outBuffer out = {
+		m_recvbuffer, size_t(m_recvcapacity), size_t(m_recvbytes)};
+	size_t result = ZSTD_decompressStream(m_zstdDctx, &out, &in);
+	if(ZSTD_isError(result)) {
+		// Also happens if the peer uses a window larger than we allow.
+		qWarning(
+			"Error decompressing message stream: %s",
+			ZSTD_getErrorName(result));
+		return FILL_BAD_DATA;
+	}
+
+	int progress = outRead + (int(in.pos) - m_zstdRecvbytes) +
+				   (int(out.pos) - m_recvbytes);
+	m_zstdRecvbytes = int(in.pos);
+	m_recvbytes = int(out.pos);
+	return progress;
+}
+
+void TcpMessageQueue::ensureRecvBufferSpace()
 {
-	if(m_recvbytes >= DP_MESSAGE_HEADER_LENGTH) {
-		int bodyLength = qFromBigEndian<quint16>(m_recvbuffer);
+	// Whole messages have been taken out of the buffer at this point, only the
+	// start of a partial one may be left at the front. If it won't fit, grow
+	// the buffer to make room for it.
+	if(m_recvbytes >= DP_MESSAGE_HEADER_LENGTH &&
+	   m_recvcapacity < MAX_BUF_LEN) {
+		int messageLength = qFromBigEndian<quint16>(m_recvbuffer) +
+							DP_MESSAGE_HEADER_LENGTH;
+		if(messageLength > m_recvcapacity) {
+			int capacity =
+				qMin(qMax(messageLength, m_recvcapacity * 2), MAX_BUF_LEN);
+			char *recvbuffer = new char[capacity];
+			memcpy(recvbuffer, m_recvbuffer, size_t(m_recvbytes));
+			delete[] m_recvbuffer;
+			m_recvbuffer = recvbuffer;
+			m_recvcapacity = capacity;
+		}
+	}
+}
+
+int TcpMessageQueue::haveWholeMessageToRead(int offset)
+{
+	int available = m_recvbytes - offset;
+	if(available >= DP_MESSAGE_HEADER_LENGTH) {
+		int bodyLength = qFromBigEndian<quint16>(m_recvbuffer + offset);
 		int messageLength = bodyLength + DP_MESSAGE_HEADER_LENGTH;
-		if(m_recvbytes >= messageLength) {
+		if(available >= messageLength) {
 			return messageLength;
 		}
 	}
 	return 0;
 }
 
+bool TcpMessageQueue::startStreamDecompression(int offset)
+{
+	if(!m_zstdAllowed || m_zstdDctx) {
+		qWarning("Unexpected stream compression marker");
+		return false;
+	}
+
+	m_zstdDctx = ZSTD_createDCtx();
+	if(!m_zstdDctx) {
+		qWarning("Error creating stream decompression context");
+		return false;
+	}
+
+	size_t result = ZSTD_DCtx_setParameter(
+		m_zstdDctx, ZSTD_d_windowLogMax, ZSTD_STREAM_WINDOW_LOG);
+	if(ZSTD_isError(result)) {
+		qWarning(
+			"Error limiting stream decompression window: %s",
+			ZSTD_getErrorName(result));
+		ZSTD_freeDCtx(m_zstdDctx);
+		m_zstdDctx = nullptr;
+		return false;
+	}
+
+	// Whatever follows the marker was already compressed.
+	m_zstdRecvbuffer = QByteArray(m_recvbuffer + offset, m_recvbytes - offset);
+	m_zstdRecvbytes = 0;
+	m_recvbytes = offset;
+
+	// Compress our side too if we haven't already.
+	startStreamCompression();
+	return true;
+}
+
+void TcpMessageQueue::setWriteHighWaterMark(int bytes)
+{
+	m_writeHighWaterMark = qMax(bytes, DP_MESSAGE_HEADER_LENGTH);
+}
+
 void TcpMessageQueue::writeData()
 {
-	bool sendMore = true;
 	int sentBatch = 0;
-
-	while(sendMore && sentBatch < 1024 * 64) {
-		sendMore = false;
-		if(m_sendbuffer.isEmpty() && messagesInOutbox()) {
-			// Upload buffer is empty, but there are messages in the outbox
+	while(sentBatch < m_writeHighWaterMark) {
+		if(m_sendbuffer.isEmpty()) {
+			// Upload buffer is empty, gather up messages from the outbox
 			Q_ASSERT(m_sentbytes == 0);
-			net::Message msg = dequeueFromOutbox();
-			if(msg.isNull()) {
-				continue;
-			} else if(!serializeMessage(msg)) {
-				qWarning("Error serializing message: %s", DP_error());
-				sendMore = messagesInOutbox();
+			net::Message direct = fillSendBuffer();
+			if(!direct.isNull()) {
+				// Large message already in wire format, relayed messages
+				// usually are. Write it directly, only copy what the socket
+				// didn't take.
+				size_t length;
+				const char *data = getSerializedMessage(direct, length);
+				const qint64 sent = m_socket->write(data, qint64(length));
+				if(sent < 0) {
+					emit writeError();
+					return;
+				}
+				sentBatch += int(sent);
+				if(size_t(sent) < length) {
+					m_sendbuffer.append(
+						data + sent, int(length - size_t(sent)));
+				}
 				continue;
-			}
-		}
-
-		if(m_sentbytes < m_sendbuffer.length()) {
-			const int sent = m_socket->write(
-				m_sendbuffer.constData() + m_sentbytes,
-				m_sendbuffer.length() - m_sentbytes);
-			if(sent < 0) {
+			} else if(m_sendbuffer.isEmpty()) {
+				return;
+			} else if(m_zstdCctx && !compressSendBuffer()) {
 				emit writeError();
 				return;
+			} else if(m_zstdMarkerSent && !m_zstdCctx) {
+				// Batch ends with the compression marker, uncompressed.
+				// Everything after it gets compressed.
+				m_zstdCctx = ZSTD_createCCtx();
+				if(!m_zstdCctx) {
+					qWarning("Error creating stream compression context");
+					emit writeError();
+					return;
+				}
+				ZSTD_CCtx_setParameter(
+					m_zstdCctx, ZSTD_c_windowLog, ZSTD_STREAM_WINDOW_LOG);
 			}
-			m_sentbytes += sent;
-			sentBatch += sent;
+		}
 
-			Q_ASSERT(m_sentbytes <= m_sendbuffer.length());
+		// Write the whole batch in one go instead of once per message.
+		const int sent = m_socket->write(
+			m_sendbuffer.constData() + m_sentbytes,
+			m_sendbuffer.length() - m_sentbytes);
+		if(sent < 0) {
+			emit writeError();
+			return;
+		}
+		m_sentbytes += sent;
+		sentBatch += sent;
 
-			if(m_sentbytes >= m_sendbuffer.length()) {
-				// Complete envelope sent
-				m_sendbuffer.clear();
-				m_sentbytes = 0;
-				sendMore = messagesInOutbox();
+		Q_ASSERT(m_sentbytes <= m_sendbuffer.length());
+
+		if(m_sentbytes >= m_sendbuffer.length()) {
+			// Complete batch sent
+			m_sendbuffer.truncate(0);
+			m_sentbytes = 0;
+		} else {
+			return;
+		}
+	}
+}
+
+net::Message TcpMessageQueue::fillSendBuffer()
+{
+	while(messagesInOutbox() && m_sendbuffer.length() < m_writeHighWaterMark) {
+		net::Message msg = dequeueFromOutbox();
+		if(msg.isNull()) {
+			continue;
+		}
+
+		size_t length;
+		if(msg.type() == MSG_TYPE_ZSTD_STREAM) {
+			// The compression marker finishes this batch, since the ones after
+			// it are compressed.
+			m_sendbuffer.append(
+				reinterpret_cast<const char *>(msg.serialized(length)),
+				int(length));
+			m_zstdMarkerSent = true;
+			break;
+		}
+
+		const char *data = getSerializedMessage(msg, length);
+		if(data) {
+			if(!m_zstdCctx && m_sendbuffer.isEmpty() &&
+			   length >= DIRECT_WRITE_MIN_LEN) {
+				return msg;
 			}
+			m_sendbuffer.append(data, int(length));
+		} else if(!serializeMessageAppend(msg)) {
+			qWarning("Error serializing message: %s", DP_error());
 		}
 	}
+	return net::Message();
+}
+
+bool TcpMessageQueue::compressSendBuffer()
+{
+	ZSTD_inBuffer in = {
+		m_sendbuffer.constData(), size_t(m_sendbuffer.length()), 0};
+	m_zstdSendbuffer.truncate(0);
+	size_t result;
+	do {
+		int offset = m_zstdSendbuffer.length();
+		m_zstdSendbuffer.resize(
+			offset + compat::castSize(ZSTD_CStreamOutSize()));
+		ZSTD_outBuffer out = {
+			m_zstdSendbuffer.data(), size_t(m_zstdSendbuffer.length()),
+			size_t(offset)};
+		// Flushing makes each batch decodable on arrival, while keeping the
+		// stream's history around to compress the following ones.
+		result = ZSTD_compressStream2(m_zstdCctx, &out, &in, ZSTD_e_flush);
+		if(ZSTD_isError(result)) {
+			qWarning(
+				"Error compressing messages: %s", ZSTD_getErrorName(result));
+			return false;
+		}
+		m_zstdSendbuffer.truncate(int(out.pos));
+	} while(result != 0);
+	m_sendbuffer.swap(m_zstdSendbuffer);
+	return true;
 }
 
-bool TcpMessageQueue::serializeMessage(const net::Message &msg)
+bool TcpMessageQueue::serializeMessageAppend(const net::Message &msg)
 {
 	if(compatibilityMode()) {
-		return msg.serializeCompat(m_sendbuffer);
+		return msg.serializeAppendCompat(m_sendbuffer);
 	} else {
-		return msg.serialize(m_sendbuffer);
+		return msg.serializeAppend(m_sendbuffer);
 	}
 }
 
-net::Message TcpMessageQueue::deserializeMessage()
+const char *TcpMessageQueue::getSerializedMessage(
+	const net::Message &msg, size_t &outLength)
+{
+	const unsigned char *data = compatibilityMode()
+									? msg.serializedCompat(outLength)
+									: msg.serialized(outLength);
+	return reinterpret_cast<const char *>(data);
+}
+
+net::Message
+TcpMessageQueue::deserializeMessage(const char *buf, int messageLength)
 {
+	const unsigned char *data = reinterpret_cast<const unsigned char *>(buf);
+	size_t length = size_t(messageLength);
 	if(compatibilityMode()) {
-		return net::Message::deserializeCompat(
-			reinterpret_cast<unsigned char *>(m_recvbuffer), m_recvbytes,
-			m_decodeOpaque);
+		return net::Message::deserializeCompat(data, length, m_decodeOpaque);
 	} else {
-		return net::Message::deserialize(
-			reinterpret_cast<unsigned char *>(m_recvbuffer), m_recvbytes,
-			m_decodeOpaque);
+		return net::Message::deserialize(data, length, m_decodeOpaque);
 	}
 }
 
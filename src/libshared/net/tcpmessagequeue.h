@@ -5,6 +5,8 @@
 #include <QQueue>
 
 class QTcpSocket;
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
 
 namespace net {
 
@@ -19,9 +21,17 @@ public:
 	int uploadQueueBytes() const override;
 	bool isUploading() const override;
 
+	// Outgoing messages are gathered into batches of about this many bytes
+	// before being handed to the socket in a single write.
+	void setWriteHighWaterMark(int bytes);
+
+	bool setStreamCompressionAllowed(bool allowed) override;
+	bool startStreamCompression() override;
+
 protected:
 	void enqueueMessages(int count, const net::Message *msgs) override;
 	void enqueuePing(bool pong) override;
+	bool enqueueFramed(const char *data, size_t length) override;
 
 	QAbstractSocket::SocketState getSocketState() override;
 	void abortSocket() override;
@@ -33,14 +43,33 @@ private slots:
 
 private:
 	static constexpr int MAX_BUF_LEN = 0xffff + DP_MESSAGE_HEADER_LENGTH;
+	// Reception buffers start out this small and only grow when a message
+	// doesn't fit, since most connections never receive anything large.
+	static constexpr int INITIAL_BUF_LEN = 4096;
+	static constexpr int DEFAULT_WRITE_HIGH_WATER_MARK = 1024 * 64;
+	// Messages in wire format at least this large aren't copied into a batch.
+	static constexpr size_t DIRECT_WRITE_MIN_LEN = 1024 * 16;
+	// Keeps the compression window, and with it the memory needed per
+	// connection on both ends, reasonably small. Used as the window size when
+	// compressing and as the largest window accepted when decompressing.
+	static constexpr int ZSTD_STREAM_WINDOW_LOG = 17;
+	// Returned by fillRecvBuffer when the compressed stream is garbage.
+	static constexpr int FILL_BAD_DATA = -2;
 
 	void afterDisconnectSent() override;
 
-	int haveWholeMessageToRead();
+	int fillRecvBuffer(int &outRead);
+	void ensureRecvBufferSpace();
+	int haveWholeMessageToRead(int offset);
+	bool startStreamDecompression(int offset);
 
 	void writeData();
-	bool serializeMessage(const net::Message &msg);
-	net::Message deserializeMessage();
+	net::Message fillSendBuffer();
+	bool serializeMessageAppend(const net::Message &msg);
+	bool compressSendBuffer();
+	const char *
+	getSerializedMessage(const net::Message &msg, size_t &outLength);
+	net::Message deserializeMessage(const char *buf, int messageLength);
 
 	bool messagesInOutbox() const;
 	net::Message dequeueFromOutbox();
@@ -49,9 +78,19 @@ private:
 	char *m_recvbuffer;		 // raw message reception buffer
 	QByteArray m_sendbuffer; // raw message upload buffer
 	int m_recvbytes;		 // number of bytes in reception buffer
+	int m_recvcapacity;		 // size of the reception buffer
 	int m_sentbytes;		 // number of bytes in upload buffer already sent
+	int m_writeHighWaterMark;
 	QQueue<net::Message> m_outbox; // messages to be sent
 	QQueue<bool> m_pings;		   // pings and pongs to be sent
+	bool m_zstdAllowed = false;	   // remote end may start stream compression
+	bool m_zstdStarted = false;	   // compression marker has been enqueued
+	bool m_zstdMarkerSent = false; // compression marker is in upload buffer
+	ZSTD_CCtx *m_zstdCctx = nullptr; // compresses everything sent, if started
+	ZSTD_DCtx *m_zstdDctx = nullptr; // decompresses everything received
+	QByteArray m_zstdSendbuffer;	 // compressed upload buffer
+	QByteArray m_zstdRecvbuffer;	 // compressed bytes not yet decompressed
+	int m_zstdRecvbytes = 0; // bytes of compressed buffer already decompressed
 };
 
 }
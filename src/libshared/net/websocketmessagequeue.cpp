@@ -9,6 +9,13 @@
 
 namespace net {
 
+struct WebSocketMessageQueue::ReceiveState {
+	bool gotmessage = false;
+	bool smoothFlush = false;
+	int disconnectReason = -1;
+	QString disconnectMessage;
+};
+
 WebSocketMessageQueue::WebSocketMessageQueue(
 	QWebSocket *socket, bool decodeOpaque, QObject *parent)
 	: MessageQueue(decodeOpaque, parent)
@@ -29,11 +36,19 @@ WebSocketMessageQueue::WebSocketMessageQueue(
 	connect(
 		socket, &QWebSocket::bytesWritten, this,
 		&WebSocketMessageQueue::dataWritten, connectionType);
+
+	m_batchTimer = new QTimer(this);
+	m_batchTimer->setTimerType(Qt::PreciseTimer);
+	m_batchTimer->setSingleShot(true);
+	m_batchTimer->setInterval(0);
+	connect(
+		m_batchTimer, &QTimer::timeout, this,
+		&WebSocketMessageQueue::flushBatch);
 }
 
 int WebSocketMessageQueue::uploadQueueBytes() const
 {
-	return m_socket->bytesToWrite();
+	return m_socket->bytesToWrite() + m_batchBuffer.size();
 }
 
 bool WebSocketMessageQueue::isUploading() const
@@ -41,31 +56,168 @@ bool WebSocketMessageQueue::isUploading() const
 	return uploadQueueBytes() != 0;
 }
 
+bool WebSocketMessageQueue::setMessageBatchingAllowed(bool allowed)
+{
+	m_batchAllowed = allowed;
+	return true;
+}
+
+bool WebSocketMessageQueue::startMessageBatching()
+{
+	if(!m_batchStarted) {
+		m_batchAllowed = true;
+		m_batchStarted = true;
+		// The first batch doubles as the marker that tells the remote end
+		// that we're batching, so send it even if nothing else goes in it.
+		appendToBatch(nullptr, 0);
+	}
+	return true;
+}
+
 void WebSocketMessageQueue::enqueueMessages(int count, const net::Message *msgs)
 {
 	for(int i = 0; i < count; ++i) {
 		const net::Message &msg = msgs[i];
 		if(!msg.isNull()) {
-			if(serializeMessage(msg)) {
-				qint64 sent =
-					m_socket->sendBinaryMessage(m_serializationBuffer);
-				if(sent != qint64(m_serializationBuffer.size())) {
-					emit writeError();
-					break;
-				}
-			} else {
-				qWarning("Error serializing message: %s", DP_error());
+			bool ok = m_batchStarted ? batchMessage(msg) : sendMessage(msg);
+			if(!ok) {
+				break;
 			}
 		}
 	}
 }
 
+bool WebSocketMessageQueue::sendMessage(const net::Message &msg)
+{
+	// Messages already in wire format get sent without copying them into the
+	// serialization buffer first. The socket frames them right away, so the
+	// message outlives the raw data.
+	size_t length;
+	const unsigned char *data = compatibilityMode()
+									? msg.serializedWsCompat(length)
+									: msg.serializedWs(length);
+	QByteArray bytes;
+	if(data) {
+		bytes = QByteArray::fromRawData(
+			reinterpret_cast<const char *>(data), compat::castSize(length));
+	} else if(serializeMessage(msg)) {
+		bytes = m_serializationBuffer;
+	} else {
+		qWarning("Error serializing message: %s", DP_error());
+		return true;
+	}
+	return sendFrame(bytes);
+}
+
+bool WebSocketMessageQueue::batchMessage(const net::Message &msg)
+{
+	// Batched messages use the regular length-prefixed framing, since the
+	// frame boundaries no longer delimit them.
+	size_t length;
+	const unsigned char *data = compatibilityMode()
+									? msg.serializedCompat(length)
+									: msg.serialized(length);
+	if(data) {
+		return appendToBatch(reinterpret_cast<const char *>(data), length);
+	} else if(serializeMessageFramed(msg)) {
+		return appendToBatch(
+			m_serializationBuffer.constData(),
+			compat::cast<size_t>(m_serializationBuffer.size()));
+	} else {
+		qWarning("Error serializing message: %s", DP_error());
+		return true;
+	}
+}
+
+bool WebSocketMessageQueue::appendToBatch(const char *data, size_t length)
+{
+	if(!m_batchBuffer.isEmpty() &&
+	   compat::cast<size_t>(m_batchBuffer.size()) + length >
+		   size_t(MAX_BATCH_BYTES) &&
+	   !flushBatch()) {
+		return false;
+	}
+
+	if(m_batchBuffer.isEmpty()) {
+		m_batchBuffer.append(char(MSG_TYPE_BATCH));
+		m_batchBuffer.append(char(0));
+		m_batchTimer->start();
+	}
+	if(length != 0) {
+		m_batchBuffer.append(data, compat::castSize(length));
+	}
+	return true;
+}
+
+bool WebSocketMessageQueue::flushBatch()
+{
+	m_batchTimer->stop();
+	if(m_batchBuffer.isEmpty()) {
+		return true;
+	} else {
+		qint64 sent = m_socket->sendBinaryMessage(m_batchBuffer);
+		bool ok = sent == qint64(m_batchBuffer.size());
+		// Keep the capacity around for the next batch.
+		m_batchBuffer.resize(0);
+		if(!ok) {
+			emit writeError();
+		}
+		return ok;
+	}
+}
+
+bool WebSocketMessageQueue::sendFrame(const QByteArray &bytes)
+{
+	// Anything still waiting in a batch has to go out first.
+	if(!flushBatch()) {
+		return false;
+	}
+
+	qint64 sent = m_socket->sendBinaryMessage(bytes);
+	if(sent != qint64(bytes.size())) {
+		emit writeError();
+		return false;
+	}
+	return true;
+}
+
 void WebSocketMessageQueue::enqueuePing(bool pong)
 {
 	net::Message msg = net::makePingMessage(0, pong);
 	enqueueMessages(1, &msg);
 }
 
+bool WebSocketMessageQueue::enqueueFramed(const char *data, size_t length)
+{
+	// Recorded messages are in the current format and length-prefixed, which
+	// is just what goes into a batch. They get split up at message boundaries
+	// to keep each frame within the batch size.
+	if(!m_batchStarted || compatibilityMode()) {
+		return false;
+	}
+
+	size_t offset = 0;
+	while(offset < length) {
+		if(length - offset < DP_MESSAGE_HEADER_LENGTH) {
+			qWarning("Truncated framed message header");
+			return true;
+		}
+		size_t messageLength =
+			DP_MESSAGE_HEADER_LENGTH +
+			qFromBigEndian<quint16>(
+				reinterpret_cast<const unsigned char *>(data + offset));
+		if(messageLength > length - offset) {
+			qWarning("Truncated framed message body");
+			return true;
+		}
+		if(!appendToBatch(data + offset, messageLength)) {
+			break;
+		}
+		offset += messageLength;
+	}
+	return true;
+}
+
 QAbstractSocket::SocketState WebSocketMessageQueue::getSocketState()
 {
 	return m_socket->state();
@@ -79,7 +231,7 @@ void WebSocketMessageQueue::abortSocket()
 void WebSocketMessageQueue::dataWritten(qint64 bytes)
 {
 	emit bytesSent(bytes);
-	if(m_socket->bytesToWrite() == 0) {
+	if(m_socket->bytesToWrite() == 0 && m_batchBuffer.isEmpty()) {
 		emit allSent();
 #ifndef __EMSCRIPTEN__
 		if(m_gracefullyDisconnecting && !m_quietDisconnecting) {
@@ -94,88 +246,34 @@ void WebSocketMessageQueue::receiveBinaryMessage(const QByteArray &bytes)
 {
 	// Ignore incoming messages while we're in the process of disconnecting.
 	if(!m_gracefullyDisconnecting || m_quietDisconnecting) {
-		bool gotmessage = false;
-		bool smoothFlush = false;
-		int disconnectReason = -1;
-		QString disconnectMessage;
-
-		int type = static_cast<unsigned char>(bytes[0]);
-		size_t messageLength = compat::cast<size_t>(bytes.size());
-		if(type == MSG_TYPE_PING) {
-			// Pings are handled internally
-			if(messageLength != DP_MESSAGE_WS_HEADER_LENGTH + 1) {
-				// Not a valid Ping message!
-				emit badData(int(messageLength), MSG_TYPE_PING, 0);
-			} else {
-				handlePing(bytes[DP_MESSAGE_WS_HEADER_LENGTH]);
-			}
-
-		} else if(type == MSG_TYPE_KEEP_ALIVE) {
-			// Nothing to do, just keeps the connection alive if the client
-			// fails to send out a ping due upload queue saturation.
-
-		} else if(type == MSG_TYPE_DISCONNECT) {
-			// Graceful disconnects are also handled internally
-			if(messageLength < DP_MESSAGE_WS_HEADER_LENGTH + 1) {
-				// We expected at least a reason!
-				emit badData(int(messageLength), MSG_TYPE_DISCONNECT, 0);
+		ReceiveState state;
+		const char *data = bytes.constData();
+		size_t length = compat::cast<size_t>(bytes.size());
+		if(length >= DP_MESSAGE_WS_HEADER_LENGTH &&
+		   static_cast<unsigned char>(data[0]) == MSG_TYPE_BATCH) {
+			if(m_batchAllowed) {
+				// The remote end is batching, so we can do so in turn.
+				startMessageBatching();
+				receiveBatch(data, length, state);
 			} else {
-				smoothFlush = true;
-				disconnectReason = bytes[DP_MESSAGE_WS_HEADER_LENGTH];
-				disconnectMessage = QString::fromUtf8(
-					bytes.constData() + DP_MESSAGE_WS_HEADER_LENGTH + 1,
-					int(messageLength) - DP_MESSAGE_WS_HEADER_LENGTH - 1);
+				emit badData(int(length), MSG_TYPE_BATCH, 0);
 			}
-
-		} else if(m_gracefullyDisconnecting) {
-			// Just keep echoing everything that has a client effect.
-			if(type == MSG_TYPE_CHAT || type == MSG_TYPE_PRIVATE_CHAT ||
-			   type >= MSG_TYPE_CLIENT_META) {
-				m_socket->sendBinaryMessage(bytes);
-			}
-
 		} else {
-			// The rest are normal messages
-			net::Message msg = deserializeMessage(
-				reinterpret_cast<const unsigned char *>(bytes.constData()),
-				messageLength);
-			if(msg.isNull()) {
-				qWarning("Error deserializing message: %s", DP_error());
-				emit badData(
-					int(messageLength), type,
-					static_cast<unsigned char>(bytes[1]));
-			} else {
-				if(m_smoothTimer) {
-					// Undos already have a delay because they require a
-					// round trip, we don't want to make them even
-					// slower.
-					bool ownUndoReceived = m_contextId != 0 &&
-										   msg.type() == DP_MSG_UNDO &&
-										   msg.contextId() == m_contextId;
-					if(ownUndoReceived) {
-						smoothFlush = true;
-					}
-					m_smoothBuffer.append(msg);
-				} else {
-					m_inbox.append(msg);
-				}
-				gotmessage = true;
-			}
+			receiveFrame(data, length, state);
 		}
 
 		resetLastRecvTimer();
 		emit bytesReceived(compat::cast_6<int>(bytes.size()));
 
-		if(gotmessage) {
+		if(state.gotmessage) {
 			if(m_smoothTimer) {
-				if(smoothFlush) {
+				if(state.smoothFlush) {
 					m_inbox.append(m_smoothBuffer);
 					m_smoothBuffer.clear();
 					emit messageAvailable();
 					m_smoothTimer->stop();
 				} else {
-					m_smoothMessagesToDrain =
-						m_smoothBuffer.size() / m_smoothDrainRate;
+					m_smoothMessagesToDrain = smoothMessagesToDrainFromBuffer();
 					if(!m_smoothTimer->isActive()) {
 						receiveSmoothedMessages();
 					}
@@ -185,9 +283,109 @@ void WebSocketMessageQueue::receiveBinaryMessage(const QByteArray &bytes)
 			}
 		}
 
-		if(disconnectReason != -1) {
+		if(state.disconnectReason != -1) {
 			emit gracefulDisconnect(
-				GracefulDisconnect(disconnectReason), disconnectMessage);
+				GracefulDisconnect(state.disconnectReason),
+				state.disconnectMessage);
+		}
+	}
+}
+
+void WebSocketMessageQueue::receiveBatch(
+	const char *data, size_t length, ReceiveState &state)
+{
+	// Batched messages are length-prefixed, skipping past that prefix leaves
+	// them in the same framing as a standalone WebSocket message.
+	constexpr size_t prefixLength =
+		DP_MESSAGE_HEADER_LENGTH - DP_MESSAGE_WS_HEADER_LENGTH;
+	size_t offset = DP_MESSAGE_WS_HEADER_LENGTH;
+	while(offset < length) {
+		size_t remaining = length - offset;
+		if(remaining < DP_MESSAGE_HEADER_LENGTH) {
+			emit badData(int(remaining), MSG_TYPE_BATCH, 0);
+			break;
+		}
+
+		size_t messageLength =
+			DP_MESSAGE_HEADER_LENGTH +
+			qFromBigEndian<quint16>(
+				reinterpret_cast<const unsigned char *>(data + offset));
+		if(messageLength > remaining) {
+			emit badData(
+				int(remaining), static_cast<unsigned char>(data[offset + 2]),
+				static_cast<unsigned char>(data[offset + 3]));
+			break;
+		}
+
+		receiveFrame(
+			data + offset + prefixLength, messageLength - prefixLength, state);
+		offset += messageLength;
+	}
+}
+
+void WebSocketMessageQueue::receiveFrame(
+	const char *data, size_t length, ReceiveState &state)
+{
+	int type = length == 0 ? -1 : static_cast<unsigned char>(data[0]);
+	if(type == MSG_TYPE_PING) {
+		// Pings are handled internally
+		if(length != DP_MESSAGE_WS_HEADER_LENGTH + 1) {
+			// Not a valid Ping message!
+			emit badData(int(length), MSG_TYPE_PING, 0);
+		} else {
+			handlePing(data[DP_MESSAGE_WS_HEADER_LENGTH]);
+		}
+
+	} else if(type == MSG_TYPE_KEEP_ALIVE) {
+		// Nothing to do, just keeps the connection alive if the client
+		// fails to send out a ping due upload queue saturation.
+
+	} else if(type == MSG_TYPE_DISCONNECT) {
+		// Graceful disconnects are also handled internally
+		if(length < DP_MESSAGE_WS_HEADER_LENGTH + 1) {
+			// We expected at least a reason!
+			emit badData(int(length), MSG_TYPE_DISCONNECT, 0);
+		} else {
+			state.smoothFlush = true;
+			state.disconnectReason = data[DP_MESSAGE_WS_HEADER_LENGTH];
+			state.disconnectMessage = QString::fromUtf8(
+				data + DP_MESSAGE_WS_HEADER_LENGTH + 1,
+				int(length) - DP_MESSAGE_WS_HEADER_LENGTH - 1);
+		}
+
+	} else if(m_gracefullyDisconnecting) {
+		// Just keep echoing everything that has a client effect.
+		if(type == MSG_TYPE_CHAT || type == MSG_TYPE_PRIVATE_CHAT ||
+		   type >= MSG_TYPE_CLIENT_META) {
+			sendFrame(QByteArray(data, compat::castSize(length)));
+		}
+
+	} else {
+		// The rest are normal messages
+		net::Message msg = deserializeMessage(
+			reinterpret_cast<const unsigned char *>(data), length);
+		if(msg.isNull()) {
+			qWarning("Error deserializing message: %s", DP_error());
+			emit badData(
+				int(length), type,
+				length < DP_MESSAGE_WS_HEADER_LENGTH
+					? 0
+					: static_cast<unsigned char>(data[1]));
+		} else {
+			if(m_smoothTimer) {
+				// Undos already have a delay because they require a
+				// round trip, we don't want to make them even slower.
+				bool ownUndoReceived = m_contextId != 0 &&
+									   msg.type() == DP_MSG_UNDO &&
+									   msg.contextId() == m_contextId;
+				if(ownUndoReceived) {
+					state.smoothFlush = true;
+				}
+				m_smoothBuffer.append(msg);
+			} else {
+				m_inbox.append(msg);
+			}
+			state.gotmessage = true;
 		}
 	}
 }
@@ -200,6 +398,7 @@ void WebSocketMessageQueue::receiveTextMessage(const QString &text)
 
 void WebSocketMessageQueue::afterDisconnectSent()
 {
+	flushBatch();
 	m_socket->flush();
 #ifdef __EMSCRIPTEN__
 	qInfo("Socket flushed, gracefully disconnecting.");
@@ -218,6 +417,15 @@ bool WebSocketMessageQueue::serializeMessage(const net::Message &msg)
 	}
 }
 
+bool WebSocketMessageQueue::serializeMessageFramed(const net::Message &msg)
+{
+	if(compatibilityMode()) {
+		return msg.serializeCompat(m_serializationBuffer);
+	} else {
+		return msg.serialize(m_serializationBuffer);
+	}
+}
+
 net::Message WebSocketMessageQueue::deserializeMessage(
 	const unsigned char *buf, size_t bufsize)
 {
@@ -3,6 +3,7 @@
 #define LIBSHARED_NET_WEBSOCKETMESSSAGEQUEUE_H
 #include "libshared/net/messagequeue.h"
 
+class QTimer;
 class QWebSocket;
 
 namespace net {
@@ -16,9 +17,13 @@ public:
 	int uploadQueueBytes() const override;
 	bool isUploading() const override;
 
+	bool setMessageBatchingAllowed(bool allowed) override;
+	bool startMessageBatching() override;
+
 protected:
 	void enqueueMessages(int count, const net::Message *msgs) override;
 	void enqueuePing(bool pong) override;
+	bool enqueueFramed(const char *data, size_t length) override;
 
 	QAbstractSocket::SocketState getSocketState() override;
 	void abortSocket() override;
@@ -27,15 +32,35 @@ private slots:
 	void dataWritten(qint64 bytes);
 	void receiveBinaryMessage(const QByteArray &bytes);
 	void receiveTextMessage(const QString &text);
+	bool flushBatch();
 
 private:
+	// Batches are sent once they're this large or when control returns to
+	// the event loop, whichever comes first.
+	static constexpr int MAX_BATCH_BYTES = 0xffff;
+
+	struct ReceiveState;
+
 	void afterDisconnectSent() override;
 
+	bool sendMessage(const net::Message &msg);
+	bool batchMessage(const net::Message &msg);
+	bool appendToBatch(const char *data, size_t length);
+	bool sendFrame(const QByteArray &bytes);
+
+	void receiveBatch(const char *data, size_t length, ReceiveState &state);
+	void receiveFrame(const char *data, size_t length, ReceiveState &state);
+
 	bool serializeMessage(const net::Message &msg);
+	bool serializeMessageFramed(const net::Message &msg);
 	net::Message deserializeMessage(const unsigned char *buf, size_t bufsize);
 
 	QWebSocket *m_socket;
 	QByteArray m_serializationBuffer;
+	QByteArray m_batchBuffer;
+	QTimer *m_batchTimer = nullptr;
+	bool m_batchAllowed = false; // remote end may send batched frames
+	bool m_batchStarted = false; // our own messages are sent batched
 };
 
 }
@@ -185,6 +185,29 @@ private slots:
 		loopUntil(allReceived);
 	}
 
+	void testSendLarge()
+	{
+		auto mq = getMsgQueue();
+
+		// Larger than the initial reception buffer, which has to grow.
+		net::Message msg = net::makeChatMessage(
+			0, 0, 0, QString(30000, QLatin1Char('x')));
+
+		bool messageReceived = false;
+
+		connect(
+			mq.get(), &net::MessageQueue::messageAvailable,
+			[&mq, msg, &messageReceived]() {
+				net::MessageList got;
+				mq->receive(got);
+				messageReceived = true;
+				QVERIFY(got.size() == 1);
+				QVERIFY(got[0].equals(msg));
+			});
+		mq->send(msg);
+		loopUntil(messageReceived);
+	}
+
 	void testSendDisconnect()
 	{
 		auto s = getConnection();
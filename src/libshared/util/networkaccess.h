@@ -18,7 +18,9 @@ namespace networkaccess {
 /**
  * @brief Get a shared instance of a QNetworkAccessManager
  *
- * The returned instance will be unique to the current thread
+ * The returned instance will be unique to the current thread. Use this instead
+ * of making a new manager, since connections are only kept alive and reused
+ * between requests going through the same one.
  */
 QNetworkAccessManager *getInstance();
 
@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "thinsrv/database.h"
+#include "libserver/ipprefixtree.h"
 #include "libserver/serverlog.h"
 #include "libshared/util/database.h"
 #include "libshared/util/passwordhash.h"
@@ -8,6 +9,7 @@
 #include "thinsrv/dblog.h"
 #include "thinsrv/extbans.h"
 #include <QDateTime>
+#include <QHash>
 #include <QHostAddress>
 #include <QJsonArray>
 #include <QJsonObject>
@@ -15,14 +17,48 @@
 #include <QTimer>
 #include <QUrl>
 #include <QVariant>
+#include <QVector>
+#include <algorithm>
 #include <dpdb/sql_qt.h>
 
 namespace server {
 
+namespace {
+struct CachedIpBan {
+	int id;
+	QHostAddress ip;
+	int subnet;
+	QString expires;
+};
+
+struct CachedBan {
+	int id;
+	BanReaction reaction;
+	QString expires;
+	QString reason;
+};
+}
+
+// Bans and settings are consulted on every connection and all over the place
+// respectively, so they're kept in memory. Everything that changes them goes
+// through this class, which drops the caches when it does. The daily tasks
+// also drop them to pick up changes made to the database file by hand.
 struct Database::Private {
 	drawdance::Database db;
 	InMemoryLog *memlog;
 	DbLog *dblog;
+	bool bansCached = false;
+	QVector<CachedIpBan> ipBans;
+	IpPrefixTree ipBanTree;
+	QVector<int> unindexedIpBans;
+	QHash<QString, QVector<CachedBan>> systemBans;
+	QHash<long long, QVector<CachedBan>> userBans;
+	bool settingsCached = false;
+	QHash<QString, QString> settings;
+	// Hit counts by ban id, since the server started.
+	QHash<int, quint64> ipBanHits;
+	QHash<int, quint64> systemBanHits;
+	QHash<int, quint64> userBanHits;
 };
 
 static bool initDatabase(drawdance::Database &db)
@@ -30,6 +66,9 @@ static bool initDatabase(drawdance::Database &db)
 	drawdance::Query query = db.queryWithoutLock();
 	query.enableWalMode();
 	query.setForeignKeysEnabled(false);
+	// The server log is written through a connection of its own on another
+	// thread, wait for it instead of failing when it holds the write lock.
+	query.exec("pragma busy_timeout = 5000");
 	return query.tx([&query] {
 		return query.exec("create table if not exists settings ("
 						  "key primary key, value)") &&
@@ -55,7 +94,12 @@ static bool initDatabase(drawdance::Database &db)
 			   query.exec("create table if not exists users ("
 						  "username unique, password, locked, flags)") &&
 			   query.exec("create table if not exists disabledextbans ("
-						  "id integer primary key not null)");
+						  "id integer primary key not null)") &&
+			   query.exec("create table if not exists clustersessions ("
+						  "node text not null,"
+						  "id text not null,"
+						  "alias text,"
+						  "updated integer not null)");
 	});
 }
 
@@ -97,7 +141,7 @@ bool Database::openFile(const QString &path)
 	}
 
 	DbLog *dblog = new DbLog(d->db);
-	if(!dblog->initDb()) {
+	if(!dblog->initDb(path)) {
 		qWarning("Couldn't initialize database log!");
 		delete dblog;
 	} else {
@@ -144,7 +188,14 @@ void Database::setConfigValue(ConfigKey key, const QString &value)
 void Database::setConfigValueByName(const QString &name, const QString &value)
 {
 	drawdance::Query query = d->db.queryWithoutLock();
-	query.exec("insert or replace into settings values (?, ?)", {name, value});
+	if(query.exec(
+		   "insert or replace into settings values (?, ?)", {name, value})) {
+		if(d->settingsCached) {
+			d->settings.insert(name, value);
+		}
+	} else {
+		d->settingsCached = false;
+	}
 }
 
 QString Database::getConfigValue(const ConfigKey key, bool &found) const
@@ -154,17 +205,92 @@ QString Database::getConfigValue(const ConfigKey key, bool &found) const
 
 QString Database::getConfigValueByName(const QString &name, bool &found) const
 {
-	drawdance::Query query = d->db.queryWithoutLock();
-	if(query.exec("select value from settings where key = ?", {name}) &&
-	   query.next()) {
-		found = true;
-		return query.columnText16(0);
-	} else {
+	cacheSettings();
+	QHash<QString, QString>::const_iterator it = d->settings.constFind(name);
+	if(it == d->settings.constEnd()) {
 		found = false;
 		return QString();
+	} else {
+		found = true;
+		return it.value();
+	}
+}
+
+void Database::cacheSettings() const
+{
+	if(!d->settingsCached) {
+		d->settings.clear();
+		drawdance::Query query = d->db.queryWithoutLock();
+		if(query.exec("select key, value from settings")) {
+			while(query.next()) {
+				d->settings.insert(
+					query.columnText16(0), query.columnText16(1));
+			}
+			d->settingsCached = true;
+		}
 	}
 }
 
+void Database::cacheBans() const
+{
+	if(d->bansCached) {
+		return;
+	}
+
+	d->ipBans.clear();
+	d->ipBanTree.clear();
+	d->unindexedIpBans.clear();
+	d->systemBans.clear();
+	d->userBans.clear();
+	drawdance::Query query = d->db.queryWithoutLock();
+	if(!query.exec("select rowid, ip, subnet, expires from ipbans "
+				   "order by rowid")) {
+		return;
+	}
+	while(query.next()) {
+		CachedIpBan ban = {
+			query.columnInt(0), QHostAddress(query.columnText16(1)),
+			query.columnInt(2), query.columnText16(3)};
+		Q_IPV6ADDR prefix;
+		int length;
+		if(bannedAddressToPrefix(ban.ip, ban.subnet, prefix, length)) {
+			d->ipBanTree.insertPrefix(prefix, length, d->ipBans.size());
+		} else {
+			d->unindexedIpBans.append(d->ipBans.size());
+		}
+		d->ipBans.append(ban);
+	}
+
+	if(!query.exec("select id, sid, reaction, expires, reason "
+				   "from systembans order by id")) {
+		return;
+	}
+	while(query.next()) {
+		d->systemBans[query.columnText16(1)].append(
+			{query.columnInt(0), parseReaction(query.columnText16(2)),
+			 query.columnText16(3), query.columnText16(4)});
+	}
+
+	if(!query.exec("select id, userid, reaction, expires, reason "
+				   "from userbans order by id")) {
+		return;
+	}
+	while(query.next()) {
+		d->userBans[query.columnInt64(1)].append(
+			{query.columnInt(0), parseReaction(query.columnText16(2)),
+			 query.columnText16(3), query.columnText16(4)});
+	}
+
+	d->bansCached = true;
+}
+
+// Same as datetime('now') in SQLite, which the expiry used to be compared to.
+static QString currentUtcDateTimeString()
+{
+	return QDateTime::currentDateTimeUtc().toString(
+		QStringLiteral("yyyy-MM-dd HH:mm:ss"));
+}
+
 bool Database::isAllowedAnnouncementUrl(const QUrl &url) const
 {
 	if(!url.isValid()) {
@@ -233,23 +359,34 @@ void Database::updateListServerWhitelist(const QStringList &whitelist)
 
 BanResult Database::isAddressBanned(const QHostAddress &addr) const
 {
-	drawdance::Query query = d->db.queryWithoutLock();
-	if(query.exec("select rowid, ip, subnet, expires from ipbans "
-				  "where expires > datetime('now')")) {
-		while(query.next()) {
-			QHostAddress ip(query.columnText16(1));
-			int subnet = query.columnInt(2);
-			if(matchesBannedAddress(addr, ip, subnet)) {
-				return {
-					BanReaction::NormalBan,
-					QString(),
-					parseDateTime(query.columnText16(3)),
-					addr.toString(),
-					QStringLiteral("database"),
-					QStringLiteral("IP"),
-					query.columnInt(0),
-					true};
-			}
+	cacheBans();
+	QVector<int> candidates;
+	if(!addr.isNull()) {
+		d->ipBanTree.lookup(IpPrefixTree::normalize(addr), candidates);
+	}
+	for(int i : d->unindexedIpBans) {
+		const CachedIpBan &ban = d->ipBans[i];
+		if(matchesBannedAddress(addr, ban.ip, ban.subnet)) {
+			candidates.append(i);
+		}
+	}
+	// Same order as the table, so the same ban wins as it always has.
+	std::sort(candidates.begin(), candidates.end());
+
+	QString now = currentUtcDateTimeString();
+	for(int i : candidates) {
+		const CachedIpBan &ban = d->ipBans[i];
+		if(ban.expires > now) {
+			++d->ipBanHits[ban.id];
+			return {
+				BanReaction::NormalBan,
+				QString(),
+				parseDateTime(ban.expires),
+				addr.toString(),
+				QStringLiteral("database"),
+				QStringLiteral("IP"),
+				ban.id,
+				true};
 		}
 	}
 	return ServerConfig::isAddressBanned(addr);
@@ -257,50 +394,42 @@ BanResult Database::isAddressBanned(const QHostAddress &addr) const
 
 BanResult Database::isSystemBanned(const QString &sid) const
 {
-	drawdance::Query query = d->db.queryWithoutLock();
-	bool ok = query.exec(
-		"select id, reaction, expires, reason from systembans "
-		"where sid = ? and expires > datetime('now') limit 1",
-		{sid});
-	if(ok && query.next()) {
-		int id = query.columnInt64(0);
-		BanReaction reaction = parseReaction(query.columnText16(1));
-		QDateTime expires = parseDateTime(query.columnText16(2));
-		QString reason = query.columnText16(3);
-		return {
-			reaction,
-			reason,
-			expires,
-			sid,
-			QStringLiteral("database"),
-			QStringLiteral("SID"),
-			id,
-			false};
+	cacheBans();
+	QString now = currentUtcDateTimeString();
+	for(const CachedBan &ban : d->systemBans.value(sid)) {
+		if(ban.expires > now) {
+			++d->systemBanHits[ban.id];
+			return {
+				ban.reaction,
+				ban.reason,
+				parseDateTime(ban.expires),
+				sid,
+				QStringLiteral("database"),
+				QStringLiteral("SID"),
+				ban.id,
+				false};
+		}
 	}
 	return ServerConfig::isSystemBanned(sid);
 }
 
 BanResult Database::isUserBanned(long long userId) const
 {
-	drawdance::Query query = d->db.queryWithoutLock();
-	bool ok = query.exec(
-		"select id, reaction, expires, reason from userbans "
-		"where userid = ? and expires > datetime('now') limit 1",
-		{userId});
-	if(ok && query.next()) {
-		int id = query.columnInt64(0);
-		BanReaction reaction = parseReaction(query.columnText16(1));
-		QDateTime expires = parseDateTime(query.columnText16(2));
-		QString reason = query.columnText16(3);
-		return {
-			reaction,
-			reason,
-			expires,
-			QString::number(userId),
-			QStringLiteral("database"),
-			QStringLiteral("User"),
-			id,
-			false};
+	cacheBans();
+	QString now = currentUtcDateTimeString();
+	for(const CachedBan &ban : d->userBans.value(userId)) {
+		if(ban.expires > now) {
+			++d->userBanHits[ban.id];
+			return {
+				ban.reaction,
+				ban.reason,
+				parseDateTime(ban.expires),
+				QString::number(userId),
+				QStringLiteral("database"),
+				QStringLiteral("User"),
+				ban.id,
+				false};
+		}
 	}
 	return ServerConfig::isUserBanned(userId);
 }
@@ -312,7 +441,10 @@ QJsonArray Database::getIpBanlist() const
 	bool ok = query.exec(
 		"select rowid, ip, subnet, expires, comment, added from ipbans");
 	while(ok && query.next()) {
-		result.append(ipBanResultToJson(query));
+		QJsonObject ban = ipBanResultToJson(query);
+		ban[QStringLiteral("hits")] =
+			double(d->ipBanHits.value(query.columnInt(0)));
+		result.append(ban);
 	}
 	return result;
 }
@@ -324,7 +456,10 @@ QJsonArray Database::getSystemBanlist() const
 	bool ok = query.exec("select id, sid, expires, reaction, reason, comment, "
 						 "added from systembans order by id asc");
 	while(ok && query.next()) {
-		result.append(systemBanResultToJson(query));
+		QJsonObject ban = systemBanResultToJson(query);
+		ban[QStringLiteral("hits")] =
+			double(d->systemBanHits.value(query.columnInt(0)));
+		result.append(ban);
 	}
 	return result;
 }
@@ -336,7 +471,10 @@ QJsonArray Database::getUserBanlist() const
 	bool ok = query.exec("select id, userid, expires, reaction, reason, "
 						 "comment, added from userbans order by id asc");
 	while(ok && query.next()) {
-		result.append(userBanResultToJson(query));
+		QJsonObject ban = userBanResultToJson(query);
+		ban[QStringLiteral("hits")] =
+			double(d->userBanHits.value(query.columnInt(0)));
+		result.append(ban);
 	}
 	return result;
 }
@@ -345,6 +483,7 @@ QJsonObject Database::addIpBan(
 	const QHostAddress &ip, int subnet, const QDateTime &expiration,
 	const QString &comment)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	QString ipstr = ip.toString();
 	if(!query.exec(
@@ -383,6 +522,7 @@ QJsonObject Database::addSystemBan(
 	const QString &sid, const QDateTime &expires, BanReaction reaction,
 	const QString &reason, const QString &comment)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	QString expiresString = formatDateTime(expires);
 	QString addedString = formatDateTime(QDateTime::currentDateTime());
@@ -412,6 +552,7 @@ QJsonObject Database::addUserBan(
 	long long userId, const QDateTime &expires, BanReaction reaction,
 	const QString &reason, const QString &comment)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	QString expiresString = formatDateTime(expires);
 	QString addedString = formatDateTime(QDateTime::currentDateTime());
@@ -439,6 +580,7 @@ QJsonObject Database::addUserBan(
 
 bool Database::deleteIpBan(int entryId)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	return query.exec("delete from ipbans where rowid = ?", {entryId}) &&
 		   query.numRowsAffected() > 0;
@@ -446,6 +588,7 @@ bool Database::deleteIpBan(int entryId)
 
 bool Database::deleteSystemBan(int entryId)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	return query.exec("delete from systembans where id = ?", {entryId}) &&
 		   query.numRowsAffected() > 0;
@@ -453,6 +596,7 @@ bool Database::deleteSystemBan(int entryId)
 
 bool Database::deleteUserBan(int entryId)
 {
+	d->bansCached = false;
 	drawdance::Query query = d->db.queryWithoutLock();
 	return query.exec("delete from userbans where id = ?", {entryId}) &&
 		   query.numRowsAffected() > 0;
@@ -496,6 +640,52 @@ QJsonObject Database::userBanResultToJson(const drawdance::Query &query)
 	});
 }
 
+void Database::setClusterNodeSessions(
+	const QString &nodeUrl, const QVector<ClusterSession> &sessions)
+{
+	d->db.txWithoutLock([&nodeUrl, &sessions](drawdance::Query &query) {
+		if(!query.exec(
+			   "delete from clustersessions where node = ?", {nodeUrl})) {
+			return false;
+		}
+
+		if(!sessions.isEmpty()) {
+			if(!query.prepare("insert into clustersessions "
+							  "(node, id, alias, updated) "
+							  "values (?, ?, ?, strftime('%s', 'now'))")) {
+				return false;
+			}
+			for(const ClusterSession &cs : sessions) {
+				if(!query.bind(0, nodeUrl) || !query.bind(1, cs.id) ||
+				   !query.bind(2, cs.alias) || !query.execPrepared()) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	});
+}
+
+QString Database::getClusterSessionNodeUrl(
+	const QString &idOrAlias, const QString &ownNodeUrl) const
+{
+	// Nodes refresh their entries periodically, anything that hasn't been
+	// touched in a while belongs to a node that went away without cleaning up.
+	drawdance::Query query = d->db.queryWithoutLock();
+	if(query.exec(
+		   "select node from clustersessions "
+		   "where (id = ?1 or alias = ?1) and node <> ?2 "
+		   "and updated > strftime('%s', 'now') - ?3 "
+		   "order by updated desc limit 1",
+		   {idOrAlias, ownNodeUrl, CLUSTER_SESSION_EXPIRY_SECS}) &&
+	   query.next()) {
+		return query.columnText16(0);
+	} else {
+		return QString();
+	}
+}
+
 ServerLog *Database::logger() const
 {
 	if(d->dblog) {
@@ -505,8 +695,8 @@ ServerLog *Database::logger() const
 	}
 }
 
-RegisteredUser
-Database::getUserAccount(const QString &username, const QString &password) const
+RegisteredUser Database::findUserAccount(
+	const QString &username, QByteArray &outPasswordHash) const
 {
 	drawdance::Query query = d->db.queryWithoutLock();
 	if(query.exec(
@@ -515,7 +705,6 @@ Database::getUserAccount(const QString &username, const QString &password) const
 		   {username}) &&
 	   query.next()) {
 		int rowid = query.columnInt(0);
-		QByteArray passwordHash = query.columnBlob(1);
 		int locked = query.columnInt(2);
 		QStringList flags =
 			query.columnText16(3).split(',', compat::SkipEmptyParts);
@@ -525,11 +714,7 @@ Database::getUserAccount(const QString &username, const QString &password) const
 				RegisteredUser::Banned, username, QStringList(), QString()};
 		}
 
-		if(!passwordhash::check(password, passwordHash)) {
-			return RegisteredUser{
-				RegisteredUser::BadPass, username, QStringList(), QString()};
-		}
-
+		outPasswordHash = query.columnBlob(1);
 		return RegisteredUser{
 			RegisteredUser::Ok, username, flags, QString::number(rowid)};
 	} else {
@@ -575,6 +760,7 @@ bool Database::checkAdminSectionLockPassword(const QString &password) const
 bool Database::setAdminSectionsLocked(
 	const QSet<QString> &sections, const QString &password)
 {
+	d->settingsCached = false;
 	return d->db.txWithoutLock([&sections, &password](drawdance::Query &query) {
 		if(!query.exec(
 			   "delete from settings where instr(key, '_lock_admin_') = 1")) {
@@ -705,6 +891,9 @@ bool Database::deleteAccount(int userId)
 
 void Database::dailyTasks()
 {
+	d->bansCached = false;
+	d->settingsCached = false;
+
 	// Purge old Database log entries
 	if(d->dblog) {
 		int purged = d->dblog->purgeLogs(getConfigInt(config::LogPurgeDays));
@@ -27,8 +27,8 @@ public:
 	BanResult isAddressBanned(const QHostAddress &addr) const override;
 	BanResult isSystemBanned(const QString &sid) const override;
 	BanResult isUserBanned(long long userId) const override;
-	RegisteredUser getUserAccount(
-		const QString &username, const QString &password) const override;
+	RegisteredUser findUserAccount(
+		const QString &username, QByteArray &outPasswordHash) const override;
 	bool hasAnyUserAccounts() const override;
 	bool supportsAdminSectionLocks() const override;
 	bool isAdminSectionLocked(const QString &section) const override;
@@ -37,6 +37,12 @@ public:
 		const QSet<QString> &sections, const QString &password) override;
 	ServerLog *logger() const override;
 
+	void setClusterNodeSessions(
+		const QString &nodeUrl,
+		const QVector<ClusterSession> &sessions) override;
+	QString getClusterSessionNodeUrl(
+		const QString &idOrAlias, const QString &ownNodeUrl) const override;
+
 	//! Get the list server URL whitelist
 	QStringList listServerWhitelist() const;
 
@@ -76,8 +82,12 @@ protected:
 	void setConfigValue(ConfigKey key, const QString &value) override;
 
 private:
+	static constexpr int CLUSTER_SESSION_EXPIRY_SECS = 120;
+
 	QString getConfigValueByName(const QString &name, bool &found) const;
 	void setConfigValueByName(const QString &name, const QString &value);
+	void cacheSettings() const;
+	void cacheBans() const;
 
 	static QJsonObject ipBanResultToJson(const drawdance::Query &query);
 	static QJsonObject systemBanResultToJson(const drawdance::Query &query);
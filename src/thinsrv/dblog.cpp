@@ -1,33 +1,74 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "thinsrv/dblog.h"
 #include <QMetaEnum>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
 #include <dpdb/sql_qt.h>
 
 namespace server {
 
 struct DbLog::Private {
+	explicit Private(drawdance::Database &database)
+		: db(database)
+	{
+	}
+
 	drawdance::Database &db;
-	drawdance::Query query;
+	drawdance::Database writerDb;
+	QThread *thread = nullptr;
+	QMutex mutex;
+	QWaitCondition workAvailable;
+	QWaitCondition workDone;
+	QVector<Log> queue;
+	bool writing = false;
+	bool flushRequested = false;
+	bool quit = false;
 };
 
 DbLog::DbLog(drawdance::Database &db)
-	: d(new Private{db, db.queryWithoutLock()})
+	: d(new Private(db))
 {
 }
 
 DbLog::~DbLog()
 {
+	if(d->thread) {
+		{
+			QMutexLocker locker(&d->mutex);
+			d->quit = true;
+			d->workAvailable.wakeOne();
+		}
+		d->thread->wait();
+		delete d->thread;
+	}
 	delete d;
 }
 
-bool DbLog::initDb()
+bool DbLog::initDb(const QString &path)
 {
-	return d->query.exec("create table if not exists serverlog ("
-						 "timestamp, level, topic, user, session, message)") &&
-		   d->query.prepare(
-			   "insert into serverlog (timestamp, level, topic, user, "
-			   "session, message) values (?, ?, ?, ?, ?, ?)",
-			   drawdance::Database::PREPARE_PERSISTENT);
+	drawdance::Query query = d->db.queryWithoutLock();
+	if(!query.exec("create table if not exists serverlog ("
+				   "timestamp, level, topic, user, session, message)")) {
+		return false;
+	}
+
+	// The main thread may be writing to the database at the same time, so
+	// wait for its lock instead of failing right away.
+	if(!d->writerDb.open(path, QStringLiteral("server log"))) {
+		return false;
+	}
+	drawdance::Query writerQuery = d->writerDb.queryWithoutLock();
+	if(!writerQuery.exec("pragma busy_timeout = 5000")) {
+		return false;
+	}
+
+	d->thread = QThread::create([this] {
+		run();
+	});
+	d->thread->start();
+	return true;
 }
 
 QList<Log> DbLog::getLogEntries(
@@ -85,6 +126,7 @@ QList<Log> DbLog::getLogEntries(
 		params.append(offset);
 	}
 
+	flush();
 	QList<Log> results;
 	drawdance::Query query = d->db.queryWithoutLock();
 	if(query.exec(sql, params)) {
@@ -103,19 +145,95 @@ QList<Log> DbLog::getLogEntries(
 
 void DbLog::storeMessage(const Log &entry)
 {
-	d->query.bind(0, entry.timestamp().toString(Qt::ISODate));
-	d->query.bind(1, int(entry.level()));
-	d->query.bind(
-		2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
-	d->query.bind(3, entry.user());
-	d->query.bind(4, entry.session());
-	d->query.bind(5, entry.message());
-	d->query.execPrepared();
+	QMutexLocker locker(&d->mutex);
+	while(d->queue.size() >= MAX_QUEUED_ENTRIES) {
+		// The disk isn't keeping up, hold off until it does.
+		d->workAvailable.wakeOne();
+		d->workDone.wait(&d->mutex);
+	}
+	d->queue.append(entry);
+	if(d->queue.size() >= BATCH_SIZE) {
+		d->workAvailable.wakeOne();
+	}
+}
+
+void DbLog::flush() const
+{
+	QMutexLocker locker(&d->mutex);
+	if(!d->queue.isEmpty()) {
+		d->flushRequested = true;
+		d->workAvailable.wakeOne();
+	}
+	while(d->writing || !d->queue.isEmpty()) {
+		d->workDone.wait(&d->mutex);
+	}
+}
+
+void DbLog::run()
+{
+	drawdance::Query query = d->writerDb.queryWithoutLock();
+	bool prepared = query.prepare(
+		"insert into serverlog (timestamp, level, topic, user, "
+		"session, message) values (?, ?, ?, ?, ?, ?)",
+		drawdance::Database::PREPARE_PERSISTENT);
+	if(!prepared) {
+		qWarning("Couldn't prepare server log insert statement");
+	}
+
+	// Starting a transaction runs statements of its own, so it needs a query
+	// separate from the prepared insert.
+	drawdance::Query txQuery = d->writerDb.queryWithoutLock();
+	QMetaEnum topics = QMetaEnum::fromType<Log::Topic>();
+	QMutexLocker locker(&d->mutex);
+	while(!d->quit || !d->queue.isEmpty()) {
+		// Let entries pile up for a bit so that they share a transaction.
+		while(!d->quit && !d->flushRequested &&
+			  d->queue.size() < BATCH_SIZE) {
+			if(!d->workAvailable.wait(&d->mutex, BATCH_DELAY_MSECS)) {
+				break;
+			}
+		}
+
+		if(d->queue.isEmpty()) {
+			continue;
+		}
+
+		QVector<Log> batch;
+		batch.swap(d->queue);
+		d->flushRequested = false;
+		d->writing = true;
+		locker.unlock();
+
+		bool ok = prepared && txQuery.tx([&] {
+			for(const Log &entry : batch) {
+				bool inserted =
+					query.bind(0, entry.timestamp().toString(Qt::ISODate)) &&
+					query.bind(1, int(entry.level())) &&
+					query.bind(2, topics.valueToKey(int(entry.topic()))) &&
+					query.bind(3, entry.user()) &&
+					query.bind(4, entry.session()) &&
+					query.bind(5, entry.message()) && query.execPrepared();
+				if(!inserted) {
+					return false;
+				}
+			}
+			return true;
+		});
+		if(!ok) {
+			qWarning(
+				"Error writing %d server log entries", int(batch.size()));
+		}
+
+		locker.relock();
+		d->writing = false;
+		d->workDone.wakeAll();
+	}
 }
 
 int DbLog::purgeLogs(int olderThanDays)
 {
 	if(olderThanDays > 0) {
+		flush();
 		drawdance::Query query = d->db.queryWithoutLock();
 		if(query.exec(
 			   "delete from serverlog where timestamp < date('now', ?)",
@@ -9,12 +9,21 @@ class Database;
 
 namespace server {
 
+/**
+ * @brief Server log stored in the configuration database
+ *
+ * Entries are written by a thread of their own, using a separate connection
+ * to the database file. They're gathered up and inserted in one transaction
+ * per batch, either once enough of them have piled up or after a short delay.
+ * Reading or purging the log first waits for pending entries to be written.
+ */
 class DbLog final : public ServerLog {
 public:
 	explicit DbLog(drawdance::Database &db);
 	~DbLog() override;
 
-	bool initDb();
+	//! Create the log table and start the writer on the given database file.
+	bool initDb(const QString &path);
 
 	QList<Log> getLogEntries(
 		const QString &session, const QString &user,
@@ -33,6 +42,14 @@ protected:
 	void storeMessage(const Log &entry) override;
 
 private:
+	static constexpr int BATCH_SIZE = 256;
+	static constexpr int BATCH_DELAY_MSECS = 1000;
+	// Logging blocks when more than this many entries are waiting.
+	static constexpr int MAX_QUEUED_ENTRIES = 16 * BATCH_SIZE;
+
+	void flush() const;
+	void run();
+
 	struct Private;
 	Private *d;
 };
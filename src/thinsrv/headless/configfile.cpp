@@ -264,7 +264,7 @@ bool ConfigFile::isAllowedAnnouncementUrl(const QUrl &url) const
 	return m_announcewhitelist.contains(url);
 }
 
-RegisteredUser ConfigFile::getUserAccount(const QString &username, const QString &password) const
+RegisteredUser ConfigFile::findUserAccount(const QString &username, QByteArray &outPasswordHash) const
 {
 	if(m_users.contains(username)) {
 		const User &u = m_users[username];
@@ -276,14 +276,8 @@ RegisteredUser ConfigFile::getUserAccount(const QString &username, const QString
 				username
 			};
 
-		} else if(!passwordhash::check(password, u.password)) {
-			return RegisteredUser {
-				RegisteredUser::BadPass,
-				username,
-				QStringList(),
-				username
-			};
 		} else {
+			outPasswordHash = u.password;
 			return RegisteredUser {
 				RegisteredUser::Ok,
 				username,
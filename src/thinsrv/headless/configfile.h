@@ -45,7 +45,7 @@ public:
 	BanResult isAddressBanned(const QHostAddress &addr) const override;
 	BanResult isSystemBanned(const QString &sid) const override;
 	BanResult isUserBanned(long long userId) const override;
-	RegisteredUser getUserAccount(const QString &username, const QString &password) const override;
+	RegisteredUser findUserAccount(const QString &username, QByteArray &outPasswordHash) const override;
 	bool hasAnyUserAccounts() const override;
 
 	ServerLog *logger() const override { return m_logger; }
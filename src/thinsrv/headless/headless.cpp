@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "cmake-config/config.h"
 #include "libserver/inmemoryconfig.h"
+#include "libserver/profiler.h"
 #include "libserver/sslserver.h"
 #include "libshared/util/paths.h"
 #include "thinsrv/database.h"
@@ -306,6 +307,12 @@ bool start()
 		QStringList() << "report-url", "Abuse report handler URL", "url");
 	parser.addOption(reportUrlOption);
 
+	// --profile-trace <file>
+	QCommandLineOption profileTraceOption(
+		QStringList() << "profile-trace",
+		"Write a performance trace of the server's main thread", "file");
+	parser.addOption(profileTraceOption);
+
 	// Parse
 	parser.process(*QCoreApplication::instance());
 
@@ -426,6 +433,15 @@ bool start()
 
 	serverconfig->setInternalConfig(icfg);
 
+	if(parser.isSet(profileTraceOption)) {
+		if(!server::Profiler::openTrace(parser.value(profileTraceOption))) {
+			return false;
+		}
+		QObject::connect(
+			QCoreApplication::instance(), &QCoreApplication::aboutToQuit,
+			&server::Profiler::closeTrace);
+	}
+
 	// Initialize the server
 	std::unique_ptr<server::MultiServer> server(
 		new server::MultiServer(serverconfig.release()));
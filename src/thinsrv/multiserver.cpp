@@ -2,6 +2,7 @@
 #include "thinsrv/multiserver.h"
 #include "cmake-config/config.h"
 #include "libserver/jsonapi.h"
+#include "libserver/profiler.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/session.h"
@@ -58,6 +59,16 @@ MultiServer::MultiServer(ServerConfig *config, QObject *parent)
 	connect(
 		m_sessions, &SessionServer::sessionEnded, this,
 		&MultiServer::tryAutoStop);
+
+	// A timer that fires late means the event loop was busy with something
+	// else, which delays everything else the server does by the same amount.
+	QTimer *eventLoopLagTimer = new QTimer(this);
+	eventLoopLagTimer->setTimerType(Qt::PreciseTimer);
+	connect(
+		eventLoopLagTimer, &QTimer::timeout, this,
+		&MultiServer::measureEventLoopLag);
+	eventLoopLagTimer->start(EVENT_LOOP_LAG_INTERVAL_MSECS);
+	m_eventLoopLagTimer.start();
 	connect(m_sessions, &SessionServer::userCountChanged, [this](int users) {
 		printStatusUpdate();
 		emit userCountChanged(users);
@@ -323,6 +334,14 @@ void MultiServer::printStatusUpdate()
 							  .arg(m_sessions->sessionCount()));
 }
 
+void MultiServer::measureEventLoopLag()
+{
+	qint64 nsecs = m_eventLoopLagTimer.nsecsElapsed();
+	m_eventLoopLagTimer.restart();
+	m_eventLoopLag.observe(
+		nsecs - qint64(EVENT_LOOP_LAG_INTERVAL_MSECS) * 1000000LL);
+}
+
 /**
  * @brief Stop the server if vacant (and autostop is enabled)
  */
@@ -393,6 +412,8 @@ JsonApiResult MultiServer::callJsonApi(
 			&MultiServer::serverJsonApi);
 	} else if(head == QStringLiteral("status")) {
 		return statusJsonApi(method, tail, request);
+	} else if(head == QStringLiteral("profile")) {
+		return profileJsonApi(method, tail, request);
 	} else if(head == QStringLiteral("sessions")) {
 		return callJsonApiCheckLock(
 			method, tail, request, QStringLiteral("sessions"),
@@ -401,6 +422,10 @@ JsonApiResult MultiServer::callJsonApi(
 		return callJsonApiCheckLock(
 			method, tail, request, QStringLiteral("sessions"),
 			&MultiServer::usersJsonApi);
+	} else if(head == QStringLiteral("changes")) {
+		return callJsonApiCheckLock(
+			method, tail, request, QStringLiteral("sessions"),
+			&MultiServer::changesJsonApi);
 	} else if(head == QStringLiteral("banlist")) {
 		return callJsonApiCheckLock(
 			method, tail, request, QStringLiteral("bans"),
@@ -444,6 +469,24 @@ void MultiServer::callJsonApiAsync(
 	emit jsonApiResult(requestId, result);
 }
 
+QByteArray MultiServer::metricsText() const
+{
+	MetricsWriter w;
+	w.declare(
+		"drawpile_uptime_seconds", "gauge",
+		"Time since the server was started.");
+	w.sample(
+		"drawpile_uptime_seconds",
+		double(m_started.secsTo(QDateTime::currentDateTimeUtc())));
+	w.declare(
+		"drawpile_event_loop_lag_seconds", "histogram",
+		"How late timers on the main thread fire.");
+	w.histogram(
+		"drawpile_event_loop_lag_seconds", QByteArray(), m_eventLoopLag);
+	m_sessions->writeMetrics(w);
+	return w.text();
+}
+
 JsonApiResult MultiServer::callJsonApiCheckLock(
 	JsonApiMethod method, const QStringList &path, const QJsonObject &request,
 	const QString &section,
@@ -531,6 +574,17 @@ JsonApiResult MultiServer::serverJsonApi(
 		config::FilterNameRegex,
 		config::UnlistedHostPolicy,
 		config::MinimumAutoresetThreshold,
+		config::StreamCompression,
+		config::RecordingCommitInterval,
+		config::RecordingCommitSize,
+		config::ServerCanvas,
+		config::CatchupRate,
+		config::ClusterNodeUrl,
+		config::HibernateTime,
+		config::MessageBatching,
+		config::RecordingCompression,
+		config::DrawCostBudget,
+		config::HistoryCompression,
 	};
 	const int settingCount = sizeof(settings) / sizeof(settings[0]);
 
@@ -606,6 +660,28 @@ JsonApiResult MultiServer::statusJsonApi(
 	return JsonApiResult{JsonApiResult::Ok, QJsonDocument(result)};
 }
 
+JsonApiResult MultiServer::profileJsonApi(
+	JsonApiMethod method, const QStringList &path, const QJsonObject &request)
+{
+	if(!path.isEmpty()) {
+		return JsonApiNotFound();
+	}
+
+	if(method != JsonApiMethod::Get) {
+		return JsonApiBadMethod();
+	}
+
+	// Query parameters arrive as strings.
+	bool ok;
+	int top = request.value(QStringLiteral("top")).toString().toInt(&ok);
+	if(!ok || top <= 0) {
+		top = 10;
+	}
+
+	return JsonApiResult{
+		JsonApiResult::Ok, QJsonDocument(Profiler::reportToJson(top))};
+}
+
 JsonApiResult MultiServer::sessionsJsonApi(
 	JsonApiMethod method, const QStringList &path, const QJsonObject &request,
 	bool sectionLocked)
@@ -620,6 +696,14 @@ JsonApiResult MultiServer::usersJsonApi(
 	return m_sessions->callUserJsonApi(method, path, request, sectionLocked);
 }
 
+JsonApiResult MultiServer::changesJsonApi(
+	JsonApiMethod method, const QStringList &path, const QJsonObject &request,
+	bool sectionLocked)
+{
+	return m_sessions->callChangesJsonApi(
+		method, path, request, sectionLocked);
+}
+
 JsonApiResult MultiServer::banlistJsonApi(
 	JsonApiMethod method, const QStringList &path, const QJsonObject &request,
 	bool sectionLocked)
@@ -2,8 +2,10 @@
 #ifndef THINSRV_MULTISERVER_H
 #define THINSRV_MULTISERVER_H
 #include "libserver/jsonapi.h"
+#include "libserver/metrics.h"
 #include "libserver/sslserver.h"
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QHostAddress>
 #include <QObject>
 
@@ -90,6 +92,13 @@ public slots:
 		const QString &requestId, JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request);
 
+	/**
+	 * @brief Get server metrics in the Prometheus text format
+	 *
+	 * This is used by the HTTP admin API's metrics endpoint.
+	 */
+	Q_INVOKABLE QByteArray metricsText() const;
+
 private slots:
 	void newTcpClient();
 #ifdef HAVE_WEBSOCKETS
@@ -97,6 +106,7 @@ private slots:
 #endif
 	void printStatusUpdate();
 	void tryAutoStop();
+	void measureEventLoopLag();
 
 	/**
 	 * @brief Assign a recording file name to a new session
@@ -129,6 +139,7 @@ signals:
 
 private:
 	enum State { RUNNING, STOPPING, STOPPED };
+	static constexpr int EVENT_LOOP_LAG_INTERVAL_MSECS = 250;
 
 	bool createServer();
 	bool createServer(bool enableWebSockets);
@@ -150,12 +161,18 @@ private:
 	JsonApiResult statusJsonApi(
 		JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request);
+	JsonApiResult profileJsonApi(
+		JsonApiMethod method, const QStringList &path,
+		const QJsonObject &request);
 	JsonApiResult sessionsJsonApi(
 		JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request, bool sectionLocked);
 	JsonApiResult usersJsonApi(
 		JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request, bool sectionLocked);
+	JsonApiResult changesJsonApi(
+		JsonApiMethod method, const QStringList &path,
+		const QJsonObject &request, bool sectionLocked);
 	JsonApiResult banlistJsonApi(
 		JsonApiMethod method, const QStringList &path,
 		const QJsonObject &request, bool sectionLocked);
@@ -196,6 +213,8 @@ private:
 	SslServer::Algorithm m_sslKeyAlgorithm;
 	QString m_recordingPath;
 	QDateTime m_started;
+	QElapsedTimer m_eventLoopLagTimer;
+	MetricsHistogram m_eventLoopLag;
 };
 
 }
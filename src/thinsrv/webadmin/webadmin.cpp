@@ -38,6 +38,21 @@ void Webadmin::setAllowedOrigin(const QString &allowedOrigin)
 
 void Webadmin::setSessions(MultiServer *server)
 {
+	m_server->addRequestHandler("^/metrics$", [server](const HttpRequest &req) {
+		if(req.method() != HttpRequest::HEAD && req.method() != HttpRequest::GET)
+			return HttpResponse::MethodNotAllowed(QStringList() << "HEAD" << "GET");
+
+		QByteArray text;
+		QMetaObject::invokeMethod(
+			server, "metricsText", Qt::BlockingQueuedConnection,
+			Q_RETURN_ARG(QByteArray, text)
+			);
+
+		HttpResponse r(200, text);
+		r.setHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+		return r;
+	});
+
 	m_server->addRequestHandler("^/api/(.*)", [server](const HttpRequest &req) {
 		JsonApiMethod m;
 		switch(req.method()) {
@@ -188,7 +188,9 @@ pub extern "C" fn dprectool_main() -> c_int {
         optional --msg-freq
         /// Print information about which users were part of the recordings.
         optional -u,--users
-        /// Input recording file.
+        /// Input recording file. Server session recordings are read together
+        /// with the .blocks file next to them, if there is one, so converting
+        /// such a recording gives a plain one with all of its history.
         optional input: String
     };
 
@@ -1,17 +1,29 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
-use anyhow::Result;
+mod serve;
+
+use anyhow::{anyhow, Result};
 use drawdance::{
-    common::Perf,
+    common::{Perf, PerfSection},
     dp_cmake_config_version,
-    engine::{BaseCanvasState, CanvasState, DrawContext, Image, PaintEngine, Player},
-    Interpolation, DP_PLAYER_TYPE_GUESS, DP_PROTOCOL_VERSION, DP_SAVE_IMAGE_ORA,
-    DP_SAVE_IMAGE_PROJECT_CANVAS, DP_SAVE_IMAGE_PSD,
+    engine::{
+        BaseCanvasState, CanvasState, DetachedCanvasState, DrawContext, Image, PaintEngine, Player,
+    },
+    Interpolation, DP_PLAYER_REPLAY_STEP_MESSAGES, DP_PLAYER_REPLAY_STEP_NONE,
+    DP_PLAYER_REPLAY_STEP_UNDO_POINTS, DP_PLAYER_TYPE_GUESS, DP_PROTOCOL_VERSION,
+    DP_SAVE_IMAGE_JPEG, DP_SAVE_IMAGE_ORA, DP_SAVE_IMAGE_PNG, DP_SAVE_IMAGE_PROJECT_CANVAS,
+    DP_SAVE_IMAGE_PSD,
 };
 use std::{
     ffi::{c_int, CStr, OsStr},
     fs::metadata,
     path::Path,
     str::FromStr,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        mpsc::{sync_channel, Receiver},
+        Mutex,
+    },
+    thread,
 };
 
 #[derive(Copy, Clone, Debug)]
@@ -68,6 +80,24 @@ impl OutputFormat {
     fn supports_scaling(self) -> bool {
         !matches!(self, Self::Dpcs | Self::Ora | Self::Psd)
     }
+
+    fn from_extension(path: &str) -> Option<Self> {
+        let ext = Path::new(path)
+            .extension()?
+            .to_string_lossy()
+            .to_lowercase();
+        match ext.as_str() {
+            "dpcs" => Some(Self::Dpcs),
+            "ora" => Some(Self::Ora),
+            "psd" => Some(Self::Psd),
+            "png" => Some(Self::Png),
+            "jpg" => Some(Self::Jpg),
+            "jpeg" => Some(Self::Jpeg),
+            "webp" => Some(Self::Webp),
+            "qoi" => Some(Self::Qoi),
+            _ => None,
+        }
+    }
 }
 
 impl FromStr for OutputFormat {
@@ -134,6 +164,17 @@ pub extern "C" fn drawpile_cmd_main() -> c_int {
         /// that they didn't have permission to draw on. The Drawpile client
         /// would also filter these out when playing back a recording.
         optional -A,--acl
+        /// Replay recordings in batch mode. This skips the paint engine with
+        /// its rendering and playback handling and just applies the messages to
+        /// the canvas as fast as possible, which is a lot quicker. The output
+        /// is the canvas itself, so local changes like hidden layers that the
+        /// Drawpile client would apply aren't included.
+        optional -b,--batch
+        /// Number of threads that flatten and save images in batch mode while
+        /// the replay keeps going. Defaults to the number of CPU cores. Passing
+        /// 0 saves the images on the replay thread instead. Only has an effect
+        /// together with -b/--batch.
+        optional -j,--jobs jobs: usize
         /// Maximum image size. Any images larger than this will be scaled down,
         /// retaining the aspect ratio. This option is not supported for the
         /// dpcs, ora and psd output formats.
@@ -148,6 +189,19 @@ pub extern "C" fn drawpile_cmd_main() -> c_int {
         /// default), 'bilinear', 'bicubic', 'experimental', 'nearest', 'area',
         /// 'bicublin', 'gauss', 'sinc', 'lanczos' or 'spline'.
         optional -I,--interpolation interpolation: Interpolation
+        /// Run as a render service instead of converting the given inputs.
+        /// Requests are read from stdin, one per line, as tab-separated
+        /// key=value fields: 'in' and 'out' paths (required), 'id' (echoed in
+        /// the response), 'format', 'crop' as X,Y,WIDTH,HEIGHT, 'maxsize' as
+        /// WIDTHxHEIGHT, 'fixed' and 'recording' as 0 or 1 and
+        /// 'interpolation'. Inputs ending in .dprec or .dptxt are replayed as
+        /// recordings unless 'recording' says otherwise. Each request gets a
+        /// response line on stdout, either 'ok' or 'error' with a 'message'.
+        /// Loaded canvases stay cached until their file changes.
+        optional --serve
+        /// Number of loaded canvases to keep cached with --serve. Defaults to
+        /// 8. Passing 0 disables the cache.
+        optional --cache-size cache_size: usize
         /// Input image file. Mutually exclusive with passing recording input
         /// files.
         optional -i,--image image: String
@@ -171,6 +225,20 @@ pub extern "C" fn drawpile_cmd_main() -> c_int {
         eprintln!("Warning: -a/--merge-annotations has no effect");
     }
 
+    if flags.serve {
+        if !flags.input.is_empty() || flags.image.is_some() {
+            eprintln!("--serve takes its inputs from requests, not the command line");
+            return 2;
+        }
+        return match serve::serve(flags.cache_size.unwrap_or(8), !flags.acl) {
+            Ok(_) => 0,
+            Err(e) => {
+                eprintln!("{}", e);
+                1
+            }
+        };
+    }
+
     let (every, steps) = if flags.every_seq.is_some() && flags.every_msg.is_some() {
         eprintln!("-e/--every-seq and -m/--every-msg are mutually incompatible");
         return 2;
@@ -250,24 +318,14 @@ pub extern "C" fn drawpile_cmd_main() -> c_int {
     };
 
     if format == OutputFormat::Guess {
-        format = if let Some(ext) = Path::new(&pre_out_pattern)
+        format = if let Some(guessed) = OutputFormat::from_extension(&pre_out_pattern) {
+            guessed
+        } else if let Some(ext) = Path::new(&pre_out_pattern)
             .extension()
             .map(OsStr::to_string_lossy)
         {
-            match ext.to_lowercase().as_str() {
-                "dpcs" => OutputFormat::Dpcs,
-                "ora" => OutputFormat::Ora,
-                "psd" => OutputFormat::Psd,
-                "png" => OutputFormat::Png,
-                "jpg" => OutputFormat::Jpg,
-                "jpeg" => OutputFormat::Jpeg,
-                "webp" => OutputFormat::Webp,
-                "qoi" => OutputFormat::Qoi,
-                _ => {
-                    eprintln!("Can't guess output format for extension '.{}'", ext);
-                    return 2;
-                }
-            }
+            eprintln!("Can't guess output format for extension '.{}'", ext);
+            return 2;
         } else {
             eprintln!("Can't guess output format from '{}'", pre_out_pattern);
             return 2;
@@ -311,8 +369,19 @@ pub extern "C" fn drawpile_cmd_main() -> c_int {
 
         let acl_override = !flags.acl;
 
+        let batch_jobs = if flags.batch {
+            Some(
+                flags
+                    .jobs
+                    .unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get())),
+            )
+        } else {
+            None
+        };
+
         dump_recordings(
             &input_paths,
+            batch_jobs,
             acl_override,
             every,
             steps,
@@ -352,18 +421,50 @@ fn dump_image(
 ) -> Result<()> {
     let mut dc = DrawContext::default();
     let cs = CanvasState::new_load(&mut dc, in_path)?;
+    save_canvas_state(
+        &cs,
+        &mut dc,
+        max_size,
+        fixed_size,
+        format,
+        interpolation,
+        out_path,
+    )
+}
+
+fn save_canvas_state(
+    cs: &CanvasState,
+    dc: &mut DrawContext,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    format: OutputFormat,
+    interpolation: Interpolation,
+    out_path: String,
+) -> Result<()> {
     match format {
-        OutputFormat::Dpcs => cs.save(&mut dc, DP_SAVE_IMAGE_PROJECT_CANVAS, out_path)?,
-        OutputFormat::Ora => cs.save(&mut dc, DP_SAVE_IMAGE_ORA, out_path)?,
-        OutputFormat::Psd => cs.save(&mut dc, DP_SAVE_IMAGE_PSD, out_path)?,
+        OutputFormat::Dpcs => cs.save(dc, DP_SAVE_IMAGE_PROJECT_CANVAS, out_path)?,
+        OutputFormat::Ora => cs.save(dc, DP_SAVE_IMAGE_ORA, out_path)?,
+        OutputFormat::Psd => cs.save(dc, DP_SAVE_IMAGE_PSD, out_path)?,
+        OutputFormat::Png | OutputFormat::Jpg | OutputFormat::Jpeg
+            if out_path != "-" && !needs_scaling(cs, max_size, fixed_size) =>
+        {
+            // Saving these directly flattens and encodes the canvas in strips,
+            // so it never has to be in memory all at once.
+            let save_type = if format == OutputFormat::Png {
+                DP_SAVE_IMAGE_PNG
+            } else {
+                DP_SAVE_IMAGE_JPEG
+            };
+            cs.save(dc, save_type, out_path)?
+        }
         OutputFormat::Png
         | OutputFormat::Jpg
         | OutputFormat::Jpeg
         | OutputFormat::Webp
         | OutputFormat::Qoi => {
             save_flat_image(
-                &cs,
-                &mut dc,
+                cs,
+                dc,
                 max_size,
                 fixed_size,
                 format,
@@ -376,6 +477,14 @@ fn dump_image(
     Ok(())
 }
 
+fn needs_scaling(cs: &CanvasState, max_size: Option<ImageSize>, fixed_size: bool) -> bool {
+    if let Some(ImageSize { width, height }) = max_size {
+        fixed_size || cs.width() as usize > width || cs.height() as usize > height
+    } else {
+        false
+    }
+}
+
 fn save_flat_image(
     cs: &CanvasState,
     dc: &mut DrawContext,
@@ -385,34 +494,39 @@ fn save_flat_image(
     interpolation: Interpolation,
     out_path: String,
 ) -> Result<()> {
-    let img = if let Some(ImageSize { width, height }) = max_size {
-        if fixed_size {
-            cs.to_flat_image()?.scaled(
-                width,
-                height,
-                true,
-                interpolation.to_scale_interpolation(),
-                dc,
-            )?
-        } else if cs.width() as usize <= width && cs.height() as usize <= height {
-            cs.to_flat_image()?
-        } else {
-            cs.to_flat_image()?.scaled(
+    let img = cs.to_flat_image()?;
+    match scale_image(&img, max_size, fixed_size, interpolation, dc)? {
+        Some(scaled) => write_image(&scaled, format, &out_path),
+        None => write_image(&img, format, &out_path),
+    }
+}
+
+// Returns None if the image can be used as-is.
+fn scale_image(
+    img: &Image,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    interpolation: Interpolation,
+    dc: &mut DrawContext,
+) -> Result<Option<Image>> {
+    if let Some(ImageSize { width, height }) = max_size {
+        if fixed_size || img.width() > width || img.height() > height {
+            let scaled = img.scaled(
                 width,
                 height,
-                false,
+                fixed_size,
                 interpolation.to_scale_interpolation(),
                 dc,
-            )?
+            )?;
+            return Ok(Some(scaled));
         }
-    } else {
-        cs.to_flat_image()?
-    };
-    write_image(&img, format, &out_path)
+    }
+    Ok(None)
 }
 
 fn dump_recordings(
     input_paths: &Vec<String>,
+    batch_jobs: Option<usize>,
     acl_override: bool,
     every: Every,
     steps: i64,
@@ -424,18 +538,34 @@ fn dump_recordings(
 ) -> Result<()> {
     let mut index = 1;
     for input_path in input_paths {
-        dump_recording(
-            &mut index,
-            input_path,
-            acl_override,
-            every,
-            steps,
-            max_size,
-            fixed_size,
-            format,
-            interpolation,
-            out_pattern,
-        )?;
+        if let Some(jobs) = batch_jobs {
+            dump_recording_batch(
+                &mut index,
+                input_path,
+                jobs,
+                acl_override,
+                every,
+                steps,
+                max_size,
+                fixed_size,
+                format,
+                interpolation,
+                out_pattern,
+            )?;
+        } else {
+            dump_recording(
+                &mut index,
+                input_path,
+                acl_override,
+                every,
+                steps,
+                max_size,
+                fixed_size,
+                format,
+                interpolation,
+                out_pattern,
+            )?;
+        }
     }
     Ok(())
 }
@@ -496,6 +626,138 @@ fn dump_recording(
     }
 }
 
+fn dump_recording_batch(
+    index: &mut i32,
+    input_path: &String,
+    jobs: usize,
+    acl_override: bool,
+    every: Every,
+    steps: i64,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    format: OutputFormat,
+    interpolation: Interpolation,
+    out_pattern: &str,
+) -> Result<()> {
+    let mut player = make_player(input_path).and_then(Player::check_compatible)?;
+    player.set_acl_override(acl_override);
+
+    let step = match every {
+        Every::None => DP_PLAYER_REPLAY_STEP_NONE,
+        Every::Message => DP_PLAYER_REPLAY_STEP_MESSAGES,
+        Every::UndoPoint => DP_PLAYER_REPLAY_STEP_UNDO_POINTS,
+    };
+
+    let mut dc = DrawContext::default();
+    if jobs == 0 {
+        let mut save_dc = DrawContext::default();
+        return player.replay(&mut dc, step, steps, |cs, _last| {
+            let path = out_pattern.replace(":idx:", &index.to_string());
+            *index += 1;
+            save_recording_canvas_state(
+                &cs,
+                &mut save_dc,
+                max_size,
+                fixed_size,
+                format,
+                interpolation,
+                path,
+            )
+        });
+    }
+
+    // Canvas states are cheap to hold on to, so the replay just hands them off
+    // and keeps going while the workers flatten and encode them. The channel
+    // is bounded so that a slow encoder doesn't pile up unlimited states.
+    let (sender, receiver) = sync_channel::<(String, DetachedCanvasState)>(jobs);
+    let receiver = Mutex::new(receiver);
+    let failed = AtomicBool::new(false);
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..jobs)
+            .map(|_| {
+                scope.spawn(|| {
+                    let result = save_recording_canvas_states(
+                        &receiver,
+                        max_size,
+                        fixed_size,
+                        format,
+                        interpolation,
+                    );
+                    if result.is_err() {
+                        failed.store(true, Ordering::Relaxed);
+                    }
+                    result
+                })
+            })
+            .collect();
+
+        let replay_result = player.replay(&mut dc, step, steps, |cs, _last| {
+            if failed.load(Ordering::Relaxed) {
+                return Err(anyhow!("Saving images failed"));
+            }
+            let path = out_pattern.replace(":idx:", &index.to_string());
+            *index += 1;
+            sender
+                .send((path, cs))
+                .map_err(|_| anyhow!("Saving images failed"))
+        });
+        drop(sender);
+
+        // An error from saving is more useful than the replay reporting that
+        // it had to stop because of it, so that takes precedence.
+        let mut save_result = Ok(());
+        for worker in workers {
+            let result = worker.join().unwrap();
+            if save_result.is_ok() {
+                save_result = result;
+            }
+        }
+        save_result.and(replay_result)
+    })
+}
+
+fn save_recording_canvas_states(
+    receiver: &Mutex<Receiver<(String, DetachedCanvasState)>>,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    format: OutputFormat,
+    interpolation: Interpolation,
+) -> Result<()> {
+    let mut dc = DrawContext::default();
+    loop {
+        let received = receiver.lock().unwrap().recv();
+        match received {
+            Ok((path, cs)) => save_recording_canvas_state(
+                &cs,
+                &mut dc,
+                max_size,
+                fixed_size,
+                format,
+                interpolation,
+                path,
+            )?,
+            Err(_) => return Ok(()), // Replay is done.
+        }
+    }
+}
+
+fn save_recording_canvas_state(
+    cs: &CanvasState,
+    dc: &mut DrawContext,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    format: OutputFormat,
+    interpolation: Interpolation,
+    path: String,
+) -> Result<()> {
+    let _section = PerfSection::begin(
+        CStr::from_bytes_with_nul(b"drawpilecmd\0").unwrap(),
+        CStr::from_bytes_with_nul(b"save\0").unwrap(),
+        &path,
+    );
+    save_canvas_state(cs, dc, max_size, fixed_size, format, interpolation, path)
+}
+
 fn make_player(input_path: &String) -> Result<Player> {
     if input_path == "-" {
         Player::new_from_stdin(DP_PLAYER_TYPE_GUESS)
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+use crate::{make_player, scale_image, write_image, ImageSize, OutputFormat};
+use anyhow::{anyhow, Result};
+use drawdance::{
+    engine::{BaseCanvasState, CanvasState, DetachedCanvasState, DrawContext, Image, Player},
+    Interpolation, DP_PLAYER_REPLAY_STEP_NONE, DP_SAVE_IMAGE_ORA, DP_SAVE_IMAGE_PROJECT_CANVAS,
+    DP_SAVE_IMAGE_PSD,
+};
+use std::{
+    collections::HashMap,
+    fs::metadata,
+    io::{stdin, stdout, BufRead, Write},
+    time::{Instant, SystemTime},
+};
+
+// Rect within the flattened canvas to render, given as X,Y,WIDTH,HEIGHT.
+#[derive(Copy, Clone, Debug)]
+struct Crop {
+    x: usize,
+    y: usize,
+    width: usize,
+    height: usize,
+}
+
+impl Crop {
+    fn parse(s: &str) -> Result<Self> {
+        let values: Vec<usize> = s
+            .split(',')
+            .map(|v| v.trim().parse::<usize>())
+            .collect::<Result<_, _>>()
+            .map_err(|_| anyhow!("Invalid crop '{s}', must be given as X,Y,WIDTH,HEIGHT"))?;
+        match values[..] {
+            [x, y, width, height] if width != 0 && height != 0 => Ok(Crop {
+                x,
+                y,
+                width,
+                height,
+            }),
+            _ => Err(anyhow!(
+                "Invalid crop '{s}', must be given as X,Y,WIDTH,HEIGHT"
+            )),
+        }
+    }
+}
+
+struct RenderRequest {
+    in_path: String,
+    out_path: String,
+    format: OutputFormat,
+    crop: Option<Crop>,
+    max_size: Option<ImageSize>,
+    fixed_size: bool,
+    interpolation: Interpolation,
+    recording: bool,
+}
+
+impl RenderRequest {
+    // The id is parsed along the way, so that it can be included in the
+    // response even if the rest of the request turns out to be invalid.
+    fn parse(line: &str) -> (String, Result<Self>) {
+        let mut id = String::new();
+        let result = Self::parse_fields(line, &mut id);
+        (id, result)
+    }
+
+    fn parse_fields(line: &str, id: &mut String) -> Result<Self> {
+        let mut in_path = None;
+        let mut out_path = None;
+        let mut format = OutputFormat::Guess;
+        let mut crop = None;
+        let mut max_size = None;
+        let mut fixed_size = false;
+        let mut interpolation = Interpolation::default();
+        let mut recording = None;
+
+        for field in line.split('\t').filter(|f| !f.is_empty()) {
+            let (key, value) = field
+                .split_once('=')
+                .ok_or_else(|| anyhow!("Field '{field}' is not of the form key=value"))?;
+            match key {
+                "id" => *id = value.to_owned(),
+                "in" => in_path = Some(value.to_owned()),
+                "out" => out_path = Some(value.to_owned()),
+                "format" => format = value.parse().map_err(|e: String| anyhow!(e))?,
+                "crop" => crop = Some(Crop::parse(value)?),
+                "maxsize" => max_size = Some(value.parse().map_err(|e: String| anyhow!(e))?),
+                "fixed" => fixed_size = parse_bool(key, value)?,
+                "interpolation" => interpolation = value.parse().map_err(|e: String| anyhow!(e))?,
+                "recording" => recording = Some(parse_bool(key, value)?),
+                _ => return Err(anyhow!("Unknown field '{key}'")),
+            }
+        }
+
+        let in_path = in_path.ok_or_else(|| anyhow!("Missing in field"))?;
+        let out_path = out_path.ok_or_else(|| anyhow!("Missing out field"))?;
+        // Standard input and output are where the requests and responses go.
+        if in_path == "-" || out_path == "-" {
+            return Err(anyhow!("Can't read from or write to '-' when serving"));
+        }
+
+        if format == OutputFormat::Guess {
+            format = OutputFormat::from_extension(&out_path)
+                .ok_or_else(|| anyhow!("Can't guess output format from '{out_path}'"))?;
+        }
+
+        if (crop.is_some() || max_size.is_some() || fixed_size) && !format.supports_scaling() {
+            return Err(anyhow!(
+                "The dpcs, ora and psd output formats don't support crop, maxsize or fixed"
+            ));
+        }
+
+        let recording = recording.unwrap_or_else(|| is_recording_path(&in_path));
+        Ok(RenderRequest {
+            in_path,
+            out_path,
+            format,
+            crop,
+            max_size,
+            fixed_size,
+            interpolation,
+            recording,
+        })
+    }
+}
+
+fn parse_bool(key: &str, value: &str) -> Result<bool> {
+    match value {
+        "0" | "false" => Ok(false),
+        "1" | "true" => Ok(true),
+        _ => Err(anyhow!("Invalid value '{value}' for {key}, must be 0 or 1")),
+    }
+}
+
+fn is_recording_path(path: &str) -> bool {
+    let lower = path.to_lowercase();
+    lower.ends_with(".dprec") || lower.ends_with(".dptxt")
+}
+
+// A loaded canvas along with what the file looked like when it was loaded, so
+// that changes to it are noticed. The flattened image is kept around too,
+// since most requests are going to be renders of the same canvas at different
+// crops and sizes.
+struct CachedCanvas {
+    modified: SystemTime,
+    len: u64,
+    recording: bool,
+    cs: DetachedCanvasState,
+    flat: Option<Image>,
+    last_used: u64,
+}
+
+struct RenderService {
+    dc: DrawContext,
+    acl_override: bool,
+    cache_size: usize,
+    cache: HashMap<String, CachedCanvas>,
+    counter: u64,
+}
+
+impl RenderService {
+    fn new(cache_size: usize, acl_override: bool) -> Self {
+        RenderService {
+            dc: DrawContext::default(),
+            acl_override,
+            cache_size,
+            cache: HashMap::new(),
+            counter: 0,
+        }
+    }
+
+    fn render(&mut self, req: &RenderRequest) -> Result<()> {
+        self.counter += 1;
+        let counter = self.counter;
+        let meta = metadata(&req.in_path)?;
+        let modified = meta.modified()?;
+        let len = meta.len();
+
+        let fresh = self.cache.get(&req.in_path).map_or(false, |entry| {
+            entry.modified == modified && entry.len == len && entry.recording == req.recording
+        });
+        if !fresh {
+            self.cache.remove(&req.in_path);
+            let cs = self.load(req)?;
+            if self.cache_size == 0 {
+                return render_canvas(&cs, &mut None, &mut self.dc, req);
+            }
+            self.evict();
+            self.cache.insert(
+                req.in_path.clone(),
+                CachedCanvas {
+                    modified,
+                    len,
+                    recording: req.recording,
+                    cs,
+                    flat: None,
+                    last_used: counter,
+                },
+            );
+        }
+
+        let entry = self.cache.get_mut(&req.in_path).unwrap();
+        entry.last_used = counter;
+        render_canvas(&entry.cs, &mut entry.flat, &mut self.dc, req)
+    }
+
+    fn load(&mut self, req: &RenderRequest) -> Result<DetachedCanvasState> {
+        if req.recording {
+            let mut player = make_player(&req.in_path).and_then(Player::check_compatible)?;
+            player.set_acl_override(self.acl_override);
+            let mut last = None;
+            player.replay(&mut self.dc, DP_PLAYER_REPLAY_STEP_NONE, 0, |cs, _last| {
+                last = Some(cs);
+                Ok(())
+            })?;
+            last.ok_or_else(|| anyhow!("Recording didn't produce a canvas"))
+        } else {
+            CanvasState::new_load(&mut self.dc, req.in_path.clone())
+        }
+    }
+
+    fn evict(&mut self) {
+        while self.cache.len() >= self.cache_size {
+            let oldest = self
+                .cache
+                .iter()
+                .min_by_key(|(_, entry)| entry.last_used)
+                .map(|(path, _)| path.clone());
+            match oldest {
+                Some(path) => self.cache.remove(&path),
+                None => break,
+            };
+        }
+    }
+}
+
+fn render_canvas(
+    cs: &CanvasState,
+    flat: &mut Option<Image>,
+    dc: &mut DrawContext,
+    req: &RenderRequest,
+) -> Result<()> {
+    let save_type = match req.format {
+        OutputFormat::Dpcs => Some(DP_SAVE_IMAGE_PROJECT_CANVAS),
+        OutputFormat::Ora => Some(DP_SAVE_IMAGE_ORA),
+        OutputFormat::Psd => Some(DP_SAVE_IMAGE_PSD),
+        _ => None,
+    };
+    if let Some(save_type) = save_type {
+        return cs.save(dc, save_type, req.out_path.clone());
+    }
+
+    if flat.is_none() {
+        *flat = Some(cs.to_flat_image()?);
+    }
+    let img = flat.as_ref().unwrap();
+
+    let cropped = if let Some(Crop {
+        x,
+        y,
+        width,
+        height,
+    }) = req.crop
+    {
+        if x + width > img.width() || y + height > img.height() {
+            return Err(anyhow!(
+                "Crop {x},{y},{width},{height} is outside of the {}x{} canvas",
+                img.width(),
+                img.height()
+            ));
+        }
+        Some(img.cropped(x, y, width, height)?)
+    } else {
+        None
+    };
+    let img = cropped.as_ref().unwrap_or(img);
+
+    match scale_image(img, req.max_size, req.fixed_size, req.interpolation, dc)? {
+        Some(scaled) => write_image(&scaled, req.format, &req.out_path),
+        None => write_image(img, req.format, &req.out_path),
+    }
+}
+
+fn sanitize(s: &str) -> String {
+    s.replace(['\t', '\r', '\n'], " ")
+}
+
+pub fn serve(cache_size: usize, acl_override: bool) -> Result<()> {
+    let mut service = RenderService::new(cache_size, acl_override);
+    let mut out = stdout();
+    for line in stdin().lock().lines() {
+        let line = line?;
+        let line = line.trim_end_matches('\r');
+        if line.is_empty() {
+            continue;
+        }
+
+        let start = Instant::now();
+        let (id, result) = RenderRequest::parse(line);
+        let result = result.and_then(|req| service.render(&req));
+        match result {
+            Ok(()) => writeln!(
+                out,
+                "ok\tid={}\tms={}",
+                sanitize(&id),
+                start.elapsed().as_millis()
+            )?,
+            Err(e) => writeln!(
+                out,
+                "error\tid={}\tmessage={}",
+                sanitize(&id),
+                sanitize(&e.to_string())
+            )?,
+        }
+        out.flush()?;
+    }
+    Ok(())
+}
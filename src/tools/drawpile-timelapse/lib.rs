@@ -3,12 +3,14 @@ use anyhow::{anyhow, Result};
 use drawdance::{
     common::Perf,
     dp_cmake_config_version,
-    engine::{Image, PaintEngine, Player},
+    engine::{
+        BaseCanvasState, CanvasState, DetachedCanvasState, DrawContext, Image, PaintEngine, Player,
+    },
     DP_UPixel8, Interpolation, DP_PLAYER_TYPE_GUESS, DP_PROTOCOL_VERSION,
 };
 use regex::Regex;
 use std::{
-    collections::{HashMap, VecDeque},
+    collections::{BTreeMap, HashMap, VecDeque},
     env::consts::EXE_SUFFIX,
     ffi::{c_char, c_int, CStr, OsStr},
     fmt::Display,
@@ -16,6 +18,12 @@ use std::{
     io::{self, stdout},
     process::{Command, Stdio},
     str::FromStr,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        mpsc::{sync_channel, Receiver, SyncSender},
+        Mutex,
+    },
+    thread,
 };
 
 #[derive(Copy, Clone, Debug)]
@@ -348,6 +356,12 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
         optional -I,--interpolation interpolation: Interpolation
         /// Override background color, in rgb or argb hexadecimal format.
         optional -B,--background background: String
+        /// Number of threads to flatten and scale frames on. Defaults to the
+        /// number of available CPU cores.
+        optional -j,--jobs jobs: usize
+        /// Keep frames that are identical to the one before them. By default,
+        /// they are dropped, since they just make the timelapse stall.
+        optional -K,--keep-identical-frames
         /// Input recording file(s).
         repeated input: String
     };
@@ -487,6 +501,11 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
 
     let acl_override = !flags.acl;
     let reveal_censored = flags.uncensor;
+    let jobs = flags
+        .jobs
+        .unwrap_or_else(|| thread::available_parallelism().map_or(1, |n| n.get()))
+        .max(1);
+    let keep_identical = flags.keep_identical_frames;
 
     if flags.print_only {
         eprintln!();
@@ -514,6 +533,25 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
         if let Some(background_color) = background {
             eprintln!("background override:\n    {:x}", background_color);
         }
+        eprintln!("jobs:\n    {}", jobs);
+        eprintln!("keep identical frames:\n    {}", keep_identical);
+        if !flags.input.is_empty() {
+            match estimate_frame_count(
+                &flags.input,
+                acl_override,
+                interval,
+                framerate,
+                flash,
+                linger_time,
+            ) {
+                Ok(frames) => eprintln!(
+                    "estimated frames:\n    at most {} ({:.1} sec)",
+                    frames,
+                    frames as f64 / f64::from(framerate)
+                ),
+                Err(e) => eprintln!("estimated frames:\n    unknown ({})", e),
+            }
+        }
         if let Some(command) = opt_command {
             eprintln!(
                 "ffmpeg command line:\n    {} {}",
@@ -552,6 +590,8 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
             &flags.crop,
             interpolation,
             background,
+            jobs,
+            keep_identical,
         )
     } else if flags.out == "-" {
         timelapse(
@@ -568,6 +608,8 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
             &flags.crop,
             interpolation,
             background,
+            jobs,
+            keep_identical,
         )
     } else {
         make_timelapse_raw(
@@ -584,6 +626,8 @@ pub extern "C" fn drawpile_timelapse_main(default_logo_path: *const c_char) -> c
             &flags.crop,
             interpolation,
             background,
+            jobs,
+            keep_identical,
         )
     };
 
@@ -610,6 +654,8 @@ fn make_timelapse_command(
     crop: &Option<Crop>,
     interpolation: Interpolation,
     background: Option<u32>,
+    jobs: usize,
+    keep_identical: bool,
 ) -> Result<()> {
     let mut child = match command.spawn() {
         Ok(c) => c,
@@ -639,6 +685,8 @@ fn make_timelapse_command(
         crop,
         interpolation,
         background,
+        jobs,
+        keep_identical,
     )?;
     drop(pipe);
     let status = child.wait()?;
@@ -663,6 +711,8 @@ fn make_timelapse_raw(
     crop: &Option<Crop>,
     interpolation: Interpolation,
     background: Option<u32>,
+    jobs: usize,
+    keep_identical: bool,
 ) -> Result<()> {
     let mut f = File::create(path)?;
     timelapse(
@@ -679,12 +729,14 @@ fn make_timelapse_raw(
         crop,
         interpolation,
         background,
+        jobs,
+        keep_identical,
     )?;
     Ok(())
 }
 
 struct TimelapseContext<'a> {
-    writer: &'a mut dyn io::Write,
+    writer: &'a mut (dyn io::Write + Send),
     images: VecDeque<Image>,
 }
 
@@ -703,7 +755,7 @@ impl<'a> TimelapseContext<'a> {
 }
 
 fn timelapse(
-    writer: &mut dyn io::Write,
+    writer: &mut (dyn io::Write + Send),
     input_paths: &Vec<String>,
     framerate: i32,
     acl_override: bool,
@@ -716,55 +768,95 @@ fn timelapse(
     crop: &Option<Crop>,
     interpolation: Interpolation,
     background: Option<u32>,
+    jobs: usize,
+    keep_identical: bool,
 ) -> Result<()> {
-    let mut ctx = TimelapseContext {
-        writer,
-        images: VecDeque::new(),
-    };
-
-    for input_path in input_paths {
-        timelapse_recording(
-            &mut ctx,
-            input_path,
-            acl_override,
-            reveal_censored,
-            interval,
-            width,
-            height,
-            crop,
-            interpolation,
-            background,
-        )?;
-    }
-
-    if !ctx.images.is_empty() {
-        let fr = f64::from(framerate);
-        let img1 = &ctx.images.front().unwrap();
-        let img2 = &ctx.images.back().unwrap();
-
-        if let Some(color) = flash {
-            render_flash(ctx.writer, img1, img2, fr, color)?;
-        } else {
-            img1.dump(ctx.writer)?;
+    // Playback has to happen in order, but flattening and scaling the frames
+    // doesn't, so the playback only grabs canvas states and hands them off to
+    // the workers. A separate thread puts the finished frames back in order
+    // and feeds them to the output. The channels are bounded so that a slow
+    // encoder doesn't pile up unlimited frames in memory.
+    let jobs = jobs.max(1);
+    let (frame_sender, frame_receiver) = sync_channel::<(usize, DetachedCanvasState)>(jobs);
+    let (image_sender, image_receiver) = sync_channel::<(usize, Result<Image>)>(jobs);
+    let frame_receiver = Mutex::new(frame_receiver);
+    let failed = AtomicBool::new(false);
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..jobs)
+            .map(|_| {
+                let frame_receiver = &frame_receiver;
+                let image_sender = image_sender.clone();
+                scope.spawn(move || {
+                    scale_frames(
+                        frame_receiver,
+                        image_sender,
+                        width,
+                        height,
+                        crop,
+                        interpolation,
+                    )
+                })
+            })
+            .collect();
+        drop(image_sender);
+
+        let failed = &failed;
+        let output = scope.spawn(move || {
+            let result = write_frames(
+                writer,
+                image_receiver,
+                framerate,
+                flash,
+                linger_time,
+                keep_identical,
+            );
+            if result.is_err() {
+                failed.store(true, Ordering::Relaxed);
+            }
+            result
+        });
+
+        let mut seq = 0;
+        let mut playback_result = Ok(());
+        for input_path in input_paths {
+            playback_result = timelapse_recording(
+                &frame_sender,
+                failed,
+                &mut seq,
+                input_path,
+                acl_override,
+                reveal_censored,
+                interval,
+                crop,
+                background,
+                keep_identical,
+            );
+            if playback_result.is_err() {
+                break;
+            }
         }
-        render_linger(ctx.writer, img2, fr, linger_time)?;
-    }
+        drop(frame_sender);
 
-    ctx.writer.flush()?;
-    Ok(())
+        for worker in workers {
+            worker.join().unwrap();
+        }
+        // If writing failed, the playback only stopped because of that, so
+        // the write error is the more useful one to report.
+        output.join().unwrap().and(playback_result)
+    })
 }
 
 fn timelapse_recording(
-    ctx: &mut TimelapseContext,
+    sender: &SyncSender<(usize, DetachedCanvasState)>,
+    failed: &AtomicBool,
+    seq: &mut usize,
     input_path: &String,
     acl_override: bool,
     reveal_censored: bool,
     interval: i64,
-    width: usize,
-    height: usize,
     crop: &Option<Crop>,
-    interpolation: Interpolation,
     background: Option<u32>,
+    keep_identical: bool,
 ) -> Result<()> {
     let mut player = make_player(input_path).and_then(Player::check_compatible)?;
     player.set_acl_override(acl_override);
@@ -778,22 +870,38 @@ fn timelapse_recording(
 
     let mut initial = true;
     let mut last_area: Option<CropArea> = None;
+    let mut last_cs: Option<DetachedCanvasState> = None;
     loop {
         let pos = if initial {
             pe.skip_playback(1)
         } else {
             pe.play_playback_timelapse(interval, last_area.map(|a| a.as_tuple()))
         }?;
-
-        pe.render();
-        match to_image(&mut pe, width, height, crop, interpolation) {
-            Ok((mut img, area)) => {
-                img.add_background(pe.effective_background_color());
-                last_area = area;
-                ctx.push(img)?;
-                initial = false;
+        initial = false;
+
+        pe.sync();
+        if let Some(cs) = pe.view_canvas_state() {
+            last_area = crop
+                .as_ref()
+                .map(|c| *c.get_area(cs.width() as usize, cs.height() as usize));
+
+            // Canvas states are immutable, so getting the same one again means
+            // nothing visible happened since the last frame.
+            let identical = !keep_identical
+                && last_cs
+                    .as_ref()
+                    .map_or(false, |prev| prev.persistent_ptr() == cs.persistent_ptr());
+            if !identical {
+                if failed.load(Ordering::Relaxed) {
+                    return Err(anyhow!("Writing frames failed"));
+                }
+                let frame = CanvasState::new_detached_inc(unsafe { &mut *cs.persistent_ptr() });
+                sender
+                    .send((*seq, frame))
+                    .map_err(|_| anyhow!("Writing frames failed"))?;
+                *seq += 1;
+                last_cs = Some(cs);
             }
-            Err(e) => eprintln!("Warning: {}", e),
         }
 
         if pos == -1 {
@@ -802,34 +910,103 @@ fn timelapse_recording(
     }
 }
 
+fn scale_frames(
+    receiver: &Mutex<Receiver<(usize, DetachedCanvasState)>>,
+    sender: SyncSender<(usize, Result<Image>)>,
+    width: usize,
+    height: usize,
+    crop: &Option<Crop>,
+    interpolation: Interpolation,
+) {
+    let mut dc = DrawContext::default();
+    loop {
+        let received = receiver.lock().unwrap().recv();
+        match received {
+            Ok((seq, cs)) => {
+                let result = to_image(&cs, &mut dc, width, height, crop, interpolation);
+                // If the writer bailed, keep taking frames off the queue
+                // anyway so that the playback doesn't get stuck sending them.
+                let _ = sender.send((seq, result));
+            }
+            Err(_) => return, // Playback is done.
+        }
+    }
+}
+
 fn to_image(
-    pe: &mut PaintEngine,
+    cs: &CanvasState,
+    dc: &mut DrawContext,
     width: usize,
     height: usize,
     crop: &Option<Crop>,
     interpolation: Interpolation,
-) -> Result<(Image, Option<CropArea>)> {
+) -> Result<Image> {
+    let mut img = Image::new_from_canvas_state(cs.persistent_ptr())?;
     if let Some(ref c) = crop {
-        let area = c.get_area(pe.render_width(), pe.render_height());
-        Ok((
-            pe.to_scaled_image_crop(
-                width,
-                height,
-                true,
-                area.x,
-                area.y,
-                area.width,
-                area.height,
-                interpolation.to_scale_interpolation(),
-            )?,
-            Some(*area),
-        ))
-    } else {
-        Ok((
-            pe.to_scaled_image(width, height, true, interpolation.to_scale_interpolation())?,
-            None,
-        ))
+        let area = c.get_area(img.width(), img.height());
+        img = img.cropped(area.x, area.y, area.width, area.height)?;
     }
+    img.scaled(
+        width,
+        height,
+        true,
+        interpolation.to_scale_interpolation(),
+        dc,
+    )
+}
+
+fn write_frames(
+    writer: &mut (dyn io::Write + Send),
+    receiver: Receiver<(usize, Result<Image>)>,
+    framerate: i32,
+    flash: Option<u32>,
+    linger_time: f64,
+    keep_identical: bool,
+) -> Result<()> {
+    let mut ctx = TimelapseContext {
+        writer,
+        images: VecDeque::new(),
+    };
+
+    // Workers finish their frames in whatever order, so the ones that arrive
+    // early wait here until everything before them is written.
+    let mut pending = BTreeMap::<usize, Result<Image>>::new();
+    let mut next_seq = 0;
+    for (seq, result) in receiver {
+        pending.insert(seq, result);
+        while let Some(result) = pending.remove(&next_seq) {
+            next_seq += 1;
+            match result {
+                Ok(img) => {
+                    let identical = !keep_identical
+                        && ctx
+                            .images
+                            .back()
+                            .map_or(false, |prev| prev.pixels() == img.pixels());
+                    if !identical {
+                        ctx.push(img)?;
+                    }
+                }
+                Err(e) => eprintln!("Warning: {}", e),
+            }
+        }
+    }
+
+    if !ctx.images.is_empty() {
+        let fr = f64::from(framerate);
+        let img1 = &ctx.images.front().unwrap();
+        let img2 = &ctx.images.back().unwrap();
+
+        if let Some(color) = flash {
+            render_flash(ctx.writer, img1, img2, fr, color)?;
+        } else {
+            img1.dump(ctx.writer)?;
+        }
+        render_linger(ctx.writer, img2, fr, linger_time)?;
+    }
+
+    ctx.writer.flush()?;
+    Ok(())
 }
 
 fn make_player(input_path: &String) -> Result<Player> {
@@ -874,3 +1051,47 @@ fn render_linger(writer: &mut dyn io::Write, img: &Image, fr: f64, linger_time:
     }
     Ok(())
 }
+
+// Playback with a crop only counts time spent inside of the cropped area and
+// identical frames get dropped, so this is an upper bound on the frame count.
+fn estimate_frame_count(
+    input_paths: &Vec<String>,
+    acl_override: bool,
+    interval: i64,
+    framerate: i32,
+    flash: Option<u32>,
+    linger_time: f64,
+) -> Result<i64> {
+    let mut frames = 0;
+    for input_path in input_paths {
+        let mut player = make_player(input_path).and_then(Player::check_compatible)?;
+        player.set_acl_override(acl_override);
+        // The initial frame, one per interval and the one at the very end.
+        frames += 2 + player.guess_timelapse_msecs()? / interval;
+    }
+
+    // The final two frames aren't output directly, they get turned into the
+    // flash and the lingering at the end instead.
+    frames -= 2;
+    let fr = f64::from(framerate);
+    if flash.is_some() {
+        let mut opa = 0.0_f64;
+        while opa < 255.0_f64 {
+            opa = 255.0_f64.min(opa + 2400.0_f64 / fr);
+            frames += 1;
+        }
+        while opa > 0.0_f64 {
+            opa = 0.0_f64.max(opa - 360.0_f64 / fr);
+            frames += 1;
+        }
+    } else {
+        frames += 1;
+    }
+
+    let mut lingered = 0.0;
+    while lingered <= linger_time {
+        lingered += 1.0_f64 / fr;
+        frames += 1;
+    }
+    Ok(frames)
+}